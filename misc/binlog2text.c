@@ -0,0 +1,265 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * binlog2text converts access logs written with a "binary" log_format
+ * back to text, one line per record, fields separated by spaces:
+ *
+ *     cc -o binlog2text misc/binlog2text.c
+ *     binlog2text access.bin [...]
+ *
+ * times are printed as seconds since the epoch with milliseconds,
+ * durations as seconds with milliseconds, missing values as "-".
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+
+#define BINLOG_MAGIC    0x4e
+#define BINLOG_VERSION  1
+#define BINLOG_HEADER   6
+
+#define BINLOG_NONE     0
+#define BINLOG_UINT     1
+#define BINLOG_TIME     2
+#define BINLOG_MSEC     3
+#define BINLOG_ADDR     4
+#define BINLOG_STRING   5
+
+
+static uint64_t
+binlog_uint(const unsigned char *p)
+{
+    int       i;
+    uint64_t  n;
+
+    n = 0;
+
+    for (i = 0; i < 8; i++) {
+        n = (n << 8) | p[i];
+    }
+
+    return n;
+}
+
+
+static void
+binlog_string(const unsigned char *p, size_t len)
+{
+    while (len--) {
+        if (*p < 0x20 || *p >= 0x7f || *p == '"' || *p == '\\') {
+            printf("\\x%02X", *p);
+
+        } else {
+            putchar(*p);
+        }
+
+        p++;
+    }
+}
+
+
+static int
+binlog_record(const unsigned char *p, size_t len)
+{
+    char                  addr[INET6_ADDRSTRLEN];
+    size_t                n;
+    uint64_t              v;
+    const unsigned char  *last;
+
+    last = p + len;
+
+    while (p < last) {
+
+        switch (*p++) {
+
+        case BINLOG_NONE:
+            putchar('-');
+            break;
+
+        case BINLOG_UINT:
+        case BINLOG_TIME:
+        case BINLOG_MSEC:
+            if (last - p < 8) {
+                return -1;
+            }
+
+            v = binlog_uint(p);
+
+            if (p[-1] == BINLOG_UINT) {
+                printf("%llu", (unsigned long long) v);
+
+            } else {
+                printf("%llu.%03u", (unsigned long long) (v / 1000),
+                       (unsigned) (v % 1000));
+            }
+
+            p += 8;
+            break;
+
+        case BINLOG_ADDR:
+            if (p == last) {
+                return -1;
+            }
+
+            n = *p++;
+
+            if ((size_t) (last - p) < n || (n != 4 && n != 16)) {
+                return -1;
+            }
+
+            if (inet_ntop(n == 4 ? AF_INET : AF_INET6, p, addr, sizeof(addr))
+                == NULL)
+            {
+                return -1;
+            }
+
+            fputs(addr, stdout);
+
+            p += n;
+            break;
+
+        case BINLOG_STRING:
+            if (last - p < 2) {
+                return -1;
+            }
+
+            n = (p[0] << 8) | p[1];
+            p += 2;
+
+            if ((size_t) (last - p) < n) {
+                return -1;
+            }
+
+            binlog_string(p, n);
+
+            p += n;
+            break;
+
+        default:
+            return -1;
+        }
+
+        putchar(p < last ? ' ' : '\n');
+    }
+
+    return 0;
+}
+
+
+static int
+binlog_file(FILE *fp, const char *name)
+{
+    size_t          len, size;
+    unsigned char   header[BINLOG_HEADER], *buf;
+    unsigned long   nrec;
+
+    buf = NULL;
+    size = 0;
+    nrec = 0;
+
+    for ( ;; ) {
+        len = fread(header, 1, BINLOG_HEADER, fp);
+
+        if (len == 0) {
+            break;
+        }
+
+        if (len != BINLOG_HEADER
+            || header[0] != BINLOG_MAGIC
+            || header[1] != BINLOG_VERSION)
+        {
+            fprintf(stderr, "%s: invalid record header at record %lu\n",
+                    name, nrec);
+            goto failed;
+        }
+
+        len = ((size_t) header[2] << 24) | (header[3] << 16)
+              | (header[4] << 8) | header[5];
+
+        if (len > size) {
+            free(buf);
+
+            size = len;
+
+            buf = malloc(size);
+            if (buf == NULL) {
+                fprintf(stderr, "%s: out of memory\n", name);
+                return -1;
+            }
+        }
+
+        if (fread(buf, 1, len, fp) != len) {
+            fprintf(stderr, "%s: truncated record %lu\n", name, nrec);
+            goto failed;
+        }
+
+        if (len == 0) {
+            putchar('\n');
+
+        } else if (binlog_record(buf, len) != 0) {
+            fprintf(stderr, "%s: invalid record %lu\n", name, nrec);
+            goto failed;
+        }
+
+        nrec++;
+    }
+
+    free(buf);
+
+    return 0;
+
+failed:
+
+    free(buf);
+
+    return -1;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int    i, rc;
+    FILE  *fp;
+
+    if (argc < 2) {
+        return binlog_file(stdin, "stdin") == 0 ? 0 : 1;
+    }
+
+    rc = 0;
+
+    for (i = 1; i < argc; i++) {
+
+        if (strcmp(argv[i], "-") == 0) {
+            if (binlog_file(stdin, "stdin") != 0) {
+                rc = 1;
+            }
+
+            continue;
+        }
+
+        fp = fopen(argv[i], "rb");
+        if (fp == NULL) {
+            perror(argv[i]);
+            rc = 1;
+            continue;
+        }
+
+        if (binlog_file(fp, argv[i]) != 0) {
+            rc = 1;
+        }
+
+        fclose(fp);
+    }
+
+    return rc;
+}
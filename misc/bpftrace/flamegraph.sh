@@ -0,0 +1,44 @@
+#!/bin/sh
+
+# Builds a flamegraph of nginx workers' CPU time per request phase:
+#
+#     misc/bpftrace/flamegraph.sh /usr/local/nginx/sbin/nginx 30 > phases.svg
+#
+# nginx has to be built with --with-usdt, and preferably with frame
+# pointers (--with-cc-opt=-fno-omit-frame-pointer).  flamegraph.pl from
+# https://github.com/brendangregg/FlameGraph is looked for in $FLAMEGRAPH
+# or in $PATH.
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 /path/to/nginx [seconds]" >&2
+    exit 1
+fi
+
+bin=$1
+seconds=${2:-10}
+dir=`dirname $0`
+fg=${FLAMEGRAPH:+$FLAMEGRAPH/}flamegraph.pl
+
+echo "sampling for $seconds seconds" >&2
+
+# the phase name becomes the root frame, stacks are printed leaf first
+
+timeout -s INT $seconds bpftrace $dir/phase-stacks.bt $bin 2>/dev/null \
+| awk '
+    /^@stacks\[/ {
+        sub(/^@stacks\[/, ""); sub(/, *$/, "");
+        phase = $0; n = 0; next
+    }
+    /^\]: [0-9]+$/ {
+        line = phase
+        for (i = n; i > 0; i--) line = line ";" frame[i]
+        print line, $2
+        phase = ""; next
+    }
+    phase != "" && NF {
+        f = $1; sub(/\+[0-9]+$/, "", f); frame[++n] = f
+    }
+' \
+| $fg --title "nginx request phases" --countname samples
@@ -0,0 +1,218 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * connbench measures the cost of dispatching events to connections
+ * spread over a large connections array, as after a long uptime, with
+ * the "split" and "packed" values of the "connection_layout" directive;
+ * run it from a configured source tree:
+ *
+ *     cc -O2 -I src/core -I src/event -I src/os/unix -I objs \
+ *         -o connbench misc/connbench.c
+ *
+ *     connbench [connections [active [events]]]
+ *
+ * the defaults are 1000000 connections, 100000 of them active, and
+ * 10000000 events; the output is the average cost of an event in ns.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+static uint64_t  bench_seed = 88172645463325252ULL;
+static off_t     bench_sum;
+
+
+static double
+bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static ngx_uint_t
+bench_random(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+
+    return (ngx_uint_t) bench_seed;
+}
+
+
+static void
+bench_handler(ngx_event_t *ev)
+{
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    /* a handler looks at the connection and its other event */
+
+    if (ev->write) {
+        bench_sum += c->read->ready;
+
+    } else {
+        bench_sum += c->write->active;
+    }
+
+    c->sent += ev->ready;
+    ev->ready = 0;
+
+    bench_sum += c->fd;
+}
+
+
+static ngx_connection_t *
+bench_connections(ngx_uint_t n, ngx_uint_t packed, size_t *size)
+{
+    u_char            *p;
+    ngx_uint_t         i;
+    ngx_event_t       *rev, *wev;
+    ngx_connection_t  *c, *cs;
+
+    /* the same layouts as ngx_event_process_init() uses */
+
+    if (packed) {
+        *size = ngx_align(sizeof(ngx_connection_t) + 2 * sizeof(ngx_event_t),
+                          NGX_CPU_CACHE_LINE);
+
+        if (posix_memalign((void **) &p, NGX_CPU_CACHE_LINE, *size * n) != 0) {
+            return NULL;
+        }
+
+        cs = (ngx_connection_t *) p;
+
+        for (i = 0; i < n; i++) {
+            c = (ngx_connection_t *) (p + i * *size);
+            c->read = (ngx_event_t *) (c + 1);
+            c->write = c->read + 1;
+        }
+
+    } else {
+        *size = sizeof(ngx_connection_t);
+
+        cs = malloc(sizeof(ngx_connection_t) * n);
+        rev = malloc(sizeof(ngx_event_t) * n);
+        wev = malloc(sizeof(ngx_event_t) * n);
+
+        if (cs == NULL || rev == NULL || wev == NULL) {
+            return NULL;
+        }
+
+        for (i = 0; i < n; i++) {
+            cs[i].read = &rev[i];
+            cs[i].write = &wev[i];
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        c = (ngx_connection_t *) ((u_char *) cs + i * *size);
+
+        rev = c->read;
+        wev = c->write;
+
+        ngx_memzero(c, sizeof(ngx_connection_t));
+        ngx_memzero(rev, sizeof(ngx_event_t));
+        ngx_memzero(wev, sizeof(ngx_event_t));
+
+        c->read = rev;
+        c->write = wev;
+        c->fd = (ngx_socket_t) i;
+
+        rev->data = c;
+        rev->handler = bench_handler;
+        rev->instance = 1;
+        rev->active = 1;
+
+        wev->data = c;
+        wev->handler = bench_handler;
+        wev->instance = 1;
+        wev->write = 1;
+    }
+
+    return cs;
+}
+
+
+static void
+bench_run(const char *name, ngx_uint_t packed, ngx_uint_t n,
+    ngx_uint_t active, ngx_uint_t events)
+{
+    size_t             size;
+    double             start;
+    uintptr_t          ptr, *ptrs;
+    ngx_uint_t         i, k;
+    ngx_event_t       *ev;
+    ngx_connection_t  *c, *cs;
+
+    cs = bench_connections(n, packed, &size);
+    ptrs = malloc(sizeof(uintptr_t) * active);
+
+    if (cs == NULL || ptrs == NULL) {
+        fprintf(stderr, "%s: cannot allocate %lu connections\n",
+                name, (unsigned long) n);
+        exit(1);
+    }
+
+    /* the event data of active connections, as ngx_epoll_add_event() */
+
+    for (i = 0; i < active; i++) {
+        c = (ngx_connection_t *) ((u_char *) cs + (bench_random() % n) * size);
+        ptrs[i] = (uintptr_t) c | c->read->instance;
+    }
+
+    start = bench_now();
+
+    for (k = 0; k < events; k++) {
+
+        /* as ngx_epoll_process_events() does */
+
+        ptr = ptrs[bench_random() % active];
+
+        c = (ngx_connection_t *) (ptr & ~1);
+        ev = (k & 1) ? c->write : c->read;
+
+        if (c->fd == -1 || ev->instance != (ptr & 1)) {
+            continue;
+        }
+
+        ev->ready = 1;
+        ev->handler(ev);
+    }
+
+    printf("%-10s %8.1f ns/event\n", name,
+           (bench_now() - start) * 1e9 / events);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    ngx_uint_t  n, active, events;
+
+    n = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 1000000;
+    active = (argc > 2) ? (ngx_uint_t) atol(argv[2]) : 100000;
+    events = (argc > 3) ? (ngx_uint_t) atol(argv[3]) : 10000000;
+
+    if (n == 0 || active == 0 || active > n) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    bench_run("split", 0, n, active, events);
+    bench_run("packed", 1, n, active, events);
+
+    return bench_sum == 0;
+}
@@ -0,0 +1,1126 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * corebench measures core data structures and parsers as they are
+ * built for the server, on fixed inputs; it is linked against
+ * the objects of a configured and built tree with
+ *
+ *     make bench
+ *
+ * or run as
+ *
+ *     objs/corebench [scale [filter]]
+ *
+ * the scale multiplies the default number of iterations, the filter
+ * limits the run to the benchmarks with the given name prefix; each
+ * benchmark prints a tab separated line with its name, the number of
+ * operations, and the cost of an operation in ns, so that the outputs
+ * of two builds may be compared by name.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <ngx_md5.h>
+
+
+#define BENCH_ADDRS       4096
+#define BENCH_NODES       8192
+#define BENCH_SLABS       1024
+#define BENCH_TIMERS      1000000
+#define BENCH_NAMES       10000
+
+
+typedef struct {
+    char         *name;
+    ngx_uint_t    ops;
+    ngx_uint_t  (*handler)(ngx_uint_t n);
+} bench_t;
+
+
+static ngx_uint_t bench_palloc(ngx_uint_t n);
+static ngx_uint_t bench_pool_cycle(ngx_uint_t n);
+static ngx_uint_t bench_pool_cycle_cached(ngx_uint_t n);
+static ngx_uint_t bench_hash_find(ngx_uint_t n);
+static ngx_uint_t bench_hash_find_10k(ngx_uint_t n);
+static ngx_uint_t bench_hash_wc_head(ngx_uint_t n);
+static ngx_uint_t bench_hash_wc_head_trie(ngx_uint_t n);
+static ngx_uint_t bench_radix_find(ngx_uint_t n);
+static ngx_uint_t bench_poptrie_find(ngx_uint_t n);
+static ngx_uint_t bench_rbtree(ngx_uint_t n);
+static ngx_uint_t bench_slab(ngx_uint_t n);
+static ngx_uint_t bench_timer_rbtree(ngx_uint_t n);
+static ngx_uint_t bench_timer_wheel(ngx_uint_t n);
+static ngx_uint_t bench_crc32_short(ngx_uint_t n);
+static ngx_uint_t bench_crc32_long(ngx_uint_t n);
+static ngx_uint_t bench_md5(ngx_uint_t n);
+static ngx_uint_t bench_murmurhash(ngx_uint_t n);
+static ngx_uint_t bench_base64_encode(ngx_uint_t n);
+static ngx_uint_t bench_base64_decode(ngx_uint_t n);
+static ngx_uint_t bench_request_line(ngx_uint_t n);
+static ngx_uint_t bench_request_line_long(ngx_uint_t n);
+static ngx_uint_t bench_header_lines(ngx_uint_t n);
+#if (NGX_HTTP_V2)
+static ngx_uint_t bench_huff_decode(ngx_uint_t n);
+#endif
+static ngx_uint_t bench_parse_request_line(ngx_uint_t n, u_char *line,
+    size_t len);
+
+
+static bench_t  benchs[] = {
+    { "palloc", 10000000, bench_palloc },
+    { "pool_cycle", 1000000, bench_pool_cycle },
+    { "pool_cycle_cached", 1000000, bench_pool_cycle_cached },
+    { "hash_find", 10000000, bench_hash_find },
+    { "hash_find_10k", 10000000, bench_hash_find_10k },
+    { "hash_wc_head_10k", 5000000, bench_hash_wc_head },
+    { "hash_wc_head_10k_trie", 5000000, bench_hash_wc_head_trie },
+    { "radix32_find", 10000000, bench_radix_find },
+    { "poptrie32_find", 10000000, bench_poptrie_find },
+    { "rbtree_insert_delete", 2000000, bench_rbtree },
+    { "slab_alloc_free", 5000000, bench_slab },
+    { "timer_rbtree", 100000, bench_timer_rbtree },
+    { "timer_wheel", 100000, bench_timer_wheel },
+    { "crc32_short_32", 5000000, bench_crc32_short },
+    { "crc32_long_4k", 200000, bench_crc32_long },
+    { "md5_4k", 100000, bench_md5 },
+    { "murmurhash2_32", 20000000, bench_murmurhash },
+    { "base64_encode_1k", 1000000, bench_base64_encode },
+    { "base64_decode_1k", 1000000, bench_base64_decode },
+    { "http_request_line", 5000000, bench_request_line },
+    { "http_request_line_long", 2000000, bench_request_line_long },
+    { "http_header_lines", 1000000, bench_header_lines },
+#if (NGX_HTTP_V2)
+    { "hpack_huff_decode_1k", 500000, bench_huff_decode },
+#endif
+    { NULL, 0, NULL }
+};
+
+
+/* the header names of a typical browser request and response */
+
+static char  *bench_names[] = {
+    "host", "connection", "cache-control", "upgrade-insecure-requests",
+    "user-agent", "accept", "sec-fetch-site", "sec-fetch-mode",
+    "sec-fetch-user", "sec-fetch-dest", "referer", "accept-encoding",
+    "accept-language", "cookie", "if-modified-since", "if-none-match",
+    "range", "if-range", "content-length", "content-type",
+    "transfer-encoding", "te", "expect", "authorization", "keep-alive",
+    "x-forwarded-for", "x-real-ip", "via", "date", "server", "etag",
+    "last-modified", "location", "vary", "expires", "set-cookie",
+    NULL
+};
+
+
+static u_char  bench_request[] =
+    "GET /static/js/app.min.js?v=1.24.0&lang=en HTTP/1.1\r\n";
+
+static u_char  bench_request_long[] =
+    "GET /api/v2/catalog/products/electronics/computers/laptops/"
+        "ultrabook-14-inch-2023-edition/reviews/verified"
+        "?sort=most_recent&page=3&per_page=50&lang=en-US&currency=USD"
+        "&utm_source=newsletter&utm_medium=email&utm_campaign=autumn_sale"
+        "&session_token=8f14e45fceea167a5a36dedd4bea2543b7b1c4d7e0a6f3c2"
+        " HTTP/1.1\r\n";
+
+static u_char  bench_headers[] =
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+        "(KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: */*\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Referer: https://www.example.com/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Cookie: session=4f1c2a9e8b7d6c5f; theme=dark; _ga=GA1.2.1234567.89\r\n"
+    "If-None-Match: \"65a1b2c3-1f4a\"\r\n"
+    "\r\n";
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+volatile ngx_msec_t    ngx_current_msec;
+ngx_uint_t             ngx_process;
+ngx_uint_t             ngx_event_loop_timing;
+#if (NGX_THREADS)
+pthread_t              ngx_main_thread;
+#endif
+
+static uint64_t        bench_seed;
+static ngx_uint_t      bench_sum;
+static ngx_log_t       bench_log;
+static ngx_cycle_t     bench_cycle;
+static u_char          bench_data[4096];
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void
+ngx_debug_point(void)
+{
+}
+
+
+void
+ngx_event_loop_call(ngx_event_t *ev)
+{
+    ev->handler(ev);
+}
+
+
+void
+ngx_shmtx_lock(ngx_shmtx_t *mtx)
+{
+}
+
+
+void
+ngx_shmtx_unlock(ngx_shmtx_t *mtx)
+{
+}
+
+
+static double
+bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static ngx_uint_t
+bench_random(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+
+    return (ngx_uint_t) bench_seed;
+}
+
+
+static ngx_pool_t *
+bench_pool(void)
+{
+    ngx_pool_t  *pool;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &bench_log);
+    if (pool == NULL) {
+        fprintf(stderr, "cannot create pool\n");
+        exit(1);
+    }
+
+    return pool;
+}
+
+
+static ngx_uint_t
+bench_palloc(ngx_uint_t n)
+{
+    u_char      *p;
+    ngx_uint_t   i;
+    ngx_pool_t  *pool;
+
+    /* a request pool: small allocations of various sizes */
+
+    pool = NULL;
+
+    for (i = 0; i < n; i++) {
+
+        if (i % 256 == 0) {
+            if (pool) {
+                ngx_destroy_pool(pool);
+            }
+
+            pool = bench_pool();
+        }
+
+        p = ngx_palloc(pool, 8 + (i & 0x7f));
+        bench_sum += (uintptr_t) p;
+    }
+
+    ngx_destroy_pool(pool);
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_pool_requests(ngx_uint_t n, size_t cache)
+{
+    u_char      *p;
+    ngx_uint_t   i, k;
+    ngx_pool_t  *pool;
+
+    ngx_pool_cache_init(cache);
+
+    /*
+     * the life of a request pool: it grows by a few blocks
+     * and gets a large allocation, e.g. for a buffer
+     */
+
+    for (i = 0; i < n; i++) {
+        pool = bench_pool();
+
+        for (k = 0; k < 64; k++) {
+            p = ngx_palloc(pool, 256 + (k & 0x7f));
+            bench_sum += (uintptr_t) p;
+        }
+
+        p = ngx_palloc(pool, 8192);
+        bench_sum += (uintptr_t) p;
+
+        ngx_destroy_pool(pool);
+    }
+
+    ngx_pool_cache_done(&bench_log);
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_pool_cycle(ngx_uint_t n)
+{
+    return bench_pool_requests(n, 0);
+}
+
+
+static ngx_uint_t
+bench_pool_cycle_cached(ngx_uint_t n)
+{
+    /* as with "worker_pool_cache 1m" */
+
+    return bench_pool_requests(n, 1024 * 1024);
+}
+
+
+static ngx_uint_t
+bench_hash_find(ngx_uint_t n)
+{
+    ngx_str_t        *names;
+    ngx_uint_t        i, k, nnames;
+    ngx_hash_t        hash;
+    ngx_pool_t       *pool;
+    ngx_hash_key_t   *keys;
+    ngx_hash_init_t   hinit;
+
+    pool = bench_pool();
+
+    for (nnames = 0; bench_names[nnames]; nnames++) { /* void */ }
+
+    names = ngx_palloc(pool, nnames * sizeof(ngx_str_t));
+    keys = ngx_palloc(pool, nnames * sizeof(ngx_hash_key_t));
+    if (names == NULL || keys == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < nnames; i++) {
+        names[i].len = ngx_strlen(bench_names[i]);
+        names[i].data = (u_char *) bench_names[i];
+
+        keys[i].key = names[i];
+        keys[i].key_hash = ngx_hash_key(names[i].data, names[i].len);
+        keys[i].value = &names[i];
+    }
+
+    /* the sizes of the headers_in hash */
+
+    hinit.hash = &hash;
+    hinit.key = ngx_hash_key;
+    hinit.max_size = 512;
+    hinit.bucket_size = ngx_align(64, ngx_cacheline_size);
+    hinit.name = "bench_hash";
+    hinit.pool = pool;
+    hinit.temp_pool = NULL;
+
+    if (ngx_hash_init(&hinit, keys, nnames) != NGX_OK) {
+        return 0;
+    }
+
+    /* the key is calculated as the parser does, the lookup is measured */
+
+    for (i = 0; i < n; i++) {
+        k = i % nnames;
+        bench_sum += (uintptr_t) ngx_hash_find(&hash, keys[k].key_hash,
+                                               names[k].data, names[k].len);
+    }
+
+    ngx_destroy_pool(pool);
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_hash_find_10k(ngx_uint_t n)
+{
+    u_char           *p;
+    ngx_str_t        *names;
+    ngx_uint_t        i, k;
+    ngx_hash_t        hash;
+    ngx_pool_t       *pool;
+    ngx_hash_key_t   *keys;
+    ngx_hash_init_t   hinit;
+
+    pool = bench_pool();
+
+    names = ngx_palloc(pool, 2 * BENCH_NAMES * sizeof(ngx_str_t));
+    keys = ngx_palloc(pool, BENCH_NAMES * sizeof(ngx_hash_key_t));
+    p = ngx_pnalloc(pool, 2 * BENCH_NAMES * 32);
+    if (names == NULL || keys == NULL || p == NULL) {
+        return 0;
+    }
+
+    /* server names of virtual hosts, and as many unknown ones */
+
+    for (i = 0; i < 2 * BENCH_NAMES; i++) {
+        names[i].data = p;
+        names[i].len = ngx_sprintf(p, "www.site%ui.example%ui.com",
+                                   i, i % 97)
+                       - p;
+        p += 32;
+    }
+
+    for (i = 0; i < BENCH_NAMES; i++) {
+        keys[i].key = names[i];
+        keys[i].key_hash = ngx_hash_key(names[i].data, names[i].len);
+        keys[i].value = &names[i];
+    }
+
+    /* the default server_names_hash_max_size and bucket_size */
+
+    hinit.hash = &hash;
+    hinit.key = ngx_hash_key;
+    hinit.max_size = 512;
+    hinit.bucket_size = ngx_align(64, ngx_cacheline_size);
+    hinit.name = "bench_hash_10k";
+    hinit.pool = pool;
+    hinit.temp_pool = NULL;
+
+    if (ngx_hash_init(&hinit, keys, BENCH_NAMES) != NGX_OK) {
+        return 0;
+    }
+
+    /* a hit and a miss in turn */
+
+    for (i = 0; i < n; i++) {
+        k = bench_random() % BENCH_NAMES + ((i & 1) ? BENCH_NAMES : 0);
+
+        bench_sum += (uintptr_t) ngx_hash_find(&hash,
+                                     ngx_hash_key(names[k].data, names[k].len),
+                                     names[k].data, names[k].len);
+    }
+
+    ngx_destroy_pool(pool);
+
+    return n;
+}
+
+
+static int ngx_libc_cdecl
+bench_cmp_dns_wildcards(const void *one, const void *two)
+{
+    ngx_hash_key_t  *first, *second;
+
+    first = (ngx_hash_key_t *) one;
+    second = (ngx_hash_key_t *) two;
+
+    return ngx_dns_strcmp(first->key.data, second->key.data);
+}
+
+
+static ngx_uint_t
+bench_wildcards(ngx_uint_t n, ngx_uint_t trie)
+{
+    u_char                  *p;
+    ngx_int_t                rc;
+    ngx_str_t               *names, name;
+    ngx_uint_t               i, k;
+    ngx_pool_t              *pool;
+    ngx_hash_init_t          hinit;
+    ngx_hash_wildcard_t     *hwc;
+    ngx_hash_keys_arrays_t   ha;
+
+    pool = bench_pool();
+
+    ngx_memzero(&ha, sizeof(ngx_hash_keys_arrays_t));
+
+    ha.pool = pool;
+    ha.temp_pool = pool;
+
+    if (ngx_hash_keys_array_init(&ha, NGX_HASH_LARGE) != NGX_OK) {
+        return 0;
+    }
+
+    names = ngx_palloc(pool, 2 * BENCH_NAMES * sizeof(ngx_str_t));
+    p = ngx_pnalloc(pool, 3 * BENCH_NAMES * 32);
+    if (names == NULL || p == NULL) {
+        return 0;
+    }
+
+    /* "*.siteN.exampleM.com" as ngx_http_server_names() adds them */
+
+    for (i = 0; i < BENCH_NAMES; i++) {
+        name.data = p;
+        name.len = ngx_sprintf(p, "*.site%ui.example%ui.com", i, i % 97) - p;
+        p += 32;
+
+        if (ngx_hash_add_key(&ha, &name, &names[i], NGX_HASH_WILDCARD_KEY)
+            != NGX_OK)
+        {
+            return 0;
+        }
+    }
+
+    /* host names under the wildcards, and as many under unknown ones */
+
+    for (i = 0; i < 2 * BENCH_NAMES; i++) {
+        names[i].data = p;
+        names[i].len = ngx_sprintf(p, "img.site%ui.example%ui.com",
+                                   i, i % 97)
+                       - p;
+        p += 32;
+    }
+
+    ngx_qsort(ha.dns_wc_head.elts, (size_t) ha.dns_wc_head.nelts,
+              sizeof(ngx_hash_key_t), bench_cmp_dns_wildcards);
+
+    hinit.hash = NULL;
+    hinit.key = ngx_hash_key_lc;
+    hinit.max_size = 512;
+    hinit.bucket_size = ngx_align(64, ngx_cacheline_size);
+    hinit.name = "bench_wc_head";
+    hinit.pool = pool;
+    hinit.temp_pool = pool;
+
+    rc = NGX_DECLINED;
+
+    if (trie) {
+        rc = ngx_hash_wildcard_trie_init(&hinit, ha.dns_wc_head.elts,
+                                         ha.dns_wc_head.nelts);
+    }
+
+    if (rc == NGX_DECLINED) {
+        rc = ngx_hash_wildcard_init(&hinit, ha.dns_wc_head.elts,
+                                    ha.dns_wc_head.nelts);
+    }
+
+    if (rc != NGX_OK) {
+        return 0;
+    }
+
+    hwc = (ngx_hash_wildcard_t *) hinit.hash;
+
+    /* two hits and a miss, as with a virtual server per customer */
+
+    for (i = 0; i < n; i++) {
+        k = bench_random() % BENCH_NAMES + ((i % 3 == 2) ? BENCH_NAMES : 0);
+
+        bench_sum += (uintptr_t) ngx_hash_find_wc_head(hwc, names[k].data,
+                                                       names[k].len);
+    }
+
+    ngx_destroy_pool(pool);
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_hash_wc_head(ngx_uint_t n)
+{
+    return bench_wildcards(n, 0);
+}
+
+
+static ngx_uint_t
+bench_hash_wc_head_trie(ngx_uint_t n)
+{
+    /* as with "server_names_hash_trie on" */
+
+    return bench_wildcards(n, 1);
+}
+
+
+static ngx_uint_t
+bench_radix_find(ngx_uint_t n)
+{
+    uint32_t           *addrs, key, mask;
+    ngx_uint_t          i;
+    ngx_pool_t         *pool;
+    ngx_radix_tree_t   *tree;
+
+    pool = bench_pool();
+
+    tree = ngx_radix_tree_create(pool, -1);
+    addrs = ngx_palloc(pool, BENCH_ADDRS * sizeof(uint32_t));
+    if (tree == NULL || addrs == NULL) {
+        return 0;
+    }
+
+    /* a geo table: networks from /16 to /28 */
+
+    for (i = 0; i < BENCH_ADDRS; i++) {
+        mask = 0xffffffff << (4 + bench_random() % 13);
+        key = (uint32_t) bench_random() & mask;
+
+        (void) ngx_radix32tree_insert(tree, key, mask, i + 1);
+
+        addrs[i] = key | ((uint32_t) bench_random() & ~mask);
+    }
+
+    for (i = 0; i < n; i++) {
+        key = (i & 1) ? addrs[i % BENCH_ADDRS] : (uint32_t) bench_random();
+        bench_sum += ngx_radix32tree_find(tree, key);
+    }
+
+    ngx_destroy_pool(pool);
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_poptrie_find(ngx_uint_t n)
+{
+    uint32_t           *addrs, key, mask;
+    ngx_uint_t          i;
+    ngx_pool_t         *pool;
+    ngx_poptrie_t      *trie;
+    ngx_radix_tree_t   *tree;
+
+    pool = bench_pool();
+
+    tree = ngx_radix_tree_create(pool, -1);
+    addrs = ngx_palloc(pool, BENCH_ADDRS * sizeof(uint32_t));
+    if (tree == NULL || addrs == NULL) {
+        return 0;
+    }
+
+    /* the geo table of radix32_find, compiled as the geo module does */
+
+    for (i = 0; i < BENCH_ADDRS; i++) {
+        mask = 0xffffffff << (4 + bench_random() % 13);
+        key = (uint32_t) bench_random() & mask;
+
+        (void) ngx_radix32tree_insert(tree, key, mask, i + 1);
+
+        addrs[i] = key | ((uint32_t) bench_random() & ~mask);
+    }
+
+    trie = ngx_poptrie_create(pool, tree, 32);
+    if (trie == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        key = (i & 1) ? addrs[i % BENCH_ADDRS] : (uint32_t) bench_random();
+        bench_sum += ngx_poptrie32_find(trie, key);
+    }
+
+    ngx_destroy_pool(pool);
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_rbtree(ngx_uint_t n)
+{
+    ngx_uint_t          i, k;
+    ngx_rbtree_t        tree;
+    ngx_rbtree_node_t   sentinel, *nodes;
+
+    nodes = malloc(BENCH_NODES * sizeof(ngx_rbtree_node_t));
+    if (nodes == NULL) {
+        return 0;
+    }
+
+    ngx_rbtree_init(&tree, &sentinel, ngx_rbtree_insert_value);
+
+    for (i = 0; i < BENCH_NODES; i++) {
+        nodes[i].key = bench_random();
+        ngx_rbtree_insert(&tree, &nodes[i]);
+    }
+
+    /* a timer-like churn: the tree size stays the same */
+
+    for (i = 0; i < n; i++) {
+        k = bench_random() % BENCH_NODES;
+
+        ngx_rbtree_delete(&tree, &nodes[k]);
+
+        nodes[k].key = bench_random();
+        ngx_rbtree_insert(&tree, &nodes[k]);
+    }
+
+    bench_sum += ngx_rbtree_min(tree.root, &sentinel)->key;
+
+    free(nodes);
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_slab(ngx_uint_t n)
+{
+    u_char           *addr;
+    size_t            size;
+    void            **p;
+    ngx_uint_t        i, k;
+    ngx_slab_pool_t  *sp;
+
+    size = 16 * 1024 * 1024;
+
+    addr = malloc(size);
+    p = calloc(BENCH_SLABS, sizeof(void *));
+    if (addr == NULL || p == NULL) {
+        return 0;
+    }
+
+    /* as ngx_init_zone_pool() does */
+
+    sp = (ngx_slab_pool_t *) addr;
+
+    sp->end = addr + size;
+    sp->min_shift = 3;
+    sp->addr = addr;
+
+    ngx_slab_init(sp);
+
+    /* cache nodes and keys of various sizes, freed in random order */
+
+    for (i = 0; i < n; i++) {
+        k = bench_random() % BENCH_SLABS;
+
+        if (p[k]) {
+            ngx_slab_free_locked(sp, p[k]);
+        }
+
+        p[k] = ngx_slab_alloc_locked(sp, 16 + (k & 0x3ff));
+    }
+
+    free(p);
+    free(addr);
+
+    return n;
+}
+
+
+static void
+bench_timer_handler(ngx_event_t *ev)
+{
+    bench_sum++;
+
+    ngx_event_add_timer(ev, 1000 + bench_random() % 59000);
+}
+
+
+static ngx_uint_t
+bench_timers(ngx_uint_t n, ngx_uint_t engine)
+{
+    ngx_uint_t    i;
+    ngx_event_t  *events, *ev;
+
+    events = calloc(BENCH_TIMERS, sizeof(ngx_event_t));
+    if (events == NULL) {
+        return 0;
+    }
+
+    ngx_current_msec = 0;
+    ngx_event_timer_wheel = (engine == NGX_EVENT_TIMER_WHEEL);
+
+    if (ngx_event_timer_init(&bench_log) != NGX_OK) {
+        return 0;
+    }
+
+    for (i = 0; i < BENCH_TIMERS; i++) {
+        events[i].handler = bench_timer_handler;
+        events[i].log = &bench_log;
+
+        bench_timer_handler(&events[i]);
+    }
+
+    /*
+     * keepalive-like connections: each millisecond a read timer
+     * is moved, and the timers due, about 30 of them, are found
+     * and expired
+     */
+
+    for (i = 0; i < n; i++) {
+        ngx_current_msec++;
+
+        ev = &events[bench_random() % BENCH_TIMERS];
+        ngx_event_add_timer(ev, 1000 + bench_random() % 59000);
+
+        bench_sum += ngx_event_find_timer();
+
+        ngx_event_expire_timers();
+    }
+
+    for (i = 0; i < BENCH_TIMERS; i++) {
+        if (events[i].timer_set) {
+            ngx_event_del_timer(&events[i]);
+        }
+    }
+
+    free(events);
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_timer_rbtree(ngx_uint_t n)
+{
+    return bench_timers(n, NGX_EVENT_TIMER_RBTREE);
+}
+
+
+static ngx_uint_t
+bench_timer_wheel(ngx_uint_t n)
+{
+    return bench_timers(n, NGX_EVENT_TIMER_WHEEL);
+}
+
+
+static ngx_uint_t
+bench_crc32_short(ngx_uint_t n)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < n; i++) {
+        bench_sum += ngx_crc32_short(bench_data + (i & 0xff), 32);
+    }
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_crc32_long(ngx_uint_t n)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < n; i++) {
+        bench_sum += ngx_crc32_long(bench_data, sizeof(bench_data));
+    }
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_md5(ngx_uint_t n)
+{
+    u_char      md5[16];
+    ngx_md5_t   ctx;
+    ngx_uint_t  i;
+
+    for (i = 0; i < n; i++) {
+        ngx_md5_init(&ctx);
+        ngx_md5_update(&ctx, bench_data, sizeof(bench_data));
+        ngx_md5_final(md5, &ctx);
+
+        bench_sum += md5[0];
+    }
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_murmurhash(ngx_uint_t n)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < n; i++) {
+        bench_sum += ngx_murmur_hash2(bench_data + (i & 0xff), 32);
+    }
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_base64_encode(ngx_uint_t n)
+{
+    u_char      buf[ngx_base64_encoded_length(1024)];
+    ngx_str_t   src, dst;
+    ngx_uint_t  i;
+
+    src.len = 1024;
+    dst.data = buf;
+
+    for (i = 0; i < n; i++) {
+        src.data = bench_data + (i & 0xff);
+
+        ngx_encode_base64(&dst, &src);
+
+        bench_sum += dst.data[i & 0xff];
+    }
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_base64_decode(ngx_uint_t n)
+{
+    u_char      buf[ngx_base64_encoded_length(1024)], out[1024];
+    ngx_str_t   src, dst;
+    ngx_uint_t  i;
+
+    src.len = 1024;
+    src.data = bench_data;
+    dst.data = buf;
+
+    ngx_encode_base64(&dst, &src);
+
+    src = dst;
+    dst.data = out;
+
+    for (i = 0; i < n; i++) {
+        if (ngx_decode_base64(&dst, &src) != NGX_OK) {
+            return 0;
+        }
+
+        bench_sum += dst.data[i & 0xff];
+    }
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_request_line(ngx_uint_t n)
+{
+    return bench_parse_request_line(n, bench_request,
+                                    sizeof(bench_request) - 1);
+}
+
+
+static ngx_uint_t
+bench_request_line_long(ngx_uint_t n)
+{
+    /* a long URI and arguments, as of an API call or a tracked link */
+
+    return bench_parse_request_line(n, bench_request_long,
+                                    sizeof(bench_request_long) - 1);
+}
+
+
+static ngx_uint_t
+bench_parse_request_line(ngx_uint_t n, u_char *line, size_t len)
+{
+    ngx_buf_t            b;
+    ngx_uint_t           i;
+    ngx_http_request_t  *r;
+
+    r = calloc(1, sizeof(ngx_http_request_t));
+    if (r == NULL) {
+        return 0;
+    }
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    for (i = 0; i < n; i++) {
+        r->state = 0;
+
+        b.pos = line;
+        b.last = line + len;
+
+        if (ngx_http_parse_request_line(r, &b) != NGX_OK) {
+            fprintf(stderr, "request line: parse error\n");
+            exit(1);
+        }
+
+        bench_sum += r->method;
+    }
+
+    free(r);
+
+    return n;
+}
+
+
+static ngx_uint_t
+bench_header_lines(ngx_uint_t n)
+{
+    ngx_int_t            rc;
+    ngx_buf_t            b;
+    ngx_uint_t           i, k;
+    ngx_http_request_t  *r;
+
+    r = calloc(1, sizeof(ngx_http_request_t));
+    if (r == NULL) {
+        return 0;
+    }
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    k = 0;
+
+    for (i = 0; i < n; i++) {
+        r->state = 0;
+
+        b.pos = bench_headers;
+        b.last = bench_headers + sizeof(bench_headers) - 1;
+
+        for ( ;; ) {
+            rc = ngx_http_parse_header_line(r, &b, 1);
+
+            if (rc == NGX_OK) {
+                bench_sum += r->header_hash;
+                k++;
+                continue;
+            }
+
+            if (rc == NGX_HTTP_PARSE_HEADER_DONE) {
+                break;
+            }
+
+            fprintf(stderr, "http_header_lines: parse error\n");
+            exit(1);
+        }
+    }
+
+    free(r);
+
+    return k;
+}
+
+
+#if (NGX_HTTP_V2)
+
+static ngx_uint_t
+bench_huff_decode(ngx_uint_t n)
+{
+    u_char       state, *dst;
+    u_char       value[1024], huff[1024], out[1024];
+    size_t       len;
+    ngx_uint_t   i;
+
+    /* a cookie-like value: letters, digits, and some punctuation */
+
+    for (i = 0; i < sizeof(value); i++) {
+        value[i] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                   "0123456789=;-_. "[bench_data[i] % 68];
+    }
+
+    len = ngx_http_v2_huff_encode(value, sizeof(value), huff, 0);
+    if (len == 0) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        state = 0;
+        dst = out;
+
+        if (ngx_http_v2_huff_decode(&state, huff, len, &dst, 1, &bench_log)
+            != NGX_OK)
+        {
+            fprintf(stderr, "hpack_huff_decode: decode error\n");
+            exit(1);
+        }
+
+        bench_sum += out[i & 0x3ff];
+    }
+
+    if (dst - out != sizeof(value) || ngx_memcmp(out, value, sizeof(value))) {
+        fprintf(stderr, "hpack_huff_decode: wrong result\n");
+        exit(1);
+    }
+
+    return n;
+}
+
+#endif
+
+
+int
+main(int argc, char *argv[])
+{
+    size_t      len;
+    double      start, elapsed;
+    ngx_uint_t  i, ops, scale;
+
+    scale = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 1;
+    len = (argc > 2) ? strlen(argv[2]) : 0;
+
+    if (scale == 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    /* as ngx_os_init() and main() do; nothing is logged */
+
+    bench_cycle.log = &bench_log;
+    ngx_cycle = &bench_cycle;
+
+#if (NGX_THREADS)
+    ngx_main_thread = pthread_self();
+#endif
+
+    ngx_pagesize = getpagesize();
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    for (i = ngx_pagesize; i >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_cpuinfo();
+
+    if (ngx_crc32_table_init() != NGX_OK) {
+        return 1;
+    }
+
+    ngx_slab_sizes_init();
+
+    for (i = 0; i < sizeof(bench_data); i++) {
+        bench_data[i] = (u_char) (i * 31 + (i >> 8));
+    }
+
+    for (i = 0; benchs[i].name; i++) {
+
+        if (len && ngx_strncmp(benchs[i].name, argv[2], len) != 0) {
+            continue;
+        }
+
+        /* each benchmark sees the same random sequence */
+
+        bench_seed = 88172645463325252ULL;
+
+        start = bench_now();
+
+        ops = benchs[i].handler(benchs[i].ops * scale);
+
+        elapsed = bench_now() - start;
+
+        if (ops == 0) {
+            fprintf(stderr, "%s: failed\n", benchs[i].name);
+            return 1;
+        }
+
+        printf("%s\t%lu\t%.2f\n", benchs[i].name, (unsigned long) ops,
+               elapsed * 1e9 / ops);
+    }
+
+    return bench_sum == 0;
+}
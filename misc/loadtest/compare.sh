@@ -0,0 +1,50 @@
+#!/bin/sh
+
+# Compares two results of run.sh, the baseline first:
+#
+#     misc/loadtest/compare.sh old.tsv new.tsv [threshold]
+#
+# Prints the changes in percent for each workload and marks those where
+# the requests per second dropped, or the 99th percentile or the CPU
+# time per request grew, by more than the threshold, 5 by default; the
+# exit status is 1 if there are any.
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 old.tsv new.tsv [threshold]" >&2
+    exit 2
+fi
+
+awk -v t=${3:-5} '
+
+    function delta(old, new) {
+        return (old > 0) ? (new - old) * 100 / old : 0
+    }
+
+    /^#/ { next }
+
+    FNR == NR {
+        rps[$1] = $2; p50[$1] = $3; p99[$1] = $4; cpu[$1] = $5
+        next
+    }
+
+    !($1 in rps) { next }
+
+    {
+        r = delta(rps[$1], $2)
+        l = delta(p99[$1], $4)
+        c = delta(cpu[$1], $5)
+
+        mark = ""
+
+        if (r < -t || l > t || c > t) {
+            mark = "\tregression"
+            bad = 1
+        }
+
+        printf("%s\trps %+.1f%%\tp50 %+.1f%%\tp99 %+.1f%%\tcpu %+.1f%%%s\n",
+               $1, r, delta(p50[$1], $3), l, c, mark)
+    }
+
+    END { exit bad }
+
+' "$1" "$2"
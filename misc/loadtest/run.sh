@@ -0,0 +1,163 @@
+#!/bin/sh
+
+# Runs the reference workloads against an nginx binary and prints
+# the results, a line per workload:
+#
+#     misc/loadtest/run.sh objs/nginx > new.tsv
+#     misc/loadtest/run.sh objs/nginx static proxy_cache > new.tsv
+#     misc/loadtest/compare.sh old.tsv new.tsv
+#
+# The workloads are static, static_1m, proxy, proxy_cache, ssl and
+# http2, their configurations are in conf/; ssl and http2 require
+# the http_ssl and http_v2 modules.  The backend of the proxy workloads
+# is the same binary with conf/backend.conf, the client is h2load from
+# nghttp2.  The ports 8080, 8081 and 8443 on 127.0.0.1 are used.
+#
+# The results are tab separated: the workload, requests per second,
+# the 50th and 99th percentiles of the response time in ms, and the
+# CPU time of the workers per request in us.  The CPU time is read
+# from /proc, so on Linux only.
+#
+# The DURATION (10), CONNECTIONS (64), THREADS (2) and WORKERS (1)
+# environment variables change the defaults.
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 /path/to/nginx [workload ...]" >&2
+    exit 1
+fi
+
+bin=`cd \`dirname $1\` && pwd`/`basename $1`
+shift
+
+workloads=${*:-static static_1m proxy proxy_cache ssl http2}
+
+dir=`cd \`dirname $0\` && pwd`
+work=`mktemp -d ${TMPDIR:-/tmp}/loadtest.XXXXXX`
+
+duration=${DURATION:-10}
+connections=${CONNECTIONS:-64}
+threads=${THREADS:-2}
+workers=${WORKERS:-1}
+
+hz=`getconf CLK_TCK`
+
+
+start() {
+    $bin -p $work/ -c conf/$2 -g "worker_processes $3;"
+
+    while [ ! -f $work/logs/$1.pid ]; do sleep 0.1; done
+}
+
+
+stop() {
+    if [ -f $work/logs/$1.pid ]; then
+        kill -QUIT `cat $work/logs/$1.pid` 2>/dev/null || true
+
+        while [ -f $work/logs/$1.pid ]; do sleep 0.1; done
+    fi
+}
+
+
+cleanup() {
+    stop nginx
+    stop backend
+    rm -rf $work
+}
+
+
+# the CPU time of the worker processes, in ticks
+
+cpu() {
+    for pid in `pgrep -P \`cat $work/logs/nginx.pid\``; do
+        cat /proc/$pid/stat
+    done | awk '{ t += $14 + $15 } END { print t + 0 }'
+}
+
+
+run() {
+    name=$1
+    conf=$2
+    url=$3
+    shift 3
+
+    start nginx $conf $workers
+
+    # the first requests open files, establish upstream connections
+    # and fill the cache
+
+    h2load -c $connections -t $threads -n `expr $connections \* 100` \
+        "$@" $url > /dev/null
+
+    cpu0=`cpu`
+
+    h2load -c $connections -t $threads -D $duration \
+        --log-file=$work/h2load.log "$@" $url > $work/h2load.out
+
+    cpu1=`cpu`
+
+    stop nginx
+
+    rps=`awk '/^finished in/ { print $4 + 0 }' $work/h2load.out`
+    ok=`awk '/^requests:/ { print $8 }' $work/h2load.out`
+
+    if [ -z "$ok" ] || [ "$ok" -eq 0 ]; then
+        echo "$name: no successful requests" >&2
+        cat $work/h2load.out >&2
+        return 1
+    fi
+
+    n=`wc -l < $work/h2load.log`
+
+    sort -n -k3 $work/h2load.log | awk -v name=$name -v rps=$rps -v n=$n \
+        -v cpu=$((cpu1 - cpu0)) -v hz=$hz -v ok=$ok '
+        NR == int(n * 0.50 + 0.5) { p50 = $3 }
+        NR == int(n * 0.99 + 0.5) { p99 = $3 }
+        END {
+            printf("%s\t%.2f\t%.3f\t%.3f\t%.2f\n", name, rps,
+                   p50 / 1000, p99 / 1000, cpu * 1000000 / hz / ok)
+        }'
+
+    rm $work/h2load.log
+}
+
+
+trap cleanup EXIT INT TERM
+
+mkdir -p $work/conf $work/html $work/logs $work/cache
+
+cp $dir/conf/*.conf $work/conf
+
+head -c 1024 /dev/zero | tr '\0' 'x' > $work/html/1k
+head -c 1048576 /dev/zero | tr '\0' 'x' > $work/html/1m
+
+case " $workloads " in
+    *" ssl "*|*" http2 "*)
+        openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+            -keyout $work/conf/cert.key -out $work/conf/cert.pem 2>/dev/null
+        ;;
+esac
+
+start backend backend.conf 2
+
+echo "# `$bin -v 2>&1 | sed -e 's/^nginx version: //'`" \
+     "`uname -sm` workers=$workers connections=$connections" \
+     "duration=$duration"
+echo "# workload	rps	p50_ms	p99_ms	cpu_us"
+
+for w in $workloads; do
+    case $w in
+        static)      run $w static.conf http://127.0.0.1:8080/1k --h1 ;;
+        static_1m)   run $w static.conf http://127.0.0.1:8080/1m --h1 ;;
+        proxy)       run $w proxy.conf http://127.0.0.1:8080/1k --h1 ;;
+        proxy_cache) run $w proxy_cache.conf http://127.0.0.1:8080/1k --h1 ;;
+        ssl)         run $w ssl.conf https://127.0.0.1:8443/1k --h1 ;;
+        http2)       run $w http2.conf https://127.0.0.1:8443/1k -m 10 ;;
+
+        *)
+            echo "unknown workload \"$w\"" >&2
+            exit 1
+            ;;
+    esac
+done
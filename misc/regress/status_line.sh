@@ -0,0 +1,101 @@
+#!/bin/sh
+
+# Checks that the status line of a proxied response is passed as is,
+# in particular that the header cache of a worker does not reuse the
+# status line of another response with the same status code:
+#
+#     misc/regress/status_line.sh objs/nginx
+#
+# The backends are the same binary, responding with "200 Alpha" and
+# "200 Bravo" from the stream return module, so the http_proxy, map
+# and stream modules are required; the client is curl.  The ports
+# 8090, 8091 and 8092 on 127.0.0.1 are used.
+
+set -e
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 /path/to/nginx" >&2
+    exit 1
+fi
+
+bin=`cd \`dirname $1\` && pwd`/`basename $1`
+
+work=`mktemp -d ${TMPDIR:-/tmp}/regress.XXXXXX`
+
+
+cleanup() {
+    if [ -f $work/logs/nginx.pid ]; then
+        kill -QUIT `cat $work/logs/nginx.pid` 2>/dev/null || true
+
+        while [ -f $work/logs/nginx.pid ]; do sleep 0.1; done
+    fi
+
+    rm -rf $work
+}
+
+
+trap cleanup EXIT INT TERM
+
+mkdir -p $work/conf $work/logs
+
+cat > $work/conf/nginx.conf << 'END'
+worker_processes  1;
+
+events {
+}
+
+stream {
+    server {
+        listen  127.0.0.1:8091;
+        return  "HTTP/1.0 200 Alpha\r\nContent-Type: text/plain\r\n\r\nalpha\n";
+    }
+
+    server {
+        listen  127.0.0.1:8092;
+        return  "HTTP/1.0 200 Bravo\r\nContent-Type: text/plain\r\n\r\nbravo\n";
+    }
+}
+
+http {
+    access_log  off;
+
+    map $uri $backend {
+        /alpha   127.0.0.1:8091;
+        default  127.0.0.1:8092;
+    }
+
+    server {
+        listen  127.0.0.1:8090;
+
+        location / {
+            proxy_pass  http://$backend;
+        }
+    }
+}
+END
+
+$bin -p $work/ -c conf/nginx.conf
+
+while [ ! -f $work/logs/nginx.pid ]; do sleep 0.1; done
+
+failed=0
+
+for i in 1 2 3; do
+    for name in Alpha Bravo; do
+        uri=`echo $name | tr A-Z a-z`
+
+        line=`curl -si http://127.0.0.1:8090/$uri | head -n 1 | tr -d '\r'`
+
+        if [ "$line" != "HTTP/1.1 200 $name" ]; then
+            echo "/$uri: \"$line\", expected \"HTTP/1.1 200 $name\"" >&2
+            failed=1
+        fi
+    done
+done
+
+if [ $failed = 1 ]; then
+    echo "status_line: failed"
+    exit 1
+fi
+
+echo "status_line: ok"
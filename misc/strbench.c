@@ -0,0 +1,143 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * strbench measures ngx_string.c helpers on header-like and URI-like
+ * strings; run it from a configured source tree, once built with the
+ * SIMD code and once without it to compare:
+ *
+ *     cc -O2 -I src/core -I src/event -I src/os/unix -I objs \
+ *         -o strbench misc/strbench.c src/core/ngx_string.c
+ *     cc -O2 -I src/core -I src/event -I src/os/unix -I objs \
+ *         -DNGX_HAVE_SSE2=0 -DNGX_HAVE_NEON=0 \
+ *         -o strbench-scalar misc/strbench.c src/core/ngx_string.c
+ *
+ *     strbench [iterations]
+ *
+ * the output is the throughput of each function in MB/s.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+
+void *
+ngx_alloc(size_t size, ngx_log_t *log)
+{
+    return malloc(size);
+}
+
+
+void *
+ngx_pnalloc(ngx_pool_t *pool, size_t size)
+{
+    return malloc(size);
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+static u_char *strings[] = {
+    (u_char *) "Accept-Encoding",
+    (u_char *) "X-Forwarded-For",
+    (u_char *) "Content-Security-Policy-Report-Only",
+    (u_char *) "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+               "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36",
+    (u_char *) "/static/js/vendor/jquery-3.7.1.min.js",
+    (u_char *) "/search?q=nginx%20performance&page=2&lang=en_US",
+    (u_char *) "/images/2024/05/very_long_file-name.with.dots.and-dashes"
+               ".thumbnail.jpeg",
+    (u_char *) "<a href=\"/index.html\">home</a> &amp; about",
+    NULL
+};
+
+
+static double
+bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+bench_report(const char *name, size_t bytes, double start)
+{
+    printf("%-20s %10.1f MB/s\n", name,
+           bytes / (bench_now() - start) / (1024 * 1024));
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    u_char      *s, *d, *src, *lower[16], dst[1024];
+    size_t       len, bytes;
+    double       start;
+    ngx_int_t    sum;
+    ngx_uint_t   i, n, k;
+
+    n = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 1000000;
+
+    sum = 0;
+
+    for (k = 0; strings[k]; k++) {
+        len = ngx_strlen(strings[k]);
+
+        lower[k] = malloc(len + 1);
+        if (lower[k] == NULL) {
+            return 1;
+        }
+
+        ngx_strlow(lower[k], strings[k], len + 1);
+    }
+
+#define bench_run(name, code)                                                 \
+    bytes = 0;                                                                \
+    start = bench_now();                                                      \
+                                                                              \
+    for (i = 0; i < n; i++) {                                                 \
+        for (k = 0; strings[k]; k++) {                                        \
+            src = strings[k];                                                 \
+            len = ngx_strlen(src);                                            \
+            code;                                                             \
+            bytes += len;                                                     \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    bench_report(name, bytes, start)
+
+    bench_run("ngx_strlow", ngx_strlow(dst, src, len); sum += dst[0]);
+
+    bench_run("ngx_strcasecmp", sum += ngx_strcasecmp(src, lower[k]));
+
+    bench_run("ngx_strncasecmp", sum += ngx_strncasecmp(src, lower[k], len));
+
+    bench_run("ngx_escape_uri",
+              sum += ngx_escape_uri(dst, src, len, NGX_ESCAPE_ARGS));
+
+    bench_run("ngx_unescape_uri",
+              d = dst; s = src;
+              ngx_unescape_uri(&d, &s, len, NGX_UNESCAPE_URI);
+              sum += d - dst);
+
+    bench_run("ngx_escape_html",
+              sum += ngx_escape_html(dst, src, len));
+
+    return sum == 0;
+}
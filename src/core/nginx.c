@@ -8,6 +8,9 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <nginx.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
 
 
 static void ngx_show_version_info(void);
@@ -20,11 +23,21 @@ static void *ngx_core_module_create_conf(ngx_cycle_t *cycle);
 static char *ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf);
 static char *ngx_set_user(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_env(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_set_shm_policy(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_set_cache_manager(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+static ngx_int_t ngx_set_numa_affinity(ngx_cycle_t *cycle,
+    ngx_core_conf_t *ccf);
+#endif
 static char *ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_set_io_buffers(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_load_module(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 #if (NGX_HAVE_DLOPEN)
 static void ngx_unload_module(void *data);
@@ -110,6 +123,13 @@ static ngx_command_t  ngx_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("reuseport_steering"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, reuseport_steering),
+      NULL },
+
     { ngx_string("worker_rlimit_nofile"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_num_slot,
@@ -131,6 +151,34 @@ static ngx_command_t  ngx_core_commands[] = {
       offsetof(ngx_core_conf_t, shutdown_timeout),
       NULL },
 
+    { ngx_string("worker_rolling_reload"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_core_conf_t, rolling_reload),
+      NULL },
+
+    { ngx_string("cache_manager"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_set_cache_manager,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("worker_pool_cache"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_core_conf_t, pool_cache),
+      NULL },
+
+    { ngx_string("worker_io_buffers"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE12,
+      ngx_set_io_buffers,
+      0,
+      0,
+      NULL },
+
     { ngx_string("working_directory"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_slot,
@@ -145,6 +193,13 @@ static ngx_command_t  ngx_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("shared_memory_policy"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_2MORE,
+      ngx_set_shm_policy,
+      0,
+      0,
+      NULL },
+
     { ngx_string("load_module"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_load_module,
@@ -182,6 +237,7 @@ ngx_module_t  ngx_core_module = {
 static ngx_uint_t   ngx_show_help;
 static ngx_uint_t   ngx_show_version;
 static ngx_uint_t   ngx_show_configure;
+static ngx_uint_t   ngx_show_profile;
 static u_char      *ngx_prefix;
 static u_char      *ngx_conf_file;
 static u_char      *ngx_conf_params;
@@ -194,12 +250,13 @@ static char **ngx_os_environ;
 int ngx_cdecl
 main(int argc, char *const *argv)
 {
-    ngx_buf_t        *b;
-    ngx_log_t        *log;
-    ngx_uint_t        i;
-    ngx_cycle_t      *cycle, init_cycle;
-    ngx_conf_dump_t  *cd;
-    ngx_core_conf_t  *ccf;
+    ngx_buf_t           *b;
+    ngx_log_t           *log;
+    ngx_uint_t           i;
+    ngx_cycle_t         *cycle, init_cycle;
+    ngx_conf_dump_t     *cd;
+    ngx_core_conf_t     *ccf;
+    ngx_conf_profile_t   profile;
 
     ngx_debug_init();
 
@@ -298,11 +355,20 @@ main(int argc, char *const *argv)
         return 1;
     }
 
+    if (ngx_show_profile && ngx_conf_profile_init() != NGX_OK) {
+        return 1;
+    }
+
+    ngx_conf_profile_start(&profile);
+
     /*
      * NOTE: ngx_init_cycle 函数里面就把所有配置项给解析出来了，所以这之后都可以用了
      * QUESTION: 但是为什么要重新使用 cycle，而不是继续使用 init_cycle 呢？
      */
     cycle = ngx_init_cycle(&init_cycle);
+
+    ngx_conf_profile_stop(&profile, NULL, 0);
+
     if (cycle == NULL) {
         if (ngx_test_config) {
             ngx_log_stderr(0, "configuration file %s test failed",
@@ -336,6 +402,10 @@ main(int argc, char *const *argv)
             }
         }
 
+        if (ngx_show_profile) {
+            ngx_conf_profile_report(cycle);
+        }
+
         return 0;
     }
 
@@ -421,7 +491,7 @@ ngx_show_version_info(void)
 
     if (ngx_show_help) {
         ngx_write_stderr(
-            "Usage: nginx [-?hvVtTq] [-s signal] [-c filename] "
+            "Usage: nginx [-?hvVtTPq] [-s signal] [-c filename] "
                          "[-p prefix] [-g directives]" NGX_LINEFEED
                          NGX_LINEFEED
             "Options:" NGX_LINEFEED
@@ -432,6 +502,8 @@ ngx_show_version_info(void)
             "  -t            : test configuration and exit" NGX_LINEFEED
             "  -T            : test configuration, dump it and exit"
                                NGX_LINEFEED
+            "  -P            : test configuration, show time spent "
+                               "by modules and exit" NGX_LINEFEED
             "  -q            : suppress non-error messages "
                                "during configuration testing" NGX_LINEFEED
             "  -s signal     : send signal to a master process: "
@@ -836,6 +908,11 @@ ngx_get_options(int argc, char *const *argv)
                 ngx_dump_config = 1;
                 break;
 
+            case 'P':
+                ngx_test_config = 1;
+                ngx_show_profile = 1;
+                break;
+
             case 'q':
                 // QUESTION: 这个具体用来控制啥？不太懂
                 ngx_quiet_mode = 1;
@@ -1118,14 +1195,23 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
      *     ccf->oldpid = NULL;
      *     ccf->priority = 0;
      *     ccf->cpu_affinity_auto = 0;
+     *     ccf->cpu_affinity_numa = 0;
      *     ccf->cpu_affinity_n = 0;
      *     ccf->cpu_affinity = NULL;
+     *     ccf->cpu_affinity_node = NULL;
+     *     ccf->cpu_nodes = NULL;
      */
 
     ccf->daemon = NGX_CONF_UNSET;
     ccf->master = NGX_CONF_UNSET;
     ccf->timer_resolution = NGX_CONF_UNSET_MSEC;
     ccf->shutdown_timeout = NGX_CONF_UNSET_MSEC;
+    ccf->rolling_reload = NGX_CONF_UNSET_MSEC;
+    ccf->pool_cache = NGX_CONF_UNSET_SIZE;
+    ccf->io_buffers = NGX_CONF_UNSET_SIZE;
+    ccf->io_buffers_huge = NGX_CONF_UNSET;
+    ccf->reuseport_steering = NGX_CONF_UNSET;
+    ccf->cache_manager = NGX_CONF_UNSET_UINT;
 
     ccf->worker_processes = NGX_CONF_UNSET;
     ccf->debug_points = NGX_CONF_UNSET;
@@ -1142,6 +1228,13 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
         return NULL;
     }
 
+    if (ngx_array_init(&ccf->shm_policies, cycle->pool, 1,
+                       sizeof(ngx_shm_policy_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
     return ccf;
 }
 
@@ -1155,6 +1248,11 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ccf->master, 1);
     ngx_conf_init_msec_value(ccf->timer_resolution, 0);
     ngx_conf_init_msec_value(ccf->shutdown_timeout, 0);
+    ngx_conf_init_msec_value(ccf->rolling_reload, 0);
+    ngx_conf_init_size_value(ccf->pool_cache, 0);
+    ngx_conf_init_size_value(ccf->io_buffers, 0);
+    ngx_conf_init_value(ccf->io_buffers_huge, 0);
+    ngx_conf_init_uint_value(ccf->cache_manager, NGX_CACHE_MANAGER_PROCESS);
 
     ngx_conf_init_value(ccf->worker_processes, 1);
     ngx_conf_init_value(ccf->debug_points, 0);
@@ -1172,6 +1270,38 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
                       "using last mask for remaining worker processes");
     }
 
+#endif
+
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+
+    if (ccf->cpu_affinity_numa) {
+        if (ngx_set_numa_affinity(cycle, ccf) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+#endif
+
+    ngx_conf_init_value(ccf->reuseport_steering, ccf->cpu_affinity_numa);
+
+#if (NGX_HAVE_REUSEPORT_CBPF)
+
+    if (ccf->reuseport_steering && ccf->cpu_affinity == NULL) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"reuseport_steering\" requires "
+                      "\"worker_cpu_affinity\", ignored");
+        ccf->reuseport_steering = 0;
+    }
+
+#else
+
+    if (ccf->reuseport_steering) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"reuseport_steering\" is not supported "
+                      "on this platform, ignored");
+        ccf->reuseport_steering = 0;
+    }
+
 #endif
 
 
@@ -1368,6 +1498,136 @@ ngx_set_env(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_set_shm_policy(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_core_conf_t  *ccf = conf;
+
+#if (NGX_HAVE_MBIND)
+    ngx_int_t          n;
+#endif
+    ngx_str_t         *value;
+    ngx_uint_t         i;
+    ngx_shm_policy_t  *policy;
+
+    value = cf->args->elts;
+
+    policy = ccf->shm_policies.elts;
+
+    for (i = 0; i < ccf->shm_policies.nelts; i++) {
+        if (policy[i].name.len == value[1].len
+            && ngx_strncmp(policy[i].name.data, value[1].data, value[1].len)
+               == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate shared memory policy for \"%V\"",
+                               &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    policy = ngx_array_push(&ccf->shm_policies);
+    if (policy == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    policy->name = value[1];
+    policy->huge = NGX_SHM_HUGE_OFF;
+    policy->numa = NGX_SHM_NUMA_DEFAULT;
+    ngx_str_null(&policy->file);
+    policy->used = 0;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "hugepages=on") == 0) {
+#if (NGX_HAVE_MAP_HUGETLB)
+            policy->huge = NGX_SHM_HUGE_ON;
+            continue;
+#else
+            goto not_supported;
+#endif
+        }
+
+        if (ngx_strcmp(value[i].data, "hugepages=transparent") == 0) {
+#if (NGX_HAVE_MADV_HUGEPAGE)
+            policy->huge = NGX_SHM_HUGE_TRANSPARENT;
+            continue;
+#else
+            goto not_supported;
+#endif
+        }
+
+        if (ngx_strcmp(value[i].data, "hugepages=off") == 0) {
+            policy->huge = NGX_SHM_HUGE_OFF;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "numa=", 5) == 0) {
+#if (NGX_HAVE_MBIND)
+            if (ngx_strcmp(&value[i].data[5], "interleave") == 0) {
+                policy->numa = NGX_SHM_NUMA_INTERLEAVE;
+                continue;
+            }
+
+            n = ngx_atoi(value[i].data + 5, value[i].len - 5);
+
+            if (n == NGX_ERROR || n >= (ngx_int_t) (sizeof(unsigned long) * 8))
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid NUMA node \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            policy->numa = n;
+            continue;
+#else
+            goto not_supported;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "persistent=", 11) == 0) {
+#if (NGX_SHM_PERSISTENT)
+            policy->file.len = value[i].len - 11;
+            policy->file.data = value[i].data + 11;
+
+            if (ngx_conf_full_name(cf->cycle, &policy->file, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            goto not_supported;
+#endif
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (policy->file.len && policy->huge != NGX_SHM_HUGE_OFF) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "persistent zone \"%V\" cannot use huge pages",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+#if !(NGX_HAVE_MAP_HUGETLB && NGX_HAVE_MADV_HUGEPAGE && NGX_HAVE_MBIND \
+      && NGX_SHM_PERSISTENT)
+
+not_supported:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"%V\" is not supported on this platform",
+                       &value[i]);
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+
 static char *
 ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1408,6 +1668,57 @@ ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_set_cache_manager(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_core_conf_t  *ccf = conf;
+
+    ngx_str_t  *value;
+
+    if (ccf->cache_manager != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "process") == 0) {
+        ccf->cache_manager = NGX_CACHE_MANAGER_PROCESS;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "threads", 7) == 0
+        && (value[1].len == 7 || value[1].data[7] == '='))
+    {
+#if (NGX_THREADS)
+        if (value[1].len >= 8) {
+            ccf->cache_manager_pool.len = value[1].len - 8;
+            ccf->cache_manager_pool.data = value[1].data + 8;
+
+        } else {
+            ngx_str_set(&ccf->cache_manager_pool, "default");
+        }
+
+        if (ngx_thread_pool_add(cf, &ccf->cache_manager_pool) == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ccf->cache_manager = NGX_CACHE_MANAGER_THREADS;
+
+        return NGX_CONF_OK;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_manager threads\" "
+                           "is unsupported on this platform");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid value \"%V\"", &value[1]);
+    return NGX_CONF_ERROR;
+}
+
+
 static char *
 ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1435,7 +1746,21 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     if (ngx_strcmp(value[1].data, "auto") == 0) {
 
-        if (cf->args->nelts > 3) {
+        n = 2;
+
+        if (cf->args->nelts > 2 && ngx_strcmp(value[2].data, "numa") == 0) {
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+            ccf->cpu_affinity_numa = 1;
+            n = 3;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"worker_cpu_affinity auto numa\" is not "
+                               "supported on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (cf->args->nelts > n + 1) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                "invalid number of arguments in "
                                "\"worker_cpu_affinity\" directive");
@@ -1449,7 +1774,11 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             CPU_SET(i, &mask[0]);
         }
 
-        n = 2;
+        /* the mask in place of "numa" keeps the last one for all CPUs */
+
+        if (n == 3) {
+            mask[1] = mask[0];
+        }
 
     } else {
         n = 1;
@@ -1507,7 +1836,7 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
 
 ngx_cpuset_t *
-ngx_get_cpu_affinity(ngx_uint_t n)
+ngx_get_cpu_affinity(ngx_cycle_t *cycle, ngx_uint_t n)
 {
 #if (NGX_HAVE_CPU_AFFINITY)
     ngx_uint_t        i, j;
@@ -1516,8 +1845,7 @@ ngx_get_cpu_affinity(ngx_uint_t n)
 
     static ngx_cpuset_t  result;
 
-    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
-                                           ngx_core_module);
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
 
     if (ccf->cpu_affinity == NULL) {
         return NULL;
@@ -1560,6 +1888,99 @@ ngx_get_cpu_affinity(ngx_uint_t n)
 }
 
 
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+
+/*
+ * "worker_cpu_affinity auto numa" spreads workers over the NUMA nodes
+ * in turn and binds each of them to the next available CPU of its node
+ */
+
+static ngx_int_t
+ngx_set_numa_affinity(ngx_cycle_t *cycle, ngx_core_conf_t *ccf)
+{
+    ngx_int_t      *nodes, *worker_node;
+    ngx_uint_t      i, w, k, n, nnodes, ids[NGX_NUMA_MAX_NODES],
+                    next[NGX_NUMA_MAX_NODES];
+    ngx_cpuset_t   *allowed, *mask;
+
+    nodes = ngx_palloc(cycle->pool, CPU_SETSIZE * sizeof(ngx_int_t));
+    if (nodes == NULL) {
+        return NGX_ERROR;
+    }
+
+    allowed = &ccf->cpu_affinity[ccf->cpu_affinity_n - 1];
+
+    if (ngx_get_cpu_nodes(nodes, cycle->log) == 0) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "NUMA topology is not available, "
+                      "\"numa\" of \"worker_cpu_affinity\" ignored");
+        ccf->cpu_affinity_numa = 0;
+        return NGX_OK;
+    }
+
+    /* nodes with allowed CPUs */
+
+    nnodes = 0;
+
+    for (k = 0; k < NGX_NUMA_MAX_NODES; k++) {
+
+        for (i = 0; i < CPU_SETSIZE; i++) {
+            if (nodes[i] == (ngx_int_t) k && CPU_ISSET(i, allowed)) {
+                next[nnodes] = i;
+                ids[nnodes++] = k;
+                break;
+            }
+        }
+    }
+
+    if (nnodes == 0) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "no CPUs of \"worker_cpu_affinity\" mask "
+                      "are found on NUMA nodes");
+        return NGX_ERROR;
+    }
+
+    n = ccf->worker_processes;
+
+    mask = ngx_palloc(cycle->pool, n * sizeof(ngx_cpuset_t));
+    if (mask == NULL) {
+        return NGX_ERROR;
+    }
+
+    worker_node = ngx_palloc(cycle->pool, n * sizeof(ngx_int_t));
+    if (worker_node == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (w = 0; w < n; w++) {
+        k = w % nnodes;
+
+        for (i = next[k]; /* void */ ; i = (i + 1) % CPU_SETSIZE) {
+            if (nodes[i] == (ngx_int_t) ids[k] && CPU_ISSET(i, allowed)) {
+                break;
+            }
+        }
+
+        next[k] = (i + 1) % CPU_SETSIZE;
+
+        CPU_ZERO(&mask[w]);
+        CPU_SET(i, &mask[w]);
+
+        worker_node[w] = ids[k];
+    }
+
+    ccf->cpu_affinity_auto = 0;
+    ccf->cpu_affinity_n = n;
+    ccf->cpu_affinity = mask;
+    ccf->cpu_affinity_node = worker_node;
+    ccf->cpu_nodes = nodes;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static char *
 ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1589,6 +2010,47 @@ ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_set_io_buffers(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_core_conf_t *ccf = conf;
+
+    ngx_str_t  *value;
+
+    if (ccf->io_buffers != NGX_CONF_UNSET_SIZE) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ccf->io_buffers = ngx_parse_size(&value[1]);
+
+    if (ccf->io_buffers == (size_t) NGX_ERROR) {
+        return "invalid value";
+    }
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcmp(value[2].data, "huge") != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_HAVE_MADV_HUGEPAGE)
+    ccf->io_buffers_huge = 1;
+#else
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "huge pages are not supported on this platform, "
+                       "ignored");
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_load_module(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -125,6 +125,12 @@ struct ngx_output_chain_ctx_s {
 
     off_t                        alignment;
 
+    /* read-ahead of sequentially read files */
+    off_t                        prefetch;
+    ngx_file_t                  *prefetch_file;
+    off_t                        prefetch_next;
+    off_t                        prefetch_last;
+
     ngx_pool_t                  *pool;
     ngx_int_t                    allocated;
     ngx_bufs_t                   bufs;
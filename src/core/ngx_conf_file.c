@@ -11,9 +11,13 @@
 #define NGX_CONF_BUFFER  4096
 
 static ngx_int_t ngx_conf_add_dump(ngx_conf_t *cf, ngx_str_t *filename);
+static ngx_int_t ngx_conf_hash_directives(ngx_cycle_t *cycle);
 static ngx_int_t ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last);
 static ngx_int_t ngx_conf_read_token(ngx_conf_t *cf);
 static void ngx_conf_flush_files(ngx_cycle_t *cycle);
+static uint64_t ngx_conf_profile_now(void);
+static int ngx_libc_cdecl ngx_conf_profile_cmp(const void *one,
+    const void *two);
 
 
 static ngx_command_t  ngx_conf_commands[] = {
@@ -47,6 +51,24 @@ ngx_module_t  ngx_conf_module = {
 
 /* The eight fixed arguments */
 
+/* the characters which end or alter an unquoted parameter */
+
+static uint32_t  ngx_conf_special[] = {
+    0x00002600, /* 0000 0000 0000 0000  0010 0110 0000 0000 */
+
+                /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
+    0x08000011, /* 0000 1000 0000 0000  0000 0000 0001 0001 */
+
+                /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
+    0x10000000, /* 0001 0000 0000 0000  0000 0000 0000 0000 */
+
+                /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
+    0x08000000, /* 0000 1000 0000 0000  0000 0000 0000 0000 */
+
+    0x00000000, 0x00000000, 0x00000000, 0x00000000
+};
+
+
 static ngx_uint_t argument_number[] = {
     NGX_CONF_NOARGS,
     NGX_CONF_TAKE1,
@@ -59,6 +81,23 @@ static ngx_uint_t argument_number[] = {
 };
 
 
+ngx_uint_t  ngx_conf_profiling;
+
+static uint64_t  *ngx_conf_profile_times;
+static uint64_t   ngx_conf_profile_nested;
+static uint64_t   ngx_conf_profile_total;
+
+static char  *ngx_conf_profile_stages[] = {
+    "directives",
+    "create_conf",
+    "preconfiguration",
+    "init_conf",
+    "merge_conf",
+    "postconfiguration",
+    "init_module"
+};
+
+
 char *
 ngx_conf_param(ngx_conf_t *cf)
 {
@@ -363,254 +402,334 @@ done:
 
 
 static ngx_int_t
-ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last)
+ngx_conf_hash_directives(ngx_cycle_t *cycle)
 {
-    char           *rv;
-    void           *conf, **confp;
-    ngx_uint_t      i, found;
-    ngx_str_t      *name;
-    ngx_command_t  *cmd;
+    ngx_uint_t              i, key;
+    ngx_command_t          *cmd;
+    ngx_conf_directive_t   *d, **dp;
+    ngx_conf_directives_t  *dirs;
 
-    name = cf->args->elts;
+    dirs = cycle->directives;
 
-    found = 0;
+    if (dirs && dirs->modules_n == cycle->modules_n) {
+        return NGX_OK;
+    }
+
+    /*
+     * "load_module" may insert modules in the middle of the list,
+     * so the hash is rebuilt to keep the order of modules
+     */
 
-    for (i = 0; cf->cycle->modules[i]; i++) {
+    if (dirs == NULL) {
+        dirs = ngx_palloc(cycle->pool, sizeof(ngx_conf_directives_t));
+        if (dirs == NULL) {
+            return NGX_ERROR;
+        }
 
-        cmd = cf->cycle->modules[i]->commands;
+        cycle->directives = dirs;
+    }
+
+    ngx_memzero(dirs->buckets, sizeof(dirs->buckets));
+
+    for (i = 0; i < cycle->modules_n; i++) {
+
+        cmd = cycle->modules[i]->commands;
         if (cmd == NULL) {
             continue;
         }
 
-        /*
-         * NOTE: 每个模块的 commands 数组最后一个元素都是 ngx_null_command
-         *       所以通过 cmd->name.len 来作判断就可以了
-         */
         for ( /* void */ ; cmd->name.len; cmd++) {
 
-            if (name->len != cmd->name.len) {
-                continue;
+            key = ngx_hash_key(cmd->name.data, cmd->name.len)
+                  & (NGX_CONF_DIRECTIVES_HASH - 1);
+
+            for (dp = &dirs->buckets[key]; *dp; dp = &(*dp)->next) {
+                /* void */
             }
 
-            if (ngx_strcmp(name->data, cmd->name.data) != 0) {
-                continue;
+            d = ngx_palloc(cycle->pool, sizeof(ngx_conf_directive_t));
+            if (d == NULL) {
+                return NGX_ERROR;
             }
 
-            found = 1;
+            d->cmd = cmd;
+            d->module = cycle->modules[i];
+            d->next = NULL;
 
-            /*
-             * QUESTION: 为什么不先判断 module_type，然后再比对 name?
-             *
-             * QUESTION: 为什么 NGX_CONF_MODULE 不参与 type 比对？
-             */
-            if (cf->cycle->modules[i]->type != NGX_CONF_MODULE
-                && cf->cycle->modules[i]->type != cf->module_type)
-            {
-                continue;
-            }
+            *dp = d;
+        }
+    }
 
-            /* is the directive's location right ? */
+    dirs->modules_n = cycle->modules_n;
 
-            /*
-             * NOTE: 这个 type 是用来指明 cmd 的类型(块指令、flag...)、出现的位置、带参数的个数...
-             */
-            if (!(cmd->type & cf->cmd_type)) {
-                continue;
-            }
+    return NGX_OK;
+}
 
-            /*
-             * NOTE: 只要不是块指令，那么上一次的返回值就得是 NGX_OK？为啥呢？
-             */
-            if (!(cmd->type & NGX_CONF_BLOCK) && last != NGX_OK) {
-                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                                  "directive \"%s\" is not terminated by \";\"",
-                                  name->data);
-                return NGX_ERROR;
-            }
 
-            /*
-             * QUESTION: 不是先解析了 cmd，后面才有 { 么？
-             *           比如 http {...}，先看到 http，然后再看到 {，last 难道不是指
-             *           上一轮解析的返回值么？
-             */
-            if ((cmd->type & NGX_CONF_BLOCK) && last != NGX_CONF_BLOCK_START) {
-                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                                   "directive \"%s\" has no opening \"{\"",
-                                   name->data);
-                return NGX_ERROR;
-            }
+static ngx_int_t
+ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last)
+{
+    char                  *rv;
+    void                  *conf, **confp;
+    ngx_uint_t             found;
+    ngx_str_t             *name;
+    ngx_module_t          *module;
+    ngx_command_t         *cmd;
+    ngx_conf_profile_t     profile;
+    ngx_conf_directive_t  *d;
 
-            /* is the directive's argument count right ? */
+    name = cf->args->elts;
 
-            if (!(cmd->type & NGX_CONF_ANY)) {
+    found = 0;
 
-                if (cmd->type & NGX_CONF_FLAG) {
+    if (ngx_conf_hash_directives(cf->cycle) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-                    /*
-                     * NOTE: cf->args 里面也包括了指令本身，比如 flv on;
-                     *       这个和命令行的 argv 类似
-                     */
-                    if (cf->args->nelts != 2) {
-                        goto invalid;
-                    }
+    /* the directives of a bucket are kept in the order of modules */
 
-                } else if (cmd->type & NGX_CONF_1MORE) {
+    d = cf->cycle->directives->buckets[ngx_hash_key(name->data, name->len)
+                                       & (NGX_CONF_DIRECTIVES_HASH - 1)];
 
-                    if (cf->args->nelts < 2) {
-                        goto invalid;
-                    }
+    for ( /* void */ ; d; d = d->next) {
 
-                } else if (cmd->type & NGX_CONF_2MORE) {
+        cmd = d->cmd;
+        module = d->module;
 
-                    if (cf->args->nelts < 3) {
-                        goto invalid;
-                    }
+        if (name->len != cmd->name.len) {
+            continue;
+        }
+
+        if (ngx_strcmp(name->data, cmd->name.data) != 0) {
+            continue;
+        }
 
-                } else if (cf->args->nelts > NGX_CONF_MAX_ARGS) {
+        found = 1;
 
+        /*
+         * QUESTION: 为什么不先判断 module_type，然后再比对 name?
+         *
+         * QUESTION: 为什么 NGX_CONF_MODULE 不参与 type 比对？
+         */
+        if (module->type != NGX_CONF_MODULE
+            && module->type != cf->module_type)
+        {
+            continue;
+        }
+
+        /* is the directive's location right ? */
+
+        /*
+         * NOTE: 这个 type 是用来指明 cmd 的类型(块指令、flag...)、出现的位置、带参数的个数...
+         */
+        if (!(cmd->type & cf->cmd_type)) {
+            continue;
+        }
+
+        /*
+         * NOTE: 只要不是块指令，那么上一次的返回值就得是 NGX_OK？为啥呢？
+         */
+        if (!(cmd->type & NGX_CONF_BLOCK) && last != NGX_OK) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                              "directive \"%s\" is not terminated by \";\"",
+                              name->data);
+            return NGX_ERROR;
+        }
+
+        /*
+         * QUESTION: 不是先解析了 cmd，后面才有 { 么？
+         *           比如 http {...}，先看到 http，然后再看到 {，last 难道不是指
+         *           上一轮解析的返回值么？
+         */
+        if ((cmd->type & NGX_CONF_BLOCK) && last != NGX_CONF_BLOCK_START) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "directive \"%s\" has no opening \"{\"",
+                               name->data);
+            return NGX_ERROR;
+        }
+
+        /* is the directive's argument count right ? */
+
+        if (!(cmd->type & NGX_CONF_ANY)) {
+
+            if (cmd->type & NGX_CONF_FLAG) {
+
+                /*
+                 * NOTE: cf->args 里面也包括了指令本身，比如 flv on;
+                 *       这个和命令行的 argv 类似
+                 */
+                if (cf->args->nelts != 2) {
                     goto invalid;
+                }
 
-                } else if (!(cmd->type & argument_number[cf->args->nelts - 1]))
-                {
+            } else if (cmd->type & NGX_CONF_1MORE) {
+
+                if (cf->args->nelts < 2) {
+                    goto invalid;
+                }
+
+            } else if (cmd->type & NGX_CONF_2MORE) {
+
+                if (cf->args->nelts < 3) {
                     goto invalid;
                 }
+
+            } else if (cf->args->nelts > NGX_CONF_MAX_ARGS) {
+
+                goto invalid;
+
+            } else if (!(cmd->type & argument_number[cf->args->nelts - 1]))
+            {
+                goto invalid;
             }
+        }
 
-            /* set up the directive's configuration context */
+        /* set up the directive's configuration context */
 
+        /*
+         * NOTE: 这一块得好好理解
+         */
+        conf = NULL;
+
+        /*
+         * QUESTION: DIRECT_CONF 和 MAIN_CONF 的区别？
+         *           这两者所处的位置时一样的，都是最顶层
+         *           但是不同的是，DIRECT_CONF 的配置项时需要为这个配置项本身来分配
+         *           内存的，比如说 daemon 这个指令；而 http 这个指令，虽然和 daemon
+         *           是出于同一层级，但是并不需要为 http 指令本身分配内存
+         *
+         * QUESTION:
+         */
+        if (cmd->type & NGX_DIRECT_CONF) {
+            conf = ((void **) cf->ctx)[module->index];
+
+        } else if (cmd->type & NGX_MAIN_CONF) {
             /*
-             * NOTE: 这一块得好好理解
+             * NOTE: 对于 http 这种顶层的配置项，而又不需要为指令本身分配内存，通常
+             *       是需要为其下的指令来分配的内存的，此时把该模块在 conf_ctx 中
+             *       位置的指针传给传给它的 set 回调，由它自己来分配内存，然后把数据
+             *       存进去。
+             *
+             * conf_ctx 里面其实就是一个数组，每个模块占一个槽:
+             * void ****conf_ctx: |ngx_core_module|...|ngx_http_module|...|
+             * 比如对于 http 这个指令，它就是 MAIN_CONF(但是没有 DIRECT_CONF)，
+             * 但是 HTTP 模块的 main/srv/loc_conf 都必须存着，而且具有层级结构，所以
+             * http 模块自己定义 ngx_http_conf_ctx_t:
+             * typedef struct {
+             *     void         **main_conf;
+             *     void         **srv_conf;
+             *     void         **loc_conf;
+             * }
+             * http 模块的实际存储的内容就是这个结构，这种内存分配操作是由 HTTP 模块
+             * 自己做的，同样的还有诸如 RTMP 模块这些，所以 Nginx 能做的就是把它们
+             * 在 conf_ctx 中的槽的【位置】(也就是指针)给 set-callback，让模块自己分配内存，然后
+             * 把结构体放到给如的位置中。
+             *
+             * 然后在 http 指令的 set 回调，也就是 ngx_http_block 函数中：
+             * static char *
+             * ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+             * {
+             *     ...
+             *     if (*(ngx_http_conf_ctx_t **) conf) {
+             *         return "is duplicate";
+             *     }
+             *
+             *     ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_conf_ctx_t));
+             *
+             *     *(ngx_http_conf_ctx_t **) conf = ctx;
+             *     ...
+             * }
+             *
+             * 1. 首先检查传入的位置是不是已经有数据了，有说明 http 指令出现了两次，不 ok。
+             * 2. 然后 HTTP 是用 ngx_http_conf_ctx_t 来存储 HTTP 模块的所有层次的
+             *    配置项的值，所以分配内存，然后放到给定的位置中去
              */
-            conf = NULL;
+            conf = &(((void **) cf->ctx)[module->index]);
 
+        } else if (cf->ctx) {
             /*
-             * QUESTION: DIRECT_CONF 和 MAIN_CONF 的区别？
-             *           这两者所处的位置时一样的，都是最顶层
-             *           但是不同的是，DIRECT_CONF 的配置项时需要为这个配置项本身来分配
-             *           内存的，比如说 daemon 这个指令；而 http 这个指令，虽然和 daemon
-             *           是出于同一层级，但是并不需要为 http 指令本身分配内存
+             * NOTE: 不是 direct_conf，也不是 main_conf，那么
+             *
+             * ATTENTION: 感觉配置项的存储太绕了。尤其是像 HTTP 模块，好几层，怎么统一存储呢？
+             *            可以参考 https://zhuanlan.zhihu.com/p/81731535
+             *
+             * 举个例子：
+             *
+             * http {
+             *     server {
+             *         location ~/.flv {
+             *         flv;
+             *         flv_time_offset         off;
+             *         flv_with_metadata       off;
+             *         flv_buffer_size         512k;
+             *         flv_max_buffer_size     2M;
+             *         }
+             *     }
+             * }
+             *
+             * 这个 flv 相关的配置存在一个结构体中：
+             * typedef struct {
+             *     size_t                buffer_size;
+             *     size_t                max_buffer_size;
+             *     ngx_flag_t            time_offset;
+             *     ngx_flag_t            with_metadata;
+             * } ngx_http_flv_conf_t;
+             *
+             * 比如说 flv_buffer_size 这个配置项，它的 ngx_command_t 定义就是：
+             * { ngx_string("flv_buffer_size"),
+             *   NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+             *   ngx_conf_set_size_slot,
+             *   NGX_HTTP_LOC_CONF_OFFSET,
+             *   offsetof(ngx_http_flv_conf_t, buffer_size),
+             *   NULL },
              *
-             * QUESTION:
+             *
+             * NOTE: 在 parse http{} 内部的配置项，也就是 http 指令的 set 回调 ngx_http_block 方法中
+             * cf->ctx 会被设置为自己 ngx_http_conf_ctx_t 结构体的指针：
+             * typedef struct {
+             *     void        **main_conf;
+             *     void        **srv_conf;
+             *     void        **loc_conf;
+             * } ngx_http_conf_ctx_t;
+             *
+             * 此时 confp = &ngx_http_conf_ctx_t + buffer_size->conf
+             * 对于 flv_buffer_size 这条指令，其 conf 为 NGX_HTTP_LOC_CONF_OFFSET，
+             * 也就是 offsetof(ngx_http_conf_ctx_t, loc_conf)
              */
-            if (cmd->type & NGX_DIRECT_CONF) {
-                conf = ((void **) cf->ctx)[cf->cycle->modules[i]->index];
+            // QUESTION: 这里的 confp 为什么是 void**，它不是对 void** 提领了么？
+            confp = *(void **) ((char *) cf->ctx + cmd->conf);
 
-            } else if (cmd->type & NGX_MAIN_CONF) {
-                /*
-                 * NOTE: 对于 http 这种顶层的配置项，而又不需要为指令本身分配内存，通常
-                 *       是需要为其下的指令来分配的内存的，此时把该模块在 conf_ctx 中
-                 *       位置的指针传给传给它的 set 回调，由它自己来分配内存，然后把数据
-                 *       存进去。
-                 *
-                 * conf_ctx 里面其实就是一个数组，每个模块占一个槽:
-                 * void ****conf_ctx: |ngx_core_module|...|ngx_http_module|...|
-                 * 比如对于 http 这个指令，它就是 MAIN_CONF(但是没有 DIRECT_CONF)，
-                 * 但是 HTTP 模块的 main/srv/loc_conf 都必须存着，而且具有层级结构，所以
-                 * http 模块自己定义 ngx_http_conf_ctx_t:
-                 * typedef struct {
-                 *     void         **main_conf;
-                 *     void         **srv_conf;
-                 *     void         **loc_conf;
-                 * }
-                 * http 模块的实际存储的内容就是这个结构，这种内存分配操作是由 HTTP 模块
-                 * 自己做的，同样的还有诸如 RTMP 模块这些，所以 Nginx 能做的就是把它们
-                 * 在 conf_ctx 中的槽的【位置】(也就是指针)给 set-callback，让模块自己分配内存，然后
-                 * 把结构体放到给如的位置中。
-                 *
-                 * 然后在 http 指令的 set 回调，也就是 ngx_http_block 函数中：
-                 * static char *
-                 * ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
-                 * {
-                 *     ...
-                 *     if (*(ngx_http_conf_ctx_t **) conf) {
-                 *         return "is duplicate";
-                 *     }
-                 *
-                 *     ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_conf_ctx_t));
-                 *
-                 *     *(ngx_http_conf_ctx_t **) conf = ctx;
-                 *     ...
-                 * }
-                 *
-                 * 1. 首先检查传入的位置是不是已经有数据了，有说明 http 指令出现了两次，不 ok。
-                 * 2. 然后 HTTP 是用 ngx_http_conf_ctx_t 来存储 HTTP 模块的所有层次的
-                 *    配置项的值，所以分配内存，然后放到给定的位置中去
-                 */
-                conf = &(((void **) cf->ctx)[cf->cycle->modules[i]->index]);
+            if (confp) {
+                conf = confp[module->ctx_index];
 
-            } else if (cf->ctx) {
-                /*
-                 * NOTE: 不是 direct_conf，也不是 main_conf，那么
-                 *
-                 * ATTENTION: 感觉配置项的存储太绕了。尤其是像 HTTP 模块，好几层，怎么统一存储呢？
-                 *            可以参考 https://zhuanlan.zhihu.com/p/81731535
-                 *
-                 * 举个例子：
-                 *
-                 * http {
-                 *     server {
-                 *         location ~/.flv {
-                 *         flv;
-                 *         flv_time_offset         off;
-                 *         flv_with_metadata       off;
-                 *         flv_buffer_size         512k;
-                 *         flv_max_buffer_size     2M;
-                 *         }
-                 *     }
-                 * }
-                 *
-                 * 这个 flv 相关的配置存在一个结构体中：
-                 * typedef struct {
-                 *     size_t                buffer_size;
-                 *     size_t                max_buffer_size;
-                 *     ngx_flag_t            time_offset;
-                 *     ngx_flag_t            with_metadata;
-                 * } ngx_http_flv_conf_t;
-                 *
-                 * 比如说 flv_buffer_size 这个配置项，它的 ngx_command_t 定义就是：
-                 * { ngx_string("flv_buffer_size"),
-                 *   NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
-                 *   ngx_conf_set_size_slot,
-                 *   NGX_HTTP_LOC_CONF_OFFSET,
-                 *   offsetof(ngx_http_flv_conf_t, buffer_size),
-                 *   NULL },
-                 *
-                 *
-                 * NOTE: 在 parse http{} 内部的配置项，也就是 http 指令的 set 回调 ngx_http_block 方法中
-                 * cf->ctx 会被设置为自己 ngx_http_conf_ctx_t 结构体的指针：
-                 * typedef struct {
-                 *     void        **main_conf;
-                 *     void        **srv_conf;
-                 *     void        **loc_conf;
-                 * } ngx_http_conf_ctx_t;
-                 *
-                 * 此时 confp = &ngx_http_conf_ctx_t + buffer_size->conf
-                 * 对于 flv_buffer_size 这条指令，其 conf 为 NGX_HTTP_LOC_CONF_OFFSET，
-                 * 也就是 offsetof(ngx_http_conf_ctx_t, loc_conf)
-                 */
-                // QUESTION: 这里的 confp 为什么是 void**，它不是对 void** 提领了么？
-                confp = *(void **) ((char *) cf->ctx + cmd->conf);
+                if (conf == NULL && cf->create_conf) {
+                    if (cf->create_conf(cf, cmd, module) != NGX_OK) {
+                        return NGX_ERROR;
+                    }
 
-                if (confp) {
-                    conf = confp[cf->cycle->modules[i]->ctx_index];
+                    conf = confp[module->ctx_index];
                 }
             }
+        }
 
-            rv = cmd->set(cf, cmd, conf);
+        ngx_conf_profile_start(&profile);
 
-            if (rv == NGX_CONF_OK) {
-                return NGX_OK;
-            }
+        rv = cmd->set(cf, cmd, conf);
 
-            if (rv == NGX_CONF_ERROR) {
-                return NGX_ERROR;
-            }
+        ngx_conf_profile_stop(&profile, module, NGX_CONF_PROFILE_DIRECTIVES);
 
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "\"%s\" directive %s", name->data, rv);
+        if (rv == NGX_CONF_OK) {
+            return NGX_OK;
+        }
 
+        if (rv == NGX_CONF_ERROR) {
             return NGX_ERROR;
         }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%s\" directive %s", name->data, rv);
+
+        return NGX_ERROR;
     }
 
     if (found) {
@@ -638,12 +757,12 @@ invalid:
 static ngx_int_t
 ngx_conf_read_token(ngx_conf_t *cf)
 {
-    u_char      *start, ch, *src, *dst;
+    u_char      *start, ch, *src, *dst, *p;
     off_t        file_size;
     size_t       len;
     ssize_t      n, size;
     ngx_uint_t   found, need_space, last_space, sharp_comment, variable;
-    ngx_uint_t   quoted, s_quoted, d_quoted, start_line;
+    ngx_uint_t   quoted, s_quoted, d_quoted, escaped, start_line;
     ngx_str_t   *word;
     ngx_buf_t   *b, *dump;
 
@@ -655,6 +774,7 @@ ngx_conf_read_token(ngx_conf_t *cf)
     quoted = 0;
     s_quoted = 0;
     d_quoted = 0;
+    escaped = 0;
 
     cf->args->nelts = 0;
     b = cf->conf_file->buffer;
@@ -746,6 +866,48 @@ ngx_conf_read_token(ngx_conf_t *cf)
             }
         }
 
+        /*
+         * comments and plain characters of a parameter are skipped
+         * at once, leaving only the characters which matter to the loop
+         */
+
+        if (sharp_comment) {
+            p = ngx_strlchr(b->pos, b->last, LF);
+
+            if (p == NULL) {
+                b->pos = b->last;
+                start = b->pos;
+                continue;
+            }
+
+            b->pos = p;
+
+        } else if (!last_space && !need_space && !quoted && !variable) {
+
+            if (d_quoted || s_quoted) {
+                ch = d_quoted ? '"' : '\'';
+
+                for (p = b->pos; p < b->last; p++) {
+                    if (*p == ch || *p == '\\' || *p == '$' || *p == LF) {
+                        break;
+                    }
+                }
+
+            } else {
+                for (p = b->pos; p < b->last; p++) {
+                    if (ngx_conf_special[*p >> 5] & (1U << (*p & 0x1f))) {
+                        break;
+                    }
+                }
+            }
+
+            b->pos = p;
+
+            if (p == b->last) {
+                continue;
+            }
+        }
+
         ch = *b->pos++;
 
         if (ch == LF) {
@@ -831,6 +993,7 @@ ngx_conf_read_token(ngx_conf_t *cf)
 
             case '\\':
                 quoted = 1;
+                escaped = 1;
                 last_space = 0;
                 continue;
 
@@ -864,6 +1027,7 @@ ngx_conf_read_token(ngx_conf_t *cf)
 
             if (ch == '\\') {
                 quoted = 1;
+                escaped = 1;
                 continue;
             }
 
@@ -904,6 +1068,14 @@ ngx_conf_read_token(ngx_conf_t *cf)
                     return NGX_ERROR;
                 }
 
+                if (!escaped) {
+                    len = b->pos - 1 - start;
+                    ngx_memcpy(word->data, start, len);
+                    word->data[len] = '\0';
+                    word->len = len;
+                    goto done;
+                }
+
                 for (dst = word->data, src = start, len = 0;
                      src < b->pos - 1;
                      len++)
@@ -938,6 +1110,10 @@ ngx_conf_read_token(ngx_conf_t *cf)
                 *dst = '\0';
                 word->len = len;
 
+                escaped = 0;
+
+            done:
+
                 if (ch == ';') {
                     return NGX_OK;
                 }
@@ -953,6 +1129,135 @@ ngx_conf_read_token(ngx_conf_t *cf)
 }
 
 
+ngx_int_t
+ngx_conf_profile_init(void)
+{
+    ngx_conf_profile_times = ngx_calloc(ngx_max_module
+                                        * NGX_CONF_PROFILE_STAGES
+                                        * sizeof(uint64_t),
+                                        ngx_cycle->log);
+    if (ngx_conf_profile_times == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_conf_profiling = 1;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_conf_profile_begin(ngx_conf_profile_t *profile)
+{
+    profile->start = ngx_conf_profile_now();
+    profile->nested = ngx_conf_profile_nested;
+
+    ngx_conf_profile_nested = 0;
+}
+
+
+void
+ngx_conf_profile_end(ngx_conf_profile_t *profile, ngx_module_t *module,
+    ngx_uint_t stage)
+{
+    uint64_t  elapsed;
+
+    elapsed = ngx_conf_profile_now() - profile->start;
+
+    if (module == NULL) {
+        ngx_conf_profile_total = elapsed;
+
+    } else {
+        ngx_conf_profile_times[module->index * NGX_CONF_PROFILE_STAGES
+                               + stage] += elapsed - ngx_conf_profile_nested;
+    }
+
+    ngx_conf_profile_nested = profile->nested + elapsed;
+}
+
+
+void
+ngx_conf_profile_report(ngx_cycle_t *cycle)
+{
+    char        *name;
+    uint64_t     t;
+    ngx_uint_t   i, m, n, *rows;
+
+    rows = ngx_alloc(ngx_max_module * NGX_CONF_PROFILE_STAGES
+                     * sizeof(ngx_uint_t), cycle->log);
+    if (rows == NULL) {
+        return;
+    }
+
+    n = 0;
+
+    for (i = 0; i < ngx_max_module * NGX_CONF_PROFILE_STAGES; i++) {
+        if (ngx_conf_profile_times[i]) {
+            rows[n++] = i;
+        }
+    }
+
+    ngx_qsort(rows, n, sizeof(ngx_uint_t), ngx_conf_profile_cmp);
+
+    t = ngx_conf_profile_total;
+
+    ngx_log_stderr(0, "startup profile: %uL.%03uL ms total",
+                   t / 1000, t % 1000);
+
+    for (i = 0; i < n; i++) {
+        t = ngx_conf_profile_times[rows[i]];
+
+        name = "unknown";
+
+        for (m = 0; m < cycle->modules_n; m++) {
+            if (cycle->modules[m]->index == rows[i] / NGX_CONF_PROFILE_STAGES)
+            {
+                name = cycle->modules[m]->name;
+                break;
+            }
+        }
+
+        ngx_log_stderr(0, "%8uL.%03uL ms  %s %s", t / 1000, t % 1000, name,
+                       ngx_conf_profile_stages[rows[i]
+                                               % NGX_CONF_PROFILE_STAGES]);
+    }
+
+    ngx_free(rows);
+}
+
+
+static int ngx_libc_cdecl
+ngx_conf_profile_cmp(const void *one, const void *two)
+{
+    uint64_t  a, b;
+
+    a = ngx_conf_profile_times[*(ngx_uint_t *) one];
+    b = ngx_conf_profile_times[*(ngx_uint_t *) two];
+
+    return (a < b) - (a > b);
+}
+
+
+static uint64_t
+ngx_conf_profile_now(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+
 char *
 ngx_conf_include(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -111,6 +111,8 @@ typedef struct {
 
 typedef char *(*ngx_conf_handler_pt)(ngx_conf_t *cf,
     ngx_command_t *dummy, void *conf);
+typedef ngx_int_t (*ngx_conf_create_pt)(ngx_conf_t *cf, ngx_command_t *cmd,
+    ngx_module_t *module);
 
 
 struct ngx_conf_s {
@@ -129,9 +131,57 @@ struct ngx_conf_s {
 
     ngx_conf_handler_pt   handler;
     void                 *handler_conf;
+
+    /* creates a conf which was not created with its context */
+    ngx_conf_create_pt    create_conf;
+};
+
+
+#define NGX_CONF_DIRECTIVES_HASH  1024
+
+
+typedef struct ngx_conf_directive_s  ngx_conf_directive_t;
+
+struct ngx_conf_directive_s {
+    ngx_command_t            *cmd;
+    ngx_module_t             *module;
+    ngx_conf_directive_t     *next;
+};
+
+
+/* the commands of all modules of a cycle hashed by name */
+
+struct ngx_conf_directives_s {
+    ngx_conf_directive_t     *buckets[NGX_CONF_DIRECTIVES_HASH];
+    ngx_uint_t                modules_n;
 };
 
 
+#define NGX_CONF_PROFILE_DIRECTIVES         0
+#define NGX_CONF_PROFILE_CREATE_CONF        1
+#define NGX_CONF_PROFILE_PRECONFIGURATION   2
+#define NGX_CONF_PROFILE_INIT_CONF          3
+#define NGX_CONF_PROFILE_MERGE_CONF         4
+#define NGX_CONF_PROFILE_POSTCONFIGURATION  5
+#define NGX_CONF_PROFILE_INIT_MODULE        6
+#define NGX_CONF_PROFILE_STAGES             7
+
+
+/* times are in microseconds, nested profiled calls are not counted */
+
+typedef struct {
+    uint64_t                  start;
+    uint64_t                  nested;
+} ngx_conf_profile_t;
+
+
+#define ngx_conf_profile_start(profile)                                       \
+    if (ngx_conf_profiling) ngx_conf_profile_begin(profile)
+
+#define ngx_conf_profile_stop(profile, module, stage)                         \
+    if (ngx_conf_profiling) ngx_conf_profile_end(profile, module, stage)
+
+
 typedef char *(*ngx_conf_post_handler_pt) (ngx_conf_t *cf,
     void *data, void *conf);
 
@@ -265,6 +315,12 @@ char *ngx_conf_check_num_bounds(ngx_conf_t *cf, void *post, void *data);
     }
 
 
+ngx_int_t ngx_conf_profile_init(void);
+void ngx_conf_profile_begin(ngx_conf_profile_t *profile);
+void ngx_conf_profile_end(ngx_conf_profile_t *profile, ngx_module_t *module,
+    ngx_uint_t stage);
+void ngx_conf_profile_report(ngx_cycle_t *cycle);
+
 char *ngx_conf_param(ngx_conf_t *cf);
 char *ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename);
 char *ngx_conf_include(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
@@ -292,4 +348,7 @@ char *ngx_conf_set_enum_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 char *ngx_conf_set_bitmask_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 
+extern ngx_uint_t  ngx_conf_profiling;
+
+
 #endif /* _NGX_CONF_FILE_H_INCLUDED_ */
@@ -44,6 +44,14 @@
 #endif
 
 
+#if (NGX_HAVE_SSE2)
+#include <emmintrin.h>
+
+#elif (NGX_HAVE_NEON)
+#include <arm_neon.h>
+#endif
+
+
 #ifndef NGX_HAVE_SO_SNDLOWAT
 #define NGX_HAVE_SO_SNDLOWAT     1
 #endif
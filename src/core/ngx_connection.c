@@ -14,6 +14,13 @@ ngx_os_io_t  ngx_io;
 
 
 static void ngx_drain_connections(ngx_cycle_t *cycle);
+#if (NGX_HAVE_REUSEPORT_CBPF)
+static void ngx_steer_reuseport(ngx_cycle_t *cycle, ngx_listening_t *ls);
+#if (NGX_QUIC)
+static void ngx_steer_quic_reuseport(ngx_cycle_t *cycle,
+    ngx_listening_t *ls);
+#endif
+#endif
 
 
 ngx_listening_t *
@@ -91,6 +98,10 @@ ngx_create_listening(ngx_conf_t *cf, struct sockaddr *sockaddr,
     ls->fastopen = -1;
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+    ls->busy_poll = -1;
+#endif
+
     return ls;
 }
 
@@ -848,6 +859,39 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
         }
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+        if (ls[i].busy_poll != -1) {
+
+            /* accepted sockets inherit the options of the listening one */
+
+            if (setsockopt(ls[i].fd, SOL_SOCKET, SO_BUSY_POLL,
+                           (const void *) &ls[i].busy_poll, sizeof(int))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                              "setsockopt(SO_BUSY_POLL, %d) %V failed, "
+                              "ignored", ls[i].busy_poll, &ls[i].addr_text);
+            }
+
+            value = (ls[i].busy_poll != 0);
+
+            if (setsockopt(ls[i].fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+                           (const void *) &value, sizeof(int))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                              "setsockopt(SO_PREFER_BUSY_POLL) %V failed, "
+                              "ignored", &ls[i].addr_text);
+            }
+        }
+#endif
+
+#if (NGX_HAVE_REUSEPORT_CBPF)
+        if (ls[i].reuseport && ls[i].worker == 0) {
+            ngx_steer_reuseport(cycle, &ls[i]);
+        }
+#endif
+
 #if 0
         if (1) {
             int tcp_nodelay = 1;
@@ -1303,6 +1347,166 @@ ngx_reusable_connection(ngx_connection_t *c, ngx_uint_t reusable)
 }
 
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+
+/*
+ * With "reuseport_steering" a connection is passed to the worker bound to
+ * the CPU which received it: the sockets of a reuseport group are indexed
+ * in the order they are opened, that is, by worker number, and the program
+ * maps each CPU to the first worker allowed to run on it.  With
+ * "worker_cpu_affinity auto numa" the other CPUs of a node are mapped to
+ * the workers of the node in turn.  An index past the group, returned for
+ * the rest of CPUs, falls back to the hash.
+ */
+
+static void
+ngx_steer_reuseport(ngx_cycle_t *cycle, ngx_listening_t *ls)
+{
+    ngx_int_t            node;
+    ngx_uint_t           cpu, w, n, k, nworkers, rank[NGX_NUMA_MAX_NODES];
+    ngx_cpuset_t        *mask;
+    ngx_core_conf_t     *ccf;
+    struct sock_fprog    prog;
+    struct sock_filter  *code;
+
+#if (NGX_QUIC)
+    if (ls->quic) {
+        ngx_steer_quic_reuseport(cycle, ls);
+        return;
+    }
+#endif
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (!ccf->reuseport_steering) {
+        return;
+    }
+
+    code = ngx_alloc((2 * CPU_SETSIZE + 2) * sizeof(struct sock_filter),
+                     cycle->log);
+    if (code == NULL) {
+        return;
+    }
+
+    nworkers = ccf->worker_processes;
+    ngx_memzero(rank, sizeof(rank));
+
+    n = 0;
+    code[n++] = (struct sock_filter)
+                BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+
+        for (w = 0; w < nworkers; w++) {
+            mask = ngx_get_cpu_affinity(cycle, w);
+
+            if (mask && CPU_ISSET(cpu, mask)) {
+                goto found;
+            }
+        }
+
+        if (!ccf->cpu_affinity_numa) {
+            continue;
+        }
+
+        node = ccf->cpu_nodes[cpu];
+
+        if (node == -1) {
+            continue;
+        }
+
+        for (w = 0, k = 0; w < nworkers; w++) {
+            if (ccf->cpu_affinity_node[w] == node) {
+                k++;
+            }
+        }
+
+        if (k == 0) {
+            continue;
+        }
+
+        k = rank[node]++ % k;
+
+        for (w = 0; w < nworkers; w++) {
+            if (ccf->cpu_affinity_node[w] == node && k-- == 0) {
+                break;
+            }
+        }
+
+    found:
+
+        code[n++] = (struct sock_filter)
+                    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, cpu, 0, 1);
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, w);
+    }
+
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, 0xffffffff);
+
+    prog.len = n;
+    prog.filter = code;
+
+    if (setsockopt(ls->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   &prog, sizeof(struct sock_fprog))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_ATTACH_REUSEPORT_CBPF) %V failed, "
+                      "ignored", &ls->addr_text);
+    }
+
+    ngx_free(code);
+}
+
+
+#if (NGX_QUIC)
+
+/*
+ * QUIC packets are passed to the worker which owns the connection: the
+ * connection ids issued by the server start with the worker number, and
+ * the rest of packets, mostly initial ones with ids chosen by clients,
+ * fall back to the hash
+ */
+
+static void
+ngx_steer_quic_reuseport(ngx_cycle_t *cycle, ngx_listening_t *ls)
+{
+    struct sock_fprog    prog;
+    struct sock_filter   code[] = {
+
+        /* the first byte of the UDP payload */
+        BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x80, 0, 5),
+
+        /* a long header: the dcid length and the dcid */
+        BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 5),
+        BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, NGX_QUIC_SERVER_CID_LEN, 1, 0),
+        BPF_STMT(BPF_RET|BPF_K, 0xffffffff),
+        BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 6),
+        BPF_STMT(BPF_RET|BPF_A, 0),
+
+        /* a short header: the dcid follows the first byte */
+        BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 1),
+        BPF_STMT(BPF_RET|BPF_A, 0)
+    };
+
+    prog.len = sizeof(code) / sizeof(struct sock_filter);
+    prog.filter = code;
+
+    if (setsockopt(ls->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   &prog, sizeof(struct sock_fprog))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_ATTACH_REUSEPORT_CBPF) %V failed, "
+                      "ignored", &ls->addr_text);
+    }
+}
+
+#endif
+
+#endif
+
+
 static void
 ngx_drain_connections(ngx_cycle_t *cycle)
 {
@@ -1335,15 +1539,15 @@ ngx_close_idle_connections(ngx_cycle_t *cycle)
     ngx_uint_t         i;
     ngx_connection_t  *c;
 
-    c = cycle->connections;
-
     for (i = 0; i < cycle->connection_n; i++) {
 
+        c = ngx_cycle_connection(cycle, i);
+
         /* THREAD: lock */
 
-        if (c[i].fd != (ngx_socket_t) -1 && c[i].idle) {
-            c[i].close = 1;
-            c[i].read->handler(c[i].read);
+        if (c->fd != (ngx_socket_t) -1 && c->idle) {
+            c->close = 1;
+            c->read->handler(c->read);
         }
     }
 }
@@ -1464,6 +1668,84 @@ ngx_tcp_nodelay(ngx_connection_t *c)
 }
 
 
+/*
+ * the options are not set on connections where TCP_NODELAY is disabled,
+ * that is, on unix domain sockets and on fake HTTP/2 stream connections
+ */
+
+ngx_int_t
+ngx_tcp_notsent_lowat(ngx_connection_t *c, size_t lowat)
+{
+#if (NGX_HAVE_TCP_NOTSENT_LOWAT)
+    int  value;
+
+    if (c->notsent_lowat == lowat
+        || c->tcp_nodelay == NGX_TCP_NODELAY_DISABLED)
+    {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, c->log, 0,
+                   "tcp_notsent_lowat: %uz", lowat);
+
+    /* zero means the net.ipv4.tcp_notsent_lowat value */
+
+    value = (int) lowat;
+
+    if (setsockopt(c->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                   (const void *) &value, sizeof(int))
+        == -1)
+    {
+        ngx_connection_error(c, ngx_socket_errno,
+                             "setsockopt(TCP_NOTSENT_LOWAT) failed");
+        return NGX_ERROR;
+    }
+
+    c->notsent_lowat = lowat;
+#endif
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_tcp_pacing_rate(ngx_connection_t *c, size_t rate)
+{
+#if (NGX_HAVE_SO_MAX_PACING_RATE)
+    unsigned int  value;
+
+    if (c->pacing_rate == rate
+        || c->tcp_nodelay == NGX_TCP_NODELAY_DISABLED)
+    {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, c->log, 0,
+                   "tcp_pacing_rate: %uz", rate);
+
+    if (rate == 0 || rate > NGX_MAX_UINT32_VALUE) {
+        value = NGX_MAX_UINT32_VALUE;
+
+    } else {
+        value = (unsigned int) rate;
+    }
+
+    if (setsockopt(c->fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+                   (const void *) &value, sizeof(unsigned int))
+        == -1)
+    {
+        ngx_connection_error(c, ngx_socket_errno,
+                             "setsockopt(SO_MAX_PACING_RATE) failed");
+        return NGX_ERROR;
+    }
+
+    c->pacing_rate = rate;
+#endif
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_connection_error(ngx_connection_t *c, ngx_err_t err, char *text)
 {
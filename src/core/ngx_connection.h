@@ -53,6 +53,7 @@ struct ngx_listening_s {
 
     ngx_rbtree_t        rbtree;
     ngx_rbtree_node_t   sentinel;
+    ngx_udp_flows_t    *flows;
 
     ngx_uint_t          worker;
 
@@ -75,6 +76,7 @@ struct ngx_listening_s {
     unsigned            reuseport:1;
     unsigned            add_reuseport:1;
     unsigned            keepalive:2;
+    unsigned            quic:1;
 
     unsigned            deferred_accept:1;
     unsigned            delete_deferred:1;
@@ -90,6 +92,10 @@ struct ngx_listening_s {
     int                 fastopen;
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+    int                 busy_poll;
+#endif
+
 };
 
 
@@ -116,6 +122,13 @@ typedef enum {
 } ngx_connection_tcp_nopush_e;
 
 
+/* connections are placed in cycle->connections with a stride */
+
+#define ngx_cycle_connection(cycle, i)                                        \
+    ((ngx_connection_t *) ((u_char *) (cycle)->connections                    \
+                           + (i) * (cycle)->connection_size))
+
+
 #define NGX_LOWLEVEL_BUFFERED  0x0f
 #define NGX_SSL_BUFFERED       0x01
 #define NGX_HTTP_V2_BUFFERED   0x02
@@ -155,6 +168,10 @@ struct ngx_connection_s {
 
     ngx_udp_connection_t  *udp;
 
+#if (NGX_QUIC)
+    ngx_quic_connection_t  *quic;
+#endif
+
     struct sockaddr    *local_sockaddr;
     socklen_t           local_socklen;
 
@@ -193,6 +210,18 @@ struct ngx_connection_s {
 #if (NGX_THREADS || NGX_COMPAT)
     ngx_thread_task_t  *sendfile_task;
 #endif
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    ngx_zerocopy_t     *zerocopy;
+#endif
+
+    /* TCP_NOTSENT_LOWAT and SO_MAX_PACING_RATE set, 0 if not */
+    size_t              notsent_lowat;
+    size_t              pacing_rate;
+
+    /* bytes read in an iteration of the event loop, see "read_budget" */
+    ngx_uint_t          budget_iteration;
+    size_t              budget_used;
 };
 
 
@@ -219,6 +248,8 @@ void ngx_close_idle_connections(ngx_cycle_t *cycle);
 ngx_int_t ngx_connection_local_sockaddr(ngx_connection_t *c, ngx_str_t *s,
     ngx_uint_t port);
 ngx_int_t ngx_tcp_nodelay(ngx_connection_t *c);
+ngx_int_t ngx_tcp_notsent_lowat(ngx_connection_t *c, size_t lowat);
+ngx_int_t ngx_tcp_pacing_rate(ngx_connection_t *c, size_t rate);
 ngx_int_t ngx_connection_error(ngx_connection_t *c, ngx_err_t err, char *text);
 
 ngx_connection_t *ngx_get_connection(ngx_socket_t s, ngx_log_t *log);
@@ -9,6 +9,14 @@
 #include <ngx_core.h>
 
 
+#if (NGX_HAVE_ARM_CRC32)
+#include <sys/auxv.h>
+#endif
+
+
+ngx_uint_t  ngx_cpu_features;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
@@ -91,6 +99,18 @@ ngx_cpuinfo(void)
 
     ngx_cpuid(1, cpu);
 
+    /* ECX bit 1: carry-less multiplication */
+
+    if (cpu[3] & 0x2) {
+        ngx_cpu_features |= NGX_CPU_PCLMUL;
+    }
+
+    /* ECX bit 9: supplemental SSE3 */
+
+    if (cpu[3] & 0x200) {
+        ngx_cpu_features |= NGX_CPU_SSSE3;
+    }
+
     if (ngx_strcmp(vendor, "GenuineIntel") == 0) {
 
         switch ((cpu[0] & 0xf00) >> 8) {
@@ -127,6 +147,18 @@ ngx_cpuinfo(void)
     }
 }
 
+#elif (NGX_HAVE_ARM_CRC32)
+
+
+void
+ngx_cpuinfo(void)
+{
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        ngx_cpu_features |= NGX_CPU_CRC32;
+    }
+}
+
+
 #else
 
 
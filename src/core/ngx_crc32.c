@@ -8,6 +8,12 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+#if (NGX_HAVE_PCLMUL)
+#include <wmmintrin.h>
+#elif (NGX_HAVE_ARM_CRC32)
+#include <arm_acle.h>
+#endif
+
 
 /*
  * The code and lookup tables are based on the algorithm
@@ -101,12 +107,169 @@ uint32_t  ngx_crc32_table256[] = {
 
 uint32_t *ngx_crc32_table_short = ngx_crc32_table16;
 
+ngx_crc32_hw_pt  ngx_crc32_hw;
+
+
+#if (NGX_HAVE_PCLMUL)
+
+/*
+ * The same IEEE 802.3 polynomial as in the tables above, computed by folding
+ * 64-byte blocks with carry-less multiplication, see Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ * The crc is the internal (not inverted) value, len is at least 64 bytes,
+ * and the tail which is not a multiple of 16 bytes is processed by the table.
+ */
+
+__attribute__((target("sse2,pclmul")))
+static uint32_t
+ngx_crc32_pclmul(uint32_t crc, u_char *p, size_t len)
+{
+    size_t   tail;
+    __m128i  x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+    __m128i  k1k2, k3k4, k5k0, poly, mask;
+
+    k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+
+    tail = len & 0xf;
+
+    x1 = _mm_loadu_si128((__m128i *) (p + 0x00));
+    x2 = _mm_loadu_si128((__m128i *) (p + 0x10));
+    x3 = _mm_loadu_si128((__m128i *) (p + 0x20));
+    x4 = _mm_loadu_si128((__m128i *) (p + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+
+    p += 64;
+    len -= 64 + tail;
+
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        y5 = _mm_loadu_si128((__m128i *) (p + 0x00));
+        y6 = _mm_loadu_si128((__m128i *) (p + 0x10));
+        y7 = _mm_loadu_si128((__m128i *) (p + 0x20));
+        y8 = _mm_loadu_si128((__m128i *) (p + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        p += 64;
+        len -= 64;
+    }
+
+    /* fold into 128 bits */
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((__m128i *) p);
+
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        p += 16;
+        len -= 16;
+    }
+
+    /* fold 128 bits to 64 bits */
+
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    crc = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+    while (tail--) {
+        crc = ngx_crc32_table256[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#elif (NGX_HAVE_ARM_CRC32)
+
+__attribute__((target("+crc")))
+static uint32_t
+ngx_crc32_arm(uint32_t crc, u_char *p, size_t len)
+{
+    while (len && ((uintptr_t) p & 7)) {
+        crc = __crc32b(crc, *p++);
+        len--;
+    }
+
+    while (len >= 8) {
+        crc = __crc32d(crc, *(uint64_t *) p);
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = __crc32b(crc, *p++);
+    }
+
+    return crc;
+}
+
+#endif
+
 
 ngx_int_t
 ngx_crc32_table_init(void)
 {
     void  *p;
 
+#if (NGX_HAVE_PCLMUL)
+
+    if (ngx_cpu_features & NGX_CPU_PCLMUL) {
+        ngx_crc32_hw = ngx_crc32_pclmul;
+    }
+
+#elif (NGX_HAVE_ARM_CRC32)
+
+    if (ngx_cpu_features & NGX_CPU_CRC32) {
+        ngx_crc32_hw = ngx_crc32_arm;
+    }
+
+#endif
+
     if (((uintptr_t) ngx_crc32_table_short
           & ~((uintptr_t) ngx_cacheline_size - 1))
         == (uintptr_t) ngx_crc32_table_short)
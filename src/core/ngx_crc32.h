@@ -17,6 +17,15 @@ extern uint32_t  *ngx_crc32_table_short;
 extern uint32_t   ngx_crc32_table256[];
 
 
+/* the hardware assisted CRC32 of the internal (not inverted) value */
+
+#define NGX_CRC32_HW_MIN  64
+
+typedef uint32_t (*ngx_crc32_hw_pt)(uint32_t crc, u_char *p, size_t len);
+
+extern ngx_crc32_hw_pt  ngx_crc32_hw;
+
+
 static ngx_inline uint32_t
 ngx_crc32_short(u_char *p, size_t len)
 {
@@ -42,6 +51,10 @@ ngx_crc32_long(u_char *p, size_t len)
 
     crc = 0xffffffff;
 
+    if (ngx_crc32_hw && len >= NGX_CRC32_HW_MIN) {
+        return ngx_crc32_hw(crc, p, len) ^ 0xffffffff;
+    }
+
     while (len--) {
         crc = ngx_crc32_table256[(crc ^ *p++) & 0xff] ^ (crc >> 8);
     }
@@ -59,6 +72,11 @@ ngx_crc32_update(uint32_t *crc, u_char *p, size_t len)
 {
     uint32_t  c;
 
+    if (ngx_crc32_hw && len >= NGX_CRC32_HW_MIN) {
+        *crc = ngx_crc32_hw(*crc, p, len);
+        return;
+    }
+
     c = *crc;
 
     while (len--) {
@@ -191,6 +191,7 @@ ngx_crypt_ssha(ngx_pool_t *pool, u_char *key, u_char *salt, u_char **encrypted)
     ngx_int_t    rc;
     ngx_str_t    encoded, decoded;
     ngx_sha1_t   sha1;
+    u_char       buf[64];
 
     /* "{SSHA}" base64(SHA1(key salt) salt) */
 
@@ -201,9 +202,16 @@ ngx_crypt_ssha(ngx_pool_t *pool, u_char *key, u_char *salt, u_char **encrypted)
 
     len = ngx_max(ngx_base64_decoded_length(encoded.len), 20);
 
-    decoded.data = ngx_pnalloc(pool, len);
-    if (decoded.data == NULL) {
-        return NGX_ERROR;
+    /* the usual salts fit on the stack */
+
+    if (len <= sizeof(buf)) {
+        decoded.data = buf;
+
+    } else {
+        decoded.data = ngx_pnalloc(pool, len);
+        if (decoded.data == NULL) {
+            return NGX_ERROR;
+        }
     }
 
     rc = ngx_decode_base64(&decoded, &encoded);
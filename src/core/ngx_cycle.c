@@ -57,7 +57,9 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     ngx_open_file_t     *file;
     ngx_listening_t     *ls, *nls;
     ngx_core_conf_t     *ccf, *old_ccf;
+    ngx_shm_policy_t    *policy;
     ngx_core_module_t   *module;
+    ngx_conf_profile_t   profile;
     char                 hostname[NGX_MAXHOSTNAMELEN];
 
     ngx_timezone_update();
@@ -246,7 +248,13 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         module = cycle->modules[i]->ctx;
 
         if (module->create_conf) {
+            ngx_conf_profile_start(&profile);
+
             rv = module->create_conf(cycle);
+
+            ngx_conf_profile_stop(&profile, cycle->modules[i],
+                                  NGX_CONF_PROFILE_CREATE_CONF);
+
             if (rv == NULL) {
                 ngx_destroy_pool(pool);
                 return NULL;
@@ -317,10 +325,15 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         module = cycle->modules[i]->ctx;
 
         if (module->init_conf) {
-            if (module->init_conf(cycle,
-                                  cycle->conf_ctx[cycle->modules[i]->index])
-                == NGX_CONF_ERROR)
-            {
+            ngx_conf_profile_start(&profile);
+
+            rv = module->init_conf(cycle,
+                                   cycle->conf_ctx[cycle->modules[i]->index]);
+
+            ngx_conf_profile_stop(&profile, cycle->modules[i],
+                                  NGX_CONF_PROFILE_INIT_CONF);
+
+            if (rv == NGX_CONF_ERROR) {
                 environ = senv;
                 ngx_destroy_cycle_pools(&conf);
                 return NULL;
@@ -454,6 +467,36 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
         shm_zone[i].shm.log = cycle->log;
 
+        policy = ccf->shm_policies.elts;
+
+        for (n = 0; n < ccf->shm_policies.nelts; n++) {
+            if (policy[n].name.len == shm_zone[i].shm.name.len
+                && ngx_strncmp(policy[n].name.data, shm_zone[i].shm.name.data,
+                               policy[n].name.len)
+                   == 0)
+            {
+                shm_zone[i].shm.huge = policy[n].huge;
+                shm_zone[i].shm.numa = policy[n].numa;
+                policy[n].used = 1;
+
+                if (policy[n].file.len == 0) {
+                    break;
+                }
+
+                if (shm_zone[i].shm.layout) {
+                    shm_zone[i].shm.file = policy[n].file;
+
+                } else {
+                    ngx_log_error(NGX_LOG_WARN, log, 0,
+                                  "shared memory zone \"%V\" "
+                                  "cannot be persistent",
+                                  &shm_zone[i].shm.name);
+                }
+
+                break;
+            }
+        }
+
         opart = &old_cycle->shared_memory.part;
         oshm_zone = opart->elts;
 
@@ -482,12 +525,23 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
             if (shm_zone[i].tag == oshm_zone[n].tag
                 && shm_zone[i].shm.size == oshm_zone[n].shm.size
+                && shm_zone[i].shm.huge == oshm_zone[n].shm.huge
+                && shm_zone[i].shm.numa == oshm_zone[n].shm.numa
+                && ngx_memn2cmp(shm_zone[i].shm.file.data,
+                                oshm_zone[n].shm.file.data,
+                                shm_zone[i].shm.file.len,
+                                oshm_zone[n].shm.file.len)
+                   == 0
                 && !shm_zone[i].noreuse)
             {
                 shm_zone[i].shm.addr = oshm_zone[n].shm.addr;
+                shm_zone[i].shm.page_size = oshm_zone[n].shm.page_size;
 #if (NGX_WIN32)
                 shm_zone[i].shm.handle = oshm_zone[n].shm.handle;
 #endif
+#if (NGX_SHM_PERSISTENT)
+                shm_zone[i].shm.fd = oshm_zone[n].shm.fd;
+#endif
 
                 if (shm_zone[i].init(&shm_zone[i], oshm_zone[n].data)
                     != NGX_OK)
@@ -530,6 +584,16 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         continue;
     }
 
+    policy = ccf->shm_policies.elts;
+
+    for (n = 0; n < ccf->shm_policies.nelts; n++) {
+        if (!policy[n].used) {
+            ngx_log_error(NGX_LOG_WARN, log, 0,
+                          "shared memory policy for unknown zone \"%V\"",
+                          &policy[n].name);
+        }
+    }
+
 
     /* handle the listening sockets */
 
@@ -716,6 +780,13 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
             if (oshm_zone[i].tag == shm_zone[n].tag
                 && oshm_zone[i].shm.size == shm_zone[n].shm.size
+                && oshm_zone[i].shm.huge == shm_zone[n].shm.huge
+                && oshm_zone[i].shm.numa == shm_zone[n].shm.numa
+                && ngx_memn2cmp(oshm_zone[i].shm.file.data,
+                                shm_zone[n].shm.file.data,
+                                oshm_zone[i].shm.file.len,
+                                shm_zone[n].shm.file.len)
+                   == 0
                 && !oshm_zone[i].noreuse)
             {
                 goto live_shm_zone;
@@ -934,6 +1005,13 @@ failed:
 
             if (shm_zone[i].tag == oshm_zone[n].tag
                 && shm_zone[i].shm.size == oshm_zone[n].shm.size
+                && shm_zone[i].shm.huge == oshm_zone[n].shm.huge
+                && shm_zone[i].shm.numa == oshm_zone[n].shm.numa
+                && ngx_memn2cmp(shm_zone[i].shm.file.data,
+                                oshm_zone[n].shm.file.data,
+                                shm_zone[i].shm.file.len,
+                                oshm_zone[n].shm.file.len)
+                   == 0
                 && !shm_zone[i].noreuse)
             {
                 goto old_shm_zone_found;
@@ -995,7 +1073,17 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
          * NOTE: 新分配的内存都是 0 值，所以如果 sp == sp->addr，那么说明已经初始化过了
          */
         if (sp == sp->addr) {
-            return NGX_OK;
+
+            if (!zn->shm.restored) {
+                return NGX_OK;
+            }
+
+            /* a previous master process might have left the mutex locked */
+
+            ngx_memzero(&sp->mutex, sizeof(ngx_shmtx_t));
+            ngx_memzero(&sp->lock, sizeof(ngx_shmtx_sh_t));
+
+            goto mutex;
         }
 
 #if (NGX_WIN32)
@@ -1024,6 +1112,8 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
     sp->min_shift = 3;
     sp->addr = zn->shm.addr;
 
+mutex:
+
 #if (NGX_HAVE_ATOMIC_OPS)
 
     file = NULL;
@@ -1044,6 +1134,10 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
         return NGX_ERROR;
     }
 
+    if (zn->shm.restored) {
+        return NGX_OK;
+    }
+
     ngx_slab_init(sp);
 
     return NGX_OK;
@@ -1414,6 +1508,12 @@ ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
     shm_zone->shm.size = size;
     shm_zone->shm.name = *name;
     shm_zone->shm.exists = 0;
+    shm_zone->shm.huge = NGX_SHM_HUGE_OFF;
+    shm_zone->shm.numa = NGX_SHM_NUMA_DEFAULT;
+    shm_zone->shm.page_size = 0;
+    ngx_str_null(&shm_zone->shm.file);
+    shm_zone->shm.layout = 0;
+    shm_zone->shm.restored = 0;
     shm_zone->init = NULL;
     shm_zone->tag = tag;
     shm_zone->noreuse = 0;
@@ -1446,7 +1546,7 @@ ngx_clean_old_cycles(ngx_event_t *ev)
         found = 0;
 
         for (n = 0; n < cycle[i]->connection_n; n++) {
-            if (cycle[i]->connections[n].fd != (ngx_socket_t) -1) {
+            if (ngx_cycle_connection(cycle[i], n)->fd != (ngx_socket_t) -1) {
                 found = 1;
 
                 ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0, "live fd:%ui", n);
@@ -1506,25 +1606,25 @@ ngx_shutdown_timer_handler(ngx_event_t *ev)
 
     cycle = ev->data;
 
-    c = cycle->connections;
-
     for (i = 0; i < cycle->connection_n; i++) {
 
-        if (c[i].fd == (ngx_socket_t) -1
-            || c[i].read == NULL
-            || c[i].read->accept
-            || c[i].read->channel
-            || c[i].read->resolver)
+        c = ngx_cycle_connection(cycle, i);
+
+        if (c->fd == (ngx_socket_t) -1
+            || c->read == NULL
+            || c->read->accept
+            || c->read->channel
+            || c->read->resolver)
         {
             continue;
         }
 
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
-                       "*%uA shutdown timeout", c[i].number);
+                       "*%uA shutdown timeout", c->number);
 
-        c[i].close = 1;
-        c[i].error = 1;
+        c->close = 1;
+        c->error = 1;
 
-        c[i].read->handler(c[i].read);
+        c->read->handler(c->read);
     }
 }
@@ -22,6 +22,10 @@
 #define NGX_DEBUG_POINTS_ABORT  2
 
 
+#define NGX_CACHE_MANAGER_PROCESS  0
+#define NGX_CACHE_MANAGER_THREADS  1
+
+
 typedef struct ngx_shm_zone_s  ngx_shm_zone_t;
 
 typedef ngx_int_t (*ngx_shm_zone_init_pt) (ngx_shm_zone_t *zone, void *data);
@@ -61,6 +65,8 @@ struct ngx_cycle_s {
     ngx_uint_t                modules_n;
     ngx_uint_t                modules_used;    /* unsigned  modules_used:1; */
 
+    ngx_conf_directives_t    *directives;
+
     ngx_queue_t               reusable_connections_queue;
     ngx_uint_t                reusable_connections_n;
 
@@ -80,6 +86,7 @@ struct ngx_cycle_s {
     ngx_uint_t                files_n;
 
     ngx_connection_t         *connections;
+    size_t                    connection_size;
     ngx_event_t              *read_events;
     ngx_event_t              *write_events;
 
@@ -94,12 +101,26 @@ struct ngx_cycle_s {
 };
 
 
+typedef struct {
+    ngx_str_t                 name;
+    ngx_uint_t                huge;
+    ngx_int_t                 numa;
+    ngx_str_t                 file;
+    ngx_uint_t                used;     /* unsigned  used:1; */
+} ngx_shm_policy_t;
+
+
 typedef struct {
     ngx_flag_t                daemon;
     ngx_flag_t                master;
 
     ngx_msec_t                timer_resolution;
     ngx_msec_t                shutdown_timeout;
+    ngx_msec_t                rolling_reload;
+
+    size_t                    pool_cache;
+    size_t                    io_buffers;
+    ngx_flag_t                io_buffers_huge;
 
     ngx_int_t                 worker_processes;
     ngx_int_t                 debug_points;
@@ -110,8 +131,16 @@ typedef struct {
     int                       priority;
 
     ngx_uint_t                cpu_affinity_auto;
+    ngx_uint_t                cpu_affinity_numa;
     ngx_uint_t                cpu_affinity_n;
     ngx_cpuset_t             *cpu_affinity;
+    ngx_int_t                *cpu_affinity_node;  /* per worker */
+    ngx_int_t                *cpu_nodes;          /* per CPU */
+
+    ngx_flag_t                reuseport_steering;
+
+    ngx_uint_t                cache_manager;
+    ngx_str_t                 cache_manager_pool;
 
     char                     *username;
     ngx_uid_t                 user;
@@ -126,6 +155,8 @@ typedef struct {
     ngx_array_t               env;
     char                    **environment;
 
+    ngx_array_t               shm_policies;  /* ngx_shm_policy_t */
+
     ngx_uint_t                transparent;  /* unsigned  transparent:1; */
 } ngx_core_conf_t;
 
@@ -140,7 +171,7 @@ ngx_int_t ngx_signal_process(ngx_cycle_t *cycle, char *sig);
 void ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user);
 char **ngx_set_environment(ngx_cycle_t *cycle, ngx_uint_t *last);
 ngx_pid_t ngx_exec_new_binary(ngx_cycle_t *cycle, char *const *argv);
-ngx_cpuset_t *ngx_get_cpu_affinity(ngx_uint_t n);
+ngx_cpuset_t *ngx_get_cpu_affinity(ngx_cycle_t *cycle, ngx_uint_t n);
 ngx_shm_zone_t *ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name,
     size_t size, void *tag);
 void ngx_set_shutdown_timer(ngx_cycle_t *cycle);
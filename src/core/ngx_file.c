@@ -111,6 +111,9 @@ ssize_t
 ngx_write_chain_to_temp_file(ngx_temp_file_t *tf, ngx_chain_t *chain)
 {
     ngx_int_t  rc;
+#if (NGX_HAVE_FALLOCATE)
+    ngx_err_t  err;
+#endif
 
     if (tf->file.fd == NGX_INVALID_FILE) {
         rc = ngx_create_temp_file(&tf->file, tf->path, tf->pool,
@@ -124,6 +127,33 @@ ngx_write_chain_to_temp_file(ngx_temp_file_t *tf, ngx_chain_t *chain)
             ngx_log_error(tf->log_level, tf->file.log, 0, "%s %V",
                           tf->warn, &tf->file.name);
         }
+
+#if (NGX_HAVE_FALLOCATE)
+
+        /*
+         * reserve the blocks of a file of known size up front,
+         * this fails early if there is no space left and keeps
+         * the file contiguous when many of them grow at once
+         */
+
+        if (tf->preallocate
+            && ngx_preallocate_file(tf->file.fd, tf->preallocate) == -1)
+        {
+            err = ngx_errno;
+
+            if (err == NGX_ENOSPC) {
+                ngx_log_error(NGX_LOG_CRIT, tf->file.log, err,
+                              ngx_preallocate_file_n " \"%V\" failed",
+                              &tf->file.name);
+                return NGX_ERROR;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, tf->file.log, err,
+                           ngx_preallocate_file_n " \"%V\" %O failed",
+                           &tf->file.name, tf->preallocate);
+        }
+
+#endif
     }
 
 #if (NGX_THREADS && NGX_HAVE_PWRITEV)
@@ -803,6 +833,9 @@ ngx_copy_file(u_char *from, u_char *to, ngx_copy_file_t *cf)
     ssize_t           n;
     ngx_fd_t          fd, nfd;
     ngx_int_t         rc;
+#if (NGX_HAVE_COPY_FILE_RANGE)
+    ngx_err_t         err;
+#endif
     ngx_uint_t        access;
     ngx_file_info_t   fi;
 
@@ -836,17 +869,6 @@ ngx_copy_file(u_char *from, u_char *to, ngx_copy_file_t *cf)
         time = (cf->time != -1) ? cf->time : ngx_file_mtime(&fi);
     }
 
-    len = cf->buf_size ? cf->buf_size : 65536;
-
-    if ((off_t) len > size) {
-        len = (size_t) size;
-    }
-
-    buf = ngx_alloc(len, cf->log);
-    if (buf == NULL) {
-        goto failed;
-    }
-
     nfd = ngx_open_file(to, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE, access);
 
     if (nfd == NGX_INVALID_FILE) {
@@ -855,6 +877,73 @@ ngx_copy_file(u_char *from, u_char *to, ngx_copy_file_t *cf)
         goto failed;
     }
 
+#if (NGX_HAVE_FICLONE)
+
+    /* a filesystem with shared extents copies nothing at all */
+
+    if (size > 0 && ioctl(nfd, FICLONE, fd) == 0) {
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, cf->log, 0,
+                       "clone \"%s\" to \"%s\"", from, to);
+        size = 0;
+    }
+
+#endif
+
+#if (NGX_HAVE_COPY_FILE_RANGE)
+
+    /*
+     * the kernel copies within a filesystem without passing the data
+     * through user space; the file offsets of both descriptors advance,
+     * so the loop below picks up where an unsupported copy stopped
+     */
+
+    while (size > 0) {
+
+        n = copy_file_range(fd, NULL, nfd, NULL,
+                            (size_t) ngx_min(size, NGX_MAX_SIZE_T_VALUE), 0);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EXDEV || err == NGX_EINVAL || err == NGX_ENOSYS
+                || err == NGX_EOPNOTSUPP)
+            {
+                ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, err,
+                               "copy_file_range() \"%s\" unsupported", to);
+                break;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, cf->log, err,
+                          "copy_file_range() \"%s\" to \"%s\" failed",
+                          from, to);
+            goto failed;
+        }
+
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_ALERT, cf->log, 0,
+                          "copy_file_range() has copied only part of %O "
+                          "from %s", size, from);
+            goto failed;
+        }
+
+        size -= n;
+    }
+
+#endif
+
+    len = cf->buf_size ? cf->buf_size : 65536;
+
+    if ((off_t) len > size) {
+        len = (size_t) size;
+    }
+
+    if (size > 0) {
+        buf = ngx_alloc(len, cf->log);
+        if (buf == NULL) {
+            goto failed;
+        }
+    }
+
     while (size > 0) {
 
         if ((off_t) len > size) {
@@ -56,6 +56,7 @@ typedef struct {
     ngx_path_purger_pt         purger;
     ngx_path_loader_pt         loader;
     void                      *data;
+    ngx_uint_t                 loaders;
 
     u_char                    *conf_file;
     ngx_uint_t                 line;
@@ -71,6 +72,7 @@ typedef struct {
 typedef struct {
     ngx_file_t                 file;
     off_t                      offset;
+    off_t                      preallocate;
     ngx_path_t                *path;
     ngx_pool_t                *pool;
     char                      *warn;
@@ -9,6 +9,41 @@
 #include <ngx_core.h>
 
 
+#define NGX_HASH_PERFECT_GROUP    4
+#define NGX_HASH_PERFECT_MAX      32
+#define NGX_HASH_PERFECT_TRIES    65536
+
+
+static ngx_int_t ngx_hash_perfect_init(ngx_hash_init_t *hinit,
+    ngx_hash_key_t *names, ngx_uint_t nelts);
+static ngx_int_t ngx_hash_wildcard_trie_create(ngx_hash_init_t *hinit,
+    ngx_hash_wildcard_node_t *node, ngx_hash_key_t **names, ngx_uint_t n,
+    size_t depth);
+static size_t ngx_hash_wildcard_lcp(ngx_str_t *first, ngx_str_t *last,
+    size_t depth);
+static int ngx_libc_cdecl ngx_hash_wildcard_cmp(const void *one,
+    const void *two);
+static void *ngx_hash_wildcard_trie_head(ngx_hash_wildcard_node_t *node,
+    u_char *name, size_t len);
+static void *ngx_hash_wildcard_trie_tail(ngx_hash_wildcard_node_t *node,
+    u_char *name, size_t len);
+
+
+static ngx_inline ngx_uint_t
+ngx_hash_perfect_slot(ngx_uint_t key, ngx_uint_t d, ngx_uint_t size)
+{
+    key ^= d * 0x9e3779b9;
+
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+
+    return key % size;
+}
+
+
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 {
@@ -19,6 +54,24 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
     ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "hf:\"%*s\"", len, name);
 #endif
 
+    if (hash->disp) {
+        elt = hash->buckets[ngx_hash_perfect_slot(key,
+                                                  hash->disp[key % hash->ndisp],
+                                                  hash->size)];
+
+        if (elt == NULL || len != (size_t) elt->len) {
+            return NULL;
+        }
+
+        for (i = 0; i < len; i++) {
+            if (name[i] != elt->name[i]) {
+                return NULL;
+            }
+        }
+
+        return elt->value;
+    }
+
     elt = hash->buckets[key % hash->size];
 
     if (elt == NULL) {
@@ -59,6 +112,10 @@ ngx_hash_find_wc_head(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
     ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "wch:\"%*s\"", len, name);
 #endif
 
+    if (hwc->trie) {
+        return ngx_hash_wildcard_trie_head(hwc->trie, name, len);
+    }
+
     n = len;
 
     while (n) {
@@ -153,6 +210,10 @@ ngx_hash_find_wc_tail(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
     ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "wct:\"%*s\"", len, name);
 #endif
 
+    if (hwc->trie) {
+        return ngx_hash_wildcard_trie_tail(hwc->trie, name, len);
+    }
+
     key = 0;
 
     for (i = 0; i < len; i++) {
@@ -225,7 +286,8 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
         return NULL;
     }
 
-    if (hash->wc_head && hash->wc_head->hash.buckets) {
+    if (hash->wc_head && (hash->wc_head->hash.buckets || hash->wc_head->trie))
+    {
         value = ngx_hash_find_wc_head(hash->wc_head, name, len);
 
         if (value) {
@@ -233,7 +295,8 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
         }
     }
 
-    if (hash->wc_tail && hash->wc_tail->hash.buckets) {
+    if (hash->wc_tail && (hash->wc_tail->hash.buckets || hash->wc_tail->trie))
+    {
         value = ngx_hash_find_wc_tail(hash->wc_tail, name, len);
 
         if (value) {
@@ -245,6 +308,139 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
 }
 
 
+
+/*
+ * The trie lookups return the value of the longest matching name.
+ * For head wildcards the labels of the name are walked from the last
+ * one, so "www.example.com" is matched as "com.example.www":
+ * "com.example" from ".example.com" matches it up to a label boundary,
+ * and "com.example." from "*.example.com" only if a label follows.
+ */
+
+static void *
+ngx_hash_wildcard_trie_head(ngx_hash_wildcard_node_t *node, u_char *name,
+    size_t len)
+{
+    void        *value;
+    u_char      *k;
+    ngx_int_t    c;
+    ngx_uint_t   i, n, start, end;
+
+    value = NULL;
+
+    end = len;
+
+    for (start = end; start && name[start - 1] != '.'; start--) {
+        /* void */
+    }
+
+    i = start;
+    n = 0;
+
+    for ( ;; ) {
+
+        /* the next byte of the name with the labels reversed, -1 at end */
+
+        if (i < end) {
+            c = name[i++];
+
+        } else if (start) {
+            end = start - 1;
+
+            for (start = end; start && name[start - 1] != '.'; start--) {
+                /* void */
+            }
+
+            i = start;
+            c = '.';
+
+        } else {
+            c = -1;
+        }
+
+        if (n < node->len) {
+            if (c != node->label[n]) {
+                break;
+            }
+
+            n++;
+            continue;
+        }
+
+        if (node->value) {
+            if (node->dot ? c != -1 : (c == -1 || c == '.')) {
+                value = node->value;
+            }
+        }
+
+        if (c == -1) {
+            break;
+        }
+
+        k = ngx_strlchr(node->keys, node->keys + node->nchildren, (u_char) c);
+
+        if (k == NULL) {
+            break;
+        }
+
+        node = &node->children[k - node->keys];
+        n = 1;
+    }
+
+    return value;
+}
+
+
+/* "www.example" from "www.example.*" matches if a label follows */
+
+static void *
+ngx_hash_wildcard_trie_tail(ngx_hash_wildcard_node_t *node, u_char *name,
+    size_t len)
+{
+    void        *value;
+    u_char      *k;
+    ngx_int_t    c;
+    ngx_uint_t   i, n;
+
+    value = NULL;
+
+    i = 0;
+    n = 0;
+
+    for ( ;; ) {
+
+        c = (i < len) ? name[i++] : -1;
+
+        if (n < node->len) {
+            if (c != node->label[n]) {
+                break;
+            }
+
+            n++;
+            continue;
+        }
+
+        if (node->value && c == '.') {
+            value = node->value;
+        }
+
+        if (c == -1) {
+            break;
+        }
+
+        k = ngx_strlchr(node->keys, node->keys + node->nchildren, (u_char) c);
+
+        if (k == NULL) {
+            break;
+        }
+
+        node = &node->children[k - node->keys];
+        n = 1;
+    }
+
+    return value;
+}
+
 #define NGX_HASH_ELT_SIZE(name)                                               \
     (sizeof(void *) + ngx_align((name)->key.len + 2, sizeof(void *)))
 
@@ -257,6 +453,18 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
     ngx_uint_t       i, n, key, size, start, bucket_size;
     ngx_hash_elt_t  *elt, **buckets;
 
+    switch (ngx_hash_perfect_init(hinit, names, nelts)) {
+
+    case NGX_OK:
+        return NGX_OK;
+
+    case NGX_ERROR:
+        return NGX_ERROR;
+
+    default: /* NGX_DECLINED */
+        break;
+    }
+
     if (hinit->max_size == 0) {
         ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
                       "could not build %s, you should "
@@ -447,6 +655,8 @@ found:
 
     hinit->hash->buckets = buckets;
     hinit->hash->size = size;
+    hinit->hash->disp = NULL;
+    hinit->hash->ndisp = 0;
 
 #if 0
 
@@ -482,6 +692,237 @@ found:
 }
 
 
+/*
+ * A minimal perfect hash built in the "hash, displace and compress"
+ * manner: the keys are split into groups of about four by the key hash,
+ * and the groups, largest first, are given a displacement which puts
+ * all keys of a group into free slots.  Slots are about 12% more than
+ * keys, and a lookup tests a single element, so neither max_size nor
+ * bucket_size apply.  If two keys have the same key hash, or a group
+ * cannot be placed, the usual buckets are built instead.
+ */
+
+static ngx_int_t
+ngx_hash_perfect_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts)
+{
+    u_char          *elts, *used;
+    size_t           len;
+    u_short         *disp;
+    ngx_int_t        rc;
+    ngx_uint_t       i, j, k, m, n, g, d, s, size, ngroups, max;
+    ngx_uint_t      *count, *start, *order, *groups, *slots;
+    ngx_hash_elt_t  *elt, **buckets;
+
+    n = 0;
+
+    for (i = 0; i < nelts; i++) {
+        if (names[i].key.data == NULL) {
+            continue;
+        }
+
+        if (names[i].key.len > 65535) {
+            return NGX_DECLINED;
+        }
+
+        n++;
+    }
+
+    if (n == 0) {
+        return NGX_DECLINED;
+    }
+
+    ngroups = n / NGX_HASH_PERFECT_GROUP + 1;
+    size = n + n / 8 + 1;
+
+    count = ngx_alloc((3 * ngroups + 1 + n + NGX_HASH_PERFECT_MAX)
+                      * sizeof(ngx_uint_t) + size, hinit->pool->log);
+    if (count == NULL) {
+        return NGX_ERROR;
+    }
+
+    start = count + ngroups;
+    groups = start + ngroups + 1;
+    order = groups + ngroups;
+    slots = order + n;
+    used = (u_char *) (slots + NGX_HASH_PERFECT_MAX);
+
+    ngx_memzero(count, ngroups * sizeof(ngx_uint_t));
+    ngx_memzero(used, size);
+
+    rc = NGX_DECLINED;
+
+    max = 0;
+
+    for (i = 0; i < nelts; i++) {
+        if (names[i].key.data == NULL) {
+            continue;
+        }
+
+        g = names[i].key_hash % ngroups;
+
+        if (++count[g] > max) {
+            max = count[g];
+        }
+    }
+
+    if (max > NGX_HASH_PERFECT_MAX) {
+        goto done;
+    }
+
+    /* the keys ordered by group */
+
+    start[0] = 0;
+
+    for (g = 0; g < ngroups; g++) {
+        start[g + 1] = start[g] + count[g];
+        count[g] = start[g];
+    }
+
+    for (i = 0; i < nelts; i++) {
+        if (names[i].key.data == NULL) {
+            continue;
+        }
+
+        g = names[i].key_hash % ngroups;
+        order[count[g]++] = i;
+    }
+
+    /* the groups ordered by size, largest first */
+
+    j = 0;
+
+    for (k = max; k > 0; k--) {
+        for (g = 0; g < ngroups; g++) {
+            if (start[g + 1] - start[g] == k) {
+                groups[j++] = g;
+            }
+        }
+    }
+
+    disp = ngx_palloc(hinit->pool, ngroups * sizeof(u_short));
+    if (disp == NULL) {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    ngx_memzero(disp, ngroups * sizeof(u_short));
+
+    for (i = 0; i < j; i++) {
+        g = groups[i];
+        m = start[g + 1] - start[g];
+
+        for (d = 0; d < NGX_HASH_PERFECT_TRIES; d++) {
+
+            for (k = 0; k < m; k++) {
+                s = ngx_hash_perfect_slot(names[order[start[g] + k]].key_hash,
+                                          d, size);
+
+                if (used[s]) {
+                    break;
+                }
+
+                used[s] = 1;
+                slots[k] = s;
+            }
+
+            if (k == m) {
+                break;
+            }
+
+            while (k--) {
+                used[slots[k]] = 0;
+            }
+
+            if (d == 0) {
+                /* keys with the same hash never fit into distinct slots */
+
+                for (k = 1; k < m; k++) {
+                    for (s = 0; s < k; s++) {
+                        if (names[order[start[g] + k]].key_hash
+                            == names[order[start[g] + s]].key_hash)
+                        {
+                            goto done;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (d == NGX_HASH_PERFECT_TRIES) {
+            goto done;
+        }
+
+        disp[g] = (u_short) d;
+    }
+
+    if (hinit->hash == NULL) {
+        hinit->hash = ngx_pcalloc(hinit->pool, sizeof(ngx_hash_wildcard_t)
+                                             + size * sizeof(ngx_hash_elt_t *));
+        if (hinit->hash == NULL) {
+            rc = NGX_ERROR;
+            goto done;
+        }
+
+        buckets = (ngx_hash_elt_t **)
+                      ((u_char *) hinit->hash + sizeof(ngx_hash_wildcard_t));
+
+    } else {
+        buckets = ngx_pcalloc(hinit->pool, size * sizeof(ngx_hash_elt_t *));
+        if (buckets == NULL) {
+            rc = NGX_ERROR;
+            goto done;
+        }
+    }
+
+    len = 0;
+
+    for (i = 0; i < nelts; i++) {
+        if (names[i].key.data != NULL) {
+            len += NGX_HASH_ELT_SIZE(&names[i]);
+        }
+    }
+
+    elts = ngx_palloc(hinit->pool, len);
+    if (elts == NULL) {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    for (i = 0; i < nelts; i++) {
+        if (names[i].key.data == NULL) {
+            continue;
+        }
+
+        g = names[i].key_hash % ngroups;
+        s = ngx_hash_perfect_slot(names[i].key_hash, disp[g], size);
+
+        elt = (ngx_hash_elt_t *) elts;
+
+        elt->value = names[i].value;
+        elt->len = (u_short) names[i].key.len;
+
+        ngx_strlow(elt->name, names[i].key.data, names[i].key.len);
+
+        buckets[s] = elt;
+        elts += NGX_HASH_ELT_SIZE(&names[i]);
+    }
+
+    hinit->hash->buckets = buckets;
+    hinit->hash->size = size;
+    hinit->hash->disp = disp;
+    hinit->hash->ndisp = ngroups;
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_free(count);
+
+    return rc;
+}
+
+
 ngx_int_t
 ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts)
@@ -627,6 +1068,209 @@ ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
 }
 
 
+/*
+ * Instead of nested hashes, one per label, a single compressed trie
+ * is built from the names sorted bytewise.  It builds faster than the
+ * nested hashes, but a lookup visits a node per branching byte rather
+ * than a hash per label, so it is only used on request.  NGX_DECLINED
+ * is returned for an ngx_hash_t given by the caller, which cannot hold
+ * the trie, and for names too long for the u_short node lengths, and
+ * ngx_hash_wildcard_init() should be used then.
+ */
+
+ngx_int_t
+ngx_hash_wildcard_trie_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts)
+{
+    ngx_uint_t            i, n;
+    ngx_hash_key_t      **sorted;
+    ngx_hash_wildcard_t  *hwc;
+
+    if (hinit->hash != NULL || nelts == 0) {
+        return NGX_DECLINED;
+    }
+
+    sorted = ngx_palloc(hinit->temp_pool, nelts * sizeof(ngx_hash_key_t *));
+    if (sorted == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+
+    for (i = 0; i < nelts; i++) {
+        if (names[i].key.len > 65535) {
+            return NGX_DECLINED;
+        }
+
+        ngx_strlow(names[i].key.data, names[i].key.data, names[i].key.len);
+
+        sorted[n++] = &names[i];
+    }
+
+    ngx_qsort(sorted, n, sizeof(ngx_hash_key_t *), ngx_hash_wildcard_cmp);
+
+    hwc = ngx_pcalloc(hinit->pool, sizeof(ngx_hash_wildcard_t));
+    if (hwc == NULL) {
+        return NGX_ERROR;
+    }
+
+    hwc->trie = ngx_pcalloc(hinit->pool, sizeof(ngx_hash_wildcard_node_t));
+    if (hwc->trie == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_hash_wildcard_trie_create(hinit, hwc->trie, sorted, n, 0)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    hinit->hash = (ngx_hash_t *) hwc;
+
+    return NGX_OK;
+}
+
+
+/*
+ * all "n" names share the first "depth" bytes; the first one is
+ * the node value if it is exactly "depth" bytes long, the rest are split
+ * into children by the byte at "depth", and each child label runs up
+ * to the common prefix of the first and last names of the group
+ */
+
+static ngx_int_t
+ngx_hash_wildcard_trie_create(ngx_hash_init_t *hinit,
+    ngx_hash_wildcard_node_t *node, ngx_hash_key_t **names, ngx_uint_t n,
+    size_t depth)
+{
+    u_char                     c, *p;
+    size_t                     len, size;
+    ngx_str_t                 *first, *last;
+    ngx_uint_t                 i, j, k;
+    ngx_hash_wildcard_node_t  *child;
+
+    i = 0;
+
+    /* equal names are skipped, the first one is used as by ngx_hash_find() */
+
+    while (i < n && names[i]->key.len == depth) {
+        if (i == 0) {
+            node->value = names[0]->value;
+            node->dot = (depth && names[0]->key.data[depth - 1] == '.');
+        }
+
+        i++;
+    }
+
+    if (i == n) {
+        return NGX_OK;
+    }
+
+    /*
+     * the children, their first bytes and their labels are allocated
+     * in one block, so a step down the trie mostly touches one place
+     */
+
+    k = 0;
+    size = 0;
+
+    for (j = i; j < n; /* void */) {
+        first = &names[j]->key;
+        c = first->data[depth];
+
+        for (j++; j < n && names[j]->key.data[depth] == c; j++) {
+            /* void */
+        }
+
+        last = &names[j - 1]->key;
+
+        size += ngx_hash_wildcard_lcp(first, last, depth) - depth;
+        k++;
+    }
+
+    p = ngx_palloc(hinit->pool, k * sizeof(ngx_hash_wildcard_node_t)
+                                + k + size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    node->children = (ngx_hash_wildcard_node_t *) p;
+    node->keys = p + k * sizeof(ngx_hash_wildcard_node_t);
+    node->nchildren = (u_short) k;
+
+    p = node->keys + k;
+
+    for (k = 0; i < n; k++, i = j) {
+
+        first = &names[i]->key;
+        c = first->data[depth];
+
+        for (j = i + 1; j < n && names[j]->key.data[depth] == c; j++) {
+            /* void */
+        }
+
+        last = &names[j - 1]->key;
+
+        len = ngx_hash_wildcard_lcp(first, last, depth);
+
+        child = &node->children[k];
+        ngx_memzero(child, sizeof(ngx_hash_wildcard_node_t));
+
+        node->keys[k] = c;
+
+        child->len = (u_short) (len - depth);
+        child->label = p;
+
+        p = ngx_cpymem(p, first->data + depth, child->len);
+
+        if (ngx_hash_wildcard_trie_create(hinit, child, &names[i], j - i, len)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/* the length of the common prefix of sorted names, at least depth + 1 */
+
+static size_t
+ngx_hash_wildcard_lcp(ngx_str_t *first, ngx_str_t *last, size_t depth)
+{
+    size_t  len;
+
+    for (len = depth + 1; len < first->len && len < last->len; len++) {
+        if (first->data[len] != last->data[len]) {
+            break;
+        }
+    }
+
+    return len;
+}
+
+
+static int ngx_libc_cdecl
+ngx_hash_wildcard_cmp(const void *one, const void *two)
+{
+    ngx_int_t        rc;
+    ngx_hash_key_t  *first, *second;
+
+    first = *(ngx_hash_key_t **) one;
+    second = *(ngx_hash_key_t **) two;
+
+    rc = ngx_memcmp(first->key.data, second->key.data,
+                    ngx_min(first->key.len, second->key.len));
+
+    if (rc != 0) {
+        return (int) rc;
+    }
+
+    return (int) first->key.len - (int) second->key.len;
+}
+
+
 ngx_uint_t
 ngx_hash_key(u_char *data, size_t len)
 {
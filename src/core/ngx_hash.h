@@ -23,12 +23,39 @@ typedef struct {
 typedef struct {
     ngx_hash_elt_t  **buckets;
     ngx_uint_t        size;
+
+    /* displacements of a perfect hash, each bucket is a single element */
+    u_short          *disp;
+    ngx_uint_t        ndisp;
 } ngx_hash_t;
 
 
+typedef struct ngx_hash_wildcard_node_s  ngx_hash_wildcard_node_t;
+
+/*
+ * a node of the compressed trie of wildcard names, in the form
+ * prepared by ngx_hash_add_key(), e.g. "com.example." for "*.example.com":
+ * each node consumes "len" bytes of "label", children start with
+ * distinct bytes listed in "keys"
+ */
+
+struct ngx_hash_wildcard_node_s {
+    ngx_hash_wildcard_node_t  *children;
+    u_char                    *keys;
+    u_char                    *label;
+    void                      *value;
+    u_short                    nchildren;
+    u_short                    len;
+
+    /* the name ends with a dot, "*.example.com" */
+    unsigned                   dot:1;
+};
+
+
 typedef struct {
-    ngx_hash_t        hash;
-    void             *value;
+    ngx_hash_t                 hash;
+    void                      *value;
+    ngx_hash_wildcard_node_t  *trie;
 } ngx_hash_wildcard_t;
 
 
@@ -107,6 +134,8 @@ ngx_int_t ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts);
 ngx_int_t ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts);
+ngx_int_t ngx_hash_wildcard_trie_init(ngx_hash_init_t *hinit,
+    ngx_hash_key_t *names, ngx_uint_t nelts);
 
 #define ngx_hash(key, c)   ((ngx_uint_t) key * 31 + c)
 ngx_uint_t ngx_hash_key(u_char *data, size_t len);
@@ -7,12 +7,72 @@
 
 #include <ngx_config.h>
 #include <ngx_core.h>
+#include <ngx_event.h>
 
 
+#define NGX_LOG_BUFFER_MSGS  NGX_SYSLOG_BATCH
+
+
+typedef struct {
+    ngx_array_t           buffers;     /* ngx_log_buffer_t * */
+} ngx_log_conf_t;
+
+
+/*
+ * a buffered, rate limited or deduplicated log: the writer is replaced
+ * with ngx_log_buffer_writer(), and the file or syslog peer is kept here
+ */
+
+typedef struct {
+    ngx_open_file_t      *file;
+    ngx_syslog_peer_t    *peer;
+
+    u_char               *start;
+    u_char               *pos;
+    u_char               *end;
+
+    /* syslog messages in the buffer, sent with one sendmmsg() */
+    ngx_uint_t            nmsgs;
+    ngx_str_t            *msgs;
+
+    ngx_event_t           event;
+    ngx_msec_t            flush;
+
+    time_t                disk_full_time;
+
+    ngx_uint_t            rate;
+    time_t                rate_time;
+    ngx_uint_t            rate_count;
+    ngx_uint_t            suppressed;
+
+    ngx_str_t             last;
+    ngx_uint_t            last_level;
+    ngx_uint_t            repeated;
+
+    unsigned              dedup:1;
+    unsigned              active:1;
+    unsigned              busy:1;
+} ngx_log_buffer_t;
+
+
+static void *ngx_log_create_conf(ngx_cycle_t *cycle);
 static char *ngx_error_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_log_set_buffer(ngx_conf_t *cf, ngx_log_t *log);
 static char *ngx_log_set_levels(ngx_conf_t *cf, ngx_log_t *log);
 static void ngx_log_insert(ngx_log_t *log, ngx_log_t *new_log);
 
+static void ngx_log_buffer_writer(ngx_log_t *log, ngx_uint_t level,
+    u_char *buf, size_t len);
+static void ngx_log_buffer_add(ngx_log_buffer_t *b, ngx_uint_t level,
+    u_char *buf, size_t len);
+static void ngx_log_buffer_write(ngx_log_buffer_t *b, ngx_uint_t level,
+    u_char *buf, size_t len);
+static void ngx_log_buffer_repeated(ngx_log_buffer_t *b);
+static void ngx_log_buffer_suppressed(ngx_log_buffer_t *b);
+static void ngx_log_buffer_flush(ngx_log_buffer_t *b);
+static void ngx_log_buffer_flush_handler(ngx_event_t *ev);
+static void ngx_log_buffer_cleanup(void *data);
+
 
 #if (NGX_DEBUG)
 
@@ -46,7 +106,7 @@ static ngx_command_t  ngx_errlog_commands[] = {
 
 static ngx_core_module_t  ngx_errlog_module_ctx = {
     ngx_string("errlog"),
-    NULL,
+    ngx_log_create_conf,
     NULL
 };
 
@@ -166,6 +226,11 @@ ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
 
         if (log->writer) {
             log->writer(log, level, errstr, p - errstr);
+
+            if (log->file && log->file->fd == ngx_stderr) {
+                wrote_stderr = 1;
+            }
+
             goto next;
         }
 
@@ -665,6 +730,10 @@ ngx_log_set_log(ngx_conf_t *cf, ngx_log_t **head)
         }
     }
 
+    if (ngx_log_set_buffer(cf, new_log) != NGX_CONF_OK) {
+        return NGX_CONF_ERROR;
+    }
+
     if (ngx_log_set_levels(cf, new_log) != NGX_CONF_OK) {
         return NGX_CONF_ERROR;
     }
@@ -677,6 +746,166 @@ ngx_log_set_log(ngx_conf_t *cf, ngx_log_t **head)
 }
 
 
+static char *
+ngx_log_set_buffer(ngx_conf_t *cf, ngx_log_t *log)
+{
+    ssize_t              size;
+    ngx_int_t            rate;
+    ngx_str_t           *value, s;
+    ngx_msec_t           flush;
+    ngx_uint_t           i, n, dedup;
+    ngx_log_conf_t      *lcf;
+    ngx_log_buffer_t    *b, **bp;
+    ngx_pool_cleanup_t  *cln;
+
+    size = 0;
+    flush = 0;
+    rate = 0;
+    dedup = 0;
+
+    value = cf->args->elts;
+
+    /* the parameters are removed, levels are left for ngx_log_set_levels() */
+
+    for (i = 2, n = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "buffer=", 7) == 0) {
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR || size < (ssize_t) (NGX_SYSLOG_MAX_STR)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid buffer size \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "flush=", 6) == 0) {
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            flush = ngx_parse_time(&s, 0);
+
+            if (flush == (ngx_msec_t) NGX_ERROR || flush == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid flush time \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "rate=", 5) == 0) {
+            rate = ngx_atoi(value[i].data + 5, value[i].len - 5);
+
+            if (rate == NGX_ERROR || rate == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid rate \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "dedup") == 0) {
+            dedup = 1;
+            continue;
+        }
+
+        value[n++] = value[i];
+    }
+
+    cf->args->nelts = n;
+
+    if (size == 0 && flush == 0 && rate == 0 && !dedup) {
+        return NGX_CONF_OK;
+    }
+
+    if (log->file == NULL && log->writer != ngx_syslog_writer) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "buffer, flush, rate, and dedup parameters "
+                           "are not supported for memory log");
+        return NGX_CONF_ERROR;
+    }
+
+    if (flush && size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no buffer is defined for error_log \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    b = ngx_pcalloc(cf->pool, sizeof(ngx_log_buffer_t));
+    if (b == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (log->writer == ngx_syslog_writer) {
+        b->peer = log->wdata;
+
+    } else {
+        b->file = log->file;
+    }
+
+    if (size) {
+        b->start = ngx_pnalloc(cf->pool, size);
+        if (b->start == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        b->pos = b->start;
+        b->end = b->start + size;
+
+        if (b->peer) {
+            b->msgs = ngx_palloc(cf->pool,
+                                 NGX_LOG_BUFFER_MSGS * sizeof(ngx_str_t));
+            if (b->msgs == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+    }
+
+    b->flush = flush ? flush : 1000;
+    b->rate = rate;
+
+    if (dedup) {
+        b->dedup = 1;
+
+        b->last.data = ngx_pnalloc(cf->pool, NGX_MAX_ERROR_STR);
+        if (b->last.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    lcf = (ngx_log_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                          ngx_errlog_module);
+
+    bp = ngx_array_push(&lcf->buffers);
+    if (bp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *bp = b;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->data = b;
+    cln->handler = ngx_log_buffer_cleanup;
+
+    log->writer = ngx_log_buffer_writer;
+    log->wdata = b;
+
+    return NGX_CONF_OK;
+}
+
+
 static void
 ngx_log_insert(ngx_log_t *log, ngx_log_t *new_log)
 {
@@ -711,6 +940,356 @@ ngx_log_insert(ngx_log_t *log, ngx_log_t *new_log)
 }
 
 
+static void *
+ngx_log_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_log_conf_t  *lcf;
+
+    lcf = ngx_pcalloc(cycle->pool, sizeof(ngx_log_conf_t));
+    if (lcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&lcf->buffers, cycle->pool, 4,
+                       sizeof(ngx_log_buffer_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return lcf;
+}
+
+
+/*
+ * buffers are only used by worker processes, once event timers
+ * are initialized; the master process writes error logs directly
+ */
+
+void
+ngx_log_init_buffers(ngx_cycle_t *cycle)
+{
+    ngx_uint_t          i;
+    ngx_log_conf_t     *lcf;
+    ngx_log_buffer_t  **b;
+
+    lcf = (ngx_log_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_errlog_module);
+
+    b = lcf->buffers.elts;
+
+    for (i = 0; i < lcf->buffers.nelts; i++) {
+
+        /* state inherited from the master process */
+
+        b[i]->rate_count = 0;
+        b[i]->suppressed = 0;
+        b[i]->last.len = 0;
+        b[i]->repeated = 0;
+
+        b[i]->event.data = b[i];
+        b[i]->event.handler = ngx_log_buffer_flush_handler;
+        b[i]->event.log = cycle->log;
+        b[i]->event.cancelable = 1;
+
+        b[i]->active = 1;
+    }
+}
+
+
+static void
+ngx_log_buffer_writer(ngx_log_t *log, ngx_uint_t level, u_char *buf,
+    size_t len)
+{
+    u_char            *p, *last;
+    size_t             n;
+    ngx_log_buffer_t  *b;
+
+    b = log->wdata;
+
+    if (b->busy) {
+
+        /* logged while the buffer is flushed */
+
+        if (b->file) {
+            (void) ngx_write_fd(b->file->fd, buf, len);
+        }
+
+        return;
+    }
+
+    if (b->dedup) {
+
+        /* skip time, level, pid#tid, and connection number */
+
+        p = buf + ngx_cached_err_log_time.len;
+        last = buf + len;
+
+        p = ngx_strlchr(p, last, ':');
+        p = p ? p + 2 : last;
+
+        if (p < last && *p == '*') {
+            p = ngx_strlchr(p, last, ' ');
+            p = p ? p + 1 : last;
+        }
+
+        n = last - p;
+
+        if (n == b->last.len
+            && level == b->last_level
+            && ngx_memcmp(p, b->last.data, n) == 0)
+        {
+            if (b->repeated++ == 0 && b->active && !b->event.timer_set) {
+                ngx_add_timer(&b->event, b->flush);
+            }
+
+            return;
+        }
+
+        ngx_log_buffer_repeated(b);
+
+        b->last.len = ngx_min(n, NGX_MAX_ERROR_STR);
+        b->last_level = level;
+        ngx_memcpy(b->last.data, p, b->last.len);
+    }
+
+    if (b->rate && level > NGX_LOG_CRIT) {
+
+        if (b->rate_time != ngx_time()) {
+            b->rate_time = ngx_time();
+            b->rate_count = 0;
+
+            ngx_log_buffer_suppressed(b);
+        }
+
+        if (b->rate_count++ >= b->rate) {
+
+            if (b->suppressed++ == 0 && b->active && !b->event.timer_set) {
+                ngx_add_timer(&b->event, b->flush);
+            }
+
+            return;
+        }
+    }
+
+    ngx_log_buffer_add(b, level, buf, len);
+}
+
+
+static void
+ngx_log_buffer_add(ngx_log_buffer_t *b, ngx_uint_t level, u_char *buf,
+    size_t len)
+{
+    u_char  *p, msg[NGX_SYSLOG_MAX_STR];
+
+    if (!b->active || b->start == NULL) {
+        ngx_log_buffer_write(b, level, buf, len);
+        return;
+    }
+
+    if (b->peer) {
+        p = ngx_syslog_add_message(b->peer, level, msg, buf, len);
+
+        buf = msg;
+        len = p - msg;
+
+        if (b->nmsgs == NGX_LOG_BUFFER_MSGS) {
+            ngx_log_buffer_flush(b);
+        }
+    }
+
+    if (len > (size_t) (b->end - b->pos)) {
+        ngx_log_buffer_flush(b);
+    }
+
+    if (b->pos == b->start && !b->event.timer_set) {
+        ngx_add_timer(&b->event, b->flush);
+    }
+
+    if (b->peer) {
+        b->msgs[b->nmsgs].data = b->pos;
+        b->msgs[b->nmsgs].len = len;
+        b->nmsgs++;
+    }
+
+    b->pos = ngx_cpymem(b->pos, buf, len);
+
+    if (level <= NGX_LOG_CRIT) {
+        ngx_log_buffer_flush(b);
+    }
+}
+
+
+static void
+ngx_log_buffer_write(ngx_log_buffer_t *b, ngx_uint_t level, u_char *buf,
+    size_t len)
+{
+    u_char  *p, msg[NGX_SYSLOG_MAX_STR];
+
+    if (b->peer) {
+
+        if (b->peer->busy) {
+            return;
+        }
+
+        b->peer->busy = 1;
+
+        p = ngx_syslog_add_message(b->peer, level, msg, buf, len);
+
+        (void) ngx_syslog_send(b->peer, msg, p - msg);
+
+        b->peer->busy = 0;
+
+        return;
+    }
+
+    if (ngx_time() == b->disk_full_time) {
+        return;
+    }
+
+    if (ngx_write_fd(b->file->fd, buf, len) == -1
+        && ngx_errno == NGX_ENOSPC)
+    {
+        b->disk_full_time = ngx_time();
+    }
+}
+
+
+static void
+ngx_log_buffer_repeated(ngx_log_buffer_t *b)
+{
+    u_char  *p;
+    u_char   note[NGX_MAX_ERROR_STR];
+
+    if (b->repeated == 0) {
+        return;
+    }
+
+    p = ngx_cpymem(note, ngx_cached_err_log_time.data,
+                   ngx_cached_err_log_time.len);
+
+    p = ngx_slprintf(p, note + NGX_MAX_ERROR_STR - NGX_LINEFEED_SIZE,
+                     " [%V] %P#" NGX_TID_T_FMT ": "
+                     "last message repeated %ui times",
+                     &err_levels[b->last_level], ngx_log_pid, ngx_log_tid,
+                     b->repeated);
+
+    ngx_linefeed(p);
+
+    b->repeated = 0;
+
+    ngx_log_buffer_add(b, b->last_level, note, p - note);
+}
+
+
+static void
+ngx_log_buffer_suppressed(ngx_log_buffer_t *b)
+{
+    u_char  *p;
+    u_char   note[NGX_MAX_ERROR_STR];
+
+    if (b->suppressed == 0) {
+        return;
+    }
+
+    p = ngx_cpymem(note, ngx_cached_err_log_time.data,
+                   ngx_cached_err_log_time.len);
+
+    p = ngx_slprintf(p, note + NGX_MAX_ERROR_STR - NGX_LINEFEED_SIZE,
+                     " [%V] %P#" NGX_TID_T_FMT ": "
+                     "%ui messages suppressed by error log rate limit",
+                     &err_levels[NGX_LOG_WARN], ngx_log_pid, ngx_log_tid,
+                     b->suppressed);
+
+    ngx_linefeed(p);
+
+    b->suppressed = 0;
+
+    ngx_log_buffer_add(b, NGX_LOG_WARN, note, p - note);
+}
+
+
+static void
+ngx_log_buffer_flush(ngx_log_buffer_t *b)
+{
+    size_t   len;
+    ssize_t  n;
+
+    if (b->event.timer_set) {
+        ngx_del_timer(&b->event);
+    }
+
+    len = b->pos - b->start;
+
+    if (len == 0) {
+        return;
+    }
+
+    b->busy = 1;
+
+    if (b->peer) {
+        if (!b->peer->busy) {
+            b->peer->busy = 1;
+
+            (void) ngx_syslog_send_batch(b->peer, b->msgs, b->nmsgs);
+
+            b->peer->busy = 0;
+        }
+
+        b->nmsgs = 0;
+
+    } else if (ngx_time() != b->disk_full_time) {
+
+        n = ngx_write_fd(b->file->fd, b->start, len);
+
+        if (n == -1 && ngx_errno == NGX_ENOSPC) {
+            b->disk_full_time = ngx_time();
+        }
+    }
+
+    b->pos = b->start;
+
+    b->busy = 0;
+}
+
+
+static void
+ngx_log_buffer_flush_handler(ngx_event_t *ev)
+{
+    ngx_log_buffer_t  *b = ev->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "error log buffer flush handler");
+
+    ngx_log_buffer_repeated(b);
+    ngx_log_buffer_suppressed(b);
+    ngx_log_buffer_flush(b);
+}
+
+
+static void
+ngx_log_buffer_cleanup(void *data)
+{
+    ngx_log_buffer_t  *b = data;
+
+    if (!b->active) {
+        return;
+    }
+
+    ngx_log_buffer_repeated(b);
+    ngx_log_buffer_suppressed(b);
+
+    if (b->start) {
+        ngx_log_buffer_flush(b);
+    }
+
+    if (b->event.timer_set) {
+        ngx_del_timer(&b->event);
+    }
+
+    b->active = 0;
+}
+
+
 #if (NGX_DEBUG)
 
 static void
@@ -0,0 +1,1015 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_MMDB_POINTER    1
+#define NGX_MMDB_STRING     2
+#define NGX_MMDB_DOUBLE     3
+#define NGX_MMDB_BYTES      4
+#define NGX_MMDB_UINT16     5
+#define NGX_MMDB_UINT32     6
+#define NGX_MMDB_MAP        7
+#define NGX_MMDB_INT32      8
+#define NGX_MMDB_UINT64     9
+#define NGX_MMDB_UINT128    10
+#define NGX_MMDB_ARRAY      11
+#define NGX_MMDB_BOOLEAN    14
+#define NGX_MMDB_FLOAT      15
+
+/* the nesting of maps and arrays skipped while looking for a key */
+#define NGX_MMDB_MAX_DEPTH  32
+
+/* the metadata are within the last 128K of a file */
+#define NGX_MMDB_METADATA   (128 * 1024)
+
+
+typedef struct {
+    ngx_uint_t        type;
+    ngx_uint_t        size;
+    u_char           *data;
+} ngx_mmdb_entry_t;
+
+
+static ngx_int_t ngx_mmdb_metadata(ngx_conf_t *cf, ngx_mmdb_t *db,
+    u_char *meta, u_char *end);
+static ngx_int_t ngx_mmdb_search(ngx_mmdb_t *db, u_char *addr, ngx_uint_t len,
+    u_char **data);
+static uint32_t ngx_mmdb_record(ngx_mmdb_t *db, uint32_t node,
+    ngx_uint_t bit);
+static ngx_int_t ngx_mmdb_extract(ngx_mmdb_t *db, u_char *addr,
+    ngx_uint_t len, ngx_str_t *values, u_char *buf, ngx_log_t *log);
+static ngx_int_t ngx_mmdb_decode(u_char *base, u_char *end, u_char **pos,
+    ngx_mmdb_entry_t *e);
+static ngx_int_t ngx_mmdb_skip(u_char *base, u_char *end, u_char **pos,
+    ngx_uint_t depth);
+static ngx_int_t ngx_mmdb_find(u_char *base, u_char *end, ngx_mmdb_entry_t *e,
+    ngx_str_t *key);
+static ngx_int_t ngx_mmdb_format(ngx_mmdb_entry_t *e, ngx_str_t *value,
+    u_char *buf);
+static uint64_t ngx_mmdb_uint(u_char *p, ngx_uint_t size);
+static ngx_mmdb_node_t *ngx_mmdb_cache_lookup(ngx_mmdb_t *db, u_char *addr,
+    ngx_uint_t len, uint32_t hash);
+static ngx_mmdb_node_t *ngx_mmdb_cache_add(ngx_mmdb_t *db, u_char *addr,
+    ngx_uint_t len, uint32_t hash, ngx_log_t *log);
+static void ngx_mmdb_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static void ngx_mmdb_cleanup(void *data);
+
+
+static u_char  ngx_mmdb_marker[] = "\xab\xcd\xefMaxMind.com";
+
+
+ngx_mmdb_t *
+ngx_mmdb_open(ngx_conf_t *cf, ngx_str_t *name, ngx_uint_t cache)
+{
+    u_char              *p, *last, *meta;
+    size_t               tree;
+    ngx_fd_t             fd;
+    ngx_mmdb_t          *db;
+    ngx_file_info_t      fi;
+    ngx_pool_cleanup_t  *cln;
+
+    if (ngx_conf_full_name(cf->cycle, name, 1) != NGX_OK) {
+        return NULL;
+    }
+
+    db = ngx_pcalloc(cf->pool, sizeof(ngx_mmdb_t));
+    if (db == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&db->fields, cf->pool, 4, sizeof(ngx_mmdb_field_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    ngx_rbtree_init(&db->rbtree, &db->sentinel, ngx_mmdb_rbtree_insert_value);
+    ngx_queue_init(&db->lru);
+
+    db->cache_max = cache;
+
+    fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%s\" failed", name->data);
+        return NULL;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%s\" failed", name->data);
+
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_conf_log_error(NGX_LOG_ALERT, cf, ngx_errno,
+                               ngx_close_file_n " \"%s\" failed", name->data);
+        }
+
+        return NULL;
+    }
+
+    db->fm.name = name->data;
+    db->fm.size = (size_t) ngx_file_size(&fi);
+    db->fm.fd = fd;
+    db->fm.log = cf->log;
+
+    if (db->fm.size < sizeof(ngx_mmdb_marker) - 1
+        || ngx_open_file_mapping(&db->fm) != NGX_OK)
+    {
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_conf_log_error(NGX_LOG_ALERT, cf, ngx_errno,
+                               ngx_close_file_n " \"%s\" failed", name->data);
+        }
+
+        goto invalid;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        ngx_close_file_mapping(&db->fm);
+        return NULL;
+    }
+
+    cln->handler = ngx_mmdb_cleanup;
+    cln->data = db;
+
+    db->start = db->fm.addr;
+    last = db->start + db->fm.size;
+
+    /* the last marker starts the metadata */
+
+    meta = NULL;
+    p = last - (sizeof(ngx_mmdb_marker) - 1);
+
+    while (p >= db->start && last - p <= NGX_MMDB_METADATA) {
+
+        if (ngx_memcmp(p, ngx_mmdb_marker, sizeof(ngx_mmdb_marker) - 1) == 0)
+        {
+            meta = p;
+            break;
+        }
+
+        p--;
+    }
+
+    if (meta == NULL
+        || ngx_mmdb_metadata(cf, db, meta + sizeof(ngx_mmdb_marker) - 1, last)
+           != NGX_OK)
+    {
+        goto invalid;
+    }
+
+    tree = (size_t) db->node_count * db->record_size / 4;
+
+    if (tree + 16 > (size_t) (meta - db->start)) {
+        goto invalid;
+    }
+
+    db->data = db->start + tree + 16;
+    db->end = meta;
+
+    /* IPv4 addresses are looked up as ::a.b.c.d in IPv6 databases */
+
+    db->ipv4_node = 0;
+
+    if (db->ip_version == 6) {
+        for (tree = 0; tree < 96 && db->ipv4_node < db->node_count; tree++) {
+            db->ipv4_node = ngx_mmdb_record(db, db->ipv4_node, 0);
+        }
+    }
+
+    return db;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid MaxMind DB \"%s\"", name->data);
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_mmdb_metadata(ngx_conf_t *cf, ngx_mmdb_t *db, u_char *meta, u_char *end)
+{
+    u_char            *p;
+    uint64_t           n[3];
+    ngx_uint_t         i;
+    ngx_mmdb_entry_t   e;
+
+    static ngx_str_t  keys[] = {
+        ngx_string("node_count"),
+        ngx_string("record_size"),
+        ngx_string("ip_version")
+    };
+
+    for (i = 0; i < 3; i++) {
+        p = meta;
+
+        if (ngx_mmdb_decode(meta, end, &p, &e) != NGX_OK
+            || ngx_mmdb_find(meta, end, &e, &keys[i]) != NGX_OK
+            || (e.type != NGX_MMDB_UINT16 && e.type != NGX_MMDB_UINT32)
+            || e.size > 4)
+        {
+            return NGX_ERROR;
+        }
+
+        n[i] = ngx_mmdb_uint(e.data, e.size);
+    }
+
+    if ((n[1] != 24 && n[1] != 28 && n[1] != 32)
+        || (n[2] != 4 && n[2] != 6))
+    {
+        return NGX_ERROR;
+    }
+
+    db->node_count = (uint32_t) n[0];
+    db->record_size = (ngx_uint_t) n[1];
+    db->ip_version = (ngx_uint_t) n[2];
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, cf->log, 0,
+                   "mmdb \"%s\": nodes:%uD record:%ui ipv%ui",
+                   db->fm.name, db->node_count, db->record_size,
+                   db->ip_version);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_mmdb_add_field(ngx_conf_t *cf, ngx_mmdb_t *db, ngx_str_t *keys,
+    ngx_uint_t n)
+{
+    ngx_mmdb_field_t  *field;
+
+    field = ngx_array_push(&db->fields);
+    if (field == NULL) {
+        return NGX_ERROR;
+    }
+
+    field->keys = ngx_palloc(cf->pool, n * sizeof(ngx_str_t));
+    if (field->keys == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(field->keys, keys, n * sizeof(ngx_str_t));
+    field->nkeys = n;
+
+    return db->fields.nelts - 1;
+}
+
+
+ngx_int_t
+ngx_mmdb_lookup(ngx_mmdb_t *db, struct sockaddr *sa, ngx_str_t *values,
+    ngx_pool_t *pool, ngx_log_t *log)
+{
+    u_char               *addr, *buf, *p;
+    uint32_t              hash;
+    ngx_int_t             rc;
+    ngx_uint_t            i, n, len;
+    ngx_mmdb_node_t      *node;
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (sa->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) sa;
+
+        addr = sin6->sin6_addr.s6_addr;
+        len = 16;
+
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            addr += 12;
+            len = 4;
+        }
+
+        break;
+#endif
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) sa;
+
+        addr = (u_char *) &sin->sin_addr.s_addr;
+        len = 4;
+        break;
+
+    default:
+        return NGX_DECLINED;
+    }
+
+    n = db->fields.nelts;
+
+    if (db->cache_max == 0) {
+        buf = ngx_pnalloc(pool, n * NGX_MMDB_VALUE_LEN);
+        if (buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        return ngx_mmdb_extract(db, addr, len, values, buf, log);
+    }
+
+    hash = ngx_crc32_short(addr, len);
+
+    node = ngx_mmdb_cache_lookup(db, addr, len, hash);
+
+    if (node) {
+        ngx_queue_remove(&node->queue);
+        ngx_queue_insert_head(&db->lru, &node->queue);
+
+    } else {
+        node = ngx_mmdb_cache_add(db, addr, len, hash, log);
+        if (node == NULL) {
+            return NGX_ERROR;
+        }
+
+        rc = ngx_mmdb_extract(db, addr, len, node->values,
+                              (u_char *) &node->values[n], log);
+
+        if (rc == NGX_ERROR) {
+            ngx_rbtree_delete(&db->rbtree, &node->node);
+            ngx_queue_remove(&node->queue);
+            ngx_free(node);
+            db->cached--;
+
+            return NGX_ERROR;
+        }
+
+        node->found = (rc == NGX_OK);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "mmdb cached:%ui found:%d", db->cached, node->found);
+
+    if (!node->found) {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * strings point to the database, and the rest is copied
+     * as the node may be reused by a later lookup
+     */
+
+    for (i = 0; i < n; i++) {
+        values[i] = node->values[i];
+
+        if (values[i].data == NULL
+            || (values[i].data >= db->data && values[i].data < db->end))
+        {
+            continue;
+        }
+
+        p = ngx_pnalloc(pool, values[i].len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, values[i].data, values[i].len);
+        values[i].data = p;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_mmdb_extract(ngx_mmdb_t *db, u_char *addr, ngx_uint_t len,
+    ngx_str_t *values, u_char *buf, ngx_log_t *log)
+{
+    u_char            *data, *p;
+    ngx_int_t          rc;
+    ngx_uint_t         i, k;
+    ngx_mmdb_field_t  *field;
+    ngx_mmdb_entry_t   e;
+
+    rc = ngx_mmdb_search(db, addr, len, &data);
+
+    if (rc != NGX_OK) {
+        goto done;
+    }
+
+    field = db->fields.elts;
+
+    for (i = 0; i < db->fields.nelts; i++) {
+        p = data;
+
+        rc = ngx_mmdb_decode(db->data, db->end, &p, &e);
+
+        for (k = 0; rc == NGX_OK && k < field[i].nkeys; k++) {
+            rc = ngx_mmdb_find(db->data, db->end, &e, &field[i].keys[k]);
+        }
+
+        if (rc == NGX_ERROR) {
+            goto done;
+        }
+
+        if (rc == NGX_DECLINED
+            || ngx_mmdb_format(&e, &values[i], buf + i * NGX_MMDB_VALUE_LEN)
+               != NGX_OK)
+        {
+            values[i].len = 0;
+            values[i].data = NULL;
+        }
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    if (rc == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "invalid data in MaxMind DB \"%s\"", db->fm.name);
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_mmdb_search(ngx_mmdb_t *db, u_char *addr, ngx_uint_t len, u_char **data)
+{
+    size_t      offset;
+    uint32_t    node;
+    ngx_uint_t  i, bits;
+
+    if (len == 4) {
+        node = db->ipv4_node;
+
+    } else if (db->ip_version == 6) {
+        node = 0;
+
+    } else {
+        return NGX_DECLINED;
+    }
+
+    bits = len * 8;
+
+    for (i = 0; i < bits && node < db->node_count; i++) {
+        node = ngx_mmdb_record(db, node,
+                               (addr[i >> 3] >> (7 - (i & 7))) & 1);
+    }
+
+    if (node == db->node_count) {
+        return NGX_DECLINED;
+    }
+
+    if (node < db->node_count) {
+        return NGX_ERROR;
+    }
+
+    offset = (size_t) (node - db->node_count) - 16;
+
+    if (offset >= (size_t) (db->end - db->data)) {
+        return NGX_ERROR;
+    }
+
+    *data = db->data + offset;
+
+    return NGX_OK;
+}
+
+
+static uint32_t
+ngx_mmdb_record(ngx_mmdb_t *db, uint32_t node, ngx_uint_t bit)
+{
+    u_char  *p;
+
+    switch (db->record_size) {
+
+    case 24:
+        p = db->start + (size_t) node * 6 + bit * 3;
+        return ((uint32_t) p[0] << 16) | (p[1] << 8) | p[2];
+
+    case 28:
+        p = db->start + (size_t) node * 7;
+
+        if (bit) {
+            return ((uint32_t) (p[3] & 0x0f) << 24)
+                   | ((uint32_t) p[4] << 16) | (p[5] << 8) | p[6];
+        }
+
+        return ((uint32_t) (p[3] & 0xf0) << 20)
+               | ((uint32_t) p[0] << 16) | (p[1] << 8) | p[2];
+
+    default: /* 32 */
+        p = db->start + (size_t) node * 8 + bit * 4;
+        return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+               | (p[2] << 8) | p[3];
+    }
+}
+
+
+static ngx_int_t
+ngx_mmdb_decode(u_char *base, u_char *end, u_char **pos, ngx_mmdb_entry_t *e)
+{
+    u_char      *p, ctrl;
+    size_t       ptr;
+    ngx_uint_t   n, type, size, pointer;
+
+    p = *pos;
+    pointer = 0;
+
+again:
+
+    if (p >= end) {
+        return NGX_ERROR;
+    }
+
+    ctrl = *p++;
+    type = ctrl >> 5;
+
+    if (type == NGX_MMDB_POINTER) {
+
+        /* pointers to pointers are invalid */
+
+        if (pointer) {
+            return NGX_ERROR;
+        }
+
+        n = (ctrl >> 3) & 3;
+
+        if ((size_t) (end - p) < n + 1) {
+            return NGX_ERROR;
+        }
+
+        switch (n) {
+
+        case 0:
+            ptr = ((ctrl & 7) << 8) | p[0];
+            break;
+
+        case 1:
+            ptr = (((ctrl & 7) << 16) | (p[0] << 8) | p[1]) + 2048;
+            break;
+
+        case 2:
+            ptr = (((size_t) (ctrl & 7) << 24) | (p[0] << 16) | (p[1] << 8)
+                   | p[2])
+                  + 526336;
+            break;
+
+        default: /* 3 */
+            ptr = ((size_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+            break;
+        }
+
+        if (ptr >= (size_t) (end - base)) {
+            return NGX_ERROR;
+        }
+
+        *pos = p + n + 1;
+        pointer = 1;
+
+        p = base + ptr;
+        goto again;
+    }
+
+    if (type == 0) {
+
+        /* an extended type */
+
+        if (p == end) {
+            return NGX_ERROR;
+        }
+
+        type = 7 + *p++;
+    }
+
+    size = ctrl & 0x1f;
+
+    if (size >= 29) {
+        n = size - 28;
+
+        if ((size_t) (end - p) < n) {
+            return NGX_ERROR;
+        }
+
+        switch (n) {
+
+        case 1:
+            size = 29 + p[0];
+            break;
+
+        case 2:
+            size = 285 + ((p[0] << 8) | p[1]);
+            break;
+
+        default: /* 3 */
+            size = 65821 + ((p[0] << 16) | (p[1] << 8) | p[2]);
+            break;
+        }
+
+        p += n;
+    }
+
+    e->type = type;
+    e->size = size;
+    e->data = p;
+
+    switch (type) {
+
+    case NGX_MMDB_MAP:
+    case NGX_MMDB_ARRAY:
+
+        /* the contents follow */
+
+        break;
+
+    case NGX_MMDB_BOOLEAN:
+
+        /* the value is the size */
+
+        break;
+
+    case NGX_MMDB_DOUBLE:
+        if (size != 8) {
+            return NGX_ERROR;
+        }
+
+        /* fall through */
+
+    default:
+        if ((size_t) (end - p) < size) {
+            return NGX_ERROR;
+        }
+
+        p += size;
+    }
+
+    if (!pointer) {
+        *pos = p;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_mmdb_skip(u_char *base, u_char *end, u_char **pos, ngx_uint_t depth)
+{
+    ngx_uint_t        i, n, pointer;
+    ngx_mmdb_entry_t  e;
+
+    if (depth > NGX_MMDB_MAX_DEPTH || *pos >= end) {
+        return NGX_ERROR;
+    }
+
+    pointer = ((**pos >> 5) == NGX_MMDB_POINTER);
+
+    if (ngx_mmdb_decode(base, end, pos, &e) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (pointer) {
+        return NGX_OK;
+    }
+
+    switch (e.type) {
+
+    case NGX_MMDB_MAP:
+        n = e.size * 2;
+        break;
+
+    case NGX_MMDB_ARRAY:
+        n = e.size;
+        break;
+
+    default:
+        return NGX_OK;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ngx_mmdb_skip(base, end, pos, depth + 1) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_mmdb_find(u_char *base, u_char *end, ngx_mmdb_entry_t *e, ngx_str_t *key)
+{
+    u_char            *p;
+    ngx_int_t          index;
+    ngx_uint_t         i;
+    ngx_mmdb_entry_t   k;
+
+    p = e->data;
+
+    switch (e->type) {
+
+    case NGX_MMDB_MAP:
+
+        for (i = 0; i < e->size; i++) {
+
+            if (ngx_mmdb_decode(base, end, &p, &k) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            if (k.type == NGX_MMDB_STRING
+                && k.size == key->len
+                && ngx_memcmp(k.data, key->data, key->len) == 0)
+            {
+                return ngx_mmdb_decode(base, end, &p, e);
+            }
+
+            if (ngx_mmdb_skip(base, end, &p, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        return NGX_DECLINED;
+
+    case NGX_MMDB_ARRAY:
+
+        index = ngx_atoi(key->data, key->len);
+
+        if (index == NGX_ERROR || (ngx_uint_t) index >= e->size) {
+            return NGX_DECLINED;
+        }
+
+        for (i = 0; i < (ngx_uint_t) index; i++) {
+            if (ngx_mmdb_skip(base, end, &p, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        return ngx_mmdb_decode(base, end, &p, e);
+
+    default:
+        return NGX_DECLINED;
+    }
+}
+
+
+static ngx_int_t
+ngx_mmdb_format(ngx_mmdb_entry_t *e, ngx_str_t *value, u_char *buf)
+{
+    float     f;
+    double    d;
+    uint32_t  u32;
+    uint64_t  u64;
+
+    switch (e->type) {
+
+    case NGX_MMDB_STRING:
+    case NGX_MMDB_BYTES:
+        value->len = e->size;
+        value->data = e->data;
+        return NGX_OK;
+
+    case NGX_MMDB_DOUBLE:
+        u64 = ngx_mmdb_uint(e->data, 8);
+        ngx_memcpy(&d, &u64, sizeof(double));
+        break;
+
+    case NGX_MMDB_FLOAT:
+        if (e->size != 4) {
+            return NGX_DECLINED;
+        }
+
+        u32 = (uint32_t) ngx_mmdb_uint(e->data, 4);
+        ngx_memcpy(&f, &u32, sizeof(float));
+        d = f;
+        break;
+
+    case NGX_MMDB_UINT16:
+    case NGX_MMDB_UINT32:
+    case NGX_MMDB_UINT64:
+        if (e->size > 8) {
+            return NGX_DECLINED;
+        }
+
+        value->len = ngx_snprintf(buf, NGX_MMDB_VALUE_LEN, "%uL",
+                                  ngx_mmdb_uint(e->data, e->size))
+                     - buf;
+        value->data = buf;
+        return NGX_OK;
+
+    case NGX_MMDB_UINT128:
+        if (e->size > 16) {
+            return NGX_DECLINED;
+        }
+
+        if (e->size > 8 && ngx_mmdb_uint(e->data, e->size - 8) != 0) {
+            value->len = ngx_hex_dump(ngx_cpymem(buf, "0x", 2), e->data,
+                                      e->size)
+                         - buf;
+
+        } else {
+            value->len = ngx_snprintf(buf, NGX_MMDB_VALUE_LEN, "%uL",
+                                      ngx_mmdb_uint(e->data, e->size))
+                         - buf;
+        }
+
+        value->data = buf;
+        return NGX_OK;
+
+    case NGX_MMDB_INT32:
+        if (e->size > 4) {
+            return NGX_DECLINED;
+        }
+
+        value->len = ngx_snprintf(buf, NGX_MMDB_VALUE_LEN, "%D",
+                                  (int32_t) ngx_mmdb_uint(e->data, e->size))
+                     - buf;
+        value->data = buf;
+        return NGX_OK;
+
+    case NGX_MMDB_BOOLEAN:
+        buf[0] = e->size ? '1' : '0';
+        value->len = 1;
+        value->data = buf;
+        return NGX_OK;
+
+    default:
+        return NGX_DECLINED;
+    }
+
+    /* latitude and longitude have 4 digits of precision */
+
+    value->len = ngx_snprintf(buf, NGX_MMDB_VALUE_LEN, "%.4f", d) - buf;
+    value->data = buf;
+
+    return NGX_OK;
+}
+
+
+static uint64_t
+ngx_mmdb_uint(u_char *p, ngx_uint_t size)
+{
+    uint64_t  n;
+
+    n = 0;
+
+    while (size--) {
+        n = (n << 8) | *p++;
+    }
+
+    return n;
+}
+
+
+static ngx_mmdb_node_t *
+ngx_mmdb_cache_lookup(ngx_mmdb_t *db, u_char *addr, ngx_uint_t len,
+    uint32_t hash)
+{
+    ngx_int_t           rc;
+    ngx_mmdb_node_t    *mn;
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    node = db->rbtree.root;
+    sentinel = db->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        mn = (ngx_mmdb_node_t *) node;
+
+        rc = (ngx_int_t) len - mn->len;
+
+        if (rc == 0) {
+            rc = ngx_memcmp(addr, mn->addr, len);
+        }
+
+        if (rc == 0) {
+            return mn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static ngx_mmdb_node_t *
+ngx_mmdb_cache_add(ngx_mmdb_t *db, u_char *addr, ngx_uint_t len,
+    uint32_t hash, ngx_log_t *log)
+{
+    ngx_queue_t      *q;
+    ngx_mmdb_node_t  *node;
+
+    if (db->cached < db->cache_max) {
+
+        /* values are followed by the buffers for numbers */
+
+        node = ngx_alloc(offsetof(ngx_mmdb_node_t, values)
+                         + db->fields.nelts
+                           * (sizeof(ngx_str_t) + NGX_MMDB_VALUE_LEN),
+                         log);
+        if (node == NULL) {
+            return NULL;
+        }
+
+        db->cached++;
+
+    } else {
+
+        /* reuse the least recently used node */
+
+        q = ngx_queue_last(&db->lru);
+        node = ngx_queue_data(q, ngx_mmdb_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&db->rbtree, &node->node);
+    }
+
+    node->node.key = hash;
+    node->len = (u_char) len;
+    node->found = 0;
+    ngx_memcpy(node->addr, addr, len);
+
+    ngx_rbtree_insert(&db->rbtree, &node->node);
+    ngx_queue_insert_head(&db->lru, &node->queue);
+
+    return node;
+}
+
+
+static void
+ngx_mmdb_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_int_t           rc;
+    ngx_mmdb_node_t    *mn, *mnt;
+    ngx_rbtree_node_t **p;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            mn = (ngx_mmdb_node_t *) node;
+            mnt = (ngx_mmdb_node_t *) temp;
+
+            rc = (ngx_int_t) mn->len - mnt->len;
+
+            if (rc == 0) {
+                rc = ngx_memcmp(mn->addr, mnt->addr, mn->len);
+            }
+
+            p = (rc < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static void
+ngx_mmdb_cleanup(void *data)
+{
+    ngx_mmdb_t  *db = data;
+
+    ngx_queue_t      *q;
+    ngx_mmdb_node_t  *node;
+
+    while (!ngx_queue_empty(&db->lru)) {
+        q = ngx_queue_head(&db->lru);
+        node = ngx_queue_data(q, ngx_mmdb_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_free(node);
+    }
+
+    ngx_close_file_mapping(&db->fm);
+}
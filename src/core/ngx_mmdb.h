@@ -0,0 +1,72 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_MMDB_H_INCLUDED_
+#define _NGX_MMDB_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * A reader of MaxMind DB files.  A database is mapped read-only when
+ * the configuration is read, so its pages are shared by all processes.
+ * The fields of interest are declared in advance: a lookup walks the
+ * search tree once and extracts all of them, and the results are kept
+ * in a per-process LRU cache keyed by the address.
+ */
+
+#define NGX_MMDB_VALUE_LEN  48
+
+
+typedef struct {
+    ngx_str_t            *keys;
+    ngx_uint_t            nkeys;
+} ngx_mmdb_field_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t     node;
+    ngx_queue_t           queue;
+    u_char                addr[16];
+    u_char                len;
+    u_char                found;
+    ngx_str_t             values[1];
+} ngx_mmdb_node_t;
+
+
+typedef struct {
+    ngx_file_mapping_t    fm;
+
+    u_char               *start;
+    u_char               *data;
+    u_char               *end;
+
+    uint32_t              node_count;
+    uint32_t              ipv4_node;
+    ngx_uint_t            record_size;
+    ngx_uint_t            ip_version;
+
+    ngx_array_t           fields;       /* ngx_mmdb_field_t */
+
+    ngx_rbtree_t          rbtree;
+    ngx_rbtree_node_t     sentinel;
+    ngx_queue_t           lru;
+    ngx_uint_t            cached;
+    ngx_uint_t            cache_max;
+} ngx_mmdb_t;
+
+
+ngx_mmdb_t *ngx_mmdb_open(ngx_conf_t *cf, ngx_str_t *name,
+    ngx_uint_t cache);
+ngx_int_t ngx_mmdb_add_field(ngx_conf_t *cf, ngx_mmdb_t *db,
+    ngx_str_t *keys, ngx_uint_t n);
+ngx_int_t ngx_mmdb_lookup(ngx_mmdb_t *db, struct sockaddr *sa,
+    ngx_str_t *values, ngx_pool_t *pool, ngx_log_t *log);
+
+
+#endif /* _NGX_MMDB_H_INCLUDED_ */
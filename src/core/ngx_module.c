@@ -65,11 +65,20 @@ ngx_cycle_modules(ngx_cycle_t *cycle)
 ngx_int_t
 ngx_init_modules(ngx_cycle_t *cycle)
 {
-    ngx_uint_t  i;
+    ngx_int_t           rc;
+    ngx_uint_t          i;
+    ngx_conf_profile_t  profile;
 
     for (i = 0; cycle->modules[i]; i++) {
         if (cycle->modules[i]->init_module) {
-            if (cycle->modules[i]->init_module(cycle) != NGX_OK) {
+            ngx_conf_profile_start(&profile);
+
+            rc = cycle->modules[i]->init_module(cycle);
+
+            ngx_conf_profile_stop(&profile, cycle->modules[i],
+                                  NGX_CONF_PROFILE_INIT_MODULE);
+
+            if (rc != NGX_OK) {
                 return NGX_ERROR;
             }
         }
@@ -8,6 +8,10 @@
 #include <ngx_core.h>
 
 
+static const u_char *ngx_murmur_hash3_body(ngx_murmur_hash3_t *ctx,
+    const u_char *data, size_t size);
+
+
 uint32_t
 ngx_murmur_hash2(u_char *data, size_t len)
 {
@@ -50,3 +54,275 @@ ngx_murmur_hash2(u_char *data, size_t len)
 
     return h;
 }
+
+
+/*
+ * MurmurHash3 x64 128-bit variant with the zero seed, the result
+ * is h1 and h2 in little-endian byte order
+ */
+
+#define ngx_murmur_rotl64(x, r)  (((x) << (r)) | ((x) >> (64 - (r))))
+
+#define ngx_murmur_c1  0x87c37b91114253d5ULL
+#define ngx_murmur_c2  0x4cf5ad432745937fULL
+
+#if (NGX_HAVE_LITTLE_ENDIAN && NGX_HAVE_NONALIGNED)
+
+#define ngx_murmur_get64(p)  (*(uint64_t *) (p))
+
+#else
+
+#define ngx_murmur_get64(p)                                                   \
+    ((uint64_t) (p)[0] | ((uint64_t) (p)[1] << 8)                             \
+     | ((uint64_t) (p)[2] << 16) | ((uint64_t) (p)[3] << 24)                  \
+     | ((uint64_t) (p)[4] << 32) | ((uint64_t) (p)[5] << 40)                  \
+     | ((uint64_t) (p)[6] << 48) | ((uint64_t) (p)[7] << 56))
+
+#endif
+
+
+void
+ngx_murmur_hash3_init(ngx_murmur_hash3_t *ctx)
+{
+    ctx->h1 = 0;
+    ctx->h2 = 0;
+
+    ctx->bytes = 0;
+}
+
+
+void
+ngx_murmur_hash3_update(ngx_murmur_hash3_t *ctx, const void *data,
+    size_t size)
+{
+    size_t  used, free;
+
+    used = (size_t) (ctx->bytes & 0xf);
+    ctx->bytes += size;
+
+    if (used) {
+        free = 16 - used;
+
+        if (size < free) {
+            ngx_memcpy(&ctx->buffer[used], data, size);
+            return;
+        }
+
+        ngx_memcpy(&ctx->buffer[used], data, free);
+        data = (u_char *) data + free;
+        size -= free;
+        (void) ngx_murmur_hash3_body(ctx, ctx->buffer, 16);
+    }
+
+    if (size >= 16) {
+        data = ngx_murmur_hash3_body(ctx, data, size & ~(size_t) 0xf);
+        size &= 0xf;
+    }
+
+    ngx_memcpy(ctx->buffer, data, size);
+}
+
+
+static ngx_inline uint64_t
+ngx_murmur_fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+
+void
+ngx_murmur_hash3_final(u_char result[16], ngx_murmur_hash3_t *ctx)
+{
+    u_char    *p;
+    size_t     n;
+    uint64_t   h1, h2, k1, k2;
+
+    h1 = ctx->h1;
+    h2 = ctx->h2;
+
+    p = ctx->buffer;
+    n = (size_t) (ctx->bytes & 0xf);
+
+    k1 = 0;
+    k2 = 0;
+
+    switch (n) {
+    case 15:
+        k2 ^= (uint64_t) p[14] << 48;
+        /* fall through */
+    case 14:
+        k2 ^= (uint64_t) p[13] << 40;
+        /* fall through */
+    case 13:
+        k2 ^= (uint64_t) p[12] << 32;
+        /* fall through */
+    case 12:
+        k2 ^= (uint64_t) p[11] << 24;
+        /* fall through */
+    case 11:
+        k2 ^= (uint64_t) p[10] << 16;
+        /* fall through */
+    case 10:
+        k2 ^= (uint64_t) p[9] << 8;
+        /* fall through */
+    case 9:
+        k2 ^= (uint64_t) p[8];
+        k2 *= ngx_murmur_c2;
+        k2 = ngx_murmur_rotl64(k2, 33);
+        k2 *= ngx_murmur_c1;
+        h2 ^= k2;
+        /* fall through */
+    case 8:
+        k1 ^= (uint64_t) p[7] << 56;
+        /* fall through */
+    case 7:
+        k1 ^= (uint64_t) p[6] << 48;
+        /* fall through */
+    case 6:
+        k1 ^= (uint64_t) p[5] << 40;
+        /* fall through */
+    case 5:
+        k1 ^= (uint64_t) p[4] << 32;
+        /* fall through */
+    case 4:
+        k1 ^= (uint64_t) p[3] << 24;
+        /* fall through */
+    case 3:
+        k1 ^= (uint64_t) p[2] << 16;
+        /* fall through */
+    case 2:
+        k1 ^= (uint64_t) p[1] << 8;
+        /* fall through */
+    case 1:
+        k1 ^= (uint64_t) p[0];
+        k1 *= ngx_murmur_c1;
+        k1 = ngx_murmur_rotl64(k1, 31);
+        k1 *= ngx_murmur_c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= ctx->bytes;
+    h2 ^= ctx->bytes;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = ngx_murmur_fmix64(h1);
+    h2 = ngx_murmur_fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    for (n = 0; n < 8; n++) {
+        result[n] = (u_char) (h1 >> (n * 8));
+        result[n + 8] = (u_char) (h2 >> (n * 8));
+    }
+
+    ngx_memzero(ctx, sizeof(*ctx));
+}
+
+
+static const u_char *
+ngx_murmur_hash3_body(ngx_murmur_hash3_t *ctx, const u_char *data,
+    size_t size)
+{
+    uint64_t  h1, h2, k1, k2;
+
+    h1 = ctx->h1;
+    h2 = ctx->h2;
+
+    do {
+        k1 = ngx_murmur_get64(data);
+        k2 = ngx_murmur_get64(data + 8);
+
+        k1 *= ngx_murmur_c1;
+        k1 = ngx_murmur_rotl64(k1, 31);
+        k1 *= ngx_murmur_c2;
+        h1 ^= k1;
+
+        h1 = ngx_murmur_rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= ngx_murmur_c2;
+        k2 = ngx_murmur_rotl64(k2, 33);
+        k2 *= ngx_murmur_c1;
+        h2 ^= k2;
+
+        h2 = ngx_murmur_rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+
+        data += 16;
+
+    } while (size -= 16);
+
+    ctx->h1 = h1;
+    ctx->h2 = h2;
+
+    return data;
+}
+
+
+/*
+ * MurmurHash64A with the zero seed, it reads 8 bytes per step and is
+ * about twice as fast as MurmurHash2 on long keys
+ */
+
+uint64_t
+ngx_murmur_hash64a(u_char *data, size_t len)
+{
+    uint64_t  h, k;
+
+    h = (uint64_t) len * 0xc6a4a7935bd1e995ULL;
+
+    while (len >= 8) {
+        k = ngx_murmur_get64(data);
+
+        k *= 0xc6a4a7935bd1e995ULL;
+        k ^= k >> 47;
+        k *= 0xc6a4a7935bd1e995ULL;
+
+        h ^= k;
+        h *= 0xc6a4a7935bd1e995ULL;
+
+        data += 8;
+        len -= 8;
+    }
+
+    switch (len) {
+    case 7:
+        h ^= (uint64_t) data[6] << 48;
+        /* fall through */
+    case 6:
+        h ^= (uint64_t) data[5] << 40;
+        /* fall through */
+    case 5:
+        h ^= (uint64_t) data[4] << 32;
+        /* fall through */
+    case 4:
+        h ^= (uint64_t) data[3] << 24;
+        /* fall through */
+    case 3:
+        h ^= (uint64_t) data[2] << 16;
+        /* fall through */
+    case 2:
+        h ^= (uint64_t) data[1] << 8;
+        /* fall through */
+    case 1:
+        h ^= data[0];
+        h *= 0xc6a4a7935bd1e995ULL;
+    }
+
+    h ^= h >> 47;
+    h *= 0xc6a4a7935bd1e995ULL;
+    h ^= h >> 47;
+
+    return h;
+}
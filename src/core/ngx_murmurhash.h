@@ -13,7 +13,20 @@
 #include <ngx_core.h>
 
 
+typedef struct {
+    uint64_t  h1, h2;
+    uint64_t  bytes;
+    u_char    buffer[16];
+} ngx_murmur_hash3_t;
+
+
 uint32_t ngx_murmur_hash2(u_char *data, size_t len);
+uint64_t ngx_murmur_hash64a(u_char *data, size_t len);
+
+void ngx_murmur_hash3_init(ngx_murmur_hash3_t *ctx);
+void ngx_murmur_hash3_update(ngx_murmur_hash3_t *ctx, const void *data,
+    size_t size);
+void ngx_murmur_hash3_final(u_char result[16], ngx_murmur_hash3_t *ctx);
 
 
 #endif /* _NGX_MURMURHASH_H_INCLUDED_ */
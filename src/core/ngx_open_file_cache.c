@@ -9,18 +9,43 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 
 /*
  * open file cache caches
  *    open file handles with stat() info;
  *    directories stat() info;
- *    files and directories errors: not found, access denied, etc.
+ *    files and directories errors: not found, access denied, etc.;
+ *    contents of small files, if enabled.
  */
 
 
 #define NGX_MIN_READ_AHEAD  (128 * 1024)
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_str_t                name;
+    ngx_open_file_info_t     of;
+    ngx_int_t                rc;
+    ngx_log_t               *log;
+
+    /* the descriptor and the inode the operation was started with */
+    ngx_fd_t                 fd;
+    ngx_file_uniq_t          uniq;
+
+    unsigned                 stat:1;
+    unsigned                 test_dir:1;
+    unsigned                 pending:1;
+} ngx_open_file_thread_ctx_t;
+
+#endif
+
+
 static void ngx_open_file_cache_cleanup(void *data);
 #if (NGX_HAVE_OPENAT)
 static ngx_fd_t ngx_openat_file_owner(ngx_fd_t at_fd, const u_char *name,
@@ -37,8 +62,20 @@ static ngx_int_t ngx_file_info_wrapper(ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_file_info_t *fi, ngx_log_t *log);
 static ngx_int_t ngx_open_and_stat_file(ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_log_t *log);
+static ngx_int_t ngx_stat_file(ngx_str_t *name, ngx_open_file_info_t *of,
+    ngx_log_t *log);
+static ngx_int_t ngx_open_file_thread(ngx_str_t *name,
+    ngx_open_file_info_t *of, ngx_uint_t stat, ngx_pool_t *pool);
+#if (NGX_THREADS)
+static void ngx_open_file_thread_handler(void *data, ngx_log_t *log);
+static void ngx_open_file_thread_discard(ngx_open_file_thread_ctx_t *ctx);
+static void ngx_open_file_thread_cleanup(void *data);
+#endif
 static void ngx_open_file_add_event(ngx_open_file_cache_t *cache,
     ngx_cached_open_file_t *file, ngx_open_file_info_t *of, ngx_log_t *log);
+static void ngx_open_file_content(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file, ngx_open_file_info_t *of, ngx_log_t *log);
+static void ngx_open_file_content_free(ngx_open_file_content_t *content);
 static void ngx_open_file_cleanup(void *data);
 static void ngx_close_cached_file(ngx_open_file_cache_t *cache,
     ngx_cached_open_file_t *file, ngx_uint_t min_uses, ngx_log_t *log);
@@ -51,6 +88,29 @@ static ngx_cached_open_file_t *
     ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
+#if (NGX_HAVE_INOTIFY)
+static ngx_int_t ngx_open_file_inotify_init(ngx_log_t *log);
+static ngx_int_t ngx_open_file_inotify_add(ngx_open_file_cache_event_t *fev,
+    ngx_log_t *log);
+static void ngx_open_file_inotify_del(ngx_open_file_cache_event_t *fev);
+static ngx_open_file_cache_event_t *ngx_open_file_inotify_lookup(int wd);
+static void ngx_open_file_inotify_handler(ngx_event_t *ev);
+
+
+/*
+ * a single inotify instance per process watches the open files of all
+ * caches, the watches are found by their descriptors in an rbtree; as
+ * watches are per inode, several cached files may share a watch
+ */
+
+static int                ngx_open_file_inotify = -1;
+static ngx_uint_t         ngx_open_file_inotify_failed;
+static ngx_event_t        ngx_open_file_inotify_rev;
+static ngx_event_t        ngx_open_file_inotify_wev;
+static ngx_connection_t   ngx_open_file_inotify_conn;
+static ngx_rbtree_t       ngx_open_file_inotify_tree;
+static ngx_rbtree_node_t  ngx_open_file_inotify_sentinel;
+#endif
 
 
 ngx_open_file_cache_t *
@@ -72,6 +132,7 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
     cache->current = 0;
     cache->max = max;
     cache->inactive = inactive;
+    cache->content = 0;
 
     cln = ngx_pool_cleanup_add(pool, 0);
     if (cln == NULL) {
@@ -147,7 +208,6 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     time_t                          now;
     uint32_t                        hash;
     ngx_int_t                       rc;
-    ngx_file_info_t                 fi;
     ngx_pool_cleanup_t             *cln;
     ngx_cached_open_file_t         *file;
     ngx_pool_cleanup_file_t        *clnf;
@@ -155,27 +215,12 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     of->fd = NGX_INVALID_FILE;
     of->err = 0;
+    of->content = NULL;
 
     if (cache == NULL) {
 
         if (of->test_only) {
-
-            if (ngx_file_info_wrapper(name, of, &fi, pool->log)
-                == NGX_FILE_ERROR)
-            {
-                return NGX_ERROR;
-            }
-
-            of->uniq = ngx_file_uniq(&fi);
-            of->mtime = ngx_file_mtime(&fi);
-            of->size = ngx_file_size(&fi);
-            of->fs_size = ngx_file_fs_size(&fi);
-            of->is_dir = ngx_is_dir(&fi);
-            of->is_file = ngx_is_file(&fi);
-            of->is_link = ngx_is_link(&fi);
-            of->is_exec = ngx_is_exec(&fi);
-
-            return NGX_OK;
+            return ngx_open_file_thread(name, of, 1, pool);
         }
 
         cln = ngx_pool_cleanup_add(pool, sizeof(ngx_pool_cleanup_file_t));
@@ -183,7 +228,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
             return NGX_ERROR;
         }
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_file_thread(name, of, 0, pool);
 
         if (rc == NGX_OK && !of->is_dir) {
             cln->handler = ngx_pool_cleanup_file;
@@ -218,7 +263,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
             /* file was not used often enough to keep open */
 
-            rc = ngx_open_and_stat_file(name, of, pool->log);
+            rc = ngx_open_file_thread(name, of, 0, pool);
+
+            if (rc == NGX_AGAIN) {
+                goto again;
+            }
 
             if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
                 goto failed;
@@ -286,7 +335,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         of->fd = file->fd;
         of->uniq = file->uniq;
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_file_thread(name, of, 0, pool);
+
+        if (rc == NGX_AGAIN) {
+            goto again;
+        }
 
         if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
             goto failed;
@@ -332,6 +385,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
             ngx_open_file_del_event(file);
 
+            if (file->content) {
+                ngx_open_file_content_free(file->content);
+                file->content = NULL;
+            }
+
             if (ngx_close_file(file->fd) == NGX_FILE_ERROR) {
                 ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
                               ngx_close_file_n " \"%V\" failed", name);
@@ -351,7 +409,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     /* not found */
 
-    rc = ngx_open_and_stat_file(name, of, pool->log);
+    rc = ngx_open_file_thread(name, of, 0, pool);
+
+    if (rc == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
 
     if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
         goto failed;
@@ -389,6 +451,7 @@ create:
     file->count = 0;
     file->use_event = 0;
     file->event = NULL;
+    file->content = NULL;
 
 add_event:
 
@@ -418,6 +481,10 @@ update:
 
         if (!of->is_dir) {
             file->count++;
+
+            file->etag_len = ngx_sprintf(file->etag, "\"%xT-%xO\"",
+                                         of->mtime, of->size)
+                             - file->etag;
         }
     }
 
@@ -425,6 +492,14 @@ update:
 
 found:
 
+#if (NGX_THREADS)
+
+    if (of->thread_task && !of->thread_task->event.active) {
+        ngx_open_file_thread_discard(of->thread_task->ctx);
+    }
+
+#endif
+
     file->accessed = now;
 
     ngx_queue_insert_head(&cache->expire_queue, &file->queue);
@@ -436,11 +511,20 @@ found:
     if (of->err == 0) {
 
         if (!of->is_dir) {
+
+            if (of->read_content && cache->content) {
+                ngx_open_file_content(cache, file, of, pool->log);
+            }
+
+            of->etag.len = file->etag_len;
+            of->etag.data = file->etag;
+
             cln->handler = ngx_open_file_cleanup;
             ofcln = cln->data;
 
             ofcln->cache = cache;
             ofcln->file = file;
+            ofcln->content = of->content;
             ofcln->min_uses = of->min_uses;
             ofcln->log = pool->log;
         }
@@ -450,6 +534,16 @@ found:
 
     return NGX_ERROR;
 
+again:
+
+    /* the file is tested in a thread, the request is resumed later */
+
+    file->uses--;
+
+    ngx_queue_insert_head(&cache->expire_queue, &file->queue);
+
+    return NGX_AGAIN;
+
 failed:
 
     if (file) {
@@ -459,6 +553,10 @@ failed:
 
         if (file->count == 0) {
 
+            if (file->content) {
+                ngx_open_file_content_free(file->content);
+            }
+
             if (file->fd != NGX_INVALID_FILE) {
                 if (ngx_close_file(file->fd) == NGX_FILE_ERROR) {
                     ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
@@ -945,6 +1043,205 @@ done:
 }
 
 
+static ngx_int_t
+ngx_stat_file(ngx_str_t *name, ngx_open_file_info_t *of, ngx_log_t *log)
+{
+    ngx_file_info_t  fi;
+
+    if (ngx_file_info_wrapper(name, of, &fi, log) == NGX_FILE_ERROR) {
+        return NGX_ERROR;
+    }
+
+    of->uniq = ngx_file_uniq(&fi);
+    of->mtime = ngx_file_mtime(&fi);
+    of->size = ngx_file_size(&fi);
+    of->fs_size = ngx_file_fs_size(&fi);
+    of->is_dir = ngx_is_dir(&fi);
+    of->is_file = ngx_is_file(&fi);
+    of->is_link = ngx_is_link(&fi);
+    of->is_exec = ngx_is_exec(&fi);
+
+    return NGX_OK;
+}
+
+
+/*
+ * stat() a file as an uncached ngx_open_cached_file() with of->test_only
+ * would, honouring of->disable_symlinks; this may be called in a thread
+ */
+
+ngx_int_t
+ngx_open_file_stat(ngx_str_t *name, ngx_open_file_info_t *of, ngx_log_t *log)
+{
+    return ngx_stat_file(name, of, log);
+}
+
+
+/*
+ * open() and stat() may block on a cold dentry cache, so if the caller
+ * provided a thread handler, they are run in a thread pool, and NGX_AGAIN
+ * is returned; the caller is expected to repeat the same call once the
+ * task is completed, and the result is then taken from the task
+ */
+
+static ngx_int_t
+ngx_open_file_thread(ngx_str_t *name, ngx_open_file_info_t *of,
+    ngx_uint_t stat, ngx_pool_t *pool)
+{
+#if (NGX_THREADS)
+    ngx_thread_task_t           *task;
+    ngx_pool_cleanup_t          *cln;
+    ngx_open_file_thread_ctx_t  *ctx;
+
+    if (of->thread_handler == NULL) {
+        goto sync;
+    }
+
+    task = of->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(pool, sizeof(ngx_open_file_thread_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_open_file_thread_cleanup;
+        cln->data = task->ctx;
+
+        of->thread_task = task;
+    }
+
+    ctx = task->ctx;
+
+    if (task->event.active) {
+        /* the caller was woken up before the task was completed */
+        return NGX_AGAIN;
+    }
+
+    if (ctx->pending) {
+
+        if (ctx->stat == stat
+            && ctx->fd == of->fd
+            && ctx->uniq == of->uniq
+            && ctx->test_dir == of->test_dir
+            && ctx->name.len == name->len
+            && ngx_memcmp(ctx->name.data, name->data, name->len) == 0)
+        {
+            ctx->pending = 0;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                           "thread open: \"%V\" %i", name, ctx->rc);
+
+            of->fd = ctx->of.fd;
+            of->uniq = ctx->of.uniq;
+            of->mtime = ctx->of.mtime;
+            of->size = ctx->of.size;
+            of->fs_size = ctx->of.fs_size;
+            of->err = ctx->of.err;
+            of->failed = ctx->of.failed;
+
+            of->is_dir = ctx->of.is_dir;
+            of->is_file = ctx->of.is_file;
+            of->is_link = ctx->of.is_link;
+            of->is_exec = ctx->of.is_exec;
+            of->is_directio = ctx->of.is_directio;
+
+            return ctx->rc;
+        }
+
+        /* the cache was changed while the task was running */
+
+        ngx_open_file_thread_discard(ctx);
+    }
+
+    ctx->name = *name;
+    ctx->of = *of;
+    ctx->log = pool->log;
+    ctx->fd = of->fd;
+    ctx->uniq = of->uniq;
+    ctx->stat = stat;
+    ctx->test_dir = of->test_dir;
+
+    task->handler = ngx_open_file_thread_handler;
+
+    if (of->thread_handler(task, of) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ctx->pending = 1;
+
+    return NGX_AGAIN;
+
+sync:
+
+#endif
+
+    if (stat) {
+        return ngx_stat_file(name, of, pool->log);
+    }
+
+    return ngx_open_and_stat_file(name, of, pool->log);
+}
+
+
+#if (NGX_THREADS)
+
+static void
+ngx_open_file_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_open_file_thread_ctx_t *ctx = data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                   "thread open handler: \"%V\"", &ctx->name);
+
+    if (ctx->stat) {
+        ctx->rc = ngx_stat_file(&ctx->name, &ctx->of, log);
+
+    } else {
+        ctx->rc = ngx_open_and_stat_file(&ctx->name, &ctx->of, log);
+    }
+}
+
+
+static void
+ngx_open_file_thread_discard(ngx_open_file_thread_ctx_t *ctx)
+{
+    if (!ctx->pending) {
+        return;
+    }
+
+    ctx->pending = 0;
+
+    /* a descriptor passed to the task is owned by the cache */
+
+    if (ctx->rc == NGX_OK
+        && ctx->of.fd != NGX_INVALID_FILE
+        && ctx->of.fd != ctx->fd)
+    {
+        if (ngx_close_file(ctx->of.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, ctx->log, ngx_errno,
+                          ngx_close_file_n " \"%V\" failed", &ctx->name);
+        }
+    }
+}
+
+
+static void
+ngx_open_file_thread_cleanup(void *data)
+{
+    ngx_open_file_thread_ctx_t  *ctx = data;
+
+    ngx_open_file_thread_discard(ctx);
+}
+
+#endif
+
+
 /*
  * we ignore any possible event setting error and
  * fallback to usual periodic file retests
@@ -956,8 +1253,7 @@ ngx_open_file_add_event(ngx_open_file_cache_t *cache,
 {
     ngx_open_file_cache_event_t  *fev;
 
-    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)
-        || !of->events
+    if (!of->events
         || file->event
         || of->fd == NGX_INVALID_FILE
         || file->uses < of->min_uses)
@@ -965,6 +1261,16 @@ ngx_open_file_add_event(ngx_open_file_cache_t *cache,
         return;
     }
 
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+#if (NGX_HAVE_INOTIFY)
+        if (ngx_open_file_inotify_init(log) != NGX_OK) {
+            return;
+        }
+#else
+        return;
+#endif
+    }
+
     file->use_event = 0;
 
     file->event = ngx_calloc(sizeof(ngx_event_t), log);
@@ -994,6 +1300,21 @@ ngx_open_file_add_event(ngx_open_file_cache_t *cache,
 
     file->event->log = ngx_cycle->log;
 
+#if (NGX_HAVE_INOTIFY)
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+
+        if (ngx_open_file_inotify_add(fev, log) != NGX_OK) {
+            ngx_free(file->event->data);
+            ngx_free(file->event);
+            file->event = NULL;
+        }
+
+        /* see the note below on file->use_event */
+
+        return;
+    }
+#endif
+
     if (ngx_add_event(file->event, NGX_VNODE_EVENT, NGX_ONESHOT_EVENT)
         != NGX_OK)
     {
@@ -1014,11 +1335,95 @@ ngx_open_file_add_event(ngx_open_file_cache_t *cache,
 }
 
 
+static void
+ngx_open_file_content(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file, ngx_open_file_info_t *of, ngx_log_t *log)
+{
+    ssize_t                   n;
+    ngx_file_t                f;
+    ngx_open_file_content_t  *content;
+
+    content = file->content;
+
+    if (content
+        && (content->size != (size_t) of->size || content->mtime != of->mtime))
+    {
+        /* the file was changed in place */
+
+        ngx_open_file_content_free(content);
+        file->content = NULL;
+        content = NULL;
+    }
+
+    if (content == NULL) {
+
+        if (!of->is_file
+            || of->is_directio
+            || of->fd == NGX_INVALID_FILE
+            || of->size == 0
+            || of->size > (off_t) cache->content
+            || file->uses < of->min_uses)
+        {
+            return;
+        }
+
+        content = ngx_alloc(sizeof(ngx_open_file_content_t) + of->size, log);
+        if (content == NULL) {
+            return;
+        }
+
+        content->data = (u_char *) content + sizeof(ngx_open_file_content_t);
+        content->size = (size_t) of->size;
+        content->mtime = of->mtime;
+
+        ngx_memzero(&f, sizeof(ngx_file_t));
+
+        f.fd = of->fd;
+        f.name.len = ngx_strlen(file->name);
+        f.name.data = file->name;
+        f.log = log;
+
+        n = ngx_read_file(&f, content->data, content->size, 0);
+
+        if (n != (ssize_t) content->size) {
+            ngx_free(content);
+            return;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                       "cached open file content: %s, %uz",
+                       file->name, content->size);
+
+        /* the reference of the cached file itself */
+        content->count = 1;
+
+        file->content = content;
+    }
+
+    content->count++;
+
+    of->content = content;
+}
+
+
+static void
+ngx_open_file_content_free(ngx_open_file_content_t *content)
+{
+    if (--content->count == 0) {
+        ngx_free(content);
+    }
+}
+
+
 static void
 ngx_open_file_cleanup(void *data)
 {
     ngx_open_file_cache_cleanup_t  *c = data;
 
+    if (c->content) {
+        ngx_open_file_content_free(c->content);
+    }
+
     c->file->count--;
 
     ngx_close_cached_file(c->cache, c->file, c->min_uses, c->log);
@@ -1055,6 +1460,11 @@ ngx_close_cached_file(ngx_open_file_cache_t *cache,
         return;
     }
 
+    if (file->content) {
+        ngx_open_file_content_free(file->content);
+        file->content = NULL;
+    }
+
     if (file->fd != NGX_INVALID_FILE) {
 
         if (ngx_close_file(file->fd) == NGX_FILE_ERROR) {
@@ -1081,8 +1491,16 @@ ngx_open_file_del_event(ngx_cached_open_file_t *file)
         return;
     }
 
-    (void) ngx_del_event(file->event, NGX_VNODE_EVENT,
-                         file->count ? NGX_FLUSH_EVENT : NGX_CLOSE_EVENT);
+#if (NGX_HAVE_INOTIFY)
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+        ngx_open_file_inotify_del(file->event->data);
+
+    } else
+#endif
+    {
+        (void) ngx_del_event(file->event, NGX_VNODE_EVENT,
+                             file->count ? NGX_FLUSH_EVENT : NGX_CLOSE_EVENT);
+    }
 
     ngx_free(file->event->data);
     ngx_free(file->event);
@@ -1232,6 +1650,12 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     fev = ev->data;
     file = fev->file;
 
+#if (NGX_HAVE_INOTIFY)
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+        ngx_open_file_inotify_del(fev);
+    }
+#endif
+
     ngx_queue_remove(&file->queue);
 
     ngx_rbtree_delete(&fev->cache->rbtree, &file->node);
@@ -1251,3 +1675,226 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     ngx_free(ev->data);
     ngx_free(ev);
 }
+
+
+#if (NGX_HAVE_INOTIFY)
+
+static ngx_int_t
+ngx_open_file_inotify_init(ngx_log_t *log)
+{
+    if (ngx_open_file_inotify != -1) {
+        return NGX_OK;
+    }
+
+    if (ngx_open_file_inotify_failed) {
+        return NGX_ERROR;
+    }
+
+    ngx_open_file_inotify_failed = 1;
+
+    ngx_open_file_inotify = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if (ngx_open_file_inotify == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "inotify_init1() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                   "open file cache inotify: %d", ngx_open_file_inotify);
+
+    ngx_rbtree_init(&ngx_open_file_inotify_tree,
+                    &ngx_open_file_inotify_sentinel, ngx_rbtree_insert_value);
+
+    ngx_open_file_inotify_rev.handler = ngx_open_file_inotify_handler;
+    ngx_open_file_inotify_rev.data = &ngx_open_file_inotify_conn;
+    ngx_open_file_inotify_rev.log = ngx_cycle->log;
+
+    ngx_open_file_inotify_wev.data = &ngx_open_file_inotify_conn;
+    ngx_open_file_inotify_wev.log = ngx_cycle->log;
+
+    ngx_open_file_inotify_conn.fd = ngx_open_file_inotify;
+    ngx_open_file_inotify_conn.read = &ngx_open_file_inotify_rev;
+    ngx_open_file_inotify_conn.write = &ngx_open_file_inotify_wev;
+    ngx_open_file_inotify_conn.log = ngx_cycle->log;
+
+    if (ngx_handle_read_event(&ngx_open_file_inotify_rev, 0) != NGX_OK) {
+
+        if (close(ngx_open_file_inotify) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "inotify close() failed");
+        }
+
+        ngx_open_file_inotify = -1;
+
+        return NGX_ERROR;
+    }
+
+    ngx_open_file_inotify_failed = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_inotify_add(ngx_open_file_cache_event_t *fev, ngx_log_t *log)
+{
+    int     wd;
+    u_char  name[sizeof("/proc/self/fd/") + NGX_INT_T_LEN];
+
+    /*
+     * the watch is added through the descriptor, so it is set exactly
+     * on the file which was opened even if the name was replaced since
+     */
+
+    (void) ngx_sprintf(name, "/proc/self/fd/%d%Z", fev->fd);
+
+    wd = inotify_add_watch(ngx_open_file_inotify, (char *) name,
+                           IN_MODIFY|IN_ATTRIB|IN_MOVE_SELF|IN_DELETE_SELF);
+
+    if (wd == -1) {
+        ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                      "inotify_add_watch(\"%s\") failed", fev->file->name);
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "inotify watch: %s, wd:%d", fev->file->name, wd);
+
+    fev->node.key = wd;
+
+    ngx_rbtree_insert(&ngx_open_file_inotify_tree, &fev->node);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_open_file_inotify_del(ngx_open_file_cache_event_t *fev)
+{
+    int  wd;
+
+    ngx_rbtree_delete(&ngx_open_file_inotify_tree, &fev->node);
+
+    wd = (int) fev->node.key;
+
+    if (ngx_open_file_inotify_lookup(wd) == NULL) {
+
+        /* the watch may be already removed by the kernel */
+
+        (void) inotify_rm_watch(ngx_open_file_inotify, wd);
+    }
+}
+
+
+static ngx_open_file_cache_event_t *
+ngx_open_file_inotify_lookup(int wd)
+{
+    ngx_rbtree_key_t    key;
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    key = (ngx_rbtree_key_t) wd;
+
+    node = ngx_open_file_inotify_tree.root;
+    sentinel = ngx_open_file_inotify_tree.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        return (ngx_open_file_cache_event_t *)
+                   ((u_char *) node - offsetof(ngx_open_file_cache_event_t,
+                                               node));
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_open_file_inotify_handler(ngx_event_t *ev)
+{
+    u_char                       *p;
+    ssize_t                       n;
+    ngx_err_t                     err;
+    ngx_rbtree_node_t            *node;
+    struct inotify_event         *ie;
+    ngx_open_file_cache_event_t  *fev;
+    uint32_t                      buf[1024];
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                   "open file cache inotify handler");
+
+    for ( ;; ) {
+
+        n = read(ngx_open_file_inotify, buf, sizeof(buf));
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                              "inotify read() failed");
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ev->ready = 0;
+            return;
+        }
+
+        for (p = (u_char *) buf; p < (u_char *) buf + n; /* void */) {
+
+            ie = (struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + ie->len;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "inotify event: wd:%d mask:%xD", ie->wd, ie->mask);
+
+            if (ie->mask & IN_Q_OVERFLOW) {
+
+                /* the events were lost, so nothing can be trusted */
+
+                ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                              "inotify queue overflow");
+
+                while (ngx_open_file_inotify_tree.root
+                       != ngx_open_file_inotify_tree.sentinel)
+                {
+                    node = ngx_rbtree_min(ngx_open_file_inotify_tree.root,
+                                          ngx_open_file_inotify_tree.sentinel);
+
+                    fev = (ngx_open_file_cache_event_t *)
+                              ((u_char *) node
+                               - offsetof(ngx_open_file_cache_event_t, node));
+
+                    ngx_open_file_cache_remove(fev->file->event);
+                }
+
+                continue;
+            }
+
+            for ( ;; ) {
+                fev = ngx_open_file_inotify_lookup(ie->wd);
+
+                if (fev == NULL) {
+                    break;
+                }
+
+                ngx_open_file_cache_remove(fev->file->event);
+            }
+        }
+    }
+}
+
+#endif
@@ -15,8 +15,20 @@
 
 #define NGX_OPEN_FILE_DIRECTIO_OFF  NGX_MAX_OFF_T_VALUE
 
+#define NGX_OPEN_FILE_ETAG_LEN      (NGX_TIME_T_LEN + NGX_OFF_T_LEN + 3)
+
 
 typedef struct {
+    u_char                  *data;
+    size_t                   size;
+    time_t                   mtime;
+    ngx_uint_t               count;
+} ngx_open_file_content_t;
+
+
+typedef struct ngx_open_file_info_s  ngx_open_file_info_t;
+
+struct ngx_open_file_info_s {
     ngx_fd_t                 fd;
     ngx_file_uniq_t          uniq;
     time_t                   mtime;
@@ -32,6 +44,18 @@ typedef struct {
 
     ngx_uint_t               min_uses;
 
+    ngx_open_file_content_t *content;
+
+    /* points to the cached file, to be copied before the next lookup */
+    ngx_str_t                etag;
+
+#if (NGX_THREADS || NGX_COMPAT)
+    ngx_int_t              (*thread_handler)(ngx_thread_task_t *task,
+                                             ngx_open_file_info_t *of);
+    void                    *thread_ctx;
+    ngx_thread_task_t       *thread_task;
+#endif
+
 #if (NGX_HAVE_OPENAT)
     size_t                   disable_symlinks_from;
     unsigned                 disable_symlinks:2;
@@ -39,6 +63,7 @@ typedef struct {
 
     unsigned                 test_dir:1;
     unsigned                 test_only:1;
+    unsigned                 read_content:1;
     unsigned                 log:1;
     unsigned                 errors:1;
     unsigned                 events:1;
@@ -48,7 +73,7 @@ typedef struct {
     unsigned                 is_link:1;
     unsigned                 is_exec:1;
     unsigned                 is_directio:1;
-} ngx_open_file_info_t;
+};
 
 
 typedef struct ngx_cached_open_file_s  ngx_cached_open_file_t;
@@ -69,6 +94,12 @@ struct ngx_cached_open_file_s {
 
     uint32_t                 uses;
 
+    ngx_open_file_content_t *content;
+
+    /* the HTTP entity tag, formatted when the file is tested */
+    u_char                   etag[NGX_OPEN_FILE_ETAG_LEN];
+    u_char                   etag_len;
+
 #if (NGX_HAVE_OPENAT)
     size_t                   disable_symlinks_from;
     unsigned                 disable_symlinks:2;
@@ -96,12 +127,16 @@ typedef struct {
     ngx_uint_t               current;
     ngx_uint_t               max;
     time_t                   inactive;
+
+    /* the maximum size of files kept in memory */
+    size_t                   content;
 } ngx_open_file_cache_t;
 
 
 typedef struct {
     ngx_open_file_cache_t   *cache;
     ngx_cached_open_file_t  *file;
+    ngx_open_file_content_t *content;
     ngx_uint_t               min_uses;
     ngx_log_t               *log;
 } ngx_open_file_cache_cleanup_t;
@@ -117,6 +152,11 @@ typedef struct {
 
     ngx_cached_open_file_t  *file;
     ngx_open_file_cache_t   *cache;
+
+#if (NGX_HAVE_INOTIFY)
+    /* node.key is an inotify watch descriptor */
+    ngx_rbtree_node_t        node;
+#endif
 } ngx_open_file_cache_event_t;
 
 
@@ -124,6 +164,8 @@ ngx_open_file_cache_t *ngx_open_file_cache_init(ngx_pool_t *pool,
     ngx_uint_t max, time_t inactive);
 ngx_int_t ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool);
+ngx_int_t ngx_open_file_stat(ngx_str_t *name, ngx_open_file_info_t *of,
+    ngx_log_t *log);
 
 
 #endif /* _NGX_OPEN_FILE_CACHE_H_INCLUDED_ */
@@ -40,6 +40,9 @@ static ngx_int_t ngx_output_chain_align_file_buf(ngx_output_chain_ctx_t *ctx,
 static ngx_int_t ngx_output_chain_get_buf(ngx_output_chain_ctx_t *ctx,
     off_t bsize);
 static ngx_int_t ngx_output_chain_copy_buf(ngx_output_chain_ctx_t *ctx);
+static void ngx_output_chain_prefetch(ngx_output_chain_ctx_t *ctx,
+    ngx_buf_t *src, off_t n);
+static void ngx_output_chain_prefetch_cleanup(void *data);
 
 
 ngx_int_t
@@ -492,7 +495,8 @@ ngx_output_chain_get_buf(ngx_output_chain_ctx_t *ctx, off_t bsize)
          * userland buffer direct usage conjunctly with directio
          */
 
-        b->start = ngx_pmemalign(ctx->pool, size, (size_t) ctx->alignment);
+        b->start = ngx_palloc_io_buffer(ctx->pool, size,
+                                        (size_t) ctx->alignment);
         if (b->start == NULL) {
             return NGX_ERROR;
         }
@@ -647,6 +651,10 @@ ngx_output_chain_copy_buf(ngx_output_chain_ctx_t *ctx)
             return NGX_ERROR;
         }
 
+        if (ctx->prefetch && !src->file->directio) {
+            ngx_output_chain_prefetch(ctx, src, n);
+        }
+
         dst->last += n;
 
         if (sendfile) {
@@ -672,6 +680,102 @@ ngx_output_chain_copy_buf(ngx_output_chain_ctx_t *ctx)
 }
 
 
+static void
+ngx_output_chain_prefetch(ngx_output_chain_ctx_t *ctx, ngx_buf_t *src,
+    off_t n)
+{
+    off_t                used, start, last;
+    ngx_pool_cleanup_t  *cln;
+
+    /*
+     * a read is sequential if it continues the previous one or starts
+     * at the beginning of a file; other reads end the stream, and the data
+     * prefetched but not yet read are accounted as wasted
+     */
+
+    if (ctx->prefetch_file != src->file
+        || ctx->prefetch_next != src->file_pos)
+    {
+        if (ctx->prefetch_file == NULL) {
+            cln = ngx_pool_cleanup_add(ctx->pool, 0);
+            if (cln == NULL) {
+                return;
+            }
+
+            cln->handler = ngx_output_chain_prefetch_cleanup;
+            cln->data = ctx;
+
+        } else if (ngx_event_loop_timing
+                   && ctx->prefetch_last > ctx->prefetch_next)
+        {
+            ngx_event_loop_prefetch(0, 0,
+                                    ctx->prefetch_last - ctx->prefetch_next);
+        }
+
+        ctx->prefetch_file = src->file;
+        ctx->prefetch_next = src->file_pos + n;
+        ctx->prefetch_last = src->file_pos + n;
+
+        if (src->file_pos != 0) {
+            return;
+        }
+
+        used = 0;
+
+    } else {
+        used = ngx_min(ctx->prefetch_last - src->file_pos, n);
+
+        ctx->prefetch_next = src->file_pos + n;
+    }
+
+    start = ngx_max(ctx->prefetch_last, ctx->prefetch_next);
+    last = start;
+
+    /* the window is refilled once a half of it is read */
+
+    if (start - ctx->prefetch_next < ctx->prefetch / 2) {
+        last = ngx_min(ctx->prefetch_next + ctx->prefetch, src->file_last);
+
+        if (last > start) {
+            ngx_log_debug4(NGX_LOG_DEBUG_CORE, ctx->pool->log, 0,
+                           "prefetch: \"%s\" %O-%O, used %O",
+                           src->file->name.data, start, last, used);
+
+            if (ngx_prefetch_file(src->file->fd, start, last - start)
+                == NGX_FILE_ERROR)
+            {
+                ngx_log_error(NGX_LOG_ALERT, ctx->pool->log, ngx_errno,
+                              ngx_prefetch_file_n " \"%s\" failed",
+                              src->file->name.data);
+
+                ctx->prefetch = 0;
+                last = start;
+            }
+
+        } else {
+            last = start;
+        }
+    }
+
+    ctx->prefetch_last = last;
+
+    if (ngx_event_loop_timing && (used || last > start)) {
+        ngx_event_loop_prefetch(last - start, used, 0);
+    }
+}
+
+
+static void
+ngx_output_chain_prefetch_cleanup(void *data)
+{
+    ngx_output_chain_ctx_t *ctx = data;
+
+    if (ngx_event_loop_timing && ctx->prefetch_last > ctx->prefetch_next) {
+        ngx_event_loop_prefetch(0, 0, ctx->prefetch_last - ctx->prefetch_next);
+    }
+}
+
+
 ngx_int_t
 ngx_chain_writer(void *data, ngx_chain_t *in)
 {
@@ -13,6 +13,22 @@ static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static ngx_inline ngx_int_t ngx_pool_cache_index(size_t size,
+    ngx_uint_t exact);
+static void *ngx_get_cached_block(size_t size, ngx_log_t *log);
+static void ngx_free_cached_block(void *p, size_t size);
+static void *ngx_io_buffer_alloc(ngx_io_buffer_slot_t *slot, ngx_log_t *log);
+static void ngx_io_buffer_release(void *data);
+
+
+typedef struct {
+    ngx_io_buffer_slot_t  *slot;
+    ngx_cached_block_t    *buffer;
+} ngx_io_buffer_ref_t;
+
+
+ngx_pool_cache_t       ngx_pool_cache;
+ngx_io_buffer_cache_t  ngx_io_buffer_cache;
 
 
 ngx_pool_t *
@@ -20,7 +36,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_get_cached_block(size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -82,12 +98,12 @@ ngx_destroy_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_free_cached_block(l->alloc, l->size);
         }
     }
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_free_cached_block(p, (size_t) (p->d.end - (u_char *) p));
 
         if (n == NULL) {
             break;
@@ -104,7 +120,7 @@ ngx_reset_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_free_cached_block(l->alloc, l->size);
         }
     }
 
@@ -183,7 +199,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_get_cached_block(psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -214,10 +230,28 @@ static void *
 ngx_palloc_large(ngx_pool_t *pool, size_t size)
 {
     void              *p;
+    size_t             csize;
+    ngx_int_t          i;
     ngx_uint_t         n;
     ngx_pool_large_t  *large;
 
-    p = ngx_alloc(size, pool->log);
+    csize = 0;
+
+    if (ngx_pool_cache.max_size) {
+        i = ngx_pool_cache_index(size, 0);
+
+        if (i != NGX_ERROR) {
+            csize = ngx_pool_cache.slots[i].size;
+        }
+    }
+
+    if (csize) {
+        p = ngx_get_cached_block(csize, pool->log);
+
+    } else {
+        p = ngx_alloc(size, pool->log);
+    }
+
     if (p == NULL) {
         return NULL;
     }
@@ -227,6 +261,8 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = csize;
+            large->len = size;
             return p;
         }
 
@@ -237,11 +273,13 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
+        ngx_free_cached_block(p, csize);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = csize;
+    large->len = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -267,6 +305,8 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     }
 
     large->alloc = p;
+    large->size = 0;
+    large->len = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -283,7 +323,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc);
+            ngx_free_cached_block(l->alloc, l->size);
             l->alloc = NULL;
 
             return NGX_OK;
@@ -294,6 +334,31 @@ ngx_pfree(ngx_pool_t *pool, void *p)
 }
 
 
+size_t
+ngx_pool_memory(ngx_pool_t *pool)
+{
+    size_t             size;
+    ngx_pool_t        *p;
+    ngx_pool_large_t  *l;
+
+    /* cached large blocks are counted by the size of their class */
+
+    size = 0;
+
+    for (p = pool; p; p = p->d.next) {
+        size += p->d.end - (u_char *) p;
+    }
+
+    for (l = pool->large; l; l = l->next) {
+        if (l->alloc) {
+            size += l->size ? l->size : l->len;
+        }
+    }
+
+    return size;
+}
+
+
 void *
 ngx_pcalloc(ngx_pool_t *pool, size_t size)
 {
@@ -401,30 +466,376 @@ ngx_pool_delete_file(void *data)
 }
 
 
-#if 0
+void
+ngx_pool_cache_init(size_t max_size)
+{
+    ngx_uint_t  i;
+
+    ngx_memzero(&ngx_pool_cache, sizeof(ngx_pool_cache_t));
+
+    if (max_size == 0 || ngx_pagesize_shift <= NGX_POOL_CACHE_MIN_SHIFT) {
+        return;
+    }
+
+    ngx_pool_cache.nsubpage = ngx_pagesize_shift - NGX_POOL_CACHE_MIN_SHIFT;
+    ngx_pool_cache.nslots = ngx_pool_cache.nsubpage + NGX_POOL_CACHE_MAX_PAGES;
+
+    if (ngx_pool_cache.nslots > NGX_POOL_CACHE_SLOTS) {
+        ngx_pool_cache.nslots = NGX_POOL_CACHE_SLOTS;
+    }
+
+    for (i = 0; i < ngx_pool_cache.nslots; i++) {
+        if (i < ngx_pool_cache.nsubpage) {
+            ngx_pool_cache.slots[i].size =
+                                    (size_t) 1 << (i + NGX_POOL_CACHE_MIN_SHIFT);
+
+        } else {
+            ngx_pool_cache.slots[i].size =
+                   (i - ngx_pool_cache.nsubpage + 1) << ngx_pagesize_shift;
+        }
+    }
+
+    ngx_pool_cache.max_size = max_size;
+}
+
+
+void
+ngx_pool_cache_done(ngx_log_t *log)
+{
+    ngx_uint_t                i;
+    ngx_cached_block_t       *b, *next;
+    ngx_cached_block_slot_t  *slot;
+
+    if (ngx_pool_cache.max_size == 0) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, log, 0,
+                  "pool cache: %ui hits, %ui misses, %ui drops, %uz cached",
+                  ngx_pool_cache.hits, ngx_pool_cache.misses,
+                  ngx_pool_cache.drops, ngx_pool_cache.size);
+
+    /* blocks freed from now on go directly to free() */
+
+    ngx_pool_cache.max_size = 0;
+
+    for (i = 0; i < ngx_pool_cache.nslots; i++) {
+        slot = &ngx_pool_cache.slots[i];
+
+        for (b = slot->block; b; b = next) {
+            next = b->next;
+            ngx_free(b);
+        }
+
+        slot->block = NULL;
+        slot->number = 0;
+    }
+
+    ngx_pool_cache.size = 0;
+}
+
+
+static ngx_inline ngx_int_t
+ngx_pool_cache_index(size_t size, ngx_uint_t exact)
+{
+    ngx_uint_t  n;
+
+    if (size <= (ngx_pagesize >> 1)) {
+
+        for (n = 0; n < ngx_pool_cache.nsubpage; n++) {
+            if (size <= ngx_pool_cache.slots[n].size) {
+                break;
+            }
+        }
+
+    } else {
+        n = (size + ngx_pagesize - 1) >> ngx_pagesize_shift;
+        n += ngx_pool_cache.nsubpage - 1;
+    }
+
+    if (n >= ngx_pool_cache.nslots) {
+        return NGX_ERROR;
+    }
+
+    if (exact && ngx_pool_cache.slots[n].size != size) {
+        return NGX_ERROR;
+    }
+
+    return n;
+}
+
 
 static void *
-ngx_get_cached_block(size_t size)
+ngx_get_cached_block(size_t size, ngx_log_t *log)
 {
-    void                     *p;
+    ngx_int_t                 i;
+    ngx_cached_block_t       *b;
     ngx_cached_block_slot_t  *slot;
 
-    if (ngx_cycle->cache == NULL) {
-        return NULL;
+    if (ngx_pool_cache.max_size == 0 || !ngx_thread_is_main()) {
+        return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
     }
 
-    slot = &ngx_cycle->cache[(size + ngx_pagesize - 1) / ngx_pagesize];
+    /*
+     * only blocks of exactly the class size are cached, so it does not
+     * matter whether a block was allocated before the cache was enabled
+     */
+
+    i = ngx_pool_cache_index(size, 1);
+
+    if (i == NGX_ERROR) {
+        return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    }
+
+    slot = &ngx_pool_cache.slots[i];
 
     slot->tries++;
 
     if (slot->number) {
-        p = slot->block;
-        slot->block = slot->block->next;
+        b = slot->block;
+        slot->block = b->next;
         slot->number--;
-        return p;
+
+        ngx_pool_cache.size -= size;
+        ngx_pool_cache.hits++;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                       "pool cache: %p:%uz", b, size);
+
+        return b;
+    }
+
+    ngx_pool_cache.misses++;
+
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+
+static void
+ngx_free_cached_block(void *p, size_t size)
+{
+    ngx_int_t                 i;
+    ngx_cached_block_t       *b;
+    ngx_cached_block_slot_t  *slot;
+
+    if (ngx_pool_cache.max_size == 0 || size == 0
+        || !ngx_thread_is_main())
+    {
+        ngx_free(p);
+        return;
+    }
+
+    i = ngx_pool_cache_index(size, 1);
+
+    if (i == NGX_ERROR) {
+        ngx_free(p);
+        return;
+    }
+
+    if (ngx_pool_cache.size + size > ngx_pool_cache.max_size) {
+        ngx_pool_cache.drops++;
+        ngx_free(p);
+        return;
+    }
+
+    slot = &ngx_pool_cache.slots[i];
+
+    b = p;
+    b->next = slot->block;
+    slot->block = b;
+    slot->number++;
+
+    ngx_pool_cache.size += size;
+}
+
+
+void *
+ngx_palloc_io_buffer(ngx_pool_t *pool, size_t size, size_t alignment)
+{
+    ngx_uint_t             i;
+    ngx_cached_block_t    *b;
+    ngx_pool_cleanup_t    *cln;
+    ngx_io_buffer_ref_t   *ref;
+    ngx_io_buffer_slot_t  *slot;
+
+    if (ngx_io_buffer_cache.max_size == 0 || !ngx_thread_is_main()) {
+        return ngx_pmemalign(pool, size, alignment);
+    }
+
+    slot = NULL;
+
+    for (i = 0; i < ngx_io_buffer_cache.nslots; i++) {
+        if (ngx_io_buffer_cache.slots[i].size == size
+            && ngx_io_buffer_cache.slots[i].alignment == alignment)
+        {
+            slot = &ngx_io_buffer_cache.slots[i];
+            break;
+        }
+    }
+
+    if (slot == NULL) {
+        if (ngx_io_buffer_cache.nslots == NGX_IO_BUFFER_SLOTS) {
+            ngx_io_buffer_cache.fallbacks++;
+            return ngx_pmemalign(pool, size, alignment);
+        }
+
+        slot = &ngx_io_buffer_cache.slots[ngx_io_buffer_cache.nslots++];
+        slot->size = size;
+        slot->alignment = alignment;
+    }
+
+    cln = ngx_pool_cleanup_add(pool, sizeof(ngx_io_buffer_ref_t));
+    if (cln == NULL) {
+        return NULL;
     }
 
-    return NULL;
+    if (slot->number) {
+        b = slot->block;
+        slot->block = b->next;
+        slot->number--;
+
+        ngx_io_buffer_cache.hits++;
+
+    } else {
+        ngx_io_buffer_cache.misses++;
+
+        b = ngx_io_buffer_alloc(slot, pool->log);
+
+        if (b == NULL) {
+
+            /* the cache is full, the buffer is freed with the pool */
+
+            ngx_io_buffer_cache.fallbacks++;
+            return ngx_pmemalign(pool, size, alignment);
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                   "io buffer: %p:%uz", b, size);
+
+    ref = cln->data;
+    ref->slot = slot;
+    ref->buffer = b;
+
+    cln->handler = ngx_io_buffer_release;
+
+    return b;
 }
 
+
+static void *
+ngx_io_buffer_alloc(ngx_io_buffer_slot_t *slot, ngx_log_t *log)
+{
+    u_char              *p;
+    size_t               size, bsize;
+    ngx_uint_t           i, n;
+    ngx_cached_block_t  *b;
+
+    if (!ngx_io_buffer_cache.huge) {
+
+        if (ngx_io_buffer_cache.size + slot->size
+            > ngx_io_buffer_cache.max_size)
+        {
+            return NULL;
+        }
+
+        p = ngx_memalign(slot->alignment, slot->size, log);
+        if (p == NULL) {
+            return NULL;
+        }
+
+        ngx_io_buffer_cache.size += slot->size;
+
+        return p;
+    }
+
+    /*
+     * huge buffers are carved from chunks aligned to a huge page size,
+     * and the chunks are advised to be backed by transparent huge pages
+     */
+
+    bsize = ngx_align(slot->size, slot->alignment);
+
+    if (bsize > NGX_IO_BUFFER_HUGE_SIZE) {
+        size = ngx_align(bsize, NGX_IO_BUFFER_HUGE_SIZE);
+        n = 1;
+
+    } else {
+        size = NGX_IO_BUFFER_HUGE_SIZE;
+        n = NGX_IO_BUFFER_HUGE_SIZE / bsize;
+    }
+
+    if (ngx_io_buffer_cache.size + size > ngx_io_buffer_cache.max_size) {
+        return NULL;
+    }
+
+    p = ngx_memalign(NGX_IO_BUFFER_HUGE_SIZE, size, log);
+    if (p == NULL) {
+        return NULL;
+    }
+
+#if (NGX_HAVE_MADV_HUGEPAGE)
+
+    if (madvise(p, size, MADV_HUGEPAGE) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "madvise(MADV_HUGEPAGE) failed for I/O buffers");
+    }
+
 #endif
+
+    ngx_io_buffer_cache.size += size;
+
+    for (i = 1; i < n; i++) {
+        b = (ngx_cached_block_t *) (p + i * bsize);
+        b->next = slot->block;
+        slot->block = b;
+        slot->number++;
+    }
+
+    return p;
+}
+
+
+static void
+ngx_io_buffer_release(void *data)
+{
+    ngx_io_buffer_ref_t *ref = data;
+
+    ngx_io_buffer_slot_t  *slot;
+
+    slot = ref->slot;
+
+    ref->buffer->next = slot->block;
+    slot->block = ref->buffer;
+    slot->number++;
+}
+
+
+void
+ngx_io_buffer_cache_init(size_t max_size, ngx_flag_t huge)
+{
+    ngx_memzero(&ngx_io_buffer_cache, sizeof(ngx_io_buffer_cache_t));
+
+    ngx_io_buffer_cache.max_size = max_size;
+    ngx_io_buffer_cache.huge = huge;
+}
+
+
+void
+ngx_io_buffer_cache_done(ngx_log_t *log)
+{
+    if (ngx_io_buffer_cache.max_size == 0) {
+        return;
+    }
+
+    /*
+     * the buffers are not freed as some of them may still be used
+     * by requests finalized later, the memory is released with the process
+     */
+
+    ngx_log_error(NGX_LOG_INFO, log, 0,
+                  "io buffers: %ui hits, %ui misses, %ui fallbacks, "
+                  "%uz allocated",
+                  ngx_io_buffer_cache.hits, ngx_io_buffer_cache.misses,
+                  ngx_io_buffer_cache.fallbacks, ngx_io_buffer_cache.size);
+}
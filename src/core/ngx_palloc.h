@@ -27,6 +27,17 @@
               NGX_POOL_ALIGNMENT)
 
 
+/*
+ * the pool block cache keeps freed blocks in size classes: powers of two
+ * from 2^NGX_POOL_CACHE_MIN_SHIFT up to a half of a page, and then
+ * 1..NGX_POOL_CACHE_MAX_PAGES pages
+ */
+
+#define NGX_POOL_CACHE_MIN_SHIFT  7
+#define NGX_POOL_CACHE_MAX_PAGES  16
+#define NGX_POOL_CACHE_SLOTS      (16 + NGX_POOL_CACHE_MAX_PAGES)
+
+
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
 typedef struct ngx_pool_cleanup_s  ngx_pool_cleanup_t;
@@ -43,6 +54,8 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    size_t                size;     /* block size if cacheable */
+    size_t                len;      /* the size requested */
 };
 
 
@@ -65,6 +78,68 @@ struct ngx_pool_s {
 };
 
 
+typedef struct ngx_cached_block_s  ngx_cached_block_t;
+
+struct ngx_cached_block_s {
+    ngx_cached_block_t   *next;
+};
+
+
+typedef struct {
+    ngx_cached_block_t   *block;
+    size_t                size;
+    ngx_uint_t            number;
+    ngx_uint_t            tries;
+} ngx_cached_block_slot_t;
+
+
+typedef struct {
+    size_t                max_size;
+    size_t                size;
+
+    ngx_uint_t            hits;
+    ngx_uint_t            misses;
+    ngx_uint_t            drops;
+
+    ngx_uint_t            nslots;
+    ngx_uint_t            nsubpage;
+
+    ngx_cached_block_slot_t  slots[NGX_POOL_CACHE_SLOTS];
+} ngx_pool_cache_t;
+
+
+/*
+ * aligned I/O buffers, such as ones used to read files with directio,
+ * are kept in per-process free lists of the same size and alignment
+ * instead of being freed with a pool
+ */
+
+#define NGX_IO_BUFFER_SLOTS       8
+#define NGX_IO_BUFFER_HUGE_SIZE   (2 * 1024 * 1024)
+
+
+typedef struct {
+    ngx_cached_block_t   *block;
+    size_t                size;
+    size_t                alignment;
+    ngx_uint_t            number;
+} ngx_io_buffer_slot_t;
+
+
+typedef struct {
+    size_t                max_size;
+    size_t                size;     /* allocated for buffers */
+    ngx_flag_t            huge;
+
+    ngx_uint_t            hits;
+    ngx_uint_t            misses;
+    ngx_uint_t            fallbacks;
+
+    ngx_uint_t            nslots;
+    ngx_io_buffer_slot_t  slots[NGX_IO_BUFFER_SLOTS];
+} ngx_io_buffer_cache_t;
+
+
 typedef struct {
     ngx_fd_t              fd;
     u_char               *name;
@@ -81,6 +156,7 @@ void *ngx_pnalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pcalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment);
 ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p);
+size_t ngx_pool_memory(ngx_pool_t *pool);
 
 
 ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size);
@@ -88,5 +164,16 @@ void ngx_pool_run_cleanup_file(ngx_pool_t *p, ngx_fd_t fd);
 void ngx_pool_cleanup_file(void *data);
 void ngx_pool_delete_file(void *data);
 
+void ngx_pool_cache_init(size_t max_size);
+void ngx_pool_cache_done(ngx_log_t *log);
+
+void *ngx_palloc_io_buffer(ngx_pool_t *pool, size_t size, size_t alignment);
+void ngx_io_buffer_cache_init(size_t max_size, ngx_flag_t huge);
+void ngx_io_buffer_cache_done(ngx_log_t *log);
+
+
+extern ngx_pool_cache_t       ngx_pool_cache;
+extern ngx_io_buffer_cache_t  ngx_io_buffer_cache;
+
 
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
@@ -0,0 +1,393 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+typedef struct {
+    ngx_radix_node_t  *node;
+    uintptr_t          value;
+} ngx_poptrie_entry_t;
+
+
+static void ngx_poptrie_build(ngx_poptrie_t *trie, ngx_uint_t n,
+    ngx_radix_node_t *node, uintptr_t value, ngx_uint_t depth,
+    ngx_uint_t bits);
+static void ngx_poptrie_fill(ngx_poptrie_entry_t *entries,
+    ngx_radix_node_t *node, uintptr_t value, ngx_uint_t prefix,
+    ngx_uint_t level, ngx_uint_t stride);
+
+
+ngx_poptrie_t *
+ngx_poptrie_create(ngx_pool_t *pool, ngx_radix_tree_t *tree, ngx_uint_t bits)
+{
+    ngx_poptrie_t  *trie;
+
+    trie = ngx_pcalloc(pool, sizeof(ngx_poptrie_t));
+    if (trie == NULL) {
+        return NULL;
+    }
+
+    /* the first pass only counts nodes and leaves */
+
+    trie->nnodes = 1;
+
+    ngx_poptrie_build(trie, 0, tree->root, tree->root->value, 0, bits);
+
+    trie->nodes = ngx_palloc(pool, trie->nnodes * sizeof(ngx_poptrie_node_t));
+    if (trie->nodes == NULL) {
+        return NULL;
+    }
+
+    trie->leaves = ngx_palloc(pool, trie->nleaves * sizeof(uintptr_t));
+    if (trie->leaves == NULL) {
+        return NULL;
+    }
+
+    trie->nnodes = 1;
+    trie->nleaves = 0;
+
+    ngx_poptrie_build(trie, 0, tree->root, tree->root->value, 0, bits);
+
+    return trie;
+}
+
+
+static void
+ngx_poptrie_build(ngx_poptrie_t *trie, ngx_uint_t n, ngx_radix_node_t *node,
+    uintptr_t value, ngx_uint_t depth, ngx_uint_t bits)
+{
+    uint64_t              vector, leafvec;
+    uintptr_t             last;
+    ngx_uint_t            i, k, stride, base0, base1;
+    ngx_poptrie_entry_t   entries[1 << NGX_POPTRIE_STRIDE];
+
+    stride = ngx_min(bits - depth, NGX_POPTRIE_STRIDE);
+
+    ngx_poptrie_fill(entries, node, value, 0, 0, stride);
+
+    vector = 0;
+    leafvec = 0;
+    last = NGX_RADIX_NO_VALUE;
+    base0 = trie->nleaves;
+    k = 0;
+
+    for (i = 0; i < (1 << NGX_POPTRIE_STRIDE); i++) {
+
+        if (entries[i].node) {
+            vector |= (uint64_t) 1 << i;
+            k++;
+            continue;
+        }
+
+        /* entries referring to children do not break runs of leaves */
+
+        if (trie->nleaves == base0 || entries[i].value != last) {
+            leafvec |= (uint64_t) 1 << i;
+            last = entries[i].value;
+
+            if (trie->leaves) {
+                trie->leaves[trie->nleaves] = last;
+            }
+
+            trie->nleaves++;
+        }
+    }
+
+    base1 = trie->nnodes;
+    trie->nnodes += k;
+
+    if (trie->nodes) {
+        trie->nodes[n].vector = vector;
+        trie->nodes[n].leafvec = leafvec;
+        trie->nodes[n].base0 = (uint32_t) base0;
+        trie->nodes[n].base1 = (uint32_t) base1;
+    }
+
+    for (i = 0, k = 0; i < (1 << NGX_POPTRIE_STRIDE); i++) {
+        if (entries[i].node) {
+            ngx_poptrie_build(trie, base1 + k++, entries[i].node,
+                              entries[i].value, depth + NGX_POPTRIE_STRIDE,
+                              bits);
+        }
+    }
+}
+
+
+/*
+ * walks the radix tree down to "stride" bits below the node and fills
+ * the entries with the longest matching values, the radix nodes which
+ * have children after the full stride become child nodes of the trie
+ */
+
+static void
+ngx_poptrie_fill(ngx_poptrie_entry_t *entries, ngx_radix_node_t *node,
+    uintptr_t value, ngx_uint_t prefix, ngx_uint_t level, ngx_uint_t stride)
+{
+    ngx_uint_t         i, n;
+    ngx_radix_node_t  *child;
+
+    if (node && node->value != NGX_RADIX_NO_VALUE) {
+        value = node->value;
+    }
+
+    if (node && (node->left || node->right)) {
+
+        if (level < stride) {
+            ngx_poptrie_fill(entries, node->left, value, prefix << 1,
+                             level + 1, stride);
+            ngx_poptrie_fill(entries, node->right, value, (prefix << 1) | 1,
+                             level + 1, stride);
+            return;
+        }
+
+        child = node;
+
+    } else {
+        child = NULL;
+    }
+
+    n = (ngx_uint_t) 1 << (NGX_POPTRIE_STRIDE - level);
+    entries += prefix << (NGX_POPTRIE_STRIDE - level);
+
+    for (i = 0; i < n; i++) {
+        entries[i].node = child;
+        entries[i].value = value;
+    }
+}
+
+
+ngx_poptrie_cidrs_t *
+ngx_poptrie_cidrs_create(ngx_pool_t *pool, ngx_array_t *cidrs, ngx_log_t *log)
+{
+    ngx_int_t             rc;
+    ngx_uint_t            i, n;
+    ngx_pool_t           *temp_pool;
+    ngx_cidr_t           *cidr;
+    ngx_radix_tree_t     *tree;
+#if (NGX_HAVE_INET6)
+    ngx_uint_t            n6;
+    ngx_radix_tree_t     *tree6;
+#endif
+    ngx_poptrie_cidrs_t  *set;
+
+    set = ngx_pcalloc(pool, sizeof(ngx_poptrie_cidrs_t));
+    if (set == NULL) {
+        return NULL;
+    }
+
+    temp_pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (temp_pool == NULL) {
+        return NULL;
+    }
+
+    tree = ngx_radix_tree_create(temp_pool, 0);
+    if (tree == NULL) {
+        goto failed;
+    }
+
+#if (NGX_HAVE_INET6)
+    tree6 = ngx_radix_tree_create(temp_pool, 0);
+    if (tree6 == NULL) {
+        goto failed;
+    }
+#endif
+
+    n = 0;
+#if (NGX_HAVE_INET6)
+    n6 = 0;
+#endif
+    cidr = cidrs->elts;
+
+    for (i = 0; i < cidrs->nelts; i++) {
+
+        switch (cidr[i].family) {
+
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+            rc = ngx_radix128tree_insert(tree6,
+                                         cidr[i].u.in6.addr.s6_addr,
+                                         cidr[i].u.in6.mask.s6_addr, 1);
+            n6++;
+            break;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+        case AF_UNIX:
+            set->local = 1;
+            continue;
+#endif
+
+        default: /* AF_INET */
+            rc = ngx_radix32tree_insert(tree, ntohl(cidr[i].u.in.addr),
+                                        ntohl(cidr[i].u.in.mask), 1);
+            n++;
+            break;
+        }
+
+        /* NGX_BUSY: the same network is listed twice */
+
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+    }
+
+    /* the radix trees are compiled into tries and freed */
+
+    if (n) {
+        set->trie = ngx_poptrie_create(pool, tree, 32);
+        if (set->trie == NULL) {
+            goto failed;
+        }
+    }
+
+#if (NGX_HAVE_INET6)
+    if (n6) {
+        set->trie6 = ngx_poptrie_create(pool, tree6, 128);
+        if (set->trie6 == NULL) {
+            goto failed;
+        }
+    }
+#endif
+
+    ngx_destroy_pool(temp_pool);
+
+    return set;
+
+failed:
+
+    ngx_destroy_pool(temp_pool);
+
+    return NULL;
+}
+
+
+ngx_int_t
+ngx_poptrie_cidrs_match(ngx_poptrie_cidrs_t *set, struct sockaddr *sa)
+{
+#if (NGX_HAVE_INET6)
+    u_char           *p;
+    in_addr_t         inaddr;
+    struct in6_addr  *inaddr6;
+#endif
+    uintptr_t         value;
+
+    switch (sa->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        inaddr6 = &((struct sockaddr_in6 *) sa)->sin6_addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(inaddr6)) {
+            if (set->trie == NULL) {
+                return NGX_DECLINED;
+            }
+
+            p = inaddr6->s6_addr;
+
+            inaddr = (in_addr_t) p[12] << 24;
+            inaddr += p[13] << 16;
+            inaddr += p[14] << 8;
+            inaddr += p[15];
+
+            value = ngx_poptrie32_find(set->trie, inaddr);
+            break;
+        }
+
+        if (set->trie6 == NULL) {
+            return NGX_DECLINED;
+        }
+
+        value = ngx_poptrie128_find(set->trie6, inaddr6->s6_addr);
+        break;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return set->local ? NGX_OK : NGX_DECLINED;
+#endif
+
+    case AF_INET:
+        if (set->trie == NULL) {
+            return NGX_DECLINED;
+        }
+
+        value = ngx_poptrie32_find(set->trie,
+                      ntohl(((struct sockaddr_in *) sa)->sin_addr.s_addr));
+        break;
+
+    default:
+        return NGX_DECLINED;
+    }
+
+    return (value == NGX_RADIX_NO_VALUE) ? NGX_DECLINED : NGX_OK;
+}
+
+
+uintptr_t
+ngx_poptrie32_find(ngx_poptrie_t *trie, uint32_t key)
+{
+    uint64_t             k, bit, mask;
+    ngx_poptrie_node_t  *node;
+
+    k = (uint64_t) key << 32;
+    node = trie->nodes;
+
+    for ( ;; ) {
+        bit = (uint64_t) 1 << (k >> (64 - NGX_POPTRIE_STRIDE));
+        mask = bit | (bit - 1);
+
+        if ((node->vector & bit) == 0) {
+            return trie->leaves[node->base0
+                                + ngx_popcount64(node->leafvec & mask) - 1];
+        }
+
+        node = &trie->nodes[node->base1
+                            + ngx_popcount64(node->vector & mask) - 1];
+
+        k <<= NGX_POPTRIE_STRIDE;
+    }
+}
+
+
+#if (NGX_HAVE_INET6)
+
+uintptr_t
+ngx_poptrie128_find(ngx_poptrie_t *trie, u_char *key)
+{
+    uint64_t             hi, lo, bit, mask;
+    ngx_uint_t           i;
+    ngx_poptrie_node_t  *node;
+
+    hi = 0;
+    lo = 0;
+
+    for (i = 0; i < 8; i++) {
+        hi = (hi << 8) | key[i];
+        lo = (lo << 8) | key[i + 8];
+    }
+
+    node = trie->nodes;
+
+    for ( ;; ) {
+        bit = (uint64_t) 1 << (hi >> (64 - NGX_POPTRIE_STRIDE));
+        mask = bit | (bit - 1);
+
+        if ((node->vector & bit) == 0) {
+            return trie->leaves[node->base0
+                                + ngx_popcount64(node->leafvec & mask) - 1];
+        }
+
+        node = &trie->nodes[node->base1
+                            + ngx_popcount64(node->vector & mask) - 1];
+
+        hi = (hi << NGX_POPTRIE_STRIDE) | (lo >> (64 - NGX_POPTRIE_STRIDE));
+        lo <<= NGX_POPTRIE_STRIDE;
+    }
+}
+
+#endif
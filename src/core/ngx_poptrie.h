@@ -0,0 +1,87 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_POPTRIE_H_INCLUDED_
+#define _NGX_POPTRIE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * A multibit trie compiled from a radix tree, after "Poptrie: A Compressed
+ * Trie with Population Count for Fast and Scalable Software IP Routing
+ * Table Lookup" by H. Asai and Y. Ohara.  Each node consumes 6 bits of
+ * a key: the "vector" bits mark the 64 entries which refer to a child
+ * node, the "leafvec" bits mark the entries which start a run of equal
+ * values, children and values of a node are stored consecutively and
+ * an entry is found by population count.
+ */
+
+#define NGX_POPTRIE_STRIDE  6
+
+
+typedef struct {
+    uint64_t            vector;
+    uint64_t            leafvec;
+    uint32_t            base0;
+    uint32_t            base1;
+} ngx_poptrie_node_t;
+
+
+typedef struct {
+    ngx_poptrie_node_t  *nodes;
+    uintptr_t           *leaves;
+    ngx_uint_t           nnodes;
+    ngx_uint_t           nleaves;
+} ngx_poptrie_t;
+
+
+/* a set of networks, such as trusted proxies, compiled for matching */
+
+typedef struct {
+    ngx_poptrie_t       *trie;
+#if (NGX_HAVE_INET6)
+    ngx_poptrie_t       *trie6;
+#endif
+    ngx_uint_t           local;     /* unsigned  local:1; */
+} ngx_poptrie_cidrs_t;
+
+
+ngx_poptrie_t *ngx_poptrie_create(ngx_pool_t *pool, ngx_radix_tree_t *tree,
+    ngx_uint_t bits);
+ngx_poptrie_cidrs_t *ngx_poptrie_cidrs_create(ngx_pool_t *pool,
+    ngx_array_t *cidrs, ngx_log_t *log);
+ngx_int_t ngx_poptrie_cidrs_match(ngx_poptrie_cidrs_t *set,
+    struct sockaddr *sa);
+
+uintptr_t ngx_poptrie32_find(ngx_poptrie_t *trie, uint32_t key);
+#if (NGX_HAVE_INET6)
+uintptr_t ngx_poptrie128_find(ngx_poptrie_t *trie, u_char *key);
+#endif
+
+
+#if (NGX_HAVE_GCC_POPCOUNT)
+
+#define ngx_popcount64(x)   __builtin_popcountll(x)
+
+#else
+
+static ngx_inline ngx_uint_t
+ngx_popcount64(uint64_t x)
+{
+    x -= (x >> 1) & 0x5555555555555555ULL;
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+    return (ngx_uint_t) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+#endif
+
+
+#endif /* _NGX_POPTRIE_H_INCLUDED_ */
@@ -0,0 +1,40 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_PROBE_H_INCLUDED_
+#define _NGX_PROBE_H_INCLUDED_
+
+
+/*
+ * USDT probes of the "nginx" provider, see misc/bpftrace/ for their users;
+ * a probe is a single nop until a tracer attaches to it, arguments should
+ * be cheap to evaluate as they are computed either way
+ */
+
+#if (NGX_HAVE_USDT)
+
+#include <sys/sdt.h>
+
+#define ngx_probe0(name)                                                      \
+    DTRACE_PROBE(nginx, name)
+#define ngx_probe1(name, a1)                                                  \
+    DTRACE_PROBE1(nginx, name, a1)
+#define ngx_probe2(name, a1, a2)                                              \
+    DTRACE_PROBE2(nginx, name, a1, a2)
+#define ngx_probe3(name, a1, a2, a3)                                          \
+    DTRACE_PROBE3(nginx, name, a1, a2, a3)
+
+#else
+
+#define ngx_probe0(name)
+#define ngx_probe1(name, a1)
+#define ngx_probe2(name, a1, a2)
+#define ngx_probe3(name, a1, a2, a3)
+
+#endif
+
+
+#endif /* _NGX_PROBE_H_INCLUDED_ */
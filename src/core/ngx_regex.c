@@ -11,11 +11,20 @@
 
 typedef struct {
     ngx_flag_t  pcre_jit;
+#if (NGX_PCRE2)
+    size_t      jit_stack_size;
+#endif
 } ngx_regex_conf_t;
 
 
+#if (NGX_PCRE2)
+static void *ngx_regex_malloc(size_t size, void *data);
+static void ngx_regex_free(void *p, void *data);
+static void ngx_regex_jit_stack_init(void);
+#else
 static void * ngx_libc_cdecl ngx_regex_malloc(size_t size);
 static void ngx_libc_cdecl ngx_regex_free(void *p);
+#endif
 #if (NGX_HAVE_PCRE_JIT)
 static void ngx_pcre_free_studies(void *data);
 #endif
@@ -38,6 +47,17 @@ static ngx_command_t  ngx_regex_commands[] = {
       offsetof(ngx_regex_conf_t, pcre_jit),
       &ngx_regex_pcre_jit_post },
 
+#if (NGX_PCRE2)
+
+    { ngx_string("pcre_jit_stack_size"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_regex_conf_t, jit_stack_size),
+      NULL },
+
+#endif
+
       ngx_null_command
 };
 
@@ -68,12 +88,30 @@ ngx_module_t  ngx_regex_module = {
 static ngx_pool_t  *ngx_pcre_pool;
 static ngx_list_t  *ngx_pcre_studies;
 
+#if (NGX_PCRE2)
+
+/*
+ * the match data and the JIT stack are shared by all matches
+ * of the process, as a worker runs one match at a time
+ */
+
+static pcre2_match_data     *ngx_regex_match_data;
+static ngx_uint_t            ngx_regex_match_data_size;
+
+static pcre2_match_context  *ngx_regex_match_context;
+static pcre2_jit_stack      *ngx_regex_jit_stack;
+static size_t                ngx_regex_jit_stack_size;
+
+#endif
+
 
 void
 ngx_regex_init(void)
 {
+#if !(NGX_PCRE2)
     pcre_malloc = ngx_regex_malloc;
     pcre_free = ngx_regex_free;
+#endif
 }
 
 
@@ -91,18 +129,242 @@ ngx_regex_malloc_done(void)
 }
 
 
+#if (NGX_PCRE2)
+
+ngx_int_t
+ngx_regex_compile(ngx_regex_compile_t *rc)
+{
+    int                     n, errcode;
+    char                   *p;
+    u_char                  errstr[128];
+    size_t                  erroff;
+    uint32_t                options;
+    pcre2_code             *re;
+    ngx_regex_elt_t        *elt;
+    pcre2_general_context  *gctx;
+    pcre2_compile_context  *cctx;
+
+    options = 0;
+
+    if (rc->options & NGX_REGEX_CASELESS) {
+        options |= PCRE2_CASELESS;
+    }
+
+    ngx_regex_malloc_init(rc->pool);
+
+    /* the contexts are allocated from the pool as well */
+
+    gctx = pcre2_general_context_create(ngx_regex_malloc, ngx_regex_free,
+                                        NULL);
+    if (gctx == NULL) {
+        ngx_regex_malloc_done();
+        goto nomem;
+    }
+
+    cctx = pcre2_compile_context_create(gctx);
+    if (cctx == NULL) {
+        ngx_regex_malloc_done();
+        goto nomem;
+    }
+
+    re = pcre2_compile(rc->pattern.data, rc->pattern.len, options,
+                       &errcode, &erroff, cctx);
+
+    /* ensure that there is no current pool */
+    ngx_regex_malloc_done();
+
+    if (re == NULL) {
+        pcre2_get_error_message(errcode, errstr, sizeof(errstr));
+
+        if (erroff == rc->pattern.len) {
+           rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                              "pcre2_compile() failed: %s in \"%V\"",
+                               errstr, &rc->pattern)
+                      - rc->err.data;
+
+        } else {
+           rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                              "pcre2_compile() failed: %s in \"%V\" at \"%s\"",
+                               errstr, &rc->pattern, rc->pattern.data + erroff)
+                      - rc->err.data;
+        }
+
+        return NGX_ERROR;
+    }
+
+    rc->regex = re;
+
+    /* do not JIT compile at runtime */
+
+    if (ngx_pcre_studies != NULL) {
+        elt = ngx_list_push(ngx_pcre_studies);
+        if (elt == NULL) {
+            goto nomem;
+        }
+
+        elt->regex = rc->regex;
+        elt->name = rc->pattern.data;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &rc->captures);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_CAPTURECOUNT) failed: %d";
+        goto failed;
+    }
+
+    if (rc->captures == 0) {
+        return NGX_OK;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_NAMECOUNT, &rc->named_captures);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_NAMECOUNT) failed: %d";
+        goto failed;
+    }
+
+    if (rc->named_captures == 0) {
+        return NGX_OK;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_NAMEENTRYSIZE, &rc->name_size);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_NAMEENTRYSIZE) failed: %d";
+        goto failed;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_NAMETABLE, &rc->names);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_NAMETABLE) failed: %d";
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    rc->err.len = ngx_snprintf(rc->err.data, rc->err.len, p, &rc->pattern, n)
+                  - rc->err.data;
+    return NGX_ERROR;
+
+nomem:
+
+    rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                               "regex \"%V\" compilation failed: no memory",
+                               &rc->pattern)
+                  - rc->err.data;
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures, ngx_uint_t size)
+{
+    int          rc;
+    size_t      *ov;
+    ngx_uint_t   i, n;
+
+    /* as with pcre_exec(), the last third of captures is a workspace */
+    size /= 3;
+
+    if (ngx_regex_match_data == NULL || size > ngx_regex_match_data_size) {
+
+        if (ngx_regex_match_data) {
+            pcre2_match_data_free(ngx_regex_match_data);
+        }
+
+        ngx_regex_match_data_size = size;
+        ngx_regex_match_data = pcre2_match_data_create(size ? size : 1, NULL);
+
+        if (ngx_regex_match_data == NULL) {
+            return PCRE2_ERROR_NOMEMORY;
+        }
+    }
+
+    if (ngx_regex_jit_stack_size && ngx_regex_match_context == NULL) {
+        ngx_regex_jit_stack_init();
+    }
+
+    rc = pcre2_match(re, s->data, s->len, 0, 0, ngx_regex_match_data,
+                     ngx_regex_match_context);
+
+    if (rc < 0) {
+        return rc;
+    }
+
+    n = pcre2_get_ovector_count(ngx_regex_match_data);
+    ov = pcre2_get_ovector_pointer(ngx_regex_match_data);
+
+    if (n > size) {
+        n = size;
+    }
+
+    for (i = 0; i < n; i++) {
+        captures[i * 2] = ov[i * 2];
+        captures[i * 2 + 1] = ov[i * 2 + 1];
+    }
+
+    /* the shared match data may be larger than the captures */
+
+    if ((ngx_uint_t) rc > size) {
+        rc = 0;
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_regex_jit_stack_init(void)
+{
+    ngx_regex_match_context = pcre2_match_context_create(NULL);
+    if (ngx_regex_match_context == NULL) {
+        goto failed;
+    }
+
+    ngx_regex_jit_stack = pcre2_jit_stack_create(
+                                  ngx_min(32 * 1024, ngx_regex_jit_stack_size),
+                                  ngx_regex_jit_stack_size, NULL);
+    if (ngx_regex_jit_stack == NULL) {
+        pcre2_match_context_free(ngx_regex_match_context);
+        ngx_regex_match_context = NULL;
+        goto failed;
+    }
+
+    pcre2_jit_stack_assign(ngx_regex_match_context, NULL, ngx_regex_jit_stack);
+
+    return;
+
+failed:
+
+    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                  "failed to allocate PCRE2 JIT stack of %uz bytes, "
+                  "the default stack is used",
+                  ngx_regex_jit_stack_size);
+
+    /* do not retry */
+    ngx_regex_jit_stack_size = 0;
+}
+
+#else
+
 ngx_int_t
 ngx_regex_compile(ngx_regex_compile_t *rc)
 {
-    int               n, erroff;
+    int               n, erroff, options;
     char             *p;
     pcre             *re;
     const char       *errstr;
     ngx_regex_elt_t  *elt;
 
+    options = 0;
+
+    if (rc->options & NGX_REGEX_CASELESS) {
+        options |= PCRE_CASELESS;
+    }
+
     ngx_regex_malloc_init(rc->pool);
 
-    re = pcre_compile((const char *) rc->pattern.data, (int) rc->options,
+    re = pcre_compile((const char *) rc->pattern.data, options,
                       &errstr, &erroff, NULL);
 
     /* ensure that there is no current pool */
@@ -193,6 +455,8 @@ nomem:
     return NGX_ERROR;
 }
 
+#endif
+
 
 ngx_int_t
 ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
@@ -227,6 +491,30 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+#if (NGX_PCRE2)
+
+static void *
+ngx_regex_malloc(size_t size, void *data)
+{
+    ngx_pool_t      *pool;
+    pool = ngx_pcre_pool;
+
+    if (pool) {
+        return ngx_palloc(pool, size);
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_regex_free(void *p, void *data)
+{
+    return;
+}
+
+#else
+
 static void * ngx_libc_cdecl
 ngx_regex_malloc(size_t size)
 {
@@ -247,6 +535,8 @@ ngx_regex_free(void *p)
     return;
 }
 
+#endif
+
 
 #if (NGX_HAVE_PCRE_JIT)
 
@@ -274,15 +564,99 @@ ngx_pcre_free_studies(void *data)
             i = 0;
         }
 
+#if (NGX_PCRE2)
+        /* frees the JIT code, the pattern itself is in the pool */
+        pcre2_code_free(elts[i].regex);
+#else
         if (elts[i].regex->extra != NULL) {
             pcre_free_study(elts[i].regex->extra);
         }
+#endif
     }
 }
 
 #endif
 
 
+#if (NGX_PCRE2)
+
+static ngx_int_t
+ngx_regex_module_init(ngx_cycle_t *cycle)
+{
+    int                  n;
+    ngx_uint_t           i;
+    ngx_list_part_t     *part;
+    ngx_regex_elt_t     *elts;
+    ngx_regex_conf_t    *rcf;
+    ngx_pool_cleanup_t  *cln;
+
+    rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
+
+    /* the JIT stack is recreated on first match with the new size */
+
+    if (ngx_regex_match_context) {
+        pcre2_match_context_free(ngx_regex_match_context);
+        pcre2_jit_stack_free(ngx_regex_jit_stack);
+        ngx_regex_match_context = NULL;
+        ngx_regex_jit_stack = NULL;
+    }
+
+    ngx_regex_jit_stack_size = rcf->pcre_jit ? rcf->jit_stack_size : 0;
+
+    if (!rcf->pcre_jit) {
+        ngx_pcre_studies = NULL;
+        return NGX_OK;
+    }
+
+    /*
+     * The PCRE2 JIT compiler uses mmap for its executable codes, so we
+     * have to explicitly call the pcre2_code_free() function to free
+     * this memory.
+     */
+
+    cln = ngx_pool_cleanup_add(cycle->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_pcre_free_studies;
+    cln->data = ngx_pcre_studies;
+
+    ngx_regex_malloc_init(cycle->pool);
+
+    part = &ngx_pcre_studies->part;
+    elts = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            elts = part->elts;
+            i = 0;
+        }
+
+        n = pcre2_jit_compile(elts[i].regex, PCRE2_JIT_COMPLETE);
+
+        if (n != 0) {
+            ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                          "JIT compiler does not support pattern: \"%s\"",
+                          elts[i].name);
+        }
+    }
+
+    ngx_regex_malloc_done();
+
+    ngx_pcre_studies = NULL;
+
+    return NGX_OK;
+}
+
+#else
+
 static ngx_int_t
 ngx_regex_module_init(ngx_cycle_t *cycle)
 {
@@ -370,6 +744,8 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
     return NGX_OK;
 }
 
+#endif
+
 
 static void *
 ngx_regex_create_conf(ngx_cycle_t *cycle)
@@ -382,6 +758,9 @@ ngx_regex_create_conf(ngx_cycle_t *cycle)
     }
 
     rcf->pcre_jit = NGX_CONF_UNSET;
+#if (NGX_PCRE2)
+    rcf->jit_stack_size = NGX_CONF_UNSET_SIZE;
+#endif
 
     ngx_pcre_studies = ngx_list_create(cycle->pool, 8, sizeof(ngx_regex_elt_t));
     if (ngx_pcre_studies == NULL) {
@@ -398,6 +777,9 @@ ngx_regex_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_regex_conf_t *rcf = conf;
 
     ngx_conf_init_value(rcf->pcre_jit, 0);
+#if (NGX_PCRE2)
+    ngx_conf_init_size_value(rcf->jit_stack_size, 1024 * 1024);
+#endif
 
     return NGX_CONF_OK;
 }
@@ -412,7 +794,19 @@ ngx_regex_pcre_jit(ngx_conf_t *cf, void *post, void *data)
         return NGX_CONF_OK;
     }
 
-#if (NGX_HAVE_PCRE_JIT)
+#if (NGX_PCRE2)
+    {
+    uint32_t  jit;
+
+    jit = 0;
+
+    if (pcre2_config(PCRE2_CONFIG_JIT, &jit) < 0 || jit != 1) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "PCRE2 library does not support JIT");
+        *fp = 0;
+    }
+    }
+#elif (NGX_HAVE_PCRE_JIT)
     {
     int  jit, r;
 
@@ -12,19 +12,31 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
-#include <pcre.h>
+#if (NGX_PCRE2)
+
+#define PCRE2_CODE_UNIT_WIDTH  8
+#include <pcre2.h>
 
+#define NGX_REGEX_NO_MATCHED   PCRE2_ERROR_NOMATCH   /* -1 */
 
-#define NGX_REGEX_NO_MATCHED  PCRE_ERROR_NOMATCH   /* -1 */
+typedef pcre2_code  ngx_regex_t;
 
-#define NGX_REGEX_CASELESS    PCRE_CASELESS
+#else
 
+#include <pcre.h>
+
+#define NGX_REGEX_NO_MATCHED   PCRE_ERROR_NOMATCH    /* -1 */
 
 typedef struct {
     pcre        *code;
     pcre_extra  *extra;
 } ngx_regex_t;
 
+#endif
+
+
+#define NGX_REGEX_CASELESS     0x00000001
+
 
 typedef struct {
     ngx_str_t     pattern;
@@ -49,12 +61,43 @@ typedef struct {
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
+#if (NGX_PCRE2)
+
+ngx_int_t ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures,
+    ngx_uint_t size);
+
+#define ngx_regex_exec_n       "pcre2_match()"
+
+#else
+
 #define ngx_regex_exec(re, s, captures, size)                                \
     pcre_exec(re->code, re->extra, (const char *) (s)->data, (s)->len, 0, 0, \
               captures, size)
-#define ngx_regex_exec_n      "pcre_exec()"
+#define ngx_regex_exec_n       "pcre_exec()"
+
+#endif
 
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
 
+#if (NGX_RE2)
+
+/*
+ * a set of patterns matched in one pass by RE2, used as a prefilter:
+ * ngx_regex_set_match() returns a map with a non-zero byte for each
+ * pattern that may match, patterns RE2 cannot compile are always set
+ */
+
+typedef struct ngx_regex_set_s  ngx_regex_set_t;
+
+ngx_regex_set_t *ngx_regex_set_create(ngx_pool_t *pool, ngx_uint_t n);
+ngx_int_t ngx_regex_set_add(ngx_regex_set_t *set, ngx_str_t *pattern,
+    ngx_int_t options, ngx_str_t *err);
+ngx_int_t ngx_regex_set_compile(ngx_regex_set_t *set);
+u_char *ngx_regex_set_match(ngx_regex_set_t *set, ngx_str_t *s,
+    ngx_pool_t *pool);
+
+#endif
+
+
 #endif /* _NGX_REGEX_H_INCLUDED_ */
@@ -0,0 +1,238 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+extern "C" {
+  #include <ngx_config.h>
+  #include <ngx_core.h>
+}
+
+// nginx header files should go before other, because they define 64-bit off_t
+#include <new>
+#include <string>
+#include <vector>
+#include <re2/re2.h>
+#include <re2/set.h>
+
+
+struct ngx_regex_set_s {
+    ngx_regex_set_s(const re2::RE2::Options &options)
+        : set(options, re2::RE2::UNANCHORED) {}
+
+    re2::RE2::Set       set;
+    std::vector<int>    matches;
+
+    ngx_uint_t          n;
+    ngx_uint_t          nelts;
+    ngx_uint_t          nset;
+
+    /* pattern number of each RE2 set entry */
+    ngx_uint_t         *index;
+
+    /* initial match map, patterns not in the set are always tested */
+    u_char             *always;
+};
+
+
+static void ngx_regex_set_cleanup(void *data);
+
+
+ngx_regex_set_t *
+ngx_regex_set_create(ngx_pool_t *pool, ngx_uint_t n)
+{
+    ngx_regex_set_t     *set;
+    ngx_pool_cleanup_t  *cln;
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    /*
+     * URIs are byte strings and PCRE is used without UTF-8,
+     * so RE2 sees the patterns and subjects as Latin-1
+     */
+
+    re2::RE2::Options  options;
+
+    options.set_encoding(re2::RE2::Options::EncodingLatin1);
+    options.set_log_errors(false);
+
+    try {
+        set = new ngx_regex_set_s(options);
+
+    } catch (...) {
+        return NULL;
+    }
+
+    cln->handler = ngx_regex_set_cleanup;
+    cln->data = set;
+
+    set->n = n;
+    set->nelts = 0;
+    set->nset = 0;
+
+    set->index = (ngx_uint_t *) ngx_palloc(pool, n * sizeof(ngx_uint_t));
+    if (set->index == NULL) {
+        return NULL;
+    }
+
+    set->always = (u_char *) ngx_pcalloc(pool, n);
+    if (set->always == NULL) {
+        return NULL;
+    }
+
+    return set;
+}
+
+
+ngx_int_t
+ngx_regex_set_add(ngx_regex_set_t *set, ngx_str_t *pattern,
+    ngx_int_t options, ngx_str_t *err)
+{
+    int          i;
+    u_char      *p, *last;
+    std::string  re, error;
+
+    if (set->nelts == set->n) {
+        return NGX_ERROR;
+    }
+
+    p = pattern->data;
+    last = p + pattern->len;
+
+    try {
+        if (options & NGX_REGEX_CASELESS) {
+            re.assign("(?i)");
+        }
+
+        /*
+         * RE2 only knows the "(?P<name>" syntax of named captures;
+         * a wrong rewrite inside a character class may only widen it,
+         * which is harmless as PCRE still tests the matched patterns
+         */
+
+        while (p < last) {
+
+            if (*p == '\\' && p + 1 < last) {
+                re.append((const char *) p, 2);
+                p += 2;
+                continue;
+            }
+
+            re.push_back(*p);
+
+            if (last - p > 3 && ngx_strncmp(p, "(?<", 3) == 0
+                && p[3] != '=' && p[3] != '!')
+            {
+                re.append("?P<");
+                p += 3;
+                continue;
+            }
+
+            p++;
+        }
+
+        i = set->set.Add(re, &error);
+
+    } catch (...) {
+        return NGX_ERROR;
+    }
+
+    if (i < 0) {
+        set->always[set->nelts++] = 1;
+
+        err->len = ngx_snprintf(err->data, err->len, "%*s",
+                                error.length(), error.data())
+                   - err->data;
+
+        return NGX_DECLINED;
+    }
+
+    set->index[i] = set->nelts++;
+    set->nset++;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_regex_set_compile(ngx_regex_set_t *set)
+{
+    bool  rc;
+
+    if (set->nset == 0) {
+        return NGX_DECLINED;
+    }
+
+    try {
+        set->matches.reserve(set->nset);
+
+        rc = set->set.Compile();
+
+    } catch (...) {
+        return NGX_ERROR;
+    }
+
+    return rc ? NGX_OK : NGX_ERROR;
+}
+
+
+u_char *
+ngx_regex_set_match(ngx_regex_set_t *set, ngx_str_t *s, ngx_pool_t *pool)
+{
+    u_char                         *map;
+    std::vector<int>::iterator      it;
+    re2::RE2::Set::ErrorInfo        info;
+
+    map = (u_char *) ngx_pnalloc(pool, set->n);
+    if (map == NULL) {
+        return NULL;
+    }
+
+    /*
+     * PCRE "$" also matches before a trailing newline, and RE2 "$" does
+     * not, so subjects with newlines are left to PCRE entirely
+     */
+
+    if (ngx_strlchr(s->data, s->data + s->len, '\n')) {
+        ngx_memset(map, 1, set->n);
+        return map;
+    }
+
+    ngx_memcpy(map, set->always, set->n);
+
+    try {
+        if (!set->set.Match(re2::StringPiece((const char *) s->data, s->len),
+                            &set->matches, &info))
+        {
+            if (info.kind != re2::RE2::Set::kNoError) {
+                /* the DFA is out of memory, test all patterns */
+                ngx_memset(map, 1, set->n);
+            }
+
+            return map;
+        }
+
+    } catch (...) {
+        ngx_memset(map, 1, set->n);
+        return map;
+    }
+
+    for (it = set->matches.begin(); it != set->matches.end(); ++it) {
+        map[set->index[*it]] = 1;
+    }
+
+    return map;
+}
+
+
+static void
+ngx_regex_set_cleanup(void *data)
+{
+    ngx_regex_set_t  *set = (ngx_regex_set_t *) data;
+
+    delete set;
+}
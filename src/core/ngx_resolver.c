@@ -51,6 +51,29 @@ typedef struct {
 } ngx_resolver_an_t;
 
 
+/*
+ * a node of the shared cache holds the name followed by its A and AAAA
+ * addresses
+ */
+
+typedef struct {
+    ngx_str_node_t            sn;
+    ngx_queue_t               queue;
+    time_t                    valid;
+    u_short                   naddrs;
+    u_short                   naddrs6;
+    u_short                   ipv6;
+    u_char                    data[1];
+} ngx_resolver_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t              rbtree;
+    ngx_rbtree_node_t         sentinel;
+    ngx_queue_t               queue;
+} ngx_resolver_cache_t;
+
+
 #define ngx_resolver_node(n)                                                 \
     (ngx_resolver_node_t *)                                                  \
         ((u_char *) (n) - offsetof(ngx_resolver_node_t, node))
@@ -109,6 +132,15 @@ static ngx_int_t ngx_resolver_set_timeout(ngx_resolver_t *r,
     ngx_resolver_ctx_t *ctx);
 static void ngx_resolver_timeout_handler(ngx_event_t *ev);
 static void ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn);
+static void ngx_resolver_free_stale(ngx_resolver_t *r, ngx_resolver_node_t *rn);
+static void ngx_resolver_report_stale(ngx_resolver_t *r,
+    ngx_resolver_ctx_t *ctx, ngx_resolver_node_t *rn);
+static ngx_int_t ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_resolver_cache_get(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_str_t *name, uint32_t hash);
+static void ngx_resolver_cache_set(ngx_resolver_t *r, ngx_resolver_node_t *rn);
+static void ngx_resolver_cache_expire(ngx_slab_pool_t *shpool,
+    ngx_resolver_cache_t *cache, ngx_uint_t force);
 static void *ngx_resolver_alloc(ngx_resolver_t *r, size_t size);
 static void *ngx_resolver_calloc(ngx_resolver_t *r, size_t size);
 static void ngx_resolver_free(ngx_resolver_t *r, void *p);
@@ -134,7 +166,9 @@ static ngx_resolver_node_t *ngx_resolver_lookup_addr6(ngx_resolver_t *r,
 ngx_resolver_t *
 ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 {
-    ngx_str_t                   s;
+    u_char                     *p;
+    ssize_t                     size;
+    ngx_str_t                   s, z;
     ngx_url_t                   u;
     ngx_uint_t                  i, j;
     ngx_resolver_t             *r;
@@ -197,6 +231,8 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
     r->tcp_timeout = 5;
     r->expire = 30;
     r->valid = 0;
+    r->stale = 0;
+    r->prefetch = 0;
 
     r->log = &cf->cycle->new_log;
     r->log_level = NGX_LOG_ERR;
@@ -226,6 +262,77 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+        if (ngx_strncmp(names[i].data, "stale=", 6) == 0) {
+            s.len = names[i].len - 6;
+            s.data = names[i].data + 6;
+
+            r->stale = ngx_parse_time(&s, 1);
+
+            if (r->stale == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "prefetch=", 9) == 0) {
+            s.len = names[i].len - 9;
+            s.data = names[i].data + 9;
+
+            r->prefetch = ngx_parse_time(&s, 1);
+
+            if (r->prefetch == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "zone=", 5) == 0) {
+            s.data = names[i].data + 5;
+
+            p = (u_char *) ngx_strchr(s.data, ':');
+
+            if (p == NULL || p == s.data) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            s.len = p - s.data;
+
+            z.data = p + 1;
+            z.len = names[i].data + names[i].len - z.data;
+
+            size = ngx_parse_size(&z);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &names[i]);
+                return NULL;
+            }
+
+            r->shm_zone = ngx_shared_memory_add(cf, &s, size,
+                                                &ngx_core_module);
+            if (r->shm_zone == NULL) {
+                return NULL;
+            }
+
+            r->shm_zone->init = ngx_resolver_init_zone;
+
+            continue;
+        }
+
 #if (NGX_HAVE_INET6)
         if (ngx_strncmp(names[i].data, "ipv6=", 5) == 0) {
 
@@ -615,7 +722,10 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
         /* ctx can be a list after NGX_RESOLVE_CNAME */
         for (last = ctx; last->next; last = last->next);
 
-        if (rn->valid >= ngx_time()) {
+        if (rn->valid >= ngx_time()
+            && (rn->valid - ngx_time() >= r->prefetch
+                || ctx->service.len || rn->cnlen))
+        {
 
             ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
 
@@ -724,6 +834,15 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
             return NGX_OK;
         }
 
+        if (rn->stale && rn->stale_valid >= ngx_time()) {
+
+            /* the name is being refreshed */
+
+            ngx_resolver_report_stale(r, ctx, rn);
+
+            return NGX_OK;
+        }
+
         if (rn->waiting) {
             if (ngx_resolver_set_timeout(r, ctx) != NGX_OK) {
                 return NGX_ERROR;
@@ -744,6 +863,28 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
 
         ngx_queue_remove(&rn->queue);
 
+        ngx_resolver_free_stale(r, rn);
+
+        /*
+         * an answer which is about to expire or has expired recently
+         * is kept and served while the name is queried again
+         */
+
+        naddrs = 0;
+
+        if (rn->valid && rn->valid + r->stale >= ngx_time()) {
+            naddrs = rn->naddrs;
+#if (NGX_HAVE_INET6)
+            naddrs += rn->naddrs6;
+#endif
+        }
+
+        if (naddrs && ctx->service.len == 0) {
+            rn->stale = ngx_resolver_export(r, rn, 0);
+            rn->nstale = naddrs;
+            rn->stale_valid = rn->valid + r->stale;
+        }
+
         /* lock alloc mutex */
 
         if (rn->query) {
@@ -799,10 +940,23 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
 #if (NGX_HAVE_INET6)
         rn->query6 = NULL;
 #endif
+        rn->stale = NULL;
 
         ngx_rbtree_insert(tree, &rn->node);
     }
 
+    if (r->shm_zone && ctx->service.len == 0
+        && ngx_resolver_cache_get(r, rn, name, hash) == NGX_OK)
+    {
+        ngx_resolver_free_stale(r, rn);
+
+        rn->expire = ngx_time() + r->expire;
+
+        ngx_queue_insert_head(expire_queue, &rn->queue);
+
+        return ngx_resolve_name_locked(r, ctx, name);
+    }
+
     if (ctx->service.len) {
         rc = ngx_resolver_create_srv_query(r, rn, name);
 
@@ -817,6 +971,7 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
     if (rc == NGX_DECLINED) {
         ngx_rbtree_delete(tree, &rn->node);
 
+        ngx_resolver_free_stale(r, rn);
         ngx_resolver_free(r, rn->query);
         ngx_resolver_free(r, rn->name);
         ngx_resolver_free(r, rn);
@@ -858,7 +1013,7 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
         (void) ngx_resolver_send_query(r, rn);
     }
 
-    if (ngx_resolver_set_timeout(r, ctx) != NGX_OK) {
+    if (rn->stale == NULL && ngx_resolver_set_timeout(r, ctx) != NGX_OK) {
         goto failed;
     }
 
@@ -874,6 +1029,15 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
     rn->cnlen = 0;
     rn->valid = 0;
     rn->ttl = NGX_MAX_UINT32_VALUE;
+
+    if (rn->stale) {
+        rn->waiting = NULL;
+
+        ngx_resolver_report_stale(r, ctx, rn);
+
+        return NGX_OK;
+    }
+
     rn->waiting = ctx;
 
     ctx->state = NGX_AGAIN;
@@ -890,6 +1054,8 @@ failed:
 
     ngx_rbtree_delete(tree, &rn->node);
 
+    ngx_resolver_free_stale(r, rn);
+
     if (rn->query) {
         ngx_resolver_free(r, rn->query);
     }
@@ -960,7 +1126,10 @@ ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
 
     if (rn) {
 
-        if (rn->valid >= ngx_time()) {
+        if (rn->valid >= ngx_time()
+            && (rn->valid - ngx_time() >= r->prefetch
+                || ctx->service.len || rn->cnlen))
+        {
 
             ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
 
@@ -991,6 +1160,15 @@ ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
             return NGX_OK;
         }
 
+        if (rn->stale && rn->stale_valid >= ngx_time()) {
+
+            /* the name is being refreshed */
+
+            ngx_resolver_report_stale(r, ctx, rn);
+
+            return NGX_OK;
+        }
+
         if (rn->waiting) {
             if (ngx_resolver_set_timeout(r, ctx) != NGX_OK) {
                 return NGX_ERROR;
@@ -1038,6 +1216,7 @@ ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
 #if (NGX_HAVE_INET6)
         rn->query6 = NULL;
 #endif
+        rn->stale = NULL;
 
         ngx_rbtree_insert(tree, &rn->node);
     }
@@ -1515,7 +1694,7 @@ ngx_resolver_resend(ngx_resolver_t *r, ngx_rbtree_t *tree, ngx_queue_t *queue)
 
         ngx_queue_remove(q);
 
-        if (rn->waiting) {
+        if (rn->waiting || (rn->stale && rn->stale_valid >= now)) {
 
             if (++rn->last_connection == r->connections.nelts) {
                 rn->last_connection = 0;
@@ -1976,7 +2155,7 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_remove(&rn->queue);
 
-        if (rn->waiting == NULL) {
+        if (rn->waiting == NULL && rn->stale == NULL) {
             ngx_rbtree_delete(&r->name_rbtree, &rn->node);
             ngx_resolver_free_node(r, rn);
             goto next;
@@ -2397,6 +2576,12 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        ngx_resolver_free_stale(r, rn);
+
+        if (r->shm_zone) {
+            ngx_resolver_cache_set(r, rn);
+        }
+
         next = rn->waiting;
         rn->waiting = NULL;
 
@@ -2469,6 +2654,8 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        ngx_resolver_free_stale(r, rn);
+
         ngx_resolver_free(r, rn->query);
         rn->query = NULL;
 #if (NGX_HAVE_INET6)
@@ -4088,12 +4275,332 @@ ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
         ngx_resolver_free_locked(r, rn->u.srvs);
     }
 
+    if (rn->stale) {
+        ngx_resolver_free_locked(r, rn->stale->sockaddr);
+        ngx_resolver_free_locked(r, rn->stale);
+    }
+
     ngx_resolver_free_locked(r, rn);
 
     /* unlock alloc mutex */
 }
 
 
+static void
+ngx_resolver_free_stale(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    if (rn->stale) {
+        ngx_resolver_free(r, rn->stale->sockaddr);
+        ngx_resolver_free(r, rn->stale);
+        rn->stale = NULL;
+    }
+}
+
+
+static void
+ngx_resolver_report_stale(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
+    ngx_resolver_node_t *rn)
+{
+    ngx_resolver_ctx_t  *next;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve stale \"%*s\"", (size_t) rn->nlen, rn->name);
+
+    /* unlock name mutex */
+
+    do {
+        ctx->state = NGX_OK;
+        ctx->valid = ngx_time();
+        ctx->naddrs = rn->nstale;
+        ctx->addrs = rn->stale;
+
+        next = ctx->next;
+
+        ctx->handler(ctx);
+
+        ctx = next;
+    } while (ctx);
+}
+
+
+static ngx_int_t
+ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_cache_t  *ocache = data;
+
+    size_t                 len;
+    ngx_slab_pool_t       *shpool;
+    ngx_resolver_cache_t  *cache;
+
+    if (ocache) {
+        shm_zone->data = ocache;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    cache = ngx_slab_alloc(shpool, sizeof(ngx_resolver_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = cache;
+    shm_zone->data = cache;
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->queue);
+
+    len = sizeof(" in resolver zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in resolver zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* the oldest answers are evicted when the zone is full */
+
+    shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_resolver_cache_get(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_str_t *name, uint32_t hash)
+{
+    u_char                     *p;
+    in_addr_t                  *addr;
+    ngx_slab_pool_t            *shpool;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+#if (NGX_HAVE_INET6)
+    struct in6_addr            *addr6;
+#endif
+
+    shpool = (ngx_slab_pool_t *) r->shm_zone->shm.addr;
+    cache = r->shm_zone->data;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    cn = (ngx_resolver_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->rbtree, name, hash);
+
+    /* answers due to be prefetched are queried by the worker itself */
+
+    if (cn == NULL
+        || cn->valid - ngx_time() < r->prefetch
+        || cn->valid < ngx_time()
+#if (NGX_HAVE_INET6)
+        || cn->ipv6 != r->ipv6
+#endif
+       )
+    {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+    p = cn->data + name->len;
+
+    if (cn->naddrs > 1) {
+        addr = ngx_resolver_alloc(r, cn->naddrs * sizeof(in_addr_t));
+        if (addr == NULL) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return NGX_ERROR;
+        }
+
+        rn->u.addrs = addr;
+
+    } else {
+        addr = &rn->u.addr;
+    }
+
+    p = ngx_cpymem(addr, p, cn->naddrs * sizeof(in_addr_t));
+
+#if (NGX_HAVE_INET6)
+
+    if (cn->naddrs6 > 1) {
+        addr6 = ngx_resolver_alloc(r, cn->naddrs6 * sizeof(struct in6_addr));
+        if (addr6 == NULL) {
+            ngx_shmtx_unlock(&shpool->mutex);
+
+            if (cn->naddrs > 1) {
+                ngx_resolver_free(r, addr);
+            }
+
+            return NGX_ERROR;
+        }
+
+        rn->u6.addrs6 = addr6;
+
+    } else {
+        addr6 = &rn->u6.addr6;
+    }
+
+    ngx_memcpy(addr6, p, cn->naddrs6 * sizeof(struct in6_addr));
+
+    rn->naddrs6 = cn->naddrs6;
+
+#endif
+
+    rn->naddrs = cn->naddrs;
+    rn->valid = cn->valid;
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver shared \"%V\" %T", name, rn->valid - ngx_time());
+
+    rn->code = 0;
+    rn->cnlen = 0;
+    rn->nsrvs = 0;
+    rn->waiting = NULL;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_resolver_cache_set(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                     *p;
+    size_t                      size, n, n6;
+    in_addr_t                  *addr;
+    ngx_str_t                   name;
+    ngx_slab_pool_t            *shpool;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+#if (NGX_HAVE_INET6)
+    struct in6_addr            *addr6;
+#endif
+
+    shpool = (ngx_slab_pool_t *) r->shm_zone->shm.addr;
+    cache = r->shm_zone->data;
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+    n = rn->naddrs * sizeof(in_addr_t);
+    addr = (rn->naddrs == 1) ? &rn->u.addr : rn->u.addrs;
+
+#if (NGX_HAVE_INET6)
+    n6 = rn->naddrs6 * sizeof(struct in6_addr);
+    addr6 = (rn->naddrs6 == 1) ? &rn->u6.addr6 : rn->u6.addrs6;
+#else
+    n6 = 0;
+#endif
+
+    size = offsetof(ngx_resolver_cache_node_t, data) + name.len + n + n6;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    ngx_resolver_cache_expire(shpool, cache, 0);
+
+    cn = (ngx_resolver_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->rbtree, &name, rn->node.key);
+
+    if (cn) {
+        ngx_queue_remove(&cn->queue);
+        ngx_rbtree_delete(&cache->rbtree, &cn->sn.node);
+        ngx_slab_free_locked(shpool, cn);
+    }
+
+    cn = ngx_slab_alloc_locked(shpool, size);
+
+    if (cn == NULL) {
+        ngx_resolver_cache_expire(shpool, cache, 1);
+
+        cn = ngx_slab_alloc_locked(shpool, size);
+
+        if (cn == NULL) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return;
+        }
+    }
+
+    cn->sn.node.key = rn->node.key;
+    cn->sn.str.len = name.len;
+    cn->sn.str.data = cn->data;
+
+    p = ngx_cpymem(cn->data, name.data, name.len);
+    p = ngx_cpymem(p, addr, n);
+
+#if (NGX_HAVE_INET6)
+    ngx_memcpy(p, addr6, n6);
+
+    cn->naddrs6 = rn->naddrs6;
+    cn->ipv6 = (u_short) r->ipv6;
+#else
+    cn->naddrs6 = 0;
+    cn->ipv6 = 0;
+#endif
+
+    cn->naddrs = rn->naddrs;
+    cn->valid = rn->valid;
+
+    ngx_rbtree_insert(&cache->rbtree, &cn->sn.node);
+
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+/*
+ * removes up to two expired answers not used for the longest time,
+ * or the least recently used answer regardless of its expiration
+ * if memory is needed
+ */
+
+static void
+ngx_resolver_cache_expire(ngx_slab_pool_t *shpool,
+    ngx_resolver_cache_t *cache, ngx_uint_t force)
+{
+    time_t                      now;
+    ngx_uint_t                  n;
+    ngx_queue_t                *q;
+    ngx_resolver_cache_node_t  *cn;
+
+    now = ngx_time();
+
+    for (n = 0; n < 2; n++) {
+
+        if (ngx_queue_empty(&cache->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->queue);
+
+        cn = ngx_queue_data(q, ngx_resolver_cache_node_t, queue);
+
+        if (!force && cn->valid >= now) {
+            return;
+        }
+
+        force = 0;
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&cache->rbtree, &cn->sn.node);
+
+        ngx_slab_free_locked(shpool, cn);
+    }
+}
+
+
 static void *
 ngx_resolver_alloc(ngx_resolver_t *r, size_t size)
 {
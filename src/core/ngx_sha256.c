@@ -0,0 +1,269 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ *
+ * An internal SHA-256 implementation.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_sha256.h>
+
+
+static const u_char *ngx_sha256_body(ngx_sha256_t *ctx, const u_char *data,
+    size_t size);
+
+
+void
+ngx_sha256_init(ngx_sha256_t *ctx)
+{
+    ctx->h[0] = 0x6a09e667;
+    ctx->h[1] = 0xbb67ae85;
+    ctx->h[2] = 0x3c6ef372;
+    ctx->h[3] = 0xa54ff53a;
+    ctx->h[4] = 0x510e527f;
+    ctx->h[5] = 0x9b05688c;
+    ctx->h[6] = 0x1f83d9ab;
+    ctx->h[7] = 0x5be0cd19;
+
+    ctx->bytes = 0;
+}
+
+
+void
+ngx_sha256_update(ngx_sha256_t *ctx, const void *data, size_t size)
+{
+    size_t  used, free;
+
+    used = (size_t) (ctx->bytes & 0x3f);
+    ctx->bytes += size;
+
+    if (used) {
+        free = 64 - used;
+
+        if (size < free) {
+            ngx_memcpy(&ctx->buffer[used], data, size);
+            return;
+        }
+
+        ngx_memcpy(&ctx->buffer[used], data, free);
+        data = (u_char *) data + free;
+        size -= free;
+        (void) ngx_sha256_body(ctx, ctx->buffer, 64);
+    }
+
+    if (size >= 64) {
+        data = ngx_sha256_body(ctx, data, size & ~(size_t) 0x3f);
+        size &= 0x3f;
+    }
+
+    ngx_memcpy(ctx->buffer, data, size);
+}
+
+
+void
+ngx_sha256_final(u_char result[32], ngx_sha256_t *ctx)
+{
+    size_t      used, free;
+    ngx_uint_t  i;
+
+    used = (size_t) (ctx->bytes & 0x3f);
+
+    ctx->buffer[used++] = 0x80;
+
+    free = 64 - used;
+
+    if (free < 8) {
+        ngx_memzero(&ctx->buffer[used], free);
+        (void) ngx_sha256_body(ctx, ctx->buffer, 64);
+        used = 0;
+        free = 64;
+    }
+
+    ngx_memzero(&ctx->buffer[used], free - 8);
+
+    ctx->bytes <<= 3;
+    ctx->buffer[56] = (u_char) (ctx->bytes >> 56);
+    ctx->buffer[57] = (u_char) (ctx->bytes >> 48);
+    ctx->buffer[58] = (u_char) (ctx->bytes >> 40);
+    ctx->buffer[59] = (u_char) (ctx->bytes >> 32);
+    ctx->buffer[60] = (u_char) (ctx->bytes >> 24);
+    ctx->buffer[61] = (u_char) (ctx->bytes >> 16);
+    ctx->buffer[62] = (u_char) (ctx->bytes >> 8);
+    ctx->buffer[63] = (u_char) ctx->bytes;
+
+    (void) ngx_sha256_body(ctx, ctx->buffer, 64);
+
+    for (i = 0; i < 8; i++) {
+        result[i * 4] = (u_char) (ctx->h[i] >> 24);
+        result[i * 4 + 1] = (u_char) (ctx->h[i] >> 16);
+        result[i * 4 + 2] = (u_char) (ctx->h[i] >> 8);
+        result[i * 4 + 3] = (u_char) ctx->h[i];
+    }
+
+    ngx_memzero(ctx, sizeof(*ctx));
+}
+
+
+void
+ngx_hmac_sha256_init(ngx_hmac_sha256_t *hmac, u_char *key, size_t len)
+{
+    u_char        pad[64], hkey[32];
+    ngx_uint_t    i;
+    ngx_sha256_t  sha256;
+
+    if (len > 64) {
+        ngx_sha256_init(&sha256);
+        ngx_sha256_update(&sha256, key, len);
+        ngx_sha256_final(hkey, &sha256);
+
+        key = hkey;
+        len = 32;
+    }
+
+    for (i = 0; i < 64; i++) {
+        pad[i] = (u_char) ((i < len ? key[i] : 0) ^ 0x36);
+    }
+
+    ngx_sha256_init(&hmac->inner);
+    ngx_sha256_update(&hmac->inner, pad, 64);
+
+    for (i = 0; i < 64; i++) {
+        pad[i] ^= 0x36 ^ 0x5c;
+    }
+
+    ngx_sha256_init(&hmac->outer);
+    ngx_sha256_update(&hmac->outer, pad, 64);
+
+    ngx_explicit_memzero(pad, 64);
+    ngx_explicit_memzero(hkey, 32);
+}
+
+
+void
+ngx_hmac_sha256(u_char result[32], ngx_hmac_sha256_t *hmac, u_char *data,
+    size_t len)
+{
+    ngx_sha256_t  sha256;
+
+    sha256 = hmac->inner;
+    ngx_sha256_update(&sha256, data, len);
+    ngx_sha256_final(result, &sha256);
+
+    sha256 = hmac->outer;
+    ngx_sha256_update(&sha256, result, 32);
+    ngx_sha256_final(result, &sha256);
+}
+
+
+/*
+ * Helper functions.
+ */
+
+#define ROTR(bits, word)  (((word) >> (bits)) | ((word) << (32 - (bits))))
+
+#define CH(e, f, g)   (((e) & (f)) ^ ((~(e)) & (g)))
+#define MAJ(a, b, c)  (((a) & (b)) ^ ((a) & (c)) ^ ((b) & (c)))
+
+#define BSIG0(a)  (ROTR(2, a) ^ ROTR(13, a) ^ ROTR(22, a))
+#define BSIG1(e)  (ROTR(6, e) ^ ROTR(11, e) ^ ROTR(25, e))
+#define SSIG0(w)  (ROTR(7, w) ^ ROTR(18, w) ^ ((w) >> 3))
+#define SSIG1(w)  (ROTR(17, w) ^ ROTR(19, w) ^ ((w) >> 10))
+
+
+/*
+ * GET() reads 4 input bytes in big-endian byte order and returns
+ * them as uint32_t.
+ */
+
+#define GET(n)                                                                \
+    ((uint32_t) p[n * 4 + 3] |                                                \
+    ((uint32_t) p[n * 4 + 2] << 8) |                                          \
+    ((uint32_t) p[n * 4 + 1] << 16) |                                         \
+    ((uint32_t) p[n * 4] << 24))
+
+
+static const uint32_t  ngx_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+/*
+ * This processes one or more 64-byte data blocks, but does not update
+ * the bit counters.  There are no alignment requirements.
+ */
+
+static const u_char *
+ngx_sha256_body(ngx_sha256_t *ctx, const u_char *data, size_t size)
+{
+    uint32_t       a, b, c, d, e, f, g, h, t1, t2;
+    uint32_t       words[64];
+    ngx_uint_t     i;
+    const u_char  *p;
+
+    p = data;
+
+    do {
+        for (i = 0; i < 16; i++) {
+            words[i] = GET(i);
+        }
+
+        for (i = 16; i < 64; i++) {
+            words[i] = SSIG1(words[i - 2]) + words[i - 7]
+                       + SSIG0(words[i - 15]) + words[i - 16];
+        }
+
+        a = ctx->h[0];
+        b = ctx->h[1];
+        c = ctx->h[2];
+        d = ctx->h[3];
+        e = ctx->h[4];
+        f = ctx->h[5];
+        g = ctx->h[6];
+        h = ctx->h[7];
+
+        for (i = 0; i < 64; i++) {
+            t1 = h + BSIG1(e) + CH(e, f, g) + ngx_sha256_k[i] + words[i];
+            t2 = BSIG0(a) + MAJ(a, b, c);
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        ctx->h[0] += a;
+        ctx->h[1] += b;
+        ctx->h[2] += c;
+        ctx->h[3] += d;
+        ctx->h[4] += e;
+        ctx->h[5] += f;
+        ctx->h[6] += g;
+        ctx->h[7] += h;
+
+        p += 64;
+
+    } while (size -= 64);
+
+    return p;
+}
@@ -0,0 +1,39 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_SHA256_H_INCLUDED_
+#define _NGX_SHA256_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+typedef struct {
+    uint64_t  bytes;
+    uint32_t  h[8];
+    u_char    buffer[64];
+} ngx_sha256_t;
+
+
+/* HMAC-SHA256 with the key already mixed into the inner and outer states */
+
+typedef struct {
+    ngx_sha256_t  inner;
+    ngx_sha256_t  outer;
+} ngx_hmac_sha256_t;
+
+
+void ngx_sha256_init(ngx_sha256_t *ctx);
+void ngx_sha256_update(ngx_sha256_t *ctx, const void *data, size_t size);
+void ngx_sha256_final(u_char result[32], ngx_sha256_t *ctx);
+
+void ngx_hmac_sha256_init(ngx_hmac_sha256_t *hmac, u_char *key, size_t len);
+void ngx_hmac_sha256(u_char result[32], ngx_hmac_sha256_t *hmac,
+    u_char *data, size_t len);
+
+
+#endif /* _NGX_SHA256_H_INCLUDED_ */
@@ -12,21 +12,44 @@
 #if (NGX_HAVE_ATOMIC_OPS)
 
 
+#define NGX_SHMTX_SPIN      2048
+#define NGX_SHMTX_SPIN_MIN  16
+
+
+static void ngx_shmtx_locked(ngx_shmtx_t *mtx, uint64_t start);
+static uint64_t ngx_shmtx_time(void);
 static void ngx_shmtx_wakeup(ngx_shmtx_t *mtx);
 
+#if (NGX_HAVE_FUTEX)
+static ngx_int_t ngx_shmtx_futex_wait(ngx_shmtx_t *mtx);
+static ngx_int_t ngx_shmtx_futex_post(ngx_shmtx_t *mtx);
+#endif
+
 
 ngx_int_t
 ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 {
     mtx->lock = &addr->lock;
+    mtx->adaptive = &addr->spin;
+    mtx->stat = &addr->stat;
 
     if (mtx->spin == (ngx_uint_t) -1) {
         return NGX_OK;
     }
 
-    mtx->spin = 2048;
+    mtx->spin = NGX_SHMTX_SPIN;
 
-#if (NGX_HAVE_POSIX_SEM)
+    if (*mtx->adaptive == 0) {
+        *mtx->adaptive = NGX_SHMTX_SPIN;
+    }
+
+#if (NGX_HAVE_FUTEX)
+
+    mtx->wait = &addr->wait;
+    mtx->futex = &addr->futex;
+    mtx->semaphore = 1;
+
+#elif (NGX_HAVE_POSIX_SEM)
 
     mtx->wait = &addr->wait;
 
@@ -46,7 +69,7 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 void
 ngx_shmtx_destroy(ngx_shmtx_t *mtx)
 {
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_POSIX_SEM && !NGX_HAVE_FUTEX)
 
     if (mtx->semaphore) {
         if (sem_destroy(&mtx->sem) == -1) {
@@ -62,52 +85,84 @@ ngx_shmtx_destroy(ngx_shmtx_t *mtx)
 ngx_uint_t
 ngx_shmtx_trylock(ngx_shmtx_t *mtx)
 {
-    return (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid));
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+        mtx->stat->acquired++;
+        return 1;
+    }
+
+    return 0;
 }
 
 
+/*
+ * the spin limit adapts to how long the lock is held: it drifts towards
+ * twice the spinning that was needed to get the lock, and shrinks if
+ * spinning did not help, so long critical sections go to sleep sooner
+ */
+
 void
 ngx_shmtx_lock(ngx_shmtx_t *mtx)
 {
-    ngx_uint_t         i, n;
+    uint64_t    start;
+    ngx_uint_t  i, n, spin, spun;
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx lock");
 
-    for ( ;; ) {
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+        mtx->stat->acquired++;
+        return;
+    }
 
-        if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
-            return;
-        }
+    start = ngx_shmtx_time();
+
+    for ( ;; ) {
 
         if (ngx_ncpu > 1) {
 
-            for (n = 1; n < mtx->spin; n <<= 1) {
+            spin = ngx_min(*mtx->adaptive, mtx->spin);
+            spun = 0;
+
+            for (n = 1; n < spin; n <<= 1) {
 
                 for (i = 0; i < n; i++) {
                     ngx_cpu_pause();
                 }
 
+                spun += n;
+
                 if (*mtx->lock == 0
                     && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid))
                 {
+                    *mtx->adaptive = ngx_min(spin - spin / 8 + spun / 4,
+                                             mtx->spin);
+                    ngx_shmtx_locked(mtx, start);
                     return;
                 }
             }
+
+            *mtx->adaptive = ngx_max(spin - spin / 8, NGX_SHMTX_SPIN_MIN);
         }
 
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX || NGX_HAVE_POSIX_SEM)
 
         if (mtx->semaphore) {
             (void) ngx_atomic_fetch_add(mtx->wait, 1);
 
             if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
                 (void) ngx_atomic_fetch_add(mtx->wait, -1);
+                ngx_shmtx_locked(mtx, start);
                 return;
             }
 
             ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
                            "shmtx wait %uA", *mtx->wait);
 
+#if (NGX_HAVE_FUTEX)
+
+            (void) ngx_shmtx_futex_wait(mtx);
+
+#else
+
             while (sem_wait(&mtx->sem) == -1) {
                 ngx_err_t  err;
 
@@ -120,19 +175,63 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
                 }
             }
 
+#endif
+
             ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
                            "shmtx awoke");
 
-            continue;
+        } else {
+            ngx_sched_yield();
         }
 
-#endif
+#else
 
         ngx_sched_yield();
+
+#endif
+
+        if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+            ngx_shmtx_locked(mtx, start);
+            return;
+        }
     }
 }
 
 
+static void
+ngx_shmtx_locked(ngx_shmtx_t *mtx, uint64_t start)
+{
+    ngx_shmtx_stat_t  *stat;
+
+    /* the counters are updated by the lock owner only */
+
+    stat = mtx->stat;
+
+    stat->acquired++;
+    stat->contended++;
+    stat->wait_time += ngx_shmtx_time() - start;
+}
+
+
+static uint64_t
+ngx_shmtx_time(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+
 void
 ngx_shmtx_unlock(ngx_shmtx_t *mtx)
 {
@@ -164,7 +263,7 @@ ngx_shmtx_force_unlock(ngx_shmtx_t *mtx, ngx_pid_t pid)
 static void
 ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
 {
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX || NGX_HAVE_POSIX_SEM)
     ngx_atomic_uint_t  wait;
 
     if (!mtx->semaphore) {
@@ -187,21 +286,101 @@ ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
     ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
                    "shmtx wake %uA", wait);
 
+#if (NGX_HAVE_FUTEX)
+
+    (void) ngx_shmtx_futex_post(mtx);
+
+#else
+
     if (sem_post(&mtx->sem) == -1) {
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
                       "sem_post() failed while wake shmtx");
     }
 
+#endif
+
 #endif
 }
 
 
+#if (NGX_HAVE_FUTEX)
+
+/*
+ * a counting semaphore in the shared memory, the futex operates
+ * on the low 32 bits of the counter
+ */
+
+#if (NGX_HAVE_LITTLE_ENDIAN)
+#define ngx_shmtx_futex_word(p)  ((uint32_t *) (p))
+#else
+#define ngx_shmtx_futex_word(p)                                               \
+    ((uint32_t *) (p) + sizeof(ngx_atomic_t) / sizeof(uint32_t) - 1)
+#endif
+
+
+static ngx_int_t
+ngx_shmtx_futex_wait(ngx_shmtx_t *mtx)
+{
+    ngx_err_t          err;
+    ngx_atomic_uint_t  n;
+
+    for ( ;; ) {
+
+        n = *mtx->futex;
+
+        if (n) {
+            if (ngx_atomic_cmp_set(mtx->futex, n, n - 1)) {
+                return NGX_OK;
+            }
+
+            continue;
+        }
+
+        if (syscall(SYS_futex, ngx_shmtx_futex_word(mtx->futex), FUTEX_WAIT,
+                    0, NULL, NULL, 0)
+            == -1)
+        {
+            err = ngx_errno;
+
+            if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                              "futex(FUTEX_WAIT) failed while waiting "
+                              "on shmtx");
+                return NGX_ERROR;
+            }
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_shmtx_futex_post(ngx_shmtx_t *mtx)
+{
+    (void) ngx_atomic_fetch_add(mtx->futex, 1);
+
+    if (syscall(SYS_futex, ngx_shmtx_futex_word(mtx->futex), FUTEX_WAKE,
+                1, NULL, NULL, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "futex(FUTEX_WAKE) failed while wake shmtx");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 #else
 
 
 ngx_int_t
 ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 {
+    mtx->stat = &addr->stat;
+
     if (mtx->name) {
 
         if (ngx_strcmp(name, mtx->name) == 0) {
@@ -250,6 +429,7 @@ ngx_shmtx_trylock(ngx_shmtx_t *mtx)
     err = ngx_trylock_fd(mtx->fd);
 
     if (err == 0) {
+        mtx->stat->acquired++;
         return 1;
     }
 
@@ -279,6 +459,7 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
     err = ngx_lock_fd(mtx->fd);
 
     if (err == 0) {
+        mtx->stat->acquired++;
         return;
     }
 
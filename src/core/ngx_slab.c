@@ -69,6 +69,37 @@
 
 #endif
 
+
+/*
+ * A magazine is a small per-process stack of free chunks of one size,
+ * kept busy in the pool bitmaps.  Chunks freed by a worker are pushed
+ * there and handed back to the next allocation of the same size without
+ * touching the page lists, and without the pool mutex when the unlocked
+ * interface is used.  The magazines are bounded to NGX_SLAB_MAGAZINE_BYTES
+ * per slot, are returned to the pool when an allocation fails and on
+ * worker exit; a crashed worker leaks its magazines until the zone is
+ * recreated.  Allocations made in thread pools go to the pool directly.
+ */
+
+#define NGX_SLAB_MAGAZINE_SLOTS  8
+#define NGX_SLAB_MAGAZINE_BYTES  1024
+#define NGX_SLAB_MAGAZINE_MAX    32
+
+
+typedef struct {
+    ngx_slab_pool_t  *pool;
+    void             *free[NGX_SLAB_MAGAZINE_SLOTS];
+    ngx_uint_t        number[NGX_SLAB_MAGAZINE_SLOTS];
+} ngx_slab_magazine_t;
+
+
+static void *ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_free_chunk(ngx_slab_pool_t *pool, void *p);
+static ngx_slab_magazine_t *ngx_slab_magazine(ngx_slab_pool_t *pool,
+    ngx_uint_t create);
+static void *ngx_slab_magazine_alloc(ngx_slab_pool_t *pool, size_t size);
+static ngx_int_t ngx_slab_magazine_free(ngx_slab_pool_t *pool, void *p);
+static ngx_uint_t ngx_slab_magazine_drain(ngx_slab_magazine_t *mag);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -81,6 +112,12 @@ static ngx_uint_t  ngx_slab_max_size;
 static ngx_uint_t  ngx_slab_exact_size;
 static ngx_uint_t  ngx_slab_exact_shift;
 
+static ngx_slab_magazine_t  *ngx_slab_magazines;
+static ngx_slab_magazine_t  *ngx_slab_magazine_last;
+static ngx_uint_t            ngx_slab_nmagazines;
+static ngx_uint_t            ngx_slab_magazines_size;
+static ngx_uint_t            ngx_slab_magazines_off;
+
 
 void
 ngx_slab_sizes_init(void)
@@ -204,6 +241,7 @@ ngx_slab_init(ngx_slab_pool_t *pool)
      * NOTE: 这个 log_ctx 是用来
      */
     pool->log_nomem = 1;
+    pool->magazine = 0;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
 }
@@ -214,6 +252,13 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
     void  *p;
 
+    if (pool->magazine) {
+        p = ngx_slab_magazine_alloc(pool, size);
+        if (p) {
+            return p;
+        }
+    }
+
     ngx_shmtx_lock(&pool->mutex);
 
     p = ngx_slab_alloc_locked(pool, size);
@@ -226,6 +271,38 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+    void                 *p;
+    ngx_slab_magazine_t  *mag;
+
+    if (!pool->magazine) {
+        return ngx_slab_alloc_chunk(pool, size);
+    }
+
+    p = ngx_slab_magazine_alloc(pool, size);
+    if (p) {
+        return p;
+    }
+
+    p = ngx_slab_alloc_chunk(pool, size);
+
+    if (p == NULL) {
+
+        /* give the chunks cached by this process back and retry */
+
+        mag = ngx_slab_magazine(pool, 0);
+
+        if (mag && ngx_slab_magazine_drain(mag)) {
+            p = ngx_slab_alloc_chunk(pool, size);
+        }
+    }
+
+    return p;
+}
+
+
+static void *
+ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size)
 {
     size_t            s;
     uintptr_t         p, m, mask, *bitmap;
@@ -626,6 +703,10 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+    if (pool->magazine && ngx_slab_magazine_free(pool, p) == NGX_OK) {
+        return;
+    }
+
     ngx_shmtx_lock(&pool->mutex);
 
     ngx_slab_free_locked(pool, p);
@@ -636,6 +717,17 @@ ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 
 void
 ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+    if (pool->magazine && ngx_slab_magazine_free(pool, p) == NGX_OK) {
+        return;
+    }
+
+    ngx_slab_free_chunk(pool, p);
+}
+
+
+static void
+ngx_slab_free_chunk(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
@@ -953,6 +1045,261 @@ fail:
 }
 
 
+void
+ngx_slab_magazines_done(ngx_log_t *log)
+{
+    ngx_uint_t            i, n;
+    ngx_slab_magazine_t  *mag;
+
+    /* chunks freed from now on go directly to the pools */
+
+    ngx_slab_magazines_off = 1;
+
+    n = 0;
+
+    for (i = 0; i < ngx_slab_nmagazines; i++) {
+        mag = &ngx_slab_magazines[i];
+
+        ngx_shmtx_lock(&mag->pool->mutex);
+
+        n += ngx_slab_magazine_drain(mag);
+
+        ngx_shmtx_unlock(&mag->pool->mutex);
+    }
+
+    if (ngx_slab_nmagazines) {
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, log, 0,
+                       "slab magazines: %ui chunks returned", n);
+
+        ngx_free(ngx_slab_magazines);
+    }
+
+    ngx_slab_magazines = NULL;
+    ngx_slab_magazine_last = NULL;
+    ngx_slab_nmagazines = 0;
+    ngx_slab_magazines_size = 0;
+}
+
+
+static ngx_slab_magazine_t *
+ngx_slab_magazine(ngx_slab_pool_t *pool, ngx_uint_t create)
+{
+    ngx_uint_t            i, n;
+    ngx_slab_magazine_t  *mag;
+
+    /*
+     * magazines are process-local, and only workers use them: they
+     * never outlive the zones mapped at the time they were started;
+     * they are not locked, so zones used from thread pools, such as
+     * by "cache_manager threads", bypass them there
+     */
+
+    if (!ngx_thread_is_main()) {
+        return NULL;
+    }
+
+    mag = ngx_slab_magazine_last;
+
+    if (mag && mag->pool == pool) {
+        return mag;
+    }
+
+    if (ngx_process != NGX_PROCESS_WORKER || ngx_slab_magazines_off) {
+        return NULL;
+    }
+
+    for (i = 0; i < ngx_slab_nmagazines; i++) {
+        if (ngx_slab_magazines[i].pool == pool) {
+            ngx_slab_magazine_last = &ngx_slab_magazines[i];
+            return ngx_slab_magazine_last;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    if (ngx_slab_nmagazines == ngx_slab_magazines_size) {
+        n = ngx_slab_magazines_size ? 2 * ngx_slab_magazines_size : 8;
+
+        mag = ngx_alloc(n * sizeof(ngx_slab_magazine_t), ngx_cycle->log);
+        if (mag == NULL) {
+            return NULL;
+        }
+
+        if (ngx_slab_nmagazines) {
+            ngx_memcpy(mag, ngx_slab_magazines,
+                       ngx_slab_nmagazines * sizeof(ngx_slab_magazine_t));
+            ngx_free(ngx_slab_magazines);
+        }
+
+        ngx_slab_magazines = mag;
+        ngx_slab_magazines_size = n;
+    }
+
+    mag = &ngx_slab_magazines[ngx_slab_nmagazines++];
+
+    ngx_memzero(mag, sizeof(ngx_slab_magazine_t));
+    mag->pool = pool;
+
+    ngx_slab_magazine_last = mag;
+
+    return mag;
+}
+
+
+static void *
+ngx_slab_magazine_alloc(ngx_slab_pool_t *pool, size_t size)
+{
+    void                 *p;
+    size_t                s;
+    ngx_uint_t            slot, shift;
+    ngx_slab_magazine_t  *mag;
+
+    if (size > (pool->min_size << (NGX_SLAB_MAGAZINE_SLOTS - 1))) {
+        return NULL;
+    }
+
+    if (size > pool->min_size) {
+        shift = 1;
+        for (s = size - 1; s >>= 1; shift++) { /* void */ }
+        slot = shift - pool->min_shift;
+
+    } else {
+        slot = 0;
+    }
+
+    mag = ngx_slab_magazine(pool, 0);
+
+    if (mag == NULL || mag->free[slot] == NULL) {
+        return NULL;
+    }
+
+    p = mag->free[slot];
+    mag->free[slot] = *(void **) p;
+    mag->number[slot]--;
+
+    (void) ngx_atomic_fetch_add(&pool->stats[slot].cached, -1);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab magazine alloc: %uz %p", size, p);
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_slab_magazine_free(ngx_slab_pool_t *pool, void *p)
+{
+    size_t                size;
+    ngx_uint_t            slot, shift, max;
+    ngx_slab_page_t      *page;
+    ngx_slab_magazine_t  *mag;
+#if (NGX_DEBUG)
+    void                 *c;
+#endif
+
+    if ((u_char *) p < pool->start || (u_char *) p >= pool->end) {
+        return NGX_DECLINED;
+    }
+
+    /* the page type cannot change while the chunk is busy */
+
+    page = &pool->pages[((u_char *) p - pool->start) >> ngx_pagesize_shift];
+
+    switch (ngx_slab_page_type(page)) {
+
+    case NGX_SLAB_SMALL:
+    case NGX_SLAB_BIG:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        return NGX_DECLINED;
+    }
+
+    slot = shift - pool->min_shift;
+    size = (size_t) 1 << shift;
+
+    if (slot >= NGX_SLAB_MAGAZINE_SLOTS || ((uintptr_t) p & (size - 1))) {
+        return NGX_DECLINED;
+    }
+
+    max = NGX_SLAB_MAGAZINE_BYTES >> shift;
+
+    if (max > NGX_SLAB_MAGAZINE_MAX) {
+        max = NGX_SLAB_MAGAZINE_MAX;
+    }
+
+    mag = ngx_slab_magazine(pool, 1);
+
+    if (mag == NULL || mag->number[slot] >= max) {
+        return NGX_DECLINED;
+    }
+
+#if (NGX_DEBUG)
+
+    for (c = mag->free[slot]; c; c = *(void **) c) {
+        if (c == p) {
+            ngx_slab_error(pool, NGX_LOG_ALERT,
+                           "ngx_slab_free(): chunk is already free");
+            return NGX_OK;
+        }
+    }
+
+#endif
+
+    ngx_slab_junk(p, size);
+
+    *(void **) p = mag->free[slot];
+    mag->free[slot] = p;
+    mag->number[slot]++;
+
+    (void) ngx_atomic_fetch_add(&pool->stats[slot].cached, 1);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab magazine free: %p", p);
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_slab_magazine_drain(ngx_slab_magazine_t *mag)
+{
+    void        *p;
+    ngx_uint_t   i, n;
+
+    n = 0;
+
+    for (i = 0; i < NGX_SLAB_MAGAZINE_SLOTS; i++) {
+
+        if (mag->number[i] == 0) {
+            continue;
+        }
+
+        (void) ngx_atomic_fetch_add(&mag->pool->stats[i].cached,
+                                    - (ngx_atomic_int_t) mag->number[i]);
+
+        while (mag->free[i]) {
+            p = mag->free[i];
+            mag->free[i] = *(void **) p;
+
+            ngx_slab_free_chunk(mag->pool, p);
+            n++;
+        }
+
+        mag->number[i] = 0;
+    }
+
+    return n;
+}
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
@@ -28,6 +28,9 @@ typedef struct {
 
     ngx_uint_t        reqs;
     ngx_uint_t        fails;
+
+    /* chunks held in worker magazines, counted as used */
+    ngx_atomic_t      cached;
 } ngx_slab_stat_t;
 
 
@@ -53,6 +56,7 @@ typedef struct {
     u_char            zero;
 
     unsigned          log_nomem:1;
+    unsigned          magazine:1;
 
     void             *data;
     void             *addr;
@@ -67,6 +71,7 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_magazines_done(ngx_log_t *log);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
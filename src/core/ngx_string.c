@@ -8,18 +8,63 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+#if (NGX_HAVE_SSSE3)
+#include <tmmintrin.h>
+#endif
+
 
 static u_char *ngx_sprintf_num(u_char *buf, u_char *last, uint64_t ui64,
     u_char zero, ngx_uint_t hexadecimal, ngx_uint_t width);
 static void ngx_encode_base64_internal(ngx_str_t *dst, ngx_str_t *src,
     const u_char *basis, ngx_uint_t padding);
 static ngx_int_t ngx_decode_base64_internal(ngx_str_t *dst, ngx_str_t *src,
-    const u_char *basis);
+    const u_char *basis, u_char c62, u_char c63);
+
+#if (NGX_HAVE_SSSE3)
+static size_t ngx_encode_base64_ssse3(u_char *dst, u_char *src, size_t len,
+    u_char c62, u_char c63);
+static size_t ngx_decode_base64_ssse3(u_char *dst, u_char *src, size_t len,
+    u_char c62, u_char c63);
+#endif
+
+#if (NGX_HAVE_SSE2 || NGX_HAVE_NEON)
+
+#define NGX_STRING_SIMD  1
+
+/*
+ * the 16-byte loads are only used within a known length; strings passed
+ * to ngx_strncasecmp() may still end with NUL before it, so the loads must
+ * not cross a page, 4096 is the smallest page size of the supported
+ * platforms
+ */
+
+#define ngx_str_simd_safe(p)                                                  \
+    (((uintptr_t) (p) & 4095) <= 4096 - 16)
+
+static ngx_inline void ngx_str_lower16(u_char *dst, u_char *src);
+static ngx_inline ngx_uint_t ngx_str_casecmp16(u_char *s1, u_char *s2);
+static ngx_inline u_char *ngx_str_skip_plain(u_char *dst, u_char *p,
+    u_char *last, u_char c1, u_char c2);
+static ngx_inline u_char *ngx_str_skip_to(u_char *dst, u_char *p,
+    u_char *last, u_char c1, u_char c2, u_char c3, u_char c4);
+
+#endif
 
 
 void
 ngx_strlow(u_char *dst, u_char *src, size_t n)
 {
+#if (NGX_STRING_SIMD)
+
+    while (n >= 16) {
+        ngx_str_lower16(dst, src);
+        dst += 16;
+        src += 16;
+        n -= 16;
+    }
+
+#endif
+
     while (n) {
         *dst = ngx_tolower(*src);
         dst++;
@@ -614,6 +659,24 @@ ngx_strncasecmp(u_char *s1, u_char *s2, size_t n)
 {
     ngx_uint_t  c1, c2;
 
+#if (NGX_STRING_SIMD)
+
+    ngx_uint_t  i;
+
+    while (n >= 16 && ngx_str_simd_safe(s1) && ngx_str_simd_safe(s2)) {
+        i = ngx_str_casecmp16(s1, s2);
+
+        s1 += i;
+        s2 += i;
+        n -= i;
+
+        if (i < 16) {
+            break;
+        }
+    }
+
+#endif
+
     while (n) {
         c1 = (ngx_uint_t) *s1++;
         c2 = (ngx_uint_t) *s2++;
@@ -1164,11 +1227,26 @@ ngx_encode_base64_internal(ngx_str_t *dst, ngx_str_t *src, const u_char *basis,
 {
     u_char         *d, *s;
     size_t          len;
+#if (NGX_HAVE_SSSE3)
+    size_t          n;
+#endif
 
     len = src->len;
     s = src->data;
     d = dst->data;
 
+#if (NGX_HAVE_SSSE3)
+
+    if (ngx_cpu_features & NGX_CPU_SSSE3) {
+        n = ngx_encode_base64_ssse3(d, s, len, basis[62], basis[63]);
+
+        s += n;
+        d += n / 3 * 4;
+        len -= n;
+    }
+
+#endif
+
     while (len > 2) {
         *d++ = basis[(s[0] >> 2) & 0x3f];
         *d++ = basis[((s[0] & 3) << 4) | (s[1] >> 4)];
@@ -1225,7 +1303,7 @@ ngx_decode_base64(ngx_str_t *dst, ngx_str_t *src)
         77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77
     };
 
-    return ngx_decode_base64_internal(dst, src, basis64);
+    return ngx_decode_base64_internal(dst, src, basis64, '+', '/');
 }
 
 
@@ -1252,22 +1330,41 @@ ngx_decode_base64url(ngx_str_t *dst, ngx_str_t *src)
         77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77
     };
 
-    return ngx_decode_base64_internal(dst, src, basis64);
+    return ngx_decode_base64_internal(dst, src, basis64, '-', '_');
 }
 
 
 static ngx_int_t
-ngx_decode_base64_internal(ngx_str_t *dst, ngx_str_t *src, const u_char *basis)
+ngx_decode_base64_internal(ngx_str_t *dst, ngx_str_t *src, const u_char *basis,
+    u_char c62, u_char c63)
 {
-    size_t          len;
+    size_t          len, n;
     u_char         *d, *s;
 
-    for (len = 0; len < src->len; len++) {
-        if (src->data[len] == '=') {
+    s = src->data;
+    d = dst->data;
+    n = src->len;
+
+#if (NGX_HAVE_SSSE3)
+
+    /* the valid blocks before the padding or an invalid character */
+
+    if (ngx_cpu_features & NGX_CPU_SSSE3) {
+        len = ngx_decode_base64_ssse3(d, s, n, c62, c63);
+
+        s += len;
+        d += len / 4 * 3;
+        n -= len;
+    }
+
+#endif
+
+    for (len = 0; len < n; len++) {
+        if (s[len] == '=') {
             break;
         }
 
-        if (basis[src->data[len]] == 77) {
+        if (basis[s[len]] == 77) {
             return NGX_ERROR;
         }
     }
@@ -1276,9 +1373,6 @@ ngx_decode_base64_internal(ngx_str_t *dst, ngx_str_t *src, const u_char *basis)
         return NGX_ERROR;
     }
 
-    s = src->data;
-    d = dst->data;
-
     while (len > 3) {
         *d++ = (u_char) (basis[s[0]] << 2 | basis[s[1]] >> 4);
         *d++ = (u_char) (basis[s[1]] << 4 | basis[s[2]] >> 2);
@@ -1447,6 +1541,9 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
     ngx_uint_t      n;
     uint32_t       *escape;
     static u_char   hex[] = "0123456789ABCDEF";
+#if (NGX_STRING_SIMD)
+    u_char         *p, c1, c2;
+#endif
 
                     /* " ", "#", "%", "?", %00-%1F, %7F-%FF */
 
@@ -1576,6 +1673,15 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
 
     escape = map[type];
 
+#if (NGX_STRING_SIMD)
+
+    /* "/" and "=" are also skipped with the types that do not escape them */
+
+    c1 = (escape['/' >> 5] & (1U << ('/' & 0x1f))) ? '_' : '/';
+    c2 = (escape['=' >> 5] & (1U << ('=' & 0x1f))) ? '_' : '=';
+
+#endif
+
     if (dst == NULL) {
 
         /* find the number of the characters to be escaped */
@@ -1583,6 +1689,19 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
         n = 0;
 
         while (size) {
+
+#if (NGX_STRING_SIMD)
+            if (size >= 16) {
+                p = ngx_str_skip_plain(NULL, src, src + size, c1, c2);
+                size -= p - src;
+                src = p;
+
+                if (size == 0) {
+                    break;
+                }
+            }
+#endif
+
             if (escape[*src >> 5] & (1U << (*src & 0x1f))) {
                 n++;
             }
@@ -1594,6 +1713,20 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
     }
 
     while (size) {
+
+#if (NGX_STRING_SIMD)
+        if (size >= 16) {
+            p = ngx_str_skip_plain(dst, src, src + size, c1, c2);
+            dst += p - src;
+            size -= p - src;
+            src = p;
+
+            if (size == 0) {
+                break;
+            }
+        }
+#endif
+
         if (escape[*src >> 5] & (1U << (*src & 0x1f))) {
             *dst++ = '%';
             *dst++ = hex[*src >> 4];
@@ -1614,6 +1747,9 @@ void
 ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type)
 {
     u_char  *d, *s, ch, c, decoded;
+#if (NGX_STRING_SIMD)
+    u_char  *p, q;
+#endif
     enum {
         sw_usual = 0,
         sw_quoted,
@@ -1626,8 +1762,33 @@ ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type)
     state = 0;
     decoded = 0;
 
-    while (size--) {
+#if (NGX_STRING_SIMD)
+    q = (type & (NGX_UNESCAPE_URI|NGX_UNESCAPE_REDIRECT)) ? '?' : '%';
+#endif
+
+    while (size) {
+
+#if (NGX_STRING_SIMD)
+        if (state == sw_usual && size >= 16) {
+            p = ngx_str_skip_to(NULL, s, s + size, '%', q, '%', '%');
+
+            /* d may be equal to s, but never exceeds it */
+
+            if (d != s) {
+                ngx_memmove(d, s, p - s);
+            }
+
+            d += p - s;
+            size -= p - s;
+            s = p;
+
+            if (size == 0) {
+                break;
+            }
+        }
+#endif
 
+        size--;
         ch = *s++;
 
         switch (state) {
@@ -1745,12 +1906,29 @@ ngx_escape_html(u_char *dst, u_char *src, size_t size)
 {
     u_char      ch;
     ngx_uint_t  len;
+#if (NGX_STRING_SIMD)
+    u_char     *p;
+#endif
 
     if (dst == NULL) {
 
         len = 0;
 
         while (size) {
+
+#if (NGX_STRING_SIMD)
+            if (size >= 16) {
+                p = ngx_str_skip_to(NULL, src, src + size,
+                                    '<', '>', '&', '"');
+                size -= p - src;
+                src = p;
+
+                if (size == 0) {
+                    break;
+                }
+            }
+#endif
+
             switch (*src++) {
 
             case '<':
@@ -1779,6 +1957,20 @@ ngx_escape_html(u_char *dst, u_char *src, size_t size)
     }
 
     while (size) {
+
+#if (NGX_STRING_SIMD)
+        if (size >= 16) {
+            p = ngx_str_skip_to(dst, src, src + size, '<', '>', '&', '"');
+            dst += p - src;
+            size -= p - src;
+            src = p;
+
+            if (size == 0) {
+                break;
+            }
+        }
+#endif
+
         ch = *src++;
 
         switch (ch) {
@@ -2043,3 +2235,381 @@ ngx_memcpy(void *dst, const void *src, size_t n)
 }
 
 #endif
+
+
+#if (NGX_STRING_SIMD)
+
+/*
+ * SSE2 and NEON are part of the amd64 and aarch64 baselines, so they are
+ * selected at compile time; the helpers process 16 bytes at a time
+ */
+
+#if (NGX_HAVE_SSE2)
+
+#define ngx_str_simd_range(v, lo, hi)                                         \
+    _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(v, _mm_set1_epi8(lo)),           \
+                                _mm_set1_epi8((hi) - (lo))),                  \
+                   _mm_sub_epi8(v, _mm_set1_epi8(lo)))
+
+#define ngx_str_simd_lower(v)                                                 \
+    _mm_or_si128(v, _mm_and_si128(ngx_str_simd_range(v, 'A', 'Z'),            \
+                                  _mm_set1_epi8(0x20)))
+
+#else /* NGX_HAVE_NEON */
+
+#define ngx_str_simd_range(v, lo, hi)                                         \
+    vcleq_u8(vsubq_u8(v, vdupq_n_u8(lo)), vdupq_n_u8((hi) - (lo)))
+
+#define ngx_str_simd_lower(v)                                                 \
+    vorrq_u8(v, vandq_u8(ngx_str_simd_range(v, 'A', 'Z'), vdupq_n_u8(0x20)))
+
+/* 4 bits of the mask per byte */
+
+#define ngx_str_simd_mask(v)                                                  \
+    vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v),    \
+                                                  4)), 0)
+
+#endif
+
+
+static ngx_inline void
+ngx_str_lower16(u_char *dst, u_char *src)
+{
+#if (NGX_HAVE_SSE2)
+
+    __m128i  v;
+
+    v = _mm_loadu_si128((__m128i *) src);
+    _mm_storeu_si128((__m128i *) dst, ngx_str_simd_lower(v));
+
+#else /* NGX_HAVE_NEON */
+
+    uint8x16_t  v;
+
+    v = vld1q_u8(src);
+    vst1q_u8(dst, ngx_str_simd_lower(v));
+
+#endif
+}
+
+
+/* returns the offset of the first differing or NUL byte, or 16 */
+
+static ngx_inline ngx_uint_t
+ngx_str_casecmp16(u_char *s1, u_char *s2)
+{
+#if (NGX_HAVE_SSE2)
+
+    int      mask;
+    __m128i  v1, v2;
+
+    v1 = _mm_loadu_si128((__m128i *) s1);
+    v2 = _mm_loadu_si128((__m128i *) s2);
+
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(ngx_str_simd_lower(v1),
+                                            ngx_str_simd_lower(v2)))
+           ^ 0xffff;
+
+    mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(v1, _mm_setzero_si128()));
+
+    return mask ? (ngx_uint_t) __builtin_ctz(mask) : 16;
+
+#else /* NGX_HAVE_NEON */
+
+    uint64_t    mask;
+    uint8x16_t  v1, v2, stop;
+
+    v1 = vld1q_u8(s1);
+    v2 = vld1q_u8(s2);
+
+    stop = vorrq_u8(vmvnq_u8(vceqq_u8(ngx_str_simd_lower(v1),
+                                      ngx_str_simd_lower(v2))),
+                    vceqq_u8(v1, vdupq_n_u8(0)));
+
+    mask = ngx_str_simd_mask(stop);
+
+    return mask ? (ngx_uint_t) (__builtin_ctzll(mask) >> 2) : 16;
+
+#endif
+}
+
+
+/*
+ * the skip functions return a pointer to the first byte of interest or
+ * to one of the last less than 16 bytes; if dst is not NULL, the skipped
+ * bytes are copied there, and the whole 16-byte blocks are stored, so
+ * there must be at least last - p bytes in dst, and it must not overlap
+ * the source
+ */
+
+/*
+ * letters, digits, "-", ".", and "_" are not escaped by any of
+ * the ngx_escape_uri() types, c1 and c2 are the additional characters
+ * not escaped by the given type
+ */
+
+static ngx_inline u_char *
+ngx_str_skip_plain(u_char *dst, u_char *p, u_char *last, u_char c1,
+    u_char c2)
+{
+#if (NGX_HAVE_SSE2)
+
+    int      mask;
+    __m128i  v, plain;
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        plain = _mm_or_si128(
+                    ngx_str_simd_range(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                                       'a', 'z'),
+                    ngx_str_simd_range(v, '-', '.'));
+
+        plain = _mm_or_si128(plain,
+                    _mm_or_si128(ngx_str_simd_range(v, '0', '9'),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))));
+
+        plain = _mm_or_si128(plain,
+                             _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(c1)),
+                                          _mm_cmpeq_epi8(v, _mm_set1_epi8(c2))));
+
+        mask = _mm_movemask_epi8(plain) ^ 0xffff;
+
+        if (dst) {
+            _mm_storeu_si128((__m128i *) dst, v);
+            dst += 16;
+        }
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+#else /* NGX_HAVE_NEON */
+
+    uint64_t    mask;
+    uint8x16_t  v, plain;
+
+    while (last - p >= 16) {
+        v = vld1q_u8(p);
+
+        plain = vorrq_u8(ngx_str_simd_range(vorrq_u8(v, vdupq_n_u8(0x20)),
+                                            'a', 'z'),
+                         ngx_str_simd_range(v, '-', '.'));
+
+        plain = vorrq_u8(plain, vorrq_u8(ngx_str_simd_range(v, '0', '9'),
+                                         vceqq_u8(v, vdupq_n_u8('_'))));
+
+        plain = vorrq_u8(plain, vorrq_u8(vceqq_u8(v, vdupq_n_u8(c1)),
+                                         vceqq_u8(v, vdupq_n_u8(c2))));
+
+        mask = ngx_str_simd_mask(vmvnq_u8(plain));
+
+        if (dst) {
+            vst1q_u8(dst, v);
+            dst += 16;
+        }
+
+        if (mask) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+
+        p += 16;
+    }
+
+#endif
+
+    return p;
+}
+
+
+static ngx_inline u_char *
+ngx_str_skip_to(u_char *dst, u_char *p, u_char *last, u_char c1, u_char c2,
+    u_char c3, u_char c4)
+{
+#if (NGX_HAVE_SSE2)
+
+    int      mask;
+    __m128i  v, stop;
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        stop = _mm_or_si128(
+                   _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(c1)),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8(c2))),
+                   _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(c3)),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8(c4))));
+
+        mask = _mm_movemask_epi8(stop);
+
+        if (dst) {
+            _mm_storeu_si128((__m128i *) dst, v);
+            dst += 16;
+        }
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+#else /* NGX_HAVE_NEON */
+
+    uint64_t    mask;
+    uint8x16_t  v, stop;
+
+    while (last - p >= 16) {
+        v = vld1q_u8(p);
+
+        stop = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(c1)),
+                                 vceqq_u8(v, vdupq_n_u8(c2))),
+                        vorrq_u8(vceqq_u8(v, vdupq_n_u8(c3)),
+                                 vceqq_u8(v, vdupq_n_u8(c4))));
+
+        mask = ngx_str_simd_mask(stop);
+
+        if (dst) {
+            vst1q_u8(dst, v);
+            dst += 16;
+        }
+
+        if (mask) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+
+        p += 16;
+    }
+
+#endif
+
+    return p;
+}
+
+
+
+#if (NGX_HAVE_SSSE3)
+
+/*
+ * SSSE3 is not part of the amd64 baseline, so the base64 kernels are
+ * selected at run time by ngx_cpu_features; they follow W. Mula and
+ * D. Lemire, "Faster Base64 Encoding and Decoding Using AVX2 Instructions",
+ * and return the number of source bytes processed, the rest is left
+ * to the table code
+ */
+
+__attribute__((target("ssse3")))
+static size_t
+ngx_encode_base64_ssse3(u_char *dst, u_char *src, size_t len, u_char c62,
+    u_char c63)
+{
+    size_t   n;
+    __m128i  v, hi, lo, index, shift;
+
+    /* the offsets to the characters of each range of the 6-bit values */
+
+    shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                          '0' - 52, (char) (c62 - 62), (char) (c63 - 63),
+                          'A', 0, 0);
+
+    /* 12 bytes are encoded into 16 characters, 16 bytes are loaded */
+
+    for (n = 0; len - n >= 16; n += 12) {
+        v = _mm_loadu_si128((__m128i *) (src + n));
+
+        v = _mm_shuffle_epi8(v, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                              7, 6, 8, 7, 10, 9, 11, 10));
+
+        /* the 6-bit values are shifted in place by multiplications */
+
+        hi = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+        hi = _mm_mulhi_epu16(hi, _mm_set1_epi32(0x04000040));
+
+        lo = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+        lo = _mm_mullo_epi16(lo, _mm_set1_epi32(0x01000010));
+
+        index = _mm_or_si128(hi, lo);
+
+        /* 0 for 26..51, 1..12 for 52..63, and 13 for 0..25 */
+
+        v = _mm_cmpgt_epi8(_mm_set1_epi8(26), index);
+        v = _mm_or_si128(_mm_subs_epu8(index, _mm_set1_epi8(51)),
+                         _mm_and_si128(v, _mm_set1_epi8(13)));
+
+        v = _mm_add_epi8(index, _mm_shuffle_epi8(shift, v));
+
+        _mm_storeu_si128((__m128i *) dst, v);
+        dst += 16;
+    }
+
+    return n;
+}
+
+
+/*
+ * 16 characters are decoded into 12 bytes, 16 bytes are stored, so
+ * the blocks are only decoded if at least 24 characters are left:
+ * nothing is written past the end of the data decoded by the table code
+ * from the same number of valid characters
+ */
+
+__attribute__((target("ssse3")))
+static size_t
+ngx_decode_base64_ssse3(u_char *dst, u_char *src, size_t len, u_char c62,
+    u_char c63)
+{
+    size_t   n;
+    __m128i  v, upper, lower, digit, e62, e63, valid, shift;
+
+    for (n = 0; len - n >= 24; n += 16) {
+        v = _mm_loadu_si128((__m128i *) (src + n));
+
+        upper = ngx_str_simd_range(v, 'A', 'Z');
+        lower = ngx_str_simd_range(v, 'a', 'z');
+        digit = ngx_str_simd_range(v, '0', '9');
+        e62 = _mm_cmpeq_epi8(v, _mm_set1_epi8(c62));
+        e63 = _mm_cmpeq_epi8(v, _mm_set1_epi8(c63));
+
+        valid = _mm_or_si128(_mm_or_si128(upper, lower), digit);
+        valid = _mm_or_si128(valid, _mm_or_si128(e62, e63));
+
+        if (_mm_movemask_epi8(valid) != 0xffff) {
+            break;
+        }
+
+        /* the offsets from the characters to the 6-bit values */
+
+        shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+        shift = _mm_or_si128(shift,
+                             _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+        shift = _mm_or_si128(shift,
+                             _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+        shift = _mm_or_si128(shift,
+                             _mm_and_si128(e62, _mm_set1_epi8(62 - c62)));
+        shift = _mm_or_si128(shift,
+                             _mm_and_si128(e63, _mm_set1_epi8(63 - c63)));
+
+        v = _mm_add_epi8(v, shift);
+
+        /* the 6-bit values are merged into 24-bit big-endian groups */
+
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+
+        v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                              14, 13, 12, -1, -1, -1, -1));
+
+        _mm_storeu_si128((__m128i *) dst, v);
+        dst += 12;
+    }
+
+    return n;
+}
+
+#endif
+
+#endif
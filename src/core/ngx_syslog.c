@@ -9,12 +9,6 @@
 #include <ngx_event.h>
 
 
-#define NGX_SYSLOG_MAX_STR                                                    \
-    NGX_MAX_ERROR_STR + sizeof("<255>Jan 01 00:00:00 ") - 1                   \
-    + (NGX_MAXHOSTNAMELEN - 1) + 1 /* space */                                \
-    + 32 /* tag */ + 2 /* colon, space */
-
-
 static char *ngx_syslog_parse_args(ngx_conf_t *cf, ngx_syslog_peer_t *peer);
 static ngx_int_t ngx_syslog_init_peer(ngx_syslog_peer_t *peer);
 static void ngx_syslog_cleanup(void *data);
@@ -252,7 +246,6 @@ ngx_syslog_writer(ngx_log_t *log, ngx_uint_t level, u_char *buf,
     size_t len)
 {
     u_char             *p, msg[NGX_SYSLOG_MAX_STR];
-    ngx_uint_t          head_len;
     ngx_syslog_peer_t  *peer;
 
     peer = log->wdata;
@@ -262,6 +255,22 @@ ngx_syslog_writer(ngx_log_t *log, ngx_uint_t level, u_char *buf,
     }
 
     peer->busy = 1;
+
+    p = ngx_syslog_add_message(peer, level, msg, buf, len);
+
+    (void) ngx_syslog_send(peer, msg, p - msg);
+
+    peer->busy = 0;
+}
+
+
+u_char *
+ngx_syslog_add_message(ngx_syslog_peer_t *peer, ngx_uint_t level, u_char *msg,
+    u_char *buf, size_t len)
+{
+    u_char      *p;
+    ngx_uint_t   head_len;
+
     peer->severity = level - 1;
 
     p = ngx_syslog_add_header(peer, msg);
@@ -273,11 +282,7 @@ ngx_syslog_writer(ngx_log_t *log, ngx_uint_t level, u_char *buf,
         len = NGX_SYSLOG_MAX_STR - head_len;
     }
 
-    p = ngx_snprintf(p, len, "%s", buf);
-
-    (void) ngx_syslog_send(peer, msg, p - msg);
-
-    peer->busy = 0;
+    return ngx_snprintf(p, len, "%s", buf);
 }
 
 
@@ -317,6 +322,90 @@ ngx_syslog_send(ngx_syslog_peer_t *peer, u_char *buf, size_t len)
 }
 
 
+ngx_int_t
+ngx_syslog_send_batch(ngx_syslog_peer_t *peer, ngx_str_t *msgs, ngx_uint_t n)
+{
+    ngx_uint_t       i;
+#if (NGX_HAVE_SENDMMSG)
+    int              rc;
+    ngx_err_t        err;
+    struct iovec     iovs[NGX_SYSLOG_BATCH];
+    struct mmsghdr   mmsgs[NGX_SYSLOG_BATCH];
+#endif
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+#if (NGX_HAVE_SENDMMSG)
+
+    if (peer->conn.fd == (ngx_socket_t) -1) {
+        if (ngx_syslog_init_peer(peer) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    peer->conn.log = ngx_cycle->log;
+
+    ngx_memzero(mmsgs, n * sizeof(struct mmsghdr));
+
+    for (i = 0; i < n; i++) {
+        iovs[i].iov_base = msgs[i].data;
+        iovs[i].iov_len = msgs[i].len;
+
+        mmsgs[i].msg_hdr.msg_iov = &iovs[i];
+        mmsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    for (i = 0; i < n; /* void */) {
+
+        rc = sendmmsg(peer->conn.fd, &mmsgs[i], n - i, 0);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "syslog sendmmsg: fd:%d %d of %ui",
+                       peer->conn.fd, rc, n - i);
+
+        if (rc > 0) {
+            i += rc;
+            continue;
+        }
+
+        err = ngx_socket_errno;
+
+        if (rc == -1 && err == NGX_EINTR) {
+            continue;
+        }
+
+        if (rc == -1 && err == NGX_EAGAIN) {
+            return NGX_AGAIN;
+        }
+
+        (void) ngx_connection_error(&peer->conn, err, "sendmmsg() failed");
+
+        if (ngx_close_socket(peer->conn.fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        peer->conn.fd = (ngx_socket_t) -1;
+
+        return NGX_ERROR;
+    }
+
+#else
+
+    for (i = 0; i < n; i++) {
+        if (ngx_syslog_send(peer, msgs[i].data, msgs[i].len) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_syslog_init_peer(ngx_syslog_peer_t *peer)
 {
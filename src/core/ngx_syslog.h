@@ -8,6 +8,14 @@
 #define _NGX_SYSLOG_H_INCLUDED_
 
 
+#define NGX_SYSLOG_MAX_STR                                                    \
+    NGX_MAX_ERROR_STR + sizeof("<255>Jan 01 00:00:00 ") - 1                   \
+    + (NGX_MAXHOSTNAMELEN - 1) + 1 /* space */                                \
+    + 32 /* tag */ + 2 /* colon, space */
+
+#define NGX_SYSLOG_BATCH  64
+
+
 typedef struct {
     ngx_uint_t        facility;
     ngx_uint_t        severity;
@@ -22,9 +30,13 @@ typedef struct {
 
 char *ngx_syslog_process_conf(ngx_conf_t *cf, ngx_syslog_peer_t *peer);
 u_char *ngx_syslog_add_header(ngx_syslog_peer_t *peer, u_char *buf);
+u_char *ngx_syslog_add_message(ngx_syslog_peer_t *peer, ngx_uint_t level,
+    u_char *msg, u_char *buf, size_t len);
 void ngx_syslog_writer(ngx_log_t *log, ngx_uint_t level, u_char *buf,
     size_t len);
 ssize_t ngx_syslog_send(ngx_syslog_peer_t *peer, u_char *buf, size_t len);
+ngx_int_t ngx_syslog_send_batch(ngx_syslog_peer_t *peer, ngx_str_t *msgs,
+    ngx_uint_t n);
 
 
 #endif /* _NGX_SYSLOG_H_INCLUDED_ */
@@ -30,8 +30,12 @@ struct ngx_thread_pool_s {
     ngx_thread_mutex_t        mtx;
     ngx_thread_pool_queue_t   queue;
     ngx_int_t                 waiting;
+    ngx_uint_t                idle;
     ngx_thread_cond_t         cond;
 
+    ngx_atomic_t              tasks;
+    ngx_atomic_t              wait_time;
+
     ngx_log_t                *log;
 
     ngx_str_t                 name;
@@ -99,8 +103,9 @@ ngx_module_t  ngx_thread_pool_module = {
 static ngx_str_t  ngx_thread_pool_default = ngx_string("default");
 
 static ngx_uint_t               ngx_thread_pool_task_id;
-static ngx_atomic_t             ngx_thread_pool_done_lock;
-static ngx_thread_pool_queue_t  ngx_thread_pool_done;
+
+/* a lock-free stack of completed tasks, pushed by threads */
+static ngx_atomic_t             ngx_thread_pool_done;
 
 
 static ngx_int_t
@@ -281,17 +286,17 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
     task->event.active = 1;
 
     task->id = ngx_thread_pool_task_id++;
+    task->posted = ngx_current_msec;
     task->next = NULL;
 
     /*
-     * NOTE: 此时 cond_signal 并不能真正唤醒线程池中的线程，因为这里还持有互斥量，
-     *       所以线程池中的线程没法获取到互斥量，所以虽然唤醒，却被阻塞在加锁的过程
-     *       中，而这也是正确的，因为此时还没有把新的任务加到任务队列上去。而后面将
-     *       任务加到队列中去后，才释放互斥量，此时线程池中的线程就可以获取任务执行。
-     *
-     * QUESTION: 为什么不先将新的任务放到任务队列上，然后再解锁、cond_signal？
+     * busy threads recheck the queue before sleeping,
+     * so only idle ones have to be woken up
      */
-    if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
+
+    if (tp->idle
+        && ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK)
+    {
         (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
         return NGX_ERROR;
     }
@@ -319,6 +324,8 @@ ngx_thread_pool_cycle(void *data)
 
     int                 err;
     sigset_t            set;
+    ngx_msec_t          wait;
+    ngx_atomic_uint_t   head;
     ngx_thread_task_t  *task;
 
 #if 0
@@ -361,12 +368,17 @@ ngx_thread_pool_cycle(void *data)
          *       主要是为了处理虚假唤醒的情况
          */
         while (tp->queue.first == NULL) {
+            tp->idle++;
+
             if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
                 != NGX_OK)
             {
+                tp->idle--;
                 (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
                 return NULL;
             }
+
+            tp->idle--;
         }
 
         task = tp->queue.first;
@@ -384,6 +396,16 @@ ngx_thread_pool_cycle(void *data)
         ngx_time_update();
 #endif
 
+        /* ngx_current_msec is updated by the event loop, this is close enough */
+
+        wait = ngx_current_msec - task->posted;
+
+        (void) ngx_atomic_fetch_add(&tp->tasks, 1);
+
+        if ((ngx_msec_int_t) wait > 0) {
+            (void) ngx_atomic_fetch_add(&tp->wait_time, wait);
+        }
+
         ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
                        "run task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
@@ -394,31 +416,21 @@ ngx_thread_pool_cycle(void *data)
                        "complete task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
 
-        task->next = NULL;
-
-        ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+        do {
+            head = ngx_thread_pool_done;
+            task->next = (ngx_thread_task_t *) head;
 
-        *ngx_thread_pool_done.last = task;
-        ngx_thread_pool_done.last = &task->next;
+        } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, head,
+                                     (ngx_atomic_uint_t) task));
 
         /*
-         * NOTE: 这里的 memory_barrier 是为了让
-         *       下面的 ngx_unlock 只是简单的一个宏：*(lock) = 0，所以可能会被编译器
-         *       的指令重排优化所影响，导致 ngx_spinlock 之后就立刻执行 ngx_unlock，
-         *       那么此处和 ngx_thread_pool_handler 中 ngx_thread_pool_done 相关
-         *       的操作就会相互影响。
-         *
-         * REF: http://mailman.nginx.org/pipermail/nginx-devel/2016-April/008160.html
+         * the completion handler takes all the tasks at once,
+         * so notifying is only needed when the stack was empty
          */
 
-        ngx_memory_barrier();
-
-        ngx_unlock(&ngx_thread_pool_done_lock);
-
-        /*
-         * NOTE: 线程执行完任务后，得通知主线程
-         */
-        (void) ngx_notify(ngx_thread_pool_handler);
+        if (head == 0) {
+            (void) ngx_notify(ngx_thread_pool_handler);
+        }
     }
 }
 
@@ -427,22 +439,27 @@ static void
 ngx_thread_pool_handler(ngx_event_t *ev)
 {
     ngx_event_t        *event;
-    ngx_thread_task_t  *task;
+    ngx_atomic_uint_t   head;
+    ngx_thread_task_t  *task, *next, *done;
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "thread pool handler");
 
-    ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+    do {
+        head = ngx_thread_pool_done;
 
-    /*
-     * NOTE: 清空整个 done 队列
-     */
-    task = ngx_thread_pool_done.first;
-    ngx_thread_pool_done.first = NULL;
-    ngx_thread_pool_done.last = &ngx_thread_pool_done.first;
+    } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, head, 0));
 
-    ngx_memory_barrier();
+    /* restore the completion order */
+
+    done = NULL;
+
+    for (task = (ngx_thread_task_t *) head; task; task = next) {
+        next = task->next;
+        task->next = done;
+        done = task;
+    }
 
-    ngx_unlock(&ngx_thread_pool_done_lock);
+    task = done;
 
     while (task) {
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
@@ -682,7 +699,7 @@ ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
         return NGX_OK;
     }
 
-    ngx_thread_pool_queue_init(&ngx_thread_pool_done);
+    ngx_thread_pool_done = 0;
 
     tpp = tcf->pools.elts;
 
@@ -722,3 +739,43 @@ ngx_thread_pool_exit_worker(ngx_cycle_t *cycle)
         ngx_thread_pool_destroy(tpp[i]);
     }
 }
+
+
+ngx_array_t *
+ngx_thread_pool_stats(ngx_cycle_t *cycle, ngx_pool_t *pool)
+{
+    ngx_uint_t                i;
+    ngx_array_t              *stats;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_stat_t   *st;
+    ngx_thread_pool_conf_t   *tcf;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    stats = ngx_array_create(pool, tcf->pools.nelts ? tcf->pools.nelts : 1,
+                             sizeof(ngx_thread_pool_stat_t));
+    if (stats == NULL) {
+        return NULL;
+    }
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+        st = ngx_array_push(stats);
+        if (st == NULL) {
+            return NULL;
+        }
+
+        st->name = tpp[i]->name;
+        st->threads = tpp[i]->threads;
+
+        /* the number is negative while threads are waiting for tasks */
+        st->queued = tpp[i]->waiting > 0 ? tpp[i]->waiting : 0;
+
+        st->tasks = tpp[i]->tasks;
+        st->wait_time = tpp[i]->wait_time;
+    }
+
+    return stats;
+}
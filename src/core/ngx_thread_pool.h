@@ -17,6 +17,7 @@
 struct ngx_thread_task_s {
     ngx_thread_task_t   *next;
     ngx_uint_t           id;
+    ngx_msec_t           posted;
     void                *ctx;
     void               (*handler)(void *data, ngx_log_t *log);
     ngx_event_t          event;
@@ -26,11 +27,22 @@ struct ngx_thread_task_s {
 typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 
 
+typedef struct {
+    ngx_str_t            name;
+    ngx_uint_t           threads;
+    ngx_uint_t           queued;       /* tasks waiting in the queue */
+    ngx_uint_t           tasks;        /* tasks taken by threads */
+    ngx_msec_t           wait_time;    /* total time tasks were queued */
+} ngx_thread_pool_stat_t;
+
+
 ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
 ngx_thread_pool_t *ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name);
 
 ngx_thread_task_t *ngx_thread_task_alloc(ngx_pool_t *pool, size_t size);
 ngx_int_t ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task);
 
+ngx_array_t *ngx_thread_pool_stats(ngx_cycle_t *cycle, ngx_pool_t *pool);
+
 
 #endif /* _NGX_THREAD_POOL_H_INCLUDED_ */
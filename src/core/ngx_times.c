@@ -9,7 +9,16 @@
 #include <ngx_core.h>
 
 
+typedef struct {
+    time_t                sec;
+    ngx_int_t             gmtoff;
+    volatile ngx_uint_t   formatted;
+    ngx_str_t             str[NGX_TIME_STRINGS];
+} ngx_time_strings_t;
+
+
 static ngx_msec_t ngx_monotonic_time(time_t sec, ngx_uint_t msec);
+static void ngx_time_format(ngx_time_strings_t *ts, ngx_uint_t n);
 
 
 /*
@@ -19,6 +28,11 @@ static ngx_msec_t ngx_monotonic_time(time_t sec, ngx_uint_t msec);
  * values and strings from the current slot.  Thus thread may get the corrupted
  * values only if it is preempted while copying and then it is not scheduled
  * to run more than NGX_TIME_SLOTS seconds.
+ *
+ * The time strings are formatted on first use in a second, as many
+ * updates change only milliseconds or are not followed by any logging.
+ * A string may be formatted twice by concurrent readers, with the
+ * same result.
  */
 
 #define NGX_TIME_SLOTS   64
@@ -28,11 +42,6 @@ static ngx_atomic_t      ngx_time_lock;
 
 volatile ngx_msec_t      ngx_current_msec;
 volatile ngx_time_t     *ngx_cached_time;
-volatile ngx_str_t       ngx_cached_err_log_time;
-volatile ngx_str_t       ngx_cached_http_time;
-volatile ngx_str_t       ngx_cached_http_log_time;
-volatile ngx_str_t       ngx_cached_http_log_iso8601;
-volatile ngx_str_t       ngx_cached_syslog_time;
 
 #if !(NGX_WIN32)
 
@@ -57,21 +66,44 @@ static u_char            cached_http_log_iso8601[NGX_TIME_SLOTS]
 static u_char            cached_syslog_time[NGX_TIME_SLOTS]
                                     [sizeof("Sep 28 12:00:00")];
 
+static ngx_time_strings_t   cached_strings[NGX_TIME_SLOTS];
+static ngx_time_strings_t  *cached_strings_current;
+
 
 static char  *week[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
 static char  *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
                            "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
 
+
 void
 ngx_time_init(void)
 {
-    ngx_cached_err_log_time.len = sizeof("1970/09/28 12:00:00") - 1;
-    ngx_cached_http_time.len = sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1;
-    ngx_cached_http_log_time.len = sizeof("28/Sep/1970:12:00:00 +0600") - 1;
-    ngx_cached_http_log_iso8601.len = sizeof("1970-09-28T12:00:00+06:00") - 1;
-    ngx_cached_syslog_time.len = sizeof("Sep 28 12:00:00") - 1;
+    ngx_uint_t           i;
+    ngx_time_strings_t  *ts;
+
+    for (i = 0; i < NGX_TIME_SLOTS; i++) {
+        ts = &cached_strings[i];
+
+        ts->str[NGX_TIME_ERR_LOG].len = sizeof("1970/09/28 12:00:00") - 1;
+        ts->str[NGX_TIME_ERR_LOG].data = cached_err_log_time[i];
+
+        ts->str[NGX_TIME_HTTP].len = sizeof("Mon, 28 Sep 1970 06:00:00 GMT")
+                                     - 1;
+        ts->str[NGX_TIME_HTTP].data = cached_http_time[i];
+
+        ts->str[NGX_TIME_HTTP_LOG].len = sizeof("28/Sep/1970:12:00:00 +0600")
+                                         - 1;
+        ts->str[NGX_TIME_HTTP_LOG].data = cached_http_log_time[i];
+
+        ts->str[NGX_TIME_ISO8601].len = sizeof("1970-09-28T12:00:00+06:00") - 1;
+        ts->str[NGX_TIME_ISO8601].data = cached_http_log_iso8601[i];
+
+        ts->str[NGX_TIME_SYSLOG].len = sizeof("Sep 28 12:00:00") - 1;
+        ts->str[NGX_TIME_SYSLOG].data = cached_syslog_time[i];
+    }
 
     ngx_cached_time = &cached_time[0];
+    cached_strings_current = &cached_strings[0];
 
     ngx_time_update();
 }
@@ -80,12 +112,14 @@ ngx_time_init(void)
 void
 ngx_time_update(void)
 {
-    u_char          *p0, *p1, *p2, *p3, *p4;
-    ngx_tm_t         tm, gmt;
-    time_t           sec;
-    ngx_uint_t       msec;
-    ngx_time_t      *tp;
-    struct timeval   tv;
+    time_t               sec;
+    ngx_uint_t           msec;
+    ngx_time_t          *tp;
+    struct timeval       tv;
+    ngx_time_strings_t  *ts;
+#if !(NGX_HAVE_GETTIMEZONE)
+    ngx_tm_t             tm;
+#endif
 
     if (!ngx_trylock(&ngx_time_lock)) {
         return;
@@ -117,20 +151,9 @@ ngx_time_update(void)
     tp->sec = sec;
     tp->msec = msec;
 
-    ngx_gmtime(sec, &gmt);
-
-
-    p0 = &cached_http_time[slot][0];
-
-    (void) ngx_sprintf(p0, "%s, %02d %s %4d %02d:%02d:%02d GMT",
-                       week[gmt.ngx_tm_wday], gmt.ngx_tm_mday,
-                       months[gmt.ngx_tm_mon - 1], gmt.ngx_tm_year,
-                       gmt.ngx_tm_hour, gmt.ngx_tm_min, gmt.ngx_tm_sec);
-
 #if (NGX_HAVE_GETTIMEZONE)
 
     tp->gmtoff = ngx_gettimezone();
-    ngx_gmtime(sec + tp->gmtoff * 60, &tm);
 
 #elif (NGX_HAVE_GMTOFF)
 
@@ -147,46 +170,16 @@ ngx_time_update(void)
 #endif
 
 
-    p1 = &cached_err_log_time[slot][0];
-
-    (void) ngx_sprintf(p1, "%4d/%02d/%02d %02d:%02d:%02d",
-                       tm.ngx_tm_year, tm.ngx_tm_mon,
-                       tm.ngx_tm_mday, tm.ngx_tm_hour,
-                       tm.ngx_tm_min, tm.ngx_tm_sec);
-
+    ts = &cached_strings[slot];
 
-    p2 = &cached_http_log_time[slot][0];
-
-    (void) ngx_sprintf(p2, "%02d/%s/%d:%02d:%02d:%02d %c%02i%02i",
-                       tm.ngx_tm_mday, months[tm.ngx_tm_mon - 1],
-                       tm.ngx_tm_year, tm.ngx_tm_hour,
-                       tm.ngx_tm_min, tm.ngx_tm_sec,
-                       tp->gmtoff < 0 ? '-' : '+',
-                       ngx_abs(tp->gmtoff / 60), ngx_abs(tp->gmtoff % 60));
-
-    p3 = &cached_http_log_iso8601[slot][0];
-
-    (void) ngx_sprintf(p3, "%4d-%02d-%02dT%02d:%02d:%02d%c%02i:%02i",
-                       tm.ngx_tm_year, tm.ngx_tm_mon,
-                       tm.ngx_tm_mday, tm.ngx_tm_hour,
-                       tm.ngx_tm_min, tm.ngx_tm_sec,
-                       tp->gmtoff < 0 ? '-' : '+',
-                       ngx_abs(tp->gmtoff / 60), ngx_abs(tp->gmtoff % 60));
-
-    p4 = &cached_syslog_time[slot][0];
-
-    (void) ngx_sprintf(p4, "%s %2d %02d:%02d:%02d",
-                       months[tm.ngx_tm_mon - 1], tm.ngx_tm_mday,
-                       tm.ngx_tm_hour, tm.ngx_tm_min, tm.ngx_tm_sec);
+    ts->sec = sec;
+    ts->gmtoff = tp->gmtoff;
+    ts->formatted = 0;
 
     ngx_memory_barrier();
 
     ngx_cached_time = tp;
-    ngx_cached_http_time.data = p0;
-    ngx_cached_err_log_time.data = p1;
-    ngx_cached_http_log_time.data = p2;
-    ngx_cached_http_log_iso8601.data = p3;
-    ngx_cached_syslog_time.data = p4;
+    cached_strings_current = ts;
 
     ngx_unlock(&ngx_time_lock);
 }
@@ -222,11 +215,10 @@ ngx_monotonic_time(time_t sec, ngx_uint_t msec)
 void
 ngx_time_sigsafe_update(void)
 {
-    u_char          *p, *p2;
-    ngx_tm_t         tm;
-    time_t           sec;
-    ngx_time_t      *tp;
-    struct timeval   tv;
+    time_t               sec;
+    ngx_time_t          *tp;
+    struct timeval       tv;
+    ngx_time_strings_t  *ts;
 
     if (!ngx_trylock(&ngx_time_lock)) {
         return;
@@ -253,25 +245,20 @@ ngx_time_sigsafe_update(void)
 
     tp->sec = 0;
 
-    ngx_gmtime(sec + cached_gmtoff * 60, &tm);
-
-    p = &cached_err_log_time[slot][0];
-
-    (void) ngx_sprintf(p, "%4d/%02d/%02d %02d:%02d:%02d",
-                       tm.ngx_tm_year, tm.ngx_tm_mon,
-                       tm.ngx_tm_mday, tm.ngx_tm_hour,
-                       tm.ngx_tm_min, tm.ngx_tm_sec);
+    /*
+     * only the strings are switched to the new second, they are
+     * formatted with ngx_gmtime() which is safe in a signal handler
+     */
 
-    p2 = &cached_syslog_time[slot][0];
+    ts = &cached_strings[slot];
 
-    (void) ngx_sprintf(p2, "%s %2d %02d:%02d:%02d",
-                       months[tm.ngx_tm_mon - 1], tm.ngx_tm_mday,
-                       tm.ngx_tm_hour, tm.ngx_tm_min, tm.ngx_tm_sec);
+    ts->sec = sec;
+    ts->gmtoff = cached_gmtoff;
+    ts->formatted = 0;
 
     ngx_memory_barrier();
 
-    ngx_cached_err_log_time.data = p;
-    ngx_cached_syslog_time.data = p2;
+    cached_strings_current = ts;
 
     ngx_unlock(&ngx_time_lock);
 }
@@ -279,6 +266,80 @@ ngx_time_sigsafe_update(void)
 #endif
 
 
+volatile ngx_str_t *
+ngx_cached_time_string(ngx_uint_t n)
+{
+    ngx_time_strings_t  *ts;
+
+    ts = cached_strings_current;
+
+    if (!(ts->formatted & (1 << n))) {
+        ngx_time_format(ts, n);
+
+        ngx_memory_barrier();
+
+        ts->formatted |= 1 << n;
+    }
+
+    return &ts->str[n];
+}
+
+
+static void
+ngx_time_format(ngx_time_strings_t *ts, ngx_uint_t n)
+{
+    u_char    *p;
+    ngx_tm_t   tm;
+
+    p = ts->str[n].data;
+
+    if (n == NGX_TIME_HTTP) {
+        ngx_gmtime(ts->sec, &tm);
+
+        (void) ngx_sprintf(p, "%s, %02d %s %4d %02d:%02d:%02d GMT",
+                           week[tm.ngx_tm_wday], tm.ngx_tm_mday,
+                           months[tm.ngx_tm_mon - 1], tm.ngx_tm_year,
+                           tm.ngx_tm_hour, tm.ngx_tm_min, tm.ngx_tm_sec);
+        return;
+    }
+
+    ngx_gmtime(ts->sec + ts->gmtoff * 60, &tm);
+
+    switch (n) {
+
+    case NGX_TIME_ERR_LOG:
+        (void) ngx_sprintf(p, "%4d/%02d/%02d %02d:%02d:%02d",
+                           tm.ngx_tm_year, tm.ngx_tm_mon,
+                           tm.ngx_tm_mday, tm.ngx_tm_hour,
+                           tm.ngx_tm_min, tm.ngx_tm_sec);
+        break;
+
+    case NGX_TIME_HTTP_LOG:
+        (void) ngx_sprintf(p, "%02d/%s/%d:%02d:%02d:%02d %c%02i%02i",
+                           tm.ngx_tm_mday, months[tm.ngx_tm_mon - 1],
+                           tm.ngx_tm_year, tm.ngx_tm_hour,
+                           tm.ngx_tm_min, tm.ngx_tm_sec,
+                           ts->gmtoff < 0 ? '-' : '+',
+                           ngx_abs(ts->gmtoff / 60), ngx_abs(ts->gmtoff % 60));
+        break;
+
+    case NGX_TIME_ISO8601:
+        (void) ngx_sprintf(p, "%4d-%02d-%02dT%02d:%02d:%02d%c%02i:%02i",
+                           tm.ngx_tm_year, tm.ngx_tm_mon,
+                           tm.ngx_tm_mday, tm.ngx_tm_hour,
+                           tm.ngx_tm_min, tm.ngx_tm_sec,
+                           ts->gmtoff < 0 ? '-' : '+',
+                           ngx_abs(ts->gmtoff / 60), ngx_abs(ts->gmtoff % 60));
+        break;
+
+    default: /* NGX_TIME_SYSLOG */
+        (void) ngx_sprintf(p, "%s %2d %02d:%02d:%02d",
+                           months[tm.ngx_tm_mon - 1], tm.ngx_tm_mday,
+                           tm.ngx_tm_hour, tm.ngx_tm_min, tm.ngx_tm_sec);
+    }
+}
+
+
 u_char *
 ngx_http_time(u_char *buf, time_t t)
 {
@@ -36,11 +36,26 @@ extern volatile ngx_time_t  *ngx_cached_time;
 #define ngx_time()           ngx_cached_time->sec
 #define ngx_timeofday()      (ngx_time_t *) ngx_cached_time
 
-extern volatile ngx_str_t    ngx_cached_err_log_time;
-extern volatile ngx_str_t    ngx_cached_http_time;
-extern volatile ngx_str_t    ngx_cached_http_log_time;
-extern volatile ngx_str_t    ngx_cached_http_log_iso8601;
-extern volatile ngx_str_t    ngx_cached_syslog_time;
+#define NGX_TIME_ERR_LOG     0
+#define NGX_TIME_HTTP        1
+#define NGX_TIME_HTTP_LOG    2
+#define NGX_TIME_ISO8601     3
+#define NGX_TIME_SYSLOG      4
+
+#define NGX_TIME_STRINGS     5
+
+volatile ngx_str_t *ngx_cached_time_string(ngx_uint_t n);
+
+#define ngx_cached_err_log_time                                               \
+    (*ngx_cached_time_string(NGX_TIME_ERR_LOG))
+#define ngx_cached_http_time                                                  \
+    (*ngx_cached_time_string(NGX_TIME_HTTP))
+#define ngx_cached_http_log_time                                              \
+    (*ngx_cached_time_string(NGX_TIME_HTTP_LOG))
+#define ngx_cached_http_log_iso8601                                           \
+    (*ngx_cached_time_string(NGX_TIME_ISO8601))
+#define ngx_cached_syslog_time                                                \
+    (*ngx_cached_time_string(NGX_TIME_SYSLOG))
 
 /*
  * milliseconds elapsed since some unspecified point in the past
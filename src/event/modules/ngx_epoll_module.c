@@ -95,9 +95,32 @@ struct io_event {
 #endif /* NGX_TEST_BUILD_EPOLL */
 
 
+#ifndef EPIOCSPARAMS
+
+/* EPIOCSPARAMS appeared in Linux 6.9, glibc 2.40 */
+
+struct epoll_params {
+    uint32_t      busy_poll_usecs;
+    uint16_t      busy_poll_budget;
+    uint8_t       prefer_busy_poll;
+    uint8_t       pad;
+};
+
+#define EPIOCSPARAMS  _IOW(0x8A, 0x01, struct epoll_params)
+
+#endif
+
+
 typedef struct {
     ngx_uint_t  events;
     ngx_uint_t  aio_requests;
+    ngx_flag_t  aio_io_uring;
+
+    /* microseconds */
+    ngx_uint_t  busy_poll;
+    ngx_uint_t  busy_poll_budget;
+    ngx_flag_t  prefer_busy_poll;
+    ngx_uint_t  spin;
 } ngx_epoll_conf_t;
 
 
@@ -109,6 +132,7 @@ static void ngx_epoll_notify_handler(ngx_event_t *ev);
 #if (NGX_HAVE_EPOLLRDHUP)
 static void ngx_epoll_test_rdhup(ngx_cycle_t *cycle);
 #endif
+static void ngx_epoll_busy_poll(ngx_cycle_t *cycle, ngx_epoll_conf_t *epcf);
 static void ngx_epoll_done(ngx_cycle_t *cycle);
 static ngx_int_t ngx_epoll_add_event(ngx_event_t *ev, ngx_int_t event,
     ngx_uint_t flags);
@@ -122,6 +146,7 @@ static ngx_int_t ngx_epoll_notify(ngx_event_handler_pt handler);
 #endif
 static ngx_int_t ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
     ngx_uint_t flags);
+static int ngx_epoll_spin(ngx_msec_t timer);
 
 #if (NGX_HAVE_FILE_AIO)
 static void ngx_epoll_eventfd_handler(ngx_event_t *ev);
@@ -129,11 +154,17 @@ static void ngx_epoll_eventfd_handler(ngx_event_t *ev);
 
 static void *ngx_epoll_create_conf(ngx_cycle_t *cycle);
 static char *ngx_epoll_init_conf(ngx_cycle_t *cycle, void *conf);
+static char *ngx_epoll_busy_poll_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 static int                  ep = -1;
 static struct epoll_event  *event_list;
 static ngx_uint_t           nevents;
 
+/* the spin before sleeping in epoll_wait(), adapted within the limit, usec */
+static ngx_uint_t           spin;
+static ngx_uint_t           spin_max;
+
 #if (NGX_HAVE_EVENTFD)
 static int                  notify_fd = -1;
 static ngx_event_t          notify_event;
@@ -172,6 +203,31 @@ static ngx_command_t  ngx_epoll_commands[] = {
       offsetof(ngx_epoll_conf_t, aio_requests),
       NULL },
 
+#if (NGX_HAVE_FILE_AIO && NGX_HAVE_IO_URING)
+
+    { ngx_string("worker_aio_io_uring"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_epoll_conf_t, aio_io_uring),
+      NULL },
+
+#endif
+
+    { ngx_string("epoll_busy_poll"),
+      NGX_EVENT_CONF|NGX_CONF_1MORE,
+      ngx_epoll_busy_poll_conf,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("epoll_spin"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_epoll_conf_t, spin),
+      NULL },
+
       ngx_null_command
 };
 
@@ -275,12 +331,27 @@ ngx_epoll_aio_init(ngx_cycle_t *cycle, ngx_epoll_conf_t *epcf)
         goto failed;
     }
 
+#if (NGX_HAVE_IO_URING)
+
+    if (epcf->aio_io_uring
+        && ngx_file_aio_uring_init(cycle, ngx_eventfd, epcf->aio_requests)
+           == NGX_OK)
+    {
+        goto add;
+    }
+
+#endif
+
     if (io_setup(epcf->aio_requests, &ngx_aio_ctx) == -1) {
         ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
                       "io_setup() failed");
         goto failed;
     }
 
+#if (NGX_HAVE_IO_URING)
+add:
+#endif
+
     ngx_eventfd_event.data = &ngx_eventfd_conn;
     ngx_eventfd_event.handler = ngx_epoll_eventfd_handler;
     ngx_eventfd_event.log = cycle->log;
@@ -299,6 +370,12 @@ ngx_epoll_aio_init(ngx_cycle_t *cycle, ngx_epoll_conf_t *epcf)
     ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
                   "epoll_ctl(EPOLL_CTL_ADD, eventfd) failed");
 
+#if (NGX_HAVE_IO_URING)
+    if (ngx_file_aio_uring != -1) {
+        ngx_file_aio_uring_done(cycle);
+
+    } else
+#endif
     if (io_destroy(ngx_aio_ctx) == -1) {
         ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
                       "io_destroy() failed");
@@ -348,8 +425,15 @@ ngx_epoll_init(ngx_cycle_t *cycle, ngx_msec_t timer)
 #if (NGX_HAVE_EPOLLRDHUP)
         ngx_epoll_test_rdhup(cycle);
 #endif
+
+        if (epcf->busy_poll) {
+            ngx_epoll_busy_poll(cycle, epcf);
+        }
     }
 
+    spin_max = epcf->spin;
+    spin = spin_max;
+
     if (nevents < epcf->events) {
         if (event_list) {
             ngx_free(event_list);
@@ -526,6 +610,36 @@ failed:
 #endif
 
 
+static void
+ngx_epoll_busy_poll(ngx_cycle_t *cycle, ngx_epoll_conf_t *epcf)
+{
+    struct epoll_params  params;
+
+    ngx_memzero(&params, sizeof(struct epoll_params));
+
+    params.busy_poll_usecs = epcf->busy_poll;
+    params.busy_poll_budget = epcf->busy_poll_budget;
+    params.prefer_busy_poll = epcf->prefer_busy_poll;
+
+    /*
+     * the budget above the net.core.busy_poll_budget default of 8
+     * requires CAP_NET_ADMIN
+     */
+
+    if (ioctl(ep, EPIOCSPARAMS, &params) == -1) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, ngx_errno,
+                      "ioctl(EPIOCSPARAMS) failed, epoll busy polling "
+                      "is not used");
+        return;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "epoll busy poll: %uD usec, budget:%uD, prefer:%ud",
+                   params.busy_poll_usecs, (uint32_t) params.busy_poll_budget,
+                   (ngx_uint_t) params.prefer_busy_poll);
+}
+
+
 static void
 ngx_epoll_done(ngx_cycle_t *cycle)
 {
@@ -551,6 +665,12 @@ ngx_epoll_done(ngx_cycle_t *cycle)
 
     if (ngx_eventfd != -1) {
 
+#if (NGX_HAVE_IO_URING)
+        if (ngx_file_aio_uring != -1) {
+            ngx_file_aio_uring_done(cycle);
+
+        } else
+#endif
         if (io_destroy(ngx_aio_ctx) == -1) {
             ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
                           "io_destroy() failed");
@@ -797,7 +917,12 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                    "epoll timer: %M", timer);
 
-    events = epoll_wait(ep, event_list, (int) nevents, timer);
+    if (spin && timer) {
+        events = ngx_epoll_spin(timer);
+
+    } else {
+        events = epoll_wait(ep, event_list, (int) nevents, timer);
+    }
 
     err = (events == -1) ? ngx_errno : 0;
 
@@ -908,7 +1033,7 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
                 ngx_post_event(rev, queue);
 
             } else {
-                rev->handler(rev);
+                ngx_event_call(rev);
             }
         }
 
@@ -937,7 +1062,7 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
                 ngx_post_event(wev, &ngx_posted_events);
 
             } else {
-                wev->handler(wev);
+                ngx_event_call(wev);
             }
         }
     }
@@ -946,6 +1071,91 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
 }
 
 
+/*
+ * polls for events without sleeping for up to the current spin time,
+ * then sleeps as usual; the spin time doubles if events arrive within
+ * the limit since the spin started, and halves otherwise
+ */
+
+static int
+ngx_epoll_spin(ngx_msec_t timer)
+{
+    int         events;
+    uint64_t    start, now, limit;
+    ngx_uint_t  polls;
+
+    limit = spin;
+
+    if (timer != NGX_TIMER_INFINITE && limit > (uint64_t) timer * 1000) {
+        limit = (uint64_t) timer * 1000;
+    }
+
+    start = ngx_event_loop_now();
+    now = start;
+    polls = 0;
+
+    for ( ;; ) {
+        events = epoll_wait(ep, event_list, (int) nevents, 0);
+        polls++;
+
+        if (events != 0) {
+            break;
+        }
+
+        now = ngx_event_loop_now();
+
+        if (now - start >= limit) {
+            break;
+        }
+
+        ngx_cpu_pause();
+    }
+
+    if (events == -1 || (events && polls == 1)) {
+
+        /* there was no need to spin */
+
+        return events;
+    }
+
+    if (events) {
+        now = ngx_event_loop_now();
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                   "epoll spin: %uL usec, events:%d, limit:%ui",
+                   now - start, events, spin);
+
+    if (ngx_event_loop_timing) {
+        ngx_event_loop_spin(events != 0, now - start);
+    }
+
+    if (events == 0) {
+
+        if (timer != NGX_TIMER_INFINITE) {
+            timer -= ngx_min(timer, (ngx_msec_t) ((now - start) / 1000));
+        }
+
+        events = epoll_wait(ep, event_list, (int) nevents, timer);
+
+        if (events <= 0) {
+            return events;
+        }
+
+        now = ngx_event_loop_now();
+    }
+
+    if (now - start < spin_max) {
+        spin = ngx_min(spin * 2, spin_max);
+
+    } else {
+        spin = ngx_max(spin / 2, 1);
+    }
+
+    return events;
+}
+
+
 #if (NGX_HAVE_FILE_AIO)
 
 static void
@@ -983,6 +1193,15 @@ ngx_epoll_eventfd_handler(ngx_event_t *ev)
         return;
     }
 
+#if (NGX_HAVE_IO_URING)
+
+    if (ngx_file_aio_uring != -1) {
+        ngx_file_aio_uring_process(ev->log);
+        return;
+    }
+
+#endif
+
     ts.tv_sec = 0;
     ts.tv_nsec = 0;
 
@@ -1044,6 +1263,11 @@ ngx_epoll_create_conf(ngx_cycle_t *cycle)
 
     epcf->events = NGX_CONF_UNSET;
     epcf->aio_requests = NGX_CONF_UNSET;
+    epcf->aio_io_uring = NGX_CONF_UNSET;
+    epcf->busy_poll = NGX_CONF_UNSET_UINT;
+    epcf->busy_poll_budget = NGX_CONF_UNSET_UINT;
+    epcf->prefer_busy_poll = NGX_CONF_UNSET;
+    epcf->spin = NGX_CONF_UNSET_UINT;
 
     return epcf;
 }
@@ -1056,6 +1280,72 @@ ngx_epoll_init_conf(ngx_cycle_t *cycle, void *conf)
 
     ngx_conf_init_uint_value(epcf->events, 512);
     ngx_conf_init_uint_value(epcf->aio_requests, 32);
+    ngx_conf_init_value(epcf->aio_io_uring, 1);
+    ngx_conf_init_uint_value(epcf->busy_poll, 0);
+    ngx_conf_init_uint_value(epcf->busy_poll_budget, 8);
+    ngx_conf_init_value(epcf->prefer_busy_poll, 0);
+    ngx_conf_init_uint_value(epcf->spin, 0);
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_epoll_busy_poll_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_epoll_conf_t  *epcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+    ngx_uint_t  i;
+
+    if (epcf->busy_poll != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        epcf->busy_poll = 0;
+        return NGX_CONF_OK;
+    }
+
+    /* microseconds */
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        return "invalid value";
+    }
+
+    epcf->busy_poll = n;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "budget=", 7) == 0) {
+
+            n = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (n == NGX_ERROR || n == 0 || n > 65535) {
+                goto invalid;
+            }
+
+            epcf->busy_poll_budget = n;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "prefer") == 0) {
+            epcf->prefer_busy_poll = 1;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
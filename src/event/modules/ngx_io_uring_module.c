@@ -0,0 +1,1030 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The module uses io_uring as a readiness notification mechanism:
+ * a connection is watched by a single multishot IORING_OP_POLL_ADD
+ * request, and all poll additions and removals made during an event loop
+ * iteration are submitted in one io_uring_enter() call together with
+ * waiting for completions.  Reads and writes are still done with the usual
+ * system calls once a connection is reported ready.
+ *
+ * The poll request user_data is the connection pointer, the instance bit
+ * in the bit 0, and the request generation in the bits 1 and 2.  The poll
+ * mask of the current request is kept in c->read->index, and the
+ * generation in c->write->index.
+ *
+ * Note that a file referenced by a poll request is not released on close()
+ * until the request is removed, so the request is always removed before
+ * a connection is closed.
+ */
+
+
+#define NGX_IO_URING_READ     (POLLIN|POLLRDHUP)
+#define NGX_IO_URING_WRITE    POLLOUT
+
+#define NGX_IO_URING_GEN      0x6
+
+
+typedef struct {
+    ngx_uint_t            entries;
+} ngx_io_uring_conf_t;
+
+
+typedef struct {
+    unsigned             *head;
+    unsigned             *tail;
+    unsigned             *mask;
+    unsigned             *entries;
+    unsigned             *flags;
+    unsigned             *array;
+    struct io_uring_sqe  *sqes;
+    unsigned              tail_local;
+    void                 *ring;
+    size_t                ring_size;
+    size_t                sqes_size;
+} ngx_io_uring_sq_t;
+
+
+typedef struct {
+    unsigned             *head;
+    unsigned             *tail;
+    unsigned             *mask;
+    unsigned             *entries;
+    struct io_uring_cqe  *cqes;
+    void                 *ring;
+    size_t                ring_size;
+} ngx_io_uring_cq_t;
+
+
+static ngx_int_t ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_io_uring_setup(ngx_cycle_t *cycle,
+    ngx_io_uring_conf_t *urcf);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify_init(ngx_log_t *log);
+static void ngx_io_uring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_io_uring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_add_connection(ngx_connection_t *c);
+static ngx_int_t ngx_io_uring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_io_uring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+
+static ngx_int_t ngx_io_uring_set_poll(ngx_connection_t *c, ngx_uint_t mask,
+    ngx_log_t *log);
+static ngx_int_t ngx_io_uring_poll_add(ngx_connection_t *c, ngx_uint_t mask,
+    ngx_log_t *log);
+static ngx_int_t ngx_io_uring_poll_remove(ngx_connection_t *c,
+    ngx_log_t *log);
+static struct io_uring_sqe *ngx_io_uring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_enter(ngx_uint_t wait, ngx_msec_t timer,
+    ngx_log_t *log);
+static void ngx_io_uring_event(ngx_cycle_t *cycle, struct io_uring_cqe *cqe,
+    ngx_uint_t flags);
+
+static void *ngx_io_uring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static int                  ring = -1;
+static ngx_io_uring_sq_t    sq;
+static ngx_io_uring_cq_t    cq;
+static ngx_uint_t           nsubmit;
+
+#if (NGX_HAVE_EVENTFD)
+static int                  notify_fd = -1;
+static ngx_event_t          notify_event;
+static ngx_event_t          notify_write_event;
+static ngx_connection_t     notify_conn;
+#endif
+
+
+static ngx_str_t      io_uring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_io_uring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_event_module_t  ngx_io_uring_module_ctx = {
+    &io_uring_name,
+    ngx_io_uring_create_conf,            /* create configuration */
+    ngx_io_uring_init_conf,              /* init configuration */
+
+    {
+        ngx_io_uring_add_event,          /* add an event */
+        ngx_io_uring_del_event,          /* delete an event */
+        ngx_io_uring_add_event,          /* enable an event */
+        ngx_io_uring_del_event,          /* disable an event */
+        ngx_io_uring_add_connection,     /* add an connection */
+        ngx_io_uring_del_connection,     /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_io_uring_notify,             /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_io_uring_process_events,     /* process the events */
+        ngx_io_uring_init,               /* init the events */
+        ngx_io_uring_done,               /* done the events */
+    }
+};
+
+ngx_module_t  ngx_io_uring_module = {
+    NGX_MODULE_V1,
+    &ngx_io_uring_module_ctx,            /* module context */
+    ngx_io_uring_commands,               /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls
+ * to avoid dependency on liburing.
+ */
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags, void *arg, size_t size)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, size);
+}
+
+
+static ngx_int_t
+ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_event_get_conf(cycle->conf_ctx, ngx_io_uring_module);
+
+    if (ring == -1) {
+        if (ngx_io_uring_setup(cycle, urcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+#if (NGX_HAVE_EVENTFD)
+        if (ngx_io_uring_notify_init(cycle->log) != NGX_OK) {
+            ngx_io_uring_module_ctx.actions.notify = NULL;
+        }
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+
+        /* Linux AIO completions are reported via epoll only */
+
+        if (ngx_file_aio) {
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "file AIO is not supported by io_uring module, "
+                          "files are read synchronously");
+            ngx_file_aio = 0;
+        }
+
+#endif
+    }
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_io_uring_module_ctx.actions;
+
+    /* the multishot poll semantics is the same as of edge-triggered epoll */
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_EPOLL_EVENT;
+
+#if (NGX_HAVE_EPOLLRDHUP)
+
+    /*
+     * POLLRDHUP is reported by poll requests as EPOLLRDHUP is by epoll,
+     * so a short read means that the socket buffer was drained
+     */
+
+    ngx_use_epoll_rdhup = 1;
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_setup(ngx_cycle_t *cycle, ngx_io_uring_conf_t *urcf)
+{
+    u_char                  *p;
+    struct io_uring_params   params;
+
+    ngx_memzero(&params, sizeof(struct io_uring_params));
+
+    /* multishot poll requests may produce many completions */
+
+    params.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+    params.cq_entries = 2 * ngx_max(urcf->entries, cycle->connection_n);
+
+    ring = io_uring_setup(urcf->entries, &params);
+
+    if (ring == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    /* IORING_FEAT_RSRC_TAGS appeared in Linux 5.13 with multishot poll */
+
+    if (!(params.features & IORING_FEAT_NODROP)
+        || !(params.features & IORING_FEAT_EXT_ARG)
+        || !(params.features & IORING_FEAT_RSRC_TAGS))
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring features 0x%xD are not sufficient, "
+                      "at least Linux 5.13 is required", params.features);
+        goto failed;
+    }
+
+    sq.ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq.ring_size = params.cq_off.cqes
+                   + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq.ring_size = ngx_max(sq.ring_size, cq.ring_size);
+        cq.ring_size = sq.ring_size;
+    }
+
+    sq.ring = mmap(NULL, sq.ring_size, PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+
+    if (sq.ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        sq.ring = NULL;
+        goto failed;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq.ring = sq.ring;
+
+    } else {
+        cq.ring = mmap(NULL, cq.ring_size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+
+        if (cq.ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            cq.ring = NULL;
+            goto failed;
+        }
+    }
+
+    sq.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    sq.sqes = mmap(NULL, sq.sqes_size, PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQES);
+
+    if (sq.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        sq.sqes = NULL;
+        goto failed;
+    }
+
+    p = sq.ring;
+
+    sq.head = (unsigned *) (p + params.sq_off.head);
+    sq.tail = (unsigned *) (p + params.sq_off.tail);
+    sq.mask = (unsigned *) (p + params.sq_off.ring_mask);
+    sq.entries = (unsigned *) (p + params.sq_off.ring_entries);
+    sq.flags = (unsigned *) (p + params.sq_off.flags);
+    sq.array = (unsigned *) (p + params.sq_off.array);
+    sq.tail_local = *sq.tail;
+
+    p = cq.ring;
+
+    cq.head = (unsigned *) (p + params.cq_off.head);
+    cq.tail = (unsigned *) (p + params.cq_off.tail);
+    cq.mask = (unsigned *) (p + params.cq_off.ring_mask);
+    cq.entries = (unsigned *) (p + params.cq_off.ring_entries);
+    cq.cqes = (struct io_uring_cqe *) (p + params.cq_off.cqes);
+
+    nsubmit = 0;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD",
+                   ring, params.sq_entries, params.cq_entries);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_io_uring_done(cycle);
+
+    return NGX_ERROR;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify_init(ngx_log_t *log)
+{
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_io_uring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+    notify_event.index = NGX_INVALID_INDEX;
+
+    notify_write_event.log = log;
+    notify_write_event.index = 0;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.write = &notify_write_event;
+    notify_conn.log = log;
+
+    if (ngx_io_uring_set_poll(&notify_conn, POLLIN, log) != NGX_OK) {
+
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    /* the notify event index keeps the poll mask, so read the counter */
+
+    n = read(notify_fd, &count, sizeof(uint64_t));
+
+    err = ngx_errno;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+    if ((size_t) n != sizeof(uint64_t) && err != NGX_EAGAIN) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                      "read() eventfd %d failed", notify_fd);
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_io_uring_done(ngx_cycle_t *cycle)
+{
+#if (NGX_HAVE_EVENTFD)
+
+    if (notify_fd != -1) {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+    }
+
+#endif
+
+    if (sq.sqes) {
+        if (munmap(sq.sqes, sq.sqes_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_SQES) failed");
+        }
+    }
+
+    if (cq.ring && cq.ring != sq.ring) {
+        if (munmap(cq.ring, cq.ring_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_CQ_RING) failed");
+        }
+    }
+
+    if (sq.ring) {
+        if (munmap(sq.ring, sq.ring_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_SQ_RING) failed");
+        }
+    }
+
+    if (ring != -1 && close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+    ngx_memzero(&sq, sizeof(ngx_io_uring_sq_t));
+    ngx_memzero(&cq, sizeof(ngx_io_uring_cq_t));
+
+    nsubmit = 0;
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_uint_t         mask;
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        mask = NGX_IO_URING_READ;
+
+        if (e->active) {
+            mask |= NGX_IO_URING_WRITE;
+        }
+
+    } else {
+        e = c->read;
+        mask = NGX_IO_URING_WRITE;
+
+        if (e->active) {
+            mask |= NGX_IO_URING_READ;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d ev:%04Xi", c->fd, mask);
+
+    if (ngx_io_uring_set_poll(c, mask, ev->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_uint_t         mask;
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        mask = NGX_IO_URING_WRITE;
+
+    } else {
+        e = c->read;
+        mask = NGX_IO_URING_READ;
+    }
+
+    /*
+     * unlike epoll, the poll request has to be removed even if the
+     * file descriptor is going to be closed
+     */
+
+    if (!e->active || (flags & NGX_CLOSE_EVENT)) {
+        mask = 0;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d ev:%04Xi", c->fd, mask);
+
+    if (ngx_io_uring_set_poll(c, mask, ev->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_connection(ngx_connection_t *c)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring add connection: fd:%d", c->fd);
+
+    if (ngx_io_uring_set_poll(c, NGX_IO_URING_READ|NGX_IO_URING_WRITE, c->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 1;
+    c->write->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring del connection: fd:%d", c->fd);
+
+    if (ngx_io_uring_set_poll(c, 0, c->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 0;
+    c->write->active = 0;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_io_uring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    unsigned              head, tail;
+    ngx_int_t             rc;
+    ngx_uint_t            events;
+    struct io_uring_cqe  *cqe;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M, submit: %ui", timer, nsubmit);
+
+    rc = ngx_io_uring_enter(1, timer, cycle->log);
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_DONE) {
+        ngx_event_timer_alarm = 0;
+        return NGX_OK;
+    }
+
+    events = 0;
+
+    head = *cq.head;
+
+    for ( ;; ) {
+        tail = *cq.tail;
+        ngx_memory_barrier();
+
+        if (head == tail) {
+            break;
+        }
+
+        while (head != tail) {
+            cqe = &cq.cqes[head & *cq.mask];
+            head++;
+
+            events++;
+
+            ngx_io_uring_event(cycle, cqe, flags);
+        }
+
+        ngx_memory_barrier();
+        *cq.head = head;
+    }
+
+    /*
+     * io_uring_enter() returns the number of submitted entries if waiting
+     * was interrupted by a signal, so no events is not an error
+     */
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring events: %ui", events);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_event(ngx_cycle_t *cycle, struct io_uring_cqe *cqe,
+    ngx_uint_t flags)
+{
+    uint32_t           revents;
+    ngx_uint_t         instance, gen;
+    ngx_event_t       *rev, *wev;
+    ngx_queue_t       *queue;
+    ngx_connection_t  *c;
+
+    if (cqe->user_data == 0) {
+        /* a poll remove completion */
+        return;
+    }
+
+    c = (ngx_connection_t *) (uintptr_t) cqe->user_data;
+
+    instance = (uintptr_t) c & 1;
+    gen = (uintptr_t) c & NGX_IO_URING_GEN;
+    c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~7);
+
+    rev = c->read;
+    wev = c->write;
+
+    if (c->fd == -1
+        || rev->instance != instance
+        || rev->index == NGX_INVALID_INDEX
+        || (wev->index & NGX_IO_URING_GEN) != gen)
+    {
+        /*
+         * the stale event from a file descriptor
+         * that was just closed or a poll request that was just replaced
+         */
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: stale event %p res:%d", c, cqe->res);
+        return;
+    }
+
+    if (cqe->res < 0) {
+        if (cqe->res == -NGX_ECANCELED) {
+            return;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, -cqe->res,
+                      "io_uring poll on fd:%d failed", c->fd);
+
+        /* the poll request is not active anymore */
+
+        rev->index = NGX_INVALID_INDEX;
+
+        revents = POLLERR;
+
+    } else {
+        revents = (uint32_t) cqe->res;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d ev:%04XD f:%uD",
+                   c->fd, revents, cqe->flags);
+
+    if (cqe->res >= 0 && !(cqe->flags & IORING_CQE_F_MORE)) {
+
+        /* the multishot poll request has been terminated, re-arm it */
+
+        if (ngx_io_uring_poll_add(c, rev->index, cycle->log) != NGX_OK) {
+            revents |= POLLERR;
+        }
+    }
+
+    if (revents & (POLLERR|POLLHUP|POLLNVAL)) {
+
+        /*
+         * if the error events were returned, add POLLIN and POLLOUT
+         * to handle the events at least in one active handler
+         */
+
+        revents |= POLLIN|POLLOUT;
+    }
+
+    if ((revents & POLLIN) && rev->active) {
+
+        if (revents & POLLRDHUP) {
+            rev->pending_eof = 1;
+        }
+
+        rev->ready = 1;
+        rev->available = -1;
+
+        if (flags & NGX_POST_EVENTS) {
+            queue = rev->accept ? &ngx_posted_accept_events
+                                : &ngx_posted_events;
+
+            ngx_post_event(rev, queue);
+
+        } else {
+            ngx_event_call(rev);
+        }
+    }
+
+    if ((revents & POLLOUT) && wev->active) {
+
+        if (c->fd == -1 || rev->instance != instance) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            return;
+        }
+
+        wev->ready = 1;
+#if (NGX_THREADS)
+        wev->complete = 1;
+#endif
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(wev, &ngx_posted_events);
+
+        } else {
+            ngx_event_call(wev);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_io_uring_set_poll(ngx_connection_t *c, ngx_uint_t mask, ngx_log_t *log)
+{
+    if (c->read->index != NGX_INVALID_INDEX) {
+
+        if (c->read->index == mask) {
+            return NGX_OK;
+        }
+
+        if (ngx_io_uring_poll_remove(c, log) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (mask == 0) {
+        return NGX_OK;
+    }
+
+    return ngx_io_uring_poll_add(c, mask, log);
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll_add(ngx_connection_t *c, ngx_uint_t mask, ngx_log_t *log)
+{
+    ngx_uint_t            gen;
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    gen = (c->write->index + 2) & NGX_IO_URING_GEN;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = (uint32_t) mask;
+    sqe->user_data = (uintptr_t) c | c->read->instance | gen;
+
+    c->read->index = mask;
+    c->write->index = gen;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll_remove(ngx_connection_t *c, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t) c | c->read->instance
+                | (c->write->index & NGX_IO_URING_GEN);
+    sqe->user_data = 0;
+
+    c->read->index = NGX_INVALID_INDEX;
+
+    return NGX_OK;
+}
+
+
+static struct io_uring_sqe *
+ngx_io_uring_get_sqe(ngx_log_t *log)
+{
+    unsigned              n;
+    struct io_uring_sqe  *sqe;
+
+    if (sq.tail_local - *sq.head >= *sq.entries) {
+
+        /* the submission queue is full */
+
+        if (ngx_io_uring_enter(0, 0, log) == NGX_ERROR) {
+            return NULL;
+        }
+
+        if (sq.tail_local - *sq.head >= *sq.entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue overflow");
+            return NULL;
+        }
+    }
+
+    n = sq.tail_local & *sq.mask;
+
+    sqe = &sq.sqes[n];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    sq.array[n] = n;
+    sq.tail_local++;
+
+    ngx_memory_barrier();
+    *sq.tail = sq.tail_local;
+
+    nsubmit++;
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_io_uring_enter(ngx_uint_t wait, ngx_msec_t timer, ngx_log_t *log)
+{
+    int                              n;
+    unsigned                         min_complete, flags;
+    ngx_err_t                        err;
+    ngx_uint_t                       level;
+    struct __kernel_timespec         ts;
+    struct io_uring_getevents_arg    arg, *argp;
+
+    min_complete = 0;
+    flags = 0;
+    argp = NULL;
+
+    if (wait) {
+        flags = IORING_ENTER_GETEVENTS;
+
+        if (timer != 0) {
+            min_complete = 1;
+        }
+
+        if (timer != NGX_TIMER_INFINITE) {
+            ts.tv_sec = timer / 1000;
+            ts.tv_nsec = (timer % 1000) * 1000000;
+
+            ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+            arg.ts = (uintptr_t) &ts;
+
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+        }
+    }
+
+    n = io_uring_enter(ring, nsubmit, min_complete, flags, argp,
+                       argp ? sizeof(struct io_uring_getevents_arg) : 0);
+
+    if (n >= 0) {
+        nsubmit -= ngx_min((ngx_uint_t) n, nsubmit);
+        return NGX_OK;
+    }
+
+    err = ngx_errno;
+
+    switch (err) {
+
+    case ETIME:
+        return NGX_OK;
+
+    case NGX_EINTR:
+
+        if (ngx_event_timer_alarm) {
+            return NGX_DONE;
+        }
+
+        level = NGX_LOG_INFO;
+        break;
+
+    case NGX_EBUSY:
+    case NGX_EAGAIN:
+
+        /*
+         * the completion queue overflowed or there are no resources,
+         * the submissions are retried after completions are processed
+         */
+
+        return NGX_AGAIN;
+
+    default:
+        level = NGX_LOG_ALERT;
+    }
+
+    ngx_log_error(level, log, err, "io_uring_enter() failed");
+
+    return NGX_ERROR;
+}
+
+
+static void *
+ngx_io_uring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_palloc(cycle->pool, sizeof(ngx_io_uring_conf_t));
+    if (urcf == NULL) {
+        return NULL;
+    }
+
+    urcf->entries = NGX_CONF_UNSET;
+
+    return urcf;
+}
+
+
+static char *
+ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_io_uring_conf_t *urcf = conf;
+
+    ngx_conf_init_uint_value(urcf->entries, 1024);
+
+    return NGX_CONF_OK;
+}
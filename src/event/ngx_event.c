@@ -30,6 +30,8 @@ static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_event_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_event_loop_stats(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 static void *ngx_event_core_create_conf(ngx_cycle_t *cycle);
 static char *ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf);
@@ -56,6 +58,9 @@ ngx_uint_t            ngx_accept_mutex_held;
 ngx_msec_t            ngx_accept_mutex_delay;
 ngx_int_t             ngx_accept_disabled;
 
+size_t                ngx_read_budget;
+ngx_uint_t            ngx_event_iteration;
+
 
 #if (NGX_STAT_STUB)
 
@@ -117,6 +122,35 @@ ngx_module_t  ngx_events_module = {
 static ngx_str_t  event_core_name = ngx_string("event_core");
 
 
+static ngx_conf_enum_t  ngx_event_multi_accept[] = {
+    { ngx_string("off"), NGX_EVENT_MULTI_ACCEPT_OFF },
+    { ngx_string("on"), NGX_EVENT_MULTI_ACCEPT_ON },
+    { ngx_string("auto"), NGX_EVENT_MULTI_ACCEPT_AUTO },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_conf_enum_t  ngx_event_connection_layouts[] = {
+    { ngx_string("split"), NGX_EVENT_CONNECTIONS_SPLIT },
+    { ngx_string("packed"), NGX_EVENT_CONNECTIONS_PACKED },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_conf_enum_t  ngx_event_timer_engines[] = {
+    { ngx_string("rbtree"), NGX_EVENT_TIMER_RBTREE },
+    { ngx_string("wheel"), NGX_EVENT_TIMER_WHEEL },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_conf_enum_t  ngx_event_udp_sessions[] = {
+    { ngx_string("rbtree"), NGX_UDP_SESSIONS_RBTREE },
+    { ngx_string("hash"), NGX_UDP_SESSIONS_HASH },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_event_core_commands[] = {
 
     { ngx_string("worker_connections"),
@@ -126,6 +160,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("connection_layout"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      0,
+      offsetof(ngx_event_conf_t, connection_layout),
+      &ngx_event_connection_layouts },
+
     { ngx_string("use"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_use,
@@ -134,10 +175,17 @@ static ngx_command_t  ngx_event_core_commands[] = {
       NULL },
 
     { ngx_string("multi_accept"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      0,
+      offsetof(ngx_event_conf_t, multi_accept),
+      &ngx_event_multi_accept },
+
+    { ngx_string("udp_batch"),
       NGX_EVENT_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
       0,
-      offsetof(ngx_event_conf_t, multi_accept),
+      offsetof(ngx_event_conf_t, udp_batch),
       NULL },
 
     { ngx_string("accept_mutex"),
@@ -154,6 +202,41 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 
+    { ngx_string("read_budget"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_event_conf_t, read_budget),
+      NULL },
+
+    { ngx_string("udp_sessions"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      0,
+      offsetof(ngx_event_conf_t, udp_sessions),
+      &ngx_event_udp_sessions },
+
+    { ngx_string("timer_engine"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_engine),
+      &ngx_event_timer_engines },
+
+    { ngx_string("loop_stats"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_event_loop_stats,
+      0,
+      offsetof(ngx_event_conf_t, loop_stats),
+      NULL },
+
+    { ngx_string("loop_stall_threshold"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_event_conf_t, loop_stall),
+      NULL },
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -196,6 +279,8 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
     ngx_uint_t  flags;
     ngx_msec_t  timer, delta;
 
+    ngx_event_iteration++;
+
     /*
      * NOTE: 如果配置了 timer_resolution 配置项（其值在 ngx_core_conf_t 中）的话，那么
      *       每隔
@@ -242,11 +327,16 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
     }
 
     if (!ngx_queue_empty(&ngx_posted_next_events)) {
-        ngx_queue_add(&ngx_posted_events, &ngx_posted_next_events);
-        ngx_queue_init(&ngx_posted_next_events);
+        ngx_event_move_posted_next(cycle);
         timer = 0;
     }
 
+    ngx_probe1(event_loop_start, timer);
+
+    if (ngx_event_loop_timing) {
+        ngx_event_loop_begin();
+    }
+
     delta = ngx_current_msec;
 
     (void) ngx_process_events(cycle, timer, flags);
@@ -267,6 +357,51 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
     }
 
     ngx_event_process_posted(cycle, &ngx_posted_events);
+
+    if (ngx_event_loop_timing) {
+        ngx_event_loop_end(cycle->log);
+    }
+
+    ngx_probe0(event_loop_end);
+}
+
+
+/*
+ * a connection which has read "read_budget" bytes in this iteration
+ * of the event loop yields to other connections: recv() returns NGX_AGAIN,
+ * and the read event is posted to the next iteration, where it is made
+ * ready again; until then it is not ready, as the handlers read while
+ * the event is ready
+ */
+
+ngx_uint_t
+ngx_event_read_exhausted(ngx_connection_t *c)
+{
+    if (c->budget_iteration != ngx_event_iteration) {
+        c->budget_iteration = ngx_event_iteration;
+        c->budget_used = 0;
+        return 0;
+    }
+
+    if (c->budget_used < ngx_read_budget) {
+        return 0;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "read budget exhausted: fd:%d %uz", c->fd, c->budget_used);
+
+    c->read->ready = 0;
+    c->read->budget_deferred = 1;
+
+    if (c->read->posted) {
+        ngx_delete_posted_event(c->read);
+    }
+
+    ngx_post_event(c->read, &ngx_posted_next_events);
+
+    ngx_event_loop_read_deferred();
+
+    return 1;
 }
 
 
@@ -549,9 +684,13 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
 #endif
 
+    ngx_memzero(&shm, sizeof(ngx_shm_t));
+
     shm.size = size;
     ngx_str_set(&shm.name, "nginx_shared_zone");
     shm.log = cycle->log;
+    shm.huge = NGX_SHM_HUGE_OFF;
+    shm.numa = NGX_SHM_NUMA_DEFAULT;
 
     if (ngx_shm_alloc(&shm) != NGX_OK) {
         return NGX_ERROR;
@@ -624,6 +763,9 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ngx_core_conf_t     *ccf;
     ngx_event_conf_t    *ecf;
     ngx_event_module_t  *module;
+#if (NGX_HAVE_UDP_GRO)
+    int                  gro;
+#endif
 
     ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
     ecf = ngx_event_get_conf(cycle->conf_ctx, ngx_event_core_module);
@@ -652,10 +794,22 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ngx_queue_init(&ngx_posted_next_events);
     ngx_queue_init(&ngx_posted_events);
 
+    ngx_read_budget = ecf->read_budget;
+
+    ngx_event_timer_wheel = (ecf->timer_engine == NGX_EVENT_TIMER_WHEEL);
+
+#if !(NGX_WIN32)
+    ngx_udp_sessions_hash = (ecf->udp_sessions == NGX_UDP_SESSIONS_HASH);
+#endif
+
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
         return NGX_ERROR;
     }
 
+    if (ngx_event_loop_init(cycle) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
     for (m = 0; cycle->modules[m]; m++) {
         if (cycle->modules[m]->type != NGX_EVENT_MODULE) {
             continue;
@@ -731,35 +885,65 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
 #endif
 
-    cycle->connections =
-        ngx_alloc(sizeof(ngx_connection_t) * cycle->connection_n, cycle->log);
-    if (cycle->connections == NULL) {
-        return NGX_ERROR;
-    }
+    if (ecf->connection_layout == NGX_EVENT_CONNECTIONS_PACKED) {
+
+        /*
+         * a connection is followed by its read and write events, and
+         * the connections are aligned to the cache line, so dispatching
+         * an event touches adjacent cache lines only
+         */
 
-    c = cycle->connections;
+        cycle->connection_size = ngx_align(sizeof(ngx_connection_t)
+                                           + 2 * sizeof(ngx_event_t),
+                                           NGX_CPU_CACHE_LINE);
 
-    cycle->read_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                   cycle->log);
-    if (cycle->read_events == NULL) {
-        return NGX_ERROR;
-    }
+        cycle->connections = ngx_memalign(NGX_CPU_CACHE_LINE,
+                                          cycle->connection_size
+                                          * cycle->connection_n,
+                                          cycle->log);
+        if (cycle->connections == NULL) {
+            return NGX_ERROR;
+        }
 
-    rev = cycle->read_events;
-    for (i = 0; i < cycle->connection_n; i++) {
-        rev[i].closed = 1;
-        rev[i].instance = 1;
-    }
+        cycle->read_events = NULL;
+        cycle->write_events = NULL;
 
-    cycle->write_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                    cycle->log);
-    if (cycle->write_events == NULL) {
-        return NGX_ERROR;
-    }
+        for (i = 0; i < cycle->connection_n; i++) {
+            c = ngx_cycle_connection(cycle, i);
 
-    wev = cycle->write_events;
-    for (i = 0; i < cycle->connection_n; i++) {
-        wev[i].closed = 1;
+            c->read = (ngx_event_t *) ((u_char *) c
+                                       + sizeof(ngx_connection_t));
+            c->write = c->read + 1;
+        }
+
+    } else {
+        cycle->connection_size = sizeof(ngx_connection_t);
+
+        cycle->connections =
+            ngx_alloc(sizeof(ngx_connection_t) * cycle->connection_n,
+                      cycle->log);
+        if (cycle->connections == NULL) {
+            return NGX_ERROR;
+        }
+
+        cycle->read_events = ngx_alloc(sizeof(ngx_event_t)
+                                       * cycle->connection_n, cycle->log);
+        if (cycle->read_events == NULL) {
+            return NGX_ERROR;
+        }
+
+        cycle->write_events = ngx_alloc(sizeof(ngx_event_t)
+                                        * cycle->connection_n, cycle->log);
+        if (cycle->write_events == NULL) {
+            return NGX_ERROR;
+        }
+
+        c = cycle->connections;
+
+        for (i = 0; i < cycle->connection_n; i++) {
+            c[i].read = &cycle->read_events[i];
+            c[i].write = &cycle->write_events[i];
+        }
     }
 
     i = cycle->connection_n;
@@ -768,12 +952,19 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     do {
         i--;
 
-        c[i].data = next;
-        c[i].read = &cycle->read_events[i];
-        c[i].write = &cycle->write_events[i];
-        c[i].fd = (ngx_socket_t) -1;
+        c = ngx_cycle_connection(cycle, i);
+
+        rev = c->read;
+        rev->closed = 1;
+        rev->instance = 1;
+
+        wev = c->write;
+        wev->closed = 1;
 
-        next = &c[i];
+        c->data = next;
+        c->fd = (ngx_socket_t) -1;
+
+        next = c;
     } while (i);
 
     cycle->free_connections = next;
@@ -872,6 +1063,24 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         rev->handler = (c->type == SOCK_STREAM) ? ngx_event_accept
                                                 : ngx_event_recvmsg;
 
+#if (NGX_HAVE_UDP_GRO)
+
+        /* a socket inherited on reload may have GRO turned on */
+
+        if (c->type == SOCK_DGRAM && ls[i].sockaddr->sa_family != AF_UNIX) {
+            gro = ecf->udp_batch;
+
+            if (setsockopt(c->fd, SOL_UDP, UDP_GRO, &gro, sizeof(int)) == -1
+                && gro)
+            {
+                ngx_log_error(NGX_LOG_WARN, cycle->log, ngx_socket_errno,
+                              "setsockopt(UDP_GRO) for %V failed, ignored",
+                              &ls[i].addr_text);
+            }
+        }
+
+#endif
+
 #if (NGX_HAVE_REUSEPORT)
 
         if (ls[i].reuseport) {
@@ -1252,6 +1461,27 @@ ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_event_loop_stats(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_event_conf_t  *ecf = conf;
+
+    char  *rv;
+
+    rv = ngx_conf_set_flag_slot(cf, cmd, conf);
+
+    if (rv != NGX_CONF_OK) {
+        return rv;
+    }
+
+    if (ecf->loop_stats && ngx_event_loop_add_zone(cf, ecf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static void *
 ngx_event_core_create_conf(ngx_cycle_t *cycle)
 {
@@ -1263,10 +1493,19 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     }
 
     ecf->connections = NGX_CONF_UNSET_UINT;
+    ecf->connection_layout = NGX_CONF_UNSET_UINT;
     ecf->use = NGX_CONF_UNSET_UINT;
-    ecf->multi_accept = NGX_CONF_UNSET;
+    ecf->multi_accept = NGX_CONF_UNSET_UINT;
     ecf->accept_mutex = NGX_CONF_UNSET;
+    ecf->udp_batch = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->read_budget = NGX_CONF_UNSET_SIZE;
+    ecf->udp_sessions = NGX_CONF_UNSET_UINT;
+    ecf->timer_engine = NGX_CONF_UNSET_UINT;
+    ecf->loop_stats = NGX_CONF_UNSET;
+    ecf->loop_stall = NGX_CONF_UNSET_MSEC;
+    ecf->loop_workers = 0;
+    ecf->loop_counters = NULL;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1359,14 +1598,34 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_uint_value(ecf->connections, DEFAULT_CONNECTIONS);
     cycle->connection_n = ecf->connections;
 
+    ngx_conf_init_uint_value(ecf->connection_layout,
+                             NGX_EVENT_CONNECTIONS_SPLIT);
+
     ngx_conf_init_uint_value(ecf->use, module->ctx_index);
 
     event_module = module->ctx;
     ngx_conf_init_ptr_value(ecf->name, event_module->name->data);
 
-    ngx_conf_init_value(ecf->multi_accept, 0);
+    ngx_conf_init_uint_value(ecf->multi_accept, NGX_EVENT_MULTI_ACCEPT_OFF);
     ngx_conf_init_value(ecf->accept_mutex, 0);
+    ngx_conf_init_value(ecf->udp_batch, 0);
+
+#if !(NGX_HAVE_SENDMMSG)
+
+    if (ecf->udp_batch) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"udp_batch\" is not supported "
+                      "on this platform, ignored");
+        ecf->udp_batch = 0;
+    }
+
+#endif
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_size_value(ecf->read_budget, 0);
+    ngx_conf_init_uint_value(ecf->udp_sessions, NGX_UDP_SESSIONS_RBTREE);
+    ngx_conf_init_uint_value(ecf->timer_engine, NGX_EVENT_TIMER_RBTREE);
+    ngx_conf_init_value(ecf->loop_stats, 0);
+    ngx_conf_init_msec_value(ecf->loop_stall, 0);
 
     return NGX_CONF_OK;
 }
@@ -76,6 +76,9 @@ struct ngx_event_s {
 
     unsigned         cancelable:1;
 
+    /* reading was put off to the next iteration by "read_budget" */
+    unsigned         budget_deferred:1;
+
 #if (NGX_HAVE_KQUEUE)
     unsigned         kq_vnode:1;
 
@@ -430,15 +433,38 @@ extern ngx_os_io_t  ngx_io;
 #define NGX_EVENT_CONF        0x02000000
 
 
+#define NGX_EVENT_MULTI_ACCEPT_OFF   0
+#define NGX_EVENT_MULTI_ACCEPT_ON    1
+#define NGX_EVENT_MULTI_ACCEPT_AUTO  2
+
+/* the largest number of connections accepted at once by "multi_accept auto" */
+#define NGX_EVENT_ACCEPT_BATCH       64
+
+#define NGX_EVENT_CONNECTIONS_SPLIT   0
+#define NGX_EVENT_CONNECTIONS_PACKED  1
+
+
 typedef struct {
     ngx_uint_t    connections;
+    ngx_uint_t    connection_layout;
     ngx_uint_t    use;
 
-    ngx_flag_t    multi_accept;
+    ngx_uint_t    multi_accept;
     ngx_flag_t    accept_mutex;
+    ngx_flag_t    udp_batch;
+    ngx_uint_t    udp_sessions;
 
     ngx_msec_t    accept_mutex_delay;
 
+    size_t        read_budget;
+
+    ngx_uint_t    timer_engine;
+
+    ngx_flag_t    loop_stats;
+    ngx_msec_t    loop_stall;
+    ngx_uint_t    loop_workers;
+    u_char       *loop_counters;
+
     u_char       *name;
 
 #if (NGX_DEBUG)
@@ -467,6 +493,9 @@ extern ngx_uint_t             ngx_accept_mutex_held;
 extern ngx_msec_t             ngx_accept_mutex_delay;
 extern ngx_int_t              ngx_accept_disabled;
 
+extern size_t                 ngx_read_budget;
+extern ngx_uint_t             ngx_event_iteration;
+
 
 #if (NGX_STAT_STUB)
 
@@ -504,12 +533,45 @@ extern ngx_module_t           ngx_event_core_module;
 void ngx_event_accept(ngx_event_t *ev);
 #if !(NGX_WIN32)
 void ngx_event_recvmsg(ngx_event_t *ev);
+#if (NGX_HAVE_SENDMMSG)
+
+/* datagrams received or sent by a single call with "udp_batch" */
+#define NGX_UDP_BATCH        16
+
+/* room for a destination address and a GRO or GSO segment size */
+#define NGX_UDP_CONTROL_LEN                                                   \
+    (CMSG_SPACE(sizeof(struct in6_pktinfo)) + CMSG_SPACE(sizeof(int)))
+
+#endif
+
+#define NGX_UDP_SESSIONS_RBTREE  0
+#define NGX_UDP_SESSIONS_HASH    1
+
+extern ngx_uint_t             ngx_udp_sessions_hash;
+
+
+struct ngx_udp_connection_s {
+    ngx_rbtree_node_t   node;
+    ngx_connection_t   *connection;
+    ngx_buf_t          *buffer;
+#if (NGX_QUIC)
+    ngx_str_t           key;
+#endif
+};
+
+
 void ngx_udp_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+#if (NGX_QUIC)
+ngx_int_t ngx_insert_udp_connection_id(ngx_connection_t *c, ngx_str_t *id);
+#endif
 #endif
 void ngx_delete_udp_connection(void *data);
 ngx_int_t ngx_trylock_accept_mutex(ngx_cycle_t *cycle);
 ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle);
+ngx_int_t ngx_event_accept_queue(ngx_listening_t *ls, ngx_uint_t *queue,
+    ngx_uint_t *backlog);
+ngx_int_t ngx_event_listen_overflows(uint64_t *overflows, uint64_t *drops);
 u_char *ngx_accept_log_error(ngx_log_t *log, u_char *buf, size_t len);
 #if (NGX_DEBUG)
 void ngx_debug_accepted_connection(ngx_event_conf_t *ecf, ngx_connection_t *c);
@@ -518,6 +580,7 @@ void ngx_debug_accepted_connection(ngx_event_conf_t *ecf, ngx_connection_t *c);
 
 void ngx_process_events_and_timers(ngx_cycle_t *cycle);
 ngx_int_t ngx_handle_read_event(ngx_event_t *rev, ngx_uint_t flags);
+ngx_uint_t ngx_event_read_exhausted(ngx_connection_t *c);
 ngx_int_t ngx_handle_write_event(ngx_event_t *wev, size_t lowat);
 
 
@@ -537,6 +600,11 @@ ngx_int_t ngx_send_lowat(ngx_connection_t *c, size_t lowat);
 
 #include <ngx_event_timer.h>
 #include <ngx_event_posted.h>
+#include <ngx_event_loop.h>
+
+#if (NGX_QUIC)
+#include <ngx_event_quic.h>
+#endif
 
 #if (NGX_WIN32)
 #include <ngx_iocp_module.h>
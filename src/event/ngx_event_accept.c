@@ -11,6 +11,7 @@
 
 
 static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle, ngx_uint_t all);
+static ngx_uint_t ngx_event_accept_batch(ngx_cycle_t *cycle);
 static void ngx_close_accepted_connection(ngx_connection_t *c);
 
 
@@ -21,6 +22,7 @@ ngx_event_accept(ngx_event_t *ev)
     ngx_err_t          err;
     ngx_log_t         *log;
     ngx_uint_t         level;
+    ngx_uint_t         batch, limited;
     ngx_socket_t       s;
     ngx_event_t       *rev, *wev;
     ngx_sockaddr_t     sa;
@@ -41,7 +43,22 @@ ngx_event_accept(ngx_event_t *ev)
 
     ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
 
-    if (!(ngx_event_flags & NGX_USE_KQUEUE_EVENT)) {
+    batch = 0;
+    limited = 0;
+
+    if (ecf->multi_accept == NGX_EVENT_MULTI_ACCEPT_AUTO) {
+        batch = ngx_event_accept_batch((ngx_cycle_t *) ngx_cycle);
+
+        /* kqueue reports the number of pending connections */
+
+        if (!(ngx_event_flags & NGX_USE_KQUEUE_EVENT)
+            || ev->available > (int) batch)
+        {
+            ev->available = batch;
+            limited = 1;
+        }
+
+    } else if (!(ngx_event_flags & NGX_USE_KQUEUE_EVENT)) {
         ev->available = ecf->multi_accept;
     }
 
@@ -97,7 +114,7 @@ ngx_event_accept(ngx_event_t *ev)
 #endif
 
             if (err == NGX_ECONNABORTED) {
-                if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+                if ((ngx_event_flags & NGX_USE_KQUEUE_EVENT) || batch) {
                     ev->available--;
                 }
 
@@ -133,6 +150,10 @@ ngx_event_accept(ngx_event_t *ev)
         (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
 #endif
 
+        if (ngx_event_loop_timing) {
+            ngx_event_loop_accepted();
+        }
+
         ngx_accept_disabled = ngx_cycle->connection_n / 8
                               - ngx_cycle->free_connection_n;
 
@@ -307,11 +328,173 @@ ngx_event_accept(ngx_event_t *ev)
 
         ls->handler(c);
 
-        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+        if ((ngx_event_flags & NGX_USE_KQUEUE_EVENT) || batch) {
             ev->available--;
         }
 
     } while (ev->available);
+
+    if (limited) {
+        /* the rest of the queue is left to the next iteration */
+        ngx_event_loop_accept_limited();
+    }
+}
+
+
+static ngx_uint_t
+ngx_event_accept_batch(ngx_cycle_t *cycle)
+{
+    uint64_t    busy;
+    ngx_int_t   room;
+    ngx_uint_t  batch;
+
+    /*
+     * the batch is halved for each doubling of the average busy time
+     * of event loop iterations above 1ms, so a loaded worker accepts
+     * less and leaves connections to other workers, and it is limited
+     * by free connections above the reserve of ngx_accept_disabled
+     */
+
+    batch = NGX_EVENT_ACCEPT_BATCH;
+
+    for (busy = ngx_event_loop_busy; busy >= 1000 && batch > 1; busy /= 2) {
+        batch /= 2;
+    }
+
+    room = cycle->free_connection_n - cycle->connection_n / 8;
+
+    if (room < (ngx_int_t) batch) {
+        batch = (room > 1) ? room : 1;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "accept batch: %ui, busy: %uLus",
+                   batch, ngx_event_loop_busy);
+
+    return batch;
+}
+
+
+ngx_int_t
+ngx_event_accept_queue(ngx_listening_t *ls, ngx_uint_t *queue,
+    ngx_uint_t *backlog)
+{
+#if (NGX_HAVE_TCP_INFO) && (NGX_LINUX)
+    socklen_t        len;
+    struct tcp_info  ti;
+
+    if (ls->type != SOCK_STREAM || ls->fd == (ngx_socket_t) -1
+        || ls->sockaddr->sa_family == AF_UNIX)
+    {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * on listening sockets Linux reports the length of the accept queue
+     * in tcpi_unacked, and its limit in tcpi_sacked
+     */
+
+    len = sizeof(struct tcp_info);
+
+    if (getsockopt(ls->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1) {
+        return NGX_ERROR;
+    }
+
+    *queue = ti.tcpi_unacked;
+    *backlog = ti.tcpi_sacked;
+
+    return NGX_OK;
+
+#else
+
+    return NGX_DECLINED;
+
+#endif
+}
+
+
+ngx_int_t
+ngx_event_listen_overflows(uint64_t *overflows, uint64_t *drops)
+{
+#if (NGX_LINUX)
+    off_t       value;
+    u_char     *p, *q, *names, *values, *n, *v;
+    ssize_t     size;
+    ngx_fd_t    fd;
+    ngx_uint_t  found;
+    u_char      buf[8192];
+
+    /* the counters are kept by the network namespace, not by sockets */
+
+    fd = ngx_open_file("/proc/net/netstat", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        return NGX_ERROR;
+    }
+
+    size = ngx_read_fd(fd, buf, sizeof(buf) - 1);
+
+    (void) ngx_close_file(fd);
+
+    if (size <= 0) {
+        return NGX_ERROR;
+    }
+
+    buf[size] = '\0';
+
+    /* "TcpExt:" lines come in pairs of names and values */
+
+    names = (u_char *) ngx_strstr(buf, "TcpExt: ");
+    if (names == NULL) {
+        return NGX_ERROR;
+    }
+
+    values = (u_char *) ngx_strstr(names + 8, "TcpExt: ");
+    if (values == NULL) {
+        return NGX_ERROR;
+    }
+
+    found = 0;
+
+    n = names + 8;
+    v = values + 8;
+
+    while (*n != LF && *n != '\0' && *v != LF && *v != '\0') {
+
+        for (p = n; *p != ' ' && *p != LF && *p != '\0'; p++) {
+            /* void */
+        }
+
+        for (q = v; *q != ' ' && *q != LF && *q != '\0'; q++) {
+            /* void */
+        }
+
+        value = ngx_atoof(v, q - v);
+
+        if (value != NGX_ERROR) {
+
+            if (p - n == 15 && ngx_strncmp(n, "ListenOverflows", 15) == 0) {
+                *overflows = value;
+                found++;
+
+            } else if (p - n == 11 && ngx_strncmp(n, "ListenDrops", 11) == 0)
+            {
+                *drops = value;
+                found++;
+            }
+        }
+
+        n = (*p == ' ') ? p + 1 : p;
+        v = (*q == ' ') ? q + 1 : q;
+    }
+
+    return (found == 2) ? NGX_OK : NGX_ERROR;
+
+#else
+
+    return NGX_DECLINED;
+
+#endif
 }
 
 
@@ -0,0 +1,436 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+#define ngx_event_loop_stride                                                 \
+    ngx_align(sizeof(ngx_event_loop_stat_t), NGX_CPU_CACHE_LINE)
+
+
+static ngx_int_t ngx_event_loop_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void ngx_event_loop_slow(ngx_event_handler_pt handler, uint64_t time);
+
+
+ngx_uint_t                     ngx_event_loop_timing;
+
+/* the moving average of busy time of iterations, usec */
+uint64_t                       ngx_event_loop_busy;
+
+static ngx_msec_t              ngx_event_loop_stall;
+static ngx_event_loop_stat_t   ngx_event_loop_local;
+static ngx_event_loop_stat_t  *ngx_event_loop_current;
+
+/* the current iteration */
+
+static uint64_t                ngx_event_loop_start;
+static uint64_t                ngx_event_loop_woke;
+static ngx_uint_t              ngx_event_loop_events;
+static ngx_event_handler_pt    ngx_event_loop_slowest;
+static uint64_t                ngx_event_loop_slowest_time;
+
+
+ngx_int_t
+ngx_event_loop_add_zone(ngx_conf_t *cf, ngx_event_conf_t *ecf)
+{
+    size_t            size;
+    ngx_str_t         name;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_core_conf_t  *ccf;
+
+    /*
+     * "worker_processes" usually precedes "events", if it does not,
+     * a slot per CPU is allocated and the rest of workers are not counted
+     */
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    if (ccf->worker_processes != NGX_CONF_UNSET) {
+        ecf->loop_workers = ngx_max(ccf->worker_processes, 1);
+
+    } else {
+        ecf->loop_workers = ngx_max(ngx_ncpu, 1);
+    }
+
+    size = ecf->loop_workers * ngx_event_loop_stride + 8 * ngx_pagesize;
+
+    ngx_str_set(&name, "event_loop");
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, &ngx_event_core_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* old workers keep writing to their zone until they exit */
+
+    shm_zone->noreuse = 1;
+    shm_zone->init = ngx_event_loop_init_zone;
+    shm_zone->data = ecf;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_event_loop_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_event_conf_t  *ecf = shm_zone->data;
+
+    size_t            size;
+    ngx_slab_pool_t  *shpool;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    size = ecf->loop_workers * ngx_event_loop_stride;
+
+    /* large slab allocations are page aligned */
+
+    ecf->loop_counters = ngx_slab_calloc(shpool, ngx_max(size, ngx_pagesize));
+    if (ecf->loop_counters == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "could not allocate event loop statistics");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_event_loop_init(ngx_cycle_t *cycle)
+{
+    ngx_event_conf_t  *ecf;
+
+    ecf = ngx_event_get_conf(cycle->conf_ctx, ngx_event_core_module);
+
+    ngx_event_loop_stall = ecf->loop_stall;
+    ngx_event_loop_timing = (ecf->loop_stats || ecf->loop_stall
+                             || ecf->multi_accept
+                                == NGX_EVENT_MULTI_ACCEPT_AUTO);
+
+    if (!ngx_event_loop_timing) {
+        return NGX_OK;
+    }
+
+    ngx_event_loop_current = &ngx_event_loop_local;
+
+    if (ecf->loop_counters
+        && (ngx_process == NGX_PROCESS_WORKER
+            || ngx_process == NGX_PROCESS_SINGLE))
+    {
+        if (ngx_worker < ecf->loop_workers) {
+            ngx_event_loop_current = ngx_event_loop_stat(cycle, ngx_worker);
+
+        } else {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                          "event loop statistics are only collected for "
+                          "%ui worker processes, \"worker_processes\" "
+                          "should be specified before \"events\"",
+                          ecf->loop_workers);
+        }
+    }
+
+    ngx_event_loop_current->pid = ngx_pid;
+
+    /* the gauges of a previous worker in the slot are stale */
+
+    ngx_event_loop_current->idle = 0;
+    ngx_event_loop_current->idle_memory = 0;
+    ngx_event_loop_current->parked = 0;
+    ngx_event_loop_current->parked_memory = 0;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_event_loop_begin(void)
+{
+    ngx_event_loop_start = ngx_event_loop_now();
+    ngx_event_loop_woke = 0;
+    ngx_event_loop_events = 0;
+    ngx_event_loop_slowest = NULL;
+    ngx_event_loop_slowest_time = 0;
+}
+
+
+void
+ngx_event_loop_end(ngx_log_t *log)
+{
+    uint64_t                now, busy, bound;
+    ngx_uint_t              i;
+    ngx_event_loop_stat_t  *st;
+
+    now = ngx_event_loop_now();
+
+    if (ngx_event_loop_woke == 0) {
+        ngx_event_loop_woke = now;
+    }
+
+    /*
+     * the time up to the first handler call is spent waiting for events,
+     * and the rest in handlers and the loop itself
+     */
+
+    busy = now - ngx_event_loop_woke;
+
+    ngx_event_loop_busy = (ngx_event_loop_busy * 7 + busy) / 8;
+
+    st = ngx_event_loop_current;
+
+    st->iterations++;
+    st->events += ngx_event_loop_events;
+    st->wait += ngx_event_loop_woke - ngx_event_loop_start;
+    st->busy += busy;
+
+    if (st->max_events < ngx_event_loop_events) {
+        st->max_events = ngx_event_loop_events;
+    }
+
+    if (st->max < busy) {
+        st->max = busy;
+    }
+
+    bound = 1000;
+
+    for (i = 0; i < NGX_EVENT_LOOP_BUCKETS - 1; i++) {
+        if (busy < bound) {
+            break;
+        }
+
+        bound *= 4;
+    }
+
+    st->histogram[i]++;
+
+    if (ngx_event_loop_stall
+        && busy >= (uint64_t) ngx_event_loop_stall * 1000)
+    {
+        st->stalls++;
+
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "event loop stalled for %uLms: %ui events, "
+                      "slowest handler %p took %uLms",
+                      busy / 1000, ngx_event_loop_events,
+                      ngx_event_loop_slowest,
+                      ngx_event_loop_slowest_time / 1000);
+    }
+}
+
+
+void
+ngx_event_loop_call(ngx_event_t *ev)
+{
+    uint64_t              start, time;
+    ngx_event_handler_pt  handler;
+
+    /* the event may be freed by its handler */
+
+    handler = ev->handler;
+
+    start = ngx_event_loop_now();
+
+    if (ngx_event_loop_woke == 0) {
+        ngx_event_loop_woke = start;
+    }
+
+    handler(ev);
+
+    time = ngx_event_loop_now() - start;
+
+    ngx_event_loop_events++;
+
+    if (time > ngx_event_loop_slowest_time) {
+        ngx_event_loop_slowest = handler;
+        ngx_event_loop_slowest_time = time;
+    }
+
+    if (time >= NGX_EVENT_LOOP_SLOW) {
+        ngx_event_loop_slow(handler, time);
+    }
+}
+
+
+static void
+ngx_event_loop_slow(ngx_event_handler_pt handler, uint64_t time)
+{
+    ngx_uint_t                 i, n;
+    ngx_event_loop_handler_t  *h;
+
+    h = ngx_event_loop_current->handlers;
+    n = 0;
+
+    for (i = 0; i < NGX_EVENT_LOOP_HANDLERS; i++) {
+
+        if (h[i].handler == handler) {
+            break;
+        }
+
+        if (h[i].max < h[n].max) {
+            n = i;
+        }
+    }
+
+    if (i == NGX_EVENT_LOOP_HANDLERS) {
+
+        /* replace the handler with the smallest maximum, if any */
+
+        if (h[n].handler && h[n].max >= time) {
+            return;
+        }
+
+        i = n;
+
+        h[i].handler = handler;
+        h[i].calls = 0;
+        h[i].time = 0;
+        h[i].max = 0;
+    }
+
+    h[i].calls++;
+    h[i].time += time;
+
+    if (h[i].max < time) {
+        h[i].max = time;
+    }
+}
+
+
+void
+ngx_event_loop_accepted(void)
+{
+    ngx_event_loop_current->accepted++;
+}
+
+
+void
+ngx_event_loop_accept_limited(void)
+{
+    ngx_event_loop_current->accept_limited++;
+}
+
+
+void
+ngx_event_loop_read_deferred(void)
+{
+    ngx_event_loop_current->read_deferred++;
+}
+
+
+void
+ngx_event_loop_udp(ngx_uint_t send, ngx_uint_t calls, ngx_uint_t n)
+{
+    if (send) {
+        ngx_event_loop_current->udp_send_calls += calls;
+        ngx_event_loop_current->udp_sent += n;
+
+    } else {
+        ngx_event_loop_current->udp_recv_calls += calls;
+        ngx_event_loop_current->udp_received += n;
+    }
+}
+
+
+void
+ngx_event_loop_idle(ngx_uint_t parked, ngx_int_t n, ssize_t size)
+{
+    if (parked) {
+        ngx_event_loop_current->parked += n;
+        ngx_event_loop_current->parked_memory += size;
+
+    } else {
+        ngx_event_loop_current->idle += n;
+        ngx_event_loop_current->idle_memory += size;
+    }
+}
+
+
+void
+ngx_event_loop_prefetch(off_t prefetched, off_t used, off_t wasted)
+{
+    ngx_event_loop_current->prefetched += prefetched;
+    ngx_event_loop_current->prefetch_used += used;
+    ngx_event_loop_current->prefetch_wasted += wasted;
+}
+
+
+void
+ngx_event_loop_ssl_handshake(ngx_uint_t resumed, uint64_t time)
+{
+    if (resumed) {
+        ngx_event_loop_current->ssl_resumed++;
+        ngx_event_loop_current->ssl_resumed_time += time;
+
+    } else {
+        ngx_event_loop_current->ssl_handshakes++;
+        ngx_event_loop_current->ssl_handshake_time += time;
+    }
+}
+
+
+void
+ngx_event_loop_ssl_limited(ngx_uint_t rejected)
+{
+    if (rejected) {
+        ngx_event_loop_current->ssl_rejected++;
+
+    } else {
+        ngx_event_loop_current->ssl_queued++;
+    }
+}
+
+
+void
+ngx_event_loop_spin(ngx_uint_t hit, uint64_t time)
+{
+    ngx_event_loop_current->spins++;
+    ngx_event_loop_current->spin_hits += hit;
+    ngx_event_loop_current->spin_time += time;
+}
+
+
+ngx_event_loop_stat_t *
+ngx_event_loop_stat(ngx_cycle_t *cycle, ngx_uint_t n)
+{
+    ngx_event_conf_t  *ecf;
+
+    if (ngx_get_conf(cycle->conf_ctx, ngx_events_module) == NULL) {
+        return NULL;
+    }
+
+    ecf = ngx_event_get_conf(cycle->conf_ctx, ngx_event_core_module);
+
+    if (ecf->loop_counters == NULL || n >= ecf->loop_workers) {
+        return NULL;
+    }
+
+    return (ngx_event_loop_stat_t *)
+               (ecf->loop_counters + n * ngx_event_loop_stride);
+}
+
+
+uint64_t
+ngx_event_loop_now(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
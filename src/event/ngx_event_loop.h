@@ -0,0 +1,117 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_LOOP_H_INCLUDED_
+#define _NGX_EVENT_LOOP_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+#define NGX_EVENT_LOOP_HANDLERS  8
+#define NGX_EVENT_LOOP_BUCKETS   7
+
+/* handler calls that took at least this long are recorded, usec */
+#define NGX_EVENT_LOOP_SLOW      1000
+
+
+typedef struct {
+    ngx_event_handler_pt      handler;
+    uint64_t                  calls;
+    uint64_t                  time;
+    uint64_t                  max;
+} ngx_event_loop_handler_t;
+
+
+/* all times are in microseconds */
+
+typedef struct {
+    ngx_pid_t                 pid;
+    uint64_t                  iterations;
+    uint64_t                  events;
+    uint64_t                  max_events;
+    uint64_t                  wait;
+    uint64_t                  busy;
+    uint64_t                  max;
+    uint64_t                  stalls;
+
+    /* connections accepted, shows the balance of "reuseport" sockets */
+    uint64_t                  accepted;
+
+    /* accept batches of "multi_accept auto" which were cut short */
+    uint64_t                  accept_limited;
+
+    /* reads put off to the next iteration by "read_budget" */
+    uint64_t                  read_deferred;
+
+    /* datagrams per call are received / calls, and sent / send_calls */
+    uint64_t                  udp_recv_calls;
+    uint64_t                  udp_received;
+    uint64_t                  udp_send_calls;
+    uint64_t                  udp_sent;
+
+    /* idle keepalive connections kept with their pools, and parked ones */
+    uint64_t                  idle;
+    uint64_t                  idle_memory;
+    uint64_t                  parked;
+    uint64_t                  parked_memory;
+
+    /* bytes of files prefetched, then read from the prefetched ranges */
+    uint64_t                  prefetched;
+    uint64_t                  prefetch_used;
+    uint64_t                  prefetch_wasted;
+
+    /* SSL handshakes of clients, full and resumed, and the time in them */
+    uint64_t                  ssl_handshakes;
+    uint64_t                  ssl_handshake_time;
+    uint64_t                  ssl_resumed;
+    uint64_t                  ssl_resumed_time;
+
+    /* full handshakes queued and rejected by "ssl_handshake_limit" */
+    uint64_t                  ssl_queued;
+    uint64_t                  ssl_rejected;
+
+    /* spins of "epoll_spin", ones which found events, and the time spent */
+    uint64_t                  spins;
+    uint64_t                  spin_hits;
+    uint64_t                  spin_time;
+
+    /* busy time per iteration: under 1, 4, 16, 64, 256, 1024 ms and more */
+    uint64_t                  histogram[NGX_EVENT_LOOP_BUCKETS];
+
+    ngx_event_loop_handler_t  handlers[NGX_EVENT_LOOP_HANDLERS];
+} ngx_event_loop_stat_t;
+
+
+#define ngx_event_call(ev)                                                    \
+    (ngx_event_loop_timing ? ngx_event_loop_call(ev) : (ev)->handler(ev))
+
+
+ngx_int_t ngx_event_loop_add_zone(ngx_conf_t *cf, ngx_event_conf_t *ecf);
+ngx_int_t ngx_event_loop_init(ngx_cycle_t *cycle);
+void ngx_event_loop_begin(void);
+void ngx_event_loop_end(ngx_log_t *log);
+void ngx_event_loop_call(ngx_event_t *ev);
+void ngx_event_loop_accepted(void);
+void ngx_event_loop_accept_limited(void);
+void ngx_event_loop_read_deferred(void);
+void ngx_event_loop_udp(ngx_uint_t send, ngx_uint_t calls, ngx_uint_t n);
+void ngx_event_loop_idle(ngx_uint_t parked, ngx_int_t n, ssize_t size);
+void ngx_event_loop_prefetch(off_t prefetched, off_t used, off_t wasted);
+void ngx_event_loop_ssl_handshake(ngx_uint_t resumed, uint64_t time);
+void ngx_event_loop_ssl_limited(ngx_uint_t rejected);
+void ngx_event_loop_spin(ngx_uint_t hit, uint64_t time);
+uint64_t ngx_event_loop_now(void);
+ngx_event_loop_stat_t *ngx_event_loop_stat(ngx_cycle_t *cycle, ngx_uint_t n);
+
+
+extern ngx_uint_t  ngx_event_loop_timing;
+extern uint64_t    ngx_event_loop_busy;
+
+
+#endif /* _NGX_EVENT_LOOP_H_INCLUDED_ */
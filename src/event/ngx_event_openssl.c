@@ -8,16 +8,94 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
 
 
 #define NGX_SSL_PASSWORD_BUFFER_SIZE  4096
 
 
+/*
+ * the key offload uses RSA and EC key methods, which are deprecated
+ * in OpenSSL 3.0 and not used with providers
+ */
+
+#if (defined SSL_MODE_ASYNC && NGX_THREADS                                   \
+     && OPENSSL_VERSION_NUMBER < 0x30000000L)
+#define NGX_SSL_ASYNC_KEYS  1
+#endif
+
+
+#if (NGX_SSL_ASYNC_KEYS)
+
+#define NGX_SSL_ASYNC_RSA_ENC  0
+#define NGX_SSL_ASYNC_RSA_DEC  1
+#define NGX_SSL_ASYNC_ECDSA    2
+
+
+typedef struct {
+    int                     fd[2];
+    ngx_thread_task_t      *task;
+    unsigned                orphan:1;
+} ngx_ssl_async_wait_t;
+
+
+typedef struct {
+    ngx_uint_t              type;
+    int                     rc;
+    int                     padding;
+    RSA                    *rsa;
+#ifndef OPENSSL_NO_EC
+    EC_KEY                 *ec;
+#endif
+    u_char                 *in;
+    int                     inlen;
+    u_char                 *out;
+    unsigned int            outlen;
+    ngx_ssl_async_wait_t   *wait;
+    unsigned                done:1;
+    unsigned                abandoned:1;
+} ngx_ssl_async_op_t;
+
+#endif
+
+
 typedef struct {
     ngx_uint_t  engine;   /* unsigned  engine:1; */
 } ngx_openssl_conf_t;
 
 
+typedef struct {
+    ngx_str_node_t          sn;
+    ngx_queue_t             queue;
+
+    X509                   *x509;
+    STACK_OF(X509)         *chain;
+    EVP_PKEY               *pkey;
+
+    time_t                  validated;
+    time_t                  accessed;
+
+    time_t                  cert_mtime;
+    time_t                  key_mtime;
+    ngx_file_uniq_t         cert_uniq;
+    ngx_file_uniq_t         key_uniq;
+} ngx_ssl_cache_node_t;
+
+
+static ngx_int_t ngx_ssl_use_certificate(ngx_connection_t *c,
+    ngx_str_t *cert, ngx_str_t *key, X509 *x509, STACK_OF(X509) *chain,
+    EVP_PKEY *pkey);
+static ngx_ssl_cache_node_t *ngx_ssl_cache_fetch(ngx_connection_t *c,
+    ngx_pool_t *pool, ngx_ssl_cache_t *cache, ngx_str_t *cert, ngx_str_t *key,
+    ngx_array_t *passwords);
+static void ngx_ssl_cache_file_info(ngx_pool_t *pool, ngx_str_t *name,
+    time_t *mtime, ngx_file_uniq_t *uniq);
+static void ngx_ssl_cache_expire(ngx_ssl_cache_t *cache, ngx_uint_t n);
+static void ngx_ssl_cache_free_node(ngx_ssl_cache_t *cache,
+    ngx_ssl_cache_node_t *node);
+static void ngx_ssl_cache_cleanup(void *data);
 static X509 *ngx_ssl_load_certificate(ngx_pool_t *pool, char **err,
     ngx_str_t *cert, STACK_OF(X509) **chain);
 static EVP_PKEY *ngx_ssl_load_certificate_key(ngx_pool_t *pool, char **err,
@@ -37,6 +115,21 @@ static ngx_int_t ngx_ssl_try_early_data(ngx_connection_t *c);
 static void ngx_ssl_handshake_log(ngx_connection_t *c);
 #endif
 static void ngx_ssl_handshake_handler(ngx_event_t *ev);
+static void ngx_ssl_handshake_account(ngx_connection_t *c);
+#ifdef SSL_CLIENT_HELLO_SUCCESS
+static int ngx_ssl_client_hello_limit(ngx_ssl_conn_t *ssl_conn, int *al,
+    void *arg);
+static ngx_uint_t ngx_ssl_client_hello_resumption(ngx_ssl_conn_t *ssl_conn);
+static void ngx_ssl_handshake_limit_update(ngx_ssl_handshake_limit_t *limit);
+static void ngx_ssl_handshake_limit_timer(ngx_ssl_handshake_limit_t *limit);
+static void ngx_ssl_handshake_limit_handler(ngx_event_t *ev);
+static void ngx_ssl_handshake_wait_cleanup(void *data);
+#endif
+#ifdef SSL_MODE_ASYNC
+static ngx_int_t ngx_ssl_async_wait(ngx_connection_t *c);
+static void ngx_ssl_async_handler(ngx_event_t *ev);
+static void ngx_ssl_async_close(ngx_connection_t *c);
+#endif
 #ifdef SSL_READ_EARLY_DATA_SUCCESS
 static ssize_t ngx_ssl_recv_early(ngx_connection_t *c, u_char *buf,
     size_t size);
@@ -48,11 +141,46 @@ static void ngx_ssl_next_read_handler(ngx_event_t *rev);
 static ssize_t ngx_ssl_write_early(ngx_connection_t *c, u_char *data,
     size_t size);
 #endif
+static ssize_t ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file,
+    size_t size);
+static void ngx_ssl_sendfile_update(ngx_buf_t *file, ssize_t n);
+static size_t ngx_ssl_record_size(ngx_connection_t *c);
+static void ngx_ssl_record_sent(ngx_connection_t *c, ssize_t n);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
 static void ngx_ssl_shutdown_handler(ngx_event_t *ev);
 static void ngx_ssl_connection_error(ngx_connection_t *c, int sslerr,
     ngx_err_t err, char *text);
-static void ngx_ssl_clear_error(ngx_log_t *log);
+
+#if (NGX_SSL_ASYNC_KEYS)
+static ngx_int_t ngx_ssl_async_keys(ngx_ssl_t *ssl, ngx_thread_pool_t *tp);
+static ngx_int_t ngx_ssl_async_methods(ngx_log_t *log);
+static int ngx_ssl_async_rsa_priv_enc(int flen, const unsigned char *from,
+    unsigned char *to, RSA *rsa, int padding);
+static int ngx_ssl_async_rsa_priv_dec(int flen, const unsigned char *from,
+    unsigned char *to, RSA *rsa, int padding);
+static int ngx_ssl_async_rsa(ngx_uint_t type, int flen,
+    const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+static int ngx_ssl_async_rsa_op(ngx_uint_t type, int flen,
+    const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+#ifndef OPENSSL_NO_EC
+static int ngx_ssl_async_ec_sign(int type, const unsigned char *dgst,
+    int dlen, unsigned char *sig, unsigned int *siglen, const BIGNUM *kinv,
+    const BIGNUM *r, EC_KEY *eckey);
+static int ngx_ssl_async_ec_op(int type, const unsigned char *dgst,
+    int dlen, unsigned char *sig, unsigned int *siglen, const BIGNUM *kinv,
+    const BIGNUM *r, EC_KEY *eckey);
+#endif
+static ngx_thread_task_t *ngx_ssl_async_task(ngx_uint_t type, int inlen,
+    int outlen);
+static ngx_int_t ngx_ssl_async_run(ngx_thread_pool_t *tp,
+    ngx_thread_task_t *task);
+static void ngx_ssl_async_thread_handler(void *data, ngx_log_t *log);
+static void ngx_ssl_async_event_handler(ngx_event_t *ev);
+static void ngx_ssl_async_wait_cleanup(ASYNC_WAIT_CTX *ctx, const void *key,
+    OSSL_ASYNC_FD fd, void *custom);
+static void ngx_ssl_async_wait_close(ngx_ssl_async_wait_t *wait);
+static void ngx_ssl_async_free(ngx_thread_task_t *task);
+#endif
 
 static ngx_int_t ngx_ssl_session_id_context(ngx_ssl_t *ssl,
     ngx_str_t *sess_ctx, ngx_array_t *certificates);
@@ -64,8 +192,12 @@ static ngx_ssl_session_t *ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 #endif
     u_char *id, int len, int *copy);
 static void ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
+static void ngx_ssl_session_shard_init(ngx_ssl_session_shard_t *shard,
+    ngx_slab_pool_t *shpool);
+static ngx_ssl_session_shard_t *ngx_ssl_session_shard_lock(
+    ngx_ssl_session_cache_t *cache, uint32_t hash);
 static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n);
+    ngx_ssl_session_shard_t *shard, ngx_uint_t n);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
@@ -74,6 +206,17 @@ static int ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc);
 static void ngx_ssl_session_ticket_keys_cleanup(void *data);
+static ngx_int_t ngx_ssl_session_ticket_keys_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_ssl_session_ticket_keys_read(
+    ngx_ssl_session_ticket_keys_t *ctx, ngx_log_t *log);
+static ngx_int_t ngx_ssl_session_ticket_keys_rotate(
+    ngx_ssl_session_ticket_keys_t *ctx, ngx_log_t *log);
+static ngx_uint_t ngx_ssl_session_ticket_keys_install(
+    ngx_ssl_session_ticket_keys_t *ctx, ngx_ssl_session_ticket_key_t *keys,
+    ngx_uint_t n);
+static void ngx_ssl_session_ticket_keys_update(
+    ngx_ssl_session_ticket_keys_t *ctx, ngx_log_t *log);
 #endif
 
 #ifndef X509_CHECK_FLAG_ALWAYS_CHECK_SUBJECT
@@ -131,12 +274,40 @@ int  ngx_ssl_connection_index;
 int  ngx_ssl_server_conf_index;
 int  ngx_ssl_session_cache_index;
 int  ngx_ssl_session_ticket_keys_index;
+int  ngx_ssl_session_ticket_keys_zone_index;
 int  ngx_ssl_certificate_index;
 int  ngx_ssl_next_certificate_index;
 int  ngx_ssl_certificate_name_index;
 int  ngx_ssl_stapling_index;
 
 
+#ifdef SSL_CLIENT_HELLO_SUCCESS
+
+typedef struct {
+    ngx_queue_t                 queue;
+    ngx_connection_t           *connection;
+    ngx_ssl_handshake_limit_t  *limit;
+    ngx_uint_t                  queued;     /* unsigned  queued:1; */
+} ngx_ssl_handshake_wait_t;
+
+
+static int  ngx_ssl_handshake_limit_index;
+
+#endif
+
+
+#if (NGX_SSL_ASYNC_KEYS)
+
+static int  ngx_ssl_async_key_index;
+static RSA_METHOD  *ngx_ssl_async_rsa_method;
+#ifndef OPENSSL_NO_EC
+static int  ngx_ssl_async_ec_key_index;
+static EC_KEY_METHOD  *ngx_ssl_async_ec_method;
+#endif
+
+#endif
+
+
 ngx_int_t
 ngx_ssl_init(ngx_log_t *log)
 {
@@ -214,6 +385,14 @@ ngx_ssl_init(ngx_log_t *log)
         return NGX_ERROR;
     }
 
+    ngx_ssl_session_ticket_keys_zone_index = SSL_CTX_get_ex_new_index(0, NULL,
+                                                            NULL, NULL, NULL);
+    if (ngx_ssl_session_ticket_keys_zone_index == -1) {
+        ngx_ssl_error(NGX_LOG_ALERT, log, 0,
+                      "SSL_CTX_get_ex_new_index() failed");
+        return NGX_ERROR;
+    }
+
     ngx_ssl_certificate_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL,
                                                          NULL);
     if (ngx_ssl_certificate_index == -1) {
@@ -244,6 +423,18 @@ ngx_ssl_init(ngx_log_t *log)
         return NGX_ERROR;
     }
 
+#ifdef SSL_CLIENT_HELLO_SUCCESS
+
+    ngx_ssl_handshake_limit_index = SSL_CTX_get_ex_new_index(0, NULL, NULL,
+                                                             NULL, NULL);
+    if (ngx_ssl_handshake_limit_index == -1) {
+        ngx_ssl_error(NGX_LOG_ALERT, log, 0,
+                      "SSL_CTX_get_ex_new_index() failed");
+        return NGX_ERROR;
+    }
+
+#endif
+
     return NGX_OK;
 }
 
@@ -533,12 +724,25 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
 
 ngx_int_t
 ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
-    ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords)
+    ngx_str_t *cert, ngx_str_t *key, ngx_ssl_cache_t *cache,
+    ngx_array_t *passwords)
 {
-    char            *err;
-    X509            *x509;
-    EVP_PKEY        *pkey;
-    STACK_OF(X509)  *chain;
+    char                  *err;
+    X509                  *x509;
+    EVP_PKEY              *pkey;
+    ngx_int_t              rc;
+    STACK_OF(X509)        *chain;
+    ngx_ssl_cache_node_t  *node;
+
+    if (cache) {
+        node = ngx_ssl_cache_fetch(c, pool, cache, cert, key, passwords);
+        if (node == NULL) {
+            return NGX_ERROR;
+        }
+
+        return ngx_ssl_use_certificate(c, cert, key, node->x509, node->chain,
+                                       node->pkey);
+    }
 
     x509 = ngx_ssl_load_certificate(pool, &err, cert, &chain);
     if (x509 == NULL) {
@@ -551,213 +755,556 @@ ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
         return NGX_ERROR;
     }
 
-    if (SSL_use_certificate(c->ssl->connection, x509) == 0) {
-        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
-                      "SSL_use_certificate(\"%s\") failed", cert->data);
+    pkey = ngx_ssl_load_certificate_key(pool, &err, key, passwords);
+    if (pkey == NULL) {
+        if (err != NULL) {
+            ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                          "cannot load certificate key \"%s\": %s",
+                          key->data, err);
+        }
+
         X509_free(x509);
         sk_X509_pop_free(chain, X509_free);
         return NGX_ERROR;
     }
 
+    rc = ngx_ssl_use_certificate(c, cert, key, x509, chain, pkey);
+
     X509_free(x509);
+    sk_X509_pop_free(chain, X509_free);
+    EVP_PKEY_free(pkey);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_ssl_use_certificate(ngx_connection_t *c, ngx_str_t *cert, ngx_str_t *key,
+    X509 *x509, STACK_OF(X509) *chain, EVP_PKEY *pkey)
+{
+    /* the connection takes its own references to the objects */
 
-#ifdef SSL_set0_chain
+    if (SSL_use_certificate(c->ssl->connection, x509) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_use_certificate(\"%s\") failed", cert->data);
+        return NGX_ERROR;
+    }
+
+#ifdef SSL_set1_chain
 
     /*
-     * SSL_set0_chain() is only available in OpenSSL 1.0.2+,
+     * SSL_set1_chain() is only available in OpenSSL 1.0.2+,
      * but this function is only called via certificate callback,
      * which is only available in OpenSSL 1.0.2+ as well
      */
 
-    if (SSL_set0_chain(c->ssl->connection, chain) == 0) {
+    if (SSL_set1_chain(c->ssl->connection, chain) == 0) {
         ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
-                      "SSL_set0_chain(\"%s\") failed", cert->data);
-        sk_X509_pop_free(chain, X509_free);
+                      "SSL_set1_chain(\"%s\") failed", cert->data);
         return NGX_ERROR;
     }
 
 #endif
 
-    pkey = ngx_ssl_load_certificate_key(pool, &err, key, passwords);
-    if (pkey == NULL) {
-        if (err != NULL) {
-            ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
-                          "cannot load certificate key \"%s\": %s",
-                          key->data, err);
-        }
-
-        return NGX_ERROR;
-    }
-
     if (SSL_use_PrivateKey(c->ssl->connection, pkey) == 0) {
         ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
                       "SSL_use_PrivateKey(\"%s\") failed", key->data);
-        EVP_PKEY_free(pkey);
         return NGX_ERROR;
     }
 
-    EVP_PKEY_free(pkey);
-
     return NGX_OK;
 }
 
 
-static X509 *
-ngx_ssl_load_certificate(ngx_pool_t *pool, char **err, ngx_str_t *cert,
-    STACK_OF(X509) **chain)
+static ngx_ssl_cache_node_t *
+ngx_ssl_cache_fetch(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_ssl_cache_t *cache, ngx_str_t *cert, ngx_str_t *key,
+    ngx_array_t *passwords)
 {
-    BIO     *bio;
-    X509    *x509, *temp;
-    u_long   n;
-
-    if (ngx_strncmp(cert->data, "data:", sizeof("data:") - 1) == 0) {
+    char                  *err;
+    u_char                *p;
+    time_t                 now, cert_mtime, key_mtime;
+    uint32_t               hash;
+    ngx_str_t              name;
+    ngx_file_uniq_t        cert_uniq, key_uniq;
+    ngx_ssl_cache_node_t  *node;
 
-        bio = BIO_new_mem_buf(cert->data + sizeof("data:") - 1,
-                              cert->len - (sizeof("data:") - 1));
-        if (bio == NULL) {
-            *err = "BIO_new_mem_buf() failed";
-            return NULL;
-        }
+    now = ngx_time();
 
-    } else {
+    ngx_ssl_cache_expire(cache, 1);
 
-        if (ngx_get_full_name(pool, (ngx_str_t *) &ngx_cycle->conf_prefix, cert)
-            != NGX_OK)
-        {
-            *err = NULL;
-            return NULL;
-        }
+    /* the pair of a certificate and its key, as given by the variables */
 
-        bio = BIO_new_file((char *) cert->data, "r");
-        if (bio == NULL) {
-            *err = "BIO_new_file() failed";
-            return NULL;
-        }
+    name.len = cert->len + 1 + key->len;
+    name.data = ngx_pnalloc(pool, name.len);
+    if (name.data == NULL) {
+        return NULL;
     }
 
-    /* certificate itself */
+    p = ngx_cpymem(name.data, cert->data, cert->len);
+    *p++ = '\0';
+    ngx_memcpy(p, key->data, key->len);
 
-    x509 = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
-    if (x509 == NULL) {
-        *err = "PEM_read_bio_X509_AUX() failed";
-        BIO_free(bio);
-        return NULL;
-    }
+    hash = ngx_crc32_long(name.data, name.len);
 
-    /* rest of the chain */
+    node = (ngx_ssl_cache_node_t *)
+               ngx_str_rbtree_lookup(&cache->rbtree, &name, hash);
 
-    *chain = sk_X509_new_null();
-    if (*chain == NULL) {
-        *err = "sk_X509_new_null() failed";
-        BIO_free(bio);
-        X509_free(x509);
-        return NULL;
+    if (node && now - node->validated < cache->valid) {
+        goto found;
     }
 
-    for ( ;; ) {
+    /*
+     * file information is obtained before the files are read,
+     * so a file replaced meanwhile is reloaded on the next validation
+     */
 
-        temp = PEM_read_bio_X509(bio, NULL, NULL, NULL);
-        if (temp == NULL) {
-            n = ERR_peek_last_error();
+    ngx_ssl_cache_file_info(pool, cert, &cert_mtime, &cert_uniq);
+    ngx_ssl_cache_file_info(pool, key, &key_mtime, &key_uniq);
 
-            if (ERR_GET_LIB(n) == ERR_LIB_PEM
-                && ERR_GET_REASON(n) == PEM_R_NO_START_LINE)
-            {
-                /* end of file */
-                ERR_clear_error();
-                break;
-            }
+    if (node) {
+        if (node->cert_mtime == cert_mtime && node->cert_uniq == cert_uniq
+            && node->key_mtime == key_mtime && node->key_uniq == key_uniq)
+        {
+            node->validated = now;
+            goto found;
+        }
 
-            /* some real error */
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "ssl cache: \"%s\" changed", cert->data);
 
-            *err = "PEM_read_bio_X509() failed";
-            BIO_free(bio);
-            X509_free(x509);
-            sk_X509_pop_free(*chain, X509_free);
-            return NULL;
+        ngx_ssl_cache_free_node(cache, node);
+    }
+
+    node = ngx_alloc(sizeof(ngx_ssl_cache_node_t) + name.len, c->log);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    node->x509 = ngx_ssl_load_certificate(pool, &err, cert, &node->chain);
+    if (node->x509 == NULL) {
+        if (err != NULL) {
+            ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                          "cannot load certificate \"%s\": %s",
+                          cert->data, err);
         }
 
-        if (sk_X509_push(*chain, temp) == 0) {
-            *err = "sk_X509_push() failed";
-            BIO_free(bio);
-            X509_free(x509);
-            sk_X509_pop_free(*chain, X509_free);
-            return NULL;
+        ngx_free(node);
+        return NULL;
+    }
+
+    node->pkey = ngx_ssl_load_certificate_key(pool, &err, key, passwords);
+    if (node->pkey == NULL) {
+        if (err != NULL) {
+            ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                          "cannot load certificate key \"%s\": %s",
+                          key->data, err);
         }
+
+        X509_free(node->x509);
+        sk_X509_pop_free(node->chain, X509_free);
+        ngx_free(node);
+        return NULL;
     }
 
-    BIO_free(bio);
+    if (cache->current >= cache->max) {
+        ngx_ssl_cache_free_node(cache, ngx_queue_data(
+                                    ngx_queue_last(&cache->expire_queue),
+                                    ngx_ssl_cache_node_t, queue));
+    }
 
-    return x509;
-}
+    node->sn.node.key = hash;
+    node->sn.str.len = name.len;
+    node->sn.str.data = (u_char *) node + sizeof(ngx_ssl_cache_node_t);
+    ngx_memcpy(node->sn.str.data, name.data, name.len);
 
+    node->validated = now;
+    node->cert_mtime = cert_mtime;
+    node->key_mtime = key_mtime;
+    node->cert_uniq = cert_uniq;
+    node->key_uniq = key_uniq;
 
-static EVP_PKEY *
-ngx_ssl_load_certificate_key(ngx_pool_t *pool, char **err,
-    ngx_str_t *key, ngx_array_t *passwords)
-{
-    BIO              *bio;
-    EVP_PKEY         *pkey;
-    ngx_str_t        *pwd;
-    ngx_uint_t        tries;
-    pem_password_cb  *cb;
+    ngx_rbtree_insert(&cache->rbtree, &node->sn.node);
+    ngx_queue_insert_head(&cache->expire_queue, &node->queue);
 
-    if (ngx_strncmp(key->data, "engine:", sizeof("engine:") - 1) == 0) {
+    cache->current++;
 
-#ifndef OPENSSL_NO_ENGINE
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl cache: \"%s\" loaded, %ui cached",
+                   cert->data, cache->current);
 
-        u_char  *p, *last;
-        ENGINE  *engine;
+    node->accessed = now;
 
-        p = key->data + sizeof("engine:") - 1;
-        last = (u_char *) ngx_strchr(p, ':');
+    return node;
 
-        if (last == NULL) {
-            *err = "invalid syntax";
-            return NULL;
-        }
+found:
 
-        *last = '\0';
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl cache: \"%s\" hit", cert->data);
 
-        engine = ENGINE_by_id((char *) p);
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&cache->expire_queue, &node->queue);
 
-        if (engine == NULL) {
-            *err = "ENGINE_by_id() failed";
-            return NULL;
-        }
+    node->accessed = now;
 
-        *last++ = ':';
+    return node;
+}
 
-        pkey = ENGINE_load_private_key(engine, (char *) last, 0, 0);
 
-        if (pkey == NULL) {
-            *err = "ENGINE_load_private_key() failed";
-            ENGINE_free(engine);
-            return NULL;
-        }
+static void
+ngx_ssl_cache_file_info(ngx_pool_t *pool, ngx_str_t *name, time_t *mtime,
+    ngx_file_uniq_t *uniq)
+{
+    ngx_file_info_t  fi;
 
-        ENGINE_free(engine);
+    *mtime = 0;
+    *uniq = 0;
 
-        return pkey;
+    if (ngx_strncmp(name->data, "data:", sizeof("data:") - 1) == 0
+        || ngx_strncmp(name->data, "engine:", sizeof("engine:") - 1) == 0)
+    {
+        return;
+    }
 
-#else
+    if (ngx_get_full_name(pool, (ngx_str_t *) &ngx_cycle->conf_prefix, name)
+        != NGX_OK)
+    {
+        return;
+    }
 
-        *err = "loading \"engine:...\" certificate keys is not supported";
-        return NULL;
+    /* errors are reported when the file is loaded */
 
-#endif
+    if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR) {
+        return;
     }
 
-    if (ngx_strncmp(key->data, "data:", sizeof("data:") - 1) == 0) {
+    *mtime = ngx_file_mtime(&fi);
+    *uniq = ngx_file_uniq(&fi);
+}
 
-        bio = BIO_new_mem_buf(key->data + sizeof("data:") - 1,
-                              key->len - (sizeof("data:") - 1));
-        if (bio == NULL) {
-            *err = "BIO_new_mem_buf() failed";
-            return NULL;
-        }
 
-    } else {
+static void
+ngx_ssl_cache_expire(ngx_ssl_cache_t *cache, ngx_uint_t n)
+{
+    time_t                 now;
+    ngx_queue_t           *q;
+    ngx_ssl_cache_node_t  *node;
+
+    now = ngx_time();
+
+    while (n--) {
+
+        if (ngx_queue_empty(&cache->expire_queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->expire_queue);
+
+        node = ngx_queue_data(q, ngx_ssl_cache_node_t, queue);
+
+        if (now - node->accessed <= cache->inactive) {
+            return;
+        }
+
+        ngx_ssl_cache_free_node(cache, node);
+    }
+}
+
+
+static void
+ngx_ssl_cache_free_node(ngx_ssl_cache_t *cache, ngx_ssl_cache_node_t *node)
+{
+    ngx_queue_remove(&node->queue);
+    ngx_rbtree_delete(&cache->rbtree, &node->sn.node);
+
+    cache->current--;
+
+    /* connections still using the objects hold their own references */
+
+    X509_free(node->x509);
+    sk_X509_pop_free(node->chain, X509_free);
+    EVP_PKEY_free(node->pkey);
+
+    ngx_free(node);
+}
+
+
+static void
+ngx_ssl_cache_cleanup(void *data)
+{
+    ngx_ssl_cache_t  *cache = data;
+
+    while (!ngx_queue_empty(&cache->expire_queue)) {
+        ngx_ssl_cache_free_node(cache,
+                                ngx_queue_data(
+                                    ngx_queue_last(&cache->expire_queue),
+                                    ngx_ssl_cache_node_t, queue));
+    }
+}
+
+
+char *
+ngx_ssl_certificate_cache(ngx_conf_t *cf, ngx_ssl_cache_t **cache)
+{
+    time_t               inactive, valid;
+    ngx_str_t           *value, s;
+    ngx_int_t            max;
+    ngx_uint_t           i;
+    ngx_ssl_cache_t     *c;
+    ngx_pool_cleanup_t  *cln;
+
+    value = cf->args->elts;
+
+    max = 0;
+    inactive = 10;
+    valid = 60;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            max = ngx_atoi(value[i].data + 4, value[i].len - 4);
+            if (max <= 0) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            inactive = ngx_parse_time(&s, 1);
+            if (inactive == (time_t) NGX_ERROR) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            valid = ngx_parse_time(&s, 1);
+            if (valid == (time_t) NGX_ERROR) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "off") == 0) {
+
+            *cache = NULL;
+
+            continue;
+        }
+
+    failed:
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid \"%V\" parameter \"%V\"",
+                           &value[0], &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (*cache == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    if (max == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"max\" parameter",
+                           &value[0]);
+        return NGX_CONF_ERROR;
+    }
+
+    c = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_cache_t));
+    if (c == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_rbtree_init(&c->rbtree, &c->sentinel, ngx_str_rbtree_insert_value);
+    ngx_queue_init(&c->expire_queue);
+
+    c->max = max;
+    c->valid = valid;
+    c->inactive = inactive;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_ssl_cache_cleanup;
+    cln->data = c;
+
+    *cache = c;
+
+    return NGX_CONF_OK;
+}
+
+
+static X509 *
+ngx_ssl_load_certificate(ngx_pool_t *pool, char **err, ngx_str_t *cert,
+    STACK_OF(X509) **chain)
+{
+    BIO     *bio;
+    X509    *x509, *temp;
+    u_long   n;
+
+    if (ngx_strncmp(cert->data, "data:", sizeof("data:") - 1) == 0) {
+
+        bio = BIO_new_mem_buf(cert->data + sizeof("data:") - 1,
+                              cert->len - (sizeof("data:") - 1));
+        if (bio == NULL) {
+            *err = "BIO_new_mem_buf() failed";
+            return NULL;
+        }
+
+    } else {
+
+        if (ngx_get_full_name(pool, (ngx_str_t *) &ngx_cycle->conf_prefix, cert)
+            != NGX_OK)
+        {
+            *err = NULL;
+            return NULL;
+        }
+
+        bio = BIO_new_file((char *) cert->data, "r");
+        if (bio == NULL) {
+            *err = "BIO_new_file() failed";
+            return NULL;
+        }
+    }
+
+    /* certificate itself */
+
+    x509 = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
+    if (x509 == NULL) {
+        *err = "PEM_read_bio_X509_AUX() failed";
+        BIO_free(bio);
+        return NULL;
+    }
+
+    /* rest of the chain */
+
+    *chain = sk_X509_new_null();
+    if (*chain == NULL) {
+        *err = "sk_X509_new_null() failed";
+        BIO_free(bio);
+        X509_free(x509);
+        return NULL;
+    }
+
+    for ( ;; ) {
+
+        temp = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+        if (temp == NULL) {
+            n = ERR_peek_last_error();
+
+            if (ERR_GET_LIB(n) == ERR_LIB_PEM
+                && ERR_GET_REASON(n) == PEM_R_NO_START_LINE)
+            {
+                /* end of file */
+                ERR_clear_error();
+                break;
+            }
+
+            /* some real error */
+
+            *err = "PEM_read_bio_X509() failed";
+            BIO_free(bio);
+            X509_free(x509);
+            sk_X509_pop_free(*chain, X509_free);
+            return NULL;
+        }
+
+        if (sk_X509_push(*chain, temp) == 0) {
+            *err = "sk_X509_push() failed";
+            BIO_free(bio);
+            X509_free(x509);
+            sk_X509_pop_free(*chain, X509_free);
+            return NULL;
+        }
+    }
+
+    BIO_free(bio);
+
+    return x509;
+}
+
+
+static EVP_PKEY *
+ngx_ssl_load_certificate_key(ngx_pool_t *pool, char **err,
+    ngx_str_t *key, ngx_array_t *passwords)
+{
+    BIO              *bio;
+    EVP_PKEY         *pkey;
+    ngx_str_t        *pwd;
+    ngx_uint_t        tries;
+    pem_password_cb  *cb;
+
+    if (ngx_strncmp(key->data, "engine:", sizeof("engine:") - 1) == 0) {
+
+#ifndef OPENSSL_NO_ENGINE
+
+        u_char  *p, *last;
+        ENGINE  *engine;
+
+        p = key->data + sizeof("engine:") - 1;
+        last = (u_char *) ngx_strchr(p, ':');
+
+        if (last == NULL) {
+            *err = "invalid syntax";
+            return NULL;
+        }
+
+        *last = '\0';
+
+        engine = ENGINE_by_id((char *) p);
+
+        if (engine == NULL) {
+            *err = "ENGINE_by_id() failed";
+            return NULL;
+        }
+
+        *last++ = ':';
+
+        pkey = ENGINE_load_private_key(engine, (char *) last, 0, 0);
+
+        if (pkey == NULL) {
+            *err = "ENGINE_load_private_key() failed";
+            ENGINE_free(engine);
+            return NULL;
+        }
+
+        ENGINE_free(engine);
+
+        return pkey;
+
+#else
+
+        *err = "loading \"engine:...\" certificate keys is not supported";
+        return NULL;
+
+#endif
+    }
+
+    if (ngx_strncmp(key->data, "data:", sizeof("data:") - 1) == 0) {
+
+        bio = BIO_new_mem_buf(key->data + sizeof("data:") - 1,
+                              key->len - (sizeof("data:") - 1));
+        if (bio == NULL) {
+            *err = "BIO_new_mem_buf() failed";
+            return NULL;
+        }
+
+    } else {
 
         if (ngx_get_full_name(pool, (ngx_str_t *) &ngx_cycle->conf_prefix, key)
             != NGX_OK)
@@ -1461,15 +2008,841 @@ ngx_ssl_early_data(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
 
 
 ngx_int_t
-ngx_ssl_client_session_cache(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
+ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
 {
     if (!enable) {
         return NGX_OK;
     }
 
-    SSL_CTX_set_session_cache_mode(ssl->ctx,
-                                   SSL_SESS_CACHE_CLIENT
-                                   |SSL_SESS_CACHE_NO_INTERNAL);
+#if (defined SSL_OP_ENABLE_KTLS && defined BIO_get_ktls_send)
+
+    /*
+     * OpenSSL switches to kernel TLS after the handshake if the kernel
+     * and the negotiated cipher support it, and falls back silently
+     */
+
+    SSL_CTX_set_options(ssl->ctx, SSL_OP_ENABLE_KTLS);
+
+#else
+    ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                  "\"ssl_ktls\" is not supported on this platform, "
+                  "ignored");
+#endif
+
+    return NGX_OK;
+}
+
+
+char *
+ngx_ssl_async_conf(ngx_conf_t *cf, ngx_uint_t *async, ngx_str_t *pool)
+{
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        *async = NGX_SSL_ASYNC_OFF;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcmp(value[1].data, "on") == 0) {
+        *async = NGX_SSL_ASYNC_ON;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "threads", 7) == 0
+        && (value[1].len == 7 || value[1].data[7] == '='))
+    {
+#if (NGX_SSL_ASYNC_KEYS)
+        *async = NGX_SSL_ASYNC_THREADS;
+
+        if (value[1].len > 8) {
+            pool->len = value[1].len - 8;
+            pool->data = value[1].data + 8;
+        }
+
+        return NGX_CONF_OK;
+#elif (NGX_THREADS)
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V threads\" is not supported with this "
+                           "OpenSSL version", &value[0]);
+        return NGX_CONF_ERROR;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V threads\" is unsupported "
+                           "without threads support", &value[0]);
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid value \"%V\"", &value[1]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+ngx_int_t
+ngx_ssl_async(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t async,
+    ngx_str_t *pool)
+{
+#if (NGX_SSL_ASYNC_KEYS)
+    ngx_thread_pool_t  *tp;
+#endif
+
+    if (async == NGX_SSL_ASYNC_OFF) {
+        return NGX_OK;
+    }
+
+#ifdef SSL_MODE_ASYNC
+
+    /*
+     * handshakes run as OpenSSL async jobs, and an engine (or
+     * the key methods below) may pause a job while a private key
+     * operation is in progress
+     */
+
+    SSL_CTX_set_mode(ssl->ctx, SSL_MODE_ASYNC);
+
+#if (NGX_SSL_ASYNC_KEYS)
+
+    if (async == NGX_SSL_ASYNC_THREADS) {
+        tp = ngx_thread_pool_add(cf, pool->len ? pool : NULL);
+        if (tp == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_ssl_async_keys(ssl, tp) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+#else
+    ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                  "\"ssl_async\" is not supported on this platform, "
+                  "ignored");
+#endif
+
+    return NGX_OK;
+}
+
+
+char *
+ngx_ssl_handshake_limit_conf(ngx_conf_t *cf, ngx_ssl_handshake_limit_t **limit)
+{
+    ngx_int_t                   rate, queue;
+    ngx_str_t                  *value;
+    ngx_uint_t                  i;
+    ngx_ssl_handshake_limit_t  *hl;
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "invalid number of arguments";
+        }
+
+        *limit = NULL;
+        return NGX_CONF_OK;
+    }
+
+    rate = 0;
+    queue = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "rate=", 5) == 0) {
+
+            rate = ngx_atoi(value[i].data + 5, value[i].len - 5);
+            if (rate <= 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "queue=", 6) == 0) {
+
+            queue = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (queue == NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+    invalid:
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (rate == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"rate\" parameter",
+                           &value[0]);
+        return NGX_CONF_ERROR;
+    }
+
+    hl = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_handshake_limit_t));
+    if (hl == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     hl->tokens = 0;
+     *     hl->updated = 0;
+     *     hl->waiting = 0;
+     */
+
+    hl->rate = rate;
+    hl->queue = queue;
+
+    ngx_queue_init(&hl->waiters);
+
+#ifdef SSL_CLIENT_HELLO_SUCCESS
+
+    hl->event = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
+    if (hl->event == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    hl->event->handler = ngx_ssl_handshake_limit_handler;
+    hl->event->data = hl;
+    hl->event->log = &cf->cycle->new_log;
+    hl->event->cancelable = 1;
+
+#endif
+
+    *limit = hl;
+
+    return NGX_CONF_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_handshake_limit(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_ssl_handshake_limit_t *limit)
+{
+    if (limit == NULL) {
+        return NGX_OK;
+    }
+
+#ifdef SSL_CLIENT_HELLO_SUCCESS
+
+    /*
+     * the ClientHello callback runs before the server name is known,
+     * so the limit of the default server applies to its listen sockets;
+     * servers which inherit the directive share one budget
+     */
+
+    if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_handshake_limit_index, limit)
+        == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_set_ex_data() failed");
+        return NGX_ERROR;
+    }
+
+    SSL_CTX_set_client_hello_cb(ssl->ctx, ngx_ssl_client_hello_limit, NULL);
+
+#else
+    ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                  "\"ssl_handshake_limit\" is not supported on this platform, "
+                  "ignored");
+#endif
+
+    return NGX_OK;
+}
+
+
+#if (NGX_SSL_ASYNC_KEYS)
+
+/*
+ * Private keys are replaced with copies using RSA and EC key methods
+ * which, when called within an async job, post the operation to a thread
+ * pool and pause the job.  The operation works on own copies of its input
+ * and output, and the worker waits for the result on a pipe registered
+ * as the job wait fd, so the event loop resumes the handshake as soon as
+ * the signature is ready.
+ */
+
+static ngx_int_t
+ngx_ssl_async_keys(ngx_ssl_t *ssl, ngx_thread_pool_t *tp)
+{
+    RSA       *rsa;
+    EVP_PKEY  *pkey, *key;
+#ifndef OPENSSL_NO_EC
+    EC_KEY    *ec;
+#endif
+
+    if (ngx_ssl_async_methods(ssl->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (SSL_CTX_set_current_cert(ssl->ctx, SSL_CERT_SET_FIRST) == 0) {
+        return NGX_OK;
+    }
+
+    do {
+        pkey = SSL_CTX_get0_privatekey(ssl->ctx);
+
+        if (pkey == NULL) {
+            continue;
+        }
+
+        key = NULL;
+
+        switch (EVP_PKEY_base_id(pkey)) {
+
+        case EVP_PKEY_RSA:
+
+            rsa = EVP_PKEY_get1_RSA(pkey);
+            if (rsa == NULL) {
+                goto failed;
+            }
+
+            key = EVP_PKEY_new();
+
+            if (key == NULL
+                || RSA_set_method(rsa, ngx_ssl_async_rsa_method) == 0
+                || RSA_set_ex_data(rsa, ngx_ssl_async_key_index, tp) == 0
+                || EVP_PKEY_assign_RSA(key, rsa) == 0)
+            {
+                RSA_free(rsa);
+                goto failed;
+            }
+
+            break;
+
+#ifndef OPENSSL_NO_EC
+        case EVP_PKEY_EC:
+
+            ec = EVP_PKEY_get1_EC_KEY(pkey);
+            if (ec == NULL) {
+                goto failed;
+            }
+
+            key = EVP_PKEY_new();
+
+            if (key == NULL
+                || EC_KEY_set_method(ec, ngx_ssl_async_ec_method) == 0
+                || EC_KEY_set_ex_data(ec, ngx_ssl_async_ec_key_index, tp)
+                   == 0
+                || EVP_PKEY_assign_EC_KEY(key, ec) == 0)
+            {
+                EC_KEY_free(ec);
+                goto failed;
+            }
+
+            break;
+#endif
+
+        default:
+
+            /* other keys are used as is */
+
+            continue;
+        }
+
+        if (SSL_CTX_use_PrivateKey(ssl->ctx, key) == 0) {
+            EVP_PKEY_free(key);
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "SSL_CTX_use_PrivateKey() failed");
+            return NGX_ERROR;
+        }
+
+        EVP_PKEY_free(key);
+
+    } while (SSL_CTX_set_current_cert(ssl->ctx, SSL_CERT_SET_NEXT));
+
+    return NGX_OK;
+
+failed:
+
+    if (key) {
+        EVP_PKEY_free(key);
+    }
+
+    ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                  "cannot prepare private key for \"ssl_async threads\"");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_ssl_async_methods(ngx_log_t *log)
+{
+#ifndef OPENSSL_NO_EC
+    int  (*sign_setup)(EC_KEY *eckey, BN_CTX *ctx, BIGNUM **kinv,
+                       BIGNUM **r);
+    ECDSA_SIG  *(*sign_sig)(const unsigned char *dgst, int dlen,
+                            const BIGNUM *kinv, const BIGNUM *r,
+                            EC_KEY *eckey);
+#endif
+
+    if (ngx_ssl_async_rsa_method) {
+        return NGX_OK;
+    }
+
+    ngx_ssl_async_key_index = RSA_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+
+    if (ngx_ssl_async_key_index == -1) {
+        ngx_ssl_error(NGX_LOG_EMERG, log, 0, "RSA_get_ex_new_index() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_ssl_async_rsa_method = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+
+    if (ngx_ssl_async_rsa_method == NULL
+        || RSA_meth_set1_name(ngx_ssl_async_rsa_method, "nginx async") == 0
+        || RSA_meth_set_priv_enc(ngx_ssl_async_rsa_method,
+                                 ngx_ssl_async_rsa_priv_enc)
+           == 0
+        || RSA_meth_set_priv_dec(ngx_ssl_async_rsa_method,
+                                 ngx_ssl_async_rsa_priv_dec)
+           == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, log, 0, "RSA_meth_dup() failed");
+        return NGX_ERROR;
+    }
+
+#ifndef OPENSSL_NO_EC
+
+    ngx_ssl_async_ec_key_index = EC_KEY_get_ex_new_index(0, NULL, NULL, NULL,
+                                                         NULL);
+
+    if (ngx_ssl_async_ec_key_index == -1) {
+        ngx_ssl_error(NGX_LOG_EMERG, log, 0,
+                      "EC_KEY_get_ex_new_index() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_ssl_async_ec_method = EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+
+    if (ngx_ssl_async_ec_method == NULL) {
+        ngx_ssl_error(NGX_LOG_EMERG, log, 0, "EC_KEY_METHOD_new() failed");
+        return NGX_ERROR;
+    }
+
+    EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), NULL, &sign_setup, &sign_sig);
+    EC_KEY_METHOD_set_sign(ngx_ssl_async_ec_method, ngx_ssl_async_ec_sign,
+                           sign_setup, sign_sig);
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static int
+ngx_ssl_async_rsa_priv_enc(int flen, const unsigned char *from,
+    unsigned char *to, RSA *rsa, int padding)
+{
+    return ngx_ssl_async_rsa(NGX_SSL_ASYNC_RSA_ENC, flen, from, to, rsa,
+                             padding);
+}
+
+
+static int
+ngx_ssl_async_rsa_priv_dec(int flen, const unsigned char *from,
+    unsigned char *to, RSA *rsa, int padding)
+{
+    return ngx_ssl_async_rsa(NGX_SSL_ASYNC_RSA_DEC, flen, from, to, rsa,
+                             padding);
+}
+
+
+static int
+ngx_ssl_async_rsa(ngx_uint_t type, int flen, const unsigned char *from,
+    unsigned char *to, RSA *rsa, int padding)
+{
+    int                  rc;
+    ngx_thread_task_t   *task;
+    ngx_ssl_async_op_t  *op;
+
+    task = ngx_ssl_async_task(type, flen, RSA_size(rsa));
+
+    if (task == NULL) {
+        return ngx_ssl_async_rsa_op(type, flen, from, to, rsa, padding);
+    }
+
+    op = task->ctx;
+
+    ngx_memcpy(op->in, from, flen);
+    op->padding = padding;
+
+    RSA_up_ref(rsa);
+    op->rsa = rsa;
+
+    if (ngx_ssl_async_run(RSA_get_ex_data(rsa, ngx_ssl_async_key_index), task)
+        != NGX_OK)
+    {
+        return -1;
+    }
+
+    rc = op->rc;
+
+    if (rc > 0) {
+        ngx_memcpy(to, op->out, rc);
+    }
+
+    ngx_ssl_async_free(task);
+
+    return rc;
+}
+
+
+static int
+ngx_ssl_async_rsa_op(ngx_uint_t type, int flen, const unsigned char *from,
+    unsigned char *to, RSA *rsa, int padding)
+{
+    const RSA_METHOD  *meth;
+
+    meth = RSA_PKCS1_OpenSSL();
+
+    if (type == NGX_SSL_ASYNC_RSA_ENC) {
+        return RSA_meth_get_priv_enc(meth)(flen, from, to, rsa, padding);
+    }
+
+    return RSA_meth_get_priv_dec(meth)(flen, from, to, rsa, padding);
+}
+
+
+#ifndef OPENSSL_NO_EC
+
+static int
+ngx_ssl_async_ec_sign(int type, const unsigned char *dgst, int dlen,
+    unsigned char *sig, unsigned int *siglen, const BIGNUM *kinv,
+    const BIGNUM *r, EC_KEY *eckey)
+{
+    int                  rc;
+    ngx_thread_task_t   *task;
+    ngx_ssl_async_op_t  *op;
+
+    task = NULL;
+
+    if (kinv == NULL && r == NULL) {
+        task = ngx_ssl_async_task(NGX_SSL_ASYNC_ECDSA, dlen,
+                                  ECDSA_size(eckey));
+    }
+
+    if (task == NULL) {
+        return ngx_ssl_async_ec_op(type, dgst, dlen, sig, siglen, kinv, r,
+                                   eckey);
+    }
+
+    op = task->ctx;
+
+    ngx_memcpy(op->in, dgst, dlen);
+    op->padding = type;
+
+    EC_KEY_up_ref(eckey);
+    op->ec = eckey;
+
+    if (ngx_ssl_async_run(EC_KEY_get_ex_data(eckey,
+                                             ngx_ssl_async_ec_key_index),
+                          task)
+        != NGX_OK)
+    {
+        return 0;
+    }
+
+    rc = op->rc;
+
+    if (rc == 1) {
+        ngx_memcpy(sig, op->out, op->outlen);
+        *siglen = op->outlen;
+    }
+
+    ngx_ssl_async_free(task);
+
+    return rc;
+}
+
+
+static int
+ngx_ssl_async_ec_op(int type, const unsigned char *dgst, int dlen,
+    unsigned char *sig, unsigned int *siglen, const BIGNUM *kinv,
+    const BIGNUM *r, EC_KEY *eckey)
+{
+    int  (*sign)(int type, const unsigned char *dgst, int dlen,
+                 unsigned char *sig, unsigned int *siglen,
+                 const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey);
+
+    EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &sign, NULL, NULL);
+
+    return sign(type, dgst, dlen, sig, siglen, kinv, r, eckey);
+}
+
+#endif
+
+
+static ngx_thread_task_t *
+ngx_ssl_async_task(ngx_uint_t type, int inlen, int outlen)
+{
+    ngx_thread_task_t   *task;
+    ngx_ssl_async_op_t  *op;
+
+    /* without a job, as in OpenSSL internal checks, keys are used inline */
+
+    if (ASYNC_get_current_job() == NULL || inlen < 0 || outlen <= 0) {
+        return NULL;
+    }
+
+    task = ngx_calloc(sizeof(ngx_thread_task_t) + sizeof(ngx_ssl_async_op_t)
+                      + inlen + outlen, ngx_cycle->log);
+    if (task == NULL) {
+        return NULL;
+    }
+
+    op = (ngx_ssl_async_op_t *) (task + 1);
+
+    op->type = type;
+    op->inlen = inlen;
+    op->in = (u_char *) (op + 1);
+    op->out = op->in + inlen;
+    op->outlen = outlen;
+
+    task->ctx = op;
+    task->handler = ngx_ssl_async_thread_handler;
+    task->event.handler = ngx_ssl_async_event_handler;
+    task->event.data = task;
+    task->event.log = ngx_cycle->log;
+
+    return task;
+}
+
+
+static ngx_int_t
+ngx_ssl_async_run(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
+{
+    int                    fds[2];
+    u_char                 buf[16];
+    void                  *custom;
+    ASYNC_JOB             *job;
+    OSSL_ASYNC_FD          fd;
+    ASYNC_WAIT_CTX        *waitctx;
+    ngx_ssl_async_op_t    *op;
+    ngx_ssl_async_wait_t  *wait;
+
+    op = task->ctx;
+
+    job = ASYNC_get_current_job();
+    waitctx = ASYNC_get_wait_ctx(job);
+
+    if (ASYNC_WAIT_CTX_get_fd(waitctx, &ngx_ssl_async_key_index, &fd, &custom))
+    {
+        wait = custom;
+
+    } else {
+        wait = ngx_alloc(sizeof(ngx_ssl_async_wait_t), ngx_cycle->log);
+        if (wait == NULL) {
+            goto failed;
+        }
+
+        if (pipe(fds) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          "pipe() failed");
+            ngx_free(wait);
+            goto failed;
+        }
+
+        wait->fd[0] = fds[0];
+        wait->fd[1] = fds[1];
+        wait->task = NULL;
+        wait->orphan = 0;
+
+        if (ngx_nonblocking(fds[0]) == -1 || ngx_nonblocking(fds[1]) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_socket_errno,
+                          ngx_nonblocking_n " failed");
+            ngx_ssl_async_wait_close(wait);
+            goto failed;
+        }
+
+        if (ASYNC_WAIT_CTX_set_wait_fd(waitctx, &ngx_ssl_async_key_index,
+                                       fds[0], wait,
+                                       ngx_ssl_async_wait_cleanup)
+            == 0)
+        {
+            ngx_ssl_async_wait_close(wait);
+            goto failed;
+        }
+    }
+
+    op->wait = wait;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        goto failed;
+    }
+
+    wait->task = task;
+
+    while (!op->done) {
+
+        /*
+         * the handshake may also be resumed by socket events,
+         * the job is paused again until the operation is done
+         */
+
+        if (ASYNC_pause_job() == 0) {
+            op->abandoned = 1;
+            return NGX_ERROR;
+        }
+    }
+
+    wait->task = NULL;
+
+    while (read(wait->fd[0], buf, sizeof(buf)) > 0) { /* void */ }
+
+    return NGX_OK;
+
+failed:
+
+    /* the operation is done inline */
+
+    if (op->type == NGX_SSL_ASYNC_ECDSA) {
+#ifndef OPENSSL_NO_EC
+        op->rc = ngx_ssl_async_ec_op(op->padding, op->in, op->inlen, op->out,
+                                     &op->outlen, NULL, NULL, op->ec);
+#endif
+
+    } else {
+        op->rc = ngx_ssl_async_rsa_op(op->type, op->inlen, op->in, op->out,
+                                      op->rsa, op->padding);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_async_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_ssl_async_op_t  *op = data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "ssl async key operation: %ui, %d", op->type, op->inlen);
+
+    if (op->type == NGX_SSL_ASYNC_ECDSA) {
+#ifndef OPENSSL_NO_EC
+        op->rc = ngx_ssl_async_ec_op(op->padding, op->in, op->inlen, op->out,
+                                     &op->outlen, NULL, NULL, op->ec);
+#endif
+
+    } else {
+        op->rc = ngx_ssl_async_rsa_op(op->type, op->inlen, op->in, op->out,
+                                      op->rsa, op->padding);
+    }
+
+    /* errors are reported by the result, the queue is per thread */
+
+    ERR_clear_error();
+}
+
+
+static void
+ngx_ssl_async_event_handler(ngx_event_t *ev)
+{
+    ngx_thread_task_t     *task;
+    ngx_ssl_async_op_t    *op;
+    ngx_ssl_async_wait_t  *wait;
+
+    task = ev->data;
+    op = task->ctx;
+    wait = op->wait;
+
+    op->done = 1;
+
+    if (wait->orphan) {
+
+        /* the connection was freed while the operation was in progress */
+
+        ngx_ssl_async_wait_close(wait);
+        ngx_ssl_async_free(task);
+        return;
+    }
+
+    if (op->abandoned) {
+        wait->task = NULL;
+        ngx_ssl_async_free(task);
+        return;
+    }
+
+    if (write(wait->fd[1], "", 1) != 1) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                      "write() to ssl async pipe failed");
+    }
+}
+
+
+static void
+ngx_ssl_async_wait_cleanup(ASYNC_WAIT_CTX *ctx, const void *key,
+    OSSL_ASYNC_FD fd, void *custom)
+{
+    ngx_ssl_async_wait_t  *wait = custom;
+
+    if (wait->task) {
+        wait->orphan = 1;
+        return;
+    }
+
+    ngx_ssl_async_wait_close(wait);
+}
+
+
+static void
+ngx_ssl_async_wait_close(ngx_ssl_async_wait_t *wait)
+{
+    if (close(wait->fd[0]) == -1 || close(wait->fd[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() ssl async pipe failed");
+    }
+
+    ngx_free(wait);
+}
+
+
+static void
+ngx_ssl_async_free(ngx_thread_task_t *task)
+{
+    ngx_ssl_async_op_t  *op;
+
+    op = task->ctx;
+
+    if (op->rsa) {
+        RSA_free(op->rsa);
+    }
+
+#ifndef OPENSSL_NO_EC
+    if (op->ec) {
+        EC_KEY_free(op->ec);
+    }
+#endif
+
+    ngx_free(task);
+}
+
+#endif
+
+
+ngx_int_t
+ngx_ssl_client_session_cache(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
+{
+    if (!enable) {
+        return NGX_OK;
+    }
+
+    SSL_CTX_set_session_cache_mode(ssl->ctx,
+                                   SSL_SESS_CACHE_CLIENT
+                                   |SSL_SESS_CACHE_NO_INTERNAL);
 
     SSL_CTX_sess_set_new_cb(ssl->ctx, ngx_ssl_new_client_session);
 
@@ -1508,6 +2881,7 @@ ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
 
     sc->buffer = ((flags & NGX_SSL_BUFFER) != 0);
     sc->buffer_size = ssl->buffer_size;
+    sc->dyn_rec = ssl->dyn_rec;
 
     sc->session_ctx = ssl->ctx;
 
@@ -1594,8 +2968,11 @@ ngx_int_t
 ngx_ssl_handshake(ngx_connection_t *c)
 {
     int        n, sslerr;
+    uint64_t   start;
     ngx_err_t  err;
 
+    ngx_probe1(ssl_handshake_start, c);
+
 #ifdef SSL_READ_EARLY_DATA_SUCCESS
     if (c->ssl->try_early_data) {
         return ngx_ssl_try_early_data(c);
@@ -1604,8 +2981,14 @@ ngx_ssl_handshake(ngx_connection_t *c)
 
     ngx_ssl_clear_error(c->log);
 
+    start = ngx_event_loop_timing ? ngx_event_loop_now() : 0;
+
     n = SSL_do_handshake(c->ssl->connection);
 
+    if (ngx_event_loop_timing) {
+        c->ssl->handshake_time += ngx_event_loop_now() - start;
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake: %d", n);
 
     if (n == 1) {
@@ -1622,6 +3005,14 @@ ngx_ssl_handshake(ngx_connection_t *c)
         ngx_ssl_handshake_log(c);
 #endif
 
+#ifdef SSL_MODE_ASYNC
+        if (c->ssl->async) {
+            ngx_ssl_async_close(c);
+        }
+#endif
+
+        ngx_ssl_handshake_account(c);
+
         c->ssl->handshaked = 1;
 
         c->recv = ngx_ssl_recv;
@@ -1629,6 +3020,16 @@ ngx_ssl_handshake(ngx_connection_t *c)
         c->recv_chain = ngx_ssl_recv_chain;
         c->send_chain = ngx_ssl_send_chain;
 
+#if (defined SSL_OP_ENABLE_KTLS && defined BIO_get_ktls_send)
+
+        if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "BIO_get_ktls_send(): 1");
+            c->ssl->sendfile = 1;
+        }
+
+#endif
+
 #ifndef SSL_OP_NO_RENEGOTIATION
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 #ifdef SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS
@@ -1642,6 +3043,8 @@ ngx_ssl_handshake(ngx_connection_t *c)
 #endif
 #endif
 
+        ngx_probe2(ssl_handshake_done, c, NGX_OK);
+
         return NGX_OK;
     }
 
@@ -1681,8 +3084,49 @@ ngx_ssl_handshake(ngx_connection_t *c)
         return NGX_AGAIN;
     }
 
+#ifdef SSL_ERROR_WANT_CLIENT_HELLO_CB
+
+    if (sslerr == SSL_ERROR_WANT_CLIENT_HELLO_CB) {
+
+        /* queued by ssl_handshake_limit, the read event is posted later */
+
+        if (c->read->pending_eof) {
+            c->ssl->no_wait_shutdown = 1;
+            c->ssl->no_send_shutdown = 1;
+            c->read->eof = 1;
+
+            ngx_connection_error(c, 0,
+                                 "peer closed connection in SSL handshake");
+            return NGX_ERROR;
+        }
+
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
+#ifdef SSL_MODE_ASYNC
+
+    if (sslerr == SSL_ERROR_WANT_ASYNC) {
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        if (ngx_ssl_async_wait(c) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
     err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
 
+    ngx_probe2(ssl_handshake_done, c, NGX_ERROR);
+
     c->ssl->no_wait_shutdown = 1;
     c->ssl->no_send_shutdown = 1;
     c->read->eof = 1;
@@ -1710,14 +3154,21 @@ ngx_ssl_try_early_data(ngx_connection_t *c)
     int        n, sslerr;
     u_char     buf;
     size_t     readbytes;
+    uint64_t   start;
     ngx_err_t  err;
 
     ngx_ssl_clear_error(c->log);
 
     readbytes = 0;
 
+    start = ngx_event_loop_timing ? ngx_event_loop_now() : 0;
+
     n = SSL_read_early_data(c->ssl->connection, &buf, 1, &readbytes);
 
+    if (ngx_event_loop_timing) {
+        c->ssl->handshake_time += ngx_event_loop_now() - start;
+    }
+
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "SSL_read_early_data: %d, %uz", n, readbytes);
 
@@ -1740,6 +3191,14 @@ ngx_ssl_try_early_data(ngx_connection_t *c)
         ngx_ssl_handshake_log(c);
 #endif
 
+#ifdef SSL_MODE_ASYNC
+        if (c->ssl->async) {
+            ngx_ssl_async_close(c);
+        }
+#endif
+
+        ngx_ssl_handshake_account(c);
+
         c->ssl->try_early_data = 0;
 
         c->ssl->early_buf = buf;
@@ -1787,13 +3246,52 @@ ngx_ssl_try_early_data(ngx_connection_t *c)
             return NGX_ERROR;
         }
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+#ifdef SSL_ERROR_WANT_CLIENT_HELLO_CB
+
+    if (sslerr == SSL_ERROR_WANT_CLIENT_HELLO_CB) {
+
+        /* queued by ssl_handshake_limit, the read event is posted later */
+
+        if (c->read->pending_eof) {
+            c->ssl->no_wait_shutdown = 1;
+            c->ssl->no_send_shutdown = 1;
+            c->read->eof = 1;
+
+            ngx_connection_error(c, 0,
+                                 "peer closed connection in SSL handshake");
+            return NGX_ERROR;
+        }
+
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
+#ifdef SSL_MODE_ASYNC
+
+    if (sslerr == SSL_ERROR_WANT_ASYNC) {
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        if (ngx_ssl_async_wait(c) != NGX_OK) {
             return NGX_ERROR;
         }
 
         return NGX_AGAIN;
     }
 
+#endif
+
     err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
 
     c->ssl->no_wait_shutdown = 1;
@@ -1892,6 +3390,372 @@ ngx_ssl_handshake_handler(ngx_event_t *ev)
 }
 
 
+static void
+ngx_ssl_handshake_account(ngx_connection_t *c)
+{
+    ngx_uint_t                  reused;
+#ifdef SSL_CLIENT_HELLO_SUCCESS
+    ngx_ssl_handshake_limit_t  *limit;
+#endif
+
+    if (!SSL_is_server(c->ssl->connection)) {
+        return;
+    }
+
+    reused = SSL_session_reused(c->ssl->connection);
+
+#ifdef SSL_CLIENT_HELLO_SUCCESS
+
+    if (c->ssl->handshake_resumption && !reused) {
+
+        /*
+         * a resumption attempt which ended in a full handshake
+         * is charged afterwards, with the debt limited to a second
+         */
+
+        limit = SSL_CTX_get_ex_data(c->ssl->session_ctx,
+                                    ngx_ssl_handshake_limit_index);
+
+        if (limit && limit->tokens > -(ngx_int_t) (limit->rate * 1000)) {
+            limit->tokens -= 1000;
+        }
+    }
+
+#endif
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake: reused:%ui resumption:%ui time:%uLus",
+                   reused, (ngx_uint_t) c->ssl->handshake_resumption,
+                   c->ssl->handshake_time);
+
+    if (ngx_event_loop_timing) {
+        ngx_event_loop_ssl_handshake(reused, c->ssl->handshake_time);
+    }
+}
+
+
+#ifdef SSL_CLIENT_HELLO_SUCCESS
+
+static int
+ngx_ssl_client_hello_limit(ngx_ssl_conn_t *ssl_conn, int *al, void *arg)
+{
+    ngx_connection_t           *c;
+    ngx_pool_cleanup_t         *cln;
+    ngx_ssl_handshake_wait_t   *w;
+    ngx_ssl_handshake_limit_t  *limit;
+
+    c = ngx_ssl_get_connection(ssl_conn);
+
+    if (c->ssl->handshake_admitted) {
+        return SSL_CLIENT_HELLO_SUCCESS;
+    }
+
+    if (c->ssl->handshake_queued) {
+        return SSL_CLIENT_HELLO_RETRY;
+    }
+
+    /* session resumptions are cheap and are never delayed */
+
+    if (ngx_ssl_client_hello_resumption(ssl_conn)) {
+        c->ssl->handshake_resumption = 1;
+        return SSL_CLIENT_HELLO_SUCCESS;
+    }
+
+    limit = SSL_CTX_get_ex_data(c->ssl->session_ctx,
+                                ngx_ssl_handshake_limit_index);
+
+    ngx_ssl_handshake_limit_update(limit);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake limit: %i, waiting:%ui",
+                   limit->tokens, limit->waiting);
+
+    if (limit->tokens >= 1000 && limit->waiting == 0) {
+        limit->tokens -= 1000;
+        c->ssl->handshake_admitted = 1;
+        return SSL_CLIENT_HELLO_SUCCESS;
+    }
+
+    if (limit->waiting >= limit->queue) {
+        goto rejected;
+    }
+
+    cln = ngx_pool_cleanup_add(c->pool, sizeof(ngx_ssl_handshake_wait_t));
+    if (cln == NULL) {
+        goto rejected;
+    }
+
+    w = cln->data;
+
+    w->connection = c;
+    w->limit = limit;
+    w->queued = 1;
+
+    cln->handler = ngx_ssl_handshake_wait_cleanup;
+
+    ngx_queue_insert_tail(&limit->waiters, &w->queue);
+    limit->waiting++;
+
+    c->ssl->handshake_queued = 1;
+
+    ngx_ssl_handshake_limit_timer(limit);
+
+    if (ngx_event_loop_timing) {
+        ngx_event_loop_ssl_limited(0);
+    }
+
+    return SSL_CLIENT_HELLO_RETRY;
+
+rejected:
+
+    ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                  "SSL handshake rejected by limit, %ui handshakes waiting",
+                  limit->waiting);
+
+    if (ngx_event_loop_timing) {
+        ngx_event_loop_ssl_limited(1);
+    }
+
+    *al = SSL_AD_HANDSHAKE_FAILURE;
+
+    return SSL_CLIENT_HELLO_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_ssl_client_hello_resumption(ngx_ssl_conn_t *ssl_conn)
+{
+    size_t                len;
+    const unsigned char  *p;
+
+    if (SSL_client_hello_get0_ext(ssl_conn, TLSEXT_TYPE_psk, &p, &len)) {
+        return 1;
+    }
+
+    if (SSL_client_hello_get0_ext(ssl_conn, TLSEXT_TYPE_session_ticket,
+                                  &p, &len)
+        && len)
+    {
+        return 1;
+    }
+
+    /* TLSv1.3 clients send a random session id for middlebox compatibility */
+
+    if (SSL_client_hello_get0_ext(ssl_conn, TLSEXT_TYPE_supported_versions,
+                                  &p, &len))
+    {
+        return 0;
+    }
+
+    return SSL_client_hello_get0_session_id(ssl_conn, &p) != 0;
+}
+
+
+static void
+ngx_ssl_handshake_limit_update(ngx_ssl_handshake_limit_t *limit)
+{
+    ngx_msec_int_t  ms;
+
+    ms = (ngx_msec_int_t) (ngx_current_msec - limit->updated);
+
+    if (ms <= 0) {
+        return;
+    }
+
+    limit->updated = ngx_current_msec;
+
+    /* no more than a second worth of handshakes accumulates */
+
+    if (ms > 1000) {
+        ms = 1000;
+    }
+
+    limit->tokens += (ngx_int_t) limit->rate * ms;
+
+    if (limit->tokens > (ngx_int_t) (limit->rate * 1000)) {
+        limit->tokens = limit->rate * 1000;
+    }
+}
+
+
+static void
+ngx_ssl_handshake_limit_timer(ngx_ssl_handshake_limit_t *limit)
+{
+    ngx_msec_t  delay;
+
+    if (limit->event->timer_set) {
+        return;
+    }
+
+    delay = 1;
+
+    if (limit->tokens < 1000) {
+        delay = (1000 - limit->tokens + limit->rate - 1) / limit->rate;
+    }
+
+    ngx_add_timer(limit->event, delay);
+}
+
+
+static void
+ngx_ssl_handshake_limit_handler(ngx_event_t *ev)
+{
+    ngx_queue_t                *q;
+    ngx_connection_t           *c;
+    ngx_ssl_handshake_wait_t   *w;
+    ngx_ssl_handshake_limit_t  *limit;
+
+    limit = ev->data;
+
+    ngx_ssl_handshake_limit_update(limit);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "SSL handshake limit timer: %i, waiting:%ui",
+                   limit->tokens, limit->waiting);
+
+    while (limit->tokens >= 1000 && !ngx_queue_empty(&limit->waiters)) {
+
+        q = ngx_queue_head(&limit->waiters);
+        ngx_queue_remove(q);
+        limit->waiting--;
+        limit->tokens -= 1000;
+
+        w = ngx_queue_data(q, ngx_ssl_handshake_wait_t, queue);
+        w->queued = 0;
+
+        c = w->connection;
+        c->ssl->handshake_queued = 0;
+        c->ssl->handshake_admitted = 1;
+
+        ngx_post_event(c->read, &ngx_posted_events);
+    }
+
+    if (!ngx_queue_empty(&limit->waiters)) {
+        ngx_ssl_handshake_limit_timer(limit);
+    }
+}
+
+
+static void
+ngx_ssl_handshake_wait_cleanup(void *data)
+{
+    ngx_ssl_handshake_wait_t  *w = data;
+
+    if (w->queued) {
+        ngx_queue_remove(&w->queue);
+        w->limit->waiting--;
+    }
+}
+
+#endif
+
+
+#ifdef SSL_MODE_ASYNC
+
+static ngx_int_t
+ngx_ssl_async_wait(ngx_connection_t *c)
+{
+    size_t             n;
+    OSSL_ASYNC_FD      fd;
+    ngx_connection_t  *ac;
+
+    /* a single key operation is in progress at a time */
+
+    if (SSL_get_all_async_fds(c->ssl->connection, NULL, &n) == 0 || n != 1) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL async job uses %uz wait fds", n);
+        return NGX_ERROR;
+    }
+
+    if (SSL_get_all_async_fds(c->ssl->connection, &fd, &n) == 0) {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_get_all_async_fds() failed");
+        return NGX_ERROR;
+    }
+
+    ac = c->ssl->async;
+
+    if (ac && ac->fd != fd) {
+        ngx_ssl_async_close(c);
+        ac = NULL;
+    }
+
+    if (ac == NULL) {
+        ac = ngx_get_connection(fd, c->log);
+        if (ac == NULL) {
+            return NGX_ERROR;
+        }
+
+        ac->data = c;
+        ac->read->handler = ngx_ssl_async_handler;
+        ac->read->log = c->log;
+
+        c->ssl->async = ac;
+    }
+
+    if (ac->read->active) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL async wait fd:%d", fd);
+
+    if (ngx_add_event(ac->read, NGX_READ_EVENT, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_async_handler(ngx_event_t *ev)
+{
+    ngx_connection_t  *c, *ac;
+
+    ac = ev->data;
+    c = ac->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL async handler fd:%d", ac->fd);
+
+    if (ev->active) {
+        (void) ngx_del_event(ev, NGX_READ_EVENT, 0);
+    }
+
+    ev->ready = 0;
+
+    c->read->handler(c->read);
+}
+
+
+static void
+ngx_ssl_async_close(ngx_connection_t *c)
+{
+    ngx_connection_t  *ac;
+
+    ac = c->ssl->async;
+
+    /* the wait fd is owned by OpenSSL */
+
+    if (ac->read->active) {
+        (void) ngx_del_event(ac->read, NGX_READ_EVENT, 0);
+    }
+
+    if (ac->read->posted) {
+        ngx_delete_posted_event(ac->read);
+    }
+
+    ngx_free_connection(ac);
+
+    ac->fd = (ngx_socket_t) -1;
+
+    c->ssl->async = NULL;
+}
+
+#endif
+
+
 ssize_t
 ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl, off_t limit)
 {
@@ -1977,6 +3841,10 @@ ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
         return 0;
     }
 
+    if (ngx_read_budget && ngx_event_read_exhausted(c)) {
+        return NGX_AGAIN;
+    }
+
     bytes = 0;
 
     ngx_ssl_clear_error(c->log);
@@ -1994,6 +3862,7 @@ ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
 
         if (n > 0) {
             bytes += n;
+            c->budget_used += n;
         }
 
         c->ssl->last = ngx_ssl_handle_recv(c, n);
@@ -2365,9 +4234,11 @@ ngx_chain_t *
 ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
     int          n;
+    u_char      *end;
+    size_t       record;
     ngx_uint_t   flush;
     ssize_t      send, size;
-    ngx_buf_t   *buf;
+    ngx_buf_t   *buf, *file;
 
     if (!c->ssl->buffer) {
 
@@ -2377,6 +4248,27 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+            if (in->buf->in_file && c->ssl->sendfile) {
+                n = ngx_ssl_sendfile(c, in->buf,
+                                     in->buf->file_last - in->buf->file_pos);
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+                    return in;
+                }
+
+                ngx_ssl_sendfile_update(in->buf, n);
+
+                if (in->buf->file_pos == in->buf->file_last) {
+                    in = in->next;
+                }
+
+                continue;
+            }
+
             n = ngx_ssl_write(c, in->buf->pos, in->buf->last - in->buf->pos);
 
             if (n == NGX_ERROR) {
@@ -2398,6 +4290,13 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
     }
 
 
+    if (c->ssl->dyn_rec
+        && ngx_current_msec - c->ssl->dyn_rec_last > c->ssl->dyn_rec->idle)
+    {
+        /* start over with small records once the connection was idle */
+        c->ssl->dyn_rec_sent = 0;
+    }
+
     /* the maximum limit size is the maximum int32_t value - the page size */
 
     if (limit == 0 || limit > (off_t) (NGX_MAX_INT32_VALUE - ngx_pagesize)) {
@@ -2431,7 +4330,17 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
     for ( ;; ) {
 
-        while (in && buf->last < buf->end && send < limit) {
+        /*
+         * with dynamic record sizing, the buffer is filled up to a record
+         * fitting a single TCP segment until enough data are sent
+         */
+
+        record = ngx_ssl_record_size(c);
+
+        end = (record && record < (size_t) (buf->end - buf->start))
+              ? buf->start + record : buf->end;
+
+        while (in && buf->last < end && send < limit) {
             if (in->buf->last_buf || in->buf->flush) {
                 flush = 1;
             }
@@ -2441,10 +4350,18 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+            if (in->buf->in_file && c->ssl->sendfile) {
+
+                /* flush the buffered data before passing the file */
+
+                flush = 1;
+                break;
+            }
+
             size = in->buf->last - in->buf->pos;
 
-            if (size > buf->end - buf->last) {
-                size = buf->end - buf->last;
+            if (size > end - buf->last) {
+                size = end - buf->last;
             }
 
             if (send + size > limit) {
@@ -2465,12 +4382,45 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             }
         }
 
-        if (!flush && send < limit && buf->last < buf->end) {
+        if (!flush && send < limit && buf->last < end) {
             break;
         }
 
         size = buf->last - buf->pos;
 
+        if (size == 0 && in && in->buf->in_file && c->ssl->sendfile
+            && send < limit)
+        {
+            file = in->buf;
+
+            size = (ssize_t) ngx_min(file->file_last - file->file_pos,
+                                     limit - send);
+
+            n = ngx_ssl_sendfile(c, file, size);
+
+            if (n == NGX_ERROR) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (n == NGX_AGAIN) {
+                break;
+            }
+
+            ngx_ssl_sendfile_update(file, n);
+            ngx_ssl_record_sent(c, n);
+            send += n;
+
+            if (file->file_pos == file->file_last) {
+                in = in->next;
+            }
+
+            if (n < size || in == NULL || send == limit) {
+                break;
+            }
+
+            continue;
+        }
+
         if (size == 0) {
             buf->flush = 0;
             c->buffered &= ~NGX_SSL_BUFFERED;
@@ -2484,9 +4434,12 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         }
 
         if (n == NGX_AGAIN) {
+            ngx_ssl_record_sent(c, 0);
             break;
         }
 
+        ngx_ssl_record_sent(c, n);
+
         buf->pos += n;
 
         if (n < size) {
@@ -2516,6 +4469,156 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 }
 
 
+static size_t
+ngx_ssl_record_size(ngx_connection_t *c)
+{
+    ngx_ssl_dyn_rec_t  *dr;
+
+    dr = c->ssl->dyn_rec;
+
+    if (dr == NULL || c->ssl->dyn_rec_sent >= dr->threshold) {
+        return 0;
+    }
+
+    return dr->size;
+}
+
+
+static void
+ngx_ssl_record_sent(ngx_connection_t *c, ssize_t n)
+{
+    if (c->ssl->dyn_rec == NULL) {
+        return;
+    }
+
+    /* a connection blocked on writing is not idle */
+
+    c->ssl->dyn_rec_sent += n;
+    c->ssl->dyn_rec_last = ngx_current_msec;
+}
+
+
+static ssize_t
+ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
+{
+#if (defined SSL_OP_ENABLE_KTLS && defined BIO_get_ktls_send)
+
+    int        sslerr;
+    ssize_t    n;
+    ngx_err_t  err;
+
+    ngx_ssl_clear_error(c->log);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL to sendfile: @%O %uz", file->file_pos, size);
+
+    ngx_set_errno(0);
+
+    n = SSL_sendfile(c->ssl->connection, file->file->fd, file->file_pos,
+                     size, 0);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_sendfile: %z", n);
+
+    if (n > 0) {
+
+        if (c->ssl->saved_read_handler) {
+
+            c->read->handler = c->ssl->saved_read_handler;
+            c->ssl->saved_read_handler = NULL;
+            c->read->ready = 1;
+
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_post_event(c->read, &ngx_posted_events);
+        }
+
+        c->sent += n;
+
+        return n;
+    }
+
+    if (n == 0) {
+
+        /*
+         * if sendfile returns zero, then someone has truncated the file,
+         * so the offset became beyond the end of the file
+         */
+
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_sendfile() reported that \"%s\" was truncated at %O",
+                      file->file->name.data, file->file_pos);
+
+        return NGX_ERROR;
+    }
+
+    sslerr = SSL_get_error(c->ssl->connection, n);
+
+    if (sslerr == SSL_ERROR_ZERO_RETURN) {
+
+        /*
+         * OpenSSL fails to return SSL_ERROR_SYSCALL if an error
+         * happens during the SSL_sendfile() call
+         */
+
+        sslerr = SSL_ERROR_SYSCALL;
+    }
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    if (sslerr == SSL_ERROR_WANT_WRITE) {
+        c->write->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    if (sslerr == SSL_ERROR_WANT_READ) {
+
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL_sendfile: want read");
+
+        c->read->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (c->ssl->saved_read_handler == NULL) {
+            c->ssl->saved_read_handler = c->read->handler;
+            c->read->handler = ngx_ssl_read_handler;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->write->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_sendfile() failed");
+
+#else
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                  "SSL_sendfile() not available");
+#endif
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_ssl_sendfile_update(ngx_buf_t *file, ssize_t n)
+{
+    if (ngx_buf_in_memory(file)) {
+        file->pos += n;
+    }
+
+    file->file_pos += n;
+}
+
+
 ssize_t
 ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 {
@@ -2762,6 +4865,12 @@ ngx_ssl_shutdown(ngx_connection_t *c)
     int        n, sslerr, mode;
     ngx_err_t  err;
 
+#ifdef SSL_MODE_ASYNC
+    if (c->ssl->async) {
+        ngx_ssl_async_close(c);
+    }
+#endif
+
     if (SSL_in_init(c->ssl->connection)) {
         /*
          * OpenSSL 1.0.2f complains if SSL_shutdown() is called during
@@ -3031,7 +5140,7 @@ ngx_ssl_connection_error(ngx_connection_t *c, int sslerr, ngx_err_t err,
 }
 
 
-static void
+void
 ngx_ssl_clear_error(ngx_log_t *log)
 {
     while (ERR_peek_error()) {
@@ -3296,11 +5405,27 @@ failed:
 ngx_int_t
 ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
-    size_t                    len;
-    ngx_slab_pool_t          *shpool;
+    ngx_ssl_session_cache_t  *ocache = data;
+
+    u_char                   *p;
+    size_t                    len, size;
+    ngx_uint_t                i, nshards, *shards;
+    ngx_slab_pool_t          *shpool, *sp;
     ngx_ssl_session_cache_t  *cache;
 
-    if (data) {
+    shards = shm_zone->data;
+    nshards = shards ? *shards : 1;
+
+    if (ocache) {
+
+        if (ocache->nshards != nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "session cache \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, nshards, ocache->nshards);
+            return NGX_ERROR;
+        }
+
         shm_zone->data = data;
         return NGX_OK;
     }
@@ -3309,21 +5434,46 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     if (shm_zone->shm.exists) {
         shm_zone->data = shpool->data;
+
+        if (shm_zone->shm.restored) {
+            cache = shm_zone->data;
+
+            for (i = 0; i < cache->nshards; i++) {
+                cache->shards[i].session_rbtree.insert =
+                                          ngx_ssl_session_rbtree_insert_value;
+
+                if (cache->nshards == 1) {
+                    continue;
+                }
+
+                sp = cache->shards[i].shpool;
+
+                ngx_memzero(&sp->lock, sizeof(ngx_shmtx_sh_t));
+
+                if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+            }
+        }
+
         return NGX_OK;
     }
 
-    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
+    cache = ngx_slab_calloc(shpool, sizeof(ngx_ssl_session_cache_t));
     if (cache == NULL) {
         return NGX_ERROR;
     }
 
-    shpool->data = cache;
-    shm_zone->data = cache;
+    cache->shards = ngx_slab_alloc(shpool,
+                                   nshards * sizeof(ngx_ssl_session_shard_t));
+    if (cache->shards == NULL) {
+        return NGX_ERROR;
+    }
 
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
+    cache->nshards = nshards;
 
-    ngx_queue_init(&cache->expire_queue);
+    shpool->data = cache;
+    shm_zone->data = cache;
 
     len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
 
@@ -3336,11 +5486,196 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
                 &shm_zone->shm.name);
 
     shpool->log_nomem = 0;
+    shpool->magazine = 1;
+
+    if (nshards == 1) {
+        ngx_ssl_session_shard_init(&cache->shards[0], shpool);
+        return NGX_OK;
+    }
+
+    /*
+     * each shard is a separate slab pool with its own mutex,
+     * carved out of the zone pool in equal parts
+     */
+
+    size = shpool->pfree / nshards * ngx_pagesize;
+
+    for (i = 0; i < nshards; i++) {
+
+        p = ngx_slab_alloc(shpool, size);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        sp = (ngx_slab_pool_t *) p;
+
+        sp->end = p + size;
+        sp->min_shift = 3;
+        sp->addr = p;
+
+        if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_slab_init(sp);
+
+        sp->data = cache;
+        sp->log_ctx = shpool->log_ctx;
+        sp->log_nomem = 0;
+        sp->magazine = 1;
+
+        ngx_ssl_session_shard_init(&cache->shards[i], sp);
+    }
 
     return NGX_OK;
 }
 
 
+static void
+ngx_ssl_session_shard_init(ngx_ssl_session_shard_t *shard,
+    ngx_slab_pool_t *shpool)
+{
+    shard->shpool = shpool;
+
+    ngx_rbtree_init(&shard->session_rbtree, &shard->sentinel,
+                    ngx_ssl_session_rbtree_insert_value);
+
+    ngx_queue_init(&shard->expire_queue);
+}
+
+
+char *
+ngx_ssl_session_cache_shards(ngx_conf_t *cf, ngx_shm_zone_t *shm_zone,
+    ngx_uint_t shards)
+{
+    ngx_uint_t  *n;
+
+    if (shards == 0) {
+        return NGX_CONF_OK;
+    }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+
+    if (shards > 1) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"shards\" is not supported on this platform");
+        return NGX_CONF_ERROR;
+    }
+
+#endif
+
+    if (shm_zone->shm.size < 8 * ngx_pagesize * shards) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "session cache \"%V\" is too small for %ui shards",
+                           &shm_zone->shm.name, shards);
+        return NGX_CONF_ERROR;
+    }
+
+    /* the layout of a persistent zone */
+
+    shm_zone->shm.layout = shards;
+
+    /*
+     * until the zone is initialized, its data keeps the number of shards
+     * requested in the configuration
+     */
+
+    n = shm_zone->data;
+
+    if (n) {
+        if (*n != shards) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "session cache \"%V\" is already configured "
+                               "with %ui shards",
+                               &shm_zone->shm.name, *n);
+            return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    n = ngx_palloc(cf->pool, sizeof(ngx_uint_t));
+    if (n == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *n = shards;
+
+    shm_zone->data = n;
+
+    return NGX_CONF_OK;
+}
+
+
+ngx_array_t *
+ngx_ssl_session_cache_stats(ngx_cycle_t *cycle, ngx_pool_t *pool)
+{
+    ngx_uint_t                     i;
+    ngx_list_part_t               *part;
+    ngx_array_t                   *stats;
+    ngx_shm_zone_t                *shm_zone;
+    ngx_ssl_session_cache_t       *cache;
+    ngx_ssl_session_cache_stat_t  *st;
+
+    stats = ngx_array_create(pool, 1, sizeof(ngx_ssl_session_cache_stat_t));
+    if (stats == NULL) {
+        return NULL;
+    }
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].init != ngx_ssl_session_cache_init) {
+            continue;
+        }
+
+        cache = shm_zone[i].data;
+
+        st = ngx_array_push(stats);
+        if (st == NULL) {
+            return NULL;
+        }
+
+        st->name = shm_zone[i].shm.name;
+        st->shards = cache->nshards;
+        st->hits = cache->hits;
+        st->misses = cache->misses;
+        st->evictions = cache->evictions;
+        st->lock_waits = cache->lock_waits;
+    }
+
+    return stats;
+}
+
+
+static ngx_ssl_session_shard_t *
+ngx_ssl_session_shard_lock(ngx_ssl_session_cache_t *cache, uint32_t hash)
+{
+    ngx_ssl_session_shard_t  *shard;
+
+    shard = &cache->shards[hash % cache->nshards];
+
+    if (!ngx_shmtx_trylock(&shard->shpool->mutex)) {
+        (void) ngx_atomic_fetch_add(&cache->lock_waits, 1);
+        ngx_shmtx_lock(&shard->shpool->mutex);
+    }
+
+    return shard;
+}
+
+
 /*
  * The length of the session id is 16 bytes for SSLv2 sessions and
  * between 1 and 32 bytes for SSLv3/TLSv1, typically 32 bytes.
@@ -3355,7 +5690,10 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
  * and an ASN1 representation, they take accordingly 128 and 128 bytes.
  *
  * OpenSSL's i2d_SSL_SESSION() and d2i_SSL_SESSION are slow,
- * so they are outside the code locked by shared pool mutex
+ * so they are outside the code locked by shared pool mutex.
+ *
+ * Sessions are spread over the cache shards by the hash of the session id,
+ * each shard has its own slab pool and mutex.
  */
 
 static int
@@ -3371,6 +5709,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ngx_slab_pool_t          *shpool;
     ngx_ssl_sess_id_t        *sess_id;
     ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 
     len = i2d_SSL_SESSION(sess, NULL);
@@ -3390,12 +5729,16 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
 
     cache = shm_zone->data;
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
-    ngx_shmtx_lock(&shpool->mutex);
+    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
+
+    hash = ngx_crc32_short(session_id, session_id_length);
+
+    shard = ngx_ssl_session_shard_lock(cache, hash);
+    shpool = shard->shpool;
 
     /* drop one or two expired sessions */
-    ngx_ssl_expire_sessions(cache, shpool, 1);
+    ngx_ssl_expire_sessions(cache, shard, 1);
 
     cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -3403,7 +5746,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(cache, shard, 0);
 
         cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -3419,7 +5762,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(cache, shard, 0);
 
         sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
 
@@ -3428,8 +5771,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
         }
     }
 
-    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
-
 #if (NGX_PTR_SIZE == 8)
 
     id = sess_id->sess_id;
@@ -3442,7 +5783,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(cache, shard, 0);
 
         id = ngx_slab_alloc_locked(shpool, session_id_length);
 
@@ -3457,8 +5798,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     ngx_memcpy(id, session_id, session_id_length);
 
-    hash = ngx_crc32_short(session_id, session_id_length);
-
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "ssl new session: %08XD:%ud:%d",
                    hash, session_id_length, len);
@@ -3471,9 +5810,9 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     sess_id->expire = ngx_time() + SSL_CTX_get_timeout(ssl_ctx);
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    ngx_queue_insert_head(&shard->expire_queue, &sess_id->queue);
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
+    ngx_rbtree_insert(&shard->session_rbtree, &sess_id->node);
 
     ngx_shmtx_unlock(&shpool->mutex);
 
@@ -3515,6 +5854,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     ngx_ssl_session_t        *sess;
     ngx_ssl_sess_id_t        *sess_id;
     ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
     ngx_connection_t         *c;
 
@@ -3533,12 +5873,11 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
     sess = NULL;
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
-
-    ngx_shmtx_lock(&shpool->mutex);
+    shard = ngx_ssl_session_shard_lock(cache, hash);
+    shpool = shard->shpool;
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -3568,6 +5907,8 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
                 ngx_shmtx_unlock(&shpool->mutex);
 
+                (void) ngx_atomic_fetch_add(&cache->hits, 1);
+
                 p = buf;
                 sess = d2i_SSL_SESSION(NULL, &p, slen);
 
@@ -3576,7 +5917,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -3596,6 +5937,8 @@ done:
 
     ngx_shmtx_unlock(&shpool->mutex);
 
+    (void) ngx_atomic_fetch_add(&cache->misses, 1);
+
     return sess;
 }
 
@@ -3621,6 +5964,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_sess_id_t        *sess_id;
     ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
 
     shm_zone = SSL_CTX_get_ex_data(ssl, ngx_ssl_session_cache_index);
 
@@ -3635,14 +5979,13 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     hash = ngx_crc32_short(id, len);
 
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
-                   "ssl remove session: %08XD:%ud", hash, len);
-
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+                   "ssl remove session: %08XD:%ud", hash, len);
 
-    ngx_shmtx_lock(&shpool->mutex);
+    shard = ngx_ssl_session_shard_lock(cache, hash);
+    shpool = shard->shpool;
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -3666,7 +6009,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -3688,21 +6031,23 @@ done:
 
 static void
 ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n)
+    ngx_ssl_session_shard_t *shard, ngx_uint_t n)
 {
     time_t              now;
     ngx_queue_t        *q;
+    ngx_slab_pool_t    *shpool;
     ngx_ssl_sess_id_t  *sess_id;
 
     now = ngx_time();
+    shpool = shard->shpool;
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&cache->expire_queue)) {
+        if (ngx_queue_empty(&shard->expire_queue)) {
             return;
         }
 
-        q = ngx_queue_last(&cache->expire_queue);
+        q = ngx_queue_last(&shard->expire_queue);
 
         sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
@@ -3710,12 +6055,16 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
             return;
         }
 
+        if (sess_id->expire > now) {
+            (void) ngx_atomic_fetch_add(&cache->evictions, 1);
+        }
+
         ngx_queue_remove(q);
 
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                        "expire session: %08Xi", sess_id->node.key);
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
 
         ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -3862,22 +6211,372 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
             ngx_memcpy(key->aes_key, buf + 16, 16);
             ngx_memcpy(key->hmac_key, buf + 32, 16);
 
-        } else {
-            key->size = 80;
-            ngx_memcpy(key->name, buf, 16);
-            ngx_memcpy(key->hmac_key, buf + 16, 32);
-            ngx_memcpy(key->aes_key, buf + 48, 32);
-        }
+        } else {
+            key->size = 80;
+            ngx_memcpy(key->name, buf, 16);
+            ngx_memcpy(key->hmac_key, buf + 16, 32);
+            ngx_memcpy(key->aes_key, buf + 48, 32);
+        }
+
+        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                          ngx_close_file_n " \"%V\" failed", &file.name);
+        }
+
+        ngx_explicit_memzero(&buf, 80);
+    }
+
+    if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index, keys)
+        == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_set_ex_data() failed");
+        return NGX_ERROR;
+    }
+
+    if (SSL_CTX_set_tlsext_ticket_key_cb(ssl->ctx,
+                                         ngx_ssl_session_ticket_key_callback)
+        == 0)
+    {
+        ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                      "nginx was built with Session Tickets support, however, "
+                      "now it is linked dynamically to an OpenSSL library "
+                      "which has no tlsext support, therefore Session Tickets "
+                      "are not available");
+    }
+
+    return NGX_OK;
+
+failed:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file.name);
+    }
+
+    ngx_explicit_memzero(&buf, 80);
+
+    return NGX_ERROR;
+}
+
+
+static int
+ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
+    unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
+    HMAC_CTX *hctx, int enc)
+{
+    size_t                          size;
+    SSL_CTX                        *ssl_ctx;
+    ngx_uint_t                      i;
+    ngx_array_t                    *keys;
+    ngx_connection_t               *c;
+    ngx_ssl_session_ticket_key_t   *key;
+    ngx_ssl_session_ticket_keys_t  *zone;
+    const EVP_MD                   *digest;
+    const EVP_CIPHER               *cipher;
+#if (NGX_DEBUG)
+    u_char                          buf[32];
+#endif
+
+    c = ngx_ssl_get_connection(ssl_conn);
+    ssl_ctx = c->ssl->session_ctx;
+
+#ifdef OPENSSL_NO_SHA256
+    digest = EVP_sha1();
+#else
+    digest = EVP_sha256();
+#endif
+
+    zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_ticket_keys_zone_index);
+    if (zone) {
+        ngx_ssl_session_ticket_keys_update(zone, c->log);
+    }
+
+    keys = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_ticket_keys_index);
+    if (keys == NULL || keys->nelts == 0) {
+        return -1;
+    }
+
+    key = keys->elts;
+
+    if (enc == 1) {
+        /* encrypt session ticket */
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "ssl session ticket encrypt, key: \"%*s\" (%s session)",
+                       ngx_hex_dump(buf, key[0].name, 16) - buf, buf,
+                       SSL_session_reused(ssl_conn) ? "reused" : "new");
+
+        if (key[0].size == 48) {
+            cipher = EVP_aes_128_cbc();
+            size = 16;
+
+        } else {
+            cipher = EVP_aes_256_cbc();
+            size = 32;
+        }
+
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(cipher)) != 1) {
+            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "RAND_bytes() failed");
+            return -1;
+        }
+
+        if (EVP_EncryptInit_ex(ectx, cipher, NULL, key[0].aes_key, iv) != 1) {
+            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
+                          "EVP_EncryptInit_ex() failed");
+            return -1;
+        }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+        if (HMAC_Init_ex(hctx, key[0].hmac_key, size, digest, NULL) != 1) {
+            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "HMAC_Init_ex() failed");
+            return -1;
+        }
+#else
+        HMAC_Init_ex(hctx, key[0].hmac_key, size, digest, NULL);
+#endif
+
+        ngx_memcpy(name, key[0].name, 16);
+
+        return 1;
+
+    } else {
+        /* decrypt session ticket */
+
+        for (i = 0; i < keys->nelts; i++) {
+            if (ngx_memcmp(name, key[i].name, 16) == 0) {
+                goto found;
+            }
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "ssl session ticket decrypt, key: \"%*s\" not found",
+                       ngx_hex_dump(buf, name, 16) - buf, buf);
+
+        return 0;
+
+    found:
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "ssl session ticket decrypt, key: \"%*s\"%s",
+                       ngx_hex_dump(buf, key[i].name, 16) - buf, buf,
+                       (i == 0) ? " (default)" : "");
+
+        if (key[i].size == 48) {
+            cipher = EVP_aes_128_cbc();
+            size = 16;
+
+        } else {
+            cipher = EVP_aes_256_cbc();
+            size = 32;
+        }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+        if (HMAC_Init_ex(hctx, key[i].hmac_key, size, digest, NULL) != 1) {
+            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "HMAC_Init_ex() failed");
+            return -1;
+        }
+#else
+        HMAC_Init_ex(hctx, key[i].hmac_key, size, digest, NULL);
+#endif
+
+        if (EVP_DecryptInit_ex(ectx, cipher, NULL, key[i].aes_key, iv) != 1) {
+            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
+                          "EVP_DecryptInit_ex() failed");
+            return -1;
+        }
+
+        return (i == 0) ? 1 : 2 /* renew */;
+    }
+}
+
+
+static void
+ngx_ssl_session_ticket_keys_cleanup(void *data)
+{
+    ngx_array_t  *keys = data;
+
+    ngx_explicit_memzero(keys->elts,
+                         keys->nelts * sizeof(ngx_ssl_session_ticket_key_t));
+}
+
+
+/*
+ * Session ticket keys zones keep ticket keys in shared memory, so all
+ * workers and all configurations since the zone was created use the same
+ * keys.  The keys are rotated without reload: a new key is generated every
+ * "rotate" interval, or, with "file=", the file is checked for changes
+ * every "rotate" interval.  The previous "keep" keys are still accepted
+ * for decryption, and tickets encrypted with them are renewed.
+ *
+ * The first worker that needs the keys after the interval has passed
+ * does the rotation; the others copy the keys into their local array
+ * as soon as they notice the generation has changed.
+ */
+
+char *
+ngx_ssl_session_ticket_keys_zone(ngx_conf_t *cf, ngx_shm_zone_t **zone,
+    void *tag)
+{
+    time_t                          rotate;
+    ngx_str_t                      *value, name, file;
+    ngx_int_t                       n;
+    ngx_uint_t                      i, keep;
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_pool_cleanup_t             *cln;
+    ngx_ssl_session_ticket_keys_t  *ctx;
+
+    value = cf->args->elts;
+
+    name = value[1];
+    rotate = 3600;
+    keep = 2;
+    ngx_str_null(&file);
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "rotate=", 7) == 0) {
+
+            value[i].data += 7;
+            value[i].len -= 7;
+
+            rotate = ngx_parse_time(&value[i], 1);
+            if (rotate == (time_t) NGX_ERROR || rotate == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "keep=", 5) == 0) {
+
+            n = ngx_atoi(value[i].data + 5, value[i].len - 5);
+            if (n == NGX_ERROR
+                || n > NGX_SSL_SESSION_TICKET_KEYS_MAX - 1)
+            {
+                goto invalid;
+            }
+
+            keep = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "file=", 5) == 0) {
+
+            file.data = value[i].data + 5;
+            file.len = value[i].len - 5;
+
+            if (file.len == 0) {
+                goto invalid;
+            }
+
+            if (ngx_conf_full_name(cf->cycle, &file, 1) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, 8 * ngx_pagesize, tag);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ctx = shm_zone->data;
+
+    if (ctx) {
+
+        if (ctx->rotate != rotate
+            || ctx->keep != keep
+            || ctx->file.len != file.len
+            || ngx_strncmp(ctx->file.data, file.data, file.len) != 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "session ticket keys zone \"%V\" is already "
+                               "configured with different parameters",
+                               &name);
+            return NGX_CONF_ERROR;
+        }
+
+        *zone = shm_zone;
+
+        return NGX_CONF_OK;
+    }
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_session_ticket_keys_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ctx->rotate = rotate;
+    ctx->keep = keep;
+    ctx->file = file;
+
+    ctx->keys = ngx_array_create(cf->pool, NGX_SSL_SESSION_TICKET_KEYS_MAX,
+                                 sizeof(ngx_ssl_session_ticket_key_t));
+    if (ctx->keys == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_ssl_session_ticket_keys_cleanup;
+    cln->data = ctx->keys;
+
+    if (file.len) {
+
+        /*
+         * the file is read at configuration time to report errors early,
+         * the keys are put into the zone when it is initialized
+         */
+
+        if (ngx_ssl_session_ticket_keys_read(ctx, cf->log) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    shm_zone->init = ngx_ssl_session_ticket_keys_init_zone;
+    shm_zone->data = ctx;
+
+    *zone = shm_zone;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
 
-        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
-                          ngx_close_file_n " \"%V\" failed", &file.name);
-        }
+    return NGX_CONF_ERROR;
+}
 
-        ngx_explicit_memzero(&buf, 80);
+
+ngx_int_t
+ngx_ssl_session_ticket_keys_shared(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone)
+{
+    ngx_ssl_session_ticket_keys_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index,
+                            ctx->keys)
+        == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_set_ex_data() failed");
+        return NGX_ERROR;
     }
 
-    if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index, keys)
+    if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_zone_index,
+                            ctx)
         == 0)
     {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
@@ -3897,152 +6596,307 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
     }
 
     return NGX_OK;
+}
 
-failed:
 
-    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
-                      ngx_close_file_n " \"%V\" failed", &file.name);
+static ngx_int_t
+ngx_ssl_session_ticket_keys_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_ssl_session_ticket_keys_t  *octx = data;
+
+    size_t                          len;
+    ngx_ssl_session_ticket_keys_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        goto done;
     }
 
-    ngx_explicit_memzero(&buf, 80);
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
-    return NGX_ERROR;
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_calloc(ctx->shpool,
+                              sizeof(ngx_ssl_session_ticket_keys_sh_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    len = sizeof(" in session ticket keys zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in session ticket keys zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    ctx->sh->updated = ngx_time();
+
+    if (ctx->file.len == 0) {
+        return ngx_ssl_session_ticket_keys_rotate(ctx, shm_zone->shm.log);
+    }
+
+done:
+
+    if (ctx->file.len) {
+
+        /* the keys read from the file at configuration time */
+
+        (void) ngx_ssl_session_ticket_keys_install(ctx, ctx->keys->elts,
+                                                   ctx->keys->nelts);
+
+        ngx_explicit_memzero(ctx->keys->elts, ctx->keys->nelts
+                             * sizeof(ngx_ssl_session_ticket_key_t));
+        ctx->keys->nelts = 0;
+    }
+
+    return NGX_OK;
 }
 
 
-static int
-ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
-    unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
-    HMAC_CTX *hctx, int enc)
+static ngx_int_t
+ngx_ssl_session_ticket_keys_read(ngx_ssl_session_ticket_keys_t *ctx,
+    ngx_log_t *log)
 {
+    u_char                         buf[80 * NGX_SSL_SESSION_TICKET_KEYS_MAX];
     size_t                         size;
-    SSL_CTX                       *ssl_ctx;
+    ssize_t                        n;
+    ngx_int_t                      rc;
+    ngx_file_t                     file;
     ngx_uint_t                     i;
-    ngx_array_t                   *keys;
-    ngx_connection_t              *c;
+    ngx_file_info_t                fi;
     ngx_ssl_session_ticket_key_t  *key;
-    const EVP_MD                  *digest;
-    const EVP_CIPHER              *cipher;
-#if (NGX_DEBUG)
-    u_char                         buf[32];
-#endif
 
-    c = ngx_ssl_get_connection(ssl_conn);
-    ssl_ctx = c->ssl->session_ctx;
+    rc = NGX_ERROR;
 
-#ifdef OPENSSL_NO_SHA256
-    digest = EVP_sha1();
-#else
-    digest = EVP_sha256();
-#endif
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = ctx->file;
+    file.log = log;
 
-    keys = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_ticket_keys_index);
-    if (keys == NULL) {
-        return -1;
-    }
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
 
-    key = keys->elts;
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      ngx_open_file_n " \"%V\" failed", &file.name);
+        return NGX_ERROR;
+    }
 
-    if (enc == 1) {
-        /* encrypt session ticket */
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%V\" failed", &file.name);
+        goto failed;
+    }
 
-        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                       "ssl session ticket encrypt, key: \"%*s\" (%s session)",
-                       ngx_hex_dump(buf, key[0].name, 16) - buf, buf,
-                       SSL_session_reused(ssl_conn) ? "reused" : "new");
+    size = ngx_file_size(&fi);
 
-        if (key[0].size == 48) {
-            cipher = EVP_aes_128_cbc();
-            size = 16;
+    if ((size != 48 && size % 80 != 0) || size == 0 || size > sizeof(buf)) {
+        ngx_log_error(NGX_LOG_EMERG, log, 0,
+                      "\"%V\" must be 48 bytes or up to %d keys of 80 bytes",
+                      &file.name, NGX_SSL_SESSION_TICKET_KEYS_MAX);
+        goto failed;
+    }
 
-        } else {
-            cipher = EVP_aes_256_cbc();
-            size = 32;
-        }
+    n = ngx_read_file(&file, buf, size, 0);
 
-        if (RAND_bytes(iv, EVP_CIPHER_iv_length(cipher)) != 1) {
-            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "RAND_bytes() failed");
-            return -1;
-        }
+    if (n == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_read_file_n " \"%V\" failed", &file.name);
+        goto failed;
+    }
 
-        if (EVP_EncryptInit_ex(ectx, cipher, NULL, key[0].aes_key, iv) != 1) {
-            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
-                          "EVP_EncryptInit_ex() failed");
-            return -1;
-        }
+    if ((size_t) n != size) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      ngx_read_file_n " \"%V\" returned only "
+                      "%z bytes instead of %uz", &file.name, n, size);
+        goto failed;
+    }
 
-#if OPENSSL_VERSION_NUMBER >= 0x10000000L
-        if (HMAC_Init_ex(hctx, key[0].hmac_key, size, digest, NULL) != 1) {
-            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "HMAC_Init_ex() failed");
-            return -1;
-        }
-#else
-        HMAC_Init_ex(hctx, key[0].hmac_key, size, digest, NULL);
-#endif
+    ctx->keys->nelts = 0;
 
-        ngx_memcpy(name, key[0].name, 16);
+    if (size == 48) {
+        key = ngx_array_push(ctx->keys);
+        ngx_memzero(key, sizeof(ngx_ssl_session_ticket_key_t));
 
-        return 1;
+        key->size = 48;
+        ngx_memcpy(key->name, buf, 16);
+        ngx_memcpy(key->aes_key, buf + 16, 16);
+        ngx_memcpy(key->hmac_key, buf + 32, 16);
 
     } else {
-        /* decrypt session ticket */
+        for (i = 0; i < size; i += 80) {
+            key = ngx_array_push(ctx->keys);
 
-        for (i = 0; i < keys->nelts; i++) {
-            if (ngx_memcmp(name, key[i].name, 16) == 0) {
-                goto found;
-            }
+            key->size = 80;
+            ngx_memcpy(key->name, buf + i, 16);
+            ngx_memcpy(key->hmac_key, buf + i + 16, 32);
+            ngx_memcpy(key->aes_key, buf + i + 48, 32);
         }
+    }
+
+    rc = NGX_OK;
+
+failed:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file.name);
+    }
+
+    ngx_explicit_memzero(buf, sizeof(buf));
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_ssl_session_ticket_keys_rotate(ngx_ssl_session_ticket_keys_t *ctx,
+    ngx_log_t *log)
+{
+    ngx_ssl_session_ticket_key_t  key;
+
+    key.size = 80;
+
+    if (RAND_bytes(key.name, 16) != 1
+        || RAND_bytes(key.hmac_key, 32) != 1
+        || RAND_bytes(key.aes_key, 32) != 1)
+    {
+        ngx_ssl_error(NGX_LOG_ALERT, log, 0, "RAND_bytes() failed");
+        ngx_explicit_memzero(&key, sizeof(ngx_ssl_session_ticket_key_t));
+        return NGX_ERROR;
+    }
+
+    (void) ngx_ssl_session_ticket_keys_install(ctx, &key, 1);
+
+    ngx_explicit_memzero(&key, sizeof(ngx_ssl_session_ticket_key_t));
+
+    return NGX_OK;
+}
 
-        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                       "ssl session ticket decrypt, key: \"%*s\" not found",
-                       ngx_hex_dump(buf, name, 16) - buf, buf);
 
+static ngx_uint_t
+ngx_ssl_session_ticket_keys_install(ngx_ssl_session_ticket_keys_t *ctx,
+    ngx_ssl_session_ticket_key_t *keys, ngx_uint_t n)
+{
+    ngx_uint_t                         i, j, k, max;
+    ngx_ssl_session_ticket_key_t       old[NGX_SSL_SESSION_TICKET_KEYS_MAX];
+    ngx_ssl_session_ticket_keys_sh_t  *sh;
+
+    /*
+     * the new keys go first, followed by up to "keep" previous keys
+     * which are not among the new ones
+     */
+
+    sh = ctx->sh;
+
+    if (sh->nkeys >= n
+        && ngx_memcmp(sh->keys, keys,
+                      n * sizeof(ngx_ssl_session_ticket_key_t)) == 0)
+    {
         return 0;
+    }
 
-    found:
+    ngx_memcpy(old, sh->keys, sh->nkeys * sizeof(ngx_ssl_session_ticket_key_t));
 
-        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                       "ssl session ticket decrypt, key: \"%*s\"%s",
-                       ngx_hex_dump(buf, key[i].name, 16) - buf, buf,
-                       (i == 0) ? " (default)" : "");
+    max = ngx_min(n + ctx->keep, NGX_SSL_SESSION_TICKET_KEYS_MAX);
 
-        if (key[i].size == 48) {
-            cipher = EVP_aes_128_cbc();
-            size = 16;
+    ngx_memcpy(sh->keys, keys, n * sizeof(ngx_ssl_session_ticket_key_t));
 
-        } else {
-            cipher = EVP_aes_256_cbc();
-            size = 32;
-        }
+    k = n;
 
-#if OPENSSL_VERSION_NUMBER >= 0x10000000L
-        if (HMAC_Init_ex(hctx, key[i].hmac_key, size, digest, NULL) != 1) {
-            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "HMAC_Init_ex() failed");
-            return -1;
-        }
-#else
-        HMAC_Init_ex(hctx, key[i].hmac_key, size, digest, NULL);
-#endif
+    for (i = 0; i < sh->nkeys && k < max; i++) {
 
-        if (EVP_DecryptInit_ex(ectx, cipher, NULL, key[i].aes_key, iv) != 1) {
-            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
-                          "EVP_DecryptInit_ex() failed");
-            return -1;
+        for (j = 0; j < n; j++) {
+            if (ngx_memcmp(old[i].name, keys[j].name, 16) == 0) {
+                break;
+            }
         }
 
-        return (i == 0) ? 1 : 2 /* renew */;
+        if (j == n) {
+            sh->keys[k++] = old[i];
+        }
     }
+
+    ngx_explicit_memzero(&sh->keys[k],
+                         (NGX_SSL_SESSION_TICKET_KEYS_MAX - k)
+                         * sizeof(ngx_ssl_session_ticket_key_t));
+
+    sh->nkeys = k;
+    sh->generation++;
+
+    ngx_explicit_memzero(old, sizeof(old));
+
+    return 1;
 }
 
 
 static void
-ngx_ssl_session_ticket_keys_cleanup(void *data)
+ngx_ssl_session_ticket_keys_update(ngx_ssl_session_ticket_keys_t *ctx,
+    ngx_log_t *log)
 {
-    ngx_array_t  *keys = data;
+    time_t                             now;
+    ngx_ssl_session_ticket_keys_sh_t  *sh;
 
-    ngx_explicit_memzero(keys->elts,
-                         keys->nelts * sizeof(ngx_ssl_session_ticket_key_t));
+    sh = ctx->sh;
+    now = ngx_time();
+
+    if (now - sh->updated >= ctx->rotate
+        && ngx_shmtx_trylock(&ctx->shpool->mutex))
+    {
+        if (now - sh->updated >= ctx->rotate) {
+            sh->updated = now;
+
+            if (ctx->file.len == 0) {
+                (void) ngx_ssl_session_ticket_keys_rotate(ctx, log);
+
+            } else {
+
+                /*
+                 * the file is small, so it is simply read again instead
+                 * of relying on its modification time;
+                 * the local array is refreshed from the zone below
+                 */
+
+                if (ngx_ssl_session_ticket_keys_read(ctx, log) == NGX_OK
+                    && ngx_ssl_session_ticket_keys_install(ctx,
+                                                           ctx->keys->elts,
+                                                           ctx->keys->nelts))
+                {
+                    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                                  "session ticket keys reloaded from \"%V\"",
+                                  &ctx->file);
+                }
+
+                ctx->generation = 0;
+            }
+        }
+
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+    }
+
+    if (ctx->generation == sh->generation) {
+        return;
+    }
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    ngx_memcpy(ctx->keys->elts, sh->keys,
+               sh->nkeys * sizeof(ngx_ssl_session_ticket_key_t));
+
+    ctx->keys->nelts = sh->nkeys;
+    ctx->generation = sh->generation;
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
 }
 
 #else
@@ -4058,6 +6912,31 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
     return NGX_OK;
 }
 
+
+char *
+ngx_ssl_session_ticket_keys_zone(ngx_conf_t *cf, ngx_shm_zone_t **zone,
+    void *tag)
+{
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "\"%V\" ignored, not supported", &value[0]);
+
+    *zone = NULL;
+
+    return NGX_CONF_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_session_ticket_keys_shared(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone)
+{
+    return NGX_OK;
+}
+
 #endif
 
 
@@ -4485,6 +7364,32 @@ ngx_ssl_get_early_data(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 }
 
 
+ngx_int_t
+ngx_ssl_get_ktls(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    s->len = 0;
+
+#if (defined SSL_OP_ENABLE_KTLS && defined BIO_get_ktls_send)
+
+    if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
+
+        if (BIO_get_ktls_recv(SSL_get_rbio(c->ssl->connection)) == 1) {
+            ngx_str_set(s, "tx,rx");
+
+        } else {
+            ngx_str_set(s, "tx");
+        }
+
+    } else if (BIO_get_ktls_recv(SSL_get_rbio(c->ssl->connection)) == 1) {
+        ngx_str_set(s, "rx");
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_ssl_get_server_name(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 {
@@ -64,10 +64,32 @@
 #endif
 
 
+typedef struct {
+    size_t                      size;
+    off_t                       threshold;
+    ngx_msec_t                  idle;
+} ngx_ssl_dyn_rec_t;
+
+
+typedef struct {
+    ngx_uint_t                  rate;
+    ngx_uint_t                  queue;
+
+    /* the budget of a worker process, in thousandths of a handshake */
+    ngx_int_t                   tokens;
+    ngx_msec_t                  updated;
+
+    ngx_uint_t                  waiting;
+    ngx_queue_t                 waiters;
+    ngx_event_t                *event;
+} ngx_ssl_handshake_limit_t;
+
+
 struct ngx_ssl_s {
     SSL_CTX                    *ctx;
     ngx_log_t                  *log;
     size_t                      buffer_size;
+    ngx_ssl_dyn_rec_t          *dyn_rec;
 };
 
 
@@ -79,6 +101,13 @@ struct ngx_ssl_connection_s {
     ngx_buf_t                  *buf;
     size_t                      buffer_size;
 
+    ngx_ssl_dyn_rec_t          *dyn_rec;
+    off_t                       dyn_rec_sent;
+    ngx_msec_t                  dyn_rec_last;
+
+    /* time spent in the handshake, usec */
+    uint64_t                    handshake_time;
+
     ngx_connection_handler_pt   handler;
 
     ngx_ssl_session_t          *session;
@@ -88,6 +117,10 @@ struct ngx_ssl_connection_s {
     ngx_event_handler_pt        saved_write_handler;
     ngx_event_handler_pt        next_read_handler;
 
+#ifdef SSL_MODE_ASYNC
+    ngx_connection_t           *async;
+#endif
+
     u_char                      early_buf;
 
     unsigned                    handshaked:1;
@@ -100,9 +133,18 @@ struct ngx_ssl_connection_s {
     unsigned                    in_early:1;
     unsigned                    early_preread:1;
     unsigned                    write_blocked:1;
+    unsigned                    sendfile:1;
+    unsigned                    handshake_resumption:1;
+    unsigned                    handshake_queued:1;
+    unsigned                    handshake_admitted:1;
 };
 
 
+#define NGX_SSL_ASYNC_OFF        0
+#define NGX_SSL_ASYNC_ON         1
+#define NGX_SSL_ASYNC_THREADS    2
+
+
 #define NGX_SSL_NO_SCACHE            -2
 #define NGX_SSL_NONE_SCACHE          -3
 #define NGX_SSL_NO_BUILTIN_SCACHE    -4
@@ -111,6 +153,8 @@ struct ngx_ssl_connection_s {
 
 #define NGX_SSL_MAX_SESSION_SIZE  4096
 
+#define NGX_SSL_MAX_SESSION_CACHE_SHARDS  64
+
 typedef struct ngx_ssl_sess_id_s  ngx_ssl_sess_id_t;
 
 struct ngx_ssl_sess_id_s {
@@ -131,9 +175,31 @@ typedef struct {
     ngx_rbtree_t                session_rbtree;
     ngx_rbtree_node_t           sentinel;
     ngx_queue_t                 expire_queue;
+    ngx_slab_pool_t            *shpool;
+} ngx_ssl_session_shard_t;
+
+
+typedef struct {
+    ngx_ssl_session_shard_t    *shards;
+    ngx_uint_t                  nshards;
+
+    ngx_atomic_t                hits;
+    ngx_atomic_t                misses;
+    ngx_atomic_t                evictions;
+    ngx_atomic_t                lock_waits;
 } ngx_ssl_session_cache_t;
 
 
+typedef struct {
+    ngx_str_t                   name;
+    ngx_uint_t                  shards;
+    ngx_atomic_uint_t           hits;
+    ngx_atomic_uint_t           misses;
+    ngx_atomic_uint_t           evictions;
+    ngx_atomic_uint_t           lock_waits;
+} ngx_ssl_session_cache_stat_t;
+
+
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
 typedef struct {
@@ -143,9 +209,45 @@ typedef struct {
     u_char                      aes_key[32];
 } ngx_ssl_session_ticket_key_t;
 
+
+#define NGX_SSL_SESSION_TICKET_KEYS_MAX  16
+
+typedef struct {
+    ngx_atomic_t                  generation;
+    time_t                        updated;
+    ngx_uint_t                    nkeys;
+    ngx_ssl_session_ticket_key_t  keys[NGX_SSL_SESSION_TICKET_KEYS_MAX];
+} ngx_ssl_session_ticket_keys_sh_t;
+
+
+typedef struct {
+    ngx_ssl_session_ticket_keys_sh_t  *sh;
+    ngx_slab_pool_t                   *shpool;
+
+    time_t                             rotate;
+    ngx_uint_t                         keep;
+    ngx_str_t                          file;
+
+    /* a local copy of the keys */
+    ngx_array_t                       *keys;
+    ngx_atomic_uint_t                  generation;
+} ngx_ssl_session_ticket_keys_t;
+
 #endif
 
 
+typedef struct {
+    ngx_rbtree_t                rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 expire_queue;
+
+    ngx_uint_t                  current;
+    ngx_uint_t                  max;
+    time_t                      valid;
+    time_t                      inactive;
+} ngx_ssl_cache_t;
+
+
 #define NGX_SSL_SSLv2    0x0002
 #define NGX_SSL_SSLv3    0x0004
 #define NGX_SSL_TLSv1    0x0008
@@ -168,7 +270,9 @@ ngx_int_t ngx_ssl_certificates(ngx_conf_t *cf, ngx_ssl_t *ssl,
 ngx_int_t ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords);
 ngx_int_t ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
-    ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords);
+    ngx_str_t *cert, ngx_str_t *key, ngx_ssl_cache_t *cache,
+    ngx_array_t *passwords);
+char *ngx_ssl_certificate_cache(ngx_conf_t *cf, ngx_ssl_cache_t **cache);
 
 ngx_int_t ngx_ssl_ciphers(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *ciphers,
     ngx_uint_t prefer_server_ciphers);
@@ -181,6 +285,11 @@ ngx_int_t ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *file, ngx_str_t *responder, ngx_uint_t verify);
 ngx_int_t ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_resolver_t *resolver, ngx_msec_t resolver_timeout);
+char *ngx_ssl_stapling_cache_zone(ngx_conf_t *cf, ngx_shm_zone_t **zone,
+    void *tag);
+ngx_int_t ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone);
+ngx_int_t ngx_ssl_stapling_init_process(ngx_cycle_t *cycle);
 RSA *ngx_ssl_rsa512_key_callback(ngx_ssl_conn_t *ssl_conn, int is_export,
     int key_length);
 ngx_array_t *ngx_ssl_read_password_file(ngx_conf_t *cf, ngx_str_t *file);
@@ -190,6 +299,14 @@ ngx_int_t ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file);
 ngx_int_t ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name);
 ngx_int_t ngx_ssl_early_data(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_uint_t enable);
+ngx_int_t ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable);
+char *ngx_ssl_async_conf(ngx_conf_t *cf, ngx_uint_t *async, ngx_str_t *pool);
+ngx_int_t ngx_ssl_async(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t async,
+    ngx_str_t *pool);
+char *ngx_ssl_handshake_limit_conf(ngx_conf_t *cf,
+    ngx_ssl_handshake_limit_t **limit);
+ngx_int_t ngx_ssl_handshake_limit(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_ssl_handshake_limit_t *limit);
 ngx_int_t ngx_ssl_client_session_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_uint_t enable);
 ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
@@ -197,7 +314,14 @@ ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
     ngx_shm_zone_t *shm_zone, time_t timeout);
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *paths);
+char *ngx_ssl_session_ticket_keys_zone(ngx_conf_t *cf, ngx_shm_zone_t **zone,
+    void *tag);
+ngx_int_t ngx_ssl_session_ticket_keys_shared(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+char *ngx_ssl_session_cache_shards(ngx_conf_t *cf, ngx_shm_zone_t *shm_zone,
+    ngx_uint_t shards);
+ngx_array_t *ngx_ssl_session_cache_stats(ngx_cycle_t *cycle, ngx_pool_t *pool);
 ngx_int_t ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
     ngx_uint_t flags);
 
@@ -235,6 +359,8 @@ ngx_int_t ngx_ssl_get_session_reused(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_early_data(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
+ngx_int_t ngx_ssl_get_ktls(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
 ngx_int_t ngx_ssl_get_server_name(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_raw_certificate(ngx_connection_t *c, ngx_pool_t *pool,
@@ -275,6 +401,7 @@ void ngx_ssl_free_buffer(ngx_connection_t *c);
 ngx_int_t ngx_ssl_shutdown(ngx_connection_t *c);
 void ngx_cdecl ngx_ssl_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
     char *fmt, ...);
+void ngx_ssl_clear_error(ngx_log_t *log);
 void ngx_ssl_cleanup_ctx(void *data);
 
 
@@ -282,6 +409,7 @@ extern int  ngx_ssl_connection_index;
 extern int  ngx_ssl_server_conf_index;
 extern int  ngx_ssl_session_cache_index;
 extern int  ngx_ssl_session_ticket_keys_index;
+extern int  ngx_ssl_session_ticket_keys_zone_index;
 extern int  ngx_ssl_certificate_index;
 extern int  ngx_ssl_next_certificate_index;
 extern int  ngx_ssl_certificate_name_index;
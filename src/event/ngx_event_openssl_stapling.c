@@ -14,6 +14,41 @@
 #if (!defined OPENSSL_NO_OCSP && defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB)
 
 
+#define NGX_SSL_STAPLING_ID_LEN  20
+
+
+typedef struct {
+    ngx_rbtree_node_t            node;
+    u_char                       id[NGX_SSL_STAPLING_ID_LEN];
+
+    time_t                       valid;
+    time_t                       refresh;
+    ngx_uint_t                   version;
+
+    size_t                       len;
+    u_char                      *data;
+} ngx_ssl_stapling_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                 rbtree;
+    ngx_rbtree_node_t            sentinel;
+} ngx_ssl_stapling_cache_sh_t;
+
+
+typedef struct {
+    ngx_ssl_stapling_cache_sh_t *sh;
+    ngx_slab_pool_t             *shpool;
+
+    ngx_path_t                  *path;
+
+    /* ngx_ssl_stapling_t * */
+    ngx_array_t                  staples;
+
+    ngx_event_t                  event;
+} ngx_ssl_stapling_cache_t;
+
+
 typedef struct {
     ngx_str_t                    staple;
     ngx_msec_t                   timeout;
@@ -36,6 +71,11 @@ typedef struct {
     time_t                       valid;
     time_t                       refresh;
 
+    ngx_ssl_stapling_cache_t    *cache;
+    ngx_ssl_stapling_node_t     *node;
+    ngx_uint_t                   version;
+    u_char                       id[NGX_SSL_STAPLING_ID_LEN];
+
     unsigned                     verify:1;
     unsigned                     loading:1;
 } ngx_ssl_stapling_t;
@@ -99,7 +139,30 @@ static ngx_int_t ngx_ssl_stapling_responder(ngx_conf_t *cf, ngx_ssl_t *ssl,
 static int ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn,
     void *data);
 static void ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple);
+static void ngx_ssl_stapling_request(ngx_ssl_stapling_t *staple);
 static void ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx);
+static ngx_int_t ngx_ssl_stapling_verify(ngx_ssl_stapling_t *staple,
+    u_char *data, size_t len, time_t *valid, ngx_log_t *log);
+
+static ngx_ssl_stapling_node_t *ngx_ssl_stapling_cache_node(
+    ngx_ssl_stapling_cache_t *cache, u_char *id);
+static void ngx_ssl_stapling_cache_get(ngx_ssl_stapling_t *staple,
+    ngx_log_t *log);
+static void ngx_ssl_stapling_cache_set(ngx_ssl_stapling_t *staple,
+    ngx_str_t *response, time_t valid, ngx_log_t *log);
+static ngx_int_t ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_ssl_stapling_cache_store(ngx_ssl_stapling_t *staple,
+    u_char *data, size_t len, time_t valid, time_t refresh);
+static void ngx_ssl_stapling_cache_read(ngx_ssl_stapling_t *staple,
+    ngx_log_t *log);
+static void ngx_ssl_stapling_cache_write(ngx_ssl_stapling_t *staple,
+    ngx_str_t *response, ngx_log_t *log);
+static u_char *ngx_ssl_stapling_cache_file(ngx_ssl_stapling_t *staple,
+    ngx_log_t *log, char *suffix);
+static void ngx_ssl_stapling_cache_handler(ngx_event_t *ev);
+static void ngx_ssl_stapling_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 static time_t ngx_ssl_stapling_time(ASN1_GENERALIZEDTIME *asn1time);
 
@@ -494,6 +557,336 @@ ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
 }
 
 
+char *
+ngx_ssl_stapling_cache_zone(ngx_conf_t *cf, ngx_shm_zone_t **zone, void *tag)
+{
+    u_char                    *p;
+    ssize_t                    size;
+    ngx_str_t                 *value, name, s, path;
+    ngx_uint_t                 i;
+    ngx_shm_zone_t            *shm_zone;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    value = cf->args->elts;
+
+    size = 0;
+    name.len = 0;
+    ngx_str_null(&path);
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "path=", 5) == 0) {
+
+            path.data = value[i].data + 5;
+            path.len = value[i].len - 5;
+
+            if (path.len == 0) {
+                goto invalid;
+            }
+
+            if (path.data[path.len - 1] == '/') {
+                path.len--;
+            }
+
+            if (ngx_conf_full_name(cf->cycle, &path, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &value[0]);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, tag);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache = shm_zone->data;
+
+    if (cache) {
+
+        if ((cache->path == NULL) != (path.len == 0)
+            || (cache->path
+                && (cache->path->name.len != path.len
+                    || ngx_strncmp(cache->path->name.data, path.data,
+                                   path.len)
+                       != 0)))
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "stapling cache \"%V\" is already configured "
+                               "with a different path", &name);
+            return NGX_CONF_ERROR;
+        }
+
+        *zone = shm_zone;
+
+        return NGX_CONF_OK;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_stapling_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_array_init(&cache->staples, cf->pool, 4,
+                       sizeof(ngx_ssl_stapling_t *))
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (path.len) {
+        cache->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+        if (cache->path == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->path->name = path;
+        cache->path->data = cache;
+        cache->path->conf_file = cf->conf_file->file.name.data;
+        cache->path->line = cf->conf_file->line;
+
+        if (ngx_add_path(cf, &cache->path) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    shm_zone->init = ngx_ssl_stapling_cache_init;
+    shm_zone->data = cache;
+
+    *zone = shm_zone;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_shm_zone_t *shm_zone)
+{
+    X509                       *cert;
+    unsigned int                len;
+    ngx_ssl_stapling_t         *staple, **sp;
+    ngx_ssl_stapling_cache_t   *cache;
+
+    cache = shm_zone->data;
+
+    for (cert = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_certificate_index);
+         cert;
+         cert = X509_get_ex_data(cert, ngx_ssl_next_certificate_index))
+    {
+        staple = X509_get_ex_data(cert, ngx_ssl_stapling_index);
+
+        /* responses from files are not cached */
+
+        if (staple == NULL || staple->host.len == 0) {
+            continue;
+        }
+
+        if (X509_digest(cert, EVP_sha1(), staple->id, &len) == 0
+            || len != NGX_SSL_STAPLING_ID_LEN)
+        {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "X509_digest() failed");
+            return NGX_ERROR;
+        }
+
+        staple->cache = cache;
+
+        sp = ngx_array_push(&cache->staples);
+        if (sp == NULL) {
+            return NGX_ERROR;
+        }
+
+        *sp = staple;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * A stapling cache keeps OCSP responses in shared memory, one node
+ * per certificate, identified by the SHA-1 digest of the certificate.
+ * Responses are requested by the first worker process only, ahead of
+ * expiry, and other workers copy a response into their local staple
+ * when the node version changes.  With "path=", responses are also
+ * saved to disk and used on start until they expire.
+ */
+
+static ngx_int_t
+ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_ssl_stapling_cache_t  *ocache = data;
+
+    size_t                     len;
+    time_t                     now;
+    ngx_uint_t                 i;
+    ngx_ssl_stapling_t       **staples;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        goto done;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        goto done;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_ssl_stapling_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_ssl_stapling_rbtree_insert_value);
+
+    len = sizeof(" in OCSP stapling cache \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in OCSP stapling cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+done:
+
+    now = ngx_time();
+    staples = cache->staples.elts;
+
+    for (i = 0; i < cache->staples.nelts; i++) {
+
+        staples[i]->node = ngx_ssl_stapling_cache_node(cache, staples[i]->id);
+        if (staples[i]->node == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (cache->path
+            && (staples[i]->node->len == 0 || staples[i]->node->valid < now))
+        {
+            ngx_ssl_stapling_cache_read(staples[i], shm_zone->shm.log);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                 i;
+    ngx_list_part_t           *part;
+    ngx_shm_zone_t            *shm_zone;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    /* responses in stapling caches are requested by the first worker */
+
+    if ((ngx_process != NGX_PROCESS_WORKER || ngx_worker != 0)
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].init != ngx_ssl_stapling_cache_init) {
+            continue;
+        }
+
+        cache = shm_zone[i].data;
+
+        if (cache->staples.nelts == 0) {
+            continue;
+        }
+
+        cache->event.handler = ngx_ssl_stapling_cache_handler;
+        cache->event.data = cache;
+        cache->event.log = cycle->log;
+        cache->event.cancelable = 1;
+
+        ngx_add_timer(&cache->event, 1);
+    }
+
+    return NGX_OK;
+}
+
+
 static int
 ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
 {
@@ -522,301 +915,765 @@ ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
         return rc;
     }
 
+    if (staple->cache) {
+        ngx_ssl_stapling_cache_get(staple, c->log);
+    }
+
     if (staple->staple.len
         && staple->valid >= ngx_time())
     {
         /* we have to copy ocsp response as OpenSSL will free it by itself */
 
-        p = OPENSSL_malloc(staple->staple.len);
-        if (p == NULL) {
-            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "OPENSSL_malloc() failed");
-            return SSL_TLSEXT_ERR_NOACK;
-        }
+        p = OPENSSL_malloc(staple->staple.len);
+        if (p == NULL) {
+            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "OPENSSL_malloc() failed");
+            return SSL_TLSEXT_ERR_NOACK;
+        }
+
+        ngx_memcpy(p, staple->staple.data, staple->staple.len);
+
+        SSL_set_tlsext_status_ocsp_resp(ssl_conn, p, staple->staple.len);
+
+        rc = SSL_TLSEXT_ERR_OK;
+    }
+
+    ngx_ssl_stapling_update(staple);
+
+    return rc;
+}
+
+
+static void
+ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
+{
+    /* staples in a cache are refreshed by the cache timer */
+
+    if (staple->host.len == 0 || staple->cache
+        || staple->loading || staple->refresh >= ngx_time())
+    {
+        return;
+    }
+
+    ngx_ssl_stapling_request(staple);
+}
+
+
+static void
+ngx_ssl_stapling_request(ngx_ssl_stapling_t *staple)
+{
+    ngx_ssl_ocsp_ctx_t  *ctx;
+
+    staple->loading = 1;
+
+    ctx = ngx_ssl_ocsp_start();
+    if (ctx == NULL) {
+        staple->loading = 0;
+        return;
+    }
+
+    ctx->cert = staple->cert;
+    ctx->issuer = staple->issuer;
+    ctx->name = staple->name;
+
+    ctx->addrs = staple->addrs;
+    ctx->host = staple->host;
+    ctx->uri = staple->uri;
+    ctx->port = staple->port;
+    ctx->timeout = staple->timeout;
+
+    ctx->resolver = staple->resolver;
+    ctx->resolver_timeout = staple->resolver_timeout;
+
+    ctx->handler = ngx_ssl_stapling_ocsp_handler;
+    ctx->data = staple;
+
+    ngx_ssl_ocsp_request(ctx);
+
+    return;
+}
+
+
+static void
+ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
+{
+    size_t               len;
+    time_t               now, valid;
+    ngx_str_t            response;
+    ngx_ssl_stapling_t  *staple;
+
+    staple = ctx->data;
+    now = ngx_time();
+
+    if (ctx->code != 200) {
+        goto error;
+    }
+
+    /* check the response */
+
+    len = ctx->response->last - ctx->response->pos;
+
+    if (ngx_ssl_stapling_verify(staple, ctx->response->pos, len, &valid,
+                                ctx->log)
+        != NGX_OK)
+    {
+        goto error;
+    }
+
+    /* copy the response to memory not in ctx->pool */
+
+    response.len = len;
+    response.data = ngx_alloc(response.len, ctx->log);
+
+    if (response.data == NULL) {
+        goto error;
+    }
+
+    ngx_memcpy(response.data, ctx->response->pos, response.len);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ctx->log, 0,
+                   "ssl ocsp response, %uz", response.len);
+
+    if (staple->staple.data) {
+        ngx_free(staple->staple.data);
+    }
+
+    staple->staple = response;
+    staple->valid = valid;
+
+    /*
+     * refresh before the response expires,
+     * but not earlier than in 5 minutes, and at least in an hour
+     */
+
+    staple->loading = 0;
+    staple->refresh = ngx_max(ngx_min(valid - 300, now + 3600), now + 300);
+
+    if (staple->cache) {
+        ngx_ssl_stapling_cache_set(staple, &response, valid, ctx->log);
+    }
+
+    ngx_ssl_ocsp_done(ctx);
+    return;
+
+error:
+
+    staple->loading = 0;
+    staple->refresh = now + 300;
+
+    if (staple->cache) {
+        staple->node->refresh = staple->refresh;
+    }
+
+    ngx_ssl_ocsp_done(ctx);
+}
+
+
+static ngx_int_t
+ngx_ssl_stapling_verify(ngx_ssl_stapling_t *staple, u_char *data, size_t len,
+    time_t *valid, ngx_log_t *log)
+{
+    int                    n;
+    ngx_int_t              rc;
+    X509_STORE            *store;
+    const u_char          *p;
+    STACK_OF(X509)        *chain;
+    OCSP_CERTID           *id;
+    OCSP_RESPONSE         *ocsp;
+    OCSP_BASICRESP        *basic;
+    ASN1_GENERALIZEDTIME  *thisupdate, *nextupdate;
+
+    rc = NGX_ERROR;
+    basic = NULL;
+    id = NULL;
+
+    p = data;
+
+    ocsp = d2i_OCSP_RESPONSE(NULL, &p, len);
+    if (ocsp == NULL) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "d2i_OCSP_RESPONSE() failed");
+        goto error;
+    }
+
+    n = OCSP_response_status(ocsp);
+
+    if (n != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "OCSP response not successful (%d: %s)",
+                      n, OCSP_response_status_str(n));
+        goto error;
+    }
+
+    basic = OCSP_response_get1_basic(ocsp);
+    if (basic == NULL) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "OCSP_response_get1_basic() failed");
+        goto error;
+    }
+
+    store = SSL_CTX_get_cert_store(staple->ssl_ctx);
+    if (store == NULL) {
+        ngx_ssl_error(NGX_LOG_CRIT, log, 0,
+                      "SSL_CTX_get_cert_store() failed");
+        goto error;
+    }
+
+#ifdef SSL_CTRL_SELECT_CURRENT_CERT
+    /* OpenSSL 1.0.2+ */
+    SSL_CTX_select_current_cert(staple->ssl_ctx, staple->cert);
+#endif
+
+#ifdef SSL_CTRL_GET_EXTRA_CHAIN_CERTS
+    /* OpenSSL 1.0.1+ */
+    SSL_CTX_get_extra_chain_certs(staple->ssl_ctx, &chain);
+#else
+    chain = staple->ssl_ctx->extra_certs;
+#endif
+
+    if (OCSP_basic_verify(basic, chain, store,
+                          staple->verify ? OCSP_TRUSTOTHER : OCSP_NOVERIFY)
+        != 1)
+    {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "OCSP_basic_verify() failed");
+        goto error;
+    }
+
+    id = OCSP_cert_to_id(NULL, staple->cert, staple->issuer);
+    if (id == NULL) {
+        ngx_ssl_error(NGX_LOG_CRIT, log, 0,
+                      "OCSP_cert_to_id() failed");
+        goto error;
+    }
+
+    if (OCSP_resp_find_status(basic, id, &n, NULL, NULL,
+                              &thisupdate, &nextupdate)
+        != 1)
+    {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "certificate status not found in the OCSP response");
+        goto error;
+    }
+
+    if (n != V_OCSP_CERTSTATUS_GOOD) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "certificate status \"%s\" in the OCSP response",
+                      OCSP_cert_status_str(n));
+        goto error;
+    }
+
+    if (OCSP_check_validity(thisupdate, nextupdate, 300, -1) != 1) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "OCSP_check_validity() failed");
+        goto error;
+    }
+
+    if (nextupdate) {
+        *valid = ngx_ssl_stapling_time(nextupdate);
+        if (*valid == (time_t) NGX_ERROR) {
+            ngx_log_error(NGX_LOG_ERR, log, 0,
+                          "invalid nextUpdate time in certificate status");
+            goto error;
+        }
+
+    } else {
+        *valid = NGX_MAX_TIME_T_VALUE;
+    }
+
+    rc = NGX_OK;
+
+error:
+
+    if (id) {
+        OCSP_CERTID_free(id);
+    }
+
+    if (basic) {
+        OCSP_BASICRESP_free(basic);
+    }
+
+    if (ocsp) {
+        OCSP_RESPONSE_free(ocsp);
+    }
+
+    return rc;
+}
+
+
+static time_t
+ngx_ssl_stapling_time(ASN1_GENERALIZEDTIME *asn1time)
+{
+    BIO     *bio;
+    char    *value;
+    size_t   len;
+    time_t   time;
+
+    /*
+     * OpenSSL doesn't provide a way to convert ASN1_GENERALIZEDTIME
+     * into time_t.  To do this, we use ASN1_GENERALIZEDTIME_print(),
+     * which uses the "MMM DD HH:MM:SS YYYY [GMT]" format (e.g.,
+     * "Feb  3 00:55:52 2015 GMT"), and parse the result.
+     */
+
+    bio = BIO_new(BIO_s_mem());
+    if (bio == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* fake weekday prepended to match C asctime() format */
+
+    BIO_write(bio, "Tue ", sizeof("Tue ") - 1);
+    ASN1_GENERALIZEDTIME_print(bio, asn1time);
+    len = BIO_get_mem_data(bio, &value);
+
+    time = ngx_parse_http_time((u_char *) value, len);
+
+    BIO_free(bio);
+
+    return time;
+}
+
+
+static void
+ngx_ssl_stapling_cleanup(void *data)
+{
+    ngx_ssl_stapling_t  *staple = data;
+
+    if (staple->issuer) {
+        X509_free(staple->issuer);
+    }
+
+    if (staple->staple.data) {
+        ngx_free(staple->staple.data);
+    }
+}
+
+
+static ngx_ssl_stapling_node_t *
+ngx_ssl_stapling_cache_node(ngx_ssl_stapling_cache_t *cache, u_char *id)
+{
+    uint32_t                  hash;
+    ngx_int_t                 rc;
+    ngx_rbtree_node_t        *node, *sentinel;
+    ngx_ssl_stapling_node_t  *sn;
+
+    hash = ngx_crc32_short(id, NGX_SSL_STAPLING_ID_LEN);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        sn = (ngx_ssl_stapling_node_t *) node;
+
+        rc = ngx_memcmp(id, sn->id, NGX_SSL_STAPLING_ID_LEN);
+
+        if (rc == 0) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return sn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    sn = ngx_slab_calloc_locked(cache->shpool, sizeof(ngx_ssl_stapling_node_t));
+
+    if (sn) {
+        sn->node.key = hash;
+        ngx_memcpy(sn->id, id, NGX_SSL_STAPLING_ID_LEN);
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &sn->node);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return sn;
+}
+
+
+static void
+ngx_ssl_stapling_cache_get(ngx_ssl_stapling_t *staple, ngx_log_t *log)
+{
+    u_char                   *p;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_stapling_node_t  *node;
+
+    node = staple->node;
+
+    if (node->version == staple->version) {
+        return;
+    }
+
+    shpool = staple->cache->shpool;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    p = ngx_alloc(node->len, log);
+
+    if (p == NULL) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return;
+    }
+
+    ngx_memcpy(p, node->data, node->len);
+
+    if (staple->staple.data) {
+        ngx_free(staple->staple.data);
+    }
+
+    staple->staple.data = p;
+    staple->staple.len = node->len;
+    staple->valid = node->valid;
+    staple->version = node->version;
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static ngx_int_t
+ngx_ssl_stapling_cache_store(ngx_ssl_stapling_t *staple, u_char *data,
+    size_t len, time_t valid, time_t refresh)
+{
+    u_char                   *p;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_stapling_node_t  *node;
+
+    node = staple->node;
+    shpool = staple->cache->shpool;
 
-        ngx_memcpy(p, staple->staple.data, staple->staple.len);
+    ngx_shmtx_lock(&shpool->mutex);
 
-        SSL_set_tlsext_status_ocsp_resp(ssl_conn, p, staple->staple.len);
+    p = ngx_slab_alloc_locked(shpool, len);
 
-        rc = SSL_TLSEXT_ERR_OK;
+    if (p == NULL) {
+        node->refresh = refresh;
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_ERROR;
     }
 
-    ngx_ssl_stapling_update(staple);
+    if (node->data) {
+        ngx_slab_free_locked(shpool, node->data);
+    }
 
-    return rc;
+    ngx_memcpy(p, data, len);
+
+    node->data = p;
+    node->len = len;
+    node->valid = valid;
+    node->refresh = refresh;
+    node->version++;
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return NGX_OK;
 }
 
 
 static void
-ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
+ngx_ssl_stapling_cache_set(ngx_ssl_stapling_t *staple, ngx_str_t *response,
+    time_t valid, ngx_log_t *log)
 {
-    ngx_ssl_ocsp_ctx_t  *ctx;
-
-    if (staple->host.len == 0
-        || staple->loading || staple->refresh >= ngx_time())
+    if (ngx_ssl_stapling_cache_store(staple, response->data, response->len,
+                                     valid, staple->refresh)
+        != NGX_OK)
     {
         return;
     }
 
-    staple->loading = 1;
+    if (staple->cache->path) {
+        ngx_ssl_stapling_cache_write(staple, response, log);
+    }
+}
 
-    ctx = ngx_ssl_ocsp_start();
-    if (ctx == NULL) {
+
+static void
+ngx_ssl_stapling_cache_read(ngx_ssl_stapling_t *staple, ngx_log_t *log)
+{
+    u_char           *name, *buf;
+    size_t            len;
+    time_t            now, valid;
+    ssize_t           n;
+    ngx_fd_t          fd;
+    ngx_err_t         err;
+    ngx_file_info_t   fi;
+
+    name = ngx_ssl_stapling_cache_file(staple, log, "");
+    if (name == NULL) {
         return;
     }
 
-    ctx->cert = staple->cert;
-    ctx->issuer = staple->issuer;
-    ctx->name = staple->name;
-
-    ctx->addrs = staple->addrs;
-    ctx->host = staple->host;
-    ctx->uri = staple->uri;
-    ctx->port = staple->port;
-    ctx->timeout = staple->timeout;
+    buf = NULL;
 
-    ctx->resolver = staple->resolver;
-    ctx->resolver_timeout = staple->resolver_timeout;
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
 
-    ctx->handler = ngx_ssl_stapling_ocsp_handler;
-    ctx->data = staple;
+    if (fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
 
-    ngx_ssl_ocsp_request(ctx);
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_open_file_n " \"%s\" failed", name);
+        }
 
-    return;
-}
+        ngx_free(name);
+        return;
+    }
 
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+        goto done;
+    }
 
-static void
-ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
-{
-    int                    n;
-    size_t                 len;
-    time_t                 now, valid;
-    ngx_str_t              response;
-    X509_STORE            *store;
-    const u_char          *p;
-    STACK_OF(X509)        *chain;
-    OCSP_CERTID           *id;
-    OCSP_RESPONSE         *ocsp;
-    OCSP_BASICRESP        *basic;
-    ngx_ssl_stapling_t    *staple;
-    ASN1_GENERALIZEDTIME  *thisupdate, *nextupdate;
+    len = ngx_file_size(&fi);
 
-    staple = ctx->data;
-    now = ngx_time();
-    ocsp = NULL;
-    basic = NULL;
-    id = NULL;
+    if (len == 0 || len > 65536) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "invalid OCSP response size in \"%s\"", name);
+        goto done;
+    }
 
-    if (ctx->code != 200) {
-        goto error;
+    buf = ngx_alloc(len, log);
+    if (buf == NULL) {
+        goto done;
     }
 
-    /* check the response */
+    n = ngx_read_fd(fd, buf, len);
 
-    len = ctx->response->last - ctx->response->pos;
-    p = ctx->response->pos;
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_read_fd_n " \"%s\" failed", name);
+        goto done;
+    }
 
-    ocsp = d2i_OCSP_RESPONSE(NULL, &p, len);
-    if (ocsp == NULL) {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
-                      "d2i_OCSP_RESPONSE() failed");
-        goto error;
+    if ((size_t) n != len) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      ngx_read_fd_n " \"%s\" returned only %z bytes "
+                      "instead of %uz", name, n, len);
+        goto done;
     }
 
-    n = OCSP_response_status(ocsp);
+    /* an expired or otherwise unusable response is just ignored */
 
-    if (n != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
-                      "OCSP response not successful (%d: %s)",
-                      n, OCSP_response_status_str(n));
-        goto error;
+    if (ngx_ssl_stapling_verify(staple, buf, len, &valid, log) != NGX_OK) {
+        goto done;
     }
 
-    basic = OCSP_response_get1_basic(ocsp);
-    if (basic == NULL) {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
-                      "OCSP_response_get1_basic() failed");
-        goto error;
+    now = ngx_time();
+
+    (void) ngx_ssl_stapling_cache_store(staple, buf, len, valid,
+                                        ngx_min(valid - 300, now + 3600));
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "ssl ocsp response loaded from \"%s\"", name);
+
+done:
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
     }
 
-    store = SSL_CTX_get_cert_store(staple->ssl_ctx);
-    if (store == NULL) {
-        ngx_ssl_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "SSL_CTX_get_cert_store() failed");
-        goto error;
+    if (buf) {
+        ngx_free(buf);
     }
 
-#ifdef SSL_CTRL_SELECT_CURRENT_CERT
-    /* OpenSSL 1.0.2+ */
-    SSL_CTX_select_current_cert(staple->ssl_ctx, ctx->cert);
-#endif
+    ngx_free(name);
+}
 
-#ifdef SSL_CTRL_GET_EXTRA_CHAIN_CERTS
-    /* OpenSSL 1.0.1+ */
-    SSL_CTX_get_extra_chain_certs(staple->ssl_ctx, &chain);
-#else
-    chain = staple->ssl_ctx->extra_certs;
-#endif
 
-    if (OCSP_basic_verify(basic, chain, store,
-                          staple->verify ? OCSP_TRUSTOTHER : OCSP_NOVERIFY)
-        != 1)
-    {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
-                      "OCSP_basic_verify() failed");
-        goto error;
-    }
+static void
+ngx_ssl_stapling_cache_write(ngx_ssl_stapling_t *staple, ngx_str_t *response,
+    ngx_log_t *log)
+{
+    u_char    *name, *temp;
+    ssize_t    n;
+    ngx_fd_t   fd;
 
-    id = OCSP_cert_to_id(NULL, ctx->cert, ctx->issuer);
-    if (id == NULL) {
-        ngx_ssl_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "OCSP_cert_to_id() failed");
-        goto error;
+    name = ngx_ssl_stapling_cache_file(staple, log, "");
+    temp = ngx_ssl_stapling_cache_file(staple, log, ".tmp");
+
+    if (name == NULL || temp == NULL) {
+        goto done;
     }
 
-    if (OCSP_resp_find_status(basic, id, &n, NULL, NULL,
-                              &thisupdate, &nextupdate)
-        != 1)
-    {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
-                      "certificate status not found in the OCSP response");
-        goto error;
+    fd = ngx_open_file(temp, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp);
+        goto done;
     }
 
-    if (n != V_OCSP_CERTSTATUS_GOOD) {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
-                      "certificate status \"%s\" in the OCSP response",
-                      OCSP_cert_status_str(n));
-        goto error;
+    n = ngx_write_fd(fd, response->data, response->len);
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_write_fd_n " \"%s\" failed", temp);
+
+    } else if ((size_t) n != response->len) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      ngx_write_fd_n " \"%s\" has written only %z of %uz",
+                      temp, n, response->len);
+        n = -1;
     }
 
-    if (OCSP_check_validity(thisupdate, nextupdate, 300, -1) != 1) {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
-                      "OCSP_check_validity() failed");
-        goto error;
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+        n = -1;
     }
 
-    if (nextupdate) {
-        valid = ngx_ssl_stapling_time(nextupdate);
-        if (valid == (time_t) NGX_ERROR) {
-            ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
-                          "invalid nextUpdate time in certificate status");
-            goto error;
+    if (n == -1) {
+        if (ngx_delete_file(temp) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", temp);
         }
 
-    } else {
-        valid = NGX_MAX_TIME_T_VALUE;
+        goto done;
     }
 
-    OCSP_CERTID_free(id);
-    OCSP_BASICRESP_free(basic);
-    OCSP_RESPONSE_free(ocsp);
+    if (ngx_rename_file(temp, name) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp, name);
+    }
 
-    id = NULL;
-    basic = NULL;
-    ocsp = NULL;
+done:
 
-    /* copy the response to memory not in ctx->pool */
+    if (name) {
+        ngx_free(name);
+    }
 
-    response.len = len;
-    response.data = ngx_alloc(response.len, ctx->log);
+    if (temp) {
+        ngx_free(temp);
+    }
+}
 
-    if (response.data == NULL) {
-        goto error;
+
+static u_char *
+ngx_ssl_stapling_cache_file(ngx_ssl_stapling_t *staple, ngx_log_t *log,
+    char *suffix)
+{
+    u_char      *name, *p;
+    size_t       len;
+    ngx_str_t   *path;
+
+    /* "path/" + hex id + ".der" + suffix */
+
+    path = &staple->cache->path->name;
+
+    len = path->len + 1 + 2 * NGX_SSL_STAPLING_ID_LEN + sizeof(".der") - 1
+          + ngx_strlen(suffix) + 1;
+
+    name = ngx_alloc(len, log);
+    if (name == NULL) {
+        return NULL;
     }
 
-    ngx_memcpy(response.data, ctx->response->pos, response.len);
+    p = ngx_cpymem(name, path->data, path->len);
+    *p++ = '/';
+    p = ngx_hex_dump(p, staple->id, NGX_SSL_STAPLING_ID_LEN);
+    (void) ngx_sprintf(p, ".der%s%Z", suffix);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ctx->log, 0,
-                   "ssl ocsp response, %s, %uz",
-                   OCSP_cert_status_str(n), response.len);
+    return name;
+}
 
-    if (staple->staple.data) {
-        ngx_free(staple->staple.data);
+
+static void
+ngx_ssl_stapling_cache_handler(ngx_event_t *ev)
+{
+    time_t                     now, next;
+    ngx_uint_t                 i;
+    ngx_ssl_stapling_t       **staples;
+    ngx_ssl_stapling_node_t   *node;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    if (ngx_exiting) {
+        return;
     }
 
-    staple->staple = response;
-    staple->valid = valid;
+    cache = ev->data;
+    staples = cache->staples.elts;
 
-    /*
-     * refresh before the response expires,
-     * but not earlier than in 5 minutes, and at least in an hour
-     */
+    now = ngx_time();
+    next = 60;
 
-    staple->loading = 0;
-    staple->refresh = ngx_max(ngx_min(valid - 300, now + 3600), now + 300);
+    for (i = 0; i < cache->staples.nelts; i++) {
 
-    ngx_ssl_ocsp_done(ctx);
-    return;
+        node = staples[i]->node;
 
-error:
+        if (node->refresh <= now && !staples[i]->loading) {
 
-    staple->loading = 0;
-    staple->refresh = now + 300;
+            /*
+             * the same certificate may be used in several servers,
+             * the node is claimed until the request is done
+             */
 
-    if (id) {
-        OCSP_CERTID_free(id);
-    }
+            node->refresh = now + 300;
 
-    if (basic) {
-        OCSP_BASICRESP_free(basic);
-    }
+            ngx_ssl_stapling_request(staples[i]);
+        }
 
-    if (ocsp) {
-        OCSP_RESPONSE_free(ocsp);
+        next = ngx_min(next, node->refresh - now);
     }
 
-    ngx_ssl_ocsp_done(ctx);
+    ngx_add_timer(ev, (ngx_msec_t) ngx_max(next, 1) * 1000);
 }
 
 
-static time_t
-ngx_ssl_stapling_time(ASN1_GENERALIZEDTIME *asn1time)
+static void
+ngx_ssl_stapling_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
 {
-    BIO     *bio;
-    char    *value;
-    size_t   len;
-    time_t   time;
+    ngx_rbtree_node_t        **p;
+    ngx_ssl_stapling_node_t   *sn, *snt;
 
-    /*
-     * OpenSSL doesn't provide a way to convert ASN1_GENERALIZEDTIME
-     * into time_t.  To do this, we use ASN1_GENERALIZEDTIME_print(),
-     * which uses the "MMM DD HH:MM:SS YYYY [GMT]" format (e.g.,
-     * "Feb  3 00:55:52 2015 GMT"), and parse the result.
-     */
+    for ( ;; ) {
 
-    bio = BIO_new(BIO_s_mem());
-    if (bio == NULL) {
-        return NGX_ERROR;
-    }
+        if (node->key < temp->key) {
 
-    /* fake weekday prepended to match C asctime() format */
+            p = &temp->left;
 
-    BIO_write(bio, "Tue ", sizeof("Tue ") - 1);
-    ASN1_GENERALIZEDTIME_print(bio, asn1time);
-    len = BIO_get_mem_data(bio, &value);
+        } else if (node->key > temp->key) {
 
-    time = ngx_parse_http_time((u_char *) value, len);
+            p = &temp->right;
 
-    BIO_free(bio);
+        } else { /* node->key == temp->key */
 
-    return time;
-}
+            sn = (ngx_ssl_stapling_node_t *) node;
+            snt = (ngx_ssl_stapling_node_t *) temp;
 
+            p = (ngx_memcmp(sn->id, snt->id, NGX_SSL_STAPLING_ID_LEN) < 0)
+                ? &temp->left : &temp->right;
+        }
 
-static void
-ngx_ssl_stapling_cleanup(void *data)
-{
-    ngx_ssl_stapling_t  *staple = data;
+        if (*p == sentinel) {
+            break;
+        }
 
-    if (staple->issuer) {
-        X509_free(staple->issuer);
+        temp = *p;
     }
 
-    if (staple->staple.data) {
-        ngx_free(staple->staple.data);
-    }
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
 }
 
 
@@ -1891,4 +2748,34 @@ ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
 }
 
 
+char *
+ngx_ssl_stapling_cache_zone(ngx_conf_t *cf, ngx_shm_zone_t **zone, void *tag)
+{
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "\"%V\" ignored, not supported", &value[0]);
+
+    *zone = NULL;
+
+    return NGX_CONF_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_shm_zone_t *shm_zone)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_init_process(ngx_cycle_t *cycle)
+{
+    return NGX_OK;
+}
+
+
 #endif
@@ -13,8 +13,12 @@
 
 static ngx_int_t ngx_event_pipe_read_upstream(ngx_event_pipe_t *p);
 static ngx_int_t ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p);
+static size_t ngx_event_pipe_buf_size(ngx_event_pipe_t *p);
 
 static ngx_int_t ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p);
+static ngx_int_t ngx_event_pipe_write_behind(ngx_event_pipe_t *p,
+    ngx_chain_t **out);
+static ngx_int_t ngx_event_pipe_release_out_bufs(ngx_event_pipe_t *p);
 static ngx_inline void ngx_event_pipe_remove_shadow_links(ngx_buf_t *buf);
 static ngx_int_t ngx_event_pipe_drain_chains(ngx_event_pipe_t *p);
 
@@ -229,16 +233,25 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
                     p->free_raw_bufs = NULL;
                 }
 
-            } else if (p->allocated < p->bufs.num) {
+            } else if ((size = ngx_event_pipe_buf_size(p)) != 0) {
 
                 /* allocate a new buf if it's still allowed */
 
-                b = ngx_create_temp_buf(p->pool, p->bufs.size);
+                b = ngx_create_temp_buf(p->pool, size);
                 if (b == NULL) {
                     return NGX_ABORT;
                 }
 
                 p->allocated++;
+                p->allocated_size += size;
+
+                if (p->adaptive) {
+                    p->buf_size = ngx_min((size_t) size * 2, p->bufs.size);
+
+                    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                                   "pipe buf alloc: %z, next: %uz",
+                                   size, p->buf_size);
+                }
 
                 chain = ngx_alloc_chain_link(p->pool);
                 if (chain == NULL) {
@@ -248,7 +261,7 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
                 chain->buf = b;
                 chain->next = NULL;
 
-            } else if (!p->cacheable
+            } else if ((!p->cacheable || p->write_behind)
                        && p->downstream->data == p->output_ctx
                        && p->downstream->write->ready
                        && !p->downstream->write->delayed)
@@ -274,17 +287,40 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
                  * to a temporary file, and add them to a p->out chain
                  */
 
-                rc = ngx_event_pipe_write_chain_to_temp_file(p);
+                if (p->in || p->buf_to_file || !p->write_behind) {
 
-                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, p->log, 0,
-                               "pipe temp offset: %O", p->temp_file->offset);
+                    rc = ngx_event_pipe_write_chain_to_temp_file(p);
 
-                if (rc == NGX_BUSY) {
-                    break;
+                    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                                   "pipe temp offset: %O",
+                                   p->temp_file->offset);
+
+                    if (rc == NGX_BUSY) {
+                        break;
+                    }
+
+                    if (rc != NGX_OK) {
+                        return rc;
+                    }
                 }
 
-                if (rc != NGX_OK) {
-                    return rc;
+                if (p->write_behind) {
+
+                    /*
+                     * the bufs sent from memory are already in the file,
+                     * so the ones not passed to a downstream yet are
+                     * switched to the file to free the memory
+                     */
+
+                    if (ngx_event_pipe_release_out_bufs(p) != NGX_OK) {
+                        return NGX_ABORT;
+                    }
+
+                    if (p->free_raw_bufs == NULL) {
+                        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                                       "no pipe bufs to read in");
+                        break;
+                    }
                 }
 
                 chain = p->free_raw_bufs;
@@ -498,6 +534,45 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
 }
 
 
+static size_t
+ngx_event_pipe_buf_size(ngx_event_pipe_t *p)
+{
+    size_t  size, budget;
+
+    if (!p->adaptive) {
+        return (p->allocated < p->bufs.num) ? p->bufs.size : 0;
+    }
+
+    /*
+     * in the adaptive mode the bufs start small and double each time
+     * all the previous ones were filled, up to the configured buf size;
+     * the total amount of memory is still limited by "num * size"
+     */
+
+    budget = p->bufs.num * p->bufs.size;
+
+    if (p->allocated_size >= budget) {
+        return 0;
+    }
+
+    size = p->buf_size;
+
+    if (size == 0) {
+        size = ngx_min(p->bufs.size, NGX_EVENT_PIPE_ADAPTIVE_BUF);
+    }
+
+    if (p->length > (off_t) size) {
+
+        /* the rest of the response length is known */
+
+        size = (p->length < (off_t) p->bufs.size) ? (size_t) p->length
+                                                   : p->bufs.size;
+    }
+
+    return ngx_min(size, budget - p->allocated_size);
+}
+
+
 static ngx_int_t
 ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
 {
@@ -632,8 +707,26 @@ ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
                 cl = p->out;
 
                 if (cl->buf->recycled) {
-                    ngx_log_error(NGX_LOG_ALERT, p->log, 0,
-                                  "recycled buffer in pipe out chain");
+
+                    if (!p->write_behind) {
+                        ngx_log_error(NGX_LOG_ALERT, p->log, 0,
+                                      "recycled buffer in pipe out chain");
+
+                    } else if (prev_last_shadow) {
+
+                        /* a memory buf already saved to a file */
+
+                        if (bsize + cl->buf->end - cl->buf->start
+                            > p->busy_size)
+                        {
+                            flush = 1;
+                            break;
+                        }
+
+                        bsize += cl->buf->end - cl->buf->start;
+                    }
+
+                    prev_last_shadow = cl->buf->last_shadow;
                 }
 
                 p->out = p->out->next;
@@ -827,6 +920,12 @@ ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p)
         }
 
     } else {
+        if (p->write_behind && p->in) {
+            if (ngx_event_pipe_write_behind(p, &out) != NGX_OK) {
+                return NGX_ABORT;
+            }
+        }
+
         p->in = NULL;
         p->last_in = &p->in;
     }
@@ -865,6 +964,14 @@ done:
         out = out->next;
     }
 
+    if (n > 0 && p->write_behind) {
+
+        /* the bufs are already in the p->out chain */
+
+        p->temp_file->offset += n;
+        goto free;
+    }
+
     if (n > 0) {
         /* update previous buffer or add new buffer */
 
@@ -948,6 +1055,135 @@ free:
 }
 
 
+static ngx_int_t
+ngx_event_pipe_write_behind(ngx_event_pipe_t *p, ngx_chain_t **out)
+{
+    off_t         offset;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl, *tl, **ll;
+
+    /*
+     * the p->in bufs are moved to the p->out chain to be sent from memory,
+     * and their copies without shadow links are written to the file;
+     * the raw bufs are not read into until the write is complete
+     */
+
+    ll = out;
+    offset = p->temp_file->offset;
+
+    if (p->buf_to_file) {
+        ll = &(*out)->next;
+        offset = p->buf_to_file->last - p->buf_to_file->pos;
+    }
+
+    for (cl = p->in; cl; cl = cl->next) {
+
+        tl = ngx_chain_get_free_buf(p->pool, &p->free);
+        if (tl == NULL) {
+            return NGX_ERROR;
+        }
+
+        b = tl->buf;
+
+        ngx_memcpy(b, cl->buf, sizeof(ngx_buf_t));
+        b->shadow = NULL;
+        b->last_shadow = 0;
+        b->recycled = 0;
+
+        *ll = tl;
+        ll = &tl->next;
+
+        b = cl->buf;
+
+        b->file = &p->temp_file->file;
+        b->file_pos = offset;
+        offset += b->last - b->pos;
+        b->file_last = offset;
+    }
+
+    *ll = NULL;
+
+    if (p->out) {
+        for (cl = p->out; cl->next; cl = cl->next) { /* void */ }
+        cl->next = p->in;
+
+    } else {
+        p->out = p->in;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_event_pipe_release_out_bufs(ngx_event_pipe_t *p)
+{
+    ngx_buf_t    *b, *s, *raw, *busy;
+    ngx_uint_t    first;
+    ngx_chain_t  *cl;
+
+    busy = NULL;
+    first = 1;
+
+    for (cl = p->out; cl; cl = cl->next) {
+        b = cl->buf;
+
+        if (b->in_file) {
+            continue;
+        }
+
+        for (s = b; s && !s->last_shadow; s = s->shadow) { /* void */ }
+
+        if (s == NULL) {
+            continue;
+        }
+
+        raw = s->shadow;
+
+        if (first) {
+            first = 0;
+
+            /*
+             * the first shadow bufs of the first raw buf
+             * may still be in a downstream
+             */
+
+            if (raw->shadow != b) {
+                busy = raw;
+            }
+        }
+
+        if (raw == busy) {
+            continue;
+        }
+
+        if (b->last_shadow) {
+            if (ngx_event_pipe_add_free_buf(p, raw) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        b->start = NULL;
+        b->end = NULL;
+        b->pos = NULL;
+        b->last = NULL;
+        b->temporary = 0;
+        b->recycled = 0;
+        b->last_shadow = 0;
+        b->shadow = NULL;
+
+        b->in_file = 1;
+        b->temp_file = 1;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                       "pipe write behind to file: %O-%O",
+                       b->file_pos, b->file_last);
+    }
+
+    return NGX_OK;
+}
+
+
 /* the copy input filter */
 
 ngx_int_t
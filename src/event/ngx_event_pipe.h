@@ -14,6 +14,9 @@
 #include <ngx_event.h>
 
 
+#define NGX_EVENT_PIPE_ADAPTIVE_BUF  1024
+
+
 typedef struct ngx_event_pipe_s  ngx_event_pipe_t;
 
 typedef ngx_int_t (*ngx_event_pipe_input_filter_pt)(ngx_event_pipe_t *p,
@@ -66,8 +69,12 @@ struct ngx_event_pipe_s {
     unsigned           downstream_error:1;
     unsigned           cyclic_temp_file:1;
     unsigned           aio:1;
+    unsigned           adaptive:1;
+    unsigned           write_behind:1;
 
     ngx_int_t          allocated;
+    size_t             allocated_size;
+    size_t             buf_size;
     ngx_bufs_t         bufs;
     ngx_buf_tag_t      tag;
 
@@ -10,9 +10,53 @@
 #include <ngx_event.h>
 
 
+/*
+ * The hierarchical timer wheel: the first level has 256 one-millisecond
+ * slots, each next level has 64 slots, every slot covering the whole
+ * previous level.  Timers of upper levels are cascaded down when the wheel
+ * reaches the slot boundary, the timers beyond the last level are kept
+ * in its farthest slot and are re-added on cascading.
+ *
+ * The wheel reuses the timer rbtree node of an event: node->left and
+ * node->right link the slot list, node->color keeps the level number.
+ */
+
+#define NGX_TIMER_WHEEL_LEVELS   5
+#define NGX_TIMER_WHEEL_BITS0    8
+#define NGX_TIMER_WHEEL_BITS     6
+#define NGX_TIMER_WHEEL_SIZE0    (1 << NGX_TIMER_WHEEL_BITS0)
+#define NGX_TIMER_WHEEL_SIZE     (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_SLOTS                                                 \
+    (NGX_TIMER_WHEEL_SIZE0                                                    \
+     + (NGX_TIMER_WHEEL_LEVELS - 1) * NGX_TIMER_WHEEL_SIZE)
+
+#define ngx_event_timer_wheel_shift(l)                                        \
+    ((l) ? NGX_TIMER_WHEEL_BITS0 + ((l) - 1) * NGX_TIMER_WHEEL_BITS : 0)
+
+#define ngx_event_timer_wheel_slot(l, i)                                      \
+    (&ngx_event_timer_slots[(l) ? NGX_TIMER_WHEEL_SIZE0                      \
+                               + ((l) - 1) * NGX_TIMER_WHEEL_SIZE + (i)      \
+                             : (i)])
+
+
+static ngx_msec_t ngx_event_timer_wheel_find(void);
+static void ngx_event_timer_wheel_expire(void);
+static void ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_uint_t i);
+static ngx_int_t ngx_event_timer_wheel_no_timers_left(void);
+
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
+ngx_uint_t                ngx_event_timer_wheel;
+
+static ngx_rbtree_node_t  ngx_event_timer_slots[NGX_TIMER_WHEEL_SLOTS];
+static ngx_uint_t         ngx_event_timer_count[NGX_TIMER_WHEEL_LEVELS];
+static ngx_uint_t         ngx_event_timer_total;
+
+/* the first tick which is not processed yet */
+static ngx_msec_t         ngx_event_timer_next;
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -22,9 +66,26 @@ static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+    ngx_uint_t          i;
+    ngx_rbtree_node_t  *slot;
+
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    if (!ngx_event_timer_wheel) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < NGX_TIMER_WHEEL_SLOTS; i++) {
+        slot = &ngx_event_timer_slots[i];
+        slot->left = slot;
+        slot->right = slot;
+    }
+
+    ngx_memzero(ngx_event_timer_count, sizeof(ngx_event_timer_count));
+    ngx_event_timer_total = 0;
+    ngx_event_timer_next = ngx_current_msec;
+
     return NGX_OK;
 }
 
@@ -35,6 +96,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_find();
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -56,6 +121,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_expire();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -91,7 +161,7 @@ ngx_event_expire_timers(void)
 
         ev->timedout = 1;
 
-        ev->handler(ev);
+        ngx_event_call(ev);
     }
 }
 
@@ -102,6 +172,10 @@ ngx_event_no_timers_left(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_no_timers_left();
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
     root = ngx_event_timer_rbtree.root;
 
@@ -124,3 +198,272 @@ ngx_event_no_timers_left(void)
 
     return NGX_OK;
 }
+
+
+void
+ngx_event_timer_wheel_add(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          level, shift;
+    ngx_msec_t          key, next;
+    ngx_rbtree_node_t  *slot;
+
+    key = node->key;
+    next = ngx_event_timer_next;
+
+    /* the expired timers go to the first tick to be processed */
+
+    if ((ngx_msec_int_t) (key - next) < 0) {
+        key = next;
+    }
+
+    if (key - next < NGX_TIMER_WHEEL_SIZE0) {
+        level = 0;
+        slot = ngx_event_timer_wheel_slot(0, key & (NGX_TIMER_WHEEL_SIZE0 - 1));
+
+    } else {
+
+        for (level = 1; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+            shift = ngx_event_timer_wheel_shift(level);
+
+            if ((key >> shift) - (next >> shift) < NGX_TIMER_WHEEL_SIZE) {
+                break;
+            }
+        }
+
+        shift = ngx_event_timer_wheel_shift(level);
+
+        if ((key >> shift) - (next >> shift) >= NGX_TIMER_WHEEL_SIZE) {
+            key = ((next >> shift) + NGX_TIMER_WHEEL_SIZE - 1) << shift;
+        }
+
+        slot = ngx_event_timer_wheel_slot(level, (key >> shift)
+                                                 & (NGX_TIMER_WHEEL_SIZE - 1));
+    }
+
+    node->right = slot;
+    node->left = slot->left;
+    slot->left->right = node;
+    slot->left = node;
+
+    node->color = (u_char) level;
+
+    ngx_event_timer_count[level]++;
+    ngx_event_timer_total++;
+}
+
+
+void
+ngx_event_timer_wheel_del(ngx_rbtree_node_t *node)
+{
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    ngx_event_timer_count[node->color]--;
+    ngx_event_timer_total--;
+}
+
+
+static ngx_msec_t
+ngx_event_timer_wheel_find(void)
+{
+    ngx_msec_t          key, base;
+    ngx_uint_t          i, level, shift;
+    ngx_msec_int_t      timer;
+    ngx_rbtree_node_t  *slot;
+
+    if (ngx_event_timer_total == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    /* all keys of a first level slot are the same */
+
+    if (ngx_event_timer_count[0]) {
+
+        for (i = 0; i < NGX_TIMER_WHEEL_SIZE0; i++) {
+            key = ngx_event_timer_next + i;
+            slot = ngx_event_timer_wheel_slot(0,
+                                            key & (NGX_TIMER_WHEEL_SIZE0 - 1));
+
+            if (slot->right != slot) {
+                goto found;
+            }
+        }
+    }
+
+    /*
+     * an upper level slot is reported by the time of its cascading,
+     * which is not later than any timer in the slot
+     */
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+
+        if (ngx_event_timer_count[level] == 0) {
+            continue;
+        }
+
+        shift = ngx_event_timer_wheel_shift(level);
+        base = ngx_event_timer_next >> shift;
+
+        for (i = 1; i < NGX_TIMER_WHEEL_SIZE; i++) {
+            slot = ngx_event_timer_wheel_slot(level,
+                                       (base + i) & (NGX_TIMER_WHEEL_SIZE - 1));
+
+            if (slot->right != slot) {
+                key = (base + i) << shift;
+                goto found;
+            }
+        }
+    }
+
+    return NGX_TIMER_INFINITE;
+
+found:
+
+    timer = (ngx_msec_int_t) (key - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+static void
+ngx_event_timer_wheel_expire(void)
+{
+    ngx_msec_t          boundary;
+    ngx_uint_t          i, level;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *slot, *node;
+
+    for ( ;; ) {
+
+        if ((ngx_msec_int_t) (ngx_current_msec - ngx_event_timer_next) < 0) {
+            return;
+        }
+
+        if (ngx_event_timer_total == 0) {
+            ngx_event_timer_next = ngx_current_msec;
+            return;
+        }
+
+        if ((ngx_event_timer_next & (NGX_TIMER_WHEEL_SIZE0 - 1)) == 0) {
+
+            for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+                i = (ngx_event_timer_next >> ngx_event_timer_wheel_shift(level))
+                    & (NGX_TIMER_WHEEL_SIZE - 1);
+
+                ngx_event_timer_wheel_cascade(level, i);
+
+                if (i) {
+                    break;
+                }
+            }
+        }
+
+        slot = ngx_event_timer_wheel_slot(0, ngx_event_timer_next
+                                             & (NGX_TIMER_WHEEL_SIZE0 - 1));
+
+        while (slot->right != slot) {
+            node = slot->right;
+
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ngx_event_timer_wheel_del(node);
+
+#if (NGX_DEBUG)
+            ev->timer.left = NULL;
+            ev->timer.right = NULL;
+            ev->timer.parent = NULL;
+#endif
+
+            ev->timer_set = 0;
+
+            ev->timedout = 1;
+
+            ngx_event_call(ev);
+        }
+
+        ngx_event_timer_next++;
+
+        if (ngx_event_timer_count[0]) {
+            continue;
+        }
+
+        /* skip empty first level slots up to the next cascading */
+
+        boundary = (ngx_event_timer_next + NGX_TIMER_WHEEL_SIZE0 - 1)
+                   & ~((ngx_msec_t) NGX_TIMER_WHEEL_SIZE0 - 1);
+
+        if ((ngx_msec_int_t) (ngx_current_msec - boundary) >= 0) {
+            ngx_event_timer_next = boundary;
+
+        } else if ((ngx_msec_int_t) (ngx_current_msec - ngx_event_timer_next)
+                   > 0)
+        {
+            ngx_event_timer_next = ngx_current_msec;
+        }
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_uint_t i)
+{
+    ngx_rbtree_node_t  *slot, *node, *next, list;
+
+    slot = ngx_event_timer_wheel_slot(level, i);
+
+    if (slot->right == slot) {
+        return;
+    }
+
+    /* move the slot list aside as the timers may return to the same slot */
+
+    list.right = slot->right;
+    list.left = slot->left;
+    list.right->left = &list;
+    list.left->right = &list;
+
+    slot->left = slot;
+    slot->right = slot;
+
+    for (node = list.right; node != &list; node = next) {
+        next = node->right;
+
+        ngx_event_timer_count[level]--;
+        ngx_event_timer_total--;
+
+        ngx_event_timer_wheel_add(node);
+    }
+}
+
+
+static ngx_int_t
+ngx_event_timer_wheel_no_timers_left(void)
+{
+    ngx_uint_t          i;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *slot, *node;
+
+    if (ngx_event_timer_total == 0) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < NGX_TIMER_WHEEL_SLOTS; i++) {
+        slot = &ngx_event_timer_slots[i];
+
+        for (node = slot->right; node != slot; node = node->right) {
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+            if (!ev->cancelable) {
+                return NGX_AGAIN;
+            }
+        }
+    }
+
+    /* only cancelable timers left */
+
+    return NGX_OK;
+}
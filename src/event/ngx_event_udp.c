@@ -12,13 +12,37 @@
 
 #if !(NGX_WIN32)
 
-struct ngx_udp_connection_s {
-    ngx_rbtree_node_t   node;
-    ngx_connection_t   *connection;
-    ngx_buf_t          *buffer;
+/*
+ * with "udp_sessions hash" connections of a listening socket are kept
+ * in an open addressing table with linear probing; a slot holds the hash
+ * along with the connection so that most of the probes do not touch
+ * the connections, and the table is doubled when it is half full
+ */
+
+typedef struct {
+    uint32_t               hash;
+    ngx_udp_connection_t  *udp;
+} ngx_udp_flow_t;
+
+
+struct ngx_udp_flows_s {
+    ngx_udp_flow_t        *slots;
+    ngx_uint_t             mask;
+    ngx_uint_t             nelts;
 };
 
 
+#define NGX_UDP_FLOWS_MIN  64
+
+
+ngx_uint_t  ngx_udp_sessions_hash;
+
+
+#if (NGX_HAVE_SENDMMSG)
+static void ngx_event_recvmmsg(ngx_event_t *ev);
+#endif
+static ngx_int_t ngx_event_udp_datagram(ngx_event_t *ev, struct msghdr *msg,
+    u_char *buffer, ssize_t n);
 static void ngx_close_accepted_udp_connection(ngx_connection_t *c);
 static ssize_t ngx_udp_shared_recv(ngx_connection_t *c, u_char *buf,
     size_t size);
@@ -26,24 +50,37 @@ static ngx_int_t ngx_insert_udp_connection(ngx_connection_t *c);
 static ngx_connection_t *ngx_lookup_udp_connection(ngx_listening_t *ls,
     struct sockaddr *sockaddr, socklen_t socklen,
     struct sockaddr *local_sockaddr, socklen_t local_socklen);
+static uint32_t ngx_udp_hash(ngx_listening_t *ls, struct sockaddr *sockaddr,
+    socklen_t socklen, struct sockaddr *local_sockaddr,
+    socklen_t local_socklen);
+static ngx_int_t ngx_udp_flows_insert(ngx_listening_t *ls,
+    ngx_udp_connection_t *udp);
+static ngx_int_t ngx_udp_flows_resize(ngx_udp_flows_t *flows,
+    ngx_uint_t size);
+static void ngx_udp_flows_delete(ngx_udp_flows_t *flows,
+    ngx_udp_connection_t *udp);
+static ngx_connection_t *ngx_udp_flows_lookup(ngx_listening_t *ls,
+    uint32_t hash, struct sockaddr *sockaddr, socklen_t socklen,
+    struct sockaddr *local_sockaddr, socklen_t local_socklen);
+static void ngx_udp_flows_cleanup(void *data);
+#if (NGX_QUIC)
+static ngx_connection_t *ngx_lookup_udp_connection_id(ngx_listening_t *ls,
+    ngx_str_t *key);
+static void ngx_delete_udp_connection_id(void *data);
+#endif
 
 
 void
 ngx_event_recvmsg(ngx_event_t *ev)
 {
     ssize_t            n;
-    ngx_buf_t          buf;
-    ngx_log_t         *log;
     ngx_err_t          err;
-    socklen_t          socklen, local_socklen;
-    ngx_event_t       *rev, *wev;
     struct iovec       iov[1];
     struct msghdr      msg;
-    ngx_sockaddr_t     sa, lsa;
-    struct sockaddr   *sockaddr, *local_sockaddr;
+    ngx_sockaddr_t     sa;
     ngx_listening_t   *ls;
     ngx_event_conf_t  *ecf;
-    ngx_connection_t  *c, *lc;
+    ngx_connection_t  *lc;
     static u_char      buffer[65535];
 
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
@@ -81,6 +118,15 @@ ngx_event_recvmsg(ngx_event_t *ev)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "recvmsg on %V, ready: %d", &ls->addr_text, ev->available);
 
+#if (NGX_HAVE_SENDMMSG)
+
+    if (ecf->udp_batch) {
+        ngx_event_recvmmsg(ev);
+        return;
+    }
+
+#endif
+
     do {
         ngx_memzero(&msg, sizeof(struct msghdr));
 
@@ -129,297 +175,485 @@ ngx_event_recvmsg(ngx_event_t *ev)
             return;
         }
 
-#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
-        if (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
-            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
-                          "recvmsg() truncated data");
-            continue;
+        if (ngx_event_loop_timing) {
+            ngx_event_loop_udp(0, 1, 1);
+        }
+
+        if (ngx_event_udp_datagram(ev, &msg, buffer, n) == NGX_ERROR) {
+            return;
+        }
+
+        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+            ev->available -= n;
         }
+
+    } while (ev->available);
+}
+
+
+#if (NGX_HAVE_SENDMMSG)
+
+static void
+ngx_event_recvmmsg(ngx_event_t *ev)
+{
+    int                     size;
+    u_char                 *p, *last;
+    ngx_int_t               n, i;
+    ngx_err_t               err;
+    ngx_uint_t              count;
+    struct msghdr          *msg;
+    ngx_connection_t       *lc;
+#if (NGX_HAVE_UDP_GRO)
+    struct cmsghdr         *cmsg;
 #endif
 
-        sockaddr = msg.msg_name;
-        socklen = msg.msg_namelen;
+    static struct mmsghdr   msgs[NGX_UDP_BATCH];
+    static struct iovec     iovs[NGX_UDP_BATCH];
+    static ngx_sockaddr_t   sockaddrs[NGX_UDP_BATCH];
+    static u_char           controls[NGX_UDP_BATCH][NGX_UDP_CONTROL_LEN];
+    static u_char           buffers[NGX_UDP_BATCH][65535];
+
+    lc = ev->data;
+
+    /*
+     * the buffers are only touched as far as datagrams are written there,
+     * so small datagrams do not make the whole batch resident
+     */
+
+    do {
+        for (i = 0; i < NGX_UDP_BATCH; i++) {
+            iovs[i].iov_base = (void *) buffers[i];
+            iovs[i].iov_len = sizeof(buffers[i]);
 
-        if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
-            socklen = sizeof(ngx_sockaddr_t);
+            msg = &msgs[i].msg_hdr;
+
+            ngx_memzero(msg, sizeof(struct msghdr));
+
+            msg->msg_name = &sockaddrs[i];
+            msg->msg_namelen = sizeof(ngx_sockaddr_t);
+            msg->msg_iov = &iovs[i];
+            msg->msg_iovlen = 1;
+            msg->msg_control = controls[i];
+            msg->msg_controllen = NGX_UDP_CONTROL_LEN;
         }
 
-        if (socklen == 0) {
+        n = recvmmsg(lc->fd, msgs, NGX_UDP_BATCH, 0, NULL);
 
-            /*
-             * on Linux recvmsg() returns zero msg_namelen
-             * when receiving packets from unbound AF_UNIX sockets
-             */
+        if (n == -1) {
+            err = ngx_socket_errno;
 
-            socklen = sizeof(struct sockaddr);
-            ngx_memzero(&sa, sizeof(struct sockaddr));
-            sa.sockaddr.sa_family = ls->sockaddr->sa_family;
+            if (err == NGX_EAGAIN) {
+                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
+                               "recvmmsg() not ready");
+                return;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err, "recvmmsg() failed");
+
+            return;
         }
 
-        local_sockaddr = ls->sockaddr;
-        local_socklen = ls->socklen;
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "recvmmsg on %V: %i", &lc->listening->addr_text, n);
 
-#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+        count = 0;
 
-        if (ls->wildcard) {
-            struct cmsghdr  *cmsg;
+        for (i = 0; i < n; i++) {
+            msg = &msgs[i].msg_hdr;
 
-            ngx_memcpy(&lsa, local_sockaddr, local_socklen);
-            local_sockaddr = &lsa.sockaddr;
+            p = buffers[i];
+            last = p + msgs[i].msg_len;
+            size = 0;
 
-            for (cmsg = CMSG_FIRSTHDR(&msg);
+#if (NGX_HAVE_UDP_GRO)
+
+            /* the kernel may coalesce datagrams of a flow into a buffer */
+
+            for (cmsg = CMSG_FIRSTHDR(msg);
                  cmsg != NULL;
-                 cmsg = CMSG_NXTHDR(&msg, cmsg))
+                 cmsg = CMSG_NXTHDR(msg, cmsg))
             {
+                if (cmsg->cmsg_level == SOL_UDP
+                    && cmsg->cmsg_type == UDP_GRO)
+                {
+                    ngx_memcpy(&size, CMSG_DATA(cmsg), sizeof(int));
+                    break;
+                }
+            }
 
-#if (NGX_HAVE_IP_RECVDSTADDR)
+#endif
 
-                if (cmsg->cmsg_level == IPPROTO_IP
-                    && cmsg->cmsg_type == IP_RECVDSTADDR
-                    && local_sockaddr->sa_family == AF_INET)
-                {
-                    struct in_addr      *addr;
-                    struct sockaddr_in  *sin;
+            if (size <= 0) {
+                size = last - p;
+            }
 
-                    addr = (struct in_addr *) CMSG_DATA(cmsg);
-                    sin = (struct sockaddr_in *) local_sockaddr;
-                    sin->sin_addr = *addr;
+            count += (last - p + size - 1) / size;
 
-                    break;
+            do {
+                if (ngx_event_udp_datagram(ev, msg, p,
+                                           ngx_min(size, last - p))
+                    == NGX_ERROR)
+                {
+                    return;
                 }
 
+                p += size;
+
+            } while (p < last);
+        }
+
+        if (ngx_event_loop_timing) {
+            ngx_event_loop_udp(0, 1, count);
+        }
+
+    } while (ev->available && n == NGX_UDP_BATCH);
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_event_udp_datagram(ngx_event_t *ev, struct msghdr *msg, u_char *buffer,
+    ssize_t n)
+{
+    ngx_buf_t          buf;
+    ngx_log_t         *log;
+    socklen_t          socklen, local_socklen;
+    ngx_event_t       *rev, *wev;
+    ngx_sockaddr_t     lsa;
+    struct sockaddr   *sockaddr, *local_sockaddr;
+    ngx_listening_t   *ls;
+    ngx_connection_t  *c, *lc;
+#if (NGX_DEBUG)
+    ngx_event_conf_t  *ecf;
+#endif
+
+    lc = ev->data;
+    ls = lc->listening;
+
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    if (msg->msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      "recvmsg() truncated data");
+        return NGX_DECLINED;
+    }
+#endif
+
+    sockaddr = msg->msg_name;
+    socklen = msg->msg_namelen;
+
+    if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
+        socklen = sizeof(ngx_sockaddr_t);
+    }
+
+    if (socklen == 0) {
+
+        /*
+         * on Linux recvmsg() returns zero msg_namelen
+         * when receiving packets from unbound AF_UNIX sockets
+         */
+
+        socklen = sizeof(struct sockaddr);
+        ngx_memzero(sockaddr, sizeof(struct sockaddr));
+        sockaddr->sa_family = ls->sockaddr->sa_family;
+    }
+
+    local_sockaddr = ls->sockaddr;
+    local_socklen = ls->socklen;
+
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+
+    if (ls->wildcard) {
+        struct cmsghdr  *cmsg;
+
+        ngx_memcpy(&lsa, local_sockaddr, local_socklen);
+        local_sockaddr = &lsa.sockaddr;
+
+        for (cmsg = CMSG_FIRSTHDR(msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(msg, cmsg))
+        {
+
+#if (NGX_HAVE_IP_RECVDSTADDR)
+
+            if (cmsg->cmsg_level == IPPROTO_IP
+                && cmsg->cmsg_type == IP_RECVDSTADDR
+                && local_sockaddr->sa_family == AF_INET)
+            {
+                struct in_addr      *addr;
+                struct sockaddr_in  *sin;
+
+                addr = (struct in_addr *) CMSG_DATA(cmsg);
+                sin = (struct sockaddr_in *) local_sockaddr;
+                sin->sin_addr = *addr;
+
+                break;
+            }
+
 #elif (NGX_HAVE_IP_PKTINFO)
 
-                if (cmsg->cmsg_level == IPPROTO_IP
-                    && cmsg->cmsg_type == IP_PKTINFO
-                    && local_sockaddr->sa_family == AF_INET)
-                {
-                    struct in_pktinfo   *pkt;
-                    struct sockaddr_in  *sin;
+            if (cmsg->cmsg_level == IPPROTO_IP
+                && cmsg->cmsg_type == IP_PKTINFO
+                && local_sockaddr->sa_family == AF_INET)
+            {
+                struct in_pktinfo   *pkt;
+                struct sockaddr_in  *sin;
 
-                    pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
-                    sin = (struct sockaddr_in *) local_sockaddr;
-                    sin->sin_addr = pkt->ipi_addr;
+                pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+                sin = (struct sockaddr_in *) local_sockaddr;
+                sin->sin_addr = pkt->ipi_addr;
 
-                    break;
-                }
+                break;
+            }
 
 #endif
 
 #if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
 
-                if (cmsg->cmsg_level == IPPROTO_IPV6
-                    && cmsg->cmsg_type == IPV6_PKTINFO
-                    && local_sockaddr->sa_family == AF_INET6)
-                {
-                    struct in6_pktinfo   *pkt6;
-                    struct sockaddr_in6  *sin6;
+            if (cmsg->cmsg_level == IPPROTO_IPV6
+                && cmsg->cmsg_type == IPV6_PKTINFO
+                && local_sockaddr->sa_family == AF_INET6)
+            {
+                struct in6_pktinfo   *pkt6;
+                struct sockaddr_in6  *sin6;
 
-                    pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-                    sin6 = (struct sockaddr_in6 *) local_sockaddr;
-                    sin6->sin6_addr = pkt6->ipi6_addr;
+                pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+                sin6 = (struct sockaddr_in6 *) local_sockaddr;
+                sin6->sin6_addr = pkt6->ipi6_addr;
 
-                    break;
-                }
+                break;
+            }
 
 #endif
 
-            }
         }
+    }
 
 #endif
 
+#if (NGX_QUIC)
+
+    if (ls->quic) {
+        ngx_str_t  key;
+
+        /* packets are routed by the connection id, as addresses may change */
+
+        if (ngx_quic_get_packet_dcid(ev->log, buffer, n, &key) != NGX_OK) {
+            return NGX_DECLINED;
+        }
+
+        c = ngx_lookup_udp_connection_id(ls, &key);
+
+        if (c && ngx_cmp_sockaddr(sockaddr, socklen, c->sockaddr, c->socklen,
+                                  1)
+                 != NGX_OK)
+        {
+            /* connection migration is not supported */
+
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "quic packet from another address ignored");
+            return NGX_DECLINED;
+        }
+
+    } else
+#endif
+    {
         c = ngx_lookup_udp_connection(ls, sockaddr, socklen, local_sockaddr,
                                       local_socklen);
+    }
 
-        if (c) {
+    if (c) {
 
 #if (NGX_DEBUG)
-            if (c->log->log_level & NGX_LOG_DEBUG_EVENT) {
-                ngx_log_handler_pt  handler;
+        if (c->log->log_level & NGX_LOG_DEBUG_EVENT) {
+            ngx_log_handler_pt  handler;
 
-                handler = c->log->handler;
-                c->log->handler = NULL;
+            handler = c->log->handler;
+            c->log->handler = NULL;
 
-                ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                               "recvmsg: fd:%d n:%z", c->fd, n);
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "recvmsg: fd:%d n:%z", c->fd, n);
 
-                c->log->handler = handler;
-            }
+            c->log->handler = handler;
+        }
 #endif
 
-            ngx_memzero(&buf, sizeof(ngx_buf_t));
+        ngx_memzero(&buf, sizeof(ngx_buf_t));
 
-            buf.pos = buffer;
-            buf.last = buffer + n;
+        buf.pos = buffer;
+        buf.last = buffer + n;
 
-            rev = c->read;
+        rev = c->read;
 
-            c->udp->buffer = &buf;
+        c->udp->buffer = &buf;
 
-            rev->ready = 1;
-            rev->active = 0;
+        rev->ready = 1;
+        rev->active = 0;
 
-            rev->handler(rev);
+        rev->handler(rev);
 
-            if (c->udp) {
-                c->udp->buffer = NULL;
-            }
+        if (c->udp) {
+            c->udp->buffer = NULL;
+        }
 
-            rev->ready = 0;
-            rev->active = 1;
+        rev->ready = 0;
+        rev->active = 1;
 
-            goto next;
-        }
+        return NGX_OK;
+    }
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+    (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
 #endif
 
-        ngx_accept_disabled = ngx_cycle->connection_n / 8
-                              - ngx_cycle->free_connection_n;
+    if (ngx_event_loop_timing) {
+        ngx_event_loop_accepted();
+    }
 
-        c = ngx_get_connection(lc->fd, ev->log);
-        if (c == NULL) {
-            return;
-        }
+    ngx_accept_disabled = ngx_cycle->connection_n / 8
+                          - ngx_cycle->free_connection_n;
 
-        c->shared = 1;
-        c->type = SOCK_DGRAM;
-        c->socklen = socklen;
+    c = ngx_get_connection(lc->fd, ev->log);
+    if (c == NULL) {
+        return NGX_ERROR;
+    }
+
+    c->shared = 1;
+    c->type = SOCK_DGRAM;
+    c->socklen = socklen;
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
+    (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
 #endif
 
-        c->pool = ngx_create_pool(ls->pool_size, ev->log);
-        if (c->pool == NULL) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
-
-        c->sockaddr = ngx_palloc(c->pool, socklen);
-        if (c->sockaddr == NULL) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
+    c->pool = ngx_create_pool(ls->pool_size, ev->log);
+    if (c->pool == NULL) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
 
-        ngx_memcpy(c->sockaddr, sockaddr, socklen);
+    c->sockaddr = ngx_palloc(c->pool, socklen);
+    if (c->sockaddr == NULL) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
 
-        log = ngx_palloc(c->pool, sizeof(ngx_log_t));
-        if (log == NULL) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
+    ngx_memcpy(c->sockaddr, sockaddr, socklen);
 
-        *log = ls->log;
+    log = ngx_palloc(c->pool, sizeof(ngx_log_t));
+    if (log == NULL) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
 
-        c->recv = ngx_udp_shared_recv;
-        c->send = ngx_udp_send;
-        c->send_chain = ngx_udp_send_chain;
+    *log = ls->log;
 
-        c->log = log;
-        c->pool->log = log;
-        c->listening = ls;
+    c->recv = ngx_udp_shared_recv;
+    c->send = ngx_udp_send;
+    c->send_chain = ngx_udp_send_chain;
 
-        if (local_sockaddr == &lsa.sockaddr) {
-            local_sockaddr = ngx_palloc(c->pool, local_socklen);
-            if (local_sockaddr == NULL) {
-                ngx_close_accepted_udp_connection(c);
-                return;
-            }
+    c->log = log;
+    c->pool->log = log;
+    c->listening = ls;
 
-            ngx_memcpy(local_sockaddr, &lsa, local_socklen);
+    if (local_sockaddr == &lsa.sockaddr) {
+        local_sockaddr = ngx_palloc(c->pool, local_socklen);
+        if (local_sockaddr == NULL) {
+            ngx_close_accepted_udp_connection(c);
+            return NGX_ERROR;
         }
 
-        c->local_sockaddr = local_sockaddr;
-        c->local_socklen = local_socklen;
+        ngx_memcpy(local_sockaddr, &lsa, local_socklen);
+    }
 
-        c->buffer = ngx_create_temp_buf(c->pool, n);
-        if (c->buffer == NULL) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
+    c->local_sockaddr = local_sockaddr;
+    c->local_socklen = local_socklen;
 
-        c->buffer->last = ngx_cpymem(c->buffer->last, buffer, n);
+    c->buffer = ngx_create_temp_buf(c->pool, n);
+    if (c->buffer == NULL) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
 
-        rev = c->read;
-        wev = c->write;
+    c->buffer->last = ngx_cpymem(c->buffer->last, buffer, n);
 
-        rev->active = 1;
-        wev->ready = 1;
+    rev = c->read;
+    wev = c->write;
 
-        rev->log = log;
-        wev->log = log;
+    rev->active = 1;
+    wev->ready = 1;
 
-        /*
-         * TODO: MT: - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
-         *
-         * TODO: MP: - allocated in a shared memory
-         *           - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
-         */
+    rev->log = log;
+    wev->log = log;
 
-        c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+    /*
+     * TODO: MT: - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     *
+     * TODO: MP: - allocated in a shared memory
+     *           - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     */
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
+    (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
 #endif
 
-        if (ls->addr_ntop) {
-            c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
-            if (c->addr_text.data == NULL) {
-                ngx_close_accepted_udp_connection(c);
-                return;
-            }
+    if (ls->addr_ntop) {
+        c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
+        if (c->addr_text.data == NULL) {
+            ngx_close_accepted_udp_connection(c);
+            return NGX_ERROR;
+        }
 
-            c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
-                                             c->addr_text.data,
-                                             ls->addr_text_max_len, 0);
-            if (c->addr_text.len == 0) {
-                ngx_close_accepted_udp_connection(c);
-                return;
-            }
+        c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len, 0);
+        if (c->addr_text.len == 0) {
+            ngx_close_accepted_udp_connection(c);
+            return NGX_ERROR;
         }
+    }
 
 #if (NGX_DEBUG)
-        {
-        ngx_str_t  addr;
-        u_char     text[NGX_SOCKADDR_STRLEN];
+    {
+    ngx_str_t  addr;
+    u_char     text[NGX_SOCKADDR_STRLEN];
 
-        ngx_debug_accepted_connection(ecf, c);
+    ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
 
-        if (log->log_level & NGX_LOG_DEBUG_EVENT) {
-            addr.data = text;
-            addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
-                                     NGX_SOCKADDR_STRLEN, 1);
+    ngx_debug_accepted_connection(ecf, c);
 
-            ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
-                           "*%uA recvmsg: %V fd:%d n:%z",
-                           c->number, &addr, c->fd, n);
-        }
+    if (log->log_level & NGX_LOG_DEBUG_EVENT) {
+        addr.data = text;
+        addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
+                                 NGX_SOCKADDR_STRLEN, 1);
 
-        }
-#endif
-
-        if (ngx_insert_udp_connection(c) != NGX_OK) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "*%uA recvmsg: %V fd:%d n:%z",
+                       c->number, &addr, c->fd, n);
+    }
 
-        log->data = NULL;
-        log->handler = NULL;
+    }
+#endif
 
-        ls->handler(c);
+#if (NGX_QUIC)
+    /* the connection ids are inserted once known */
+    if (!ls->quic)
+#endif
+    if (ngx_insert_udp_connection(c) != NGX_OK) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
 
-    next:
+    log->data = NULL;
+    log->handler = NULL;
 
-        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
-            ev->available -= n;
-        }
+    ls->handler(c);
 
-    } while (ev->available);
+    return NGX_OK;
 }
 
 
@@ -492,12 +726,23 @@ ngx_udp_rbtree_insert_value(ngx_rbtree_node_t *temp,
             udpt = (ngx_udp_connection_t *) temp;
             ct = udpt->connection;
 
-            rc = ngx_cmp_sockaddr(c->sockaddr, c->socklen,
-                                  ct->sockaddr, ct->socklen, 1);
+#if (NGX_QUIC)
+            if (udp->key.len) {
+                rc = ngx_memn2cmp(udp->key.data, udpt->key.data,
+                                  udp->key.len, udpt->key.len);
 
-            if (rc == 0 && c->listening->wildcard) {
-                rc = ngx_cmp_sockaddr(c->local_sockaddr, c->local_socklen,
-                                      ct->local_sockaddr, ct->local_socklen, 1);
+            } else
+#endif
+            {
+                rc = ngx_cmp_sockaddr(c->sockaddr, c->socklen,
+                                      ct->sockaddr, ct->socklen, 1);
+
+                if (rc == 0 && c->listening->wildcard) {
+                    rc = ngx_cmp_sockaddr(c->local_sockaddr,
+                                          c->local_socklen,
+                                          ct->local_sockaddr,
+                                          ct->local_socklen, 1);
+                }
             }
 
             p = (rc < 0) ? &temp->left : &temp->right;
@@ -536,14 +781,8 @@ ngx_insert_udp_connection(ngx_connection_t *c)
 
     udp->connection = c;
 
-    ngx_crc32_init(hash);
-    ngx_crc32_update(&hash, (u_char *) c->sockaddr, c->socklen);
-
-    if (c->listening->wildcard) {
-        ngx_crc32_update(&hash, (u_char *) c->local_sockaddr, c->local_socklen);
-    }
-
-    ngx_crc32_final(hash);
+    hash = ngx_udp_hash(c->listening, c->sockaddr, c->socklen,
+                        c->local_sockaddr, c->local_socklen);
 
     udp->node.key = hash;
 
@@ -552,11 +791,18 @@ ngx_insert_udp_connection(ngx_connection_t *c)
         return NGX_ERROR;
     }
 
+    if (ngx_udp_sessions_hash) {
+        if (ngx_udp_flows_insert(c->listening, udp) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        ngx_rbtree_insert(&c->listening->rbtree, &udp->node);
+    }
+
     cln->data = c;
     cln->handler = ngx_delete_udp_connection;
 
-    ngx_rbtree_insert(&c->listening->rbtree, &udp->node);
-
     c->udp = udp;
 
     return NGX_OK;
@@ -572,7 +818,12 @@ ngx_delete_udp_connection(void *data)
         return;
     }
 
-    ngx_rbtree_delete(&c->listening->rbtree, &c->udp->node);
+    if (c->listening->flows) {
+        ngx_udp_flows_delete(c->listening->flows, c->udp);
+
+    } else {
+        ngx_rbtree_delete(&c->listening->rbtree, &c->udp->node);
+    }
 
     c->udp = NULL;
 }
@@ -604,17 +855,15 @@ ngx_lookup_udp_connection(ngx_listening_t *ls, struct sockaddr *sockaddr,
 
 #endif
 
-    node = ls->rbtree.root;
-    sentinel = ls->rbtree.sentinel;
-
-    ngx_crc32_init(hash);
-    ngx_crc32_update(&hash, (u_char *) sockaddr, socklen);
+    hash = ngx_udp_hash(ls, sockaddr, socklen, local_sockaddr, local_socklen);
 
-    if (ls->wildcard) {
-        ngx_crc32_update(&hash, (u_char *) local_sockaddr, local_socklen);
+    if (ls->flows) {
+        return ngx_udp_flows_lookup(ls, hash, sockaddr, socklen,
+                                    local_sockaddr, local_socklen);
     }
 
-    ngx_crc32_final(hash);
+    node = ls->rbtree.root;
+    sentinel = ls->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -652,6 +901,308 @@ ngx_lookup_udp_connection(ngx_listening_t *ls, struct sockaddr *sockaddr,
     return NULL;
 }
 
+
+#if (NGX_QUIC)
+
+ngx_int_t
+ngx_insert_udp_connection_id(ngx_connection_t *c, ngx_str_t *id)
+{
+    ngx_pool_cleanup_t    *cln;
+    ngx_udp_connection_t  *udp;
+
+    udp = ngx_pcalloc(c->pool, sizeof(ngx_udp_connection_t));
+    if (udp == NULL) {
+        return NGX_ERROR;
+    }
+
+    udp->connection = c;
+    udp->key = *id;
+    udp->node.key = ngx_murmur_hash2(id->data, id->len);
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_insert(&c->listening->rbtree, &udp->node);
+
+    cln->data = udp;
+    cln->handler = ngx_delete_udp_connection_id;
+
+    if (c->udp == NULL) {
+        c->udp = udp;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_delete_udp_connection_id(void *data)
+{
+    ngx_udp_connection_t  *udp = data;
+
+    ngx_connection_t  *c;
+
+    c = udp->connection;
+
+    ngx_rbtree_delete(&c->listening->rbtree, &udp->node);
+
+    if (c->udp == udp) {
+        c->udp = NULL;
+    }
+}
+
+
+static ngx_connection_t *
+ngx_lookup_udp_connection_id(ngx_listening_t *ls, ngx_str_t *key)
+{
+    uint32_t               hash;
+    ngx_int_t              rc;
+    ngx_rbtree_node_t     *node, *sentinel;
+    ngx_udp_connection_t  *udp;
+
+    hash = ngx_murmur_hash2(key->data, key->len);
+
+    node = ls->rbtree.root;
+    sentinel = ls->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        udp = (ngx_udp_connection_t *) node;
+
+        rc = ngx_memn2cmp(key->data, udp->key.data, key->len, udp->key.len);
+
+        if (rc == 0) {
+            return udp->connection;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+#endif
+
+
+static uint32_t
+ngx_udp_hash(ngx_listening_t *ls, struct sockaddr *sockaddr,
+    socklen_t socklen, struct sockaddr *local_sockaddr,
+    socklen_t local_socklen)
+{
+    uint32_t  hash;
+
+    hash = ngx_murmur_hash2((u_char *) sockaddr, socklen);
+
+    if (ls->wildcard) {
+        hash = hash * 31
+               + ngx_murmur_hash2((u_char *) local_sockaddr, local_socklen);
+    }
+
+    return hash;
+}
+
+
+static ngx_int_t
+ngx_udp_flows_insert(ngx_listening_t *ls, ngx_udp_connection_t *udp)
+{
+    ngx_uint_t           i;
+    ngx_udp_flows_t     *flows;
+    ngx_pool_cleanup_t  *cln;
+
+    flows = ls->flows;
+
+    if (flows == NULL) {
+        cln = ngx_pool_cleanup_add(ngx_cycle->pool, sizeof(ngx_udp_flows_t));
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        flows = cln->data;
+        flows->slots = NULL;
+        flows->mask = 0;
+        flows->nelts = 0;
+
+        if (ngx_udp_flows_resize(flows, NGX_UDP_FLOWS_MIN) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_udp_flows_cleanup;
+
+        ls->flows = flows;
+    }
+
+    if (2 * (flows->nelts + 1) > flows->mask + 1) {
+
+        if (ngx_udp_flows_resize(flows, 2 * (flows->mask + 1)) != NGX_OK
+            && flows->nelts == flows->mask)
+        {
+            /* at least one slot is always kept free to stop probing */
+            return NGX_ERROR;
+        }
+    }
+
+    for (i = udp->node.key & flows->mask;
+         flows->slots[i].udp;
+         i = (i + 1) & flows->mask)
+    {
+        /* void */
+    }
+
+    flows->slots[i].hash = (uint32_t) udp->node.key;
+    flows->slots[i].udp = udp;
+
+    flows->nelts++;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_udp_flows_resize(ngx_udp_flows_t *flows, ngx_uint_t size)
+{
+    ngx_uint_t       i, j, mask;
+    ngx_udp_flow_t  *slots;
+
+    slots = ngx_alloc(size * sizeof(ngx_udp_flow_t), ngx_cycle->log);
+    if (slots == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(slots, size * sizeof(ngx_udp_flow_t));
+
+    mask = size - 1;
+
+    if (flows->slots) {
+        for (i = 0; i <= flows->mask; i++) {
+
+            if (flows->slots[i].udp == NULL) {
+                continue;
+            }
+
+            for (j = flows->slots[i].hash & mask;
+                 slots[j].udp;
+                 j = (j + 1) & mask)
+            {
+                /* void */
+            }
+
+            slots[j] = flows->slots[i];
+        }
+
+        ngx_free(flows->slots);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                   "udp flows resize: %ui of %ui", flows->nelts, size);
+
+    flows->slots = slots;
+    flows->mask = mask;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_udp_flows_delete(ngx_udp_flows_t *flows, ngx_udp_connection_t *udp)
+{
+    ngx_uint_t       i, j, k, mask;
+    ngx_udp_flow_t  *slots;
+
+    slots = flows->slots;
+    mask = flows->mask;
+
+    for (i = udp->node.key & mask; slots[i].udp != udp; i = (i + 1) & mask) {
+        /* void */
+    }
+
+    /*
+     * the following entries of the probe sequence are shifted back
+     * unless their own home slot lies cyclically within (i, j]
+     */
+
+    for (j = (i + 1) & mask; slots[j].udp; j = (j + 1) & mask) {
+
+        k = slots[j].hash & mask;
+
+        if (((j - k) & mask) < ((j - i) & mask)) {
+            continue;
+        }
+
+        slots[i] = slots[j];
+        i = j;
+    }
+
+    slots[i].udp = NULL;
+
+    flows->nelts--;
+}
+
+
+static ngx_connection_t *
+ngx_udp_flows_lookup(ngx_listening_t *ls, uint32_t hash,
+    struct sockaddr *sockaddr, socklen_t socklen,
+    struct sockaddr *local_sockaddr, socklen_t local_socklen)
+{
+    ngx_uint_t         i, mask;
+    ngx_udp_flow_t    *slots;
+    ngx_connection_t  *c;
+
+    slots = ls->flows->slots;
+    mask = ls->flows->mask;
+
+    for (i = hash & mask; slots[i].udp; i = (i + 1) & mask) {
+
+        if (slots[i].hash != hash) {
+            continue;
+        }
+
+        c = slots[i].udp->connection;
+
+        if (ngx_cmp_sockaddr(sockaddr, socklen, c->sockaddr, c->socklen, 1)
+            != NGX_OK)
+        {
+            continue;
+        }
+
+        if (ls->wildcard
+            && ngx_cmp_sockaddr(local_sockaddr, local_socklen,
+                                c->local_sockaddr, c->local_socklen, 1)
+               != NGX_OK)
+        {
+            continue;
+        }
+
+        return c;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_udp_flows_cleanup(void *data)
+{
+    ngx_udp_flows_t  *flows = data;
+
+    if (flows->slots) {
+        ngx_free(flows->slots);
+    }
+}
+
 #else
 
 void
@@ -0,0 +1,1749 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_quic_connection.h>
+
+
+static ngx_int_t ngx_quic_handle_datagram(ngx_connection_t *c, ngx_buf_t *b,
+    ngx_quic_conf_t *conf);
+static ngx_int_t ngx_quic_handle_packet(ngx_connection_t *c,
+    ngx_quic_conf_t *conf, ngx_quic_header_t *pkt, u_char *end, size_t size);
+static ngx_quic_connection_t *ngx_quic_new_connection(ngx_connection_t *c,
+    ngx_quic_conf_t *conf, ngx_quic_header_t *pkt);
+static ngx_int_t ngx_quic_send_version_negotiation(ngx_connection_t *c,
+    ngx_quic_header_t *pkt);
+static ngx_uint_t ngx_quic_pn_received(ngx_quic_send_ctx_t *ctx,
+    uint64_t pn);
+static void ngx_quic_ack_packet(ngx_quic_send_ctx_t *ctx,
+    ngx_quic_header_t *pkt);
+static ngx_int_t ngx_quic_handle_frames(ngx_connection_t *c,
+    ngx_quic_header_t *pkt);
+static ngx_int_t ngx_quic_handle_ack_frame(ngx_connection_t *c,
+    ngx_quic_header_t *pkt, ngx_quic_ack_frame_t *ack);
+static void ngx_quic_handle_ack_range(ngx_connection_t *c,
+    ngx_quic_send_ctx_t *ctx, uint64_t min, uint64_t max, uint64_t largest,
+    ngx_msec_t *send_time);
+static void ngx_quic_update_rtt(ngx_connection_t *c, ngx_msec_t send_time,
+    uint64_t delay, ngx_uint_t level);
+static ngx_int_t ngx_quic_handle_crypto_frame(ngx_connection_t *c,
+    ngx_quic_header_t *pkt, ngx_quic_crypto_frame_t *f);
+static ngx_int_t ngx_quic_buffer_crypto(ngx_connection_t *c,
+    ngx_quic_send_ctx_t *ctx, ngx_quic_crypto_frame_t *f);
+static ngx_int_t ngx_quic_do_handshake(ngx_connection_t *c);
+static void ngx_quic_discard_ctx(ngx_connection_t *c, ngx_uint_t level);
+static ngx_msec_t ngx_quic_idle_timeout(ngx_quic_connection_t *qc);
+
+static ngx_int_t ngx_quic_output(ngx_connection_t *c);
+static ssize_t ngx_quic_create_datagram(ngx_connection_t *c, u_char *dst,
+    size_t max);
+static ssize_t ngx_quic_create_frames(ngx_connection_t *c,
+    ngx_quic_send_ctx_t *ctx, u_char *dst, size_t avail,
+    ngx_uint_t *ack_eliciting);
+static size_t ngx_quic_header_len(ngx_quic_connection_t *qc,
+    ngx_uint_t level);
+static ngx_int_t ngx_quic_send_close(ngx_connection_t *c);
+
+static ngx_msec_t ngx_quic_pto(ngx_quic_connection_t *qc, ngx_uint_t level);
+static void ngx_quic_set_pto(ngx_connection_t *c);
+static void ngx_quic_pto_handler(ngx_event_t *ev);
+static ngx_quic_sent_t *ngx_quic_alloc_sent(ngx_connection_t *c);
+static void ngx_quic_free_sent(ngx_quic_connection_t *qc,
+    ngx_quic_sent_t *sent);
+
+static void ngx_quic_input_handler(ngx_event_t *rev);
+static void ngx_quic_close_connection(ngx_connection_t *c, ngx_int_t rc);
+
+
+ngx_int_t
+ngx_quic_init_ssl(ngx_conf_t *cf, ngx_ssl_t *ssl)
+{
+    return ngx_quic_compat_init(cf, ssl->ctx);
+}
+
+
+void
+ngx_quic_run(ngx_connection_t *c, ngx_quic_conf_t *conf)
+{
+    ngx_int_t  rc;
+
+    rc = ngx_quic_handle_datagram(c, c->buffer, conf);
+
+    if (rc != NGX_OK) {
+
+        /* nothing is sent in reply to a datagram which is not understood */
+
+        ngx_quic_close_connection(c, rc == NGX_DECLINED ? NGX_DONE : rc);
+        return;
+    }
+
+    /* the handshake timeout, which is replaced by the idle one later */
+
+    ngx_add_timer(c->read, conf->handshake_timeout);
+
+    ngx_reusable_connection(c, 1);
+
+    c->read->handler = ngx_quic_input_handler;
+}
+
+
+static void
+ngx_quic_input_handler(ngx_event_t *rev)
+{
+    ngx_int_t               rc;
+    ngx_buf_t              *b;
+    ngx_connection_t       *c;
+    ngx_quic_connection_t  *qc;
+
+    c = rev->data;
+    qc = c->quic;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "quic input handler");
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "quic client timed out");
+
+        /* RFC 9000, 10.1: the connection is closed silently */
+
+        ngx_quic_close_connection(c, NGX_DONE);
+        return;
+    }
+
+    if (c->close) {
+        qc->error = NGX_QUIC_ERR_NO_ERROR;
+        (void) ngx_quic_send_close(c);
+
+        ngx_quic_close_connection(c, NGX_DONE);
+        return;
+    }
+
+    if (c->udp == NULL || c->udp->buffer == NULL) {
+        return;
+    }
+
+    b = c->udp->buffer;
+
+    rc = ngx_quic_handle_datagram(c, b, qc->conf);
+
+    if (rc == NGX_ERROR || rc == NGX_DONE) {
+        ngx_quic_close_connection(c, rc);
+        return;
+    }
+}
+
+
+/*
+ * NGX_DECLINED means that no packet of the datagram was processed,
+ * NGX_DONE that the client has closed the connection
+ */
+
+static ngx_int_t
+ngx_quic_handle_datagram(ngx_connection_t *c, ngx_buf_t *b,
+    ngx_quic_conf_t *conf)
+{
+    size_t                  size;
+    u_char                 *p;
+    ngx_int_t               rc;
+    ngx_uint_t              good;
+    ngx_quic_header_t       pkt;
+    ngx_quic_connection_t  *qc;
+
+    static u_char           buf[65535];
+
+    size = b->last - b->pos;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic datagram len:%uz", size);
+
+    if (c->quic) {
+        c->quic->received += size;
+    }
+
+    good = 0;
+
+    for (p = b->pos; p < b->last; p = pkt.data + pkt.len) {
+
+        ngx_memzero(&pkt, sizeof(ngx_quic_header_t));
+
+        pkt.log = c->log;
+        pkt.data = p;
+        pkt.plaintext = buf;
+
+        rc = ngx_quic_handle_packet(c, conf, &pkt, b->last, size);
+
+        if (rc == NGX_ERROR || rc == NGX_DONE) {
+            return rc;
+        }
+
+        if (rc == NGX_OK) {
+            good = 1;
+        }
+
+        if (rc == NGX_ABORT) {
+            /* the rest of the datagram cannot be parsed */
+            break;
+        }
+
+        /* NGX_OK || NGX_DECLINED */
+    }
+
+    qc = c->quic;
+
+    if (qc == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_quic_output(c) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return good ? NGX_OK : NGX_DECLINED;
+}
+
+
+/*
+ * NGX_DECLINED skips the packet, while NGX_ABORT stops the processing
+ * of the datagram
+ */
+
+static ngx_int_t
+ngx_quic_handle_packet(ngx_connection_t *c, ngx_quic_conf_t *conf,
+    ngx_quic_header_t *pkt, u_char *end, size_t size)
+{
+    ngx_int_t               rc;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    rc = ngx_quic_parse_packet(pkt, end);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ABORT;
+    }
+
+    qc = c->quic;
+
+    if (rc == NGX_DECLINED) {
+
+        if (pkt->version == NGX_QUIC_VERSION) {
+            /* 0-RTT */
+            return NGX_DECLINED;
+        }
+
+        /* RFC 9000, 6.1 and 14.1 */
+
+        if (qc == NULL && size >= NGX_QUIC_MIN_INITIAL_SIZE) {
+            (void) ngx_quic_send_version_negotiation(c, pkt);
+        }
+
+        return NGX_ABORT;
+    }
+
+    if (qc == NULL) {
+
+        if (pkt->level != NGX_QUIC_LEVEL_INITIAL) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "quic packet of unknown connection");
+            return NGX_ABORT;
+        }
+
+        /* RFC 9000, 14.1 */
+
+        if (size < NGX_QUIC_MIN_INITIAL_SIZE) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "quic too small initial datagram of %uz bytes",
+                          size);
+            return NGX_ABORT;
+        }
+
+        if (pkt->dcid.len < NGX_QUIC_MIN_CID_LEN) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "quic too short dcid in initial packet");
+            return NGX_ABORT;
+        }
+
+        qc = ngx_quic_new_connection(c, conf, pkt);
+        if (qc == NULL) {
+            return NGX_ERROR;
+        }
+
+        qc->received = size;
+
+    } else {
+
+        /* a coalesced packet may belong to another connection */
+
+        if ((pkt->dcid.len != qc->scid.len
+             || ngx_memcmp(pkt->dcid.data, qc->scid.data, qc->scid.len) != 0)
+            && (pkt->dcid.len != qc->odcid.len
+                || ngx_memcmp(pkt->dcid.data, qc->odcid.data, qc->odcid.len)
+                   != 0))
+        {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "quic packet of another connection");
+            return NGX_DECLINED;
+        }
+
+        if (ngx_quic_long_pkt(pkt->flags)
+            && (pkt->scid.len != qc->dcid.len
+                || ngx_memcmp(pkt->scid.data, qc->dcid.data, qc->dcid.len)
+                   != 0))
+        {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "quic packet with unexpected scid");
+            return NGX_DECLINED;
+        }
+    }
+
+    if (!ngx_quic_keys_available(&qc->keys, pkt->level, 0)) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic no keys at level %ui, packet ignored",
+                       pkt->level);
+        return NGX_DECLINED;
+    }
+
+    ctx = &qc->send_ctx[pkt->level];
+
+    pkt->keys = &qc->keys;
+
+    rc = ngx_quic_decrypt(pkt, &ctx->largest_pn);
+
+    if (rc == NGX_DECLINED) {
+        return NGX_DECLINED;
+    }
+
+    if (rc == NGX_ERROR) {
+        qc->error = pkt->error ? pkt->error : NGX_QUIC_ERR_INTERNAL_ERROR;
+        return NGX_ERROR;
+    }
+
+    if (ngx_quic_pn_received(ctx, pkt->number)) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic duplicate packet %uL ignored", pkt->number);
+        return NGX_DECLINED;
+    }
+
+    if (pkt->level == NGX_QUIC_LEVEL_HANDSHAKE && !qc->validated) {
+
+        /*
+         * RFC 9000, 8.1: a handshake packet validates the address;
+         * RFC 9001, 4.9.1: initial keys are discarded
+         */
+
+        qc->validated = 1;
+        ngx_quic_discard_ctx(c, NGX_QUIC_LEVEL_INITIAL);
+    }
+
+    rc = ngx_quic_handle_frames(c, pkt);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_quic_ack_packet(ctx, pkt);
+
+    if (qc->crypto_input) {
+        qc->crypto_input = 0;
+
+        if (ngx_quic_do_handshake(c) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (c->ssl->handshaked) {
+        ngx_add_timer(c->read, ngx_quic_idle_timeout(qc));
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_quic_connection_t *
+ngx_quic_new_connection(ngx_connection_t *c, ngx_quic_conf_t *conf,
+    ngx_quic_header_t *pkt)
+{
+    ngx_uint_t              i;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_pcalloc(c->pool, sizeof(ngx_quic_connection_t));
+    if (qc == NULL) {
+        return NULL;
+    }
+
+    qc->conf = conf;
+
+    for (i = 0; i < NGX_QUIC_LEVELS; i++) {
+        ctx = &qc->send_ctx[i];
+
+        ctx->level = i;
+        ctx->largest_pn = NGX_QUIC_UNSET_PN;
+
+        ngx_queue_init(&ctx->sent);
+        ngx_queue_init(&ctx->lost);
+    }
+
+    ngx_queue_init(&qc->free_sent);
+
+    qc->avg_rtt = NGX_QUIC_INITIAL_RTT;
+    qc->rttvar = NGX_QUIC_INITIAL_RTT / 2;
+    qc->min_rtt = NGX_TIMER_INFINITE;
+
+    qc->pto.log = c->log;
+    qc->pto.data = c;
+    qc->pto.handler = ngx_quic_pto_handler;
+
+    qc->odcid.len = pkt->dcid.len;
+    qc->odcid.data = ngx_pstrdup(c->pool, &pkt->dcid);
+    if (qc->odcid.data == NULL) {
+        return NULL;
+    }
+
+    qc->dcid.len = pkt->scid.len;
+
+    if (qc->dcid.len) {
+        qc->dcid.data = ngx_pstrdup(c->pool, &pkt->scid);
+        if (qc->dcid.data == NULL) {
+            return NULL;
+        }
+    }
+
+    qc->scid.len = NGX_QUIC_SERVER_CID_LEN;
+    qc->scid.data = ngx_pnalloc(c->pool, NGX_QUIC_SERVER_CID_LEN);
+    if (qc->scid.data == NULL) {
+        return NULL;
+    }
+
+    qc->scid.data[0] = (u_char) (ngx_worker >> 24);
+    qc->scid.data[1] = (u_char) (ngx_worker >> 16);
+    qc->scid.data[2] = (u_char) (ngx_worker >> 8);
+    qc->scid.data[3] = (u_char) ngx_worker;
+
+    if (RAND_bytes(qc->scid.data + NGX_QUIC_CID_WORKER_LEN,
+                   NGX_QUIC_SERVER_CID_LEN - NGX_QUIC_CID_WORKER_LEN)
+        <= 0)
+    {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "RAND_bytes() failed");
+        return NULL;
+    }
+
+    if (ngx_quic_keys_set_initial_secret(&qc->keys, &qc->odcid, c->log)
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    qc->tp.max_idle_timeout = conf->timeout;
+    qc->tp.original_dcid = qc->odcid;
+    qc->tp.initial_scid = qc->scid;
+    qc->tp.disable_active_migration = 1;
+
+    /* RFC 9000, 18.2, the defaults */
+
+    qc->ctp.max_udp_payload_size = 65527;
+    qc->ctp.ack_delay_exponent = NGX_QUIC_DEFAULT_ACK_DELAY_EXPONENT;
+    qc->ctp.max_ack_delay = NGX_QUIC_DEFAULT_MAX_ACK_DELAY;
+    qc->ctp.active_connection_id_limit = 2;
+
+    c->quic = qc;
+
+    /* the packets are routed by the original dcid until the client switches */
+
+    if (ngx_insert_udp_connection_id(c, &qc->scid) != NGX_OK
+        || ngx_insert_udp_connection_id(c, &qc->odcid) != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_ssl_create_connection(conf->ssl, c, 0) != NGX_OK) {
+        return NULL;
+    }
+
+    if (ngx_quic_compat_create_connection(c) != NGX_OK) {
+        return NULL;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic new connection odcid:%uz dcid:%uz",
+                   qc->odcid.len, qc->dcid.len);
+
+    return qc;
+}
+
+
+static ngx_int_t
+ngx_quic_send_version_negotiation(ngx_connection_t *c, ngx_quic_header_t *pkt)
+{
+    size_t  len;
+    u_char  buf[1 + 4 + 1 + NGX_QUIC_MAX_CID_LEN + 1 + NGX_QUIC_MAX_CID_LEN
+                + 4];
+
+    /* the connection ids of other versions may be longer */
+
+    if (pkt->dcid.len > NGX_QUIC_MAX_CID_LEN
+        || pkt->scid.len > NGX_QUIC_MAX_CID_LEN)
+    {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic send version negotiation for 0x%xD", pkt->version);
+
+    len = ngx_quic_create_version_negotiation(pkt, buf);
+
+    if (c->send(c, buf, len) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_quic_pn_received(ngx_quic_send_ctx_t *ctx, uint64_t pn)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < ctx->nranges; i++) {
+        if (pn >= ctx->ranges[i][0] && pn <= ctx->ranges[i][1]) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * the packet number is added to the ranges to acknowledge, which are kept
+ * in the descending order; the oldest range is forgotten when there is no
+ * more room
+ */
+
+static void
+ngx_quic_ack_packet(ngx_quic_send_ctx_t *ctx, ngx_quic_header_t *pkt)
+{
+    uint64_t    pn;
+    ngx_uint_t  i, prev, next;
+
+    pn = pkt->number;
+
+    if (ctx->largest_pn == NGX_QUIC_UNSET_PN || pn > ctx->largest_pn) {
+        ctx->largest_pn = pn;
+    }
+
+    if (pkt->need_ack) {
+        ctx->send_ack = 1;
+    }
+
+    for (i = 0; i < ctx->nranges; i++) {
+        if (ctx->ranges[i][1] < pn) {
+            break;
+        }
+    }
+
+    prev = (i > 0 && ctx->ranges[i - 1][0] == pn + 1);
+    next = (i < ctx->nranges && ctx->ranges[i][1] + 1 == pn);
+
+    if (prev && next) {
+        ctx->ranges[i - 1][0] = ctx->ranges[i][0];
+
+        ngx_memmove(&ctx->ranges[i], &ctx->ranges[i + 1],
+                    (ctx->nranges - i - 1) * sizeof(ctx->ranges[0]));
+        ctx->nranges--;
+        return;
+    }
+
+    if (prev) {
+        ctx->ranges[i - 1][0] = pn;
+        return;
+    }
+
+    if (next) {
+        ctx->ranges[i][1] = pn;
+        return;
+    }
+
+    if (i == NGX_QUIC_MAX_ACK_RANGES) {
+        return;
+    }
+
+    if (ctx->nranges == NGX_QUIC_MAX_ACK_RANGES) {
+        ctx->nranges--;
+    }
+
+    ngx_memmove(&ctx->ranges[i + 1], &ctx->ranges[i],
+                (ctx->nranges - i) * sizeof(ctx->ranges[0]));
+
+    ctx->ranges[i][0] = pn;
+    ctx->ranges[i][1] = pn;
+    ctx->nranges++;
+}
+
+
+static ngx_int_t
+ngx_quic_handle_frames(ngx_connection_t *c, ngx_quic_header_t *pkt)
+{
+    u_char                 *p, *end;
+    ssize_t                 n;
+    ngx_int_t               rc;
+    ngx_quic_frame_t        frame;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    p = pkt->payload.data;
+    end = p + pkt->payload.len;
+
+    while (p < end) {
+
+        n = ngx_quic_parse_frame(pkt, p, end, &frame);
+
+        if (n == NGX_ERROR) {
+            qc->error = pkt->error;
+            return NGX_ERROR;
+        }
+
+        p += n;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic frame type:0x%xi", frame.type);
+
+        rc = NGX_OK;
+
+        switch (frame.type) {
+
+        case NGX_QUIC_FT_PADDING:
+            break;
+
+        case NGX_QUIC_FT_ACK:
+        case NGX_QUIC_FT_ACK_ECN:
+            rc = ngx_quic_handle_ack_frame(c, pkt, &frame.u.ack);
+            break;
+
+        case NGX_QUIC_FT_PING:
+            pkt->need_ack = 1;
+            break;
+
+        case NGX_QUIC_FT_CRYPTO:
+            pkt->need_ack = 1;
+            rc = ngx_quic_handle_crypto_frame(c, pkt, &frame.u.crypto);
+            break;
+
+        case NGX_QUIC_FT_PATH_CHALLENGE:
+            pkt->need_ack = 1;
+
+            ngx_memcpy(qc->path_challenge, frame.u.path_challenge.data, 8);
+            qc->send_path_response = 1;
+            break;
+
+        case NGX_QUIC_FT_CONNECTION_CLOSE:
+        case NGX_QUIC_FT_CONNECTION_CLOSE_APP:
+
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "quic client closed connection, error:0x%xL",
+                          frame.u.close.error_code);
+            return NGX_DONE;
+
+        case NGX_QUIC_FT_RESET_STREAM:
+        case NGX_QUIC_FT_STOP_SENDING:
+        case NGX_QUIC_FT_MAX_STREAM_DATA:
+        case NGX_QUIC_FT_STREAM_DATA_BLOCKED:
+
+            /* no streams are allowed by the transport parameters */
+
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "quic stream frame 0x%xi is not supported",
+                          frame.type);
+            qc->error = NGX_QUIC_ERR_STREAM_STATE_ERROR;
+            rc = NGX_ERROR;
+            break;
+
+        default:
+
+            if (frame.type >= NGX_QUIC_FT_STREAM
+                && frame.type <= NGX_QUIC_FT_STREAM_LAST)
+            {
+                ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                              "quic stream frame 0x%xi is not supported",
+                              frame.type);
+                qc->error = NGX_QUIC_ERR_STREAM_LIMIT_ERROR;
+                rc = NGX_ERROR;
+                break;
+            }
+
+            /* flow control and connection ids are ignored */
+
+            pkt->need_ack = 1;
+            break;
+        }
+
+        if (rc == NGX_ERROR) {
+            qc->error_ftype = frame.type;
+            return NGX_ERROR;
+        }
+
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_quic_handle_ack_frame(ngx_connection_t *c, ngx_quic_header_t *pkt,
+    ngx_quic_ack_frame_t *ack)
+{
+    u_char                 *pos;
+    uint64_t                min, max, gap, range;
+    ngx_msec_t              send_time;
+    ngx_uint_t              i;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+    ctx = &qc->send_ctx[pkt->level];
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic ack largest:%uL first:%uL ranges:%uL",
+                   ack->largest, ack->first_range, ack->range_count);
+
+    /* RFC 9000, 13.1 */
+
+    if (ack->largest >= ctx->pnum) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "quic ack of unsent packet %uL", ack->largest);
+        qc->error = NGX_QUIC_ERR_PROTOCOL_VIOLATION;
+        return NGX_ERROR;
+    }
+
+    send_time = NGX_TIMER_INFINITE;
+
+    max = ack->largest;
+    min = max - ack->first_range;
+
+    ngx_quic_handle_ack_range(c, ctx, min, max, ack->largest, &send_time);
+
+    pos = ack->ranges_start;
+
+    for (i = 0; i < ack->range_count; i++) {
+
+        pos = ngx_quic_parse_ack_range(c->log, pos, ack->ranges_end,
+                                       &gap, &range);
+        if (pos == NULL) {
+            qc->error = NGX_QUIC_ERR_FRAME_ENCODING_ERROR;
+            return NGX_ERROR;
+        }
+
+        if (gap + 2 > min) {
+            goto invalid;
+        }
+
+        max = min - gap - 2;
+
+        if (range > max) {
+            goto invalid;
+        }
+
+        min = max - range;
+
+        ngx_quic_handle_ack_range(c, ctx, min, max, ack->largest, &send_time);
+    }
+
+    if (send_time != NGX_TIMER_INFINITE) {
+        ngx_quic_update_rtt(c, send_time, ack->delay, pkt->level);
+        qc->pto_count = 0;
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_INFO, c->log, 0, "quic invalid ack range");
+
+    qc->error = NGX_QUIC_ERR_FRAME_ENCODING_ERROR;
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_quic_handle_ack_range(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx,
+    uint64_t min, uint64_t max, uint64_t largest, ngx_msec_t *send_time)
+{
+    ngx_queue_t            *q, *next;
+    ngx_quic_sent_t        *sent;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    for (q = ngx_queue_head(&ctx->sent);
+         q != ngx_queue_sentinel(&ctx->sent);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        sent = ngx_queue_data(q, ngx_quic_sent_t, queue);
+
+        if (sent->pnum < min || sent->pnum > max) {
+            continue;
+        }
+
+        if (sent->pnum == largest) {
+            *send_time = sent->sent;
+        }
+
+        ngx_queue_remove(q);
+        ngx_quic_free_sent(qc, sent);
+    }
+}
+
+
+/* RFC 9002, 5 */
+
+static void
+ngx_quic_update_rtt(ngx_connection_t *c, ngx_msec_t send_time,
+    uint64_t delay, ngx_uint_t level)
+{
+    ngx_msec_t              latest_rtt, adjusted_rtt, ack_delay, rttvar;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    latest_rtt = ngx_current_msec - send_time;
+
+    qc->latest_rtt = latest_rtt;
+
+    if (qc->min_rtt == NGX_TIMER_INFINITE) {
+        qc->min_rtt = latest_rtt;
+        qc->avg_rtt = latest_rtt;
+        qc->rttvar = latest_rtt / 2;
+
+    } else {
+        qc->min_rtt = ngx_min(qc->min_rtt, latest_rtt);
+
+        /* the delay is in microseconds scaled by the exponent */
+
+        if (level == NGX_QUIC_LEVEL_APPLICATION
+            && delay < ((uint64_t) 1 << 40))
+        {
+            ack_delay = (delay << qc->ctp.ack_delay_exponent) / 1000;
+            ack_delay = ngx_min(ack_delay, qc->ctp.max_ack_delay);
+
+        } else {
+            ack_delay = 0;
+        }
+
+        adjusted_rtt = latest_rtt;
+
+        if (qc->min_rtt + ack_delay < latest_rtt) {
+            adjusted_rtt -= ack_delay;
+        }
+
+        rttvar = (qc->avg_rtt > adjusted_rtt) ? qc->avg_rtt - adjusted_rtt
+                                              : adjusted_rtt - qc->avg_rtt;
+
+        qc->rttvar = (3 * qc->rttvar + rttvar) / 4;
+        qc->avg_rtt = (7 * qc->avg_rtt + adjusted_rtt) / 8;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic rtt latest:%M min:%M avg:%M var:%M",
+                   latest_rtt, qc->min_rtt, qc->avg_rtt, qc->rttvar);
+}
+
+
+static ngx_int_t
+ngx_quic_handle_crypto_frame(ngx_connection_t *c, ngx_quic_header_t *pkt,
+    ngx_quic_crypto_frame_t *f)
+{
+    size_t                  len;
+    u_char                 *data;
+    uint64_t                last;
+    ngx_quic_chunk_t       *chunk;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+    ctx = &qc->send_ctx[pkt->level];
+
+    last = f->offset + f->length;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic crypto offset:%uL len:%uL received:%uL",
+                   f->offset, f->length, ctx->crypto_received);
+
+    if (last > ctx->crypto_received + NGX_QUIC_MAX_CRYPTO_DATA) {
+        qc->error = NGX_QUIC_ERR_CRYPTO_BUFFER_EXCEEDED;
+        return NGX_ERROR;
+    }
+
+    if (last <= ctx->crypto_received) {
+        /* a retransmission */
+        return NGX_OK;
+    }
+
+    if (f->offset > ctx->crypto_received) {
+        return ngx_quic_buffer_crypto(c, ctx, f);
+    }
+
+    data = f->data + (ctx->crypto_received - f->offset);
+    len = last - ctx->crypto_received;
+
+    for ( ;; ) {
+        if (ngx_quic_compat_provide_data(c, pkt->level, data, len) != NGX_OK) {
+            qc->error = NGX_QUIC_ERR_INTERNAL_ERROR;
+            return NGX_ERROR;
+        }
+
+        ctx->crypto_received += len;
+
+        /* the data buffered ahead may be continued now */
+
+        for ( ;; ) {
+            chunk = ctx->chunks;
+
+            if (chunk == NULL
+                || chunk->offset + chunk->len > ctx->crypto_received)
+            {
+                break;
+            }
+
+            ctx->chunks = chunk->next;
+            ctx->buffered -= chunk->len;
+        }
+
+        if (chunk == NULL || chunk->offset > ctx->crypto_received) {
+            break;
+        }
+
+        ctx->chunks = chunk->next;
+        ctx->buffered -= chunk->len;
+
+        data = chunk->data + (ctx->crypto_received - chunk->offset);
+        len = chunk->offset + chunk->len - ctx->crypto_received;
+    }
+
+    qc->crypto_input = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_quic_buffer_crypto(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx,
+    ngx_quic_crypto_frame_t *f)
+{
+    ngx_quic_chunk_t       *chunk, **cp;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic crypto offset:%uL ahead of %uL, buffered",
+                   f->offset, ctx->crypto_received);
+
+    for (cp = &ctx->chunks; *cp; cp = &(*cp)->next) {
+        chunk = *cp;
+
+        if (chunk->offset <= f->offset
+            && chunk->offset + chunk->len >= f->offset + f->length)
+        {
+            /* already buffered */
+            return NGX_OK;
+        }
+
+        if (chunk->offset > f->offset) {
+            break;
+        }
+    }
+
+    if (ctx->buffered + f->length > NGX_QUIC_MAX_CRYPTO_DATA) {
+        qc->error = NGX_QUIC_ERR_CRYPTO_BUFFER_EXCEEDED;
+        return NGX_ERROR;
+    }
+
+    chunk = ngx_palloc(c->pool, sizeof(ngx_quic_chunk_t) + f->length);
+    if (chunk == NULL) {
+        qc->error = NGX_QUIC_ERR_INTERNAL_ERROR;
+        return NGX_ERROR;
+    }
+
+    chunk->offset = f->offset;
+    chunk->len = f->length;
+    chunk->data = (u_char *) chunk + sizeof(ngx_quic_chunk_t);
+
+    ngx_memcpy(chunk->data, f->data, f->length);
+
+    chunk->next = *cp;
+    *cp = chunk;
+
+    ctx->buffered += chunk->len;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_quic_add_handshake_data(ngx_connection_t *c, ngx_uint_t level,
+    const u_char *data, size_t len)
+{
+    size_t                  size;
+    u_char                 *p;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+    ctx = &qc->send_ctx[level];
+
+    if (ctx->crypto_len + len > NGX_QUIC_MAX_CRYPTO_DATA) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "quic too much handshake data at level %ui", level);
+        return NGX_ERROR;
+    }
+
+    if (ctx->crypto_len + len > ctx->crypto_size) {
+
+        size = ngx_max(ctx->crypto_size * 2, 4096);
+
+        while (size < ctx->crypto_len + len) {
+            size *= 2;
+        }
+
+        p = ngx_pnalloc(c->pool, size);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ctx->crypto_len) {
+            ngx_memcpy(p, ctx->crypto, ctx->crypto_len);
+        }
+
+        if (ctx->crypto) {
+            ngx_pfree(c->pool, ctx->crypto);
+        }
+
+        ctx->crypto = p;
+        ctx->crypto_size = size;
+    }
+
+    ngx_memcpy(ctx->crypto + ctx->crypto_len, data, len);
+    ctx->crypto_len += len;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_quic_do_handshake(ngx_connection_t *c)
+{
+    int                     n, sslerr;
+    unsigned int            len;
+    const unsigned char    *data;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    if (c->ssl->handshaked) {
+        /* no post-handshake messages are expected from clients */
+        return NGX_OK;
+    }
+
+    ngx_ssl_clear_error(c->log);
+
+    n = SSL_do_handshake(c->ssl->connection);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake: %d", n);
+
+    if (qc->error) {
+        return NGX_ERROR;
+    }
+
+    if (n <= 0) {
+        sslerr = SSL_get_error(c->ssl->connection, n);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL_get_error: %d", sslerr);
+
+        if (sslerr != SSL_ERROR_WANT_READ) {
+            ngx_ssl_error(NGX_LOG_INFO, c->log, 0,
+                          "SSL_do_handshake() failed");
+            qc->error = NGX_QUIC_ERR_INTERNAL_ERROR;
+            return NGX_ERROR;
+        }
+    }
+
+    /*
+     * RFC 9001, 8.2: once the ServerHello is produced, the client hello
+     * is processed, and it must have had the transport parameters
+     */
+
+    if (!qc->client_tp_done
+        && (n == 1 || qc->send_ctx[NGX_QUIC_LEVEL_INITIAL].crypto_len))
+    {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "quic missing transport parameters");
+        qc->error = NGX_QUIC_ERR_CRYPTO(SSL_AD_MISSING_EXTENSION);
+        return NGX_ERROR;
+    }
+
+    if (n <= 0) {
+        return NGX_OK;
+    }
+
+    /* RFC 9001, 8.1 */
+
+    SSL_get0_alpn_selected(c->ssl->connection, &data, &len);
+
+    if (len == 0) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "quic no application protocol negotiated");
+        qc->error = NGX_QUIC_ERR_CRYPTO(SSL_AD_NO_APPLICATION_PROTOCOL);
+        return NGX_ERROR;
+    }
+
+    c->ssl->handshaked = 1;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic handshake completed");
+
+    /* RFC 9001, 4.1.2 and 4.9.2 */
+
+    qc->validated = 1;
+    qc->send_handshake_done = 1;
+
+    ngx_quic_discard_ctx(c, NGX_QUIC_LEVEL_HANDSHAKE);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_quic_discard_ctx(ngx_connection_t *c, ngx_uint_t level)
+{
+    ngx_queue_t            *q;
+    ngx_quic_sent_t        *sent;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    if (!ngx_quic_keys_available(&qc->keys, level, 0)
+        && !ngx_quic_keys_available(&qc->keys, level, 1))
+    {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic discard keys at level %ui", level);
+
+    ngx_quic_keys_discard(&qc->keys, level);
+
+    ctx = &qc->send_ctx[level];
+
+    while (!ngx_queue_empty(&ctx->sent)) {
+        q = ngx_queue_head(&ctx->sent);
+        ngx_queue_remove(q);
+
+        sent = ngx_queue_data(q, ngx_quic_sent_t, queue);
+        ngx_quic_free_sent(qc, sent);
+    }
+
+    while (!ngx_queue_empty(&ctx->lost)) {
+        q = ngx_queue_head(&ctx->lost);
+        ngx_queue_remove(q);
+
+        sent = ngx_queue_data(q, ngx_quic_sent_t, queue);
+        ngx_quic_free_sent(qc, sent);
+    }
+
+    ctx->send_ack = 0;
+    ctx->crypto_sent = ctx->crypto_len;
+
+    /* RFC 9002, 6.2.1 */
+
+    qc->pto_count = 0;
+}
+
+
+static ngx_msec_t
+ngx_quic_idle_timeout(ngx_quic_connection_t *qc)
+{
+    /* RFC 9000, 10.1 */
+
+    if (qc->ctp.max_idle_timeout
+        && qc->ctp.max_idle_timeout < qc->tp.max_idle_timeout)
+    {
+        return qc->ctp.max_idle_timeout;
+    }
+
+    return qc->tp.max_idle_timeout;
+}
+
+
+static ngx_int_t
+ngx_quic_output(ngx_connection_t *c)
+{
+    size_t                  max;
+    ssize_t                 n, len;
+    ngx_quic_connection_t  *qc;
+
+    static u_char           dst[NGX_QUIC_MAX_UDP_PAYLOAD_SIZE];
+
+    qc = c->quic;
+
+    for ( ;; ) {
+
+        max = NGX_QUIC_MAX_UDP_PAYLOAD_SIZE;
+
+        /* RFC 9000, 8.1 */
+
+        if (!qc->validated
+            && qc->sent + max > NGX_QUIC_AMPLIFICATION_LIMIT * qc->received)
+        {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "quic amplification limit, sent:%uz received:%uz",
+                           qc->sent, qc->received);
+            break;
+        }
+
+        len = ngx_quic_create_datagram(c, dst, max);
+
+        if (len == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (len == 0) {
+            break;
+        }
+
+        n = c->send(c, dst, len);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (!qc->validated) {
+            qc->sent += len;
+        }
+
+        if (n == NGX_AGAIN) {
+            /* the packets are recovered as lost */
+            break;
+        }
+    }
+
+    ngx_quic_set_pto(c);
+
+    return NGX_OK;
+}
+
+
+/*
+ * packets of all levels with something to send are coalesced into
+ * a datagram, a packet per level
+ */
+
+static ssize_t
+ngx_quic_create_datagram(ngx_connection_t *c, u_char *dst, size_t max)
+{
+    size_t                  used, hlen, len, flen[NGX_QUIC_LEVELS];
+    ssize_t                 n;
+    ngx_uint_t              i, last, pad, ack_eliciting;
+    ngx_quic_header_t       pkt;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    static u_char           frames[NGX_QUIC_LEVELS]
+                                  [NGX_QUIC_MAX_UDP_PAYLOAD_SIZE];
+
+    qc = c->quic;
+
+    used = 0;
+    pad = 0;
+    last = NGX_QUIC_LEVELS;
+
+    for (i = 0; i < NGX_QUIC_LEVELS; i++) {
+
+        flen[i] = 0;
+
+        if (!ngx_quic_keys_available(&qc->keys, i, 1)) {
+            continue;
+        }
+
+        hlen = ngx_quic_header_len(qc, i) + NGX_QUIC_TAG_LEN;
+
+        if (used + hlen >= max) {
+            break;
+        }
+
+        ctx = &qc->send_ctx[i];
+
+        n = ngx_quic_create_frames(c, ctx, frames[i], max - used - hlen,
+                                   &ack_eliciting);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n == 0) {
+            continue;
+        }
+
+        flen[i] = n;
+        used += hlen + n;
+        last = i;
+
+        if (i == NGX_QUIC_LEVEL_INITIAL && ack_eliciting) {
+            pad = 1;
+        }
+    }
+
+    if (last == NGX_QUIC_LEVELS) {
+        return 0;
+    }
+
+    /* RFC 9000, 14.1 */
+
+    if (pad && used < NGX_QUIC_MIN_INITIAL_SIZE) {
+        ngx_memzero(frames[last] + flen[last],
+                    NGX_QUIC_MIN_INITIAL_SIZE - used);
+
+        flen[last] += NGX_QUIC_MIN_INITIAL_SIZE - used;
+    }
+
+    len = 0;
+
+    for (i = 0; i <= last; i++) {
+
+        if (flen[i] == 0) {
+            continue;
+        }
+
+        ngx_memzero(&pkt, sizeof(ngx_quic_header_t));
+
+        pkt.log = c->log;
+        pkt.keys = &qc->keys;
+        pkt.level = i;
+        pkt.dcid = qc->dcid;
+        pkt.scid = qc->scid;
+        pkt.number = qc->send_ctx[i].pnum++;
+        pkt.payload.data = frames[i];
+        pkt.payload.len = flen[i];
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic packet tx level:%ui pn:%uL len:%uz",
+                       i, pkt.number, flen[i]);
+
+        if (ngx_quic_encrypt(&pkt, dst + len, &hlen) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        len += hlen;
+    }
+
+    return len;
+}
+
+
+static ssize_t
+ngx_quic_create_frames(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx,
+    u_char *dst, size_t avail, ngx_uint_t *ack_eliciting)
+{
+    u_char                 *p;
+    size_t                  n, len, overhead;
+    uint64_t                offset;
+    ngx_uint_t              handshake_done;
+    ngx_queue_t            *q;
+    ngx_quic_sent_t        *sent, *lost;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    p = dst;
+
+    *ack_eliciting = 0;
+    handshake_done = 0;
+
+    if (ctx->send_ack && ctx->nranges) {
+        n = ngx_quic_create_ack(NULL, ctx->ranges, ctx->nranges, 0);
+
+        if (n <= avail) {
+            p += ngx_quic_create_ack(p, ctx->ranges, ctx->nranges, 0);
+            avail -= n;
+
+            ctx->send_ack = 0;
+        }
+    }
+
+    if (ctx->level == NGX_QUIC_LEVEL_APPLICATION) {
+
+        if (qc->send_path_response && avail >= 1 + 8) {
+            p += ngx_quic_create_path_response(p, qc->path_challenge);
+            avail -= 1 + 8;
+
+            qc->send_path_response = 0;
+            *ack_eliciting = 1;
+        }
+
+        if (qc->send_handshake_done && avail >= 1) {
+            *p++ = NGX_QUIC_FT_HANDSHAKE_DONE;
+            avail--;
+
+            qc->send_handshake_done = 0;
+            handshake_done = 1;
+            *ack_eliciting = 1;
+        }
+    }
+
+    /* the data of lost packets is resent first */
+
+    lost = NULL;
+
+    if (!ngx_queue_empty(&ctx->lost)) {
+        q = ngx_queue_head(&ctx->lost);
+        lost = ngx_queue_data(q, ngx_quic_sent_t, queue);
+
+        offset = lost->crypto_offset;
+        len = lost->crypto_len;
+
+    } else {
+        offset = ctx->crypto_sent;
+        len = ctx->crypto_len - ctx->crypto_sent;
+    }
+
+    n = 0;
+
+    if (len) {
+        overhead = ngx_quic_crypto_overhead(offset, len);
+
+        if (avail > overhead) {
+            n = ngx_min(len, avail - overhead);
+
+            p += ngx_quic_create_crypto(p, offset, ctx->crypto + offset, n);
+
+            if (lost) {
+                lost->crypto_offset += n;
+                lost->crypto_len -= n;
+
+                if (lost->crypto_len == 0) {
+                    ngx_queue_remove(&lost->queue);
+                    ngx_quic_free_sent(qc, lost);
+                }
+
+            } else {
+                ctx->crypto_sent += n;
+            }
+
+            *ack_eliciting = 1;
+        }
+    }
+
+    if (*ack_eliciting) {
+        sent = ngx_quic_alloc_sent(c);
+        if (sent == NULL) {
+            return NGX_ERROR;
+        }
+
+        sent->pnum = ctx->pnum;
+        sent->sent = ngx_current_msec;
+        sent->crypto_offset = offset;
+        sent->crypto_len = n;
+        sent->handshake_done = handshake_done;
+
+        ngx_queue_insert_tail(&ctx->sent, &sent->queue);
+    }
+
+    return p - dst;
+}
+
+
+static size_t
+ngx_quic_header_len(ngx_quic_connection_t *qc, ngx_uint_t level)
+{
+    if (level == NGX_QUIC_LEVEL_APPLICATION) {
+        return 1 + qc->dcid.len + NGX_QUIC_PN_LEN;
+    }
+
+    /* the type, version, connection ids, token length, and length */
+
+    return 1 + 4 + 1 + qc->dcid.len + 1 + qc->scid.len
+           + (level == NGX_QUIC_LEVEL_INITIAL ? 1 : 0) + 2 + NGX_QUIC_PN_LEN;
+}
+
+
+static ngx_int_t
+ngx_quic_send_close(ngx_connection_t *c)
+{
+    size_t                  len, n;
+    u_char                  frame[32];
+    ngx_uint_t              i;
+    ngx_quic_header_t       pkt;
+    ngx_quic_connection_t  *qc;
+
+    static u_char           dst[NGX_QUIC_MAX_UDP_PAYLOAD_SIZE];
+
+    qc = c->quic;
+
+    len = 0;
+
+    for (i = 0; i < NGX_QUIC_LEVELS; i++) {
+
+        if (!ngx_quic_keys_available(&qc->keys, i, 1)) {
+            continue;
+        }
+
+        ngx_memzero(&pkt, sizeof(ngx_quic_header_t));
+
+        pkt.log = c->log;
+        pkt.keys = &qc->keys;
+        pkt.level = i;
+        pkt.dcid = qc->dcid;
+        pkt.scid = qc->scid;
+        pkt.number = qc->send_ctx[i].pnum++;
+        pkt.payload.data = frame;
+        pkt.payload.len = ngx_quic_create_close(frame, qc->error,
+                                                qc->error_ftype);
+
+        if (ngx_quic_encrypt(&pkt, dst + len, &n) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        len += n;
+    }
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    if (!qc->validated
+        && qc->sent + len > NGX_QUIC_AMPLIFICATION_LIMIT * qc->received)
+    {
+        return NGX_OK;
+    }
+
+    if (c->send(c, dst, len) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* RFC 9002, 6.2.1 */
+
+static ngx_msec_t
+ngx_quic_pto(ngx_quic_connection_t *qc, ngx_uint_t level)
+{
+    ngx_msec_t  duration;
+
+    duration = qc->avg_rtt + ngx_max(4 * qc->rttvar, 1);
+
+    if (level == NGX_QUIC_LEVEL_APPLICATION) {
+        duration += qc->ctp.max_ack_delay;
+    }
+
+    return duration << ngx_min(qc->pto_count, 16);
+}
+
+
+static void
+ngx_quic_set_pto(ngx_connection_t *c)
+{
+    ngx_msec_t              timer, deadline;
+    ngx_uint_t              i, set;
+    ngx_queue_t            *q;
+    ngx_quic_sent_t        *sent;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    set = 0;
+    deadline = 0;
+
+    for (i = 0; i < NGX_QUIC_LEVELS; i++) {
+        ctx = &qc->send_ctx[i];
+
+        if (ngx_queue_empty(&ctx->sent)) {
+            continue;
+        }
+
+        q = ngx_queue_last(&ctx->sent);
+        sent = ngx_queue_data(q, ngx_quic_sent_t, queue);
+
+        timer = sent->sent + ngx_quic_pto(qc, i);
+
+        if (!set || (ngx_msec_int_t) (timer - deadline) < 0) {
+            deadline = timer;
+            set = 1;
+        }
+    }
+
+    if (!set) {
+        if (qc->pto.timer_set) {
+            ngx_del_timer(&qc->pto);
+        }
+
+        return;
+    }
+
+    timer = (ngx_msec_int_t) (deadline - ngx_current_msec) > 0
+            ? deadline - ngx_current_msec : 1;
+
+    ngx_add_timer(&qc->pto, timer);
+}
+
+
+static void
+ngx_quic_pto_handler(ngx_event_t *ev)
+{
+    ngx_uint_t              i;
+    ngx_queue_t            *q;
+    ngx_connection_t       *c;
+    ngx_quic_sent_t        *sent;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    c = ev->data;
+    qc = c->quic;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic pto timer, count:%ui", qc->pto_count);
+
+    /* the data of all packets in flight is queued to be resent */
+
+    for (i = 0; i < NGX_QUIC_LEVELS; i++) {
+        ctx = &qc->send_ctx[i];
+
+        while (!ngx_queue_empty(&ctx->sent)) {
+            q = ngx_queue_head(&ctx->sent);
+            ngx_queue_remove(q);
+
+            sent = ngx_queue_data(q, ngx_quic_sent_t, queue);
+
+            if (sent->handshake_done) {
+                qc->send_handshake_done = 1;
+            }
+
+            if (sent->crypto_len) {
+                ngx_queue_insert_tail(&ctx->lost, q);
+
+            } else {
+                ngx_quic_free_sent(qc, sent);
+            }
+        }
+    }
+
+    qc->pto_count++;
+
+    if (ngx_quic_output(c) != NGX_OK) {
+        ngx_quic_close_connection(c, NGX_ERROR);
+    }
+}
+
+
+static ngx_quic_sent_t *
+ngx_quic_alloc_sent(ngx_connection_t *c)
+{
+    ngx_queue_t            *q;
+    ngx_quic_sent_t        *sent;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    if (!ngx_queue_empty(&qc->free_sent)) {
+        q = ngx_queue_head(&qc->free_sent);
+        ngx_queue_remove(q);
+
+        sent = ngx_queue_data(q, ngx_quic_sent_t, queue);
+
+    } else {
+        sent = ngx_palloc(c->pool, sizeof(ngx_quic_sent_t));
+        if (sent == NULL) {
+            return NULL;
+        }
+    }
+
+    ngx_memzero(sent, sizeof(ngx_quic_sent_t));
+
+    return sent;
+}
+
+
+static void
+ngx_quic_free_sent(ngx_quic_connection_t *qc, ngx_quic_sent_t *sent)
+{
+    ngx_queue_insert_head(&qc->free_sent, &sent->queue);
+}
+
+
+/*
+ * NGX_ERROR closes the connection with CONNECTION_CLOSE of qc->error,
+ * while NGX_DONE closes it silently
+ */
+
+static void
+ngx_quic_close_connection(ngx_connection_t *c, ngx_int_t rc)
+{
+    ngx_pool_t             *pool;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic close connection, rc:%i", rc);
+
+    if (qc) {
+
+        if (rc == NGX_ERROR && !qc->closing) {
+            qc->closing = 1;
+
+            if (qc->error == 0) {
+                qc->error = NGX_QUIC_ERR_INTERNAL_ERROR;
+            }
+
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "quic close connection, error:0x%xi, frame:0x%xi",
+                          qc->error, qc->error_ftype);
+
+            (void) ngx_quic_send_close(c);
+        }
+
+        if (qc->pto.timer_set) {
+            ngx_del_timer(&qc->pto);
+        }
+
+        if (qc->pto.posted) {
+            ngx_delete_posted_event(&qc->pto);
+        }
+
+        ngx_quic_keys_discard(&qc->keys, NGX_QUIC_LEVEL_INITIAL);
+        ngx_quic_keys_discard(&qc->keys, NGX_QUIC_LEVEL_HANDSHAKE);
+        ngx_quic_keys_discard(&qc->keys, NGX_QUIC_LEVEL_APPLICATION);
+    }
+
+    if (c->ssl) {
+        SSL_free(c->ssl->connection);
+        c->ssl = NULL;
+    }
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_active, -1);
+#endif
+
+    c->destroyed = 1;
+
+    pool = c->pool;
+
+    ngx_close_connection(c);
+
+    ngx_destroy_pool(pool);
+}
@@ -0,0 +1,45 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_QUIC_H_INCLUDED_
+#define _NGX_EVENT_QUIC_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_QUIC_VERSION                  0x00000001
+
+#define NGX_QUIC_MIN_INITIAL_SIZE         1200
+#define NGX_QUIC_MAX_UDP_PAYLOAD_SIZE     1200
+
+#define NGX_QUIC_MIN_CID_LEN              8
+#define NGX_QUIC_MAX_CID_LEN              20
+
+/*
+ * connection ids issued by the server start with the worker number,
+ * which the reuseport program uses to steer packets of the connection
+ */
+
+#define NGX_QUIC_SERVER_CID_LEN           NGX_QUIC_MAX_CID_LEN
+#define NGX_QUIC_CID_WORKER_LEN           4
+
+
+typedef struct {
+    ngx_ssl_t                    *ssl;
+    ngx_msec_t                    timeout;
+    ngx_msec_t                    handshake_timeout;
+} ngx_quic_conf_t;
+
+
+void ngx_quic_run(ngx_connection_t *c, ngx_quic_conf_t *conf);
+ngx_int_t ngx_quic_get_packet_dcid(ngx_log_t *log, u_char *data, size_t len,
+    ngx_str_t *dcid);
+ngx_int_t ngx_quic_init_ssl(ngx_conf_t *cf, ngx_ssl_t *ssl);
+
+
+#endif /* _NGX_EVENT_QUIC_H_INCLUDED_ */
@@ -0,0 +1,132 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_QUIC_CONNECTION_H_INCLUDED_
+#define _NGX_EVENT_QUIC_CONNECTION_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+typedef struct ngx_quic_keys_s        ngx_quic_keys_t;
+
+#include <ngx_event_quic_transport.h>
+#include <ngx_event_quic_protection.h>
+#include <ngx_event_quic_openssl_compat.h>
+
+
+#define NGX_QUIC_UNSET_PN                 ((uint64_t) -1)
+
+/* RFC 9002, 6.2.2 */
+#define NGX_QUIC_INITIAL_RTT              333
+
+/* the amplification factor before the address is validated */
+#define NGX_QUIC_AMPLIFICATION_LIMIT      3
+
+#define NGX_QUIC_MAX_CRYPTO_DATA          65536
+
+
+/* an ack-eliciting packet sent and not acknowledged yet */
+
+typedef struct {
+    ngx_queue_t                       queue;
+    uint64_t                          pnum;
+    ngx_msec_t                        sent;
+    uint64_t                          crypto_offset;
+    size_t                            crypto_len;
+    unsigned                          handshake_done:1;
+} ngx_quic_sent_t;
+
+
+/* CRYPTO data received ahead of the expected offset */
+
+typedef struct ngx_quic_chunk_s  ngx_quic_chunk_t;
+
+struct ngx_quic_chunk_s {
+    ngx_quic_chunk_t                 *next;
+    uint64_t                          offset;
+    size_t                            len;
+    u_char                           *data;
+};
+
+
+/* the state of a packet number space */
+
+typedef struct {
+    ngx_uint_t                        level;
+
+    uint64_t                          pnum;        /* next to be sent */
+
+    uint64_t                          largest_pn;  /* received */
+    uint64_t                          ranges[NGX_QUIC_MAX_ACK_RANGES][2];
+    ngx_uint_t                        nranges;
+    ngx_uint_t                        send_ack;
+
+    ngx_queue_t                       sent;
+    ngx_queue_t                       lost;        /* CRYPTO to resend */
+
+    /* the CRYPTO stream: data of TLS and offsets in either direction */
+
+    u_char                           *crypto;
+    size_t                            crypto_size;
+    uint64_t                          crypto_len;
+    uint64_t                          crypto_sent;
+    uint64_t                          crypto_received;
+
+    ngx_quic_chunk_t                 *chunks;
+    size_t                            buffered;
+} ngx_quic_send_ctx_t;
+
+
+struct ngx_quic_connection_s {
+    ngx_quic_conf_t                  *conf;
+
+    ngx_str_t                         odcid;   /* original dcid of client */
+    ngx_str_t                         dcid;    /* scid of client */
+    ngx_str_t                         scid;
+
+    ngx_quic_tp_t                     tp;
+    ngx_quic_tp_t                     ctp;
+
+    ngx_quic_keys_t                   keys;
+    ngx_quic_send_ctx_t               send_ctx[NGX_QUIC_LEVELS];
+    ngx_quic_compat_t                 compat;
+
+    ngx_queue_t                       free_sent;
+
+    ngx_event_t                       pto;
+    ngx_uint_t                        pto_count;
+
+    ngx_msec_t                        latest_rtt;
+    ngx_msec_t                        avg_rtt;
+    ngx_msec_t                        rttvar;
+    ngx_msec_t                        min_rtt;
+
+    /* bytes received and sent before the address is validated */
+    size_t                            received;
+    size_t                            sent;
+
+    ngx_uint_t                        error;
+    ngx_uint_t                        error_ftype;
+
+    u_char                            path_challenge[8];
+
+    unsigned                          validated:1;
+    unsigned                          client_tp_done:1;
+    unsigned                          send_handshake_done:1;
+    unsigned                          send_path_response:1;
+    unsigned                          crypto_input:1;
+    unsigned                          closing:1;
+};
+
+
+ngx_int_t ngx_quic_add_handshake_data(ngx_connection_t *c, ngx_uint_t level,
+    const u_char *data, size_t len);
+
+
+#endif /* _NGX_EVENT_QUIC_CONNECTION_H_INCLUDED_ */
@@ -0,0 +1,502 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_quic_connection.h>
+
+
+/*
+ * OpenSSL before 3.5 has no QUIC interface for servers, so QUIC is run
+ * on top of the usual TLS 1.3 state machine:
+ *
+ * - the traffic secrets are taken from the keylog callback;
+ * - handshake messages written by OpenSSL are taken from the message
+ *   callback, with a null write BIO discarding the records themselves;
+ * - CRYPTO data received is wrapped into TLS records, encrypted with
+ *   the record keys of the client traffic secrets if needed, and fed to
+ *   OpenSSL through a memory read BIO;
+ * - the transport parameters are passed in a custom extension.
+ */
+
+
+#define NGX_QUIC_EXT_TRANSPORT_PARAMS     0x39
+#define NGX_QUIC_MAX_TP_LEN               128
+
+#define NGX_QUIC_COMPAT_RECORD_SIZE       16384
+
+
+static void ngx_quic_compat_keylog_callback(const SSL *ssl, const char *line);
+static ngx_int_t ngx_quic_compat_set_record_key(ngx_connection_t *c,
+    ngx_uint_t level, ngx_uint_t cipher, const u_char *secret, size_t len);
+static void ngx_quic_compat_message_callback(int write_p, int version,
+    int content_type, const void *buf, size_t len, SSL *ssl, void *arg);
+static int ngx_quic_compat_add_transport_params(SSL *ssl,
+    unsigned int ext_type, unsigned int context, const unsigned char **out,
+    size_t *outlen, X509 *x, size_t chainidx, int *al, void *add_arg);
+static int ngx_quic_compat_parse_transport_params(SSL *ssl,
+    unsigned int ext_type, unsigned int context, const unsigned char *in,
+    size_t inlen, X509 *x, size_t chainidx, int *al, void *parse_arg);
+
+
+ngx_int_t
+ngx_quic_compat_init(ngx_conf_t *cf, SSL_CTX *ctx)
+{
+    /* a context may be shared by servers on several addresses */
+
+    if (SSL_CTX_get_keylog_callback(ctx) == ngx_quic_compat_keylog_callback) {
+        return NGX_OK;
+    }
+
+    SSL_CTX_set_keylog_callback(ctx, ngx_quic_compat_keylog_callback);
+
+    if (SSL_CTX_add_custom_ext(ctx, NGX_QUIC_EXT_TRANSPORT_PARAMS,
+                               SSL_EXT_CLIENT_HELLO
+                               |SSL_EXT_TLS1_3_ENCRYPTED_EXTENSIONS,
+                               ngx_quic_compat_add_transport_params,
+                               NULL, NULL,
+                               ngx_quic_compat_parse_transport_params,
+                               NULL)
+        == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, cf->log, 0,
+                      "SSL_CTX_add_custom_ext() failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_quic_compat_create_connection(ngx_connection_t *c)
+{
+    BIO                    *rbio, *wbio;
+    ngx_ssl_conn_t         *ssl_conn;
+    ngx_quic_connection_t  *qc;
+
+    qc = c->quic;
+    ssl_conn = c->ssl->connection;
+
+    rbio = BIO_new(BIO_s_mem());
+    if (rbio == NULL) {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "BIO_new() failed");
+        return NGX_ERROR;
+    }
+
+    wbio = BIO_new(BIO_s_null());
+    if (wbio == NULL) {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "BIO_new() failed");
+        BIO_free(rbio);
+        return NGX_ERROR;
+    }
+
+    BIO_set_mem_eof_return(rbio, -1);
+
+    SSL_set_bio(ssl_conn, rbio, wbio);
+
+    qc->compat.rbio = rbio;
+
+    SSL_set_msg_callback(ssl_conn, ngx_quic_compat_message_callback);
+
+    if (SSL_set_min_proto_version(ssl_conn, TLS1_3_VERSION) == 0) {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_set_min_proto_version() failed");
+        return NGX_ERROR;
+    }
+
+    SSL_clear_options(ssl_conn, SSL_OP_ENABLE_MIDDLEBOX_COMPAT);
+
+    /*
+     * session tickets would allow clients to try 0-RTT, which cannot be
+     * supported here, and early data of TLS has no place in QUIC
+     */
+
+    SSL_set_num_tickets(ssl_conn, 0);
+    SSL_set_max_early_data(ssl_conn, 0);
+
+#ifdef SSL_READ_EARLY_DATA_SUCCESS
+    c->ssl->try_early_data = 0;
+#endif
+
+#ifdef SSL_MODE_ASYNC
+    SSL_clear_mode(ssl_conn, SSL_MODE_ASYNC);
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_quic_compat_keylog_callback(const SSL *ssl, const char *line)
+{
+    u_char                 *p, secret[NGX_QUIC_MAX_MD_SIZE];
+    size_t                  n;
+    ngx_int_t               v;
+    ngx_uint_t              level, write, cipher;
+    ngx_connection_t       *c;
+    ngx_quic_connection_t  *qc;
+
+    c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl);
+
+    qc = c->quic;
+
+    if (qc == NULL) {
+        return;
+    }
+
+    p = (u_char *) line;
+
+    if (ngx_strncmp(p, "CLIENT_HANDSHAKE_TRAFFIC_SECRET ", 32) == 0) {
+        level = NGX_QUIC_LEVEL_HANDSHAKE;
+        write = 0;
+
+    } else if (ngx_strncmp(p, "SERVER_HANDSHAKE_TRAFFIC_SECRET ", 32) == 0) {
+        level = NGX_QUIC_LEVEL_HANDSHAKE;
+        write = 1;
+
+    } else if (ngx_strncmp(p, "CLIENT_TRAFFIC_SECRET_0 ", 24) == 0) {
+        level = NGX_QUIC_LEVEL_APPLICATION;
+        write = 0;
+
+    } else if (ngx_strncmp(p, "SERVER_TRAFFIC_SECRET_0 ", 24) == 0) {
+        level = NGX_QUIC_LEVEL_APPLICATION;
+        write = 1;
+
+    } else {
+        return;
+    }
+
+    /* the label, the client random, and the secret in hex */
+
+    p = (u_char *) ngx_strchr(p, ' ');
+    if (p) {
+        p = (u_char *) ngx_strchr(p + 1, ' ');
+    }
+
+    if (p == NULL) {
+        goto failed;
+    }
+
+    p++;
+
+    for (n = 0; p[0] && p[1]; n++, p += 2) {
+
+        if (n == NGX_QUIC_MAX_MD_SIZE) {
+            goto failed;
+        }
+
+        v = ngx_hextoi(p, 2);
+        if (v == NGX_ERROR) {
+            goto failed;
+        }
+
+        secret[n] = (u_char) v;
+    }
+
+    cipher = SSL_CIPHER_get_id(SSL_get_current_cipher(ssl));
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic compat secret level:%ui write:%ui cipher:0x%xi",
+                   level, write, cipher);
+
+    if (ngx_quic_keys_set_encryption_secret(c->log, write, &qc->keys, level,
+                                            cipher, secret, n)
+        != NGX_OK)
+    {
+        goto error;
+    }
+
+    if (write) {
+        qc->compat.write_level = level;
+
+    } else if (ngx_quic_compat_set_record_key(c, level, cipher, secret, n)
+               != NGX_OK)
+    {
+        goto error;
+    }
+
+    ngx_explicit_memzero(secret, sizeof(secret));
+
+    return;
+
+failed:
+
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                  "quic compat failed to parse keylog line");
+
+error:
+
+    ngx_explicit_memzero(secret, sizeof(secret));
+
+    /* the handshake is aborted once control returns from OpenSSL */
+
+    if (qc->error == 0) {
+        qc->error = NGX_QUIC_ERR_INTERNAL_ERROR;
+    }
+}
+
+
+static ngx_int_t
+ngx_quic_compat_set_record_key(ngx_connection_t *c, ngx_uint_t level,
+    ngx_uint_t cipher, const u_char *secret, size_t len)
+{
+    ngx_int_t                  key_len;
+    ngx_quic_ciphers_t         ciphers;
+    ngx_quic_compat_record_t  *rec;
+
+    key_len = ngx_quic_ciphers(cipher, &ciphers);
+
+    if (key_len == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    rec = &c->quic->compat.read[level];
+
+    rec->cipher = ciphers.c;
+    rec->key.len = key_len;
+    rec->iv.len = NGX_QUIC_IV_LEN;
+    rec->seq = 0;
+
+    /* RFC 8446, 7.3 */
+
+    if (ngx_quic_expand_label(ciphers.d, "key", rec->key.data, rec->key.len,
+                              secret, len, c->log)
+        != NGX_OK
+        || ngx_quic_expand_label(ciphers.d, "iv", rec->iv.data, rec->iv.len,
+                                 secret, len, c->log)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_quic_compat_message_callback(int write_p, int version, int content_type,
+    const void *buf, size_t len, SSL *ssl, void *arg)
+{
+    ngx_uint_t              alert;
+    ngx_connection_t       *c;
+    ngx_quic_connection_t  *qc;
+
+    if (!write_p) {
+        return;
+    }
+
+    c = ngx_ssl_get_connection(ssl);
+    qc = c->quic;
+
+    switch (content_type) {
+
+    case SSL3_RT_HANDSHAKE:
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic compat tx handshake len:%uz level:%ui",
+                       len, qc->compat.write_level);
+
+        if (ngx_quic_add_handshake_data(c, qc->compat.write_level, buf, len)
+            != NGX_OK
+            && qc->error == 0)
+        {
+            qc->error = NGX_QUIC_ERR_INTERNAL_ERROR;
+        }
+
+        break;
+
+    case SSL3_RT_ALERT:
+
+        if (len < 2) {
+            break;
+        }
+
+        alert = ((u_char *) buf)[1];
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic compat tx alert:%ui", alert);
+
+        if (qc->error == 0) {
+            qc->error = NGX_QUIC_ERR_CRYPTO(alert);
+        }
+
+        break;
+    }
+}
+
+
+ngx_int_t
+ngx_quic_compat_provide_data(ngx_connection_t *c, ngx_uint_t level,
+    u_char *data, size_t len)
+{
+    size_t                     n;
+    u_char                    *p, nonce[NGX_QUIC_IV_LEN];
+    ngx_str_t                  in, out, ad;
+    ngx_quic_connection_t     *qc;
+    ngx_quic_compat_record_t  *rec;
+
+    static u_char              plain[NGX_QUIC_COMPAT_RECORD_SIZE + 1];
+    static u_char              record[5 + NGX_QUIC_COMPAT_RECORD_SIZE + 1
+                                      + NGX_QUIC_TAG_LEN];
+
+    qc = c->quic;
+    rec = &qc->compat.read[level];
+
+    while (len) {
+        n = ngx_min(len, NGX_QUIC_COMPAT_RECORD_SIZE);
+
+        p = record;
+
+        if (level == NGX_QUIC_LEVEL_INITIAL) {
+            *p++ = SSL3_RT_HANDSHAKE;
+            *p++ = 0x03;
+            *p++ = 0x03;
+            *p++ = (u_char) (n >> 8);
+            *p++ = (u_char) n;
+
+            p = ngx_cpymem(p, data, n);
+
+        } else {
+            if (rec->cipher == NULL) {
+                ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                              "quic compat no read key at level %ui", level);
+                return NGX_ERROR;
+            }
+
+            /* TLSInnerPlaintext with the content type after the data */
+
+            ngx_memcpy(plain, data, n);
+            plain[n] = SSL3_RT_HANDSHAKE;
+
+            in.data = plain;
+            in.len = n + 1;
+
+            *p++ = SSL3_RT_APPLICATION_DATA;
+            *p++ = 0x03;
+            *p++ = 0x03;
+            *p++ = (u_char) ((in.len + NGX_QUIC_TAG_LEN) >> 8);
+            *p++ = (u_char) (in.len + NGX_QUIC_TAG_LEN);
+
+            ad.data = record;
+            ad.len = 5;
+
+            out.data = p;
+
+            ngx_quic_compute_nonce(nonce, &rec->iv, rec->seq++);
+
+            if (ngx_quic_tls_seal(rec->cipher, &rec->key, nonce, &out, &in,
+                                  &ad, c->log)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            p += out.len;
+        }
+
+        if (BIO_write(qc->compat.rbio, record, p - record) != p - record) {
+            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "BIO_write() failed");
+            return NGX_ERROR;
+        }
+
+        data += n;
+        len -= n;
+    }
+
+    return NGX_OK;
+}
+
+
+static int
+ngx_quic_compat_add_transport_params(SSL *ssl, unsigned int ext_type,
+    unsigned int context, const unsigned char **out, size_t *outlen,
+    X509 *x, size_t chainidx, int *al, void *add_arg)
+{
+    u_char                 *p;
+    ssize_t                 n;
+    ngx_connection_t       *c;
+    ngx_quic_connection_t  *qc;
+
+    c = ngx_ssl_get_connection(ssl);
+    qc = c->quic;
+
+    if (qc == NULL) {
+        return 0;
+    }
+
+    p = ngx_pnalloc(c->pool, NGX_QUIC_MAX_TP_LEN);
+    if (p == NULL) {
+        *al = SSL_AD_INTERNAL_ERROR;
+        return -1;
+    }
+
+    n = ngx_quic_create_transport_params(p, p + NGX_QUIC_MAX_TP_LEN,
+                                         &qc->tp);
+    if (n == NGX_ERROR) {
+        *al = SSL_AD_INTERNAL_ERROR;
+        return -1;
+    }
+
+    *out = p;
+    *outlen = n;
+
+    return 1;
+}
+
+
+static int
+ngx_quic_compat_parse_transport_params(SSL *ssl, unsigned int ext_type,
+    unsigned int context, const unsigned char *in, size_t inlen, X509 *x,
+    size_t chainidx, int *al, void *parse_arg)
+{
+    ngx_connection_t       *c;
+    ngx_quic_connection_t  *qc;
+
+    c = ngx_ssl_get_connection(ssl);
+    qc = c->quic;
+
+    if (qc == NULL) {
+        return 1;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic compat transport parameters len:%uz", inlen);
+
+    if (ngx_quic_parse_transport_params((u_char *) in, (u_char *) in + inlen,
+                                        &qc->ctp, c->log)
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    /* RFC 9000, 7.3 */
+
+    if (qc->ctp.initial_scid.len != qc->dcid.len
+        || ngx_memcmp(qc->ctp.initial_scid.data, qc->dcid.data,
+                      qc->dcid.len)
+           != 0)
+    {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "quic client initial_source_connection_id mismatch");
+        goto failed;
+    }
+
+    /* the parameter points to the buffer of OpenSSL */
+    ngx_str_null(&qc->ctp.initial_scid);
+
+    qc->client_tp_done = 1;
+
+    return 1;
+
+failed:
+
+    qc->error = NGX_QUIC_ERR_TRANSPORT_PARAMETER_ERROR;
+    *al = SSL_AD_ILLEGAL_PARAMETER;
+
+    return -1;
+}
@@ -0,0 +1,38 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_QUIC_OPENSSL_COMPAT_H_INCLUDED_
+#define _NGX_EVENT_QUIC_OPENSSL_COMPAT_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/* the key of TLS records carrying CRYPTO data of a level to OpenSSL */
+
+typedef struct {
+    const EVP_CIPHER                 *cipher;
+    ngx_quic_md_t                     key;
+    ngx_quic_md_t                     iv;
+    uint64_t                          seq;
+} ngx_quic_compat_record_t;
+
+
+typedef struct {
+    ngx_uint_t                        write_level;
+    ngx_quic_compat_record_t          read[NGX_QUIC_LEVELS];
+    BIO                              *rbio;
+} ngx_quic_compat_t;
+
+
+ngx_int_t ngx_quic_compat_init(ngx_conf_t *cf, SSL_CTX *ctx);
+ngx_int_t ngx_quic_compat_create_connection(ngx_connection_t *c);
+ngx_int_t ngx_quic_compat_provide_data(ngx_connection_t *c,
+    ngx_uint_t level, u_char *data, size_t len);
+
+
+#endif /* _NGX_EVENT_QUIC_OPENSSL_COMPAT_H_INCLUDED_ */
@@ -0,0 +1,750 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_quic_connection.h>
+
+#include <openssl/kdf.h>
+
+
+/* RFC 9001, 5.2 */
+
+static u_char ngx_quic_initial_salt[] = {
+    0x38, 0x76, 0x2c, 0xf7, 0xf5, 0x59, 0x34, 0xb3, 0x4d, 0x17,
+    0x9a, 0xe6, 0xa4, 0xc8, 0x0c, 0xad, 0xcc, 0xbb, 0x7f, 0x0a
+};
+
+
+static ngx_int_t ngx_quic_hkdf_extract(u_char *out, size_t *out_len,
+    const EVP_MD *digest, const u_char *secret, size_t secret_len,
+    const u_char *salt, size_t salt_len);
+static ngx_int_t ngx_quic_hkdf_expand(u_char *out, size_t out_len,
+    const EVP_MD *digest, const u_char *prk, size_t prk_len,
+    const u_char *info, size_t info_len);
+static ngx_int_t ngx_quic_derive_keys(ngx_quic_secret_t *s,
+    ngx_quic_ciphers_t *ciphers, size_t key_len, ngx_log_t *log);
+static ngx_int_t ngx_quic_tls_open(const EVP_CIPHER *cipher,
+    ngx_quic_md_t *key, u_char *nonce, ngx_str_t *out, ngx_str_t *in,
+    ngx_str_t *ad, ngx_log_t *log);
+static ngx_int_t ngx_quic_tls_hp(ngx_log_t *log, const EVP_CIPHER *cipher,
+    ngx_quic_secret_t *s, u_char *out, u_char *in);
+static uint64_t ngx_quic_parse_pn(u_char **pos, ngx_int_t len, u_char *mask,
+    uint64_t *largest_pn);
+
+
+ngx_int_t
+ngx_quic_ciphers(ngx_uint_t id, ngx_quic_ciphers_t *ciphers)
+{
+    ngx_int_t  len;
+
+    switch (id) {
+
+    case TLS1_3_CK_AES_128_GCM_SHA256:
+        ciphers->c = EVP_aes_128_gcm();
+        ciphers->hp = EVP_aes_128_ecb();
+        ciphers->d = EVP_sha256();
+        len = 16;
+        break;
+
+    case TLS1_3_CK_AES_256_GCM_SHA384:
+        ciphers->c = EVP_aes_256_gcm();
+        ciphers->hp = EVP_aes_256_ecb();
+        ciphers->d = EVP_sha384();
+        len = 32;
+        break;
+
+#ifndef OPENSSL_NO_CHACHA
+    case TLS1_3_CK_CHACHA20_POLY1305_SHA256:
+        ciphers->c = EVP_chacha20_poly1305();
+        ciphers->hp = EVP_chacha20();
+        ciphers->d = EVP_sha256();
+        len = 32;
+        break;
+#endif
+
+    default:
+        return NGX_ERROR;
+    }
+
+    return len;
+}
+
+
+static ngx_int_t
+ngx_quic_hkdf_extract(u_char *out, size_t *out_len, const EVP_MD *digest,
+    const u_char *secret, size_t secret_len, const u_char *salt,
+    size_t salt_len)
+{
+    ngx_int_t      rc;
+    EVP_PKEY_CTX  *pctx;
+
+    pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    if (pctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    if (EVP_PKEY_derive_init(pctx) <= 0
+        || EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY) <= 0
+        || EVP_PKEY_CTX_set_hkdf_md(pctx, digest) <= 0
+        || EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, secret_len) <= 0
+        || EVP_PKEY_CTX_set1_hkdf_salt(pctx, salt, salt_len) <= 0
+        || EVP_PKEY_derive(pctx, out, out_len) <= 0)
+    {
+        goto done;
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    EVP_PKEY_CTX_free(pctx);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_quic_hkdf_expand(u_char *out, size_t out_len, const EVP_MD *digest,
+    const u_char *prk, size_t prk_len, const u_char *info, size_t info_len)
+{
+    ngx_int_t      rc;
+    EVP_PKEY_CTX  *pctx;
+
+    pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    if (pctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    if (EVP_PKEY_derive_init(pctx) <= 0
+        || EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) <= 0
+        || EVP_PKEY_CTX_set_hkdf_md(pctx, digest) <= 0
+        || EVP_PKEY_CTX_set1_hkdf_key(pctx, prk, prk_len) <= 0
+        || EVP_PKEY_CTX_add1_hkdf_info(pctx, info, info_len) <= 0
+        || EVP_PKEY_derive(pctx, out, &out_len) <= 0)
+    {
+        goto done;
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    EVP_PKEY_CTX_free(pctx);
+
+    return rc;
+}
+
+
+/* HKDF-Expand-Label of TLS 1.3, RFC 8446, 7.1 */
+
+ngx_int_t
+ngx_quic_expand_label(const EVP_MD *digest, const char *label, u_char *out,
+    size_t outlen, const u_char *secret, size_t secret_len, ngx_log_t *log)
+{
+    size_t   len;
+    u_char  *p, info[2 + 1 + 255 + 1];
+
+    len = ngx_strlen(label);
+
+    p = info;
+
+    *p++ = (u_char) (outlen >> 8);
+    *p++ = (u_char) outlen;
+    *p++ = (u_char) (sizeof("tls13 ") - 1 + len);
+    p = ngx_cpymem(p, "tls13 ", sizeof("tls13 ") - 1);
+    p = ngx_cpymem(p, label, len);
+    *p++ = '\0';
+
+    if (ngx_quic_hkdf_expand(out, outlen, digest, secret, secret_len,
+                             info, p - info)
+        != NGX_OK)
+    {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0,
+                      "quic HKDF-Expand-Label \"%s\" failed", label);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_quic_derive_keys(ngx_quic_secret_t *s, ngx_quic_ciphers_t *ciphers,
+    size_t key_len, ngx_log_t *log)
+{
+    s->key.len = key_len;
+    s->iv.len = NGX_QUIC_IV_LEN;
+    s->hp.len = key_len;
+
+    if (ngx_quic_expand_label(ciphers->d, "quic key", s->key.data, s->key.len,
+                              s->secret.data, s->secret.len, log)
+        != NGX_OK
+        || ngx_quic_expand_label(ciphers->d, "quic iv", s->iv.data, s->iv.len,
+                                 s->secret.data, s->secret.len, log)
+           != NGX_OK
+        || ngx_quic_expand_label(ciphers->d, "quic hp", s->hp.data, s->hp.len,
+                                 s->secret.data, s->secret.len, log)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_quic_keys_set_initial_secret(ngx_quic_keys_t *keys, ngx_str_t *secret,
+    ngx_log_t *log)
+{
+    size_t               is_len;
+    u_char               is[EVP_MAX_MD_SIZE];
+    ngx_int_t            key_len;
+    ngx_quic_secrets_t  *secrets;
+    ngx_quic_ciphers_t   ciphers;
+
+    secrets = &keys->secrets[NGX_QUIC_LEVEL_INITIAL];
+
+    secrets->cipher = TLS1_3_CK_AES_128_GCM_SHA256;
+
+    key_len = ngx_quic_ciphers(secrets->cipher, &ciphers);
+
+    is_len = EVP_MAX_MD_SIZE;
+
+    if (ngx_quic_hkdf_extract(is, &is_len, ciphers.d, secret->data,
+                              secret->len, ngx_quic_initial_salt,
+                              sizeof(ngx_quic_initial_salt))
+        != NGX_OK)
+    {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0, "quic HKDF-Extract failed");
+        return NGX_ERROR;
+    }
+
+    secrets->client.secret.len = EVP_MD_size(ciphers.d);
+    secrets->server.secret.len = EVP_MD_size(ciphers.d);
+
+    if (ngx_quic_expand_label(ciphers.d, "client in",
+                              secrets->client.secret.data,
+                              secrets->client.secret.len, is, is_len, log)
+        != NGX_OK
+        || ngx_quic_expand_label(ciphers.d, "server in",
+                                 secrets->server.secret.data,
+                                 secrets->server.secret.len, is, is_len, log)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_quic_derive_keys(&secrets->client, &ciphers, key_len, log)
+        != NGX_OK
+        || ngx_quic_derive_keys(&secrets->server, &ciphers, key_len, log)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_quic_keys_set_encryption_secret(ngx_log_t *log, ngx_uint_t is_write,
+    ngx_quic_keys_t *keys, ngx_uint_t level, ngx_uint_t cipher,
+    const u_char *secret, size_t secret_len)
+{
+    ngx_int_t            key_len;
+    ngx_quic_secret_t   *s;
+    ngx_quic_ciphers_t   ciphers;
+
+    key_len = ngx_quic_ciphers(cipher, &ciphers);
+
+    if (key_len == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_INFO, log, 0,
+                      "quic unsupported cipher 0x%xi", cipher);
+        return NGX_ERROR;
+    }
+
+    if (secret_len > NGX_QUIC_MAX_MD_SIZE) {
+        return NGX_ERROR;
+    }
+
+    s = is_write ? &keys->secrets[level].server : &keys->secrets[level].client;
+
+    keys->secrets[level].cipher = cipher;
+
+    s->secret.len = secret_len;
+    ngx_memcpy(s->secret.data, secret, secret_len);
+
+    return ngx_quic_derive_keys(s, &ciphers, key_len, log);
+}
+
+
+ngx_uint_t
+ngx_quic_keys_available(ngx_quic_keys_t *keys, ngx_uint_t level,
+    ngx_uint_t is_write)
+{
+    if (is_write) {
+        return keys->secrets[level].server.key.len != 0;
+    }
+
+    return keys->secrets[level].client.key.len != 0;
+}
+
+
+void
+ngx_quic_keys_discard(ngx_quic_keys_t *keys, ngx_uint_t level)
+{
+    ngx_explicit_memzero(&keys->secrets[level], sizeof(ngx_quic_secrets_t));
+}
+
+
+void
+ngx_quic_compute_nonce(u_char *nonce, ngx_quic_md_t *iv, uint64_t pn)
+{
+    ngx_uint_t  i;
+
+    ngx_memcpy(nonce, iv->data, iv->len);
+
+    for (i = 0; i < 8; i++) {
+        nonce[iv->len - 1 - i] ^= (u_char) (pn >> (8 * i));
+    }
+}
+
+
+ngx_int_t
+ngx_quic_tls_seal(const EVP_CIPHER *cipher, ngx_quic_md_t *key,
+    u_char *nonce, ngx_str_t *out, ngx_str_t *in, ngx_str_t *ad,
+    ngx_log_t *log)
+{
+    int              len;
+    ngx_int_t        rc;
+    EVP_CIPHER_CTX  *ctx;
+
+    ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_CIPHER_CTX_new() failed");
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    if (EVP_EncryptInit_ex(ctx, cipher, NULL, NULL, NULL) != 1
+        || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, NGX_QUIC_IV_LEN,
+                               NULL)
+           != 1
+        || EVP_EncryptInit_ex(ctx, NULL, NULL, key->data, nonce) != 1)
+    {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_EncryptInit_ex() failed");
+        goto done;
+    }
+
+    if (EVP_EncryptUpdate(ctx, NULL, &len, ad->data, ad->len) != 1
+        || EVP_EncryptUpdate(ctx, out->data, &len, in->data, in->len) != 1)
+    {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_EncryptUpdate() failed");
+        goto done;
+    }
+
+    out->len = len;
+
+    if (EVP_EncryptFinal_ex(ctx, out->data + out->len, &len) <= 0) {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_EncryptFinal_ex() failed");
+        goto done;
+    }
+
+    out->len += len;
+
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, NGX_QUIC_TAG_LEN,
+                            out->data + out->len)
+        != 1)
+    {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0,
+                      "EVP_CIPHER_CTX_ctrl(EVP_CTRL_AEAD_GET_TAG) failed");
+        goto done;
+    }
+
+    out->len += NGX_QUIC_TAG_LEN;
+
+    rc = NGX_OK;
+
+done:
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_quic_tls_open(const EVP_CIPHER *cipher, ngx_quic_md_t *key,
+    u_char *nonce, ngx_str_t *out, ngx_str_t *in, ngx_str_t *ad,
+    ngx_log_t *log)
+{
+    int              len;
+    u_char          *tag;
+    ngx_int_t        rc;
+    EVP_CIPHER_CTX  *ctx;
+
+    if (in->len < NGX_QUIC_TAG_LEN) {
+        return NGX_ERROR;
+    }
+
+    ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_CIPHER_CTX_new() failed");
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    if (EVP_DecryptInit_ex(ctx, cipher, NULL, NULL, NULL) != 1
+        || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, NGX_QUIC_IV_LEN,
+                               NULL)
+           != 1
+        || EVP_DecryptInit_ex(ctx, NULL, NULL, key->data, nonce) != 1)
+    {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_DecryptInit_ex() failed");
+        goto done;
+    }
+
+    tag = in->data + in->len - NGX_QUIC_TAG_LEN;
+
+    if (EVP_DecryptUpdate(ctx, NULL, &len, ad->data, ad->len) != 1
+        || EVP_DecryptUpdate(ctx, out->data, &len, in->data,
+                             in->len - NGX_QUIC_TAG_LEN)
+           != 1)
+    {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_DecryptUpdate() failed");
+        goto done;
+    }
+
+    out->len = len;
+
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, NGX_QUIC_TAG_LEN, tag)
+        != 1)
+    {
+        ngx_ssl_error(NGX_LOG_INFO, log, 0,
+                      "EVP_CIPHER_CTX_ctrl(EVP_CTRL_AEAD_SET_TAG) failed");
+        goto done;
+    }
+
+    /* a failure here is a forged or corrupted packet */
+
+    if (EVP_DecryptFinal_ex(ctx, out->data + out->len, &len) <= 0) {
+        ERR_clear_error();
+        goto done;
+    }
+
+    out->len += len;
+
+    rc = NGX_OK;
+
+done:
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return rc;
+}
+
+
+/* the header protection mask, RFC 9001, 5.4 */
+
+static ngx_int_t
+ngx_quic_tls_hp(ngx_log_t *log, const EVP_CIPHER *cipher,
+    ngx_quic_secret_t *s, u_char *out, u_char *in)
+{
+    int              outlen;
+    ngx_int_t        rc;
+    EVP_CIPHER_CTX  *ctx;
+    u_char           zero[NGX_QUIC_HP_LEN] = {0};
+
+    ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+#ifndef OPENSSL_NO_CHACHA
+    if (cipher == EVP_chacha20()) {
+
+        /* the sample is the counter and the nonce */
+
+        if (EVP_EncryptInit_ex(ctx, cipher, NULL, s->hp.data, in) != 1
+            || EVP_EncryptUpdate(ctx, out, &outlen, zero, NGX_QUIC_HP_LEN)
+               != 1)
+        {
+            ngx_ssl_error(NGX_LOG_INFO, log, 0,
+                          "quic header protection failed");
+            goto done;
+        }
+
+    } else
+#endif
+    {
+        if (EVP_EncryptInit_ex(ctx, cipher, NULL, s->hp.data, NULL) != 1
+            || EVP_CIPHER_CTX_set_padding(ctx, 0) != 1
+            || EVP_EncryptUpdate(ctx, out, &outlen, in, NGX_QUIC_SAMPLE_LEN)
+               != 1)
+        {
+            ngx_ssl_error(NGX_LOG_INFO, log, 0,
+                          "quic header protection failed");
+            goto done;
+        }
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return rc;
+}
+
+
+ngx_int_t
+ngx_quic_encrypt(ngx_quic_header_t *pkt, u_char *out, size_t *len)
+{
+    u_char              *p, *pnp, *sample;
+    u_char               nonce[NGX_QUIC_IV_LEN], mask[NGX_QUIC_SAMPLE_LEN];
+    ngx_str_t            ad, res;
+    ngx_uint_t           i;
+    ngx_quic_secret_t   *secret;
+    ngx_quic_ciphers_t   ciphers;
+
+    if (ngx_quic_ciphers(pkt->keys->secrets[pkt->level].cipher, &ciphers)
+        == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+    secret = &pkt->keys->secrets[pkt->level].server;
+
+    p = out;
+
+    if (pkt->level == NGX_QUIC_LEVEL_APPLICATION) {
+        *p++ = NGX_QUIC_PKT_FIXED_BIT | (NGX_QUIC_PN_LEN - 1);
+        p = ngx_cpymem(p, pkt->dcid.data, pkt->dcid.len);
+
+    } else {
+        *p++ = NGX_QUIC_PKT_LONG | NGX_QUIC_PKT_FIXED_BIT
+               | (pkt->level == NGX_QUIC_LEVEL_INITIAL
+                  ? NGX_QUIC_PKT_INITIAL : NGX_QUIC_PKT_HANDSHAKE)
+               | (NGX_QUIC_PN_LEN - 1);
+
+        *p++ = (u_char) (NGX_QUIC_VERSION >> 24);
+        *p++ = (u_char) (NGX_QUIC_VERSION >> 16);
+        *p++ = (u_char) (NGX_QUIC_VERSION >> 8);
+        *p++ = (u_char) NGX_QUIC_VERSION;
+
+        *p++ = pkt->dcid.len;
+        p = ngx_cpymem(p, pkt->dcid.data, pkt->dcid.len);
+
+        *p++ = pkt->scid.len;
+        p = ngx_cpymem(p, pkt->scid.data, pkt->scid.len);
+
+        if (pkt->level == NGX_QUIC_LEVEL_INITIAL) {
+            /* no token */
+            *p++ = 0;
+        }
+
+        /* the length in two bytes */
+
+        i = NGX_QUIC_PN_LEN + pkt->payload.len + NGX_QUIC_TAG_LEN;
+
+        *p++ = 0x40 | (u_char) (i >> 8);
+        *p++ = (u_char) i;
+    }
+
+    pnp = p;
+
+    *p++ = (u_char) (pkt->number >> 24);
+    *p++ = (u_char) (pkt->number >> 16);
+    *p++ = (u_char) (pkt->number >> 8);
+    *p++ = (u_char) pkt->number;
+
+    ad.data = out;
+    ad.len = p - out;
+
+    res.data = p;
+
+    ngx_quic_compute_nonce(nonce, &secret->iv, pkt->number);
+
+    if (ngx_quic_tls_seal(ciphers.c, &secret->key, nonce, &res, &pkt->payload,
+                          &ad, pkt->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    sample = pnp + NGX_QUIC_PN_LEN;
+
+    if (ngx_quic_tls_hp(pkt->log, ciphers.hp, secret, mask, sample)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    out[0] ^= mask[0] & (pkt->level == NGX_QUIC_LEVEL_APPLICATION
+                         ? 0x1f : 0x0f);
+
+    for (i = 0; i < NGX_QUIC_PN_LEN; i++) {
+        pnp[i] ^= mask[i + 1];
+    }
+
+    *len = ad.len + res.len;
+
+    return NGX_OK;
+}
+
+
+static uint64_t
+ngx_quic_parse_pn(u_char **pos, ngx_int_t len, u_char *mask,
+    uint64_t *largest_pn)
+{
+    u_char    *p;
+    uint64_t   truncated_pn, expected_pn, candidate_pn;
+    uint64_t   pn_nbits, pn_win, pn_hwin, pn_mask;
+
+    /* the bytes are unmasked in place, as they are a part of the AAD */
+
+    p = *pos;
+    truncated_pn = 0;
+
+    for (pn_nbits = 0; len--; pn_nbits += 8) {
+        *p ^= *mask++;
+        truncated_pn = (truncated_pn << 8) | *p++;
+    }
+
+    *pos = p;
+
+    /* RFC 9000, A.3 */
+
+    expected_pn = *largest_pn + 1;
+    pn_win = (uint64_t) 1 << pn_nbits;
+    pn_hwin = pn_win / 2;
+    pn_mask = pn_win - 1;
+
+    candidate_pn = (expected_pn & ~pn_mask) | truncated_pn;
+
+    if (candidate_pn + pn_hwin <= expected_pn
+        && candidate_pn < ((uint64_t) 1 << 62) - pn_win)
+    {
+        return candidate_pn + pn_win;
+    }
+
+    if (candidate_pn > expected_pn + pn_hwin && candidate_pn >= pn_win) {
+        return candidate_pn - pn_win;
+    }
+
+    return candidate_pn;
+}
+
+
+/*
+ * NGX_DECLINED means that the packet cannot be authenticated and is to be
+ * dropped, while NGX_ERROR is a protocol violation of an authentic packet
+ */
+
+ngx_int_t
+ngx_quic_decrypt(ngx_quic_header_t *pkt, uint64_t *largest_pn)
+{
+    u_char              *p, *sample, clearflags;
+    u_char               nonce[NGX_QUIC_IV_LEN], mask[NGX_QUIC_SAMPLE_LEN];
+    ngx_int_t            pnl;
+    ngx_str_t            in, ad;
+    ngx_quic_secret_t   *secret;
+    ngx_quic_ciphers_t   ciphers;
+
+    if (ngx_quic_ciphers(pkt->keys->secrets[pkt->level].cipher, &ciphers)
+        == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+    secret = &pkt->keys->secrets[pkt->level].client;
+
+    p = pkt->data + pkt->num_offset;
+
+    if (pkt->len < pkt->num_offset + NGX_QUIC_PN_LEN + NGX_QUIC_SAMPLE_LEN) {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic packet is too small to sample");
+        return NGX_DECLINED;
+    }
+
+    sample = p + NGX_QUIC_PN_LEN;
+
+    if (ngx_quic_tls_hp(pkt->log, ciphers.hp, secret, mask, sample)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_quic_long_pkt(pkt->flags)) {
+        clearflags = pkt->flags ^ (mask[0] & 0x0f);
+
+    } else {
+        clearflags = pkt->flags ^ (mask[0] & 0x1f);
+    }
+
+    pnl = (clearflags & 0x03) + 1;
+
+    pkt->number = ngx_quic_parse_pn(&p, pnl, &mask[1], largest_pn);
+    pkt->num_len = pnl;
+
+    pkt->data[0] = clearflags;
+
+    ad.data = pkt->data;
+    ad.len = p - pkt->data;
+
+    in.data = p;
+    in.len = pkt->data + pkt->len - p;
+
+    pkt->payload.data = pkt->plaintext;
+
+    ngx_quic_compute_nonce(nonce, &secret->iv, pkt->number);
+
+    if (ngx_quic_tls_open(ciphers.c, &secret->key, nonce, &pkt->payload, &in,
+                          &ad, pkt->log)
+        != NGX_OK)
+    {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic packet %uL decryption failed", pkt->number);
+        return NGX_DECLINED;
+    }
+
+    pkt->flags = clearflags;
+
+    /* RFC 9000, 17.2 and 17.3.1, reserved bits */
+
+    if (clearflags & (ngx_quic_long_pkt(clearflags) ? 0x0c : 0x18)) {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic reserved bits are set in packet %uL",
+                      pkt->number);
+        pkt->error = NGX_QUIC_ERR_PROTOCOL_VIOLATION;
+        return NGX_ERROR;
+    }
+
+    if (pkt->payload.len == 0) {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic packet %uL has no frames", pkt->number);
+        pkt->error = NGX_QUIC_ERR_PROTOCOL_VIOLATION;
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, pkt->log, 0,
+                   "quic packet level:%ui pn:%uL len:%uz",
+                   pkt->level, pkt->number, pkt->payload.len);
+
+    return NGX_OK;
+}
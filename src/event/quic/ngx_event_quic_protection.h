@@ -0,0 +1,80 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_QUIC_PROTECTION_H_INCLUDED_
+#define _NGX_EVENT_QUIC_PROTECTION_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_QUIC_MAX_MD_SIZE           48
+#define NGX_QUIC_IV_LEN                12
+#define NGX_QUIC_TAG_LEN               16
+#define NGX_QUIC_SAMPLE_LEN            16
+#define NGX_QUIC_HP_LEN                5
+
+/* the packet number is always sent in four bytes */
+#define NGX_QUIC_PN_LEN                4
+
+
+typedef struct {
+    size_t                             len;
+    u_char                             data[NGX_QUIC_MAX_MD_SIZE];
+} ngx_quic_md_t;
+
+
+typedef struct {
+    ngx_quic_md_t                      secret;
+    ngx_quic_md_t                      key;
+    ngx_quic_md_t                      iv;
+    ngx_quic_md_t                      hp;
+} ngx_quic_secret_t;
+
+
+typedef struct {
+    const EVP_CIPHER                  *c;
+    const EVP_CIPHER                  *hp;
+    const EVP_MD                      *d;
+} ngx_quic_ciphers_t;
+
+
+typedef struct {
+    ngx_quic_secret_t                  client;
+    ngx_quic_secret_t                  server;
+    ngx_uint_t                         cipher;
+} ngx_quic_secrets_t;
+
+
+struct ngx_quic_keys_s {
+    ngx_quic_secrets_t                 secrets[NGX_QUIC_LEVELS];
+};
+
+
+ngx_int_t ngx_quic_ciphers(ngx_uint_t id, ngx_quic_ciphers_t *ciphers);
+ngx_int_t ngx_quic_expand_label(const EVP_MD *digest, const char *label,
+    u_char *out, size_t outlen, const u_char *secret, size_t secret_len,
+    ngx_log_t *log);
+ngx_int_t ngx_quic_tls_seal(const EVP_CIPHER *cipher, ngx_quic_md_t *key,
+    u_char *nonce, ngx_str_t *out, ngx_str_t *in, ngx_str_t *ad,
+    ngx_log_t *log);
+void ngx_quic_compute_nonce(u_char *nonce, ngx_quic_md_t *iv, uint64_t pn);
+
+ngx_int_t ngx_quic_keys_set_initial_secret(ngx_quic_keys_t *keys,
+    ngx_str_t *secret, ngx_log_t *log);
+ngx_int_t ngx_quic_keys_set_encryption_secret(ngx_log_t *log,
+    ngx_uint_t is_write, ngx_quic_keys_t *keys, ngx_uint_t level,
+    ngx_uint_t cipher, const u_char *secret, size_t secret_len);
+ngx_uint_t ngx_quic_keys_available(ngx_quic_keys_t *keys, ngx_uint_t level,
+    ngx_uint_t is_write);
+void ngx_quic_keys_discard(ngx_quic_keys_t *keys, ngx_uint_t level);
+
+ngx_int_t ngx_quic_encrypt(ngx_quic_header_t *pkt, u_char *out, size_t *len);
+ngx_int_t ngx_quic_decrypt(ngx_quic_header_t *pkt, uint64_t *largest_pn);
+
+
+#endif /* _NGX_EVENT_QUIC_PROTECTION_H_INCLUDED_ */
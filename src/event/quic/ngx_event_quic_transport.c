@@ -0,0 +1,952 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_quic_connection.h>
+
+
+#define ngx_quic_parse_uint32(p)                                              \
+    ((uint32_t) (p)[0] << 24 | (p)[1] << 16 | (p)[2] << 8 | (p)[3])
+
+#define ngx_quic_write_uint32(p, s)                                           \
+    ((p)[0] = (u_char) ((s) >> 24),                                           \
+     (p)[1] = (u_char) ((s) >> 16),                                           \
+     (p)[2] = (u_char) ((s) >> 8),                                            \
+     (p)[3] = (u_char)  (s),                                                  \
+     (p) + sizeof(uint32_t))
+
+
+static u_char *ngx_quic_parse_bytes(u_char *pos, u_char *end, size_t len,
+    u_char **out);
+static u_char *ngx_quic_skip_ints(u_char *pos, u_char *end, ngx_uint_t n);
+static ngx_uint_t ngx_quic_frame_allowed(ngx_quic_header_t *pkt,
+    ngx_uint_t type);
+static u_char *ngx_quic_parse_tp_int(u_char *p, u_char *end, uint64_t *value);
+static u_char *ngx_quic_build_tp_int(u_char *p, ngx_uint_t id,
+    uint64_t value);
+
+
+u_char *
+ngx_quic_parse_int(u_char *pos, u_char *end, uint64_t *out)
+{
+    u_char      *p;
+    uint64_t     value;
+    ngx_uint_t   len;
+
+    if (pos >= end) {
+        return NULL;
+    }
+
+    p = pos;
+    len = 1 << (*p >> 6);
+
+    value = *p++ & 0x3f;
+
+    if ((size_t) (end - p) < (len - 1)) {
+        return NULL;
+    }
+
+    while (--len) {
+        value = (value << 8) + *p++;
+    }
+
+    *out = value;
+
+    return p;
+}
+
+
+u_char *
+ngx_quic_build_int(u_char *p, uint64_t value)
+{
+    ngx_uint_t  i, len;
+
+    len = ngx_quic_varint_len(value);
+
+    for (i = len; i > 0; i--) {
+        p[i - 1] = (u_char) value;
+        value >>= 8;
+    }
+
+    switch (len) {
+    case 2:
+        p[0] |= 0x40;
+        break;
+    case 4:
+        p[0] |= 0x80;
+        break;
+    case 8:
+        p[0] |= 0xc0;
+        break;
+    }
+
+    return p + len;
+}
+
+
+ngx_uint_t
+ngx_quic_varint_len(uint64_t value)
+{
+    if (value < (1 << 6)) {
+        return 1;
+    }
+
+    if (value < (1 << 14)) {
+        return 2;
+    }
+
+    if (value < (1 << 30)) {
+        return 4;
+    }
+
+    return 8;
+}
+
+
+static u_char *
+ngx_quic_parse_bytes(u_char *pos, u_char *end, size_t len, u_char **out)
+{
+    if ((size_t) (end - pos) < len) {
+        return NULL;
+    }
+
+    *out = pos;
+
+    return pos + len;
+}
+
+
+static u_char *
+ngx_quic_skip_ints(u_char *pos, u_char *end, ngx_uint_t n)
+{
+    uint64_t  value;
+
+    while (n--) {
+        pos = ngx_quic_parse_int(pos, end, &value);
+        if (pos == NULL) {
+            return NULL;
+        }
+    }
+
+    return pos;
+}
+
+
+ngx_int_t
+ngx_quic_get_packet_dcid(ngx_log_t *log, u_char *data, size_t n,
+    ngx_str_t *dcid)
+{
+    size_t  len;
+
+    if (n == 0) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_quic_long_pkt(data[0])) {
+        if (n < 6) {
+            return NGX_ERROR;
+        }
+
+        len = data[5];
+
+        if (n < 6 + len) {
+            return NGX_ERROR;
+        }
+
+        dcid->len = len;
+        dcid->data = &data[6];
+
+    } else {
+        if (n < 1 + NGX_QUIC_SERVER_CID_LEN) {
+            return NGX_ERROR;
+        }
+
+        dcid->len = NGX_QUIC_SERVER_CID_LEN;
+        dcid->data = &data[1];
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "quic packet dcid len:%uz", dcid->len);
+
+    return NGX_OK;
+}
+
+
+/*
+ * the header is parsed up to the packet number, which is protected;
+ * NGX_DECLINED is returned for packets which are skipped: those of other
+ * versions, which stop the parsing of the datagram, and 0-RTT ones
+ */
+
+ngx_int_t
+ngx_quic_parse_packet(ngx_quic_header_t *pkt, u_char *end)
+{
+    u_char    *p;
+    uint64_t   varint;
+
+    p = pkt->data;
+
+    if (p >= end) {
+        return NGX_ERROR;
+    }
+
+    pkt->flags = *p++;
+
+    if (ngx_quic_short_pkt(pkt->flags)) {
+
+        if (!(pkt->flags & NGX_QUIC_PKT_FIXED_BIT)) {
+            ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                          "quic fixed bit is not set");
+            return NGX_ERROR;
+        }
+
+        p = ngx_quic_parse_bytes(p, end, NGX_QUIC_SERVER_CID_LEN,
+                                 &pkt->dcid.data);
+        if (p == NULL) {
+            ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                          "quic packet is too small to read dcid");
+            return NGX_ERROR;
+        }
+
+        pkt->dcid.len = NGX_QUIC_SERVER_CID_LEN;
+        pkt->level = NGX_QUIC_LEVEL_APPLICATION;
+        pkt->version = NGX_QUIC_VERSION;
+
+        pkt->num_offset = p - pkt->data;
+        pkt->len = end - pkt->data;
+
+        return NGX_OK;
+    }
+
+    if (end - p < 5) {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic packet is too small to read version");
+        return NGX_ERROR;
+    }
+
+    pkt->version = ngx_quic_parse_uint32(p);
+    p += 4;
+
+    pkt->dcid.len = *p++;
+
+    p = ngx_quic_parse_bytes(p, end, pkt->dcid.len, &pkt->dcid.data);
+    if (p == NULL || p == end) {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic packet is too small to read dcid");
+        return NGX_ERROR;
+    }
+
+    pkt->scid.len = *p++;
+
+    p = ngx_quic_parse_bytes(p, end, pkt->scid.len, &pkt->scid.data);
+    if (p == NULL) {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic packet is too small to read scid");
+        return NGX_ERROR;
+    }
+
+    if (pkt->version != NGX_QUIC_VERSION) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, pkt->log, 0,
+                       "quic unsupported version: 0x%xD", pkt->version);
+        return NGX_DECLINED;
+    }
+
+    if (!(pkt->flags & NGX_QUIC_PKT_FIXED_BIT)) {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0, "quic fixed bit is not set");
+        return NGX_ERROR;
+    }
+
+    if (pkt->dcid.len > NGX_QUIC_MAX_CID_LEN
+        || pkt->scid.len > NGX_QUIC_MAX_CID_LEN)
+    {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic packet connection id is too long");
+        return NGX_ERROR;
+    }
+
+    switch (pkt->flags & NGX_QUIC_PKT_TYPE) {
+
+    case NGX_QUIC_PKT_INITIAL:
+        p = ngx_quic_parse_int(p, end, &varint);
+        if (p == NULL) {
+            ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                          "quic failed to parse token length");
+            return NGX_ERROR;
+        }
+
+        pkt->token.len = varint;
+
+        p = ngx_quic_parse_bytes(p, end, pkt->token.len, &pkt->token.data);
+        if (p == NULL) {
+            ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                          "quic packet is too small to read token");
+            return NGX_ERROR;
+        }
+
+        pkt->level = NGX_QUIC_LEVEL_INITIAL;
+        break;
+
+    case NGX_QUIC_PKT_HANDSHAKE:
+        pkt->level = NGX_QUIC_LEVEL_HANDSHAKE;
+        break;
+
+    case NGX_QUIC_PKT_ZRTT:
+        pkt->level = NGX_QUIC_LEVEL_APPLICATION;
+        break;
+
+    default: /* NGX_QUIC_PKT_RETRY */
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic retry packet from client");
+        return NGX_ERROR;
+    }
+
+    p = ngx_quic_parse_int(p, end, &varint);
+    if (p == NULL || varint > (uint64_t) (end - p)) {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic bad packet length");
+        return NGX_ERROR;
+    }
+
+    pkt->num_offset = p - pkt->data;
+    pkt->len = pkt->num_offset + varint;
+
+    ngx_log_debug5(NGX_LOG_DEBUG_EVENT, pkt->log, 0,
+                   "quic long packet flags:%xd dcid:%uz scid:%uz "
+                   "token:%uz len:%uz",
+                   pkt->flags, pkt->dcid.len, pkt->scid.len, pkt->token.len,
+                   pkt->len);
+
+    if ((pkt->flags & NGX_QUIC_PKT_TYPE) == NGX_QUIC_PKT_ZRTT) {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+size_t
+ngx_quic_create_version_negotiation(ngx_quic_header_t *pkt, u_char *out)
+{
+    u_char  *p;
+
+    p = out;
+
+    *p++ = NGX_QUIC_PKT_LONG | (ngx_random() & 0x7f);
+    p = ngx_quic_write_uint32(p, 0);
+
+    *p++ = pkt->scid.len;
+    p = ngx_cpymem(p, pkt->scid.data, pkt->scid.len);
+
+    *p++ = pkt->dcid.len;
+    p = ngx_cpymem(p, pkt->dcid.data, pkt->dcid.len);
+
+    p = ngx_quic_write_uint32(p, NGX_QUIC_VERSION);
+
+    return p - out;
+}
+
+
+ssize_t
+ngx_quic_parse_frame(ngx_quic_header_t *pkt, u_char *start, u_char *end,
+    ngx_quic_frame_t *f)
+{
+    u_char    *p, *data;
+    uint64_t   varint, len;
+
+    p = ngx_quic_parse_int(start, end, &varint);
+    if (p == NULL) {
+        goto error;
+    }
+
+    f->type = varint;
+
+    if (!ngx_quic_frame_allowed(pkt, f->type)) {
+        pkt->error = NGX_QUIC_ERR_PROTOCOL_VIOLATION;
+        return NGX_ERROR;
+    }
+
+    switch (f->type) {
+
+    case NGX_QUIC_FT_PADDING:
+
+        while (p < end && *p == NGX_QUIC_FT_PADDING) {
+            p++;
+        }
+
+        break;
+
+    case NGX_QUIC_FT_PING:
+    case NGX_QUIC_FT_HANDSHAKE_DONE:
+        break;
+
+    case NGX_QUIC_FT_ACK:
+    case NGX_QUIC_FT_ACK_ECN:
+
+        p = ngx_quic_parse_int(p, end, &f->u.ack.largest);
+        if (p == NULL) {
+            goto error;
+        }
+
+        p = ngx_quic_parse_int(p, end, &f->u.ack.delay);
+        if (p == NULL) {
+            goto error;
+        }
+
+        p = ngx_quic_parse_int(p, end, &f->u.ack.range_count);
+        if (p == NULL) {
+            goto error;
+        }
+
+        p = ngx_quic_parse_int(p, end, &f->u.ack.first_range);
+        if (p == NULL || f->u.ack.first_range > f->u.ack.largest) {
+            goto error;
+        }
+
+        f->u.ack.ranges_start = p;
+
+        if (f->u.ack.range_count > (uint64_t) (end - p) / 2) {
+            goto error;
+        }
+
+        p = ngx_quic_skip_ints(p, end, 2 * f->u.ack.range_count);
+        if (p == NULL) {
+            goto error;
+        }
+
+        f->u.ack.ranges_end = p;
+
+        if (f->type == NGX_QUIC_FT_ACK_ECN) {
+            p = ngx_quic_skip_ints(p, end, 3);
+            if (p == NULL) {
+                goto error;
+            }
+        }
+
+        break;
+
+    case NGX_QUIC_FT_CRYPTO:
+
+        p = ngx_quic_parse_int(p, end, &f->u.crypto.offset);
+        if (p == NULL) {
+            goto error;
+        }
+
+        p = ngx_quic_parse_int(p, end, &f->u.crypto.length);
+        if (p == NULL) {
+            goto error;
+        }
+
+        p = ngx_quic_parse_bytes(p, end, f->u.crypto.length,
+                                 &f->u.crypto.data);
+        if (p == NULL) {
+            goto error;
+        }
+
+        break;
+
+    case NGX_QUIC_FT_CONNECTION_CLOSE:
+    case NGX_QUIC_FT_CONNECTION_CLOSE_APP:
+
+        p = ngx_quic_parse_int(p, end, &f->u.close.error_code);
+        if (p == NULL) {
+            goto error;
+        }
+
+        f->u.close.frame_type = 0;
+
+        if (f->type == NGX_QUIC_FT_CONNECTION_CLOSE) {
+            p = ngx_quic_parse_int(p, end, &f->u.close.frame_type);
+            if (p == NULL) {
+                goto error;
+            }
+        }
+
+        p = ngx_quic_parse_int(p, end, &len);
+        if (p == NULL) {
+            goto error;
+        }
+
+        f->u.close.reason.len = len;
+
+        p = ngx_quic_parse_bytes(p, end, len, &f->u.close.reason.data);
+        if (p == NULL) {
+            goto error;
+        }
+
+        break;
+
+    case NGX_QUIC_FT_PATH_CHALLENGE:
+    case NGX_QUIC_FT_PATH_RESPONSE:
+
+        p = ngx_quic_parse_bytes(p, end, 8, &data);
+        if (p == NULL) {
+            goto error;
+        }
+
+        ngx_memcpy(f->u.path_challenge.data, data, 8);
+
+        break;
+
+    /* the rest of frames is only parsed to be skipped */
+
+    case NGX_QUIC_FT_RESET_STREAM:
+        p = ngx_quic_skip_ints(p, end, 3);
+        break;
+
+    case NGX_QUIC_FT_STOP_SENDING:
+    case NGX_QUIC_FT_MAX_STREAM_DATA:
+    case NGX_QUIC_FT_STREAM_DATA_BLOCKED:
+        p = ngx_quic_skip_ints(p, end, 2);
+        break;
+
+    case NGX_QUIC_FT_MAX_DATA:
+    case NGX_QUIC_FT_MAX_STREAMS:
+    case NGX_QUIC_FT_MAX_STREAMS2:
+    case NGX_QUIC_FT_DATA_BLOCKED:
+    case NGX_QUIC_FT_STREAMS_BLOCKED:
+    case NGX_QUIC_FT_STREAMS_BLOCKED2:
+    case NGX_QUIC_FT_RETIRE_CONNECTION_ID:
+        p = ngx_quic_skip_ints(p, end, 1);
+        break;
+
+    case NGX_QUIC_FT_NEW_TOKEN:
+
+        p = ngx_quic_parse_int(p, end, &len);
+        if (p == NULL) {
+            goto error;
+        }
+
+        p = ngx_quic_parse_bytes(p, end, len, &data);
+        break;
+
+    case NGX_QUIC_FT_NEW_CONNECTION_ID:
+
+        p = ngx_quic_skip_ints(p, end, 2);
+        if (p == NULL || p == end) {
+            goto error;
+        }
+
+        len = *p++;
+
+        if (len < 1 || len > NGX_QUIC_MAX_CID_LEN) {
+            goto error;
+        }
+
+        /* the connection id and the stateless reset token */
+
+        p = ngx_quic_parse_bytes(p, end, len + 16, &data);
+        break;
+
+    default:
+
+        if (f->type < NGX_QUIC_FT_STREAM
+            || f->type > NGX_QUIC_FT_STREAM_LAST)
+        {
+            ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                          "quic unknown frame type 0x%xL", f->type);
+            pkt->error = NGX_QUIC_ERR_FRAME_ENCODING_ERROR;
+            return NGX_ERROR;
+        }
+
+        /* stream id, and offset and length if present */
+
+        p = ngx_quic_skip_ints(p, end, 1);
+        if (p == NULL) {
+            goto error;
+        }
+
+        if (f->type & 0x04) {
+            p = ngx_quic_skip_ints(p, end, 1);
+            if (p == NULL) {
+                goto error;
+            }
+        }
+
+        if (f->type & 0x02) {
+            p = ngx_quic_parse_int(p, end, &len);
+            if (p == NULL) {
+                goto error;
+            }
+
+            p = ngx_quic_parse_bytes(p, end, len, &data);
+
+        } else {
+            p = end;
+        }
+
+        break;
+    }
+
+    if (p == NULL) {
+        goto error;
+    }
+
+    return p - start;
+
+error:
+
+    pkt->error = NGX_QUIC_ERR_FRAME_ENCODING_ERROR;
+
+    ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                  "quic failed to parse frame type:0x%xL", f->type);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_quic_frame_allowed(ngx_quic_header_t *pkt, ngx_uint_t type)
+{
+    /* RFC 9000, 12.4, table 3 */
+
+    if (pkt->level != NGX_QUIC_LEVEL_APPLICATION) {
+
+        switch (type) {
+        case NGX_QUIC_FT_PADDING:
+        case NGX_QUIC_FT_PING:
+        case NGX_QUIC_FT_ACK:
+        case NGX_QUIC_FT_ACK_ECN:
+        case NGX_QUIC_FT_CRYPTO:
+        case NGX_QUIC_FT_CONNECTION_CLOSE:
+            return 1;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic frame type 0x%xi is not allowed in %s packet",
+                      type, pkt->level == NGX_QUIC_LEVEL_INITIAL
+                            ? "initial" : "handshake");
+        return 0;
+    }
+
+    /* frames which are only sent by servers */
+
+    if (type == NGX_QUIC_FT_NEW_TOKEN || type == NGX_QUIC_FT_HANDSHAKE_DONE) {
+        ngx_log_error(NGX_LOG_INFO, pkt->log, 0,
+                      "quic frame type 0x%xi from client", type);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+u_char *
+ngx_quic_parse_ack_range(ngx_log_t *log, u_char *start, u_char *end,
+    uint64_t *gap, uint64_t *range)
+{
+    u_char  *p;
+
+    p = ngx_quic_parse_int(start, end, gap);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    return ngx_quic_parse_int(p, end, range);
+}
+
+
+/*
+ * the ranges are given as pairs of the smallest and the largest packet
+ * numbers in the descending order; "p" may be NULL to get the length
+ */
+
+size_t
+ngx_quic_create_ack(u_char *p, uint64_t (*ranges)[2], ngx_uint_t n,
+    uint64_t delay)
+{
+    size_t      len;
+    uint64_t    gap, range;
+    ngx_uint_t  i;
+
+    len = 1 + ngx_quic_varint_len(ranges[0][1])
+          + ngx_quic_varint_len(delay)
+          + ngx_quic_varint_len(n - 1)
+          + ngx_quic_varint_len(ranges[0][1] - ranges[0][0]);
+
+    for (i = 1; i < n; i++) {
+        gap = ranges[i - 1][0] - ranges[i][1] - 2;
+        range = ranges[i][1] - ranges[i][0];
+
+        len += ngx_quic_varint_len(gap) + ngx_quic_varint_len(range);
+    }
+
+    if (p == NULL) {
+        return len;
+    }
+
+    *p++ = NGX_QUIC_FT_ACK;
+    p = ngx_quic_build_int(p, ranges[0][1]);
+    p = ngx_quic_build_int(p, delay);
+    p = ngx_quic_build_int(p, n - 1);
+    p = ngx_quic_build_int(p, ranges[0][1] - ranges[0][0]);
+
+    for (i = 1; i < n; i++) {
+        gap = ranges[i - 1][0] - ranges[i][1] - 2;
+        range = ranges[i][1] - ranges[i][0];
+
+        p = ngx_quic_build_int(p, gap);
+        p = ngx_quic_build_int(p, range);
+    }
+
+    return len;
+}
+
+
+size_t
+ngx_quic_crypto_overhead(uint64_t offset, size_t len)
+{
+    return 1 + ngx_quic_varint_len(offset) + ngx_quic_varint_len(len);
+}
+
+
+size_t
+ngx_quic_create_crypto(u_char *p, uint64_t offset, u_char *data, size_t len)
+{
+    u_char  *start;
+
+    start = p;
+
+    *p++ = NGX_QUIC_FT_CRYPTO;
+    p = ngx_quic_build_int(p, offset);
+    p = ngx_quic_build_int(p, len);
+    p = ngx_cpymem(p, data, len);
+
+    return p - start;
+}
+
+
+size_t
+ngx_quic_create_close(u_char *p, ngx_uint_t error, ngx_uint_t frame_type)
+{
+    u_char  *start;
+
+    start = p;
+
+    *p++ = NGX_QUIC_FT_CONNECTION_CLOSE;
+    p = ngx_quic_build_int(p, error);
+    p = ngx_quic_build_int(p, frame_type);
+
+    /* no reason phrase */
+    *p++ = 0;
+
+    return p - start;
+}
+
+
+size_t
+ngx_quic_create_path_response(u_char *p, u_char *data)
+{
+    *p++ = NGX_QUIC_FT_PATH_RESPONSE;
+    ngx_memcpy(p, data, 8);
+
+    return 1 + 8;
+}
+
+
+static u_char *
+ngx_quic_parse_tp_int(u_char *p, u_char *end, uint64_t *value)
+{
+    /* the value must take the whole parameter */
+
+    p = ngx_quic_parse_int(p, end, value);
+
+    if (p != end) {
+        return NULL;
+    }
+
+    return p;
+}
+
+
+ngx_int_t
+ngx_quic_parse_transport_params(u_char *p, u_char *end, ngx_quic_tp_t *tp,
+    ngx_log_t *log)
+{
+    u_char    *value;
+    uint64_t   id, len, varint;
+
+    while (p < end) {
+        p = ngx_quic_parse_int(p, end, &id);
+        if (p == NULL) {
+            goto failed;
+        }
+
+        p = ngx_quic_parse_int(p, end, &len);
+        if (p == NULL || len > (uint64_t) (end - p)) {
+            goto failed;
+        }
+
+        value = p;
+        p += len;
+
+        switch (id) {
+
+        case NGX_QUIC_TP_ORIGINAL_DCID:
+        case NGX_QUIC_TP_STATELESS_RESET_TOKEN:
+        case NGX_QUIC_TP_PREFERRED_ADDRESS:
+        case NGX_QUIC_TP_RETRY_SCID:
+            ngx_log_error(NGX_LOG_INFO, log, 0,
+                          "quic client sent server transport parameter 0x%xL",
+                          id);
+            return NGX_ERROR;
+
+        case NGX_QUIC_TP_MAX_IDLE_TIMEOUT:
+            if (ngx_quic_parse_tp_int(value, p, &varint) == NULL) {
+                goto failed;
+            }
+
+            if (varint > NGX_MAX_INT32_VALUE) {
+                varint = NGX_MAX_INT32_VALUE;
+            }
+
+            tp->max_idle_timeout = (ngx_msec_t) varint;
+            break;
+
+        case NGX_QUIC_TP_MAX_UDP_PAYLOAD_SIZE:
+            if (ngx_quic_parse_tp_int(value, p, &varint) == NULL
+                || varint < NGX_QUIC_MIN_INITIAL_SIZE)
+            {
+                goto failed;
+            }
+
+            tp->max_udp_payload_size = varint;
+            break;
+
+        case NGX_QUIC_TP_ACK_DELAY_EXPONENT:
+            if (ngx_quic_parse_tp_int(value, p, &varint) == NULL
+                || varint > 20)
+            {
+                goto failed;
+            }
+
+            tp->ack_delay_exponent = varint;
+            break;
+
+        case NGX_QUIC_TP_MAX_ACK_DELAY:
+            if (ngx_quic_parse_tp_int(value, p, &varint) == NULL
+                || varint >= 16384)
+            {
+                goto failed;
+            }
+
+            tp->max_ack_delay = (ngx_msec_t) varint;
+            break;
+
+        case NGX_QUIC_TP_DISABLE_ACTIVE_MIGRATION:
+            if (len != 0) {
+                goto failed;
+            }
+
+            tp->disable_active_migration = 1;
+            break;
+
+        case NGX_QUIC_TP_ACTIVE_CONNECTION_ID_LIMIT:
+            if (ngx_quic_parse_tp_int(value, p, &varint) == NULL
+                || varint < 2)
+            {
+                goto failed;
+            }
+
+            tp->active_connection_id_limit = varint;
+            break;
+
+        case NGX_QUIC_TP_INITIAL_SCID:
+            if (len > NGX_QUIC_MAX_CID_LEN) {
+                goto failed;
+            }
+
+            tp->initial_scid.len = len;
+            tp->initial_scid.data = value;
+            tp->initial_scid_set = 1;
+            break;
+
+        case NGX_QUIC_TP_INITIAL_MAX_DATA:
+        case NGX_QUIC_TP_INITIAL_MAX_STREAM_DATA_BIDI_LOCAL:
+        case NGX_QUIC_TP_INITIAL_MAX_STREAM_DATA_BIDI_REMOTE:
+        case NGX_QUIC_TP_INITIAL_MAX_STREAM_DATA_UNI:
+        case NGX_QUIC_TP_INITIAL_MAX_STREAMS_BIDI:
+        case NGX_QUIC_TP_INITIAL_MAX_STREAMS_UNI:
+
+            /* the limits only matter for streams of the server */
+
+            if (ngx_quic_parse_tp_int(value, p, &varint) == NULL) {
+                goto failed;
+            }
+
+            break;
+
+        default:
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                           "quic unknown transport parameter 0x%xL, skipped",
+                           id);
+            break;
+        }
+    }
+
+    if (!tp->initial_scid_set) {
+        ngx_log_error(NGX_LOG_INFO, log, 0,
+                      "quic client did not send initial_source_connection_id");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_INFO, log, 0,
+                  "quic failed to parse transport parameters");
+
+    return NGX_ERROR;
+}
+
+
+static u_char *
+ngx_quic_build_tp_int(u_char *p, ngx_uint_t id, uint64_t value)
+{
+    p = ngx_quic_build_int(p, id);
+    p = ngx_quic_build_int(p, ngx_quic_varint_len(value));
+
+    return ngx_quic_build_int(p, value);
+}
+
+
+/*
+ * the server does not accept streams yet, so the initial flow control
+ * limits and stream counts are left at their defaults of zero
+ */
+
+ssize_t
+ngx_quic_create_transport_params(u_char *p, u_char *end, ngx_quic_tp_t *tp)
+{
+    u_char  *start;
+    size_t   len;
+
+    len = 3 * 2 + 2 * NGX_QUIC_MAX_CID_LEN + 2 + 2 + 8;
+
+    if ((size_t) (end - p) < len) {
+        return NGX_ERROR;
+    }
+
+    start = p;
+
+    p = ngx_quic_build_int(p, NGX_QUIC_TP_ORIGINAL_DCID);
+    p = ngx_quic_build_int(p, tp->original_dcid.len);
+    p = ngx_cpymem(p, tp->original_dcid.data, tp->original_dcid.len);
+
+    p = ngx_quic_build_tp_int(p, NGX_QUIC_TP_MAX_IDLE_TIMEOUT,
+                              tp->max_idle_timeout);
+
+    p = ngx_quic_build_int(p, NGX_QUIC_TP_DISABLE_ACTIVE_MIGRATION);
+    p = ngx_quic_build_int(p, 0);
+
+    p = ngx_quic_build_int(p, NGX_QUIC_TP_INITIAL_SCID);
+    p = ngx_quic_build_int(p, tp->initial_scid.len);
+    p = ngx_cpymem(p, tp->initial_scid.data, tp->initial_scid.len);
+
+    return p - start;
+}
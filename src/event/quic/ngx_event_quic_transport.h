@@ -0,0 +1,226 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_QUIC_TRANSPORT_H_INCLUDED_
+#define _NGX_EVENT_QUIC_TRANSPORT_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/* encryption levels, which are also packet number spaces */
+
+#define NGX_QUIC_LEVEL_INITIAL                    0
+#define NGX_QUIC_LEVEL_HANDSHAKE                  1
+#define NGX_QUIC_LEVEL_APPLICATION                2
+#define NGX_QUIC_LEVELS                           3
+
+
+#define NGX_QUIC_PKT_LONG                         0x80
+#define NGX_QUIC_PKT_FIXED_BIT                    0x40
+#define NGX_QUIC_PKT_TYPE                         0x30
+#define NGX_QUIC_PKT_KPHASE                       0x04
+
+#define NGX_QUIC_PKT_INITIAL                      0x00
+#define NGX_QUIC_PKT_ZRTT                         0x10
+#define NGX_QUIC_PKT_HANDSHAKE                    0x20
+#define NGX_QUIC_PKT_RETRY                        0x30
+
+#define ngx_quic_long_pkt(flags)  ((flags) & NGX_QUIC_PKT_LONG)
+#define ngx_quic_short_pkt(flags)  (((flags) & NGX_QUIC_PKT_LONG) == 0)
+
+
+/* RFC 9000, 12.4 */
+
+#define NGX_QUIC_FT_PADDING                       0x00
+#define NGX_QUIC_FT_PING                          0x01
+#define NGX_QUIC_FT_ACK                           0x02
+#define NGX_QUIC_FT_ACK_ECN                       0x03
+#define NGX_QUIC_FT_RESET_STREAM                  0x04
+#define NGX_QUIC_FT_STOP_SENDING                  0x05
+#define NGX_QUIC_FT_CRYPTO                        0x06
+#define NGX_QUIC_FT_NEW_TOKEN                     0x07
+#define NGX_QUIC_FT_STREAM                        0x08
+#define NGX_QUIC_FT_STREAM_LAST                   0x0f
+#define NGX_QUIC_FT_MAX_DATA                      0x10
+#define NGX_QUIC_FT_MAX_STREAM_DATA               0x11
+#define NGX_QUIC_FT_MAX_STREAMS                   0x12
+#define NGX_QUIC_FT_MAX_STREAMS2                  0x13
+#define NGX_QUIC_FT_DATA_BLOCKED                  0x14
+#define NGX_QUIC_FT_STREAM_DATA_BLOCKED           0x15
+#define NGX_QUIC_FT_STREAMS_BLOCKED               0x16
+#define NGX_QUIC_FT_STREAMS_BLOCKED2              0x17
+#define NGX_QUIC_FT_NEW_CONNECTION_ID             0x18
+#define NGX_QUIC_FT_RETIRE_CONNECTION_ID          0x19
+#define NGX_QUIC_FT_PATH_CHALLENGE                0x1a
+#define NGX_QUIC_FT_PATH_RESPONSE                 0x1b
+#define NGX_QUIC_FT_CONNECTION_CLOSE              0x1c
+#define NGX_QUIC_FT_CONNECTION_CLOSE_APP          0x1d
+#define NGX_QUIC_FT_HANDSHAKE_DONE                0x1e
+
+
+/* RFC 9000, 20.1 */
+
+#define NGX_QUIC_ERR_NO_ERROR                     0x00
+#define NGX_QUIC_ERR_INTERNAL_ERROR               0x01
+#define NGX_QUIC_ERR_CONNECTION_REFUSED           0x02
+#define NGX_QUIC_ERR_FLOW_CONTROL_ERROR           0x03
+#define NGX_QUIC_ERR_STREAM_LIMIT_ERROR           0x04
+#define NGX_QUIC_ERR_STREAM_STATE_ERROR           0x05
+#define NGX_QUIC_ERR_FINAL_SIZE_ERROR             0x06
+#define NGX_QUIC_ERR_FRAME_ENCODING_ERROR         0x07
+#define NGX_QUIC_ERR_TRANSPORT_PARAMETER_ERROR    0x08
+#define NGX_QUIC_ERR_CONNECTION_ID_LIMIT_ERROR    0x09
+#define NGX_QUIC_ERR_PROTOCOL_VIOLATION           0x0a
+#define NGX_QUIC_ERR_INVALID_TOKEN                0x0b
+#define NGX_QUIC_ERR_APPLICATION_ERROR            0x0c
+#define NGX_QUIC_ERR_CRYPTO_BUFFER_EXCEEDED       0x0d
+#define NGX_QUIC_ERR_KEY_UPDATE_ERROR             0x0e
+#define NGX_QUIC_ERR_AEAD_LIMIT_REACHED           0x0f
+#define NGX_QUIC_ERR_NO_VIABLE_PATH               0x10
+
+#define NGX_QUIC_ERR_CRYPTO(e)                    (0x100 + (e))
+
+
+/* RFC 9000, 18.2 */
+
+#define NGX_QUIC_TP_ORIGINAL_DCID                 0x00
+#define NGX_QUIC_TP_MAX_IDLE_TIMEOUT              0x01
+#define NGX_QUIC_TP_STATELESS_RESET_TOKEN         0x02
+#define NGX_QUIC_TP_MAX_UDP_PAYLOAD_SIZE          0x03
+#define NGX_QUIC_TP_INITIAL_MAX_DATA              0x04
+#define NGX_QUIC_TP_INITIAL_MAX_STREAM_DATA_BIDI_LOCAL   0x05
+#define NGX_QUIC_TP_INITIAL_MAX_STREAM_DATA_BIDI_REMOTE  0x06
+#define NGX_QUIC_TP_INITIAL_MAX_STREAM_DATA_UNI   0x07
+#define NGX_QUIC_TP_INITIAL_MAX_STREAMS_BIDI      0x08
+#define NGX_QUIC_TP_INITIAL_MAX_STREAMS_UNI       0x09
+#define NGX_QUIC_TP_ACK_DELAY_EXPONENT            0x0a
+#define NGX_QUIC_TP_MAX_ACK_DELAY                 0x0b
+#define NGX_QUIC_TP_DISABLE_ACTIVE_MIGRATION      0x0c
+#define NGX_QUIC_TP_PREFERRED_ADDRESS             0x0d
+#define NGX_QUIC_TP_ACTIVE_CONNECTION_ID_LIMIT    0x0e
+#define NGX_QUIC_TP_INITIAL_SCID                  0x0f
+#define NGX_QUIC_TP_RETRY_SCID                    0x10
+
+#define NGX_QUIC_DEFAULT_ACK_DELAY_EXPONENT       3
+#define NGX_QUIC_DEFAULT_MAX_ACK_DELAY            25
+
+#define NGX_QUIC_MAX_ACK_RANGES                   16
+
+
+typedef struct {
+    uint64_t                                  largest;
+    uint64_t                                  delay;
+    uint64_t                                  range_count;
+    uint64_t                                  first_range;
+    u_char                                   *ranges_start;
+    u_char                                   *ranges_end;
+} ngx_quic_ack_frame_t;
+
+
+typedef struct {
+    uint64_t                                  offset;
+    uint64_t                                  length;
+    u_char                                   *data;
+} ngx_quic_crypto_frame_t;
+
+
+typedef struct {
+    uint64_t                                  error_code;
+    uint64_t                                  frame_type;
+    ngx_str_t                                 reason;
+} ngx_quic_close_frame_t;
+
+
+typedef struct {
+    u_char                                    data[8];
+} ngx_quic_path_challenge_frame_t;
+
+
+typedef struct {
+    ngx_uint_t                                type;
+    union {
+        ngx_quic_ack_frame_t                  ack;
+        ngx_quic_crypto_frame_t               crypto;
+        ngx_quic_close_frame_t                close;
+        ngx_quic_path_challenge_frame_t       path_challenge;
+    } u;
+} ngx_quic_frame_t;
+
+
+typedef struct {
+    ngx_log_t                                *log;
+
+    ngx_quic_keys_t                          *keys;
+
+    uint8_t                                   flags;
+    uint32_t                                  version;
+    ngx_uint_t                                level;
+
+    ngx_str_t                                 dcid;
+    ngx_str_t                                 scid;
+    ngx_str_t                                 token;
+
+    /* the packet in the datagram and the offset of its number */
+    u_char                                   *data;
+    size_t                                    len;
+    size_t                                    num_offset;
+
+    uint64_t                                  number;
+    uint8_t                                   num_len;
+
+    ngx_str_t                                 payload;
+    u_char                                   *plaintext;
+
+    ngx_uint_t                                error;
+
+    unsigned                                  need_ack:1;
+} ngx_quic_header_t;
+
+
+typedef struct {
+    ngx_msec_t                                max_idle_timeout;
+    uint64_t                                  max_udp_payload_size;
+    uint64_t                                  ack_delay_exponent;
+    ngx_msec_t                                max_ack_delay;
+    uint64_t                                  active_connection_id_limit;
+    ngx_str_t                                 original_dcid;
+    ngx_str_t                                 initial_scid;
+    unsigned                                  disable_active_migration:1;
+    unsigned                                  initial_scid_set:1;
+} ngx_quic_tp_t;
+
+
+u_char *ngx_quic_parse_int(u_char *pos, u_char *end, uint64_t *out);
+u_char *ngx_quic_build_int(u_char *p, uint64_t value);
+ngx_uint_t ngx_quic_varint_len(uint64_t value);
+
+ngx_int_t ngx_quic_parse_packet(ngx_quic_header_t *pkt, u_char *end);
+size_t ngx_quic_create_version_negotiation(ngx_quic_header_t *pkt,
+    u_char *out);
+
+ssize_t ngx_quic_parse_frame(ngx_quic_header_t *pkt, u_char *start,
+    u_char *end, ngx_quic_frame_t *f);
+u_char *ngx_quic_parse_ack_range(ngx_log_t *log, u_char *start, u_char *end,
+    uint64_t *gap, uint64_t *range);
+
+size_t ngx_quic_create_ack(u_char *p, uint64_t (*ranges)[2], ngx_uint_t n,
+    uint64_t delay);
+size_t ngx_quic_create_crypto(u_char *p, uint64_t offset, u_char *data,
+    size_t len);
+size_t ngx_quic_crypto_overhead(uint64_t offset, size_t len);
+size_t ngx_quic_create_close(u_char *p, ngx_uint_t error,
+    ngx_uint_t frame_type);
+size_t ngx_quic_create_path_response(u_char *p, u_char *data);
+
+ngx_int_t ngx_quic_parse_transport_params(u_char *p, u_char *end,
+    ngx_quic_tp_t *tp, ngx_log_t *log);
+ssize_t ngx_quic_create_transport_params(u_char *p, u_char *end,
+    ngx_quic_tp_t *tp);
+
+
+#endif /* _NGX_EVENT_QUIC_TRANSPORT_H_INCLUDED_ */
@@ -62,6 +62,7 @@ static char *ngx_http_access_rule(ngx_conf_t *cf, ngx_command_t *cmd,
 static void *ngx_http_access_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_access_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_int_t ngx_http_access_preconfiguration(ngx_conf_t *cf);
 static ngx_int_t ngx_http_access_init(ngx_conf_t *cf);
 
 
@@ -89,7 +90,7 @@ static ngx_command_t  ngx_http_access_commands[] = {
 
 
 static ngx_http_module_t  ngx_http_access_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_access_preconfiguration,      /* preconfiguration */
     ngx_http_access_init,                  /* postconfiguration */
 
     NULL,                                  /* create main configuration */
@@ -444,6 +445,15 @@ ngx_http_access_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 }
 
 
+static ngx_int_t
+ngx_http_access_preconfiguration(ngx_conf_t *cf)
+{
+    ngx_http_share_loc_conf(cf, &ngx_http_access_module);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_access_init(ngx_conf_t *cf)
 {
@@ -9,6 +9,7 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 #include <ngx_crypt.h>
+#include <ngx_md5.h>
 
 
 #define NGX_HTTP_AUTH_BUF_SIZE  2048
@@ -17,18 +18,50 @@
 typedef struct {
     ngx_http_complex_value_t  *realm;
     ngx_http_complex_value_t   user_file;
+    ngx_flag_t                 cache;
+    time_t                     cache_valid;
+    time_t                     verified_valid;
 } ngx_http_auth_basic_loc_conf_t;
 
 
+typedef struct {
+    ngx_str_node_t             sn;
+    ngx_str_t                  passwd;
+    time_t                     verified;
+    u_char                     md5[16];
+} ngx_http_auth_basic_user_t;
+
+
+typedef struct {
+    ngx_str_node_t             sn;
+    ngx_rbtree_t               users;
+    ngx_rbtree_node_t          sentinel;
+    ngx_pool_t                *pool;
+    time_t                     checked;
+    time_t                     mtime;
+    off_t                      size;
+    ngx_file_uniq_t            uniq;
+} ngx_http_auth_basic_file_t;
+
+
 static ngx_int_t ngx_http_auth_basic_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_auth_basic_crypt_handler(ngx_http_request_t *r,
     ngx_str_t *passwd, ngx_str_t *realm);
+static ngx_int_t ngx_http_auth_basic_cached(ngx_http_request_t *r,
+    ngx_http_auth_basic_loc_conf_t *alcf, ngx_str_t *user_file,
+    ngx_str_t *realm);
+static ngx_http_auth_basic_file_t *ngx_http_auth_basic_file(
+    ngx_http_request_t *r, ngx_http_auth_basic_loc_conf_t *alcf,
+    ngx_str_t *name, ngx_int_t *rc);
+static ngx_int_t ngx_http_auth_basic_read(ngx_http_request_t *r,
+    ngx_http_auth_basic_file_t *file);
 static ngx_int_t ngx_http_auth_basic_set_realm(ngx_http_request_t *r,
     ngx_str_t *realm);
 static void ngx_http_auth_basic_close(ngx_file_t *file);
 static void *ngx_http_auth_basic_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_auth_basic_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_int_t ngx_http_auth_basic_preconfiguration(ngx_conf_t *cf);
 static ngx_int_t ngx_http_auth_basic_init(ngx_conf_t *cf);
 static char *ngx_http_auth_basic_user_file(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -52,12 +85,36 @@ static ngx_command_t  ngx_http_auth_basic_commands[] = {
       offsetof(ngx_http_auth_basic_loc_conf_t, user_file),
       NULL },
 
+    { ngx_string("auth_basic_user_file_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_auth_basic_loc_conf_t, cache),
+      NULL },
+
+    { ngx_string("auth_basic_user_file_cache_valid"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_auth_basic_loc_conf_t, cache_valid),
+      NULL },
+
+    { ngx_string("auth_basic_verified_valid"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_auth_basic_loc_conf_t, verified_valid),
+      NULL },
+
       ngx_null_command
 };
 
 
 static ngx_http_module_t  ngx_http_auth_basic_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_auth_basic_preconfiguration,  /* preconfiguration */
     ngx_http_auth_basic_init,              /* postconfiguration */
 
     NULL,                                  /* create main configuration */
@@ -87,6 +144,13 @@ ngx_module_t  ngx_http_auth_basic_module = {
 };
 
 
+/* the parsed user files of the worker process */
+
+static ngx_rbtree_t       ngx_http_auth_basic_files;
+static ngx_rbtree_node_t  ngx_http_auth_basic_files_sentinel;
+static u_char             ngx_http_auth_basic_key[16];
+
+
 static ngx_int_t
 ngx_http_auth_basic_handler(ngx_http_request_t *r)
 {
@@ -138,6 +202,10 @@ ngx_http_auth_basic_handler(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    if (alcf->cache) {
+        return ngx_http_auth_basic_cached(r, alcf, &user_file, &realm);
+    }
+
     fd = ngx_open_file(user_file.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
 
     if (fd == NGX_INVALID_FILE) {
@@ -306,6 +374,312 @@ ngx_http_auth_basic_crypt_handler(ngx_http_request_t *r, ngx_str_t *passwd,
 }
 
 
+static ngx_int_t
+ngx_http_auth_basic_cached(ngx_http_request_t *r,
+    ngx_http_auth_basic_loc_conf_t *alcf, ngx_str_t *user_file,
+    ngx_str_t *realm)
+{
+    u_char                       md5[16];
+    ngx_int_t                    rc;
+    ngx_md5_t                    ctx;
+    ngx_http_auth_basic_user_t  *user;
+    ngx_http_auth_basic_file_t  *file;
+
+    file = ngx_http_auth_basic_file(r, alcf, user_file, &rc);
+    if (file == NULL) {
+        return rc;
+    }
+
+    user = (ngx_http_auth_basic_user_t *)
+               ngx_str_rbtree_lookup(&file->users, &r->headers_in.user,
+                                     ngx_crc32_short(r->headers_in.user.data,
+                                                     r->headers_in.user.len));
+
+    if (user == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "user \"%V\" was not found in \"%s\"",
+                      &r->headers_in.user, user_file->data);
+
+        return ngx_http_auth_basic_set_realm(r, realm);
+    }
+
+    if (alcf->verified_valid) {
+
+        /*
+         * a successful verification is remembered as a keyed hash
+         * of the password rather than the password itself
+         */
+
+        ngx_md5_init(&ctx);
+        ngx_md5_update(&ctx, ngx_http_auth_basic_key,
+                       sizeof(ngx_http_auth_basic_key));
+        ngx_md5_update(&ctx, r->headers_in.passwd.data,
+                       r->headers_in.passwd.len);
+        ngx_md5_final(md5, &ctx);
+
+        if (user->verified
+            && ngx_time() - user->verified < alcf->verified_valid
+            && ngx_memcmp(md5, user->md5, 16) == 0)
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "user \"%V\": cached verification",
+                           &r->headers_in.user);
+            return NGX_OK;
+        }
+    }
+
+    rc = ngx_http_auth_basic_crypt_handler(r, &user->passwd, realm);
+
+    if (rc == NGX_OK && alcf->verified_valid) {
+        ngx_memcpy(user->md5, md5, 16);
+        user->verified = ngx_time();
+    }
+
+    return rc;
+}
+
+
+static ngx_http_auth_basic_file_t *
+ngx_http_auth_basic_file(ngx_http_request_t *r,
+    ngx_http_auth_basic_loc_conf_t *alcf, ngx_str_t *name, ngx_int_t *rc)
+{
+    time_t                       now;
+    uint32_t                     hash;
+    ngx_err_t                    err;
+    ngx_uint_t                   i, level;
+    ngx_file_info_t              fi;
+    ngx_http_auth_basic_file_t  *file;
+
+    if (ngx_http_auth_basic_files.root == NULL) {
+        ngx_rbtree_init(&ngx_http_auth_basic_files,
+                        &ngx_http_auth_basic_files_sentinel,
+                        ngx_str_rbtree_insert_value);
+
+        for (i = 0; i < sizeof(ngx_http_auth_basic_key); i++) {
+            ngx_http_auth_basic_key[i] = (u_char) ngx_random();
+        }
+    }
+
+    now = ngx_time();
+    hash = ngx_crc32_long(name->data, name->len);
+
+    file = (ngx_http_auth_basic_file_t *)
+               ngx_str_rbtree_lookup(&ngx_http_auth_basic_files, name, hash);
+
+    if (file && file->pool && now - file->checked < alcf->cache_valid) {
+        return file;
+    }
+
+    /* revalidate the file as the open file cache does */
+
+    if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+
+        if (err == NGX_ENOENT) {
+            level = NGX_LOG_ERR;
+            *rc = NGX_HTTP_FORBIDDEN;
+
+        } else {
+            level = NGX_LOG_CRIT;
+            *rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_log_error(level, r->connection->log, err,
+                      ngx_file_info_n " \"%s\" failed", name->data);
+
+        return NULL;
+    }
+
+    if (file
+        && file->pool
+        && file->mtime == ngx_file_mtime(&fi)
+        && file->size == ngx_file_size(&fi)
+        && file->uniq == ngx_file_uniq(&fi))
+    {
+        file->checked = now;
+        return file;
+    }
+
+    if (file == NULL) {
+        file = ngx_alloc(sizeof(ngx_http_auth_basic_file_t) + name->len + 1,
+                         ngx_cycle->log);
+        if (file == NULL) {
+            *rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+            return NULL;
+        }
+
+        file->sn.node.key = hash;
+        file->sn.str.len = name->len;
+        file->sn.str.data = (u_char *) file
+                            + sizeof(ngx_http_auth_basic_file_t);
+        ngx_memcpy(file->sn.str.data, name->data, name->len + 1);
+
+        file->pool = NULL;
+
+        ngx_rbtree_insert(&ngx_http_auth_basic_files, &file->sn.node);
+    }
+
+    if (ngx_http_auth_basic_read(r, file) != NGX_OK) {
+        *rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        return NULL;
+    }
+
+    file->checked = now;
+
+    return file;
+}
+
+
+static ngx_int_t
+ngx_http_auth_basic_read(ngx_http_request_t *r,
+    ngx_http_auth_basic_file_t *file)
+{
+    off_t                        size;
+    u_char                      *buf, *p, *last, *eol, *colon, *end;
+    size_t                       len;
+    ssize_t                      n;
+    ngx_fd_t                     fd;
+    ngx_str_t                    login;
+    ngx_file_t                   f;
+    ngx_pool_t                  *pool;
+    ngx_file_info_t              fi;
+    ngx_http_auth_basic_user_t  *user;
+
+    if (file->pool) {
+        ngx_destroy_pool(file->pool);
+        file->pool = NULL;
+    }
+
+    fd = ngx_open_file(file->sn.str.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file->sn.str.data);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&f, sizeof(ngx_file_t));
+
+    f.fd = fd;
+    f.name = file->sn.str;
+    f.log = r->connection->log;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file->sn.str.data);
+        ngx_http_auth_basic_close(&f);
+        return NGX_ERROR;
+    }
+
+    size = ngx_file_size(&fi);
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        ngx_http_auth_basic_close(&f);
+        return NGX_ERROR;
+    }
+
+    buf = ngx_pnalloc(pool, (size_t) size + 1);
+    if (buf == NULL) {
+        goto failed;
+    }
+
+    for (len = 0; len < (size_t) size; len += n) {
+        n = ngx_read_file(&f, buf + len, (size_t) size - len, len);
+
+        if (n == NGX_ERROR) {
+            goto failed;
+        }
+
+        if (n == 0) {
+            break;
+        }
+    }
+
+    ngx_http_auth_basic_close(&f);
+
+    buf[len] = '\0';
+
+    ngx_rbtree_init(&file->users, &file->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    /*
+     * the same format as the handler parses: "login:password[:comment]",
+     * comments and lines without a colon are skipped, the first
+     * occurrence of a login is used
+     */
+
+    last = buf + len;
+
+    for (p = buf; p < last; p = eol + 1) {
+
+        eol = ngx_strlchr(p, last, LF);
+        if (eol == NULL) {
+            eol = last;
+        }
+
+        if (*p == '#' || *p == CR) {
+            continue;
+        }
+
+        colon = ngx_strlchr(p, eol, ':');
+        if (colon == NULL) {
+            continue;
+        }
+
+        login.len = colon - p;
+        login.data = p;
+
+        for (end = colon + 1; end < eol; end++) {
+            if (*end == CR || *end == ':') {
+                break;
+            }
+        }
+
+        *end = '\0';
+
+        if (ngx_str_rbtree_lookup(&file->users, &login,
+                                  ngx_crc32_short(login.data, login.len))
+            != NULL)
+        {
+            continue;
+        }
+
+        user = ngx_palloc(pool, sizeof(ngx_http_auth_basic_user_t));
+        if (user == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_ERROR;
+        }
+
+        user->sn.node.key = ngx_crc32_short(login.data, login.len);
+        user->sn.str = login;
+        user->passwd.len = end - (colon + 1);
+        user->passwd.data = colon + 1;
+        user->verified = 0;
+
+        ngx_rbtree_insert(&file->users, &user->sn.node);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "auth basic user file \"%s\" read, size: %O",
+                   file->sn.str.data, size);
+
+    file->pool = pool;
+    file->mtime = ngx_file_mtime(&fi);
+    file->size = size;
+    file->uniq = ngx_file_uniq(&fi);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_http_auth_basic_close(&f);
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+
 static ngx_int_t
 ngx_http_auth_basic_set_realm(ngx_http_request_t *r, ngx_str_t *realm)
 {
@@ -358,6 +732,10 @@ ngx_http_auth_basic_create_loc_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    conf->cache = NGX_CONF_UNSET;
+    conf->cache_valid = NGX_CONF_UNSET;
+    conf->verified_valid = NGX_CONF_UNSET;
+
     return conf;
 }
 
@@ -376,10 +754,23 @@ ngx_http_auth_basic_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         conf->user_file = prev->user_file;
     }
 
+    ngx_conf_merge_value(conf->cache, prev->cache, 0);
+    ngx_conf_merge_sec_value(conf->cache_valid, prev->cache_valid, 60);
+    ngx_conf_merge_sec_value(conf->verified_valid, prev->verified_valid, 0);
+
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_http_auth_basic_preconfiguration(ngx_conf_t *cf)
+{
+    ngx_http_share_loc_conf(cf, &ngx_http_auth_basic_module);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_auth_basic_init(ngx_conf_t *cf)
 {
@@ -8,18 +8,79 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 
 typedef struct {
-    ngx_str_t                 uri;
-    ngx_array_t              *vars;
+    u_char                         color;
+    u_char                         nvalues;
+    u_short                        status;
+    ngx_queue_t                    queue;
+    ngx_msec_t                     expire;
+    u_char                         key[16];
+
+    /* the lengths of the values and WWW-Authenticate, then the data */
+    u_short                        len[1];
+} ngx_http_auth_request_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                   rbtree;
+    ngx_rbtree_node_t              sentinel;
+    ngx_queue_t                    queue;
+} ngx_http_auth_request_cache_sh_t;
+
+
+typedef struct {
+    ngx_http_auth_request_cache_sh_t  *sh;
+    ngx_slab_pool_t                   *shpool;
+
+    /* subrequests in progress in this worker */
+    ngx_rbtree_t                       locks;
+    ngx_rbtree_node_t                  sentinel;
+} ngx_http_auth_request_cache_t;
+
+
+typedef struct {
+    ngx_str_node_t                 sn;
+    u_char                         key[16];
+    ngx_queue_t                    waiters;
+    ngx_http_auth_request_cache_t *cache;
+} ngx_http_auth_request_lock_t;
+
+
+typedef struct {
+    ngx_str_t                      uri;
+    ngx_array_t                   *vars;
+
+    ngx_shm_zone_t                *cache_zone;
+    ngx_http_complex_value_t      *cache_key;
+    ngx_msec_t                     cache_valid;
+    ngx_msec_t                     cache_invalid;
+
+    /* the uri and the auth_request_set variables hashed into keys */
+    ngx_md5_t                      cache_md5;
 } ngx_http_auth_request_conf_t;
 
 
 typedef struct {
-    ngx_uint_t                done;
-    ngx_uint_t                status;
-    ngx_http_request_t       *subrequest;
+    ngx_uint_t                     done;
+    ngx_uint_t                     status;
+    ngx_http_request_t            *subrequest;
+
+    /* a result from the cache or from a coalesced subrequest */
+    ngx_str_t                     *values;
+    ngx_uint_t                     nvalues;
+    ngx_str_t                      www_authenticate;
+
+    ngx_http_request_t            *request;
+    ngx_http_auth_request_lock_t  *lock;
+    ngx_queue_t                    queue;
+    uint32_t                       hash;
+    u_char                         key[16];
+
+    unsigned                       cache:1;
+    unsigned                       waiting:1;
 } ngx_http_auth_request_ctx_t;
 
 
@@ -31,8 +92,31 @@ typedef struct {
 
 
 static ngx_int_t ngx_http_auth_request_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_auth_request_result(ngx_http_request_t *r,
+    ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx);
 static ngx_int_t ngx_http_auth_request_done(ngx_http_request_t *r,
     void *data, ngx_int_t rc);
+static ngx_int_t ngx_http_auth_request_cache_lookup(ngx_http_request_t *r,
+    ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx);
+static ngx_int_t ngx_http_auth_request_cache_publish(ngx_http_request_t *r,
+    ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx);
+static void ngx_http_auth_request_cache_store(ngx_http_request_t *r,
+    ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx);
+static void ngx_http_auth_request_cache_wake(
+    ngx_http_auth_request_lock_t *lock, ngx_http_auth_request_ctx_t *result);
+static void ngx_http_auth_request_cache_cleanup(void *data);
+static ngx_rbtree_node_t *ngx_http_auth_request_cache_find(
+    ngx_http_auth_request_cache_t *cache, u_char *key, uint32_t hash);
+static void ngx_http_auth_request_cache_delete(
+    ngx_http_auth_request_cache_t *cache,
+    ngx_http_auth_request_cache_node_t *cn);
+static void ngx_http_auth_request_cache_expire(
+    ngx_http_auth_request_cache_t *cache, ngx_uint_t n);
+static void ngx_http_auth_request_cache_rbtree_insert_value(
+    ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_auth_request_cache_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
 static ngx_int_t ngx_http_auth_request_set_variables(ngx_http_request_t *r,
     ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx);
 static ngx_int_t ngx_http_auth_request_variable(ngx_http_request_t *r,
@@ -45,6 +129,8 @@ static char *ngx_http_auth_request(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_auth_request_set(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_auth_request_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_command_t  ngx_http_auth_request_commands[] = {
@@ -63,6 +149,13 @@ static ngx_command_t  ngx_http_auth_request_commands[] = {
       0,
       NULL },
 
+    { ngx_string("auth_request_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_auth_request_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -101,7 +194,7 @@ ngx_module_t  ngx_http_auth_request_module = {
 static ngx_int_t
 ngx_http_auth_request_handler(ngx_http_request_t *r)
 {
-    ngx_table_elt_t               *h, *ho;
+    ngx_int_t                      rc;
     ngx_http_request_t            *sr;
     ngx_http_post_subrequest_t    *ps;
     ngx_http_auth_request_ctx_t   *ctx;
@@ -119,63 +212,37 @@ ngx_http_auth_request_handler(ngx_http_request_t *r)
     ctx = ngx_http_get_module_ctx(r, ngx_http_auth_request_module);
 
     if (ctx != NULL) {
-        if (!ctx->done) {
-            return NGX_AGAIN;
+        if (ctx->done) {
+            return ngx_http_auth_request_result(r, arcf, ctx);
         }
 
-        /*
-         * as soon as we are done - explicitly set variables to make
-         * sure they will be available after internal redirects
-         */
-
-        if (ngx_http_auth_request_set_variables(r, arcf, ctx) != NGX_OK) {
-            return NGX_ERROR;
+        if (ctx->subrequest || ctx->waiting) {
+            return NGX_AGAIN;
         }
 
-        /* return appropriate status */
+        /* a coalesced subrequest was aborted, try again */
 
-        if (ctx->status == NGX_HTTP_FORBIDDEN) {
-            return ctx->status;
+    } else {
+        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_auth_request_ctx_t));
+        if (ctx == NULL) {
+            return NGX_ERROR;
         }
 
-        if (ctx->status == NGX_HTTP_UNAUTHORIZED) {
-            sr = ctx->subrequest;
-
-            h = sr->headers_out.www_authenticate;
-
-            if (!h && sr->upstream) {
-                h = sr->upstream->headers_in.www_authenticate;
-            }
+        ctx->request = r;
 
-            if (h) {
-                ho = ngx_list_push(&r->headers_out.headers);
-                if (ho == NULL) {
-                    return NGX_ERROR;
-                }
-
-                *ho = *h;
+        ngx_http_set_ctx(r, ctx, ngx_http_auth_request_module);
+    }
 
-                r->headers_out.www_authenticate = ho;
-            }
+    if (arcf->cache_zone) {
+        rc = ngx_http_auth_request_cache_lookup(r, arcf, ctx);
 
-            return ctx->status;
+        if (rc == NGX_OK) {
+            return ngx_http_auth_request_result(r, arcf, ctx);
         }
 
-        if (ctx->status >= NGX_HTTP_OK
-            && ctx->status < NGX_HTTP_SPECIAL_RESPONSE)
-        {
-            return NGX_OK;
+        if (rc != NGX_DECLINED) {
+            return rc;
         }
-
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                      "auth request unexpected status: %ui", ctx->status);
-
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
-
-    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_auth_request_ctx_t));
-    if (ctx == NULL) {
-        return NGX_ERROR;
     }
 
     ps = ngx_palloc(r->pool, sizeof(ngx_http_post_subrequest_t));
@@ -207,12 +274,88 @@ ngx_http_auth_request_handler(ngx_http_request_t *r)
 
     ctx->subrequest = sr;
 
-    ngx_http_set_ctx(r, ctx, ngx_http_auth_request_module);
-
     return NGX_AGAIN;
 }
 
 
+static ngx_int_t
+ngx_http_auth_request_result(ngx_http_request_t *r,
+    ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx)
+{
+    ngx_table_elt_t     *h, *ho;
+    ngx_http_request_t  *sr;
+
+    if (ctx->cache) {
+        if (ngx_http_auth_request_cache_publish(r, arcf, ctx) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    /*
+     * as soon as we are done - explicitly set variables to make
+     * sure they will be available after internal redirects
+     */
+
+    if (ngx_http_auth_request_set_variables(r, arcf, ctx) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* return appropriate status */
+
+    if (ctx->status == NGX_HTTP_FORBIDDEN) {
+        return ctx->status;
+    }
+
+    if (ctx->status == NGX_HTTP_UNAUTHORIZED) {
+        sr = ctx->subrequest;
+
+        if (sr) {
+            h = sr->headers_out.www_authenticate;
+
+            if (!h && sr->upstream) {
+                h = sr->upstream->headers_in.www_authenticate;
+            }
+
+            if (h) {
+                ho = ngx_list_push(&r->headers_out.headers);
+                if (ho == NULL) {
+                    return NGX_ERROR;
+                }
+
+                *ho = *h;
+
+                r->headers_out.www_authenticate = ho;
+            }
+
+        } else if (ctx->www_authenticate.len) {
+            ho = ngx_list_push(&r->headers_out.headers);
+            if (ho == NULL) {
+                return NGX_ERROR;
+            }
+
+            ho->hash = 1;
+            ngx_str_set(&ho->key, "WWW-Authenticate");
+            ho->value = ctx->www_authenticate;
+
+            r->headers_out.www_authenticate = ho;
+        }
+
+        return ctx->status;
+    }
+
+    if (ctx->status >= NGX_HTTP_OK
+        && ctx->status < NGX_HTTP_SPECIAL_RESPONSE)
+    {
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "auth request unexpected status: %ui", ctx->status);
+
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+}
+
+
 static ngx_int_t
 ngx_http_auth_request_done(ngx_http_request_t *r, void *data, ngx_int_t rc)
 {
@@ -232,7 +375,7 @@ static ngx_int_t
 ngx_http_auth_request_set_variables(ngx_http_request_t *r,
     ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx)
 {
-    ngx_str_t                          val;
+    ngx_str_t                          val, *value;
     ngx_http_variable_t               *v;
     ngx_http_variable_value_t         *vv;
     ngx_http_auth_request_variable_t  *av, *last;
@@ -251,6 +394,8 @@ ngx_http_auth_request_set_variables(ngx_http_request_t *r,
     av = arcf->vars->elts;
     last = av + arcf->vars->nelts;
 
+    value = ctx->values;
+
     while (av < last) {
         /*
          * explicitly set new value to make sure it will be available after
@@ -259,8 +404,11 @@ ngx_http_auth_request_set_variables(ngx_http_request_t *r,
 
         vv = &r->variables[av->index];
 
-        if (ngx_http_complex_value(ctx->subrequest, &av->value, &val)
-            != NGX_OK)
+        if (value) {
+            val = *value++;
+
+        } else if (ngx_http_complex_value(ctx->subrequest, &av->value, &val)
+                   != NGX_OK)
         {
             return NGX_ERROR;
         }
@@ -299,6 +447,606 @@ ngx_http_auth_request_variable(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_auth_request_cache_lookup(ngx_http_request_t *r,
+    ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx)
+{
+    u_char                              *p;
+    size_t                               size;
+    ngx_str_t                            key;
+    ngx_md5_t                            md5;
+    ngx_uint_t                           i, n;
+    ngx_str_node_t                      *sn;
+    ngx_rbtree_node_t                   *node;
+    ngx_pool_cleanup_t                  *cln;
+    ngx_http_auth_request_lock_t        *lock;
+    ngx_http_auth_request_cache_t       *cache;
+    ngx_http_auth_request_cache_node_t  *cn;
+
+    cache = arcf->cache_zone->data;
+
+    if (!ctx->cache) {
+        if (ngx_http_complex_value(r, arcf->cache_key, &key) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (key.len == 0) {
+            return NGX_DECLINED;
+        }
+
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_auth_request_cache_cleanup;
+        cln->data = ctx;
+
+        md5 = arcf->cache_md5;
+        ngx_md5_update(&md5, key.data, key.len);
+        ngx_md5_final(ctx->key, &md5);
+
+        ctx->hash = ngx_crc32_short(ctx->key, 16);
+        ctx->cache = 1;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = ngx_http_auth_request_cache_find(cache, ctx->key, ctx->hash);
+
+    if (node) {
+        cn = (ngx_http_auth_request_cache_node_t *) &node->color;
+
+        if ((ngx_msec_int_t) (cn->expire - ngx_current_msec) <= 0) {
+            ngx_http_auth_request_cache_delete(cache, cn);
+            node = NULL;
+        }
+    }
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "auth request cache: %08XD miss", ctx->hash);
+
+        goto miss;
+    }
+
+    n = cn->nvalues;
+    size = 0;
+
+    for (i = 0; i <= n; i++) {
+        size += cn->len[i];
+    }
+
+    p = ngx_pnalloc(r->pool, size);
+    if (p == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    if (n) {
+        ctx->values = ngx_palloc(r->pool, n * sizeof(ngx_str_t));
+        if (ctx->values == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_memcpy(p, &cn->len[n + 1], size);
+
+    for (i = 0; i < n; i++) {
+        ctx->values[i].len = cn->len[i];
+        ctx->values[i].data = p;
+        p += cn->len[i];
+    }
+
+    ctx->www_authenticate.len = cn->len[n];
+    ctx->www_authenticate.data = p;
+
+    ctx->nvalues = n;
+    ctx->status = cn->status;
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "auth request cache: %08XD hit, status:%ui",
+                   ctx->hash, ctx->status);
+
+    ctx->done = 1;
+    ctx->cache = 0;
+
+    return NGX_OK;
+
+miss:
+
+    /*
+     * concurrent main requests with the same key wait for the subrequest
+     * of the first one; subrequests are not suspended
+     */
+
+    if (r != r->main) {
+        return NGX_DECLINED;
+    }
+
+    key.len = 16;
+    key.data = ctx->key;
+
+    sn = ngx_str_rbtree_lookup(&cache->locks, &key, ctx->hash);
+
+    if (sn) {
+        lock = (ngx_http_auth_request_lock_t *) sn;
+
+        ngx_queue_insert_tail(&lock->waiters, &ctx->queue);
+        ctx->waiting = 1;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "auth request cache: %08XD wait", ctx->hash);
+
+        return NGX_AGAIN;
+    }
+
+    lock = ngx_palloc(r->pool, sizeof(ngx_http_auth_request_lock_t));
+    if (lock == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(lock->key, ctx->key, 16);
+
+    lock->sn.node.key = ctx->hash;
+    lock->sn.str.len = 16;
+    lock->sn.str.data = lock->key;
+    lock->cache = cache;
+
+    ngx_queue_init(&lock->waiters);
+
+    ngx_rbtree_insert(&cache->locks, &lock->sn.node);
+
+    ctx->lock = lock;
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_auth_request_cache_publish(ngx_http_request_t *r,
+    ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx)
+{
+    ngx_uint_t                         i;
+    ngx_table_elt_t                   *h;
+    ngx_http_request_t                *sr;
+    ngx_http_auth_request_variable_t  *av;
+
+    sr = ctx->subrequest;
+
+    ctx->nvalues = arcf->vars ? arcf->vars->nelts : 0;
+
+    if (ctx->nvalues) {
+        ctx->values = ngx_palloc(r->pool, ctx->nvalues * sizeof(ngx_str_t));
+        if (ctx->values == NULL) {
+            return NGX_ERROR;
+        }
+
+        av = arcf->vars->elts;
+
+        for (i = 0; i < ctx->nvalues; i++) {
+            if (ngx_http_complex_value(sr, &av[i].value, &ctx->values[i])
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    if (ctx->status == NGX_HTTP_UNAUTHORIZED) {
+        h = sr->headers_out.www_authenticate;
+
+        if (!h && sr->upstream) {
+            h = sr->upstream->headers_in.www_authenticate;
+        }
+
+        if (h) {
+            ctx->www_authenticate = h->value;
+        }
+    }
+
+    ngx_http_auth_request_cache_store(r, arcf, ctx);
+
+    if (ctx->lock) {
+        ngx_http_auth_request_cache_wake(ctx->lock, ctx);
+        ctx->lock = NULL;
+    }
+
+    ctx->cache = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_auth_request_cache_store(ngx_http_request_t *r,
+    ngx_http_auth_request_conf_t *arcf, ngx_http_auth_request_ctx_t *ctx)
+{
+    u_char                              *p;
+    size_t                               size;
+    ngx_uint_t                           i, n;
+    ngx_msec_t                           valid;
+    ngx_rbtree_node_t                   *node;
+    ngx_http_auth_request_cache_t       *cache;
+    ngx_http_auth_request_cache_node_t  *cn;
+
+    if (ctx->status >= NGX_HTTP_OK
+        && ctx->status < NGX_HTTP_SPECIAL_RESPONSE)
+    {
+        valid = arcf->cache_valid;
+
+    } else if (ctx->status == NGX_HTTP_UNAUTHORIZED
+               || ctx->status == NGX_HTTP_FORBIDDEN)
+    {
+        valid = arcf->cache_invalid;
+
+    } else {
+        return;
+    }
+
+    n = ctx->nvalues;
+
+    if (valid == 0 || n > 0xff || ctx->www_authenticate.len > 0xffff) {
+        return;
+    }
+
+    size = ctx->www_authenticate.len;
+
+    for (i = 0; i < n; i++) {
+        if (ctx->values[i].len > 0xffff) {
+            return;
+        }
+
+        size += ctx->values[i].len;
+    }
+
+    size += offsetof(ngx_rbtree_node_t, color)
+            + offsetof(ngx_http_auth_request_cache_node_t, len)
+            + (n + 1) * sizeof(u_short);
+
+    cache = arcf->cache_zone->data;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = ngx_http_auth_request_cache_find(cache, ctx->key, ctx->hash);
+
+    if (node) {
+        /* stored by another worker */
+        cn = (ngx_http_auth_request_cache_node_t *) &node->color;
+        ngx_http_auth_request_cache_delete(cache, cn);
+    }
+
+    ngx_http_auth_request_cache_expire(cache, 1);
+
+    node = ngx_slab_alloc_locked(cache->shpool, size);
+
+    if (node == NULL) {
+        ngx_http_auth_request_cache_expire(cache, 0);
+
+        node = ngx_slab_alloc_locked(cache->shpool, size);
+        if (node == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "auth request cache: %08XD not stored",
+                           ctx->hash);
+            return;
+        }
+    }
+
+    cn = (ngx_http_auth_request_cache_node_t *) &node->color;
+
+    node->key = ctx->hash;
+    cn->nvalues = (u_char) n;
+    cn->status = (u_short) ctx->status;
+    cn->expire = ngx_current_msec + valid;
+
+    ngx_memcpy(cn->key, ctx->key, 16);
+
+    p = (u_char *) &cn->len[n + 1];
+
+    for (i = 0; i < n; i++) {
+        cn->len[i] = (u_short) ctx->values[i].len;
+        p = ngx_cpymem(p, ctx->values[i].data, ctx->values[i].len);
+    }
+
+    cn->len[n] = (u_short) ctx->www_authenticate.len;
+    ngx_memcpy(p, ctx->www_authenticate.data, ctx->www_authenticate.len);
+
+    ngx_rbtree_insert(&cache->sh->rbtree, node);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "auth request cache: %08XD stored, status:%ui",
+                   ctx->hash, ctx->status);
+}
+
+
+static void
+ngx_http_auth_request_cache_wake(ngx_http_auth_request_lock_t *lock,
+    ngx_http_auth_request_ctx_t *result)
+{
+    u_char                       *p;
+    size_t                        size;
+    ngx_uint_t                    i, n;
+    ngx_queue_t                  *q;
+    ngx_http_request_t           *r;
+    ngx_http_auth_request_ctx_t  *ctx;
+
+    ngx_rbtree_delete(&lock->cache->locks, &lock->sn.node);
+
+    /* without a result the waiting requests start over */
+
+    while (!ngx_queue_empty(&lock->waiters)) {
+
+        q = ngx_queue_head(&lock->waiters);
+        ngx_queue_remove(q);
+
+        ctx = ngx_queue_data(q, ngx_http_auth_request_ctx_t, queue);
+        r = ctx->request;
+
+        ctx->waiting = 0;
+
+        ngx_post_event(r->connection->write, &ngx_posted_events);
+
+        if (result == NULL) {
+            continue;
+        }
+
+        n = result->nvalues;
+        size = result->www_authenticate.len;
+
+        for (i = 0; i < n; i++) {
+            size += result->values[i].len;
+        }
+
+        p = ngx_pnalloc(r->pool, size);
+        if (p == NULL) {
+            continue;
+        }
+
+        if (n) {
+            ctx->values = ngx_palloc(r->pool, n * sizeof(ngx_str_t));
+            if (ctx->values == NULL) {
+                continue;
+            }
+        }
+
+        for (i = 0; i < n; i++) {
+            ctx->values[i].len = result->values[i].len;
+            ctx->values[i].data = p;
+            p = ngx_cpymem(p, result->values[i].data, result->values[i].len);
+        }
+
+        ctx->www_authenticate.len = result->www_authenticate.len;
+        ctx->www_authenticate.data = p;
+        ngx_memcpy(p, result->www_authenticate.data,
+                   result->www_authenticate.len);
+
+        ctx->nvalues = n;
+        ctx->status = result->status;
+        ctx->done = 1;
+        ctx->cache = 0;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "auth request cache: %08XD coalesced, status:%ui",
+                       ctx->hash, ctx->status);
+    }
+}
+
+
+static void
+ngx_http_auth_request_cache_cleanup(void *data)
+{
+    ngx_http_auth_request_ctx_t  *ctx = data;
+
+    if (ctx->waiting) {
+        ngx_queue_remove(&ctx->queue);
+        ctx->waiting = 0;
+    }
+
+    if (ctx->lock) {
+        ngx_http_auth_request_cache_wake(ctx->lock, NULL);
+        ctx->lock = NULL;
+    }
+}
+
+
+static void
+ngx_http_auth_request_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t                   **p;
+    ngx_http_auth_request_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_http_auth_request_cache_node_t *) &node->color;
+            cnt = (ngx_http_auth_request_cache_node_t *) &temp->color;
+
+            p = (ngx_memcmp(cn->key, cnt->key, 16) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_rbtree_node_t *
+ngx_http_auth_request_cache_find(ngx_http_auth_request_cache_t *cache,
+    u_char *key, uint32_t hash)
+{
+    ngx_int_t                            rc;
+    ngx_rbtree_node_t                   *node, *sentinel;
+    ngx_http_auth_request_cache_node_t  *cn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        cn = (ngx_http_auth_request_cache_node_t *) &node->color;
+
+        rc = ngx_memcmp(key, cn->key, 16);
+
+        if (rc == 0) {
+            return node;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_auth_request_cache_delete(ngx_http_auth_request_cache_t *cache,
+    ngx_http_auth_request_cache_node_t *cn)
+{
+    ngx_rbtree_node_t  *node;
+
+    node = (ngx_rbtree_node_t *)
+               ((u_char *) cn - offsetof(ngx_rbtree_node_t, color));
+
+    ngx_queue_remove(&cn->queue);
+    ngx_rbtree_delete(&cache->sh->rbtree, node);
+    ngx_slab_free_locked(cache->shpool, node);
+}
+
+
+static void
+ngx_http_auth_request_cache_expire(ngx_http_auth_request_cache_t *cache,
+    ngx_uint_t n)
+{
+    ngx_queue_t                         *q;
+    ngx_http_auth_request_cache_node_t  *cn;
+
+    /*
+     * n == 1 deletes one or two expired entries at most,
+     * n == 0 deletes the least recently used entry and then one or two
+     * expired ones
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        cn = ngx_queue_data(q, ngx_http_auth_request_cache_node_t, queue);
+
+        if (n++ != 0
+            && (ngx_msec_int_t) (cn->expire - ngx_current_msec) > 0)
+        {
+            return;
+        }
+
+        ngx_http_auth_request_cache_delete(cache, cn);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_auth_request_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_auth_request_cache_t  *ocache = data;
+
+    size_t                          len;
+    ngx_http_auth_request_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_auth_request_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_auth_request_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in auth_request_cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in auth_request_cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* a full zone evicts entries */
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_auth_request_create_conf(ngx_conf_t *cf)
 {
@@ -313,9 +1061,13 @@ ngx_http_auth_request_create_conf(ngx_conf_t *cf)
      * set by ngx_pcalloc():
      *
      *     conf->uri = { 0, NULL };
+     *     conf->cache_key = NULL;
+     *     conf->cache_valid = 0;
+     *     conf->cache_invalid = 0;
      */
 
     conf->vars = NGX_CONF_UNSET_PTR;
+    conf->cache_zone = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -327,9 +1079,53 @@ ngx_http_auth_request_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_auth_request_conf_t *prev = parent;
     ngx_http_auth_request_conf_t *conf = child;
 
+    ngx_uint_t                         i;
+    ngx_http_variable_t               *v;
+    ngx_http_core_main_conf_t         *cmcf;
+    ngx_http_auth_request_variable_t  *av;
+
     ngx_conf_merge_str_value(conf->uri, prev->uri, "");
     ngx_conf_merge_ptr_value(conf->vars, prev->vars, NULL);
 
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_zone = prev->cache_zone;
+        conf->cache_key = prev->cache_key;
+        conf->cache_valid = prev->cache_valid;
+        conf->cache_invalid = prev->cache_invalid;
+    }
+
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_zone = NULL;
+    }
+
+    if (conf->cache_zone == NULL || conf->uri.len == 0) {
+        return NGX_CONF_OK;
+    }
+
+    /*
+     * cached results are only shared between locations with the same
+     * subrequest uri and the same auth_request_set variables
+     */
+
+    ngx_md5_init(&conf->cache_md5);
+    ngx_md5_update(&conf->cache_md5, conf->uri.data, conf->uri.len + 1);
+
+    if (conf->vars) {
+        cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+        v = cmcf->variables.elts;
+        av = conf->vars->elts;
+
+        for (i = 0; i < conf->vars->nelts; i++) {
+            ngx_md5_update(&conf->cache_md5, v[av[i].index].name.data,
+                           v[av[i].index].name.len);
+            ngx_md5_update(&conf->cache_md5, "", 1);
+            ngx_md5_update(&conf->cache_md5, av[i].value.value.data,
+                           av[i].value.value.len);
+            ngx_md5_update(&conf->cache_md5, "", 1);
+        }
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -442,3 +1238,179 @@ ngx_http_auth_request_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_http_auth_request_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_auth_request_conf_t *arcf = conf;
+
+    u_char                            *p;
+    ssize_t                            size;
+    ngx_str_t                         *value, name, s;
+    ngx_uint_t                         i;
+    ngx_msec_t                         valid, invalid;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_complex_value_t          *cv;
+    ngx_http_auth_request_cache_t     *cache;
+    ngx_http_compile_complex_value_t   ccv;
+
+    if (arcf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "takes no parameters with \"off\"";
+        }
+
+        arcf->cache_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    size = 0;
+    name.len = 0;
+    cv = NULL;
+    valid = 10000;
+    invalid = 10000;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "key=", 4) == 0) {
+
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
+
+            cv = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+            if (cv == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+            ccv.cf = cf;
+            ccv.value = &s;
+            ccv.complex_value = cv;
+
+            if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            valid = ngx_parse_time(&s, 0);
+
+            if (valid == (ngx_msec_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid valid value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "invalid=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            invalid = ngx_parse_time(&s, 0);
+
+            if (invalid == (ngx_msec_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid invalid value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (cv == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"key\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_auth_request_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data == NULL) {
+        cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_auth_request_cache_t));
+        if (cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_rbtree_init(&cache->locks, &cache->sentinel,
+                        ngx_str_rbtree_insert_value);
+
+        shm_zone->init = ngx_http_auth_request_cache_init_zone;
+        shm_zone->data = cache;
+    }
+
+    arcf->cache_zone = shm_zone;
+    arcf->cache_key = cv;
+    arcf->cache_valid = valid;
+    arcf->cache_invalid = invalid;
+
+    return NGX_CONF_OK;
+}
@@ -10,19 +10,6 @@
 #include <ngx_http.h>
 
 
-#if 0
-
-typedef struct {
-    ngx_buf_t     *buf;
-    size_t         size;
-    ngx_pool_t    *pool;
-    size_t         alloc_size;
-    ngx_chain_t  **last_out;
-} ngx_http_autoindex_ctx_t;
-
-#endif
-
-
 typedef struct {
     ngx_str_t      name;
     size_t         utf_len;
@@ -38,13 +25,75 @@ typedef struct {
 
 
 typedef struct {
-    ngx_flag_t     enable;
-    ngx_uint_t     format;
-    ngx_flag_t     localtime;
-    ngx_flag_t     exact_size;
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+    ngx_queue_t                     queue;
+
+    ngx_uint_t                      current;
+    ngx_uint_t                      max;
+    time_t                          valid;
+} ngx_http_autoindex_cache_t;
+
+
+/*
+ * a sorted directory listing; it is allocated from its own pool,
+ * and is shared by the cache and the requests sending it
+ */
+
+typedef struct {
+    ngx_str_node_t                  sn;
+    ngx_queue_t                     queue;
+
+    ngx_pool_t                     *pool;
+    ngx_array_t                     entries;
+
+    ngx_file_uniq_t                 uniq;
+    time_t                          mtime;
+    time_t                          created;
+
+    ngx_uint_t                      count;
+    unsigned                        removed:1;
+} ngx_http_autoindex_listing_t;
+
+
+typedef struct {
+    ngx_flag_t                      enable;
+    ngx_uint_t                      format;
+    ngx_flag_t                      localtime;
+    ngx_flag_t                      exact_size;
+    ngx_http_autoindex_cache_t     *cache;
 } ngx_http_autoindex_loc_conf_t;
 
 
+typedef struct ngx_http_autoindex_ctx_s  ngx_http_autoindex_ctx_t;
+
+typedef size_t (*ngx_http_autoindex_len_pt)(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry);
+typedef u_char *(*ngx_http_autoindex_write_pt)(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry, u_char *p);
+
+struct ngx_http_autoindex_ctx_s {
+    ngx_http_autoindex_entry_t     *entries;
+    ngx_uint_t                      nelts;
+    ngx_uint_t                      next;
+
+    ngx_http_autoindex_len_pt       len;
+    ngx_http_autoindex_write_pt     write;
+
+    ngx_buf_t                      *head;
+    ngx_buf_t                      *tail;
+
+    ngx_chain_t                    *free;
+    ngx_chain_t                    *busy;
+
+    ngx_http_autoindex_loc_conf_t  *alcf;
+    ngx_int_t                       gmtoff;
+
+    unsigned                        utf8:1;
+    unsigned                        done:1;
+};
+
+
 #define NGX_HTTP_AUTOINDEX_HTML         0
 #define NGX_HTTP_AUTOINDEX_JSON         1
 #define NGX_HTTP_AUTOINDEX_JSONP        2
@@ -54,25 +103,61 @@ typedef struct {
 
 #define NGX_HTTP_AUTOINDEX_NAME_LEN     50
 
+#define NGX_HTTP_AUTOINDEX_BUFFER_SIZE  32768
 
-static ngx_buf_t *ngx_http_autoindex_html(ngx_http_request_t *r,
+
+static ngx_int_t ngx_http_autoindex_read(ngx_http_request_t *r,
+    ngx_dir_t *dir, ngx_str_t *path, size_t allocated, ngx_pool_t *pool,
     ngx_array_t *entries);
-static ngx_buf_t *ngx_http_autoindex_json(ngx_http_request_t *r,
-    ngx_array_t *entries, ngx_str_t *callback);
+static ngx_http_autoindex_listing_t *ngx_http_autoindex_cache_lookup(
+    ngx_http_request_t *r, ngx_http_autoindex_cache_t *cache, ngx_str_t *path,
+    ngx_file_info_t *fi);
+static ngx_http_autoindex_listing_t *ngx_http_autoindex_cache_create(
+    ngx_http_request_t *r, ngx_str_t *path, ngx_file_info_t *fi);
+static void ngx_http_autoindex_cache_insert(ngx_http_autoindex_cache_t *cache,
+    ngx_http_autoindex_listing_t *listing);
+static void ngx_http_autoindex_cache_remove(ngx_http_autoindex_cache_t *cache,
+    ngx_http_autoindex_listing_t *listing);
+static void ngx_http_autoindex_listing_release(void *data);
+static void ngx_http_autoindex_cache_cleanup(void *data);
+
+static ngx_int_t ngx_http_autoindex_send(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static void ngx_http_autoindex_write_handler(ngx_http_request_t *r);
+
+static ngx_int_t ngx_http_autoindex_html(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static size_t ngx_http_autoindex_html_len(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry);
+static u_char *ngx_http_autoindex_html_entry(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry, u_char *p);
+static ngx_int_t ngx_http_autoindex_json(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx, ngx_str_t *callback);
+static size_t ngx_http_autoindex_json_len(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry);
+static u_char *ngx_http_autoindex_json_entry(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry, u_char *p);
 static ngx_int_t ngx_http_autoindex_jsonp_callback(ngx_http_request_t *r,
     ngx_str_t *callback);
-static ngx_buf_t *ngx_http_autoindex_xml(ngx_http_request_t *r,
-    ngx_array_t *entries);
+static ngx_int_t ngx_http_autoindex_xml(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static size_t ngx_http_autoindex_xml_len(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry);
+static u_char *ngx_http_autoindex_xml_entry(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry, u_char *p);
 
 static int ngx_libc_cdecl ngx_http_autoindex_cmp_entries(const void *one,
     const void *two);
 static ngx_int_t ngx_http_autoindex_error(ngx_http_request_t *r,
     ngx_dir_t *dir, ngx_str_t *name);
 
+static ngx_int_t ngx_http_autoindex_preconfiguration(ngx_conf_t *cf);
 static ngx_int_t ngx_http_autoindex_init(ngx_conf_t *cf);
 static void *ngx_http_autoindex_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_autoindex_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static char *ngx_http_autoindex_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_conf_enum_t  ngx_http_autoindex_format[] = {
@@ -114,12 +199,19 @@ static ngx_command_t  ngx_http_autoindex_commands[] = {
       offsetof(ngx_http_autoindex_loc_conf_t, exact_size),
       NULL },
 
+    { ngx_string("autoindex_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_autoindex_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_autoindex_loc_conf_t, cache),
+      NULL },
+
       ngx_null_command
 };
 
 
 static ngx_http_module_t  ngx_http_autoindex_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_autoindex_preconfiguration,   /* preconfiguration */
     ngx_http_autoindex_init,               /* postconfiguration */
 
     NULL,                                  /* create main configuration */
@@ -152,18 +244,19 @@ ngx_module_t  ngx_http_autoindex_module = {
 static ngx_int_t
 ngx_http_autoindex_handler(ngx_http_request_t *r)
 {
-    u_char                         *last, *filename;
-    size_t                          len, allocated, root;
+    u_char                         *last;
+    size_t                          allocated, root;
     ngx_err_t                       err;
-    ngx_buf_t                      *b;
     ngx_int_t                       rc;
     ngx_str_t                       path, callback;
     ngx_dir_t                       dir;
-    ngx_uint_t                      level, format;
-    ngx_pool_t                     *pool;
-    ngx_chain_t                     out;
-    ngx_array_t                     entries;
-    ngx_http_autoindex_entry_t     *entry;
+    ngx_uint_t                      level, format, cacheable, fresh;
+    ngx_array_t                     entries, *list;
+    ngx_file_info_t                 fi;
+    ngx_pool_cleanup_t             *cln;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_autoindex_ctx_t       *ctx;
+    ngx_http_autoindex_listing_t   *listing;
     ngx_http_autoindex_loc_conf_t  *alcf;
 
     if (r->uri.data[r->uri.len - 1] != '/') {
@@ -214,7 +307,24 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
         }
     }
 
-    if (ngx_open_dir(&path, &dir) == NGX_ERROR) {
+    listing = NULL;
+    cacheable = 0;
+
+    if (alcf->cache
+        && ngx_file_info(path.data, &fi) != NGX_FILE_ERROR
+        && ngx_is_dir(&fi))
+    {
+        listing = ngx_http_autoindex_cache_lookup(r, alcf->cache, &path, &fi);
+
+        /*
+         * the listing of a directory changed within the last second
+         * may not match its modification time, so it is not cached
+         */
+
+        cacheable = (ngx_file_mtime(&fi) < ngx_time() - 1);
+    }
+
+    if (listing == NULL && ngx_open_dir(&path, &dir) == NGX_ERROR) {
         err = ngx_errno;
 
         if (err == NGX_ENOENT
@@ -239,22 +349,6 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
         return rc;
     }
 
-#if (NGX_SUPPRESS_WARN)
-
-    /* MSVC thinks 'entries' may be used without having been initialized */
-    ngx_memzero(&entries, sizeof(ngx_array_t));
-
-#endif
-
-    /* TODO: pool should be temporary pool */
-    pool = r->pool;
-
-    if (ngx_array_init(&entries, pool, 40, sizeof(ngx_http_autoindex_entry_t))
-        != NGX_OK)
-    {
-        return ngx_http_autoindex_error(r, &dir, &path);
-    }
-
     r->headers_out.status = NGX_HTTP_OK;
 
     switch (format) {
@@ -283,61 +377,210 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
     rc = ngx_http_send_header(r);
 
     if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        if (listing == NULL && ngx_close_dir(&dir) == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                          ngx_close_dir_n " \"%V\" failed", &path);
+        }
+
+        return rc;
+    }
+
+    if (listing == NULL && cacheable) {
+        listing = ngx_http_autoindex_cache_create(r, &path, &fi);
+        if (listing == NULL) {
+            return ngx_http_autoindex_error(r, &dir, &path);
+        }
+
+        fresh = 1;
+
+    } else {
+        fresh = (listing == NULL);
+    }
+
+    if (listing) {
+
+        /*
+         * the listing is kept until the response is sent; a new listing
+         * is destroyed with the request if it is not read completely
+         */
+
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            if (fresh) {
+                ngx_destroy_pool(listing->pool);
+                return ngx_http_autoindex_error(r, &dir, &path);
+            }
+
+            return NGX_ERROR;
+        }
+
+        listing->count++;
+
+        cln->handler = ngx_http_autoindex_listing_release;
+        cln->data = listing;
+    }
+
+#if (NGX_SUPPRESS_WARN)
+
+    /* MSVC thinks 'entries' may be used without having been initialized */
+    ngx_memzero(&entries, sizeof(ngx_array_t));
+
+#endif
+
+    if (fresh) {
+        list = listing ? &listing->entries : &entries;
+
+        if (ngx_http_autoindex_read(r, &dir, &path, allocated,
+                                    listing ? listing->pool : r->pool, list)
+            != NGX_OK)
+        {
+            return ngx_http_autoindex_error(r, &dir, &path);
+        }
+
         if (ngx_close_dir(&dir) == NGX_ERROR) {
             ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
                           ngx_close_dir_n " \"%V\" failed", &path);
         }
 
+        if (list->nelts > 1) {
+            ngx_qsort(list->elts, (size_t) list->nelts,
+                      sizeof(ngx_http_autoindex_entry_t),
+                      ngx_http_autoindex_cmp_entries);
+        }
+
+        if (listing) {
+            ngx_http_autoindex_cache_insert(alcf->cache, listing);
+        }
+
+    } else {
+        list = &listing->entries;
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_autoindex_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_set_ctx(r, ctx, ngx_http_autoindex_module);
+
+    ctx->entries = list->elts;
+    ctx->nelts = list->nelts;
+    ctx->alcf = alcf;
+
+    switch (format) {
+
+    case NGX_HTTP_AUTOINDEX_JSON:
+        rc = ngx_http_autoindex_json(r, ctx, NULL);
+        break;
+
+    case NGX_HTTP_AUTOINDEX_JSONP:
+        rc = ngx_http_autoindex_json(r, ctx, &callback);
+        break;
+
+    case NGX_HTTP_AUTOINDEX_XML:
+        rc = ngx_http_autoindex_xml(r, ctx);
+        break;
+
+    default: /* NGX_HTTP_AUTOINDEX_HTML */
+        rc = ngx_http_autoindex_html(r, ctx);
+        break;
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_http_autoindex_send(r, ctx);
+
+    if (rc != NGX_AGAIN) {
         return rc;
     }
 
-    filename = path.data;
-    filename[path.len] = '/';
+    /* the rest of the listing is sent as the client reads it */
+
+    r->main->count++;
+
+    r->write_event_handler = ngx_http_autoindex_write_handler;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (!r->connection->write->delayed) {
+        ngx_add_timer(r->connection->write, clcf->send_timeout);
+    }
+
+    if (ngx_handle_write_event(r->connection->write, clcf->send_lowat)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_DONE;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_read(ngx_http_request_t *r, ngx_dir_t *dir,
+    ngx_str_t *path, size_t allocated, ngx_pool_t *pool, ngx_array_t *entries)
+{
+    u_char                      *last, *filename;
+    size_t                       len;
+    ngx_err_t                    err;
+    ngx_http_autoindex_entry_t  *entry;
+
+    if (ngx_array_init(entries, pool, 40, sizeof(ngx_http_autoindex_entry_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    filename = path->data;
+    filename[path->len] = '/';
+    last = filename + path->len + 1;
 
     for ( ;; ) {
         ngx_set_errno(0);
 
-        if (ngx_read_dir(&dir) == NGX_ERROR) {
+        if (ngx_read_dir(dir) == NGX_ERROR) {
             err = ngx_errno;
 
             if (err != NGX_ENOMOREFILES) {
                 ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
-                              ngx_read_dir_n " \"%V\" failed", &path);
-                return ngx_http_autoindex_error(r, &dir, &path);
+                              ngx_read_dir_n " \"%V\" failed", path);
+                return NGX_ERROR;
             }
 
             break;
         }
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http autoindex file: \"%s\"", ngx_de_name(&dir));
+                       "http autoindex file: \"%s\"", ngx_de_name(dir));
 
-        len = ngx_de_namelen(&dir);
+        len = ngx_de_namelen(dir);
 
-        if (ngx_de_name(&dir)[0] == '.') {
+        if (ngx_de_name(dir)[0] == '.') {
             continue;
         }
 
-        if (!dir.valid_info) {
+        if (!dir->valid_info) {
 
             /* 1 byte for '/' and 1 byte for terminating '\0' */
 
-            if (path.len + 1 + len + 1 > allocated) {
-                allocated = path.len + 1 + len + 1
+            if (path->len + 1 + len + 1 > allocated) {
+                allocated = path->len + 1 + len + 1
                                      + NGX_HTTP_AUTOINDEX_PREALLOCATE;
 
-                filename = ngx_pnalloc(pool, allocated);
+                filename = ngx_pnalloc(r->pool, allocated);
                 if (filename == NULL) {
-                    return ngx_http_autoindex_error(r, &dir, &path);
+                    return NGX_ERROR;
                 }
 
-                last = ngx_cpystrn(filename, path.data, path.len + 1);
+                last = ngx_cpystrn(filename, path->data, path->len + 1);
                 *last++ = '/';
             }
 
-            ngx_cpystrn(last, ngx_de_name(&dir), len + 1);
+            ngx_cpystrn(last, ngx_de_name(dir), len + 1);
 
-            if (ngx_de_info(filename, &dir) == NGX_FILE_ERROR) {
+            if (ngx_de_info(filename, dir) == NGX_FILE_ERROR) {
                 err = ngx_errno;
 
                 if (err != NGX_ENOENT && err != NGX_ELOOP) {
@@ -348,398 +591,667 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
                         continue;
                     }
 
-                    return ngx_http_autoindex_error(r, &dir, &path);
+                    return NGX_ERROR;
                 }
 
-                if (ngx_de_link_info(filename, &dir) == NGX_FILE_ERROR) {
+                if (ngx_de_link_info(filename, dir) == NGX_FILE_ERROR) {
                     ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
                                   ngx_de_link_info_n " \"%s\" failed",
                                   filename);
-                    return ngx_http_autoindex_error(r, &dir, &path);
+                    return NGX_ERROR;
                 }
             }
         }
 
-        entry = ngx_array_push(&entries);
+        entry = ngx_array_push(entries);
         if (entry == NULL) {
-            return ngx_http_autoindex_error(r, &dir, &path);
+            return NGX_ERROR;
         }
 
         entry->name.len = len;
 
         entry->name.data = ngx_pnalloc(pool, len + 1);
         if (entry->name.data == NULL) {
-            return ngx_http_autoindex_error(r, &dir, &path);
+            return NGX_ERROR;
         }
 
-        ngx_cpystrn(entry->name.data, ngx_de_name(&dir), len + 1);
+        ngx_cpystrn(entry->name.data, ngx_de_name(dir), len + 1);
 
-        entry->dir = ngx_de_is_dir(&dir);
-        entry->file = ngx_de_is_file(&dir);
-        entry->mtime = ngx_de_mtime(&dir);
-        entry->size = ngx_de_size(&dir);
+        entry->dir = ngx_de_is_dir(dir);
+        entry->file = ngx_de_is_file(dir);
+        entry->mtime = ngx_de_mtime(dir);
+        entry->size = ngx_de_size(dir);
     }
 
-    if (ngx_close_dir(&dir) == NGX_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
-                      ngx_close_dir_n " \"%V\" failed", &path);
-    }
+    path->data[path->len] = '\0';
 
-    if (entries.nelts > 1) {
-        ngx_qsort(entries.elts, (size_t) entries.nelts,
-                  sizeof(ngx_http_autoindex_entry_t),
-                  ngx_http_autoindex_cmp_entries);
-    }
+    return NGX_OK;
+}
 
-    switch (format) {
 
-    case NGX_HTTP_AUTOINDEX_JSON:
-        b = ngx_http_autoindex_json(r, &entries, NULL);
-        break;
+static ngx_http_autoindex_listing_t *
+ngx_http_autoindex_cache_lookup(ngx_http_request_t *r,
+    ngx_http_autoindex_cache_t *cache, ngx_str_t *path, ngx_file_info_t *fi)
+{
+    uint32_t                       hash;
+    ngx_http_autoindex_listing_t  *listing;
 
-    case NGX_HTTP_AUTOINDEX_JSONP:
-        b = ngx_http_autoindex_json(r, &entries, &callback);
-        break;
+    hash = ngx_crc32_long(path->data, path->len);
 
-    case NGX_HTTP_AUTOINDEX_XML:
-        b = ngx_http_autoindex_xml(r, &entries);
-        break;
+    listing = (ngx_http_autoindex_listing_t *)
+                  ngx_str_rbtree_lookup(&cache->rbtree, path, hash);
 
-    default: /* NGX_HTTP_AUTOINDEX_HTML */
-        b = ngx_http_autoindex_html(r, &entries);
-        break;
+    if (listing) {
+
+        if (listing->uniq == ngx_file_uniq(fi)
+            && listing->mtime == ngx_file_mtime(fi)
+            && ngx_time() - listing->created < cache->valid)
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http autoindex cached: %ui",
+                           listing->entries.nelts);
+
+            ngx_queue_remove(&listing->queue);
+            ngx_queue_insert_head(&cache->queue, &listing->queue);
+
+            return listing;
+        }
+
+        ngx_http_autoindex_cache_remove(cache, listing);
     }
 
-    if (b == NULL) {
-        return NGX_ERROR;
+    return NULL;
+}
+
+
+static ngx_http_autoindex_listing_t *
+ngx_http_autoindex_cache_create(ngx_http_request_t *r, ngx_str_t *path,
+    ngx_file_info_t *fi)
+{
+    ngx_pool_t                    *pool;
+    ngx_http_autoindex_listing_t  *listing;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NULL;
     }
 
-    /* TODO: free temporary pool */
+    listing = ngx_pcalloc(pool, sizeof(ngx_http_autoindex_listing_t));
+    if (listing == NULL) {
+        ngx_destroy_pool(pool);
+        return NULL;
+    }
 
-    if (r == r->main) {
-        b->last_buf = 1;
+    listing->sn.str.len = path->len;
+    listing->sn.str.data = ngx_pstrdup(pool, path);
+    if (listing->sn.str.data == NULL) {
+        ngx_destroy_pool(pool);
+        return NULL;
     }
 
-    b->last_in_chain = 1;
+    listing->sn.node.key = ngx_crc32_long(path->data, path->len);
+
+    listing->pool = pool;
+    listing->uniq = ngx_file_uniq(fi);
+    listing->mtime = ngx_file_mtime(fi);
+    listing->created = ngx_time();
 
-    out.buf = b;
-    out.next = NULL;
+    /*
+     * the listing is not in the cache yet, it is inserted
+     * once read, or destroyed with the request otherwise
+     */
 
-    return ngx_http_output_filter(r, &out);
+    listing->removed = 1;
+
+    return listing;
 }
 
 
-static ngx_buf_t *
-ngx_http_autoindex_html(ngx_http_request_t *r, ngx_array_t *entries)
+static void
+ngx_http_autoindex_cache_insert(ngx_http_autoindex_cache_t *cache,
+    ngx_http_autoindex_listing_t *listing)
 {
-    u_char                         *last, scale;
-    off_t                           length;
-    size_t                          len, entry_len, char_len, escape_html;
-    ngx_tm_t                        tm;
-    ngx_buf_t                      *b;
-    ngx_int_t                       size;
-    ngx_uint_t                      i, utf8;
-    ngx_time_t                     *tp;
-    ngx_http_autoindex_entry_t     *entry;
-    ngx_http_autoindex_loc_conf_t  *alcf;
+    ngx_queue_t                   *q;
+    ngx_http_autoindex_listing_t  *old;
 
-    static u_char  title[] =
-        "<html>" CRLF
-        "<head><title>Index of "
-    ;
+    if (cache->current >= cache->max) {
+        q = ngx_queue_last(&cache->queue);
+        old = ngx_queue_data(q, ngx_http_autoindex_listing_t, queue);
 
-    static u_char  header[] =
-        "</title></head>" CRLF
-        "<body>" CRLF
-        "<h1>Index of "
-    ;
+        ngx_http_autoindex_cache_remove(cache, old);
+    }
 
-    static u_char  tail[] =
-        "</body>" CRLF
-        "</html>" CRLF
-    ;
+    ngx_rbtree_insert(&cache->rbtree, &listing->sn.node);
+    ngx_queue_insert_head(&cache->queue, &listing->queue);
 
-    static char  *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
-                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    cache->current++;
 
-    if (r->headers_out.charset.len == 5
-        && ngx_strncasecmp(r->headers_out.charset.data, (u_char *) "utf-8", 5)
-           == 0)
-    {
-        utf8 = 1;
+    listing->removed = 0;
+}
 
-    } else {
-        utf8 = 0;
-    }
 
-    escape_html = ngx_escape_html(NULL, r->uri.data, r->uri.len);
+static void
+ngx_http_autoindex_cache_remove(ngx_http_autoindex_cache_t *cache,
+    ngx_http_autoindex_listing_t *listing)
+{
+    ngx_rbtree_delete(&cache->rbtree, &listing->sn.node);
+    ngx_queue_remove(&listing->queue);
 
-    len = sizeof(title) - 1
-          + r->uri.len + escape_html
-          + sizeof(header) - 1
-          + r->uri.len + escape_html
-          + sizeof("</h1>") - 1
-          + sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1
-          + sizeof("</pre><hr>") - 1
-          + sizeof(tail) - 1;
-
-    entry = entries->elts;
-    for (i = 0; i < entries->nelts; i++) {
-        entry[i].escape = 2 * ngx_escape_uri(NULL, entry[i].name.data,
-                                             entry[i].name.len,
-                                             NGX_ESCAPE_URI_COMPONENT);
-
-        entry[i].escape_html = ngx_escape_html(NULL, entry[i].name.data,
-                                               entry[i].name.len);
-
-        if (utf8) {
-            entry[i].utf_len = ngx_utf8_length(entry[i].name.data,
-                                               entry[i].name.len);
-        } else {
-            entry[i].utf_len = entry[i].name.len;
-        }
+    cache->current--;
 
-        entry_len = sizeof("<a href=\"") - 1
-                  + entry[i].name.len + entry[i].escape
-                  + 1                                    /* 1 is for "/" */
-                  + sizeof("\">") - 1
-                  + entry[i].name.len - entry[i].utf_len
-                  + entry[i].escape_html
-                  + NGX_HTTP_AUTOINDEX_NAME_LEN + sizeof("&gt;") - 2
-                  + sizeof("</a>") - 1
-                  + sizeof(" 28-Sep-1970 12:00 ") - 1
-                  + 20                                   /* the file size */
-                  + 2;
-
-        if (len > NGX_MAX_SIZE_T_VALUE - entry_len) {
-            return NULL;
-        }
+    listing->removed = 1;
 
-        len += entry_len;
+    if (listing->count == 0) {
+        ngx_destroy_pool(listing->pool);
     }
+}
 
-    b = ngx_create_temp_buf(r->pool, len);
-    if (b == NULL) {
-        return NULL;
+
+static void
+ngx_http_autoindex_listing_release(void *data)
+{
+    ngx_http_autoindex_listing_t  *listing = data;
+
+    if (--listing->count == 0 && listing->removed) {
+        ngx_destroy_pool(listing->pool);
     }
+}
 
-    b->last = ngx_cpymem(b->last, title, sizeof(title) - 1);
 
-    if (escape_html) {
-        b->last = (u_char *) ngx_escape_html(b->last, r->uri.data, r->uri.len);
-        b->last = ngx_cpymem(b->last, header, sizeof(header) - 1);
-        b->last = (u_char *) ngx_escape_html(b->last, r->uri.data, r->uri.len);
+static void
+ngx_http_autoindex_cache_cleanup(void *data)
+{
+    ngx_http_autoindex_cache_t  *cache = data;
 
-    } else {
-        b->last = ngx_cpymem(b->last, r->uri.data, r->uri.len);
-        b->last = ngx_cpymem(b->last, header, sizeof(header) - 1);
-        b->last = ngx_cpymem(b->last, r->uri.data, r->uri.len);
+    ngx_queue_t                   *q;
+    ngx_http_autoindex_listing_t  *listing;
+
+    while (!ngx_queue_empty(&cache->queue)) {
+        q = ngx_queue_last(&cache->queue);
+        listing = ngx_queue_data(q, ngx_http_autoindex_listing_t, queue);
+
+        ngx_http_autoindex_cache_remove(cache, listing);
     }
+}
 
-    b->last = ngx_cpymem(b->last, "</h1>", sizeof("</h1>") - 1);
 
-    b->last = ngx_cpymem(b->last, "<hr><pre><a href=\"../\">../</a>" CRLF,
-                         sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1);
+static ngx_int_t
+ngx_http_autoindex_send(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx)
+{
+    size_t                       len, size;
+    ngx_buf_t                   *b;
+    ngx_int_t                    rc;
+    ngx_chain_t                 *cl, *out, **ll;
+    ngx_http_autoindex_entry_t   entry;
 
-    alcf = ngx_http_get_module_loc_conf(r, ngx_http_autoindex_module);
-    tp = ngx_timeofday();
+    /*
+     * the listing is formatted into buffers of a limited size, and the
+     * next buffers are only filled as the previous ones are sent, so
+     * the memory used does not depend on the size of the directory
+     */
 
-    for (i = 0; i < entries->nelts; i++) {
-        b->last = ngx_cpymem(b->last, "<a href=\"", sizeof("<a href=\"") - 1);
+    for ( ;; ) {
 
-        if (entry[i].escape) {
-            ngx_escape_uri(b->last, entry[i].name.data, entry[i].name.len,
-                           NGX_ESCAPE_URI_COMPONENT);
+        out = NULL;
+        ll = &out;
 
-            b->last += entry[i].name.len + entry[i].escape;
+        if (ctx->head) {
+            cl = ngx_alloc_chain_link(r->pool);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
 
-        } else {
-            b->last = ngx_cpymem(b->last, entry[i].name.data,
-                                 entry[i].name.len);
-        }
+            cl->buf = ctx->head;
+            *ll = cl;
+            ll = &cl->next;
 
-        if (entry[i].dir) {
-            *b->last++ = '/';
+            ctx->head = NULL;
         }
 
-        *b->last++ = '"';
-        *b->last++ = '>';
+        b = NULL;
 
-        len = entry[i].utf_len;
+        while (ctx->next < ctx->nelts) {
 
-        if (entry[i].name.len != len) {
-            if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
-                char_len = NGX_HTTP_AUTOINDEX_NAME_LEN - 3 + 1;
+            entry = ctx->entries[ctx->next];
 
-            } else {
-                char_len = NGX_HTTP_AUTOINDEX_NAME_LEN + 1;
-            }
+            len = ctx->len(ctx, &entry);
 
-            last = b->last;
-            b->last = ngx_utf8_cpystrn(b->last, entry[i].name.data,
-                                       char_len, entry[i].name.len + 1);
+            if (b == NULL) {
+                cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
 
-            if (entry[i].escape_html) {
-                b->last = (u_char *) ngx_escape_html(last, entry[i].name.data,
-                                                     b->last - last);
-            }
+                b = cl->buf;
 
-            last = b->last;
+                size = ngx_max(len, NGX_HTTP_AUTOINDEX_BUFFER_SIZE);
 
-        } else {
-            if (entry[i].escape_html) {
-                if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
-                    char_len = NGX_HTTP_AUTOINDEX_NAME_LEN - 3;
+                if (b->start == NULL || (size_t) (b->end - b->start) < size) {
+                    b->start = ngx_palloc(r->pool, size);
+                    if (b->start == NULL) {
+                        return NGX_ERROR;
+                    }
 
-                } else {
-                    char_len = len;
+                    b->end = b->start + size;
                 }
 
-                b->last = (u_char *) ngx_escape_html(b->last,
-                                                  entry[i].name.data, char_len);
-                last = b->last;
+                b->pos = b->start;
+                b->last = b->start;
+                b->temporary = 1;
+                b->tag = (ngx_buf_tag_t) &ngx_http_autoindex_module;
 
-            } else {
-                b->last = ngx_cpystrn(b->last, entry[i].name.data,
-                                      NGX_HTTP_AUTOINDEX_NAME_LEN + 1);
-                last = b->last - 3;
+                *ll = cl;
+                ll = &cl->next;
+            }
+
+            if (len > (size_t) (b->end - b->last)) {
+                break;
             }
+
+            b->last = ctx->write(ctx, &entry, b->last);
+
+            ctx->next++;
         }
 
-        if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
-            b->last = ngx_cpymem(last, "..&gt;</a>", sizeof("..&gt;</a>") - 1);
+        if (ctx->next == ctx->nelts) {
+            b = ctx->tail;
 
-        } else {
-            if (entry[i].dir && NGX_HTTP_AUTOINDEX_NAME_LEN - len > 0) {
-                *b->last++ = '/';
-                len++;
+            if (r == r->main) {
+                b->last_buf = 1;
             }
 
-            b->last = ngx_cpymem(b->last, "</a>", sizeof("</a>") - 1);
+            b->last_in_chain = 1;
 
-            if (NGX_HTTP_AUTOINDEX_NAME_LEN - len > 0) {
-                ngx_memset(b->last, ' ', NGX_HTTP_AUTOINDEX_NAME_LEN - len);
-                b->last += NGX_HTTP_AUTOINDEX_NAME_LEN - len;
+            cl = ngx_alloc_chain_link(r->pool);
+            if (cl == NULL) {
+                return NGX_ERROR;
             }
+
+            cl->buf = b;
+            *ll = cl;
+            ll = &cl->next;
+
+            ctx->done = 1;
         }
 
-        *b->last++ = ' ';
+        *ll = NULL;
 
-        ngx_gmtime(entry[i].mtime + tp->gmtoff * 60 * alcf->localtime, &tm);
+        rc = ngx_http_output_filter(r, out);
 
-        b->last = ngx_sprintf(b->last, "%02d-%s-%d %02d:%02d ",
-                              tm.ngx_tm_mday,
-                              months[tm.ngx_tm_mon - 1],
-                              tm.ngx_tm_year,
-                              tm.ngx_tm_hour,
-                              tm.ngx_tm_min);
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &out,
+                                (ngx_buf_tag_t) &ngx_http_autoindex_module);
 
-        if (alcf->exact_size) {
-            if (entry[i].dir) {
-                b->last = ngx_cpymem(b->last,  "                  -",
-                                     sizeof("                  -") - 1);
-            } else {
-                b->last = ngx_sprintf(b->last, "%19O", entry[i].size);
-            }
+        if (rc == NGX_ERROR || ctx->done) {
+            return rc;
+        }
 
-        } else {
-            if (entry[i].dir) {
-                b->last = ngx_cpymem(b->last,  "      -",
-                                     sizeof("      -") - 1);
+        if (rc == NGX_AGAIN) {
+            return NGX_AGAIN;
+        }
+    }
+}
 
-            } else {
-                length = entry[i].size;
-
-                if (length > 1024 * 1024 * 1024 - 1) {
-                    size = (ngx_int_t) (length / (1024 * 1024 * 1024));
-                    if ((length % (1024 * 1024 * 1024))
-                                                > (1024 * 1024 * 1024 / 2 - 1))
-                    {
-                        size++;
-                    }
-                    scale = 'G';
 
-                } else if (length > 1024 * 1024 - 1) {
-                    size = (ngx_int_t) (length / (1024 * 1024));
-                    if ((length % (1024 * 1024)) > (1024 * 1024 / 2 - 1)) {
-                        size++;
-                    }
-                    scale = 'M';
+static void
+ngx_http_autoindex_write_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_event_t               *wev;
+    ngx_connection_t          *c;
+    ngx_http_autoindex_ctx_t  *ctx;
+    ngx_http_core_loc_conf_t  *clcf;
 
-                } else if (length > 9999) {
-                    size = (ngx_int_t) (length / 1024);
-                    if (length % 1024 > 511) {
-                        size++;
-                    }
-                    scale = 'K';
+    c = r->connection;
+    wev = c->write;
 
-                } else {
-                    size = (ngx_int_t) length;
-                    scale = '\0';
-                }
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http autoindex write handler");
 
-                if (scale) {
-                    b->last = ngx_sprintf(b->last, "%6i%c", size, scale);
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-                } else {
-                    b->last = ngx_sprintf(b->last, " %6i", size);
-                }
-            }
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        c->timedout = 1;
+
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    if (wev->delayed || r->aio) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http autoindex write delayed");
+
+        if (!wev->delayed) {
+            ngx_add_timer(wev, clcf->send_timeout);
+        }
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
         }
 
-        *b->last++ = CR;
-        *b->last++ = LF;
+        return;
     }
 
-    b->last = ngx_cpymem(b->last, "</pre><hr>", sizeof("</pre><hr>") - 1);
+    ctx = ngx_http_get_module_ctx(r, ngx_http_autoindex_module);
 
-    b->last = ngx_cpymem(b->last, tail, sizeof(tail) - 1);
+    rc = ngx_http_autoindex_send(r, ctx);
 
-    return b;
+    if (rc == NGX_AGAIN) {
+        if (!wev->delayed) {
+            ngx_add_timer(wev, clcf->send_timeout);
+        }
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
+
+        return;
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    ngx_http_finalize_request(r, rc);
 }
 
 
-static ngx_buf_t *
-ngx_http_autoindex_json(ngx_http_request_t *r, ngx_array_t *entries,
-    ngx_str_t *callback)
+static ngx_int_t
+ngx_http_autoindex_html(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx)
 {
-    size_t                       len, entry_len;
-    ngx_buf_t                   *b;
-    ngx_uint_t                   i;
-    ngx_http_autoindex_entry_t  *entry;
+    size_t       len, escape_html;
+    ngx_buf_t   *b;
+    ngx_time_t  *tp;
 
-    len = sizeof("[" CRLF CRLF "]") - 1;
+    static u_char  title[] =
+        "<html>" CRLF
+        "<head><title>Index of "
+    ;
 
-    if (callback) {
-        len += sizeof("/* callback */" CRLF "();") - 1 + callback->len;
+    static u_char  header[] =
+        "</title></head>" CRLF
+        "<body>" CRLF
+        "<h1>Index of "
+    ;
+
+    static u_char  tail[] =
+        "</pre><hr>"
+        "</body>" CRLF
+        "</html>" CRLF
+    ;
+
+    if (r->headers_out.charset.len == 5
+        && ngx_strncasecmp(r->headers_out.charset.data, (u_char *) "utf-8", 5)
+           == 0)
+    {
+        ctx->utf8 = 1;
     }
 
-    entry = entries->elts;
+    tp = ngx_timeofday();
+    ctx->gmtoff = tp->gmtoff;
+
+    ctx->len = ngx_http_autoindex_html_len;
+    ctx->write = ngx_http_autoindex_html_entry;
 
-    for (i = 0; i < entries->nelts; i++) {
-        entry[i].escape = ngx_escape_json(NULL, entry[i].name.data,
-                                          entry[i].name.len);
+    escape_html = ngx_escape_html(NULL, r->uri.data, r->uri.len);
 
-        entry_len = sizeof("{  }," CRLF) - 1
-                  + sizeof("\"name\":\"\"") - 1
-                  + entry[i].name.len + entry[i].escape
-                  + sizeof(", \"type\":\"directory\"") - 1
-                  + sizeof(", \"mtime\":\"Wed, 31 Dec 1986 10:00:00 GMT\"") - 1;
+    len = sizeof(title) - 1
+          + r->uri.len + escape_html
+          + sizeof(header) - 1
+          + r->uri.len + escape_html
+          + sizeof("</h1>") - 1
+          + sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1;
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->last, title, sizeof(title) - 1);
+
+    if (escape_html) {
+        b->last = (u_char *) ngx_escape_html(b->last, r->uri.data, r->uri.len);
+        b->last = ngx_cpymem(b->last, header, sizeof(header) - 1);
+        b->last = (u_char *) ngx_escape_html(b->last, r->uri.data, r->uri.len);
 
-        if (entry[i].file) {
-            entry_len += sizeof(", \"size\":") - 1 + NGX_OFF_T_LEN;
+    } else {
+        b->last = ngx_cpymem(b->last, r->uri.data, r->uri.len);
+        b->last = ngx_cpymem(b->last, header, sizeof(header) - 1);
+        b->last = ngx_cpymem(b->last, r->uri.data, r->uri.len);
+    }
+
+    b->last = ngx_cpymem(b->last, "</h1>", sizeof("</h1>") - 1);
+
+    b->last = ngx_cpymem(b->last, "<hr><pre><a href=\"../\">../</a>" CRLF,
+                         sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1);
+
+    ctx->head = b;
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = tail;
+    b->last = tail + sizeof(tail) - 1;
+    b->memory = 1;
+
+    ctx->tail = b;
+
+    return NGX_OK;
+}
+
+
+static size_t
+ngx_http_autoindex_html_len(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry)
+{
+    entry->escape = 2 * ngx_escape_uri(NULL, entry->name.data,
+                                       entry->name.len,
+                                       NGX_ESCAPE_URI_COMPONENT);
+
+    entry->escape_html = ngx_escape_html(NULL, entry->name.data,
+                                         entry->name.len);
+
+    if (ctx->utf8) {
+        entry->utf_len = ngx_utf8_length(entry->name.data, entry->name.len);
+
+    } else {
+        entry->utf_len = entry->name.len;
+    }
+
+    return sizeof("<a href=\"") - 1
+           + entry->name.len + entry->escape
+           + 1                                          /* 1 is for "/" */
+           + sizeof("\">") - 1
+           + entry->name.len - entry->utf_len
+           + entry->escape_html
+           + NGX_HTTP_AUTOINDEX_NAME_LEN + sizeof("&gt;") - 2
+           + sizeof("</a>") - 1
+           + sizeof(" 28-Sep-1970 12:00 ") - 1
+           + 20                                         /* the file size */
+           + 2;
+}
+
+
+static u_char *
+ngx_http_autoindex_html_entry(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry, u_char *p)
+{
+    u_char      *last, scale;
+    off_t        length;
+    size_t       len, char_len;
+    ngx_tm_t     tm;
+    ngx_int_t    size;
+
+    static char  *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+    p = ngx_cpymem(p, "<a href=\"", sizeof("<a href=\"") - 1);
+
+    if (entry->escape) {
+        ngx_escape_uri(p, entry->name.data, entry->name.len,
+                       NGX_ESCAPE_URI_COMPONENT);
+
+        p += entry->name.len + entry->escape;
+
+    } else {
+        p = ngx_cpymem(p, entry->name.data, entry->name.len);
+    }
+
+    if (entry->dir) {
+        *p++ = '/';
+    }
+
+    *p++ = '"';
+    *p++ = '>';
+
+    len = entry->utf_len;
+
+    if (entry->name.len != len) {
+        if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
+            char_len = NGX_HTTP_AUTOINDEX_NAME_LEN - 3 + 1;
+
+        } else {
+            char_len = NGX_HTTP_AUTOINDEX_NAME_LEN + 1;
+        }
+
+        last = p;
+        p = ngx_utf8_cpystrn(p, entry->name.data, char_len,
+                             entry->name.len + 1);
+
+        if (entry->escape_html) {
+            p = (u_char *) ngx_escape_html(last, entry->name.data, p - last);
+        }
+
+        last = p;
+
+    } else {
+        if (entry->escape_html) {
+            if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
+                char_len = NGX_HTTP_AUTOINDEX_NAME_LEN - 3;
+
+            } else {
+                char_len = len;
+            }
+
+            p = (u_char *) ngx_escape_html(p, entry->name.data, char_len);
+            last = p;
+
+        } else {
+            p = ngx_cpystrn(p, entry->name.data,
+                            NGX_HTTP_AUTOINDEX_NAME_LEN + 1);
+            last = p - 3;
         }
+    }
+
+    if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
+        p = ngx_cpymem(last, "..&gt;</a>", sizeof("..&gt;</a>") - 1);
 
-        if (len > NGX_MAX_SIZE_T_VALUE - entry_len) {
-            return NULL;
+    } else {
+        if (entry->dir && NGX_HTTP_AUTOINDEX_NAME_LEN - len > 0) {
+            *p++ = '/';
+            len++;
         }
 
-        len += entry_len;
+        p = ngx_cpymem(p, "</a>", sizeof("</a>") - 1);
+
+        if (NGX_HTTP_AUTOINDEX_NAME_LEN - len > 0) {
+            ngx_memset(p, ' ', NGX_HTTP_AUTOINDEX_NAME_LEN - len);
+            p += NGX_HTTP_AUTOINDEX_NAME_LEN - len;
+        }
+    }
+
+    *p++ = ' ';
+
+    ngx_gmtime(entry->mtime + ctx->gmtoff * 60 * ctx->alcf->localtime, &tm);
+
+    p = ngx_sprintf(p, "%02d-%s-%d %02d:%02d ",
+                    tm.ngx_tm_mday,
+                    months[tm.ngx_tm_mon - 1],
+                    tm.ngx_tm_year,
+                    tm.ngx_tm_hour,
+                    tm.ngx_tm_min);
+
+    if (ctx->alcf->exact_size) {
+        if (entry->dir) {
+            p = ngx_cpymem(p,  "                  -",
+                           sizeof("                  -") - 1);
+        } else {
+            p = ngx_sprintf(p, "%19O", entry->size);
+        }
+
+    } else {
+        if (entry->dir) {
+            p = ngx_cpymem(p,  "      -", sizeof("      -") - 1);
+
+        } else {
+            length = entry->size;
+
+            if (length > 1024 * 1024 * 1024 - 1) {
+                size = (ngx_int_t) (length / (1024 * 1024 * 1024));
+                if ((length % (1024 * 1024 * 1024))
+                                            > (1024 * 1024 * 1024 / 2 - 1))
+                {
+                    size++;
+                }
+                scale = 'G';
+
+            } else if (length > 1024 * 1024 - 1) {
+                size = (ngx_int_t) (length / (1024 * 1024));
+                if ((length % (1024 * 1024)) > (1024 * 1024 / 2 - 1)) {
+                    size++;
+                }
+                scale = 'M';
+
+            } else if (length > 9999) {
+                size = (ngx_int_t) (length / 1024);
+                if (length % 1024 > 511) {
+                    size++;
+                }
+                scale = 'K';
+
+            } else {
+                size = (ngx_int_t) length;
+                scale = '\0';
+            }
+
+            if (scale) {
+                p = ngx_sprintf(p, "%6i%c", size, scale);
+
+            } else {
+                p = ngx_sprintf(p, " %6i", size);
+            }
+        }
+    }
+
+    *p++ = CR;
+    *p++ = LF;
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_json(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx,
+    ngx_str_t *callback)
+{
+    size_t      len;
+    ngx_buf_t  *b;
+
+    ctx->len = ngx_http_autoindex_json_len;
+    ctx->write = ngx_http_autoindex_json_entry;
+
+    len = sizeof("[") - 1;
+
+    if (callback) {
+        len += sizeof("/* callback */" CRLF "(") - 1 + callback->len;
     }
 
     b = ngx_create_temp_buf(r->pool, len);
     if (b == NULL) {
-        return NULL;
+        return NGX_ERROR;
     }
 
     if (callback) {
@@ -753,59 +1265,96 @@ ngx_http_autoindex_json(ngx_http_request_t *r, ngx_array_t *entries,
 
     *b->last++ = '[';
 
-    for (i = 0; i < entries->nelts; i++) {
-        b->last = ngx_cpymem(b->last, CRLF "{ \"name\":\"",
-                             sizeof(CRLF "{ \"name\":\"") - 1);
+    ctx->head = b;
 
-        if (entry[i].escape) {
-            b->last = (u_char *) ngx_escape_json(b->last, entry[i].name.data,
-                                                 entry[i].name.len);
-        } else {
-            b->last = ngx_cpymem(b->last, entry[i].name.data,
-                                 entry[i].name.len);
-        }
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
 
-        b->last = ngx_cpymem(b->last, "\", \"type\":\"",
-                             sizeof("\", \"type\":\"") - 1);
+    if (callback) {
+        b->pos = (u_char *) CRLF "]);";
+        b->last = b->pos + sizeof(CRLF "]);") - 1;
 
-        if (entry[i].dir) {
-            b->last = ngx_cpymem(b->last, "directory", sizeof("directory") - 1);
+    } else {
+        b->pos = (u_char *) CRLF "]";
+        b->last = b->pos + sizeof(CRLF "]") - 1;
+    }
 
-        } else if (entry[i].file) {
-            b->last = ngx_cpymem(b->last, "file", sizeof("file") - 1);
+    b->memory = 1;
 
-        } else {
-            b->last = ngx_cpymem(b->last, "other", sizeof("other") - 1);
-        }
+    ctx->tail = b;
 
-        b->last = ngx_cpymem(b->last, "\", \"mtime\":\"",
-                             sizeof("\", \"mtime\":\"") - 1);
+    return NGX_OK;
+}
 
-        b->last = ngx_http_time(b->last, entry[i].mtime);
 
-        if (entry[i].file) {
-            b->last = ngx_cpymem(b->last, "\", \"size\":",
-                                 sizeof("\", \"size\":") - 1);
-            b->last = ngx_sprintf(b->last, "%O", entry[i].size);
+static size_t
+ngx_http_autoindex_json_len(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry)
+{
+    size_t  len;
 
-        } else {
-            *b->last++ = '"';
-        }
+    entry->escape = ngx_escape_json(NULL, entry->name.data, entry->name.len);
 
-        b->last = ngx_cpymem(b->last, " },", sizeof(" },") - 1);
+    len = sizeof("," CRLF "{  }") - 1
+          + sizeof("\"name\":\"\"") - 1
+          + entry->name.len + entry->escape
+          + sizeof(", \"type\":\"directory\"") - 1
+          + sizeof(", \"mtime\":\"Wed, 31 Dec 1986 10:00:00 GMT\"") - 1;
+
+    if (entry->file) {
+        len += sizeof(", \"size\":") - 1 + NGX_OFF_T_LEN;
     }
 
-    if (i > 0) {
-        b->last--;  /* strip last comma */
+    return len;
+}
+
+
+static u_char *
+ngx_http_autoindex_json_entry(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry, u_char *p)
+{
+    if (ctx->next) {
+        *p++ = ',';
     }
 
-    b->last = ngx_cpymem(b->last, CRLF "]", sizeof(CRLF "]") - 1);
+    p = ngx_cpymem(p, CRLF "{ \"name\":\"", sizeof(CRLF "{ \"name\":\"") - 1);
 
-    if (callback) {
-        *b->last++ = ')'; *b->last++ = ';';
+    if (entry->escape) {
+        p = (u_char *) ngx_escape_json(p, entry->name.data, entry->name.len);
+
+    } else {
+        p = ngx_cpymem(p, entry->name.data, entry->name.len);
     }
 
-    return b;
+    p = ngx_cpymem(p, "\", \"type\":\"", sizeof("\", \"type\":\"") - 1);
+
+    if (entry->dir) {
+        p = ngx_cpymem(p, "directory", sizeof("directory") - 1);
+
+    } else if (entry->file) {
+        p = ngx_cpymem(p, "file", sizeof("file") - 1);
+
+    } else {
+        p = ngx_cpymem(p, "other", sizeof("other") - 1);
+    }
+
+    p = ngx_cpymem(p, "\", \"mtime\":\"", sizeof("\", \"mtime\":\"") - 1);
+
+    p = ngx_http_time(p, entry->mtime);
+
+    if (entry->file) {
+        p = ngx_cpymem(p, "\", \"size\":", sizeof("\", \"size\":") - 1);
+        p = ngx_sprintf(p, "%O", entry->size);
+
+    } else {
+        *p++ = '"';
+    }
+
+    p = ngx_cpymem(p, " }", sizeof(" }") - 1);
+
+    return p;
 }
 
 
@@ -850,101 +1399,116 @@ ngx_http_autoindex_jsonp_callback(ngx_http_request_t *r, ngx_str_t *callback)
 }
 
 
-static ngx_buf_t *
-ngx_http_autoindex_xml(ngx_http_request_t *r, ngx_array_t *entries)
+static ngx_int_t
+ngx_http_autoindex_xml(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx)
 {
-    size_t                          len, entry_len;
-    ngx_tm_t                        tm;
-    ngx_buf_t                      *b;
-    ngx_str_t                       type;
-    ngx_uint_t                      i;
-    ngx_http_autoindex_entry_t     *entry;
+    ngx_buf_t  *b;
 
     static u_char  head[] = "<?xml version=\"1.0\"?>" CRLF "<list>" CRLF;
     static u_char  tail[] = "</list>" CRLF;
 
-    len = sizeof(head) - 1 + sizeof(tail) - 1;
+    ctx->len = ngx_http_autoindex_xml_len;
+    ctx->write = ngx_http_autoindex_xml_entry;
 
-    entry = entries->elts;
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
 
-    for (i = 0; i < entries->nelts; i++) {
-        entry[i].escape = ngx_escape_html(NULL, entry[i].name.data,
-                                          entry[i].name.len);
+    b->pos = head;
+    b->last = head + sizeof(head) - 1;
+    b->memory = 1;
 
-        entry_len = sizeof("<directory></directory>" CRLF) - 1
-                  + entry[i].name.len + entry[i].escape
-                  + sizeof(" mtime=\"1986-12-31T10:00:00Z\"") - 1;
+    ctx->head = b;
 
-        if (entry[i].file) {
-            entry_len += sizeof(" size=\"\"") - 1 + NGX_OFF_T_LEN;
-        }
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
 
-        if (len > NGX_MAX_SIZE_T_VALUE - entry_len) {
-            return NULL;
-        }
+    b->pos = tail;
+    b->last = tail + sizeof(tail) - 1;
+    b->memory = 1;
 
-        len += entry_len;
-    }
+    ctx->tail = b;
 
-    b = ngx_create_temp_buf(r->pool, len);
-    if (b == NULL) {
-        return NULL;
-    }
+    return NGX_OK;
+}
 
-    b->last = ngx_cpymem(b->last, head, sizeof(head) - 1);
 
-    for (i = 0; i < entries->nelts; i++) {
-        *b->last++ = '<';
+static size_t
+ngx_http_autoindex_xml_len(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry)
+{
+    size_t  len;
 
-        if (entry[i].dir) {
-            ngx_str_set(&type, "directory");
+    entry->escape = ngx_escape_html(NULL, entry->name.data, entry->name.len);
 
-        } else if (entry[i].file) {
-            ngx_str_set(&type, "file");
+    len = sizeof("<directory></directory>" CRLF) - 1
+          + entry->name.len + entry->escape
+          + sizeof(" mtime=\"1986-12-31T10:00:00Z\"") - 1;
 
-        } else {
-            ngx_str_set(&type, "other");
-        }
+    if (entry->file) {
+        len += sizeof(" size=\"\"") - 1 + NGX_OFF_T_LEN;
+    }
 
-        b->last = ngx_cpymem(b->last, type.data, type.len);
+    return len;
+}
 
-        b->last = ngx_cpymem(b->last, " mtime=\"", sizeof(" mtime=\"") - 1);
 
-        ngx_gmtime(entry[i].mtime, &tm);
+static u_char *
+ngx_http_autoindex_xml_entry(ngx_http_autoindex_ctx_t *ctx,
+    ngx_http_autoindex_entry_t *entry, u_char *p)
+{
+    ngx_tm_t   tm;
+    ngx_str_t  type;
 
-        b->last = ngx_sprintf(b->last, "%4d-%02d-%02dT%02d:%02d:%02dZ",
-                              tm.ngx_tm_year, tm.ngx_tm_mon,
-                              tm.ngx_tm_mday, tm.ngx_tm_hour,
-                              tm.ngx_tm_min, tm.ngx_tm_sec);
+    *p++ = '<';
 
-        if (entry[i].file) {
-            b->last = ngx_cpymem(b->last, "\" size=\"",
-                                 sizeof("\" size=\"") - 1);
-            b->last = ngx_sprintf(b->last, "%O", entry[i].size);
-        }
+    if (entry->dir) {
+        ngx_str_set(&type, "directory");
 
-        *b->last++ = '"'; *b->last++ = '>';
+    } else if (entry->file) {
+        ngx_str_set(&type, "file");
 
-        if (entry[i].escape) {
-            b->last = (u_char *) ngx_escape_html(b->last, entry[i].name.data,
-                                                 entry[i].name.len);
-        } else {
-            b->last = ngx_cpymem(b->last, entry[i].name.data,
-                                 entry[i].name.len);
-        }
+    } else {
+        ngx_str_set(&type, "other");
+    }
+
+    p = ngx_cpymem(p, type.data, type.len);
 
-        *b->last++ = '<'; *b->last++ = '/';
+    p = ngx_cpymem(p, " mtime=\"", sizeof(" mtime=\"") - 1);
 
-        b->last = ngx_cpymem(b->last, type.data, type.len);
+    ngx_gmtime(entry->mtime, &tm);
 
-        *b->last++ = '>';
+    p = ngx_sprintf(p, "%4d-%02d-%02dT%02d:%02d:%02dZ",
+                    tm.ngx_tm_year, tm.ngx_tm_mon,
+                    tm.ngx_tm_mday, tm.ngx_tm_hour,
+                    tm.ngx_tm_min, tm.ngx_tm_sec);
 
-        *b->last++ = CR; *b->last++ = LF;
+    if (entry->file) {
+        p = ngx_cpymem(p, "\" size=\"", sizeof("\" size=\"") - 1);
+        p = ngx_sprintf(p, "%O", entry->size);
     }
 
-    b->last = ngx_cpymem(b->last, tail, sizeof(tail) - 1);
+    *p++ = '"'; *p++ = '>';
+
+    if (entry->escape) {
+        p = (u_char *) ngx_escape_html(p, entry->name.data, entry->name.len);
+
+    } else {
+        p = ngx_cpymem(p, entry->name.data, entry->name.len);
+    }
 
-    return b;
+    *p++ = '<'; *p++ = '/';
+
+    p = ngx_cpymem(p, type.data, type.len);
+
+    *p++ = '>';
+
+    *p++ = CR; *p++ = LF;
+
+    return p;
 }
 
 
@@ -968,44 +1532,6 @@ ngx_http_autoindex_cmp_entries(const void *one, const void *two)
 }
 
 
-#if 0
-
-static ngx_buf_t *
-ngx_http_autoindex_alloc(ngx_http_autoindex_ctx_t *ctx, size_t size)
-{
-    ngx_chain_t  *cl;
-
-    if (ctx->buf) {
-
-        if ((size_t) (ctx->buf->end - ctx->buf->last) >= size) {
-            return ctx->buf;
-        }
-
-        ctx->size += ctx->buf->last - ctx->buf->pos;
-    }
-
-    ctx->buf = ngx_create_temp_buf(ctx->pool, ctx->alloc_size);
-    if (ctx->buf == NULL) {
-        return NULL;
-    }
-
-    cl = ngx_alloc_chain_link(ctx->pool);
-    if (cl == NULL) {
-        return NULL;
-    }
-
-    cl->buf = ctx->buf;
-    cl->next = NULL;
-
-    *ctx->last_out = cl;
-    ctx->last_out = &cl->next;
-
-    return ctx->buf;
-}
-
-#endif
-
-
 static ngx_int_t
 ngx_http_autoindex_error(ngx_http_request_t *r, ngx_dir_t *dir, ngx_str_t *name)
 {
@@ -1032,6 +1558,7 @@ ngx_http_autoindex_create_loc_conf(ngx_conf_t *cf)
     conf->format = NGX_CONF_UNSET_UINT;
     conf->localtime = NGX_CONF_UNSET;
     conf->exact_size = NGX_CONF_UNSET;
+    conf->cache = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -1048,11 +1575,120 @@ ngx_http_autoindex_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
                               NGX_HTTP_AUTOINDEX_HTML);
     ngx_conf_merge_value(conf->localtime, prev->localtime, 0);
     ngx_conf_merge_value(conf->exact_size, prev->exact_size, 1);
+    ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
 
     return NGX_CONF_OK;
 }
 
 
+static char *
+ngx_http_autoindex_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_autoindex_loc_conf_t *alcf = conf;
+
+    time_t                       valid;
+    ngx_str_t                   *value, s;
+    ngx_int_t                    max;
+    ngx_uint_t                   i;
+    ngx_pool_cleanup_t          *cln;
+    ngx_http_autoindex_cache_t  *cache;
+
+    if (alcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "has invalid parameters";
+        }
+
+        alcf->cache = NULL;
+
+        return NGX_CONF_OK;
+    }
+
+    max = 0;
+    valid = 60;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            max = ngx_atoi(value[i].data + 4, value[i].len - 4);
+            if (max <= 0) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            valid = ngx_parse_time(&s, 1);
+            if (valid == (time_t) NGX_ERROR) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+    failed:
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid \"autoindex_cache\" parameter \"%V\"",
+                           &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (max == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                        "\"autoindex_cache\" must have the \"max\" parameter");
+        return NGX_CONF_ERROR;
+    }
+
+    cache = ngx_palloc(cf->pool, sizeof(ngx_http_autoindex_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->queue);
+
+    cache->current = 0;
+    cache->max = max;
+    cache->valid = valid;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_autoindex_cache_cleanup;
+    cln->data = cache;
+
+    alcf->cache = cache;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_preconfiguration(ngx_conf_t *cf)
+{
+    ngx_http_share_loc_conf(cf, &ngx_http_autoindex_module);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_autoindex_init(ngx_conf_t *cf)
 {
@@ -75,6 +75,7 @@ typedef struct {
     unsigned                    length:16;
     unsigned                    from_utf8:1;
     unsigned                    to_utf8:1;
+    unsigned                    ascii:1;
 } ngx_http_charset_ctx_t;
 
 
@@ -96,7 +97,10 @@ static ngx_inline void ngx_http_set_charset(ngx_http_request_t *r,
     ngx_str_t *charset);
 static ngx_int_t ngx_http_charset_ctx(ngx_http_request_t *r,
     ngx_http_charset_t *charsets, ngx_int_t charset, ngx_int_t source_charset);
-static ngx_uint_t ngx_http_charset_recode(ngx_buf_t *b, u_char *table);
+static ngx_uint_t ngx_http_charset_ascii(ngx_http_charset_ctx_t *ctx);
+static ngx_uint_t ngx_http_charset_recode(ngx_buf_t *b,
+    ngx_http_charset_ctx_t *ctx);
+static ngx_inline u_char *ngx_http_charset_skip_ascii(u_char *p, u_char *last);
 static ngx_chain_t *ngx_http_charset_recode_from_utf8(ngx_pool_t *pool,
     ngx_buf_t *buf, ngx_http_charset_ctx_t *ctx);
 static ngx_chain_t *ngx_http_charset_recode_to_utf8(ngx_pool_t *pool,
@@ -529,6 +533,7 @@ ngx_http_charset_ctx(ngx_http_request_t *r, ngx_http_charset_t *charsets,
     ctx->length = charsets[charset].length;
     ctx->from_utf8 = charsets[source_charset].utf8;
     ctx->to_utf8 = charsets[charset].utf8;
+    ctx->ascii = ngx_http_charset_ascii(ctx);
 
     r->filter_need_in_memory = 1;
 
@@ -641,7 +646,7 @@ ngx_http_charset_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     }
 
     for (cl = in; cl; cl = cl->next) {
-        (void) ngx_http_charset_recode(cl->buf, ctx->table);
+        (void) ngx_http_charset_recode(cl->buf, ctx);
     }
 
     return ngx_http_next_body_filter(r, in);
@@ -649,14 +654,56 @@ ngx_http_charset_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
 
 static ngx_uint_t
-ngx_http_charset_recode(ngx_buf_t *b, u_char *table)
+ngx_http_charset_ascii(ngx_http_charset_ctx_t *ctx)
 {
-    u_char  *p, *last;
+    u_char      *p;
+    ngx_uint_t   i;
+
+    /*
+     * ASCII characters are copied as is if the table does not redefine
+     * them; a UTF-8 source is always recoded so
+     */
+
+    if (ctx->from_utf8) {
+        return 1;
+    }
+
+    for (i = 0; i < 128; i++) {
+
+        if (ctx->to_utf8) {
+            p = &ctx->table[i * NGX_UTF_LEN];
+
+            if (p[0] != '\1' || p[1] != i) {
+                return 0;
+            }
 
+        } else if (ctx->table[i] != i) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+static ngx_uint_t
+ngx_http_charset_recode(ngx_buf_t *b, ngx_http_charset_ctx_t *ctx)
+{
+    u_char  *p, *last, *table;
+
+    table = ctx->table;
     last = b->last;
 
     for (p = b->pos; p < last; p++) {
 
+        if (ctx->ascii) {
+            p = ngx_http_charset_skip_ascii(p, last);
+
+            if (p == last) {
+                break;
+            }
+        }
+
         if (*p != table[*p]) {
             goto recode;
         }
@@ -667,6 +714,11 @@ ngx_http_charset_recode(ngx_buf_t *b, u_char *table)
 recode:
 
     do {
+        if (ctx->ascii && *p < 0x80) {
+            p = ngx_http_charset_skip_ascii(p, last);
+            continue;
+        }
+
         if (*p != table[*p]) {
             *p = table[*p];
         }
@@ -698,8 +750,10 @@ ngx_http_charset_recode_from_utf8(ngx_pool_t *pool, ngx_buf_t *buf,
 
         for ( /* void */ ; src < buf->last; src++) {
 
-            if (*src < 0x80) {
-                continue;
+            src = ngx_http_charset_skip_ascii(src, buf->last);
+
+            if (src == buf->last) {
+                break;
             }
 
             len = src - buf->pos;
@@ -896,7 +950,12 @@ recode:
         }
 
         if (*src < 0x80) {
-            *dst++ = *src++;
+            p = src + ngx_min(buf->last - src, b->end - dst);
+            p = ngx_http_charset_skip_ascii(src, p);
+
+            dst = ngx_cpymem(dst, src, p - src);
+            src = p;
+
             continue;
         }
 
@@ -974,6 +1033,15 @@ ngx_http_charset_recode_to_utf8(ngx_pool_t *pool, ngx_buf_t *buf,
     table = ctx->table;
 
     for (src = buf->pos; src < buf->last; src++) {
+
+        if (ctx->ascii) {
+            src = ngx_http_charset_skip_ascii(src, buf->last);
+
+            if (src == buf->last) {
+                break;
+            }
+        }
+
         if (table[*src * NGX_UTF_LEN] == '\1') {
             continue;
         }
@@ -1050,6 +1118,18 @@ recode:
 
     while (src < buf->last) {
 
+        if (ctx->ascii && *src < 0x80) {
+            p = src + ngx_min(buf->last - src, b->end - dst);
+            p = ngx_http_charset_skip_ascii(src, p);
+
+            if (p != src) {
+                dst = ngx_cpymem(dst, src, p - src);
+                src = p;
+
+                continue;
+            }
+        }
+
         p = &table[*src++ * NGX_UTF_LEN];
         len = *p++;
 
@@ -1089,6 +1169,49 @@ recode:
 }
 
 
+static ngx_inline u_char *
+ngx_http_charset_skip_ascii(u_char *p, u_char *last)
+{
+#if (NGX_HAVE_SSE2)
+
+    int      mask;
+    __m128i  v;
+
+    /* the sign bits of 16 bytes at a time */
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        mask = _mm_movemask_epi8(v);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+#elif (NGX_HAVE_NEON)
+
+    while (last - p >= 16) {
+
+        if (vmaxvq_u8(vld1q_u8(p)) >= 0x80) {
+            break;
+        }
+
+        p += 16;
+    }
+
+#endif
+
+    while (p < last && *p < 0x80) {
+        p++;
+    }
+
+    return p;
+}
+
+
 static ngx_chain_t *
 ngx_http_charset_get_buf(ngx_pool_t *pool, ngx_http_charset_ctx_t *ctx)
 {
@@ -1153,6 +1276,13 @@ ngx_http_charset_get_buffer(ngx_pool_t *pool, ngx_http_charset_ctx_t *ctx,
         return NULL;
     }
 
+    /*
+     * the sizes depend on the data, so they are rounded up
+     * for the buffers to be reused for the next input buffers
+     */
+
+    size = ngx_align(size, ngx_pagesize);
+
     cl->buf = ngx_create_temp_buf(pool, size);
     if (cl->buf == NULL) {
         return NULL;
@@ -13,6 +13,11 @@
 typedef struct {
     ngx_chain_t         *free;
     ngx_chain_t         *busy;
+
+    /* data held to be sent in one chunk */
+    ngx_chain_t         *out;
+    ngx_chain_t        **last;
+    off_t                size;
 } ngx_http_chunked_filter_ctx_t;
 
 
@@ -90,6 +95,8 @@ ngx_http_chunked_header_filter(ngx_http_request_t *r)
                 return NGX_ERROR;
             }
 
+            ctx->last = &ctx->out;
+
             ngx_http_set_ctx(r, ctx, ngx_http_chunked_filter_module);
 
         } else if (r->headers_out.content_length_n == -1) {
@@ -108,7 +115,9 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     off_t                           size;
     ngx_int_t                       rc;
     ngx_buf_t                      *b;
+    ngx_uint_t                      flush;
     ngx_chain_t                    *out, *cl, *tl, **ll;
+    ngx_http_core_loc_conf_t       *clcf;
     ngx_http_chunked_filter_ctx_t  *ctx;
 
     if (in == NULL || !r->chunked || r->header_only) {
@@ -117,10 +126,10 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_chunked_filter_module);
 
-    out = NULL;
-    ll = &out;
+    ll = ctx->last;
 
-    size = 0;
+    size = ctx->size;
+    flush = 0;
     cl = in;
 
     for ( ;; ) {
@@ -129,6 +138,10 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
         size += ngx_buf_size(cl->buf);
 
+        if (cl->buf->flush || cl->buf->recycled) {
+            flush = 1;
+        }
+
         if (cl->buf->flush
             || cl->buf->sync
             || ngx_buf_in_memory(cl->buf)
@@ -151,6 +164,34 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         cl = cl->next;
     }
 
+    /*
+     * small writes are sent in one chunk: the data are held while
+     * the write filter would hold them too, see "postpone_output"
+     */
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (!cl->buf->last_buf && !flush && size < (off_t) clcf->postpone_output)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http chunk held: %O", size);
+
+        ctx->last = ll;
+        ctx->size = size;
+
+        return NGX_OK;
+    }
+
+    out = ctx->out;
+
+    if (ll == &ctx->out) {
+        ll = &out;
+    }
+
+    ctx->out = NULL;
+    ctx->last = &ctx->out;
+    ctx->size = 0;
+
     if (size) {
         tl = ngx_chain_get_free_buf(r->pool, &ctx->free);
         if (tl == NULL) {
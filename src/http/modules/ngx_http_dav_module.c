@@ -23,6 +23,11 @@ typedef struct {
     ngx_uint_t  access;
     ngx_uint_t  min_delete_depth;
     ngx_flag_t  create_full_put_path;
+    ngx_flag_t  preallocate;
+    ngx_flag_t  fsync;
+#if (NGX_THREADS)
+    ngx_thread_pool_t  *thread_pool;
+#endif
 } ngx_http_dav_loc_conf_t;
 
 
@@ -32,9 +37,33 @@ typedef struct {
 } ngx_http_dav_copy_ctx_t;
 
 
+/*
+ * a rename or a copy of a file, preceded by flushing of an uploaded file,
+ * done either in place or by a thread
+ */
+
+typedef struct {
+    ngx_str_t                 from;
+    ngx_str_t                 to;
+
+    ngx_fd_t                  fd;
+    off_t                     drop;
+
+    ngx_copy_file_t           cf;
+    ngx_ext_rename_file_t     ext;
+
+    ngx_uint_t                status;
+    ngx_int_t                 rc;
+
+    unsigned                  copy:1;
+} ngx_http_dav_file_op_t;
+
+
 static ngx_int_t ngx_http_dav_handler(ngx_http_request_t *r);
 
 static void ngx_http_dav_put_handler(ngx_http_request_t *r);
+static void ngx_http_dav_put_finalize(ngx_http_request_t *r,
+    ngx_http_dav_file_op_t *op);
 
 static ngx_int_t ngx_http_dav_delete_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_dav_delete_path(ngx_http_request_t *r,
@@ -53,6 +82,15 @@ static ngx_int_t ngx_http_dav_copy_dir_time(ngx_tree_ctx_t *ctx,
 static ngx_int_t ngx_http_dav_copy_tree_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 
+static ngx_int_t ngx_http_dav_file_op_post(ngx_http_request_t *r,
+    ngx_http_dav_file_op_t *op);
+static void ngx_http_dav_file_op(ngx_http_dav_file_op_t *op, ngx_log_t *log);
+#if (NGX_THREADS)
+static void ngx_http_dav_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_dav_thread_event_handler(ngx_event_t *ev);
+static void ngx_http_dav_file_op_handler(ngx_http_request_t *r);
+#endif
+
 static ngx_int_t ngx_http_dav_depth(ngx_http_request_t *r, ngx_int_t dflt);
 static ngx_int_t ngx_http_dav_error(ngx_log_t *log, ngx_err_t err,
     ngx_int_t not_found, char *failed, u_char *path);
@@ -60,6 +98,8 @@ static ngx_int_t ngx_http_dav_location(ngx_http_request_t *r, u_char *path);
 static void *ngx_http_dav_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_dav_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static char *ngx_http_dav_threads(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_dav_init(ngx_conf_t *cf);
 
 
@@ -104,6 +144,27 @@ static ngx_command_t  ngx_http_dav_commands[] = {
       offsetof(ngx_http_dav_loc_conf_t, access),
       NULL },
 
+    { ngx_string("dav_preallocate"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_dav_loc_conf_t, preallocate),
+      NULL },
+
+    { ngx_string("dav_fsync"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_dav_loc_conf_t, fsync),
+      NULL },
+
+    { ngx_string("dav_threads"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_dav_threads,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -171,6 +232,7 @@ ngx_http_dav_handler(ngx_http_request_t *r)
         r->request_body_in_persistent_file = 1;
         r->request_body_in_clean_file = 1;
         r->request_body_file_group_access = 1;
+        r->request_body_file_preallocate = dlcf->preallocate;
         r->request_body_file_log_level = 0;
 
         rc = ngx_http_read_client_request_body(r, ngx_http_dav_put_handler);
@@ -205,13 +267,16 @@ ngx_http_dav_handler(ngx_http_request_t *r)
 static void
 ngx_http_dav_put_handler(ngx_http_request_t *r)
 {
-    size_t                    root;
-    time_t                    date;
-    ngx_str_t                *temp, path;
-    ngx_uint_t                status;
-    ngx_file_info_t           fi;
-    ngx_ext_rename_file_t     ext;
-    ngx_http_dav_loc_conf_t  *dlcf;
+    size_t                     root;
+    time_t                     date;
+    ngx_int_t                  rc;
+    ngx_str_t                 *temp, path;
+    ngx_uint_t                 status;
+    ngx_file_info_t            fi;
+    ngx_temp_file_t           *tf;
+    ngx_http_dav_file_op_t    *op;
+    ngx_http_dav_loc_conf_t   *dlcf;
+    ngx_http_core_loc_conf_t  *clcf;
 
     if (r->request_body == NULL) {
         ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
@@ -237,7 +302,8 @@ ngx_http_dav_put_handler(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http put filename: \"%s\"", path.data);
 
-    temp = &r->request_body->temp_file->file.name;
+    tf = r->request_body->temp_file;
+    temp = &tf->file.name;
 
     if (ngx_file_info(path.data, &fi) == NGX_FILE_ERROR) {
         status = NGX_HTTP_CREATED;
@@ -262,30 +328,76 @@ ngx_http_dav_put_handler(ngx_http_request_t *r)
 
     dlcf = ngx_http_get_module_loc_conf(r, ngx_http_dav_module);
 
-    ext.access = dlcf->access;
-    ext.path_access = dlcf->access;
-    ext.time = -1;
-    ext.create_path = dlcf->create_full_put_path;
-    ext.delete_file = 1;
-    ext.log = r->connection->log;
+    op = ngx_pcalloc(r->pool, sizeof(ngx_http_dav_file_op_t));
+    if (op == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    op->from = *temp;
+    op->to = path;
+    op->fd = NGX_INVALID_FILE;
+    op->status = status;
+
+    if (dlcf->fsync) {
+        op->fd = tf->file.fd;
+
+        /*
+         * written data cannot bypass the page cache, as request body
+         * buffers are not aligned for direct I/O, so the cache of a file
+         * large enough for directio is dropped once the file is flushed
+         */
+
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (clcf->directio != NGX_OPEN_FILE_DIRECTIO_OFF
+            && tf->offset >= clcf->directio)
+        {
+            op->drop = tf->offset;
+        }
+    }
+
+    op->ext.access = dlcf->access;
+    op->ext.path_access = dlcf->access;
+    op->ext.time = -1;
+    op->ext.create_path = dlcf->create_full_put_path;
+    op->ext.delete_file = 1;
 
     if (r->headers_in.date) {
         date = ngx_parse_http_time(r->headers_in.date->value.data,
                                    r->headers_in.date->value.len);
 
         if (date != NGX_ERROR) {
-            ext.time = date;
-            ext.fd = r->request_body->temp_file->file.fd;
+            op->ext.time = date;
+            op->ext.fd = tf->file.fd;
         }
     }
 
-    if (ngx_ext_rename_file(temp, &path, &ext) != NGX_OK) {
+    rc = ngx_http_dav_file_op_post(r, op);
+
+    if (rc == NGX_AGAIN) {
+        return;
+    }
+
+    if (rc != NGX_OK) {
         ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
         return;
     }
 
-    if (status == NGX_HTTP_CREATED) {
-        if (ngx_http_dav_location(r, path.data) != NGX_OK) {
+    ngx_http_dav_put_finalize(r, op);
+}
+
+
+static void
+ngx_http_dav_put_finalize(ngx_http_request_t *r, ngx_http_dav_file_op_t *op)
+{
+    if (op->rc != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    if (op->status == NGX_HTTP_CREATED) {
+        if (ngx_http_dav_location(r, op->to.data) != NGX_OK) {
             ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
             return;
         }
@@ -293,7 +405,7 @@ ngx_http_dav_put_handler(ngx_http_request_t *r)
         r->headers_out.content_length_n = 0;
     }
 
-    r->headers_out.status = status;
+    r->headers_out.status = op->status;
     r->header_only = 1;
 
     ngx_http_finalize_request(r, ngx_http_send_header(r));
@@ -543,10 +655,9 @@ ngx_http_dav_copy_move_handler(ngx_http_request_t *r)
     ngx_uint_t                overwrite, slash, dir, flags;
     ngx_str_t                 path, uri, duri, args;
     ngx_tree_ctx_t            tree;
-    ngx_copy_file_t           cf;
     ngx_file_info_t           fi;
     ngx_table_elt_t          *dest, *over;
-    ngx_ext_rename_file_t     ext;
+    ngx_http_dav_file_op_t   *op;
     ngx_http_dav_copy_ctx_t   copy;
     ngx_http_dav_loc_conf_t  *dlcf;
 
@@ -823,31 +934,43 @@ overwrite_done:
 
     } else {
 
+        op = ngx_pcalloc(r->pool, sizeof(ngx_http_dav_file_op_t));
+        if (op == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        op->from = path;
+        op->to = copy.path;
+        op->fd = NGX_INVALID_FILE;
+        op->status = NGX_HTTP_NO_CONTENT;
+
         if (r->method == NGX_HTTP_MOVE) {
 
             dlcf = ngx_http_get_module_loc_conf(r, ngx_http_dav_module);
 
-            ext.access = 0;
-            ext.path_access = dlcf->access;
-            ext.time = -1;
-            ext.create_path = 1;
-            ext.delete_file = 0;
-            ext.log = r->connection->log;
+            op->ext.access = 0;
+            op->ext.path_access = dlcf->access;
+            op->ext.time = -1;
+            op->ext.create_path = 1;
+            op->ext.delete_file = 0;
 
-            if (ngx_ext_rename_file(&path, &copy.path, &ext) == NGX_OK) {
-                return NGX_HTTP_NO_CONTENT;
-            }
+        } else {
+            op->copy = 1;
 
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            op->cf.size = ngx_file_size(&fi);
+            op->cf.buf_size = 0;
+            op->cf.access = ngx_file_access(&fi);
+            op->cf.time = ngx_file_mtime(&fi);
         }
 
-        cf.size = ngx_file_size(&fi);
-        cf.buf_size = 0;
-        cf.access = ngx_file_access(&fi);
-        cf.time = ngx_file_mtime(&fi);
-        cf.log = r->connection->log;
+        rc = ngx_http_dav_file_op_post(r, op);
+
+        if (rc == NGX_AGAIN) {
+            r->main->count++;
+            return NGX_DONE;
+        }
 
-        if (ngx_copy_file(path.data, copy.path.data, &cf) == NGX_OK) {
+        if (rc == NGX_OK && op->rc == NGX_OK) {
             return NGX_HTTP_NO_CONTENT;
         }
     }
@@ -996,6 +1119,148 @@ ngx_http_dav_copy_tree_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 }
 
 
+static ngx_int_t
+ngx_http_dav_file_op_post(ngx_http_request_t *r, ngx_http_dav_file_op_t *op)
+{
+#if (NGX_THREADS)
+    ngx_thread_task_t        *task;
+    ngx_http_dav_loc_conf_t  *dlcf;
+
+    dlcf = ngx_http_get_module_loc_conf(r, ngx_http_dav_module);
+
+    if (dlcf->thread_pool) {
+        task = ngx_thread_task_alloc(r->pool, 0);
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->ctx = op;
+        task->handler = ngx_http_dav_thread_handler;
+        task->event.data = r;
+        task->event.handler = ngx_http_dav_thread_event_handler;
+
+        if (ngx_thread_task_post(dlcf->thread_pool, task) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_set_ctx(r, op, ngx_http_dav_module);
+
+        r->main->blocked++;
+        r->aio = 1;
+
+        r->write_event_handler = ngx_http_dav_file_op_handler;
+
+        return NGX_AGAIN;
+    }
+#endif
+
+    ngx_http_dav_file_op(op, r->connection->log);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_dav_file_op(ngx_http_dav_file_op_t *op, ngx_log_t *log)
+{
+    if (op->fd != NGX_INVALID_FILE) {
+
+        if (ngx_fsync_file(op->fd) == -1) {
+            ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                          ngx_fsync_file_n " \"%s\" failed", op->from.data);
+            op->rc = NGX_ERROR;
+            return;
+        }
+
+        if (op->drop
+            && ngx_drop_file_cache(op->fd, 0, op->drop) == NGX_FILE_ERROR)
+        {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_drop_file_cache_n " \"%s\" failed",
+                          op->from.data);
+        }
+    }
+
+    if (op->copy) {
+        op->cf.log = log;
+        op->rc = ngx_copy_file(op->from.data, op->to.data, &op->cf);
+        return;
+    }
+
+    op->ext.log = log;
+    op->rc = ngx_ext_rename_file(&op->from, &op->to, &op->ext);
+}
+
+
+#if (NGX_THREADS)
+
+static void
+ngx_http_dav_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_dav_file_op_t *op = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "dav thread");
+
+    ngx_http_dav_file_op(op, log);
+}
+
+
+static void
+ngx_http_dav_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http dav thread: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    if (r->done) {
+        c->write->handler(c->write);
+
+    } else {
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+
+static void
+ngx_http_dav_file_op_handler(ngx_http_request_t *r)
+{
+    ngx_http_dav_file_op_t  *op;
+
+    if (r->aio) {
+        return;
+    }
+
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    op = ngx_http_get_module_ctx(r, ngx_http_dav_module);
+
+    if (r->method == NGX_HTTP_PUT) {
+        ngx_http_dav_put_finalize(r, op);
+        return;
+    }
+
+    if (op->rc != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    ngx_http_finalize_request(r, op->status);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_dav_depth(ngx_http_request_t *r, ngx_int_t dflt)
 {
@@ -1122,6 +1387,12 @@ ngx_http_dav_create_loc_conf(ngx_conf_t *cf)
     conf->min_delete_depth = NGX_CONF_UNSET_UINT;
     conf->access = NGX_CONF_UNSET_UINT;
     conf->create_full_put_path = NGX_CONF_UNSET;
+    conf->preallocate = NGX_CONF_UNSET;
+    conf->fsync = NGX_CONF_UNSET;
+
+#if (NGX_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
 
     return conf;
 }
@@ -1144,10 +1415,69 @@ ngx_http_dav_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->create_full_put_path,
                          prev->create_full_put_path, 0);
 
+    ngx_conf_merge_value(conf->preallocate, prev->preallocate, 0);
+    ngx_conf_merge_value(conf->fsync, prev->fsync, 0);
+
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
     return NGX_CONF_OK;
 }
 
 
+static char *
+ngx_http_dav_threads(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_THREADS)
+    ngx_http_dav_loc_conf_t *dlcf = conf;
+
+    ngx_str_t  name;
+#endif
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+#if (NGX_THREADS)
+    if (dlcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+#endif
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+#if (NGX_THREADS)
+        dlcf->thread_pool = NULL;
+#endif
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "threads", 7) == 0
+        && (value[1].len == 7 || value[1].data[7] == '='))
+    {
+#if (NGX_THREADS)
+        name.len = value[1].len > 8 ? value[1].len - 8 : 0;
+        name.data = value[1].data + 8;
+
+        dlcf->thread_pool = ngx_thread_pool_add(cf, name.len ? &name : NULL);
+        if (dlcf->thread_pool == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"dav_threads\" is unsupported "
+                           "on this platform");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid value \"%V\"", &value[1]);
+    return NGX_CONF_ERROR;
+}
+
+
 static ngx_int_t
 ngx_http_dav_init(ngx_conf_t *cf)
 {
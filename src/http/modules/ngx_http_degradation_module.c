@@ -10,8 +10,18 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_DEGRADATION_TICK   100
+#define NGX_HTTP_DEGRADATION_TICKS  10
+
+
 typedef struct {
     size_t      sbrk_size;
+
+    /* the limits of the load of a worker process */
+    ngx_msec_t  lag;
+    ngx_uint_t  connections;
+    ngx_uint_t  queue;
+    size_t      rss;
 } ngx_http_degradation_main_conf_t;
 
 
@@ -23,6 +33,7 @@ typedef struct {
 static ngx_conf_enum_t  ngx_http_degrade[] = {
     { ngx_string("204"), 204 },
     { ngx_string("444"), 444 },
+    { ngx_string("503"), 503 },
     { ngx_null_string, 0 }
 };
 
@@ -34,12 +45,16 @@ static char *ngx_http_degradation_merge_loc_conf(ngx_conf_t *cf, void *parent,
 static char *ngx_http_degradation(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_degradation_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_degradation_init_process(ngx_cycle_t *cycle);
+static void ngx_http_degradation_load_handler(ngx_event_t *ev);
+static ngx_uint_t ngx_http_degradation_queued(void);
+static size_t ngx_http_degradation_rss(ngx_log_t *log);
 
 
 static ngx_command_t  ngx_http_degradation_commands[] = {
 
     { ngx_string("degradation"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
       ngx_http_degradation,
       NGX_HTTP_MAIN_CONF_OFFSET,
       0,
@@ -78,7 +93,7 @@ ngx_module_t  ngx_http_degradation_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_degradation_init_process,     /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -87,6 +102,15 @@ ngx_module_t  ngx_http_degradation_module = {
 };
 
 
+static ngx_event_t  ngx_http_degradation_load_event;
+static ngx_uint_t   ngx_http_degradation_overloaded;
+static ngx_uint_t   ngx_http_degradation_ticks;
+static ngx_msec_t   ngx_http_degradation_lag;
+static ngx_msec_t   ngx_http_degradation_prev_lag;
+static ngx_msec_t   ngx_http_degradation_expires;
+static size_t       ngx_http_degradation_rss_size;
+
+
 static ngx_int_t
 ngx_http_degradation_handler(ngx_http_request_t *r)
 {
@@ -111,6 +135,10 @@ ngx_http_degraded(ngx_http_request_t *r)
     static time_t                      sbrk_time;
     ngx_http_degradation_main_conf_t  *dmcf;
 
+    if (ngx_http_degradation_overloaded) {
+        return 1;
+    }
+
     dmcf = ngx_http_get_module_main_conf(r, ngx_http_degradation_module);
 
     if (dmcf->sbrk_size) {
@@ -151,6 +179,145 @@ ngx_http_degraded(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_degradation_load_handler(ngx_event_t *ev)
+{
+    ngx_msec_t                         lag;
+    ngx_uint_t                         overloaded, connections, queued;
+    ngx_http_degradation_main_conf_t  *dmcf;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    dmcf = ev->data;
+
+    /* the timer fires late by the time the event loop was busy */
+
+    lag = ngx_current_msec - ngx_http_degradation_expires;
+
+    if ((ngx_msec_int_t) lag > 0 && lag > ngx_http_degradation_lag) {
+        ngx_http_degradation_lag = lag;
+    }
+
+    if (++ngx_http_degradation_ticks >= NGX_HTTP_DEGRADATION_TICKS) {
+        ngx_http_degradation_prev_lag = ngx_http_degradation_lag;
+        ngx_http_degradation_lag = 0;
+        ngx_http_degradation_ticks = 0;
+
+        if (dmcf->rss) {
+            ngx_http_degradation_rss_size = ngx_http_degradation_rss(ev->log);
+        }
+    }
+
+    /* the lag is the worst one seen during the last second or so */
+
+    lag = ngx_max(ngx_http_degradation_lag, ngx_http_degradation_prev_lag);
+
+    connections = ngx_cycle->connection_n - ngx_cycle->free_connection_n;
+    queued = dmcf->queue ? ngx_http_degradation_queued() : 0;
+
+    overloaded = (dmcf->lag && lag >= dmcf->lag)
+                 || (dmcf->connections && connections >= dmcf->connections)
+                 || (dmcf->queue && queued >= dmcf->queue)
+                 || (dmcf->rss && ngx_http_degradation_rss_size >= dmcf->rss);
+
+    if (overloaded != ngx_http_degradation_overloaded) {
+        ngx_log_error(NGX_LOG_NOTICE, ev->log, 0,
+                      "degradation %s, lag:%M connections:%ui queue:%ui "
+                      "rss:%uzM", overloaded ? "started" : "stopped",
+                      lag, connections, queued,
+                      ngx_http_degradation_rss_size / (1024 * 1024));
+
+        ngx_http_degradation_overloaded = overloaded;
+    }
+
+    ngx_http_degradation_expires = ngx_current_msec
+                                   + NGX_HTTP_DEGRADATION_TICK;
+    ngx_add_timer(ev, NGX_HTTP_DEGRADATION_TICK);
+}
+
+
+static ngx_uint_t
+ngx_http_degradation_queued(void)
+{
+    ngx_uint_t                      i, n;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                               ngx_http_upstream_module);
+    if (umcf == NULL) {
+        return 0;
+    }
+
+    n = 0;
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        n += uscfp[i]->queued;
+    }
+
+    return n;
+}
+
+
+static size_t
+ngx_http_degradation_rss(ngx_log_t *log)
+{
+#if (NGX_LINUX)
+    u_char    *p, *last;
+    ssize_t    n;
+    ngx_fd_t   fd;
+    ngx_int_t  pages;
+    u_char     buf[NGX_INT_T_LEN * 7 + 8];
+
+    /* "size resident shared text lib data dt", in pages */
+
+    fd = ngx_open_file("/proc/self/statm", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_open_file_n " \"/proc/self/statm\" failed");
+        return 0;
+    }
+
+    n = ngx_read_fd(fd, buf, sizeof(buf));
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"/proc/self/statm\" failed");
+    }
+
+    if (n <= 0) {
+        return 0;
+    }
+
+    p = ngx_strlchr(buf, buf + n, ' ');
+
+    if (p == NULL) {
+        return 0;
+    }
+
+    p++;
+
+    for (last = p; last < buf + n && *last >= '0' && *last <= '9'; last++) {
+        /* void */
+    }
+
+    pages = ngx_atoi(p, last - p);
+
+    if (pages == NGX_ERROR) {
+        return 0;
+    }
+
+    return (size_t) pages * ngx_pagesize;
+#else
+    return 0;
+#endif
+}
+
+
 static void *
 ngx_http_degradation_create_main_conf(ngx_conf_t *cf)
 {
@@ -161,6 +328,16 @@ ngx_http_degradation_create_main_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     dmcf->sbrk_size = 0;
+     *     dmcf->lag = 0;
+     *     dmcf->connections = 0;
+     *     dmcf->queue = 0;
+     *     dmcf->rss = 0;
+     */
+
     return dmcf;
 }
 
@@ -198,27 +375,93 @@ ngx_http_degradation(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_degradation_main_conf_t  *dmcf = conf;
 
-    ngx_str_t  *value, s;
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_uint_t   i;
 
     value = cf->args->elts;
 
-    if (ngx_strncmp(value[1].data, "sbrk=", 5) == 0) {
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "sbrk=", 5) == 0) {
+
+            s.len = value[i].len - 5;
+            s.data = value[i].data + 5;
+
+            dmcf->sbrk_size = ngx_parse_size(&s);
+            if (dmcf->sbrk_size == (size_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid sbrk size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "lag=", 4) == 0) {
+
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
+
+            dmcf->lag = ngx_parse_time(&s, 0);
+            if (dmcf->lag == (ngx_msec_t) NGX_ERROR || dmcf->lag == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "connections=", 12) == 0) {
 
-        s.len = value[1].len - 5;
-        s.data = value[1].data + 5;
+            n = ngx_atoi(value[i].data + 12, value[i].len - 12);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
 
-        dmcf->sbrk_size = ngx_parse_size(&s);
-        if (dmcf->sbrk_size == (size_t) NGX_ERROR) {
+            dmcf->connections = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "queue=", 6) == 0) {
+
+            n = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            dmcf->queue = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "rss=", 4) == 0) {
+
+#if (NGX_LINUX)
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
+
+            dmcf->rss = ngx_parse_size(&s);
+            if (dmcf->rss == (size_t) NGX_ERROR || dmcf->rss == 0) {
+                goto invalid;
+            }
+
+            continue;
+#else
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid sbrk size \"%V\"", &value[1]);
+                               "\"rss\" is not supported "
+                               "on this platform");
             return NGX_CONF_ERROR;
+#endif
         }
 
-        return NGX_CONF_OK;
+        goto invalid;
     }
 
+    return NGX_CONF_OK;
+
+invalid:
+
     ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                       "invalid parameter \"%V\"", &value[1]);
+                       "invalid parameter \"%V\"", &value[i]);
 
     return NGX_CONF_ERROR;
 }
@@ -241,3 +484,43 @@ ngx_http_degradation_init(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+static ngx_int_t
+ngx_http_degradation_init_process(ngx_cycle_t *cycle)
+{
+    ngx_event_t                       *ev;
+    ngx_http_degradation_main_conf_t  *dmcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    dmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_degradation_module);
+    if (dmcf == NULL
+        || (dmcf->lag == 0 && dmcf->connections == 0 && dmcf->queue == 0
+            && dmcf->rss == 0))
+    {
+        return NGX_OK;
+    }
+
+    if (dmcf->rss) {
+        ngx_http_degradation_rss_size = ngx_http_degradation_rss(cycle->log);
+    }
+
+    ev = &ngx_http_degradation_load_event;
+
+    ev->handler = ngx_http_degradation_load_handler;
+    ev->data = dmcf;
+    ev->log = cycle->log;
+    ev->cancelable = 1;
+
+    ngx_http_degradation_expires = ngx_current_msec
+                                   + NGX_HTTP_DEGRADATION_TICK;
+    ngx_add_timer(ev, NGX_HTTP_DEGRADATION_TICK);
+
+    return NGX_OK;
+}
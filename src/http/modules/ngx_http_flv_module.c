@@ -9,7 +9,15 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_flag_t                 cache_seek;
+} ngx_http_flv_conf_t;
+
+
 static char *ngx_http_flv(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static void *ngx_http_flv_create_conf(ngx_conf_t *cf);
+static char *ngx_http_flv_merge_conf(ngx_conf_t *cf, void *parent, void *child);
+static ngx_int_t ngx_http_flv_filter_init(ngx_conf_t *cf);
 
 static ngx_command_t  ngx_http_flv_commands[] = {
 
@@ -20,6 +28,13 @@ static ngx_command_t  ngx_http_flv_commands[] = {
       0,
       NULL },
 
+    { ngx_string("flv_cache_seek"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_flv_conf_t, cache_seek),
+      NULL },
+
       ngx_null_command
 };
 
@@ -37,8 +52,8 @@ static ngx_http_module_t  ngx_http_flv_module_ctx = {
     NULL,                          /* create server configuration */
     NULL,                          /* merge server configuration */
 
-    NULL,                          /* create location configuration */
-    NULL                           /* merge location configuration */
+    ngx_http_flv_create_conf,      /* create location configuration */
+    ngx_http_flv_merge_conf        /* merge location configuration */
 };
 
 
@@ -58,6 +73,50 @@ ngx_module_t  ngx_http_flv_module = {
 };
 
 
+static ngx_http_module_t  ngx_http_flv_filter_module_ctx = {
+    NULL,                          /* preconfiguration */
+    ngx_http_flv_filter_init,      /* postconfiguration */
+
+    NULL,                          /* create main configuration */
+    NULL,                          /* init main configuration */
+
+    NULL,                          /* create server configuration */
+    NULL,                          /* merge server configuration */
+
+    NULL,                          /* create location configuration */
+    NULL                           /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_flv_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_flv_filter_module_ctx, /* module context */
+    NULL,                          /* module directives */
+    NGX_HTTP_MODULE,               /* module type */
+    NULL,                          /* init master */
+    NULL,                          /* init module */
+    NULL,                          /* init process */
+    NULL,                          /* init thread */
+    NULL,                          /* exit thread */
+    NULL,                          /* exit process */
+    NULL,                          /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+#if (NGX_HTTP_CACHE)
+
+typedef struct {
+    off_t                      start;
+} ngx_http_flv_ctx_t;
+
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
+
+#endif
+
+
 static ngx_int_t
 ngx_http_flv_handler(ngx_http_request_t *r)
 {
@@ -264,3 +323,198 @@ ngx_http_flv(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+#if (NGX_HTTP_CACHE)
+
+static ngx_int_t
+ngx_http_flv_header_filter(ngx_http_request_t *r)
+{
+    off_t                 start, len;
+    ngx_int_t             rc;
+    ngx_str_t             value;
+    ngx_http_cache_t     *c;
+    ngx_http_flv_ctx_t   *ctx;
+    ngx_http_flv_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_flv_module);
+
+    if (!conf->cache_seek
+        || !r->cached
+        || r->cache == NULL
+        || r->args.len == 0
+        || r->headers_out.status != NGX_HTTP_OK
+        || r->headers_out.content_encoding
+        || ngx_http_arg(r, (u_char *) "start", 5, &value) != NGX_OK)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    c = r->cache;
+
+    /* the entries being written or kept in memory are sent as is */
+
+    if (c->streaming || c->memory || c->file.fd == NGX_INVALID_FILE) {
+        return ngx_http_next_header_filter(r);
+    }
+
+    len = c->length - c->body_start;
+
+    if (r->headers_out.content_length_n != -1
+        && r->headers_out.content_length_n != len)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    start = ngx_atoof(value.data, value.len);
+
+    if (start == NGX_ERROR || start == 0 || start >= len) {
+        return ngx_http_next_header_filter(r);
+    }
+
+    ctx = ngx_palloc(r->pool, sizeof(ngx_http_flv_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->start = start;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http flv cached: \"%s\", start:%O",
+                   c->file.name.data, start);
+
+    r->headers_out.content_length_n = sizeof(ngx_flv_header) - 1 + len - start;
+    r->single_range = 1;
+
+    rc = ngx_http_next_header_filter(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    ngx_http_set_ctx(r, ctx, ngx_http_flv_filter_module);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_flv_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_buf_t           *b;
+    ngx_chain_t         *cl, *out;
+    ngx_http_cache_t    *c;
+    ngx_http_flv_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_flv_filter_module);
+
+    if (ctx == NULL || in == NULL) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    ngx_http_set_ctx(r, NULL, ngx_http_flv_filter_module);
+
+    /* the cached body is sent from the start offset after the header */
+
+    for (cl = in; cl; cl = cl->next) {
+        cl->buf->pos = cl->buf->last;
+        cl->buf->file_pos = cl->buf->file_last;
+    }
+
+    c = r->cache;
+
+    out = ngx_alloc_chain_link(r->pool);
+    if (out == NULL) {
+        return NGX_ERROR;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = ngx_flv_header;
+    b->last = ngx_flv_header + sizeof(ngx_flv_header) - 1;
+    b->memory = 1;
+
+    out->buf = b;
+
+    out->next = ngx_alloc_chain_link(r->pool);
+    if (out->next == NULL) {
+        return NGX_ERROR;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+    if (b->file == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->file_pos = c->body_start + ctx->start;
+    b->file_last = c->length;
+
+    b->in_file = 1;
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    b->file->fd = c->file.fd;
+    b->file->name = c->file.name;
+    b->file->log = r->connection->log;
+    b->file->directio = c->file.directio;
+
+    out->next->buf = b;
+    out->next->next = NULL;
+
+    return ngx_http_next_body_filter(r, out);
+}
+
+#endif
+
+
+static void *
+ngx_http_flv_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_flv_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool, sizeof(ngx_http_flv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->cache_seek = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_flv_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_flv_conf_t *prev = parent;
+    ngx_http_flv_conf_t *conf = child;
+
+    ngx_conf_merge_value(conf->cache_seek, prev->cache_seek, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_flv_filter_init(ngx_conf_t *cf)
+{
+#if (NGX_HTTP_CACHE)
+
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_flv_header_filter;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_flv_body_filter;
+
+#endif
+
+    return NGX_OK;
+}
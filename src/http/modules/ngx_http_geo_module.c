@@ -17,16 +17,30 @@ typedef struct {
 } ngx_http_geo_range_t;
 
 
+/*
+ * the ranges base is position independent: values and ranges refer
+ * to each other by offsets from the start of the base, so a binary base
+ * file is used in place, mapped read-only
+ */
+
 typedef struct {
-    ngx_radix_tree_t                *tree;
+    uint32_t                         value;
+    u_short                          start;
+    u_short                          end;
+} ngx_http_geo_base_range_t;
+
+
+typedef struct {
+    ngx_poptrie_t                   *trie;
 #if (NGX_HAVE_INET6)
-    ngx_radix_tree_t                *tree6;
+    ngx_poptrie_t                   *trie6;
 #endif
 } ngx_http_geo_trees_t;
 
 
 typedef struct {
-    ngx_http_geo_range_t           **low;
+    u_char                          *base;
+    uint32_t                        *low;
     ngx_http_variable_value_t       *default_value;
 } ngx_http_geo_high_ranges_t;
 
@@ -42,6 +56,7 @@ typedef struct {
     ngx_http_variable_value_t       *value;
     ngx_str_t                       *net;
     ngx_http_geo_high_ranges_t       high;
+    ngx_array_t                    **low;
     ngx_radix_tree_t                *tree;
 #if (NGX_HAVE_INET6)
     ngx_radix_tree_t                *tree6;
@@ -105,6 +120,8 @@ static char *ngx_http_geo_include(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_str_t *name);
 static ngx_int_t ngx_http_geo_include_binary_base(ngx_conf_t *cf,
     ngx_http_geo_conf_ctx_t *ctx, ngx_str_t *name);
+static void ngx_http_geo_cleanup_binary_base(void *data);
+static void ngx_http_geo_create_base(ngx_http_geo_conf_ctx_t *ctx);
 static void ngx_http_geo_create_binary_base(ngx_http_geo_conf_ctx_t *ctx);
 static u_char *ngx_http_geo_copy_values(u_char *base, u_char *p,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
@@ -164,7 +181,7 @@ typedef struct {
 
 
 static ngx_http_geo_header_t  ngx_http_geo_header = {
-    { 'G', 'E', 'O', 'R', 'N', 'G' }, 0, sizeof(void *), 0x12345678, 0
+    { 'G', 'E', 'O', 'R', 'N', 'G' }, 1, sizeof(void *), 0x12345678, 0
 };
 
 
@@ -187,7 +204,7 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 
     if (ngx_http_geo_addr(r, ctx, &addr) != NGX_OK) {
         vv = (ngx_http_variable_value_t *)
-                  ngx_radix32tree_find(ctx->u.trees.tree, INADDR_NONE);
+                  ngx_poptrie32_find(ctx->u.trees.trie, INADDR_NONE);
         goto done;
     }
 
@@ -205,11 +222,11 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
             inaddr += p[15];
 
             vv = (ngx_http_variable_value_t *)
-                      ngx_radix32tree_find(ctx->u.trees.tree, inaddr);
+                      ngx_poptrie32_find(ctx->u.trees.trie, inaddr);
 
         } else {
             vv = (ngx_http_variable_value_t *)
-                      ngx_radix128tree_find(ctx->u.trees.tree6, p);
+                      ngx_poptrie128_find(ctx->u.trees.trie6, p);
         }
 
         break;
@@ -218,7 +235,7 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 #if (NGX_HAVE_UNIX_DOMAIN)
     case AF_UNIX:
         vv = (ngx_http_variable_value_t *)
-                  ngx_radix32tree_find(ctx->u.trees.tree, INADDR_NONE);
+                  ngx_poptrie32_find(ctx->u.trees.trie, INADDR_NONE);
         break;
 #endif
 
@@ -227,7 +244,7 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         inaddr = ntohl(sin->sin_addr.s_addr);
 
         vv = (ngx_http_variable_value_t *)
-                  ngx_radix32tree_find(ctx->u.trees.tree, inaddr);
+                  ngx_poptrie32_find(ctx->u.trees.trie, inaddr);
 
         break;
     }
@@ -249,14 +266,17 @@ ngx_http_geo_range_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_http_geo_ctx_t *ctx = (ngx_http_geo_ctx_t *) data;
 
-    in_addr_t              inaddr;
-    ngx_addr_t             addr;
-    ngx_uint_t             n;
-    struct sockaddr_in    *sin;
-    ngx_http_geo_range_t  *range;
+    u_char                     *base;
+    uint32_t                   *bucket;
+    in_addr_t                   inaddr;
+    ngx_addr_t                  addr;
+    ngx_uint_t                  n, i, lo, hi;
+    struct sockaddr_in         *sin;
+    ngx_http_variable_value_t  *vv;
+    ngx_http_geo_base_range_t  *range;
 #if (NGX_HAVE_INET6)
-    u_char                *p;
-    struct in6_addr       *inaddr6;
+    u_char                     *p;
+    struct in6_addr            *inaddr6;
 #endif
 
     *v = *ctx->u.high.default_value;
@@ -300,19 +320,34 @@ ngx_http_geo_range_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         inaddr = INADDR_NONE;
     }
 
-    if (ctx->u.high.low) {
-        range = ctx->u.high.low[inaddr >> 16];
+    if (ctx->u.high.low && ctx->u.high.low[inaddr >> 16]) {
+        base = ctx->u.high.base;
 
-        if (range) {
-            n = inaddr & 0xffff;
-            do {
-                if (n >= (ngx_uint_t) range->start
-                    && n <= (ngx_uint_t) range->end)
-                {
-                    *v = *range->value;
-                    break;
-                }
-            } while ((++range)->value);
+        bucket = (uint32_t *) (base + ctx->u.high.low[inaddr >> 16]);
+        range = (ngx_http_geo_base_range_t *) &bucket[1];
+
+        /* the ranges are sorted and do not overlap */
+
+        n = inaddr & 0xffff;
+        lo = 0;
+        hi = bucket[0];
+
+        while (lo < hi) {
+            i = (lo + hi) / 2;
+
+            if (n < (ngx_uint_t) range[i].start) {
+                hi = i;
+
+            } else {
+                lo = i + 1;
+            }
+        }
+
+        if (lo && n <= (ngx_uint_t) range[lo - 1].end) {
+            vv = (ngx_http_variable_value_t *) (base + range[lo - 1].value);
+
+            *v = *vv;
+            v->data = base + (size_t) vv->data;
         }
     }
 
@@ -385,7 +420,6 @@ static char *
 ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     char                     *rv;
-    size_t                    len;
     ngx_str_t                *value, name;
     ngx_uint_t                i;
     ngx_conf_t                save;
@@ -461,7 +495,7 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ctx.pool = cf->pool;
     ctx.data_size = sizeof(ngx_http_geo_header_t)
                   + sizeof(ngx_http_variable_value_t)
-                  + 0x10000 * sizeof(ngx_http_geo_range_t *);
+                  + 0x10000 * sizeof(uint32_t);
     ctx.allow_binary_include = 1;
 
     save = *cf;
@@ -483,31 +517,29 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     if (ctx.ranges) {
 
-        if (ctx.high.low && !ctx.binary_include) {
+        if (ctx.low && !ctx.binary_include) {
             for (i = 0; i < 0x10000; i++) {
-                a = (ngx_array_t *) ctx.high.low[i];
-
-                if (a == NULL) {
-                    continue;
-                }
+                a = ctx.low[i];
 
-                if (a->nelts == 0) {
-                    ctx.high.low[i] = NULL;
-                    continue;
+                if (a && a->nelts) {
+                    ctx.data_size += sizeof(uint32_t)
+                               + a->nelts * sizeof(ngx_http_geo_base_range_t);
                 }
+            }
 
-                len = a->nelts * sizeof(ngx_http_geo_range_t);
-
-                ctx.high.low[i] = ngx_palloc(cf->pool, len + sizeof(void *));
-                if (ctx.high.low[i] == NULL) {
-                    goto failed;
-                }
+            if ((uint64_t) ctx.data_size > 0xffffffff) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "geo range base is too large");
+                goto failed;
+            }
 
-                ngx_memcpy(ctx.high.low[i], a->elts, len);
-                ctx.high.low[i][a->nelts].value = NULL;
-                ctx.data_size += len + sizeof(void *);
+            ctx.high.base = ngx_palloc(cf->pool, ctx.data_size);
+            if (ctx.high.base == NULL) {
+                goto failed;
             }
 
+            ngx_http_geo_create_base(&ctx);
+
             if (ctx.allow_binary_include
                 && !ctx.outside_entries
                 && ctx.entries > 100000
@@ -528,23 +560,19 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     } else {
         if (ctx.tree == NULL) {
-            ctx.tree = ngx_radix_tree_create(cf->pool, -1);
+            ctx.tree = ngx_radix_tree_create(ctx.temp_pool, -1);
             if (ctx.tree == NULL) {
                 goto failed;
             }
         }
 
-        geo->u.trees.tree = ctx.tree;
-
 #if (NGX_HAVE_INET6)
         if (ctx.tree6 == NULL) {
-            ctx.tree6 = ngx_radix_tree_create(cf->pool, -1);
+            ctx.tree6 = ngx_radix_tree_create(ctx.temp_pool, -1);
             if (ctx.tree6 == NULL) {
                 goto failed;
             }
         }
-
-        geo->u.trees.tree6 = ctx.tree6;
 #endif
 
         var->get_handler = ngx_http_geo_cidr_variable;
@@ -567,6 +595,20 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             goto failed;
         }
 #endif
+
+        /* the radix trees are compiled into tries and freed */
+
+        geo->u.trees.trie = ngx_poptrie_create(cf->pool, ctx.tree, 32);
+        if (geo->u.trees.trie == NULL) {
+            goto failed;
+        }
+
+#if (NGX_HAVE_INET6)
+        geo->u.trees.trie6 = ngx_poptrie_create(cf->pool, ctx.tree6, 128);
+        if (geo->u.trees.trie6 == NULL) {
+            goto failed;
+        }
+#endif
     }
 
     ngx_destroy_pool(ctx.temp_pool);
@@ -701,10 +743,10 @@ ngx_http_geo_range(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
         return NGX_CONF_ERROR;
     }
 
-    if (ctx->high.low == NULL) {
-        ctx->high.low = ngx_pcalloc(ctx->pool,
-                                    0x10000 * sizeof(ngx_http_geo_range_t *));
-        if (ctx->high.low == NULL) {
+    if (ctx->low == NULL) {
+        ctx->low = ngx_pcalloc(ctx->temp_pool,
+                               0x10000 * sizeof(ngx_array_t *));
+        if (ctx->low == NULL) {
             return NGX_CONF_ERROR;
         }
     }
@@ -806,7 +848,7 @@ ngx_http_geo_add_range(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
             e = 0xffff;
         }
 
-        a = (ngx_array_t *) ctx->high.low[h];
+        a = ctx->low[h];
 
         if (a == NULL) {
             a = ngx_array_create(ctx->temp_pool, 64,
@@ -815,7 +857,7 @@ ngx_http_geo_add_range(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
                 return NGX_CONF_ERROR;
             }
 
-            ctx->high.low[h] = (ngx_http_geo_range_t *) a;
+            ctx->low[h] = a;
         }
 
         i = a->nelts;
@@ -1010,7 +1052,7 @@ ngx_http_geo_delete_range(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
             e = 0xffff;
         }
 
-        a = (ngx_array_t *) ctx->high.low[h];
+        a = ctx->low[h];
 
         if (a == NULL || a->nelts == 0) {
             warn = 1;
@@ -1057,7 +1099,7 @@ ngx_http_geo_cidr(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_cidr_t   cidr;
 
     if (ctx->tree == NULL) {
-        ctx->tree = ngx_radix_tree_create(ctx->pool, -1);
+        ctx->tree = ngx_radix_tree_create(ctx->temp_pool, -1);
         if (ctx->tree == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1065,7 +1107,7 @@ ngx_http_geo_cidr(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
 
 #if (NGX_HAVE_INET6)
     if (ctx->tree6 == NULL) {
-        ctx->tree6 = ngx_radix_tree_create(ctx->pool, -1);
+        ctx->tree6 = ngx_radix_tree_create(ctx->temp_pool, -1);
         if (ctx->tree6 == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1404,17 +1446,16 @@ static ngx_int_t
 ngx_http_geo_include_binary_base(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_str_t *name)
 {
-    u_char                     *base, ch;
+    u_char                     *base, *last, ch;
     time_t                      mtime;
-    size_t                      size, len;
-    ssize_t                     n;
+    size_t                      size;
     uint32_t                    crc32;
     ngx_err_t                   err;
     ngx_int_t                   rc;
-    ngx_uint_t                  i;
     ngx_file_t                  file;
     ngx_file_info_t             fi;
-    ngx_http_geo_range_t       *range, **ranges;
+    ngx_pool_cleanup_t         *cln;
+    ngx_file_mapping_t         *fm;
     ngx_http_geo_header_t      *header;
     ngx_http_variable_value_t  *vv;
 
@@ -1433,6 +1474,8 @@ ngx_http_geo_include_binary_base(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
         return NGX_DECLINED;
     }
 
+    fm = NULL;
+
     if (ctx->outside_entries) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
             "binary geo range base \"%s\" cannot be mixed with usual entries",
@@ -1475,89 +1518,88 @@ ngx_http_geo_include_binary_base(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
         goto failed;
     }
 
-    base = ngx_palloc(ctx->pool, size);
-    if (base == NULL) {
-        goto failed;
+    if (size < sizeof(ngx_http_geo_header_t)
+                + sizeof(ngx_http_variable_value_t)
+                + 0x10000 * sizeof(uint32_t))
+    {
+        goto incompatible;
     }
 
-    n = ngx_read_file(&file, base, size, 0);
+    /*
+     * the base is mapped read-only and is not changed, so its pages
+     * are shared by all processes and configurations which use it
+     */
 
-    if (n == NGX_ERROR) {
-        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
-                           ngx_read_file_n " \"%s\" failed", name->data);
+    fm = ngx_palloc(ctx->pool, sizeof(ngx_file_mapping_t));
+    if (fm == NULL) {
         goto failed;
     }
 
-    if ((size_t) n != size) {
-        ngx_conf_log_error(NGX_LOG_CRIT, cf, 0,
-            ngx_read_file_n " \"%s\" returned only %z bytes instead of %z",
-            name->data, n, size);
+    fm->name = name->data;
+    fm->size = size;
+    fm->fd = file.fd;
+    fm->log = cf->log;
+
+    if (ngx_open_file_mapping(fm) != NGX_OK) {
+        fm = NULL;
         goto failed;
     }
 
+    base = fm->addr;
+    last = base + size;
     header = (ngx_http_geo_header_t *) base;
 
-    if (size < 16 || ngx_memcmp(&ngx_http_geo_header, header, 12) != 0) {
+    if (ngx_memcmp(&ngx_http_geo_header, header, 12) != 0) {
+        goto incompatible;
+    }
+
+    crc32 = ngx_crc32_long(base + sizeof(ngx_http_geo_header_t),
+                           size - sizeof(ngx_http_geo_header_t));
+
+    if (crc32 != header->crc32) {
         ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
-             "incompatible binary geo range base \"%s\"", name->data);
+                  "CRC32 mismatch in binary geo range base \"%s\"", name->data);
         goto failed;
     }
 
-    ngx_crc32_init(crc32);
-
     vv = (ngx_http_variable_value_t *) (base + sizeof(ngx_http_geo_header_t));
 
     while (vv->data) {
-        len = ngx_align(sizeof(ngx_http_variable_value_t) + vv->len,
-                        sizeof(void *));
-        ngx_crc32_update(&crc32, (u_char *) vv, len);
-        vv->data += (size_t) base;
-        vv = (ngx_http_variable_value_t *) ((u_char *) vv + len);
-    }
-    ngx_crc32_update(&crc32, (u_char *) vv, sizeof(ngx_http_variable_value_t));
-    vv++;
-
-    ranges = (ngx_http_geo_range_t **) vv;
-
-    for (i = 0; i < 0x10000; i++) {
-        ngx_crc32_update(&crc32, (u_char *) &ranges[i], sizeof(void *));
-        if (ranges[i]) {
-            ranges[i] = (ngx_http_geo_range_t *)
-                            ((u_char *) ranges[i] + (size_t) base);
-        }
-    }
-
-    range = (ngx_http_geo_range_t *) &ranges[0x10000];
+        vv = (ngx_http_variable_value_t *)
+                 ((u_char *) vv + ngx_align(sizeof(ngx_http_variable_value_t)
+                                            + vv->len, sizeof(void *)));
 
-    while ((u_char *) range < base + size) {
-        while (range->value) {
-            ngx_crc32_update(&crc32, (u_char *) range,
-                             sizeof(ngx_http_geo_range_t));
-            range->value = (ngx_http_variable_value_t *)
-                               ((u_char *) range->value + (size_t) base);
-            range++;
+        if ((u_char *) vv + sizeof(ngx_http_variable_value_t)
+            + 0x10000 * sizeof(uint32_t) > last)
+        {
+            goto incompatible;
         }
-        ngx_crc32_update(&crc32, (u_char *) range, sizeof(void *));
-        range = (ngx_http_geo_range_t *) ((u_char *) range + sizeof(void *));
     }
 
-    ngx_crc32_final(crc32);
+    vv++;
 
-    if (crc32 != header->crc32) {
-        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
-                  "CRC32 mismatch in binary geo range base \"%s\"", name->data);
+    cln = ngx_pool_cleanup_add(ctx->pool, 0);
+    if (cln == NULL) {
         goto failed;
     }
 
+    cln->handler = ngx_http_geo_cleanup_binary_base;
+    cln->data = fm;
+
     ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
                        "using binary geo range base \"%s\"", name->data);
 
     ctx->include_name = *name;
     ctx->binary_include = 1;
-    ctx->high.low = ranges;
-    rc = NGX_OK;
+    ctx->high.base = base;
+    ctx->high.low = (uint32_t *) vv;
+
+    return NGX_OK;
+
+incompatible:
 
-    goto done;
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "incompatible binary geo range base \"%s\"", name->data);
 
 failed:
 
@@ -1565,6 +1607,11 @@ failed:
 
 done:
 
+    if (fm) {
+        ngx_close_file_mapping(fm);
+        return rc;
+    }
+
     if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
         ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
                       ngx_close_file_n " \"%s\" failed", name->data);
@@ -1575,80 +1622,132 @@ done:
 
 
 static void
-ngx_http_geo_create_binary_base(ngx_http_geo_conf_ctx_t *ctx)
+ngx_http_geo_cleanup_binary_base(void *data)
 {
-    u_char                              *p;
-    uint32_t                             hash;
-    ngx_str_t                            s;
-    ngx_uint_t                           i;
-    ngx_file_mapping_t                   fm;
-    ngx_http_geo_range_t                *r, *range, **ranges;
-    ngx_http_geo_header_t               *header;
-    ngx_http_geo_variable_value_node_t  *gvvn;
-
-    fm.name = ngx_pnalloc(ctx->temp_pool, ctx->include_name.len + 5);
-    if (fm.name == NULL) {
-        return;
-    }
+    ngx_file_mapping_t  *fm = data;
 
-    ngx_sprintf(fm.name, "%V.bin%Z", &ctx->include_name);
+    ngx_close_file_mapping(fm);
+}
 
-    fm.size = ctx->data_size;
-    fm.log = ctx->pool->log;
 
-    ngx_log_error(NGX_LOG_NOTICE, fm.log, 0,
-                  "creating binary geo range base \"%s\"", fm.name);
+static void
+ngx_http_geo_create_base(ngx_http_geo_conf_ctx_t *ctx)
+{
+    u_char                              *p, *base;
+    uint32_t                            *low, hash;
+    ngx_str_t                            s;
+    ngx_uint_t                           i, n;
+    ngx_array_t                         *a;
+    ngx_http_geo_range_t                *r;
+    ngx_http_geo_base_range_t           *range;
+    ngx_http_variable_value_t           *vv;
+    ngx_http_geo_variable_value_node_t  *gvvn;
 
-    if (ngx_create_file_mapping(&fm) != NGX_OK) {
-        return;
-    }
+    base = ctx->high.base;
 
-    p = ngx_cpymem(fm.addr, &ngx_http_geo_header,
-                   sizeof(ngx_http_geo_header_t));
+    p = ngx_cpymem(base, &ngx_http_geo_header, sizeof(ngx_http_geo_header_t));
 
-    p = ngx_http_geo_copy_values(fm.addr, p, ctx->rbtree.root,
+    p = ngx_http_geo_copy_values(base, p, ctx->rbtree.root,
                                  ctx->rbtree.sentinel);
 
+    vv = (ngx_http_variable_value_t *) p;
+    ngx_memzero(vv, sizeof(ngx_http_variable_value_t));
+
     p += sizeof(ngx_http_variable_value_t);
 
-    ranges = (ngx_http_geo_range_t **) p;
+    low = (uint32_t *) p;
+    ctx->high.low = low;
 
-    p += 0x10000 * sizeof(ngx_http_geo_range_t *);
+    p += 0x10000 * sizeof(uint32_t);
 
     for (i = 0; i < 0x10000; i++) {
-        r = ctx->high.low[i];
-        if (r == NULL) {
+        a = ctx->low[i];
+
+        if (a == NULL || a->nelts == 0) {
+            low[i] = 0;
             continue;
         }
 
-        range = (ngx_http_geo_range_t *) p;
-        ranges[i] = (ngx_http_geo_range_t *) (p - (u_char *) fm.addr);
+        low[i] = (uint32_t) (p - base);
+
+        *(uint32_t *) p = (uint32_t) a->nelts;
+        range = (ngx_http_geo_base_range_t *) (p + sizeof(uint32_t));
+
+        r = a->elts;
 
-        do {
-            s.len = r->value->len;
-            s.data = r->value->data;
+        for (n = 0; n < a->nelts; n++) {
+            s.len = r[n].value->len;
+            s.data = r[n].value->data;
             hash = ngx_crc32_long(s.data, s.len);
             gvvn = (ngx_http_geo_variable_value_node_t *)
                         ngx_str_rbtree_lookup(&ctx->rbtree, &s, hash);
 
-            range->value = (ngx_http_variable_value_t *) gvvn->offset;
-            range->start = r->start;
-            range->end = r->end;
-            range++;
+            range[n].value = (uint32_t) gvvn->offset;
+            range[n].start = r[n].start;
+            range[n].end = r[n].end;
+        }
 
-        } while ((++r)->value);
+        p = (u_char *) &range[n];
+    }
+}
 
-        range->value = NULL;
 
-        p = (u_char *) range + sizeof(void *);
-    }
+static void
+ngx_http_geo_create_binary_base(ngx_http_geo_conf_ctx_t *ctx)
+{
+    u_char                 *name;
+    ngx_file_mapping_t      fm;
+    ngx_http_geo_header_t  *header;
 
-    header = fm.addr;
-    header->crc32 = ngx_crc32_long((u_char *) fm.addr
+    header = (ngx_http_geo_header_t *) ctx->high.base;
+    header->crc32 = ngx_crc32_long(ctx->high.base
                                        + sizeof(ngx_http_geo_header_t),
-                                   fm.size - sizeof(ngx_http_geo_header_t));
+                                   ctx->data_size
+                                       - sizeof(ngx_http_geo_header_t));
+
+    name = ngx_pnalloc(ctx->temp_pool, ctx->include_name.len + 5);
+    if (name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(name, "%V.bin%Z", &ctx->include_name);
+
+    /*
+     * the base is written to a temporary file which is then renamed,
+     * as the old base may still be mapped by running processes
+     */
+
+    fm.name = ngx_pnalloc(ctx->temp_pool, ctx->include_name.len + 10);
+    if (fm.name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(fm.name, "%V.bin.tmp%Z", &ctx->include_name);
+
+    fm.size = ctx->data_size;
+    fm.log = ctx->pool->log;
+
+    ngx_log_error(NGX_LOG_NOTICE, fm.log, 0,
+                  "creating binary geo range base \"%s\"", name);
+
+    if (ngx_create_file_mapping(&fm) != NGX_OK) {
+        return;
+    }
+
+    ngx_memcpy(fm.addr, ctx->high.base, fm.size);
 
     ngx_close_file_mapping(&fm);
+
+    if (ngx_rename_file(fm.name, name) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, fm.log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      fm.name, name);
+
+        if (ngx_delete_file(fm.name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, fm.log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", fm.name);
+        }
+    }
 }
 
 
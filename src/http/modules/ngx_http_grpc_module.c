@@ -10,14 +10,6 @@
 #include <ngx_http.h>
 
 
-typedef struct {
-    ngx_array_t               *flushes;
-    ngx_array_t               *lengths;
-    ngx_array_t               *values;
-    ngx_hash_t                 hash;
-} ngx_http_grpc_headers_t;
-
-
 typedef struct {
     ngx_http_upstream_conf_t   upstream;
 
@@ -76,6 +68,10 @@ typedef struct {
 
     ngx_http_grpc_conn_t      *connection;
 
+    ngx_http_grpc_headers_t   *headers;
+    ngx_str_t                 *host;
+    ngx_str_t                 *path;
+
     ngx_uint_t                 id;
 
     ngx_uint_t                 pings;
@@ -515,9 +511,7 @@ static ngx_http_variable_t  ngx_http_grpc_vars[] = {
 static ngx_int_t
 ngx_http_grpc_handler(ngx_http_request_t *r)
 {
-    ngx_int_t                  rc;
     ngx_http_upstream_t       *u;
-    ngx_http_grpc_ctx_t       *ctx;
     ngx_http_grpc_loc_conf_t  *glcf;
 
     if (ngx_http_upstream_create(r) != NGX_OK) {
@@ -541,10 +535,26 @@ ngx_http_grpc_handler(ngx_http_request_t *r)
     ngx_str_set(&u->schema, "grpc://");
 #endif
 
-    u->output.tag = (ngx_buf_tag_t) &ngx_http_grpc_module;
-
     u->conf = &glcf->upstream;
 
+    return ngx_http_grpc_upstream_init(r, &glcf->headers,
+                                       glcf->host_set ? NULL : &glcf->host,
+                                       NULL);
+}
+
+
+ngx_int_t
+ngx_http_grpc_upstream_init(ngx_http_request_t *r,
+    ngx_http_grpc_headers_t *headers, ngx_str_t *host, ngx_str_t *path)
+{
+    ngx_int_t             rc;
+    ngx_http_upstream_t  *u;
+    ngx_http_grpc_ctx_t  *ctx;
+
+    u = r->upstream;
+
+    u->output.tag = (ngx_buf_tag_t) &ngx_http_grpc_module;
+
     u->create_request = ngx_http_grpc_create_request;
     u->reinit_request = ngx_http_grpc_reinit_request;
     u->process_header = ngx_http_grpc_process_header;
@@ -557,6 +567,9 @@ ngx_http_grpc_handler(ngx_http_request_t *r)
     }
 
     ctx->request = r;
+    ctx->headers = headers;
+    ctx->host = host;
+    ctx->path = path;
 
     ngx_http_set_ctx(r, ctx, ngx_http_grpc_module);
 
@@ -589,14 +602,16 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
     ngx_table_elt_t              *header;
     ngx_http_upstream_t          *u;
     ngx_http_grpc_frame_t        *f;
+    ngx_http_grpc_ctx_t          *ctx;
     ngx_http_script_code_pt       code;
-    ngx_http_grpc_loc_conf_t     *glcf;
+    ngx_http_grpc_headers_t      *headers;
     ngx_http_script_engine_t      e, le;
     ngx_http_script_len_code_pt   lcode;
 
     u = r->upstream;
 
-    glcf = ngx_http_get_module_loc_conf(r, ngx_http_grpc_module);
+    ctx = ngx_http_get_module_ctx(r, ngx_http_grpc_module);
+    headers = ctx->headers;
 
     len = sizeof(ngx_http_grpc_connection_start) - 1
           + sizeof(ngx_http_grpc_frame_t);             /* headers frame */
@@ -618,7 +633,11 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
 
     /* :path header */
 
-    if (r->valid_unparsed_uri) {
+    if (ctx->path) {
+        escape = 0;
+        uri_len = ctx->path->len;
+
+    } else if (r->valid_unparsed_uri) {
         escape = 0;
         uri_len = r->unparsed_uri.len;
 
@@ -636,20 +655,20 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
 
     /* :authority header */
 
-    if (!glcf->host_set) {
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + glcf->host.len;
+    if (ctx->host) {
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + ctx->host->len;
 
-        if (tmp_len < glcf->host.len) {
-            tmp_len = glcf->host.len;
+        if (tmp_len < ctx->host->len) {
+            tmp_len = ctx->host->len;
         }
     }
 
     /* other headers */
 
-    ngx_http_script_flush_no_cacheable_variables(r, glcf->headers.flushes);
+    ngx_http_script_flush_no_cacheable_variables(r, headers->flushes);
     ngx_memzero(&le, sizeof(ngx_http_script_engine_t));
 
-    le.ip = glcf->headers.lengths->elts;
+    le.ip = headers->lengths->elts;
     le.request = r;
     le.flushed = 1;
 
@@ -679,7 +698,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
         }
     }
 
-    if (glcf->upstream.pass_request_headers) {
+    if (u->conf->pass_request_headers) {
         part = &r->headers_in.headers.part;
         header = part->elts;
 
@@ -695,7 +714,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
                 i = 0;
             }
 
-            if (ngx_hash_find(&glcf->headers.hash, header[i].hash,
+            if (ngx_hash_find(&headers->hash, header[i].hash,
                               header[i].lowcase_key, header[i].key.len))
             {
                 continue;
@@ -785,7 +804,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
     }
 
 #if (NGX_HTTP_SSL)
-    if (glcf->ssl) {
+    if (u->ssl) {
         *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTPS_INDEX);
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -799,7 +818,15 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
                        "grpc header: \":scheme: http\"");
     }
 
-    if (r->valid_unparsed_uri) {
+    if (ctx->path) {
+        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_PATH_INDEX);
+        b->last = ngx_http_v2_write_value(b->last, ctx->path->data,
+                                          ctx->path->len, tmp);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "grpc header: \":path: %V\"", ctx->path);
+
+    } else if (r->valid_unparsed_uri) {
 
         if (r->unparsed_uri.len == 1 && r->unparsed_uri.data[0] == '/') {
             *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_PATH_ROOT_INDEX);
@@ -844,22 +871,22 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
                        "grpc header: \":path: %V\"", &r->uri);
     }
 
-    if (!glcf->host_set) {
+    if (ctx->host) {
         *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_AUTHORITY_INDEX);
-        b->last = ngx_http_v2_write_value(b->last, glcf->host.data,
-                                          glcf->host.len, tmp);
+        b->last = ngx_http_v2_write_value(b->last, ctx->host->data,
+                                          ctx->host->len, tmp);
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "grpc header: \":authority: %V\"", &glcf->host);
+                       "grpc header: \":authority: %V\"", ctx->host);
     }
 
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
 
-    e.ip = glcf->headers.values->elts;
+    e.ip = headers->values->elts;
     e.request = r;
     e.flushed = 1;
 
-    le.ip = glcf->headers.lengths->elts;
+    le.ip = headers->lengths->elts;
 
     while (*(uintptr_t *) le.ip) {
 
@@ -915,7 +942,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
 #endif
     }
 
-    if (glcf->upstream.pass_request_headers) {
+    if (u->conf->pass_request_headers) {
         part = &r->headers_in.headers.part;
         header = part->elts;
 
@@ -931,7 +958,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
                 i = 0;
             }
 
-            if (ngx_hash_find(&glcf->headers.hash, header[i].hash,
+            if (ngx_hash_find(&headers->hash, header[i].hash,
                               header[i].lowcase_key, header[i].key.len))
             {
                 continue;
@@ -8,64 +8,133 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 #include <zlib.h>
 
 
+#define NGX_HTTP_GZIP_LOAD_TICK    100
+#define NGX_HTTP_GZIP_LOAD_TICKS   10
+#define NGX_HTTP_GZIP_LOAD_SHIFT   8
+
+
 typedef struct {
-    ngx_flag_t           enable;
-    ngx_flag_t           no_buffer;
+    ngx_rbtree_node_t    node;
+    ngx_queue_t          queue;
 
-    ngx_hash_t           types;
+    u_char               key[NGX_HTTP_CACHE_KEY_LEN];
 
-    ngx_bufs_t           bufs;
+    size_t               len;
+    size_t               zin;
+    u_char              *data;
 
-    size_t               postpone_gzipping;
-    ngx_int_t            level;
-    size_t               wbits;
-    size_t               memlevel;
-    ssize_t              min_length;
+    unsigned             count:24;
+    unsigned             close:1;
+} ngx_http_gzip_cached_t;
+
+
+typedef struct {
+    ngx_rbtree_t         rbtree;
+    ngx_rbtree_node_t    sentinel;
+    ngx_queue_t          queue;
+
+    ngx_uint_t           current;
+    ngx_uint_t           max;
+    size_t               max_length;
+} ngx_http_gzip_cache_t;
 
-    ngx_array_t         *types_keys;
-} ngx_http_gzip_conf_t;
+
+typedef struct {
+    ngx_flag_t           adaptive;
+    ngx_msec_t           latency;
+    ngx_uint_t           cpu;
+} ngx_http_gzip_main_conf_t;
 
 
 typedef struct {
-    ngx_chain_t         *in;
-    ngx_chain_t         *free;
-    ngx_chain_t         *busy;
-    ngx_chain_t         *out;
-    ngx_chain_t        **last_out;
+    ngx_flag_t             enable;
+    ngx_flag_t             no_buffer;
 
-    ngx_chain_t         *copied;
-    ngx_chain_t         *copy_buf;
+    ngx_hash_t             types;
 
-    ngx_buf_t           *in_buf;
-    ngx_buf_t           *out_buf;
-    ngx_int_t            bufs;
+    ngx_bufs_t             bufs;
 
-    void                *preallocated;
-    char                *free_mem;
-    ngx_uint_t           allocated;
+    size_t                 postpone_gzipping;
+    ngx_int_t              level;
+    ngx_int_t              min_level;
+    size_t                 wbits;
+    size_t                 memlevel;
+    ssize_t                min_length;
 
-    int                  wbits;
-    int                  memlevel;
+    ngx_http_gzip_cache_t *cache;
 
-    unsigned             flush:4;
-    unsigned             redo:1;
-    unsigned             done:1;
-    unsigned             nomem:1;
-    unsigned             buffering:1;
-    unsigned             intel:1;
+#if (NGX_THREADS)
+    ngx_thread_pool_t     *thread_pool;
+#endif
+
+    ngx_array_t           *types_keys;
+} ngx_http_gzip_conf_t;
 
-    size_t               zin;
-    size_t               zout;
 
-    z_stream             zstream;
-    ngx_http_request_t  *request;
+typedef struct {
+    ngx_chain_t            *in;
+    ngx_chain_t            *free;
+    ngx_chain_t            *busy;
+    ngx_chain_t            *out;
+    ngx_chain_t           **last_out;
+
+    ngx_chain_t            *copied;
+    ngx_chain_t            *copy_buf;
+
+    ngx_buf_t              *in_buf;
+    ngx_buf_t              *out_buf;
+    ngx_int_t               bufs;
+
+    void                   *preallocated;
+    char                   *free_mem;
+    ngx_uint_t              allocated;
+
+    int                     wbits;
+    int                     memlevel;
+    int                     level;
+
+    unsigned                flush:4;
+    unsigned                redo:1;
+    unsigned                done:1;
+    unsigned                nomem:1;
+    unsigned                buffering:1;
+    unsigned                intel:1;
+    unsigned                threaded:1;
+    unsigned                deflated:1;
+
+    size_t                  zin;
+    size_t                  zout;
+
+    ngx_http_gzip_cached_t *cached;
+    ngx_buf_t              *stored;
+    u_char                  key[NGX_HTTP_CACHE_KEY_LEN];
+
+    z_stream                zstream;
+    ngx_http_request_t     *request;
+
+#if (NGX_THREADS)
+    ngx_thread_task_t      *thread_task;
+#endif
 } ngx_http_gzip_ctx_t;
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    z_stream            *zstream;
+    int                  flush;
+    int                  rc;
+} ngx_http_gzip_thread_ctx_t;
+
+#endif
+
+
+static ngx_int_t ngx_http_gzip_filter_enabled(ngx_http_request_t *r);
 static void ngx_http_gzip_filter_memory(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 static ngx_int_t ngx_http_gzip_filter_buffer(ngx_http_gzip_ctx_t *ctx,
@@ -80,6 +149,12 @@ static ngx_int_t ngx_http_gzip_filter_deflate(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 static ngx_int_t ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_gzip_filter_thread_post(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_thread_pool_t *tp);
+static void ngx_http_gzip_filter_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_gzip_filter_thread_event_handler(ngx_event_t *ev);
+#endif
 
 static void *ngx_http_gzip_filter_alloc(void *opaque, u_int items,
     u_int size);
@@ -87,16 +162,44 @@ static void ngx_http_gzip_filter_free(void *opaque, void *address);
 static void ngx_http_gzip_filter_free_copy_buf(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 
+static ngx_int_t ngx_http_gzip_cache_lookup(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_http_gzip_cache_t *cache);
+static ngx_http_gzip_cached_t *ngx_http_gzip_cache_find(
+    ngx_http_gzip_cache_t *cache, u_char *key);
+static ngx_int_t ngx_http_gzip_cache_send(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_chain_t *in);
+static void ngx_http_gzip_cache_append(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_chain_t *in);
+static void ngx_http_gzip_cache_insert(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+static void ngx_http_gzip_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static void ngx_http_gzip_cache_cleanup(void *data);
+static void ngx_http_gzip_cache_free(void *data);
+
+static void ngx_http_gzip_load_handler(ngx_event_t *ev);
+static ngx_uint_t ngx_http_gzip_load_cpu(void);
+
 static ngx_int_t ngx_http_gzip_add_variables(ngx_conf_t *cf);
 static ngx_int_t ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 
 static ngx_int_t ngx_http_gzip_filter_init(ngx_conf_t *cf);
+static void *ngx_http_gzip_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_gzip_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_gzip_create_conf(ngx_conf_t *cf);
 static char *ngx_http_gzip_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static char *ngx_http_gzip_window(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data);
+static char *ngx_http_gzip_threads(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_gzip_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_gzip_load_adaptive(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+static ngx_int_t ngx_http_gzip_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_conf_num_bounds_t  ngx_http_gzip_comp_level_bounds = {
@@ -138,6 +241,20 @@ static ngx_command_t  ngx_http_gzip_filter_commands[] = {
       offsetof(ngx_http_gzip_conf_t, level),
       &ngx_http_gzip_comp_level_bounds },
 
+    { ngx_string("gzip_min_comp_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_conf_t, min_level),
+      &ngx_http_gzip_comp_level_bounds },
+
+    { ngx_string("gzip_load_adaptive"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_gzip_load_adaptive,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("gzip_window"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -173,6 +290,20 @@ static ngx_command_t  ngx_http_gzip_filter_commands[] = {
       offsetof(ngx_http_gzip_conf_t, min_length),
       NULL },
 
+    { ngx_string("gzip_threads"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_gzip_threads,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("gzip_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_gzip_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -181,8 +312,8 @@ static ngx_http_module_t  ngx_http_gzip_filter_module_ctx = {
     ngx_http_gzip_add_variables,           /* preconfiguration */
     ngx_http_gzip_filter_init,             /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_http_gzip_create_main_conf,        /* create main configuration */
+    ngx_http_gzip_init_main_conf,          /* init main configuration */
 
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
@@ -199,7 +330,7 @@ ngx_module_t  ngx_http_gzip_filter_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_gzip_init_process,            /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -215,6 +346,14 @@ static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 
 static ngx_uint_t  ngx_http_gzip_assume_intel;
 
+static ngx_event_t  ngx_http_gzip_load_event;
+static ngx_uint_t   ngx_http_gzip_load_shift;
+static ngx_uint_t   ngx_http_gzip_load_ticks;
+static ngx_msec_t   ngx_http_gzip_load_lag;
+static ngx_msec_t   ngx_http_gzip_load_expires;
+static ngx_msec_t   ngx_http_gzip_load_used;
+static ngx_msec_t   ngx_http_gzip_load_time;
+
 
 static ngx_int_t
 ngx_http_gzip_header_filter(ngx_http_request_t *r)
@@ -223,22 +362,12 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
     ngx_http_gzip_ctx_t   *ctx;
     ngx_http_gzip_conf_t  *conf;
 
-    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
-
-    if (!conf->enable
-        || (r->headers_out.status != NGX_HTTP_OK
-            && r->headers_out.status != NGX_HTTP_FORBIDDEN
-            && r->headers_out.status != NGX_HTTP_NOT_FOUND)
-        || (r->headers_out.content_encoding
-            && r->headers_out.content_encoding->value.len)
-        || (r->headers_out.content_length_n != -1
-            && r->headers_out.content_length_n < conf->min_length)
-        || ngx_http_test_content_type(r, &conf->types) == NULL
-        || r->header_only)
-    {
+    if (ngx_http_gzip_filter_enabled(r) != NGX_OK) {
         return ngx_http_next_header_filter(r);
     }
 
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
     r->gzip_vary = 1;
 
 #if (NGX_HTTP_DEGRADATION)
@@ -253,12 +382,7 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
     }
 #endif
 
-    if (!r->gzip_tested) {
-        if (ngx_http_gzip_ok(r) != NGX_OK) {
-            return ngx_http_next_header_filter(r);
-        }
-
-    } else if (!r->gzip_ok) {
+    if (ngx_http_encoding_ok(r, NGX_HTTP_ENCODING_GZIP, 0) != NGX_OK) {
         return ngx_http_next_header_filter(r);
     }
 
@@ -272,8 +396,25 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
     ctx->request = r;
     ctx->buffering = (conf->postpone_gzipping != 0);
 
+    /* under load the level is lowered down to gzip_min_comp_level */
+
+    ctx->level = (int) (conf->level - (ngx_int_t) ngx_http_gzip_load_shift);
+
+    if (ctx->level < conf->min_level) {
+        ctx->level = (int) ngx_min(conf->min_level, conf->level);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip level: %d", ctx->level);
+
     ngx_http_gzip_filter_memory(r, ctx);
 
+    if (conf->cache
+        && ngx_http_gzip_cache_lookup(r, ctx, conf->cache) == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
     h = ngx_list_push(&r->headers_out.headers);
     if (h == NULL) {
         return NGX_ERROR;
@@ -284,16 +425,46 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
     ngx_str_set(&h->value, "gzip");
     r->headers_out.content_encoding = h;
 
-    r->main_filter_need_in_memory = 1;
-
     ngx_http_clear_content_length(r);
     ngx_http_clear_accept_ranges(r);
     ngx_http_weak_etag(r);
 
+    if (ctx->cached) {
+        r->headers_out.content_length_n = ctx->cached->len;
+
+    } else {
+        r->main_filter_need_in_memory = 1;
+    }
+
     return ngx_http_next_header_filter(r);
 }
 
 
+static ngx_int_t
+ngx_http_gzip_filter_enabled(ngx_http_request_t *r)
+{
+    ngx_http_gzip_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
+    if (!conf->enable
+        || (r->headers_out.status != NGX_HTTP_OK
+            && r->headers_out.status != NGX_HTTP_FORBIDDEN
+            && r->headers_out.status != NGX_HTTP_NOT_FOUND)
+        || (r->headers_out.content_encoding
+            && r->headers_out.content_encoding->value.len)
+        || (r->headers_out.content_length_n != -1
+            && r->headers_out.content_length_n < conf->min_length)
+        || ngx_http_test_content_type(r, &conf->types) == NULL
+        || r->header_only)
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
@@ -311,6 +482,10 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http gzip filter");
 
+    if (ctx->cached) {
+        return ngx_http_gzip_cache_send(r, ctx, in);
+    }
+
     if (ctx->buffering) {
 
         /*
@@ -355,6 +530,13 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         r->connection->buffered |= NGX_HTTP_GZIP_BUFFERED;
     }
 
+    if (ctx->threaded) {
+
+        /* deflate() is running in a thread, the input waits in ctx->in */
+
+        return NGX_AGAIN;
+    }
+
     if (ctx->nomem) {
 
         /* flush busy buffers */
@@ -382,6 +564,12 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
             /* cycle while there is data to feed zlib and ... */
 
+#if (NGX_THREADS)
+            if (ctx->deflated) {
+                goto deflate;
+            }
+#endif
+
             rc = ngx_http_gzip_filter_add_data(r, ctx);
 
             if (rc == NGX_DECLINED) {
@@ -405,10 +593,13 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                 goto failed;
             }
 
+#if (NGX_THREADS)
+        deflate:
+#endif
 
             rc = ngx_http_gzip_filter_deflate(r, ctx);
 
-            if (rc == NGX_OK) {
+            if (rc == NGX_OK || rc == NGX_BUSY) {
                 break;
             }
 
@@ -422,7 +613,15 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         if (ctx->out == NULL && !flush) {
             ngx_http_gzip_filter_free_copy_buf(r, ctx);
 
-            return ctx->busy ? NGX_AGAIN : NGX_OK;
+            return (ctx->busy || ctx->threaded) ? NGX_AGAIN : NGX_OK;
+        }
+
+        if (ctx->stored) {
+            ngx_http_gzip_cache_append(r, ctx, ctx->out);
+
+            if (ctx->done && ctx->stored) {
+                ngx_http_gzip_cache_insert(r, ctx);
+            }
         }
 
         rc = ngx_http_next_body_filter(r, ctx->out);
@@ -443,6 +642,10 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         if (ctx->done) {
             return rc;
         }
+
+        if (ctx->threaded) {
+            return NGX_AGAIN;
+        }
     }
 
     /* unreachable */
@@ -515,7 +718,7 @@ ngx_http_gzip_filter_memory(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
          * 16-byte padding in one out of the two window-sized buffers.
          */
 
-        if (conf->level == 1) {
+        if (ctx->level == 1) {
             wbits = ngx_max(wbits, 13);
         }
 
@@ -599,10 +802,7 @@ static ngx_int_t
 ngx_http_gzip_filter_deflate_start(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx)
 {
-    int                    rc;
-    ngx_http_gzip_conf_t  *conf;
-
-    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+    int  rc;
 
     ctx->preallocated = ngx_palloc(r->pool, ctx->allocated);
     if (ctx->preallocated == NULL) {
@@ -615,7 +815,7 @@ ngx_http_gzip_filter_deflate_start(ngx_http_request_t *r,
     ctx->zstream.zfree = ngx_http_gzip_filter_free;
     ctx->zstream.opaque = ctx;
 
-    rc = deflateInit2(&ctx->zstream, (int) conf->level, Z_DEFLATED,
+    rc = deflateInit2(&ctx->zstream, ctx->level, Z_DEFLATED,
                       ctx->wbits + 16, ctx->memlevel, Z_DEFAULT_STRATEGY);
 
     if (rc != Z_OK) {
@@ -744,14 +944,45 @@ ngx_http_gzip_filter_deflate(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
     ngx_chain_t           *cl;
     ngx_http_gzip_conf_t  *conf;
 
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
+#if (NGX_THREADS)
+
+    if (ctx->deflated) {
+        ctx->deflated = 0;
+
+        rc = ((ngx_http_gzip_thread_ctx_t *) ctx->thread_task->ctx)->rc;
+        goto deflated;
+    }
+
+#endif
+
     ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                  "deflate in: ni:%p no:%p ai:%ud ao:%ud fl:%d redo:%d",
                  ctx->zstream.next_in, ctx->zstream.next_out,
                  ctx->zstream.avail_in, ctx->zstream.avail_out,
                  ctx->flush, ctx->redo);
 
+#if (NGX_THREADS)
+
+    if (conf->thread_pool) {
+        if (ngx_http_gzip_filter_thread_post(r, ctx, conf->thread_pool)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        return NGX_BUSY;
+    }
+
+#endif
+
     rc = deflate(&ctx->zstream, ctx->flush);
 
+#if (NGX_THREADS)
+deflated:
+#endif
+
     if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
         ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
                       "deflate() failed: %d, %d", ctx->flush, rc);
@@ -842,8 +1073,6 @@ ngx_http_gzip_filter_deflate(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
         return NGX_OK;
     }
 
-    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
-
     if (conf->no_buffer && ctx->in == NULL) {
 
         cl = ngx_alloc_chain_link(r->pool);
@@ -913,6 +1142,96 @@ ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
 }
 
 
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_gzip_filter_thread_post(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_thread_pool_t *tp)
+{
+    ngx_thread_task_t           *task;
+    ngx_http_gzip_thread_ctx_t  *tctx;
+
+    task = ctx->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(r->pool,
+                                     sizeof(ngx_http_gzip_thread_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_http_gzip_filter_thread_handler;
+
+        ctx->thread_task = task;
+    }
+
+    tctx = task->ctx;
+
+    tctx->zstream = &ctx->zstream;
+    tctx->flush = ctx->flush;
+
+    task->event.data = r;
+    task->event.handler = ngx_http_gzip_filter_thread_event_handler;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    ctx->threaded = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gzip_filter_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_gzip_thread_ctx_t *ctx = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "gzip deflate thread");
+
+    ctx->rc = deflate(ctx->zstream, ctx->flush);
+}
+
+
+static void
+ngx_http_gzip_filter_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t     *c;
+    ngx_http_request_t   *r;
+    ngx_http_gzip_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http gzip thread: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gzip_filter_module);
+
+    ctx->threaded = 0;
+    ctx->deflated = 1;
+
+    if (r->done) {
+        c->write->handler(c->write);
+
+    } else {
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+#endif
+
+
 static void *
 ngx_http_gzip_filter_alloc(void *opaque, u_int items, u_int size)
 {
@@ -987,91 +1306,575 @@ ngx_http_gzip_filter_free_copy_buf(ngx_http_request_t *r,
 
 
 static ngx_int_t
-ngx_http_gzip_add_variables(ngx_conf_t *cf)
+ngx_http_gzip_cache_lookup(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_http_gzip_cache_t *cache)
 {
-    ngx_http_variable_t  *var;
+    u_char                  *last;
+    size_t                   root;
+    ngx_str_t                path;
+    ngx_md5_t                md5;
+    ngx_pool_cleanup_t      *cln;
+    ngx_http_gzip_cached_t  *gc;
 
-    var = ngx_http_add_variable(cf, &ngx_http_gzip_ratio, NGX_HTTP_VAR_NOHASH);
-    if (var == NULL) {
+    /*
+     * only static files are cached: the compressed copy is identified
+     * by the file name, its modification time and size, and the gzip
+     * parameters used
+     */
+
+    if (r->upstream
+        || r->headers_out.last_modified_time == -1
+        || r->headers_out.content_length_n < 0
+        || r->headers_out.content_length_n > (off_t) cache->max_length)
+    {
+        return NGX_DECLINED;
+    }
+
+    last = ngx_http_map_uri_to_path(r, &path, &root, 0);
+    if (last == NULL) {
         return NGX_ERROR;
     }
 
-    var->get_handler = ngx_http_gzip_ratio_variable;
+    path.len = last - path.data;
 
-    return NGX_OK;
-}
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, &path.len, sizeof(size_t));
+    ngx_md5_update(&md5, path.data, path.len);
+    ngx_md5_update(&md5, r->args.data, r->args.len);
+    ngx_md5_update(&md5, &r->headers_out.last_modified_time, sizeof(time_t));
+    ngx_md5_update(&md5, &r->headers_out.content_length_n, sizeof(off_t));
+    ngx_md5_update(&md5, &ctx->level, sizeof(int));
+    ngx_md5_update(&md5, &ctx->wbits, sizeof(int));
+    ngx_md5_update(&md5, &ctx->memlevel, sizeof(int));
+    ngx_md5_final(ctx->key, &md5);
 
+    gc = ngx_http_gzip_cache_find(cache, ctx->key);
 
-static ngx_int_t
-ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    ngx_uint_t            zint, zfrac;
-    ngx_http_gzip_ctx_t  *ctx;
+    if (gc == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "gzip cache miss: \"%V\"", &path);
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_gzip_filter_module);
+        ctx->stored = ngx_create_temp_buf(r->pool,
+                               (size_t) r->headers_out.content_length_n + 32);
+        if (ctx->stored == NULL) {
+            return NGX_ERROR;
+        }
 
-    if (ctx == NULL || ctx->zout == 0) {
-        v->not_found = 1;
-        return NGX_OK;
+        return NGX_DECLINED;
     }
 
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip cache hit: \"%V\" %uz", &path, gc->len);
 
-    v->data = ngx_pnalloc(r->pool, NGX_INT32_LEN + 3);
-    if (v->data == NULL) {
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
         return NGX_ERROR;
     }
 
-    zint = (ngx_uint_t) (ctx->zin / ctx->zout);
-    zfrac = (ngx_uint_t) ((ctx->zin * 100 / ctx->zout) % 100);
-
-    if ((ctx->zin * 1000 / ctx->zout) % 10 > 4) {
-
-        /* the rounding, e.g., 2.125 to 2.13 */
+    cln->handler = ngx_http_gzip_cache_cleanup;
+    cln->data = gc;
 
-        zfrac++;
+    gc->count++;
 
-        if (zfrac > 99) {
-            zint++;
-            zfrac = 0;
-        }
-    }
+    ngx_queue_remove(&gc->queue);
+    ngx_queue_insert_head(&cache->queue, &gc->queue);
 
-    v->len = ngx_sprintf(v->data, "%ui.%02ui", zint, zfrac) - v->data;
+    ctx->cached = gc;
+    ctx->zin = gc->zin;
+    ctx->zout = gc->len;
 
     return NGX_OK;
 }
 
 
-static void *
-ngx_http_gzip_create_conf(ngx_conf_t *cf)
+static ngx_http_gzip_cached_t *
+ngx_http_gzip_cache_find(ngx_http_gzip_cache_t *cache, u_char *key)
 {
-    ngx_http_gzip_conf_t  *conf;
+    ngx_int_t                rc;
+    ngx_rbtree_key_t         node_key;
+    ngx_rbtree_node_t       *node, *sentinel;
+    ngx_http_gzip_cached_t  *gc;
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_conf_t));
-    if (conf == NULL) {
-        return NULL;
-    }
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
-    /*
-     * set by ngx_pcalloc():
-     *
-     *     conf->bufs.num = 0;
-     *     conf->types = { NULL };
-     *     conf->types_keys = NULL;
-     */
+    node = cache->rbtree.root;
+    sentinel = cache->rbtree.sentinel;
 
-    conf->enable = NGX_CONF_UNSET;
-    conf->no_buffer = NGX_CONF_UNSET;
+    while (node != sentinel) {
 
-    conf->postpone_gzipping = NGX_CONF_UNSET_SIZE;
-    conf->level = NGX_CONF_UNSET;
-    conf->wbits = NGX_CONF_UNSET_SIZE;
-    conf->memlevel = NGX_CONF_UNSET_SIZE;
-    conf->min_length = NGX_CONF_UNSET;
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        gc = (ngx_http_gzip_cached_t *) node;
+
+        rc = ngx_memcmp(key, gc->key, NGX_HTTP_CACHE_KEY_LEN);
+
+        if (rc == 0) {
+            return gc;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_send(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    ngx_buf_t    *b;
+    ngx_uint_t    last;
+    ngx_chain_t   out;
+
+    /* the file data are not needed, the compressed copy is sent instead */
+
+    last = 0;
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        b->pos = b->last;
+
+        if (b->in_file) {
+            b->file_pos = b->file_last;
+        }
+
+        if (b->last_buf) {
+            last = 1;
+        }
+    }
+
+    if (!last) {
+        return NGX_OK;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = ctx->cached->data;
+    b->last = b->pos + ctx->cached->len;
+    b->memory = 1;
+    b->last_buf = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    ctx->done = 1;
+
+    return ngx_http_next_body_filter(r, &out);
+}
+
+
+static void
+ngx_http_gzip_cache_append(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    size_t      size;
+    ngx_buf_t  *b, *buf;
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+        buf = ctx->stored;
+
+        size = b->last - b->pos;
+
+        if (size > (size_t) (buf->end - buf->last)) {
+
+            /* incompressible data */
+
+            ctx->stored = ngx_create_temp_buf(r->pool,
+                                            2 * (buf->end - buf->start) + size);
+            if (ctx->stored == NULL) {
+                return;
+            }
+
+            ctx->stored->last = ngx_cpymem(ctx->stored->pos, buf->pos,
+                                           buf->last - buf->pos);
+
+            ngx_pfree(r->pool, buf->start);
+
+            buf = ctx->stored;
+        }
+
+        buf->last = ngx_cpymem(buf->last, b->pos, size);
+    }
+}
+
+
+static void
+ngx_http_gzip_cache_insert(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
+{
+    size_t                   size;
+    ngx_queue_t             *q;
+    ngx_http_gzip_conf_t    *conf;
+    ngx_http_gzip_cache_t   *cache;
+    ngx_http_gzip_cached_t  *gc;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
+    cache = conf->cache;
+
+    if (ngx_http_gzip_cache_find(cache, ctx->key)) {
+
+        /* another request has already stored the same copy */
+
+        return;
+    }
+
+    if (cache->current >= cache->max) {
+
+        /* remove the least recently used copy */
+
+        q = ngx_queue_last(&cache->queue);
+        gc = ngx_queue_data(q, ngx_http_gzip_cached_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->rbtree, &gc->node);
+        cache->current--;
+
+        if (gc->count) {
+            gc->close = 1;
+
+        } else {
+            ngx_free(gc);
+        }
+    }
+
+    size = ctx->stored->last - ctx->stored->pos;
+
+    gc = ngx_alloc(sizeof(ngx_http_gzip_cached_t) + size,
+                   r->connection->log);
+    if (gc == NULL) {
+        return;
+    }
+
+    ngx_memcpy((u_char *) &gc->node.key, ctx->key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(gc->key, ctx->key, NGX_HTTP_CACHE_KEY_LEN);
+
+    gc->data = (u_char *) gc + sizeof(ngx_http_gzip_cached_t);
+    gc->len = size;
+    gc->zin = ctx->zin;
+    gc->count = 0;
+    gc->close = 0;
+
+    ngx_memcpy(gc->data, ctx->stored->pos, size);
+
+    ngx_rbtree_insert(&cache->rbtree, &gc->node);
+    ngx_queue_insert_head(&cache->queue, &gc->queue);
+    cache->current++;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip cache store: %uz", size);
+}
+
+
+static void
+ngx_http_gzip_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t       **p;
+    ngx_http_gzip_cached_t   *gc, *gct;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            gc = (ngx_http_gzip_cached_t *) node;
+            gct = (ngx_http_gzip_cached_t *) temp;
+
+            p = (ngx_memcmp(gc->key, gct->key, NGX_HTTP_CACHE_KEY_LEN) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static void
+ngx_http_gzip_cache_cleanup(void *data)
+{
+    ngx_http_gzip_cached_t *gc = data;
+
+    gc->count--;
+
+    if (gc->count == 0 && gc->close) {
+        ngx_free(gc);
+    }
+}
+
+
+static void
+ngx_http_gzip_cache_free(void *data)
+{
+    ngx_http_gzip_cache_t *cache = data;
+
+    ngx_queue_t             *q;
+    ngx_http_gzip_cached_t  *gc;
+
+    while (!ngx_queue_empty(&cache->queue)) {
+        q = ngx_queue_head(&cache->queue);
+        gc = ngx_queue_data(q, ngx_http_gzip_cached_t, queue);
+
+        ngx_queue_remove(q);
+
+        ngx_free(gc);
+    }
+}
+
+
+static void
+ngx_http_gzip_load_handler(ngx_event_t *ev)
+{
+    ngx_msec_t                  lag;
+    ngx_uint_t                  cpu, shift;
+    ngx_http_gzip_main_conf_t  *gmcf;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    /* the timer fires late by the time the event loop was busy */
+
+    lag = ngx_current_msec - ngx_http_gzip_load_expires;
+
+    if ((ngx_msec_int_t) lag > 0 && lag > ngx_http_gzip_load_lag) {
+        ngx_http_gzip_load_lag = lag;
+    }
+
+    if (++ngx_http_gzip_load_ticks < NGX_HTTP_GZIP_LOAD_TICKS) {
+        goto next;
+    }
+
+    gmcf = ev->data;
+
+    lag = ngx_http_gzip_load_lag;
+    cpu = ngx_http_gzip_load_cpu();
+
+    ngx_http_gzip_load_lag = 0;
+    ngx_http_gzip_load_ticks = 0;
+
+    shift = ngx_http_gzip_load_shift;
+
+    if ((gmcf->latency && lag >= gmcf->latency)
+        || (gmcf->cpu && cpu >= gmcf->cpu))
+    {
+        if (shift < NGX_HTTP_GZIP_LOAD_SHIFT) {
+            shift++;
+        }
+
+    } else if ((gmcf->latency == 0 || lag < gmcf->latency / 2)
+               && (gmcf->cpu == 0 || cpu < gmcf->cpu / 2))
+    {
+        if (shift) {
+            shift--;
+        }
+    }
+
+    if (shift != ngx_http_gzip_load_shift) {
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                       "gzip load lag:%M cpu:%ui%%, level shift: %ui",
+                       lag, cpu, shift);
+
+        ngx_http_gzip_load_shift = shift;
+    }
+
+next:
+
+    ngx_http_gzip_load_expires = ngx_current_msec + NGX_HTTP_GZIP_LOAD_TICK;
+    ngx_add_timer(ev, NGX_HTTP_GZIP_LOAD_TICK);
+}
+
+
+static ngx_uint_t
+ngx_http_gzip_load_cpu(void)
+{
+#if !(NGX_WIN32)
+    ngx_msec_t     used, elapsed;
+    ngx_uint_t     cpu;
+    struct rusage  ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1) {
+        return 0;
+    }
+
+    used = ru.ru_utime.tv_sec * 1000 + ru.ru_utime.tv_usec / 1000
+           + ru.ru_stime.tv_sec * 1000 + ru.ru_stime.tv_usec / 1000;
+
+    elapsed = ngx_current_msec - ngx_http_gzip_load_time;
+
+    cpu = elapsed ? (used - ngx_http_gzip_load_used) * 100 / elapsed : 0;
+
+    ngx_http_gzip_load_used = used;
+    ngx_http_gzip_load_time = ngx_current_msec;
+
+    return cpu;
+#else
+    return 0;
+#endif
+}
+
+
+static ngx_int_t
+ngx_http_gzip_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var;
+
+    ngx_http_share_loc_conf(cf, &ngx_http_gzip_filter_module);
+
+    var = ngx_http_add_variable(cf, &ngx_http_gzip_ratio, NGX_HTTP_VAR_NOHASH);
+    if (var == NULL) {
+        return NGX_ERROR;
+    }
+
+    var->get_handler = ngx_http_gzip_ratio_variable;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_uint_t            zint, zfrac;
+    ngx_http_gzip_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gzip_filter_module);
+
+    if (ctx == NULL || ctx->zout == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    v->data = ngx_pnalloc(r->pool, NGX_INT32_LEN + 3);
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    zint = (ngx_uint_t) (ctx->zin / ctx->zout);
+    zfrac = (ngx_uint_t) ((ctx->zin * 100 / ctx->zout) % 100);
+
+    if ((ctx->zin * 1000 / ctx->zout) % 10 > 4) {
+
+        /* the rounding, e.g., 2.125 to 2.13 */
+
+        zfrac++;
+
+        if (zfrac > 99) {
+            zint++;
+            zfrac = 0;
+        }
+    }
+
+    v->len = ngx_sprintf(v->data, "%ui.%02ui", zint, zfrac) - v->data;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_gzip_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_gzip_main_conf_t  *gmcf;
+
+    gmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_main_conf_t));
+    if (gmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     gmcf->latency = 0;
+     *     gmcf->cpu = 0;
+     */
+
+    gmcf->adaptive = NGX_CONF_UNSET;
+
+    return gmcf;
+}
+
+
+static char *
+ngx_http_gzip_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_gzip_main_conf_t *gmcf = conf;
+
+    ngx_conf_init_value(gmcf->adaptive, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+static void *
+ngx_http_gzip_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_gzip_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->bufs.num = 0;
+     *     conf->types = { NULL };
+     *     conf->types_keys = NULL;
+     */
+
+    conf->enable = NGX_CONF_UNSET;
+    conf->no_buffer = NGX_CONF_UNSET;
+
+    conf->postpone_gzipping = NGX_CONF_UNSET_SIZE;
+    conf->level = NGX_CONF_UNSET;
+    conf->min_level = NGX_CONF_UNSET;
+    conf->wbits = NGX_CONF_UNSET_SIZE;
+    conf->memlevel = NGX_CONF_UNSET_SIZE;
+    conf->min_length = NGX_CONF_UNSET;
+
+    conf->cache = NGX_CONF_UNSET_PTR;
+
+#if (NGX_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
 
     return conf;
 }
@@ -1092,11 +1895,18 @@ ngx_http_gzip_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->postpone_gzipping, prev->postpone_gzipping,
                               0);
     ngx_conf_merge_value(conf->level, prev->level, 1);
+    ngx_conf_merge_value(conf->min_level, prev->min_level, 1);
     ngx_conf_merge_size_value(conf->wbits, prev->wbits, MAX_WBITS);
     ngx_conf_merge_size_value(conf->memlevel, prev->memlevel,
                               MAX_MEM_LEVEL - 1);
     ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
 
+    ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
+
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
     if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
                              &prev->types_keys, &prev->types,
                              ngx_http_html_default_types)
@@ -1112,6 +1922,13 @@ ngx_http_gzip_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 static ngx_int_t
 ngx_http_gzip_filter_init(ngx_conf_t *cf)
 {
+    if (ngx_http_encoding_add(cf, NGX_HTTP_ENCODING_GZIP, 0,
+                              ngx_http_gzip_filter_enabled)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
     ngx_http_next_header_filter = ngx_http_top_header_filter;
     ngx_http_top_header_filter = ngx_http_gzip_header_filter;
 
@@ -1168,3 +1985,265 @@ ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data)
 
     return "must be 512, 1k, 2k, 4k, 8k, 16k, 32k, 64k, or 128k";
 }
+
+
+static char *
+ngx_http_gzip_threads(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_THREADS)
+    ngx_http_gzip_conf_t *gcf = conf;
+
+    ngx_str_t  name;
+#endif
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+#if (NGX_THREADS)
+    if (gcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+#endif
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+#if (NGX_THREADS)
+        gcf->thread_pool = NULL;
+#endif
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "threads", 7) == 0
+        && (value[1].len == 7 || value[1].data[7] == '='))
+    {
+#if (NGX_THREADS)
+        name.len = value[1].len > 8 ? value[1].len - 8 : 0;
+        name.data = value[1].data + 8;
+
+        gcf->thread_pool = ngx_thread_pool_add(cf, name.len ? &name : NULL);
+        if (gcf->thread_pool == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"gzip_threads\" is unsupported "
+                           "on this platform");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid value \"%V\"", &value[1]);
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_gzip_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_conf_t *gcf = conf;
+
+    ssize_t                 max_length;
+    ngx_int_t               max;
+    ngx_str_t              *value, s;
+    ngx_uint_t              i;
+    ngx_pool_cleanup_t     *cln;
+    ngx_http_gzip_cache_t  *cache;
+
+    if (gcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    max = 0;
+    max_length = 16384;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            max = ngx_atoi(value[i].data + 4, value[i].len - 4);
+            if (max <= 0) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_length=", 11) == 0) {
+
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            max_length = ngx_parse_size(&s);
+            if (max_length == NGX_ERROR) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "off") == 0) {
+
+            gcf->cache = NULL;
+
+            continue;
+        }
+
+    failed:
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid \"gzip_cache\" parameter \"%V\"",
+                           &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (gcf->cache == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    if (max == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"gzip_cache\" must have the \"max\" parameter");
+        return NGX_CONF_ERROR;
+    }
+
+    cache = ngx_palloc(cf->pool, sizeof(ngx_http_gzip_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_http_gzip_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->queue);
+
+    cache->current = 0;
+    cache->max = max;
+    cache->max_length = max_length;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_gzip_cache_free;
+    cln->data = cache;
+
+    gcf->cache = cache;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gzip_load_adaptive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_main_conf_t *gmcf = conf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_uint_t   i;
+
+    if (gmcf->adaptive != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 2 && ngx_strcmp(value[1].data, "off") == 0) {
+        gmcf->adaptive = 0;
+        return NGX_CONF_OK;
+    }
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "latency=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            gmcf->latency = ngx_parse_time(&s, 0);
+            if (gmcf->latency == (ngx_msec_t) NGX_ERROR
+                || gmcf->latency == 0)
+            {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "cpu=", 4) == 0) {
+
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
+
+            if (s.len && s.data[s.len - 1] == '%') {
+                s.len--;
+            }
+
+            n = ngx_atoi(s.data, s.len);
+            if (n <= 0) {
+                goto failed;
+            }
+
+            gmcf->cpu = n;
+
+            continue;
+        }
+
+    failed:
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid \"gzip_load_adaptive\" parameter \"%V\"",
+                           &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (gmcf->latency == 0 && gmcf->cpu == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"gzip_load_adaptive\" must have "
+                           "the \"latency\" or \"cpu\" parameter");
+        return NGX_CONF_ERROR;
+    }
+
+    gmcf->adaptive = 1;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_init_process(ngx_cycle_t *cycle)
+{
+    ngx_event_t                *ev;
+    ngx_http_gzip_main_conf_t  *gmcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    gmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_gzip_filter_module);
+    if (gmcf == NULL || !gmcf->adaptive) {
+        return NGX_OK;
+    }
+
+    (void) ngx_http_gzip_load_cpu();
+
+    ev = &ngx_http_gzip_load_event;
+
+    ev->handler = ngx_http_gzip_load_handler;
+    ev->data = gmcf;
+    ev->log = cycle->log;
+    ev->cancelable = 1;
+
+    ngx_http_gzip_load_expires = ngx_current_msec + NGX_HTTP_GZIP_LOAD_TICK;
+    ngx_add_timer(ev, NGX_HTTP_GZIP_LOAD_TICK);
+
+    return NGX_OK;
+}
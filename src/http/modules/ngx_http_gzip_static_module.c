@@ -8,23 +8,93 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
+
+#if (NGX_ZLIB)
+#include <zlib.h>
+#endif
 
 
 #define NGX_HTTP_GZIP_STATIC_OFF     0
 #define NGX_HTTP_GZIP_STATIC_ON      1
 #define NGX_HTTP_GZIP_STATIC_ALWAYS  2
 
+#define NGX_HTTP_GZIP_STATIC_JOBS    64
+#define NGX_HTTP_GZIP_STATIC_BUFFER  32768
+
 
 typedef struct {
-    ngx_uint_t  enable;
+    ngx_path_t                     *path;
+    ngx_int_t                       level;
+    off_t                           min_length;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t              *thread_pool;
+#endif
+
+    ngx_queue_t                     jobs;
+    ngx_uint_t                      njobs;
+} ngx_http_gzip_static_cache_t;
+
+
+typedef struct {
+    ngx_uint_t                      enable;
+
+    ngx_http_gzip_static_cache_t   *cache;
+
+    ngx_hash_t                      types;
+    ngx_array_t                    *types_keys;
 } ngx_http_gzip_static_conf_t;
 
 
+#if (NGX_ZLIB)
+
+typedef struct {
+    ngx_queue_t                     queue;
+    ngx_http_gzip_static_cache_t   *cache;
+
+    u_char                          key[NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_str_t                       name;
+    ngx_str_t                       temp;
+    ngx_str_t                       file;
+
+    time_t                          mtime;
+    off_t                           size;
+
+    ngx_err_t                       err;
+    char                           *failed;
+
+#if (NGX_THREADS)
+    ngx_thread_task_t               task;
+#endif
+} ngx_http_gzip_static_job_t;
+
+#endif
+
+
 static ngx_int_t ngx_http_gzip_static_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_gzip_static_send(ngx_http_request_t *r,
+    ngx_str_t *path, ngx_open_file_info_t *of);
+#if (NGX_ZLIB)
+static ngx_int_t ngx_http_gzip_static_cached(ngx_http_request_t *r,
+    ngx_str_t *name, ngx_int_t ok);
+static ngx_int_t ngx_http_gzip_static_test(ngx_open_file_info_t *of,
+    ngx_open_file_info_t *gof, ngx_str_t *path, ngx_log_t *log);
+static ngx_int_t ngx_http_gzip_static_generate(ngx_http_request_t *r,
+    ngx_http_gzip_static_cache_t *cache, u_char *key, ngx_str_t *name,
+    ngx_str_t *file, ngx_open_file_info_t *of);
+static void ngx_http_gzip_static_compress(void *data, ngx_log_t *log);
+static void ngx_http_gzip_static_compress_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_gzip_static_done(ngx_http_gzip_static_job_t *job);
+#endif
+static ngx_int_t ngx_http_gzip_static_enabled(ngx_http_request_t *r);
 static void *ngx_http_gzip_static_create_conf(ngx_conf_t *cf);
 static char *ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
 static ngx_int_t ngx_http_gzip_static_init(ngx_conf_t *cf);
+static char *ngx_http_gzip_static_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_conf_enum_t  ngx_http_gzip_static[] = {
@@ -44,6 +114,20 @@ static ngx_command_t  ngx_http_gzip_static_commands[] = {
       offsetof(ngx_http_gzip_static_conf_t, enable),
       &ngx_http_gzip_static },
 
+    { ngx_string("gzip_static_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_gzip_static_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("gzip_static_cache_types"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_types_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_static_conf_t, types_keys),
+      &ngx_http_html_default_types[0] },
+
       ngx_null_command
 };
 
@@ -88,9 +172,6 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
     ngx_int_t                     rc;
     ngx_uint_t                    level;
     ngx_log_t                    *log;
-    ngx_buf_t                    *b;
-    ngx_chain_t                   out;
-    ngx_table_elt_t              *h;
     ngx_open_file_info_t          of;
     ngx_http_core_loc_conf_t     *clcf;
     ngx_http_gzip_static_conf_t  *gzcf;
@@ -110,7 +191,7 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
     }
 
     if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
-        rc = ngx_http_gzip_ok(r);
+        rc = ngx_http_encoding_ok(r, NGX_HTTP_ENCODING_GZIP, 1);
 
     } else {
         /* always */
@@ -165,6 +246,15 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
         case NGX_ENOTDIR:
         case NGX_ENAMETOOLONG:
 
+#if (NGX_ZLIB)
+            if (gzcf->cache) {
+                path.len -= sizeof(".gz") - 1;
+                path.data[path.len] = '\0';
+
+                return ngx_http_gzip_static_cached(r, &path, rc);
+            }
+#endif
+
             return NGX_DECLINED;
 
         case NGX_EACCES:
@@ -196,18 +286,34 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
         }
     }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "http static fd: %d", of.fd);
+    return ngx_http_gzip_static_send(r, &path, &of);
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_send(ngx_http_request_t *r, ngx_str_t *path,
+    ngx_open_file_info_t *of)
+{
+    ngx_int_t         rc;
+    ngx_log_t        *log;
+    ngx_buf_t        *b;
+    ngx_chain_t       out;
+    ngx_table_elt_t  *h;
 
-    if (of.is_dir) {
+    log = r->connection->log;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "http static fd: %d", of->fd);
+
+    if (of->is_dir) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "http dir");
         return NGX_DECLINED;
     }
 
 #if !(NGX_WIN32) /* the not regular files are probably Unix specific */
 
-    if (!of.is_file) {
+    if (!of->is_file) {
         ngx_log_error(NGX_LOG_CRIT, log, 0,
-                      "\"%s\" is not a regular file", path.data);
+                      "\"%s\" is not a regular file", path->data);
 
         return NGX_HTTP_NOT_FOUND;
     }
@@ -225,10 +331,10 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
     log->action = "sending response to client";
 
     r->headers_out.status = NGX_HTTP_OK;
-    r->headers_out.content_length_n = of.size;
-    r->headers_out.last_modified_time = of.mtime;
+    r->headers_out.content_length_n = of->size;
+    r->headers_out.last_modified_time = of->mtime;
 
-    if (ngx_http_set_etag(r) != NGX_OK) {
+    if (ngx_http_set_file_etag(r, of) != NGX_OK) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
@@ -265,16 +371,16 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
     }
 
     b->file_pos = 0;
-    b->file_last = of.size;
+    b->file_last = of->size;
 
     b->in_file = b->file_last ? 1 : 0;
     b->last_buf = (r == r->main) ? 1 : 0;
     b->last_in_chain = 1;
 
-    b->file->fd = of.fd;
-    b->file->name = path;
+    b->file->fd = of->fd;
+    b->file->name = *path;
     b->file->log = log;
-    b->file->directio = of.is_directio;
+    b->file->directio = of->is_directio;
 
     out.buf = b;
     out.next = NULL;
@@ -283,17 +389,482 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 }
 
 
+#if (NGX_ZLIB)
+
+static ngx_int_t
+ngx_http_gzip_static_cached(ngx_http_request_t *r, ngx_str_t *name,
+    ngx_int_t ok)
+{
+    u_char                        *p;
+    ngx_md5_t                      md5;
+    ngx_str_t                      file;
+    ngx_uint_t                     generated;
+    ngx_open_file_info_t           of, gof;
+    ngx_http_core_loc_conf_t      *clcf;
+    ngx_http_gzip_static_conf_t   *gzcf;
+    ngx_http_gzip_static_cache_t  *cache;
+    u_char                         key[NGX_HTTP_CACHE_KEY_LEN];
+
+    gzcf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_static_module);
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    cache = gzcf->cache;
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = clcf->directio;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, name, &of) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* errors are left to the static module */
+
+    if (ngx_open_cached_file(clcf->open_file_cache, name, &of, r->pool)
+        != NGX_OK
+        || !of.is_file
+        || of.size < cache->min_length)
+    {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_set_content_type(r) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_http_test_content_type(r, &gzcf->types) == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
+        r->gzip_vary = 1;
+
+        if (ok != NGX_OK) {
+            return NGX_DECLINED;
+        }
+    }
+
+    /* the compressed copy is stored under the MD5 hash of the file name */
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, name->data, name->len);
+    ngx_md5_final(key, &md5);
+
+    file.len = cache->path->name.len + 1 + cache->path->len
+               + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    file.data = ngx_pnalloc(r->pool, file.len + 1);
+    if (file.data == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    p = ngx_cpymem(file.data, cache->path->name.data, cache->path->name.len);
+    p += 1 + cache->path->len;
+    p = ngx_hex_dump(p, key, NGX_HTTP_CACHE_KEY_LEN);
+    *p = '\0';
+
+    ngx_create_hashed_filename(cache->path, file.data, file.len);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http gzip static cache: \"%s\"", file.data);
+
+    generated = 0;
+
+    for ( ;; ) {
+
+        ngx_memzero(&gof, sizeof(ngx_open_file_info_t));
+
+        gof.read_ahead = clcf->read_ahead;
+        gof.directio = clcf->directio;
+        gof.valid = clcf->open_file_cache_valid;
+        gof.min_uses = clcf->open_file_cache_min_uses;
+        gof.events = clcf->open_file_cache_events;
+
+        if (ngx_open_cached_file(clcf->open_file_cache, &file, &gof, r->pool)
+            == NGX_OK
+            && ngx_http_gzip_static_test(&of, &gof, &file, r->connection->log)
+               == NGX_OK)
+        {
+            r->root_tested = !r->error_page;
+
+            return ngx_http_gzip_static_send(r, &file, &gof);
+        }
+
+        if (generated) {
+            return NGX_DECLINED;
+        }
+
+        switch (ngx_http_gzip_static_generate(r, cache, key, name, &file,
+                                              &of))
+        {
+        case NGX_OK:
+
+            /* compressed synchronously, try once more */
+
+            generated = 1;
+            continue;
+
+        case NGX_ERROR:
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+        default: /* NGX_DECLINED */
+
+            /* compression is in progress in a thread */
+
+            return NGX_DECLINED;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_test(ngx_open_file_info_t *of, ngx_open_file_info_t *gof,
+    ngx_str_t *path, ngx_log_t *log)
+{
+    u_char      buf[4];
+    ssize_t     n;
+    uint32_t    isize;
+    ngx_file_t  file;
+
+    /*
+     * the copy gets the modification time of the original file,
+     * and the gzip trailer keeps the original size modulo 2^32
+     */
+
+    if (gof->mtime != of->mtime || !gof->is_file || gof->size < 18) {
+        return NGX_DECLINED;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.fd = gof->fd;
+    file.name = *path;
+    file.log = log;
+
+    n = ngx_read_file(&file, buf, 4, gof->size - 4);
+
+    if (n != 4) {
+        return NGX_DECLINED;
+    }
+
+    isize = (uint32_t) buf[0] | (uint32_t) buf[1] << 8
+            | (uint32_t) buf[2] << 16 | (uint32_t) buf[3] << 24;
+
+    if (isize != (uint32_t) of->size) {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_generate(ngx_http_request_t *r,
+    ngx_http_gzip_static_cache_t *cache, u_char *key, ngx_str_t *name,
+    ngx_str_t *file, ngx_open_file_info_t *of)
+{
+    u_char                      *p;
+    ngx_queue_t                 *q;
+    ngx_http_gzip_static_job_t  *job;
+
+    static ngx_uint_t            seq;
+
+    for (q = ngx_queue_head(&cache->jobs);
+         q != ngx_queue_sentinel(&cache->jobs);
+         q = ngx_queue_next(q))
+    {
+        job = ngx_queue_data(q, ngx_http_gzip_static_job_t, queue);
+
+        if (ngx_memcmp(job->key, key, NGX_HTTP_CACHE_KEY_LEN) == 0) {
+            return NGX_DECLINED;
+        }
+    }
+
+    if (cache->njobs >= NGX_HTTP_GZIP_STATIC_JOBS) {
+        return NGX_DECLINED;
+    }
+
+    job = ngx_alloc(sizeof(ngx_http_gzip_static_job_t)
+                    + name->len + 1 + 2 * (file->len + 1) + 2 * NGX_INT_T_LEN,
+                    r->connection->log);
+    if (job == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(job, sizeof(ngx_http_gzip_static_job_t));
+
+    job->cache = cache;
+    ngx_memcpy(job->key, key, NGX_HTTP_CACHE_KEY_LEN);
+
+    job->mtime = of->mtime;
+    job->size = of->size;
+
+    p = (u_char *) job + sizeof(ngx_http_gzip_static_job_t);
+
+    job->name.data = p;
+    job->name.len = name->len;
+    p = ngx_cpymem(p, name->data, name->len + 1);
+
+    job->file.data = p;
+    job->file.len = file->len;
+    p = ngx_cpymem(p, file->data, file->len + 1);
+
+    /* the temporary file is created next to the cache levels */
+
+    job->temp.data = p;
+    p = ngx_cpymem(p, cache->path->name.data, cache->path->name.len);
+    *p++ = '/';
+    p = ngx_cpymem(p, file->data + file->len - 2 * NGX_HTTP_CACHE_KEY_LEN,
+                   2 * NGX_HTTP_CACHE_KEY_LEN);
+    p = ngx_sprintf(p, ".%P.%ui", ngx_pid, seq++);
+    job->temp.len = p - job->temp.data;
+    *p = '\0';
+
+    ngx_queue_insert_tail(&cache->jobs, &job->queue);
+    cache->njobs++;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http gzip static compress: \"%s\"", job->temp.data);
+
+#if (NGX_THREADS)
+
+    if (cache->thread_pool) {
+        job->task.ctx = job;
+        job->task.handler = ngx_http_gzip_static_compress;
+        job->task.event.data = job;
+        job->task.event.handler = ngx_http_gzip_static_compress_handler;
+        job->task.event.log = ngx_cycle->log;
+
+        if (ngx_thread_task_post(cache->thread_pool, &job->task) != NGX_OK) {
+            ngx_queue_remove(&job->queue);
+            cache->njobs--;
+
+            ngx_free(job);
+            return NGX_ERROR;
+        }
+
+        return NGX_DECLINED;
+    }
+
+#endif
+
+    ngx_http_gzip_static_compress(job, r->connection->log);
+
+    return ngx_http_gzip_static_done(job);
+}
+
+
+static void
+ngx_http_gzip_static_compress(void *data, ngx_log_t *log)
+{
+    ngx_http_gzip_static_job_t *job = data;
+
+    int              rc, flush;
+    ssize_t          n;
+    ngx_fd_t         fd, tfd;
+    z_stream         zstream;
+    ngx_file_info_t  fi;
+    u_char           in[NGX_HTTP_GZIP_STATIC_BUFFER];
+    u_char           out[NGX_HTTP_GZIP_STATIC_BUFFER];
+
+    /* runs in a thread: only the job is used and nothing is logged */
+
+    fd = ngx_open_file(job->name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        job->err = ngx_errno;
+        job->failed = ngx_open_file_n;
+        return;
+    }
+
+    tfd = ngx_open_file(job->temp.data, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                        NGX_FILE_OWNER_ACCESS);
+
+    if (tfd == NGX_INVALID_FILE) {
+        job->err = ngx_errno;
+        job->failed = ngx_open_file_n;
+        (void) ngx_close_file(fd);
+        return;
+    }
+
+    ngx_memzero(&zstream, sizeof(z_stream));
+
+    if (deflateInit2(&zstream, (int) job->cache->level, Z_DEFLATED,
+                     MAX_WBITS + 16, MAX_MEM_LEVEL - 1, Z_DEFAULT_STRATEGY)
+        != Z_OK)
+    {
+        job->failed = "deflateInit2()";
+        goto failed;
+    }
+
+    do {
+        n = ngx_read_fd(fd, in, NGX_HTTP_GZIP_STATIC_BUFFER);
+
+        if (n == -1) {
+            job->err = ngx_errno;
+            job->failed = ngx_read_fd_n;
+            break;
+        }
+
+        zstream.next_in = in;
+        zstream.avail_in = n;
+
+        flush = (n == 0) ? Z_FINISH : Z_NO_FLUSH;
+
+        do {
+            zstream.next_out = out;
+            zstream.avail_out = NGX_HTTP_GZIP_STATIC_BUFFER;
+
+            rc = deflate(&zstream, flush);
+
+            if (rc == Z_STREAM_ERROR) {
+                job->failed = "deflate()";
+                break;
+            }
+
+            n = NGX_HTTP_GZIP_STATIC_BUFFER - zstream.avail_out;
+
+            if (n && ngx_write_fd(tfd, out, n) != n) {
+                job->err = ngx_errno;
+                job->failed = ngx_write_fd_n;
+                break;
+            }
+
+        } while (zstream.avail_out == 0);
+
+    } while (flush != Z_FINISH && job->failed == NULL);
+
+    deflateEnd(&zstream);
+
+    if (job->failed) {
+        goto failed;
+    }
+
+    /* the file might be changed while it was compressed */
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        job->err = ngx_errno;
+        job->failed = ngx_fd_info_n;
+        goto failed;
+    }
+
+    if (ngx_file_mtime(&fi) != job->mtime
+        || ngx_file_size(&fi) != job->size
+        || (off_t) zstream.total_in != job->size)
+    {
+        job->failed = "file changed";
+        goto failed;
+    }
+
+    (void) ngx_close_file(fd);
+
+    if (ngx_close_file(tfd) == NGX_FILE_ERROR) {
+        job->err = ngx_errno;
+        job->failed = ngx_close_file_n;
+    }
+
+    return;
+
+failed:
+
+    (void) ngx_close_file(fd);
+    (void) ngx_close_file(tfd);
+}
+
+
+static void
+ngx_http_gzip_static_compress_handler(ngx_event_t *ev)
+{
+    (void) ngx_http_gzip_static_done(ev->data);
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_done(ngx_http_gzip_static_job_t *job)
+{
+    ngx_int_t              rc;
+    ngx_uint_t             level;
+    ngx_ext_rename_file_t  ext;
+
+    job->cache->njobs--;
+    ngx_queue_remove(&job->queue);
+
+    if (job->failed) {
+        level = job->err ? NGX_LOG_CRIT : NGX_LOG_ERR;
+
+        ngx_log_error(level, ngx_cycle->log, job->err,
+                      "%s \"%s\" failed while compressing \"%s\"",
+                      job->failed, job->temp.data, job->name.data);
+
+        if (ngx_delete_file(job->temp.data) == NGX_FILE_ERROR
+            && ngx_errno != NGX_ENOENT)
+        {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed",
+                          job->temp.data);
+        }
+
+        ngx_free(job);
+        return NGX_DECLINED;
+    }
+
+    ext.access = NGX_FILE_OWNER_ACCESS;
+    ext.path_access = NGX_FILE_OWNER_ACCESS;
+    ext.time = job->mtime;
+    ext.create_path = 1;
+    ext.delete_file = 1;
+    ext.fd = NGX_INVALID_FILE;
+    ext.log = ngx_cycle->log;
+
+    rc = ngx_ext_rename_file(&job->temp, &job->file, &ext);
+
+    ngx_free(job);
+
+    return (rc == NGX_OK) ? NGX_OK : NGX_DECLINED;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_gzip_static_enabled(ngx_http_request_t *r)
+{
+    ngx_http_gzip_static_conf_t  *gzcf;
+
+    gzcf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_static_module);
+
+    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_OFF) {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
 {
     ngx_http_gzip_static_conf_t  *conf;
 
-    conf = ngx_palloc(cf->pool, sizeof(ngx_http_gzip_static_conf_t));
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_static_conf_t));
     if (conf == NULL) {
         return NULL;
     }
 
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->types = { NULL };
+     *     conf->types_keys = NULL;
+     */
+
     conf->enable = NGX_CONF_UNSET_UINT;
+    conf->cache = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -308,6 +879,16 @@ ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->enable, prev->enable,
                               NGX_HTTP_GZIP_STATIC_OFF);
 
+    ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
+
+    if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
+                             &prev->types_keys, &prev->types,
+                             ngx_http_html_default_types)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -318,6 +899,13 @@ ngx_http_gzip_static_init(ngx_conf_t *cf)
     ngx_http_handler_pt        *h;
     ngx_http_core_main_conf_t  *cmcf;
 
+    if (ngx_http_encoding_add(cf, NGX_HTTP_ENCODING_GZIP, 1,
+                              ngx_http_gzip_static_enabled)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
 
     h = ngx_array_push(&cmcf->phases[NGX_HTTP_CONTENT_PHASE].handlers);
@@ -329,3 +917,178 @@ ngx_http_gzip_static_init(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+static char *
+ngx_http_gzip_static_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_static_conf_t *gzcf = conf;
+
+#if (NGX_ZLIB)
+    u_char                        *p, *last;
+    ssize_t                        size;
+    ngx_str_t                     *value, s;
+    ngx_int_t                      level;
+    ngx_uint_t                     i, n;
+    ngx_http_gzip_static_cache_t  *cache;
+#endif
+
+    if (gzcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+#if (NGX_ZLIB)
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "has invalid parameters";
+        }
+
+        gzcf->cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_static_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+    if (cache->path == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->path->name = value[1];
+
+    if (cache->path->name.data[cache->path->name.len - 1] == '/') {
+        cache->path->name.len--;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, &cache->path->name, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->level = 6;
+    cache->min_length = 20;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "levels=", 7) == 0) {
+
+            p = value[i].data + 7;
+            last = value[i].data + value[i].len;
+
+            for (n = 0; n < NGX_MAX_PATH_LEVEL && p < last; n++) {
+
+                if (*p > '0' && *p < '3') {
+
+                    cache->path->level[n] = *p++ - '0';
+                    cache->path->len += cache->path->level[n] + 1;
+
+                    if (p == last) {
+                        break;
+                    }
+
+                    if (*p++ == ':' && n < NGX_MAX_PATH_LEVEL - 1 && p < last) {
+                        continue;
+                    }
+
+                    goto invalid_levels;
+                }
+
+                goto invalid_levels;
+            }
+
+            if (cache->path->len < 10 + NGX_MAX_PATH_LEVEL) {
+                continue;
+            }
+
+        invalid_levels:
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid \"levels\" \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_strncmp(value[i].data, "comp_level=", 11) == 0) {
+
+            level = ngx_atoi(value[i].data + 11, value[i].len - 11);
+
+            if (level < 1 || level > 9) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid compression level \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            cache->level = level;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "min_length=", 11) == 0) {
+
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            size = ngx_parse_size(&s);
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid min_length \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            cache->min_length = size;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "threads", 7) == 0
+            && (value[i].len == 7 || value[i].data[7] == '='))
+        {
+#if (NGX_THREADS)
+            s.len = value[i].len > 8 ? value[i].len - 8 : 0;
+            s.data = value[i].data + 8;
+
+            cache->thread_pool = ngx_thread_pool_add(cf, s.len ? &s : NULL);
+            if (cache->thread_pool == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"threads\" is unsupported on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    cache->path->conf_file = cf->conf_file->file.name.data;
+    cache->path->line = cf->conf_file->line;
+
+    if (ngx_add_path(cf, &cache->path) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_queue_init(&cache->jobs);
+
+    gzcf->cache = cache;
+
+    return NGX_CONF_OK;
+
+#else
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "nginx was built without zlib support");
+    return NGX_CONF_ERROR;
+
+#endif
+}
@@ -49,6 +49,11 @@ typedef struct {
     ngx_http_complex_value_t  *expires_value;
     ngx_array_t               *headers;
     ngx_array_t               *trailers;
+
+    /* the static headers, for all statuses and with "always" only */
+    ngx_http_header_block_t   *block;
+    ngx_http_header_block_t   *always_block;
+    ngx_uint_t                 compiled;  /* unsigned  compiled:1 */
 } ngx_http_headers_conf_t;
 
 
@@ -68,6 +73,13 @@ static ngx_int_t ngx_http_set_response_header(ngx_http_request_t *r,
 static void *ngx_http_headers_create_conf(ngx_conf_t *cf);
 static char *ngx_http_headers_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_int_t ngx_http_headers_compile(ngx_conf_t *cf,
+    ngx_http_headers_conf_t *conf);
+static ngx_uint_t ngx_http_headers_static(ngx_array_t *headers,
+    ngx_http_header_val_t *hv);
+static ngx_int_t ngx_http_headers_block(ngx_conf_t *cf,
+    ngx_array_t *headers, ngx_uint_t always, ngx_http_header_block_t **bp);
+static ngx_int_t ngx_http_headers_preconfiguration(ngx_conf_t *cf);
 static ngx_int_t ngx_http_headers_filter_init(ngx_conf_t *cf);
 static char *ngx_http_headers_expires(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -128,7 +140,7 @@ static ngx_command_t  ngx_http_headers_filter_commands[] = {
 
 
 static ngx_http_module_t  ngx_http_headers_filter_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_headers_preconfiguration,     /* preconfiguration */
     ngx_http_headers_filter_init,          /* postconfiguration */
 
     NULL,                                  /* create main configuration */
@@ -178,6 +190,7 @@ ngx_http_headers_filter(ngx_http_request_t *r)
 
     if (conf->expires == NGX_HTTP_EXPIRES_OFF
         && conf->headers == NULL
+        && conf->block == NULL
         && conf->trailers == NULL)
     {
         return ngx_http_next_header_filter(r);
@@ -227,6 +240,9 @@ ngx_http_headers_filter(ngx_http_request_t *r)
         }
     }
 
+    r->headers_out.header_block = safe_status ? conf->block
+                                              : conf->always_block;
+
     if (conf->trailers) {
         h = conf->trailers->elts;
         for (i = 0; i < conf->trailers->nelts; i++) {
@@ -667,6 +683,9 @@ ngx_http_headers_create_conf(ngx_conf_t *cf)
      *
      *     conf->headers = NULL;
      *     conf->trailers = NULL;
+     *     conf->block = NULL;
+     *     conf->always_block = NULL;
+     *     conf->compiled = 0;
      *     conf->expires_time = 0;
      *     conf->expires_value = NULL;
      */
@@ -694,7 +713,20 @@ ngx_http_headers_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     }
 
     if (conf->headers == NULL) {
+
+        /* the http level is not merged, see ngx_http_share_loc_conf() */
+
+        if (ngx_http_headers_compile(cf, prev) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
         conf->headers = prev->headers;
+        conf->block = prev->block;
+        conf->always_block = prev->always_block;
+        conf->compiled = 1;
+
+    } else if (ngx_http_headers_compile(cf, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
     }
 
     if (conf->trailers == NULL) {
@@ -705,9 +737,204 @@ ngx_http_headers_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 }
 
 
+/*
+ * the headers with static values are serialized once into blocks sent
+ * as a whole, only those with variables are added per request
+ */
+
+static ngx_int_t
+ngx_http_headers_compile(ngx_conf_t *cf, ngx_http_headers_conf_t *conf)
+{
+    ngx_uint_t              i;
+    ngx_array_t            *headers;
+    ngx_http_header_val_t  *h, *hv;
+
+    if (conf->compiled) {
+        return NGX_OK;
+    }
+
+    conf->compiled = 1;
+
+    if (conf->headers == NULL) {
+        return NGX_OK;
+    }
+
+    headers = ngx_array_create(cf->pool, conf->headers->nelts,
+                               sizeof(ngx_http_header_val_t));
+    if (headers == NULL) {
+        return NGX_ERROR;
+    }
+
+    h = conf->headers->elts;
+    for (i = 0; i < conf->headers->nelts; i++) {
+
+        if (ngx_http_headers_static(conf->headers, &h[i])) {
+            continue;
+        }
+
+        hv = ngx_array_push(headers);
+        if (hv == NULL) {
+            return NGX_ERROR;
+        }
+
+        *hv = h[i];
+    }
+
+    if (headers->nelts == conf->headers->nelts) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_headers_block(cf, conf->headers, 0, &conf->block)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_headers_block(cf, conf->headers, 1, &conf->always_block)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    conf->headers = headers->nelts ? headers : NULL;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_headers_static(ngx_array_t *headers, ngx_http_header_val_t *hv)
+{
+    ngx_uint_t              i;
+    ngx_http_header_val_t  *h;
+
+    if (hv->handler != ngx_http_add_header || hv->value.lengths) {
+        return 0;
+    }
+
+    /* the order of the headers with the same name is preserved */
+
+    h = headers->elts;
+    for (i = 0; i < headers->nelts; i++) {
+
+        if (h[i].handler == ngx_http_add_header && h[i].value.lengths == NULL) {
+            continue;
+        }
+
+        if (h[i].key.len == hv->key.len
+            && ngx_strncasecmp(h[i].key.data, hv->key.data, hv->key.len) == 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+static ngx_int_t
+ngx_http_headers_block(ngx_conf_t *cf, ngx_array_t *headers,
+    ngx_uint_t always, ngx_http_header_block_t **bp)
+{
+    u_char                   *p;
+    ngx_uint_t                i, n;
+    ngx_table_elt_t          *t;
+    ngx_http_header_val_t    *h;
+    ngx_http_header_block_t  *block;
+
+    block = ngx_pcalloc(cf->pool, sizeof(ngx_http_header_block_t));
+    if (block == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+
+    h = headers->elts;
+    for (i = 0; i < headers->nelts; i++) {
+
+        if (!ngx_http_headers_static(headers, &h[i])
+            || h[i].value.value.len == 0
+            || (always && !h[i].always))
+        {
+            continue;
+        }
+
+        block->data.len += h[i].key.len + sizeof(": ") - 1
+                           + h[i].value.value.len + sizeof(CRLF) - 1;
+        block->size += h[i].key.len + h[i].value.value.len;
+        block->max = ngx_max(block->max, h[i].key.len);
+        block->max = ngx_max(block->max, h[i].value.value.len);
+        n++;
+    }
+
+    if (n == 0) {
+        *bp = NULL;
+        return NGX_OK;
+    }
+
+    block->part.elts = ngx_palloc(cf->pool, n * sizeof(ngx_table_elt_t));
+    if (block->part.elts == NULL) {
+        return NGX_ERROR;
+    }
+
+    block->data.data = ngx_pnalloc(cf->pool, block->data.len);
+    if (block->data.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    t = block->part.elts;
+    p = block->data.data;
+
+    for (i = 0; i < headers->nelts; i++) {
+
+        if (!ngx_http_headers_static(headers, &h[i])
+            || h[i].value.value.len == 0
+            || (always && !h[i].always))
+        {
+            continue;
+        }
+
+        t->hash = 1;
+        t->key = h[i].key;
+        t->value = h[i].value.value;
+        t->lowcase_key = NULL;
+        t++;
+
+        p = ngx_cpymem(p, h[i].key.data, h[i].key.len);
+        *p++ = ':'; *p++ = ' ';
+        p = ngx_cpymem(p, h[i].value.value.data, h[i].value.value.len);
+        *p++ = CR; *p++ = LF;
+    }
+
+    block->part.nelts = n;
+    block->part.next = NULL;
+
+    *bp = block;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_headers_preconfiguration(ngx_conf_t *cf)
+{
+    ngx_http_share_loc_conf(cf, &ngx_http_headers_filter_module);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_headers_filter_init(ngx_conf_t *cf)
 {
+    ngx_http_headers_conf_t  *conf;
+
+    conf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_headers_filter_module);
+
+    if (ngx_http_headers_compile(cf, conf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     ngx_http_next_header_filter = ngx_http_top_header_filter;
     ngx_http_top_header_filter = ngx_http_headers_filter;
 
@@ -8,6 +8,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 #include <gd.h>
 
@@ -25,6 +26,8 @@
 #define NGX_HTTP_IMAGE_PROCESS   2
 #define NGX_HTTP_IMAGE_PASS      3
 #define NGX_HTTP_IMAGE_DONE      4
+#define NGX_HTTP_IMAGE_CACHED    5
+#define NGX_HTTP_IMAGE_SKIP      6
 
 
 #define NGX_HTTP_IMAGE_NONE      0
@@ -37,6 +40,12 @@
 #define NGX_HTTP_IMAGE_BUFFERED  0x08
 
 
+typedef struct {
+    ngx_path_t                  *cache_path;
+    time_t                       cache_valid;
+} ngx_http_image_filter_main_conf_t;
+
+
 typedef struct {
     ngx_uint_t                   filter;
     ngx_uint_t                   width;
@@ -57,9 +66,44 @@ typedef struct {
     ngx_http_complex_value_t    *shcv;
 
     size_t                       buffer_size;
+
+    ngx_flag_t                   cache;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t           *thread_pool;
+#endif
 } ngx_http_image_filter_conf_t;
 
 
+/* everything libgd needs, so the transformation may run in a thread */
+
+typedef struct {
+    u_char                      *image;
+    size_t                       length;
+
+    ngx_uint_t                   type;
+    ngx_uint_t                   filter;
+    ngx_uint_t                   max_width;
+    ngx_uint_t                   max_height;
+    ngx_uint_t                   angle;
+    ngx_uint_t                   force;
+    ngx_uint_t                   transparency;
+    ngx_uint_t                   interlace;
+    int                          sharpen;
+    int                          quality;
+
+    /* a temporary file for the result cache */
+    ngx_fd_t                     fd;
+
+    u_char                      *out;
+    int                          size;
+    ngx_uint_t                   asis;
+    ngx_err_t                    err;
+
+    ngx_log_t                   *log;
+} ngx_http_image_transform_t;
+
+
 typedef struct {
     u_char                      *image;
     u_char                      *last;
@@ -75,6 +119,19 @@ typedef struct {
     ngx_uint_t                   phase;
     ngx_uint_t                   type;
     ngx_uint_t                   force;
+
+    ngx_http_image_transform_t  *transform;
+
+    ngx_str_t                    cache_name;
+    ngx_file_t                  *cache_file;
+    off_t                        cache_size;
+    ngx_file_t                  *temp_file;
+
+#if (NGX_THREADS)
+    ngx_thread_task_t           *thread_task;
+#endif
+
+    unsigned                     threaded:1;
 } ngx_http_image_filter_ctx_t;
 
 
@@ -93,18 +150,38 @@ static ngx_int_t ngx_http_image_size(ngx_http_request_t *r,
 
 static ngx_buf_t *ngx_http_image_resize(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx);
-static gdImagePtr ngx_http_image_source(ngx_http_request_t *r,
-    ngx_http_image_filter_ctx_t *ctx);
-static gdImagePtr ngx_http_image_new(ngx_http_request_t *r, int w, int h,
+static void ngx_http_image_transform(ngx_http_image_transform_t *t);
+static gdImagePtr ngx_http_image_source(ngx_http_image_transform_t *t);
+static gdImagePtr ngx_http_image_new(ngx_log_t *log, int w, int h,
     int colors);
-static u_char *ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type,
+static u_char *ngx_http_image_out(ngx_http_image_transform_t *t,
     gdImagePtr img, int *size);
 static void ngx_http_image_cleanup(void *data);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_image_thread_post(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx, ngx_thread_pool_t *tp);
+static void ngx_http_image_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_image_thread_event_handler(ngx_event_t *ev);
+#endif
+
+static ngx_int_t ngx_http_image_cache_lookup(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx, ngx_http_image_filter_conf_t *conf);
+static ngx_buf_t *ngx_http_image_cached(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx);
+static void ngx_http_image_skip(ngx_chain_t *in);
+static void ngx_http_image_cache_store(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx);
+static ngx_msec_t ngx_http_image_cache_manager(void *data);
+static ngx_int_t ngx_http_image_cache_manage_file(ngx_tree_ctx_t *ctx,
+    ngx_str_t *path);
+static ngx_int_t ngx_http_image_cache_noop(ngx_tree_ctx_t *ctx,
+    ngx_str_t *path);
 static ngx_uint_t ngx_http_image_filter_get_value(ngx_http_request_t *r,
     ngx_http_complex_value_t *cv, ngx_uint_t v);
 static ngx_uint_t ngx_http_image_filter_value(ngx_str_t *value);
 
 
+static void *ngx_http_image_filter_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_image_filter_create_conf(ngx_conf_t *cf);
 static char *ngx_http_image_filter_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
@@ -116,6 +193,10 @@ static char *ngx_http_image_filter_webp_quality(ngx_conf_t *cf,
     ngx_command_t *cmd, void *conf);
 static char *ngx_http_image_filter_sharpen(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_image_filter_cache_path(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_image_filter_threads(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_image_filter_init(ngx_conf_t *cf);
 
 
@@ -170,6 +251,27 @@ static ngx_command_t  ngx_http_image_filter_commands[] = {
       offsetof(ngx_http_image_filter_conf_t, buffer_size),
       NULL },
 
+    { ngx_string("image_filter_cache_path"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_image_filter_cache_path,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("image_filter_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_image_filter_conf_t, cache),
+      NULL },
+
+    { ngx_string("image_filter_threads"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_image_filter_threads,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -178,7 +280,7 @@ static ngx_http_module_t  ngx_http_image_filter_module_ctx = {
     NULL,                                  /* preconfiguration */
     ngx_http_image_filter_init,            /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_image_filter_create_main_conf, /* create main configuration */
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
@@ -221,6 +323,7 @@ static ngx_int_t
 ngx_http_image_header_filter(ngx_http_request_t *r)
 {
     off_t                          len;
+    ngx_int_t                      rc;
     ngx_http_image_filter_ctx_t   *ctx;
     ngx_http_image_filter_conf_t  *conf;
 
@@ -281,6 +384,24 @@ ngx_http_image_header_filter(ngx_http_request_t *r)
         r->headers_out.refresh->hash = 0;
     }
 
+    if (conf->cache
+        && conf->filter != NGX_HTTP_IMAGE_TEST
+        && conf->filter != NGX_HTTP_IMAGE_SIZE)
+    {
+        rc = ngx_http_image_cache_lookup(r, ctx, conf);
+
+        if (rc == NGX_OK) {
+
+            /* the source body is discarded without reading it */
+
+            return ngx_http_next_header_filter(r);
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     r->main_filter_need_in_memory = 1;
     r->allow_ranges = 0;
 
@@ -299,13 +420,15 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "image filter");
 
-    if (in == NULL) {
+    ctx = ngx_http_get_module_ctx(r, ngx_http_image_filter_module);
+
+    if (ctx == NULL) {
         return ngx_http_next_body_filter(r, in);
     }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_image_filter_module);
+    /* an empty call continues processing after a thread is done */
 
-    if (ctx == NULL) {
+    if (in == NULL && ctx->phase != NGX_HTTP_IMAGE_PROCESS) {
         return ngx_http_next_body_filter(r, in);
     }
 
@@ -370,8 +493,17 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     case NGX_HTTP_IMAGE_PROCESS:
 
+        if (ctx->threaded) {
+            return NGX_AGAIN;
+        }
+
         out.buf = ngx_http_image_process(r);
 
+        if (ctx->threaded) {
+            ctx->phase = NGX_HTTP_IMAGE_PROCESS;
+            return NGX_AGAIN;
+        }
+
         if (out.buf == NULL) {
             return ngx_http_filter_finalize_request(r,
                                               &ngx_http_image_filter_module,
@@ -387,6 +519,27 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
         return ngx_http_next_body_filter(r, in);
 
+    case NGX_HTTP_IMAGE_CACHED:
+
+        ngx_http_image_skip(in);
+
+        out.buf = ngx_http_image_cached(r, ctx);
+
+        if (out.buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        out.next = NULL;
+        ctx->phase = NGX_HTTP_IMAGE_SKIP;
+
+        return ngx_http_next_body_filter(r, &out);
+
+    case NGX_HTTP_IMAGE_SKIP:
+
+        ngx_http_image_skip(in);
+
+        return ngx_http_next_body_filter(r, NULL);
+
     default: /* NGX_HTTP_IMAGE_DONE */
 
         rc = ngx_http_next_body_filter(r, NULL);
@@ -532,6 +685,13 @@ ngx_http_image_process(ngx_http_request_t *r)
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_image_filter_module);
 
+    if (ctx->transform) {
+
+        /* the image was transformed in a thread */
+
+        return ngx_http_image_resize(r, ctx);
+    }
+
     rc = ngx_http_image_size(r, ctx);
 
     conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
@@ -819,39 +979,187 @@ ngx_http_image_size(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 static ngx_buf_t *
 ngx_http_image_resize(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 {
-    int                            sx, sy, dx, dy, ox, oy, ax, ay, size,
-                                   colors, palette, transparent, sharpen,
-                                   red, green, blue, t;
-    u_char                        *out;
-    ngx_buf_t                     *b;
-    ngx_uint_t                     resize;
-    gdImagePtr                     src, dst;
-    ngx_pool_cleanup_t            *cln;
-    ngx_http_image_filter_conf_t  *conf;
+    ngx_buf_t                          *b;
+    ngx_pool_cleanup_t                 *cln;
+    ngx_http_image_transform_t         *t;
+    ngx_http_image_filter_conf_t       *conf;
+    ngx_http_image_filter_main_conf_t  *imcf;
 
-    src = ngx_http_image_source(r, ctx);
+    t = ctx->transform;
 
-    if (src == NULL) {
+    if (t != NULL) {
+        goto done;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
+
+#if (NGX_THREADS)
+
+    if (conf->thread_pool) {
+        ctx->thread_task = ngx_thread_task_alloc(r->pool,
+                                          sizeof(ngx_http_image_transform_t));
+        if (ctx->thread_task == NULL) {
+            return NULL;
+        }
+
+        t = ctx->thread_task->ctx;
+
+    } else
+
+#endif
+
+    {
+        t = ngx_pcalloc(r->pool, sizeof(ngx_http_image_transform_t));
+        if (t == NULL) {
+            return NULL;
+        }
+    }
+
+    t->image = ctx->image;
+    t->length = ctx->length;
+    t->type = ctx->type;
+    t->filter = conf->filter;
+    t->max_width = ctx->max_width;
+    t->max_height = ctx->max_height;
+    t->angle = ctx->angle;
+    t->force = ctx->force;
+    t->transparency = conf->transparency;
+    t->interlace = conf->interlace;
+    t->sharpen = ngx_http_image_filter_get_value(r, conf->shcv,
+                                                 conf->sharpen);
+
+    switch (ctx->type) {
+
+    case NGX_HTTP_IMAGE_JPEG:
+        t->quality = ngx_http_image_filter_get_value(r, conf->jqcv,
+                                                     conf->jpeg_quality);
+        if (t->quality <= 0) {
+            return NULL;
+        }
+
+        break;
+
+    case NGX_HTTP_IMAGE_WEBP:
+        t->quality = ngx_http_image_filter_get_value(r, conf->wqcv,
+                                                     conf->webp_quality);
+        if (t->quality <= 0) {
+            return NULL;
+        }
+
+        break;
+    }
+
+    t->fd = NGX_INVALID_FILE;
+
+    if (ctx->cache_name.len) {
+        ctx->temp_file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (ctx->temp_file == NULL) {
+            return NULL;
+        }
+
+        ctx->temp_file->log = r->connection->log;
+
+        imcf = ngx_http_get_module_main_conf(r, ngx_http_image_filter_module);
+
+        if (ngx_create_temp_file(ctx->temp_file, imcf->cache_path, r->pool,
+                                 1, 1, 0)
+            == NGX_OK)
+        {
+            t->fd = ctx->temp_file->fd;
+
+        } else {
+            ctx->temp_file = NULL;
+        }
+    }
+
+    ctx->transform = t;
+
+#if (NGX_THREADS)
+
+    if (conf->thread_pool) {
+
+        /* ctx->threaded is only set if the task was posted */
+
+        (void) ngx_http_image_thread_post(r, ctx, conf->thread_pool);
+        return NULL;
+    }
+
+#endif
+
+    t->log = r->connection->log;
+
+    ngx_http_image_transform(t);
+
+done:
+
+    if (t->asis || t->out == NULL) {
+        ngx_http_image_cache_store(r, ctx);
+
+        return t->asis ? ngx_http_image_asis(r, ctx) : NULL;
+    }
+
+    ngx_pfree(r->pool, ctx->image);
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        gdFree(t->out);
+        return NULL;
+    }
+
+    cln->handler = ngx_http_image_cleanup;
+    cln->data = t->out;
+
+    ngx_http_image_cache_store(r, ctx);
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
         return NULL;
     }
 
+    b->pos = t->out;
+    b->last = t->out + t->size;
+    b->memory = 1;
+    b->last_buf = 1;
+
+    ngx_http_image_length(r, b);
+    ngx_http_weak_etag(r);
+
+    return b;
+}
+
+
+static void
+ngx_http_image_transform(ngx_http_image_transform_t *t)
+{
+    int          sx, sy, dx, dy, ox, oy, ax, ay, size,
+                 colors, palette, transparent, red, green, blue, tmp;
+    u_char      *out;
+    ssize_t      n;
+    ngx_uint_t   resize;
+    gdImagePtr   src, dst;
+
+    src = ngx_http_image_source(t);
+
+    if (src == NULL) {
+        return;
+    }
+
     sx = gdImageSX(src);
     sy = gdImageSY(src);
 
-    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
-
-    if (!ctx->force
-        && ctx->angle == 0
-        && (ngx_uint_t) sx <= ctx->max_width
-        && (ngx_uint_t) sy <= ctx->max_height)
+    if (!t->force
+        && t->angle == 0
+        && (ngx_uint_t) sx <= t->max_width
+        && (ngx_uint_t) sy <= t->max_height)
     {
         gdImageDestroy(src);
-        return ngx_http_image_asis(r, ctx);
+        t->asis = 1;
+        return;
     }
 
     colors = gdImageColorsTotal(src);
 
-    if (colors && conf->transparency) {
+    if (colors && t->transparency) {
         transparent = gdImageGetTransparent(src);
 
         if (transparent != -1) {
@@ -877,23 +1185,23 @@ transparent:
     dx = sx;
     dy = sy;
 
-    if (conf->filter == NGX_HTTP_IMAGE_RESIZE) {
+    if (t->filter == NGX_HTTP_IMAGE_RESIZE) {
 
-        if ((ngx_uint_t) dx > ctx->max_width) {
-            dy = dy * ctx->max_width / dx;
+        if ((ngx_uint_t) dx > t->max_width) {
+            dy = dy * t->max_width / dx;
             dy = dy ? dy : 1;
-            dx = ctx->max_width;
+            dx = t->max_width;
         }
 
-        if ((ngx_uint_t) dy > ctx->max_height) {
-            dx = dx * ctx->max_height / dy;
+        if ((ngx_uint_t) dy > t->max_height) {
+            dx = dx * t->max_height / dy;
             dx = dx ? dx : 1;
-            dy = ctx->max_height;
+            dy = t->max_height;
         }
 
         resize = 1;
 
-    } else if (conf->filter == NGX_HTTP_IMAGE_ROTATE) {
+    } else if (t->filter == NGX_HTTP_IMAGE_ROTATE) {
 
         resize = 0;
 
@@ -901,29 +1209,29 @@ transparent:
 
         resize = 0;
 
-        if ((double) dx / dy < (double) ctx->max_width / ctx->max_height) {
-            if ((ngx_uint_t) dx > ctx->max_width) {
-                dy = dy * ctx->max_width / dx;
+        if ((double) dx / dy < (double) t->max_width / t->max_height) {
+            if ((ngx_uint_t) dx > t->max_width) {
+                dy = dy * t->max_width / dx;
                 dy = dy ? dy : 1;
-                dx = ctx->max_width;
+                dx = t->max_width;
                 resize = 1;
             }
 
         } else {
-            if ((ngx_uint_t) dy > ctx->max_height) {
-                dx = dx * ctx->max_height / dy;
+            if ((ngx_uint_t) dy > t->max_height) {
+                dx = dx * t->max_height / dy;
                 dx = dx ? dx : 1;
-                dy = ctx->max_height;
+                dy = t->max_height;
                 resize = 1;
             }
         }
     }
 
     if (resize) {
-        dst = ngx_http_image_new(r, dx, dy, palette);
+        dst = ngx_http_image_new(t->log, dx, dy, palette);
         if (dst == NULL) {
             gdImageDestroy(src);
-            return NULL;
+            return;
         }
 
         if (colors == 0) {
@@ -943,22 +1251,22 @@ transparent:
         dst = src;
     }
 
-    if (ctx->angle) {
+    if (t->angle) {
         src = dst;
 
         ax = (dx % 2 == 0) ? 1 : 0;
         ay = (dy % 2 == 0) ? 1 : 0;
 
-        switch (ctx->angle) {
+        switch (t->angle) {
 
         case 90:
         case 270:
-            dst = ngx_http_image_new(r, dy, dx, palette);
+            dst = ngx_http_image_new(t->log, dy, dx, palette);
             if (dst == NULL) {
                 gdImageDestroy(src);
-                return NULL;
+                return;
             }
-            if (ctx->angle == 90) {
+            if (t->angle == 90) {
                 ox = dy / 2 + ay;
                 oy = dx / 2 - ax;
 
@@ -968,40 +1276,40 @@ transparent:
             }
 
             gdImageCopyRotated(dst, src, ox, oy, 0, 0,
-                               dx + ax, dy + ay, ctx->angle);
+                               dx + ax, dy + ay, t->angle);
             gdImageDestroy(src);
 
-            t = dx;
+            tmp = dx;
             dx = dy;
-            dy = t;
+            dy = tmp;
             break;
 
         case 180:
-            dst = ngx_http_image_new(r, dx, dy, palette);
+            dst = ngx_http_image_new(t->log, dx, dy, palette);
             if (dst == NULL) {
                 gdImageDestroy(src);
-                return NULL;
+                return;
             }
             gdImageCopyRotated(dst, src, dx / 2 - ax, dy / 2 - ay, 0, 0,
-                               dx + ax, dy + ay, ctx->angle);
+                               dx + ax, dy + ay, t->angle);
             gdImageDestroy(src);
             break;
         }
     }
 
-    if (conf->filter == NGX_HTTP_IMAGE_CROP) {
+    if (t->filter == NGX_HTTP_IMAGE_CROP) {
 
         src = dst;
 
-        if ((ngx_uint_t) dx > ctx->max_width) {
-            ox = dx - ctx->max_width;
+        if ((ngx_uint_t) dx > t->max_width) {
+            ox = dx - t->max_width;
 
         } else {
             ox = 0;
         }
 
-        if ((ngx_uint_t) dy > ctx->max_height) {
-            oy = dy - ctx->max_height;
+        if ((ngx_uint_t) dy > t->max_height) {
+            oy = dy - t->max_height;
 
         } else {
             oy = 0;
@@ -1009,17 +1317,17 @@ transparent:
 
         if (ox || oy) {
 
-            dst = ngx_http_image_new(r, dx - ox, dy - oy, colors);
+            dst = ngx_http_image_new(t->log, dx - ox, dy - oy, colors);
 
             if (dst == NULL) {
                 gdImageDestroy(src);
-                return NULL;
+                return;
             }
 
             ox /= 2;
             oy /= 2;
 
-            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, t->log, 0,
                            "image crop: %d x %d @ %d x %d",
                            dx, dy, ox, oy);
 
@@ -1042,80 +1350,74 @@ transparent:
         gdImageColorTransparent(dst, gdImageColorExact(dst, red, green, blue));
     }
 
-    sharpen = ngx_http_image_filter_get_value(r, conf->shcv, conf->sharpen);
-    if (sharpen > 0) {
-        gdImageSharpen(dst, sharpen);
+    if (t->sharpen > 0) {
+        gdImageSharpen(dst, t->sharpen);
     }
 
-    gdImageInterlace(dst, (int) conf->interlace);
+    gdImageInterlace(dst, (int) t->interlace);
 
-    out = ngx_http_image_out(r, ctx->type, dst, &size);
+    out = ngx_http_image_out(t, dst, &size);
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, t->log, 0,
                    "image: %d x %d %d", sx, sy, colors);
 
     gdImageDestroy(dst);
-    ngx_pfree(r->pool, ctx->image);
 
     if (out == NULL) {
-        return NULL;
+        return;
     }
 
-    cln = ngx_pool_cleanup_add(r->pool, 0);
-    if (cln == NULL) {
-        gdFree(out);
-        return NULL;
-    }
+    t->out = out;
+    t->size = size;
 
-    b = ngx_calloc_buf(r->pool);
-    if (b == NULL) {
-        gdFree(out);
-        return NULL;
+    if (t->fd == NGX_INVALID_FILE) {
+        return;
     }
 
-    cln->handler = ngx_http_image_cleanup;
-    cln->data = out;
+    /* the result is written to a cache file here to keep it off the loop */
 
-    b->pos = out;
-    b->last = out + size;
-    b->memory = 1;
-    b->last_buf = 1;
+    while (size) {
+        n = ngx_write_fd(t->fd, out, size);
 
-    ngx_http_image_length(r, b);
-    ngx_http_weak_etag(r);
+        if (n == -1) {
+            t->err = ngx_errno;
+            return;
+        }
 
-    return b;
+        out += n;
+        size -= n;
+    }
 }
 
 
 static gdImagePtr
-ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
+ngx_http_image_source(ngx_http_image_transform_t *t)
 {
     char        *failed;
     gdImagePtr   img;
 
     img = NULL;
 
-    switch (ctx->type) {
+    switch (t->type) {
 
     case NGX_HTTP_IMAGE_JPEG:
-        img = gdImageCreateFromJpegPtr(ctx->length, ctx->image);
+        img = gdImageCreateFromJpegPtr(t->length, t->image);
         failed = "gdImageCreateFromJpegPtr() failed";
         break;
 
     case NGX_HTTP_IMAGE_GIF:
-        img = gdImageCreateFromGifPtr(ctx->length, ctx->image);
+        img = gdImageCreateFromGifPtr(t->length, t->image);
         failed = "gdImageCreateFromGifPtr() failed";
         break;
 
     case NGX_HTTP_IMAGE_PNG:
-        img = gdImageCreateFromPngPtr(ctx->length, ctx->image);
+        img = gdImageCreateFromPngPtr(t->length, t->image);
         failed = "gdImageCreateFromPngPtr() failed";
         break;
 
     case NGX_HTTP_IMAGE_WEBP:
 #if (NGX_HAVE_GD_WEBP)
-        img = gdImageCreateFromWebpPtr(ctx->length, ctx->image);
+        img = gdImageCreateFromWebpPtr(t->length, t->image);
         failed = "gdImageCreateFromWebpPtr() failed";
 #else
         failed = "nginx was built without GD WebP support";
@@ -1128,7 +1430,7 @@ ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
     }
 
     if (img == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, failed);
+        ngx_log_error(NGX_LOG_ERR, t->log, 0, failed);
     }
 
     return img;
@@ -1136,7 +1438,7 @@ ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 
 
 static gdImagePtr
-ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
+ngx_http_image_new(ngx_log_t *log, int w, int h, int colors)
 {
     gdImagePtr  img;
 
@@ -1144,7 +1446,7 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
         img = gdImageCreateTrueColor(w, h);
 
         if (img == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+            ngx_log_error(NGX_LOG_ERR, log, 0,
                           "gdImageCreateTrueColor() failed");
             return NULL;
         }
@@ -1153,8 +1455,7 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
         img = gdImageCreate(w, h);
 
         if (img == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "gdImageCreate() failed");
+            ngx_log_error(NGX_LOG_ERR, log, 0, "gdImageCreate() failed");
             return NULL;
         }
     }
@@ -1164,27 +1465,17 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
 
 
 static u_char *
-ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type, gdImagePtr img,
-    int *size)
+ngx_http_image_out(ngx_http_image_transform_t *t, gdImagePtr img, int *size)
 {
-    char                          *failed;
-    u_char                        *out;
-    ngx_int_t                      q;
-    ngx_http_image_filter_conf_t  *conf;
+    char    *failed;
+    u_char  *out;
 
     out = NULL;
 
-    switch (type) {
+    switch (t->type) {
 
     case NGX_HTTP_IMAGE_JPEG:
-        conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
-
-        q = ngx_http_image_filter_get_value(r, conf->jqcv, conf->jpeg_quality);
-        if (q <= 0) {
-            return NULL;
-        }
-
-        out = gdImageJpegPtr(img, size, q);
+        out = gdImageJpegPtr(img, size, t->quality);
         failed = "gdImageJpegPtr() failed";
         break;
 
@@ -1200,14 +1491,7 @@ ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type, gdImagePtr img,
 
     case NGX_HTTP_IMAGE_WEBP:
 #if (NGX_HAVE_GD_WEBP)
-        conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
-
-        q = ngx_http_image_filter_get_value(r, conf->wqcv, conf->webp_quality);
-        if (q <= 0) {
-            return NULL;
-        }
-
-        out = gdImageWebpPtrEx(img, size, q);
+        out = gdImageWebpPtrEx(img, size, t->quality);
         failed = "gdImageWebpPtrEx() failed";
 #else
         failed = "nginx was built without GD WebP support";
@@ -1220,7 +1504,7 @@ ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type, gdImagePtr img,
     }
 
     if (out == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, failed);
+        ngx_log_error(NGX_LOG_ERR, t->log, 0, failed);
     }
 
     return out;
@@ -1234,6 +1518,375 @@ ngx_http_image_cleanup(void *data)
 }
 
 
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_image_thread_post(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx, ngx_thread_pool_t *tp)
+{
+    ngx_thread_task_t  *task;
+
+    task = ctx->thread_task;
+
+    task->handler = ngx_http_image_thread_handler;
+    task->event.data = r;
+    task->event.handler = ngx_http_image_thread_event_handler;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    r->connection->buffered |= NGX_HTTP_IMAGE_BUFFERED;
+
+    ctx->threaded = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_image_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_image_transform_t *t = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "image filter thread");
+
+    t->log = log;
+
+    ngx_http_image_transform(t);
+}
+
+
+static void
+ngx_http_image_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t             *c;
+    ngx_http_request_t           *r;
+    ngx_http_image_filter_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http image thread: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_image_filter_module);
+
+    ctx->threaded = 0;
+
+    if (r->done) {
+        c->write->handler(c->write);
+
+    } else {
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_image_cache_lookup(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx, ngx_http_image_filter_conf_t *conf)
+{
+    u_char                              *p, key[16], head[16];
+    ssize_t                              n;
+    ngx_buf_t                            b;
+    ngx_str_t                           *ct;
+    ngx_md5_t                            md5;
+    ngx_uint_t                           params[9];
+    ngx_path_t                          *path;
+    ngx_chain_t                          cl;
+    ngx_open_file_info_t                 of;
+    ngx_http_core_loc_conf_t            *clcf;
+    ngx_http_image_filter_main_conf_t   *imcf;
+
+    /* the source is identified by its uri and validators */
+
+    if (r->headers_out.etag == NULL
+        && r->headers_out.last_modified_time == -1)
+    {
+        return NGX_DECLINED;
+    }
+
+    params[0] = conf->filter;
+    params[1] = ngx_http_image_filter_get_value(r, conf->wcv, conf->width);
+    params[2] = ngx_http_image_filter_get_value(r, conf->hcv, conf->height);
+    params[3] = ngx_http_image_filter_get_value(r, conf->acv, conf->angle);
+    params[4] = ngx_http_image_filter_get_value(r, conf->jqcv,
+                                                conf->jpeg_quality);
+    params[5] = ngx_http_image_filter_get_value(r, conf->wqcv,
+                                                conf->webp_quality);
+    params[6] = ngx_http_image_filter_get_value(r, conf->shcv, conf->sharpen);
+    params[7] = conf->transparency;
+    params[8] = conf->interlace;
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, r->headers_in.server.data, r->headers_in.server.len);
+    ngx_md5_update(&md5, "", 1);
+    ngx_md5_update(&md5, r->uri.data, r->uri.len);
+    ngx_md5_update(&md5, "", 1);
+
+    if (r->headers_out.etag) {
+        ngx_md5_update(&md5, r->headers_out.etag->value.data,
+                       r->headers_out.etag->value.len);
+    }
+
+    ngx_md5_update(&md5, "", 1);
+    ngx_md5_update(&md5, &r->headers_out.last_modified_time, sizeof(time_t));
+    ngx_md5_update(&md5, &r->headers_out.content_length_n, sizeof(off_t));
+    ngx_md5_update(&md5, params, sizeof(params));
+    ngx_md5_final(key, &md5);
+
+    imcf = ngx_http_get_module_main_conf(r, ngx_http_image_filter_module);
+    path = imcf->cache_path;
+
+    ctx->cache_name.len = path->name.len + 1 + path->len + 2 * 16;
+
+    ctx->cache_name.data = ngx_pnalloc(r->pool, ctx->cache_name.len + 1);
+    if (ctx->cache_name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(ctx->cache_name.data, path->name.data, path->name.len);
+
+    p = ctx->cache_name.data + path->name.len + 1 + path->len;
+    p = ngx_hex_dump(p, key, 16);
+    *p = '\0';
+
+    ngx_create_hashed_filename(path, ctx->cache_name.data,
+                               ctx->cache_name.len);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "image cache file: \"%s\"", ctx->cache_name.data);
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = NGX_OPEN_FILE_DIRECTIO_OFF;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.events = clcf->open_file_cache_events;
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &ctx->cache_name, &of,
+                             r->pool)
+        != NGX_OK)
+    {
+        if (of.err != NGX_ENOENT && of.err != NGX_ENOTDIR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, of.err,
+                          "%s \"%V\" failed", of.failed, &ctx->cache_name);
+        }
+
+        return NGX_DECLINED;
+    }
+
+    if (!of.is_file || ngx_time() - of.mtime >= imcf->cache_valid) {
+        return NGX_DECLINED;
+    }
+
+    ctx->cache_file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+    if (ctx->cache_file == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->cache_file->fd = of.fd;
+    ctx->cache_file->name = ctx->cache_name;
+    ctx->cache_file->log = r->connection->log;
+
+    /* the type of the result is that of the source */
+
+    n = ngx_read_file(ctx->cache_file, head, sizeof(head), 0);
+
+    if (n == NGX_ERROR) {
+        return NGX_DECLINED;
+    }
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    b.pos = head;
+    b.last = head + n;
+
+    cl.buf = &b;
+    cl.next = NULL;
+
+    ctx->type = ngx_http_image_test(r, &cl);
+
+    if (ctx->type == NGX_HTTP_IMAGE_NONE) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "image cache hit: %O", of.size);
+
+    ctx->cache_size = of.size;
+    ctx->phase = NGX_HTTP_IMAGE_CACHED;
+
+    ct = &ngx_http_image_types[ctx->type - 1];
+    r->headers_out.content_type_len = ct->len;
+    r->headers_out.content_type = *ct;
+    r->headers_out.content_type_lowcase = NULL;
+
+    r->headers_out.content_length_n = of.size;
+
+    if (r->headers_out.content_length) {
+        r->headers_out.content_length->hash = 0;
+    }
+
+    r->headers_out.content_length = NULL;
+
+    r->allow_ranges = 0;
+
+    ngx_http_weak_etag(r);
+
+    return NGX_OK;
+}
+
+
+static ngx_buf_t *
+ngx_http_image_cached(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
+{
+    ngx_buf_t  *b;
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->file = ctx->cache_file;
+    b->file_pos = 0;
+    b->file_last = ctx->cache_size;
+
+    b->in_file = b->file_last ? 1 : 0;
+    b->last_buf = 1;
+    b->last_in_chain = 1;
+
+    return b;
+}
+
+
+static void
+ngx_http_image_skip(ngx_chain_t *in)
+{
+    ngx_chain_t  *cl;
+
+    for (cl = in; cl; cl = cl->next) {
+        cl->buf->pos = cl->buf->last;
+        cl->buf->file_pos = cl->buf->file_last;
+    }
+}
+
+
+static void
+ngx_http_image_cache_store(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx)
+{
+    ngx_file_t                  *file;
+    ngx_ext_rename_file_t        ext;
+    ngx_http_image_transform_t  *t;
+
+    file = ctx->temp_file;
+
+    if (file == NULL) {
+        return;
+    }
+
+    ctx->temp_file = NULL;
+
+    t = ctx->transform;
+
+    if (t->err) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, t->err,
+                      ngx_write_fd_n " \"%s\" failed", file->name.data);
+    }
+
+    if (t->out == NULL || t->asis || t->err) {
+
+        /* the cleanup handler deletes the file */
+
+        ngx_pool_run_cleanup_file(r->pool, file->fd);
+        return;
+    }
+
+    ext.access = 0;
+    ext.path_access = NGX_FILE_OWNER_ACCESS;
+    ext.time = -1;
+    ext.create_path = 1;
+    ext.delete_file = 1;
+    ext.fd = file->fd;
+    ext.log = r->connection->log;
+
+    if (ngx_ext_rename_file(&file->name, &ctx->cache_name, &ext) == NGX_OK) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "image cache stored: \"%s\"", ctx->cache_name.data);
+    }
+
+    ngx_pool_run_cleanup_file(r->pool, file->fd);
+}
+
+
+static ngx_msec_t
+ngx_http_image_cache_manager(void *data)
+{
+    ngx_http_image_filter_main_conf_t *imcf = data;
+
+    ngx_tree_ctx_t  tree;
+
+    tree.init_handler = NULL;
+    tree.file_handler = ngx_http_image_cache_manage_file;
+    tree.pre_tree_handler = ngx_http_image_cache_noop;
+    tree.post_tree_handler = ngx_http_image_cache_noop;
+    tree.spec_handler = ngx_http_image_cache_noop;
+    tree.data = imcf;
+    tree.alloc = 0;
+    tree.log = ngx_cycle->log;
+
+    (void) ngx_walk_tree(&tree, &imcf->cache_path->name);
+
+    return (ngx_msec_t) ngx_min(imcf->cache_valid, 3600) * 1000;
+}
+
+
+static ngx_int_t
+ngx_http_image_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_http_image_filter_main_conf_t *imcf = ctx->data;
+
+    if (ngx_time() - ctx->mtime < imcf->cache_valid) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "image cache expire: \"%s\"", path->data);
+
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR
+        && ngx_errno != NGX_ENOENT)
+    {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_image_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
 static ngx_uint_t
 ngx_http_image_filter_get_value(ngx_http_request_t *r,
     ngx_http_complex_value_t *cv, ngx_uint_t v)
@@ -1271,6 +1924,27 @@ ngx_http_image_filter_value(ngx_str_t *value)
 }
 
 
+static void *
+ngx_http_image_filter_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_image_filter_main_conf_t  *imcf;
+
+    imcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_image_filter_main_conf_t));
+    if (imcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     imcf->cache_path = NULL;
+     *     imcf->cache_valid = 0;
+     */
+
+    return imcf;
+}
+
+
 static void *
 ngx_http_image_filter_create_conf(ngx_conf_t *cf)
 {
@@ -1302,6 +1976,11 @@ ngx_http_image_filter_create_conf(ngx_conf_t *cf)
     conf->transparency = NGX_CONF_UNSET;
     conf->interlace = NGX_CONF_UNSET;
     conf->buffer_size = NGX_CONF_UNSET_SIZE;
+    conf->cache = NGX_CONF_UNSET;
+
+#if (NGX_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
 
     return conf;
 }
@@ -1313,6 +1992,8 @@ ngx_http_image_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_image_filter_conf_t *prev = parent;
     ngx_http_image_filter_conf_t *conf = child;
 
+    ngx_http_image_filter_main_conf_t  *imcf;
+
     if (conf->filter == NGX_CONF_UNSET_UINT) {
 
         if (prev->filter == NGX_CONF_UNSET_UINT) {
@@ -1364,6 +2045,24 @@ ngx_http_image_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size,
                               1 * 1024 * 1024);
 
+    ngx_conf_merge_value(conf->cache, prev->cache, 0);
+
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
+    if (conf->cache) {
+        imcf = ngx_http_conf_get_module_main_conf(cf,
+                                                 ngx_http_image_filter_module);
+
+        if (imcf->cache_path == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"image_filter_cache\" requires "
+                               "\"image_filter_cache_path\"");
+            return NGX_CONF_ERROR;
+        }
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -1662,6 +2361,168 @@ ngx_http_image_filter_sharpen(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+static char *
+ngx_http_image_filter_cache_path(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_image_filter_main_conf_t *imcf = conf;
+
+    u_char      *p, *last;
+    time_t       valid;
+    ngx_str_t   *value, s;
+    ngx_uint_t   i, n;
+    ngx_path_t  *path;
+
+    if (imcf->cache_path) {
+        return "is duplicate";
+    }
+
+    path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+    if (path == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    path->name = value[1];
+
+    if (path->name.data[path->name.len - 1] == '/') {
+        path->name.len--;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, &path->name, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    valid = 86400;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "levels=", 7) == 0) {
+
+            p = value[i].data + 7;
+            last = value[i].data + value[i].len;
+
+            for (n = 0; n < NGX_MAX_PATH_LEVEL && p < last; n++) {
+
+                if (*p > '0' && *p < '3') {
+
+                    path->level[n] = *p++ - '0';
+                    path->len += path->level[n] + 1;
+
+                    if (p == last) {
+                        break;
+                    }
+
+                    if (*p++ == ':' && n < NGX_MAX_PATH_LEVEL - 1 && p < last) {
+                        continue;
+                    }
+
+                    goto invalid_levels;
+                }
+
+                goto invalid_levels;
+            }
+
+            if (path->len < 10 + NGX_MAX_PATH_LEVEL) {
+                continue;
+            }
+
+        invalid_levels:
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid \"levels\" \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            valid = ngx_parse_time(&s, 1);
+            if (valid == (time_t) NGX_ERROR || valid == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid valid value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    path->manager = ngx_http_image_cache_manager;
+    path->data = imcf;
+    path->conf_file = cf->conf_file->file.name.data;
+    path->line = cf->conf_file->line;
+
+    imcf->cache_path = path;
+    imcf->cache_valid = valid;
+
+    if (ngx_add_path(cf, &imcf->cache_path) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_image_filter_threads(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_THREADS)
+    ngx_http_image_filter_conf_t *imcf = conf;
+
+    ngx_str_t  name;
+#endif
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+#if (NGX_THREADS)
+    if (imcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+#endif
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+#if (NGX_THREADS)
+        imcf->thread_pool = NULL;
+#endif
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "threads", 7) == 0
+        && (value[1].len == 7 || value[1].data[7] == '='))
+    {
+#if (NGX_THREADS)
+        name.len = value[1].len > 8 ? value[1].len - 8 : 0;
+        name.data = value[1].data + 8;
+
+        imcf->thread_pool = ngx_thread_pool_add(cf, name.len ? &name : NULL);
+        if (imcf->thread_pool == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"image_filter_threads\" is unsupported "
+                           "on this platform");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid value \"%V\"", &value[1]);
+    return NGX_CONF_ERROR;
+}
+
+
 static ngx_int_t
 ngx_http_image_filter_init(ngx_conf_t *cf)
 {
@@ -17,9 +17,24 @@ typedef struct {
 } ngx_http_index_t;
 
 
+typedef struct {
+    ngx_rbtree_t             rbtree;
+    ngx_rbtree_node_t        sentinel;
+    ngx_queue_t              queue;
+
+    ngx_uint_t               current;
+    ngx_uint_t               max;
+} ngx_http_index_cache_t;
+
+
 typedef struct {
     ngx_array_t             *indices;    /* array of ngx_http_index_t */
     size_t                   max_index_len;
+
+    ngx_http_index_cache_t  *cache;
+
+    /* the index file found can be cached */
+    ngx_uint_t               cacheable;  /* unsigned  cacheable:1; */
 } ngx_http_index_loc_conf_t;
 
 
@@ -30,13 +45,21 @@ static ngx_int_t ngx_http_index_test_dir(ngx_http_request_t *r,
     ngx_http_core_loc_conf_t *clcf, u_char *path, u_char *last);
 static ngx_int_t ngx_http_index_error(ngx_http_request_t *r,
     ngx_http_core_loc_conf_t *clcf, u_char *file, ngx_err_t err);
+static ngx_http_index_cached_t *ngx_http_index_cache_dir(
+    ngx_http_request_t *r);
+static void ngx_http_index_cache_delete(ngx_http_index_cache_t *cache,
+    ngx_http_index_cached_t *cached);
+static void ngx_http_index_cache_free(void *data);
 
+static ngx_int_t ngx_http_index_preconfiguration(ngx_conf_t *cf);
 static ngx_int_t ngx_http_index_init(ngx_conf_t *cf);
 static void *ngx_http_index_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_index_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static char *ngx_http_index_set_index(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_index_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_command_t  ngx_http_index_commands[] = {
@@ -48,12 +71,19 @@ static ngx_command_t  ngx_http_index_commands[] = {
       0,
       NULL },
 
+    { ngx_string("index_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_index_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
 
 static ngx_http_module_t  ngx_http_index_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_index_preconfiguration,       /* preconfiguration */
     ngx_http_index_init,                   /* postconfiguration */
 
     NULL,                                  /* create main configuration */
@@ -105,6 +135,7 @@ ngx_http_index_handler(ngx_http_request_t *r)
     ngx_open_file_info_t          of;
     ngx_http_script_code_pt       code;
     ngx_http_script_engine_t      e;
+    ngx_http_index_cached_t      *cached;
     ngx_http_core_loc_conf_t     *clcf;
     ngx_http_index_loc_conf_t    *ilcf;
     ngx_http_script_len_code_pt   lcode;
@@ -124,10 +155,35 @@ ngx_http_index_handler(ngx_http_request_t *r)
     root = 0;
     dir_tested = 0;
     name = NULL;
+    cached = NULL;
     /* suppress MSVC warning */
     path.data = NULL;
 
     index = ilcf->indices->elts;
+
+    if (ilcf->cache && ilcf->cacheable) {
+        cached = ngx_http_index_cache_dir(r);
+
+        if (cached && cached->indexed && cached->index_conf == ilcf) {
+
+            if (cached->index.len == 0) {
+                return NGX_DECLINED;
+            }
+
+            uri.len = r->uri.len + cached->index.len;
+
+            uri.data = ngx_pnalloc(r->pool, uri.len);
+            if (uri.data == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            p = ngx_copy(uri.data, r->uri.data, r->uri.len);
+            ngx_memcpy(p, cached->index.data, cached->index.len);
+
+            return ngx_http_internal_redirect(r, &uri, &r->args);
+        }
+    }
+
     for (i = 0; i < ilcf->indices->nelts; i++) {
 
         if (index[i].lengths == NULL) {
@@ -259,6 +315,15 @@ ngx_http_index_handler(ngx_http_request_t *r)
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
+        if (cached) {
+            /* index[i].name.len includes the terminating '\0' */
+
+            uri.len = index[i].name.len - 1;
+            uri.data = index[i].name.data;
+
+            ngx_http_index_cache_index(cached, ilcf, &uri);
+        }
+
         uri.len = r->uri.len + len - 1;
 
         if (!clcf->alias) {
@@ -277,6 +342,11 @@ ngx_http_index_handler(ngx_http_request_t *r)
         return ngx_http_internal_redirect(r, &uri, &r->args);
     }
 
+    if (cached) {
+        uri.len = 0;
+        ngx_http_index_cache_index(cached, ilcf, &uri);
+    }
+
     return NGX_DECLINED;
 }
 
@@ -384,6 +454,226 @@ ngx_http_index_error(ngx_http_request_t *r, ngx_http_core_loc_conf_t  *clcf,
 }
 
 
+static ngx_http_index_cached_t *
+ngx_http_index_cache_dir(ngx_http_request_t *r)
+{
+    u_char     *last;
+    size_t      root;
+    ngx_str_t   path;
+
+    last = ngx_http_map_uri_to_path(r, &path, &root, 0);
+    if (last == NULL) {
+        return NULL;
+    }
+
+    path.len = last - path.data;
+
+    if (path.len > 1 && path.data[path.len - 1] == '/') {
+        path.len--;
+        path.data[path.len] = '\0';
+    }
+
+    return ngx_http_index_cache_lookup(r, &path);
+}
+
+
+/*
+ * the directory is tested through the open file cache, so an entry is
+ * as fresh as the open file cache allows; a directory changed within the
+ * last second is not cached, as its modification time may not change yet
+ */
+
+ngx_http_index_cached_t *
+ngx_http_index_cache_lookup(ngx_http_request_t *r, ngx_str_t *dir)
+{
+    uint32_t                    hash;
+    ngx_open_file_info_t        of;
+    ngx_http_index_cache_t     *cache;
+    ngx_http_index_cached_t    *cached;
+    ngx_http_core_loc_conf_t   *clcf;
+    ngx_http_index_loc_conf_t  *ilcf;
+
+    ilcf = ngx_http_get_module_loc_conf(r, ngx_http_index_module);
+
+    cache = ilcf->cache;
+
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.test_dir = 1;
+    of.test_only = 1;
+    of.valid = clcf->open_file_cache_valid;
+    of.errors = clcf->open_file_cache_errors;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, dir, &of) != NGX_OK) {
+        return NULL;
+    }
+
+    if (ngx_open_cached_file(clcf->open_file_cache, dir, &of, r->pool)
+        != NGX_OK
+        || !of.is_dir)
+    {
+        /* the caller reports errors */
+        return NULL;
+    }
+
+    hash = ngx_crc32_short(dir->data, dir->len);
+
+    cached = (ngx_http_index_cached_t *)
+                 ngx_str_rbtree_lookup(&cache->rbtree, dir, hash);
+
+    if (cached) {
+
+        if (cached->uniq == of.uniq && cached->mtime == of.mtime) {
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http index cache hit: \"%V\"", dir);
+
+            ngx_queue_remove(&cached->queue);
+            ngx_queue_insert_head(&cache->queue, &cached->queue);
+
+            return cached;
+        }
+
+        ngx_http_index_cache_delete(cache, cached);
+    }
+
+    if (ngx_time() - of.mtime < 2) {
+        return NULL;
+    }
+
+    if (cache->current >= cache->max) {
+        cached = ngx_queue_data(ngx_queue_last(&cache->queue),
+                                ngx_http_index_cached_t, queue);
+
+        ngx_http_index_cache_delete(cache, cached);
+    }
+
+    cached = ngx_alloc(sizeof(ngx_http_index_cached_t) + dir->len,
+                       r->connection->log);
+    if (cached == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(cached, sizeof(ngx_http_index_cached_t));
+
+    cached->sn.node.key = hash;
+    cached->sn.str.len = dir->len;
+    cached->sn.str.data = (u_char *) (cached + 1);
+    ngx_memcpy(cached->sn.str.data, dir->data, dir->len);
+
+    cached->uniq = of.uniq;
+    cached->mtime = of.mtime;
+
+    ngx_rbtree_insert(&cache->rbtree, &cached->sn.node);
+    ngx_queue_insert_head(&cache->queue, &cached->queue);
+
+    cache->current++;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http index cache add: \"%V\"", dir);
+
+    return cached;
+}
+
+
+/* the index name is kept by the configuration */
+
+void
+ngx_http_index_cache_index(ngx_http_index_cached_t *cached, void *index_conf,
+    ngx_str_t *index)
+{
+    cached->index_conf = index_conf;
+    cached->index = *index;
+    cached->indexed = 1;
+}
+
+
+void
+ngx_http_index_cache_files(ngx_http_index_cached_t *cached, ngx_str_t *files,
+    ngx_uint_t n)
+{
+    u_char      *p;
+    size_t       size;
+    ngx_str_t   *copy;
+    ngx_uint_t   i;
+
+    size = n * sizeof(ngx_str_t);
+
+    for (i = 0; i < n; i++) {
+        size += files[i].len;
+    }
+
+    /* the names follow the array in a single allocation */
+
+    copy = ngx_alloc(size, ngx_cycle->log);
+    if (copy == NULL) {
+        return;
+    }
+
+    p = (u_char *) (copy + n);
+
+    for (i = 0; i < n; i++) {
+        copy[i].len = files[i].len;
+        copy[i].data = p;
+        p = ngx_cpymem(p, files[i].data, files[i].len);
+    }
+
+    if (cached->files) {
+        ngx_free(cached->files);
+    }
+
+    cached->files = copy;
+    cached->nfiles = n;
+    cached->listed = 1;
+}
+
+
+static void
+ngx_http_index_cache_delete(ngx_http_index_cache_t *cache,
+    ngx_http_index_cached_t *cached)
+{
+    ngx_queue_remove(&cached->queue);
+    ngx_rbtree_delete(&cache->rbtree, &cached->sn.node);
+
+    cache->current--;
+
+    if (cached->files) {
+        ngx_free(cached->files);
+    }
+
+    ngx_free(cached);
+}
+
+
+static void
+ngx_http_index_cache_free(void *data)
+{
+    ngx_http_index_cache_t *cache = data;
+
+    ngx_queue_t              *q;
+    ngx_http_index_cached_t  *cached;
+
+    while (!ngx_queue_empty(&cache->queue)) {
+        q = ngx_queue_head(&cache->queue);
+        cached = ngx_queue_data(q, ngx_http_index_cached_t, queue);
+
+        ngx_queue_remove(q);
+
+        if (cached->files) {
+            ngx_free(cached->files);
+        }
+
+        ngx_free(cached);
+    }
+}
+
+
 static void *
 ngx_http_index_create_loc_conf(ngx_conf_t *cf)
 {
@@ -396,6 +686,8 @@ ngx_http_index_create_loc_conf(ngx_conf_t *cf)
 
     conf->indices = NULL;
     conf->max_index_len = 0;
+    conf->cache = NGX_CONF_UNSET_PTR;
+    conf->cacheable = 0;
 
     return conf;
 }
@@ -407,13 +699,28 @@ ngx_http_index_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_index_loc_conf_t  *prev = parent;
     ngx_http_index_loc_conf_t  *conf = child;
 
+    ngx_uint_t         i;
     ngx_http_index_t  *index;
 
+    ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
+
     if (conf->indices == NULL) {
         conf->indices = prev->indices;
         conf->max_index_len = prev->max_index_len;
     }
 
+    conf->cacheable = 1;
+
+    if (conf->indices) {
+        index = conf->indices->elts;
+
+        for (i = 0; i < conf->indices->nelts; i++) {
+            if (index[i].lengths) {
+                conf->cacheable = 0;
+            }
+        }
+    }
+
     if (conf->indices == NULL) {
         conf->indices = ngx_array_create(cf->pool, 1, sizeof(ngx_http_index_t));
         if (conf->indices == NULL) {
@@ -439,6 +746,15 @@ ngx_http_index_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 }
 
 
+static ngx_int_t
+ngx_http_index_preconfiguration(ngx_conf_t *cf)
+{
+    ngx_http_share_loc_conf(cf, &ngx_http_index_module);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_index_init(ngx_conf_t *cf)
 {
@@ -538,3 +854,64 @@ ngx_http_index_set_index(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_http_index_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_index_loc_conf_t *ilcf = conf;
+
+    ngx_int_t                max;
+    ngx_str_t               *value;
+    ngx_pool_cleanup_t      *cln;
+    ngx_http_index_cache_t  *cache;
+
+    if (ilcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        ilcf->cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "max=", 4) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    max = ngx_atoi(value[1].data + 4, value[1].len - 4);
+    if (max <= 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid \"max\" value \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    cache = ngx_palloc(cf->pool, sizeof(ngx_http_index_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->queue);
+
+    cache->current = 0;
+    cache->max = max;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_index_cache_free;
+    cln->data = cache;
+
+    ilcf->cache = cache;
+
+    return NGX_CONF_OK;
+}
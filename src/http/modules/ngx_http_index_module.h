@@ -0,0 +1,51 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HTTP_INDEX_H_INCLUDED_
+#define _NGX_HTTP_INDEX_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * The per-worker cache of directories set with "index_cache" keeps what
+ * the index and random_index modules found in a directory: the index file
+ * and the list of regular files.  An entry is valid while the directory
+ * has the same inode and modification time.
+ */
+
+typedef struct {
+    ngx_str_node_t           sn;
+    ngx_queue_t              queue;
+
+    ngx_file_uniq_t          uniq;
+    time_t                   mtime;
+
+    /* the index file found with the "index" list of index_conf */
+    void                    *index_conf;
+    ngx_str_t                index;
+
+    /* the regular files of the directory */
+    ngx_str_t               *files;
+    ngx_uint_t               nfiles;
+
+    unsigned                 indexed:1;
+    unsigned                 listed:1;
+} ngx_http_index_cached_t;
+
+
+ngx_http_index_cached_t *ngx_http_index_cache_lookup(ngx_http_request_t *r,
+    ngx_str_t *dir);
+void ngx_http_index_cache_index(ngx_http_index_cached_t *cached,
+    void *index_conf, ngx_str_t *index);
+void ngx_http_index_cache_files(ngx_http_index_cached_t *cached,
+    ngx_str_t *files, ngx_uint_t n);
+
+
+#endif /* _NGX_HTTP_INDEX_H_INCLUDED_ */
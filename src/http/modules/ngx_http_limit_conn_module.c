@@ -14,6 +14,14 @@
 #define NGX_HTTP_LIMIT_CONN_REJECTED          2
 #define NGX_HTTP_LIMIT_CONN_REJECTED_DRY_RUN  3
 
+#define NGX_HTTP_LIMIT_CONN_PROBES            8
+
+/*
+ * a table slot keeps a key fingerprint in the upper 48 bits
+ * and the number of connections in the lower 16 bits
+ */
+#define NGX_HTTP_LIMIT_CONN_MASK              0xffff
+
 
 typedef struct {
     u_char                        color;
@@ -26,6 +34,7 @@ typedef struct {
 typedef struct {
     ngx_shm_zone_t               *shm_zone;
     ngx_rbtree_node_t            *node;
+    ngx_atomic_t                 *slot;
 } ngx_http_limit_conn_cleanup_t;
 
 
@@ -36,6 +45,8 @@ typedef struct {
 typedef struct {
     ngx_rbtree_t                  rbtree;
     ngx_rbtree_node_t             sentinel;
+    ngx_atomic_t                 *slots;
+    ngx_uint_t                    nslots;
 } ngx_http_limit_conn_shctx_t;
 
 
@@ -43,6 +54,7 @@ typedef struct {
     ngx_http_limit_conn_shctx_t  *sh;
     ngx_slab_pool_t              *shpool;
     ngx_http_complex_value_t      key;
+    ngx_flag_t                    atomic;
 } ngx_http_limit_conn_ctx_t;
 
 
@@ -63,6 +75,10 @@ typedef struct {
 
 static ngx_rbtree_node_t *ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree,
     ngx_str_t *key, uint32_t hash);
+static ngx_int_t ngx_http_limit_conn_acquire(ngx_http_limit_conn_ctx_t *ctx,
+    ngx_str_t *key, uint32_t hash, ngx_uint_t limit, ngx_atomic_t **slotp);
+static ngx_int_t ngx_http_limit_conn_slot_inc(ngx_atomic_t *slot,
+    ngx_atomic_uint_t fp, ngx_uint_t limit);
 static void ngx_http_limit_conn_cleanup(void *data);
 static ngx_inline void ngx_http_limit_conn_cleanup_all(ngx_pool_t *pool);
 
@@ -96,7 +112,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_conn_status_bounds = {
 static ngx_command_t  ngx_http_limit_conn_commands[] = {
 
     { ngx_string("limit_conn_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE23,
       ngx_http_limit_conn_zone,
       0,
       0,
@@ -186,8 +202,10 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 {
     size_t                          n;
     uint32_t                        hash;
+    ngx_int_t                       rc;
     ngx_str_t                       key;
     ngx_uint_t                      i;
+    ngx_atomic_t                   *slot;
     ngx_rbtree_node_t              *node;
     ngx_pool_cleanup_t             *cln;
     ngx_http_limit_conn_ctx_t      *ctx;
@@ -247,6 +265,51 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
          */
         hash = ngx_crc32_short(key.data, key.len);
 
+        if (ctx->sh->slots) {
+            rc = ngx_http_limit_conn_acquire(ctx, &key, hash, limits[i].conn,
+                                             &slot);
+
+            if (rc == NGX_BUSY) {
+                ngx_log_error(lccf->log_level, r->connection->log, 0,
+                              "limiting connections%s by zone \"%V\"",
+                              lccf->dry_run ? ", dry run," : "",
+                              &limits[i].shm_zone->shm.name);
+            }
+
+            if (rc != NGX_OK) {
+                ngx_http_limit_conn_cleanup_all(r->pool);
+
+                if (lccf->dry_run) {
+                    r->main->limit_conn_status =
+                                          NGX_HTTP_LIMIT_CONN_REJECTED_DRY_RUN;
+                    return NGX_DECLINED;
+                }
+
+                r->main->limit_conn_status = NGX_HTTP_LIMIT_CONN_REJECTED;
+
+                return lccf->status_code;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "limit conn: %08Xi %d",
+                           hash, (int) (*slot & NGX_HTTP_LIMIT_CONN_MASK));
+
+            cln = ngx_pool_cleanup_add(r->pool,
+                                       sizeof(ngx_http_limit_conn_cleanup_t));
+            if (cln == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            cln->handler = ngx_http_limit_conn_cleanup;
+            lccln = cln->data;
+
+            lccln->shm_zone = limits[i].shm_zone;
+            lccln->node = NULL;
+            lccln->slot = slot;
+
+            continue;
+        }
+
         ngx_shmtx_lock(&ctx->shpool->mutex);
 
         /*
@@ -370,6 +433,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         lccln->shm_zone = limits[i].shm_zone;
         lccln->node = node;
+        lccln->slot = NULL;
     }
 
     return NGX_DECLINED;
@@ -456,6 +520,126 @@ ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree, ngx_str_t *key, uint32_t hash)
 }
 
 
+static ngx_int_t
+ngx_http_limit_conn_acquire(ngx_http_limit_conn_ctx_t *ctx, ngx_str_t *key,
+    uint32_t hash, ngx_uint_t limit, ngx_atomic_t **slotp)
+{
+    ngx_int_t           rc;
+    ngx_uint_t          i, n;
+    ngx_atomic_t       *slot;
+    ngx_atomic_uint_t   fp, v;
+
+    fp = (ngx_atomic_uint_t) (ngx_murmur_hash2(key->data, key->len) & 0xffff)
+         << 48
+         | (ngx_atomic_uint_t) hash << 16;
+
+    if (fp == 0) {
+        fp = NGX_HTTP_LIMIT_CONN_MASK + 1;
+    }
+
+    /*
+     * slots are never emptied, so a key is always found
+     * before the first empty slot; known keys are counted
+     * without locking
+     */
+
+    n = hash % ctx->sh->nslots;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_CONN_PROBES; i++) {
+        slot = &ctx->sh->slots[n];
+
+        if (*slot == 0) {
+            break;
+        }
+
+        rc = ngx_http_limit_conn_slot_inc(slot, fp, limit);
+
+        if (rc != NGX_DECLINED) {
+            *slotp = slot;
+            return rc;
+        }
+
+        n = (n + 1) % ctx->sh->nslots;
+    }
+
+    /* new keys are added under the lock to be added only once */
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    n = hash % ctx->sh->nslots;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_CONN_PROBES; i++) {
+        slot = &ctx->sh->slots[n];
+
+        if (*slot == 0) {
+            break;
+        }
+
+        rc = ngx_http_limit_conn_slot_inc(slot, fp, limit);
+
+        if (rc != NGX_DECLINED) {
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+            *slotp = slot;
+            return rc;
+        }
+
+        n = (n + 1) % ctx->sh->nslots;
+    }
+
+    /* an empty slot or a slot of a key without connections is taken */
+
+    n = hash % ctx->sh->nslots;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_CONN_PROBES; i++) {
+        slot = &ctx->sh->slots[n];
+        v = *slot;
+
+        if ((v & NGX_HTTP_LIMIT_CONN_MASK) == 0
+            && ngx_atomic_cmp_set(slot, v, fp | 1))
+        {
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+            *slotp = slot;
+            return NGX_OK;
+        }
+
+        n = (n + 1) % ctx->sh->nslots;
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, 0,
+                  "no free slots%s", ctx->shpool->log_ctx);
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_limit_conn_slot_inc(ngx_atomic_t *slot, ngx_atomic_uint_t fp,
+    ngx_uint_t limit)
+{
+    ngx_atomic_uint_t  v;
+
+    for ( ;; ) {
+        v = *slot;
+
+        if ((v & ~((ngx_atomic_uint_t) NGX_HTTP_LIMIT_CONN_MASK)) != fp) {
+            return NGX_DECLINED;
+        }
+
+        if ((v & NGX_HTTP_LIMIT_CONN_MASK) >= limit) {
+            return NGX_BUSY;
+        }
+
+        if (ngx_atomic_cmp_set(slot, v, v + 1)) {
+            return NGX_OK;
+        }
+    }
+}
+
+
 static void
 ngx_http_limit_conn_cleanup(void *data)
 {
@@ -465,6 +649,15 @@ ngx_http_limit_conn_cleanup(void *data)
     ngx_http_limit_conn_ctx_t   *ctx;
     ngx_http_limit_conn_node_t  *lc;
 
+    if (lccln->slot) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, lccln->shm_zone->shm.log, 0,
+                       "limit conn cleanup: %d",
+                       (int) (*lccln->slot & NGX_HTTP_LIMIT_CONN_MASK));
+
+        (void) ngx_atomic_fetch_add(lccln->slot, -1);
+        return;
+    }
+
     ctx = lccln->shm_zone->data;
     node = lccln->node;
     lc = (ngx_http_limit_conn_node_t *) &node->color;
@@ -510,7 +703,7 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_conn_ctx_t  *octx = data;
 
-    size_t                      len;
+    size_t                      len, size;
     ngx_http_limit_conn_ctx_t  *ctx;
 
     /*
@@ -533,6 +726,16 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->atomic != octx->atomic) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_conn_zone \"%V\" %s \"atomic\" "
+                          "while previously it %s",
+                          &shm_zone->shm.name,
+                          ctx->atomic ? "uses" : "does not use",
+                          octx->atomic ? "did" : "did not");
+            return NGX_ERROR;
+        }
+
         ctx->sh = octx->sh;
         ctx->shpool = octx->shpool;
 
@@ -570,6 +773,20 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_sprintf(ctx->shpool->log_ctx, " in limit_conn_zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
+    if (ctx->atomic) {
+
+        /* the table takes all the remaining memory at once */
+
+        size = ctx->shpool->pfree * ngx_pagesize;
+
+        ctx->sh->nslots = size / sizeof(ngx_atomic_t);
+
+        ctx->sh->slots = ngx_slab_calloc(ctx->shpool, size);
+        if (ctx->sh->slots == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
     return NGX_OK;
 }
 
@@ -709,6 +926,19 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[i].data, "atomic") == 0) {
+
+#if (NGX_HAVE_ATOMIC_OPS && NGX_PTR_SIZE == 8)
+            ctx->atomic = 1;
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"atomic\" is not supported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -876,6 +1106,8 @@ ngx_http_limit_conn_add_variables(ngx_conf_t *cf)
 {
     ngx_http_variable_t  *var, *v;
 
+    ngx_http_share_loc_conf(cf, &ngx_http_limit_conn_module);
+
     for (v = ngx_http_limit_conn_vars; v->name.len; v++) {
         var = ngx_http_add_variable(cf, &v->name, v->flags);
         if (var == NULL) {
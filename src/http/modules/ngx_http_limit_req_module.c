@@ -16,6 +16,18 @@
 #define NGX_HTTP_LIMIT_REQ_DELAYED_DRY_RUN   4
 #define NGX_HTTP_LIMIT_REQ_REJECTED_DRY_RUN  5
 
+#define NGX_HTTP_LIMIT_REQ_MAX_SHARDS        64
+
+#define NGX_HTTP_LIMIT_REQ_LEAKY_BUCKET      0
+#define NGX_HTTP_LIMIT_REQ_TOKEN_BUCKET      1
+#define NGX_HTTP_LIMIT_REQ_SLIDING_WINDOW    2
+
+/* slots per bucket, 4 slots of 16 bytes fill a cache line */
+#define NGX_HTTP_LIMIT_REQ_BUCKET            4
+
+#define NGX_HTTP_LIMIT_REQ_SYNC_MAGIC        "LRS1"
+#define NGX_HTTP_LIMIT_REQ_SYNC_SIZE         1400
+
 
 typedef struct {
     u_char                       color;
@@ -30,20 +42,55 @@ typedef struct {
 } ngx_http_limit_req_node_t;
 
 
+/*
+ * the token bucket and the sliding window keep state in fixed size slots
+ * identified by the key hash only; a key which collides with another one
+ * or is evicted from a full bucket starts over with a clean state
+ */
+
+typedef struct {
+    uint32_t                     hash;
+    uint32_t                     last;
+    /*
+     * token bucket: the bucket level, a request corresponds to "period",
+     * sliding window: the previous window count and the current one
+     */
+    uint64_t                     value;
+} ngx_http_limit_req_slot_t;
+
+
 typedef struct {
     ngx_rbtree_t                  rbtree;
     ngx_rbtree_node_t             sentinel;
     ngx_queue_t                   queue;
+    ngx_http_limit_req_slot_t    *slots;
+    /* requests accounted locally since the last sync, per slot */
+    uint32_t                     *deltas;
+    ngx_uint_t                    nbuckets;
 } ngx_http_limit_req_shctx_t;
 
 
 typedef struct {
     ngx_http_limit_req_shctx_t  *sh;
     ngx_slab_pool_t             *shpool;
+} ngx_http_limit_req_shard_t;
+
+
+typedef struct {
+    ngx_http_limit_req_shard_t  *shards;
+    ngx_uint_t                   nshards;
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   rate;
+    /* the rate as specified, requests per period */
+    ngx_uint_t                   limit;
+    ngx_msec_t                   period;
+    ngx_uint_t                   algorithm;
+    ngx_flag_t                   sync;
     ngx_http_complex_value_t     key;
     ngx_http_limit_req_node_t   *node;
+    ngx_http_limit_req_slot_t   *slot;
+    uint32_t                     hash;
+    ngx_http_limit_req_shard_t  *shard;
 } ngx_http_limit_req_ctx_t;
 
 
@@ -55,6 +102,17 @@ typedef struct {
 } ngx_http_limit_req_limit_t;
 
 
+typedef struct {
+    ngx_addr_t                  *listen;
+    ngx_array_t                  peers;        /* ngx_addr_t */
+    ngx_msec_t                   interval;
+    ngx_array_t                  zones;        /* ngx_shm_zone_t * */
+
+    ngx_connection_t            *connection;
+    ngx_event_t                  event;
+} ngx_http_limit_req_main_conf_t;
+
+
 typedef struct {
     ngx_array_t                  limits;
     ngx_uint_t                   limit_log_level;
@@ -66,14 +124,38 @@ typedef struct {
 
 static void ngx_http_limit_req_delay(ngx_http_request_t *r);
 static ngx_int_t ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
-    ngx_uint_t hash, ngx_str_t *key, ngx_uint_t *ep, ngx_uint_t account);
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, ngx_str_t *key,
+    ngx_uint_t *ep, ngx_uint_t account);
+static ngx_int_t ngx_http_limit_req_lookup_slot(
+    ngx_http_limit_req_limit_t *limit, ngx_http_limit_req_shard_t *shard,
+    uint32_t hash, ngx_uint_t *ep, ngx_uint_t account);
+static ngx_http_limit_req_slot_t *ngx_http_limit_req_find_slot(
+    ngx_http_limit_req_ctx_t *ctx, ngx_http_limit_req_shard_t *shard,
+    uint32_t hash);
+static ngx_uint_t ngx_http_limit_req_slot_update(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_slot_t *slot, ngx_uint_t burst, ngx_uint_t n);
 static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n, ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
-    ngx_uint_t n);
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n);
+static ngx_int_t ngx_http_limit_req_init_shard(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, ngx_slab_pool_t *shpool);
+
+static ngx_int_t ngx_http_limit_req_init_process(ngx_cycle_t *cycle);
+static void ngx_http_limit_req_exit_process(ngx_cycle_t *cycle);
+static void ngx_http_limit_req_sync_handler(ngx_event_t *ev);
+static void ngx_http_limit_req_sync_zone(ngx_http_limit_req_main_conf_t *lrmcf,
+    ngx_shm_zone_t *shm_zone);
+static void ngx_http_limit_req_sync_send(ngx_http_limit_req_main_conf_t *lrmcf,
+    u_char *buf, size_t len);
+static void ngx_http_limit_req_sync_read_handler(ngx_event_t *rev);
+static void ngx_http_limit_req_sync_receive(
+    ngx_http_limit_req_main_conf_t *lrmcf, u_char *buf, size_t len);
 
 static ngx_int_t ngx_http_limit_req_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static void *ngx_http_limit_req_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_limit_req_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
@@ -81,6 +163,10 @@ static char *ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_limit_req(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_limit_req_sync_listen(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_limit_req_sync_peer(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_limit_req_add_variables(ngx_conf_t *cf);
 static ngx_int_t ngx_http_limit_req_init(ngx_conf_t *cf);
 
@@ -102,12 +188,34 @@ static ngx_conf_num_bounds_t  ngx_http_limit_req_status_bounds = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3|NGX_CONF_TAKE4|NGX_CONF_TAKE5
+                        |NGX_CONF_TAKE6,
       ngx_http_limit_req_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("limit_req_sync_listen"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_limit_req_sync_listen,
+      NGX_HTTP_MAIN_CONF_OFFSET,
       0,
+      NULL },
+
+    { ngx_string("limit_req_sync_peer"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_limit_req_sync_peer,
+      NGX_HTTP_MAIN_CONF_OFFSET,
       0,
       NULL },
 
+    { ngx_string("limit_req_sync_interval"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_limit_req_main_conf_t, interval),
+      NULL },
+
     { ngx_string("limit_req"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE123,
       ngx_http_limit_req,
@@ -144,8 +252,8 @@ static ngx_http_module_t  ngx_http_limit_req_module_ctx = {
     ngx_http_limit_req_add_variables,      /* preconfiguration */
     ngx_http_limit_req_init,               /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_http_limit_req_create_main_conf,   /* create main configuration */
+    ngx_http_limit_req_init_main_conf,     /* init main configuration */
 
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
@@ -162,10 +270,10 @@ ngx_module_t  ngx_http_limit_req_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_limit_req_init_process,       /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_http_limit_req_exit_process,       /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -199,6 +307,7 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
     ngx_msec_t                   delay;
     ngx_http_limit_req_ctx_t    *ctx;
     ngx_http_limit_req_conf_t   *lrcf;
+    ngx_http_limit_req_shard_t  *shard;
     ngx_http_limit_req_limit_t  *limit, *limits;
 
     if (r->main->limit_req_status) {
@@ -240,12 +349,20 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(key.data, key.len);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        /* zero hash marks an empty slot */
+
+        if (hash == 0) {
+            hash = 1;
+        }
+
+        shard = &ctx->shards[hash % ctx->nshards];
 
-        rc = ngx_http_limit_req_lookup(limit, hash, &key, &excess,
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        rc = ngx_http_limit_req_lookup(limit, shard, hash, &key, &excess,
                                        (n == lrcf->limits.nelts - 1));
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -273,15 +390,17 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
         while (n--) {
             ctx = limits[n].shm_zone->data;
 
+            ctx->slot = NULL;
+
             if (ctx->node == NULL) {
                 continue;
             }
 
-            ngx_shmtx_lock(&ctx->shpool->mutex);
+            ngx_shmtx_lock(&ctx->shard->shpool->mutex);
 
             ctx->node->count--;
 
-            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
 
             ctx->node = NULL;
         }
@@ -408,8 +527,9 @@ ngx_http_limit_req_rbtree_insert_value(ngx_rbtree_node_t *temp,
 
 
 static ngx_int_t
-ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
-    ngx_str_t *key, ngx_uint_t *ep, ngx_uint_t account)
+ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, ngx_str_t *key,
+    ngx_uint_t *ep, ngx_uint_t account)
 {
     size_t                      size;
     ngx_int_t                   rc, excess;
@@ -419,12 +539,16 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
     ngx_http_limit_req_ctx_t   *ctx;
     ngx_http_limit_req_node_t  *lr;
 
-    now = ngx_current_msec;
-
     ctx = limit->shm_zone->data;
 
-    node = ctx->sh->rbtree.root;
-    sentinel = ctx->sh->rbtree.sentinel;
+    if (ctx->algorithm != NGX_HTTP_LIMIT_REQ_LEAKY_BUCKET) {
+        return ngx_http_limit_req_lookup_slot(limit, shard, hash, ep, account);
+    }
+
+    now = ngx_current_msec;
+
+    node = shard->sh->rbtree.root;
+    sentinel = shard->sh->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -446,7 +570,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
         if (rc == 0) {
             ngx_queue_remove(&lr->queue);
-            ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+            ngx_queue_insert_head(&shard->sh->queue, &lr->queue);
 
             ms = (ngx_msec_int_t) (now - lr->last);
 
@@ -482,6 +606,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
             lr->count++;
 
             ctx->node = lr;
+            ctx->shard = shard;
 
             return NGX_AGAIN;
         }
@@ -495,17 +620,17 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
            + offsetof(ngx_http_limit_req_node_t, data)
            + key->len;
 
-    ngx_http_limit_req_expire(ctx, 1);
+    ngx_http_limit_req_expire(ctx, shard, 1);
 
-    node = ngx_slab_alloc_locked(ctx->shpool, size);
+    node = ngx_slab_alloc_locked(shard->shpool, size);
 
     if (node == NULL) {
-        ngx_http_limit_req_expire(ctx, 0);
+        ngx_http_limit_req_expire(ctx, shard, 0);
 
-        node = ngx_slab_alloc_locked(ctx->shpool, size);
+        node = ngx_slab_alloc_locked(shard->shpool, size);
         if (node == NULL) {
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                          "could not allocate node%s", ctx->shpool->log_ctx);
+                          "could not allocate node%s", shard->shpool->log_ctx);
             return NGX_ERROR;
         }
     }
@@ -519,9 +644,9 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     ngx_memcpy(lr->data, key->data, key->len);
 
-    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_rbtree_insert(&shard->sh->rbtree, node);
 
-    ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+    ngx_queue_insert_head(&shard->sh->queue, &lr->queue);
 
     if (account) {
         lr->last = now;
@@ -533,11 +658,178 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
     lr->count = 1;
 
     ctx->node = lr;
+    ctx->shard = shard;
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_lookup_slot(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, uint32_t hash, ngx_uint_t *ep,
+    ngx_uint_t account)
+{
+    ngx_uint_t                  excess;
+    ngx_http_limit_req_ctx_t   *ctx;
+    ngx_http_limit_req_slot_t  *slot;
+
+    ctx = limit->shm_zone->data;
+
+    slot = ngx_http_limit_req_find_slot(ctx, shard, hash);
+
+    excess = ngx_http_limit_req_slot_update(ctx, slot, limit->burst, account);
+
+    *ep = excess;
+
+    if (excess > limit->burst) {
+        return NGX_BUSY;
+    }
+
+    if (account) {
+        if (shard->sh->deltas) {
+            shard->sh->deltas[slot - shard->sh->slots]++;
+        }
+
+        return NGX_OK;
+    }
+
+    ctx->slot = slot;
+    ctx->hash = hash;
+    ctx->shard = shard;
 
     return NGX_AGAIN;
 }
 
 
+static ngx_http_limit_req_slot_t *
+ngx_http_limit_req_find_slot(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, uint32_t hash)
+{
+    int32_t                     ms, oldest;
+    uint32_t                    now;
+    ngx_uint_t                  i;
+    ngx_http_limit_req_slot_t  *slot, *bucket;
+
+    /* the remainder of the division by the number of shards selects a shard */
+
+    bucket = &shard->sh->slots[hash / ctx->nshards % shard->sh->nbuckets
+                               * NGX_HTTP_LIMIT_REQ_BUCKET];
+
+    now = (uint32_t) ngx_current_msec;
+
+    slot = bucket;
+    oldest = -1;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_BUCKET; i++) {
+
+        if (bucket[i].hash == hash) {
+            return &bucket[i];
+        }
+
+        ms = (bucket[i].hash == 0) ? (int32_t) NGX_MAX_INT32_VALUE
+                                   : (int32_t) (now - bucket[i].last);
+
+        if (ms > oldest) {
+            oldest = ms;
+            slot = &bucket[i];
+        }
+    }
+
+    /* the least recently used slot is replaced */
+
+    slot->hash = hash;
+    slot->last = now;
+    slot->value = 0;
+
+    if (shard->sh->deltas) {
+        shard->sh->deltas[slot - shard->sh->slots] = 0;
+    }
+
+    return slot;
+}
+
+
+/*
+ * returns the excess of a request, and accounts n requests
+ * unless the excess is greater than burst
+ */
+
+static ngx_uint_t
+ngx_http_limit_req_slot_update(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_slot_t *slot, ngx_uint_t burst, ngx_uint_t n)
+{
+    int32_t     ms;
+    uint32_t    now, start;
+    uint64_t    level, drained, prev, cur, count;
+    ngx_uint_t  excess;
+
+    now = (uint32_t) ngx_current_msec;
+    ms = (int32_t) (now - slot->last);
+
+    if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_TOKEN_BUCKET) {
+
+        /*
+         * the level is kept in units of 1/period of a request,
+         * so "limit" units drain every millisecond exactly
+         */
+
+        level = slot->value;
+
+        if (ms < 0) {
+            level = 0;
+
+        } else {
+            drained = (uint64_t) ms * ctx->limit;
+            level = (level > drained) ? level - drained : 0;
+        }
+
+        excess = (ngx_uint_t) (level * 1000 / ctx->period);
+
+        if (n && excess <= burst) {
+            slot->value = level + (uint64_t) n * ctx->period;
+            slot->last = now;
+        }
+
+        return excess;
+    }
+
+    /* NGX_HTTP_LIMIT_REQ_SLIDING_WINDOW */
+
+    start = slot->last;
+    prev = slot->value >> 32;
+    cur = slot->value & 0xffffffff;
+
+    if (ms < 0 || (ngx_msec_t) ms >= 2 * ctx->period) {
+        start = now;
+        ms = 0;
+        prev = 0;
+        cur = 0;
+
+    } else if ((ngx_msec_t) ms >= ctx->period) {
+        start += ctx->period;
+        ms -= ctx->period;
+        prev = cur;
+        cur = 0;
+    }
+
+    /* the previous window is weighted by its part still in the window */
+
+    count = prev * 1000 * (ctx->period - ms) / ctx->period + cur * 1000;
+
+    excess = (count + 1000 > ctx->limit * 1000)
+             ? (ngx_uint_t) (count + 1000 - ctx->limit * 1000) : 0;
+
+    if (n && excess <= burst) {
+        cur = ngx_min(cur + n, 0xffffffff);
+
+        slot->value = prev << 32 | cur;
+        slot->last = start;
+    }
+
+    return excess;
+}
+
+
 static ngx_msec_t
 ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
     ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit)
@@ -560,13 +852,39 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 
     while (n--) {
         ctx = limits[n].shm_zone->data;
+
+        if (ctx->slot) {
+            ngx_shmtx_lock(&ctx->shard->shpool->mutex);
+
+            /* the slot may have been taken by another key meanwhile */
+
+            if (ctx->slot->hash == ctx->hash) {
+                excess = ngx_http_limit_req_slot_update(ctx, ctx->slot,
+                                                        NGX_MAX_INT_T_VALUE, 1);
+
+                if (ctx->shard->sh->deltas) {
+                    ctx->shard->sh->deltas[ctx->slot
+                                           - ctx->shard->sh->slots]++;
+                }
+
+            } else {
+                excess = 0;
+            }
+
+            ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
+
+            ctx->slot = NULL;
+
+            goto check;
+        }
+
         lr = ctx->node;
 
         if (lr == NULL) {
             continue;
         }
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        ngx_shmtx_lock(&ctx->shard->shpool->mutex);
 
         now = ngx_current_msec;
         ms = (ngx_msec_int_t) (now - lr->last);
@@ -591,10 +909,12 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
         lr->excess = excess;
         lr->count--;
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
 
         ctx->node = NULL;
 
+    check:
+
         if ((ngx_uint_t) excess <= limits[n].delay) {
             continue;
         }
@@ -613,7 +933,8 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 
 
 static void
-ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
+ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n)
 {
     ngx_int_t                   excess;
     ngx_msec_t                  now;
@@ -632,11 +953,11 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&ctx->sh->queue)) {
+        if (ngx_queue_empty(&shard->sh->queue)) {
             return;
         }
 
-        q = ngx_queue_last(&ctx->sh->queue);
+        q = ngx_queue_last(&shard->sh->queue);
 
         lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
 
@@ -671,9 +992,9 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
         node = (ngx_rbtree_node_t *)
                    ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
 
-        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+        ngx_rbtree_delete(&shard->sh->rbtree, node);
 
-        ngx_slab_free_locked(ctx->shpool, node);
+        ngx_slab_free_locked(shard->shpool, node);
     }
 }
 
@@ -683,8 +1004,11 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_req_ctx_t  *octx = data;
 
-    size_t                     len;
-    ngx_http_limit_req_ctx_t  *ctx;
+    u_char                     *p;
+    size_t                      len, size;
+    ngx_uint_t                  i;
+    ngx_slab_pool_t            *shpool, *sp, **pools;
+    ngx_http_limit_req_ctx_t   *ctx;
 
     ctx = shm_zone->data;
 
@@ -702,149 +1026,719 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
-        ctx->sh = octx->sh;
-        ctx->shpool = octx->shpool;
+        if (ctx->algorithm != octx->algorithm) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses another algorithm "
+                          "than previously", &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
+        if (ctx->sync != octx->sync) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" is %ssynchronized "
+                          "while previously it was %ssynchronized",
+                          &shm_zone->shm.name, ctx->sync ? "" : "not ",
+                          octx->sync ? "" : "not ");
+            return NGX_ERROR;
+        }
+
+        if (ctx->nshards != octx->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->nshards, octx->nshards);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(ctx->shards, octx->shards,
+                   ctx->nshards * sizeof(ngx_http_limit_req_shard_t));
 
         return NGX_OK;
     }
 
-    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
     if (shm_zone->shm.exists) {
-        ctx->sh = ctx->shpool->data;
+
+        if (ctx->nshards == 1) {
+            ctx->shards[0].shpool = shpool;
+            ctx->shards[0].sh = shpool->data;
+
+        } else {
+            pools = shpool->data;
+
+            for (i = 0; i < ctx->nshards; i++) {
+                ctx->shards[i].shpool = pools[i];
+                ctx->shards[i].sh = pools[i]->data;
+
+                if (shm_zone->shm.restored) {
+                    ngx_memzero(&pools[i]->lock, sizeof(ngx_shmtx_sh_t));
+
+                    if (ngx_shmtx_create(&pools[i]->mutex, &pools[i]->lock,
+                                         NULL)
+                        != NGX_OK)
+                    {
+                        return NGX_ERROR;
+                    }
+                }
+            }
+        }
+
+        if (shm_zone->shm.restored) {
+            for (i = 0; i < ctx->nshards; i++) {
+                ctx->shards[i].sh->rbtree.insert =
+                                         ngx_http_limit_req_rbtree_insert_value;
+            }
+        }
 
         return NGX_OK;
     }
 
-    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_limit_req_shctx_t));
-    if (ctx->sh == NULL) {
+    len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
         return NGX_ERROR;
     }
 
-    ctx->shpool->data = ctx->sh;
+    ngx_sprintf(shpool->log_ctx, " in limit_req zone \"%V\"%Z",
+                &shm_zone->shm.name);
 
-    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
-                    ngx_http_limit_req_rbtree_insert_value);
+    shpool->log_nomem = 0;
+    shpool->magazine = 1;
 
-    ngx_queue_init(&ctx->sh->queue);
+    if (ctx->nshards == 1) {
+        return ngx_http_limit_req_init_shard(ctx, &ctx->shards[0], shpool);
+    }
 
-    len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
+    /*
+     * each shard is a separate slab pool with its own mutex,
+     * carved out of the zone pool in equal parts
+     */
 
-    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
-    if (ctx->shpool->log_ctx == NULL) {
+    pools = ngx_slab_alloc(shpool, ctx->nshards * sizeof(ngx_slab_pool_t *));
+    if (pools == NULL) {
         return NGX_ERROR;
     }
 
-    ngx_sprintf(ctx->shpool->log_ctx, " in limit_req zone \"%V\"%Z",
-                &shm_zone->shm.name);
+    shpool->data = pools;
 
-    ctx->shpool->log_nomem = 0;
+    size = shpool->pfree / ctx->nshards * ngx_pagesize;
 
-    return NGX_OK;
-}
+    for (i = 0; i < ctx->nshards; i++) {
 
+        p = ngx_slab_alloc(shpool, size);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
 
-static ngx_int_t
-ngx_http_limit_req_status_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    if (r->main->limit_req_status == 0) {
-        v->not_found = 1;
-        return NGX_OK;
-    }
+        sp = (ngx_slab_pool_t *) p;
 
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
-    v->len = ngx_http_limit_req_status[r->main->limit_req_status - 1].len;
-    v->data = ngx_http_limit_req_status[r->main->limit_req_status - 1].data;
+        sp->end = p + size;
+        sp->min_shift = 3;
+        sp->addr = p;
+
+        if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_slab_init(sp);
+
+        sp->log_ctx = shpool->log_ctx;
+        sp->log_nomem = 0;
+        sp->magazine = 1;
+
+        pools[i] = sp;
+
+        if (ngx_http_limit_req_init_shard(ctx, &ctx->shards[i], sp) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
 
     return NGX_OK;
 }
 
 
-static void *
-ngx_http_limit_req_create_conf(ngx_conf_t *cf)
+static ngx_int_t
+ngx_http_limit_req_init_shard(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, ngx_slab_pool_t *shpool)
 {
-    ngx_http_limit_req_conf_t  *conf;
+    size_t  size, slot;
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_req_conf_t));
-    if (conf == NULL) {
-        return NULL;
-    }
-
-    /*
-     * set by ngx_pcalloc():
-     *
-     *     conf->limits.elts = NULL;
-     */
+    shard->shpool = shpool;
 
-    conf->limit_log_level = NGX_CONF_UNSET_UINT;
-    conf->status_code = NGX_CONF_UNSET_UINT;
-    conf->dry_run = NGX_CONF_UNSET;
+    shard->sh = ngx_slab_alloc(shpool, sizeof(ngx_http_limit_req_shctx_t));
+    if (shard->sh == NULL) {
+        return NGX_ERROR;
+    }
 
-    return conf;
-}
+    shpool->data = shard->sh;
 
+    ngx_rbtree_init(&shard->sh->rbtree, &shard->sh->sentinel,
+                    ngx_http_limit_req_rbtree_insert_value);
 
-static char *
-ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent, void *child)
-{
-    ngx_http_limit_req_conf_t *prev = parent;
-    ngx_http_limit_req_conf_t *conf = child;
+    ngx_queue_init(&shard->sh->queue);
 
-    if (conf->limits.elts == NULL) {
-        conf->limits = prev->limits;
+    if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_LEAKY_BUCKET) {
+        return NGX_OK;
     }
 
-    ngx_conf_merge_uint_value(conf->limit_log_level, prev->limit_log_level,
-                              NGX_LOG_ERR);
+    /* the slots take all the remaining memory at once */
 
-    conf->delay_log_level = (conf->limit_log_level == NGX_LOG_INFO) ?
-                                NGX_LOG_INFO : conf->limit_log_level + 1;
+    size = shpool->pfree * ngx_pagesize;
+    slot = sizeof(ngx_http_limit_req_slot_t)
+           + (ctx->sync ? sizeof(uint32_t) : 0);
 
-    ngx_conf_merge_uint_value(conf->status_code, prev->status_code,
-                              NGX_HTTP_SERVICE_UNAVAILABLE);
+    shard->sh->nbuckets = size / (NGX_HTTP_LIMIT_REQ_BUCKET * slot);
 
-    ngx_conf_merge_value(conf->dry_run, prev->dry_run, 0);
+    shard->sh->slots = ngx_slab_calloc(shpool, size);
+    if (shard->sh->slots == NULL || shard->sh->nbuckets == 0) {
+        return NGX_ERROR;
+    }
 
-    return NGX_CONF_OK;
+    if (ctx->sync) {
+        shard->sh->deltas = (uint32_t *)
+            (shard->sh->slots + shard->sh->nbuckets * NGX_HTTP_LIMIT_REQ_BUCKET);
+    }
+
+    return NGX_OK;
 }
 
 
-static char *
-ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static ngx_int_t
+ngx_http_limit_req_init_process(ngx_cycle_t *cycle)
 {
-    u_char                            *p;
-    size_t                             len;
-    ssize_t                            size;
-    ngx_str_t                         *value, name, s;
-    ngx_int_t                          rate, scale;
-    ngx_uint_t                         i;
-    ngx_shm_zone_t                    *shm_zone;
-    ngx_http_limit_req_ctx_t          *ctx;
-    ngx_http_compile_complex_value_t   ccv;
+    int                              reuseport;
+    ngx_socket_t                     s;
+    ngx_connection_t                *c;
+    ngx_http_limit_req_main_conf_t  *lrmcf;
 
-    value = cf->args->elts;
+    /* zones are shared, so synchronizing from the first worker is enough */
 
-    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_req_ctx_t));
-    if (ctx == NULL) {
-        return NGX_CONF_ERROR;
+    if ((ngx_process != NGX_PROCESS_WORKER || ngx_worker != 0)
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
     }
 
-    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+    lrmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_limit_req_module);
+    if (lrmcf == NULL || lrmcf->zones.nelts == 0) {
+        return NGX_OK;
+    }
 
-    ccv.cf = cf;
-    ccv.value = &value[1];
-    ccv.complex_value = &ctx->key;
+    s = ngx_socket(lrmcf->listen->sockaddr->sa_family, SOCK_DGRAM, 0);
 
-    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
-        return NGX_CONF_ERROR;
+    if (s == (ngx_socket_t) -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_socket_n " failed");
+        return NGX_OK;
     }
 
-    size = 0;
+    /* the socket of an old worker process may still be open */
+
+    reuseport = 1;
+
+#if (NGX_HAVE_REUSEPORT)
+
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                   (const void *) &reuseport, sizeof(int))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_REUSEPORT) failed");
+    }
+
+#endif
+
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR,
+                   (const void *) &reuseport, sizeof(int))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_REUSEADDR) failed");
+    }
+
+    if (ngx_nonblocking(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_nonblocking_n " failed");
+        goto failed;
+    }
+
+    if (bind(s, lrmcf->listen->sockaddr, lrmcf->listen->socklen) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "bind() to %V failed, limit_req zones "
+                      "are not synchronized", &lrmcf->listen->name);
+        goto failed;
+    }
+
+    c = ngx_get_connection(s, cycle->log);
+    if (c == NULL) {
+        goto failed;
+    }
+
+    c->type = SOCK_DGRAM;
+    c->data = lrmcf;
+
+    c->read->handler = ngx_http_limit_req_sync_read_handler;
+    c->read->log = cycle->log;
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        return NGX_OK;
+    }
+
+    lrmcf->connection = c;
+
+    lrmcf->event.handler = ngx_http_limit_req_sync_handler;
+    lrmcf->event.data = lrmcf;
+    lrmcf->event.log = cycle->log;
+    lrmcf->event.cancelable = 1;
+
+    ngx_add_timer(&lrmcf->event, lrmcf->interval);
+
+    return NGX_OK;
+
+failed:
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " failed");
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_limit_req_sync_handler(ngx_event_t *ev)
+{
+    ngx_uint_t                        i;
+    ngx_shm_zone_t                  **zones;
+    ngx_http_limit_req_main_conf_t   *lrmcf;
+
+    lrmcf = ev->data;
+
+    zones = lrmcf->zones.elts;
+
+    for (i = 0; i < lrmcf->zones.nelts; i++) {
+        ngx_http_limit_req_sync_zone(lrmcf, zones[i]);
+    }
+
+    ngx_add_timer(ev, lrmcf->interval);
+}
+
+
+static void
+ngx_http_limit_req_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                        i;
+    ngx_shm_zone_t                  **zones;
+    ngx_http_limit_req_main_conf_t   *lrmcf;
+
+    lrmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_limit_req_module);
+    if (lrmcf == NULL || lrmcf->connection == NULL) {
+        return;
+    }
+
+    /* requests accounted since the last timer are not lost */
+
+    zones = lrmcf->zones.elts;
+
+    for (i = 0; i < lrmcf->zones.nelts; i++) {
+        ngx_http_limit_req_sync_zone(lrmcf, zones[i]);
+    }
+
+    ngx_close_connection(lrmcf->connection);
+    lrmcf->connection = NULL;
+}
+
+
+/*
+ * a datagram is the magic, the zone name length and name,
+ * followed by pairs of a key hash and a number of requests
+ * accounted since the previous datagram, in network byte order
+ */
+
+static void
+ngx_http_limit_req_sync_zone(ngx_http_limit_req_main_conf_t *lrmcf,
+    ngx_shm_zone_t *shm_zone)
+{
+    u_char                      *p, *start, *end;
+    uint32_t                     n;
+    ngx_uint_t                   i, k, nslots;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_shard_t  *shard;
+    u_char                       buf[NGX_HTTP_LIMIT_REQ_SYNC_SIZE];
+
+    ctx = shm_zone->data;
+
+    p = ngx_cpymem(buf, NGX_HTTP_LIMIT_REQ_SYNC_MAGIC, 4);
+    *p++ = (u_char) shm_zone->shm.name.len;
+    p = ngx_cpymem(p, shm_zone->shm.name.data, shm_zone->shm.name.len);
+
+    start = p;
+    end = buf + NGX_HTTP_LIMIT_REQ_SYNC_SIZE - 2 * sizeof(uint32_t);
+
+    for (k = 0; k < ctx->nshards; k++) {
+        shard = &ctx->shards[k];
+        nslots = shard->sh->nbuckets * NGX_HTTP_LIMIT_REQ_BUCKET;
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        for (i = 0; i < nslots; i++) {
+
+            if (shard->sh->deltas[i] == 0) {
+                continue;
+            }
+
+            n = htonl(shard->sh->slots[i].hash);
+            p = ngx_cpymem(p, &n, sizeof(uint32_t));
+
+            n = htonl(shard->sh->deltas[i]);
+            p = ngx_cpymem(p, &n, sizeof(uint32_t));
+
+            shard->sh->deltas[i] = 0;
+
+            if (p > end) {
+                ngx_shmtx_unlock(&shard->shpool->mutex);
+
+                ngx_http_limit_req_sync_send(lrmcf, buf, p - buf);
+                p = start;
+
+                ngx_shmtx_lock(&shard->shpool->mutex);
+            }
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
+    if (p != start) {
+        ngx_http_limit_req_sync_send(lrmcf, buf, p - buf);
+    }
+}
+
+
+static void
+ngx_http_limit_req_sync_send(ngx_http_limit_req_main_conf_t *lrmcf,
+    u_char *buf, size_t len)
+{
+    ngx_uint_t   i;
+    ngx_addr_t  *peer;
+
+    peer = lrmcf->peers.elts;
+
+    for (i = 0; i < lrmcf->peers.nelts; i++) {
+
+        if (sendto(lrmcf->connection->fd, buf, len, 0, peer[i].sockaddr,
+                   peer[i].socklen)
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_INFO, lrmcf->connection->log,
+                          ngx_socket_errno,
+                          "sendto() to limit_req peer %V failed",
+                          &peer[i].name);
+        }
+    }
+}
+
+
+static void
+ngx_http_limit_req_sync_read_handler(ngx_event_t *rev)
+{
+    ssize_t                          n;
+    ngx_err_t                        err;
+    ngx_uint_t                       i;
+    socklen_t                        socklen;
+    ngx_addr_t                      *peer;
+    ngx_sockaddr_t                   sa;
+    ngx_connection_t                *c;
+    ngx_http_limit_req_main_conf_t  *lrmcf;
+    u_char                           buf[NGX_HTTP_LIMIT_REQ_SYNC_SIZE];
+
+    c = rev->data;
+    lrmcf = c->data;
+
+    for ( ;; ) {
+        socklen = sizeof(ngx_sockaddr_t);
+
+        n = recvfrom(c->fd, buf, NGX_HTTP_LIMIT_REQ_SYNC_SIZE, 0,
+                     &sa.sockaddr, &socklen);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EAGAIN) {
+                break;
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_INFO, c->log, err,
+                          "recvfrom() from limit_req peer failed");
+            break;
+        }
+
+        /* only the peers configured may change the limits */
+
+        peer = lrmcf->peers.elts;
+
+        for (i = 0; i < lrmcf->peers.nelts; i++) {
+            if (ngx_cmp_sockaddr(&sa.sockaddr, socklen, peer[i].sockaddr,
+                                 peer[i].socklen, 0)
+                == NGX_OK)
+            {
+                ngx_http_limit_req_sync_receive(lrmcf, buf, n);
+                break;
+            }
+        }
+    }
+
+    rev->ready = 0;
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "limit_req zones synchronization stopped");
+    }
+}
+
+
+static void
+ngx_http_limit_req_sync_receive(ngx_http_limit_req_main_conf_t *lrmcf,
+    u_char *buf, size_t len)
+{
+    u_char                      *p, *last;
+    uint32_t                     hash, n;
+    ngx_str_t                    name;
+    ngx_uint_t                   i;
+    ngx_shm_zone_t             **zones, *shm_zone;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_slot_t   *slot;
+    ngx_http_limit_req_shard_t  *shard;
+
+    if (len < 5 || ngx_memcmp(buf, NGX_HTTP_LIMIT_REQ_SYNC_MAGIC, 4) != 0) {
+        return;
+    }
+
+    name.len = buf[4];
+    name.data = &buf[5];
+
+    if (len < 5 + name.len) {
+        return;
+    }
+
+    zones = lrmcf->zones.elts;
+    shm_zone = NULL;
+
+    for (i = 0; i < lrmcf->zones.nelts; i++) {
+        if (zones[i]->shm.name.len == name.len
+            && ngx_strncmp(zones[i]->shm.name.data, name.data, name.len) == 0)
+        {
+            shm_zone = zones[i];
+            break;
+        }
+    }
+
+    if (shm_zone == NULL) {
+        return;
+    }
+
+    ctx = shm_zone->data;
+
+    last = buf + len - 2 * sizeof(uint32_t);
+
+    for (p = name.data + name.len; p <= last; p += 2 * sizeof(uint32_t)) {
+
+        ngx_memcpy(&hash, p, sizeof(uint32_t));
+        ngx_memcpy(&n, p + sizeof(uint32_t), sizeof(uint32_t));
+
+        hash = ntohl(hash);
+        n = ntohl(n);
+
+        if (hash == 0 || n == 0) {
+            continue;
+        }
+
+        shard = &ctx->shards[hash % ctx->nshards];
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        /* requests accounted by peers are added without a limit */
+
+        slot = ngx_http_limit_req_find_slot(ctx, shard, hash);
+
+        (void) ngx_http_limit_req_slot_update(ctx, slot, NGX_MAX_INT_T_VALUE,
+                                              n);
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_status_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    if (r->main->limit_req_status == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = ngx_http_limit_req_status[r->main->limit_req_status - 1].len;
+    v->data = ngx_http_limit_req_status[r->main->limit_req_status - 1].data;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_limit_req_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_limit_req_main_conf_t  *lrmcf;
+
+    lrmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_req_main_conf_t));
+    if (lrmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     lrmcf->listen = NULL;
+     *     lrmcf->connection = NULL;
+     */
+
+    if (ngx_array_init(&lrmcf->peers, cf->pool, 2, sizeof(ngx_addr_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&lrmcf->zones, cf->pool, 2, sizeof(ngx_shm_zone_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    lrmcf->interval = NGX_CONF_UNSET_MSEC;
+
+    return lrmcf;
+}
+
+
+static char *
+ngx_http_limit_req_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_limit_req_main_conf_t  *lrmcf = conf;
+
+    ngx_conf_init_msec_value(lrmcf->interval, 100);
+
+    if (lrmcf->zones.nelts && lrmcf->listen == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "synchronized limit_req zones "
+                           "require \"limit_req_sync_listen\"");
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static void *
+ngx_http_limit_req_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_limit_req_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_req_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->limits.elts = NULL;
+     */
+
+    conf->limit_log_level = NGX_CONF_UNSET_UINT;
+    conf->status_code = NGX_CONF_UNSET_UINT;
+    conf->dry_run = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_limit_req_conf_t *prev = parent;
+    ngx_http_limit_req_conf_t *conf = child;
+
+    if (conf->limits.elts == NULL) {
+        conf->limits = prev->limits;
+    }
+
+    ngx_conf_merge_uint_value(conf->limit_log_level, prev->limit_log_level,
+                              NGX_LOG_ERR);
+
+    conf->delay_log_level = (conf->limit_log_level == NGX_LOG_INFO) ?
+                                NGX_LOG_INFO : conf->limit_log_level + 1;
+
+    ngx_conf_merge_uint_value(conf->status_code, prev->status_code,
+                              NGX_HTTP_SERVICE_UNAVAILABLE);
+
+    ngx_conf_merge_value(conf->dry_run, prev->dry_run, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_limit_req_main_conf_t  *lrmcf = conf;
+
+    u_char                            *p;
+    size_t                             len;
+    ssize_t                            size;
+    ngx_str_t                         *value, name, s;
+    ngx_int_t                          rate, scale, shards;
+    ngx_uint_t                         i, algorithm, sync;
+    ngx_shm_zone_t                   **zonep;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_limit_req_ctx_t          *ctx;
+    ngx_http_compile_complex_value_t   ccv;
+
+    value = cf->args->elts;
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_req_ctx_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = &ctx->key;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    size = 0;
     rate = 1;
     scale = 1;
+    shards = 1;
+    algorithm = NGX_HTTP_LIMIT_REQ_LEAKY_BUCKET;
+    sync = 0;
     name.len = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
@@ -907,6 +1801,61 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0 || shards > NGX_HTTP_LIMIT_REQ_MAX_SHARDS) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid shards value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"shards\" is not supported "
+                                   "on this platform");
+                return NGX_CONF_ERROR;
+            }
+
+#endif
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "algorithm=", 10) == 0) {
+
+            s.len = value[i].len - 10;
+            s.data = value[i].data + 10;
+
+            if (s.len == 12 && ngx_strncmp(s.data, "leaky_bucket", 12) == 0) {
+                algorithm = NGX_HTTP_LIMIT_REQ_LEAKY_BUCKET;
+
+            } else if (s.len == 12
+                       && ngx_strncmp(s.data, "token_bucket", 12) == 0)
+            {
+                algorithm = NGX_HTTP_LIMIT_REQ_TOKEN_BUCKET;
+
+            } else if (s.len == 14
+                       && ngx_strncmp(s.data, "sliding_window", 14) == 0)
+            {
+                algorithm = NGX_HTTP_LIMIT_REQ_SLIDING_WINDOW;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid algorithm \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "sync") == 0) {
+            sync = 1;
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -919,7 +1868,40 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (sync && algorithm == NGX_HTTP_LIMIT_REQ_LEAKY_BUCKET) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"sync\" requires the \"token_bucket\" "
+                           "or \"sliding_window\" algorithm");
+        return NGX_CONF_ERROR;
+    }
+
+    if (sync && name.len > 255) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone name \"%V\" is too long for \"sync\"",
+                           &name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size && size < (ssize_t) (8 * ngx_pagesize * shards)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small for %i shards",
+                           &name, shards);
+        return NGX_CONF_ERROR;
+    }
+
     ctx->rate = rate * 1000 / scale;
+    ctx->limit = rate;
+    ctx->period = scale * 1000;
+    ctx->algorithm = algorithm;
+    ctx->sync = sync;
+
+    ctx->nshards = shards;
+
+    ctx->shards = ngx_pcalloc(cf->pool,
+                              shards * sizeof(ngx_http_limit_req_shard_t));
+    if (ctx->shards == NULL) {
+        return NGX_CONF_ERROR;
+    }
 
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_req_module);
@@ -939,6 +1921,19 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     shm_zone->init = ngx_http_limit_req_init_zone;
     shm_zone->data = ctx;
 
+    /* the contents of a persistent zone depend on these */
+
+    shm_zone->shm.layout = (ngx_uint_t) shards << 8 | algorithm << 1 | sync;
+
+    if (sync) {
+        zonep = ngx_array_push(&lrmcf->zones);
+        if (zonep == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *zonep = shm_zone;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -1047,11 +2042,101 @@ ngx_http_limit_req(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_limit_req_sync_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_limit_req_main_conf_t  *lrmcf = conf;
+
+    ngx_str_t  *value;
+    ngx_url_t   u;
+
+    if (lrmcf->listen) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+    u.listen = 1;
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in \"%V\" of the \"%V\" directive",
+                               u.err, &u.url, &cmd->name);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    if (u.no_port) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no port in \"%V\" of the \"%V\" directive",
+                           &u.url, &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    lrmcf->listen = &u.addrs[0];
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_limit_req_sync_peer(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_limit_req_main_conf_t  *lrmcf = conf;
+
+    ngx_str_t   *value;
+    ngx_url_t    u;
+    ngx_uint_t   i;
+    ngx_addr_t  *peer;
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in \"%V\" of the \"%V\" directive",
+                               u.err, &u.url, &cmd->name);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    if (u.no_port) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no port in \"%V\" of the \"%V\" directive",
+                           &u.url, &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 0; i < u.naddrs; i++) {
+        peer = ngx_array_push(&lrmcf->peers);
+        if (peer == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *peer = u.addrs[i];
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static ngx_int_t
 ngx_http_limit_req_add_variables(ngx_conf_t *cf)
 {
     ngx_http_variable_t  *var, *v;
 
+    ngx_http_share_loc_conf(cf, &ngx_http_limit_req_module);
+
     for (v = ngx_http_limit_req_vars; v->name.len; v++) {
         var = ngx_http_add_variable(cf, &v->name, v->flags);
         if (var == NULL) {
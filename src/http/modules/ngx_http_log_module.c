@@ -35,6 +35,7 @@ typedef struct {
     ngx_str_t                   name;
     ngx_array_t                *flushes;
     ngx_array_t                *ops;        /* array of ngx_http_log_op_t */
+    ngx_uint_t                  binary;     /* unsigned  binary:1 */
 } ngx_http_log_fmt_t;
 
 
@@ -52,9 +53,33 @@ typedef struct {
     ngx_event_t                *event;
     ngx_msec_t                  flush;
     ngx_int_t                   gzip;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *task;
+    ngx_thread_task_t         **free;       /* ring of idle buffers */
+    ngx_uint_t                  nfree;
+    ngx_uint_t                  nbuffers;
+    ngx_uint_t                  dropped;
+#endif
 } ngx_http_log_buf_t;
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_open_file_t            *file;
+    u_char                     *start;
+    size_t                      len;
+    ngx_fd_t                    fd;
+    ngx_int_t                   gzip;
+    ssize_t                     n;
+    ngx_err_t                   err;
+} ngx_http_log_thread_ctx_t;
+
+#endif
+
+
 typedef struct {
     ngx_array_t                *lengths;
     ngx_array_t                *values;
@@ -95,6 +120,27 @@ typedef struct {
 #define NGX_HTTP_LOG_ESCAPE_NONE     2
 
 
+/*
+ * a binary log record is a 6-byte header (magic, version, 32-bit length
+ * of the rest of the record) followed by the fields, each starting with
+ * a type byte; all integers are in network byte order
+ */
+
+#define NGX_HTTP_LOG_BINARY_MAGIC    0x4e
+#define NGX_HTTP_LOG_BINARY_VERSION  1
+#define NGX_HTTP_LOG_BINARY_HEADER   6
+
+#define NGX_HTTP_LOG_BINARY_NONE     0
+#define NGX_HTTP_LOG_BINARY_UINT     1      /* 64-bit integer */
+#define NGX_HTTP_LOG_BINARY_TIME     2      /* msec since the epoch */
+#define NGX_HTTP_LOG_BINARY_MSEC     3      /* duration in msec */
+#define NGX_HTTP_LOG_BINARY_ADDR     4      /* length byte, 4 or 16 bytes */
+#define NGX_HTTP_LOG_BINARY_STRING   5      /* 16-bit length, bytes */
+
+#define NGX_HTTP_LOG_BINARY_INT_LEN  9
+#define NGX_HTTP_LOG_BINARY_ADDR_LEN 18
+
+
 static void ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log,
     u_char *buf, size_t len);
 static ssize_t ngx_http_log_script_write(ngx_http_request_t *r,
@@ -111,6 +157,13 @@ static void ngx_http_log_gzip_free(void *opaque, void *address);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_log_thread_post(ngx_open_file_t *file,
+    ngx_log_t *log);
+static void ngx_http_log_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_log_thread_event_handler(ngx_event_t *ev);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -130,6 +183,29 @@ static u_char *ngx_http_log_body_bytes_sent(ngx_http_request_t *r,
 static u_char *ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 
+static u_char *ngx_http_log_binary_record(ngx_http_request_t *r,
+    ngx_http_log_fmt_t *fmt, u_char *buf);
+static u_char *ngx_http_log_binary_pipe(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_request_time(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_bytes_sent(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_body_bytes_sent(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_request_length(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_remote_addr(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static size_t ngx_http_log_binary_variable_getlen(ngx_http_request_t *r,
+    uintptr_t data);
+static u_char *ngx_http_log_binary_variable(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+
 static ngx_int_t ngx_http_log_variable_compile(ngx_conf_t *cf,
     ngx_http_log_op_t *op, ngx_str_t *value, ngx_uint_t escape);
 static size_t ngx_http_log_variable_getlen(ngx_http_request_t *r,
@@ -156,7 +232,8 @@ static char *ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_log_compile_format(ngx_conf_t *cf,
-    ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
+    ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s,
+    ngx_uint_t binary);
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
@@ -250,6 +327,32 @@ static ngx_http_log_var_t  ngx_http_log_vars[] = {
 };
 
 
+static ngx_http_log_var_t  ngx_http_log_binary_vars[] = {
+    { ngx_string("pipe"), NGX_HTTP_LOG_BINARY_INT_LEN,
+                          ngx_http_log_binary_pipe },
+    { ngx_string("time_local"), NGX_HTTP_LOG_BINARY_INT_LEN,
+                          ngx_http_log_binary_time },
+    { ngx_string("time_iso8601"), NGX_HTTP_LOG_BINARY_INT_LEN,
+                          ngx_http_log_binary_time },
+    { ngx_string("msec"), NGX_HTTP_LOG_BINARY_INT_LEN,
+                          ngx_http_log_binary_time },
+    { ngx_string("request_time"), NGX_HTTP_LOG_BINARY_INT_LEN,
+                          ngx_http_log_binary_request_time },
+    { ngx_string("status"), NGX_HTTP_LOG_BINARY_INT_LEN,
+                          ngx_http_log_binary_status },
+    { ngx_string("bytes_sent"), NGX_HTTP_LOG_BINARY_INT_LEN,
+                          ngx_http_log_binary_bytes_sent },
+    { ngx_string("body_bytes_sent"), NGX_HTTP_LOG_BINARY_INT_LEN,
+                          ngx_http_log_binary_body_bytes_sent },
+    { ngx_string("request_length"), NGX_HTTP_LOG_BINARY_INT_LEN,
+                          ngx_http_log_binary_request_length },
+    { ngx_string("remote_addr"), NGX_HTTP_LOG_BINARY_ADDR_LEN,
+                          ngx_http_log_binary_remote_addr },
+
+    { ngx_null_string, 0, NULL }
+};
+
+
 static ngx_int_t
 ngx_http_log_handler(ngx_http_request_t *r)
 {
@@ -258,6 +361,9 @@ ngx_http_log_handler(ngx_http_request_t *r)
     ssize_t                   n;
     ngx_str_t                 val;
     ngx_uint_t                i, l;
+#if (NGX_THREADS)
+    ngx_int_t                 rc;
+#endif
     ngx_http_log_t           *log;
     ngx_http_log_op_t        *op;
     ngx_http_log_buf_t       *buffer;
@@ -319,7 +425,8 @@ ngx_http_log_handler(ngx_http_request_t *r)
             goto alloc_line;
         }
 
-        len += NGX_LINEFEED_SIZE;
+        len += log[l].format->binary ? NGX_HTTP_LOG_BINARY_HEADER
+                                     : NGX_LINEFEED_SIZE;
 
         buffer = log[l].file ? log[l].file->data : NULL;
 
@@ -327,12 +434,35 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
             if (len > (size_t) (buffer->last - buffer->pos)) {
 
+#if (NGX_THREADS)
+                if (buffer->thread_pool) {
+                    rc = ngx_http_log_thread_post(log[l].file,
+                                                  r->connection->log);
+
+                    if (rc == NGX_BUSY
+                        && len <= (size_t) (buffer->last - buffer->start))
+                    {
+                        /* all buffers are being written, drop the line */
+                        buffer->dropped++;
+                        continue;
+                    }
+
+                    if (rc == NGX_OK || rc == NGX_BUSY) {
+                        goto buffered;
+                    }
+                }
+#endif
+
                 ngx_http_log_write(r, &log[l], buffer->start,
                                    buffer->pos - buffer->start);
 
                 buffer->pos = buffer->start;
             }
 
+#if (NGX_THREADS)
+        buffered:
+#endif
+
             if (len <= (size_t) (buffer->last - buffer->pos)) {
 
                 p = buffer->pos;
@@ -341,6 +471,12 @@ ngx_http_log_handler(ngx_http_request_t *r)
                     ngx_add_timer(buffer->event, buffer->flush);
                 }
 
+                if (log[l].format->binary) {
+                    buffer->pos = ngx_http_log_binary_record(r, log[l].format,
+                                                             p);
+                    continue;
+                }
+
                 for (i = 0; i < log[l].format->ops->nelts; i++) {
                     p = op[i].run(r, p, &op[i]);
                 }
@@ -352,7 +488,9 @@ ngx_http_log_handler(ngx_http_request_t *r)
                 continue;
             }
 
-            if (buffer->event && buffer->event->timer_set) {
+            if (buffer->event && buffer->event->timer_set
+                && buffer->pos == buffer->start)
+            {
                 ngx_del_timer(buffer->event);
             }
         }
@@ -366,6 +504,12 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         p = line;
 
+        if (log[l].format->binary) {
+            p = ngx_http_log_binary_record(r, log[l].format, p);
+            ngx_http_log_write(r, &log[l], line, p - line);
+            continue;
+        }
+
         if (log[l].syslog_peer) {
             p = ngx_syslog_add_header(log[l].syslog_peer, line);
         }
@@ -724,6 +868,17 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 
     buffer = file->data;
 
+#if (NGX_THREADS)
+    if (buffer->dropped) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "%ui lines dropped from \"%s\", "
+                      "all %ui log buffers were busy",
+                      buffer->dropped, file->name.data, buffer->nbuffers);
+
+        buffer->dropped = 0;
+    }
+#endif
+
     len = buffer->pos - buffer->start;
 
     if (len == 0) {
@@ -762,13 +917,173 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 static void
 ngx_http_log_flush_handler(ngx_event_t *ev)
 {
+#if (NGX_THREADS)
+    ngx_int_t            rc;
+    ngx_open_file_t     *file;
+    ngx_http_log_buf_t  *buffer;
+#endif
+
     ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "http log buffer flush handler");
 
+#if (NGX_THREADS)
+    file = ev->data;
+    buffer = file->data;
+
+    if (buffer->thread_pool) {
+        rc = ngx_http_log_thread_post(file, ev->log);
+
+        if (rc == NGX_OK) {
+            return;
+        }
+
+        if (rc == NGX_BUSY) {
+            ngx_add_timer(ev, buffer->flush);
+            return;
+        }
+    }
+#endif
+
     ngx_http_log_flush(ev->data, ev->log);
 }
 
 
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_log_thread_post(ngx_open_file_t *file, ngx_log_t *log)
+{
+    ngx_fd_t                    fd;
+    ngx_thread_task_t          *task;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    buffer = file->data;
+
+    if (buffer->pos == buffer->start) {
+        return NGX_OK;
+    }
+
+    if (buffer->nfree == 0) {
+        return NGX_BUSY;
+    }
+
+    /*
+     * the descriptor is duplicated as the file may be reopened
+     * or closed while the write is still in progress
+     */
+
+    fd = dup(file->fd);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "dup() of \"%s\" failed", file->name.data);
+        return NGX_ERROR;
+    }
+
+    task = buffer->task;
+    ctx = task->ctx;
+
+    ctx->len = buffer->pos - ctx->start;
+    ctx->fd = fd;
+
+    task->event.data = task;
+    task->event.handler = ngx_http_log_thread_event_handler;
+    task->event.log = ngx_cycle->log;
+
+    if (ngx_thread_task_post(buffer->thread_pool, task) != NGX_OK) {
+        (void) ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http log thread post: %uz bytes, %ui buffers free",
+                   ctx->len, buffer->nfree - 1);
+
+    task = buffer->free[--buffer->nfree];
+    ctx = task->ctx;
+
+    buffer->task = task;
+    buffer->last = ctx->start + (buffer->last - buffer->start);
+    buffer->start = ctx->start;
+    buffer->pos = ctx->start;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_log_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_log_thread_ctx_t *ctx = data;
+
+    ssize_t  n;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                   "http log thread write: %uz", ctx->len);
+
+#if (NGX_ZLIB)
+    if (ctx->gzip) {
+        n = ngx_http_log_gzip(ctx->fd, ctx->start, ctx->len, ctx->gzip, log);
+    } else {
+        n = ngx_write_fd(ctx->fd, ctx->start, ctx->len);
+    }
+#else
+    n = ngx_write_fd(ctx->fd, ctx->start, ctx->len);
+#endif
+
+    ctx->err = (n == -1) ? ngx_errno : 0;
+    ctx->n = n;
+
+    (void) ngx_close_file(ctx->fd);
+}
+
+
+static void
+ngx_http_log_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_thread_task_t          *task;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    task = ev->data;
+    ctx = task->ctx;
+    buffer = ctx->file->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http log thread done: %z", ctx->n);
+
+    if (ctx->n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ctx->err,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      ctx->file->name.data);
+
+    } else if ((size_t) ctx->n != ctx->len) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                      ctx->file->name.data, ctx->n, ctx->len);
+    }
+
+    buffer->free[buffer->nfree++] = task;
+
+    if (buffer->dropped) {
+        ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                      "%ui lines dropped from \"%s\", "
+                      "all %ui log buffers were busy",
+                      buffer->dropped, ctx->file->name.data,
+                      buffer->nbuffers);
+
+        buffer->dropped = 0;
+    }
+}
+
+#endif
+
+
 static u_char *
 ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
@@ -912,6 +1227,225 @@ ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
 }
 
 
+static u_char *
+ngx_http_log_binary_record(ngx_http_request_t *r, ngx_http_log_fmt_t *fmt,
+    u_char *buf)
+{
+    u_char             *p;
+    size_t              len;
+    ngx_uint_t          i;
+    ngx_http_log_op_t  *op;
+
+    p = buf + NGX_HTTP_LOG_BINARY_HEADER;
+
+    op = fmt->ops->elts;
+    for (i = 0; i < fmt->ops->nelts; i++) {
+        p = op[i].run(r, p, &op[i]);
+    }
+
+    len = p - buf - NGX_HTTP_LOG_BINARY_HEADER;
+
+    buf[0] = NGX_HTTP_LOG_BINARY_MAGIC;
+    buf[1] = NGX_HTTP_LOG_BINARY_VERSION;
+    buf[2] = (u_char) (len >> 24);
+    buf[3] = (u_char) (len >> 16);
+    buf[4] = (u_char) (len >> 8);
+    buf[5] = (u_char) len;
+
+    return p;
+}
+
+
+static ngx_inline u_char *
+ngx_http_log_binary_uint(u_char *buf, ngx_uint_t type, uint64_t n)
+{
+    *buf++ = (u_char) type;
+    *buf++ = (u_char) (n >> 56);
+    *buf++ = (u_char) (n >> 48);
+    *buf++ = (u_char) (n >> 40);
+    *buf++ = (u_char) (n >> 32);
+    *buf++ = (u_char) (n >> 24);
+    *buf++ = (u_char) (n >> 16);
+    *buf++ = (u_char) (n >> 8);
+    *buf++ = (u_char) n;
+
+    return buf;
+}
+
+
+static u_char *
+ngx_http_log_binary_pipe(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_binary_uint(buf, NGX_HTTP_LOG_BINARY_UINT,
+                                    r->pipeline ? 1 : 0);
+}
+
+
+static u_char *
+ngx_http_log_binary_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return ngx_http_log_binary_uint(buf, NGX_HTTP_LOG_BINARY_TIME,
+                                    (uint64_t) tp->sec * 1000 + tp->msec);
+}
+
+
+static u_char *
+ngx_http_log_binary_request_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_time_t      *tp;
+    ngx_msec_int_t   ms;
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+    ms = ngx_max(ms, 0);
+
+    return ngx_http_log_binary_uint(buf, NGX_HTTP_LOG_BINARY_MSEC, ms);
+}
+
+
+static u_char *
+ngx_http_log_binary_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_uint_t  status;
+
+    if (r->err_status) {
+        status = r->err_status;
+
+    } else if (r->headers_out.status) {
+        status = r->headers_out.status;
+
+    } else if (r->http_version == NGX_HTTP_VERSION_9) {
+        status = 9;
+
+    } else {
+        status = 0;
+    }
+
+    return ngx_http_log_binary_uint(buf, NGX_HTTP_LOG_BINARY_UINT, status);
+}
+
+
+static u_char *
+ngx_http_log_binary_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_binary_uint(buf, NGX_HTTP_LOG_BINARY_UINT,
+                                    r->connection->sent);
+}
+
+
+static u_char *
+ngx_http_log_binary_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    off_t  length;
+
+    length = r->connection->sent - r->header_size;
+
+    return ngx_http_log_binary_uint(buf, NGX_HTTP_LOG_BINARY_UINT,
+                                    length > 0 ? length : 0);
+}
+
+
+static u_char *
+ngx_http_log_binary_request_length(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_binary_uint(buf, NGX_HTTP_LOG_BINARY_UINT,
+                                    r->request_length);
+}
+
+
+static u_char *
+ngx_http_log_binary_remote_addr(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    struct sockaddr      *sa;
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    sa = r->connection->sockaddr;
+
+    switch (sa->sa_family) {
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) sa;
+
+        *buf++ = NGX_HTTP_LOG_BINARY_ADDR;
+        *buf++ = 4;
+
+        return ngx_cpymem(buf, &sin->sin_addr, 4);
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) sa;
+
+        *buf++ = NGX_HTTP_LOG_BINARY_ADDR;
+        *buf++ = 16;
+
+        return ngx_cpymem(buf, &sin6->sin6_addr, 16);
+#endif
+
+    default: /* AF_UNIX */
+        *buf = NGX_HTTP_LOG_BINARY_NONE;
+        return buf + 1;
+    }
+}
+
+
+static size_t
+ngx_http_log_binary_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, data);
+
+    if (value == NULL || value->not_found) {
+        return 1;
+    }
+
+    return 3 + ngx_min(value->len, 0xffff);
+}
+
+
+static u_char *
+ngx_http_log_binary_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    size_t                      len;
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, op->data);
+
+    if (value == NULL || value->not_found) {
+        *buf = NGX_HTTP_LOG_BINARY_NONE;
+        return buf + 1;
+    }
+
+    /* longer values are truncated */
+
+    len = ngx_min(value->len, 0xffff);
+
+    *buf++ = NGX_HTTP_LOG_BINARY_STRING;
+    *buf++ = (u_char) (len >> 8);
+    *buf++ = (u_char) len;
+
+    return ngx_cpymem(buf, value->data, len);
+}
+
+
 static ngx_int_t
 ngx_http_log_variable_compile(ngx_conf_t *cf, ngx_http_log_op_t *op,
     ngx_str_t *value, ngx_uint_t escape)
@@ -1148,6 +1682,7 @@ ngx_http_log_create_main_conf(ngx_conf_t *cf)
     ngx_str_set(&fmt->name, "combined");
 
     fmt->flushes = NULL;
+    fmt->binary = 0;
 
     fmt->ops = ngx_array_create(cf->pool, 16, sizeof(ngx_http_log_op_t));
     if (fmt->ops == NULL) {
@@ -1244,6 +1779,13 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_uint_t                         i, n;
     ngx_msec_t                         flush;
     ngx_str_t                         *value, name, s;
+#if (NGX_THREADS)
+    ngx_int_t                          nbuffers;
+    ngx_str_t                          pool;
+    ngx_thread_pool_t                 *tp;
+    ngx_thread_task_t                 *task;
+    ngx_http_log_thread_ctx_t         *ctx;
+#endif
     ngx_http_log_t                    *log;
     ngx_syslog_peer_t                 *peer;
     ngx_http_log_buf_t                *buffer;
@@ -1361,9 +1903,20 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+    if (log->syslog_peer && log->format->binary) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "binary log format \"%V\" cannot be used "
+                           "with syslog", &name);
+        return NGX_CONF_ERROR;
+    }
+
     size = 0;
     flush = 0;
     gzip = 0;
+#if (NGX_THREADS)
+    tp = NULL;
+    nbuffers = 0;
+#endif
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1430,6 +1983,51 @@ process_formats:
 #endif
         }
 
+        if (ngx_strncmp(value[i].data, "threads", 7) == 0
+            && (value[i].len == 7 || value[i].data[7] == '='))
+        {
+#if (NGX_THREADS)
+            pool.len = value[i].len > 8 ? value[i].len - 8 : 0;
+            pool.data = value[i].data + 8;
+
+            tp = ngx_thread_pool_add(cf, pool.len ? &pool : NULL);
+            if (tp == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            if (size == 0) {
+                size = 64 * 1024;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"threads\" is unsupported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "buffers=", 8) == 0) {
+#if (NGX_THREADS)
+            nbuffers = ngx_atoi(value[i].data + 8, value[i].len - 8);
+
+            if (nbuffers < 2 || nbuffers > 64) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of buffers \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"buffers\" is unsupported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
             s.len = value[i].len - 3;
             s.data = value[i].data + 3;
@@ -1458,6 +2056,19 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_THREADS)
+    if (nbuffers && tp == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no thread pool is defined for access_log \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (tp && nbuffers == 0) {
+        nbuffers = 4;
+    }
+#endif
+
     if (flush && size == 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "no buffer is defined for access_log \"%V\"",
@@ -1493,6 +2104,18 @@ process_formats:
                 return NGX_CONF_ERROR;
             }
 
+#if (NGX_THREADS)
+            if (buffer->thread_pool != tp
+                || buffer->nbuffers != (ngx_uint_t) nbuffers)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "access_log \"%V\" already defined "
+                                   "with conflicting thread pool parameters",
+                                   &value[1]);
+                return NGX_CONF_ERROR;
+            }
+#endif
+
             return NGX_CONF_OK;
         }
 
@@ -1501,7 +2124,51 @@ process_formats:
             return NGX_CONF_ERROR;
         }
 
+#if (NGX_THREADS)
+        if (tp) {
+            buffer->free = ngx_palloc(cf->pool,
+                                      nbuffers * sizeof(ngx_thread_task_t *));
+            if (buffer->free == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            for (n = 0; n < (ngx_uint_t) nbuffers; n++) {
+                task = ngx_thread_task_alloc(cf->pool,
+                                             sizeof(ngx_http_log_thread_ctx_t));
+                if (task == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                ctx = task->ctx;
+
+                ctx->start = ngx_pnalloc(cf->pool, size);
+                if (ctx->start == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                ctx->file = log->file;
+                ctx->gzip = gzip;
+
+                task->handler = ngx_http_log_thread_handler;
+
+                buffer->free[n] = task;
+            }
+
+            buffer->task = buffer->free[--nbuffers];
+            buffer->nfree = nbuffers;
+            buffer->nbuffers = nbuffers + 1;
+            buffer->thread_pool = tp;
+
+            buffer->start = ((ngx_http_log_thread_ctx_t *)
+                                                 buffer->task->ctx)->start;
+
+        } else {
+            buffer->start = ngx_pnalloc(cf->pool, size);
+        }
+#else
         buffer->start = ngx_pnalloc(cf->pool, size);
+#endif
+
         if (buffer->start == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1539,7 +2206,7 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_log_main_conf_t *lmcf = conf;
 
     ngx_str_t           *value;
-    ngx_uint_t           i;
+    ngx_uint_t           i, s;
     ngx_http_log_fmt_t  *fmt;
 
     value = cf->args->elts;
@@ -1562,6 +2229,14 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     fmt->name = value[1];
+    fmt->binary = 0;
+
+    s = 2;
+
+    if (cf->args->nelts > 3 && ngx_strcmp(value[2].data, "binary") == 0) {
+        fmt->binary = 1;
+        s = 3;
+    }
 
     fmt->flushes = ngx_array_create(cf->pool, 4, sizeof(ngx_int_t));
     if (fmt->flushes == NULL) {
@@ -1573,13 +2248,14 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
-    return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, 2);
+    return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, s,
+                                       fmt->binary);
 }
 
 
 static char *
 ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
-    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s)
+    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s, ngx_uint_t binary)
 {
     u_char              *data, *p, ch;
     size_t               i, len;
@@ -1674,7 +2350,9 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
                     goto invalid;
                 }
 
-                for (v = ngx_http_log_vars; v->name.len; v++) {
+                v = binary ? ngx_http_log_binary_vars : ngx_http_log_vars;
+
+                for ( /* void */ ; v->name.len; v++) {
 
                     if (v->name.len == var.len
                         && ngx_strncmp(v->name.data, var.data, var.len) == 0)
@@ -1688,8 +2366,18 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
                     }
                 }
 
-                if (ngx_http_log_variable_compile(cf, op, &var, escape)
-                    != NGX_OK)
+                if (binary) {
+                    op->data = ngx_http_get_variable_index(cf, &var);
+                    if (op->data == (uintptr_t) NGX_ERROR) {
+                        return NGX_CONF_ERROR;
+                    }
+
+                    op->len = 0;
+                    op->getlen = ngx_http_log_binary_variable_getlen;
+                    op->run = ngx_http_log_binary_variable;
+
+                } else if (ngx_http_log_variable_compile(cf, op, &var, escape)
+                           != NGX_OK)
                 {
                     return NGX_CONF_ERROR;
                 }
@@ -1717,6 +2405,14 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
 
             len = &value[s].data[i] - data;
 
+            if (binary) {
+
+                /* text between variables only separates binary fields */
+
+                ops->nelts--;
+                continue;
+            }
+
             if (len) {
 
                 op->len = len;
@@ -1889,7 +2585,7 @@ ngx_http_log_init(ngx_conf_t *cf)
         *value = ngx_http_combined_fmt;
         fmt = lmcf->formats.elts;
 
-        if (ngx_http_log_compile_format(cf, NULL, fmt->ops, &a, 0)
+        if (ngx_http_log_compile_format(cf, NULL, fmt->ops, &a, 0, 0)
             != NGX_CONF_OK)
         {
             return NGX_ERROR;
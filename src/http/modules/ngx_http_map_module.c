@@ -13,6 +13,12 @@
 typedef struct {
     ngx_uint_t                  hash_max_size;
     ngx_uint_t                  hash_bucket_size;
+#if (NGX_PCRE)
+    ngx_uint_t                  regex_cache;
+#if (NGX_RE2)
+    ngx_flag_t                  regex_set;
+#endif
+#endif
 } ngx_http_map_conf_t;
 
 
@@ -22,6 +28,9 @@ typedef struct {
     ngx_array_t                *values_hash;
 #if (NGX_PCRE)
     ngx_array_t                 regexes;
+#if (NGX_RE2)
+    ngx_array_t                 regex_options;
+#endif
 #endif
 
     ngx_http_variable_value_t  *default_value;
@@ -44,6 +53,10 @@ static int ngx_libc_cdecl ngx_http_map_cmp_dns_wildcards(const void *one,
 static void *ngx_http_map_create_conf(ngx_conf_t *cf);
 static char *ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
+#if (NGX_RE2)
+static ngx_int_t ngx_http_map_regex_set(ngx_conf_t *cf,
+    ngx_http_map_conf_ctx_t *ctx, ngx_http_map_t *map);
+#endif
 
 
 static ngx_command_t  ngx_http_map_commands[] = {
@@ -69,6 +82,27 @@ static ngx_command_t  ngx_http_map_commands[] = {
       offsetof(ngx_http_map_conf_t, hash_bucket_size),
       NULL },
 
+#if (NGX_PCRE)
+
+    { ngx_string("map_regex_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_map_conf_t, regex_cache),
+      NULL },
+
+#if (NGX_RE2)
+
+    { ngx_string("map_regex_set"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_map_conf_t, regex_set),
+      NULL },
+
+#endif
+#endif
+
       ngx_null_command
 };
 
@@ -167,6 +201,12 @@ ngx_http_map_create_conf(ngx_conf_t *cf)
 
     mcf->hash_max_size = NGX_CONF_UNSET_UINT;
     mcf->hash_bucket_size = NGX_CONF_UNSET_UINT;
+#if (NGX_PCRE)
+    mcf->regex_cache = NGX_CONF_UNSET_UINT;
+#if (NGX_RE2)
+    mcf->regex_set = NGX_CONF_UNSET;
+#endif
+#endif
 
     return mcf;
 }
@@ -199,6 +239,18 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                                           ngx_cacheline_size);
     }
 
+#if (NGX_PCRE)
+    if (mcf->regex_cache == NGX_CONF_UNSET_UINT) {
+        mcf->regex_cache = 0;
+    }
+
+#if (NGX_RE2)
+    if (mcf->regex_set == NGX_CONF_UNSET) {
+        mcf->regex_set = 0;
+    }
+#endif
+#endif
+
     map = ngx_pcalloc(cf->pool, sizeof(ngx_http_map_ctx_t));
     if (map == NULL) {
         return NGX_CONF_ERROR;
@@ -261,6 +313,15 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         ngx_destroy_pool(pool);
         return NGX_CONF_ERROR;
     }
+
+#if (NGX_RE2)
+    if (ngx_array_init(&ctx.regex_options, pool, 2, sizeof(ngx_int_t))
+        != NGX_OK)
+    {
+        ngx_destroy_pool(pool);
+        return NGX_CONF_ERROR;
+    }
+#endif
 #endif
 
     ctx.default_value = NULL;
@@ -355,6 +416,23 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     if (ctx.regexes.nelts) {
         map->map.regex = ctx.regexes.elts;
         map->map.nregex = ctx.regexes.nelts;
+
+#if (NGX_RE2)
+        if (mcf->regex_set
+            && ngx_http_map_regex_set(cf, &ctx, &map->map) != NGX_OK)
+        {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+#endif
+
+        if (mcf->regex_cache
+            && ngx_http_map_cache_init(cf, &map->map, mcf->regex_cache)
+               != NGX_OK)
+        {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
     }
 
 #endif
@@ -530,12 +608,22 @@ found:
         ngx_regex_compile_t    rc;
         ngx_http_map_regex_t  *regex;
         u_char                 errstr[NGX_MAX_CONF_ERRSTR];
+#if (NGX_RE2)
+        ngx_int_t             *options;
+#endif
 
         regex = ngx_array_push(&ctx->regexes);
         if (regex == NULL) {
             return NGX_CONF_ERROR;
         }
 
+#if (NGX_RE2)
+        options = ngx_array_push(&ctx->regex_options);
+        if (options == NULL) {
+            return NGX_CONF_ERROR;
+        }
+#endif
+
         value[0].len--;
         value[0].data++;
 
@@ -558,6 +646,10 @@ found:
 
         regex->value = var;
 
+#if (NGX_RE2)
+        *options = rc.options;
+#endif
+
         return NGX_CONF_OK;
     }
 
@@ -587,3 +679,63 @@ found:
 
     return NGX_CONF_ERROR;
 }
+
+
+#if (NGX_RE2)
+
+static ngx_int_t
+ngx_http_map_regex_set(ngx_conf_t *cf, ngx_http_map_conf_ctx_t *ctx,
+    ngx_http_map_t *map)
+{
+    u_char            errstr[NGX_MAX_CONF_ERRSTR];
+    ngx_int_t         rc, *options;
+    ngx_str_t         err;
+    ngx_uint_t        i;
+    ngx_regex_set_t  *set;
+
+    set = ngx_regex_set_create(cf->pool, map->nregex);
+    if (set == NULL) {
+        return NGX_ERROR;
+    }
+
+    options = ctx->regex_options.elts;
+
+    for (i = 0; i < map->nregex; i++) {
+
+        err.len = NGX_MAX_CONF_ERRSTR;
+        err.data = errstr;
+
+        rc = ngx_regex_set_add(set, &map->regex[i].regex->name, options[i],
+                               &err);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                               "map regex \"%V\" is not supported by RE2 "
+                               "and is always tested: %V",
+                               &map->regex[i].regex->name, &err);
+        }
+    }
+
+    rc = ngx_regex_set_compile(set);
+
+    if (rc == NGX_DECLINED) {
+        return NGX_OK;
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "failed to compile RE2 set of %ui map regexes, "
+                           "the regexes are tested one by one", map->nregex);
+        return NGX_OK;
+    }
+
+    map->set = set;
+
+    return NGX_OK;
+}
+
+#endif
@@ -10,9 +10,31 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_MIRROR_SAMPLE_ALL  10000
+
+
+typedef struct {
+    ngx_queue_t  queue;
+    ngx_queue_t  free;
+
+    ngx_uint_t   queue_size;
+    ngx_uint_t   concurrent;
+
+    /* per worker */
+    ngx_uint_t   queued;
+    ngx_uint_t   active;
+    ngx_uint_t   sent;
+    ngx_uint_t   dropped;
+
+    ngx_event_t  event;
+} ngx_http_mirror_main_conf_t;
+
+
 typedef struct {
     ngx_array_t  *mirror;
     ngx_flag_t    request_body;
+    ngx_flag_t    detached;
+    ngx_uint_t    sample;
 } ngx_http_mirror_loc_conf_t;
 
 
@@ -21,13 +43,56 @@ typedef struct {
 } ngx_http_mirror_ctx_t;
 
 
+/*
+ * a detached mirror request runs on a connection without a socket,
+ * the structure is reused and all other memory is from the request pool
+ */
+
+typedef struct {
+    ngx_connection_t             connection;
+    ngx_event_t                  read;
+    ngx_event_t                  write;
+    ngx_log_t                    log;
+    ngx_http_log_ctx_t           log_ctx;
+    ngx_http_connection_t        http_connection;
+    ngx_buf_t                    buffer;
+
+    ngx_queue_t                  queue;
+    ngx_http_mirror_main_conf_t *mcf;
+    unsigned                     started:1;
+} ngx_http_mirror_detached_t;
+
+
 static ngx_int_t ngx_http_mirror_handler(ngx_http_request_t *r);
 static void ngx_http_mirror_body_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_mirror_handler_internal(ngx_http_request_t *r);
+static void ngx_http_mirror_detach(ngx_http_request_t *r, ngx_str_t *uri);
+static ngx_int_t ngx_http_mirror_copy_request(ngx_http_request_t *nr,
+    ngx_http_request_t *r, ngx_uint_t body);
+static ngx_int_t ngx_http_mirror_copy_headers(ngx_http_request_t *nr,
+    ngx_http_request_t *r);
+static ngx_int_t ngx_http_mirror_copy_body(ngx_http_request_t *nr,
+    ngx_http_request_t *r);
+static ngx_int_t ngx_http_mirror_copy_string(ngx_pool_t *pool, ngx_str_t *dst,
+    ngx_str_t *src);
+static void ngx_http_mirror_dispatch(ngx_event_t *ev);
+static void ngx_http_mirror_detached_handler(ngx_event_t *ev);
+static void ngx_http_mirror_detached_cleanup(void *data);
+static ngx_chain_t *ngx_http_mirror_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ngx_int_t ngx_http_mirror_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_http_mirror_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static void *ngx_http_mirror_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_mirror_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_mirror_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_mirror_merge_loc_conf(ngx_conf_t *cf, void *parent,
     void *child);
 static char *ngx_http_mirror(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_mirror_sample(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_mirror_queue(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_mirror_init(ngx_conf_t *cf);
 
 
@@ -47,16 +112,59 @@ static ngx_command_t  ngx_http_mirror_commands[] = {
       offsetof(ngx_http_mirror_loc_conf_t, request_body),
       NULL },
 
+    { ngx_string("mirror_detached"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_mirror_loc_conf_t, detached),
+      NULL },
+
+    { ngx_string("mirror_sample"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_mirror_sample,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("mirror_queue"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_mirror_queue,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
 
+static ngx_http_variable_t  ngx_http_mirror_vars[] = {
+
+    { ngx_string("mirror_queued"), NULL, ngx_http_mirror_variable,
+      offsetof(ngx_http_mirror_main_conf_t, queued),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("mirror_active"), NULL, ngx_http_mirror_variable,
+      offsetof(ngx_http_mirror_main_conf_t, active),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("mirror_sent"), NULL, ngx_http_mirror_variable,
+      offsetof(ngx_http_mirror_main_conf_t, sent),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("mirror_dropped"), NULL, ngx_http_mirror_variable,
+      offsetof(ngx_http_mirror_main_conf_t, dropped),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+      ngx_http_null_variable
+};
+
+
 static ngx_http_module_t  ngx_http_mirror_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_mirror_add_variables,         /* preconfiguration */
     ngx_http_mirror_init,                  /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_http_mirror_create_main_conf,      /* create main configuration */
+    ngx_http_mirror_init_main_conf,        /* init main configuration */
 
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
@@ -107,7 +215,18 @@ ngx_http_mirror_handler(ngx_http_request_t *r)
         if (ctx) {
             return ctx->status;
         }
+    }
+
+    if (mlcf->sample < NGX_HTTP_MIRROR_SAMPLE_ALL
+        && (ngx_uint_t) ngx_random() % NGX_HTTP_MIRROR_SAMPLE_ALL
+           >= mlcf->sample)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "mirror skipped");
+        return NGX_DECLINED;
+    }
 
+    if (mlcf->request_body) {
         ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_mirror_ctx_t));
         if (ctx == NULL) {
             return NGX_ERROR;
@@ -159,6 +278,12 @@ ngx_http_mirror_handler_internal(ngx_http_request_t *r)
     name = mlcf->mirror->elts;
 
     for (i = 0; i < mlcf->mirror->nelts; i++) {
+
+        if (mlcf->detached) {
+            ngx_http_mirror_detach(r, &name[i]);
+            continue;
+        }
+
         if (ngx_http_subrequest(r, &name[i], &r->args, &sr, NULL,
                                 NGX_HTTP_SUBREQUEST_BACKGROUND)
             != NGX_OK)
@@ -175,6 +300,665 @@ ngx_http_mirror_handler_internal(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_mirror_detach(ngx_http_request_t *r, ngx_str_t *uri)
+{
+    ngx_queue_t                  *q;
+    ngx_connection_t             *c;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_request_t           *nr;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_core_srv_conf_t     *cscf;
+    ngx_http_mirror_detached_t   *d;
+    ngx_http_mirror_loc_conf_t   *mlcf;
+    ngx_http_mirror_main_conf_t  *mcf;
+
+    mcf = ngx_http_get_module_main_conf(r, ngx_http_mirror_module);
+
+    if (mcf->queued >= mcf->queue_size) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "mirror \"%V\" dropped, queue is full", uri);
+        mcf->dropped++;
+        return;
+    }
+
+    if (ngx_connection_local_sockaddr(r->connection, NULL, 0) != NGX_OK) {
+        mcf->dropped++;
+        return;
+    }
+
+    if (!ngx_queue_empty(&mcf->free)) {
+        q = ngx_queue_head(&mcf->free);
+        ngx_queue_remove(q);
+
+        d = ngx_queue_data(q, ngx_http_mirror_detached_t, queue);
+
+    } else {
+        d = ngx_palloc(ngx_cycle->pool, sizeof(ngx_http_mirror_detached_t));
+        if (d == NULL) {
+            mcf->dropped++;
+            return;
+        }
+    }
+
+    ngx_memzero(d, sizeof(ngx_http_mirror_detached_t));
+
+    d->mcf = mcf;
+
+    c = &d->connection;
+
+    d->log = *r->connection->log;
+    d->log.data = &d->log_ctx;
+    d->log_ctx.connection = c;
+
+    c->fd = (ngx_socket_t) -1;
+    c->type = SOCK_STREAM;
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+    c->log = &d->log;
+    c->log->connection = c->number;
+    c->listening = r->connection->listening;
+    c->send_chain = ngx_http_mirror_send_chain;
+    c->buffer = &d->buffer;
+    c->sndlowat = 1;
+    c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+    c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+
+    /*
+     * the events are never registered, the write one is marked active
+     * so that the upstream module does not try to add it
+     */
+
+    c->read = &d->read;
+    c->write = &d->write;
+
+    d->read.data = c;
+    d->read.log = c->log;
+    d->read.handler = ngx_http_mirror_detached_handler;
+
+    d->write = d->read;
+    d->write.write = 1;
+    d->write.ready = 1;
+    d->write.active = 1;
+
+    cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+
+    d->http_connection.conf_ctx = cscf->ctx;
+    d->http_connection.addr_conf = r->http_connection->addr_conf;
+
+    c->data = &d->http_connection;
+
+    nr = ngx_http_create_request(c);
+    if (nr == NULL) {
+        ngx_queue_insert_head(&mcf->free, &d->queue);
+        mcf->dropped++;
+        return;
+    }
+
+    c->data = nr;
+    c->pool = nr->pool;
+
+    cln = ngx_pool_cleanup_add(nr->pool, 0);
+    if (cln == NULL) {
+        nr->logged = 1;
+        ngx_http_free_request(nr, 0);
+        ngx_queue_insert_head(&mcf->free, &d->queue);
+        mcf->dropped++;
+        return;
+    }
+
+    cln->handler = ngx_http_mirror_detached_cleanup;
+    cln->data = d;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    mlcf = ngx_http_get_module_loc_conf(r, ngx_http_mirror_module);
+
+    nr->uri = *uri;
+    nr->internal = 1;
+    nr->header_only = 1;
+    nr->expect_tested = 1;
+    nr->logged = !clcf->log_subrequest;
+
+    switch (ngx_http_mirror_copy_request(nr, r, mlcf->request_body)) {
+
+    case NGX_OK:
+        break;
+
+    case NGX_DECLINED:
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "mirror \"%V\" dropped, request body is in file", uri);
+
+        /* fall through */
+
+    default:
+        nr->logged = 1;
+        ngx_http_free_request(nr, 0);
+        mcf->dropped++;
+        return;
+    }
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_reading, -1);
+    nr->stat_reading = 0;
+    (void) ngx_atomic_fetch_add(ngx_stat_writing, 1);
+    nr->stat_writing = 1;
+#endif
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "mirror \"%V?%V\" queued as *%uA", uri, &nr->args,
+                   c->number);
+
+    ngx_queue_insert_tail(&mcf->queue, &d->queue);
+    mcf->queued++;
+
+    if (!mcf->event.posted) {
+        ngx_post_event(&mcf->event, &ngx_posted_events);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_mirror_copy_request(ngx_http_request_t *nr, ngx_http_request_t *r,
+    ngx_uint_t body)
+{
+    ngx_connection_t  *c, *nc;
+
+    c = r->connection;
+    nc = nr->connection;
+
+    nc->sockaddr = ngx_palloc(nr->pool, c->socklen + c->local_socklen);
+    if (nc->sockaddr == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(nc->sockaddr, c->sockaddr, c->socklen);
+    nc->socklen = c->socklen;
+
+    nc->local_sockaddr = (struct sockaddr *)
+                                   ((u_char *) nc->sockaddr + c->socklen);
+    ngx_memcpy(nc->local_sockaddr, c->local_sockaddr, c->local_socklen);
+    nc->local_socklen = c->local_socklen;
+
+    if (ngx_http_mirror_copy_string(nr->pool, &nc->addr_text, &c->addr_text)
+        != NGX_OK
+        || ngx_http_mirror_copy_string(nr->pool, &nr->request_line,
+                                       &r->request_line)
+           != NGX_OK
+        || ngx_http_mirror_copy_string(nr->pool, &nr->unparsed_uri,
+                                       &r->unparsed_uri)
+           != NGX_OK
+        || ngx_http_mirror_copy_string(nr->pool, &nr->args, &r->args)
+           != NGX_OK
+        || ngx_http_mirror_copy_string(nr->pool, &nr->method_name,
+                                       &r->method_name)
+           != NGX_OK
+        || ngx_http_mirror_copy_string(nr->pool, &nr->http_protocol,
+                                       &r->http_protocol)
+           != NGX_OK
+        || ngx_http_mirror_copy_string(nr->pool, &nr->schema, &r->schema)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    nr->method = r->method;
+    nr->http_version = r->http_version;
+
+    ngx_http_set_exten(nr);
+
+    if (ngx_http_mirror_copy_headers(nr, r) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    nr->request_body = ngx_pcalloc(nr->pool, sizeof(ngx_http_request_body_t));
+    if (nr->request_body == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the length is set again if the body is copied */
+
+    if (nr->headers_in.content_length_n > 0 || nr->headers_in.chunked) {
+        nr->headers_in.content_length_n = 0;
+        nr->headers_in.chunked = 0;
+    }
+
+    if (body) {
+        return ngx_http_mirror_copy_body(nr, r);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mirror_copy_headers(ngx_http_request_t *nr, ngx_http_request_t *r)
+{
+    u_char                     *p;
+    ngx_uint_t                  i, n;
+    ngx_array_t                *a;
+    ngx_list_part_t            *part;
+    ngx_table_elt_t            *h, *nh, **ph;
+    ngx_http_header_t          *hh;
+    ngx_http_headers_in_t      *hi;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    /* the values parsed from the headers are kept, the pointers are reset */
+
+    hi = &nr->headers_in;
+
+    *hi = r->headers_in;
+
+    hi->index = NULL;
+
+    ngx_str_null(&hi->user);
+    ngx_str_null(&hi->passwd);
+
+    ngx_memzero(&hi->cookies, sizeof(ngx_array_t));
+#if (NGX_HTTP_X_FORWARDED_FOR)
+    ngx_memzero(&hi->x_forwarded_for, sizeof(ngx_array_t));
+#endif
+
+    for (hh = ngx_http_headers_in; hh->name.len; hh++) {
+
+        if (hh->offset == offsetof(ngx_http_headers_in_t, cookies)
+#if (NGX_HTTP_X_FORWARDED_FOR)
+            || hh->offset == offsetof(ngx_http_headers_in_t, x_forwarded_for)
+#endif
+           )
+        {
+            continue;
+        }
+
+        ph = (ngx_table_elt_t **) ((char *) hi + hh->offset);
+        *ph = NULL;
+    }
+
+    if (ngx_http_mirror_copy_string(nr->pool, &hi->server,
+                                    &r->headers_in.server)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+
+    for (part = &r->headers_in.headers.part; part; part = part->next) {
+        n += part->nelts;
+    }
+
+    if (ngx_list_init(&hi->headers, nr->pool, n ? n : 1,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    cmcf = ngx_http_get_module_main_conf(nr, ngx_http_core_module);
+
+    part = &r->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        nh = ngx_list_push(&hi->headers);
+        if (nh == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_pnalloc(nr->pool, 2 * h[i].key.len + h[i].value.len + 2);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        nh->hash = h[i].hash;
+
+        nh->key.len = h[i].key.len;
+        nh->key.data = p;
+        p = ngx_cpymem(p, h[i].key.data, h[i].key.len);
+        *p++ = '\0';
+
+        nh->value.len = h[i].value.len;
+        nh->value.data = p;
+        p = ngx_cpymem(p, h[i].value.data, h[i].value.len);
+        *p++ = '\0';
+
+        nh->lowcase_key = p;
+        ngx_memcpy(p, h[i].lowcase_key, h[i].key.len);
+
+        hh = ngx_hash_find(&cmcf->headers_in_hash, nh->hash,
+                           nh->lowcase_key, nh->key.len);
+
+        if (hh == NULL) {
+            continue;
+        }
+
+        if (hh->offset == offsetof(ngx_http_headers_in_t, cookies)
+#if (NGX_HTTP_X_FORWARDED_FOR)
+            || hh->offset == offsetof(ngx_http_headers_in_t, x_forwarded_for)
+#endif
+           )
+        {
+            a = (ngx_array_t *) ((char *) hi + hh->offset);
+
+            if (a->elts == NULL
+                && ngx_array_init(a, nr->pool, 1, sizeof(ngx_table_elt_t *))
+                   != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            ph = ngx_array_push(a);
+            if (ph == NULL) {
+                return NGX_ERROR;
+            }
+
+            *ph = nh;
+            continue;
+        }
+
+        ph = (ngx_table_elt_t **) ((char *) hi + hh->offset);
+
+        if (*ph == NULL) {
+            *ph = nh;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mirror_copy_body(ngx_http_request_t *nr, ngx_http_request_t *r)
+{
+    off_t         len;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    if (r->request_body == NULL || r->request_body->bufs == NULL) {
+        return NGX_OK;
+    }
+
+    /* only bodies kept in memory are mirrored */
+
+    if (r->request_body->temp_file) {
+        return NGX_DECLINED;
+    }
+
+    len = 0;
+
+    for (cl = r->request_body->bufs; cl; cl = cl->next) {
+        if (cl->buf->in_file) {
+            return NGX_DECLINED;
+        }
+
+        len += cl->buf->last - cl->buf->pos;
+    }
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    b = ngx_create_temp_buf(nr->pool, len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (cl = r->request_body->bufs; cl; cl = cl->next) {
+        b->last = ngx_cpymem(b->last, cl->buf->pos,
+                             cl->buf->last - cl->buf->pos);
+    }
+
+    b->last_buf = 1;
+
+    cl = ngx_alloc_chain_link(nr->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    nr->request_body->bufs = cl;
+
+    nr->headers_in.content_length_n = len;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mirror_copy_string(ngx_pool_t *pool, ngx_str_t *dst, ngx_str_t *src)
+{
+    *dst = *src;
+
+    if (src->len == 0) {
+        return NGX_OK;
+    }
+
+    dst->data = ngx_pstrdup(pool, src);
+    if (dst->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_mirror_dispatch(ngx_event_t *ev)
+{
+    ngx_queue_t                  *q;
+    ngx_connection_t             *c;
+    ngx_http_request_t           *r;
+    ngx_http_mirror_detached_t   *d;
+    ngx_http_mirror_main_conf_t  *mcf;
+
+    mcf = ev->data;
+
+    while (mcf->active < mcf->concurrent && !ngx_queue_empty(&mcf->queue)) {
+
+        q = ngx_queue_head(&mcf->queue);
+        ngx_queue_remove(q);
+
+        d = ngx_queue_data(q, ngx_http_mirror_detached_t, queue);
+
+        d->started = 1;
+
+        mcf->queued--;
+        mcf->active++;
+        mcf->sent++;
+
+        c = &d->connection;
+        r = c->data;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "mirror request \"%V?%V\"", &r->uri, &r->args);
+
+        ngx_http_handler(r);
+
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+
+static void
+ngx_http_mirror_detached_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    c = ev->data;
+    r = c->data;
+
+    if (ev->write) {
+        r->write_event_handler(r);
+
+    } else {
+        r->read_event_handler(r);
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_mirror_detached_cleanup(void *data)
+{
+    ngx_http_mirror_detached_t *d = data;
+
+    ngx_http_mirror_main_conf_t  *mcf;
+
+    mcf = d->mcf;
+
+    if (d->read.timer_set) {
+        ngx_del_timer(&d->read);
+    }
+
+    if (d->write.timer_set) {
+        ngx_del_timer(&d->write);
+    }
+
+    if (d->read.posted) {
+        ngx_delete_posted_event(&d->read);
+    }
+
+    if (d->write.posted) {
+        ngx_delete_posted_event(&d->write);
+    }
+
+    ngx_queue_insert_head(&mcf->free, &d->queue);
+
+    if (!d->started) {
+        return;
+    }
+
+    mcf->active--;
+
+    if (!ngx_queue_empty(&mcf->queue) && !mcf->event.posted) {
+        ngx_post_event(&mcf->event, &ngx_posted_events);
+    }
+}
+
+
+static ngx_chain_t *
+ngx_http_mirror_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    off_t         sent;
+    ngx_chain_t  *cl;
+
+    /* responses to mirror requests are discarded */
+
+    sent = 0;
+
+    for (cl = in; cl; cl = cl->next) {
+        if (!ngx_buf_special(cl->buf)) {
+            sent += ngx_buf_size(cl->buf);
+        }
+    }
+
+    c->sent += sent;
+
+    return ngx_chain_update_sent(in, sent);
+}
+
+
+static ngx_int_t
+ngx_http_mirror_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_mirror_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mirror_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                       *p;
+    ngx_http_mirror_main_conf_t  *mcf;
+
+    mcf = ngx_http_get_module_main_conf(r, ngx_http_mirror_module);
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%ui", *(ngx_uint_t *) ((char *) mcf + data)) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_mirror_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_mirror_main_conf_t  *mcf;
+
+    mcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_mirror_main_conf_t));
+    if (mcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     mcf->queued = 0;
+     *     mcf->active = 0;
+     *     mcf->sent = 0;
+     *     mcf->dropped = 0;
+     */
+
+    mcf->queue_size = NGX_CONF_UNSET_UINT;
+    mcf->concurrent = NGX_CONF_UNSET_UINT;
+
+    return mcf;
+}
+
+
+static char *
+ngx_http_mirror_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_mirror_main_conf_t *mcf = conf;
+
+    ngx_conf_init_uint_value(mcf->queue_size, 256);
+    ngx_conf_init_uint_value(mcf->concurrent, 64);
+
+    ngx_queue_init(&mcf->queue);
+    ngx_queue_init(&mcf->free);
+
+    mcf->event.handler = ngx_http_mirror_dispatch;
+    mcf->event.data = mcf;
+    mcf->event.log = &cf->cycle->new_log;
+
+    return NGX_CONF_OK;
+}
+
+
 static void *
 ngx_http_mirror_create_loc_conf(ngx_conf_t *cf)
 {
@@ -187,6 +971,8 @@ ngx_http_mirror_create_loc_conf(ngx_conf_t *cf)
 
     mlcf->mirror = NGX_CONF_UNSET_PTR;
     mlcf->request_body = NGX_CONF_UNSET;
+    mlcf->detached = NGX_CONF_UNSET;
+    mlcf->sample = NGX_CONF_UNSET_UINT;
 
     return mlcf;
 }
@@ -200,6 +986,9 @@ ngx_http_mirror_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_ptr_value(conf->mirror, prev->mirror, NULL);
     ngx_conf_merge_value(conf->request_body, prev->request_body, 1);
+    ngx_conf_merge_value(conf->detached, prev->detached, 0);
+    ngx_conf_merge_uint_value(conf->sample, prev->sample,
+                              NGX_HTTP_MIRROR_SAMPLE_ALL);
 
     return NGX_CONF_OK;
 }
@@ -245,6 +1034,88 @@ ngx_http_mirror(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_mirror_sample(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_mirror_loc_conf_t *mlcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (mlcf->sample != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (value[1].len < 2 || value[1].data[value[1].len - 1] != '%') {
+        goto invalid;
+    }
+
+    n = ngx_atofp(value[1].data, value[1].len - 1, 2);
+
+    if (n == NGX_ERROR || n > NGX_HTTP_MIRROR_SAMPLE_ALL) {
+        goto invalid;
+    }
+
+    mlcf->sample = n;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid percent value \"%V\"", &value[1]);
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_mirror_queue(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_mirror_main_conf_t *mcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (mcf->queue_size != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid queue size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    mcf->queue_size = n;
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[2].data, "concurrent=", 11) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    n = ngx_atoi(value[2].data + 11, value[2].len - 11);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid concurrent value \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    mcf->concurrent = n;
+
+    return NGX_CONF_OK;
+}
+
+
 static ngx_int_t
 ngx_http_mirror_init(ngx_conf_t *cf)
 {
@@ -0,0 +1,344 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_mmdb_t                *mmdb;
+    ngx_http_complex_value_t  *source;
+    ngx_uint_t                 index;
+} ngx_http_mmdb_t;
+
+
+typedef struct {
+    ngx_http_mmdb_t           *db;
+    ngx_uint_t                 field;
+} ngx_http_mmdb_variable_t;
+
+
+typedef struct {
+    ngx_uint_t                 ndbs;
+} ngx_http_mmdb_conf_t;
+
+
+/* the results of a request, per database */
+
+typedef struct {
+    ngx_str_t                 *values;
+    ngx_uint_t                 done;      /* unsigned  done:1; */
+} ngx_http_mmdb_ctx_t;
+
+
+static ngx_int_t ngx_http_mmdb_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_str_t *ngx_http_mmdb_lookup(ngx_http_request_t *r,
+    ngx_http_mmdb_t *db);
+static void *ngx_http_mmdb_create_conf(ngx_conf_t *cf);
+static char *ngx_http_mmdb_block(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_mmdb(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
+
+
+static ngx_command_t  ngx_http_mmdb_commands[] = {
+
+    { ngx_string("mmdb"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_1MORE,
+      ngx_http_mmdb_block,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_mmdb_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_mmdb_create_conf,             /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_mmdb_module = {
+    NGX_MODULE_V1,
+    &ngx_http_mmdb_module_ctx,             /* module context */
+    ngx_http_mmdb_commands,                /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_mmdb_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
+    uintptr_t data)
+{
+    ngx_http_mmdb_variable_t *var = (ngx_http_mmdb_variable_t *) data;
+
+    ngx_str_t  *values;
+
+    values = ngx_http_mmdb_lookup(r, var->db);
+
+    if (values == NULL || values[var->field].data == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = values[var->field].len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = values[var->field].data;
+
+    return NGX_OK;
+}
+
+
+static ngx_str_t *
+ngx_http_mmdb_lookup(ngx_http_request_t *r, ngx_http_mmdb_t *db)
+{
+    ngx_int_t              rc;
+    ngx_str_t              source, *values;
+    ngx_addr_t             addr;
+    ngx_http_mmdb_ctx_t   *ctx;
+    ngx_http_mmdb_conf_t  *mcf;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_mmdb_module);
+
+    if (ctx == NULL) {
+        mcf = ngx_http_get_module_main_conf(r, ngx_http_mmdb_module);
+
+        ctx = ngx_pcalloc(r->pool, mcf->ndbs * sizeof(ngx_http_mmdb_ctx_t));
+        if (ctx == NULL) {
+            return NULL;
+        }
+
+        ngx_http_set_ctx(r, ctx, ngx_http_mmdb_module);
+    }
+
+    ctx = &ctx[db->index];
+
+    /* all fields of a database are looked up at once */
+
+    if (ctx->done) {
+        return ctx->values;
+    }
+
+    ctx->done = 1;
+
+    if (db->source) {
+        if (ngx_http_complex_value(r, db->source, &source) != NGX_OK) {
+            return NULL;
+        }
+
+        if (ngx_parse_addr(r->pool, &addr, source.data, source.len)
+            != NGX_OK)
+        {
+            return NULL;
+        }
+
+    } else {
+        addr.sockaddr = r->connection->sockaddr;
+    }
+
+    values = ngx_palloc(r->pool, db->mmdb->fields.nelts * sizeof(ngx_str_t));
+    if (values == NULL) {
+        return NULL;
+    }
+
+    rc = ngx_mmdb_lookup(db->mmdb, addr.sockaddr, values, r->pool,
+                         r->connection->log);
+
+    if (rc == NGX_OK) {
+        ctx->values = values;
+    }
+
+    return ctx->values;
+}
+
+
+static void *
+ngx_http_mmdb_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_mmdb_conf_t  *mcf;
+
+    mcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_mmdb_conf_t));
+    if (mcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     mcf->ndbs = 0;
+     */
+
+    return mcf;
+}
+
+
+static char *
+ngx_http_mmdb_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_mmdb_conf_t  *mcf = conf;
+
+    char                              *rv;
+    ngx_int_t                          n;
+    ngx_str_t                         *value, name, s;
+    ngx_uint_t                         i, cache;
+    ngx_conf_t                         save;
+    ngx_http_mmdb_t                   *db;
+    ngx_http_compile_complex_value_t   ccv;
+
+    db = ngx_pcalloc(cf->pool, sizeof(ngx_http_mmdb_t));
+    if (db == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    cache = 256;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "cache=", 6) == 0) {
+
+            n = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (n == NGX_ERROR) {
+                goto invalid;
+            }
+
+            cache = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "source=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            db->source = ngx_palloc(cf->pool,
+                                    sizeof(ngx_http_complex_value_t));
+            if (db->source == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+            ccv.cf = cf;
+            ccv.value = &s;
+            ccv.complex_value = db->source;
+
+            if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    name = value[1];
+
+    db->mmdb = ngx_mmdb_open(cf, &name, cache);
+    if (db->mmdb == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    db->index = mcf->ndbs++;
+
+    save = *cf;
+    cf->handler = ngx_http_mmdb;
+    cf->handler_conf = (void *) db;
+
+    rv = ngx_conf_parse(cf, NULL);
+
+    *cf = save;
+
+    return rv;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_mmdb(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
+{
+    ngx_int_t                  field;
+    ngx_str_t                 *value, name;
+    ngx_http_mmdb_t           *db;
+    ngx_http_variable_t       *v;
+    ngx_http_mmdb_variable_t  *var;
+
+    db = conf;
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts < 2) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid number of the mmdb parameters");
+        return NGX_CONF_ERROR;
+    }
+
+    name = value[0];
+
+    if (name.len < 2 || name.data[0] != '$') {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid variable name \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len--;
+    name.data++;
+
+    /* the keys of maps and the indices of arrays down to the value */
+
+    field = ngx_mmdb_add_field(cf, db->mmdb, &value[1], cf->args->nelts - 1);
+    if (field == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    var = ngx_palloc(cf->pool, sizeof(ngx_http_mmdb_variable_t));
+    if (var == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    var->db = db;
+    var->field = field;
+
+    v = ngx_http_add_variable(cf, &name, NGX_HTTP_VAR_CHANGEABLE);
+    if (v == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    v->get_handler = ngx_http_mmdb_variable;
+    v->data = (uintptr_t) var;
+
+    return NGX_CONF_OK;
+}
@@ -43,9 +43,43 @@
 typedef struct {
     size_t                buffer_size;
     size_t                max_buffer_size;
+    ngx_flag_t            cache_seek;
 } ngx_http_mp4_conf_t;
 
 
+typedef struct {
+    uint64_t              time;
+    uint64_t              sample;
+} ngx_http_mp4_stts_index_t;
+
+
+typedef struct {
+    ngx_str_node_t        sn;
+    ngx_queue_t           queue;
+
+    ngx_file_uniq_t       uniq;
+    time_t                mtime;
+    off_t                 file_size;
+    off_t                 offset;
+    size_t                len;
+    size_t                size;
+    u_char               *data;
+
+    ngx_uint_t            ntraks;
+    ngx_http_mp4_stts_index_t  **stts;
+} ngx_http_mp4_moov_t;
+
+
+typedef struct {
+    size_t                moov_cache;
+    size_t                moov_cache_size;
+
+    ngx_rbtree_t          rbtree;
+    ngx_rbtree_node_t     sentinel;
+    ngx_queue_t           queue;
+} ngx_http_mp4_main_conf_t;
+
+
 typedef struct {
     u_char                chunk[4];
     u_char                samples[4];
@@ -125,6 +159,7 @@ typedef struct {
     u_char               *buffer_end;
     size_t                buffer_size;
 
+    off_t                 body_start;
     off_t                 offset;
     off_t                 end;
     off_t                 content_length;
@@ -132,6 +167,9 @@ typedef struct {
     ngx_uint_t            length;
     uint32_t              timescale;
     ngx_http_request_t   *request;
+    ngx_file_uniq_t       uniq;
+    time_t                mtime;
+    ngx_http_mp4_moov_t  *moov;
     ngx_array_t           trak;
     ngx_http_mp4_trak_t   traks[2];
 
@@ -223,12 +261,22 @@ typedef struct {
 
 
 static ngx_int_t ngx_http_mp4_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_mp4_args(ngx_http_request_t *r, ngx_int_t *start,
+    ngx_uint_t *length);
 static ngx_int_t ngx_http_mp4_atofp(u_char *line, size_t n, size_t point);
 
 static ngx_int_t ngx_http_mp4_process(ngx_http_mp4_file_t *mp4);
 static ngx_int_t ngx_http_mp4_read_atom(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_atom_handler_t *atom, uint64_t atom_data_size);
 static ngx_int_t ngx_http_mp4_read(ngx_http_mp4_file_t *mp4, size_t size);
+static ngx_int_t ngx_http_mp4_read_moov(ngx_http_mp4_file_t *mp4,
+    size_t size);
+static void ngx_http_mp4_cache_moov(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_main_conf_t *mmcf);
+static void ngx_http_mp4_free_moov(ngx_http_mp4_main_conf_t *mmcf,
+    ngx_http_mp4_moov_t *moov);
+static ngx_http_mp4_stts_index_t *ngx_http_mp4_stts_index(
+    ngx_http_mp4_file_t *mp4, ngx_http_mp4_trak_t *trak);
 static ngx_int_t ngx_http_mp4_read_ftyp_atom(ngx_http_mp4_file_t *mp4,
     uint64_t atom_data_size);
 static ngx_int_t ngx_http_mp4_read_moov_atom(ngx_http_mp4_file_t *mp4,
@@ -313,8 +361,11 @@ static void ngx_http_mp4_adjust_co64_atom(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_trak_t *trak, off_t adjustment);
 
 static char *ngx_http_mp4(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static void *ngx_http_mp4_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_mp4_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_mp4_create_conf(ngx_conf_t *cf);
 static char *ngx_http_mp4_merge_conf(ngx_conf_t *cf, void *parent, void *child);
+static ngx_int_t ngx_http_mp4_filter_init(ngx_conf_t *cf);
 
 
 static ngx_command_t  ngx_http_mp4_commands[] = {
@@ -340,6 +391,20 @@ static ngx_command_t  ngx_http_mp4_commands[] = {
       offsetof(ngx_http_mp4_conf_t, max_buffer_size),
       NULL },
 
+    { ngx_string("mp4_moov_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_mp4_main_conf_t, moov_cache),
+      NULL },
+
+    { ngx_string("mp4_cache_seek"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_mp4_conf_t, cache_seek),
+      NULL },
+
       ngx_null_command
 };
 
@@ -348,8 +413,8 @@ static ngx_http_module_t  ngx_http_mp4_module_ctx = {
     NULL,                          /* preconfiguration */
     NULL,                          /* postconfiguration */
 
-    NULL,                          /* create main configuration */
-    NULL,                          /* init main configuration */
+    ngx_http_mp4_create_main_conf, /* create main configuration */
+    ngx_http_mp4_init_main_conf,   /* init main configuration */
 
     NULL,                          /* create server configuration */
     NULL,                          /* merge server configuration */
@@ -375,6 +440,45 @@ ngx_module_t  ngx_http_mp4_module = {
 };
 
 
+static ngx_http_module_t  ngx_http_mp4_filter_module_ctx = {
+    NULL,                          /* preconfiguration */
+    ngx_http_mp4_filter_init,      /* postconfiguration */
+
+    NULL,                          /* create main configuration */
+    NULL,                          /* init main configuration */
+
+    NULL,                          /* create server configuration */
+    NULL,                          /* merge server configuration */
+
+    NULL,                          /* create location configuration */
+    NULL                           /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_mp4_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_mp4_filter_module_ctx, /* module context */
+    NULL,                          /* module directives */
+    NGX_HTTP_MODULE,               /* module type */
+    NULL,                          /* init master */
+    NULL,                          /* init module */
+    NULL,                          /* init process */
+    NULL,                          /* init thread */
+    NULL,                          /* exit thread */
+    NULL,                          /* exit process */
+    NULL,                          /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+#if (NGX_HTTP_CACHE)
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
+
+#endif
+
+
 static ngx_http_mp4_atom_handler_t  ngx_http_mp4_atoms[] = {
     { "ftyp", ngx_http_mp4_read_ftyp_atom },
     { "moov", ngx_http_mp4_read_moov_atom },
@@ -428,9 +532,9 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
 {
     u_char                    *last;
     size_t                     root;
-    ngx_int_t                  rc, start, end;
+    ngx_int_t                  rc, start;
     ngx_uint_t                 level, length;
-    ngx_str_t                  path, value;
+    ngx_str_t                  path;
     ngx_log_t                 *log;
     ngx_buf_t                 *b;
     ngx_chain_t                out;
@@ -533,41 +637,11 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
     r->root_tested = !r->error_page;
     r->allow_ranges = 1;
 
-    start = -1;
-    length = 0;
     r->headers_out.content_length_n = of.size;
     mp4 = NULL;
     b = NULL;
 
-    if (r->args.len) {
-
-        if (ngx_http_arg(r, (u_char *) "start", 5, &value) == NGX_OK) {
-
-            /*
-             * A Flash player may send start value with a lot of digits
-             * after dot so a custom function is used instead of ngx_atofp().
-             */
-
-            start = ngx_http_mp4_atofp(value.data, value.len, 3);
-        }
-
-        if (ngx_http_arg(r, (u_char *) "end", 3, &value) == NGX_OK) {
-
-            end = ngx_http_mp4_atofp(value.data, value.len, 3);
-
-            if (end > 0) {
-                if (start < 0) {
-                    start = 0;
-                }
-
-                if (end > start) {
-                    length = end - start;
-                }
-            }
-        }
-    }
-
-    if (start >= 0) {
+    if (ngx_http_mp4_args(r, &start, &length) == NGX_OK) {
         r->single_range = 1;
 
         mp4 = ngx_pcalloc(r->pool, sizeof(ngx_http_mp4_file_t));
@@ -582,6 +656,8 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
         mp4->start = (ngx_uint_t) start;
         mp4->length = length;
         mp4->request = r;
+        mp4->uniq = of.uniq;
+        mp4->mtime = of.mtime;
 
         switch (ngx_http_mp4_process(mp4)) {
 
@@ -683,6 +759,172 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
 }
 
 
+#if (NGX_HTTP_CACHE)
+
+static ngx_int_t
+ngx_http_mp4_header_filter(ngx_http_request_t *r)
+{
+    ngx_int_t             rc, start;
+    ngx_uint_t            length;
+    ngx_http_cache_t     *c;
+    ngx_http_mp4_conf_t  *conf;
+    ngx_http_mp4_file_t  *mp4;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_mp4_module);
+
+    if (!conf->cache_seek
+        || !r->cached
+        || r->cache == NULL
+        || r->headers_out.status != NGX_HTTP_OK
+        || r->headers_out.content_encoding
+        || ngx_http_mp4_args(r, &start, &length) != NGX_OK)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    c = r->cache;
+
+    /* the entries being written or kept in memory are sent as is */
+
+    if (c->streaming
+        || c->memory
+        || c->file.fd == NGX_INVALID_FILE
+        || (r->headers_out.content_length_n != -1
+            && r->headers_out.content_length_n
+               != c->length - (off_t) c->body_start))
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    mp4 = ngx_pcalloc(r->pool, sizeof(ngx_http_mp4_file_t));
+    if (mp4 == NULL) {
+        return NGX_ERROR;
+    }
+
+    mp4->file.fd = c->file.fd;
+    mp4->file.name = c->file.name;
+    mp4->file.log = r->connection->log;
+    mp4->file.directio = c->file.directio;
+    mp4->body_start = c->body_start;
+    mp4->end = c->length - c->body_start;
+    mp4->start = (ngx_uint_t) start;
+    mp4->length = length;
+    mp4->request = r;
+    mp4->uniq = c->uniq;
+    mp4->mtime = c->date;
+
+    switch (ngx_http_mp4_process(mp4)) {
+
+    case NGX_DECLINED:
+        if (mp4->buffer) {
+            ngx_pfree(r->pool, mp4->buffer);
+        }
+
+        ngx_pfree(r->pool, mp4);
+
+        return ngx_http_next_header_filter(r);
+
+    case NGX_OK:
+        break;
+
+    default: /* NGX_ERROR */
+        if (mp4->buffer) {
+            ngx_pfree(r->pool, mp4->buffer);
+        }
+
+        ngx_pfree(r->pool, mp4);
+
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http mp4 cached: \"%s\", body:%O",
+                   c->file.name.data, mp4->end);
+
+    r->headers_out.content_length_n = mp4->content_length;
+    r->single_range = 1;
+
+    rc = ngx_http_next_header_filter(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    ngx_http_set_ctx(r, mp4, ngx_http_mp4_filter_module);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_mp4_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_chain_t          *cl;
+    ngx_http_mp4_file_t  *mp4;
+
+    mp4 = ngx_http_get_module_ctx(r, ngx_http_mp4_filter_module);
+
+    if (mp4 == NULL || in == NULL) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    ngx_http_set_ctx(r, NULL, ngx_http_mp4_filter_module);
+
+    /* the cached body is sent as the processed mp4 instead */
+
+    for (cl = in; cl; cl = cl->next) {
+        cl->buf->pos = cl->buf->last;
+        cl->buf->file_pos = cl->buf->file_last;
+    }
+
+    return ngx_http_next_body_filter(r, mp4->out);
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_mp4_args(ngx_http_request_t *r, ngx_int_t *start, ngx_uint_t *length)
+{
+    ngx_int_t  end;
+    ngx_str_t  value;
+
+    *start = -1;
+    *length = 0;
+
+    if (r->args.len == 0) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "start", 5, &value) == NGX_OK) {
+
+        /*
+         * A Flash player may send start value with a lot of digits
+         * after dot so a custom function is used instead of ngx_atofp().
+         */
+
+        *start = ngx_http_mp4_atofp(value.data, value.len, 3);
+    }
+
+    if (ngx_http_arg(r, (u_char *) "end", 3, &value) == NGX_OK) {
+
+        end = ngx_http_mp4_atofp(value.data, value.len, 3);
+
+        if (end > 0) {
+            if (*start < 0) {
+                *start = 0;
+            }
+
+            if (end > *start) {
+                *length = end - *start;
+            }
+        }
+    }
+
+    return (*start >= 0) ? NGX_OK : NGX_DECLINED;
+}
+
+
 static ngx_int_t
 ngx_http_mp4_atofp(u_char *line, size_t n, size_t point)
 {
@@ -889,6 +1131,11 @@ ngx_http_mp4_process(ngx_http_mp4_file_t *mp4)
         }
     }
 
+    /* the offsets are relative to the cached response body */
+
+    mp4->mdat_data.buf->file_pos += mp4->body_start;
+    mp4->mdat_data.buf->file_last += mp4->body_start;
+
     return NGX_OK;
 }
 
@@ -1038,7 +1285,7 @@ ngx_http_mp4_read(ngx_http_mp4_file_t *mp4, size_t size)
     }
 
     n = ngx_read_file(&mp4->file, mp4->buffer_start, mp4->buffer_size,
-                      mp4->offset);
+                      mp4->body_start + mp4->offset);
 
     if (n == NGX_ERROR) {
         return NGX_ERROR;
@@ -1058,6 +1305,159 @@ ngx_http_mp4_read(ngx_http_mp4_file_t *mp4, size_t size)
 }
 
 
+static ngx_int_t
+ngx_http_mp4_read_moov(ngx_http_mp4_file_t *mp4, size_t size)
+{
+    uint32_t                   hash;
+    ngx_http_mp4_moov_t       *moov;
+    ngx_http_mp4_main_conf_t  *mmcf;
+
+    /*
+     * a large moov atom is read into a buffer of its own, so a pristine
+     * copy of the buffer can be kept and reused by subsequent requests
+     * instead of reading the atom from the file again
+     */
+
+    mmcf = ngx_http_get_module_main_conf(mp4->request, ngx_http_mp4_module);
+
+    if (mmcf->moov_cache == 0) {
+        return ngx_http_mp4_read(mp4, size);
+    }
+
+    if (mp4->offset + (off_t) mp4->buffer_size > mp4->end) {
+        mp4->buffer_size = (size_t) (mp4->end - mp4->offset);
+    }
+
+    hash = ngx_crc32_long(mp4->file.name.data, mp4->file.name.len);
+
+    moov = (ngx_http_mp4_moov_t *)
+               ngx_str_rbtree_lookup(&mmcf->rbtree, &mp4->file.name, hash);
+
+    if (moov) {
+
+        if (moov->uniq == mp4->uniq
+            && moov->mtime == mp4->mtime
+            && moov->file_size == mp4->end
+            && moov->offset == mp4->offset
+            && moov->len == mp4->buffer_size)
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                           "mp4 moov cache hit: %uz", moov->len);
+
+            mp4->buffer = ngx_palloc(mp4->request->pool, moov->len);
+            if (mp4->buffer == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memcpy(mp4->buffer, moov->data, moov->len);
+
+            mp4->buffer_start = mp4->buffer;
+            mp4->buffer_pos = mp4->buffer;
+            mp4->buffer_end = mp4->buffer + moov->len;
+
+            ngx_queue_remove(&moov->queue);
+            ngx_queue_insert_head(&mmcf->queue, &moov->queue);
+
+            mp4->moov = moov;
+
+            return NGX_OK;
+        }
+
+        ngx_http_mp4_free_moov(mmcf, moov);
+    }
+
+    if (ngx_http_mp4_read(mp4, size) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_mp4_cache_moov(mp4, mmcf);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_mp4_cache_moov(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_main_conf_t *mmcf)
+{
+    size_t                size;
+    ngx_queue_t          *q;
+    ngx_http_mp4_moov_t  *moov;
+
+    size = sizeof(ngx_http_mp4_moov_t) + mp4->file.name.len + mp4->buffer_size;
+
+    if (size > mmcf->moov_cache) {
+        return;
+    }
+
+    while (mmcf->moov_cache_size + size > mmcf->moov_cache) {
+        q = ngx_queue_last(&mmcf->queue);
+        ngx_http_mp4_free_moov(mmcf,
+                               ngx_queue_data(q, ngx_http_mp4_moov_t, queue));
+    }
+
+    moov = ngx_alloc(size, mp4->file.log);
+    if (moov == NULL) {
+        return;
+    }
+
+    moov->sn.str.len = mp4->file.name.len;
+    moov->sn.str.data = (u_char *) moov + sizeof(ngx_http_mp4_moov_t);
+    ngx_memcpy(moov->sn.str.data, mp4->file.name.data, mp4->file.name.len);
+
+    moov->sn.node.key = ngx_crc32_long(mp4->file.name.data,
+                                       mp4->file.name.len);
+
+    moov->uniq = mp4->uniq;
+    moov->mtime = mp4->mtime;
+    moov->file_size = mp4->end;
+    moov->offset = mp4->offset;
+    moov->len = mp4->buffer_size;
+    moov->size = size;
+
+    moov->data = moov->sn.str.data + mp4->file.name.len;
+    ngx_memcpy(moov->data, mp4->buffer_start, mp4->buffer_size);
+
+    moov->ntraks = 0;
+    moov->stts = NULL;
+
+    ngx_rbtree_insert(&mmcf->rbtree, &moov->sn.node);
+    ngx_queue_insert_head(&mmcf->queue, &moov->queue);
+
+    mmcf->moov_cache_size += size;
+
+    mp4->moov = moov;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                   "mp4 moov cache add: %uz", moov->len);
+}
+
+
+static void
+ngx_http_mp4_free_moov(ngx_http_mp4_main_conf_t *mmcf,
+    ngx_http_mp4_moov_t *moov)
+{
+    ngx_uint_t  i;
+
+    ngx_rbtree_delete(&mmcf->rbtree, &moov->sn.node);
+    ngx_queue_remove(&moov->queue);
+
+    if (moov->stts) {
+        for (i = 0; i < moov->ntraks; i++) {
+            if (moov->stts[i]) {
+                ngx_free(moov->stts[i]);
+            }
+        }
+
+        ngx_free(moov->stts);
+    }
+
+    mmcf->moov_cache_size -= moov->size;
+
+    ngx_free(moov);
+}
+
+
 static ngx_int_t
 ngx_http_mp4_read_ftyp_atom(ngx_http_mp4_file_t *mp4, uint64_t atom_data_size)
 {
@@ -1153,6 +1553,10 @@ ngx_http_mp4_read_moov_atom(ngx_http_mp4_file_t *mp4, uint64_t atom_data_size)
 
         mp4->buffer_size = (size_t) atom_data_size
                          + NGX_HTTP_MP4_MOOV_BUFFER_EXCESS * no_mdat;
+
+        if (ngx_http_mp4_read_moov(mp4, (size_t) atom_data_size) != NGX_OK) {
+            return NGX_ERROR;
+        }
     }
 
     if (ngx_http_mp4_read(mp4, (size_t) atom_data_size) != NGX_OK) {
@@ -2113,6 +2517,91 @@ ngx_http_mp4_read_stts_atom(ngx_http_mp4_file_t *mp4, uint64_t atom_data_size)
 }
 
 
+static ngx_http_mp4_stts_index_t *
+ngx_http_mp4_stts_index(ngx_http_mp4_file_t *mp4, ngx_http_mp4_trak_t *trak)
+{
+    size_t                      size;
+    uint32_t                    count;
+    uint64_t                    time, sample;
+    ngx_buf_t                  *data;
+    ngx_uint_t                  i, n;
+    ngx_http_mp4_moov_t        *moov;
+    ngx_mp4_stts_entry_t       *entry;
+    ngx_http_mp4_main_conf_t   *mmcf;
+    ngx_http_mp4_stts_index_t  *index;
+
+    /*
+     * cumulative time and sample numbers at the beginning of each
+     * time-to-sample entry, built once per track of a cached moov atom
+     */
+
+    moov = mp4->moov;
+
+    if (moov == NULL) {
+        return NULL;
+    }
+
+    mmcf = ngx_http_get_module_main_conf(mp4->request, ngx_http_mp4_module);
+
+    if (moov->stts == NULL) {
+        moov->stts = ngx_alloc(mp4->trak.nelts * sizeof(void *),
+                               mp4->file.log);
+        if (moov->stts == NULL) {
+            return NULL;
+        }
+
+        ngx_memzero(moov->stts, mp4->trak.nelts * sizeof(void *));
+
+        moov->ntraks = mp4->trak.nelts;
+        moov->size += mp4->trak.nelts * sizeof(void *);
+        mmcf->moov_cache_size += mp4->trak.nelts * sizeof(void *);
+    }
+
+    i = trak - (ngx_http_mp4_trak_t *) mp4->trak.elts;
+
+    if (i >= moov->ntraks) {
+        return NULL;
+    }
+
+    if (moov->stts[i]) {
+        return moov->stts[i];
+    }
+
+    n = trak->time_to_sample_entries;
+    size = (n + 1) * sizeof(ngx_http_mp4_stts_index_t);
+
+    index = ngx_alloc(size, mp4->file.log);
+    if (index == NULL) {
+        return NULL;
+    }
+
+    data = trak->out[NGX_HTTP_MP4_STTS_DATA].buf;
+    entry = (ngx_mp4_stts_entry_t *) data->pos;
+
+    time = 0;
+    sample = 0;
+
+    for (i = 0; i < n; i++) {
+        index[i].time = time;
+        index[i].sample = sample;
+
+        count = ngx_mp4_get_32value(entry[i].count);
+
+        time += (uint64_t) count * ngx_mp4_get_32value(entry[i].duration);
+        sample += count;
+    }
+
+    index[n].time = time;
+    index[n].sample = sample;
+
+    moov->stts[trak - (ngx_http_mp4_trak_t *) mp4->trak.elts] = index;
+    moov->size += size;
+    mmcf->moov_cache_size += size;
+
+    return index;
+}
+
+
 static ngx_int_t
 ngx_http_mp4_update_stts_atom(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_trak_t *trak)
@@ -2165,11 +2654,13 @@ static ngx_int_t
 ngx_http_mp4_crop_stts_data(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_trak_t *trak, ngx_uint_t start)
 {
-    uint32_t               count, duration, rest;
-    uint64_t               start_time;
-    ngx_buf_t             *data;
-    ngx_uint_t             start_sample, entries, start_sec;
-    ngx_mp4_stts_entry_t  *entry, *end;
+    uint32_t                    count, duration, rest;
+    uint64_t                    start_time;
+    ngx_buf_t                  *data;
+    ngx_uint_t                  start_sample, entries, start_sec, left, right,
+                                n;
+    ngx_mp4_stts_entry_t       *entry, *end;
+    ngx_http_mp4_stts_index_t  *index;
 
     if (start) {
         start_sec = mp4->start;
@@ -2196,6 +2687,41 @@ ngx_http_mp4_crop_stts_data(ngx_http_mp4_file_t *mp4,
     entry = (ngx_mp4_stts_entry_t *) data->pos;
     end = (ngx_mp4_stts_entry_t *) data->last;
 
+    index = start ? ngx_http_mp4_stts_index(mp4, trak) : NULL;
+
+    if (index && start_time < index[entries].time) {
+
+        /* the entry containing start time, found by binary search */
+
+        left = 0;
+        right = entries;
+
+        while (right - left > 1) {
+            n = left + (right - left) / 2;
+
+            if (index[n].time <= start_time) {
+                left = n;
+
+            } else {
+                right = n;
+            }
+        }
+
+        entry += left;
+        entries -= left;
+        start_sample = (ngx_uint_t) index[left].sample;
+        start_time -= index[left].time;
+
+        count = ngx_mp4_get_32value(entry->count);
+        duration = ngx_mp4_get_32value(entry->duration);
+
+        start_sample += (ngx_uint_t) (start_time / duration);
+        rest = (uint32_t) (start_time / duration);
+        goto found;
+    }
+
+    /* without an index, and for the end time over the kept entries */
+
     while (entry < end) {
         count = ngx_mp4_get_32value(entry->count);
         duration = ngx_mp4_get_32value(entry->duration);
@@ -2394,9 +2920,9 @@ static void
 ngx_http_mp4_crop_stss_data(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_trak_t *trak, ngx_uint_t start)
 {
-    uint32_t     sample, start_sample, *entry, *end;
+    uint32_t     sample, start_sample, *entry;
     ngx_buf_t   *data;
-    ngx_uint_t   entries;
+    ngx_uint_t   entries, left, right, n;
 
     /* sync samples starts from 1 */
 
@@ -2420,26 +2946,35 @@ ngx_http_mp4_crop_stss_data(ngx_http_mp4_file_t *mp4,
 
     entries = trak->sync_samples_entries;
     entry = (uint32_t *) data->pos;
-    end = (uint32_t *) data->last;
 
-    while (entry < end) {
-        sample = ngx_mp4_get_32value(entry);
+    /* sync samples are sorted, the first one not before start_sample */
+
+    left = 0;
+    right = entries;
+
+    while (left < right) {
+        n = left + (right - left) / 2;
+
+        sample = ngx_mp4_get_32value(&entry[n]);
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
                        "sync:%uD", sample);
 
         if (sample >= start_sample) {
-            goto found;
-        }
+            right = n;
 
-        entries--;
-        entry++;
+        } else {
+            left = n + 1;
+        }
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
-                   "sample is out of mp4 stss atom");
+    if (left == entries) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                       "sample is out of mp4 stss atom");
+    }
 
-found:
+    entry += left;
+    entries -= left;
 
     if (start) {
         data->pos = (u_char *) entry;
@@ -3531,6 +4066,43 @@ ngx_http_mp4(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static void *
+ngx_http_mp4_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_mp4_main_conf_t  *mmcf;
+
+    mmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_mp4_main_conf_t));
+    if (mmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     mmcf->moov_cache_size = 0;
+     */
+
+    mmcf->moov_cache = NGX_CONF_UNSET_SIZE;
+
+    ngx_rbtree_init(&mmcf->rbtree, &mmcf->sentinel,
+                    ngx_str_rbtree_insert_value);
+    ngx_queue_init(&mmcf->queue);
+
+    return mmcf;
+}
+
+
+static char *
+ngx_http_mp4_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_mp4_main_conf_t *mmcf = conf;
+
+    ngx_conf_init_size_value(mmcf->moov_cache, 0);
+
+    return NGX_CONF_OK;
+}
+
+
 static void *
 ngx_http_mp4_create_conf(ngx_conf_t *cf)
 {
@@ -3543,6 +4115,7 @@ ngx_http_mp4_create_conf(ngx_conf_t *cf)
 
     conf->buffer_size = NGX_CONF_UNSET_SIZE;
     conf->max_buffer_size = NGX_CONF_UNSET_SIZE;
+    conf->cache_seek = NGX_CONF_UNSET;
 
     return conf;
 }
@@ -3557,6 +4130,24 @@ ngx_http_mp4_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size, 512 * 1024);
     ngx_conf_merge_size_value(conf->max_buffer_size, prev->max_buffer_size,
                               10 * 1024 * 1024);
+    ngx_conf_merge_value(conf->cache_seek, prev->cache_seek, 0);
 
     return NGX_CONF_OK;
 }
+
+
+static ngx_int_t
+ngx_http_mp4_filter_init(ngx_conf_t *cf)
+{
+#if (NGX_HTTP_CACHE)
+
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_mp4_header_filter;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_mp4_body_filter;
+
+#endif
+
+    return NGX_OK;
+}
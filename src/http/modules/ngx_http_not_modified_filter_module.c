@@ -14,6 +14,7 @@ static ngx_uint_t ngx_http_test_if_unmodified(ngx_http_request_t *r);
 static ngx_uint_t ngx_http_test_if_modified(ngx_http_request_t *r);
 static ngx_uint_t ngx_http_test_if_match(ngx_http_request_t *r,
     ngx_table_elt_t *header, ngx_uint_t weak);
+static time_t ngx_http_not_modified_parse_time(ngx_str_t *value);
 static ngx_int_t ngx_http_not_modified_filter_init(ngx_conf_t *cf);
 
 
@@ -51,6 +52,12 @@ ngx_module_t  ngx_http_not_modified_filter_module = {
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 
 
+/* the last date parsed: clients revalidating a file repeat the same one */
+
+static u_char  ngx_http_last_date[sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1];
+static time_t  ngx_http_last_time;
+
+
 static ngx_int_t
 ngx_http_not_modified_header_filter(ngx_http_request_t *r)
 {
@@ -118,8 +125,8 @@ ngx_http_test_if_unmodified(ngx_http_request_t *r)
         return 0;
     }
 
-    iums = ngx_parse_http_time(r->headers_in.if_unmodified_since->value.data,
-                               r->headers_in.if_unmodified_since->value.len);
+    iums = ngx_http_not_modified_parse_time(
+                                   &r->headers_in.if_unmodified_since->value);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                  "http iums:%T lm:%T", iums, r->headers_out.last_modified_time);
@@ -148,8 +155,8 @@ ngx_http_test_if_modified(ngx_http_request_t *r)
         return 1;
     }
 
-    ims = ngx_parse_http_time(r->headers_in.if_modified_since->value.data,
-                              r->headers_in.if_modified_since->value.len);
+    ims = ngx_http_not_modified_parse_time(
+                                     &r->headers_in.if_modified_since->value);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http ims:%T lm:%T", ims, r->headers_out.last_modified_time);
@@ -256,6 +263,28 @@ ngx_http_test_if_match(ngx_http_request_t *r, ngx_table_elt_t *header,
 }
 
 
+static time_t
+ngx_http_not_modified_parse_time(ngx_str_t *value)
+{
+    time_t  t;
+
+    if (value->len != sizeof(ngx_http_last_date)) {
+        return ngx_parse_http_time(value->data, value->len);
+    }
+
+    if (ngx_memcmp(value->data, ngx_http_last_date, value->len) == 0) {
+        return ngx_http_last_time;
+    }
+
+    t = ngx_parse_http_time(value->data, value->len);
+
+    ngx_memcpy(ngx_http_last_date, value->data, value->len);
+    ngx_http_last_time = t;
+
+    return t;
+}
+
+
 static ngx_int_t
 ngx_http_not_modified_filter_init(ngx_conf_t *cf)
 {
@@ -49,6 +49,9 @@ typedef struct {
     ngx_array_t                   *lengths;
     ngx_array_t                   *values;
     ngx_hash_t                     hash;
+
+    /* headers with constant values, formatted at configuration time */
+    ngx_str_t                      fixed;
 } ngx_http_proxy_headers_t;
 
 
@@ -63,6 +66,11 @@ typedef struct {
     ngx_http_proxy_headers_t       headers;
 #if (NGX_HTTP_CACHE)
     ngx_http_proxy_headers_t       headers_cache;
+#endif
+#if (NGX_HTTP_GRPC)
+    /* HTTP/2 requests are created by the grpc module */
+    ngx_http_grpc_headers_t        headers_v2;
+    ngx_uint_t                     host_set;
 #endif
     ngx_array_t                   *headers_source;
 
@@ -125,6 +133,10 @@ static ngx_int_t ngx_http_proxy_eval(ngx_http_request_t *r,
 static ngx_int_t ngx_http_proxy_create_key(ngx_http_request_t *r);
 #endif
 static ngx_int_t ngx_http_proxy_create_request(ngx_http_request_t *r);
+#if (NGX_HTTP_GRPC)
+static ngx_int_t ngx_http_proxy_create_v2_uri(ngx_http_request_t *r,
+    ngx_http_proxy_ctx_t *ctx, ngx_http_proxy_loc_conf_t *plcf);
+#endif
 static ngx_int_t ngx_http_proxy_reinit_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_proxy_body_output_filter(void *data, ngx_chain_t *in);
 static ngx_int_t ngx_http_proxy_process_status_line(ngx_http_request_t *r);
@@ -170,7 +182,7 @@ static char *ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static ngx_int_t ngx_http_proxy_init_headers(ngx_conf_t *cf,
     ngx_http_proxy_loc_conf_t *conf, ngx_http_proxy_headers_t *headers,
-    ngx_keyval_t *default_headers);
+    ngx_keyval_t *default_headers, ngx_uint_t fixed);
 
 static char *ngx_http_proxy_pass(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -182,6 +194,8 @@ static char *ngx_http_proxy_cookie_path(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_proxy_store(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_proxy_coalesce(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 #if (NGX_HTTP_CACHE)
 static char *ngx_http_proxy_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -245,6 +259,9 @@ static ngx_conf_bitmask_t  ngx_http_proxy_ssl_protocols[] = {
 static ngx_conf_enum_t  ngx_http_proxy_http_version[] = {
     { ngx_string("1.0"), NGX_HTTP_VERSION_10 },
     { ngx_string("1.1"), NGX_HTTP_VERSION_11 },
+#if (NGX_HTTP_GRPC)
+    { ngx_string("2"), NGX_HTTP_VERSION_20 },
+#endif
     { ngx_null_string, 0 }
 };
 
@@ -296,6 +313,20 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, upstream.store_access),
       NULL },
 
+    { ngx_string("proxy_coalesce"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_proxy_coalesce,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("proxy_coalesce_max_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.coalesce_max_size),
+      NULL },
+
     { ngx_string("proxy_buffering"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -429,6 +460,13 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, upstream.bufs),
       NULL },
 
+    { ngx_string("proxy_buffers_adaptive"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.adaptive_buffers),
+      NULL },
+
     { ngx_string("proxy_busy_buffers_size"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -487,6 +525,20 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, upstream.no_cache),
       NULL },
 
+    { ngx_string("proxy_cache_purge"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_set_predicate_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_purge),
+      NULL },
+
+    { ngx_string("proxy_cache_tag"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_set_predicate_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_tags),
+      NULL },
+
     { ngx_string("proxy_cache_valid"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
       ngx_http_file_cache_valid_set_slot,
@@ -564,6 +616,20 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_background_update),
       NULL },
 
+    { ngx_string("proxy_cache_write_behind"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_write_behind),
+      NULL },
+
+    { ngx_string("proxy_cache_read_while_write"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_read_while_write),
+      NULL },
+
 #endif
 
     { ngx_string("proxy_temp_path"),
@@ -813,6 +879,24 @@ static ngx_keyval_t  ngx_http_proxy_cache_headers[] = {
 #endif
 
 
+#if (NGX_HTTP_GRPC)
+
+static ngx_keyval_t  ngx_http_proxy_v2_headers[] = {
+    { ngx_string("Host"), ngx_string("") },
+    { ngx_string("Content-Length"), ngx_string("$content_length") },
+    { ngx_string("Connection"), ngx_string("") },
+    { ngx_string("Transfer-Encoding"), ngx_string("") },
+    { ngx_string("TE"), ngx_string("") },
+    { ngx_string("Keep-Alive"), ngx_string("") },
+    { ngx_string("Proxy-Connection"), ngx_string("") },
+    { ngx_string("Expect"), ngx_string("") },
+    { ngx_string("Upgrade"), ngx_string("") },
+    { ngx_null_string, ngx_null_string }
+};
+
+#endif
+
+
 static ngx_http_variable_t  ngx_http_proxy_vars[] = {
 
     { ngx_string("proxy_host"), NULL, ngx_http_proxy_host_variable, 0,
@@ -855,6 +939,9 @@ ngx_http_proxy_handler(ngx_http_request_t *r)
 #if (NGX_HTTP_CACHE)
     ngx_http_proxy_main_conf_t  *pmcf;
 #endif
+#if (NGX_HTTP_GRPC)
+    ngx_str_t                   *host;
+#endif
 
     if (ngx_http_upstream_create(r) != NGX_OK) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -911,6 +998,22 @@ ngx_http_proxy_handler(ngx_http_request_t *r)
         u->rewrite_cookie = ngx_http_proxy_rewrite_cookie;
     }
 
+#if (NGX_HTTP_GRPC)
+
+    if (plcf->http_version == NGX_HTTP_VERSION_20) {
+
+        if (ngx_http_proxy_create_v2_uri(r, ctx, plcf) != NGX_OK) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        host = plcf->host_set ? NULL : &ctx->vars.host_header;
+
+        return ngx_http_grpc_upstream_init(r, &plcf->headers_v2, host,
+                                           &u->uri);
+    }
+
+#endif
+
     u->buffering = plcf->upstream.buffering;
 
     u->pipe = ngx_pcalloc(r->pool, sizeof(ngx_event_pipe_t));
@@ -1281,6 +1384,8 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
         len += key_len + sizeof(": ") - 1 + val_len + sizeof(CRLF) - 1;
     }
 
+    len += headers->fixed.len;
+
 
     /*
      * NOTE: 把 client 发送给 nginx 的 request 中的 header 也发送给 upstream
@@ -1371,6 +1476,8 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
                              sizeof(ngx_http_proxy_version) - 1);
     }
 
+    b->last = ngx_copy(b->last, headers->fixed.data, headers->fixed.len);
+
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
 
     e.ip = headers->values->elts;
@@ -1486,6 +1593,9 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
         if (ctx->internal_chunked) {
             u->output.output_filter = ngx_http_proxy_body_output_filter;
             u->output.filter_ctx = r;
+
+        } else if (!r->headers_in.chunked) {
+            u->request_body_splice = 1;
         }
 
     } else if (plcf->body_values == NULL && plcf->upstream.pass_request_body) {
@@ -1523,6 +1633,80 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
 }
 
 
+#if (NGX_HTTP_GRPC)
+
+static ngx_int_t
+ngx_http_proxy_create_v2_uri(ngx_http_request_t *r, ngx_http_proxy_ctx_t *ctx,
+    ngx_http_proxy_loc_conf_t *plcf)
+{
+    u_char               *p;
+    size_t                len, loc_len;
+    uintptr_t             escape;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    if (plcf->proxy_lengths && ctx->vars.uri.len) {
+        u->uri = ctx->vars.uri;
+        return NGX_OK;
+    }
+
+    if (ctx->vars.uri.len == 0 && r->valid_unparsed_uri) {
+        u->uri = r->unparsed_uri;
+        return NGX_OK;
+    }
+
+    escape = 0;
+    loc_len = (r->valid_location && ctx->vars.uri.len) ?
+                  plcf->location.len : 0;
+
+    if (r->quoted_uri || r->space_in_uri || r->internal) {
+        escape = 2 * ngx_escape_uri(NULL, r->uri.data + loc_len,
+                                    r->uri.len - loc_len, NGX_ESCAPE_URI);
+    }
+
+    len = ctx->vars.uri.len + r->uri.len - loc_len + escape
+          + sizeof("?") - 1 + r->args.len;
+
+    if (len == 0) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "zero length URI to proxy");
+        return NGX_ERROR;
+    }
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    u->uri.data = p;
+
+    if (r->valid_location) {
+        p = ngx_copy(p, ctx->vars.uri.data, ctx->vars.uri.len);
+    }
+
+    if (escape) {
+        ngx_escape_uri(p, r->uri.data + loc_len,
+                       r->uri.len - loc_len, NGX_ESCAPE_URI);
+        p += r->uri.len - loc_len + escape;
+
+    } else {
+        p = ngx_copy(p, r->uri.data + loc_len, r->uri.len - loc_len);
+    }
+
+    if (r->args.len > 0) {
+        *p++ = '?';
+        p = ngx_copy(p, r->args.data, r->args.len);
+    }
+
+    u->uri.len = p - u->uri.data;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_proxy_reinit_request(ngx_http_request_t *r)
 {
@@ -2002,6 +2186,8 @@ ngx_http_proxy_input_filter_init(void *data)
 
         u->pipe->length = u->headers_in.content_length_n;
         u->length = u->headers_in.content_length_n;
+
+        u->response_body_splice = 1;
     }
 
     return NGX_OK;
@@ -2819,9 +3005,15 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
      *     conf->headers.lengths = NULL;
      *     conf->headers.values = NULL;
      *     conf->headers.hash = { NULL, 0 };
+     *     conf->headers.fixed = { 0, NULL };
      *     conf->headers_cache.lengths = NULL;
      *     conf->headers_cache.values = NULL;
      *     conf->headers_cache.hash = { NULL, 0 };
+     *     conf->headers_cache.fixed = { 0, NULL };
+     *     conf->headers_v2.lengths = NULL;
+     *     conf->headers_v2.values = NULL;
+     *     conf->headers_v2.hash = { NULL, 0 };
+     *     conf->host_set = 0;
      *     conf->body_lengths = NULL;
      *     conf->body_values = NULL;
      *     conf->body_source = { 0, NULL };
@@ -2854,6 +3046,7 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->upstream.send_lowat = NGX_CONF_UNSET_SIZE;
     conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
     conf->upstream.limit_rate = NGX_CONF_UNSET_SIZE;
+    conf->upstream.adaptive_buffers = NGX_CONF_UNSET;
 
     conf->upstream.busy_buffers_size_conf = NGX_CONF_UNSET_SIZE;
     conf->upstream.max_temp_file_size_conf = NGX_CONF_UNSET_SIZE;
@@ -2862,12 +3055,17 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->upstream.pass_request_headers = NGX_CONF_UNSET;
     conf->upstream.pass_request_body = NGX_CONF_UNSET;
 
+    conf->upstream.coalesce = NGX_CONF_UNSET_PTR;
+    conf->upstream.coalesce_max_size = NGX_CONF_UNSET_SIZE;
+
 #if (NGX_HTTP_CACHE)
     conf->upstream.cache = NGX_CONF_UNSET;
     conf->upstream.cache_min_uses = NGX_CONF_UNSET_UINT;
     conf->upstream.cache_max_range_offset = NGX_CONF_UNSET;
     conf->upstream.cache_bypass = NGX_CONF_UNSET_PTR;
     conf->upstream.no_cache = NGX_CONF_UNSET_PTR;
+    conf->upstream.cache_purge = NGX_CONF_UNSET_PTR;
+    conf->upstream.cache_tags = NGX_CONF_UNSET_PTR;
     conf->upstream.cache_valid = NGX_CONF_UNSET_PTR;
     conf->upstream.cache_lock = NGX_CONF_UNSET;
     conf->upstream.cache_lock_timeout = NGX_CONF_UNSET_MSEC;
@@ -2875,6 +3073,8 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->upstream.cache_revalidate = NGX_CONF_UNSET;
     conf->upstream.cache_convert_head = NGX_CONF_UNSET;
     conf->upstream.cache_background_update = NGX_CONF_UNSET;
+    conf->upstream.cache_write_behind = NGX_CONF_UNSET;
+    conf->upstream.cache_read_while_write = NGX_CONF_UNSET;
 #endif
 
     conf->upstream.hide_headers = NGX_CONF_UNSET_PTR;
@@ -2923,6 +3123,9 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_core_loc_conf_t   *clcf;
     ngx_http_proxy_rewrite_t   *pr;
     ngx_http_script_compile_t   sc;
+#if (NGX_HTTP_GRPC)
+    ngx_http_proxy_headers_t    headers;
+#endif
 
 #if (NGX_HTTP_CACHE)
 
@@ -2947,6 +3150,13 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->upstream.store_access,
                               prev->upstream.store_access, 0600);
 
+    ngx_conf_merge_ptr_value(conf->upstream.coalesce,
+                              prev->upstream.coalesce, NULL);
+
+    ngx_conf_merge_size_value(conf->upstream.coalesce_max_size,
+                              prev->upstream.coalesce_max_size,
+                              1024 * 1024);
+
     ngx_conf_merge_uint_value(conf->upstream.next_upstream_tries,
                               prev->upstream.next_upstream_tries, 0);
 
@@ -2993,6 +3203,9 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_bufs_value(conf->upstream.bufs, prev->upstream.bufs,
                               8, ngx_pagesize);
 
+    ngx_conf_merge_value(conf->upstream.adaptive_buffers,
+                              prev->upstream.adaptive_buffers, 0);
+
     if (conf->upstream.bufs.num < 2) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "there must be at least 2 \"proxy_buffers\"");
@@ -3161,6 +3374,12 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_ptr_value(conf->upstream.no_cache,
                              prev->upstream.no_cache, NULL);
 
+    ngx_conf_merge_ptr_value(conf->upstream.cache_purge,
+                             prev->upstream.cache_purge, NULL);
+
+    ngx_conf_merge_ptr_value(conf->upstream.cache_tags,
+                             prev->upstream.cache_tags, NULL);
+
     ngx_conf_merge_ptr_value(conf->upstream.cache_valid,
                              prev->upstream.cache_valid, NULL);
 
@@ -3186,6 +3405,12 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.cache_background_update,
                               prev->upstream.cache_background_update, 0);
 
+    ngx_conf_merge_value(conf->upstream.cache_write_behind,
+                              prev->upstream.cache_write_behind, 0);
+
+    ngx_conf_merge_value(conf->upstream.cache_read_while_write,
+                              prev->upstream.cache_read_while_write, 0);
+
 #endif
 
     if (conf->method == NULL) {
@@ -3200,6 +3425,32 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.intercept_errors,
                               prev->upstream.intercept_errors, 0);
 
+    ngx_conf_merge_uint_value(conf->http_version, prev->http_version,
+                              NGX_HTTP_VERSION_10);
+
+#if (NGX_HTTP_GRPC)
+
+    if (conf->http_version == NGX_HTTP_VERSION_20) {
+
+#if (NGX_HTTP_CACHE)
+        if (conf->upstream.cache) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"proxy_cache\" cannot be used with "
+                               "\"proxy_http_version 2\"");
+            return NGX_CONF_ERROR;
+        }
+#endif
+
+        /* responses are read from HTTP/2 frames without buffering */
+
+        conf->upstream.buffering = 0;
+        conf->upstream.store = 0;
+        conf->upstream.pass_trailers = 1;
+        conf->upstream.preserve_output = 1;
+    }
+
+#endif
+
 #if (NGX_HTTP_SSL)
 
     ngx_conf_merge_value(conf->upstream.ssl_session_reuse,
@@ -3293,9 +3544,6 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_ptr_value(conf->cookie_paths, prev->cookie_paths, NULL);
 
-    ngx_conf_merge_uint_value(conf->http_version, prev->http_version,
-                              NGX_HTTP_VERSION_10);
-
     ngx_conf_merge_uint_value(conf->headers_hash_max_size,
                               prev->headers_hash_max_size, 512);
 
@@ -3367,12 +3615,16 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         conf->headers = prev->headers;
 #if (NGX_HTTP_CACHE)
         conf->headers_cache = prev->headers_cache;
+#endif
+#if (NGX_HTTP_GRPC)
+        conf->headers_v2 = prev->headers_v2;
+        conf->host_set = prev->host_set;
 #endif
         conf->headers_source = prev->headers_source;
     }
 
     rc = ngx_http_proxy_init_headers(cf, conf, &conf->headers,
-                                     ngx_http_proxy_headers);
+                                     ngx_http_proxy_headers, 1);
     if (rc != NGX_OK) {
         return NGX_CONF_ERROR;
     }
@@ -3381,10 +3633,33 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     if (conf->upstream.cache) {
         rc = ngx_http_proxy_init_headers(cf, conf, &conf->headers_cache,
-                                         ngx_http_proxy_cache_headers);
+                                         ngx_http_proxy_cache_headers, 1);
+        if (rc != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+#endif
+
+#if (NGX_HTTP_GRPC)
+
+    if (conf->http_version == NGX_HTTP_VERSION_20
+        && conf->headers_v2.hash.buckets == NULL)
+    {
+        ngx_memzero(&headers, sizeof(ngx_http_proxy_headers_t));
+
+        /* the grpc module needs all headers as scripts */
+
+        rc = ngx_http_proxy_init_headers(cf, conf, &headers,
+                                         ngx_http_proxy_v2_headers, 0);
         if (rc != NGX_OK) {
             return NGX_CONF_ERROR;
         }
+
+        conf->headers_v2.flushes = headers.flushes;
+        conf->headers_v2.lengths = headers.lengths;
+        conf->headers_v2.values = headers.values;
+        conf->headers_v2.hash = headers.hash;
     }
 
 #endif
@@ -3400,6 +3675,10 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         prev->headers = conf->headers;
 #if (NGX_HTTP_CACHE)
         prev->headers_cache = conf->headers_cache;
+#endif
+#if (NGX_HTTP_GRPC)
+        prev->headers_v2 = conf->headers_v2;
+        prev->host_set = conf->host_set;
 #endif
     }
 
@@ -3409,13 +3688,14 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
 static ngx_int_t
 ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
-    ngx_http_proxy_headers_t *headers, ngx_keyval_t *default_headers)
+    ngx_http_proxy_headers_t *headers, ngx_keyval_t *default_headers,
+    ngx_uint_t fixed)
 {
     u_char                       *p;
     size_t                        size;
     uintptr_t                    *code;
-    ngx_uint_t                    i;
-    ngx_array_t                   headers_names, headers_merged;
+    ngx_uint_t                    i, n;
+    ngx_array_t                   headers_names, headers_merged, constant;
     ngx_keyval_t                 *src, *s, *h;
     ngx_hash_key_t               *hk;
     ngx_hash_init_t               hash;
@@ -3438,6 +3718,10 @@ ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
         return NGX_ERROR;
     }
 
+    if (ngx_array_init(&constant, cf->temp_pool, 256, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     headers->lengths = ngx_array_create(cf->pool, 64, 1);
     if (headers->lengths == NULL) {
         return NGX_ERROR;
@@ -3453,6 +3737,14 @@ ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
         src = conf->headers_source->elts;
         for (i = 0; i < conf->headers_source->nelts; i++) {
 
+#if (NGX_HTTP_GRPC)
+            if (src[i].key.len == 4
+                && ngx_strncasecmp(src[i].key.data, (u_char *) "Host", 4) == 0)
+            {
+                conf->host_set = 1;
+            }
+#endif
+
             s = ngx_array_push(&headers_merged);
             if (s == NULL) {
                 return NGX_ERROR;
@@ -3502,6 +3794,39 @@ ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
             continue;
         }
 
+        if (fixed && ngx_http_script_variables_count(&src[i].value) == 0) {
+
+            /* repeated headers are kept in order as scripts */
+
+            for (n = 0; n < headers_merged.nelts; n++) {
+                if (n != i
+                    && src[n].key.len == src[i].key.len
+                    && ngx_strncasecmp(src[n].key.data, src[i].key.data,
+                                       src[i].key.len)
+                       == 0)
+                {
+                    break;
+                }
+            }
+
+            if (n == headers_merged.nelts) {
+                size = src[i].key.len + sizeof(": ") - 1
+                       + src[i].value.len + sizeof(CRLF) - 1;
+
+                p = ngx_array_push_n(&constant, size);
+                if (p == NULL) {
+                    return NGX_ERROR;
+                }
+
+                p = ngx_cpymem(p, src[i].key.data, src[i].key.len);
+                *p++ = ':'; *p++ = ' ';
+                p = ngx_cpymem(p, src[i].value.data, src[i].value.len);
+                *p++ = CR; *p = LF;
+
+                continue;
+            }
+        }
+
         copy = ngx_array_push_n(headers->lengths,
                                 sizeof(ngx_http_script_copy_code_t));
         if (copy == NULL) {
@@ -3561,6 +3886,16 @@ ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
 
     *code = (uintptr_t) NULL;
 
+    if (constant.nelts) {
+        headers->fixed.data = ngx_pnalloc(cf->pool, constant.nelts);
+        if (headers->fixed.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(headers->fixed.data, constant.elts, constant.nelts);
+        headers->fixed.len = constant.nelts;
+    }
+
 
     hash.hash = &headers->hash;
     hash.key = ngx_hash_key_lc;
@@ -4108,6 +4443,47 @@ ngx_http_proxy_store(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_proxy_coalesce(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_proxy_loc_conf_t *plcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_http_complex_value_t          *cv;
+    ngx_http_compile_complex_value_t   ccv;
+
+    if (plcf->upstream.coalesce != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        plcf->upstream.coalesce = NULL;
+        return NGX_CONF_OK;
+    }
+
+    cv = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (cv == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = cv;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    plcf->upstream.coalesce = cv;
+
+    return NGX_CONF_OK;
+}
+
+
 #if (NGX_HTTP_CACHE)
 
 static char *
@@ -4334,6 +4710,22 @@ ngx_http_proxy_set_ssl(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *plcf)
         return NGX_ERROR;
     }
 
+#if (NGX_HTTP_GRPC)
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+
+    if (plcf->http_version == NGX_HTTP_VERSION_20
+        && SSL_CTX_set_alpn_protos(plcf->upstream.ssl->ctx,
+                                   (u_char *) "\x02h2", 3)
+           != 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, cf->log, 0,
+                      "SSL_CTX_set_alpn_protos() failed");
+        return NGX_ERROR;
+    }
+
+#endif
+#endif
+
     return NGX_OK;
 }
 
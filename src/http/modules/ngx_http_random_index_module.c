@@ -81,6 +81,7 @@ ngx_http_random_index_handler(ngx_http_request_t *r)
     ngx_dir_t                          dir;
     ngx_uint_t                         n, level;
     ngx_array_t                        names;
+    ngx_http_index_cached_t           *cached;
     ngx_http_random_index_loc_conf_t  *rlcf;
 
     if (r->uri.data[r->uri.len - 1] != '/') {
@@ -116,6 +117,14 @@ ngx_http_random_index_handler(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http random index: \"%s\"", path.data);
 
+    cached = ngx_http_index_cache_lookup(r, &path);
+
+    if (cached && cached->listed) {
+        n = cached->nfiles;
+        name = cached->files;
+        goto found;
+    }
+
     if (ngx_open_dir(&path, &dir) == NGX_ERROR) {
         err = ngx_errno;
 
@@ -234,13 +243,18 @@ ngx_http_random_index_handler(ngx_http_request_t *r)
     }
 
     n = names.nelts;
+    name = names.elts;
+
+    if (cached) {
+        ngx_http_index_cache_files(cached, name, n);
+    }
+
+found:
 
     if (n == 0) {
         return NGX_DECLINED;
     }
 
-    name = names.elts;
-
     n = (ngx_uint_t) (((uint64_t) ngx_random() * n) / 0x80000000);
 
     uri.len = r->uri.len + name[n].len;
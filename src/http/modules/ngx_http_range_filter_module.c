@@ -27,10 +27,18 @@
 #include <ngx_http.h>
 
 
+/*
+ * multipart ranges are sent in batches of this many parts, so the memory
+ * used for the part headers and buffers does not depend on the number
+ * of ranges
+ */
+
+#define NGX_HTTP_RANGE_MULTIPART_BATCH  64
+
+
 typedef struct {
     off_t        start;
     off_t        end;
-    ngx_str_t    content_range;
 } ngx_http_range_t;
 
 
@@ -38,6 +46,12 @@ typedef struct {
     off_t        offset;
     ngx_str_t    boundary_header;
     ngx_array_t  ranges;
+    off_t        length;
+
+    ngx_buf_t   *buf;
+    ngx_uint_t   next;
+    ngx_chain_t *free;
+    ngx_chain_t *busy;
 } ngx_http_range_filter_ctx_t;
 
 
@@ -54,6 +68,8 @@ static ngx_int_t ngx_http_range_singlepart_body(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in);
 static ngx_int_t ngx_http_range_multipart_body(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in);
+static ngx_chain_t *ngx_http_range_get_buf(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx);
 
 static ngx_int_t ngx_http_range_header_filter_init(ngx_conf_t *cf);
 static ngx_int_t ngx_http_range_body_filter_init(ngx_conf_t *cf);
@@ -583,6 +599,7 @@ ngx_http_range_multipart_header(ngx_http_request_t *r,
     ngx_uint_t          i;
     ngx_http_range_t   *range;
     ngx_atomic_uint_t   boundary;
+    u_char              content_range[3 * NGX_OFF_T_LEN + 2 + 4];
 
     size = sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN
            + sizeof(CRLF "Content-Type: ") - 1
@@ -680,25 +697,22 @@ ngx_http_range_multipart_header(ngx_http_request_t *r,
     range = ctx->ranges.elts;
     for (i = 0; i < ctx->ranges.nelts; i++) {
 
-        /* the size of the range: "SSSS-EEEE/TTTT" CRLF CRLF */
-
-        range[i].content_range.data =
-                               ngx_pnalloc(r->pool, 3 * NGX_OFF_T_LEN + 2 + 4);
-
-        if (range[i].content_range.data == NULL) {
-            return NGX_ERROR;
-        }
+        /*
+         * the size of the range: "SSSS-EEEE/TTTT" CRLF CRLF,
+         * it is printed again when the part is sent
+         */
 
-        range[i].content_range.len = ngx_sprintf(range[i].content_range.data,
-                                               "%O-%O/%O" CRLF CRLF,
-                                               range[i].start, range[i].end - 1,
-                                               r->headers_out.content_length_n)
-                                     - range[i].content_range.data;
+        size = ngx_sprintf(content_range, "%O-%O/%O" CRLF CRLF,
+                           range[i].start, range[i].end - 1,
+                           r->headers_out.content_length_n)
+               - content_range;
 
-        len += ctx->boundary_header.len + range[i].content_range.len
+        len += ctx->boundary_header.len + size
                                              + (range[i].end - range[i].start);
     }
 
+    ctx->length = r->headers_out.content_length_n;
+
     r->headers_out.content_length_n = len;
 
     if (r->headers_out.content_length) {
@@ -751,13 +765,18 @@ ngx_http_range_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
     ngx_http_range_filter_ctx_t  *ctx;
 
-    if (in == NULL) {
+    ctx = ngx_http_get_module_ctx(r, ngx_http_range_body_filter_module);
+
+    if (ctx == NULL) {
         return ngx_http_next_body_filter(r, in);
     }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_range_body_filter_module);
+    if (in == NULL) {
+
+        if (ctx->buf) {
+            return ngx_http_range_multipart_body(r, ctx, NULL);
+        }
 
-    if (ctx == NULL) {
         return ngx_http_next_body_filter(r, in);
     }
 
@@ -955,129 +974,190 @@ static ngx_int_t
 ngx_http_range_multipart_body(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in)
 {
+    ngx_int_t          rc;
     ngx_buf_t         *b, *buf;
-    ngx_uint_t         i;
-    ngx_chain_t       *out, *hcl, *rcl, *dcl, **ll;
+    ngx_uint_t         n;
+    ngx_chain_t       *out, *cl, **ll;
     ngx_http_range_t  *range;
 
-    ll = &out;
-    buf = in->buf;
+    if (in) {
+        ctx->buf = in->buf;
+        r->buffered |= NGX_HTTP_RANGE_BUFFERED;
+    }
+
+    buf = ctx->buf;
     range = ctx->ranges.elts;
 
-    for (i = 0; i < ctx->ranges.nelts; i++) {
+    /*
+     * each part is a memory buffer with its boundary header followed by
+     * a buffer with the range data, which refers to the original file
+     * or memory, so that the parts can be sent with writev() and sendfile()
+     */
 
-        /*
-         * The boundary header of the range:
-         * CRLF
-         * "--0123456789" CRLF
-         * "Content-Type: image/jpeg" CRLF
-         * "Content-Range: bytes "
-         */
+    if (in == NULL && ctx->busy) {
+        out = NULL;
 
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
+        rc = ngx_http_next_body_filter(r, NULL);
 
-        b->memory = 1;
-        b->pos = ctx->boundary_header.data;
-        b->last = ctx->boundary_header.data + ctx->boundary_header.len;
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &out,
+                         (ngx_buf_tag_t) &ngx_http_range_body_filter_module);
 
-        hcl = ngx_alloc_chain_link(r->pool);
-        if (hcl == NULL) {
-            return NGX_ERROR;
+        if (rc != NGX_OK) {
+            return rc;
         }
+    }
+
+    for ( ;; ) {
+        out = NULL;
+        ll = &out;
+
+        for (n = 0;
+             n < NGX_HTTP_RANGE_MULTIPART_BATCH
+             && ctx->next < ctx->ranges.nelts;
+             n++, ctx->next++)
+        {
+            /*
+             * The boundary header of the range:
+             * CRLF
+             * "--0123456789" CRLF
+             * "Content-Type: image/jpeg" CRLF
+             * "Content-Range: bytes "
+             * "SSSS-EEEE/TTTT" CRLF CRLF
+             */
 
-        hcl->buf = b;
+            cl = ngx_http_range_get_buf(r, ctx);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
 
+            b = cl->buf;
 
-        /* "SSSS-EEEE/TTTT" CRLF CRLF */
+            b->last = ngx_cpymem(b->pos, ctx->boundary_header.data,
+                                 ctx->boundary_header.len);
+            b->last = ngx_sprintf(b->last, "%O-%O/%O" CRLF CRLF,
+                                  range[ctx->next].start,
+                                  range[ctx->next].end - 1, ctx->length);
 
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
+            *ll = cl;
+            ll = &cl->next;
 
-        b->temporary = 1;
-        b->pos = range[i].content_range.data;
-        b->last = range[i].content_range.data + range[i].content_range.len;
 
-        rcl = ngx_alloc_chain_link(r->pool);
-        if (rcl == NULL) {
-            return NGX_ERROR;
-        }
+            /* the range data */
 
-        rcl->buf = b;
+            cl = ngx_http_range_get_buf(r, ctx);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
 
+            b = cl->buf;
 
-        /* the range data */
+            b->temporary = buf->temporary;
+            b->memory = buf->memory;
+            b->mmap = buf->mmap;
 
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
+            if (buf->in_file) {
+                b->in_file = 1;
+                b->file = buf->file;
+                b->file_pos = buf->file_pos + range[ctx->next].start;
+                b->file_last = buf->file_pos + range[ctx->next].end;
+            }
 
-        b->in_file = buf->in_file;
-        b->temporary = buf->temporary;
-        b->memory = buf->memory;
-        b->mmap = buf->mmap;
-        b->file = buf->file;
+            if (ngx_buf_in_memory(buf)) {
+                b->pos = buf->pos + (size_t) range[ctx->next].start;
+                b->last = buf->pos + (size_t) range[ctx->next].end;
 
-        if (buf->in_file) {
-            b->file_pos = buf->file_pos + range[i].start;
-            b->file_last = buf->file_pos + range[i].end;
-        }
+            } else {
+                b->temporary = 0;
+                b->pos = NULL;
+                b->last = NULL;
+            }
 
-        if (ngx_buf_in_memory(buf)) {
-            b->pos = buf->pos + (size_t) range[i].start;
-            b->last = buf->pos + (size_t) range[i].end;
+            *ll = cl;
+            ll = &cl->next;
         }
 
-        dcl = ngx_alloc_chain_link(r->pool);
-        if (dcl == NULL) {
-            return NGX_ERROR;
+        if (ctx->next == ctx->ranges.nelts) {
+
+            /* the last boundary CRLF "--0123456789--" CRLF  */
+
+            cl = ngx_http_range_get_buf(r, ctx);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = cl->buf;
+
+            b->last = ngx_cpymem(b->pos, ctx->boundary_header.data,
+                                 sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN);
+            *b->last++ = '-'; *b->last++ = '-';
+            *b->last++ = CR; *b->last++ = LF;
+
+            b->last_buf = 1;
+
+            *ll = cl;
+
+            ctx->buf = NULL;
+            r->buffered &= ~NGX_HTTP_RANGE_BUFFERED;
+
+            return ngx_http_next_body_filter(r, out);
         }
 
-        dcl->buf = b;
+        rc = ngx_http_next_body_filter(r, out);
+
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &out,
+                         (ngx_buf_tag_t) &ngx_http_range_body_filter_module);
 
-        *ll = hcl;
-        hcl->next = rcl;
-        rcl->next = dcl;
-        ll = &dcl->next;
+        if (rc != NGX_OK) {
+            return rc;
+        }
     }
+}
 
-    /* the last boundary CRLF "--0123456789--" CRLF  */
 
-    b = ngx_calloc_buf(r->pool);
-    if (b == NULL) {
-        return NGX_ERROR;
-    }
+static ngx_chain_t *
+ngx_http_range_get_buf(ngx_http_request_t *r, ngx_http_range_filter_ctx_t *ctx)
+{
+    size_t        size;
+    u_char       *start;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
 
-    b->temporary = 1;
-    b->last_buf = 1;
+    /*
+     * the buffers are reused once sent, each has room for a part header,
+     * which is allocated on first use
+     */
 
-    b->pos = ngx_pnalloc(r->pool, sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN
-                                  + sizeof("--" CRLF) - 1);
-    if (b->pos == NULL) {
-        return NGX_ERROR;
+    cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
+    if (cl == NULL) {
+        return NULL;
     }
 
-    b->last = ngx_cpymem(b->pos, ctx->boundary_header.data,
-                         sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN);
-    *b->last++ = '-'; *b->last++ = '-';
-    *b->last++ = CR; *b->last++ = LF;
+    b = cl->buf;
+    start = b->start;
 
-    hcl = ngx_alloc_chain_link(r->pool);
-    if (hcl == NULL) {
-        return NGX_ERROR;
+    if (start == NULL) {
+        size = ctx->boundary_header.len + 3 * NGX_OFF_T_LEN + 2 + 4;
+
+        start = ngx_pnalloc(r->pool, size);
+        if (start == NULL) {
+            return NULL;
+        }
+
+        b->end = start + size;
     }
 
-    hcl->buf = b;
-    hcl->next = NULL;
+    size = b->end - start;
 
-    *ll = hcl;
+    ngx_memzero(b, sizeof(ngx_buf_t));
+
+    b->start = start;
+    b->end = start + size;
+    b->pos = start;
+    b->last = start;
+    b->temporary = 1;
+    b->tag = (ngx_buf_tag_t) &ngx_http_range_body_filter_module;
 
-    return ngx_http_next_body_filter(r, out);
+    return cl;
 }
 
 
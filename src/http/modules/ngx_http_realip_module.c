@@ -17,11 +17,12 @@
 
 
 typedef struct {
-    ngx_array_t       *from;     /* array of ngx_cidr_t */
-    ngx_uint_t         type;
-    ngx_uint_t         hash;
-    ngx_str_t          header;
-    ngx_flag_t         recursive;
+    ngx_array_t          *from;     /* array of ngx_cidr_t */
+    ngx_poptrie_cidrs_t  *trusted;
+    ngx_uint_t            type;
+    ngx_uint_t            hash;
+    ngx_str_t             header;
+    ngx_flag_t            recursive;
 } ngx_http_realip_loc_conf_t;
 
 
@@ -232,8 +233,8 @@ found:
     addr.socklen = c->socklen;
     /* addr.name = c->addr_text; */
 
-    if (ngx_http_get_forwarded_addr(r, &addr, xfwd, value, rlcf->from,
-                                    rlcf->recursive)
+    if (ngx_http_get_forwarded_addr_trusted(r, &addr, xfwd, value,
+                                            rlcf->trusted, rlcf->recursive)
         != NGX_DECLINED)
     {
         if (rlcf->type == NGX_HTTP_REALIP_PROXY) {
@@ -464,6 +465,7 @@ ngx_http_realip_create_loc_conf(ngx_conf_t *cf)
      * set by ngx_pcalloc():
      *
      *     conf->from = NULL;
+     *     conf->trusted = NULL;
      *     conf->hash = 0;
      *     conf->header = { 0, NULL };
      */
@@ -482,7 +484,24 @@ ngx_http_realip_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_realip_loc_conf_t  *conf = child;
 
     if (conf->from == NULL) {
+
+        if (prev->from && prev->trusted == NULL) {
+            prev->trusted = ngx_poptrie_cidrs_create(cf->pool, prev->from,
+                                                     cf->log);
+            if (prev->trusted == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
         conf->from = prev->from;
+        conf->trusted = prev->trusted;
+
+    } else if (conf->trusted == NULL) {
+        conf->trusted = ngx_poptrie_cidrs_create(cf->pool, conf->from,
+                                                 cf->log);
+        if (conf->trusted == NULL) {
+            return NGX_CONF_ERROR;
+        }
     }
 
     ngx_conf_merge_uint_value(conf->type, prev->type, NGX_HTTP_REALIP_XREALIP);
@@ -502,6 +521,8 @@ ngx_http_realip_add_variables(ngx_conf_t *cf)
 {
     ngx_http_variable_t  *var, *v;
 
+    ngx_http_share_loc_conf(cf, &ngx_http_realip_module);
+
     for (v = ngx_http_realip_vars; v->name.len; v++) {
         var = ngx_http_add_variable(cf, &v->name, v->flags);
         if (var == NULL) {
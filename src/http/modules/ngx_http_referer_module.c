@@ -12,6 +12,25 @@
 
 #define NGX_HTTP_REFERER_NO_URI_PART  ((void *) 4)
 
+#define NGX_HTTP_REFERER_CACHE_MISS     (ngx_uint_t) -1
+#define NGX_HTTP_REFERER_CACHE_MAX_LEN  1024
+
+
+typedef struct {
+    ngx_rbtree_t             rbtree;
+    ngx_rbtree_node_t        sentinel;
+    ngx_queue_t              queue;
+    ngx_uint_t               size;
+    ngx_uint_t               n;
+} ngx_http_referer_cache_t;
+
+
+typedef struct {
+    ngx_str_node_t           sn;
+    ngx_queue_t              queue;
+    ngx_uint_t               valid;
+} ngx_http_referer_cache_node_t;
+
 
 typedef struct {
     ngx_hash_combined_t      hash;
@@ -21,6 +40,14 @@ typedef struct {
     ngx_array_t             *server_name_regex;
 #endif
 
+#if (NGX_RE2)
+    ngx_regex_set_t         *set;
+    ngx_flag_t               regex_set;
+#endif
+
+    ngx_http_referer_cache_t  *cache;
+    ngx_uint_t                 cache_size;
+
     ngx_flag_t               no_referer;
     ngx_flag_t               blocked_referer;
     ngx_flag_t               server_names;
@@ -32,10 +59,28 @@ typedef struct {
 } ngx_http_referer_conf_t;
 
 
+static ngx_int_t ngx_http_referer_match(ngx_http_request_t *r,
+    ngx_http_referer_conf_t *rlcf, ngx_str_t *value);
+#if (NGX_RE2)
+static ngx_int_t ngx_http_referer_regex_set_exec(ngx_http_request_t *r,
+    ngx_http_referer_conf_t *rlcf, ngx_str_t *referer);
+static ngx_int_t ngx_http_referer_regex_set(ngx_conf_t *cf,
+    ngx_http_referer_conf_t *conf);
+#endif
+static ngx_uint_t ngx_http_referer_cache_lookup(ngx_http_referer_cache_t *cache,
+    ngx_str_t *value);
+static void ngx_http_referer_cache_insert(ngx_http_referer_cache_t *cache,
+    ngx_str_t *value, ngx_uint_t valid);
+static ngx_int_t ngx_http_referer_cache_init(ngx_conf_t *cf,
+    ngx_http_referer_conf_t *conf);
+static void ngx_http_referer_cache_cleanup(void *data);
 static ngx_int_t ngx_http_referer_add_variables(ngx_conf_t *cf);
 static void * ngx_http_referer_create_conf(ngx_conf_t *cf);
 static char * ngx_http_referer_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
+static ngx_int_t ngx_http_referer_merge_lookup(ngx_conf_t *cf,
+    ngx_http_referer_conf_t *prev, ngx_http_referer_conf_t *conf,
+    ngx_uint_t inherited);
 static char *ngx_http_valid_referers(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_add_referer(ngx_conf_t *cf,
@@ -73,6 +118,24 @@ static ngx_command_t  ngx_http_referer_commands[] = {
       offsetof(ngx_http_referer_conf_t, referer_hash_bucket_size),
       NULL },
 
+#if (NGX_RE2)
+
+    { ngx_string("referer_regex_set"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_referer_conf_t, regex_set),
+      NULL },
+
+#endif
+
+    { ngx_string("referer_cache"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_referer_conf_t, cache_size),
+      NULL },
+
       ngx_null_command
 };
 
@@ -115,16 +178,10 @@ static ngx_int_t
 ngx_http_referer_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     uintptr_t data)
 {
-    u_char                    *p, *ref, *last;
-    size_t                     len;
-    ngx_str_t                 *uri;
-    ngx_uint_t                 i, key;
-    ngx_http_referer_conf_t   *rlcf;
-    u_char                     buf[256];
-#if (NGX_PCRE)
-    ngx_int_t                  rc;
-    ngx_str_t                  referer;
-#endif
+    ngx_int_t                 rc;
+    ngx_uint_t                valid;
+    ngx_str_t                *value;
+    ngx_http_referer_conf_t  *rlcf;
 
     rlcf = ngx_http_get_module_loc_conf(r, ngx_http_referer_module);
 
@@ -148,8 +205,67 @@ ngx_http_referer_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         goto invalid;
     }
 
-    len = r->headers_in.referer->value.len;
-    ref = r->headers_in.referer->value.data;
+    value = &r->headers_in.referer->value;
+
+    if (rlcf->cache) {
+        valid = ngx_http_referer_cache_lookup(rlcf->cache, value);
+
+        if (valid != NGX_HTTP_REFERER_CACHE_MISS) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http referer cached: %ui", valid);
+
+            if (valid) {
+                goto valid;
+            }
+
+            goto invalid;
+        }
+    }
+
+    rc = ngx_http_referer_match(r, rlcf, value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rlcf->cache) {
+        ngx_http_referer_cache_insert(rlcf->cache, value, rc == NGX_OK);
+    }
+
+    if (rc == NGX_OK) {
+        goto valid;
+    }
+
+invalid:
+
+    *v = ngx_http_variable_true_value;
+
+    return NGX_OK;
+
+valid:
+
+    *v = ngx_http_variable_null_value;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_referer_match(ngx_http_request_t *r, ngx_http_referer_conf_t *rlcf,
+    ngx_str_t *value)
+{
+    u_char      *p, *ref, *last;
+    size_t       len;
+    ngx_str_t   *uri;
+    ngx_uint_t   i, key;
+    u_char       buf[256];
+#if (NGX_PCRE)
+    ngx_int_t    rc;
+    ngx_str_t    referer;
+#endif
+
+    len = value->len;
+    ref = value->data;
 
     if (len >= sizeof("http://i.ru") - 1) {
         last = ref + len;
@@ -167,10 +283,10 @@ ngx_http_referer_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     }
 
     if (rlcf->blocked_referer) {
-        goto valid;
+        return NGX_OK;
     }
 
-    goto invalid;
+    return NGX_DECLINED;
 
 valid_scheme:
 
@@ -183,7 +299,7 @@ valid_scheme:
         }
 
         if (i == 256) {
-            goto invalid;
+            return NGX_DECLINED;
         }
 
         buf[i] = ngx_tolower(*p);
@@ -205,41 +321,28 @@ valid_scheme:
         rc = ngx_regex_exec_array(rlcf->server_name_regex, &referer,
                                   r->connection->log);
 
-        if (rc == NGX_OK) {
-            goto valid;
-        }
-
-        if (rc == NGX_ERROR) {
+        if (rc != NGX_DECLINED) {
             return rc;
         }
-
-        /* NGX_DECLINED */
     }
 
     if (rlcf->regex) {
         referer.len = len;
         referer.data = ref;
 
-        rc = ngx_regex_exec_array(rlcf->regex, &referer, r->connection->log);
-
-        if (rc == NGX_OK) {
-            goto valid;
-        }
-
-        if (rc == NGX_ERROR) {
-            return rc;
+#if (NGX_RE2)
+        if (rlcf->set) {
+            return ngx_http_referer_regex_set_exec(r, rlcf, &referer);
         }
+#endif
 
-        /* NGX_DECLINED */
+        return ngx_regex_exec_array(rlcf->regex, &referer,
+                                    r->connection->log);
     }
 
 #endif
 
-invalid:
-
-    *v = ngx_http_variable_true_value;
-
-    return NGX_OK;
+    return NGX_DECLINED;
 
 uri:
 
@@ -252,26 +355,187 @@ uri:
     len = last - p;
 
     if (uri == NGX_HTTP_REFERER_NO_URI_PART) {
-        goto valid;
+        return NGX_OK;
     }
 
     if (len < uri->len || ngx_strncmp(uri->data, p, uri->len) != 0) {
-        goto invalid;
+        return NGX_DECLINED;
     }
 
-valid:
+    return NGX_OK;
+}
+
+
+#if (NGX_RE2)
+
+static ngx_int_t
+ngx_http_referer_regex_set_exec(ngx_http_request_t *r,
+    ngx_http_referer_conf_t *rlcf, ngx_str_t *referer)
+{
+    u_char           *matched;
+    ngx_int_t         n;
+    ngx_uint_t        i;
+    ngx_regex_elt_t  *re;
+
+    matched = ngx_regex_set_match(rlcf->set, referer, r->pool);
+    if (matched == NULL) {
+        return NGX_ERROR;
+    }
+
+    re = rlcf->regex->elts;
+
+    for (i = 0; i < rlcf->regex->nelts; i++) {
+
+        if (!matched[i]) {
+            continue;
+        }
+
+        n = ngx_regex_exec(re[i].regex, referer, NULL, 0);
+
+        if (n == NGX_REGEX_NO_MATCHED) {
+            continue;
+        }
+
+        if (n < 0) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          ngx_regex_exec_n " failed: %i on \"%V\" using \"%s\"",
+                          n, referer, re[i].name);
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
+
+#endif
 
-    *v = ngx_http_variable_null_value;
+
+static ngx_uint_t
+ngx_http_referer_cache_lookup(ngx_http_referer_cache_t *cache,
+    ngx_str_t *value)
+{
+    uint32_t                        hash;
+    ngx_str_node_t                 *sn;
+    ngx_http_referer_cache_node_t  *cn;
+
+    hash = ngx_crc32_short(value->data, value->len);
+
+    sn = ngx_str_rbtree_lookup(&cache->rbtree, value, hash);
+
+    if (sn == NULL) {
+        return NGX_HTTP_REFERER_CACHE_MISS;
+    }
+
+    cn = (ngx_http_referer_cache_node_t *) sn;
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+    return cn->valid;
+}
+
+
+static void
+ngx_http_referer_cache_insert(ngx_http_referer_cache_t *cache,
+    ngx_str_t *value, ngx_uint_t valid)
+{
+    ngx_queue_t                    *q;
+    ngx_http_referer_cache_node_t  *cn;
+
+    if (value->len > NGX_HTTP_REFERER_CACHE_MAX_LEN) {
+        return;
+    }
+
+    if (cache->n == cache->size) {
+        q = ngx_queue_last(&cache->queue);
+        cn = ngx_queue_data(q, ngx_http_referer_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->rbtree, &cn->sn.node);
+        ngx_free(cn);
+
+        cache->n--;
+    }
+
+    cn = ngx_alloc(sizeof(ngx_http_referer_cache_node_t) + value->len,
+                   ngx_cycle->log);
+    if (cn == NULL) {
+        return;
+    }
+
+    cn->sn.node.key = ngx_crc32_short(value->data, value->len);
+    cn->sn.str.len = value->len;
+    cn->sn.str.data = (u_char *) cn + sizeof(ngx_http_referer_cache_node_t);
+    ngx_memcpy(cn->sn.str.data, value->data, value->len);
+
+    cn->valid = valid;
+
+    ngx_rbtree_insert(&cache->rbtree, &cn->sn.node);
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+    cache->n++;
+}
+
+
+static ngx_int_t
+ngx_http_referer_cache_init(ngx_conf_t *cf, ngx_http_referer_conf_t *conf)
+{
+    ngx_pool_cleanup_t        *cln;
+    ngx_http_referer_cache_t  *cache;
+
+    cache = ngx_palloc(cf->pool, sizeof(ngx_http_referer_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_str_rbtree_insert_value);
+    ngx_queue_init(&cache->queue);
+
+    cache->size = conf->cache_size;
+    cache->n = 0;
+
+    cln->handler = ngx_http_referer_cache_cleanup;
+    cln->data = cache;
+
+    conf->cache = cache;
 
     return NGX_OK;
 }
 
 
+static void
+ngx_http_referer_cache_cleanup(void *data)
+{
+    ngx_http_referer_cache_t  *cache = data;
+
+    ngx_queue_t                    *q;
+    ngx_http_referer_cache_node_t  *cn;
+
+    while (!ngx_queue_empty(&cache->queue)) {
+        q = ngx_queue_head(&cache->queue);
+        cn = ngx_queue_data(q, ngx_http_referer_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_free(cn);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_referer_add_variables(ngx_conf_t *cf)
 {
     ngx_http_variable_t  *var;
 
+    ngx_http_share_loc_conf(cf, &ngx_http_referer_module);
+
     var = ngx_http_add_variable(cf, &ngx_http_invalid_referer_name,
                                 NGX_HTTP_VAR_CHANGEABLE);
     if (var == NULL) {
@@ -300,6 +564,8 @@ ngx_http_referer_create_conf(ngx_conf_t *cf)
      *     conf->hash = { NULL };
      *     conf->server_names = 0;
      *     conf->keys = NULL;
+     *     conf->set = NULL;
+     *     conf->cache = NULL;
      */
 
 #if (NGX_PCRE)
@@ -307,6 +573,11 @@ ngx_http_referer_create_conf(ngx_conf_t *cf)
     conf->server_name_regex = NGX_CONF_UNSET_PTR;
 #endif
 
+#if (NGX_RE2)
+    conf->regex_set = NGX_CONF_UNSET;
+#endif
+
+    conf->cache_size = NGX_CONF_UNSET_UINT;
     conf->no_referer = NGX_CONF_UNSET;
     conf->blocked_referer = NGX_CONF_UNSET;
     conf->referer_hash_max_size = NGX_CONF_UNSET_UINT;
@@ -342,6 +613,10 @@ ngx_http_referer_merge_conf(ngx_conf_t *cf, void *parent, void *child)
         ngx_conf_merge_uint_value(conf->referer_hash_bucket_size,
                                   prev->referer_hash_bucket_size, 64);
 
+        if (ngx_http_referer_merge_lookup(cf, prev, conf, 1) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
         return NGX_CONF_OK;
     }
 
@@ -462,12 +737,117 @@ ngx_http_referer_merge_conf(ngx_conf_t *cf, void *parent, void *child)
         conf->blocked_referer = 0;
     }
 
+    if (ngx_http_referer_merge_lookup(cf, prev, conf, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
     conf->keys = NULL;
 
     return NGX_CONF_OK;
 }
 
 
+/*
+ * the regex set and the cache are shared with the enclosing level
+ * if the referers are inherited from it with the same settings
+ */
+
+static ngx_int_t
+ngx_http_referer_merge_lookup(ngx_conf_t *cf, ngx_http_referer_conf_t *prev,
+    ngx_http_referer_conf_t *conf, ngx_uint_t inherited)
+{
+#if (NGX_RE2)
+
+    ngx_conf_merge_value(conf->regex_set, prev->regex_set, 0);
+
+    if (inherited && conf->regex_set == prev->regex_set) {
+        conf->set = prev->set;
+
+    } else if (conf->regex_set && conf->regex) {
+        if (ngx_http_referer_regex_set(cf, conf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    ngx_conf_merge_uint_value(conf->cache_size, prev->cache_size, 0);
+
+    if (inherited && conf->cache_size == prev->cache_size) {
+        conf->cache = prev->cache;
+        return NGX_OK;
+    }
+
+    if (conf->cache_size) {
+        return ngx_http_referer_cache_init(cf, conf);
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_RE2)
+
+static ngx_int_t
+ngx_http_referer_regex_set(ngx_conf_t *cf, ngx_http_referer_conf_t *conf)
+{
+    u_char            errstr[NGX_MAX_CONF_ERRSTR];
+    ngx_int_t         rc;
+    ngx_str_t         err, pattern;
+    ngx_uint_t        i;
+    ngx_regex_elt_t  *re;
+    ngx_regex_set_t  *set;
+
+    set = ngx_regex_set_create(cf->pool, conf->regex->nelts);
+    if (set == NULL) {
+        return NGX_ERROR;
+    }
+
+    re = conf->regex->elts;
+
+    for (i = 0; i < conf->regex->nelts; i++) {
+
+        pattern.len = ngx_strlen(re[i].name);
+        pattern.data = re[i].name;
+
+        err.len = NGX_MAX_CONF_ERRSTR;
+        err.data = errstr;
+
+        rc = ngx_regex_set_add(set, &pattern, NGX_REGEX_CASELESS, &err);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                               "referer regex \"%V\" is not supported by RE2 "
+                               "and is always tested: %V", &pattern, &err);
+        }
+    }
+
+    rc = ngx_regex_set_compile(set);
+
+    if (rc == NGX_DECLINED) {
+        return NGX_OK;
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "failed to compile RE2 set of %ui referer regexes, "
+                           "the regexes are tested one by one",
+                           conf->regex->nelts);
+        return NGX_OK;
+    }
+
+    conf->set = set;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static char *
 ngx_http_valid_referers(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
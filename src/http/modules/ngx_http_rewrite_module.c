@@ -10,6 +10,65 @@
 #include <ngx_http.h>
 
 
+typedef struct ngx_http_rewrite_node_s  ngx_http_rewrite_node_t;
+
+/*
+ * a trie of the literal prefixes of the rewrite regexes in a run,
+ * a node lists the rules whose prefix ends in it
+ */
+
+struct ngx_http_rewrite_node_s {
+    ngx_http_rewrite_node_t     *child;
+    ngx_http_rewrite_node_t     *next;
+    ngx_array_t                 *rules;         /* ngx_uint_t */
+    u_char                       ch;
+};
+
+
+typedef struct {
+    uintptr_t                    offset;        /* from the index code */
+    ngx_str_t                    prefix;
+} ngx_http_rewrite_rule_t;
+
+
+typedef struct {
+    ngx_rbtree_t                 rbtree;
+    ngx_rbtree_node_t            sentinel;
+    ngx_queue_t                  queue;
+    ngx_uint_t                   size;
+    ngx_uint_t                   n;
+} ngx_http_rewrite_cache_t;
+
+
+typedef struct {
+    ngx_str_node_t               sn;
+    ngx_queue_t                  queue;
+    ngx_uint_t                   rule;
+} ngx_http_rewrite_cache_node_t;
+
+
+/* a run of consecutive "rewrite" directives */
+
+typedef struct {
+    ngx_array_t                  rules;         /* ngx_http_rewrite_rule_t */
+    ngx_uint_t                   start;         /* offset in the codes */
+    ngx_http_rewrite_node_t     *tree;
+    ngx_http_rewrite_cache_t    *cache;
+} ngx_http_rewrite_index_t;
+
+
+typedef struct {
+    ngx_http_script_code_pt      code;
+    ngx_http_rewrite_index_t    *index;
+} ngx_http_rewrite_index_code_t;
+
+
+typedef struct {
+    ngx_uint_t                   cache;
+    ngx_array_t                  indexes;       /* ngx_http_rewrite_index_t * */
+} ngx_http_rewrite_main_conf_t;
+
+
 typedef struct {
     ngx_array_t  *codes;        /* uintptr_t */
 
@@ -17,14 +76,34 @@ typedef struct {
 
     ngx_flag_t    log;
     ngx_flag_t    uninitialized_variable_warn;
+
+    ngx_http_rewrite_index_t  *index;
+    ngx_uint_t                 index_end;
 } ngx_http_rewrite_loc_conf_t;
 
 
+#define NGX_HTTP_REWRITE_CACHE_MISS     (ngx_uint_t) -1
+#define NGX_HTTP_REWRITE_CACHE_MAX_LEN  1024
+
+
+static void ngx_http_rewrite_index_code(ngx_http_script_engine_t *e);
+static ngx_uint_t ngx_http_rewrite_cache_lookup(ngx_http_rewrite_cache_t *cache,
+    ngx_str_t *uri);
+static void ngx_http_rewrite_cache_insert(ngx_http_rewrite_cache_t *cache,
+    ngx_str_t *uri, ngx_uint_t rule);
+static void ngx_http_rewrite_cache_cleanup(void *data);
+static void *ngx_http_rewrite_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_rewrite_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_rewrite_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static ngx_int_t ngx_http_rewrite_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_rewrite_init_index(ngx_conf_t *cf,
+    ngx_http_rewrite_index_t *index, ngx_uint_t cache);
 static char *ngx_http_rewrite(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_rewrite_add_rule(ngx_conf_t *cf,
+    ngx_http_rewrite_loc_conf_t *lcf, ngx_str_t *pattern, uintptr_t offset);
+static void ngx_http_rewrite_regex_prefix(ngx_str_t *pattern,
+    ngx_str_t *prefix, ngx_pool_t *pool);
 static char *ngx_http_rewrite_return(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_rewrite_break(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -98,6 +177,13 @@ static ngx_command_t  ngx_http_rewrite_commands[] = {
       offsetof(ngx_http_rewrite_loc_conf_t, uninitialized_variable_warn),
       NULL },
 
+    { ngx_string("rewrite_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_rewrite_main_conf_t, cache),
+      NULL },
+
       ngx_null_command
 };
 
@@ -106,7 +192,7 @@ static ngx_http_module_t  ngx_http_rewrite_module_ctx = {
     NULL,                                  /* preconfiguration */
     ngx_http_rewrite_init,                 /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_rewrite_create_main_conf,     /* create main configuration */
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
@@ -185,6 +271,220 @@ ngx_http_rewrite_handler(ngx_http_request_t *r)
 }
 
 
+/*
+ * the code precedes a run of "rewrite" directives: only the rules whose
+ * literal prefix matches the URI are tried, and the rule matched is cached;
+ * the rules after a matched one are run in order as usual
+ */
+
+static void
+ngx_http_rewrite_index_code(ngx_http_script_engine_t *e)
+{
+    u_char                         *start;
+    ngx_uint_t                      i, n, w, bits, *rule;
+    uintptr_t                      *set, word;
+    ngx_str_t                      *uri;
+    ngx_http_request_t             *r;
+    ngx_http_rewrite_rule_t        *rules;
+    ngx_http_rewrite_node_t        *node;
+    ngx_http_rewrite_index_t       *index;
+    ngx_http_script_regex_code_t   *regex;
+    ngx_http_rewrite_index_code_t  *code;
+
+    code = (ngx_http_rewrite_index_code_t *) e->ip;
+    index = code->index;
+
+    /* the rewrite_log reports each of the rules */
+
+    if (index->tree == NULL || e->log) {
+        e->ip += sizeof(ngx_http_rewrite_index_code_t);
+        return;
+    }
+
+    r = e->request;
+    uri = &r->uri;
+
+    start = e->ip;
+    rules = index->rules.elts;
+    n = index->rules.nelts;
+
+    if (index->cache) {
+        i = ngx_http_rewrite_cache_lookup(index->cache, uri);
+
+        if (i != NGX_HTTP_REWRITE_CACHE_MISS) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http rewrite cached rule: %ui", i);
+
+            if (i < n) {
+                /* the regex is executed again to set the captures */
+                e->ip = start + rules[i].offset;
+                return;
+            }
+
+            goto done;
+        }
+    }
+
+    bits = 8 * sizeof(uintptr_t);
+
+    set = ngx_pcalloc(r->pool, (n + bits - 1) / bits * sizeof(uintptr_t));
+    if (set == NULL) {
+        e->ip += sizeof(ngx_http_rewrite_index_code_t);
+        return;
+    }
+
+    node = index->tree;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (node->rules) {
+            rule = node->rules->elts;
+
+            for (w = 0; w < node->rules->nelts; w++) {
+                set[rule[w] / bits] |= (uintptr_t) 1 << (rule[w] % bits);
+            }
+        }
+
+        if (i == uri->len) {
+            break;
+        }
+
+        for (node = node->child; node; node = node->next) {
+            if (node->ch == uri->data[i]) {
+                break;
+            }
+        }
+
+        if (node == NULL) {
+            break;
+        }
+    }
+
+    for (w = 0; w < (n + bits - 1) / bits; w++) {
+
+        for (word = set[w], i = w * bits; word; word >>= 1, i++) {
+
+            if ((word & 1) == 0) {
+                continue;
+            }
+
+            e->ip = start + rules[i].offset;
+            regex = (ngx_http_script_regex_code_t *) e->ip;
+
+            ngx_http_script_regex_start_code(e);
+
+            if (e->ip == (u_char *) regex + regex->next) {
+                continue;
+            }
+
+            if (index->cache
+                && e->ip == (u_char *) regex
+                            + sizeof(ngx_http_script_regex_code_t))
+            {
+                ngx_http_rewrite_cache_insert(index->cache, uri, i);
+            }
+
+            return;
+        }
+    }
+
+    if (index->cache) {
+        ngx_http_rewrite_cache_insert(index->cache, uri, n);
+    }
+
+done:
+
+    r->ncaptures = 0;
+
+    regex = (ngx_http_script_regex_code_t *) (start + rules[n - 1].offset);
+    e->ip = (u_char *) regex + regex->next;
+}
+
+
+static ngx_uint_t
+ngx_http_rewrite_cache_lookup(ngx_http_rewrite_cache_t *cache, ngx_str_t *uri)
+{
+    uint32_t                        hash;
+    ngx_str_node_t                 *sn;
+    ngx_http_rewrite_cache_node_t  *cn;
+
+    hash = ngx_crc32_short(uri->data, uri->len);
+
+    sn = ngx_str_rbtree_lookup(&cache->rbtree, uri, hash);
+
+    if (sn == NULL) {
+        return NGX_HTTP_REWRITE_CACHE_MISS;
+    }
+
+    cn = (ngx_http_rewrite_cache_node_t *) sn;
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+    return cn->rule;
+}
+
+
+static void
+ngx_http_rewrite_cache_insert(ngx_http_rewrite_cache_t *cache, ngx_str_t *uri,
+    ngx_uint_t rule)
+{
+    ngx_queue_t                    *q;
+    ngx_http_rewrite_cache_node_t  *cn;
+
+    if (uri->len > NGX_HTTP_REWRITE_CACHE_MAX_LEN) {
+        return;
+    }
+
+    if (cache->n == cache->size) {
+        q = ngx_queue_last(&cache->queue);
+        cn = ngx_queue_data(q, ngx_http_rewrite_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->rbtree, &cn->sn.node);
+        ngx_free(cn);
+
+        cache->n--;
+    }
+
+    cn = ngx_alloc(sizeof(ngx_http_rewrite_cache_node_t) + uri->len,
+                   ngx_cycle->log);
+    if (cn == NULL) {
+        return;
+    }
+
+    cn->sn.node.key = ngx_crc32_short(uri->data, uri->len);
+    cn->sn.str.len = uri->len;
+    cn->sn.str.data = (u_char *) cn + sizeof(ngx_http_rewrite_cache_node_t);
+    ngx_memcpy(cn->sn.str.data, uri->data, uri->len);
+
+    cn->rule = rule;
+
+    ngx_rbtree_insert(&cache->rbtree, &cn->sn.node);
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+    cache->n++;
+}
+
+
+static void
+ngx_http_rewrite_cache_cleanup(void *data)
+{
+    ngx_http_rewrite_cache_t  *cache = data;
+
+    ngx_queue_t                    *q;
+    ngx_http_rewrite_cache_node_t  *cn;
+
+    while (!ngx_queue_empty(&cache->queue)) {
+        q = ngx_queue_head(&cache->queue);
+        cn = ngx_queue_data(q, ngx_http_rewrite_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_free(cn);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_rewrite_var(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     uintptr_t data)
@@ -220,6 +520,29 @@ ngx_http_rewrite_var(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 }
 
 
+static void *
+ngx_http_rewrite_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_rewrite_main_conf_t  *rmcf;
+
+    rmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_rewrite_main_conf_t));
+    if (rmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&rmcf->indexes, cf->pool, 4,
+                       sizeof(ngx_http_rewrite_index_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    rmcf->cache = NGX_CONF_UNSET_UINT;
+
+    return rmcf;
+}
+
+
 static void *
 ngx_http_rewrite_create_loc_conf(ngx_conf_t *cf)
 {
@@ -274,8 +597,11 @@ ngx_http_rewrite_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 static ngx_int_t
 ngx_http_rewrite_init(ngx_conf_t *cf)
 {
-    ngx_http_handler_pt        *h;
-    ngx_http_core_main_conf_t  *cmcf;
+    ngx_uint_t                      i;
+    ngx_http_handler_pt            *h;
+    ngx_http_rewrite_index_t      **index;
+    ngx_http_core_main_conf_t      *cmcf;
+    ngx_http_rewrite_main_conf_t   *rmcf;
 
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
 
@@ -293,6 +619,114 @@ ngx_http_rewrite_init(ngx_conf_t *cf)
 
     *h = ngx_http_rewrite_handler;
 
+    rmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_rewrite_module);
+
+    if (rmcf->cache == NGX_CONF_UNSET_UINT) {
+        rmcf->cache = 0;
+    }
+
+    index = rmcf->indexes.elts;
+
+    for (i = 0; i < rmcf->indexes.nelts; i++) {
+        if (ngx_http_rewrite_init_index(cf, index[i], rmcf->cache) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_rewrite_init_index(ngx_conf_t *cf, ngx_http_rewrite_index_t *index,
+    ngx_uint_t cache)
+{
+    size_t                     j;
+    ngx_uint_t                 i, *rule;
+    ngx_pool_cleanup_t        *cln;
+    ngx_http_rewrite_node_t   *node, *child;
+    ngx_http_rewrite_rule_t   *rules;
+    ngx_http_rewrite_cache_t  *c;
+
+    /* a single rule is tried as is */
+
+    if (index->rules.nelts < 2) {
+        return NGX_OK;
+    }
+
+    index->tree = ngx_pcalloc(cf->pool, sizeof(ngx_http_rewrite_node_t));
+    if (index->tree == NULL) {
+        return NGX_ERROR;
+    }
+
+    rules = index->rules.elts;
+
+    for (i = 0; i < index->rules.nelts; i++) {
+
+        node = index->tree;
+
+        for (j = 0; j < rules[i].prefix.len; j++) {
+
+            for (child = node->child; child; child = child->next) {
+                if (child->ch == rules[i].prefix.data[j]) {
+                    break;
+                }
+            }
+
+            if (child == NULL) {
+                child = ngx_pcalloc(cf->pool, sizeof(ngx_http_rewrite_node_t));
+                if (child == NULL) {
+                    return NGX_ERROR;
+                }
+
+                child->ch = rules[i].prefix.data[j];
+                child->next = node->child;
+                node->child = child;
+            }
+
+            node = child;
+        }
+
+        if (node->rules == NULL) {
+            node->rules = ngx_array_create(cf->pool, 2, sizeof(ngx_uint_t));
+            if (node->rules == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        rule = ngx_array_push(node->rules);
+        if (rule == NULL) {
+            return NGX_ERROR;
+        }
+
+        *rule = i;
+    }
+
+    if (cache == 0) {
+        return NGX_OK;
+    }
+
+    c = ngx_palloc(cf->pool, sizeof(ngx_http_rewrite_cache_t));
+    if (c == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&c->rbtree, &c->sentinel, ngx_str_rbtree_insert_value);
+    ngx_queue_init(&c->queue);
+
+    c->size = cache;
+    c->n = 0;
+
+    cln->handler = ngx_http_rewrite_cache_cleanup;
+    cln->data = c;
+
+    index->cache = c;
+
     return NGX_OK;
 }
 
@@ -307,10 +741,52 @@ ngx_http_rewrite(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_regex_compile_t                rc;
     ngx_http_script_code_pt           *code;
     ngx_http_script_compile_t          sc;
+    ngx_http_rewrite_index_t          *index, **indexp;
     ngx_http_script_regex_code_t      *regex;
+    ngx_http_rewrite_index_code_t     *index_code;
+    ngx_http_rewrite_main_conf_t      *rmcf;
     ngx_http_script_regex_end_code_t  *regex_end;
     u_char                             errstr[NGX_MAX_CONF_ERRSTR];
 
+    /* consecutive rewrites are preceded by an index of their prefixes */
+
+    if (lcf->index == NULL || lcf->index_end != lcf->codes->nelts) {
+
+        index = ngx_pcalloc(cf->pool, sizeof(ngx_http_rewrite_index_t));
+        if (index == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_array_init(&index->rules, cf->pool, 4,
+                           sizeof(ngx_http_rewrite_rule_t))
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        index_code = ngx_http_script_start_code(cf->pool, &lcf->codes,
+                                        sizeof(ngx_http_rewrite_index_code_t));
+        if (index_code == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        index_code->code = ngx_http_rewrite_index_code;
+        index_code->index = index;
+
+        index->start = (u_char *) index_code - (u_char *) lcf->codes->elts;
+
+        rmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_rewrite_module);
+
+        indexp = ngx_array_push(&rmcf->indexes);
+        if (indexp == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *indexp = index;
+
+        lcf->index = index;
+    }
+
     regex = ngx_http_script_start_code(cf->pool, &lcf->codes,
                                        sizeof(ngx_http_script_regex_code_t));
     if (regex == NULL) {
@@ -432,10 +908,164 @@ ngx_http_rewrite(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     regex->next = (u_char *) lcf->codes->elts + lcf->codes->nelts
                                               - (u_char *) regex;
 
+    if (ngx_http_rewrite_add_rule(cf, lcf, &value[1],
+                                  (u_char *) regex
+                                  - (u_char *) lcf->codes->elts)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    lcf->index_end = lcf->codes->nelts;
+
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_http_rewrite_add_rule(ngx_conf_t *cf, ngx_http_rewrite_loc_conf_t *lcf,
+    ngx_str_t *pattern, uintptr_t offset)
+{
+    ngx_http_rewrite_rule_t  *rule;
+
+    rule = ngx_array_push(&lcf->index->rules);
+    if (rule == NULL) {
+        return NGX_ERROR;
+    }
+
+    rule->offset = offset - lcf->index->start;
+
+    ngx_http_rewrite_regex_prefix(pattern, &rule->prefix, cf->pool);
+
+    return NGX_OK;
+}
+
+
+/*
+ * the literal prefix of an anchored regex, any URI matched by the regex
+ * starts with it; an empty prefix is returned if the regex is not anchored
+ * or has alternatives at the top level
+ */
+
+static void
+ngx_http_rewrite_regex_prefix(ngx_str_t *pattern, ngx_str_t *prefix,
+    ngx_pool_t *pool)
+{
+    u_char      *p, ch, next;
+    size_t       i, len, width;
+    ngx_int_t    depth;
+    ngx_uint_t   class;
+
+    prefix->len = 0;
+    prefix->data = NULL;
+
+    p = pattern->data;
+    len = pattern->len;
+
+    if (len < 2 || p[0] != '^') {
+        return;
+    }
+
+    depth = 0;
+    class = 0;
+
+    for (i = 1; i < len; i++) {
+        ch = p[i];
+
+        if (ch == '\\') {
+            i++;
+            continue;
+        }
+
+        if (class) {
+            if (ch == ']') {
+                class = 0;
+            }
+
+            continue;
+        }
+
+        switch (ch) {
+
+        case '[':
+            class = 1;
+
+            /* "]" is literal as the first character of a class */
+
+            if (i + 1 < len && p[i + 1] == '^') {
+                i++;
+            }
+
+            if (i + 1 < len && p[i + 1] == ']') {
+                i++;
+            }
+
+            break;
+
+        case '(':
+            depth++;
+            break;
+
+        case ')':
+            depth--;
+            break;
+
+        case '|':
+            if (depth == 0) {
+                return;
+            }
+
+            break;
+        }
+    }
+
+    prefix->data = ngx_pnalloc(pool, len);
+    if (prefix->data == NULL) {
+        return;
+    }
+
+    for (i = 1; i < len; i += width) {
+        ch = p[i];
+        width = 1;
+
+        if (ch == '\\') {
+            if (i + 1 == len) {
+                break;
+            }
+
+            ch = p[i + 1];
+
+            /* "\d", "\w", "\x", "\Q" and so on are not literals */
+
+            if ((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z')
+                || (ch >= 'A' && ch <= 'Z') || ch >= 0x80)
+            {
+                break;
+            }
+
+            width = 2;
+
+        } else if (ngx_strchr("^$.|?*+()[]{}", ch) != NULL) {
+            break;
+        }
+
+        /* a quantifier may make the character optional */
+
+        next = (i + width < len) ? p[i + width] : '\0';
+
+        if (next == '?' || next == '*' || next == '{') {
+            break;
+        }
+
+        prefix->data[prefix->len++] = ch;
+
+        if (next == '+') {
+            break;
+        }
+    }
+}
+
+
 static char *
 ngx_http_rewrite_return(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
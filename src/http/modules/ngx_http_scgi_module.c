@@ -627,21 +627,25 @@ ngx_http_scgi_create_key(ngx_http_request_t *r)
 static ngx_int_t
 ngx_http_scgi_create_request(ngx_http_request_t *r)
 {
-    off_t                         content_length_n;
-    u_char                        ch, *key, *val, *lowcase_key;
-    size_t                        len, key_len, val_len, allocated;
-    ngx_buf_t                    *b;
-    ngx_str_t                     content_length;
-    ngx_uint_t                    i, n, hash, skip_empty, header_params;
-    ngx_chain_t                  *cl, *body;
-    ngx_list_part_t              *part;
-    ngx_table_elt_t              *header, **ignored;
-    ngx_http_scgi_params_t       *params;
-    ngx_http_script_code_pt       code;
-    ngx_http_script_engine_t      e, le;
-    ngx_http_scgi_loc_conf_t     *scf;
-    ngx_http_script_len_code_pt   lcode;
-    u_char                        buffer[NGX_OFF_T_LEN];
+    off_t                           content_length_n;
+    u_char                          ch, *key, *lowcase_key;
+#if (NGX_DEBUG)
+    u_char                         *val;
+#endif
+    size_t                          len, refs, key_len, val_len, allocated;
+    ngx_buf_t                      *b;
+    ngx_str_t                       content_length;
+    ngx_uint_t                      i, n, hash, skip_empty, header_params;
+    ngx_chain_t                    *cl, *body;
+    ngx_list_part_t                *part;
+    ngx_table_elt_t                *header, **ignored;
+    ngx_http_scgi_params_t         *params;
+    ngx_http_script_code_pt         code;
+    ngx_http_script_engine_t        e, le;
+    ngx_http_scgi_loc_conf_t       *scf;
+    ngx_http_script_len_code_pt     lcode;
+    ngx_http_upstream_serializer_t  s;
+    u_char                          buffer[NGX_OFF_T_LEN];
 
     content_length_n = 0;
     body = r->upstream->request_bufs;
@@ -655,6 +659,7 @@ ngx_http_scgi_create_request(ngx_http_request_t *r)
     content_length.len = ngx_sprintf(buffer, "%O", content_length_n) - buffer;
 
     len = sizeof("CONTENT_LENGTH") + content_length.len + 1;
+    refs = 0;
 
     header_params = 0;
     ignored = NULL;
@@ -765,22 +770,23 @@ ngx_http_scgi_create_request(ngx_http_request_t *r)
 
             len += sizeof("HTTP_") - 1 + header[i].key.len + 1
                 + header[i].value.len + 1;
+
+            if (header[i].value.len >= NGX_HTTP_UPSTREAM_REF_SIZE) {
+                refs += header[i].value.len;
+            }
         }
     }
 
     /* netstring: "length:" + packet + "," */
 
-    b = ngx_create_temp_buf(r->pool, NGX_SIZE_T_LEN + 1 + len + 1);
-    if (b == NULL) {
-        return NGX_ERROR;
-    }
-
-    cl = ngx_alloc_chain_link(r->pool);
-    if (cl == NULL) {
+    if (ngx_http_upstream_serializer_init(&s, r->pool,
+                                          NGX_SIZE_T_LEN + 1 + len + 1 - refs)
+        != NGX_OK)
+    {
         return NGX_ERROR;
     }
 
-    cl->buf = b;
+    b = s.buf;
 
     b->last = ngx_sprintf(b->last, "%ui:CONTENT_LENGTH%Z%V%Z",
                           len, &content_length);
@@ -886,12 +892,18 @@ ngx_http_scgi_create_request(ngx_http_request_t *r)
 
             *b->last++ = (u_char) 0;
 
-            val = b->last;
-            b->last = ngx_copy(val, header[i].value.data, header[i].value.len);
+            if (ngx_http_upstream_serializer_add(&s, header[i].value.data,
+                                                 header[i].value.len)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            b = s.buf;
             *b->last++ = (u_char) 0;
 
             ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "scgi param: \"%s: %s\"", key, val);
+                           "scgi param: \"%s: %V\"", key, &header[i].value);
 
         next:
 
@@ -901,12 +913,16 @@ ngx_http_scgi_create_request(ngx_http_request_t *r)
 
     *b->last++ = (u_char) ',';
 
+    ngx_http_upstream_serializer_finish(&s);
+
+    cl = s.last;
+
     if (r->request_body_no_buffering) {
-        r->upstream->request_bufs = cl;
+        r->upstream->request_bufs = s.out;
 
     } else if (scf->upstream.pass_request_body) {
         body = r->upstream->request_bufs;
-        r->upstream->request_bufs = cl;
+        r->upstream->request_bufs = s.out;
 
         while (body) {
             b = ngx_alloc_buf(r->pool);
@@ -928,7 +944,7 @@ ngx_http_scgi_create_request(ngx_http_request_t *r)
         }
 
     } else {
-        r->upstream->request_bufs = cl;
+        r->upstream->request_bufs = s.out;
     }
 
     cl->next = NULL;
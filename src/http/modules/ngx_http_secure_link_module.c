@@ -9,12 +9,35 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 #include <ngx_md5.h>
+#include <ngx_sha256.h>
+
+
+/* longer HMAC messages are not cached */
+#define NGX_HTTP_SECURE_LINK_CACHE_DATA  216
+
+
+typedef struct {
+    u_char                         mac[32];
+    ngx_uint_t                     valid;
+    size_t                         len;
+    u_char                         data[NGX_HTTP_SECURE_LINK_CACHE_DATA];
+} ngx_http_secure_link_cache_node_t;
+
+
+typedef struct {
+    ngx_http_secure_link_cache_node_t  *nodes;
+    ngx_uint_t                          mask;
+} ngx_http_secure_link_cache_t;
 
 
 typedef struct {
-    ngx_http_complex_value_t  *variable;
-    ngx_http_complex_value_t  *md5;
-    ngx_str_t                  secret;
+    ngx_http_complex_value_t      *variable;
+    ngx_http_complex_value_t      *md5;
+    ngx_http_complex_value_t      *hmac;
+    ngx_array_t                   *hmac_keys;  /* of ngx_hmac_sha256_t */
+    ngx_http_secure_link_cache_t  *cache;
+    ngx_uint_t                     cache_size;
+    ngx_str_t                      secret;
 } ngx_http_secure_link_conf_t;
 
 
@@ -26,12 +49,17 @@ typedef struct {
 static ngx_int_t ngx_http_secure_link_old_variable(ngx_http_request_t *r,
     ngx_http_secure_link_conf_t *conf, ngx_http_variable_value_t *v,
     uintptr_t data);
+static ngx_int_t ngx_http_secure_link_hmac(ngx_http_request_t *r,
+    ngx_http_secure_link_conf_t *conf, u_char *hash);
+static ngx_uint_t ngx_http_secure_link_equal(u_char *a, u_char *b, size_t n);
 static ngx_int_t ngx_http_secure_link_expires_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static void *ngx_http_secure_link_create_conf(ngx_conf_t *cf);
 static char *ngx_http_secure_link_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
 static ngx_int_t ngx_http_secure_link_add_variables(ngx_conf_t *cf);
+static char *ngx_http_secure_link_hmac_key(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_command_t  ngx_http_secure_link_commands[] = {
@@ -50,6 +78,27 @@ static ngx_command_t  ngx_http_secure_link_commands[] = {
       offsetof(ngx_http_secure_link_conf_t, md5),
       NULL },
 
+    { ngx_string("secure_link_hmac"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_set_complex_value_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_secure_link_conf_t, hmac),
+      NULL },
+
+    { ngx_string("secure_link_hmac_key"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_secure_link_hmac_key,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("secure_link_hmac_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_secure_link_conf_t, cache_size),
+      NULL },
+
     { ngx_string("secure_link_secret"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_slot,
@@ -102,12 +151,14 @@ ngx_http_secure_link_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
     u_char                       *p, *last;
+    size_t                        size;
+    ngx_int_t                     rc;
     ngx_str_t                     val, hash;
     time_t                        expires;
     ngx_md5_t                     md5;
     ngx_http_secure_link_ctx_t   *ctx;
     ngx_http_secure_link_conf_t  *conf;
-    u_char                        hash_buf[18], md5_buf[16];
+    u_char                        hash_buf[33], md5_buf[16];
 
     conf = ngx_http_get_module_loc_conf(r, ngx_http_secure_link_module);
 
@@ -115,7 +166,7 @@ ngx_http_secure_link_variable(ngx_http_request_t *r,
         return ngx_http_secure_link_old_variable(r, conf, v, data);
     }
 
-    if (conf->variable == NULL || conf->md5 == NULL) {
+    if (conf->variable == NULL || (conf->md5 == NULL && conf->hmac == NULL)) {
         goto not_found;
     }
 
@@ -150,7 +201,9 @@ ngx_http_secure_link_variable(ngx_http_request_t *r,
         ctx->expires.data = p;
     }
 
-    if (val.len > 24) {
+    size = conf->hmac ? 32 : 16;
+
+    if (val.len > ngx_base64_encoded_length(size)) {
         goto not_found;
     }
 
@@ -160,10 +213,24 @@ ngx_http_secure_link_variable(ngx_http_request_t *r,
         goto not_found;
     }
 
-    if (hash.len != 16) {
+    if (hash.len != size) {
         goto not_found;
     }
 
+    if (conf->hmac) {
+        rc = ngx_http_secure_link_hmac(r, conf, hash_buf);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            goto not_found;
+        }
+
+        goto found;
+    }
+
     if (ngx_http_complex_value(r, conf->md5, &val) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -179,6 +246,8 @@ ngx_http_secure_link_variable(ngx_http_request_t *r,
         goto not_found;
     }
 
+found:
+
     v->data = (u_char *) ((expires && expires < ngx_time()) ? "0" : "1");
     v->len = 1;
     v->valid = 1;
@@ -195,6 +264,91 @@ not_found:
 }
 
 
+static ngx_int_t
+ngx_http_secure_link_hmac(ngx_http_request_t *r,
+    ngx_http_secure_link_conf_t *conf, u_char *hash)
+{
+    ngx_str_t                           val;
+    ngx_uint_t                          i;
+    ngx_hmac_sha256_t                  *key;
+    ngx_http_secure_link_cache_node_t  *node;
+    u_char                              mac[32];
+
+    if (ngx_http_complex_value(r, conf->hmac, &val) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "secure link hmac: \"%V\"", &val);
+
+    /*
+     * a token checked recently for the same message is found in the cache,
+     * so requests for segments of one stream compute the HMAC once
+     */
+
+    node = NULL;
+
+    if (conf->cache && val.len <= NGX_HTTP_SECURE_LINK_CACHE_DATA) {
+        node = &conf->cache->nodes[ngx_murmur_hash2(val.data, val.len)
+                                   & conf->cache->mask];
+
+        if (node->valid
+            && node->len == val.len
+            && ngx_memcmp(node->data, val.data, val.len) == 0
+            && ngx_http_secure_link_equal(node->mac, hash, 32))
+        {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "secure link hmac cached");
+            return NGX_OK;
+        }
+    }
+
+    key = conf->hmac_keys->elts;
+
+    for (i = 0; i < conf->hmac_keys->nelts; i++) {
+
+        ngx_hmac_sha256(mac, &key[i], val.data, val.len);
+
+        if (ngx_http_secure_link_equal(mac, hash, 32)) {
+            goto found;
+        }
+    }
+
+    return NGX_DECLINED;
+
+found:
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "secure link hmac key: %ui", i);
+
+    if (node) {
+        ngx_memcpy(node->mac, mac, 32);
+        ngx_memcpy(node->data, val.data, val.len);
+        node->len = val.len;
+        node->valid = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_secure_link_equal(u_char *a, u_char *b, size_t n)
+{
+    u_char  diff;
+
+    /* constant time, so that the timing does not reveal a valid hash */
+
+    diff = 0;
+
+    while (n--) {
+        diff |= *a++ ^ *b++;
+    }
+
+    return diff == 0;
+}
+
+
 static ngx_int_t
 ngx_http_secure_link_old_variable(ngx_http_request_t *r,
     ngx_http_secure_link_conf_t *conf, ngx_http_variable_value_t *v,
@@ -304,9 +458,14 @@ ngx_http_secure_link_create_conf(ngx_conf_t *cf)
      *
      *     conf->variable = NULL;
      *     conf->md5 = NULL;
+     *     conf->hmac = NULL;
+     *     conf->hmac_keys = NULL;
+     *     conf->cache = NULL;
      *     conf->secret = { 0, NULL };
      */
 
+    conf->cache_size = NGX_CONF_UNSET_UINT;
+
     return conf;
 }
 
@@ -317,29 +476,119 @@ ngx_http_secure_link_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_secure_link_conf_t *prev = parent;
     ngx_http_secure_link_conf_t *conf = child;
 
+    ngx_uint_t                     n;
+    ngx_http_secure_link_cache_t  *cache;
+
     if (conf->secret.data) {
-        if (conf->variable || conf->md5) {
+        if (conf->variable || conf->md5 || conf->hmac) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                "\"secure_link_secret\" cannot be mixed with "
-                               "\"secure_link\" and \"secure_link_md5\"");
+                               "\"secure_link\", \"secure_link_md5\", and "
+                               "\"secure_link_hmac\"");
             return NGX_CONF_ERROR;
         }
 
         return NGX_CONF_OK;
     }
 
+    if (conf->md5 && conf->hmac) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"secure_link_md5\" cannot be mixed with "
+                           "\"secure_link_hmac\"");
+        return NGX_CONF_ERROR;
+    }
+
     if (conf->variable == NULL) {
         conf->variable = prev->variable;
     }
 
-    if (conf->md5 == NULL) {
+    if (conf->md5 == NULL && conf->hmac == NULL) {
         conf->md5 = prev->md5;
+        conf->hmac = prev->hmac;
     }
 
-    if (conf->variable == NULL && conf->md5 == NULL) {
+    if (conf->variable == NULL && conf->md5 == NULL && conf->hmac == NULL) {
         conf->secret = prev->secret;
     }
 
+    if (conf->hmac_keys == NULL) {
+        conf->hmac_keys = prev->hmac_keys;
+    }
+
+    if (conf->hmac && conf->hmac_keys == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no \"secure_link_hmac_key\" is defined");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->cache_size == NGX_CONF_UNSET_UINT) {
+        conf->cache_size = prev->cache_size;
+
+        if (conf->hmac_keys == prev->hmac_keys) {
+            conf->cache = prev->cache;
+        }
+    }
+
+    ngx_conf_init_uint_value(conf->cache_size, 0);
+
+    if (conf->hmac == NULL || conf->cache_size == 0 || conf->cache) {
+        return NGX_CONF_OK;
+    }
+
+    /* the cache is per worker process, its size is rounded to a power of 2 */
+
+    for (n = 1; n < conf->cache_size; n <<= 1) { /* void */ }
+
+    cache = ngx_palloc(cf->pool, sizeof(ngx_http_secure_link_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->nodes = ngx_pcalloc(cf->pool,
+                               n * sizeof(ngx_http_secure_link_cache_node_t));
+    if (cache->nodes == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->mask = n - 1;
+
+    conf->cache = cache;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_secure_link_hmac_key(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_secure_link_conf_t *slcf = conf;
+
+    ngx_str_t          *value;
+    ngx_hmac_sha256_t  *key;
+
+    value = cf->args->elts;
+
+    if (value[1].len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "empty secure link hmac key");
+        return NGX_CONF_ERROR;
+    }
+
+    if (slcf->hmac_keys == NULL) {
+        slcf->hmac_keys = ngx_array_create(cf->pool, 2,
+                                           sizeof(ngx_hmac_sha256_t));
+        if (slcf->hmac_keys == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    key = ngx_array_push(slcf->hmac_keys);
+    if (key == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_hmac_sha256_init(key, value[1].data, value[1].len);
+
     return NGX_CONF_OK;
 }
 
@@ -349,6 +598,8 @@ ngx_http_secure_link_add_variables(ngx_conf_t *cf)
 {
     ngx_http_variable_t  *var;
 
+    ngx_http_share_loc_conf(cf, &ngx_http_secure_link_module);
+
     var = ngx_http_add_variable(cf, &ngx_http_secure_link_name, 0);
     if (var == NULL) {
         return NGX_ERROR;
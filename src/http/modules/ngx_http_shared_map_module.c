@@ -0,0 +1,763 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * A shared map is an exact match table in a shared memory zone, loaded
+ * from a file with lines "key [value]", the value defaults to "1".
+ * Workers check the file periodically, the one which gets the zone
+ * mutex builds a new table and publishes it by a pointer swap, so
+ * lookups take no lock.  The previous table is freed only when the
+ * next one is published, and tables are not published more often than
+ * once a second, so a lookup started on an old table ends before it is
+ * freed.
+ */
+
+
+typedef struct {
+    uint32_t                        hash;
+    u_short                         key_len;
+    u_short                         value_len;
+    u_char                          data[1];
+} ngx_http_shared_map_entry_t;
+
+
+typedef struct {
+    ngx_uint_t                      nelts;
+    ngx_uint_t                      mask;
+    ngx_http_shared_map_entry_t   **buckets;
+} ngx_http_shared_map_table_t;
+
+
+typedef struct {
+    ngx_http_shared_map_table_t    *table;
+    ngx_http_shared_map_table_t    *old;
+    time_t                          updated;
+    time_t                          mtime;
+    off_t                           size;
+    ngx_file_uniq_t                 uniq;
+} ngx_http_shared_map_shctx_t;
+
+
+typedef struct {
+    ngx_http_shared_map_shctx_t    *sh;
+    ngx_slab_pool_t                *shpool;
+    ngx_http_complex_value_t        key;
+    ngx_str_t                       default_value;
+    ngx_str_t                       file;
+    ngx_msec_t                      interval;
+    ngx_event_t                     event;
+} ngx_http_shared_map_ctx_t;
+
+
+typedef struct {
+    ngx_array_t                     maps;  /* ngx_http_shared_map_ctx_t * */
+} ngx_http_shared_map_main_conf_t;
+
+
+static ngx_int_t ngx_http_shared_map_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_http_shared_map_entry_t *ngx_http_shared_map_find(
+    ngx_http_shared_map_table_t *t, ngx_str_t *key, uint32_t hash);
+static ngx_int_t ngx_http_shared_map_update(ngx_http_shared_map_ctx_t *ctx,
+    ngx_log_t *log);
+static u_char *ngx_http_shared_map_parse(u_char *p, u_char *last,
+    ngx_str_t *key, ngx_str_t *value);
+static void ngx_http_shared_map_timer(ngx_event_t *ev);
+static ngx_int_t ngx_http_shared_map_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void *ngx_http_shared_map_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_shared_map(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_shared_map_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_shared_map_commands[] = {
+
+    { ngx_string("shared_map"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_2MORE,
+      ngx_http_shared_map,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_shared_map_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_shared_map_create_main_conf,  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_shared_map_module = {
+    NGX_MODULE_V1,
+    &ngx_http_shared_map_module_ctx,       /* module context */
+    ngx_http_shared_map_commands,          /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_shared_map_init_process,      /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_shared_map_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_shared_map_ctx_t *ctx = (ngx_http_shared_map_ctx_t *) data;
+
+    u_char                       *p;
+    ngx_str_t                     key;
+    ngx_http_shared_map_entry_t  *e;
+    ngx_http_shared_map_table_t  *t;
+
+    if (ngx_http_complex_value(r, &ctx->key, &key) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    t = ctx->sh->table;
+
+    e = NULL;
+
+    if (t) {
+        e = ngx_http_shared_map_find(t, &key,
+                                     ngx_murmur_hash2(key.data, key.len));
+    }
+
+    if (e == NULL) {
+        v->len = ctx->default_value.len;
+        v->data = ctx->default_value.data;
+
+    } else {
+
+        /* the table may be freed while the request still exists */
+
+        p = ngx_pnalloc(r->pool, e->value_len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, e->data + e->key_len, e->value_len);
+
+        v->len = e->value_len;
+        v->data = p;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http shared map: \"%V\" \"%v\"", &key, v);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_shared_map_entry_t *
+ngx_http_shared_map_find(ngx_http_shared_map_table_t *t, ngx_str_t *key,
+    uint32_t hash)
+{
+    ngx_uint_t                    i;
+    ngx_http_shared_map_entry_t  *e;
+
+    for (i = hash & t->mask; /* void */ ; i = (i + 1) & t->mask) {
+
+        e = t->buckets[i];
+
+        if (e == NULL) {
+            return NULL;
+        }
+
+        if (e->hash == hash
+            && e->key_len == key->len
+            && ngx_memcmp(e->data, key->data, key->len) == 0)
+        {
+            return e;
+        }
+    }
+}
+
+
+/* called with the zone mutex locked */
+
+static ngx_int_t
+ngx_http_shared_map_update(ngx_http_shared_map_ctx_t *ctx, ngx_log_t *log)
+{
+    u_char                       *buf, *p, *last, *d;
+    size_t                        size;
+    ssize_t                       n;
+    uint32_t                      hash;
+    ngx_int_t                     rc;
+    ngx_str_t                     key, value;
+    ngx_uint_t                    nelts, i;
+    ngx_file_t                    file;
+    ngx_file_info_t               fi;
+    ngx_http_shared_map_entry_t  *e;
+    ngx_http_shared_map_shctx_t  *sh;
+    ngx_http_shared_map_table_t  *t;
+
+    sh = ctx->sh;
+
+    if (ngx_file_info(ctx->file.data, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_file_info_n " \"%V\" failed", &ctx->file);
+        return NGX_ERROR;
+    }
+
+    if (sh->table
+        && sh->mtime == ngx_file_mtime(&fi)
+        && sh->size == ngx_file_size(&fi)
+        && sh->uniq == ngx_file_uniq(&fi))
+    {
+        return NGX_DECLINED;
+    }
+
+    if (sh->table && sh->updated == ngx_time()) {
+        /* the table was published less than a second ago */
+        return NGX_DECLINED;
+    }
+
+    /* a file which fails to load is not retried until it changes */
+
+    sh->mtime = ngx_file_mtime(&fi);
+    sh->size = ngx_file_size(&fi);
+    sh->uniq = ngx_file_uniq(&fi);
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = ctx->file;
+    file.log = log;
+
+    file.fd = ngx_open_file(ctx->file.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_open_file_n " \"%V\" failed", &ctx->file);
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    size = (size_t) ngx_file_size(&fi);
+
+    buf = ngx_alloc(size + 1, log);
+    if (buf == NULL) {
+        goto done;
+    }
+
+    n = ngx_read_file(&file, buf, size, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_read_file_n " \"%V\" failed", &ctx->file);
+        goto done;
+    }
+
+    if ((size_t) n != size) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      ngx_read_file_n " \"%V\" returned only "
+                      "%z bytes instead of %uz", &ctx->file, n, size);
+        goto done;
+    }
+
+    last = buf + size;
+
+    /* the first pass only counts entries and their size */
+
+    nelts = 0;
+    size = 0;
+
+    for (p = buf; p < last; /* void */) {
+
+        p = ngx_http_shared_map_parse(p, last, &key, &value);
+
+        if (key.len == 0) {
+            continue;
+        }
+
+        if (key.len > 65535 || value.len > 65535) {
+            ngx_log_error(NGX_LOG_ERR, log, 0,
+                          "too long entry \"%*s...\" in \"%V\"",
+                          (size_t) 32, key.data, &ctx->file);
+            goto done;
+        }
+
+        nelts++;
+        size += ngx_align(offsetof(ngx_http_shared_map_entry_t, data)
+                          + key.len + value.len, sizeof(void *));
+    }
+
+    for (i = 1; i < 2 * nelts; i <<= 1) { /* void */ }
+
+    size += sizeof(ngx_http_shared_map_table_t)
+            + i * sizeof(ngx_http_shared_map_entry_t *);
+
+    if (sh->old) {
+        ngx_slab_free_locked(ctx->shpool, sh->old);
+        sh->old = NULL;
+    }
+
+    t = ngx_slab_alloc_locked(ctx->shpool, size);
+    if (t == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "could not allocate %uz bytes for \"%V\"%s",
+                      size, &ctx->file, ctx->shpool->log_ctx);
+        goto done;
+    }
+
+    t->nelts = 0;
+    t->mask = i - 1;
+    t->buckets = (ngx_http_shared_map_entry_t **) &t[1];
+
+    ngx_memzero(t->buckets, i * sizeof(ngx_http_shared_map_entry_t *));
+
+    d = (u_char *) &t->buckets[i];
+
+    for (p = buf; p < last; /* void */) {
+
+        p = ngx_http_shared_map_parse(p, last, &key, &value);
+
+        if (key.len == 0) {
+            continue;
+        }
+
+        hash = ngx_murmur_hash2(key.data, key.len);
+
+        if (ngx_http_shared_map_find(t, &key, hash)) {
+            /* the first entry wins */
+            continue;
+        }
+
+        e = (ngx_http_shared_map_entry_t *) d;
+
+        e->hash = hash;
+        e->key_len = (u_short) key.len;
+        e->value_len = (u_short) value.len;
+
+        ngx_memcpy(ngx_cpymem(e->data, key.data, key.len),
+                   value.data, value.len);
+
+        d += ngx_align(offsetof(ngx_http_shared_map_entry_t, data)
+                       + key.len + value.len, sizeof(void *));
+
+        for (i = hash & t->mask; t->buckets[i]; i = (i + 1) & t->mask) {
+            /* void */
+        }
+
+        t->buckets[i] = e;
+        t->nelts++;
+    }
+
+    ngx_memory_barrier();
+
+    sh->old = sh->table;
+    sh->table = t;
+
+    sh->updated = ngx_time();
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "shared map \"%V\" loaded, %ui entries",
+                  &ctx->file, t->nelts);
+
+    rc = NGX_OK;
+
+done:
+
+    if (buf) {
+        ngx_free(buf);
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &ctx->file);
+    }
+
+    return rc;
+}
+
+
+/*
+ * returns the next line, an empty key is returned for
+ * empty lines and comments
+ */
+
+static u_char *
+ngx_http_shared_map_parse(u_char *p, u_char *last, ngx_str_t *key,
+    ngx_str_t *value)
+{
+    u_char  *eol;
+
+    eol = ngx_strlchr(p, last, LF);
+
+    if (eol == NULL) {
+        eol = last;
+    }
+
+    while (p < eol && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+
+    key->data = p;
+
+    while (p < eol && *p != ' ' && *p != '\t' && *p != CR) {
+        p++;
+    }
+
+    key->len = p - key->data;
+
+    if (key->len && key->data[0] == '#') {
+        key->len = 0;
+    }
+
+    while (p < eol && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+
+    value->data = p;
+    p = eol;
+
+    while (p > value->data
+           && (p[-1] == ' ' || p[-1] == '\t' || p[-1] == CR))
+    {
+        p--;
+    }
+
+    value->len = p - value->data;
+
+    if (value->len == 0) {
+        ngx_str_set(value, "1");
+    }
+
+    return eol + 1;
+}
+
+
+static void
+ngx_http_shared_map_timer(ngx_event_t *ev)
+{
+    ngx_http_shared_map_ctx_t  *ctx = ev->data;
+
+    if (ngx_shmtx_trylock(&ctx->shpool->mutex)) {
+        (void) ngx_http_shared_map_update(ctx, ev->log);
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+    }
+
+    ngx_add_timer(ev, ctx->interval);
+}
+
+
+static ngx_int_t
+ngx_http_shared_map_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_shared_map_ctx_t  *octx = data;
+
+    size_t                      len;
+    ngx_int_t                   rc;
+    ngx_http_shared_map_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        goto update;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_calloc(ctx->shpool,
+                              sizeof(ngx_http_shared_map_shctx_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    len = sizeof(" in shared map zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in shared map zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+update:
+
+    /* the file may have changed or been replaced by the configuration */
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    rc = ngx_http_shared_map_update(ctx, shm_zone->shm.log);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    if (rc == NGX_ERROR && ctx->sh->table == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_shared_map_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_shared_map_main_conf_t  *smcf;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_shared_map_main_conf_t));
+    if (smcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&smcf->maps, cf->pool, 1,
+                       sizeof(ngx_http_shared_map_ctx_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return smcf;
+}
+
+
+static char *
+ngx_http_shared_map(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_shared_map_main_conf_t *smcf = conf;
+
+    u_char                            *p;
+    ssize_t                            size;
+    ngx_str_t                         *value, name, s;
+    ngx_int_t                          interval;
+    ngx_uint_t                         i;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_variable_t               *var;
+    ngx_http_shared_map_ctx_t         *ctx, **ctxp;
+    ngx_http_compile_complex_value_t   ccv;
+
+    value = cf->args->elts;
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_shared_map_ctx_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = &ctx->key;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    name = value[2];
+
+    if (name.data[0] != '$') {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid variable name \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len--;
+    name.data++;
+
+    var = ngx_http_add_variable(cf, &name, NGX_HTTP_VAR_CHANGEABLE);
+    if (var == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    var->get_handler = ngx_http_shared_map_variable;
+    var->data = (uintptr_t) ctx;
+
+    ctx->interval = 60000;
+
+    size = 0;
+    name.len = 0;
+
+    for (i = 3; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "file=", 5) == 0) {
+
+            ctx->file.len = value[i].len - 5;
+            ctx->file.data = value[i].data + 5;
+
+            if (ngx_conf_full_name(cf->cycle, &ctx->file, 1) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            interval = ngx_parse_time(&s, 0);
+
+            if (interval == NGX_ERROR || interval == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid interval \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            ctx->interval = (ngx_msec_t) interval;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "default=", 8) == 0) {
+
+            ctx->default_value.len = value[i].len - 8;
+            ctx->default_value.data = value[i].data + 8;
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ctx->file.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"file\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_shared_map_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "%V \"%V\" is already used",
+                           &cmd->name, &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_shared_map_init_zone;
+    shm_zone->data = ctx;
+
+    ctxp = ngx_array_push(&smcf->maps);
+    if (ctxp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *ctxp = ctx;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_shared_map_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                        i;
+    ngx_http_shared_map_ctx_t       **ctxp;
+    ngx_http_shared_map_main_conf_t  *smcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    smcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_shared_map_module);
+    if (smcf == NULL) {
+        return NGX_OK;
+    }
+
+    ctxp = smcf->maps.elts;
+
+    for (i = 0; i < smcf->maps.nelts; i++) {
+        ctxp[i]->event.handler = ngx_http_shared_map_timer;
+        ctxp[i]->event.data = ctxp[i];
+        ctxp[i]->event.log = cycle->log;
+        ctxp[i]->event.cancelable = 1;
+
+        ngx_add_timer(&ctxp[i]->event, ctxp[i]->interval);
+    }
+
+    return NGX_OK;
+}
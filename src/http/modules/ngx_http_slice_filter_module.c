@@ -70,16 +70,19 @@
 
 typedef struct {
     size_t               size;
+    ngx_uint_t           prefetch;
 } ngx_http_slice_loc_conf_t;
 
 
 typedef struct {
     off_t                start;
     off_t                end;
+    off_t                prefetch;
     ngx_str_t            range;
     ngx_str_t            etag;
     unsigned             last:1;
     unsigned             active:1;
+    unsigned             background:1;
     ngx_http_request_t  *sr;
 } ngx_http_slice_ctx_t;
 
@@ -99,6 +102,8 @@ static ngx_int_t ngx_http_slice_parse_content_range(ngx_http_request_t *r,
 static ngx_int_t ngx_http_slice_range_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static off_t ngx_http_slice_get_start(ngx_http_request_t *r);
+static ngx_int_t ngx_http_slice_prefetch(ngx_http_request_t *r,
+    ngx_http_slice_ctx_t *ctx, off_t start);
 static void *ngx_http_slice_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_slice_merge_loc_conf(ngx_conf_t *cf, void *parent,
     void *child);
@@ -115,6 +120,13 @@ static ngx_command_t  ngx_http_slice_filter_commands[] = {
       offsetof(ngx_http_slice_loc_conf_t, size),
       NULL },
 
+    { ngx_string("slice_prefetch"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_slice_loc_conf_t, prefetch),
+      NULL },
+
       ngx_null_command
 };
 
@@ -176,7 +188,7 @@ ngx_http_slice_header_filter(ngx_http_request_t *r)
      *       2. 或者，此请求为 subrequest
      */
     ctx = ngx_http_get_module_ctx(r, ngx_http_slice_filter_module);
-    if (ctx == NULL) {
+    if (ctx == NULL || ctx->background) {
         return ngx_http_next_header_filter(r);
     }
 
@@ -357,6 +369,12 @@ ngx_http_slice_header_filter(ngx_http_request_t *r)
         ctx->end = cr.complete_length;
     }
 
+    if (rc != NGX_ERROR
+        && ngx_http_slice_prefetch(r, ctx, ctx->start) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
     return rc;
 }
 
@@ -469,10 +487,84 @@ ngx_http_slice_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http slice subrequest: \"%V\"", &ctx->range);
 
+    if (ngx_http_slice_prefetch(r, ctx, ctx->start + (off_t) slcf->size)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
     return rc;
 }
 
 
+static ngx_int_t
+ngx_http_slice_prefetch(ngx_http_request_t *r, ngx_http_slice_ctx_t *ctx,
+    off_t start)
+{
+    u_char                     *p;
+    off_t                       last;
+    ngx_http_request_t         *sr;
+    ngx_http_slice_ctx_t       *pctx;
+    ngx_http_slice_loc_conf_t  *slcf;
+
+    /*
+     * slices following the one being fetched are requested ahead
+     * by background subrequests, which only fill the cache; the
+     * subrequests sending them to the client later find them there
+     */
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_slice_filter_module);
+
+    if (slcf->prefetch == 0) {
+        return NGX_OK;
+    }
+
+    last = ngx_min(start + (off_t) (slcf->prefetch * slcf->size), ctx->end);
+
+    for (start = ngx_max(start, ctx->prefetch);
+         start < last;
+         start += (off_t) slcf->size)
+    {
+        pctx = ngx_pcalloc(r->pool, sizeof(ngx_http_slice_ctx_t));
+        if (pctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_pnalloc(r->pool, sizeof("bytes=-") - 1 + 2 * NGX_OFF_T_LEN);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        pctx->start = start;
+        pctx->background = 1;
+
+        pctx->range.data = p;
+        pctx->range.len = ngx_sprintf(p, "bytes=%O-%O", start,
+                                      start + (off_t) slcf->size - 1)
+                          - p;
+
+        if (ngx_http_subrequest(r, &r->uri, &r->args, &sr, NULL,
+                                NGX_HTTP_SUBREQUEST_CLONE
+                                |NGX_HTTP_SUBREQUEST_BACKGROUND)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        sr->header_only = 1;
+
+        ngx_http_set_ctx(sr, pctx, ngx_http_slice_filter_module);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http slice prefetch: \"%V\"", &pctx->range);
+
+        ctx->prefetch = start + (off_t) slcf->size;
+    }
+
+    return NGX_OK;
+}
+
+
 /*
  * NOTE: 解析 upstream 返回的 Content-Range 头，其语法如下：
  *       Content-Range: bytes start-end/size
@@ -735,6 +827,7 @@ ngx_http_slice_create_loc_conf(ngx_conf_t *cf)
     }
 
     slcf->size = NGX_CONF_UNSET_SIZE;
+    slcf->prefetch = NGX_CONF_UNSET_UINT;
 
     return slcf;
 }
@@ -747,6 +840,7 @@ ngx_http_slice_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_slice_loc_conf_t *conf = child;
 
     ngx_conf_merge_size_value(conf->size, prev->size, 0);
+    ngx_conf_merge_uint_value(conf->prefetch, prev->prefetch, 0);
 
     return NGX_CONF_OK;
 }
@@ -17,6 +17,29 @@
 #define NGX_HTTP_SSI_ADD_ZERO       2
 
 
+typedef struct {
+    ngx_rbtree_node_t         node;
+    ngx_queue_t               queue;
+
+    ngx_file_uniq_t           uniq;
+    time_t                    mtime;
+    off_t                     size;
+
+    ngx_uint_t                nincludes;
+    ngx_http_ssi_include_t   *includes;
+} ngx_http_ssi_template_t;
+
+
+typedef struct {
+    ngx_rbtree_t              rbtree;
+    ngx_rbtree_node_t         sentinel;
+    ngx_queue_t               queue;
+
+    ngx_uint_t                current;
+    ngx_uint_t                max;
+} ngx_http_ssi_template_cache_t;
+
+
 typedef struct {
     ngx_flag_t    enable;
     ngx_flag_t    silent_errors;
@@ -29,6 +52,8 @@ typedef struct {
     size_t        value_len;
 
     ngx_array_t  *types_keys;
+
+    ngx_http_ssi_template_cache_t  *template_cache;
 } ngx_http_ssi_loc_conf_t;
 
 
@@ -109,6 +134,28 @@ static ngx_int_t ngx_http_ssi_endblock(ngx_http_request_t *r,
 static ngx_int_t ngx_http_ssi_date_gmt_local_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t gmt);
 
+static ngx_int_t ngx_http_ssi_template_open(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_template_prefetch(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_template_record(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_template_attach(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx, ngx_str_t *uri, ngx_str_t *args,
+    ngx_uint_t flags, ngx_http_request_t **psr);
+static ngx_int_t ngx_http_ssi_template_done(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_template_append(ngx_http_request_t *r,
+    ngx_http_postponed_request_t *pr);
+static ngx_http_ssi_template_t *ngx_http_ssi_template_lookup(
+    ngx_http_ssi_template_cache_t *cache, ngx_file_uniq_t uniq);
+static void ngx_http_ssi_template_add(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx, ngx_http_ssi_template_cache_t *cache);
+static void ngx_http_ssi_template_free(ngx_http_ssi_template_cache_t *cache,
+    ngx_http_ssi_template_t *tpl);
+static char *ngx_http_ssi_template_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
 static ngx_int_t ngx_http_ssi_preconfiguration(ngx_conf_t *cf);
 static void *ngx_http_ssi_create_main_conf(ngx_conf_t *cf);
 static char *ngx_http_ssi_init_main_conf(ngx_conf_t *cf, void *conf);
@@ -170,6 +217,13 @@ static ngx_command_t  ngx_http_ssi_filter_commands[] = {
       offsetof(ngx_http_ssi_loc_conf_t, last_modified),
       NULL },
 
+    { ngx_string("ssi_template_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_ssi_template_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -366,6 +420,21 @@ ngx_http_ssi_header_filter(ngx_http_request_t *r)
 
     r->filter_need_in_memory = 1;
 
+    if (slcf->template_cache) {
+        switch (ngx_http_ssi_template_open(r, ctx)) {
+
+        case NGX_OK:
+            ctx->prefetch = 1;
+            break;
+
+        case NGX_ERROR:
+            return NGX_ERROR;
+
+        default: /* NGX_DECLINED */
+            break;
+        }
+    }
+
     if (r == r->main) {
         ngx_http_clear_content_length(r);
         ngx_http_clear_accept_ranges(r);
@@ -424,6 +493,14 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http ssi filter \"%V?%V\"", &r->uri, &r->args);
 
+    if (ctx->prefetch) {
+        ctx->prefetch = 0;
+
+        if (ngx_http_ssi_template_prefetch(r, ctx) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
     if (ctx->wait) {
 
         if (r != r->connection->data) {
@@ -645,6 +722,16 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                     continue;
                 }
 
+                if (cmd->handler == ngx_http_ssi_include) {
+                    ctx->include++;
+
+                    if (ctx->record
+                        && ngx_http_ssi_template_record(r, ctx) != NGX_OK)
+                    {
+                        return NGX_ERROR;
+                    }
+                }
+
                 if (!ctx->output && !cmd->block) {
 
                     if (ctx->block) {
@@ -893,6 +980,13 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             b->last_buf = ctx->buf->last_buf;
             b->shadow = ctx->buf;
 
+            if ((ctx->record || ctx->prefetched)
+                && (ctx->buf->last_buf || ctx->buf->last_in_chain)
+                && ngx_http_ssi_template_done(r, ctx) != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
             if (slcf->ignore_recycled_buffers == 0)  {
                 b->recycled = ctx->buf->recycled;
             }
@@ -2176,7 +2270,19 @@ ngx_http_ssi_include(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
         flags |= NGX_HTTP_SUBREQUEST_IN_MEMORY|NGX_HTTP_SUBREQUEST_WAITED;
     }
 
-    if (ngx_http_subrequest(r, uri, &args, &sr, psr, flags) != NGX_OK) {
+    sr = NULL;
+
+    if (ctx->prefetched && psr == NULL) {
+        rc = ngx_http_ssi_template_attach(r, ctx, uri, &args, flags, &sr);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (sr == NULL
+        && ngx_http_subrequest(r, uri, &args, &sr, psr, flags) != NGX_OK)
+    {
         return NGX_HTTP_SSI_ERROR;
     }
 
@@ -2777,6 +2883,533 @@ ngx_http_ssi_date_gmt_local_variable(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_ssi_template_open(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    u_char                    *last;
+    size_t                     root;
+    ngx_str_t                  path;
+    ngx_open_file_info_t       of;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    /*
+     * a template is identified by its file, so only responses
+     * which are the file as is, e.g. sent by the static module, are used
+     */
+
+    if (r->headers_out.status != NGX_HTTP_OK
+        || r->headers_out.last_modified_time == -1
+        || r->headers_out.content_length_n <= 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    last = ngx_http_map_uri_to_path(r, &path, &root, 0);
+    if (last == NULL) {
+        return NGX_ERROR;
+    }
+
+    path.len = last - path.data;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = clcf->directio;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+    of.test_only = 1;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, &path, &of) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
+        != NGX_OK)
+    {
+        return NGX_DECLINED;
+    }
+
+    if (!of.is_file
+        || of.mtime != r->headers_out.last_modified_time
+        || of.size != r->headers_out.content_length_n)
+    {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "ssi template: \"%s\"", path.data);
+
+    ctx->uniq = of.uniq;
+    ctx->mtime = of.mtime;
+    ctx->size = of.size;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_template_prefetch(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    ngx_int_t                       rc;
+    ngx_str_t                       uri, args;
+    ngx_uint_t                      i, flags;
+    ngx_http_request_t             *sr;
+    ngx_http_ssi_include_t         *inc;
+    ngx_http_ssi_prefetch_t        *pf;
+    ngx_http_ssi_template_t        *tpl;
+    ngx_http_ssi_loc_conf_t        *slcf;
+    ngx_http_postponed_request_t  **ppr;
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_ssi_filter_module);
+
+    tpl = ngx_http_ssi_template_lookup(slcf->template_cache, ctx->uniq);
+
+    if (tpl && (tpl->mtime != ctx->mtime || tpl->size != ctx->size)) {
+        ngx_http_ssi_template_free(slcf->template_cache, tpl);
+        tpl = NULL;
+    }
+
+    if (tpl == NULL) {
+        ctx->includes = ngx_array_create(r->pool, 4,
+                                         sizeof(ngx_http_ssi_include_t));
+        if (ctx->includes == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx->record = 1;
+
+        return NGX_OK;
+    }
+
+    ngx_queue_remove(&tpl->queue);
+    ngx_queue_insert_head(&slcf->template_cache->queue, &tpl->queue);
+
+    if (tpl->nincludes == 0) {
+        return NGX_OK;
+    }
+
+    ctx->prefetched = ngx_array_create(r->pool, tpl->nincludes,
+                                       sizeof(ngx_http_ssi_prefetch_t));
+    if (ctx->prefetched == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * The includes are started at once, but are held aside of the postponed
+     * list until the template is parsed up to them, see
+     * ngx_http_ssi_template_attach(), so their output keeps its place.
+     */
+
+    inc = tpl->includes;
+
+    for (i = 0; i < tpl->nincludes; i++) {
+
+        /* the template entry may go away before the subrequest does */
+
+        uri.len = inc[i].uri.len;
+        uri.data = ngx_pstrdup(r->pool, &inc[i].uri);
+        if (uri.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        rc = ngx_http_ssi_evaluate_string(r, ctx, &uri,
+                                          NGX_HTTP_SSI_ADD_PREFIX);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc != NGX_OK) {
+            continue;
+        }
+
+        ngx_str_null(&args);
+        flags = NGX_HTTP_LOG_UNSAFE;
+
+        if (ngx_http_parse_unsafe_uri(r, &uri, &args, &flags) != NGX_OK) {
+            continue;
+        }
+
+        if (inc[i].waited) {
+            flags |= NGX_HTTP_SUBREQUEST_WAITED;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "ssi prefetch: \"%V?%V\"", &uri, &args);
+
+        if (ngx_http_subrequest(r, &uri, &args, &sr, NULL, flags) != NGX_OK) {
+            break;
+        }
+
+        for (ppr = &r->postponed; (*ppr)->next; ppr = &(*ppr)->next) {
+            /* void */
+        }
+
+        pf = ngx_array_push(ctx->prefetched);
+        if (pf == NULL) {
+            return NGX_ERROR;
+        }
+
+        pf->index = inc[i].index;
+        pf->postponed = *ppr;
+
+        *ppr = NULL;
+
+        if (r->connection->data == sr) {
+            r->connection->data = r;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_template_record(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    ngx_str_t               *uri, *file, *wait;
+    ngx_uint_t               i;
+    ngx_table_elt_t         *param;
+    ngx_http_ssi_include_t  *inc;
+
+    /*
+     * only unconditional includes of static URIs are started in advance,
+     * as anything else may depend on the template processing
+     */
+
+    if (ctx->conditional || !ctx->output) {
+        return NGX_OK;
+    }
+
+    uri = NULL;
+    file = NULL;
+    wait = NULL;
+
+    param = ctx->params.elts;
+
+    for (i = 0; i < ctx->params.nelts; i++) {
+
+        if (param[i].key.len == 7
+            && ngx_strncmp(param[i].key.data, "virtual", 7) == 0
+            && uri == NULL)
+        {
+            uri = &param[i].value;
+
+        } else if (param[i].key.len == 4
+                   && ngx_strncmp(param[i].key.data, "file", 4) == 0
+                   && file == NULL)
+        {
+            file = &param[i].value;
+
+        } else if (param[i].key.len == 4
+                   && ngx_strncmp(param[i].key.data, "wait", 4) == 0
+                   && wait == NULL)
+        {
+            wait = &param[i].value;
+
+        } else {
+            return NGX_OK;
+        }
+    }
+
+    if (file) {
+        if (uri || wait) {
+            return NGX_OK;
+        }
+
+        uri = file;
+    }
+
+    if (uri == NULL
+        || uri->len == 0
+        || ngx_http_script_variables_count(uri) != 0)
+    {
+        return NGX_OK;
+    }
+
+    if (wait
+        && !(wait->len == 3
+             && ngx_strncasecmp(wait->data, (u_char *) "yes", 3) == 0)
+        && !(wait->len == 2
+             && ngx_strncasecmp(wait->data, (u_char *) "no", 2) == 0))
+    {
+        return NGX_OK;
+    }
+
+    inc = ngx_array_push(ctx->includes);
+    if (inc == NULL) {
+        return NGX_ERROR;
+    }
+
+    inc->index = ctx->include;
+    inc->waited = file || (wait && wait->len == 3);
+
+    inc->uri.len = uri->len;
+    inc->uri.data = ngx_pstrdup(r->pool, uri);
+    if (inc->uri.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_template_attach(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
+    ngx_str_t *uri, ngx_str_t *args, ngx_uint_t flags,
+    ngx_http_request_t **psr)
+{
+    ngx_http_request_t       *sr;
+    ngx_http_ssi_prefetch_t  *pf;
+
+    pf = ctx->prefetched->elts;
+
+    while (ctx->next_prefetched < ctx->prefetched->nelts
+           && pf[ctx->next_prefetched].index < ctx->include)
+    {
+        ctx->next_prefetched++;
+    }
+
+    if (ctx->next_prefetched == ctx->prefetched->nelts
+        || pf[ctx->next_prefetched].index != ctx->include)
+    {
+        return NGX_DECLINED;
+    }
+
+    pf = &pf[ctx->next_prefetched++];
+    sr = pf->postponed->request;
+
+    if (uri->len != sr->uri.len
+        || ngx_strncmp(uri->data, sr->uri.data, uri->len) != 0
+        || args->len != sr->args.len
+        || ngx_strncmp(args->data, sr->args.data, args->len) != 0
+        || ((flags & NGX_HTTP_SUBREQUEST_WAITED) != 0) != sr->waited)
+    {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "ssi prefetched: \"%V?%V\"", &sr->uri, &sr->args);
+
+    *psr = sr;
+
+    if (ngx_http_ssi_template_append(r, pf->postponed) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    pf->postponed = NULL;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_template_done(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    ngx_uint_t                i;
+    ngx_http_ssi_prefetch_t  *pf;
+    ngx_http_ssi_loc_conf_t  *slcf;
+
+    if (ctx->record) {
+        ctx->record = 0;
+
+        slcf = ngx_http_get_module_loc_conf(r, ngx_http_ssi_filter_module);
+
+        ngx_http_ssi_template_add(r, ctx, slcf->template_cache);
+    }
+
+    if (ctx->prefetched == NULL) {
+        return NGX_OK;
+    }
+
+    /*
+     * includes not met in the template, e.g. if the file was changed
+     * after it was checked, are output at the end to be finalized
+     */
+
+    pf = ctx->prefetched->elts;
+
+    for (i = 0; i < ctx->prefetched->nelts; i++) {
+
+        if (pf[i].postponed == NULL) {
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "prefetched SSI include \"%V?%V\" not found",
+                      &pf[i].postponed->request->uri,
+                      &pf[i].postponed->request->args);
+
+        if (ngx_http_ssi_template_append(r, pf[i].postponed) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        pf[i].postponed = NULL;
+    }
+
+    ctx->prefetched = NULL;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_template_append(ngx_http_request_t *r,
+    ngx_http_postponed_request_t *pr)
+{
+    ngx_connection_t              *c;
+    ngx_http_postponed_request_t  *p;
+
+    /* the same as in ngx_http_subrequest() */
+
+    c = r->connection;
+
+    if (r->postponed) {
+        for (p = r->postponed; p->next; p = p->next) { /* void */ }
+        p->next = pr;
+
+        return NGX_OK;
+    }
+
+    r->postponed = pr;
+
+    if (c->data != r) {
+        return NGX_OK;
+    }
+
+    /* the subrequest may be already finalized with its output postponed */
+
+    c->data = pr->request;
+
+    return ngx_http_post_request(pr->request, NULL);
+}
+
+
+static ngx_http_ssi_template_t *
+ngx_http_ssi_template_lookup(ngx_http_ssi_template_cache_t *cache,
+    ngx_file_uniq_t uniq)
+{
+    ngx_rbtree_key_t          key;
+    ngx_rbtree_node_t        *node, *sentinel;
+    ngx_http_ssi_template_t  *tpl;
+
+    key = (ngx_rbtree_key_t) uniq;
+
+    node = cache->rbtree.root;
+    sentinel = cache->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* key == node->key */
+
+        tpl = (ngx_http_ssi_template_t *) node;
+
+        if (tpl->uniq == uniq) {
+            return tpl;
+        }
+
+        node = node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_ssi_template_add(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
+    ngx_http_ssi_template_cache_t *cache)
+{
+    u_char                   *p;
+    size_t                    len;
+    ngx_uint_t                i, n;
+    ngx_queue_t              *q;
+    ngx_http_ssi_include_t   *inc;
+    ngx_http_ssi_template_t  *tpl;
+
+    tpl = ngx_http_ssi_template_lookup(cache, ctx->uniq);
+
+    if (tpl) {
+        ngx_http_ssi_template_free(cache, tpl);
+    }
+
+    if (cache->current >= cache->max) {
+        q = ngx_queue_last(&cache->queue);
+        tpl = ngx_queue_data(q, ngx_http_ssi_template_t, queue);
+
+        ngx_http_ssi_template_free(cache, tpl);
+    }
+
+    inc = ctx->includes->elts;
+    n = ctx->includes->nelts;
+
+    len = sizeof(ngx_http_ssi_template_t) + n * sizeof(ngx_http_ssi_include_t);
+
+    for (i = 0; i < n; i++) {
+        len += inc[i].uri.len;
+    }
+
+    tpl = ngx_alloc(len, r->connection->log);
+    if (tpl == NULL) {
+        return;
+    }
+
+    tpl->node.key = (ngx_rbtree_key_t) ctx->uniq;
+
+    tpl->uniq = ctx->uniq;
+    tpl->mtime = ctx->mtime;
+    tpl->size = ctx->size;
+
+    tpl->nincludes = n;
+    tpl->includes = (ngx_http_ssi_include_t *) &tpl[1];
+
+    p = (u_char *) &tpl->includes[n];
+
+    for (i = 0; i < n; i++) {
+        tpl->includes[i].index = inc[i].index;
+        tpl->includes[i].waited = inc[i].waited;
+        tpl->includes[i].uri.len = inc[i].uri.len;
+        tpl->includes[i].uri.data = p;
+
+        p = ngx_cpymem(p, inc[i].uri.data, inc[i].uri.len);
+    }
+
+    ngx_rbtree_insert(&cache->rbtree, &tpl->node);
+    ngx_queue_insert_head(&cache->queue, &tpl->queue);
+
+    cache->current++;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "ssi template cached: \"%V\", %ui includes", &r->uri, n);
+}
+
+
+static void
+ngx_http_ssi_template_free(ngx_http_ssi_template_cache_t *cache,
+    ngx_http_ssi_template_t *tpl)
+{
+    ngx_queue_remove(&tpl->queue);
+    ngx_rbtree_delete(&cache->rbtree, &tpl->node);
+
+    cache->current--;
+
+    ngx_free(tpl);
+}
+
+
 static ngx_int_t
 ngx_http_ssi_preconfiguration(ngx_conf_t *cf)
 {
@@ -2889,6 +3522,8 @@ ngx_http_ssi_create_loc_conf(ngx_conf_t *cf)
     slcf->min_file_chunk = NGX_CONF_UNSET_SIZE;
     slcf->value_len = NGX_CONF_UNSET_SIZE;
 
+    slcf->template_cache = NGX_CONF_UNSET_PTR;
+
     return slcf;
 }
 
@@ -2908,6 +3543,8 @@ ngx_http_ssi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->min_file_chunk, prev->min_file_chunk, 1024);
     ngx_conf_merge_size_value(conf->value_len, prev->value_len, 255);
 
+    ngx_conf_merge_ptr_value(conf->template_cache, prev->template_cache, NULL);
+
     if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
                              &prev->types_keys, &prev->types,
                              ngx_http_html_default_types)
@@ -2920,6 +3557,57 @@ ngx_http_ssi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 }
 
 
+static char *
+ngx_http_ssi_template_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_ssi_loc_conf_t *slcf = conf;
+
+    ngx_int_t                       max;
+    ngx_str_t                      *value;
+    ngx_http_ssi_template_cache_t  *cache;
+
+    if (slcf->template_cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        slcf->template_cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "max=", 4) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    max = ngx_atoi(value[1].data + 4, value[1].len - 4);
+    if (max == NGX_ERROR || max == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_ssi_template_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_rbtree_insert_value);
+
+    ngx_queue_init(&cache->queue);
+
+    cache->max = max;
+
+    slcf->template_cache = cache;
+
+    return NGX_CONF_OK;
+}
+
+
 static ngx_int_t
 ngx_http_ssi_filter_init(ngx_conf_t *cf)
 {
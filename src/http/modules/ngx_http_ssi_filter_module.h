@@ -36,6 +36,19 @@ typedef struct {
 } ngx_http_ssi_main_conf_t;
 
 
+typedef struct {
+    ngx_uint_t                index;
+    ngx_uint_t                waited;
+    ngx_str_t                 uri;
+} ngx_http_ssi_include_t;
+
+
+typedef struct {
+    ngx_uint_t                     index;
+    ngx_http_postponed_request_t  *postponed;
+} ngx_http_ssi_prefetch_t;
+
+
 typedef struct {
     ngx_buf_t                *buf;
 
@@ -65,6 +78,15 @@ typedef struct {
     ngx_list_t               *variables;
     ngx_array_t              *blocks;
 
+    ngx_file_uniq_t           uniq;
+    time_t                    mtime;
+    off_t                     size;
+
+    ngx_uint_t                include;
+    ngx_array_t              *includes;
+    ngx_array_t              *prefetched;
+    ngx_uint_t                next_prefetched;
+
 #if (NGX_PCRE)
     ngx_uint_t                ncaptures;
     int                      *captures;
@@ -76,6 +98,8 @@ typedef struct {
     unsigned                  block:1;
     unsigned                  output:1;
     unsigned                  output_chosen:1;
+    unsigned                  prefetch:1;
+    unsigned                  record:1;
 
     ngx_http_request_t       *wait;
     void                     *value_buf;
@@ -21,6 +21,7 @@ typedef struct {
 
     ngx_flag_t                      prefer_server_ciphers;
     ngx_flag_t                      early_data;
+    ngx_flag_t                      ktls;
 
     ngx_uint_t                      protocols;
 
@@ -28,6 +29,7 @@ typedef struct {
     ngx_uint_t                      verify_depth;
 
     size_t                          buffer_size;
+    ngx_ssl_dyn_rec_t              *dyn_rec;
 
     ssize_t                         builtin_session_cache;
 
@@ -39,6 +41,8 @@ typedef struct {
     ngx_array_t                    *certificate_values;
     ngx_array_t                    *certificate_key_values;
 
+    ngx_ssl_cache_t                *certificate_cache;
+
     ngx_str_t                       dhparam;
     ngx_str_t                       ecdh_curve;
     ngx_str_t                       client_certificate;
@@ -53,11 +57,18 @@ typedef struct {
 
     ngx_flag_t                      session_tickets;
     ngx_array_t                    *session_ticket_keys;
+    ngx_shm_zone_t                 *session_ticket_keys_zone;
+
+    ngx_uint_t                      async;
+    ngx_str_t                       async_pool;
+
+    ngx_ssl_handshake_limit_t      *handshake_limit;
 
     ngx_flag_t                      stapling;
     ngx_flag_t                      stapling_verify;
     ngx_str_t                       stapling_file;
     ngx_str_t                       stapling_responder;
+    ngx_shm_zone_t                 *stapling_cache;
 
     u_char                         *file;
     ngx_uint_t                      line;
@@ -0,0 +1,2128 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * request times are kept in log-linear histograms of milliseconds:
+ * values below 8 have a bucket each, larger values get 4 buckets per
+ * power of two, so a bucket is never wider than a quarter of its value;
+ * everything above 2^21 ms goes to the last bucket
+ */
+
+#define NGX_HTTP_STATUS_LINEAR    8
+#define NGX_HTTP_STATUS_MAX_EXP   20
+#define NGX_HTTP_STATUS_BUCKETS                                               \
+    (NGX_HTTP_STATUS_LINEAR + (NGX_HTTP_STATUS_MAX_EXP - 2) * 4)
+
+/*
+ * request and error rates are counted per second in a ring of the last
+ * seconds, the current one is not complete and is not reported
+ */
+
+#define NGX_HTTP_STATUS_WINDOW    8
+
+#define NGX_HTTP_STATUS_NONE      (ngx_uint_t) -2
+
+#define NGX_HTTP_STATUS_JSON      1
+#define NGX_HTTP_STATUS_PROM      2
+
+
+typedef struct {
+    uint64_t                        sum;
+    uint64_t                        buckets[NGX_HTTP_STATUS_BUCKETS];
+} ngx_http_status_histogram_t;
+
+
+typedef struct {
+    time_t                          sec;
+    uint32_t                        requests;
+    uint32_t                        errors;
+} ngx_http_status_second_t;
+
+
+typedef struct {
+    uint64_t                        requests;
+    uint64_t                        responses[5];
+    uint64_t                        fails;
+    uint64_t                        received;
+    uint64_t                        sent;
+    uint64_t                        cpu;   /* zones only, in usec */
+    uint64_t                        pool;  /* zones only */
+    ngx_http_status_histogram_t     time;
+    ngx_http_status_histogram_t     connect;  /* upstreams only */
+    ngx_http_status_histogram_t     header;   /* upstreams only */
+    ngx_http_status_second_t        window[NGX_HTTP_STATUS_WINDOW];
+} ngx_http_status_counters_t;
+
+
+typedef struct {
+    ngx_uint_t                      workers;
+    ngx_uint_t                      nslots;
+    size_t                          stride;
+    u_char                         *counters;
+} ngx_http_status_shctx_t;
+
+
+typedef struct {
+    ngx_str_t                      *name;
+    ngx_uint_t                      slot;
+    ngx_uint_t                      backup;  /* unsigned  backup:1; */
+} ngx_http_status_peer_t;
+
+
+typedef struct {
+    ngx_str_t                       name;
+    ngx_http_upstream_srv_conf_t   *uscf;
+    ngx_http_status_peer_t         *peers;
+    ngx_uint_t                      npeers;
+} ngx_http_status_upstream_t;
+
+
+typedef struct {
+    ngx_flag_t                      enabled;
+    ngx_array_t                     zones;      /* ngx_str_t */
+    ngx_array_t                     upstreams;  /* ngx_http_status_upstream_t */
+    ngx_str_t                      *labels;
+    ngx_uint_t                      nslots;
+    ngx_uint_t                      workers;
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_http_status_shctx_t        *sh;
+} ngx_http_status_main_conf_t;
+
+
+typedef struct {
+    char                           *name;
+    ngx_uint_t                      type;
+    size_t                          offset;
+    ngx_uint_t                      upstream;
+} ngx_http_status_metric_t;
+
+
+typedef struct {
+    char                           *name;
+    char                           *type;
+    size_t                          offset;
+    ngx_uint_t                      usec;
+} ngx_http_status_loop_metric_t;
+
+
+typedef struct {
+    ngx_uint_t                      zone;
+    ngx_uint_t                      format;
+} ngx_http_status_loc_conf_t;
+
+
+static ngx_int_t ngx_http_status_log_handler(ngx_http_request_t *r);
+static void ngx_http_status_account(ngx_http_status_counters_t *c,
+    ngx_uint_t status, off_t received, off_t sent, ngx_msec_int_t ms,
+    time_t now);
+static void ngx_http_status_record(ngx_http_status_histogram_t *h,
+    ngx_msec_int_t ms);
+static ngx_http_status_counters_t *ngx_http_status_collect(
+    ngx_http_request_t *r, ngx_http_status_main_conf_t *mcf);
+static ngx_uint_t ngx_http_status_bucket(ngx_msec_int_t ms);
+static uint64_t ngx_http_status_bucket_start(ngx_uint_t n);
+static uint64_t ngx_http_status_percentile(ngx_http_status_histogram_t *h,
+    ngx_uint_t permille);
+static uint64_t ngx_http_status_get_rate(ngx_http_status_counters_t *c,
+    size_t offset);
+
+static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r);
+static u_char *ngx_http_status_json(u_char *p,
+    ngx_http_status_main_conf_t *mcf, ngx_http_status_counters_t *agg);
+static u_char *ngx_http_status_json_counters(u_char *p,
+    ngx_http_status_counters_t *c, char *time);
+static u_char *ngx_http_status_json_histogram(u_char *p,
+    ngx_http_status_histogram_t *h, char *name);
+static u_char *ngx_http_status_json_loops(u_char *p);
+static u_char *ngx_http_status_json_listeners(u_char *p);
+static u_char *ngx_http_status_json_locks(u_char *p);
+static u_char *ngx_http_status_json_slabs(u_char *p);
+static ngx_int_t ngx_http_status_cmp_handlers(const void *one,
+    const void *two);
+static u_char *ngx_http_status_prom(u_char *p,
+    ngx_http_status_main_conf_t *mcf, ngx_http_status_counters_t *agg);
+static u_char *ngx_http_status_prom_loops(u_char *p);
+static u_char *ngx_http_status_prom_listeners(u_char *p);
+static u_char *ngx_http_status_prom_locks(u_char *p);
+static u_char *ngx_http_status_prom_slabs(u_char *p);
+static u_char *ngx_http_status_prom_counter(u_char *p, char *name,
+    size_t offset, ngx_str_t *labels, ngx_http_status_counters_t *agg,
+    ngx_uint_t from, ngx_uint_t to);
+static u_char *ngx_http_status_prom_histogram(u_char *p, char *name,
+    size_t offset, ngx_str_t *labels, ngx_http_status_counters_t *agg,
+    ngx_uint_t from, ngx_uint_t to);
+static u_char *ngx_http_status_prom_rate(u_char *p, char *name,
+    size_t offset, ngx_str_t *labels, ngx_http_status_counters_t *agg,
+    ngx_uint_t from, ngx_uint_t to);
+
+static ngx_int_t ngx_http_status_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void *ngx_http_status_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_status_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_status_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_status_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_status_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_status_init_module(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_status_init_upstreams(ngx_conf_t *cf,
+    ngx_http_status_main_conf_t *mcf);
+
+
+#define NGX_HTTP_STATUS_COUNTER    0
+#define NGX_HTTP_STATUS_HISTOGRAM  1
+#define NGX_HTTP_STATUS_RATE       2
+
+#define ngx_http_status_counter(name)                                         \
+    NGX_HTTP_STATUS_COUNTER, offsetof(ngx_http_status_counters_t, name)
+
+#define ngx_http_status_histogram(name)                                       \
+    NGX_HTTP_STATUS_HISTOGRAM, offsetof(ngx_http_status_counters_t, name)
+
+#define ngx_http_status_rate(name)                                            \
+    NGX_HTTP_STATUS_RATE, offsetof(ngx_http_status_second_t, name)
+
+
+static ngx_http_status_metric_t  ngx_http_status_metrics[] = {
+
+    { "nginx_http_zone_requests_total",
+      ngx_http_status_counter(requests), 0 },
+
+    { "nginx_http_zone_responses_total",
+      ngx_http_status_counter(responses), 0 },
+
+    { "nginx_http_zone_received_bytes_total",
+      ngx_http_status_counter(received), 0 },
+
+    { "nginx_http_zone_sent_bytes_total",
+      ngx_http_status_counter(sent), 0 },
+
+    { "nginx_http_zone_cpu_seconds_total",
+      ngx_http_status_counter(cpu), 0 },
+
+    { "nginx_http_zone_pool_bytes_total",
+      ngx_http_status_counter(pool), 0 },
+
+    { "nginx_http_zone_request_seconds",
+      ngx_http_status_histogram(time), 0 },
+
+    { "nginx_http_zone_request_rate",
+      ngx_http_status_rate(requests), 0 },
+
+    { "nginx_http_zone_error_rate",
+      ngx_http_status_rate(errors), 0 },
+
+    { "nginx_http_upstream_requests_total",
+      ngx_http_status_counter(requests), 1 },
+
+    { "nginx_http_upstream_responses_total",
+      ngx_http_status_counter(responses), 1 },
+
+    { "nginx_http_upstream_fails_total",
+      ngx_http_status_counter(fails), 1 },
+
+    { "nginx_http_upstream_received_bytes_total",
+      ngx_http_status_counter(received), 1 },
+
+    { "nginx_http_upstream_sent_bytes_total",
+      ngx_http_status_counter(sent), 1 },
+
+    { "nginx_http_upstream_response_seconds",
+      ngx_http_status_histogram(time), 1 },
+
+    { "nginx_http_upstream_connect_seconds",
+      ngx_http_status_histogram(connect), 1 },
+
+    { "nginx_http_upstream_header_seconds",
+      ngx_http_status_histogram(header), 1 },
+
+    { "nginx_http_upstream_request_rate",
+      ngx_http_status_rate(requests), 1 },
+
+    { "nginx_http_upstream_error_rate",
+      ngx_http_status_rate(errors), 1 },
+
+    { NULL, 0, 0, 0 }
+};
+
+
+static ngx_http_status_loop_metric_t  ngx_http_status_loop_metrics[] = {
+
+    { "nginx_event_loop_iterations_total", "counter",
+      offsetof(ngx_event_loop_stat_t, iterations), 0 },
+
+    { "nginx_event_loop_events_total", "counter",
+      offsetof(ngx_event_loop_stat_t, events), 0 },
+
+    { "nginx_event_loop_wait_seconds_total", "counter",
+      offsetof(ngx_event_loop_stat_t, wait), 1 },
+
+    { "nginx_event_loop_busy_seconds_total", "counter",
+      offsetof(ngx_event_loop_stat_t, busy), 1 },
+
+    { "nginx_event_loop_max_busy_seconds", "gauge",
+      offsetof(ngx_event_loop_stat_t, max), 1 },
+
+    { "nginx_event_loop_stalls_total", "counter",
+      offsetof(ngx_event_loop_stat_t, stalls), 0 },
+
+    { "nginx_event_loop_accepted_total", "counter",
+      offsetof(ngx_event_loop_stat_t, accepted), 0 },
+
+    { "nginx_event_loop_accept_limited_total", "counter",
+      offsetof(ngx_event_loop_stat_t, accept_limited), 0 },
+
+    { "nginx_event_loop_read_deferred_total", "counter",
+      offsetof(ngx_event_loop_stat_t, read_deferred), 0 },
+
+    { "nginx_event_loop_idle_connections", "gauge",
+      offsetof(ngx_event_loop_stat_t, idle), 0 },
+
+    { "nginx_event_loop_idle_memory_bytes", "gauge",
+      offsetof(ngx_event_loop_stat_t, idle_memory), 0 },
+
+    { "nginx_event_loop_parked_connections", "gauge",
+      offsetof(ngx_event_loop_stat_t, parked), 0 },
+
+    { "nginx_event_loop_parked_memory_bytes", "gauge",
+      offsetof(ngx_event_loop_stat_t, parked_memory), 0 },
+
+    { "nginx_event_loop_udp_recv_calls_total", "counter",
+      offsetof(ngx_event_loop_stat_t, udp_recv_calls), 0 },
+
+    { "nginx_event_loop_udp_received_total", "counter",
+      offsetof(ngx_event_loop_stat_t, udp_received), 0 },
+
+    { "nginx_event_loop_udp_send_calls_total", "counter",
+      offsetof(ngx_event_loop_stat_t, udp_send_calls), 0 },
+
+    { "nginx_event_loop_udp_sent_total", "counter",
+      offsetof(ngx_event_loop_stat_t, udp_sent), 0 },
+
+    { "nginx_event_loop_prefetched_bytes_total", "counter",
+      offsetof(ngx_event_loop_stat_t, prefetched), 0 },
+
+    { "nginx_event_loop_prefetch_used_bytes_total", "counter",
+      offsetof(ngx_event_loop_stat_t, prefetch_used), 0 },
+
+    { "nginx_event_loop_prefetch_wasted_bytes_total", "counter",
+      offsetof(ngx_event_loop_stat_t, prefetch_wasted), 0 },
+
+    { "nginx_ssl_handshakes_total", "counter",
+      offsetof(ngx_event_loop_stat_t, ssl_handshakes), 0 },
+
+    { "nginx_ssl_handshake_seconds_total", "counter",
+      offsetof(ngx_event_loop_stat_t, ssl_handshake_time), 1 },
+
+    { "nginx_ssl_resumed_handshakes_total", "counter",
+      offsetof(ngx_event_loop_stat_t, ssl_resumed), 0 },
+
+    { "nginx_ssl_resumed_handshake_seconds_total", "counter",
+      offsetof(ngx_event_loop_stat_t, ssl_resumed_time), 1 },
+
+    { "nginx_ssl_handshakes_queued_total", "counter",
+      offsetof(ngx_event_loop_stat_t, ssl_queued), 0 },
+
+    { "nginx_ssl_handshakes_rejected_total", "counter",
+      offsetof(ngx_event_loop_stat_t, ssl_rejected), 0 },
+
+    { "nginx_event_loop_spins_total", "counter",
+      offsetof(ngx_event_loop_stat_t, spins), 0 },
+
+    { "nginx_event_loop_spin_hits_total", "counter",
+      offsetof(ngx_event_loop_stat_t, spin_hits), 0 },
+
+    { "nginx_event_loop_spin_seconds_total", "counter",
+      offsetof(ngx_event_loop_stat_t, spin_time), 1 },
+
+    { NULL, NULL, 0, 0 }
+};
+
+
+static char  *ngx_http_status_loop_bounds[] = {
+    "1", "4", "16", "64", "256", "1024", "+Inf"
+};
+
+static char  *ngx_http_status_loop_le[] = {
+    "0.001", "0.004", "0.016", "0.064", "0.256", "1.024", "+Inf"
+};
+
+
+static ngx_command_t  ngx_http_status_commands[] = {
+
+    { ngx_string("status_zone"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_status_zone,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("status"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_status,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_status_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_status_init,                  /* postconfiguration */
+
+    ngx_http_status_create_main_conf,      /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_status_create_loc_conf,       /* create location configuration */
+    ngx_http_status_merge_loc_conf         /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_status_module = {
+    NGX_MODULE_V1,
+    &ngx_http_status_module_ctx,           /* module context */
+    ngx_http_status_commands,              /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    ngx_http_status_init_module,           /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_status_log_handler(ngx_http_request_t *r)
+{
+    u_char                       *base;
+    ngx_uint_t                    i, j;
+    ngx_time_t                   *tp;
+    ngx_msec_int_t                ms;
+    ngx_http_status_peer_t       *peer;
+    ngx_http_status_shctx_t      *sh;
+    ngx_http_upstream_state_t    *state;
+    ngx_http_status_upstream_t   *us;
+    ngx_http_status_counters_t   *c;
+    ngx_http_status_loc_conf_t   *slcf;
+    ngx_http_status_main_conf_t  *smcf;
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_status_module);
+
+    sh = smcf->sh;
+
+    if (sh == NULL || ngx_worker >= sh->workers) {
+        return NGX_OK;
+    }
+
+    /*
+     * each worker only writes to its own cache line aligned set of
+     * counters, so plain increments are enough; readers sum them up
+     */
+
+    base = sh->counters + ngx_worker * sh->nslots * sh->stride;
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_status_module);
+
+    tp = ngx_timeofday();
+
+    if (slcf->zone != NGX_HTTP_STATUS_NONE) {
+        ms = (ngx_msec_int_t)
+                 ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+
+        c = (ngx_http_status_counters_t *) (base + slcf->zone * sh->stride);
+
+        ngx_http_status_account(c, r->headers_out.status, r->request_length,
+                                r->connection->sent, ngx_max(ms, 0), tp->sec);
+
+        c->cpu += r->cpu_time / 1000;
+        c->pool += ngx_pool_memory(r->pool);
+    }
+
+    if (r->upstream_states == NULL
+        || r->upstream == NULL
+        || r->upstream->upstream == NULL)
+    {
+        return NGX_OK;
+    }
+
+    us = smcf->upstreams.elts;
+
+    for (i = 0; i < smcf->upstreams.nelts; i++) {
+        if (us[i].uscf == r->upstream->upstream) {
+            break;
+        }
+    }
+
+    if (i == smcf->upstreams.nelts) {
+        return NGX_OK;
+    }
+
+    us = &us[i];
+    state = r->upstream_states->elts;
+
+    for (i = 0; i < r->upstream_states->nelts; i++) {
+
+        if (state[i].peer == NULL) {
+            continue;
+        }
+
+        peer = us->peers;
+
+        for (j = 0; j < us->npeers; j++) {
+            if (peer[j].name == state[i].peer
+                || (peer[j].name->len == state[i].peer->len
+                    && ngx_strncmp(peer[j].name->data, state[i].peer->data,
+                                   state[i].peer->len)
+                       == 0))
+            {
+                break;
+            }
+        }
+
+        if (j == us->npeers) {
+            continue;
+        }
+
+        c = (ngx_http_status_counters_t *)
+                (base + peer[j].slot * sh->stride);
+
+        if (state[i].header_time == (ngx_msec_t) -1) {
+            c->fails++;
+        }
+
+        ms = (state[i].response_time == (ngx_msec_t) -1)
+             ? -1 : (ngx_msec_int_t) state[i].response_time;
+
+        ngx_http_status_account(c, state[i].status, state[i].bytes_received,
+                                state[i].bytes_sent, ms, tp->sec);
+
+        if (state[i].connect_time != (ngx_msec_t) -1) {
+            ngx_http_status_record(&c->connect,
+                                   (ngx_msec_int_t) state[i].connect_time);
+        }
+
+        if (state[i].header_time != (ngx_msec_t) -1) {
+            ngx_http_status_record(&c->header,
+                                   (ngx_msec_int_t) state[i].header_time);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_status_account(ngx_http_status_counters_t *c, ngx_uint_t status,
+    off_t received, off_t sent, ngx_msec_int_t ms, time_t now)
+{
+    ngx_http_status_second_t  *s;
+
+    c->requests++;
+
+    if (status >= 100 && status < 600) {
+        c->responses[status / 100 - 1]++;
+    }
+
+    c->received += received;
+    c->sent += sent;
+
+    if (ms >= 0) {
+        ngx_http_status_record(&c->time, ms);
+    }
+
+    s = &c->window[now % NGX_HTTP_STATUS_WINDOW];
+
+    if (s->sec != now) {
+        s->sec = now;
+        s->requests = 0;
+        s->errors = 0;
+    }
+
+    s->requests++;
+
+    /* failed upstream attempts are reported as 502 or 504 */
+
+    if (status >= 500) {
+        s->errors++;
+    }
+}
+
+
+static void
+ngx_http_status_record(ngx_http_status_histogram_t *h, ngx_msec_int_t ms)
+{
+    h->sum += ms;
+    h->buckets[ngx_http_status_bucket(ms)]++;
+}
+
+
+static ngx_http_status_counters_t *
+ngx_http_status_collect(ngx_http_request_t *r,
+    ngx_http_status_main_conf_t *mcf)
+{
+    time_t                       now;
+    u_char                      *base;
+    ngx_uint_t                   i, n, w;
+    ngx_http_status_shctx_t     *sh;
+    ngx_http_status_second_t    *s, *a;
+    ngx_http_status_counters_t  *agg, *c;
+
+    sh = mcf->sh;
+    now = ngx_time();
+
+    agg = ngx_pcalloc(r->pool,
+                      sh->nslots * sizeof(ngx_http_status_counters_t));
+    if (agg == NULL) {
+        return NULL;
+    }
+
+    for (w = 0; w < sh->workers; w++) {
+        base = sh->counters + w * sh->nslots * sh->stride;
+
+        for (n = 0; n < sh->nslots; n++) {
+            c = (ngx_http_status_counters_t *) (base + n * sh->stride);
+
+            agg[n].requests += c->requests;
+
+            for (i = 0; i < 5; i++) {
+                agg[n].responses[i] += c->responses[i];
+            }
+
+            agg[n].fails += c->fails;
+            agg[n].received += c->received;
+            agg[n].sent += c->sent;
+            agg[n].cpu += c->cpu;
+            agg[n].pool += c->pool;
+
+            agg[n].time.sum += c->time.sum;
+            agg[n].connect.sum += c->connect.sum;
+            agg[n].header.sum += c->header.sum;
+
+            for (i = 0; i < NGX_HTTP_STATUS_BUCKETS; i++) {
+                agg[n].time.buckets[i] += c->time.buckets[i];
+                agg[n].connect.buckets[i] += c->connect.buckets[i];
+                agg[n].header.buckets[i] += c->header.buckets[i];
+            }
+
+            /* only the complete seconds of the window are kept */
+
+            for (i = 0; i < NGX_HTTP_STATUS_WINDOW; i++) {
+                s = &c->window[i];
+
+                if (s->sec >= now || now - s->sec >= NGX_HTTP_STATUS_WINDOW) {
+                    continue;
+                }
+
+                a = &agg[n].window[i];
+
+                a->sec = s->sec;
+                a->requests += s->requests;
+                a->errors += s->errors;
+            }
+        }
+    }
+
+    return agg;
+}
+
+
+static ngx_uint_t
+ngx_http_status_bucket(ngx_msec_int_t ms)
+{
+    ngx_uint_t  e;
+
+    if (ms < NGX_HTTP_STATUS_LINEAR) {
+        return ms;
+    }
+
+    for (e = 3; (ms >> (e + 1)) != 0; e++) {
+        if (e == NGX_HTTP_STATUS_MAX_EXP) {
+            return NGX_HTTP_STATUS_BUCKETS - 1;
+        }
+    }
+
+    return NGX_HTTP_STATUS_LINEAR + (e - 3) * 4 + ((ms >> (e - 2)) & 3);
+}
+
+
+static uint64_t
+ngx_http_status_bucket_start(ngx_uint_t n)
+{
+    ngx_uint_t  e;
+
+    if (n < NGX_HTTP_STATUS_LINEAR) {
+        return n;
+    }
+
+    n -= NGX_HTTP_STATUS_LINEAR;
+    e = n / 4 + 3;
+
+    return (uint64_t) (4 + n % 4) << (e - 2);
+}
+
+
+static uint64_t
+ngx_http_status_percentile(ngx_http_status_histogram_t *h, ngx_uint_t permille)
+{
+    uint64_t    count, target;
+    ngx_uint_t  i;
+
+    count = 0;
+
+    for (i = 0; i < NGX_HTTP_STATUS_BUCKETS; i++) {
+        count += h->buckets[i];
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    target = (count * permille + 999) / 1000;
+    count = 0;
+
+    for (i = 0; i < NGX_HTTP_STATUS_BUCKETS - 1; i++) {
+        count += h->buckets[i];
+
+        if (count >= target) {
+            break;
+        }
+    }
+
+    /* the largest value the bucket holds */
+
+    return ngx_http_status_bucket_start(i + 1) - 1;
+}
+
+
+static uint64_t
+ngx_http_status_get_rate(ngx_http_status_counters_t *c, size_t offset)
+{
+    uint64_t    count;
+    ngx_uint_t  i;
+
+    count = 0;
+
+    for (i = 0; i < NGX_HTTP_STATUS_WINDOW; i++) {
+        count += *(uint32_t *) ((u_char *) &c->window[i] + offset);
+    }
+
+    /* per second, in hundredths */
+
+    return count * 100 / (NGX_HTTP_STATUS_WINDOW - 1);
+}
+
+
+static ngx_int_t
+ngx_http_status_handler(ngx_http_request_t *r)
+{
+    size_t                        size;
+    ngx_int_t                     rc;
+    ngx_buf_t                    *b;
+    ngx_uint_t                    i;
+    ngx_chain_t                   out;
+    ngx_list_part_t              *part;
+    ngx_shm_zone_t               *shm_zone;
+    ngx_http_status_loc_conf_t   *slcf;
+    ngx_http_status_counters_t   *agg;
+    ngx_http_status_main_conf_t  *smcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_status_module);
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_status_module);
+
+    if (slcf->format == NGX_HTTP_STATUS_PROM) {
+        ngx_str_set(&r->headers_out.content_type,
+                    "text/plain; version=0.0.4");
+
+    } else {
+        ngx_str_set(&r->headers_out.content_type, "application/json");
+    }
+
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    agg = ngx_http_status_collect(r, smcf);
+    if (agg == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /*
+     * a slot takes at most about 90 lines in either format,
+     * each of them is well below 128 bytes plus the slot labels
+     */
+
+    size = 1024;
+
+    for (i = 0; i < smcf->nslots; i++) {
+        size += 90 * (128 + smcf->labels[i].len);
+    }
+
+    /* and an event loop about 62 lines and 2 per slow handler */
+
+    for (i = 0; ngx_event_loop_stat((ngx_cycle_t *) ngx_cycle, i); i++) {
+        size += (62 + 2 * NGX_EVENT_LOOP_HANDLERS) * 128;
+    }
+
+    /* and a listening socket 2 lines plus the address */
+
+    size += ngx_cycle->listening.nelts * 2 * (128 + NGX_SOCKADDR_STRLEN);
+
+    /*
+     * and a shared zone 3 lines for the lock plus at most 30 for the slab
+     * pages and slots, each with the zone name
+     */
+
+    part = &((ngx_cycle_t *) ngx_cycle)->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        size += 33 * (128 + shm_zone[i].shm.name.len);
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (slcf->format == NGX_HTTP_STATUS_PROM) {
+        b->last = ngx_http_status_prom(b->last, smcf, agg);
+
+    } else {
+        b->last = ngx_http_status_json(b->last, smcf, agg);
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static u_char *
+ngx_http_status_json(u_char *p, ngx_http_status_main_conf_t *mcf,
+    ngx_http_status_counters_t *agg)
+{
+    ngx_str_t                   *zone;
+    ngx_uint_t                   i, j;
+    ngx_http_status_peer_t      *peer;
+    ngx_http_status_shctx_t     *sh;
+    ngx_http_status_upstream_t  *us;
+
+    sh = mcf->sh;
+
+    p = ngx_sprintf(p, "{\"version\":1,\"nginx_version\":\"" NGINX_VERSION
+                    "\",\"workers\":%ui,\"server_zones\":{", sh->workers);
+
+    zone = mcf->zones.elts;
+
+    for (i = 0; i < mcf->zones.nelts; i++) {
+        p = ngx_sprintf(p, "%s\"%V\":{", i ? "," : "", &zone[i]);
+        p = ngx_http_status_json_counters(p, &agg[i], "request_time");
+        p = ngx_sprintf(p, ",\"cpu_time\":%uL,\"pool_bytes\":%uL}",
+                        agg[i].cpu, agg[i].pool);
+    }
+
+    p = ngx_sprintf(p, "},\"upstreams\":{");
+
+    us = mcf->upstreams.elts;
+
+    for (i = 0; i < mcf->upstreams.nelts; i++) {
+        p = ngx_sprintf(p, "%s\"%V\":{\"peers\":[", i ? "," : "", &us[i].name);
+
+        peer = us[i].peers;
+
+        for (j = 0; j < us[i].npeers; j++) {
+            p = ngx_sprintf(p, "%s{\"server\":\"%V\",\"backup\":%s,",
+                            j ? "," : "", peer[j].name,
+                            peer[j].backup ? "true" : "false");
+
+            p = ngx_http_status_json_counters(p, &agg[peer[j].slot],
+                                              "response_time");
+            *p++ = ',';
+
+            p = ngx_http_status_json_histogram(p, &agg[peer[j].slot].connect,
+                                               "connect_time");
+            *p++ = ',';
+
+            p = ngx_http_status_json_histogram(p, &agg[peer[j].slot].header,
+                                               "header_time");
+
+            p = ngx_sprintf(p, ",\"fails\":%uL}", agg[peer[j].slot].fails);
+        }
+
+        p = ngx_sprintf(p, "]}");
+    }
+
+    p = ngx_sprintf(p, "}");
+
+    p = ngx_http_status_json_loops(p);
+    p = ngx_http_status_json_listeners(p);
+    p = ngx_http_status_json_locks(p);
+    p = ngx_http_status_json_slabs(p);
+
+    return ngx_sprintf(p, "}\n");
+}
+
+
+static u_char *
+ngx_http_status_json_loops(u_char *p)
+{
+    ngx_uint_t                 i, n;
+    ngx_event_loop_stat_t     *st;
+    ngx_event_loop_handler_t   h[NGX_EVENT_LOOP_HANDLERS];
+
+    if (ngx_event_loop_stat((ngx_cycle_t *) ngx_cycle, 0) == NULL) {
+        return p;
+    }
+
+    p = ngx_sprintf(p, ",\"event_loops\":[");
+
+    for (n = 0; /* void */ ; n++) {
+
+        st = ngx_event_loop_stat((ngx_cycle_t *) ngx_cycle, n);
+        if (st == NULL) {
+            break;
+        }
+
+        p = ngx_sprintf(p, "%s{\"worker\":%ui,\"pid\":%P,\"iterations\":%uL,"
+                        "\"events\":%uL,\"max_events\":%uL,\"accepted\":%uL,"
+                        "\"accept_limited\":%uL,\"read_deferred\":%uL,",
+                        n ? "," : "", n, st->pid, st->iterations,
+                        st->events, st->max_events, st->accepted,
+                        st->accept_limited, st->read_deferred);
+
+        p = ngx_sprintf(p, "\"udp\":{\"recv_calls\":%uL,\"received\":%uL,"
+                        "\"send_calls\":%uL,\"sent\":%uL},",
+                        st->udp_recv_calls, st->udp_received,
+                        st->udp_send_calls, st->udp_sent);
+
+        p = ngx_sprintf(p, "\"idle\":{\"connections\":%uL,\"memory\":%uL},"
+                        "\"parked\":{\"connections\":%uL,\"memory\":%uL},",
+                        st->idle, st->idle_memory,
+                        st->parked, st->parked_memory);
+
+        p = ngx_sprintf(p, "\"prefetch\":{\"prefetched\":%uL,\"used\":%uL,"
+                        "\"wasted\":%uL},",
+                        st->prefetched, st->prefetch_used,
+                        st->prefetch_wasted);
+
+        p = ngx_sprintf(p, "\"ssl\":{\"handshakes\":%uL,"
+                        "\"handshake_time\":%uL.%03uL,\"resumed\":%uL,"
+                        "\"resumed_time\":%uL.%03uL,\"queued\":%uL,"
+                        "\"rejected\":%uL},",
+                        st->ssl_handshakes,
+                        st->ssl_handshake_time / 1000,
+                        st->ssl_handshake_time % 1000,
+                        st->ssl_resumed,
+                        st->ssl_resumed_time / 1000,
+                        st->ssl_resumed_time % 1000,
+                        st->ssl_queued, st->ssl_rejected);
+
+        p = ngx_sprintf(p, "\"spin\":{\"spins\":%uL,\"hits\":%uL,"
+                        "\"time\":%uL.%03uL},",
+                        st->spins, st->spin_hits,
+                        st->spin_time / 1000, st->spin_time % 1000);
+
+        p = ngx_sprintf(p, "\"wait\":%uL.%03uL,\"busy\":%uL.%03uL,"
+                        "\"max\":%uL.%03uL,\"stalls\":%uL,\"histogram\":{",
+                        st->wait / 1000, st->wait % 1000,
+                        st->busy / 1000, st->busy % 1000,
+                        st->max / 1000, st->max % 1000, st->stalls);
+
+        for (i = 0; i < NGX_EVENT_LOOP_BUCKETS; i++) {
+            p = ngx_sprintf(p, "%s\"%s\":%uL", i ? "," : "",
+                            ngx_http_status_loop_bounds[i],
+                            st->histogram[i]);
+        }
+
+        p = ngx_sprintf(p, "},\"slow_handlers\":[");
+
+        ngx_memcpy(h, st->handlers, sizeof(h));
+        ngx_sort(h, NGX_EVENT_LOOP_HANDLERS, sizeof(ngx_event_loop_handler_t),
+                 ngx_http_status_cmp_handlers);
+
+        for (i = 0; i < NGX_EVENT_LOOP_HANDLERS && h[i].handler; i++) {
+            p = ngx_sprintf(p, "%s{\"handler\":\"%p\",\"calls\":%uL,"
+                            "\"time\":%uL.%03uL,\"max\":%uL.%03uL}",
+                            i ? "," : "", h[i].handler, h[i].calls,
+                            h[i].time / 1000, h[i].time % 1000,
+                            h[i].max / 1000, h[i].max % 1000);
+        }
+
+        p = ngx_sprintf(p, "]}");
+    }
+
+    return ngx_sprintf(p, "]");
+}
+
+
+static u_char *
+ngx_http_status_json_listeners(u_char *p)
+{
+    uint64_t          overflows, drops;
+    ngx_uint_t        i, n, queue, backlog;
+    ngx_listening_t  *ls;
+
+    p = ngx_sprintf(p, ",\"listeners\":[");
+
+    ls = ngx_cycle->listening.elts;
+
+    for (i = 0, n = 0; i < ngx_cycle->listening.nelts; i++) {
+
+        if (ngx_event_accept_queue(&ls[i], &queue, &backlog) != NGX_OK) {
+            continue;
+        }
+
+        p = ngx_sprintf(p, "%s{\"address\":\"%V\",", n++ ? "," : "",
+                        &ls[i].addr_text);
+
+#if (NGX_HAVE_REUSEPORT)
+        if (ls[i].reuseport) {
+            p = ngx_sprintf(p, "\"worker\":%ui,", ls[i].worker);
+        }
+#endif
+
+        p = ngx_sprintf(p, "\"queue\":%ui,\"backlog\":%ui}", queue, backlog);
+    }
+
+    p = ngx_sprintf(p, "]");
+
+    if (ngx_event_listen_overflows(&overflows, &drops) == NGX_OK) {
+        p = ngx_sprintf(p, ",\"listen_overflows\":%uL,\"listen_drops\":%uL",
+                        overflows, drops);
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_json_locks(u_char *p)
+{
+    ngx_uint_t         i, n;
+    ngx_list_part_t   *part;
+    ngx_shm_zone_t    *shm_zone;
+    ngx_slab_pool_t   *shpool;
+    ngx_shmtx_stat_t  *st;
+
+    p = ngx_sprintf(p, ",\"locks\":{");
+
+    n = 0;
+
+    if (ngx_accept_mutex_ptr) {
+        st = ngx_accept_mutex.stat;
+
+        p = ngx_sprintf(p, "\"accept_mutex\":{\"acquired\":%uL,"
+                        "\"contended\":%uL,\"wait\":%uL.%03uL}",
+                        st->acquired, st->contended,
+                        st->wait_time / 1000000, st->wait_time / 1000 % 1000);
+        n++;
+    }
+
+    part = &((ngx_cycle_t *) ngx_cycle)->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        shpool = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+        st = &shpool->lock.stat;
+
+        p = ngx_sprintf(p, "%s\"%V\":{\"acquired\":%uL,\"contended\":%uL,"
+                        "\"wait\":%uL.%03uL}",
+                        n++ ? "," : "", &shm_zone[i].shm.name,
+                        st->acquired, st->contended,
+                        st->wait_time / 1000000, st->wait_time / 1000 % 1000);
+    }
+
+    return ngx_sprintf(p, "}");
+}
+
+
+static u_char *
+ngx_http_status_json_slabs(u_char *p)
+{
+    ngx_uint_t         i, j, n, z, pages, cached;
+    ngx_list_part_t   *part;
+    ngx_shm_zone_t    *shm_zone;
+    ngx_slab_pool_t   *shpool;
+    ngx_slab_stat_t   *st;
+
+    /*
+     * "free" chunks of a slot are those in its partially used pages,
+     * chunks held in worker magazines are reported as "cached"
+     */
+
+    p = ngx_sprintf(p, ",\"slabs\":{");
+
+    z = 0;
+
+    part = &((ngx_cycle_t *) ngx_cycle)->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        shpool = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+        pages = shpool->last - shpool->pages;
+
+        p = ngx_sprintf(p, "%s\"%V\":{\"pages\":{\"used\":%ui,\"free\":%ui},"
+                        "\"slots\":{",
+                        z++ ? "," : "", &shm_zone[i].shm.name,
+                        pages - shpool->pfree, shpool->pfree);
+
+        n = 0;
+
+        for (j = 0; j < ngx_pagesize_shift - shpool->min_shift; j++) {
+            st = &shpool->stats[j];
+
+            if (st->reqs == 0 && st->total == 0) {
+                continue;
+            }
+
+            cached = st->cached;
+
+            p = ngx_sprintf(p, "%s\"%uz\":{\"used\":%ui,\"free\":%ui,"
+                            "\"cached\":%ui,\"reqs\":%ui,\"fails\":%ui}",
+                            n++ ? "," : "", shpool->min_size << j,
+                            st->used - cached, st->total - st->used, cached,
+                            st->reqs, st->fails);
+        }
+
+        p = ngx_sprintf(p, "}}");
+    }
+
+    return ngx_sprintf(p, "}");
+}
+
+
+static ngx_int_t
+ngx_http_status_cmp_handlers(const void *one, const void *two)
+{
+    ngx_event_loop_handler_t  *first, *second;
+
+    first = (ngx_event_loop_handler_t *) one;
+    second = (ngx_event_loop_handler_t *) two;
+
+    if (first->max == second->max) {
+        return 0;
+    }
+
+    return (first->max < second->max) ? 1 : -1;
+}
+
+
+static u_char *
+ngx_http_status_json_counters(u_char *p, ngx_http_status_counters_t *c,
+    char *time)
+{
+    uint64_t  requests, errors;
+
+    requests = ngx_http_status_get_rate(c,
+                               offsetof(ngx_http_status_second_t, requests));
+    errors = ngx_http_status_get_rate(c,
+                               offsetof(ngx_http_status_second_t, errors));
+
+    p = ngx_sprintf(p, "\"requests\":%uL,\"responses\":{\"1xx\":%uL,"
+                    "\"2xx\":%uL,\"3xx\":%uL,\"4xx\":%uL,\"5xx\":%uL},"
+                    "\"received\":%uL,\"sent\":%uL,"
+                    "\"request_rate\":%uL.%02uL,\"error_rate\":%uL.%02uL,",
+                    c->requests, c->responses[0], c->responses[1],
+                    c->responses[2], c->responses[3], c->responses[4],
+                    c->received, c->sent,
+                    requests / 100, requests % 100, errors / 100, errors % 100);
+
+    return ngx_http_status_json_histogram(p, &c->time, time);
+}
+
+
+static u_char *
+ngx_http_status_json_histogram(u_char *p, ngx_http_status_histogram_t *h,
+    char *name)
+{
+    return ngx_sprintf(p, "\"%s\":{\"sum\":%uL,\"p50\":%uL,\"p90\":%uL,"
+                       "\"p99\":%uL,\"p999\":%uL}",
+                       name, h->sum,
+                       ngx_http_status_percentile(h, 500),
+                       ngx_http_status_percentile(h, 900),
+                       ngx_http_status_percentile(h, 990),
+                       ngx_http_status_percentile(h, 999));
+}
+
+
+static u_char *
+ngx_http_status_prom(u_char *p, ngx_http_status_main_conf_t *mcf,
+    ngx_http_status_counters_t *agg)
+{
+    ngx_uint_t                 from, to;
+    ngx_http_status_metric_t  *m;
+
+    for (m = ngx_http_status_metrics; m->name; m++) {
+
+        if (m->upstream) {
+            from = mcf->zones.nelts;
+            to = mcf->nslots;
+
+        } else {
+            from = 0;
+            to = mcf->zones.nelts;
+        }
+
+        switch (m->type) {
+
+        case NGX_HTTP_STATUS_HISTOGRAM:
+            p = ngx_http_status_prom_histogram(p, m->name, m->offset,
+                                               mcf->labels, agg, from, to);
+            break;
+
+        case NGX_HTTP_STATUS_RATE:
+            p = ngx_http_status_prom_rate(p, m->name, m->offset,
+                                          mcf->labels, agg, from, to);
+            break;
+
+        default: /* NGX_HTTP_STATUS_COUNTER */
+            p = ngx_http_status_prom_counter(p, m->name, m->offset,
+                                             mcf->labels, agg, from, to);
+        }
+    }
+
+    p = ngx_http_status_prom_loops(p);
+    p = ngx_http_status_prom_listeners(p);
+
+    p = ngx_http_status_prom_locks(p);
+
+    return ngx_http_status_prom_slabs(p);
+}
+
+
+static u_char *
+ngx_http_status_prom_loops(u_char *p)
+{
+    uint64_t                        v, count;
+    ngx_uint_t                      i, n;
+    ngx_event_loop_stat_t          *st;
+    ngx_http_status_loop_metric_t  *m;
+
+    if (ngx_event_loop_stat((ngx_cycle_t *) ngx_cycle, 0) == NULL) {
+        return p;
+    }
+
+    for (m = ngx_http_status_loop_metrics; m->name; m++) {
+
+        p = ngx_sprintf(p, "# TYPE %s %s\n", m->name, m->type);
+
+        for (n = 0; /* void */ ; n++) {
+
+            st = ngx_event_loop_stat((ngx_cycle_t *) ngx_cycle, n);
+            if (st == NULL) {
+                break;
+            }
+
+            v = *(uint64_t *) ((u_char *) st + m->offset);
+
+            if (m->usec) {
+                p = ngx_sprintf(p, "%s{worker=\"%ui\"} %uL.%06uL\n",
+                                m->name, n, v / 1000000, v % 1000000);
+
+            } else {
+                p = ngx_sprintf(p, "%s{worker=\"%ui\"} %uL\n",
+                                m->name, n, v);
+            }
+        }
+    }
+
+    p = ngx_sprintf(p, "# TYPE nginx_event_loop_iteration_seconds histogram\n");
+
+    for (n = 0; /* void */ ; n++) {
+
+        st = ngx_event_loop_stat((ngx_cycle_t *) ngx_cycle, n);
+        if (st == NULL) {
+            break;
+        }
+
+        count = 0;
+
+        for (i = 0; i < NGX_EVENT_LOOP_BUCKETS; i++) {
+            count += st->histogram[i];
+
+            p = ngx_sprintf(p, "nginx_event_loop_iteration_seconds_bucket"
+                            "{worker=\"%ui\",le=\"%s\"} %uL\n",
+                            n, ngx_http_status_loop_le[i], count);
+        }
+
+        p = ngx_sprintf(p, "nginx_event_loop_iteration_seconds_sum"
+                        "{worker=\"%ui\"} %uL.%06uL\n"
+                        "nginx_event_loop_iteration_seconds_count"
+                        "{worker=\"%ui\"} %uL\n",
+                        n, st->busy / 1000000, st->busy % 1000000,
+                        n, count);
+    }
+
+    p = ngx_sprintf(p, "# TYPE nginx_event_loop_slow_handler_seconds_max"
+                    " gauge\n");
+
+    for (n = 0; /* void */ ; n++) {
+
+        st = ngx_event_loop_stat((ngx_cycle_t *) ngx_cycle, n);
+        if (st == NULL) {
+            break;
+        }
+
+        for (i = 0; i < NGX_EVENT_LOOP_HANDLERS; i++) {
+            if (st->handlers[i].handler == NULL) {
+                continue;
+            }
+
+            v = st->handlers[i].max;
+
+            p = ngx_sprintf(p, "nginx_event_loop_slow_handler_seconds_max"
+                            "{worker=\"%ui\",handler=\"%p\"} %uL.%06uL\n",
+                            n, st->handlers[i].handler,
+                            v / 1000000, v % 1000000);
+        }
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_prom_listeners(u_char *p)
+{
+    uint64_t          overflows, drops;
+    ngx_uint_t        i, k, queue, backlog;
+    ngx_listening_t  *ls;
+
+    static char      *names[] = {
+        "nginx_listen_queue", "nginx_listen_backlog"
+    };
+
+    ls = ngx_cycle->listening.elts;
+
+    for (k = 0; k < 2; k++) {
+
+        p = ngx_sprintf(p, "# TYPE %s gauge\n", names[k]);
+
+        for (i = 0; i < ngx_cycle->listening.nelts; i++) {
+
+            if (ngx_event_accept_queue(&ls[i], &queue, &backlog) != NGX_OK) {
+                continue;
+            }
+
+            p = ngx_sprintf(p, "%s{listen=\"%V\"", names[k],
+                            &ls[i].addr_text);
+
+#if (NGX_HAVE_REUSEPORT)
+            if (ls[i].reuseport) {
+                p = ngx_sprintf(p, ",worker=\"%ui\"", ls[i].worker);
+            }
+#endif
+
+            p = ngx_sprintf(p, "} %ui\n", k ? backlog : queue);
+        }
+    }
+
+    if (ngx_event_listen_overflows(&overflows, &drops) == NGX_OK) {
+        p = ngx_sprintf(p, "# TYPE nginx_listen_overflows_total counter\n"
+                        "nginx_listen_overflows_total %uL\n"
+                        "# TYPE nginx_listen_drops_total counter\n"
+                        "nginx_listen_drops_total %uL\n",
+                        overflows, drops);
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_prom_locks(u_char *p)
+{
+    uint64_t           v;
+    ngx_uint_t         i, k;
+    ngx_list_part_t   *part;
+    ngx_shm_zone_t    *shm_zone;
+    ngx_slab_pool_t   *shpool;
+    ngx_shmtx_stat_t  *st;
+
+    static char       *names[] = {
+        "nginx_lock_acquired_total",
+        "nginx_lock_contended_total",
+        "nginx_lock_wait_seconds_total"
+    };
+
+    for (k = 0; k < 3; k++) {
+
+        p = ngx_sprintf(p, "# TYPE %s counter\n", names[k]);
+
+        if (ngx_accept_mutex_ptr) {
+            st = ngx_accept_mutex.stat;
+            v = (k == 0) ? st->acquired : (k == 1) ? st->contended
+                                                   : st->wait_time;
+
+            if (k == 2) {
+                p = ngx_sprintf(p, "%s{zone=\"accept_mutex\"} %uL.%06uL\n",
+                                names[k], v / 1000000000,
+                                v / 1000 % 1000000);
+
+            } else {
+                p = ngx_sprintf(p, "%s{zone=\"accept_mutex\"} %uL\n",
+                                names[k], v);
+            }
+        }
+
+        part = &((ngx_cycle_t *) ngx_cycle)->shared_memory.part;
+        shm_zone = part->elts;
+
+        for (i = 0; /* void */ ; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                shm_zone = part->elts;
+                i = 0;
+            }
+
+            shpool = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+            st = &shpool->lock.stat;
+
+            v = (k == 0) ? st->acquired : (k == 1) ? st->contended
+                                                   : st->wait_time;
+
+            if (k == 2) {
+                p = ngx_sprintf(p, "%s{zone=\"%V\"} %uL.%06uL\n",
+                                names[k], &shm_zone[i].shm.name,
+                                v / 1000000000, v / 1000 % 1000000);
+
+            } else {
+                p = ngx_sprintf(p, "%s{zone=\"%V\"} %uL\n",
+                                names[k], &shm_zone[i].shm.name, v);
+            }
+        }
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_prom_slabs(u_char *p)
+{
+    ngx_uint_t         i, j, k, s, v[3];
+    ngx_list_part_t   *part;
+    ngx_shm_zone_t    *shm_zone;
+    ngx_slab_pool_t   *shpool;
+    ngx_slab_stat_t   *st;
+
+    static char       *states[] = { "used", "free", "cached" };
+    static char       *types[] = { "gauge", "gauge", "counter" };
+    static char       *names[] = {
+        "nginx_slab_pages",
+        "nginx_slab_chunks",
+        "nginx_slab_failures_total"
+    };
+
+    for (k = 0; k < 3; k++) {
+
+        p = ngx_sprintf(p, "# TYPE %s %s\n", names[k], types[k]);
+
+        part = &((ngx_cycle_t *) ngx_cycle)->shared_memory.part;
+        shm_zone = part->elts;
+
+        for (i = 0; /* void */ ; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                shm_zone = part->elts;
+                i = 0;
+            }
+
+            shpool = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+            if (k == 0) {
+                v[0] = shpool->last - shpool->pages - shpool->pfree;
+                v[1] = shpool->pfree;
+
+                for (s = 0; s < 2; s++) {
+                    p = ngx_sprintf(p, "%s{zone=\"%V\",state=\"%s\"} %ui\n",
+                                    names[k], &shm_zone[i].shm.name,
+                                    states[s], v[s]);
+                }
+
+                continue;
+            }
+
+            for (j = 0; j < ngx_pagesize_shift - shpool->min_shift; j++) {
+                st = &shpool->stats[j];
+
+                if (st->reqs == 0 && st->total == 0) {
+                    continue;
+                }
+
+                if (k == 2) {
+                    p = ngx_sprintf(p, "%s{zone=\"%V\",size=\"%uz\"} %ui\n",
+                                    names[k], &shm_zone[i].shm.name,
+                                    shpool->min_size << j, st->fails);
+                    continue;
+                }
+
+                v[2] = st->cached;
+                v[0] = st->used - v[2];
+                v[1] = st->total - st->used;
+
+                for (s = 0; s < 3; s++) {
+                    p = ngx_sprintf(p, "%s{zone=\"%V\",size=\"%uz\","
+                                    "state=\"%s\"} %ui\n",
+                                    names[k], &shm_zone[i].shm.name,
+                                    shpool->min_size << j, states[s], v[s]);
+                }
+            }
+        }
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_prom_counter(u_char *p, char *name, size_t offset,
+    ngx_str_t *labels, ngx_http_status_counters_t *agg, ngx_uint_t from,
+    ngx_uint_t to)
+{
+    uint64_t    *v;
+    ngx_uint_t   i, n;
+
+    if (from == to) {
+        return p;
+    }
+
+    p = ngx_sprintf(p, "# TYPE %s counter\n", name);
+
+    for (n = from; n < to; n++) {
+        v = (uint64_t *) ((u_char *) &agg[n] + offset);
+
+        if (offset == offsetof(ngx_http_status_counters_t, cpu)) {
+            p = ngx_sprintf(p, "%s{%V} %uL.%06uL\n",
+                            name, &labels[n], *v / 1000000, *v % 1000000);
+            continue;
+        }
+
+        if (offset != offsetof(ngx_http_status_counters_t, responses)) {
+            p = ngx_sprintf(p, "%s{%V} %uL\n", name, &labels[n], *v);
+            continue;
+        }
+
+        for (i = 0; i < 5; i++) {
+            p = ngx_sprintf(p, "%s{%V,code=\"%uixx\"} %uL\n",
+                            name, &labels[n], i + 1, v[i]);
+        }
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_prom_histogram(u_char *p, char *name, size_t offset,
+    ngx_str_t *labels, ngx_http_status_counters_t *agg, ngx_uint_t from,
+    ngx_uint_t to)
+{
+    uint64_t                      count, le;
+    ngx_uint_t                    i, k, n, last;
+    ngx_http_status_histogram_t  *h;
+
+    if (from == to) {
+        return p;
+    }
+
+    p = ngx_sprintf(p, "# TYPE %s histogram\n", name);
+
+    for (n = from; n < to; n++) {
+        h = (ngx_http_status_histogram_t *) ((u_char *) &agg[n] + offset);
+
+        count = 0;
+        i = 0;
+
+        /*
+         * the histogram buckets are exported at power of two milliseconds,
+         * which all fall on bucket boundaries
+         */
+
+        for (k = 0; k <= NGX_HTTP_STATUS_MAX_EXP; k++) {
+            le = (uint64_t) 1 << k;
+            last = ngx_http_status_bucket(le);
+
+            while (i < last) {
+                count += h->buckets[i++];
+            }
+
+            p = ngx_sprintf(p, "%s_bucket{%V,le=\"%uL.%03uL\"} %uL\n",
+                            name, &labels[n], le / 1000, le % 1000, count);
+        }
+
+        while (i < NGX_HTTP_STATUS_BUCKETS) {
+            count += h->buckets[i++];
+        }
+
+        p = ngx_sprintf(p, "%s_bucket{%V,le=\"+Inf\"} %uL\n"
+                        "%s_sum{%V} %uL.%03uL\n"
+                        "%s_count{%V} %uL\n",
+                        name, &labels[n], count,
+                        name, &labels[n], h->sum / 1000, h->sum % 1000,
+                        name, &labels[n], count);
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_prom_rate(u_char *p, char *name, size_t offset,
+    ngx_str_t *labels, ngx_http_status_counters_t *agg, ngx_uint_t from,
+    ngx_uint_t to)
+{
+    uint64_t    v;
+    ngx_uint_t  n;
+
+    if (from == to) {
+        return p;
+    }
+
+    p = ngx_sprintf(p, "# TYPE %s gauge\n", name);
+
+    for (n = from; n < to; n++) {
+        v = ngx_http_status_get_rate(&agg[n], offset);
+
+        p = ngx_sprintf(p, "%s{%V} %uL.%02uL\n",
+                        name, &labels[n], v / 100, v % 100);
+    }
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_http_status_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_status_main_conf_t  *osmcf = data;
+
+    size_t                        size;
+    ngx_uint_t                    i;
+    ngx_slab_pool_t              *shpool;
+    ngx_http_status_shctx_t      *sh;
+    ngx_http_status_main_conf_t  *smcf;
+
+    smcf = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (osmcf) {
+        sh = osmcf->sh;
+
+        /* keep the counters over reloads unless the layout has changed */
+
+        if (sh->workers == smcf->workers && sh->nslots == smcf->nslots) {
+
+            for (i = 0; i < smcf->nslots; i++) {
+                if (smcf->labels[i].len != osmcf->labels[i].len
+                    || ngx_strncmp(smcf->labels[i].data,
+                                   osmcf->labels[i].data,
+                                   smcf->labels[i].len)
+                       != 0)
+                {
+                    break;
+                }
+            }
+
+            if (i == smcf->nslots) {
+                smcf->sh = sh;
+                return NGX_OK;
+            }
+        }
+
+        ngx_slab_free(shpool, sh->counters);
+
+    } else if (shm_zone->shm.exists) {
+        smcf->sh = shpool->data;
+        return NGX_OK;
+
+    } else {
+        sh = ngx_slab_alloc(shpool, sizeof(ngx_http_status_shctx_t));
+        if (sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        shpool->data = sh;
+    }
+
+    sh->workers = smcf->workers;
+    sh->nslots = smcf->nslots;
+    sh->stride = ngx_align(sizeof(ngx_http_status_counters_t),
+                           NGX_CPU_CACHE_LINE);
+
+    size = ngx_max(sh->workers * sh->nslots, 1) * sh->stride;
+
+    /* large slab allocations are page aligned */
+
+    sh->counters = ngx_slab_calloc(shpool, ngx_max(size, ngx_pagesize));
+    if (sh->counters == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "could not allocate status counters");
+        return NGX_ERROR;
+    }
+
+    smcf->sh = sh;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_status_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_status_main_conf_t  *smcf;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_status_main_conf_t));
+    if (smcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     smcf->enabled = 0;
+     *     smcf->labels = NULL;
+     *     smcf->nslots = 0;
+     *     smcf->workers = 0;
+     *     smcf->shm_zone = NULL;
+     *     smcf->sh = NULL;
+     */
+
+    if (ngx_array_init(&smcf->zones, cf->pool, 4, sizeof(ngx_str_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&smcf->upstreams, cf->pool, 4,
+                       sizeof(ngx_http_status_upstream_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return smcf;
+}
+
+
+static void *
+ngx_http_status_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_status_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_status_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->format = 0;
+     */
+
+    conf->zone = NGX_CONF_UNSET_UINT;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_status_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_status_loc_conf_t *prev = parent;
+    ngx_http_status_loc_conf_t *conf = child;
+
+    ngx_conf_merge_uint_value(conf->zone, prev->zone, NGX_HTTP_STATUS_NONE);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_status_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_status_loc_conf_t *slcf = conf;
+
+    ngx_str_t                    *value, *zone;
+    ngx_uint_t                    i;
+    ngx_http_status_main_conf_t  *smcf;
+
+    if (slcf->zone != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        slcf->zone = NGX_HTTP_STATUS_NONE;
+        return NGX_CONF_OK;
+    }
+
+    /* zone names are output as is in both formats */
+
+    for (i = 0; i < value[1].len; i++) {
+        if (value[1].data[i] < 0x20 || value[1].data[i] == 0x7f
+            || value[1].data[i] == '"' || value[1].data[i] == '\\')
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid zone name \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_status_module);
+
+    smcf->enabled = 1;
+
+    zone = smcf->zones.elts;
+
+    for (i = 0; i < smcf->zones.nelts; i++) {
+        if (zone[i].len == value[1].len
+            && ngx_strncmp(zone[i].data, value[1].data, value[1].len) == 0)
+        {
+            slcf->zone = i;
+            return NGX_CONF_OK;
+        }
+    }
+
+    zone = ngx_array_push(&smcf->zones);
+    if (zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *zone = value[1];
+    slcf->zone = i;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_status_loc_conf_t *slcf = conf;
+
+    ngx_str_t                    *value;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_status_main_conf_t  *smcf;
+
+    if (slcf->format) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 1 || ngx_strcmp(value[1].data, "json") == 0) {
+        slcf->format = NGX_HTTP_STATUS_JSON;
+
+    } else if (ngx_strcmp(value[1].data, "prometheus") == 0) {
+        slcf->format = NGX_HTTP_STATUS_PROM;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_status_handler;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_status_module);
+    smcf->enabled = 1;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_status_init(ngx_conf_t *cf)
+{
+    size_t                        size;
+    u_char                       *p;
+    ngx_str_t                    *zone, name;
+    ngx_uint_t                    i, j;
+    ngx_core_conf_t              *ccf;
+    ngx_http_handler_pt          *h;
+    ngx_http_status_peer_t       *peer;
+    ngx_http_status_upstream_t   *us;
+    ngx_http_core_main_conf_t    *cmcf;
+    ngx_http_status_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_status_module);
+
+    if (!smcf->enabled) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_status_init_upstreams(cf, smcf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    smcf->labels = ngx_palloc(cf->pool, smcf->nslots * sizeof(ngx_str_t));
+    if (smcf->labels == NULL) {
+        return NGX_ERROR;
+    }
+
+    zone = smcf->zones.elts;
+
+    for (i = 0; i < smcf->zones.nelts; i++) {
+        p = ngx_pnalloc(cf->pool, sizeof("zone=\"\"") - 1 + zone[i].len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        smcf->labels[i].data = p;
+        smcf->labels[i].len = ngx_sprintf(p, "zone=\"%V\"", &zone[i]) - p;
+    }
+
+    us = smcf->upstreams.elts;
+
+    for (i = 0; i < smcf->upstreams.nelts; i++) {
+        peer = us[i].peers;
+
+        for (j = 0; j < us[i].npeers; j++) {
+            p = ngx_pnalloc(cf->pool, sizeof("upstream=\"\",peer=\"\"") - 1
+                                      + us[i].name.len + peer[j].name->len);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            smcf->labels[peer[j].slot].data = p;
+            smcf->labels[peer[j].slot].len =
+                           ngx_sprintf(p, "upstream=\"%V\",peer=\"%V\"",
+                                       &us[i].name, peer[j].name)
+                           - p;
+        }
+    }
+
+    /*
+     * the number of workers is only known at this point if
+     * "worker_processes" precedes "http", otherwise the zone is sized
+     * for a worker per CPU and checked in ngx_http_status_init_module()
+     */
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    if (ccf->worker_processes != NGX_CONF_UNSET) {
+        smcf->workers = ccf->worker_processes;
+
+    } else {
+        smcf->workers = ngx_ncpu;
+    }
+
+    smcf->workers = ngx_max(smcf->workers, 1);
+
+    size = ngx_max(smcf->workers * smcf->nslots, 1)
+           * ngx_align(sizeof(ngx_http_status_counters_t), NGX_CPU_CACHE_LINE)
+           + 8 * ngx_pagesize;
+
+    ngx_str_set(&name, "http_status");
+
+    smcf->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                           &ngx_http_status_module);
+    if (smcf->shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    smcf->shm_zone->init = ngx_http_status_init_zone;
+    smcf->shm_zone->data = smcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    if (smcf->zones.nelts) {
+        cmcf->cpu_accounting = 1;
+    }
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_status_log_handler;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_status_init_upstreams(ngx_conf_t *cf,
+    ngx_http_status_main_conf_t *smcf)
+{
+    ngx_uint_t                      i, n;
+    ngx_http_status_peer_t         *peer;
+    ngx_http_upstream_rr_peer_t    *rrp;
+    ngx_http_status_upstream_t     *us;
+    ngx_http_upstream_rr_peers_t   *peers, *backup;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    smcf->nslots = smcf->zones.nelts;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        peers = uscfp[i]->peer.data;
+
+        if (peers == NULL) {
+            continue;
+        }
+
+        backup = peers->next;
+
+        n = peers->number + (backup ? backup->number : 0);
+
+        us = ngx_array_push(&smcf->upstreams);
+        if (us == NULL) {
+            return NGX_ERROR;
+        }
+
+        us->name = uscfp[i]->host;
+        us->uscf = uscfp[i];
+        us->npeers = 0;
+
+        us->peers = ngx_palloc(cf->pool, n * sizeof(ngx_http_status_peer_t));
+        if (us->peers == NULL) {
+            return NGX_ERROR;
+        }
+
+        for ( /* void */ ; peers; peers = peers->next) {
+
+            for (rrp = peers->peer; rrp; rrp = rrp->next) {
+                peer = &us->peers[us->npeers++];
+
+                peer->name = &rrp->name;
+                peer->slot = smcf->nslots++;
+                peer->backup = (peers == backup);
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_status_init_module(ngx_cycle_t *cycle)
+{
+    ngx_core_conf_t              *ccf;
+    ngx_http_status_main_conf_t  *smcf;
+
+    smcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_status_module);
+
+    if (smcf == NULL || !smcf->enabled) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if ((ngx_uint_t) ccf->worker_processes > smcf->workers) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "status counters were allocated for %ui worker "
+                      "processes only, \"worker_processes\" should be "
+                      "specified before \"http\"", smcf->workers);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
@@ -88,6 +88,21 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     ngx_buf_t         *b;
     ngx_chain_t        out;
     ngx_atomic_int_t   ap, hn, ac, rq, rd, wr, wa;
+#if (NGX_THREADS || NGX_SSL || NGX_HTTP_CACHE)
+    ngx_uint_t                     i;
+#endif
+#if (NGX_THREADS)
+    ngx_array_t                   *stats;
+    ngx_thread_pool_stat_t        *st;
+#endif
+#if (NGX_SSL)
+    ngx_array_t                   *caches;
+    ngx_ssl_session_cache_stat_t  *sc;
+#endif
+#if (NGX_HTTP_CACHE)
+    ngx_array_t                   *fcaches;
+    ngx_http_file_cache_stat_t    *fc;
+#endif
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -118,6 +133,65 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
            + 6 + 3 * NGX_ATOMIC_T_LEN
            + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
 
+#if (NGX_THREADS)
+
+    /* thread pools are per worker, the numbers are of the current one */
+
+    stats = ngx_thread_pool_stats((ngx_cycle_t *) ngx_cycle, r->pool);
+    if (stats == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    st = stats->elts;
+
+    for (i = 0; i < stats->nelts; i++) {
+        size += sizeof("Thread pool \"\": threads  queued  tasks  wait  \n")
+                + st[i].name.len + 5 * NGX_INT_T_LEN;
+    }
+
+#endif
+
+#if (NGX_SSL)
+
+    caches = ngx_ssl_session_cache_stats((ngx_cycle_t *) ngx_cycle, r->pool);
+    if (caches == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    sc = caches->elts;
+
+    for (i = 0; i < caches->nelts; i++) {
+        size += sizeof("SSL session cache \"\": shards  hits  misses  "
+                       "evictions  lock waits  \n")
+                + sc[i].name.len + NGX_INT_T_LEN + 4 * NGX_ATOMIC_T_LEN;
+    }
+
+#endif
+
+#if (NGX_HTTP_CACHE)
+
+    fcaches = ngx_http_file_cache_stats((ngx_cycle_t *) ngx_cycle, r->pool);
+    if (fcaches == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    fc = fcaches->elts;
+
+    for (i = 0; i < fcaches->nelts; i++) {
+        size += sizeof("Cache \"\": size  entries  hits  stale  misses  "
+                       "rejected  evicted  purged  \n")
+                + fc[i].name.len + NGX_OFF_T_LEN + NGX_INT_T_LEN
+                + 6 * NGX_ATOMIC_T_LEN;
+
+        if (fc[i].fast) {
+            size += sizeof("Cache \"\" fast tier: size  hits  slow hits  "
+                           "promoted  demoted  \n")
+                    + fc[i].name.len + NGX_OFF_T_LEN + 4 * NGX_ATOMIC_T_LEN;
+        }
+    }
+
+#endif
+
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -144,6 +218,46 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, wa);
 
+#if (NGX_THREADS)
+    for (i = 0; i < stats->nelts; i++) {
+        b->last = ngx_sprintf(b->last, "Thread pool \"%V\": threads %ui "
+                              "queued %ui tasks %ui wait %M \n",
+                              &st[i].name, st[i].threads, st[i].queued,
+                              st[i].tasks, st[i].wait_time);
+    }
+#endif
+
+#if (NGX_SSL)
+    for (i = 0; i < caches->nelts; i++) {
+        b->last = ngx_sprintf(b->last, "SSL session cache \"%V\": shards %ui "
+                              "hits %uA misses %uA evictions %uA "
+                              "lock waits %uA \n",
+                              &sc[i].name, sc[i].shards, sc[i].hits,
+                              sc[i].misses, sc[i].evictions,
+                              sc[i].lock_waits);
+    }
+#endif
+
+#if (NGX_HTTP_CACHE)
+    for (i = 0; i < fcaches->nelts; i++) {
+        b->last = ngx_sprintf(b->last, "Cache \"%V\": size %O entries %ui "
+                              "hits %uA stale %uA misses %uA "
+                              "rejected %uA evicted %uA purged %uA \n",
+                              &fc[i].name, fc[i].size, fc[i].entries,
+                              fc[i].hits, fc[i].stale, fc[i].misses,
+                              fc[i].rejected, fc[i].evicted, fc[i].purged);
+
+        if (fc[i].fast) {
+            b->last = ngx_sprintf(b->last, "Cache \"%V\" fast tier: size %O "
+                                  "hits %uA slow hits %uA "
+                                  "promoted %uA demoted %uA \n",
+                                  &fc[i].name, fc[i].fast_size,
+                                  fc[i].fast_hits, fc[i].slow_hits,
+                                  fc[i].promoted, fc[i].demoted);
+        }
+    }
+#endif
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
@@ -10,6 +10,9 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_SUB_AUTOMATON_SIZE  (1024 * 1024)
+
+
 typedef struct {
     ngx_http_complex_value_t   match;
     ngx_http_complex_value_t   value;
@@ -22,12 +25,25 @@ typedef struct {
 } ngx_http_sub_match_t;
 
 
+typedef struct {
+    ngx_uint_t                 nclasses;
+    u_char                     classes[256];
+
+    uint32_t                  *next;
+    uint32_t                  *depth;
+    uint32_t                  *output;
+    uint32_t                  *link;
+} ngx_http_sub_automaton_t;
+
+
 typedef struct {
     ngx_uint_t                 min_match_len;
     ngx_uint_t                 max_match_len;
 
     u_char                     index[257];
     u_char                     shift[256];
+
+    ngx_http_sub_automaton_t  *automaton;
 } ngx_http_sub_tables_t;
 
 
@@ -72,6 +88,11 @@ typedef struct {
     ngx_int_t                  offset;
     ngx_uint_t                 index;
 
+    ngx_uint_t                 state;
+    ngx_uint_t                 scanned;
+    ngx_uint_t                 best;
+    ngx_int_t                  best_start;
+
     ngx_http_sub_tables_t     *tables;
     ngx_array_t               *matches;
 } ngx_http_sub_ctx_t;
@@ -84,6 +105,10 @@ static ngx_int_t ngx_http_sub_output(ngx_http_request_t *r,
     ngx_http_sub_ctx_t *ctx);
 static ngx_int_t ngx_http_sub_parse(ngx_http_request_t *r,
     ngx_http_sub_ctx_t *ctx, ngx_uint_t flush);
+static ngx_int_t ngx_http_sub_parse_automaton(ngx_http_request_t *r,
+    ngx_http_sub_ctx_t *ctx);
+static void ngx_http_sub_split(ngx_http_sub_ctx_t *ctx, ngx_int_t start,
+    ngx_int_t next, ngx_int_t end);
 static ngx_int_t ngx_http_sub_match(ngx_http_sub_ctx_t *ctx, ngx_int_t start,
     ngx_str_t *m);
 
@@ -95,6 +120,8 @@ static char *ngx_http_sub_merge_conf(ngx_conf_t *cf,
 static void ngx_http_sub_init_tables(ngx_http_sub_tables_t *tables,
     ngx_http_sub_match_t *match, ngx_uint_t n);
 static ngx_int_t ngx_http_sub_cmp_matches(const void *one, const void *two);
+static ngx_http_sub_automaton_t *ngx_http_sub_init_automaton(ngx_conf_t *cf,
+    ngx_http_sub_match_t *match, ngx_uint_t n);
 static ngx_int_t ngx_http_sub_filter_init(ngx_conf_t *cf);
 
 
@@ -246,14 +273,18 @@ ngx_http_sub_header_filter(ngx_http_request_t *r)
 
         ngx_http_sub_init_tables(ctx->tables, ctx->matches->elts,
                                  ctx->matches->nelts);
+
+        ctx->tables->automaton = NULL;
     }
 
-    ctx->saved.data = ngx_pnalloc(r->pool, ctx->tables->max_match_len - 1);
+    /* the automaton may keep a whole match until a longer one fails */
+
+    ctx->saved.data = ngx_pnalloc(r->pool, ctx->tables->max_match_len);
     if (ctx->saved.data == NULL) {
         return NGX_ERROR;
     }
 
-    ctx->looked.data = ngx_pnalloc(r->pool, ctx->tables->max_match_len - 1);
+    ctx->looked.data = ngx_pnalloc(r->pool, ctx->tables->max_match_len);
     if (ctx->looked.data == NULL) {
         return NGX_ERROR;
     }
@@ -350,7 +381,13 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
         b = NULL;
 
-        while (ctx->pos < ctx->buf->last) {
+        /* the automaton may hold a match found before the last buffer */
+
+        while (ctx->pos < ctx->buf->last
+               || (ctx->tables->automaton
+                   && (ctx->buf->last_buf || ctx->buf->last_in_chain)
+                   && (ctx->best || ctx->scanned < ctx->looked.len)))
+        {
 
             rc = ngx_http_sub_parse(r, ctx, last);
 
@@ -607,16 +644,21 @@ static ngx_int_t
 ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx,
     ngx_uint_t flush)
 {
-    u_char                   *p, c;
+    u_char                    c;
     ngx_str_t                *m;
-    ngx_int_t                 offset, start, next, end, len, rc;
+    ngx_int_t                 offset, start, next, end, rc;
     ngx_uint_t                shift, i, j;
     ngx_http_sub_match_t     *match;
     ngx_http_sub_tables_t    *tables;
     ngx_http_sub_loc_conf_t  *slcf;
 
-    slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
     tables = ctx->tables;
+
+    if (tables->automaton) {
+        return ngx_http_sub_parse_automaton(r, ctx);
+    }
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
     match = ctx->matches->elts;
 
     offset = ctx->offset;
@@ -713,6 +755,135 @@ again:
 
 done:
 
+    ngx_http_sub_split(ctx, start, next, end);
+
+    ctx->offset -= end;
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_sub_parse_automaton(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
+{
+    u_char                    *p;
+    uint32_t                   o;
+    ngx_int_t                  k, n, end, start, next, hold, best_start;
+    ngx_uint_t                 state, best, i, once;
+    ngx_http_sub_match_t      *match;
+    ngx_http_sub_automaton_t  *a;
+    ngx_http_sub_loc_conf_t   *slcf;
+
+    /*
+     * The automaton scans the looked data and then the buffer.  A match
+     * is found at the leftmost position, and of the matches starting there
+     * the one with smaller index wins, like in ngx_http_sub_parse().
+     * As longer patterns may still match, a found match is reported only
+     * when no pattern in progress starts at or before it.
+     */
+
+    a = ctx->tables->automaton;
+    match = ctx->matches->elts;
+
+    n = ctx->looked.len;
+    end = ctx->buf->last - ctx->pos;
+
+    if (ctx->once) {
+        start = end;
+        next = end;
+
+        ngx_http_sub_split(ctx, start, next, end);
+
+        return NGX_AGAIN;
+    }
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
+
+    once = slcf->once && ctx->sub;
+
+    state = ctx->state;
+    best = ctx->best;
+    best_start = ctx->best_start;
+
+    for (k = ctx->scanned; k < n + end; k++) {
+
+        p = (k < n) ? &ctx->looked.data[k] : &ctx->pos[k - n];
+
+        state = a->next[state * a->nclasses + a->classes[*p]];
+
+        for (o = a->output[state] ? state : a->link[state]; o; o = a->link[o])
+        {
+            i = a->output[o] - 1;
+
+            if (once && ctx->sub[i].data) {
+                continue;
+            }
+
+            start = k + 1 - (ngx_int_t) match[i].match.len;
+
+            if (best == 0
+                || start < best_start
+                || (start == best_start && i + 1 < best))
+            {
+                best = i + 1;
+                best_start = start;
+            }
+        }
+
+        if (best && k + 1 - (ngx_int_t) a->depth[state] > best_start) {
+            goto found;
+        }
+    }
+
+    if (best && (ctx->buf->last_buf || ctx->buf->last_in_chain)) {
+        goto found;
+    }
+
+    /* keep the data of patterns in progress */
+
+    hold = k - (ngx_int_t) a->depth[state];
+
+    if (best && best_start < hold) {
+        hold = best_start;
+    }
+
+    ctx->state = state;
+    ctx->best = best;
+    ctx->best_start = best_start - hold;
+    ctx->scanned = k - hold;
+
+    start = hold - n;
+
+    ngx_http_sub_split(ctx, start, start, end);
+
+    return NGX_AGAIN;
+
+found:
+
+    /* the data after the match are scanned again */
+
+    ctx->index = best - 1;
+
+    ctx->state = 0;
+    ctx->best = 0;
+    ctx->scanned = 0;
+
+    start = best_start - n;
+    next = start + (ngx_int_t) match[best - 1].match.len;
+
+    ngx_http_sub_split(ctx, start, next, ngx_max(next, 0));
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_sub_split(ngx_http_sub_ctx_t *ctx, ngx_int_t start, ngx_int_t next,
+    ngx_int_t end)
+{
+    u_char     *p;
+    ngx_int_t   len;
+
     /* send [ - looked.len, start ] to client */
 
     ctx->saved.len = ctx->looked.len + ngx_min(start, 0);
@@ -734,9 +905,6 @@ done:
     /* update position */
 
     ctx->pos += end;
-    ctx->offset -= end;
-
-    return rc;
 }
 
 
@@ -938,6 +1106,13 @@ ngx_http_sub_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
         ngx_http_sub_init_tables(conf->tables, conf->matches->elts,
                                  conf->matches->nelts);
+
+        conf->tables->automaton = NULL;
+
+        if (n > 1) {
+            conf->tables->automaton = ngx_http_sub_init_automaton(cf,
+                                                                  matches, n);
+        }
     }
 
     return NGX_CONF_OK;
@@ -1005,6 +1180,138 @@ ngx_http_sub_cmp_matches(const void *one, const void *two)
 }
 
 
+static ngx_http_sub_automaton_t *
+ngx_http_sub_init_automaton(ngx_conf_t *cf, ngx_http_sub_match_t *match,
+    ngx_uint_t n)
+{
+    u_char                    *p, *last;
+    uint32_t                  *fail, *queue, *next;
+    ngx_uint_t                 i, c, u, v, f, size, nstates, head, tail;
+    ngx_http_sub_automaton_t  *a;
+
+    /*
+     * A DFA of the Aho-Corasick automaton for static patterns.
+     * The patterns are already sorted, and the sort order is used
+     * as the priority of matches starting at the same position.
+     * Transitions are indexed by classes of the bytes seen in patterns.
+     */
+
+    a = ngx_pcalloc(cf->pool, sizeof(ngx_http_sub_automaton_t));
+    if (a == NULL) {
+        return NULL;
+    }
+
+    a->nclasses = 1;
+    nstates = 1;
+
+    for (i = 0; i < n; i++) {
+        p = match[i].match.data;
+        last = p + match[i].match.len;
+
+        for ( /* void */ ; p < last; p++) {
+            if (a->classes[*p] == 0) {
+                a->classes[*p] = (u_char) a->nclasses++;
+            }
+        }
+
+        nstates += match[i].match.len;
+    }
+
+    if (a->nclasses > 255
+        || nstates * a->nclasses > NGX_HTTP_SUB_AUTOMATON_SIZE)
+    {
+        ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                      "sub_filter patterns are too long for an automaton, "
+                      "%ui states", nstates);
+        return NULL;
+    }
+
+    /* patterns are lowercased, so are the classes */
+
+    for (c = 'A'; c <= 'Z'; c++) {
+        a->classes[c] = a->classes[c | 0x20];
+    }
+
+    size = nstates * a->nclasses * sizeof(uint32_t);
+
+    a->next = ngx_pcalloc(cf->pool, size);
+    a->depth = ngx_pcalloc(cf->pool, nstates * sizeof(uint32_t));
+    a->output = ngx_pcalloc(cf->pool, nstates * sizeof(uint32_t));
+    a->link = ngx_pcalloc(cf->pool, nstates * sizeof(uint32_t));
+
+    fail = ngx_pcalloc(cf->temp_pool, nstates * sizeof(uint32_t));
+    queue = ngx_palloc(cf->temp_pool, nstates * sizeof(uint32_t));
+
+    if (a->next == NULL || a->depth == NULL || a->output == NULL
+        || a->link == NULL || fail == NULL || queue == NULL)
+    {
+        return NULL;
+    }
+
+    /* the trie, the root state is 0 */
+
+    nstates = 1;
+
+    for (i = 0; i < n; i++) {
+        u = 0;
+        p = match[i].match.data;
+        last = p + match[i].match.len;
+
+        for ( /* void */ ; p < last; p++) {
+            next = &a->next[u * a->nclasses + a->classes[*p]];
+
+            if (*next == 0) {
+                *next = nstates;
+                a->depth[nstates] = a->depth[u] + 1;
+                nstates++;
+            }
+
+            u = *next;
+        }
+
+        if (a->output[u] == 0) {
+            a->output[u] = i + 1;
+        }
+    }
+
+    /* failure links, in the breadth-first order */
+
+    head = 0;
+    tail = 0;
+
+    for (c = 0; c < a->nclasses; c++) {
+        v = a->next[c];
+
+        if (v) {
+            queue[tail++] = v;
+        }
+    }
+
+    while (head < tail) {
+        u = queue[head++];
+
+        for (c = 0; c < a->nclasses; c++) {
+            next = &a->next[u * a->nclasses + c];
+            f = a->next[fail[u] * a->nclasses + c];
+
+            if (*next == 0) {
+                *next = f;
+                continue;
+            }
+
+            v = *next;
+
+            fail[v] = f;
+            a->link[v] = a->output[f] ? f : a->link[f];
+
+            queue[tail++] = v;
+        }
+    }
+
+    return a;
+}
+
+
 static ngx_int_t
 ngx_http_sub_filter_init(ngx_conf_t *cf)
 {
@@ -20,14 +20,147 @@ typedef struct {
 } ngx_http_try_file_t;
 
 
+/*
+ * The negative lookup cache keeps the names which were found not to exist
+ * in shared memory.  Each entry belongs to the nearest existing directory
+ * above it, which the worker that stored the entry watches with inotify:
+ * a file or a directory created or moved there drops all entries of the
+ * directory.  The "valid" time bounds what cannot be watched, such as
+ * entries of exited workers, and all entries are dropped on
+ * reconfiguration, as a deployment may have switched the document root.
+ */
+
+typedef struct {
+    ngx_str_node_t         sn;
+    ngx_queue_t            entries;
+} ngx_http_try_files_dir_t;
+
+
+typedef struct {
+    ngx_str_node_t                sn;
+    ngx_queue_t                   queue;
+    ngx_queue_t                   siblings;
+    ngx_http_try_files_dir_t     *dir;
+    ngx_msec_t                    expire;
+} ngx_http_try_files_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t           rbtree;
+    ngx_rbtree_node_t      sentinel;
+    ngx_rbtree_t           dirs;
+    ngx_rbtree_node_t      dirs_sentinel;
+    ngx_queue_t            queue;
+} ngx_http_try_files_sh_t;
+
+
+typedef struct {
+    ngx_http_try_files_sh_t   *sh;
+    ngx_slab_pool_t           *shpool;
+} ngx_http_try_files_cache_t;
+
+
+#if (NGX_HAVE_INOTIFY)
+
+/* a directory watched by this worker, node.key is a watch descriptor */
+
+typedef struct {
+    ngx_rbtree_node_t             node;
+    ngx_queue_t                   queue;
+    ngx_http_try_files_cache_t   *cache;
+    ngx_uint_t                    seq;
+    uint32_t                      hash;
+    ngx_str_t                     name;
+} ngx_http_try_files_watch_t;
+
+#endif
+
+
 typedef struct {
     ngx_http_try_file_t   *try_files;
+
+    ngx_shm_zone_t        *cache_zone;
+    ngx_msec_t             cache_valid;
+
+    ngx_flag_t             threads;
 } ngx_http_try_files_loc_conf_t;
 
 
+/* the state of a candidate tested in a thread along with the others */
+
+typedef struct {
+    ngx_str_t              path;
+    size_t                 root;
+    ngx_int_t              rc;
+    ngx_open_file_info_t   of;
+
+    unsigned               cached:1;
+    unsigned               tested:1;
+} ngx_http_try_files_result_t;
+
+
+typedef struct {
+    ngx_http_try_file_t          *tf;
+    ngx_http_try_files_result_t  *results;
+
+    /* the watches added before the first name was tested */
+    ngx_uint_t                    watches;
+
+    unsigned                      batched:1;
+    unsigned                      pending:1;
+} ngx_http_try_files_ctx_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_http_try_file_t          *tf;
+    ngx_http_try_files_result_t  *results;
+    ngx_uint_t                    n;
+} ngx_http_try_files_thread_ctx_t;
+
+#endif
+
+
 static ngx_int_t ngx_http_try_files_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_try_files_map(ngx_http_request_t *r,
+    ngx_http_try_file_t *tf, ngx_str_t *path, size_t *root, size_t *allocated);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_try_files_batch(ngx_http_request_t *r,
+    ngx_http_try_files_loc_conf_t *tlcf, ngx_http_try_files_ctx_t *ctx);
+static void ngx_http_try_files_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_try_files_thread_event_handler(ngx_event_t *ev);
+#endif
+
+static ngx_int_t ngx_http_try_files_cache_lookup(ngx_http_request_t *r,
+    ngx_http_try_files_loc_conf_t *tlcf, ngx_str_t *path);
+static void ngx_http_try_files_cache_insert(ngx_http_request_t *r,
+    ngx_http_try_files_loc_conf_t *tlcf, ngx_str_t *path, ngx_uint_t since);
+static void ngx_http_try_files_cache_delete(ngx_http_try_files_cache_t *cache,
+    ngx_http_try_files_node_t *node);
+static void ngx_http_try_files_cache_drop(ngx_http_try_files_cache_t *cache,
+    ngx_str_t *name, uint32_t hash);
+static void ngx_http_try_files_cache_expire(ngx_http_try_files_cache_t *cache,
+    ngx_uint_t n);
+static ngx_int_t ngx_http_try_files_cache_dir(ngx_http_try_files_cache_t *cache,
+    ngx_str_t *path, ngx_str_t *dir, ngx_uint_t since, ngx_log_t *log);
+#if (NGX_HAVE_INOTIFY)
+static ngx_int_t ngx_http_try_files_inotify_init(ngx_log_t *log);
+static ngx_http_try_files_watch_t *ngx_http_try_files_inotify_lookup(int wd);
+static void ngx_http_try_files_inotify_del(ngx_http_try_files_watch_t *w,
+    ngx_uint_t rm);
+static void ngx_http_try_files_inotify_retire(ngx_http_try_files_watch_t *w);
+static void ngx_http_try_files_inotify_handler(ngx_event_t *ev);
+#endif
+static ngx_int_t ngx_http_try_files_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
 static char *ngx_http_try_files(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_try_files_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static void *ngx_http_try_files_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_try_files_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child);
 static ngx_int_t ngx_http_try_files_init(ngx_conf_t *cf);
 
 
@@ -40,6 +173,20 @@ static ngx_command_t  ngx_http_try_files_commands[] = {
       0,
       NULL },
 
+    { ngx_string("try_files_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_try_files_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("try_files_threads"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_try_files_loc_conf_t, threads),
+      NULL },
+
       ngx_null_command
 };
 
@@ -55,7 +202,7 @@ static ngx_http_module_t  ngx_http_try_files_module_ctx = {
     NULL,                                  /* merge server configuration */
 
     ngx_http_try_files_create_loc_conf,    /* create location configuration */
-    NULL                                   /* merge location configuration */
+    ngx_http_try_files_merge_loc_conf      /* merge location configuration */
 };
 
 
@@ -75,19 +222,39 @@ ngx_module_t  ngx_http_try_files_module = {
 };
 
 
+static ngx_uint_t         ngx_http_try_files_watches;
+
+
+#if (NGX_HAVE_INOTIFY)
+
+/* a single inotify instance per process watches directories of all zones */
+
+static int                ngx_http_try_files_inotify = -1;
+static ngx_uint_t         ngx_http_try_files_inotify_failed;
+static ngx_uint_t         ngx_http_try_files_inotify_full;
+static ngx_event_t        ngx_http_try_files_inotify_rev;
+static ngx_event_t        ngx_http_try_files_inotify_wev;
+static ngx_connection_t   ngx_http_try_files_inotify_conn;
+static ngx_rbtree_t       ngx_http_try_files_inotify_tree;
+static ngx_rbtree_node_t  ngx_http_try_files_inotify_sentinel;
+static ngx_queue_t        ngx_http_try_files_inotify_queue;
+
+#endif
+
+
 static ngx_int_t
 ngx_http_try_files_handler(ngx_http_request_t *r)
 {
-    size_t                          len, root, alias, reserve, allocated;
+    size_t                          root, alias, allocated;
     u_char                         *p, *name;
+    ngx_int_t                       rc;
     ngx_str_t                       path, args;
     ngx_uint_t                      test_dir;
     ngx_http_try_file_t            *tf;
     ngx_open_file_info_t            of;
-    ngx_http_script_code_pt         code;
-    ngx_http_script_engine_t        e;
+    ngx_http_try_files_ctx_t       *ctx;
     ngx_http_core_loc_conf_t       *clcf;
-    ngx_http_script_len_code_pt     lcode;
+    ngx_http_try_files_result_t    *res;
     ngx_http_try_files_loc_conf_t  *tlcf;
 
     tlcf = ngx_http_get_module_loc_conf(r, ngx_http_try_files_module);
@@ -101,88 +268,73 @@ ngx_http_try_files_handler(ngx_http_request_t *r)
 
     allocated = 0;
     root = 0;
-    name = NULL;
+    res = NULL;
     /* suppress MSVC warning */
     path.data = NULL;
 
-    tf = tlcf->try_files;
-
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
-    alias = clcf->alias;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_try_files_module);
 
-    for ( ;; ) {
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_try_files_ctx_t));
+        if (ctx == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
 
-        if (tf->lengths) {
-            ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
+        ngx_http_set_ctx(r, ctx, ngx_http_try_files_module);
 
-            e.ip = tf->lengths->elts;
-            e.request = r;
+        ctx->watches = ngx_http_try_files_watches;
+    }
 
-            /* 1 is for terminating '\0' as in static names */
-            len = 1;
+    if (ctx->pending) {
+        /* the handler was called before the candidates were tested */
+        return NGX_AGAIN;
+    }
 
-            while (*(uintptr_t *) e.ip) {
-                lcode = *(ngx_http_script_len_code_pt *) e.ip;
-                len += lcode(&e);
-            }
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-        } else {
-            len = tf->name.len;
-        }
+#if (NGX_THREADS)
 
-        if (!alias) {
-            reserve = len > r->uri.len ? len - r->uri.len : 0;
+    if (tlcf->threads
+        && !ctx->batched
+        && clcf->aio == NGX_HTTP_AIO_THREADS)
+    {
+        ctx->batched = 1;
 
-        } else if (alias == NGX_MAX_SIZE_T_VALUE) {
-            reserve = len;
+        rc = ngx_http_try_files_batch(r, tlcf, ctx);
 
-        } else {
-            reserve = len > r->uri.len - alias ? len - (r->uri.len - alias) : 0;
+        if (rc == NGX_ERROR) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
-        if (reserve > allocated || !allocated) {
-
-            /* 16 bytes are preallocation */
-            allocated = reserve + 16;
-
-            if (ngx_http_map_uri_to_path(r, &path, &root, allocated) == NULL) {
-                return NGX_HTTP_INTERNAL_SERVER_ERROR;
-            }
-
-            name = path.data + root;
+        if (rc == NGX_AGAIN) {
+            return NGX_AGAIN;
         }
+    }
 
-        if (tf->values == NULL) {
-
-            /* tf->name.len includes the terminating '\0' */
+#endif
 
-            ngx_memcpy(name, tf->name.data, tf->name.len);
+    tf = ctx->tf ? ctx->tf : tlcf->try_files;
 
-            path.len = (name + tf->name.len - 1) - path.data;
+    ctx->tf = NULL;
 
-        } else {
-            e.ip = tf->values->elts;
-            e.pos = name;
-            e.flushed = 1;
+    alias = clcf->alias;
 
-            while (*(uintptr_t *) e.ip) {
-                code = *(ngx_http_script_code_pt *) e.ip;
-                code((ngx_http_script_engine_t *) &e);
-            }
+    for ( ;; ) {
 
-            path.len = e.pos - path.data;
+        if (ctx->results) {
+            res = &ctx->results[tf - tlcf->try_files];
 
-            *e.pos = '\0';
+            path = res->path;
+            root = res->root;
 
-            if (alias && alias != NGX_MAX_SIZE_T_VALUE
-                && ngx_strncmp(name, r->uri.data, alias) == 0)
-            {
-                ngx_memmove(name, name + alias, len - alias);
-                path.len -= alias;
-            }
+        } else if (ngx_http_try_files_map(r, tf, &path, &root, &allocated)
+                   != NGX_OK)
+        {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
+        name = path.data + root;
+
         test_dir = tf->test_dir;
 
         tf++;
@@ -213,6 +365,22 @@ ngx_http_try_files_handler(ngx_http_request_t *r)
             return NGX_DONE;
         }
 
+        if (res && res->tested) {
+            rc = res->rc;
+            of = res->of;
+
+            goto tested;
+        }
+
+        if ((res && res->cached)
+            || (tlcf->cache_zone
+                && ngx_http_try_files_cache_lookup(r, tlcf, &path) == NGX_OK))
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "try files cache: \"%s\" not found", path.data);
+            continue;
+        }
+
         ngx_memzero(&of, sizeof(ngx_open_file_info_t));
 
         of.read_ahead = clcf->read_ahead;
@@ -227,9 +395,24 @@ ngx_http_try_files_handler(ngx_http_request_t *r)
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
-        if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
-            != NGX_OK)
-        {
+        if (res == NULL) {
+            ngx_http_set_open_file_thread(r, clcf, &of);
+        }
+
+        rc = ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool);
+
+        if (rc == NGX_AGAIN) {
+
+            /* the handler continues from this file once it is tested */
+
+            ctx->tf = tf - 1;
+
+            return NGX_AGAIN;
+        }
+
+    tested:
+
+        if (rc != NGX_OK) {
             if (of.err == 0) {
                 return NGX_HTTP_INTERNAL_SERVER_ERROR;
             }
@@ -242,6 +425,13 @@ ngx_http_try_files_handler(ngx_http_request_t *r)
                               "%s \"%s\" failed", of.failed, path.data);
             }
 
+            if (tlcf->cache_zone
+                && (of.err == NGX_ENOENT || of.err == NGX_ENOTDIR))
+            {
+                ngx_http_try_files_cache_insert(r, tlcf, &path,
+                                                ctx->watches);
+            }
+
             continue;
         }
 
@@ -287,101 +477,1226 @@ ngx_http_try_files_handler(ngx_http_request_t *r)
 }
 
 
-static char *
-ngx_http_try_files(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static ngx_int_t
+ngx_http_try_files_map(ngx_http_request_t *r, ngx_http_try_file_t *tf,
+    ngx_str_t *path, size_t *root, size_t *allocated)
 {
-    ngx_http_try_files_loc_conf_t *tlcf = conf;
+    size_t                         len, alias, reserve;
+    u_char                        *name;
+    ngx_http_script_code_pt        code;
+    ngx_http_script_engine_t       e;
+    ngx_http_core_loc_conf_t      *clcf;
+    ngx_http_script_len_code_pt    lcode;
 
-    ngx_str_t                  *value;
-    ngx_int_t                   code;
-    ngx_uint_t                  i, n;
-    ngx_http_try_file_t        *tf;
-    ngx_http_script_compile_t   sc;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-    if (tlcf->try_files) {
-        return "is duplicate";
+    alias = clcf->alias;
+
+    if (tf->lengths) {
+        ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
+
+        e.ip = tf->lengths->elts;
+        e.request = r;
+
+        /* 1 is for terminating '\0' as in static names */
+        len = 1;
+
+        while (*(uintptr_t *) e.ip) {
+            lcode = *(ngx_http_script_len_code_pt *) e.ip;
+            len += lcode(&e);
+        }
+
+    } else {
+        len = tf->name.len;
     }
 
-    tf = ngx_pcalloc(cf->pool, cf->args->nelts * sizeof(ngx_http_try_file_t));
-    if (tf == NULL) {
-        return NGX_CONF_ERROR;
+    if (!alias) {
+        reserve = len > r->uri.len ? len - r->uri.len : 0;
+
+    } else if (alias == NGX_MAX_SIZE_T_VALUE) {
+        reserve = len;
+
+    } else {
+        reserve = len > r->uri.len - alias ? len - (r->uri.len - alias) : 0;
     }
 
-    tlcf->try_files = tf;
+    if (reserve > *allocated || !*allocated) {
 
-    value = cf->args->elts;
+        /* 16 bytes are preallocation */
+        *allocated = reserve + 16;
 
-    for (i = 0; i < cf->args->nelts - 1; i++) {
+        if (ngx_http_map_uri_to_path(r, path, root, *allocated) == NULL) {
+            return NGX_ERROR;
+        }
+    }
 
-        tf[i].name = value[i + 1];
+    name = path->data + *root;
 
-        if (tf[i].name.len > 0
-            && tf[i].name.data[tf[i].name.len - 1] == '/'
-            && i + 2 < cf->args->nelts)
+    if (tf->values == NULL) {
+
+        /* tf->name.len includes the terminating '\0' */
+
+        ngx_memcpy(name, tf->name.data, tf->name.len);
+
+        path->len = (name + tf->name.len - 1) - path->data;
+
+        return NGX_OK;
+    }
+
+    e.ip = tf->values->elts;
+    e.pos = name;
+    e.flushed = 1;
+
+    while (*(uintptr_t *) e.ip) {
+        code = *(ngx_http_script_code_pt *) e.ip;
+        code((ngx_http_script_engine_t *) &e);
+    }
+
+    path->len = e.pos - path->data;
+
+    *e.pos = '\0';
+
+    if (alias && alias != NGX_MAX_SIZE_T_VALUE
+        && ngx_strncmp(name, r->uri.data, alias) == 0)
+    {
+        ngx_memmove(name, name + alias, len - alias);
+        path->len -= alias;
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_THREADS)
+
+/*
+ * the candidates are mapped to paths at once, and those not known to be
+ * missing are tested together in a single thread task, in order, until
+ * one matches; the handler then goes through the results
+ */
+
+static ngx_int_t
+ngx_http_try_files_batch(ngx_http_request_t *r,
+    ngx_http_try_files_loc_conf_t *tlcf, ngx_http_try_files_ctx_t *ctx)
+{
+    size_t                            allocated;
+    ngx_str_t                         name;
+    ngx_uint_t                        i, n, tests;
+    ngx_thread_pool_t                *tp;
+    ngx_thread_task_t                *task;
+    ngx_http_try_file_t              *tf;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_http_try_files_result_t      *res, *results;
+    ngx_http_try_files_thread_ctx_t  *tctx;
+
+    tf = tlcf->try_files;
+
+    /* the last name is a fallback and is not tested */
+
+    for (n = 0; tf[n + 1].lengths || tf[n + 1].name.len; n++) {
+        /* void */
+    }
+
+    results = ngx_pcalloc(r->pool,
+                          (n + 1) * sizeof(ngx_http_try_files_result_t));
+    if (results == NULL) {
+        return NGX_ERROR;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    tests = 0;
+
+    for (i = 0; i <= n; i++) {
+        res = &results[i];
+
+        allocated = 0;
+
+        if (ngx_http_try_files_map(r, &tf[i], &res->path, &res->root,
+                                   &allocated)
+            != NGX_OK)
         {
-            tf[i].test_dir = 1;
-            tf[i].name.len--;
-            tf[i].name.data[tf[i].name.len] = '\0';
+            return NGX_ERROR;
         }
 
-        n = ngx_http_script_variables_count(&tf[i].name);
-
-        if (n) {
-            ngx_memzero(&sc, sizeof(ngx_http_script_compile_t));
+        if (i == n) {
+            break;
+        }
 
-            sc.cf = cf;
-            sc.source = &tf[i].name;
-            sc.lengths = &tf[i].lengths;
-            sc.values = &tf[i].values;
-            sc.variables = n;
-            sc.complete_lengths = 1;
-            sc.complete_values = 1;
+        if (tlcf->cache_zone
+            && ngx_http_try_files_cache_lookup(r, tlcf, &res->path) == NGX_OK)
+        {
+            res->cached = 1;
+            continue;
+        }
 
-            if (ngx_http_script_compile(&sc) != NGX_OK) {
-                return NGX_CONF_ERROR;
-            }
+        res->of.fd = NGX_INVALID_FILE;
+        res->of.test_only = 1;
 
-        } else {
-            /* add trailing '\0' to length */
-            tf[i].name.len++;
+        if (ngx_http_set_disable_symlinks(r, clcf, &res->path, &res->of)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
         }
+
+        tests++;
     }
 
-    if (tf[i - 1].name.data[0] == '=') {
+    ctx->results = results;
 
-        code = ngx_atoi(tf[i - 1].name.data + 1, tf[i - 1].name.len - 2);
+    if (tests == 0) {
+        return NGX_OK;
+    }
 
-        if (code == NGX_ERROR || code > 999) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid code \"%*s\"",
-                               tf[i - 1].name.len - 1, tf[i - 1].name.data);
-            return NGX_CONF_ERROR;
+    tp = clcf->thread_pool;
+
+    if (tp == NULL) {
+        if (ngx_http_complex_value(r, clcf->thread_pool_value, &name)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
         }
 
-        tf[i].code = code;
+        tp = ngx_thread_pool_get((ngx_cycle_t *) ngx_cycle, &name);
+
+        if (tp == NULL) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "thread pool \"%V\" not found", &name);
+            return NGX_ERROR;
+        }
     }
 
-    return NGX_CONF_OK;
+    task = ngx_thread_task_alloc(r->pool,
+                                 sizeof(ngx_http_try_files_thread_ctx_t));
+    if (task == NULL) {
+        return NGX_ERROR;
+    }
+
+    tctx = task->ctx;
+
+    tctx->tf = tf;
+    tctx->results = results;
+    tctx->n = n;
+
+    task->handler = ngx_http_try_files_thread_handler;
+    task->event.data = r;
+    task->event.handler = ngx_http_try_files_thread_event_handler;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "try files thread: %ui names", tests);
+
+    ctx->pending = 1;
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_AGAIN;
 }
 
 
-static void *
-ngx_http_try_files_create_loc_conf(ngx_conf_t *cf)
+static void
+ngx_http_try_files_thread_handler(void *data, ngx_log_t *log)
 {
-    ngx_http_try_files_loc_conf_t  *tlcf;
+    ngx_http_try_files_thread_ctx_t *ctx = data;
 
-    tlcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_try_files_loc_conf_t));
-    if (tlcf == NULL) {
-        return NULL;
-    }
+    ngx_uint_t                    i;
+    ngx_http_try_files_result_t  *res, *prev;
 
-    /*
-     * set by ngx_pcalloc():
-     *
-     *     tlcf->try_files = NULL;
-     */
+    prev = NULL;
 
-    return tlcf;
+    for (i = 0; i < ctx->n; i++) {
+        res = &ctx->results[i];
+
+        if (res->cached) {
+            continue;
+        }
+
+        res->tested = 1;
+
+        /* "$uri" and "$uri/" map to the same path */
+
+        if (prev
+            && prev->path.len == res->path.len
+            && ngx_memcmp(prev->path.data, res->path.data, res->path.len) == 0)
+        {
+            res->rc = prev->rc;
+            res->of = prev->of;
+
+        } else {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                           "try files thread handler: \"%V\"", &res->path);
+
+            res->rc = ngx_open_file_stat(&res->path, &res->of, log);
+        }
+
+        prev = res;
+
+        if (res->rc == NGX_OK && res->of.is_dir == ctx->tf[i].test_dir) {
+            break;
+        }
+    }
+}
+
+
+static void
+ngx_http_try_files_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t          *c;
+    ngx_http_request_t        *r;
+    ngx_http_try_files_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http try files thread: \"%V?%V\"", &r->uri, &r->args);
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_try_files_module);
+    ctx->pending = 0;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_try_files_cache_lookup(ngx_http_request_t *r,
+    ngx_http_try_files_loc_conf_t *tlcf, ngx_str_t *path)
+{
+    uint32_t                     hash;
+    ngx_http_try_files_node_t   *node;
+    ngx_http_try_files_cache_t  *cache;
+
+    cache = tlcf->cache_zone->data;
+
+    hash = ngx_crc32_short(path->data, path->len);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = (ngx_http_try_files_node_t *)
+               ngx_str_rbtree_lookup(&cache->sh->rbtree, path, hash);
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    if ((ngx_msec_int_t) (node->expire - ngx_current_msec) <= 0) {
+        ngx_http_try_files_cache_delete(cache, node);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &node->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_try_files_cache_insert(ngx_http_request_t *r,
+    ngx_http_try_files_loc_conf_t *tlcf, ngx_str_t *path, ngx_uint_t since)
+{
+    uint32_t                     hash, dir_hash;
+    ngx_int_t                    rc;
+    ngx_str_t                    name;
+    ngx_file_info_t              fi;
+    ngx_http_try_files_dir_t    *dir;
+    ngx_http_try_files_node_t   *node;
+    ngx_http_try_files_cache_t  *cache;
+
+    cache = tlcf->cache_zone->data;
+
+    rc = ngx_http_try_files_cache_dir(cache, path, &name, since,
+                                      r->connection->log);
+
+    if (rc == NGX_DECLINED) {
+        return;
+    }
+
+    if (rc == NGX_DONE
+        && ngx_file_info(path->data, &fi) != NGX_FILE_ERROR)
+    {
+        /* created before the directory was watched */
+        return;
+    }
+
+    hash = ngx_crc32_short(path->data, path->len);
+    dir_hash = ngx_crc32_short(name.data, name.len);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = (ngx_http_try_files_node_t *)
+               ngx_str_rbtree_lookup(&cache->sh->rbtree, path, hash);
+
+    if (node) {
+        /* stored by another worker or for another candidate */
+
+        node->expire = ngx_current_msec + tlcf->cache_valid;
+
+        ngx_queue_remove(&node->queue);
+        ngx_queue_insert_head(&cache->sh->queue, &node->queue);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    ngx_http_try_files_cache_expire(cache, 1);
+
+    /* the node is allocated first, as eviction may free directories */
+
+    node = ngx_slab_alloc_locked(cache->shpool,
+                                 sizeof(ngx_http_try_files_node_t) + path->len);
+
+    if (node == NULL) {
+        ngx_http_try_files_cache_expire(cache, 0);
+
+        node = ngx_slab_alloc_locked(cache->shpool,
+                                     sizeof(ngx_http_try_files_node_t)
+                                     + path->len);
+        if (node == NULL) {
+            goto failed;
+        }
+    }
+
+    dir = (ngx_http_try_files_dir_t *)
+              ngx_str_rbtree_lookup(&cache->sh->dirs, &name, dir_hash);
+
+    if (dir == NULL) {
+        dir = ngx_slab_alloc_locked(cache->shpool,
+                                    sizeof(ngx_http_try_files_dir_t)
+                                    + name.len);
+
+        if (dir == NULL) {
+            ngx_http_try_files_cache_expire(cache, 0);
+
+            dir = ngx_slab_alloc_locked(cache->shpool,
+                                        sizeof(ngx_http_try_files_dir_t)
+                                        + name.len);
+            if (dir == NULL) {
+                ngx_slab_free_locked(cache->shpool, node);
+                goto failed;
+            }
+        }
+
+        dir->sn.node.key = dir_hash;
+        dir->sn.str.len = name.len;
+        dir->sn.str.data = (u_char *) (dir + 1);
+        ngx_memcpy(dir->sn.str.data, name.data, name.len);
+
+        ngx_queue_init(&dir->entries);
+
+        ngx_rbtree_insert(&cache->sh->dirs, &dir->sn.node);
+    }
+
+    node->sn.node.key = hash;
+    node->sn.str.len = path->len;
+    node->sn.str.data = (u_char *) (node + 1);
+    ngx_memcpy(node->sn.str.data, path->data, path->len);
+
+    node->dir = dir;
+    node->expire = ngx_current_msec + tlcf->cache_valid;
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &node->sn.node);
+    ngx_queue_insert_head(&cache->sh->queue, &node->queue);
+    ngx_queue_insert_tail(&dir->entries, &node->siblings);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "try files cache: \"%s\" stored, dir:\"%V\"",
+                   path->data, &name);
+
+    return;
+
+failed:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "try files cache: \"%s\" not stored", path->data);
+}
+
+
+static void
+ngx_http_try_files_cache_delete(ngx_http_try_files_cache_t *cache,
+    ngx_http_try_files_node_t *node)
+{
+    ngx_http_try_files_dir_t  *dir;
+
+    dir = node->dir;
+
+    ngx_queue_remove(&node->queue);
+    ngx_queue_remove(&node->siblings);
+    ngx_rbtree_delete(&cache->sh->rbtree, &node->sn.node);
+    ngx_slab_free_locked(cache->shpool, node);
+
+    if (ngx_queue_empty(&dir->entries)) {
+        ngx_rbtree_delete(&cache->sh->dirs, &dir->sn.node);
+        ngx_slab_free_locked(cache->shpool, dir);
+    }
+}
+
+
+static void
+ngx_http_try_files_cache_drop(ngx_http_try_files_cache_t *cache,
+    ngx_str_t *name, uint32_t hash)
+{
+    ngx_uint_t                  last;
+    ngx_queue_t                *q;
+    ngx_http_try_files_dir_t   *dir;
+    ngx_http_try_files_node_t  *node;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    dir = (ngx_http_try_files_dir_t *)
+              ngx_str_rbtree_lookup(&cache->sh->dirs, name, hash);
+
+    if (dir) {
+
+        /* the directory is freed along with its last entry */
+
+        do {
+            q = ngx_queue_head(&dir->entries);
+            last = (q == ngx_queue_last(&dir->entries));
+
+            node = ngx_queue_data(q, ngx_http_try_files_node_t, siblings);
+            ngx_http_try_files_cache_delete(cache, node);
+
+        } while (!last);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static void
+ngx_http_try_files_cache_expire(ngx_http_try_files_cache_t *cache,
+    ngx_uint_t n)
+{
+    ngx_queue_t                *q;
+    ngx_http_try_files_node_t  *node;
+
+    /*
+     * n == 1 deletes one or two expired entries at most,
+     * n == 0 deletes the least recently used entry and then one or two
+     * expired ones
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        node = ngx_queue_data(q, ngx_http_try_files_node_t, queue);
+
+        if (n++ != 0
+            && (ngx_msec_int_t) (node->expire - ngx_current_msec) > 0)
+        {
+            return;
+        }
+
+        ngx_http_try_files_cache_delete(cache, node);
+    }
+}
+
+
+/*
+ * finds the directory an entry belongs to, a prefix of the path;
+ * NGX_DONE means that the directory was not watched when the path was
+ * tested, so it has to be tested again, and NGX_DECLINED that the entry
+ * cannot be stored
+ */
+
+static ngx_int_t
+ngx_http_try_files_cache_dir(ngx_http_try_files_cache_t *cache,
+    ngx_str_t *path, ngx_str_t *dir, ngx_uint_t since, ngx_log_t *log)
+{
+    u_char                      *p;
+#if (NGX_HAVE_INOTIFY)
+    int                          wd;
+    u_char                       c;
+    ngx_err_t                    err;
+    ngx_http_try_files_watch_t  *w;
+#endif
+
+    dir->data = path->data;
+
+    p = path->data + path->len;
+
+    for ( ;; ) {
+
+        while (p > path->data && *(p - 1) != '/') {
+            p--;
+        }
+
+        if (p == path->data) {
+            /* a relative path */
+            return NGX_DECLINED;
+        }
+
+        p--;
+
+        /* the root directory keeps its slash */
+        dir->len = (p == path->data) ? 1 : (size_t) (p - path->data);
+
+#if !(NGX_HAVE_INOTIFY)
+
+        return NGX_OK;
+
+#else
+
+        if (ngx_http_try_files_inotify_init(log) != NGX_OK) {
+            return NGX_OK;
+        }
+
+        c = path->data[dir->len];
+        path->data[dir->len] = '\0';
+
+        wd = inotify_add_watch(ngx_http_try_files_inotify,
+                               (char *) path->data,
+                               IN_CREATE|IN_MOVED_TO|IN_DELETE_SELF
+                               |IN_MOVE_SELF|IN_ONLYDIR);
+
+        err = ngx_errno;
+
+        path->data[dir->len] = c;
+
+        if (wd != -1) {
+            break;
+        }
+
+        if ((err == NGX_ENOENT || err == NGX_ENOTDIR) && dir->len > 1) {
+            /* watch the nearest existing directory */
+            continue;
+        }
+
+        if (err == NGX_ENOSPC) {
+            if (!ngx_http_try_files_inotify_full) {
+                ngx_http_try_files_inotify_full = 1;
+
+                ngx_log_error(NGX_LOG_WARN, log, err,
+                              "inotify_add_watch(\"%V\") failed, "
+                              "try files cache is not used for "
+                              "unwatched directories", dir);
+            }
+
+            return NGX_DECLINED;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, err,
+                       "inotify_add_watch(\"%V\") failed, wd:%d", dir, wd);
+
+        return NGX_DECLINED;
+#endif
+    }
+
+#if (NGX_HAVE_INOTIFY)
+
+    w = ngx_http_try_files_inotify_lookup(wd);
+
+    if (w) {
+        if (w->cache == cache
+            && w->name.len == dir->len
+            && ngx_memcmp(w->name.data, dir->data, dir->len) == 0)
+        {
+            ngx_queue_remove(&w->queue);
+            ngx_queue_insert_head(&ngx_http_try_files_inotify_queue,
+                                  &w->queue);
+
+            return (w->seq > since) ? NGX_DONE : NGX_OK;
+        }
+
+        /* the same directory under another name or in another zone */
+
+        return NGX_DECLINED;
+    }
+
+    w = ngx_alloc(sizeof(ngx_http_try_files_watch_t) + dir->len, log);
+    if (w == NULL) {
+        (void) inotify_rm_watch(ngx_http_try_files_inotify, wd);
+        return NGX_DECLINED;
+    }
+
+    w->node.key = wd;
+    w->cache = cache;
+    w->seq = ++ngx_http_try_files_watches;
+    w->name.len = dir->len;
+    w->name.data = (u_char *) (w + 1);
+    ngx_memcpy(w->name.data, dir->data, dir->len);
+    w->hash = ngx_crc32_short(w->name.data, w->name.len);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "try files inotify watch: \"%V\", wd:%d", &w->name, wd);
+
+    ngx_rbtree_insert(&ngx_http_try_files_inotify_tree, &w->node);
+    ngx_queue_insert_head(&ngx_http_try_files_inotify_queue, &w->queue);
+
+    ngx_http_try_files_inotify_retire(w);
+
+    return NGX_DONE;
+
+#endif
+}
+
+
+#if (NGX_HAVE_INOTIFY)
+
+static ngx_int_t
+ngx_http_try_files_inotify_init(ngx_log_t *log)
+{
+    if (ngx_http_try_files_inotify != -1) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_try_files_inotify_failed) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_try_files_inotify_failed = 1;
+
+    ngx_http_try_files_inotify = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if (ngx_http_try_files_inotify == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "inotify_init1() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "try files inotify: %d", ngx_http_try_files_inotify);
+
+    ngx_rbtree_init(&ngx_http_try_files_inotify_tree,
+                    &ngx_http_try_files_inotify_sentinel,
+                    ngx_rbtree_insert_value);
+
+    ngx_queue_init(&ngx_http_try_files_inotify_queue);
+
+    ngx_http_try_files_inotify_rev.handler =
+                                           ngx_http_try_files_inotify_handler;
+    ngx_http_try_files_inotify_rev.data = &ngx_http_try_files_inotify_conn;
+    ngx_http_try_files_inotify_rev.log = ngx_cycle->log;
+
+    ngx_http_try_files_inotify_wev.data = &ngx_http_try_files_inotify_conn;
+    ngx_http_try_files_inotify_wev.log = ngx_cycle->log;
+
+    ngx_http_try_files_inotify_conn.fd = ngx_http_try_files_inotify;
+    ngx_http_try_files_inotify_conn.read = &ngx_http_try_files_inotify_rev;
+    ngx_http_try_files_inotify_conn.write = &ngx_http_try_files_inotify_wev;
+    ngx_http_try_files_inotify_conn.log = ngx_cycle->log;
+
+    if (ngx_handle_read_event(&ngx_http_try_files_inotify_rev, 0) != NGX_OK) {
+
+        if (close(ngx_http_try_files_inotify) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "inotify close() failed");
+        }
+
+        ngx_http_try_files_inotify = -1;
+
+        return NGX_ERROR;
+    }
+
+    ngx_http_try_files_inotify_failed = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_try_files_watch_t *
+ngx_http_try_files_inotify_lookup(int wd)
+{
+    ngx_rbtree_key_t    key;
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    key = (ngx_rbtree_key_t) wd;
+
+    node = ngx_http_try_files_inotify_tree.root;
+    sentinel = ngx_http_try_files_inotify_tree.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        return (ngx_http_try_files_watch_t *) node;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_try_files_inotify_del(ngx_http_try_files_watch_t *w, ngx_uint_t rm)
+{
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "try files inotify del: \"%V\", wd:%d",
+                   &w->name, (int) w->node.key);
+
+    if (rm) {
+        (void) inotify_rm_watch(ngx_http_try_files_inotify, (int) w->node.key);
+    }
+
+    ngx_rbtree_delete(&ngx_http_try_files_inotify_tree, &w->node);
+    ngx_queue_remove(&w->queue);
+
+    ngx_free(w);
+}
+
+
+static void
+ngx_http_try_files_inotify_retire(ngx_http_try_files_watch_t *w)
+{
+    ngx_uint_t                   i;
+    ngx_queue_t                 *q;
+    ngx_str_node_t              *dir;
+    ngx_http_try_files_watch_t  *old;
+
+    /*
+     * directories whose entries were evicted or expired are not needed
+     * anymore; each new watch retires up to two of the oldest such ones
+     */
+
+    for (i = 0; i < 2; i++) {
+
+        q = ngx_queue_last(&ngx_http_try_files_inotify_queue);
+        old = ngx_queue_data(q, ngx_http_try_files_watch_t, queue);
+
+        if (old == w) {
+            return;
+        }
+
+        ngx_shmtx_lock(&old->cache->shpool->mutex);
+
+        dir = ngx_str_rbtree_lookup(&old->cache->sh->dirs, &old->name,
+                                    old->hash);
+
+        ngx_shmtx_unlock(&old->cache->shpool->mutex);
+
+        if (dir) {
+            ngx_queue_remove(q);
+            ngx_queue_insert_head(&ngx_http_try_files_inotify_queue, q);
+            continue;
+        }
+
+        ngx_http_try_files_inotify_del(old, 1);
+    }
+}
+
+
+static void
+ngx_http_try_files_inotify_handler(ngx_event_t *ev)
+{
+    u_char                      *p;
+    ssize_t                      n;
+    ngx_err_t                    err;
+    ngx_queue_t                 *q;
+    struct inotify_event        *ie;
+    ngx_http_try_files_watch_t  *w;
+    uint32_t                     buf[1024];
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "try files inotify handler");
+
+    for ( ;; ) {
+
+        n = read(ngx_http_try_files_inotify, buf, sizeof(buf));
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                              "inotify read() failed");
+            }
+
+            ev->ready = 0;
+            return;
+        }
+
+        for (p = (u_char *) buf; p < (u_char *) buf + n; /* void */) {
+
+            ie = (struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + ie->len;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                           "try files inotify event: wd:%d mask:%xD",
+                           ie->wd, ie->mask);
+
+            if (ie->mask & IN_Q_OVERFLOW) {
+
+                /* the events were lost, so nothing watched can be trusted */
+
+                ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                              "try files inotify queue overflow");
+
+                while (!ngx_queue_empty(&ngx_http_try_files_inotify_queue)) {
+                    q = ngx_queue_head(&ngx_http_try_files_inotify_queue);
+                    w = ngx_queue_data(q, ngx_http_try_files_watch_t, queue);
+
+                    ngx_http_try_files_cache_drop(w->cache, &w->name,
+                                                  w->hash);
+                    ngx_http_try_files_inotify_del(w, 1);
+                }
+
+                continue;
+            }
+
+            w = ngx_http_try_files_inotify_lookup(ie->wd);
+
+            if (w == NULL) {
+                continue;
+            }
+
+            /* the entries are dropped, and new ones add a new watch */
+
+            ngx_http_try_files_cache_drop(w->cache, &w->name, w->hash);
+            ngx_http_try_files_inotify_del(w, !(ie->mask & IN_IGNORED));
+        }
+    }
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_try_files_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_try_files_cache_t  *ocache = data;
+
+    size_t                       len;
+    ngx_http_try_files_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        /* the document root may have been switched */
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        while (!ngx_queue_empty(&cache->sh->queue)) {
+            ngx_http_try_files_cache_expire(cache, 0);
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_try_files_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_rbtree_init(&cache->sh->dirs, &cache->sh->dirs_sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in try_files_cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in try_files_cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* a full zone evicts entries */
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static char *
+ngx_http_try_files(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_try_files_loc_conf_t *tlcf = conf;
+
+    ngx_str_t                  *value;
+    ngx_int_t                   code;
+    ngx_uint_t                  i, n;
+    ngx_http_try_file_t        *tf;
+    ngx_http_script_compile_t   sc;
+
+    if (tlcf->try_files) {
+        return "is duplicate";
+    }
+
+    tf = ngx_pcalloc(cf->pool, cf->args->nelts * sizeof(ngx_http_try_file_t));
+    if (tf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    tlcf->try_files = tf;
+
+    value = cf->args->elts;
+
+    for (i = 0; i < cf->args->nelts - 1; i++) {
+
+        tf[i].name = value[i + 1];
+
+        if (tf[i].name.len > 0
+            && tf[i].name.data[tf[i].name.len - 1] == '/'
+            && i + 2 < cf->args->nelts)
+        {
+            tf[i].test_dir = 1;
+            tf[i].name.len--;
+            tf[i].name.data[tf[i].name.len] = '\0';
+        }
+
+        n = ngx_http_script_variables_count(&tf[i].name);
+
+        if (n) {
+            ngx_memzero(&sc, sizeof(ngx_http_script_compile_t));
+
+            sc.cf = cf;
+            sc.source = &tf[i].name;
+            sc.lengths = &tf[i].lengths;
+            sc.values = &tf[i].values;
+            sc.variables = n;
+            sc.complete_lengths = 1;
+            sc.complete_values = 1;
+
+            if (ngx_http_script_compile(&sc) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+        } else {
+            /* add trailing '\0' to length */
+            tf[i].name.len++;
+        }
+    }
+
+    if (tf[i - 1].name.data[0] == '=') {
+
+        code = ngx_atoi(tf[i - 1].name.data + 1, tf[i - 1].name.len - 2);
+
+        if (code == NGX_ERROR || code > 999) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid code \"%*s\"",
+                               tf[i - 1].name.len - 1, tf[i - 1].name.data);
+            return NGX_CONF_ERROR;
+        }
+
+        tf[i].code = code;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_try_files_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_try_files_loc_conf_t *tlcf = conf;
+
+    u_char                      *p;
+    ssize_t                      size;
+    ngx_str_t                   *value, name, s;
+    ngx_uint_t                   i;
+    ngx_msec_t                   valid;
+    ngx_shm_zone_t              *shm_zone;
+    ngx_http_try_files_cache_t  *cache;
+
+    if (tlcf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "takes no parameters with \"off\"";
+        }
+
+        tlcf->cache_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    size = 0;
+    name.len = 0;
+    valid = 60000;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+            name.len = value[i].len - 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                /* a zone defined elsewhere */
+                continue;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            valid = ngx_parse_time(&s, 0);
+
+            if (valid == (ngx_msec_t) NGX_ERROR || valid == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid valid value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_try_files_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data == NULL) {
+        cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_try_files_cache_t));
+        if (cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        shm_zone->init = ngx_http_try_files_cache_init_zone;
+        shm_zone->data = cache;
+    }
+
+    tlcf->cache_zone = shm_zone;
+    tlcf->cache_valid = valid;
+
+    return NGX_CONF_OK;
+}
+
+
+static void *
+ngx_http_try_files_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_try_files_loc_conf_t  *tlcf;
+
+    tlcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_try_files_loc_conf_t));
+    if (tlcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     tlcf->try_files = NULL;
+     */
+
+    tlcf->cache_zone = NGX_CONF_UNSET_PTR;
+    tlcf->cache_valid = NGX_CONF_UNSET_MSEC;
+    tlcf->threads = NGX_CONF_UNSET;
+
+    return tlcf;
+}
+
+
+static char *
+ngx_http_try_files_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_try_files_loc_conf_t *prev = parent;
+    ngx_http_try_files_loc_conf_t *conf = child;
+
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_zone = prev->cache_zone;
+        conf->cache_valid = prev->cache_valid;
+    }
+
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_zone = NULL;
+    }
+
+    ngx_conf_merge_msec_value(conf->cache_valid, prev->cache_valid, 60000);
+
+    ngx_conf_merge_value(conf->threads, prev->threads, 0);
+
+    return NGX_CONF_OK;
 }
 
 
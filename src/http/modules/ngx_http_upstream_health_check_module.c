@@ -0,0 +1,841 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_msec_t                         interval;
+    ngx_msec_t                         timeout;
+    ngx_uint_t                         fails;
+    ngx_uint_t                         passes;
+
+    ngx_str_t                          request;    /* empty for tcp checks */
+
+    ngx_http_upstream_srv_conf_t      *upstream;
+} ngx_http_upstream_hc_srv_conf_t;
+
+
+typedef struct {
+    ngx_array_t                        checks;
+                                   /* array of ngx_http_upstream_hc_srv_conf_t * */
+} ngx_http_upstream_hc_main_conf_t;
+
+
+typedef struct {
+    ngx_http_upstream_hc_srv_conf_t   *conf;
+
+    ngx_http_upstream_rr_peers_t      *peers;
+
+    /* servers may be removed at run time, so they are found by id */
+    ngx_uint_t                         id;
+    ngx_addr_t                         addr;
+
+    ngx_peer_connection_t              pc;
+    ngx_event_t                        event;
+
+    u_char                            *pos;        /* request to send */
+    u_char                            *last;
+
+    u_char                             response[32];
+    size_t                             received;
+
+    ngx_uint_t                         fails;
+    ngx_uint_t                         passes;
+} ngx_http_upstream_hc_peer_t;
+
+
+static ngx_int_t ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_upstream_hc_init_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_hc_srv_conf_t *hcf, ngx_http_upstream_rr_peers_t *peers);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_hc_peer(
+    ngx_http_upstream_hc_peer_t *hp);
+static void ngx_http_upstream_hc_start(ngx_event_t *ev);
+static void ngx_http_upstream_hc_write_handler(ngx_event_t *wev);
+static void ngx_http_upstream_hc_read_handler(ngx_event_t *rev);
+static void ngx_http_upstream_hc_dummy_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_hc_test_connect(ngx_connection_t *c);
+static ngx_int_t ngx_http_upstream_hc_parse_status(
+    ngx_http_upstream_hc_peer_t *hp);
+static void ngx_http_upstream_hc_done(ngx_http_upstream_hc_peer_t *hp,
+    ngx_uint_t ok);
+
+static void *ngx_http_upstream_hc_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_hc_init_main_conf(ngx_conf_t *cf, void *conf);
+static void *ngx_http_upstream_hc_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_health_check(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_health_check,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_health_check_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_upstream_hc_create_main_conf, /* create main configuration */
+    ngx_http_upstream_hc_init_main_conf,   /* init main configuration */
+
+    ngx_http_upstream_hc_create_srv_conf,  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_health_check_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_health_check_module_ctx, /* module context */
+    ngx_http_upstream_hc_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_hc_init_process,     /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                          i;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_hc_srv_conf_t   **hcfp;
+    ngx_http_upstream_hc_main_conf_t   *hmcf;
+
+    /*
+     * the peers state is shared via upstream zones, so probing
+     * from the first worker process is enough
+     */
+
+    if ((ngx_process != NGX_PROCESS_WORKER || ngx_worker != 0)
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    hmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                         ngx_http_upstream_health_check_module);
+    if (hmcf == NULL) {
+        return NGX_OK;
+    }
+
+    hcfp = hmcf->checks.elts;
+
+    for (i = 0; i < hmcf->checks.nelts; i++) {
+        peers = hcfp[i]->upstream->peer.data;
+
+        if (ngx_http_upstream_hc_init_peers(cycle, hcfp[i], peers) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (peers->next
+            && ngx_http_upstream_hc_init_peers(cycle, hcfp[i], peers->next)
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_hc_srv_conf_t *hcf, ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_msec_t                    delay;
+    ngx_http_upstream_rr_peer_t  *peer;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (peer->host) {
+            /* servers resolved at run time come and go */
+            continue;
+        }
+#endif
+
+        hp = ngx_pcalloc(cycle->pool, sizeof(ngx_http_upstream_hc_peer_t));
+        if (hp == NULL) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return NGX_ERROR;
+        }
+
+        hp->conf = hcf;
+        hp->peers = peers;
+        hp->id = peer->id;
+
+        hp->addr.sockaddr = ngx_pnalloc(cycle->pool, peer->socklen);
+        hp->addr.name.data = ngx_pnalloc(cycle->pool, peer->name.len);
+
+        if (hp->addr.sockaddr == NULL || hp->addr.name.data == NULL) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(hp->addr.sockaddr, peer->sockaddr, peer->socklen);
+        hp->addr.socklen = peer->socklen;
+
+        ngx_memcpy(hp->addr.name.data, peer->name.data, peer->name.len);
+        hp->addr.name.len = peer->name.len;
+
+        hp->event.handler = ngx_http_upstream_hc_start;
+        hp->event.data = hp;
+        hp->event.log = cycle->log;
+        hp->event.cancelable = 1;
+
+        /* spread the first probes over the interval */
+
+        delay = (ngx_msec_t) ngx_random() % hcf->interval;
+
+        ngx_add_timer(&hp->event, delay);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_hc_peer(ngx_http_upstream_hc_peer_t *hp)
+{
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    /* peers are locked */
+
+    for (peer = hp->peers->peer; peer; peer = peer->next) {
+        if (peer->id == hp->id) {
+            return peer;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_upstream_hc_start(ngx_event_t *ev)
+{
+    ngx_int_t                     rc;
+    ngx_connection_t             *c;
+    ngx_http_upstream_rr_peer_t  *peer;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    hp = ev->data;
+
+    if (ngx_exiting || ngx_quit || ngx_terminate) {
+        return;
+    }
+
+    ngx_http_upstream_rr_peers_rlock(hp->peers);
+
+    peer = ngx_http_upstream_hc_peer(hp);
+
+    ngx_http_upstream_rr_peers_unlock(hp->peers);
+
+    if (peer == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                       "health check of \"%V\" stopped, server removed",
+                       &hp->addr.name);
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check of \"%V\"", &hp->addr.name);
+
+    ngx_memzero(&hp->pc, sizeof(ngx_peer_connection_t));
+
+    hp->pc.sockaddr = hp->addr.sockaddr;
+    hp->pc.socklen = hp->addr.socklen;
+    hp->pc.name = &hp->addr.name;
+    hp->pc.get = ngx_event_get_peer;
+    hp->pc.log = ev->log;
+    hp->pc.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&hp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    c = hp->pc.connection;
+
+    c->data = hp;
+    c->pool = NULL;
+
+    c->read->handler = ngx_http_upstream_hc_read_handler;
+    c->write->handler = ngx_http_upstream_hc_write_handler;
+
+    hp->pos = hp->conf->request.data;
+    hp->last = hp->conf->request.data + hp->conf->request.len;
+    hp->received = 0;
+
+    ngx_add_timer(c->write, hp->conf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_hc_write_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_write_handler(ngx_event_t *wev)
+{
+    ssize_t                       n;
+    ngx_connection_t             *c;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    c = wev->data;
+    hp = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, wev->log, 0,
+                   "health check write handler");
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, wev->log, NGX_ETIMEDOUT,
+                      "health check of \"%V\" timed out", &hp->addr.name);
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    if (ngx_http_upstream_hc_test_connect(c) != NGX_OK) {
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    if (hp->pos == hp->last) {
+
+        /* tcp check: the connection was established */
+
+        ngx_http_upstream_hc_done(hp, 1);
+        return;
+    }
+
+    n = ngx_send(c, hp->pos, hp->last - hp->pos);
+
+    if (n == NGX_ERROR) {
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    if (n > 0) {
+        hp->pos += n;
+
+        if (hp->pos == hp->last) {
+            wev->handler = ngx_http_upstream_hc_dummy_handler;
+
+            if (wev->timer_set) {
+                ngx_del_timer(wev);
+            }
+
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_upstream_hc_done(hp, 0);
+                return;
+            }
+
+            ngx_add_timer(c->read, hp->conf->timeout);
+
+            if (c->read->ready) {
+                ngx_http_upstream_hc_read_handler(c->read);
+            }
+
+            return;
+        }
+    }
+
+    if (!wev->timer_set) {
+        ngx_add_timer(wev, hp->conf->timeout);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_read_handler(ngx_event_t *rev)
+{
+    ssize_t                       n;
+    ngx_int_t                     rc;
+    ngx_connection_t             *c;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    c = rev->data;
+    hp = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, rev->log, 0,
+                   "health check read handler");
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, NGX_ETIMEDOUT,
+                      "health check of \"%V\" timed out", &hp->addr.name);
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    if (hp->pos != hp->last || hp->conf->request.len == 0) {
+
+        /* the request is not sent yet, or a tcp check is in progress */
+
+        if (ngx_http_upstream_hc_test_connect(c) != NGX_OK) {
+            ngx_http_upstream_hc_done(hp, 0);
+            return;
+        }
+
+        if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+            ngx_http_upstream_hc_done(hp, 0);
+        }
+
+        return;
+    }
+
+    for ( ;; ) {
+
+        n = ngx_recv(c, hp->response + hp->received,
+                     sizeof(hp->response) - hp->received);
+
+        if (n > 0) {
+            hp->received += n;
+
+            rc = ngx_http_upstream_hc_parse_status(hp);
+
+            if (rc == NGX_AGAIN) {
+                if (hp->received < sizeof(hp->response)) {
+                    continue;
+                }
+
+                rc = NGX_ERROR;
+            }
+
+            if (rc == NGX_ERROR) {
+                ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                              "health check of \"%V\" failed: "
+                              "invalid response", &hp->addr.name);
+            }
+
+            ngx_http_upstream_hc_done(hp, rc == NGX_OK);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_hc_done(hp, 0);
+            }
+
+            return;
+        }
+
+        break;
+    }
+
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                      "health check of \"%V\" failed: "
+                      "connection closed prematurely", &hp->addr.name);
+    }
+
+    ngx_http_upstream_hc_done(hp, 0);
+}
+
+
+static void
+ngx_http_upstream_hc_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check dummy handler");
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_test_connect(ngx_connection_t *c)
+{
+    int                           err;
+    socklen_t                     len;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    err = 0;
+    len = sizeof(int);
+
+    /*
+     * BSDs and Linux return 0 and set a pending error in err
+     * Solaris returns -1 and sets errno
+     */
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == -1) {
+        err = ngx_socket_errno;
+    }
+
+    if (err) {
+        hp = c->data;
+
+        ngx_log_error(NGX_LOG_ERR, c->log, err,
+                      "health check of \"%V\" failed: connect() failed",
+                      &hp->addr.name);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_parse_status(ngx_http_upstream_hc_peer_t *hp)
+{
+    u_char      *p;
+    ngx_uint_t   status;
+
+    /* "HTTP/1.x 200 " */
+
+    if (hp->received < sizeof("HTTP/1.x 200") - 1) {
+        return NGX_AGAIN;
+    }
+
+    p = hp->response;
+
+    if (ngx_strncmp(p, "HTTP/1.", 7) != 0 || p[8] != ' ') {
+        return NGX_ERROR;
+    }
+
+    p += 9;
+
+    if (p[0] < '1' || p[0] > '5'
+        || p[1] < '0' || p[1] > '9'
+        || p[2] < '0' || p[2] > '9')
+    {
+        return NGX_ERROR;
+    }
+
+    status = (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, hp->event.log, 0,
+                   "health check of \"%V\" status: %ui",
+                   &hp->addr.name, status);
+
+    if (status >= 200 && status < 400) {
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, hp->event.log, 0,
+                  "health check of \"%V\" failed: status %ui",
+                  &hp->addr.name, status);
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_upstream_hc_done(ngx_http_upstream_hc_peer_t *hp, ngx_uint_t ok)
+{
+    ngx_http_upstream_rr_peer_t      *peer;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    if (hp->pc.connection) {
+        ngx_close_connection(hp->pc.connection);
+        hp->pc.connection = NULL;
+    }
+
+    hcf = hp->conf;
+
+    ngx_http_upstream_rr_peers_rlock(hp->peers);
+
+    peer = ngx_http_upstream_hc_peer(hp);
+
+    if (peer == NULL) {
+        ngx_http_upstream_rr_peers_unlock(hp->peers);
+        return;
+    }
+
+    ngx_http_upstream_rr_peer_lock(hp->peers, peer);
+
+    if (ok) {
+        hp->fails = 0;
+
+        if ((peer->down & NGX_HTTP_UPSTREAM_RR_PEER_UNHEALTHY)
+            && ++hp->passes >= hcf->passes)
+        {
+            peer->down &= ~NGX_HTTP_UPSTREAM_RR_PEER_UNHEALTHY;
+
+            /* let passive checks start over */
+
+            peer->fails = 0;
+
+            if (peer->slow_start) {
+                peer->start_time = ngx_current_msec;
+            }
+
+            ngx_log_error(NGX_LOG_NOTICE, hp->event.log, 0,
+                          "upstream server \"%V\" of \"%V\" is healthy",
+                          &peer->name, hp->peers->name);
+        }
+
+    } else {
+        hp->passes = 0;
+
+        if (!(peer->down & NGX_HTTP_UPSTREAM_RR_PEER_UNHEALTHY)
+            && ++hp->fails >= hcf->fails)
+        {
+            peer->down |= NGX_HTTP_UPSTREAM_RR_PEER_UNHEALTHY;
+
+            ngx_log_error(NGX_LOG_WARN, hp->event.log, 0,
+                          "upstream server \"%V\" of \"%V\" is unhealthy",
+                          &peer->name, hp->peers->name);
+        }
+    }
+
+    ngx_http_upstream_rr_peer_unlock(hp->peers, peer);
+    ngx_http_upstream_rr_peers_unlock(hp->peers);
+
+    if (ngx_exiting || ngx_quit || ngx_terminate) {
+        return;
+    }
+
+    ngx_add_timer(&hp->event, hcf->interval);
+}
+
+
+static void *
+ngx_http_upstream_hc_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_hc_main_conf_t  *hmcf;
+
+    hmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_hc_main_conf_t));
+    if (hmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&hmcf->checks, cf->pool, 4,
+                       sizeof(ngx_http_upstream_hc_srv_conf_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return hmcf;
+}
+
+
+static char *
+ngx_http_upstream_hc_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_upstream_hc_main_conf_t *hmcf = conf;
+
+    ngx_uint_t                         i;
+    ngx_http_upstream_hc_srv_conf_t  **hcfp;
+
+    hcfp = hmcf->checks.elts;
+
+    for (i = 0; i < hmcf->checks.nelts; i++) {
+
+        if (hcfp[i]->upstream->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "\"health_check\" requires \"zone\" "
+                          "in upstream \"%V\" in %s:%ui",
+                          &hcfp[i]->upstream->host,
+                          hcfp[i]->upstream->file_name,
+                          hcfp[i]->upstream->line);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static void *
+ngx_http_upstream_hc_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_hc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->request = { 0, NULL };
+     *     conf->upstream = NULL;
+     */
+
+    conf->interval = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_health_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *hcf = conf;
+
+    u_char                             *p;
+    ngx_str_t                          *value, s, uri;
+    ngx_int_t                           n;
+    ngx_uint_t                          i, tcp;
+    ngx_http_upstream_srv_conf_t       *uscf;
+    ngx_http_upstream_hc_srv_conf_t   **hcfp;
+    ngx_http_upstream_hc_main_conf_t   *hmcf;
+
+    if (hcf->interval != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    hcf->interval = 5000;
+    hcf->timeout = 1000;
+    hcf->fails = 1;
+    hcf->passes = 1;
+
+    ngx_str_set(&uri, "/");
+    tcp = 0;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            hcf->interval = ngx_parse_time(&s, 0);
+
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR
+                || hcf->timeout == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+            uri.len = value[i].len - 4;
+            uri.data = value[i].data + 4;
+
+            if (uri.len == 0 || uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=tcp") == 0) {
+            tcp = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=http") == 0) {
+            tcp = 0;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    hcf->upstream = uscf;
+
+    if (!tcp) {
+        hcf->request.len = sizeof("GET  HTTP/1.0" CRLF) - 1 + uri.len
+                           + sizeof("Host: " CRLF) - 1 + uscf->host.len
+                           + sizeof("Connection: close" CRLF CRLF) - 1;
+
+        hcf->request.data = ngx_pnalloc(cf->pool, hcf->request.len);
+        if (hcf->request.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        p = ngx_sprintf(hcf->request.data,
+                        "GET %V HTTP/1.0" CRLF
+                        "Host: %V" CRLF
+                        "Connection: close" CRLF CRLF,
+                        &uri, &uscf->host);
+
+        hcf->request.len = p - hcf->request.data;
+    }
+
+    hmcf = ngx_http_conf_get_module_main_conf(cf,
+                                         ngx_http_upstream_health_check_module);
+
+    hcfp = ngx_array_push(&hmcf->checks);
+    if (hcfp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *hcfp = hcf;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
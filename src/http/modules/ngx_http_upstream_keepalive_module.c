@@ -12,12 +12,15 @@
 
 typedef struct {
     ngx_uint_t                         max_cached;
+    ngx_uint_t                         max_total;
     ngx_uint_t                         requests;
     ngx_msec_t                         timeout;
 
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
 
+    ngx_http_upstream_srv_conf_t      *upstream;
+
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
 
@@ -65,6 +68,11 @@ static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+static ngx_atomic_t *ngx_http_upstream_keepalive_idle(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf);
+#endif
+
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_keepalive_set_session(
     ngx_peer_connection_t *pc, void *data);
@@ -80,7 +88,7 @@ static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
 
     { ngx_string("keepalive"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
       ngx_http_upstream_keepalive,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
@@ -152,6 +160,16 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     ngx_conf_init_msec_value(kcf->timeout, 60000);
     ngx_conf_init_uint_value(kcf->requests, 100);
 
+    if (kcf->max_total && us->shm_zone == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "\"keepalive\" with \"total\" requires \"zone\" "
+                      "in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
+
+    kcf->upstream = us;
+
     if (kcf->original_init_upstream(cf, us) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -232,6 +250,9 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
     ngx_int_t          rc;
     ngx_queue_t       *q, *cache;
     ngx_connection_t  *c;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_atomic_t      *idle;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer");
@@ -270,6 +291,14 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
 
 found:
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    idle = ngx_http_upstream_keepalive_idle(kp->conf);
+
+    if (idle) {
+        (void) ngx_atomic_fetch_add(idle, -1);
+    }
+#endif
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer: using connection %p", c);
 
@@ -301,6 +330,9 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_queue_t          *q;
     ngx_connection_t     *c;
     ngx_http_upstream_t  *u;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_atomic_t         *idle;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer");
@@ -344,6 +376,37 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer: saving connection %p", c);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * with "total", the number of idle connections kept by all worker
+     * processes is limited; once the limit is reached, the connection
+     * replaces the least recently used one of this worker, if any
+     */
+
+    idle = ngx_http_upstream_keepalive_idle(kp->conf);
+
+    if (idle
+        && (ngx_uint_t) ngx_atomic_fetch_add(idle, 1) >= kp->conf->max_total)
+    {
+        (void) ngx_atomic_fetch_add(idle, -1);
+
+        if (ngx_queue_empty(&kp->conf->cache)) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                           "free keepalive peer: total limit reached");
+            goto invalid;
+        }
+
+        q = ngx_queue_last(&kp->conf->cache);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+        ngx_http_upstream_keepalive_close(item->connection);
+
+    } else
+#endif
+
     if (ngx_queue_empty(&kp->conf->free)) {
 
         q = ngx_queue_last(&kp->conf->cache);
@@ -413,6 +476,9 @@ ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
     int                n;
     char               buf[1];
     ngx_connection_t  *c;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_atomic_t      *idle;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
                    "keepalive close handler");
@@ -440,6 +506,14 @@ close:
     item = c->data;
     conf = item->conf;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    idle = ngx_http_upstream_keepalive_idle(conf);
+
+    if (idle) {
+        (void) ngx_atomic_fetch_add(idle, -1);
+    }
+#endif
+
     ngx_http_upstream_keepalive_close(c);
 
     ngx_queue_remove(&item->queue);
@@ -470,6 +544,31 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_atomic_t *
+ngx_http_upstream_keepalive_idle(ngx_http_upstream_keepalive_srv_conf_t *kcf)
+{
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    if (kcf->max_total == 0) {
+        return NULL;
+    }
+
+    /* the zone module has replaced peers with their copy in shared memory */
+
+    peers = kcf->upstream->peer.data;
+
+    if (peers->shpool == NULL) {
+        return NULL;
+    }
+
+    return &peers->idle;
+}
+
+#endif
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -509,7 +608,9 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      *
      *     conf->original_init_upstream = NULL;
      *     conf->original_init_peer = NULL;
+     *     conf->upstream = NULL;
      *     conf->max_cached = 0;
+     *     conf->max_total = 0;
      */
 
     conf->timeout = NGX_CONF_UNSET_MSEC;
@@ -526,7 +627,7 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_upstream_keepalive_srv_conf_t  *kcf = conf;
 
     ngx_int_t    n;
-    ngx_str_t   *value;
+    ngx_str_t   *value, s;
 
     if (kcf->max_cached) {
         return "is duplicate";
@@ -547,6 +648,30 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     kcf->max_cached = n;
 
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "total=", 6) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 6;
+        s.data = value[2].data + 6;
+
+        n = ngx_atoi(s.data, s.len);
+
+        if (n == NGX_ERROR || n == 0) {
+            goto invalid;
+        }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        kcf->max_total = n;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"total\" requires the upstream zone module");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
     /* init upstream handler */
 
     uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
@@ -558,4 +683,11 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     uscf->peer.init_upstream = ngx_http_upstream_init_keepalive;
 
     return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
 }
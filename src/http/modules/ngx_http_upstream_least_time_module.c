@@ -0,0 +1,537 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * Each peer keeps a "peak" EWMA of its response time: a sample above
+ * the average replaces it at once, samples below it are mixed in with
+ * a weight that grows with the time passed since the previous update.
+ * Without new samples the average decays towards zero, so a peer that
+ * was slow once is eventually tried again.
+ */
+
+#define NGX_HTTP_UPSTREAM_LT_HEADER     0
+#define NGX_HTTP_UPSTREAM_LT_LAST_BYTE  1
+#define NGX_HTTP_UPSTREAM_LT_CONNECT    2
+
+/* the average is kept in 1/1024 ms units */
+#define NGX_HTTP_UPSTREAM_LT_SHIFT      10
+
+/* decay time, in milliseconds */
+#define NGX_HTTP_UPSTREAM_LT_DECAY      10000
+
+
+typedef struct {
+    ngx_http_upstream_rr_peer_t              *peer;
+    ngx_uint_t                                range;
+} ngx_http_upstream_least_time_range_t;
+
+
+typedef struct {
+    ngx_uint_t                                mode;
+    ngx_http_upstream_least_time_range_t     *ranges;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                                config;
+#endif
+} ngx_http_upstream_least_time_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t          rrp;
+
+    ngx_http_upstream_least_time_srv_conf_t  *conf;
+    ngx_http_upstream_t                      *upstream;
+    ngx_msec_t                                start;
+    u_char                                    tries;
+} ngx_http_upstream_least_time_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_least_time(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_update_least_time(ngx_pool_t *pool,
+    ngx_http_upstream_srv_conf_t *us);
+
+static ngx_int_t ngx_http_upstream_init_least_time_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_least_time_peer(
+    ngx_peer_connection_t *pc, void *data);
+static void ngx_http_upstream_free_least_time_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_uint_t ngx_http_upstream_peek_least_time_peer(
+    ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_least_time_peer_data_t *lp);
+static uint64_t ngx_http_upstream_least_time_cost(
+    ngx_http_upstream_rr_peer_t *peer, ngx_msec_t now);
+static void *ngx_http_upstream_least_time_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_least_time_commands[] = {
+
+    { ngx_string("least_time"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_least_time,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_least_time_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_least_time_create_conf, /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_least_time_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_least_time_module_ctx, /* module context */
+    ngx_http_upstream_least_time_commands, /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_time(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0, "init least time");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_least_time_peer;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (us->shm_zone) {
+        return NGX_OK;
+    }
+#endif
+
+    return ngx_http_upstream_update_least_time(cf->pool, us);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_update_least_time(ngx_pool_t *pool,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    size_t                                    size;
+    ngx_uint_t                                i, total_weight;
+    ngx_http_upstream_rr_peer_t              *peer;
+    ngx_http_upstream_rr_peers_t             *peers;
+    ngx_http_upstream_least_time_range_t     *ranges;
+    ngx_http_upstream_least_time_srv_conf_t  *ltcf;
+
+    ltcf = ngx_http_conf_upstream_srv_conf(us,
+                                           ngx_http_upstream_least_time_module);
+
+    peers = us->peer.data;
+
+    size = peers->number * sizeof(ngx_http_upstream_least_time_range_t);
+
+    ranges = pool ? ngx_palloc(pool, size) : ngx_alloc(size, ngx_cycle->log);
+    if (ranges == NULL) {
+        return NGX_ERROR;
+    }
+
+    total_weight = 0;
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        ranges[i].peer = peer;
+        ranges[i].range = total_weight;
+        total_weight += peer->weight;
+    }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (pool == NULL && ltcf->ranges) {
+        ngx_free(ltcf->ranges);
+    }
+
+    ltcf->config = peers->config ? *peers->config : 0;
+#endif
+
+    ltcf->ranges = ranges;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_time_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_least_time_srv_conf_t   *ltcf;
+    ngx_http_upstream_least_time_peer_data_t  *lp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init least time peer");
+
+    ltcf = ngx_http_conf_upstream_srv_conf(us,
+                                           ngx_http_upstream_least_time_module);
+
+    lp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_least_time_peer_data_t));
+    if (lp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &lp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_least_time_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_least_time_peer;
+
+    lp->conf = ltcf;
+    lp->upstream = r->upstream;
+    lp->start = 0;
+    lp->tries = 0;
+
+    ngx_http_upstream_rr_peers_rlock(lp->rrp.peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (lp->rrp.peers->shpool
+        && (ltcf->ranges == NULL
+            || (lp->rrp.peers->config
+                && ltcf->config != *lp->rrp.peers->config)))
+    {
+        if (ngx_http_upstream_update_least_time(NULL, us) != NGX_OK) {
+            ngx_http_upstream_rr_peers_unlock(lp->rrp.peers);
+            return NGX_ERROR;
+        }
+    }
+#endif
+
+    ngx_http_upstream_rr_peers_unlock(lp->rrp.peers);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_least_time_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_least_time_peer_data_t  *lp = data;
+
+    time_t                             now;
+    uint64_t                           cost, prev_cost;
+    uintptr_t                          m;
+    ngx_uint_t                         i, n, p;
+    ngx_http_upstream_rr_peer_t       *peer, *prev;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_rr_peer_data_t  *rrp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least time peer, try: %ui", pc->tries);
+
+    rrp = &lp->rrp;
+    peers = rrp->peers;
+
+    lp->start = ngx_current_msec;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    if (lp->tries > 20
+        || peers->single
+        || ngx_http_upstream_rr_peers_changed(rrp))
+    {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    prev = NULL;
+
+#if (NGX_SUPPRESS_WARN)
+    p = 0;
+    prev_cost = 0;
+#endif
+
+    /* the better of two random choices, as in "random two" */
+
+    for ( ;; ) {
+
+        i = ngx_http_upstream_peek_least_time_peer(peers, lp);
+
+        peer = lp->conf->ranges[i].peer;
+
+        if (peer == prev) {
+            goto next;
+        }
+
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (rrp->tried[n] & m) {
+            goto next;
+        }
+
+        if (peer->down) {
+            goto next;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            goto next;
+        }
+
+        if (peer->max_conns && peer->conns >= peer->max_conns) {
+            goto next;
+        }
+
+        cost = ngx_http_upstream_least_time_cost(peer, ngx_current_msec);
+
+        if (prev) {
+            if (cost * prev->weight > prev_cost * peer->weight) {
+                peer = prev;
+                n = p / (8 * sizeof(uintptr_t));
+                m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+            }
+
+            break;
+        }
+
+        prev = peer;
+        prev_cost = cost;
+        p = i;
+
+    next:
+
+        if (++lp->tries > 20) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+        }
+    }
+
+    rrp->current = peer;
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    peer->conns++;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    rrp->tried[n] |= m;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_free_least_time_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state)
+{
+    ngx_http_upstream_least_time_peer_data_t  *lp = data;
+
+    uint64_t                      ewma, elapsed;
+    ngx_msec_t                    now, sample;
+    ngx_http_upstream_state_t    *us;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    peer = lp->rrp.current;
+    us = lp->upstream->state;
+
+    if (peer == NULL || us == NULL || (state & NGX_PEER_FAILED)) {
+        goto done;
+    }
+
+    now = ngx_current_msec;
+
+    if (lp->conf->mode == NGX_HTTP_UPSTREAM_LT_HEADER
+        && us->header_time != (ngx_msec_t) -1)
+    {
+        sample = us->header_time;
+
+    } else if (lp->conf->mode == NGX_HTTP_UPSTREAM_LT_CONNECT
+               && us->connect_time != (ngx_msec_t) -1)
+    {
+        sample = us->connect_time;
+
+    } else {
+        sample = now - lp->start;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free least time peer: %M ms, %ui", sample, state);
+
+    ngx_http_upstream_rr_peers_rlock(lp->rrp.peers);
+    ngx_http_upstream_rr_peer_lock(lp->rrp.peers, peer);
+
+    ewma = (uint64_t) sample << NGX_HTTP_UPSTREAM_LT_SHIFT;
+
+    if (ewma < peer->ewma) {
+        elapsed = now - peer->ewma_time;
+
+        if (elapsed == 0) {
+            elapsed = 1;
+        }
+
+        ewma = ((uint64_t) peer->ewma * NGX_HTTP_UPSTREAM_LT_DECAY
+                + ewma * elapsed)
+               / (NGX_HTTP_UPSTREAM_LT_DECAY + elapsed);
+    }
+
+    peer->ewma = (ngx_uint_t) ewma;
+    peer->ewma_time = now;
+
+    ngx_http_upstream_rr_peer_unlock(lp->rrp.peers, peer);
+    ngx_http_upstream_rr_peers_unlock(lp->rrp.peers);
+
+done:
+
+    ngx_http_upstream_free_round_robin_peer(pc, &lp->rrp, state);
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_peek_least_time_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_least_time_peer_data_t *lp)
+{
+    ngx_uint_t  i, j, k, x;
+
+    x = ngx_random() % peers->total_weight;
+
+    i = 0;
+    j = peers->number;
+
+    while (j - i > 1) {
+        k = (i + j) / 2;
+
+        if (x < lp->conf->ranges[k].range) {
+            j = k;
+
+        } else {
+            i = k;
+        }
+    }
+
+    return i;
+}
+
+
+static uint64_t
+ngx_http_upstream_least_time_cost(ngx_http_upstream_rr_peer_t *peer,
+    ngx_msec_t now)
+{
+    uint64_t    ewma;
+    ngx_msec_t  elapsed;
+
+    /* the expected time of a new request queued behind the active ones */
+
+    elapsed = now - peer->ewma_time;
+
+    ewma = (uint64_t) peer->ewma * NGX_HTTP_UPSTREAM_LT_DECAY
+           / (NGX_HTTP_UPSTREAM_LT_DECAY + elapsed);
+
+    return (ewma + 1) * (peer->conns + 1);
+}
+
+
+static void *
+ngx_http_upstream_least_time_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_least_time_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_least_time_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->mode = NGX_HTTP_UPSTREAM_LT_HEADER;
+     *     conf->ranges = NULL;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_least_time_srv_conf_t  *ltcf = conf;
+
+    ngx_str_t                     *value;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "header") == 0) {
+        ltcf->mode = NGX_HTTP_UPSTREAM_LT_HEADER;
+
+    } else if (ngx_strcmp(value[1].data, "last_byte") == 0) {
+        ltcf->mode = NGX_HTTP_UPSTREAM_LT_LAST_BYTE;
+
+    } else if (ngx_strcmp(value[1].data, "connect") == 0) {
+        ltcf->mode = NGX_HTTP_UPSTREAM_LT_CONNECT;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_least_time;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_CONNS
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN;
+
+    return NGX_CONF_OK;
+}
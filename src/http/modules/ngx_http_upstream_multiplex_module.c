@@ -0,0 +1,3148 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * Upstream connection multiplexing: requests to the same server share
+ * a connection, each request being a separate FastCGI request id or
+ * HTTP/2 stream, or a key in a pipelined memcached multi-get.  The
+ * fastcgi, grpc and memcached modules are left unaware of that:
+ * every request gets a fake connection, records written to it are
+ * renumbered and queued to the real connection, and records read from
+ * the real connection are demultiplexed into the fake connections of
+ * the requests with the id rewritten back to 1.  Connection-level state,
+ * such as HTTP/2 settings and flow control, is maintained here.
+ */
+
+
+#define NGX_HTTP_FASTCGI_KEEP_CONN          1
+
+#define NGX_HTTP_FASTCGI_BEGIN_REQUEST      1
+#define NGX_HTTP_FASTCGI_ABORT_REQUEST      2
+#define NGX_HTTP_FASTCGI_END_REQUEST        3
+
+#define NGX_HTTP_FASTCGI_HEADER_SIZE        8
+
+
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_CHUNK     16384
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_BUFFERED  (256 * 1024)
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_HDR       16
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_FRAME     96
+
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_MC_KEY    250
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_MC_LINE   512
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_MC_BATCH  32
+
+
+#if (NGX_HTTP_V2)
+
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_PREFACE   24
+
+/* the receive window of a stream, advertised as the initial window size */
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_WINDOW    (256 * 1024)
+
+#define NGX_HTTP_UPSTREAM_MULTIPLEX_MAX_ID    0x7fffffff
+
+#define NGX_HTTP_V2_CANCEL                    0x8
+
+#endif
+
+
+typedef struct ngx_http_upstream_multiplex_chunk_s
+    ngx_http_upstream_multiplex_chunk_t;
+typedef struct ngx_http_upstream_multiplex_conn_s
+    ngx_http_upstream_multiplex_conn_t;
+typedef struct ngx_http_upstream_multiplex_stream_s
+    ngx_http_upstream_multiplex_stream_t;
+
+
+typedef struct {
+    size_t                             header_size;
+    size_t                             preface;
+
+    unsigned                           flow_control:1;
+    unsigned                           cached:1;
+
+    /* the end of a request is reported as the end of the connection */
+    unsigned                           eof:1;
+
+    /* the size of a record written by a request, 0 if not yet known */
+    size_t      (*record_size)(u_char *p, size_t len);
+    ngx_uint_t  (*available)(ngx_http_upstream_multiplex_conn_t *conn);
+    ngx_int_t   (*init_stream)(ngx_http_upstream_multiplex_conn_t *conn,
+                    ngx_http_upstream_multiplex_stream_t *st);
+    ngx_int_t   (*output)(ngx_http_upstream_multiplex_conn_t *conn,
+                    ngx_http_upstream_multiplex_stream_t *st,
+                    u_char *record, size_t size);
+    ngx_int_t   (*header)(ngx_http_upstream_multiplex_conn_t *conn);
+    ngx_int_t   (*end_record)(ngx_http_upstream_multiplex_conn_t *conn);
+    ngx_int_t   (*abort)(ngx_http_upstream_multiplex_conn_t *conn,
+                    ngx_http_upstream_multiplex_stream_t *st);
+    ngx_int_t   (*consumed)(ngx_http_upstream_multiplex_conn_t *conn,
+                    ngx_http_upstream_multiplex_stream_t *st);
+    ngx_int_t   (*demux)(ngx_http_upstream_multiplex_conn_t *conn,
+                    u_char *p, u_char *last);
+    ngx_int_t   (*flush)(ngx_http_upstream_multiplex_conn_t *conn);
+} ngx_http_upstream_multiplex_protocol_t;
+
+
+typedef struct {
+    ngx_uint_t                         max_requests;
+    ngx_msec_t                         timeout;
+
+    ngx_http_upstream_multiplex_protocol_t  *protocol;
+
+    ngx_queue_t                        connections;
+
+    ngx_http_upstream_init_pt          original_init_upstream;
+    ngx_http_upstream_init_peer_pt     original_init_peer;
+
+} ngx_http_upstream_multiplex_srv_conf_t;
+
+
+struct ngx_http_upstream_multiplex_chunk_s {
+    ngx_http_upstream_multiplex_chunk_t  *next;
+
+    u_char                            *pos;
+    u_char                            *last;
+    u_char                            *end;
+};
+
+
+typedef struct {
+    ngx_http_upstream_multiplex_chunk_t  *first;
+    ngx_http_upstream_multiplex_chunk_t  *last;
+    size_t                             size;
+} ngx_http_upstream_multiplex_queue_t;
+
+
+typedef struct {
+    u_char                            *key;
+    size_t                             key_len;
+
+    /* the last key of a multi-get */
+    unsigned                           last:1;
+
+    /* the value being read is for the key */
+    unsigned                           value:1;
+} ngx_http_upstream_multiplex_mc_get_t;
+
+
+/*
+ * memcached replies in order, so the slots of requests are kept in a ring:
+ * gets from head to sent are awaiting replies, from sent to last they are
+ * yet to be batched into multi-gets
+ */
+
+typedef struct {
+    ngx_http_upstream_multiplex_mc_get_t  *gets;
+    ngx_uint_t                        *ring;
+    ngx_uint_t                         nring;
+
+    ngx_uint_t                         head;
+    ngx_uint_t                         sent;
+    ngx_uint_t                         last;
+
+    /* the response line being read */
+    u_char                         line[NGX_HTTP_UPSTREAM_MULTIPLEX_MC_LINE];
+    size_t                             line_len;
+} ngx_http_upstream_multiplex_mc_t;
+
+
+struct ngx_http_upstream_multiplex_conn_s {
+    ngx_http_upstream_multiplex_srv_conf_t  *conf;
+    ngx_http_upstream_multiplex_protocol_t  *protocol;
+
+    ngx_queue_t                        queue;
+    ngx_pool_t                        *pool;
+    ngx_connection_t                  *connection;
+
+    ngx_peer_connection_t              peer;
+    ngx_sockaddr_t                     sockaddr;
+
+    ngx_http_upstream_multiplex_stream_t  **streams;
+    ngx_uint_t                         nstreams;
+
+    ngx_http_upstream_multiplex_queue_t  out;
+
+    /* data demultiplexed but not yet read by the requests */
+    size_t                             buffered;
+
+    u_char                            *buffer;
+
+    /* the record being read */
+    u_char                             header[NGX_HTTP_UPSTREAM_MULTIPLEX_HDR];
+    size_t                             header_len;
+    size_t                             rest;
+    ngx_uint_t                         type;
+    ngx_uint_t                         flags;
+    ngx_uint_t                         id;
+    ngx_http_upstream_multiplex_stream_t  *stream;
+
+    /* the payload of a connection-level record */
+    u_char                             frame[NGX_HTTP_UPSTREAM_MULTIPLEX_FRAME];
+    size_t                             frame_len;
+
+    ngx_http_upstream_multiplex_mc_t  *memcached;
+
+#if (NGX_HTTP_V2)
+    /* the request which connection preface is sent */
+    ngx_http_upstream_multiplex_stream_t  *setup;
+
+    ngx_uint_t                         next_id;
+    ngx_uint_t                         active;
+    ngx_uint_t                         max_streams;
+    ngx_uint_t                         init_window;
+    ssize_t                            send_window;
+    size_t                             recv_window;
+#endif
+
+    unsigned                           read_blocked:1;
+    unsigned                           capture:1;
+    unsigned                           preface_sent:1;
+    unsigned                           setup_done:1;
+    unsigned                           settings:1;
+    unsigned                           draining:1;
+
+    /* requests are to be batched by the protocol before flushing */
+    unsigned                           pending:1;
+};
+
+
+struct ngx_http_upstream_multiplex_stream_s {
+    ngx_connection_t                   connection;
+    ngx_event_t                        read;
+    ngx_event_t                        write;
+
+    ngx_http_upstream_multiplex_conn_t  *conn;
+    ngx_uint_t                         slot;
+    ngx_uint_t                         id;
+
+    ngx_http_upstream_multiplex_queue_t  in;
+
+    /* a record partially written by the request, or held back */
+    u_char                            *record;
+    size_t                             record_len;
+    size_t                             record_size;
+    size_t                             record_alloc;
+
+    /* connection preface bytes still to be written by the request */
+    size_t                             preface;
+
+#if (NGX_HTTP_V2)
+    size_t                             recv_window;
+    size_t                             sent;
+#endif
+
+    unsigned                           begun:1;
+    unsigned                           done:1;
+    unsigned                           eof:1;
+    unsigned                           error:1;
+    unsigned                           blocked:1;
+    unsigned                           headers:1;
+    unsigned                           closing:1;
+};
+
+
+typedef struct {
+    ngx_http_upstream_multiplex_srv_conf_t  *conf;
+
+    ngx_http_upstream_t               *upstream;
+    ngx_http_upstream_multiplex_stream_t  *stream;
+    ngx_pool_t                        *pool;
+
+    void                              *data;
+
+    ngx_event_get_peer_pt              original_get_peer;
+    ngx_event_free_peer_pt             original_free_peer;
+
+} ngx_http_upstream_multiplex_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_multiplex_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_multiplex_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_free_multiplex_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+
+static ngx_http_upstream_multiplex_conn_t *ngx_http_upstream_multiplex_connect(
+    ngx_peer_connection_t *pc, ngx_http_upstream_multiplex_peer_data_t *mp);
+static ngx_http_upstream_multiplex_stream_t *
+    ngx_http_upstream_multiplex_create_stream(
+    ngx_http_upstream_multiplex_conn_t *conn, ngx_peer_connection_t *pc,
+    ngx_pool_t *pool);
+static void ngx_http_upstream_multiplex_close_stream(
+    ngx_http_upstream_multiplex_stream_t *st);
+static void ngx_http_upstream_multiplex_detach(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, ngx_uint_t error);
+static void ngx_http_upstream_multiplex_idle(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static void ngx_http_upstream_multiplex_close(
+    ngx_http_upstream_multiplex_conn_t *conn, ngx_uint_t error);
+
+static void ngx_http_upstream_multiplex_read_handler(ngx_event_t *rev);
+static ngx_int_t ngx_http_upstream_multiplex_demux(
+    ngx_http_upstream_multiplex_conn_t *conn, u_char *p, u_char *last);
+static void ngx_http_upstream_multiplex_write_handler(ngx_event_t *wev);
+static void ngx_http_upstream_multiplex_flush(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static void ngx_http_upstream_multiplex_post_flush(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static void ngx_http_upstream_multiplex_wake_blocked(
+    ngx_http_upstream_multiplex_conn_t *conn);
+
+static u_char *ngx_http_upstream_multiplex_append(
+    ngx_http_upstream_multiplex_queue_t *q, u_char *p, size_t size);
+static void ngx_http_upstream_multiplex_free_queue(
+    ngx_http_upstream_multiplex_queue_t *q);
+static void ngx_http_upstream_multiplex_wake(ngx_event_t *ev);
+
+static ssize_t ngx_http_upstream_multiplex_recv(ngx_connection_t *c,
+    u_char *buf, size_t size);
+static ssize_t ngx_http_upstream_multiplex_recv_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ssize_t ngx_http_upstream_multiplex_send(ngx_connection_t *c,
+    u_char *buf, size_t size);
+static ngx_chain_t *ngx_http_upstream_multiplex_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ngx_int_t ngx_http_upstream_multiplex_stage(ngx_connection_t *c,
+    ngx_http_upstream_multiplex_stream_t *st, u_char *p, size_t size);
+
+static ngx_uint_t ngx_http_upstream_multiplex_available(
+    ngx_http_upstream_multiplex_conn_t *conn);
+
+static size_t ngx_http_upstream_multiplex_fastcgi_record_size(u_char *p,
+    size_t len);
+static ngx_int_t ngx_http_upstream_multiplex_fastcgi_init_stream(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st);
+static ngx_int_t ngx_http_upstream_multiplex_fastcgi_output(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, u_char *record, size_t size);
+static ngx_int_t ngx_http_upstream_multiplex_fastcgi_header(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static ngx_int_t ngx_http_upstream_multiplex_fastcgi_end_record(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static ngx_int_t ngx_http_upstream_multiplex_fastcgi_abort(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st);
+
+#if (NGX_HTTP_V2)
+static size_t ngx_http_upstream_multiplex_grpc_record_size(u_char *p,
+    size_t len);
+static ngx_uint_t ngx_http_upstream_multiplex_grpc_available(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static ngx_int_t ngx_http_upstream_multiplex_grpc_init_stream(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st);
+static ngx_int_t ngx_http_upstream_multiplex_grpc_output(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, u_char *record, size_t size);
+static ngx_int_t ngx_http_upstream_multiplex_grpc_header(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static ngx_int_t ngx_http_upstream_multiplex_grpc_end_record(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static ngx_int_t ngx_http_upstream_multiplex_grpc_settings(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static void ngx_http_upstream_multiplex_grpc_done(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, ngx_uint_t error);
+static ngx_int_t ngx_http_upstream_multiplex_grpc_abort(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st);
+static ngx_int_t ngx_http_upstream_multiplex_grpc_consumed(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st);
+static u_char *ngx_http_upstream_multiplex_grpc_frame(
+    ngx_http_upstream_multiplex_queue_t *q, ngx_uint_t type,
+    ngx_uint_t flags, ngx_uint_t id, u_char *payload, size_t len);
+static ngx_int_t ngx_http_upstream_multiplex_grpc_window_update(
+    ngx_http_upstream_multiplex_queue_t *q, ngx_uint_t id, size_t n);
+#endif
+
+static size_t ngx_http_upstream_multiplex_memcached_record_size(u_char *p,
+    size_t len);
+static ngx_int_t ngx_http_upstream_multiplex_memcached_init_stream(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st);
+static ngx_int_t ngx_http_upstream_multiplex_memcached_output(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, u_char *record, size_t size);
+static ngx_int_t ngx_http_upstream_multiplex_memcached_abort(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st);
+static ngx_int_t ngx_http_upstream_multiplex_memcached_demux(
+    ngx_http_upstream_multiplex_conn_t *conn, u_char *p, u_char *last);
+static ngx_int_t ngx_http_upstream_multiplex_memcached_line(
+    ngx_http_upstream_multiplex_conn_t *conn);
+static ngx_int_t ngx_http_upstream_multiplex_memcached_deliver(
+    ngx_http_upstream_multiplex_conn_t *conn, ngx_uint_t slot, u_char *p,
+    size_t size);
+static ngx_int_t ngx_http_upstream_multiplex_memcached_flush(
+    ngx_http_upstream_multiplex_conn_t *conn);
+
+static void *ngx_http_upstream_multiplex_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_multiplex(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_http_upstream_multiplex_protocol_t
+    ngx_http_upstream_multiplex_fastcgi_protocol =
+{
+    NGX_HTTP_FASTCGI_HEADER_SIZE,
+    0,
+    0,
+    1,
+    1,
+    ngx_http_upstream_multiplex_fastcgi_record_size,
+    ngx_http_upstream_multiplex_available,
+    ngx_http_upstream_multiplex_fastcgi_init_stream,
+    ngx_http_upstream_multiplex_fastcgi_output,
+    ngx_http_upstream_multiplex_fastcgi_header,
+    ngx_http_upstream_multiplex_fastcgi_end_record,
+    ngx_http_upstream_multiplex_fastcgi_abort,
+    NULL,
+    ngx_http_upstream_multiplex_demux,
+    NULL
+};
+
+
+#if (NGX_HTTP_V2)
+
+/*
+ * the grpc module looks for its connection data in the pool
+ * of cached connections, so requests are not reported as cached
+ */
+
+static ngx_http_upstream_multiplex_protocol_t
+    ngx_http_upstream_multiplex_grpc_protocol =
+{
+    NGX_HTTP_V2_FRAME_HEADER_SIZE,
+    NGX_HTTP_UPSTREAM_MULTIPLEX_PREFACE,
+    1,
+    0,
+    0,
+    ngx_http_upstream_multiplex_grpc_record_size,
+    ngx_http_upstream_multiplex_grpc_available,
+    ngx_http_upstream_multiplex_grpc_init_stream,
+    ngx_http_upstream_multiplex_grpc_output,
+    ngx_http_upstream_multiplex_grpc_header,
+    ngx_http_upstream_multiplex_grpc_end_record,
+    ngx_http_upstream_multiplex_grpc_abort,
+    ngx_http_upstream_multiplex_grpc_consumed,
+    ngx_http_upstream_multiplex_demux,
+    NULL
+};
+
+#endif
+
+
+static ngx_http_upstream_multiplex_protocol_t
+    ngx_http_upstream_multiplex_memcached_protocol =
+{
+    1,
+    0,
+    0,
+    1,
+    1,
+    ngx_http_upstream_multiplex_memcached_record_size,
+    ngx_http_upstream_multiplex_available,
+    ngx_http_upstream_multiplex_memcached_init_stream,
+    ngx_http_upstream_multiplex_memcached_output,
+    NULL,
+    NULL,
+    ngx_http_upstream_multiplex_memcached_abort,
+    NULL,
+    ngx_http_upstream_multiplex_memcached_demux,
+    ngx_http_upstream_multiplex_memcached_flush
+};
+
+
+static ngx_command_t  ngx_http_upstream_multiplex_commands[] = {
+
+    { ngx_string("fastcgi_multiplex"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_multiplex,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      &ngx_http_upstream_multiplex_fastcgi_protocol },
+
+#if (NGX_HTTP_V2)
+
+    { ngx_string("grpc_multiplex"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_multiplex,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      &ngx_http_upstream_multiplex_grpc_protocol },
+
+#endif
+
+    { ngx_string("memcached_multiplex"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_multiplex,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      &ngx_http_upstream_multiplex_memcached_protocol },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_multiplex_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_multiplex_create_conf, /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_multiplex_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_multiplex_module_ctx, /* module context */
+    ngx_http_upstream_multiplex_commands,    /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/* a placeholder for slots of aborted requests until their replies */
+
+static ngx_http_upstream_multiplex_stream_t
+    ngx_http_upstream_multiplex_aborted;
+
+
+static ngx_int_t
+ngx_http_upstream_init_multiplex(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_multiplex_srv_conf_t  *mcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init multiplex");
+
+    mcf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_multiplex_module);
+
+    ngx_conf_init_msec_value(mcf->timeout, 60000);
+
+    if (mcf->original_init_upstream(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    mcf->original_init_peer = us->peer.init;
+
+    us->peer.init = ngx_http_upstream_init_multiplex_peer;
+
+    ngx_queue_init(&mcf->connections);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_multiplex_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_multiplex_peer_data_t  *mp;
+    ngx_http_upstream_multiplex_srv_conf_t   *mcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init multiplex peer");
+
+    mcf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_multiplex_module);
+
+    mp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_multiplex_peer_data_t));
+    if (mp == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (mcf->original_init_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    mp->conf = mcf;
+    mp->upstream = r->upstream;
+    mp->stream = NULL;
+    mp->pool = r->pool;
+    mp->data = r->upstream->peer.data;
+    mp->original_get_peer = r->upstream->peer.get;
+    mp->original_free_peer = r->upstream->peer.free;
+
+    r->upstream->peer.data = mp;
+    r->upstream->peer.get = ngx_http_upstream_get_multiplex_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_multiplex_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_multiplex_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_multiplex_peer_data_t  *mp = data;
+
+    ngx_int_t                              rc;
+    ngx_queue_t                           *q;
+    ngx_http_upstream_multiplex_conn_t    *conn;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get multiplex peer");
+
+    /* ask balancer */
+
+    rc = mp->original_get_peer(pc, mp->data);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    /*
+     * fake connections are never added to the event module, so only
+     * edge-triggered notification methods are supported
+     */
+
+    if (!(ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
+        return NGX_OK;
+    }
+
+    /* search for a connection with a free request id */
+
+    conn = NULL;
+
+    for (q = ngx_queue_head(&mp->conf->connections);
+         q != ngx_queue_sentinel(&mp->conf->connections);
+         q = ngx_queue_next(q))
+    {
+        conn = ngx_queue_data(q, ngx_http_upstream_multiplex_conn_t, queue);
+
+        if (!conn->connection->close
+            && conn->protocol->available(conn)
+            && ngx_memn2cmp((u_char *) conn->peer.sockaddr,
+                            (u_char *) pc->sockaddr,
+                            conn->peer.socklen, pc->socklen)
+               == 0)
+        {
+            pc->cached = conn->protocol->cached;
+            break;
+        }
+
+        conn = NULL;
+    }
+
+    if (conn == NULL) {
+        conn = ngx_http_upstream_multiplex_connect(pc, mp);
+
+        if (conn == NULL) {
+            return NGX_DECLINED;
+        }
+    }
+
+    st = ngx_http_upstream_multiplex_create_stream(conn, pc, mp->pool);
+    if (st == NULL) {
+        if (conn->nstreams == 0) {
+            ngx_http_upstream_multiplex_idle(conn);
+        }
+
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get multiplex peer: using connection %p, slot:%ui",
+                   conn->connection, st->slot);
+
+    mp->stream = st;
+    pc->connection = &st->connection;
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_upstream_free_multiplex_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_multiplex_peer_data_t  *mp = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free multiplex peer");
+
+    if (mp->stream) {
+        ngx_http_upstream_multiplex_close_stream(mp->stream);
+
+        mp->stream = NULL;
+        pc->connection = NULL;
+    }
+
+    mp->original_free_peer(pc, mp->data, state);
+}
+
+
+static ngx_http_upstream_multiplex_conn_t *
+ngx_http_upstream_multiplex_connect(ngx_peer_connection_t *pc,
+    ngx_http_upstream_multiplex_peer_data_t *mp)
+{
+    size_t                               n;
+    ngx_int_t                            rc;
+    ngx_pool_t                          *pool;
+    ngx_connection_t                    *c;
+    ngx_http_upstream_multiplex_conn_t  *conn;
+
+    pool = ngx_create_pool(1024, ngx_cycle->log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    conn = ngx_pcalloc(pool, sizeof(ngx_http_upstream_multiplex_conn_t));
+    if (conn == NULL) {
+        goto failed;
+    }
+
+    conn->conf = mp->conf;
+    conn->protocol = mp->conf->protocol;
+    conn->pool = pool;
+
+#if (NGX_HTTP_V2)
+    conn->next_id = 1;
+    conn->max_streams = NGX_HTTP_UPSTREAM_MULTIPLEX_MAX_ID;
+    conn->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    conn->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    conn->recv_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+#endif
+
+    n = mp->conf->max_requests * sizeof(ngx_http_upstream_multiplex_stream_t *);
+
+    conn->streams = ngx_pcalloc(pool, n);
+    if (conn->streams == NULL) {
+        goto failed;
+    }
+
+    conn->buffer = ngx_palloc(pool, NGX_HTTP_UPSTREAM_MULTIPLEX_CHUNK);
+    if (conn->buffer == NULL) {
+        goto failed;
+    }
+
+    /* the balancer's peer may go away with the request */
+
+    conn->peer.name = ngx_pcalloc(pool, sizeof(ngx_str_t));
+    if (conn->peer.name == NULL) {
+        goto failed;
+    }
+
+    conn->peer.name->data = ngx_pstrdup(pool, pc->name);
+    if (conn->peer.name->data == NULL) {
+        goto failed;
+    }
+
+    conn->peer.name->len = pc->name->len;
+
+    ngx_memcpy(&conn->sockaddr, pc->sockaddr, pc->socklen);
+
+    conn->peer.sockaddr = &conn->sockaddr.sockaddr;
+    conn->peer.socklen = pc->socklen;
+    conn->peer.get = ngx_event_get_peer;
+    conn->peer.log = ngx_cycle->log;
+    conn->peer.log_error = pc->log_error;
+    conn->peer.local = pc->local;
+    conn->peer.type = pc->type;
+    conn->peer.rcvbuf = pc->rcvbuf;
+
+    rc = ngx_event_connect_peer(&conn->peer);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        goto failed;
+    }
+
+    c = conn->peer.connection;
+
+    c->data = conn;
+    c->pool = pool;
+    c->sendfile = 0;
+
+    c->read->handler = ngx_http_upstream_multiplex_read_handler;
+    c->write->handler = ngx_http_upstream_multiplex_write_handler;
+
+    conn->connection = c;
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, mp->upstream->conf->connect_timeout);
+    }
+
+    ngx_queue_insert_head(&mp->conf->connections, &conn->queue);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "multiplex connection %p created", c);
+
+    return conn;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NULL;
+}
+
+
+static ngx_http_upstream_multiplex_stream_t *
+ngx_http_upstream_multiplex_create_stream(
+    ngx_http_upstream_multiplex_conn_t *conn, ngx_peer_connection_t *pc,
+    ngx_pool_t *pool)
+{
+    ngx_uint_t                             i;
+    ngx_event_t                           *rev, *wev;
+    ngx_connection_t                      *c, *real;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    for (i = 0; i < conn->conf->max_requests; i++) {
+        if (conn->streams[i] == NULL) {
+            break;
+        }
+    }
+
+    st = ngx_pcalloc(pool, sizeof(ngx_http_upstream_multiplex_stream_t));
+    if (st == NULL) {
+        return NULL;
+    }
+
+    st->conn = conn;
+    st->slot = i;
+    st->preface = conn->protocol->preface;
+
+    if (conn->protocol->init_stream(conn, st) != NGX_OK) {
+        ngx_http_upstream_multiplex_free_queue(&st->in);
+        return NULL;
+    }
+
+    real = conn->connection;
+
+    c = &st->connection;
+    rev = &st->read;
+    wev = &st->write;
+
+    c->fd = real->fd;
+    c->read = rev;
+    c->write = wev;
+
+    c->recv = ngx_http_upstream_multiplex_recv;
+    c->send = ngx_http_upstream_multiplex_send;
+    c->recv_chain = ngx_http_upstream_multiplex_recv_chain;
+    c->send_chain = ngx_http_upstream_multiplex_send_chain;
+
+    c->log = pc->log;
+    c->log_error = pc->log_error;
+    c->type = SOCK_STREAM;
+
+    c->sockaddr = conn->peer.sockaddr;
+    c->socklen = conn->peer.socklen;
+    c->addr_text = *conn->peer.name;
+    c->local_sockaddr = real->local_sockaddr;
+    c->local_socklen = real->local_socklen;
+
+    /* these make socket options and tcp_nopush no-ops */
+
+    c->sendfile = 0;
+    c->sndlowat = 1;
+    c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+    c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+    /* the fake events are reported as active to keep them off the kernel */
+
+    rev->data = c;
+    rev->log = c->log;
+    rev->active = 1;
+    rev->ready = (st->in.first != NULL);
+
+    wev->data = c;
+    wev->log = c->log;
+    wev->write = 1;
+    wev->active = 1;
+    wev->ready = 1;
+
+    conn->buffered += st->in.size;
+
+    conn->streams[i] = st;
+    conn->nstreams++;
+
+    if (real->idle) {
+        real->idle = 0;
+
+        if (real->read->timer_set) {
+            ngx_del_timer(real->read);
+        }
+    }
+
+    return st;
+}
+
+
+static void
+ngx_http_upstream_multiplex_close_stream(
+    ngx_http_upstream_multiplex_stream_t *st)
+{
+    ngx_connection_t                    *c;
+    ngx_http_upstream_multiplex_conn_t  *conn;
+
+    c = &st->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "close multiplex stream, slot:%ui id:%ui",
+                   st->slot, st->id);
+
+    if (st->read.timer_set) {
+        ngx_del_timer(&st->read);
+    }
+
+    if (st->write.timer_set) {
+        ngx_del_timer(&st->write);
+    }
+
+    if (st->read.posted) {
+        ngx_delete_posted_event(&st->read);
+    }
+
+    if (st->write.posted) {
+        ngx_delete_posted_event(&st->write);
+    }
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+        c->pool = NULL;
+    }
+
+    conn = st->conn;
+
+    if (conn == NULL) {
+        ngx_http_upstream_multiplex_free_queue(&st->in);
+        return;
+    }
+
+    conn->buffered -= st->in.size;
+    ngx_http_upstream_multiplex_free_queue(&st->in);
+
+    st->conn = NULL;
+
+    if (conn->stream == st) {
+        conn->stream = NULL;
+    }
+
+    /* the request may still be processed by the server */
+
+    if (conn->protocol->abort(conn, st) != NGX_OK) {
+        ngx_http_upstream_multiplex_close(conn, 1);
+        return;
+    }
+
+#if (NGX_HTTP_V2)
+    if (conn->setup == st) {
+        conn->setup = NULL;
+    }
+#endif
+
+    ngx_http_upstream_multiplex_post_flush(conn);
+
+    if (conn->read_blocked
+        && conn->buffered < NGX_HTTP_UPSTREAM_MULTIPLEX_BUFFERED)
+    {
+        conn->read_blocked = 0;
+        ngx_post_event(conn->connection->read, &ngx_posted_events);
+    }
+
+    if (conn->nstreams == 0) {
+
+        if (ngx_terminate || ngx_exiting || conn->draining) {
+            ngx_http_upstream_multiplex_close(conn, 0);
+            return;
+        }
+
+        ngx_http_upstream_multiplex_idle(conn);
+    }
+}
+
+
+static void
+ngx_http_upstream_multiplex_detach(ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, ngx_uint_t error)
+{
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, conn->connection->log, 0,
+                   "multiplex request done, slot:%ui id:%ui error:%ui",
+                   st->slot, st->id, error);
+
+    /* the request is complete, its slot may be reused */
+
+    conn->buffered -= st->in.size;
+
+#if (NGX_HTTP_V2)
+    if (conn->setup == st) {
+        conn->setup = NULL;
+    }
+#endif
+
+    st->conn = NULL;
+
+    if (error) {
+        st->error = 1;
+        ngx_http_upstream_multiplex_wake(&st->write);
+
+    } else if (conn->protocol->eof) {
+        st->eof = 1;
+
+    } else {
+
+        /* the request ends on its own, control frames are discarded */
+
+        st->done = 1;
+    }
+
+    ngx_http_upstream_multiplex_wake(&st->read);
+
+    conn->streams[st->slot] = NULL;
+    conn->nstreams--;
+
+    if (conn->stream == st) {
+        conn->stream = NULL;
+    }
+
+    if (conn->nstreams == 0) {
+        ngx_http_upstream_multiplex_idle(conn);
+    }
+}
+
+
+static void
+ngx_http_upstream_multiplex_idle(ngx_http_upstream_multiplex_conn_t *conn)
+{
+    ngx_connection_t  *c;
+
+    c = conn->connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "multiplex connection %p idle", c);
+
+    c->idle = 1;
+
+    ngx_add_timer(c->read, conn->conf->timeout);
+}
+
+
+static void
+ngx_http_upstream_multiplex_close(ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_uint_t error)
+{
+    ngx_uint_t                             i;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, conn->connection->log, 0,
+                   "close multiplex connection %p, error:%ui",
+                   conn->connection, error);
+
+    /* requests still attached see the connection closed */
+
+    for (i = 0; i < conn->conf->max_requests; i++) {
+        st = conn->streams[i];
+
+        if (st == NULL || st == &ngx_http_upstream_multiplex_aborted) {
+            continue;
+        }
+
+        st->conn = NULL;
+
+        if (error) {
+            st->error = 1;
+
+        } else {
+            st->eof = 1;
+        }
+
+        ngx_http_upstream_multiplex_wake(&st->read);
+        ngx_http_upstream_multiplex_wake(&st->write);
+    }
+
+    ngx_queue_remove(&conn->queue);
+
+    ngx_http_upstream_multiplex_free_queue(&conn->out);
+
+    ngx_close_connection(conn->connection);
+    ngx_destroy_pool(conn->pool);
+}
+
+
+static void
+ngx_http_upstream_multiplex_read_handler(ngx_event_t *rev)
+{
+    ssize_t                              n;
+    ngx_connection_t                    *c;
+    ngx_http_upstream_multiplex_conn_t  *conn;
+
+    c = rev->data;
+    conn = c->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "multiplex read handler, streams:%ui", conn->nstreams);
+
+    if (c->close) {
+        ngx_http_upstream_multiplex_close(conn, 0);
+        return;
+    }
+
+    if (rev->timedout) {
+        rev->timedout = 0;
+
+        if (conn->nstreams == 0) {
+            ngx_http_upstream_multiplex_close(conn, 0);
+            return;
+        }
+    }
+
+    /*
+     * with flow control, the server cannot send more than the requests
+     * are able to buffer
+     */
+
+    while (conn->protocol->flow_control
+           || conn->buffered < NGX_HTTP_UPSTREAM_MULTIPLEX_BUFFERED)
+    {
+        n = c->recv(c, conn->buffer, NGX_HTTP_UPSTREAM_MULTIPLEX_CHUNK);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_multiplex_close(conn, 1);
+            }
+
+            return;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            ngx_http_upstream_multiplex_close(conn, n == NGX_ERROR);
+            return;
+        }
+
+        if (conn->protocol->demux(conn, conn->buffer, conn->buffer + n)
+            != NGX_OK)
+        {
+            ngx_http_upstream_multiplex_close(conn, 1);
+            return;
+        }
+
+        if (conn->nstreams == 0
+            && (ngx_terminate || ngx_exiting || conn->draining))
+        {
+            ngx_http_upstream_multiplex_close(conn, 0);
+            return;
+        }
+
+        /* connection-level replies */
+
+        ngx_http_upstream_multiplex_post_flush(conn);
+
+        if (!rev->ready) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_multiplex_close(conn, 1);
+            }
+
+            return;
+        }
+    }
+
+    /* reading is resumed as the requests consume buffered data */
+
+    conn->read_blocked = 1;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_demux(ngx_http_upstream_multiplex_conn_t *conn,
+    u_char *p, u_char *last)
+{
+    size_t                                 n, len, size;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    size = conn->protocol->header_size;
+
+    while (p < last) {
+
+        if (conn->header_len < size) {
+            n = ngx_min((size_t) (last - p), size - conn->header_len);
+
+            ngx_memcpy(conn->header + conn->header_len, p, n);
+
+            conn->header_len += n;
+            p += n;
+
+            if (conn->header_len < size) {
+                break;
+            }
+
+            /*
+             * the protocol parses the header, selects the request
+             * the record is for, and rewrites the id in the header
+             */
+
+            conn->stream = NULL;
+            conn->capture = 0;
+            conn->frame_len = 0;
+
+            if (conn->protocol->header(conn) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            st = conn->stream;
+
+            if (st) {
+                if (ngx_http_upstream_multiplex_append(&st->in, conn->header,
+                                                       size)
+                    == NULL)
+                {
+                    return NGX_ERROR;
+                }
+
+                conn->buffered += size;
+            }
+
+        } else {
+            n = ngx_min((size_t) (last - p), conn->rest);
+
+            st = conn->stream;
+
+            if (st) {
+                if (ngx_http_upstream_multiplex_append(&st->in, p, n)
+                    == NULL)
+                {
+                    return NGX_ERROR;
+                }
+
+                conn->buffered += n;
+            }
+
+            if (conn->capture) {
+                len = ngx_min(n, NGX_HTTP_UPSTREAM_MULTIPLEX_FRAME
+                                 - conn->frame_len);
+
+                ngx_memcpy(conn->frame + conn->frame_len, p, len);
+                conn->frame_len += len;
+            }
+
+            conn->rest -= n;
+            p += n;
+        }
+
+        if (conn->rest) {
+            continue;
+        }
+
+        conn->header_len = 0;
+
+        if (conn->stream) {
+            ngx_http_upstream_multiplex_wake(&conn->stream->read);
+        }
+
+        if (conn->protocol->end_record(conn) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        conn->stream = NULL;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_multiplex_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t                    *c;
+    ngx_http_upstream_multiplex_conn_t  *conn;
+
+    c = wev->data;
+    conn = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "multiplex write handler");
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream timed out while connecting to "
+                      "multiplexed server %V", conn->peer.name);
+
+        ngx_http_upstream_multiplex_close(conn, 1);
+        return;
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    ngx_http_upstream_multiplex_flush(conn);
+}
+
+
+static void
+ngx_http_upstream_multiplex_flush(ngx_http_upstream_multiplex_conn_t *conn)
+{
+    ssize_t                               n;
+    ngx_connection_t                     *c;
+    ngx_http_upstream_multiplex_chunk_t  *ch;
+
+    c = conn->connection;
+
+    if (conn->pending) {
+        conn->pending = 0;
+
+        if (conn->protocol->flush(conn) != NGX_OK) {
+            ngx_http_upstream_multiplex_close(conn, 1);
+            return;
+        }
+    }
+
+    while (conn->out.first && c->write->ready) {
+        ch = conn->out.first;
+
+        n = c->send(c, ch->pos, ch->last - ch->pos);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_multiplex_close(conn, 1);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        ch->pos += n;
+        conn->out.size -= n;
+
+        if (ch->pos < ch->last) {
+            continue;
+        }
+
+        conn->out.first = ch->next;
+
+        if (conn->out.first == NULL) {
+            conn->out.last = NULL;
+        }
+
+        ngx_free(ch);
+    }
+
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        ngx_http_upstream_multiplex_close(conn, 1);
+        return;
+    }
+
+    if (conn->out.size >= NGX_HTTP_UPSTREAM_MULTIPLEX_BUFFERED) {
+        return;
+    }
+
+    ngx_http_upstream_multiplex_wake_blocked(conn);
+}
+
+
+static void
+ngx_http_upstream_multiplex_post_flush(ngx_http_upstream_multiplex_conn_t *conn)
+{
+    ngx_event_t  *wev;
+
+    /* until connected, the queue is flushed by the connect event */
+
+    wev = conn->connection->write;
+
+    if ((conn->out.first || conn->pending) && wev->ready && !wev->posted) {
+        ngx_post_event(wev, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_upstream_multiplex_wake_blocked(
+    ngx_http_upstream_multiplex_conn_t *conn)
+{
+    ngx_uint_t                             i;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    /* resume requests blocked on a full output queue or a window */
+
+    for (i = 0; i < conn->conf->max_requests; i++) {
+        st = conn->streams[i];
+
+        if (st && st != &ngx_http_upstream_multiplex_aborted && st->blocked) {
+            st->blocked = 0;
+            ngx_http_upstream_multiplex_wake(&st->write);
+        }
+    }
+}
+
+
+static u_char *
+ngx_http_upstream_multiplex_append(ngx_http_upstream_multiplex_queue_t *q,
+    u_char *p, size_t size)
+{
+    size_t                                n;
+    ngx_http_upstream_multiplex_chunk_t  *ch;
+
+    ch = q->last;
+
+    if (ch == NULL || (size_t) (ch->end - ch->last) < size) {
+        n = ngx_max(size, NGX_HTTP_UPSTREAM_MULTIPLEX_CHUNK);
+
+        ch = ngx_alloc(sizeof(ngx_http_upstream_multiplex_chunk_t) + n,
+                       ngx_cycle->log);
+        if (ch == NULL) {
+            return NULL;
+        }
+
+        ch->next = NULL;
+        ch->pos = (u_char *) ch + sizeof(ngx_http_upstream_multiplex_chunk_t);
+        ch->last = ch->pos;
+        ch->end = ch->pos + n;
+
+        if (q->last) {
+            q->last->next = ch;
+
+        } else {
+            q->first = ch;
+        }
+
+        q->last = ch;
+    }
+
+    /* records are never split between chunks, the copy is returned */
+
+    p = ngx_cpymem(ch->last, p, size);
+
+    ch->last = p;
+    q->size += size;
+
+    return p - size;
+}
+
+
+static void
+ngx_http_upstream_multiplex_free_queue(ngx_http_upstream_multiplex_queue_t *q)
+{
+    ngx_http_upstream_multiplex_chunk_t  *ch, *next;
+
+    for (ch = q->first; ch; ch = next) {
+        next = ch->next;
+        ngx_free(ch);
+    }
+
+    q->first = NULL;
+    q->last = NULL;
+    q->size = 0;
+}
+
+
+static void
+ngx_http_upstream_multiplex_wake(ngx_event_t *ev)
+{
+    ev->ready = 1;
+
+    if (!ev->posted) {
+        ngx_post_event(ev, &ngx_posted_events);
+    }
+}
+
+
+static ssize_t
+ngx_http_upstream_multiplex_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    size_t                                 n, total;
+    ngx_http_upstream_multiplex_conn_t    *conn;
+    ngx_http_upstream_multiplex_chunk_t   *ch;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    st = (ngx_http_upstream_multiplex_stream_t *) c;
+
+    total = 0;
+
+    while (total < size && st->in.first) {
+        ch = st->in.first;
+
+        n = ngx_min((size_t) (ch->last - ch->pos), size - total);
+
+        buf = ngx_cpymem(buf, ch->pos, n);
+        ch->pos += n;
+        total += n;
+
+        if (ch->pos == ch->last) {
+            st->in.first = ch->next;
+
+            if (st->in.first == NULL) {
+                st->in.last = NULL;
+            }
+
+            ngx_free(ch);
+        }
+    }
+
+    st->in.size -= total;
+
+    conn = st->conn;
+
+    if (conn && total) {
+        conn->buffered -= total;
+
+        if (conn->protocol->consumed
+            && conn->protocol->consumed(conn, st) != NGX_OK)
+        {
+            ngx_http_upstream_multiplex_close(conn, 1);
+            conn = NULL;
+        }
+    }
+
+    if (conn
+        && conn->read_blocked
+        && conn->buffered < NGX_HTTP_UPSTREAM_MULTIPLEX_BUFFERED)
+    {
+        conn->read_blocked = 0;
+        ngx_post_event(conn->connection->read, &ngx_posted_events);
+    }
+
+    if (total) {
+        if (st->in.first == NULL) {
+            c->read->ready = st->eof || st->error;
+        }
+
+        return total;
+    }
+
+    if (st->error) {
+        c->read->error = 1;
+        return NGX_ERROR;
+    }
+
+    if (st->eof) {
+        c->read->eof = 1;
+        return 0;
+    }
+
+    c->read->ready = 0;
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_http_upstream_multiplex_recv_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    size_t    size;
+    ssize_t   n, total;
+
+    total = 0;
+
+    /* the caller advances the buffers, they are filled in order */
+
+    for ( /* void */ ; in; in = in->next) {
+        size = in->buf->end - in->buf->last;
+
+        if (limit && (off_t) (total + size) > limit) {
+            size = (size_t) (limit - total);
+        }
+
+        n = ngx_http_upstream_multiplex_recv(c, in->buf->last, size);
+
+        if (n <= 0) {
+            return total ? total : n;
+        }
+
+        total += n;
+
+        if ((size_t) n < size || (limit && total >= limit)) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static ssize_t
+ngx_http_upstream_multiplex_send(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_buf_t     b;
+    ngx_chain_t   cl, *rc;
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    b.pos = buf;
+    b.last = buf + size;
+    b.temporary = 1;
+
+    cl.buf = &b;
+    cl.next = NULL;
+
+    rc = ngx_http_upstream_multiplex_send_chain(c, &cl, 0);
+
+    if (rc == NGX_CHAIN_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (b.pos == buf) {
+        return NGX_AGAIN;
+    }
+
+    return b.pos - buf;
+}
+
+
+static ngx_chain_t *
+ngx_http_upstream_multiplex_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    u_char                                *p;
+    size_t                                 n, size, header;
+    ngx_int_t                              rc;
+    ngx_buf_t                             *b;
+    ngx_http_upstream_multiplex_conn_t    *conn;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    st = (ngx_http_upstream_multiplex_stream_t *) c;
+    conn = st->conn;
+
+    if (st->done) {
+        for ( /* void */ ; in; in = in->next) {
+            if (ngx_buf_in_memory(in->buf)) {
+                c->sent += in->buf->last - in->buf->pos;
+                in->buf->pos = in->buf->last;
+            }
+        }
+
+        c->buffered &= ~NGX_LOWLEVEL_BUFFERED;
+
+        return NULL;
+    }
+
+    if (conn == NULL || st->error) {
+        c->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    header = conn->protocol->header_size;
+
+    /*
+     * only complete records are queued to the connection so that records
+     * of different requests do not interleave; a record the protocol
+     * holds back is staged and retried first
+     */
+
+    if (st->record_size && st->record_len == st->record_size) {
+        rc = conn->protocol->output(conn, st, st->record, st->record_size);
+
+        if (rc == NGX_ERROR) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (rc == NGX_AGAIN) {
+            st->blocked = 1;
+            c->write->ready = 0;
+            return in;
+        }
+
+        st->record_len = 0;
+        st->record_size = 0;
+
+        c->buffered &= ~NGX_LOWLEVEL_BUFFERED;
+    }
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        if (ngx_buf_special(b)) {
+            continue;
+        }
+
+        if (!ngx_buf_in_memory(b)) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                          "file buf in multiplexed upstream request");
+            return NGX_CHAIN_ERROR;
+        }
+
+        while (b->pos < b->last) {
+
+            size = b->last - b->pos;
+
+            if (st->preface) {
+                n = ngx_min(size, st->preface);
+
+#if (NGX_HTTP_V2)
+
+                /* the connection preface is sent by the first request */
+
+                if (!conn->preface_sent) {
+                    conn->preface_sent = 1;
+                    conn->setup = st;
+                }
+
+                if (conn->setup == st
+                    && ngx_http_upstream_multiplex_append(&conn->out, b->pos,
+                                                          n)
+                       == NULL)
+                {
+                    return NGX_CHAIN_ERROR;
+                }
+#endif
+
+                st->preface -= n;
+                b->pos += n;
+                c->sent += n;
+                continue;
+            }
+
+            /* header blocks of HTTP/2 are not interrupted */
+
+            if (conn->out.size >= NGX_HTTP_UPSTREAM_MULTIPLEX_BUFFERED
+                && !st->headers)
+            {
+                st->blocked = 1;
+                c->write->ready = 0;
+                goto done;
+            }
+
+            if (st->record_len == 0) {
+                p = b->pos;
+                n = conn->protocol->record_size(p, size);
+
+                if (n && size >= n) {
+                    rc = conn->protocol->output(conn, st, p, n);
+
+                    if (rc == NGX_ERROR) {
+                        return NGX_CHAIN_ERROR;
+                    }
+
+                    if (rc == NGX_AGAIN) {
+                        if (ngx_http_upstream_multiplex_stage(c, st, p, n)
+                            != NGX_OK)
+                        {
+                            return NGX_CHAIN_ERROR;
+                        }
+
+                        st->record_size = n;
+                    }
+
+                    b->pos += n;
+                    c->sent += n;
+
+                    if (rc == NGX_AGAIN) {
+                        st->blocked = 1;
+                        c->write->ready = 0;
+                        c->buffered |= NGX_LOWLEVEL_BUFFERED;
+                        goto done;
+                    }
+
+                    continue;
+                }
+            }
+
+            /* until the size is known, the record is staged by headers */
+
+            if (st->record_size) {
+                n = st->record_size - st->record_len;
+
+            } else {
+                n = header - st->record_len % header;
+            }
+
+            size = ngx_min(size, n);
+
+            if (ngx_http_upstream_multiplex_stage(c, st, b->pos, size)
+                != NGX_OK)
+            {
+                return NGX_CHAIN_ERROR;
+            }
+
+            b->pos += size;
+            c->sent += size;
+
+            if (st->record_size == 0 && st->record_len >= header) {
+                st->record_size = conn->protocol->record_size(st->record,
+                                                              st->record_len);
+            }
+
+            if (st->record_size && st->record_len == st->record_size) {
+                rc = conn->protocol->output(conn, st, st->record,
+                                            st->record_size);
+
+                if (rc == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (rc == NGX_AGAIN) {
+                    st->blocked = 1;
+                    c->write->ready = 0;
+                    c->buffered |= NGX_LOWLEVEL_BUFFERED;
+                    goto done;
+                }
+
+                st->record_len = 0;
+                st->record_size = 0;
+            }
+        }
+    }
+
+done:
+
+    while (in && in->buf->pos == in->buf->last && !ngx_buf_special(in->buf)) {
+        in = in->next;
+    }
+
+    ngx_http_upstream_multiplex_post_flush(conn);
+
+    return in;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_stage(ngx_connection_t *c,
+    ngx_http_upstream_multiplex_stream_t *st, u_char *p, size_t size)
+{
+    u_char  *record;
+    size_t   n;
+
+    n = ngx_max(st->record_len + size, st->record_size);
+
+    if (st->record_alloc < n) {
+        record = ngx_palloc(c->pool, n);
+        if (record == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(record, st->record, st->record_len);
+
+        st->record = record;
+        st->record_alloc = n;
+    }
+
+    ngx_memcpy(st->record + st->record_len, p, size);
+
+    st->record_len += size;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_multiplex_available(ngx_http_upstream_multiplex_conn_t *conn)
+{
+    return conn->nstreams < conn->conf->max_requests;
+}
+
+
+static size_t
+ngx_http_upstream_multiplex_fastcgi_record_size(u_char *p, size_t len)
+{
+    if (len < NGX_HTTP_FASTCGI_HEADER_SIZE) {
+        return 0;
+    }
+
+    return NGX_HTTP_FASTCGI_HEADER_SIZE + (p[4] << 8) + p[5] + p[6];
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_fastcgi_init_stream(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st)
+{
+    /* request ids are slots */
+
+    st->id = st->slot + 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_fastcgi_output(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, u_char *record, size_t size)
+{
+    u_char  *h;
+
+    h = ngx_http_upstream_multiplex_append(&conn->out, record, size);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    h[2] = (u_char) (st->id >> 8);
+    h[3] = (u_char) st->id;
+
+    if (h[1] == NGX_HTTP_FASTCGI_BEGIN_REQUEST
+        && size >= NGX_HTTP_FASTCGI_HEADER_SIZE + 3)
+    {
+        /* the connection is shared and must outlive the request */
+
+        h[NGX_HTTP_FASTCGI_HEADER_SIZE + 2] |= NGX_HTTP_FASTCGI_KEEP_CONN;
+
+        st->begun = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_fastcgi_header(
+    ngx_http_upstream_multiplex_conn_t *conn)
+{
+    u_char                                *h;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    h = conn->header;
+
+    if (h[0] != 1) {
+        ngx_log_error(NGX_LOG_ERR, conn->connection->log, 0,
+                      "upstream sent unsupported FastCGI "
+                      "protocol version: %d", h[0]);
+        return NGX_ERROR;
+    }
+
+    conn->type = h[1];
+    conn->id = (h[2] << 8) + h[3];
+    conn->rest = (h[4] << 8) + h[5] + h[6];
+
+    if (conn->id == 0 || conn->id > conn->conf->max_requests) {
+        return NGX_OK;
+    }
+
+    st = conn->streams[conn->id - 1];
+
+    if (st == NULL || st == &ngx_http_upstream_multiplex_aborted) {
+        return NGX_OK;
+    }
+
+    /* the fastcgi module only expects request id 1 */
+
+    h[2] = 0;
+    h[3] = 1;
+
+    conn->stream = st;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_fastcgi_end_record(
+    ngx_http_upstream_multiplex_conn_t *conn)
+{
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    if (conn->type != NGX_HTTP_FASTCGI_END_REQUEST
+        || conn->id == 0
+        || conn->id > conn->conf->max_requests)
+    {
+        return NGX_OK;
+    }
+
+    st = conn->streams[conn->id - 1];
+
+    if (st == NULL) {
+        return NGX_OK;
+    }
+
+    if (st != &ngx_http_upstream_multiplex_aborted) {
+        ngx_http_upstream_multiplex_detach(conn, st, 0);
+        return NGX_OK;
+    }
+
+    conn->streams[conn->id - 1] = NULL;
+    conn->nstreams--;
+
+    if (conn->nstreams == 0) {
+        ngx_http_upstream_multiplex_idle(conn);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_fastcgi_abort(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st)
+{
+    u_char  header[NGX_HTTP_FASTCGI_HEADER_SIZE];
+
+    if (!st->begun) {
+        conn->streams[st->slot] = NULL;
+        conn->nstreams--;
+
+        return NGX_OK;
+    }
+
+    /*
+     * the request is still processed by the server: ask to abort it,
+     * the id is reused after FCGI_END_REQUEST
+     */
+
+    header[0] = 1;
+    header[1] = NGX_HTTP_FASTCGI_ABORT_REQUEST;
+    header[2] = 0;
+    header[3] = 0;
+    header[4] = 0;
+    header[5] = 0;
+    header[6] = 0;
+    header[7] = 0;
+
+    conn->streams[st->slot] = &ngx_http_upstream_multiplex_aborted;
+
+    return ngx_http_upstream_multiplex_fastcgi_output(conn, st, header,
+                                                  NGX_HTTP_FASTCGI_HEADER_SIZE);
+}
+
+
+#if (NGX_HTTP_V2)
+
+static size_t
+ngx_http_upstream_multiplex_grpc_record_size(u_char *p, size_t len)
+{
+    if (len < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+        return 0;
+    }
+
+    return NGX_HTTP_V2_FRAME_HEADER_SIZE + (p[0] << 16) + (p[1] << 8) + p[2];
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_multiplex_grpc_available(
+    ngx_http_upstream_multiplex_conn_t *conn)
+{
+    /* stream ids are reserved for requests which are yet to send HEADERS */
+
+    return !conn->draining
+           && conn->nstreams < conn->conf->max_requests
+           && conn->nstreams < conn->max_streams
+           && conn->next_id + 2 * (conn->nstreams + 1)
+              <= NGX_HTTP_UPSTREAM_MULTIPLEX_MAX_ID;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_grpc_init_stream(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st)
+{
+    u_char  settings[6];
+
+    /*
+     * the request is given the server settings received so far, and
+     * the largest connection window as connection flow control is
+     * maintained here
+     */
+
+    st->recv_window = NGX_HTTP_UPSTREAM_MULTIPLEX_WINDOW;
+
+    if (conn->init_window != NGX_HTTP_V2_DEFAULT_WINDOW) {
+        settings[0] = 0;
+        settings[1] = 4;
+        (void) ngx_http_v2_write_uint32(&settings[2], conn->init_window);
+
+        if (ngx_http_upstream_multiplex_grpc_frame(&st->in,
+                                                   NGX_HTTP_V2_SETTINGS_FRAME,
+                                                   0, 0, settings, 6)
+            == NULL)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return ngx_http_upstream_multiplex_grpc_window_update(&st->in, 0,
+                                                  NGX_HTTP_V2_MAX_WINDOW
+                                                  - NGX_HTTP_V2_DEFAULT_WINDOW);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_grpc_output(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, u_char *record, size_t size)
+{
+    u_char      *h, *p, *last;
+    size_t       len;
+    ngx_uint_t   type, flags;
+
+    len = size - NGX_HTTP_V2_FRAME_HEADER_SIZE;
+    type = record[3];
+    flags = record[4];
+
+    if (ngx_http_v2_parse_sid(&record[5]) == 0) {
+
+        /*
+         * the connection start of the first request is passed,
+         * connection-level frames of requests are dropped otherwise
+         */
+
+        if (conn->setup != st || conn->setup_done) {
+            return NGX_OK;
+        }
+
+        h = ngx_http_upstream_multiplex_append(&conn->out, record, size);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = h + NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+        if (type == NGX_HTTP_V2_SETTINGS_FRAME
+            && !(flags & NGX_HTTP_V2_ACK_FLAG))
+        {
+            for (last = p + len; p + 6 <= last; p += 6) {
+
+                if (p[0] == 0 && p[1] == 4) {
+                    /* SETTINGS_INITIAL_WINDOW_SIZE */
+                    (void) ngx_http_v2_write_uint32(&p[2],
+                                           NGX_HTTP_UPSTREAM_MULTIPLEX_WINDOW);
+                }
+            }
+
+        } else if (type == NGX_HTTP_V2_WINDOW_UPDATE_FRAME && len == 4) {
+            conn->recv_window += ngx_http_v2_parse_window(p);
+        }
+
+        return NGX_OK;
+    }
+
+    /* stream windows are maintained here as well */
+
+    if (type == NGX_HTTP_V2_WINDOW_UPDATE_FRAME) {
+        return NGX_OK;
+    }
+
+    if (st->id == 0) {
+        if (type != NGX_HTTP_V2_HEADERS_FRAME) {
+            return NGX_OK;
+        }
+
+        /*
+         * requests over the server limit wait for other streams to end,
+         * the limit is not known until the server settings are received
+         */
+
+        if (conn->active >= (conn->settings ? conn->max_streams : 1)) {
+            return NGX_AGAIN;
+        }
+
+        conn->active++;
+
+        st->id = conn->next_id;
+        conn->next_id += 2;
+
+        st->begun = 1;
+
+        if (conn->setup == st) {
+            conn->setup_done = 1;
+        }
+    }
+
+    if (type == NGX_HTTP_V2_DATA_FRAME) {
+
+        if ((ssize_t) len > conn->send_window) {
+            return NGX_AGAIN;
+        }
+
+        conn->send_window -= len;
+        st->sent += len;
+
+        if (st->sent >= NGX_HTTP_V2_MAX_WINDOW / 2) {
+
+            /* replenish the connection window as seen by the request */
+
+            if (ngx_http_upstream_multiplex_grpc_window_update(&st->in, 0,
+                                                               st->sent)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            conn->buffered += NGX_HTTP_V2_FRAME_HEADER_SIZE + 4;
+            st->sent = 0;
+
+            ngx_http_upstream_multiplex_wake(&st->read);
+        }
+    }
+
+    h = ngx_http_upstream_multiplex_append(&conn->out, record, size);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    (void) ngx_http_v2_write_sid(&h[5], st->id);
+
+    if (type == NGX_HTTP_V2_HEADERS_FRAME
+        || type == NGX_HTTP_V2_CONTINUATION_FRAME)
+    {
+        st->headers = (flags & NGX_HTTP_V2_END_HEADERS_FLAG) ? 0 : 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_grpc_header(
+    ngx_http_upstream_multiplex_conn_t *conn)
+{
+    u_char                                *h;
+    ngx_uint_t                             i;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    h = conn->header;
+
+    conn->rest = (h[0] << 16) + (h[1] << 8) + h[2];
+    conn->type = h[3];
+    conn->flags = h[4];
+    conn->id = ngx_http_v2_parse_sid(&h[5]);
+
+    if (conn->type == NGX_HTTP_V2_DATA_FRAME) {
+
+        if (conn->rest > conn->recv_window) {
+            ngx_log_error(NGX_LOG_ERR, conn->connection->log, 0,
+                          "upstream violated connection flow control, "
+                          "received DATA frame length %uz, available "
+                          "window %uz", conn->rest, conn->recv_window);
+            return NGX_ERROR;
+        }
+
+        conn->recv_window -= conn->rest;
+    }
+
+    if (conn->id == 0) {
+        conn->capture = 1;
+        return NGX_OK;
+    }
+
+    for (i = 0; i < conn->conf->max_requests; i++) {
+        st = conn->streams[i];
+
+        if (st == NULL || st->id != conn->id) {
+            continue;
+        }
+
+        if (conn->type == NGX_HTTP_V2_DATA_FRAME) {
+
+            if (conn->rest > st->recv_window) {
+                ngx_log_error(NGX_LOG_ERR, conn->connection->log, 0,
+                              "upstream violated stream flow control, "
+                              "received DATA frame length %uz, available "
+                              "window %uz", conn->rest, st->recv_window);
+                return NGX_ERROR;
+            }
+
+            st->recv_window -= conn->rest;
+        }
+
+        /* the grpc module only expects stream 1 */
+
+        (void) ngx_http_v2_write_sid(&h[5], 1);
+
+        conn->stream = st;
+
+        break;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_grpc_end_record(
+    ngx_http_upstream_multiplex_conn_t *conn)
+{
+    size_t                                 n;
+    ngx_uint_t                             i, id;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    if (conn->type == NGX_HTTP_V2_DATA_FRAME
+        && conn->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4)
+    {
+        n = NGX_HTTP_V2_MAX_WINDOW - conn->recv_window;
+        conn->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+
+        if (ngx_http_upstream_multiplex_grpc_window_update(&conn->out, 0, n)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    if (conn->id) {
+        st = conn->stream;
+
+        if (st == NULL) {
+            return NGX_OK;
+        }
+
+        switch (conn->type) {
+
+        case NGX_HTTP_V2_RST_STREAM_FRAME:
+            break;
+
+        case NGX_HTTP_V2_DATA_FRAME:
+
+            if (conn->flags & NGX_HTTP_V2_END_STREAM_FLAG) {
+                break;
+            }
+
+            return NGX_OK;
+
+        case NGX_HTTP_V2_HEADERS_FRAME:
+
+            st->closing = (conn->flags & NGX_HTTP_V2_END_STREAM_FLAG) ? 1 : 0;
+
+            /* fall through */
+
+        case NGX_HTTP_V2_CONTINUATION_FRAME:
+
+            if (st->closing && (conn->flags & NGX_HTTP_V2_END_HEADERS_FLAG)) {
+                break;
+            }
+
+            return NGX_OK;
+
+        default:
+            return NGX_OK;
+        }
+
+        ngx_http_upstream_multiplex_grpc_done(conn, st, 0);
+
+        return NGX_OK;
+    }
+
+    switch (conn->type) {
+
+    case NGX_HTTP_V2_SETTINGS_FRAME:
+
+        if (conn->flags & NGX_HTTP_V2_ACK_FLAG) {
+            return NGX_OK;
+        }
+
+        return ngx_http_upstream_multiplex_grpc_settings(conn);
+
+    case NGX_HTTP_V2_PING_FRAME:
+
+        if ((conn->flags & NGX_HTTP_V2_ACK_FLAG) || conn->frame_len != 8) {
+            return NGX_OK;
+        }
+
+        if (ngx_http_upstream_multiplex_grpc_frame(&conn->out,
+                                                   NGX_HTTP_V2_PING_FRAME,
+                                                   NGX_HTTP_V2_ACK_FLAG, 0,
+                                                   conn->frame, 8)
+            == NULL)
+        {
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+
+    case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+        if (conn->frame_len != 4) {
+            return NGX_OK;
+        }
+
+        n = ngx_http_v2_parse_window(conn->frame);
+
+        if (n > (size_t) (NGX_HTTP_V2_MAX_WINDOW - conn->send_window)) {
+            ngx_log_error(NGX_LOG_ERR, conn->connection->log, 0,
+                          "upstream sent too large connection "
+                          "window update");
+            return NGX_ERROR;
+        }
+
+        conn->send_window += n;
+
+        ngx_http_upstream_multiplex_wake_blocked(conn);
+
+        return NGX_OK;
+
+    case NGX_HTTP_V2_GOAWAY_FRAME:
+
+        if (conn->frame_len < 8) {
+            return NGX_OK;
+        }
+
+        id = ngx_http_v2_parse_sid(conn->frame);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, conn->connection->log, 0,
+                       "multiplex goaway, last stream:%ui", id);
+
+        /* requests not processed by the server are passed to the next one */
+
+        conn->draining = 1;
+
+        for (i = 0; i < conn->conf->max_requests; i++) {
+            st = conn->streams[i];
+
+            if (st && (st->id == 0 || st->id > id)) {
+                ngx_http_upstream_multiplex_grpc_done(conn, st, 1);
+            }
+        }
+
+        return NGX_OK;
+
+    default:
+        return NGX_OK;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_grpc_settings(
+    ngx_http_upstream_multiplex_conn_t *conn)
+{
+    u_char                                *p, *last;
+    size_t                                 len;
+    ngx_uint_t                             i;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    len = conn->frame_len - conn->frame_len % 6;
+
+    p = conn->frame;
+    last = p + len;
+
+    for ( /* void */ ; p < last; p += 6) {
+
+        switch (ngx_http_v2_parse_uint16(p)) {
+
+        case 3:
+            /* SETTINGS_MAX_CONCURRENT_STREAMS */
+            conn->max_streams = ngx_http_v2_parse_uint32(&p[2]);
+            break;
+
+        case 4:
+            /* SETTINGS_INITIAL_WINDOW_SIZE */
+            conn->init_window = ngx_http_v2_parse_uint32(&p[2]);
+            break;
+        }
+    }
+
+    if (!conn->settings) {
+        conn->settings = 1;
+        ngx_http_upstream_multiplex_wake_blocked(conn);
+    }
+
+    /* the settings are acknowledged here, and passed to all requests */
+
+    for (i = 0; i < conn->conf->max_requests; i++) {
+        st = conn->streams[i];
+
+        if (st == NULL) {
+            continue;
+        }
+
+        if (ngx_http_upstream_multiplex_grpc_frame(&st->in,
+                                                   NGX_HTTP_V2_SETTINGS_FRAME,
+                                                   0, 0, conn->frame, len)
+            == NULL)
+        {
+            return NGX_ERROR;
+        }
+
+        conn->buffered += NGX_HTTP_V2_FRAME_HEADER_SIZE + len;
+
+        ngx_http_upstream_multiplex_wake(&st->read);
+    }
+
+    if (ngx_http_upstream_multiplex_grpc_frame(&conn->out,
+                                               NGX_HTTP_V2_SETTINGS_FRAME,
+                                               NGX_HTTP_V2_ACK_FLAG, 0,
+                                               NULL, 0)
+        == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_multiplex_grpc_done(ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, ngx_uint_t error)
+{
+    if (st->id) {
+        conn->active--;
+        ngx_http_upstream_multiplex_wake_blocked(conn);
+    }
+
+    ngx_http_upstream_multiplex_detach(conn, st, error);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_grpc_abort(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st)
+{
+    u_char  code[4];
+
+    conn->streams[st->slot] = NULL;
+    conn->nstreams--;
+
+    if (conn->setup == st && !conn->setup_done) {
+        ngx_log_error(NGX_LOG_INFO, conn->connection->log, 0,
+                      "request closed before multiplexed connection setup");
+        return NGX_ERROR;
+    }
+
+    if (st->id == 0) {
+        return NGX_OK;
+    }
+
+    conn->active--;
+    ngx_http_upstream_multiplex_wake_blocked(conn);
+
+    (void) ngx_http_v2_write_uint32(code, NGX_HTTP_V2_CANCEL);
+
+    if (ngx_http_upstream_multiplex_grpc_frame(&conn->out,
+                                               NGX_HTTP_V2_RST_STREAM_FRAME,
+                                               0, st->id, code, 4)
+        == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_grpc_consumed(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st)
+{
+    size_t  n;
+
+    /* the window is reopened for data read by the request */
+
+    n = NGX_HTTP_UPSTREAM_MULTIPLEX_WINDOW - st->recv_window;
+
+    if (st->id == 0 || n <= st->in.size) {
+        return NGX_OK;
+    }
+
+    n -= st->in.size;
+
+    if (n < NGX_HTTP_UPSTREAM_MULTIPLEX_WINDOW / 2) {
+        return NGX_OK;
+    }
+
+    st->recv_window += n;
+
+    if (ngx_http_upstream_multiplex_grpc_window_update(&conn->out, st->id, n)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_http_upstream_multiplex_post_flush(conn);
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_upstream_multiplex_grpc_frame(ngx_http_upstream_multiplex_queue_t *q,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t id, u_char *payload,
+    size_t len)
+{
+    u_char  *p, frame[NGX_HTTP_V2_FRAME_HEADER_SIZE
+                      + NGX_HTTP_UPSTREAM_MULTIPLEX_FRAME];
+
+    p = frame;
+
+    *p++ = (u_char) (len >> 16);
+    *p++ = (u_char) (len >> 8);
+    *p++ = (u_char) len;
+    *p++ = (u_char) type;
+    *p++ = (u_char) flags;
+
+    p = ngx_http_v2_write_sid(p, id);
+    p = ngx_cpymem(p, payload, len);
+
+    return ngx_http_upstream_multiplex_append(q, frame, p - frame);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_grpc_window_update(
+    ngx_http_upstream_multiplex_queue_t *q, ngx_uint_t id, size_t n)
+{
+    u_char  window[4];
+
+    (void) ngx_http_v2_write_uint32(window, n);
+
+    if (ngx_http_upstream_multiplex_grpc_frame(q,
+                                               NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                               0, id, window, 4)
+        == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static size_t
+ngx_http_upstream_multiplex_memcached_record_size(u_char *p, size_t len)
+{
+    u_char  *lf;
+
+    /* a request is a line, too long ones are rejected on output */
+
+    lf = ngx_strlchr(p, p + len, LF);
+
+    if (lf) {
+        return lf + 1 - p;
+    }
+
+    if (len > NGX_HTTP_UPSTREAM_MULTIPLEX_MC_LINE) {
+        return len;
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_memcached_init_stream(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st)
+{
+    ngx_uint_t                         n;
+    ngx_http_upstream_multiplex_mc_t  *mc;
+
+    st->id = st->slot + 1;
+
+    if (conn->memcached) {
+        return NGX_OK;
+    }
+
+    n = conn->conf->max_requests;
+
+    mc = ngx_pcalloc(conn->pool, sizeof(ngx_http_upstream_multiplex_mc_t));
+    if (mc == NULL) {
+        return NGX_ERROR;
+    }
+
+    mc->gets = ngx_pcalloc(conn->pool,
+                           n * sizeof(ngx_http_upstream_multiplex_mc_get_t));
+    if (mc->gets == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* a spare entry tells a full ring from an empty one */
+
+    mc->nring = n + 1;
+
+    mc->ring = ngx_palloc(conn->pool, mc->nring * sizeof(ngx_uint_t));
+    if (mc->ring == NULL) {
+        return NGX_ERROR;
+    }
+
+    conn->memcached = mc;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_memcached_output(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st, u_char *record, size_t size)
+{
+    u_char                                *key;
+    size_t                                 len;
+    ngx_http_upstream_multiplex_mc_t      *mc;
+    ngx_http_upstream_multiplex_mc_get_t  *get;
+
+    /* the only request of the memcached module is "get <key>\r\n" */
+
+    if (st->begun
+        || size < sizeof("get x" CRLF) - 1
+        || ngx_strncmp(record, "get ", 4) != 0
+        || record[size - 2] != CR)
+    {
+        goto invalid;
+    }
+
+    key = record + 4;
+    len = size - 4 - 2;
+
+    if (len > NGX_HTTP_UPSTREAM_MULTIPLEX_MC_KEY
+        || ngx_strlchr(key, key + len, ' ') != NULL)
+    {
+        goto invalid;
+    }
+
+    mc = conn->memcached;
+    get = &mc->gets[st->slot];
+
+    if (get->key == NULL) {
+        get->key = ngx_pnalloc(conn->pool, NGX_HTTP_UPSTREAM_MULTIPLEX_MC_KEY);
+        if (get->key == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_memcpy(get->key, key, len);
+    get->key_len = len;
+
+    /* gets are batched into multi-gets on flush */
+
+    mc->ring[mc->last] = st->slot;
+    mc->last = (mc->last + 1) % mc->nring;
+
+    st->begun = 1;
+    conn->pending = 1;
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ALERT, st->connection.log, 0,
+                  "unsupported request to multiplexed memcached upstream");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_memcached_abort(
+    ngx_http_upstream_multiplex_conn_t *conn,
+    ngx_http_upstream_multiplex_stream_t *st)
+{
+    if (!st->begun) {
+        conn->streams[st->slot] = NULL;
+        conn->nstreams--;
+
+        return NGX_OK;
+    }
+
+    /* the slot is reused after the reply to its multi-get */
+
+    conn->streams[st->slot] = &ngx_http_upstream_multiplex_aborted;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_memcached_demux(
+    ngx_http_upstream_multiplex_conn_t *conn, u_char *p, u_char *last)
+{
+    u_char                                *lf;
+    size_t                                 n;
+    ngx_uint_t                             i;
+    ngx_http_upstream_multiplex_mc_t      *mc;
+    ngx_http_upstream_multiplex_mc_get_t  *get;
+
+    mc = conn->memcached;
+
+    while (p < last) {
+
+        if (conn->rest) {
+            n = ngx_min((size_t) (last - p), conn->rest);
+
+            /* a value is passed to all requests for its key */
+
+            for (i = mc->head; /* void */ ; i = (i + 1) % mc->nring) {
+                get = &mc->gets[mc->ring[i]];
+
+                if (get->value
+                    && ngx_http_upstream_multiplex_memcached_deliver(conn,
+                                                         mc->ring[i], p, n)
+                       != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                if (get->last) {
+                    break;
+                }
+            }
+
+            conn->rest -= n;
+            p += n;
+            continue;
+        }
+
+        lf = ngx_strlchr(p, last, LF);
+
+        n = (lf ? lf + 1 : last) - p;
+
+        if (mc->line_len + n > NGX_HTTP_UPSTREAM_MULTIPLEX_MC_LINE) {
+            ngx_log_error(NGX_LOG_ERR, conn->connection->log, 0,
+                          "upstream sent too long memcached response line");
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(mc->line + mc->line_len, p, n);
+
+        mc->line_len += n;
+        p += n;
+
+        if (lf == NULL) {
+            break;
+        }
+
+        if (ngx_http_upstream_multiplex_memcached_line(conn) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        mc->line_len = 0;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_memcached_line(
+    ngx_http_upstream_multiplex_conn_t *conn)
+{
+    u_char                                *p, *last, *key, *bytes;
+    off_t                                  size;
+    size_t                                 len;
+    ngx_uint_t                             i, slot;
+    ngx_http_upstream_multiplex_mc_t      *mc;
+    ngx_http_upstream_multiplex_mc_get_t  *get;
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    mc = conn->memcached;
+
+    p = mc->line;
+    last = p + mc->line_len;
+
+    if (mc->head == mc->sent) {
+        goto invalid;
+    }
+
+    if (mc->line_len > sizeof("VALUE ") - 1
+        && ngx_strncmp(p, "VALUE ", sizeof("VALUE ") - 1) == 0)
+    {
+        /* "VALUE <key> <flags> <bytes> [<cas unique>]\r\n" */
+
+        key = p + sizeof("VALUE ") - 1;
+
+        p = ngx_strlchr(key, last, ' ');
+        if (p == NULL) {
+            goto invalid;
+        }
+
+        len = p - key;
+
+        p = ngx_strlchr(p + 1, last, ' ');
+        if (p == NULL) {
+            goto invalid;
+        }
+
+        bytes = ++p;
+
+        while (p < last && *p >= '0' && *p <= '9') {
+            p++;
+        }
+
+        size = ngx_atoof(bytes, p - bytes);
+        if (size == NGX_ERROR) {
+            goto invalid;
+        }
+
+        /* the data block is followed by CRLF */
+
+        conn->rest = size + 2;
+
+        for (i = mc->head; /* void */ ; i = (i + 1) % mc->nring) {
+            get = &mc->gets[mc->ring[i]];
+
+            get->value = (get->key_len == len
+                          && ngx_memcmp(get->key, key, len) == 0);
+
+            if (get->value
+                && ngx_http_upstream_multiplex_memcached_deliver(conn,
+                                          mc->ring[i], mc->line, mc->line_len)
+                   != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            if (get->last) {
+                break;
+            }
+        }
+
+        return NGX_OK;
+    }
+
+    /* "END", as well as an error, completes the multi-get */
+
+    i = mc->head;
+
+    do {
+        slot = mc->ring[i];
+        get = &mc->gets[slot];
+        st = conn->streams[slot];
+
+        i = (i + 1) % mc->nring;
+
+        if (st == &ngx_http_upstream_multiplex_aborted) {
+            conn->streams[slot] = NULL;
+            conn->nstreams--;
+
+            if (conn->nstreams == 0) {
+                ngx_http_upstream_multiplex_idle(conn);
+            }
+
+            continue;
+        }
+
+        if (st == NULL) {
+            continue;
+        }
+
+        if (ngx_http_upstream_multiplex_memcached_deliver(conn, slot,
+                                                          mc->line,
+                                                          mc->line_len)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        ngx_http_upstream_multiplex_detach(conn, st, 0);
+
+    } while (!get->last);
+
+    mc->head = i;
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, conn->connection->log, 0,
+                  "upstream sent invalid memcached response line: \"%*s\"",
+                  mc->line_len, mc->line);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_memcached_deliver(
+    ngx_http_upstream_multiplex_conn_t *conn, ngx_uint_t slot, u_char *p,
+    size_t size)
+{
+    ngx_http_upstream_multiplex_stream_t  *st;
+
+    st = conn->streams[slot];
+
+    if (st == NULL || st == &ngx_http_upstream_multiplex_aborted) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_upstream_multiplex_append(&st->in, p, size) == NULL) {
+        return NGX_ERROR;
+    }
+
+    conn->buffered += size;
+
+    ngx_http_upstream_multiplex_wake(&st->read);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_multiplex_memcached_flush(
+    ngx_http_upstream_multiplex_conn_t *conn)
+{
+    ngx_uint_t                             i, n, first;
+    ngx_http_upstream_multiplex_mc_t      *mc;
+    ngx_http_upstream_multiplex_mc_get_t  *get, *prev;
+
+    mc = conn->memcached;
+
+    while (mc->sent != mc->last) {
+
+        if (ngx_http_upstream_multiplex_append(&conn->out, (u_char *) "get",
+                                               3)
+            == NULL)
+        {
+            return NGX_ERROR;
+        }
+
+        first = mc->sent;
+        get = NULL;
+
+        for (n = 0;
+             n < NGX_HTTP_UPSTREAM_MULTIPLEX_MC_BATCH && mc->sent != mc->last;
+             n++)
+        {
+            get = &mc->gets[mc->ring[mc->sent]];
+
+            get->last = 0;
+            get->value = 0;
+
+            /* a key requested by several requests is sent once */
+
+            for (i = first; i != mc->sent; i = (i + 1) % mc->nring) {
+                prev = &mc->gets[mc->ring[i]];
+
+                if (prev->key_len == get->key_len
+                    && ngx_memcmp(prev->key, get->key, get->key_len) == 0)
+                {
+                    break;
+                }
+            }
+
+            if (i == mc->sent
+                && (ngx_http_upstream_multiplex_append(&conn->out,
+                                                       (u_char *) " ", 1)
+                    == NULL
+                    || ngx_http_upstream_multiplex_append(&conn->out,
+                                                          get->key,
+                                                          get->key_len)
+                       == NULL))
+            {
+                return NGX_ERROR;
+            }
+
+            mc->sent = (mc->sent + 1) % mc->nring;
+        }
+
+        get->last = 1;
+
+        if (ngx_http_upstream_multiplex_append(&conn->out, (u_char *) CRLF,
+                                               2)
+            == NULL)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_upstream_multiplex_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_multiplex_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_multiplex_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->original_init_upstream = NULL;
+     *     conf->original_init_peer = NULL;
+     *     conf->max_requests = 0;
+     *     conf->protocol = NULL;
+     */
+
+    conf->timeout = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_multiplex(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_srv_conf_t            *uscf;
+    ngx_http_upstream_multiplex_srv_conf_t  *mcf = conf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_msec_t   timeout;
+
+    if (mcf->max_requests) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0 || n > 65535) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    mcf->max_requests = n;
+    mcf->protocol = cmd->post;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "timeout=", 8) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 8;
+        s.data = value[2].data + 8;
+
+        timeout = ngx_parse_time(&s, 0);
+
+        if (timeout == (ngx_msec_t) NGX_ERROR) {
+            goto invalid;
+        }
+
+        mcf->timeout = timeout;
+    }
+
+    /* init upstream handler */
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    mcf->original_init_upstream = uscf->peer.init_upstream
+                                  ? uscf->peer.init_upstream
+                                  : ngx_http_upstream_init_round_robin;
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_multiplex;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
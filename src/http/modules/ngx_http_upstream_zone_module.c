@@ -10,6 +10,17 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_int_t                      weight;
+    ngx_int_t                      max_conns;
+    ngx_int_t                      max_fails;
+    time_t                         fail_timeout;
+    ngx_int_t                      down;
+    ngx_uint_t                     drain;
+    ngx_uint_t                     backup;
+} ngx_http_upstream_conf_params_t;
+
+
 static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
@@ -18,6 +29,40 @@ static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
     ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
+static ngx_int_t ngx_http_upstream_zone_copy_hosts(
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peers_t *primary);
+static void ngx_http_upstream_zone_free_peer(ngx_slab_pool_t *pool,
+    ngx_http_upstream_rr_peer_t *peer);
+static void ngx_http_upstream_zone_free_zombies(
+    ngx_http_upstream_rr_peers_t *peers);
+static void ngx_http_upstream_zone_update_peers(
+    ngx_http_upstream_rr_peers_t *peers);
+static char *ngx_http_upstream_zone_resolver(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_zone_resolver_timeout(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_upstream_zone_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle);
+static void ngx_http_upstream_zone_resolve_timer(ngx_event_t *event);
+static void ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
+
+static char *ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_upstream_conf_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_conf_params_t *cp,
+    ngx_str_t *err);
+static ngx_int_t ngx_http_upstream_conf_add(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_conf_params_t *cp,
+    ngx_str_t *err);
+static ngx_int_t ngx_http_upstream_conf_edit(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_conf_params_t *cp,
+    ngx_uint_t id, ngx_str_t *err);
+static ngx_int_t ngx_http_upstream_conf_list(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf);
+static ngx_int_t ngx_http_upstream_conf_send(ngx_http_request_t *r,
+    ngx_uint_t status, ngx_buf_t *b, ngx_uint_t json);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -29,13 +74,34 @@ static ngx_command_t  ngx_http_upstream_zone_commands[] = {
       0,
       NULL },
 
+    { ngx_string("resolver"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
+      ngx_http_upstream_zone_resolver,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("resolver_timeout"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_zone_resolver_timeout,
+      0,
+      offsetof(ngx_http_upstream_srv_conf_t, resolver_timeout),
+      NULL },
+
+    { ngx_string("upstream_conf"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_conf,
+      0,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
 
 static ngx_http_module_t  ngx_http_upstream_zone_module_ctx = {
     NULL,                                  /* preconfiguration */
-    NULL,                                  /* postconfiguration */
+    ngx_http_upstream_zone_init,           /* postconfiguration */
 
     NULL,                                  /* create main configuration */
     NULL,                                  /* init main configuration */
@@ -55,7 +121,7 @@ ngx_module_t  ngx_http_upstream_zone_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_zone_init_worker,    /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -175,6 +241,14 @@ ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (uscf->stats) {
+            uscf->stats = ngx_slab_calloc(shpool,
+                                          sizeof(ngx_http_upstream_stats_t));
+            if (uscf->stats == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
         *peersp = peers;
         peersp = &peers->zone_next;
     }
@@ -215,6 +289,8 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
     peers->shpool = shpool;
 
+    peers->next_id = 0;
+
     for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
         peer = ngx_http_upstream_zone_copy_peer(peers, *peerp);
@@ -222,9 +298,22 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        peer->id = peers->next_id++;
+
         *peerp = peer;
     }
 
+    /* shared by primary and backup peers */
+
+    peers->config = ngx_slab_calloc(shpool, sizeof(ngx_uint_t));
+    if (peers->config == NULL) {
+        return NULL;
+    }
+
+    if (ngx_http_upstream_zone_copy_hosts(uscf, peers, peers) != NGX_OK) {
+        return NULL;
+    }
+
     if (peers->next == NULL) {
         goto done;
     }
@@ -247,9 +336,17 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        peer->id = peers->next_id++;
+
         *peerp = peer;
     }
 
+    backup->config = peers->config;
+
+    if (ngx_http_upstream_zone_copy_hosts(uscf, backup, peers) != NGX_OK) {
+        return NULL;
+    }
+
     peers->next = backup;
 
 done:
@@ -292,8 +389,10 @@ ngx_http_upstream_zone_copy_peer(ngx_http_upstream_rr_peers_t *peers,
     }
 
     if (src) {
-        ngx_memcpy(dst->sockaddr, src->sockaddr, src->socklen);
-        ngx_memcpy(dst->name.data, src->name.data, src->name.len);
+        if (src->sockaddr) {
+            ngx_memcpy(dst->sockaddr, src->sockaddr, src->socklen);
+            ngx_memcpy(dst->name.data, src->name.data, src->name.len);
+        }
 
         dst->server.data = ngx_slab_alloc_locked(pool, src->server.len);
         if (dst->server.data == NULL) {
@@ -323,3 +422,1125 @@ failed:
 
     return NULL;
 }
+
+
+static ngx_int_t
+ngx_http_upstream_zone_copy_hosts(ngx_http_upstream_srv_conf_t *uscf,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peers_t *primary)
+{
+    ngx_http_upstream_host_t     *host;
+    ngx_http_upstream_rr_peer_t  *peer, **peerp;
+
+    for (peerp = &peers->resolve; *peerp; peerp = &peer->next) {
+
+        host = ngx_slab_calloc(peers->shpool, sizeof(ngx_http_upstream_host_t));
+        if (host == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* pool is unlocked */
+        peer = ngx_http_upstream_zone_copy_peer(peers, *peerp);
+        if (peer == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* the names are only used by workers of this cycle */
+
+        host->name = (*peerp)->host->name;
+        host->service = (*peerp)->host->service;
+        host->port = (*peerp)->host->port;
+        host->timeout = uscf->resolver_timeout;
+        host->resolver = uscf->resolver;
+        host->peers = primary;
+        host->peer = peer;
+        host->backup = (peers != primary);
+
+        peer->host = host;
+
+        *peerp = peer;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_free_peer(ngx_slab_pool_t *pool,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    if (peer->server.data) {
+        ngx_slab_free_locked(pool, peer->server.data);
+    }
+
+    if (peer->name.data) {
+        ngx_slab_free_locked(pool, peer->name.data);
+    }
+
+    if (peer->sockaddr) {
+        ngx_slab_free_locked(pool, peer->sockaddr);
+    }
+
+#if (NGX_HTTP_SSL)
+    if (peer->ssl_session) {
+        ngx_slab_free_locked(pool, peer->ssl_session);
+    }
+#endif
+
+    ngx_slab_free_locked(pool, peer);
+}
+
+
+static void
+ngx_http_upstream_zone_free_zombies(ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_http_upstream_rr_peer_t  *peer, **peerp;
+
+    /* peers are locked for writing, pool is locked */
+
+    for (peerp = &peers->zombies; *peerp; /* void */) {
+        peer = *peerp;
+
+        if (peer->conns) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        *peerp = peer->next;
+
+        ngx_http_upstream_zone_free_peer(peers->shpool, peer);
+    }
+}
+
+
+static void
+ngx_http_upstream_zone_update_peers(ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                    n, w;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    /* peers are locked for writing */
+
+    n = 0;
+    w = 0;
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+        n++;
+        w += peer->weight;
+    }
+
+    peers->number = n;
+    peers->total_weight = w;
+    peers->weighted = (w != n);
+
+    /* a single server stays single only until peers are added */
+
+    peers->single = (peers->single && n == 1);
+
+    (*peers->config)++;
+}
+
+
+static char *
+ngx_http_upstream_zone_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_str_t                     *value;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->resolver) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    uscf->resolver = ngx_resolver_create(cf, &value[1], cf->args->nelts - 1);
+    if (uscf->resolver == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_zone_resolver_timeout(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    return ngx_conf_set_msec_slot(cf, cmd, uscf);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                      i;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    /* upstreams without a resolver use the one of the http block */
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        peers = uscf->peer.data;
+
+        if (uscf->shm_zone == NULL
+            || peers == NULL
+            || (peers->resolve == NULL
+                && (peers->next == NULL || peers->next->resolve == NULL)))
+        {
+            continue;
+        }
+
+        if (uscf->resolver == NULL) {
+            uscf->resolver = clcf->resolver;
+        }
+
+        ngx_conf_merge_msec_value(uscf->resolver_timeout,
+                                  clcf->resolver_timeout, 30000);
+
+        if (uscf->resolver == NULL || uscf->resolver->connections.nelts == 0) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "no resolver defined to resolve names "
+                          "of upstream \"%V\" in %s:%ui",
+                          &uscf->host, uscf->file_name, uscf->line);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                      i, n;
+    ngx_core_conf_t                *ccf;
+    ngx_http_upstream_host_t       *host;
+    ngx_http_upstream_rr_peer_t    *peer;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    uscfp = umcf->upstreams.elts;
+    n = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone == NULL) {
+            continue;
+        }
+
+        for (peers = uscf->peer.data; peers; peers = peers->next) {
+
+            for (peer = peers->resolve; peer; peer = peer->next) {
+
+                /* each name is resolved by one of the workers */
+
+                if (ngx_process == NGX_PROCESS_WORKER
+                    && n++ % ccf->worker_processes != ngx_worker)
+                {
+                    continue;
+                }
+
+                host = peer->host;
+
+                /* the event may be left by a previous worker in this slot */
+
+                ngx_memzero(&host->event, sizeof(ngx_event_t));
+
+                host->event.handler = ngx_http_upstream_zone_resolve_timer;
+                host->event.data = host;
+                host->event.log = cycle->log;
+                host->event.cancelable = 1;
+
+                ngx_add_timer(&host->event, 1);
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_timer(ngx_event_t *event)
+{
+    ngx_resolver_ctx_t        *ctx;
+    ngx_http_upstream_host_t  *host;
+
+    host = event->data;
+
+    ctx = ngx_resolve_start(host->resolver, NULL);
+    if (ctx == NULL) {
+        goto retry;
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "no resolver defined to resolve %V", &host->name);
+        return;
+    }
+
+    ctx->name = host->name;
+    ctx->service = host->service;
+    ctx->handler = ngx_http_upstream_zone_resolve_handler;
+    ctx->data = host;
+    ctx->timeout = host->timeout;
+    ctx->cancelable = 1;
+
+    if (ngx_resolve_name(ctx) == NGX_OK) {
+        return;
+    }
+
+retry:
+
+    ngx_add_timer(event, ngx_max(host->timeout, 1000));
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    time_t                         now;
+    ngx_uint_t                     i, added, removed, priority;
+    ngx_msec_t                     timer;
+    ngx_event_t                   *event;
+    ngx_slab_pool_t               *shpool;
+    ngx_resolver_addr_t           *addr;
+    ngx_http_upstream_host_t      *host;
+    ngx_http_upstream_rr_peer_t   *peer, *template, **peerp, **last;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    host = ctx->data;
+    event = &host->event;
+    template = host->peer;
+
+    peers = host->backup ? host->peers->next : host->peers;
+    shpool = peers->shpool;
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "upstream \"%V\": %V could not be resolved (%i: %s)",
+                      peers->name, &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state));
+
+        if (ctx->state != NGX_RESOLVE_NXDOMAIN) {
+
+            /* servers are kept until the name is known to be gone */
+
+            ngx_resolve_name_done(ctx);
+            ngx_add_timer(event, ngx_max(host->timeout, 1000));
+            return;
+        }
+
+        ctx->naddrs = 0;
+    }
+
+    /* only the most preferred targets of a service are used */
+
+    priority = (ngx_uint_t) -1;
+
+    for (i = 0; i < ctx->naddrs; i++) {
+        addr = &ctx->addrs[i];
+
+        if (host->service.len == 0) {
+            ngx_inet_set_port(addr->sockaddr, host->port);
+
+        } else if (addr->priority < priority) {
+            priority = addr->priority;
+        }
+    }
+
+    added = 0;
+    removed = 0;
+
+    /* backup peers are changed under the lock of primary peers as well */
+
+    ngx_http_upstream_rr_peers_wlock(host->peers);
+
+    if (host->backup) {
+        ngx_http_upstream_rr_peers_wlock(peers);
+    }
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    /* removed peers wait for their connections to be closed */
+
+    for (peerp = &peers->peer; *peerp; /* void */) {
+        peer = *peerp;
+
+        if (peer->host != host) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        for (i = 0; i < ctx->naddrs; i++) {
+            addr = &ctx->addrs[i];
+
+            if (host->service.len && addr->priority != priority) {
+                continue;
+            }
+
+            if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                 addr->sockaddr, addr->socklen, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i < ctx->naddrs) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, event->log, 0,
+                       "upstream \"%V\": removed %V", peers->name, &peer->name);
+
+        *peerp = peer->next;
+
+        peer->next = peers->zombies;
+        peers->zombies = peer;
+
+        removed++;
+    }
+
+    last = peerp;
+
+    for (i = 0; i < ctx->naddrs; i++) {
+        addr = &ctx->addrs[i];
+
+        if (host->service.len && addr->priority != priority) {
+            continue;
+        }
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+            if (peer->host == host
+                && ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                    addr->sockaddr, addr->socklen, 1)
+                   == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (peer) {
+            continue;
+        }
+
+        peer = ngx_http_upstream_zone_copy_peer(peers, template);
+        if (peer == NULL) {
+            break;
+        }
+
+        ngx_memcpy(peer->sockaddr, addr->sockaddr, addr->socklen);
+        peer->socklen = addr->socklen;
+
+        peer->name.len = ngx_sock_ntop(peer->sockaddr, peer->socklen,
+                                       peer->name.data, NGX_SOCKADDR_STRLEN, 1);
+
+        if (host->service.len) {
+            peer->weight = ngx_max(addr->weight, 1);
+            peer->effective_weight = peer->weight;
+        }
+
+        peer->id = host->peers->next_id++;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, event->log, 0,
+                       "upstream \"%V\": added %V", peers->name, &peer->name);
+
+        peer->next = NULL;
+
+        *last = peer;
+        last = &peer->next;
+
+        added++;
+    }
+
+    ngx_http_upstream_zone_free_zombies(peers);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    if (added || removed) {
+        ngx_http_upstream_zone_update_peers(peers);
+    }
+
+    if (host->backup) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(host->peers);
+
+    if (added || removed) {
+        ngx_log_error(NGX_LOG_NOTICE, event->log, 0,
+                      "upstream \"%V\": %V resolved, "
+                      "%ui servers added, %ui removed",
+                      peers->name, &ctx->name, added, removed);
+    }
+
+    now = ngx_time();
+
+    timer = (ngx_msec_t) 1000 * (ctx->valid > now ? ctx->valid - now + 1 : 1);
+
+    ngx_resolve_name_done(ctx);
+
+    ngx_add_timer(event, timer);
+}
+
+
+static char *
+ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_conf_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                        rc, id;
+    ngx_str_t                        name, value, err;
+    ngx_buf_t                       *b;
+    ngx_uint_t                       i;
+    ngx_http_upstream_srv_conf_t    *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t   *umcf;
+    ngx_http_upstream_conf_params_t  cp;
+
+    if (r->method != NGX_HTTP_GET) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "upstream", 8, &name) != NGX_OK) {
+        ngx_str_set(&err, "upstream is not specified");
+        rc = NGX_HTTP_BAD_REQUEST;
+        goto failed;
+    }
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone
+            && uscf->peer.data
+            && uscf->host.len == name.len
+            && ngx_strncmp(uscf->host.data, name.data, name.len) == 0)
+        {
+            break;
+        }
+    }
+
+    if (i == umcf->upstreams.nelts) {
+        ngx_str_set(&err, "upstream not found");
+        rc = NGX_HTTP_NOT_FOUND;
+        goto failed;
+    }
+
+    rc = ngx_http_upstream_conf_parse(r, uscf, &cp, &err);
+
+    if (rc != NGX_OK) {
+        goto failed;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "add", 3, &value) == NGX_OK) {
+        rc = ngx_http_upstream_conf_add(r, uscf, &cp, &err);
+
+    } else if (ngx_http_arg(r, (u_char *) "id", 2, &value) == NGX_OK) {
+
+        id = ngx_atoi(value.data, value.len);
+
+        if (id == NGX_ERROR) {
+            ngx_str_set(&err, "invalid id");
+            rc = NGX_HTTP_BAD_REQUEST;
+            goto failed;
+        }
+
+        rc = ngx_http_upstream_conf_edit(r, uscf, &cp, id, &err);
+    }
+
+    if (rc == NGX_OK) {
+        return ngx_http_upstream_conf_list(r, uscf);
+    }
+
+failed:
+
+    if (rc == NGX_ERROR) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b = ngx_create_temp_buf(r->pool, err.len + 1);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->last, err.data, err.len);
+    *b->last++ = LF;
+
+    return ngx_http_upstream_conf_send(r, rc, b, 0);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_conf_params_t *cp,
+    ngx_str_t *err)
+{
+    ngx_str_t   name, value;
+    ngx_uint_t  flag;
+
+    cp->weight = NGX_CONF_UNSET;
+    cp->max_conns = NGX_CONF_UNSET;
+    cp->max_fails = NGX_CONF_UNSET;
+    cp->fail_timeout = NGX_CONF_UNSET;
+    cp->down = NGX_CONF_UNSET;
+    cp->drain = 0;
+    cp->backup = 0;
+
+    /* the same parameters as of the "server" directive are allowed */
+
+    ngx_str_set(&name, "weight");
+    flag = NGX_HTTP_UPSTREAM_WEIGHT;
+
+    if (ngx_http_arg(r, name.data, name.len, &value) == NGX_OK) {
+
+        if (!(uscf->flags & flag)) {
+            goto not_supported;
+        }
+
+        cp->weight = ngx_atoi(value.data, value.len);
+
+        if (cp->weight == NGX_ERROR || cp->weight == 0) {
+            goto invalid;
+        }
+    }
+
+    ngx_str_set(&name, "max_conns");
+    flag = NGX_HTTP_UPSTREAM_MAX_CONNS;
+
+    if (ngx_http_arg(r, name.data, name.len, &value) == NGX_OK) {
+
+        if (!(uscf->flags & flag)) {
+            goto not_supported;
+        }
+
+        cp->max_conns = ngx_atoi(value.data, value.len);
+
+        if (cp->max_conns == NGX_ERROR) {
+            goto invalid;
+        }
+    }
+
+    ngx_str_set(&name, "max_fails");
+    flag = NGX_HTTP_UPSTREAM_MAX_FAILS;
+
+    if (ngx_http_arg(r, name.data, name.len, &value) == NGX_OK) {
+
+        if (!(uscf->flags & flag)) {
+            goto not_supported;
+        }
+
+        cp->max_fails = ngx_atoi(value.data, value.len);
+
+        if (cp->max_fails == NGX_ERROR) {
+            goto invalid;
+        }
+    }
+
+    ngx_str_set(&name, "fail_timeout");
+    flag = NGX_HTTP_UPSTREAM_FAIL_TIMEOUT;
+
+    if (ngx_http_arg(r, name.data, name.len, &value) == NGX_OK) {
+
+        if (!(uscf->flags & flag)) {
+            goto not_supported;
+        }
+
+        cp->fail_timeout = ngx_parse_time(&value, 1);
+
+        if (cp->fail_timeout == (time_t) NGX_ERROR) {
+            goto invalid;
+        }
+    }
+
+    flag = NGX_HTTP_UPSTREAM_DOWN;
+
+    if (ngx_http_arg(r, (u_char *) "down", 4, &value) == NGX_OK) {
+        ngx_str_set(&name, "down");
+
+        if (!(uscf->flags & flag)) {
+            goto not_supported;
+        }
+
+        cp->down = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "up", 2, &value) == NGX_OK) {
+        cp->down = 0;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "drain", 5, &value) == NGX_OK) {
+        cp->drain = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "backup", 6, &value) == NGX_OK) {
+        ngx_str_set(&name, "backup");
+        flag = NGX_HTTP_UPSTREAM_BACKUP;
+
+        if (!(uscf->flags & flag)) {
+            goto not_supported;
+        }
+
+        cp->backup = 1;
+    }
+
+    return NGX_OK;
+
+not_supported:
+
+    err->data = ngx_pnalloc(r->pool, name.len + sizeof("\"\" not supported"));
+    if (err->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    err->len = ngx_sprintf(err->data, "\"%V\" not supported", &name)
+               - err->data;
+
+    return NGX_HTTP_BAD_REQUEST;
+
+invalid:
+
+    err->data = ngx_pnalloc(r->pool, name.len + sizeof("invalid \"\" value"));
+    if (err->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    err->len = ngx_sprintf(err->data, "invalid \"%V\" value", &name)
+               - err->data;
+
+    return NGX_HTTP_BAD_REQUEST;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_add(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_conf_params_t *cp,
+    ngx_str_t *err)
+{
+    u_char                        *p, *dst, *src;
+    ngx_int_t                      rc;
+    ngx_str_t                      value;
+    ngx_addr_t                     addr;
+    ngx_slab_pool_t               *shpool;
+    ngx_http_upstream_rr_peer_t    template, *peer, **peerp;
+    ngx_http_upstream_rr_peers_t  *primary, *peers;
+    u_char                         name[NGX_SOCKADDR_STRLEN];
+
+    if (ngx_http_arg(r, (u_char *) "server", 6, &value) != NGX_OK) {
+        ngx_str_set(err, "server is not specified");
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    p = ngx_pnalloc(r->pool, value.len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    src = value.data;
+    dst = p;
+
+    ngx_unescape_uri(&dst, &src, value.len, 0);
+
+    value.data = p;
+    value.len = dst - p;
+
+    /* names are not resolved here, only addresses are accepted */
+
+    rc = ngx_parse_addr_port(r->pool, &addr, value.data, value.len);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc != NGX_OK) {
+        ngx_str_set(err, "invalid server address");
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (ngx_inet_get_port(addr.sockaddr) == 0) {
+        ngx_inet_set_port(addr.sockaddr, 80);
+    }
+
+    primary = uscf->peer.data;
+    peers = cp->backup ? primary->next : primary;
+
+    if (peers == NULL) {
+        ngx_str_set(err, "upstream has no backup servers");
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    ngx_memzero(&template, sizeof(ngx_http_upstream_rr_peer_t));
+
+    template.sockaddr = addr.sockaddr;
+    template.socklen = addr.socklen;
+    template.name.data = name;
+    template.name.len = ngx_sock_ntop(addr.sockaddr, addr.socklen, name,
+                                      NGX_SOCKADDR_STRLEN, 1);
+    template.server = value;
+
+    template.weight = (cp->weight != NGX_CONF_UNSET) ? cp->weight : 1;
+    template.effective_weight = template.weight;
+    template.max_conns = (cp->max_conns != NGX_CONF_UNSET) ? cp->max_conns : 0;
+    template.max_fails = (cp->max_fails != NGX_CONF_UNSET) ? cp->max_fails : 1;
+    template.fail_timeout = (cp->fail_timeout != NGX_CONF_UNSET)
+                            ? cp->fail_timeout : 10;
+
+    if (cp->down == 1) {
+        template.down = NGX_HTTP_UPSTREAM_RR_PEER_DOWN;
+    }
+
+    if (cp->drain) {
+        template.down |= NGX_HTTP_UPSTREAM_RR_PEER_DRAIN;
+    }
+
+    shpool = peers->shpool;
+
+    ngx_http_upstream_rr_peers_wlock(primary);
+
+    if (peers != primary) {
+        ngx_http_upstream_rr_peers_wlock(peers);
+    }
+
+    for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
+        peer = *peerp;
+
+        if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                             template.sockaddr, template.socklen, 1)
+            == NGX_OK)
+        {
+            ngx_str_set(err, "server already exists");
+            rc = NGX_HTTP_CONFLICT;
+            goto done;
+        }
+    }
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    ngx_http_upstream_zone_free_zombies(peers);
+
+    peer = ngx_http_upstream_zone_copy_peer(peers, &template);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    if (peer == NULL) {
+        ngx_str_set(err, "no memory in upstream zone");
+        rc = NGX_HTTP_INSUFFICIENT_STORAGE;
+        goto done;
+    }
+
+    peer->id = primary->next_id++;
+
+    *peerp = peer;
+
+    ngx_http_upstream_zone_update_peers(peers);
+
+    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                  "upstream \"%V\": server %V added with id %ui",
+                  peers->name, &peer->name, peer->id);
+
+    rc = NGX_OK;
+
+done:
+
+    if (peers != primary) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(primary);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_edit(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_conf_params_t *cp,
+    ngx_uint_t id, ngx_str_t *err)
+{
+    ngx_int_t                      rc;
+    ngx_str_t                      value;
+    ngx_uint_t                     remove;
+    ngx_slab_pool_t               *shpool;
+    ngx_http_upstream_rr_peer_t   *peer, **peerp;
+    ngx_http_upstream_rr_peers_t  *primary, *peers;
+
+    remove = (ngx_http_arg(r, (u_char *) "remove", 6, &value) == NGX_OK);
+
+    primary = uscf->peer.data;
+    shpool = primary->shpool;
+
+    ngx_http_upstream_rr_peers_wlock(primary);
+
+    if (primary->next) {
+        ngx_http_upstream_rr_peers_wlock(primary->next);
+    }
+
+    for (peers = primary; peers; peers = peers->next) {
+        for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
+            peer = *peerp;
+
+            if (peer->id == id) {
+                goto found;
+            }
+        }
+    }
+
+    ngx_str_set(err, "server not found");
+    rc = NGX_HTTP_NOT_FOUND;
+    goto done;
+
+found:
+
+    if (remove) {
+
+        if (peer->host) {
+            ngx_str_set(err, "server is resolved at run time");
+            rc = NGX_HTTP_BAD_REQUEST;
+            goto done;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                      "upstream \"%V\": server %V with id %ui removed",
+                      peers->name, &peer->name, peer->id);
+
+        /* removed peers wait for their connections to be closed */
+
+        *peerp = peer->next;
+
+        ngx_shmtx_lock(&shpool->mutex);
+
+        peer->next = peers->zombies;
+        peers->zombies = peer;
+
+        ngx_http_upstream_zone_free_zombies(peers);
+
+        ngx_shmtx_unlock(&shpool->mutex);
+
+        ngx_http_upstream_zone_update_peers(peers);
+
+        rc = NGX_OK;
+        goto done;
+    }
+
+    if (cp->max_conns != NGX_CONF_UNSET) {
+        peer->max_conns = cp->max_conns;
+    }
+
+    if (cp->max_fails != NGX_CONF_UNSET) {
+        peer->max_fails = cp->max_fails;
+    }
+
+    if (cp->fail_timeout != NGX_CONF_UNSET) {
+        peer->fail_timeout = cp->fail_timeout;
+    }
+
+    if (cp->down == 1) {
+        peer->down |= NGX_HTTP_UPSTREAM_RR_PEER_DOWN;
+
+    } else if (cp->down == 0) {
+
+        if ((peer->down & NGX_HTTP_UPSTREAM_RR_PEER_DOWN) && peer->slow_start) {
+            peer->start_time = ngx_current_msec;
+        }
+
+        peer->down &= ~(NGX_HTTP_UPSTREAM_RR_PEER_DOWN
+                        |NGX_HTTP_UPSTREAM_RR_PEER_DRAIN);
+    }
+
+    if (cp->drain) {
+        peer->down |= NGX_HTTP_UPSTREAM_RR_PEER_DRAIN;
+    }
+
+    if (cp->weight != NGX_CONF_UNSET && cp->weight != peer->weight) {
+        peer->weight = cp->weight;
+        peer->effective_weight = cp->weight;
+        peer->current_weight = 0;
+
+        /* hash points and random ranges depend on weights */
+
+        ngx_http_upstream_zone_update_peers(peers);
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                  "upstream \"%V\": server %V with id %ui updated",
+                  peers->name, &peer->name, peer->id);
+
+    rc = NGX_OK;
+
+done:
+
+    if (primary->next) {
+        ngx_http_upstream_rr_peers_unlock(primary->next);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(primary);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_list(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf)
+{
+    char                          *state;
+    size_t                         size;
+    ngx_buf_t                     *b;
+    ngx_uint_t                     n;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *primary, *peers;
+
+    primary = uscf->peer.data;
+
+    /* backup peers are only changed under the lock of primary peers */
+
+    ngx_http_upstream_rr_peers_rlock(primary);
+
+    size = sizeof("{\"upstream\":\"\",\"peers\":[]}" CRLF) + primary->name->len;
+
+    for (peers = primary; peers; peers = peers->next) {
+        for (peer = peers->peer; peer; peer = peer->next) {
+            size += sizeof(",{\"id\":,\"server\":\"\",\"name\":\"\","
+                           "\"weight\":,\"max_conns\":,\"max_fails\":,"
+                           "\"fail_timeout\":,\"backup\":false,"
+                           "\"state\":\"unhealthy\",\"conns\":}")
+                    + peer->server.len + peer->name.len
+                    + 5 * NGX_INT_T_LEN + NGX_TIME_T_LEN;
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        ngx_http_upstream_rr_peers_unlock(primary);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->last, "{\"upstream\":\"%V\",\"peers\":[",
+                          primary->name);
+
+    n = 0;
+
+    for (peers = primary; peers; peers = peers->next) {
+        for (peer = peers->peer; peer; peer = peer->next) {
+
+            if (peer->down & NGX_HTTP_UPSTREAM_RR_PEER_DOWN) {
+                state = "down";
+
+            } else if (peer->down & NGX_HTTP_UPSTREAM_RR_PEER_DRAIN) {
+                state = "draining";
+
+            } else if (peer->down & NGX_HTTP_UPSTREAM_RR_PEER_UNHEALTHY) {
+                state = "unhealthy";
+
+            } else {
+                state = "up";
+            }
+
+            b->last = ngx_sprintf(b->last,
+                                  "%s{\"id\":%ui,\"server\":\"%V\","
+                                  "\"name\":\"%V\",\"weight\":%i,"
+                                  "\"max_conns\":%ui,\"max_fails\":%ui,"
+                                  "\"fail_timeout\":%T,\"backup\":%s,"
+                                  "\"state\":\"%s\",\"conns\":%ui}",
+                                  n++ ? "," : "",
+                                  peer->id, &peer->server, &peer->name,
+                                  peer->weight, peer->max_conns,
+                                  peer->max_fails, peer->fail_timeout,
+                                  peers == primary ? "false" : "true",
+                                  state, peer->conns);
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(primary);
+
+    b->last = ngx_sprintf(b->last, "]}" CRLF);
+
+    return ngx_http_upstream_conf_send(r, NGX_HTTP_OK, b, 1);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_send(ngx_http_request_t *r, ngx_uint_t status,
+    ngx_buf_t *b, ngx_uint_t json)
+{
+    ngx_int_t    rc;
+    ngx_chain_t  out;
+
+    if (json) {
+        ngx_str_set(&r->headers_out.content_type, "application/json");
+
+    } else {
+        ngx_str_set(&r->headers_out.content_type, "text/plain");
+    }
+
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    r->headers_out.status = status;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
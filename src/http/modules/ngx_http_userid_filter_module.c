@@ -32,6 +32,9 @@ typedef struct {
     time_t      expires;
 
     u_char      mark;
+
+    /* the longest "Set-Cookie" value */
+    size_t      cookie_len;
 } ngx_http_userid_conf_t;
 
 
@@ -40,6 +43,9 @@ typedef struct {
     uint32_t    uid_set[4];
     ngx_str_t   cookie;
     ngx_uint_t  reset;
+
+    /* the space for "Set-Cookie" allocated with the context */
+    size_t      size;
 } ngx_http_userid_ctx_t;
 
 
@@ -51,6 +57,7 @@ static ngx_int_t ngx_http_userid_set_uid(ngx_http_request_t *r,
     ngx_http_userid_ctx_t *ctx, ngx_http_userid_conf_t *conf);
 static ngx_int_t ngx_http_userid_create_uid(ngx_http_request_t *r,
     ngx_http_userid_ctx_t *ctx, ngx_http_userid_conf_t *conf);
+static u_char *ngx_http_userid_cookie_time(u_char *p, time_t t);
 
 static ngx_int_t ngx_http_userid_add_variables(ngx_conf_t *cf);
 static ngx_int_t ngx_http_userid_init(ngx_conf_t *cf);
@@ -75,6 +82,12 @@ static uint32_t  sequencer_v2 = 0x03030302;
 
 static u_char expires[] = "; expires=Thu, 31-Dec-37 23:55:55 GMT";
 
+/* the expiry time formatted last, the same for a second */
+
+static time_t  ngx_http_userid_date_time;
+static size_t  ngx_http_userid_date_len;
+static u_char  ngx_http_userid_date[sizeof("Thu, 31-Dec-2037 23:55:55 GMT")];
+
 
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 
@@ -289,6 +302,7 @@ ngx_http_userid_set_variable(ngx_http_request_t *r,
 static ngx_http_userid_ctx_t *
 ngx_http_userid_get_uid(ngx_http_request_t *r, ngx_http_userid_conf_t *conf)
 {
+    size_t                   size;
     ngx_int_t                n;
     ngx_str_t                src, dst;
     ngx_table_elt_t        **cookies;
@@ -301,11 +315,16 @@ ngx_http_userid_get_uid(ngx_http_request_t *r, ngx_http_userid_conf_t *conf)
     }
 
     if (ctx == NULL) {
-        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_userid_ctx_t));
+        size = (conf->enable >= NGX_HTTP_USERID_V1) ? conf->cookie_len : 0;
+
+        ctx = ngx_palloc(r->pool, sizeof(ngx_http_userid_ctx_t) + size);
         if (ctx == NULL) {
             return NULL;
         }
 
+        ngx_memzero(ctx, sizeof(ngx_http_userid_ctx_t));
+        ctx->size = size;
+
         ngx_http_set_ctx(r, ctx, ngx_http_userid_filter_module);
     }
 
@@ -373,19 +392,19 @@ ngx_http_userid_set_uid(ngx_http_request_t *r, ngx_http_userid_ctx_t *ctx,
         return NGX_OK;
     }
 
-    len = conf->name.len + 1 + ngx_base64_encoded_length(16) + conf->path.len;
+    len = conf->cookie_len;
 
-    if (conf->expires) {
-        len += sizeof(expires) - 1 + 2;
-    }
+    if (len <= ctx->size) {
+        cookie = (u_char *) (ctx + 1);
 
-    if (conf->domain.len) {
-        len += conf->domain.len;
-    }
+    } else {
 
-    cookie = ngx_pnalloc(r->pool, len);
-    if (cookie == NULL) {
-        return NGX_ERROR;
+        /* the context was created with another location's configuration */
+
+        cookie = ngx_pnalloc(r->pool, len);
+        if (cookie == NULL) {
+            return NGX_ERROR;
+        }
     }
 
     p = ngx_copy(cookie, conf->name.data, conf->name.len);
@@ -415,7 +434,7 @@ ngx_http_userid_set_uid(ngx_http_request_t *r, ngx_http_userid_ctx_t *ctx,
 
     } else if (conf->expires) {
         p = ngx_cpymem(p, expires, sizeof("; expires=") - 1);
-        p = ngx_http_cookie_time(p, ngx_time() + conf->expires);
+        p = ngx_http_userid_cookie_time(p, ngx_time() + conf->expires);
     }
 
     p = ngx_copy(p, conf->domain.data, conf->domain.len);
@@ -452,6 +471,19 @@ ngx_http_userid_set_uid(ngx_http_request_t *r, ngx_http_userid_ctx_t *ctx,
 }
 
 
+static u_char *
+ngx_http_userid_cookie_time(u_char *p, time_t t)
+{
+    if (t != ngx_http_userid_date_time || ngx_http_userid_date_len == 0) {
+        ngx_http_userid_date_len = ngx_http_cookie_time(ngx_http_userid_date, t)
+                                   - ngx_http_userid_date;
+        ngx_http_userid_date_time = t;
+    }
+
+    return ngx_cpymem(p, ngx_http_userid_date, ngx_http_userid_date_len);
+}
+
+
 static ngx_int_t
 ngx_http_userid_create_uid(ngx_http_request_t *r, ngx_http_userid_ctx_t *ctx,
     ngx_http_userid_conf_t *conf)
@@ -662,6 +694,7 @@ ngx_http_userid_create_conf(ngx_conf_t *cf)
      *     conf->domain = { 0, NULL };
      *     conf->path = { 0, NULL };
      *     conf->p3p = { 0, NULL };
+     *     conf->cookie_len = 0;
      */
 
     conf->enable = NGX_CONF_UNSET_UINT;
@@ -698,6 +731,13 @@ ngx_http_userid_merge_conf(ngx_conf_t *cf, void *parent, void *child)
         }
     }
 
+    conf->cookie_len = conf->name.len + 1 + ngx_base64_encoded_length(16)
+                       + conf->domain.len + conf->path.len;
+
+    if (conf->expires) {
+        conf->cookie_len += sizeof(expires) - 1 + 2;
+    }
+
     return NGX_CONF_OK;
 }
 
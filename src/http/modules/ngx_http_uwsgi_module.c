@@ -830,20 +830,22 @@ ngx_http_uwsgi_create_key(ngx_http_request_t *r)
 static ngx_int_t
 ngx_http_uwsgi_create_request(ngx_http_request_t *r)
 {
-    u_char                        ch, *lowcase_key;
-    size_t                        key_len, val_len, len, allocated;
-    ngx_uint_t                    i, n, hash, skip_empty, header_params;
-    ngx_buf_t                    *b;
-    ngx_chain_t                  *cl, *body;
-    ngx_list_part_t              *part;
-    ngx_table_elt_t              *header, **ignored;
-    ngx_http_uwsgi_params_t      *params;
-    ngx_http_script_code_pt       code;
-    ngx_http_script_engine_t      e, le;
-    ngx_http_uwsgi_loc_conf_t    *uwcf;
-    ngx_http_script_len_code_pt   lcode;
+    u_char                          ch, *lowcase_key;
+    size_t                          key_len, val_len, len, refs, allocated;
+    ngx_uint_t                      i, n, hash, skip_empty, header_params;
+    ngx_buf_t                      *b;
+    ngx_chain_t                    *cl, *body;
+    ngx_list_part_t                *part;
+    ngx_table_elt_t                *header, **ignored;
+    ngx_http_uwsgi_params_t        *params;
+    ngx_http_script_code_pt         code;
+    ngx_http_script_engine_t        e, le;
+    ngx_http_uwsgi_loc_conf_t      *uwcf;
+    ngx_http_script_len_code_pt     lcode;
+    ngx_http_upstream_serializer_t  s;
 
     len = 0;
+    refs = 0;
     header_params = 0;
     ignored = NULL;
 
@@ -953,11 +955,19 @@ ngx_http_uwsgi_create_request(ngx_http_request_t *r)
 
             len += 2 + sizeof("HTTP_") - 1 + header[i].key.len
                  + 2 + header[i].value.len;
+
+            if (header[i].value.len >= NGX_HTTP_UPSTREAM_REF_SIZE) {
+                refs += header[i].value.len;
+            }
         }
     }
 
     len += uwcf->uwsgi_string.len;
 
+    if (uwcf->uwsgi_string.len >= NGX_HTTP_UPSTREAM_REF_SIZE) {
+        refs += uwcf->uwsgi_string.len;
+    }
+
 #if 0
     /* allow custom uwsgi packet */
     if (len > 0 && len < 2) {
@@ -973,17 +983,13 @@ ngx_http_uwsgi_create_request(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    b = ngx_create_temp_buf(r->pool, len + 4);
-    if (b == NULL) {
-        return NGX_ERROR;
-    }
-
-    cl = ngx_alloc_chain_link(r->pool);
-    if (cl == NULL) {
+    if (ngx_http_upstream_serializer_init(&s, r->pool, len + 4 - refs)
+        != NGX_OK)
+    {
         return NGX_ERROR;
     }
 
-    cl->buf = b;
+    b = s.buf;
 
     *b->last++ = (u_char) uwcf->modifier1;
     *b->last++ = (u_char) (len & 0xff);
@@ -1096,27 +1102,44 @@ ngx_http_uwsgi_create_request(ngx_http_request_t *r)
             val_len = header[i].value.len;
             *b->last++ = (u_char) (val_len & 0xff);
             *b->last++ = (u_char) ((val_len >> 8) & 0xff);
-            b->last = ngx_copy(b->last, header[i].value.data, val_len);
 
             ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "uwsgi param: \"%*s: %*s\"",
-                           key_len, b->last - (key_len + 2 + val_len),
-                           val_len, b->last - val_len);
+                           key_len, b->last - (key_len + 2),
+                           val_len, header[i].value.data);
+
+            if (ngx_http_upstream_serializer_add(&s, header[i].value.data,
+                                                 val_len)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            b = s.buf;
+
         next:
 
             continue;
         }
     }
 
-    b->last = ngx_copy(b->last, uwcf->uwsgi_string.data,
-                       uwcf->uwsgi_string.len);
+    if (ngx_http_upstream_serializer_add(&s, uwcf->uwsgi_string.data,
+                                         uwcf->uwsgi_string.len)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_http_upstream_serializer_finish(&s);
+
+    cl = s.last;
 
     if (r->request_body_no_buffering) {
-        r->upstream->request_bufs = cl;
+        r->upstream->request_bufs = s.out;
 
     } else if (uwcf->upstream.pass_request_body) {
         body = r->upstream->request_bufs;
-        r->upstream->request_bufs = cl;
+        r->upstream->request_bufs = s.out;
 
         while (body) {
             b = ngx_alloc_buf(r->pool);
@@ -1138,7 +1161,7 @@ ngx_http_uwsgi_create_request(ngx_http_request_t *r)
         }
 
     } else {
-        r->upstream->request_bufs = cl;
+        r->upstream->request_bufs = s.out;
     }
 
     cl->next = NULL;
@@ -8,6 +8,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -27,12 +28,61 @@
 #endif
 
 
+#define NGX_HTTP_XSLT_BUFFERED  0x08
+
+
 typedef struct {
     u_char                    *name;
     void                      *data;
 } ngx_http_xslt_file_t;
 
 
+/*
+ * compiled stylesheets outlive configuration cycles and are reused
+ * on reload while none of their files have changed
+ */
+
+typedef struct ngx_http_xslt_compiled_s  ngx_http_xslt_compiled_t;
+
+struct ngx_http_xslt_compiled_s {
+    ngx_http_xslt_compiled_t  *next;
+    xsltStylesheetPtr          stylesheet;
+    uint32_t                   signature;
+    ngx_uint_t                 valid;        /* unsigned  valid:1; */
+    ngx_uint_t                 count;
+    u_char                     name[1];
+};
+
+
+typedef struct {
+    ngx_rbtree_node_t          node;
+    ngx_queue_t                queue;
+
+    u_char                     key[NGX_HTTP_CACHE_KEY_LEN];
+
+    size_t                     len;
+    u_char                    *data;
+
+    u_char                    *type;
+    u_char                    *encoding;
+
+    unsigned                   count:24;
+    unsigned                   close:1;
+    unsigned                   html:1;
+} ngx_http_xslt_cached_t;
+
+
+typedef struct {
+    ngx_rbtree_t               rbtree;
+    ngx_rbtree_node_t          sentinel;
+    ngx_queue_t                queue;
+
+    ngx_uint_t                 current;
+    ngx_uint_t                 max;
+    size_t                     max_length;
+} ngx_http_xslt_cache_t;
+
+
 typedef struct {
     ngx_array_t                dtd_files;    /* ngx_http_xslt_file_t */
     ngx_array_t                sheet_files;  /* ngx_http_xslt_file_t */
@@ -42,6 +92,7 @@ typedef struct {
 typedef struct {
     u_char                    *name;
     ngx_http_complex_value_t   value;
+    ngx_array_t               *parsed;       /* split constant value */
     ngx_uint_t                 quote;        /* unsigned  quote:1; */
 } ngx_http_xslt_param_t;
 
@@ -59,17 +110,44 @@ typedef struct {
     ngx_array_t               *types_keys;
     ngx_array_t               *params;       /* ngx_http_xslt_param_t */
     ngx_flag_t                 last_modified;
+    ngx_http_xslt_cache_t     *cache;
+#if (NGX_THREADS)
+    ngx_thread_pool_t         *thread_pool;
+    size_t                     thread_min_length;
+#endif
 } ngx_http_xslt_filter_loc_conf_t;
 
 
 typedef struct {
     xmlDocPtr                  doc;
     xmlParserCtxtPtr           ctxt;
-    xsltTransformContextPtr    transform;
     ngx_http_request_t        *request;
-    ngx_array_t                params;
 
-    ngx_uint_t                 done;         /* unsigned  done:1; */
+    /* the parameters of each stylesheet */
+    ngx_array_t               *sheets;
+    u_char                  ***params;
+    u_char                  ***quoted;
+
+    /* the result of the transformation */
+    xmlChar                   *buf;
+    int                        len;
+    int                        doc_type;
+    char                      *error;
+
+    size_t                     size;
+    ngx_md5_t                  md5;
+    u_char                     key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_http_xslt_cached_t    *cached;
+
+#if (NGX_THREADS)
+    ngx_thread_task_t         *thread_task;
+#endif
+
+    unsigned                   done:1;
+    unsigned                   hash:1;
+    unsigned                   store:1;
+    unsigned                   threaded:1;
+    unsigned                   transformed:1;
 } ngx_http_xslt_filter_ctx_t;
 
 
@@ -84,20 +162,61 @@ static void ngx_http_xslt_sax_external_subset(void *data, const xmlChar *name,
 static void ngx_cdecl ngx_http_xslt_sax_error(void *data, const char *msg, ...);
 
 
-static ngx_buf_t *ngx_http_xslt_apply_stylesheet(ngx_http_request_t *r,
+static ngx_int_t ngx_http_xslt_apply_stylesheet(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx);
+static ngx_int_t ngx_http_xslt_prepare(ngx_http_request_t *r,
     ngx_http_xslt_filter_ctx_t *ctx);
+static void ngx_http_xslt_transform(ngx_http_xslt_filter_ctx_t *ctx);
+static ngx_buf_t *ngx_http_xslt_output(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx);
+static ngx_buf_t *ngx_http_xslt_buffer(ngx_http_request_t *r, u_char *data,
+    size_t len, u_char *type, u_char *encoding, ngx_uint_t html);
 static ngx_int_t ngx_http_xslt_params(ngx_http_request_t *r,
-    ngx_http_xslt_filter_ctx_t *ctx, ngx_array_t *params, ngx_uint_t final);
+    ngx_array_t *params, ngx_array_t *quoted, ngx_array_t *conf);
+static ngx_int_t ngx_http_xslt_split_params(u_char *p, ngx_array_t *params,
+    ngx_log_t *log);
 static u_char *ngx_http_xslt_content_type(xsltStylesheetPtr s);
 static u_char *ngx_http_xslt_encoding(xsltStylesheetPtr s);
 static void ngx_http_xslt_cleanup(void *data);
 
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_xslt_thread_post(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, ngx_thread_pool_t *tp);
+static void ngx_http_xslt_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_xslt_thread_event_handler(ngx_event_t *ev);
+#endif
+
+static void ngx_http_xslt_cache_key(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, ngx_md5_t *md5);
+static ngx_int_t ngx_http_xslt_cache_lookup(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, ngx_http_xslt_cache_t *cache);
+static ngx_int_t ngx_http_xslt_cache_get(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, ngx_http_xslt_cache_t *cache);
+static ngx_http_xslt_cached_t *ngx_http_xslt_cache_find(
+    ngx_http_xslt_cache_t *cache, u_char *key);
+static ngx_int_t ngx_http_xslt_cache_send(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, ngx_chain_t *in);
+static void ngx_http_xslt_cache_insert(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, u_char *type, u_char *encoding);
+static void ngx_http_xslt_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static void ngx_http_xslt_cache_cleanup(void *data);
+static void ngx_http_xslt_cache_free(void *data);
+
+static ngx_http_xslt_compiled_t *ngx_http_xslt_compile(ngx_conf_t *cf,
+    u_char *name);
+static ngx_int_t ngx_http_xslt_signature(xsltStylesheetPtr s, uint32_t *crc);
+
 static char *ngx_http_xslt_entities(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_xslt_stylesheet(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_xslt_param(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_xslt_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_xslt_threads(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static void ngx_http_xslt_cleanup_dtd(void *data);
 static void ngx_http_xslt_cleanup_stylesheet(void *data);
 static void *ngx_http_xslt_filter_create_main_conf(ngx_conf_t *cf);
@@ -159,6 +278,20 @@ static ngx_command_t  ngx_http_xslt_filter_commands[] = {
       offsetof(ngx_http_xslt_filter_loc_conf_t, last_modified),
       NULL },
 
+    { ngx_string("xslt_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_xslt_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("xslt_threads"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_xslt_threads,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -197,10 +330,14 @@ ngx_module_t  ngx_http_xslt_filter_module = {
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 
+static ngx_http_xslt_compiled_t         *ngx_http_xslt_compiled;
+
 
 static ngx_int_t
 ngx_http_xslt_header_filter(ngx_http_request_t *r)
 {
+    ngx_int_t                         rc;
+    ngx_pool_cleanup_t               *cln;
     ngx_http_xslt_filter_ctx_t       *ctx;
     ngx_http_xslt_filter_loc_conf_t  *conf;
 
@@ -230,8 +367,29 @@ ngx_http_xslt_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_xslt_cleanup;
+    cln->data = ctx;
+
     ngx_http_set_ctx(r, ctx, ngx_http_xslt_filter_module);
 
+    if (conf->cache) {
+        rc = ngx_http_xslt_cache_lookup(r, ctx, conf->cache);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_OK) {
+            /* the document is not parsed, see ngx_http_xslt_cache_send() */
+            return NGX_OK;
+        }
+    }
+
     r->main_filter_need_in_memory = 1;
 
     return NGX_OK;
@@ -241,37 +399,59 @@ ngx_http_xslt_header_filter(ngx_http_request_t *r)
 static ngx_int_t
 ngx_http_xslt_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
-    int                          wellFormed;
-    ngx_chain_t                 *cl;
-    ngx_http_xslt_filter_ctx_t  *ctx;
+    int                               wellFormed;
+    size_t                            size;
+    ngx_chain_t                      *cl;
+    ngx_http_xslt_filter_ctx_t       *ctx;
+    ngx_http_xslt_filter_loc_conf_t  *conf;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "xslt filter body");
 
-    if (in == NULL) {
+    ctx = ngx_http_get_module_ctx(r, ngx_http_xslt_filter_module);
+
+    if (ctx == NULL || ctx->done) {
         return ngx_http_next_body_filter(r, in);
     }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_xslt_filter_module);
+#if (NGX_THREADS)
 
-    if (ctx == NULL || ctx->done) {
+    if (ctx->threaded) {
+        return NGX_AGAIN;
+    }
+
+    if (ctx->transformed) {
+        r->buffered &= ~NGX_HTTP_XSLT_BUFFERED;
+        return ngx_http_xslt_send(r, ctx, ngx_http_xslt_output(r, ctx));
+    }
+
+#endif
+
+    if (in == NULL) {
         return ngx_http_next_body_filter(r, in);
     }
 
+    if (ctx->cached) {
+        return ngx_http_xslt_cache_send(r, ctx, in);
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_xslt_filter_module);
+
     for (cl = in; cl; cl = cl->next) {
 
-        if (ngx_http_xslt_add_chunk(r, ctx, cl->buf) != NGX_OK) {
+        size = cl->buf->last - cl->buf->pos;
+        ctx->size += size;
 
-            if (ctx->ctxt->myDoc) {
+        if (ctx->hash) {
+            if (ctx->size > conf->cache->max_length) {
+                ctx->hash = 0;
 
-#if (NGX_HTTP_XSLT_REUSE_DTD)
-                ctx->ctxt->myDoc->extSubset = NULL;
-#endif
-                xmlFreeDoc(ctx->ctxt->myDoc);
+            } else {
+                ngx_md5_update(&ctx->md5, cl->buf->pos, size);
             }
+        }
 
-            xmlFreeParserCtxt(ctx->ctxt);
-
+        if (ngx_http_xslt_add_chunk(r, ctx, cl->buf) != NGX_OK) {
             return ngx_http_xslt_send(r, ctx, NULL);
         }
 
@@ -286,14 +466,12 @@ ngx_http_xslt_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             wellFormed = ctx->ctxt->wellFormed;
 
             xmlFreeParserCtxt(ctx->ctxt);
+            ctx->ctxt = NULL;
 
             if (wellFormed) {
-                return ngx_http_xslt_send(r, ctx,
-                                       ngx_http_xslt_apply_stylesheet(r, ctx));
+                return ngx_http_xslt_apply_stylesheet(r, ctx);
             }
 
-            xmlFreeDoc(ctx->doc);
-
             ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
                           "not well formed XML document");
 
@@ -311,7 +489,6 @@ ngx_http_xslt_send(ngx_http_request_t *r, ngx_http_xslt_filter_ctx_t *ctx,
 {
     ngx_int_t                         rc;
     ngx_chain_t                       out;
-    ngx_pool_cleanup_t               *cln;
     ngx_http_xslt_filter_loc_conf_t  *conf;
 
     ctx->done = 1;
@@ -321,14 +498,6 @@ ngx_http_xslt_send(ngx_http_request_t *r, ngx_http_xslt_filter_ctx_t *ctx,
                                                NGX_HTTP_INTERNAL_SERVER_ERROR);
     }
 
-    cln = ngx_pool_cleanup_add(r->pool, 0);
-
-    if (cln == NULL) {
-        ngx_free(b->pos);
-        return ngx_http_filter_finalize_request(r, &ngx_http_xslt_filter_module,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-    }
-
     if (r == r->main) {
         r->headers_out.content_length_n = b->last - b->pos;
 
@@ -351,13 +520,9 @@ ngx_http_xslt_send(ngx_http_request_t *r, ngx_http_xslt_filter_ctx_t *ctx,
     rc = ngx_http_next_header_filter(r);
 
     if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        ngx_free(b->pos);
         return rc;
     }
 
-    cln->handler = ngx_http_xslt_cleanup;
-    cln->data = b->pos;
-
     out.buf = b;
     out.next = NULL;
 
@@ -484,114 +649,251 @@ ngx_http_xslt_sax_error(void *data, const char *msg, ...)
 }
 
 
-static ngx_buf_t *
+static ngx_int_t
 ngx_http_xslt_apply_stylesheet(ngx_http_request_t *r,
     ngx_http_xslt_filter_ctx_t *ctx)
 {
-    int                               len, rc, doc_type;
-    u_char                           *type, *encoding;
-    ngx_buf_t                        *b;
-    ngx_uint_t                        i;
-    xmlChar                          *buf;
-    xmlDocPtr                         doc, res;
+    ngx_int_t                         rc;
+    ngx_http_xslt_cached_t           *xc;
+    ngx_http_xslt_filter_loc_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_xslt_filter_module);
+
+    if (ctx->params == NULL && ngx_http_xslt_prepare(r, ctx) != NGX_OK) {
+        return ngx_http_xslt_send(r, ctx, NULL);
+    }
+
+    if (ctx->hash) {
+        ngx_http_xslt_cache_key(r, ctx, &ctx->md5);
+
+        rc = ngx_http_xslt_cache_get(r, ctx, conf->cache);
+
+        if (rc == NGX_ERROR) {
+            return ngx_http_xslt_send(r, ctx, NULL);
+        }
+
+        if (rc == NGX_OK) {
+            xc = ctx->cached;
+
+            return ngx_http_xslt_send(r, ctx,
+                                      ngx_http_xslt_buffer(r, xc->data, xc->len,
+                                                           xc->type,
+                                                           xc->encoding,
+                                                           xc->html));
+        }
+    }
+
+#if (NGX_THREADS)
+
+    if (conf->thread_pool && ctx->size >= conf->thread_min_length) {
+        if (ngx_http_xslt_thread_post(r, ctx, conf->thread_pool) != NGX_OK) {
+            return ngx_http_xslt_send(r, ctx, NULL);
+        }
+
+        r->buffered |= NGX_HTTP_XSLT_BUFFERED;
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
+    ngx_http_xslt_transform(ctx);
+
+    return ngx_http_xslt_send(r, ctx, ngx_http_xslt_output(r, ctx));
+}
+
+
+static ngx_int_t
+ngx_http_xslt_prepare(ngx_http_request_t *r, ngx_http_xslt_filter_ctx_t *ctx)
+{
+    u_char                          **s;
+    ngx_uint_t                        i, n;
+    ngx_array_t                       params, quoted;
     ngx_http_xslt_sheet_t            *sheet;
     ngx_http_xslt_filter_loc_conf_t  *conf;
 
+    /*
+     * the parameters are evaluated here, so the stylesheets can be
+     * applied without access to the request, see ngx_http_xslt_transform()
+     */
+
     conf = ngx_http_get_module_loc_conf(r, ngx_http_xslt_filter_module);
-    sheet = conf->sheets.elts;
-    doc = ctx->doc;
 
-    /* preallocate array for 4 params */
+    sheet = conf->sheets.elts;
+    n = conf->sheets.nelts;
 
-    if (ngx_array_init(&ctx->params, r->pool, 4 * 2 + 1, sizeof(char *))
-        != NGX_OK)
-    {
-        xmlFreeDoc(doc);
-        return NULL;
+    ctx->params = ngx_palloc(r->pool, 2 * n * sizeof(u_char **));
+    if (ctx->params == NULL) {
+        return NGX_ERROR;
     }
 
-    for (i = 0; i < conf->sheets.nelts; i++) {
+    ctx->quoted = ctx->params + n;
+    ctx->sheets = &conf->sheets;
 
-        ctx->transform = xsltNewTransformContext(sheet[i].stylesheet, doc);
-        if (ctx->transform == NULL) {
-            xmlFreeDoc(doc);
-            return NULL;
+    for (i = 0; i < n; i++) {
+
+        /* preallocate array for 4 params */
+
+        if (ngx_array_init(&params, r->pool, 4 * 2 + 1, sizeof(u_char *))
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (ngx_array_init(&quoted, r->pool, 1, sizeof(u_char *)) != NGX_OK) {
+            return NGX_ERROR;
         }
 
         if (conf->params
-            && ngx_http_xslt_params(r, ctx, conf->params, 0) != NGX_OK)
+            && ngx_http_xslt_params(r, &params, &quoted, conf->params)
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_xslt_params(r, &params, &quoted, &sheet[i].params)
+            != NGX_OK)
         {
-            xsltFreeTransformContext(ctx->transform);
+            return NGX_ERROR;
+        }
+
+        s = ngx_array_push(&params);
+        if (s == NULL) {
+            return NGX_ERROR;
+        }
+
+        *s = NULL;
+
+        s = ngx_array_push(&quoted);
+        if (s == NULL) {
+            return NGX_ERROR;
+        }
+
+        *s = NULL;
+
+        ctx->params[i] = params.elts;
+        ctx->quoted[i] = quoted.elts;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_xslt_transform(ngx_http_xslt_filter_ctx_t *ctx)
+{
+    int                       rc;
+    ngx_uint_t                i;
+    xmlDocPtr                 doc, res;
+    ngx_http_xslt_sheet_t    *sheet;
+    xsltTransformContextPtr   transform;
+
+    /* may be called in a thread, the request is not used */
+
+    sheet = ctx->sheets->elts;
+
+    doc = ctx->doc;
+    ctx->doc = NULL;
+
+    for (i = 0; i < ctx->sheets->nelts; i++) {
+
+        transform = xsltNewTransformContext(sheet[i].stylesheet, doc);
+        if (transform == NULL) {
             xmlFreeDoc(doc);
-            return NULL;
+            ctx->error = "xsltNewTransformContext() failed";
+            return;
         }
 
-        if (ngx_http_xslt_params(r, ctx, &sheet[i].params, 1) != NGX_OK) {
-            xsltFreeTransformContext(ctx->transform);
+        if (ctx->quoted[i][0]
+            && xsltQuoteUserParams(transform, (const char **) ctx->quoted[i])
+               != 0)
+        {
+            xsltFreeTransformContext(transform);
             xmlFreeDoc(doc);
-            return NULL;
+            ctx->error = "xsltQuoteUserParams() failed";
+            return;
         }
 
         res = xsltApplyStylesheetUser(sheet[i].stylesheet, doc,
-                                      ctx->params.elts, NULL, NULL,
-                                      ctx->transform);
+                                      (const char **) ctx->params[i],
+                                      NULL, NULL, transform);
 
-        xsltFreeTransformContext(ctx->transform);
+        xsltFreeTransformContext(transform);
         xmlFreeDoc(doc);
 
         if (res == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "xsltApplyStylesheet() failed");
-            return NULL;
+            ctx->error = "xsltApplyStylesheet() failed";
+            return;
         }
 
         doc = res;
-
-        /* reset array elements */
-        ctx->params.nelts = 0;
     }
 
     /* there must be at least one stylesheet */
 
-    if (r == r->main) {
-        type = ngx_http_xslt_content_type(sheet[i - 1].stylesheet);
+    ctx->doc_type = doc->type;
 
-    } else {
-        type = NULL;
+    rc = xsltSaveResultToString(&ctx->buf, &ctx->len, doc,
+                                sheet[i - 1].stylesheet);
+
+    xmlFreeDoc(doc);
+
+    if (rc != 0) {
+        ctx->error = "xsltSaveResultToString() failed";
+        return;
+    }
+
+    if (ctx->len == 0) {
+        ctx->error = "xsltSaveResultToString() returned zero-length result";
+    }
+}
+
+
+static ngx_buf_t *
+ngx_http_xslt_output(ngx_http_request_t *r, ngx_http_xslt_filter_ctx_t *ctx)
+{
+    u_char                 *type, *encoding;
+    xsltStylesheetPtr       stylesheet;
+    ngx_http_xslt_sheet_t  *sheet;
+
+    if (ctx->error) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "%s", ctx->error);
+        return NULL;
     }
 
-    encoding = ngx_http_xslt_encoding(sheet[i - 1].stylesheet);
-    doc_type = doc->type;
+    sheet = ctx->sheets->elts;
+    stylesheet = sheet[ctx->sheets->nelts - 1].stylesheet;
+
+    type = ngx_http_xslt_content_type(stylesheet);
+    encoding = ngx_http_xslt_encoding(stylesheet);
 
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "xslt filter type: %d t:%s e:%s",
-                   doc_type, type ? type : (u_char *) "(null)",
+                   ctx->doc_type, type ? type : (u_char *) "(null)",
                    encoding ? encoding : (u_char *) "(null)");
 
-    rc = xsltSaveResultToString(&buf, &len, doc, sheet[i - 1].stylesheet);
+    if (ctx->store) {
+        ngx_http_xslt_cache_insert(r, ctx, type, encoding);
+    }
 
-    xmlFreeDoc(doc);
+    return ngx_http_xslt_buffer(r, ctx->buf, ctx->len, type, encoding,
+                                ctx->doc_type == XML_HTML_DOCUMENT_NODE);
+}
 
-    if (rc != 0) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                      "xsltSaveResultToString() failed");
-        return NULL;
-    }
 
-    if (len == 0) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                      "xsltSaveResultToString() returned zero-length result");
-        return NULL;
-    }
+static ngx_buf_t *
+ngx_http_xslt_buffer(ngx_http_request_t *r, u_char *data, size_t len,
+    u_char *type, u_char *encoding, ngx_uint_t html)
+{
+    ngx_buf_t  *b;
 
     b = ngx_calloc_buf(r->pool);
     if (b == NULL) {
-        ngx_free(buf);
         return NULL;
     }
 
-    b->pos = buf;
-    b->last = buf + len;
+    b->pos = data;
+    b->last = data + len;
     b->memory = 1;
 
     if (encoding) {
@@ -612,7 +914,7 @@ ngx_http_xslt_apply_stylesheet(ngx_http_request_t *r,
         r->headers_out.content_type.len = len;
         r->headers_out.content_type.data = type;
 
-    } else if (doc_type == XML_HTML_DOCUMENT_NODE) {
+    } else if (html) {
 
         r->headers_out.content_type_len = sizeof("text/html") - 1;
         ngx_str_set(&r->headers_out.content_type, "text/html");
@@ -625,18 +927,32 @@ ngx_http_xslt_apply_stylesheet(ngx_http_request_t *r,
 
 
 static ngx_int_t
-ngx_http_xslt_params(ngx_http_request_t *r, ngx_http_xslt_filter_ctx_t *ctx,
-    ngx_array_t *params, ngx_uint_t final)
+ngx_http_xslt_params(ngx_http_request_t *r, ngx_array_t *params,
+    ngx_array_t *quoted, ngx_array_t *conf)
 {
-    u_char                 *p, *value, *dst, *src, **s;
-    size_t                  len;
-    ngx_uint_t              i;
-    ngx_str_t               string;
-    ngx_http_xslt_param_t  *param;
+    u_char                 **s;
+    ngx_uint_t               i;
+    ngx_str_t                string;
+    ngx_http_xslt_param_t   *param;
+
+    param = conf->elts;
+
+    for (i = 0; i < conf->nelts; i++) {
 
-    param = params->elts;
+        if (param[i].parsed) {
 
-    for (i = 0; i < params->nelts; i++) {
+            /* constant parameters are split once, on configuration */
+
+            s = ngx_array_push_n(params, param[i].parsed->nelts);
+            if (s == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memcpy(s, param[i].parsed->elts,
+                       param[i].parsed->nelts * sizeof(u_char *));
+
+            continue;
+        }
 
         if (ngx_http_complex_value(r, &param[i].value, &string) != NGX_OK) {
             return NGX_ERROR;
@@ -650,115 +966,93 @@ ngx_http_xslt_params(ngx_http_request_t *r, ngx_http_xslt_filter_ctx_t *ctx,
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "xslt filter param name: \"%s\"", param[i].name);
 
-            if (param[i].quote) {
-                if (xsltQuoteOneUserParam(ctx->transform, param[i].name,
-                                          string.data)
-                    != 0)
-                {
-                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                                "xsltQuoteOneUserParam(\"%s\", \"%s\") failed",
-                                param[i].name, string.data);
-                    return NGX_ERROR;
-                }
-
-                continue;
-            }
-
-            s = ngx_array_push(&ctx->params);
-            if (s == NULL) {
-                return NGX_ERROR;
-            }
-
-            *s = param[i].name;
+            /* quoted parameters are set with xsltQuoteUserParams() */
 
-            s = ngx_array_push(&ctx->params);
+            s = ngx_array_push_n(param[i].quote ? quoted : params, 2);
             if (s == NULL) {
                 return NGX_ERROR;
             }
 
-            *s = string.data;
+            s[0] = param[i].name;
+            s[1] = string.data;
 
             continue;
         }
 
-        /*
-         * parse param1=value1:param2=value2 syntax as used by parameters
-         * specified in xslt_stylesheet directives
-         */
+        if (ngx_http_xslt_split_params(string.data, params,
+                                       r->connection->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
 
-        if (param[i].value.lengths) {
-            p = string.data;
+    return NGX_OK;
+}
 
-        } else {
-            p = ngx_pnalloc(r->pool, string.len + 1);
-            if (p == NULL) {
-                return NGX_ERROR;
-            }
 
-            ngx_memcpy(p, string.data, string.len + 1);
-        }
+static ngx_int_t
+ngx_http_xslt_split_params(u_char *p, ngx_array_t *params, ngx_log_t *log)
+{
+    u_char   *value, *dst, *src, **s;
+    size_t    len;
 
-        while (p && *p) {
+    /*
+     * parse param1=value1:param2=value2 syntax as used by parameters
+     * specified in xslt_stylesheet directives
+     */
 
-            value = p;
-            p = (u_char *) ngx_strchr(p, '=');
-            if (p == NULL) {
-                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                                "invalid libxslt parameter \"%s\"", value);
-                return NGX_ERROR;
-            }
-            *p++ = '\0';
+    while (p && *p) {
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "xslt filter param name: \"%s\"", value);
-
-            s = ngx_array_push(&ctx->params);
-            if (s == NULL) {
-                return NGX_ERROR;
-            }
+        value = p;
+        p = (u_char *) ngx_strchr(p, '=');
+        if (p == NULL) {
+            ngx_log_error(NGX_LOG_ERR, log, 0,
+                          "invalid libxslt parameter \"%s\"", value);
+            return NGX_ERROR;
+        }
+        *p++ = '\0';
 
-            *s = value;
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "xslt filter param name: \"%s\"", value);
 
-            value = p;
-            p = (u_char *) ngx_strchr(p, ':');
+        s = ngx_array_push(params);
+        if (s == NULL) {
+            return NGX_ERROR;
+        }
 
-            if (p) {
-                len = p - value;
-                *p++ = '\0';
+        *s = value;
 
-            } else {
-                len = ngx_strlen(value);
-            }
+        value = p;
+        p = (u_char *) ngx_strchr(p, ':');
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "xslt filter param value: \"%s\"", value);
+        if (p) {
+            len = p - value;
+            *p++ = '\0';
 
-            dst = value;
-            src = value;
+        } else {
+            len = ngx_strlen(value);
+        }
 
-            ngx_unescape_uri(&dst, &src, len, 0);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "xslt filter param value: \"%s\"", value);
 
-            *dst = '\0';
+        dst = value;
+        src = value;
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "xslt filter param unescaped: \"%s\"", value);
+        ngx_unescape_uri(&dst, &src, len, 0);
 
-            s = ngx_array_push(&ctx->params);
-            if (s == NULL) {
-                return NGX_ERROR;
-            }
+        *dst = '\0';
 
-            *s = value;
-        }
-    }
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "xslt filter param unescaped: \"%s\"", value);
 
-    if (final) {
-        s = ngx_array_push(&ctx->params);
+        s = ngx_array_push(params);
         if (s == NULL) {
             return NGX_ERROR;
         }
 
-        *s = NULL;
+        *s = value;
     }
 
     return NGX_OK;
@@ -812,7 +1106,463 @@ ngx_http_xslt_encoding(xsltStylesheetPtr s)
 static void
 ngx_http_xslt_cleanup(void *data)
 {
-    ngx_free(data);
+    ngx_http_xslt_filter_ctx_t *ctx = data;
+
+    if (ctx->ctxt) {
+        if (ctx->ctxt->myDoc) {
+
+#if (NGX_HTTP_XSLT_REUSE_DTD)
+            ctx->ctxt->myDoc->extSubset = NULL;
+#endif
+            xmlFreeDoc(ctx->ctxt->myDoc);
+        }
+
+        xmlFreeParserCtxt(ctx->ctxt);
+    }
+
+    if (ctx->doc) {
+        xmlFreeDoc(ctx->doc);
+    }
+
+    if (ctx->buf) {
+        ngx_free(ctx->buf);
+    }
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_xslt_thread_post(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, ngx_thread_pool_t *tp)
+{
+    ngx_thread_task_t  *task;
+
+    task = ctx->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(r->pool, 0);
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_http_xslt_thread_handler;
+
+        ctx->thread_task = task;
+    }
+
+    task->ctx = ctx;
+    task->event.data = r;
+    task->event.handler = ngx_http_xslt_thread_event_handler;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    ctx->threaded = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_xslt_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_xslt_filter_ctx_t *ctx = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "xslt transform thread");
+
+    ngx_http_xslt_transform(ctx);
+}
+
+
+static void
+ngx_http_xslt_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t            *c;
+    ngx_http_request_t          *r;
+    ngx_http_xslt_filter_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http xslt thread: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_xslt_filter_module);
+
+    ctx->threaded = 0;
+    ctx->transformed = 1;
+
+    if (r->done) {
+        c->write->handler(c->write);
+
+    } else {
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+#endif
+
+
+static void
+ngx_http_xslt_cache_key(ngx_http_request_t *r, ngx_http_xslt_filter_ctx_t *ctx,
+    ngx_md5_t *md5)
+{
+    size_t                            len;
+    u_char                          **s;
+    ngx_uint_t                        i;
+    ngx_http_xslt_filter_loc_conf_t  *conf;
+
+    /* the result depends on the stylesheets and their parameters as well */
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_xslt_filter_module);
+
+    ngx_md5_update(md5, &conf, sizeof(void *));
+
+    for (i = 0; i < conf->sheets.nelts; i++) {
+
+        for (s = ctx->params[i]; *s; s++) {
+            len = ngx_strlen(*s) + 1;
+            ngx_md5_update(md5, *s, len);
+        }
+
+        ngx_md5_update(md5, "", 1);
+
+        for (s = ctx->quoted[i]; *s; s++) {
+            len = ngx_strlen(*s) + 1;
+            ngx_md5_update(md5, *s, len);
+        }
+
+        ngx_md5_update(md5, "", 1);
+    }
+
+    ngx_md5_final(ctx->key, md5);
+}
+
+
+static ngx_int_t
+ngx_http_xslt_cache_lookup(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, ngx_http_xslt_cache_t *cache)
+{
+    ngx_md5_t         md5;
+    ngx_table_elt_t  *etag;
+
+    if (r->headers_out.content_length_n > (off_t) cache->max_length) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_xslt_prepare(r, ctx) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * a document with a strong entity tag is identified by the tag and
+     * the URI before it is read, any other document is identified by
+     * the digest of its contents after it is read
+     */
+
+    etag = r->headers_out.etag;
+
+    if (etag == NULL
+        || etag->hash == 0
+        || (etag->value.len > 2
+            && etag->value.data[0] == 'W'
+            && etag->value.data[1] == '/'))
+    {
+        ngx_md5_init(&ctx->md5);
+        ngx_md5_update(&ctx->md5, "B", 1);
+
+        ctx->hash = 1;
+
+        return NGX_DECLINED;
+    }
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, "E", 1);
+    ngx_md5_update(&md5, &etag->value.len, sizeof(size_t));
+    ngx_md5_update(&md5, etag->value.data, etag->value.len);
+    ngx_md5_update(&md5, &r->uri.len, sizeof(size_t));
+    ngx_md5_update(&md5, r->uri.data, r->uri.len);
+    ngx_md5_update(&md5, r->args.data, r->args.len);
+
+    ngx_http_xslt_cache_key(r, ctx, &md5);
+
+    return ngx_http_xslt_cache_get(r, ctx, cache);
+}
+
+
+static ngx_int_t
+ngx_http_xslt_cache_get(ngx_http_request_t *r, ngx_http_xslt_filter_ctx_t *ctx,
+    ngx_http_xslt_cache_t *cache)
+{
+    ngx_pool_cleanup_t      *cln;
+    ngx_http_xslt_cached_t  *xc;
+
+    xc = ngx_http_xslt_cache_find(cache, ctx->key);
+
+    if (xc == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "xslt cache miss");
+
+        ctx->store = 1;
+
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "xslt cache hit: %uz", xc->len);
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_xslt_cache_cleanup;
+    cln->data = xc;
+
+    xc->count++;
+
+    ngx_queue_remove(&xc->queue);
+    ngx_queue_insert_head(&cache->queue, &xc->queue);
+
+    ctx->cached = xc;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_xslt_cached_t *
+ngx_http_xslt_cache_find(ngx_http_xslt_cache_t *cache, u_char *key)
+{
+    ngx_int_t                rc;
+    ngx_rbtree_key_t         node_key;
+    ngx_rbtree_node_t       *node, *sentinel;
+    ngx_http_xslt_cached_t  *xc;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->rbtree.root;
+    sentinel = cache->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        xc = (ngx_http_xslt_cached_t *) node;
+
+        rc = ngx_memcmp(key, xc->key, NGX_HTTP_CACHE_KEY_LEN);
+
+        if (rc == 0) {
+            return xc;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_xslt_cache_send(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, ngx_chain_t *in)
+{
+    ngx_buf_t               *b;
+    ngx_uint_t               last;
+    ngx_http_xslt_cached_t  *xc;
+
+    /* the document is not needed, the cached result is sent instead */
+
+    last = 0;
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        b->pos = b->last;
+
+        if (b->in_file) {
+            b->file_pos = b->file_last;
+        }
+
+        if (b->last_buf || b->last_in_chain) {
+            last = 1;
+        }
+    }
+
+    if (!last) {
+        return NGX_OK;
+    }
+
+    xc = ctx->cached;
+
+    return ngx_http_xslt_send(r, ctx,
+                              ngx_http_xslt_buffer(r, xc->data, xc->len,
+                                                   xc->type, xc->encoding,
+                                                   xc->html));
+}
+
+
+static void
+ngx_http_xslt_cache_insert(ngx_http_request_t *r,
+    ngx_http_xslt_filter_ctx_t *ctx, u_char *type, u_char *encoding)
+{
+    ngx_queue_t                      *q;
+    ngx_http_xslt_cache_t            *cache;
+    ngx_http_xslt_cached_t           *xc;
+    ngx_http_xslt_filter_loc_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_xslt_filter_module);
+
+    cache = conf->cache;
+
+    if (ctx->size > cache->max_length) {
+        return;
+    }
+
+    if (ngx_http_xslt_cache_find(cache, ctx->key)) {
+
+        /* another request has already stored the same result */
+
+        return;
+    }
+
+    if (cache->current >= cache->max) {
+
+        /* remove the least recently used result */
+
+        q = ngx_queue_last(&cache->queue);
+        xc = ngx_queue_data(q, ngx_http_xslt_cached_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->rbtree, &xc->node);
+        cache->current--;
+
+        if (xc->count) {
+            xc->close = 1;
+
+        } else {
+            ngx_free(xc);
+        }
+    }
+
+    xc = ngx_alloc(sizeof(ngx_http_xslt_cached_t) + ctx->len,
+                   r->connection->log);
+    if (xc == NULL) {
+        return;
+    }
+
+    ngx_memcpy((u_char *) &xc->node.key, ctx->key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(xc->key, ctx->key, NGX_HTTP_CACHE_KEY_LEN);
+
+    xc->data = (u_char *) xc + sizeof(ngx_http_xslt_cached_t);
+    xc->len = ctx->len;
+    xc->type = type;
+    xc->encoding = encoding;
+    xc->count = 0;
+    xc->close = 0;
+    xc->html = (ctx->doc_type == XML_HTML_DOCUMENT_NODE);
+
+    ngx_memcpy(xc->data, ctx->buf, ctx->len);
+
+    ngx_rbtree_insert(&cache->rbtree, &xc->node);
+    ngx_queue_insert_head(&cache->queue, &xc->queue);
+    cache->current++;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "xslt cache store: %uz", xc->len);
+}
+
+
+static void
+ngx_http_xslt_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t       **p;
+    ngx_http_xslt_cached_t   *xc, *xct;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            xc = (ngx_http_xslt_cached_t *) node;
+            xct = (ngx_http_xslt_cached_t *) temp;
+
+            p = (ngx_memcmp(xc->key, xct->key, NGX_HTTP_CACHE_KEY_LEN) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static void
+ngx_http_xslt_cache_cleanup(void *data)
+{
+    ngx_http_xslt_cached_t *xc = data;
+
+    xc->count--;
+
+    if (xc->count == 0 && xc->close) {
+        ngx_free(xc);
+    }
+}
+
+
+static void
+ngx_http_xslt_cache_free(void *data)
+{
+    ngx_http_xslt_cache_t *cache = data;
+
+    ngx_queue_t             *q;
+    ngx_http_xslt_cached_t  *xc;
+
+    while (!ngx_queue_empty(&cache->queue)) {
+        q = ngx_queue_head(&cache->queue);
+        xc = ngx_queue_data(q, ngx_http_xslt_cached_t, queue);
+
+        ngx_queue_remove(q);
+
+        ngx_free(xc);
+    }
 }
 
 
@@ -876,12 +1626,13 @@ ngx_http_xslt_stylesheet(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_xslt_filter_loc_conf_t *xlcf = conf;
 
+    u_char                            *p;
     ngx_str_t                         *value;
     ngx_uint_t                         i, n;
-    ngx_pool_cleanup_t                *cln;
     ngx_http_xslt_file_t              *file;
     ngx_http_xslt_sheet_t             *sheet;
     ngx_http_xslt_param_t             *param;
+    ngx_http_xslt_compiled_t          *xc;
     ngx_http_compile_complex_value_t   ccv;
     ngx_http_xslt_filter_main_conf_t  *xmcf;
 
@@ -917,21 +1668,12 @@ ngx_http_xslt_stylesheet(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
-    cln = ngx_pool_cleanup_add(cf->pool, 0);
-    if (cln == NULL) {
+    xc = ngx_http_xslt_compile(cf, value[1].data);
+    if (xc == NULL) {
         return NGX_CONF_ERROR;
     }
 
-    sheet->stylesheet = xsltParseStylesheetFile(value[1].data);
-    if (sheet->stylesheet == NULL) {
-        ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
-                           "xsltParseStylesheetFile(\"%s\") failed",
-                           value[1].data);
-        return NGX_CONF_ERROR;
-    }
-
-    cln->handler = ngx_http_xslt_cleanup_stylesheet;
-    cln->data = sheet->stylesheet;
+    sheet->stylesheet = xc->stylesheet;
 
     file = ngx_array_push(&xmcf->sheet_files);
     if (file == NULL) {
@@ -974,12 +1716,176 @@ found:
         if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
             return NGX_CONF_ERROR;
         }
+
+        if (param->value.lengths) {
+            continue;
+        }
+
+        param->parsed = ngx_array_create(cf->pool, 4, sizeof(u_char *));
+        if (param->parsed == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        p = ngx_pnalloc(cf->pool, value[i].len + 1);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_cpystrn(p, value[i].data, value[i].len + 1);
+
+        if (ngx_http_xslt_split_params(p, param->parsed, cf->log) != NGX_OK) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameters \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
     }
 
     return NGX_CONF_OK;
 }
 
 
+static ngx_http_xslt_compiled_t *
+ngx_http_xslt_compile(ngx_conf_t *cf, u_char *name)
+{
+    size_t                     len;
+    uint32_t                   crc;
+    ngx_pool_cleanup_t        *cln;
+    xsltStylesheetPtr          stylesheet;
+    ngx_http_xslt_compiled_t  *xc;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    for (xc = ngx_http_xslt_compiled; xc; xc = xc->next) {
+
+        if (ngx_strcmp(xc->name, name) != 0) {
+            continue;
+        }
+
+        if (!xc->valid) {
+            break;
+        }
+
+        ngx_crc32_init(crc);
+
+        if (ngx_http_xslt_signature(xc->stylesheet, &crc) != NGX_OK) {
+            break;
+        }
+
+        ngx_crc32_final(crc);
+
+        if (crc != xc->signature) {
+            break;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                       "xslt stylesheet \"%s\" reused", name);
+
+        goto done;
+    }
+
+    stylesheet = xsltParseStylesheetFile(name);
+    if (stylesheet == NULL) {
+        ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                           "xsltParseStylesheetFile(\"%s\") failed", name);
+        return NULL;
+    }
+
+    len = ngx_strlen(name);
+
+    xc = ngx_alloc(sizeof(ngx_http_xslt_compiled_t) + len, cf->log);
+    if (xc == NULL) {
+        xsltFreeStylesheet(stylesheet);
+        return NULL;
+    }
+
+    ngx_memcpy(xc->name, name, len + 1);
+
+    xc->stylesheet = stylesheet;
+    xc->count = 0;
+
+    /*
+     * a stylesheet is not reused if the files it was compiled from
+     * cannot be checked for changes
+     */
+
+    ngx_crc32_init(crc);
+
+    xc->valid = (ngx_http_xslt_signature(stylesheet, &crc) == NGX_OK);
+
+    ngx_crc32_final(crc);
+
+    xc->signature = crc;
+
+    xc->next = ngx_http_xslt_compiled;
+    ngx_http_xslt_compiled = xc;
+
+done:
+
+    xc->count++;
+
+    cln->handler = ngx_http_xslt_cleanup_stylesheet;
+    cln->data = xc;
+
+    return xc;
+}
+
+
+static ngx_int_t
+ngx_http_xslt_signature(xsltStylesheetPtr s, uint32_t *crc)
+{
+    off_t             size;
+    time_t            mtime;
+    ngx_file_uniq_t   uniq;
+    xmlDocPtr         doc;
+    ngx_file_info_t   fi;
+    xsltDocumentPtr   included;
+
+    /* the stylesheet file, its included and imported files */
+
+    doc = s->doc;
+    included = s->docList;
+
+    for ( ;; ) {
+
+        if (doc == NULL || doc->URL == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_file_info(doc->URL, &fi) == NGX_FILE_ERROR) {
+            return NGX_ERROR;
+        }
+
+        mtime = ngx_file_mtime(&fi);
+        size = ngx_file_size(&fi);
+        uniq = ngx_file_uniq(&fi);
+
+        ngx_crc32_update(crc, (u_char *) doc->URL, ngx_strlen(doc->URL));
+        ngx_crc32_update(crc, (u_char *) &mtime, sizeof(time_t));
+        ngx_crc32_update(crc, (u_char *) &size, sizeof(off_t));
+        ngx_crc32_update(crc, (u_char *) &uniq, sizeof(ngx_file_uniq_t));
+
+        if (included == NULL) {
+            break;
+        }
+
+        doc = included->doc;
+        included = included->next;
+    }
+
+    for (s = s->imports; s; s = s->next) {
+
+        if (ngx_http_xslt_signature(s, crc) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
 static char *
 ngx_http_xslt_param(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1022,6 +1928,184 @@ ngx_http_xslt_param(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_xslt_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_xslt_filter_loc_conf_t *xlcf = conf;
+
+    ssize_t                 max_length;
+    ngx_int_t               max;
+    ngx_str_t              *value, s;
+    ngx_uint_t              i;
+    ngx_pool_cleanup_t     *cln;
+    ngx_http_xslt_cache_t  *cache;
+
+    if (xlcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    max = 0;
+    max_length = 65536;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            max = ngx_atoi(value[i].data + 4, value[i].len - 4);
+            if (max <= 0) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_length=", 11) == 0) {
+
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            max_length = ngx_parse_size(&s);
+            if (max_length == NGX_ERROR) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "off") == 0) {
+
+            xlcf->cache = NULL;
+
+            continue;
+        }
+
+    failed:
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid \"xslt_cache\" parameter \"%V\"",
+                           &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (xlcf->cache == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    if (max == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"xslt_cache\" must have the \"max\" parameter");
+        return NGX_CONF_ERROR;
+    }
+
+    cache = ngx_palloc(cf->pool, sizeof(ngx_http_xslt_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_http_xslt_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->queue);
+
+    cache->current = 0;
+    cache->max = max;
+    cache->max_length = max_length;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_xslt_cache_free;
+    cln->data = cache;
+
+    xlcf->cache = cache;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_xslt_threads(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_THREADS)
+    ngx_http_xslt_filter_loc_conf_t *xlcf = conf;
+
+    ssize_t     min_length;
+    ngx_str_t   name, s;
+#endif
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+#if (NGX_THREADS)
+    if (xlcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+#endif
+
+    if (ngx_strcmp(value[1].data, "off") == 0 && cf->args->nelts == 2) {
+#if (NGX_THREADS)
+        xlcf->thread_pool = NULL;
+#endif
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "threads", 7) != 0
+        || (value[1].len != 7 && value[1].data[7] != '='))
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_THREADS)
+
+    name.len = value[1].len > 8 ? value[1].len - 8 : 0;
+    name.data = value[1].data + 8;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "min_length=", 11) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 11;
+        s.data = value[2].data + 11;
+
+        min_length = ngx_parse_size(&s);
+        if (min_length == NGX_ERROR) {
+            goto invalid;
+        }
+
+        xlcf->thread_min_length = min_length;
+    }
+
+    xlcf->thread_pool = ngx_thread_pool_add(cf, name.len ? &name : NULL);
+    if (xlcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid value \"%V\"", &value[2]);
+    return NGX_CONF_ERROR;
+
+#else
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"xslt_threads\" is unsupported on this platform");
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+
 static void
 ngx_http_xslt_cleanup_dtd(void *data)
 {
@@ -1032,7 +2116,23 @@ ngx_http_xslt_cleanup_dtd(void *data)
 static void
 ngx_http_xslt_cleanup_stylesheet(void *data)
 {
-    xsltFreeStylesheet(data);
+    ngx_http_xslt_compiled_t *xc = data;
+
+    ngx_http_xslt_compiled_t  **xcp;
+
+    if (--xc->count) {
+        return;
+    }
+
+    for (xcp = &ngx_http_xslt_compiled; *xcp; xcp = &(*xcp)->next) {
+        if (*xcp == xc) {
+            *xcp = xc->next;
+            break;
+        }
+    }
+
+    xsltFreeStylesheet(xc->stylesheet);
+    ngx_free(xc);
 }
 
 
@@ -1085,6 +2185,12 @@ ngx_http_xslt_filter_create_conf(ngx_conf_t *cf)
      */
 
     conf->last_modified = NGX_CONF_UNSET;
+    conf->cache = NGX_CONF_UNSET_PTR;
+
+#if (NGX_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+    conf->thread_min_length = NGX_CONF_UNSET_SIZE;
+#endif
 
     return conf;
 }
@@ -1118,6 +2224,14 @@ ngx_http_xslt_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->last_modified, prev->last_modified, 0);
 
+    ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
+
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+    ngx_conf_merge_size_value(conf->thread_min_length,
+                              prev->thread_min_length, 65536);
+#endif
+
     return NGX_CONF_OK;
 }
 
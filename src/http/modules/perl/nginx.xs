@@ -70,8 +70,11 @@ ngx_http_perl_output(ngx_http_request_t *r, ngx_http_perl_ctx_t *ctx,
     ngx_buf_t *b)
 {
     ngx_chain_t   out;
-#if (NGX_HTTP_SSI)
+#if (NGX_HTTP_SSI || NGX_HTTP_PERL_THREADS)
     ngx_chain_t  *cl;
+#endif
+
+#if (NGX_HTTP_SSI)
 
     if (ctx->ssi) {
         cl = ngx_alloc_chain_link(r->pool);
@@ -88,6 +91,22 @@ ngx_http_perl_output(ngx_http_request_t *r, ngx_http_perl_ctx_t *ctx,
     }
 #endif
 
+#if (NGX_HTTP_PERL_THREADS)
+    if (ctx->thread) {
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        return NGX_OK;
+    }
+#endif
+
     out.buf = b;
     out.next = NULL;
 
@@ -95,6 +114,58 @@ ngx_http_perl_output(ngx_http_request_t *r, ngx_http_perl_ctx_t *ctx,
 }
 
 
+#if (NGX_HTTP_PERL_THREADS)
+
+static ngx_http_variable_value_t *
+ngx_http_perl_thread_variable(ngx_http_request_t *r, ngx_str_t *name,
+    ngx_uint_t key, ngx_uint_t set)
+{
+    ngx_uint_t                  i;
+    ngx_http_variable_t        *v;
+    ngx_http_variable_value_t  *vv;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    static ngx_http_variable_value_t  not_found = { 0, 0, 0, 1, 0, NULL };
+
+    /*
+     * variable handlers are not thread safe, so a threaded handler
+     * only gets values already evaluated in the worker
+     */
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    v = ngx_hash_find(&cmcf->variables_hash, key, name->data, name->len);
+
+    if (v) {
+        if (!(v->flags & NGX_HTTP_VAR_INDEXED)) {
+            return NULL;
+        }
+
+        vv = &r->variables[v->index];
+
+        if (!set && ((!vv->valid && !vv->not_found) || vv->no_cacheable)) {
+            return NULL;
+        }
+
+        return vv;
+    }
+
+    v = cmcf->prefix_variables.elts;
+
+    for (i = 0; i < cmcf->prefix_variables.nelts; i++) {
+        if (name->len >= v[i].name.len
+            && ngx_strncmp(name->data, v[i].name.data, v[i].name.len) == 0)
+        {
+            return NULL;
+        }
+    }
+
+    return &not_found;
+}
+
+#endif
+
+
 MODULE = nginx    PACKAGE = nginx
 
 
@@ -175,6 +246,13 @@ send_http_header(r, ...)
     ctx->header_sent = 1;
 
     r->disable_not_modified = 1;
+#if (NGX_HTTP_PERL_THREADS)
+    if (ctx->thread) {
+        /* the header is sent when the handler returns */
+        ctx->header_pending = 1;
+        XSRETURN_EMPTY;
+    }
+#endif
 
     rc = ngx_http_send_header(r);
 
@@ -431,6 +509,16 @@ has_request_body(r, next)
     }
 
     ctx->next = SvRV(ST(1));
+#if (NGX_HTTP_PERL_THREADS)
+    if (ctx->thread) {
+        /* the body is read before a threaded handler is called */
+        sv_upgrade(TARG, SVt_IV);
+        sv_setiv(TARG, 1);
+
+        ST(0) = TARG;
+        XSRETURN(1);
+    }
+#endif
 
     r->request_body_in_single_buf = 1;
     r->request_body_in_persistent_file = 1;
@@ -780,6 +868,7 @@ sendfile(r, filename, offset = -1, bytes = 0)
     ngx_str_t                  path;
     ngx_buf_t                 *b;
     ngx_open_file_info_t       of;
+    ngx_open_file_cache_t     *cache;
     ngx_http_core_loc_conf_t  *clcf;
 
     ngx_http_perl_set_request(r, ctx);
@@ -837,15 +926,27 @@ sendfile(r, filename, offset = -1, bytes = 0)
     of.min_uses = clcf->open_file_cache_min_uses;
     of.errors = clcf->open_file_cache_errors;
     of.events = clcf->open_file_cache_events;
+#if (NGX_HTTP_PERL_THREADS)
+    if (ctx->thread && clcf->disable_symlinks_from) {
+        croak("sendfile(): \"disable_symlinks from=\" "
+              "cannot be used in threaded handler");
+    }
+#endif
 
     if (ngx_http_set_disable_symlinks(r, clcf, &path, &of) != NGX_OK) {
         ctx->error = 1;
         croak("ngx_http_set_disable_symlinks() failed");
     }
 
-    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
-        != NGX_OK)
-    {
+    cache = clcf->open_file_cache;
+#if (NGX_HTTP_PERL_THREADS)
+    if (ctx->thread) {
+        /* the cache is not shared with threads */
+        cache = NULL;
+    }
+#endif
+
+    if (ngx_open_cached_file(cache, &path, &of, r->pool) != NGX_OK) {
         if (of.err == 0) {
             ctx->error = 1;
             croak("ngx_open_cached_file() failed");
@@ -1065,8 +1166,21 @@ variable(r, name, value = NULL)
                        "perl variable: \"%V\"", &var);
     }
 #endif
+#if (NGX_HTTP_PERL_THREADS)
+    if (ctx->thread) {
+        vv = ngx_http_perl_thread_variable(r, &var, hash, value != NULL);
 
+        if (vv == NULL) {
+            croak("variable(): \"%.*s\" is not evaluated, "
+                  "cannot be used in threaded handler", (int) len, lowcase);
+        }
+
+    } else {
+        vv = ngx_http_get_variable(r, &var, hash);
+    }
+#else
     vv = ngx_http_get_variable(r, &var, hash);
+#endif
     if (vv == NULL) {
         ctx->error = 1;
         croak("ngx_http_get_variable() failed");
@@ -1165,6 +1279,13 @@ sleep(r, sleep, next)
                    "perl sleep: %M", sleep);
 
     ctx->next = SvRV(ST(2));
+#if (NGX_HTTP_PERL_THREADS)
+    if (ctx->thread) {
+        /* the timer is set when the handler returns */
+        ctx->sleep = sleep;
+        XSRETURN_EMPTY;
+    }
+#endif
 
     r->connection->write->delayed = 1;
     ngx_add_timer(r->connection->write, sleep);
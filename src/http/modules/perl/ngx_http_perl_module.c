@@ -16,12 +16,26 @@ typedef struct {
     HV                *nginx;
     ngx_array_t       *modules;
     ngx_array_t       *requires;
+
+    ngx_uint_t         interpreters;
+
+#if (NGX_HTTP_PERL_THREADS)
+    /* clones of the interpreter for threaded handlers */
+    ngx_uint_t                    nclones;
+    ngx_http_perl_interpreter_t  *free;
+    ngx_queue_t                   waiting;
+    ngx_event_t                   wake;
+#endif
 } ngx_http_perl_main_conf_t;
 
 
 typedef struct {
     SV                *sub;
     ngx_str_t          handler;
+#if (NGX_HTTP_PERL_THREADS)
+    ngx_int_t          index;
+    ngx_thread_pool_t *thread_pool;
+#endif
 } ngx_http_perl_loc_conf_t;
 
 
@@ -31,11 +45,48 @@ typedef struct {
 } ngx_http_perl_variable_t;
 
 
+#if (NGX_HTTP_PERL_THREADS)
+
+struct ngx_http_perl_interpreter_s {
+    PerlInterpreter              *perl;
+    HV                           *nginx;
+    ngx_http_perl_interpreter_t  *next;
+};
+
+
+typedef struct {
+    ngx_http_request_t           *request;
+    SV                           *sub;
+    ngx_str_t                    *handler;
+    ngx_int_t                     index;
+    ngx_int_t                     rc;
+} ngx_http_perl_thread_ctx_t;
+
+#endif
+
+
 #if (NGX_HTTP_SSI)
 static ngx_int_t ngx_http_perl_ssi(ngx_http_request_t *r,
     ngx_http_ssi_ctx_t *ssi_ctx, ngx_str_t **params);
 #endif
 
+static void ngx_http_perl_handle_result(ngx_http_request_t *r,
+    ngx_http_perl_ctx_t *ctx, ngx_int_t rc);
+
+#if (NGX_HTTP_PERL_THREADS)
+static void ngx_http_perl_thread_post(ngx_http_request_t *r,
+    ngx_http_perl_ctx_t *ctx, ngx_http_perl_loc_conf_t *plcf);
+static void ngx_http_perl_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_perl_thread_event_handler(ngx_event_t *ev);
+static void ngx_http_perl_thread_done(ngx_http_request_t *r);
+static ngx_http_perl_interpreter_t *ngx_http_perl_clone_interpreter(
+    ngx_http_perl_main_conf_t *pmcf, ngx_log_t *log);
+static void ngx_http_perl_release_interpreter(ngx_http_perl_ctx_t *ctx);
+static void ngx_http_perl_cleanup_request(void *data);
+static void ngx_http_perl_wake_handler(ngx_event_t *ev);
+static void ngx_http_perl_cleanup_clone(void *data);
+#endif
+
 static char *ngx_http_perl_init_interpreter(ngx_conf_t *cf,
     ngx_http_perl_main_conf_t *pmcf);
 static PerlInterpreter *ngx_http_perl_create_interpreter(ngx_conf_t *cf,
@@ -55,6 +106,8 @@ static char *ngx_http_perl_merge_loc_conf(ngx_conf_t *cf, void *parent,
     void *child);
 static char *ngx_http_perl(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_perl_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_perl_threads(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 #if (NGX_HAVE_PERL_MULTIPLICITY)
 static void ngx_http_perl_cleanup_perl(void *data);
@@ -94,6 +147,20 @@ static ngx_command_t  ngx_http_perl_commands[] = {
       0,
       NULL },
 
+    { ngx_string("perl_threads"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_perl_threads,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("perl_interpreters"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_perl_main_conf_t, interpreters),
+      NULL },
+
       ngx_null_command
 };
 
@@ -170,6 +237,40 @@ ngx_http_perl_xs_init(pTHX)
 static ngx_int_t
 ngx_http_perl_handler(ngx_http_request_t *r)
 {
+#if (NGX_HTTP_PERL_THREADS)
+    ngx_int_t                  rc;
+    ngx_http_perl_loc_conf_t  *plcf;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_perl_module);
+
+    /* subrequests share the pool of the main request, so they run here */
+
+    if (plcf->thread_pool && r == r->main) {
+
+        /*
+         * the body is read in advance, as a threaded handler
+         * cannot wait for it
+         */
+
+        r->request_body_in_single_buf = 1;
+        r->request_body_in_persistent_file = 1;
+        r->request_body_in_clean_file = 1;
+
+        if (r->request_body_in_file_only) {
+            r->request_body_file_log_level = 0;
+        }
+
+        rc = ngx_http_read_client_request_body(r,
+                                               ngx_http_perl_handle_request);
+
+        if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+            return rc;
+        }
+
+        return NGX_DONE;
+    }
+#endif
+
     r->main->count++;
 
     ngx_http_perl_handle_request(r);
@@ -183,8 +284,7 @@ ngx_http_perl_handle_request(ngx_http_request_t *r)
 {
     SV                         *sub;
     ngx_int_t                   rc;
-    ngx_str_t                   uri, args, *handler;
-    ngx_uint_t                  flags;
+    ngx_str_t                  *handler;
     ngx_http_perl_ctx_t        *ctx;
     ngx_http_perl_loc_conf_t   *plcf;
     ngx_http_perl_main_conf_t  *pmcf;
@@ -205,6 +305,15 @@ ngx_http_perl_handle_request(ngx_http_request_t *r)
         ctx->request = r;
     }
 
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_perl_module);
+
+#if (NGX_HTTP_PERL_THREADS)
+    if (plcf->thread_pool && r == r->main) {
+        ngx_http_perl_thread_post(r, ctx, plcf);
+        return;
+    }
+#endif
+
     pmcf = ngx_http_get_module_main_conf(r, ngx_http_perl_module);
 
     {
@@ -214,7 +323,6 @@ ngx_http_perl_handle_request(ngx_http_request_t *r)
     PERL_SET_INTERP(pmcf->perl);
 
     if (ctx->next == NULL) {
-        plcf = ngx_http_get_module_loc_conf(r, ngx_http_perl_module);
         sub = plcf->sub;
         handler = &plcf->handler;
 
@@ -232,6 +340,17 @@ ngx_http_perl_handle_request(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "perl handler done: %i", rc);
 
+    ngx_http_perl_handle_result(r, ctx, rc);
+}
+
+
+static void
+ngx_http_perl_handle_result(ngx_http_request_t *r, ngx_http_perl_ctx_t *ctx,
+    ngx_int_t rc)
+{
+    ngx_str_t   uri, args;
+    ngx_uint_t  flags;
+
     if (rc > 600) {
         rc = NGX_OK;
     }
@@ -336,6 +455,15 @@ ngx_http_perl_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         ctx->request = r;
     }
 
+#if (NGX_HTTP_PERL_THREADS)
+    if (ctx->thread) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "perl variable \"%V\" cannot be used "
+                      "in threaded handler", &pv->handler);
+        return NGX_ERROR;
+    }
+#endif
+
     saved = ctx->variable;
     ctx->variable = 1;
 
@@ -481,6 +609,387 @@ ngx_http_perl_ssi(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ssi_ctx,
 #endif
 
 
+#if (NGX_HTTP_PERL_THREADS)
+
+static void
+ngx_http_perl_thread_post(ngx_http_request_t *r, ngx_http_perl_ctx_t *ctx,
+    ngx_http_perl_loc_conf_t *plcf)
+{
+    size_t                       root;
+    ngx_thread_task_t           *task;
+    ngx_pool_cleanup_t          *cln;
+    ngx_http_perl_thread_ctx_t  *t;
+    ngx_http_perl_main_conf_t   *pmcf;
+
+    pmcf = ngx_http_get_module_main_conf(r, ngx_http_perl_module);
+
+    task = ctx->task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(r->pool,
+                                     sizeof(ngx_http_perl_thread_ctx_t));
+        if (task == NULL) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        cln->handler = ngx_http_perl_cleanup_request;
+        cln->data = ctx;
+
+        task->handler = ngx_http_perl_thread_handler;
+        task->event.handler = ngx_http_perl_thread_event_handler;
+        task->event.data = r;
+
+        ctx->task = task;
+    }
+
+    if (ctx->filename.data == NULL) {
+
+        /* root and alias may contain variables, so filename() is done here */
+
+        if (ngx_http_map_uri_to_path(r, &ctx->filename, &root, 0) == NULL) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        ctx->filename.len--;
+    }
+
+    if (ctx->interpreter == NULL) {
+
+        if (pmcf->free == NULL && pmcf->nclones < pmcf->interpreters) {
+            pmcf->free = ngx_http_perl_clone_interpreter(pmcf,
+                                                         r->connection->log);
+            if (pmcf->free == NULL) {
+                ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+                return;
+            }
+        }
+
+        if (pmcf->free == NULL) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "perl thread wait");
+
+            /* the request is resumed by ngx_http_perl_wake_handler() */
+
+            ngx_queue_insert_tail(&pmcf->waiting, &ctx->queue);
+
+            r->main->blocked++;
+            r->write_event_handler = ngx_http_perl_handle_request;
+
+            return;
+        }
+
+        ctx->interpreter = pmcf->free;
+        pmcf->free = pmcf->free->next;
+    }
+
+    t = task->ctx;
+
+    t->request = r;
+
+    if (ctx->next == NULL) {
+        t->sub = NULL;
+        t->handler = &plcf->handler;
+        t->index = plcf->index;
+
+    } else {
+        t->sub = ctx->next;
+        t->handler = &ngx_null_name;
+        t->index = -1;
+        ctx->next = NULL;
+    }
+
+    ctx->thread = 1;
+    ctx->out = NULL;
+    ctx->last_out = &ctx->out;
+
+    if (ngx_thread_task_post(plcf->thread_pool, task) != NGX_OK) {
+        ctx->thread = 0;
+        ngx_http_perl_release_interpreter(ctx);
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    r->write_event_handler = ngx_http_perl_thread_done;
+}
+
+
+static void
+ngx_http_perl_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_perl_thread_ctx_t *t = data;
+
+    SV                   *sub, **svp;
+    AV                   *handlers;
+    ngx_http_perl_ctx_t  *ctx;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "perl thread handler");
+
+    ctx = ngx_http_get_module_ctx(t->request, ngx_http_perl_module);
+
+    {
+
+    dTHXa(ctx->interpreter->perl);
+    PERL_SET_CONTEXT(ctx->interpreter->perl);
+
+    sub = t->sub;
+
+    if (sub == NULL) {
+        /* the copy of the handler made by perl_clone() */
+
+        handlers = get_av("nginx::handlers", 0);
+        svp = handlers ? av_fetch(handlers, t->index, 0) : NULL;
+
+        if (svp == NULL) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "perl handler \"%V\" not found in clone",
+                          t->handler);
+            t->rc = NGX_ERROR;
+            return;
+        }
+
+        sub = *svp;
+    }
+
+    t->rc = ngx_http_perl_call_handler(aTHX_ t->request, ctx,
+                                       ctx->interpreter->nginx, sub, NULL,
+                                       t->handler, NULL);
+
+    }
+}
+
+
+static void
+ngx_http_perl_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "perl thread: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->write_event_handler(r);
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_perl_thread_done(ngx_http_request_t *r)
+{
+    ngx_int_t                    rc, n;
+    ngx_http_perl_ctx_t         *ctx;
+    ngx_http_perl_thread_ctx_t  *t;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_perl_module);
+    t = ctx->task->ctx;
+
+    rc = t->rc;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "perl handler done: %i", rc);
+
+    ctx->thread = 0;
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    if (ctx->header_pending) {
+        ctx->header_pending = 0;
+
+        n = ngx_http_send_header(r);
+
+        if (n == NGX_ERROR || n > NGX_OK) {
+            rc = n;
+            ctx->out = NULL;
+            ctx->next = NULL;
+            ctx->sleep = 0;
+        }
+    }
+
+    if (ctx->out) {
+        if (ngx_http_output_filter(r, ctx->out) == NGX_ERROR) {
+            rc = NGX_ERROR;
+        }
+
+        ctx->out = NULL;
+    }
+
+    if (ctx->sleep) {
+        r->connection->write->delayed = 1;
+        ngx_add_timer(r->connection->write, ctx->sleep);
+
+        r->write_event_handler = ngx_http_perl_sleep_handler;
+        r->main->count++;
+
+        ctx->sleep = 0;
+
+    } else if (ctx->next && rc != NGX_ERROR) {
+
+        /* has_request_body(), the body is already read */
+
+        ngx_http_perl_handle_request(r);
+        return;
+    }
+
+    if (ctx->next == NULL) {
+        ngx_http_perl_release_interpreter(ctx);
+    }
+
+    ngx_http_perl_handle_result(r, ctx, rc);
+}
+
+
+static ngx_http_perl_interpreter_t *
+ngx_http_perl_clone_interpreter(ngx_http_perl_main_conf_t *pmcf,
+    ngx_log_t *log)
+{
+    PerlInterpreter              *perl;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_perl_interpreter_t  *interp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "clone perl interpreter #%ui", pmcf->nclones);
+
+    cln = ngx_pool_cleanup_add(ngx_cycle->pool,
+                               sizeof(ngx_http_perl_interpreter_t));
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    PERL_SET_CONTEXT(pmcf->perl);
+
+    perl = perl_clone(pmcf->perl, 0);
+
+    if (perl == NULL) {
+        PERL_SET_CONTEXT(pmcf->perl);
+        ngx_log_error(NGX_LOG_ALERT, log, 0, "perl_clone() failed");
+        return NULL;
+    }
+
+    interp = cln->data;
+
+    interp->perl = perl;
+    interp->next = NULL;
+
+    {
+
+    dTHXa(perl);
+
+    interp->nginx = gv_stashpv("nginx", TRUE);
+
+    }
+
+    PERL_SET_CONTEXT(pmcf->perl);
+
+    cln->handler = ngx_http_perl_cleanup_clone;
+
+    pmcf->nclones++;
+
+    return interp;
+}
+
+
+static void
+ngx_http_perl_release_interpreter(ngx_http_perl_ctx_t *ctx)
+{
+    ngx_http_perl_interpreter_t  *interp;
+    ngx_http_perl_main_conf_t    *pmcf;
+
+    interp = ctx->interpreter;
+
+    if (interp == NULL) {
+        return;
+    }
+
+    ctx->interpreter = NULL;
+
+    pmcf = ngx_http_get_module_main_conf(ctx->request, ngx_http_perl_module);
+
+    interp->next = pmcf->free;
+    pmcf->free = interp;
+
+    if (!ngx_queue_empty(&pmcf->waiting) && !pmcf->wake.posted) {
+        ngx_post_event(&pmcf->wake, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_perl_cleanup_request(void *data)
+{
+    ngx_http_perl_ctx_t  *ctx = data;
+
+    ngx_http_perl_release_interpreter(ctx);
+}
+
+
+static void
+ngx_http_perl_wake_handler(ngx_event_t *ev)
+{
+    ngx_queue_t                *q;
+    ngx_connection_t           *c;
+    ngx_http_request_t         *r;
+    ngx_http_perl_ctx_t        *ctx;
+    ngx_http_perl_main_conf_t  *pmcf;
+
+    pmcf = ev->data;
+
+    while (pmcf->free && !ngx_queue_empty(&pmcf->waiting)) {
+
+        q = ngx_queue_head(&pmcf->waiting);
+        ngx_queue_remove(q);
+
+        ctx = ngx_queue_data(q, ngx_http_perl_ctx_t, queue);
+
+        ctx->interpreter = pmcf->free;
+        pmcf->free = pmcf->free->next;
+
+        r = ctx->request;
+        c = r->connection;
+
+        ngx_http_set_log_request(c->log, r);
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "perl thread wake");
+
+        r->main->blocked--;
+
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+
+static void
+ngx_http_perl_cleanup_clone(void *data)
+{
+    ngx_http_perl_interpreter_t  *interp = data;
+
+    PERL_SET_CONTEXT(interp->perl);
+
+    (void) perl_destruct(interp->perl);
+
+    perl_free(interp->perl);
+}
+
+#endif
+
+
 static char *
 ngx_http_perl_init_interpreter(ngx_conf_t *cf, ngx_http_perl_main_conf_t *pmcf)
 {
@@ -854,6 +1363,7 @@ ngx_http_perl_create_main_conf(ngx_conf_t *cf)
 
     pmcf->modules = NGX_CONF_UNSET_PTR;
     pmcf->requires = NGX_CONF_UNSET_PTR;
+    pmcf->interpreters = NGX_CONF_UNSET_UINT;
 
     return pmcf;
 }
@@ -864,6 +1374,8 @@ ngx_http_perl_init_main_conf(ngx_conf_t *cf, void *conf)
 {
     ngx_http_perl_main_conf_t *pmcf = conf;
 
+    ngx_conf_init_uint_value(pmcf->interpreters, 8);
+
     if (pmcf->perl == NULL) {
         if (ngx_http_perl_init_interpreter(cf, pmcf) != NGX_CONF_OK) {
             return NGX_CONF_ERROR;
@@ -941,6 +1453,10 @@ ngx_http_perl_create_loc_conf(ngx_conf_t *cf)
      *     plcf->handler = { 0, NULL };
      */
 
+#if (NGX_HTTP_PERL_THREADS)
+    plcf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
+
     return plcf;
 }
 
@@ -954,8 +1470,15 @@ ngx_http_perl_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     if (conf->sub == NULL) {
         conf->sub = prev->sub;
         conf->handler = prev->handler;
+#if (NGX_HTTP_PERL_THREADS)
+        conf->index = prev->index;
+#endif
     }
 
+#if (NGX_HTTP_PERL_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
     return NGX_CONF_OK;
 }
 
@@ -968,6 +1491,9 @@ ngx_http_perl(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                  *value;
     ngx_http_core_loc_conf_t   *clcf;
     ngx_http_perl_main_conf_t  *pmcf;
+#if (NGX_HTTP_PERL_THREADS)
+    AV                         *handlers;
+#endif
 
     value = cf->args->elts;
 
@@ -1005,6 +1531,17 @@ ngx_http_perl(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         plcf->sub = newSVpvn((char *) value[1].data, value[1].len);
     }
 
+#if (NGX_HTTP_PERL_THREADS)
+
+    /* clones of the interpreter find their copies of handlers here */
+
+    handlers = get_av("nginx::handlers", GV_ADD);
+    av_push(handlers, SvREFCNT_inc(plcf->sub));
+
+    plcf->index = av_len(handlers);
+
+#endif
+
     }
 
     clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
@@ -1086,6 +1623,55 @@ ngx_http_perl_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_perl_threads(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_HTTP_PERL_THREADS)
+    ngx_http_perl_loc_conf_t *plcf = conf;
+
+    ngx_str_t  *value, name;
+
+    if (plcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        plcf->thread_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "threads", 7) != 0
+        || (value[1].len != 7 && value[1].data[7] != '='))
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len = value[1].len > 8 ? value[1].len - 8 : 0;
+    name.data = value[1].data + 8;
+
+    plcf->thread_pool = ngx_thread_pool_add(cf, name.len ? &name : NULL);
+    if (plcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+#else
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"perl_threads\" requires threads support "
+                       "in both nginx and perl");
+
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+
 static ngx_int_t
 ngx_http_perl_init_worker(ngx_cycle_t *cycle)
 {
@@ -1101,6 +1687,14 @@ ngx_http_perl_init_worker(ngx_cycle_t *cycle)
         /* set worker's $$ */
 
         sv_setiv(GvSV(gv_fetchpv("$", TRUE, SVt_PV)), (I32) ngx_pid);
+
+#if (NGX_HTTP_PERL_THREADS)
+        ngx_queue_init(&pmcf->waiting);
+
+        pmcf->wake.handler = ngx_http_perl_wake_handler;
+        pmcf->wake.data = pmcf;
+        pmcf->wake.log = cycle->log;
+#endif
     }
 
     return NGX_OK;
@@ -18,8 +18,15 @@
 #include <perl.h>
 
 
+#if (NGX_THREADS && NGX_HAVE_PERL_ITHREADS)
+#define NGX_HTTP_PERL_THREADS  1
+#endif
+
+
 typedef ngx_http_request_t   *nginx;
 
+typedef struct ngx_http_perl_interpreter_s  ngx_http_perl_interpreter_t;
+
 typedef struct {
     ngx_http_request_t       *request;
 
@@ -35,6 +42,21 @@ typedef struct {
     unsigned                  variable:1;
     unsigned                  header_sent:1;
 
+#if (NGX_HTTP_PERL_THREADS)
+    unsigned                  thread:1;
+    unsigned                  header_pending:1;
+
+    /* a threaded handler runs in its own interpreter */
+    ngx_http_perl_interpreter_t  *interpreter;
+    ngx_thread_task_t        *task;
+    ngx_queue_t               queue;
+
+    /* output and sleep() of a threaded handler, done when it returns */
+    ngx_chain_t              *out;
+    ngx_chain_t             **last_out;
+    ngx_msec_t                sleep;
+#endif
+
     ngx_array_t              *variables;  /* array of ngx_http_perl_var_t */
 
 #if (NGX_HTTP_SSI)
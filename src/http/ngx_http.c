@@ -35,6 +35,10 @@ static char *ngx_http_merge_locations(ngx_conf_t *cf,
     ngx_uint_t ctx_index);
 static ngx_int_t ngx_http_init_locations(ngx_conf_t *cf,
     ngx_http_core_srv_conf_t *cscf, ngx_http_core_loc_conf_t *pclcf);
+#if (NGX_RE2)
+static ngx_int_t ngx_http_init_regex_location_set(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *pclcf, ngx_uint_t n);
+#endif
 static ngx_int_t ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf);
 static ngx_int_t ngx_http_cmp_locations(const ngx_queue_t *one,
@@ -46,6 +50,11 @@ static void ngx_http_create_locations_list(ngx_queue_t *locations,
 static ngx_http_location_tree_node_t *
     ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
     size_t prefix);
+static ngx_int_t ngx_http_collect_static_locations(
+    ngx_http_location_tree_node_t *node, ngx_array_t *nodes);
+static ngx_int_t ngx_http_create_locations_trie(ngx_conf_t *cf,
+    ngx_http_location_trie_t *trie, ngx_http_location_tree_node_t **nodes,
+    ngx_uint_t n, size_t depth);
 
 static ngx_int_t ngx_http_optimize_servers(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf, ngx_array_t *ports);
@@ -69,9 +78,10 @@ static ngx_int_t ngx_http_add_addrs6(ngx_conf_t *cf, ngx_http_port_t *hport,
 ngx_uint_t   ngx_http_max_module;
 
 
-ngx_http_output_header_filter_pt  ngx_http_top_header_filter;
-ngx_http_output_body_filter_pt    ngx_http_top_body_filter;
-ngx_http_request_body_filter_pt   ngx_http_top_request_body_filter;
+ngx_http_output_header_filter_pt       ngx_http_top_header_filter;
+ngx_http_output_early_hints_filter_pt  ngx_http_top_early_hints_filter;
+ngx_http_output_body_filter_pt         ngx_http_top_body_filter;
+ngx_http_request_body_filter_pt        ngx_http_top_request_body_filter;
 
 
 ngx_str_t  ngx_http_html_default_types[] = {
@@ -123,6 +133,7 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_uint_t                   mi, m, s;
     ngx_conf_t                   pcf;
     ngx_http_module_t           *module;
+    ngx_conf_profile_t           profile;
     ngx_http_conf_ctx_t         *ctx;
     ngx_http_core_loc_conf_t    *clcf;
     ngx_http_core_srv_conf_t   **cscfp;
@@ -191,6 +202,8 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         module = cf->cycle->modules[m]->ctx;
         mi = cf->cycle->modules[m]->ctx_index;
 
+        ngx_conf_profile_start(&profile);
+
         if (module->create_main_conf) {
             ctx->main_conf[mi] = module->create_main_conf(cf);
             if (ctx->main_conf[mi] == NULL) {
@@ -211,6 +224,9 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 return NGX_CONF_ERROR;
             }
         }
+
+        ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                              NGX_CONF_PROFILE_CREATE_CONF);
     }
 
     pcf = *cf;
@@ -224,9 +240,14 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         module = cf->cycle->modules[m]->ctx;
 
         if (module->preconfiguration) {
+            ngx_conf_profile_start(&profile);
+
             if (module->preconfiguration(cf) != NGX_OK) {
                 return NGX_CONF_ERROR;
             }
+
+            ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                                  NGX_CONF_PROFILE_PRECONFIGURATION);
         }
     }
 
@@ -259,16 +280,26 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         /* init http{} main_conf's */
 
         if (module->init_main_conf) {
+            ngx_conf_profile_start(&profile);
+
             rv = module->init_main_conf(cf, ctx->main_conf[mi]);
             if (rv != NGX_CONF_OK) {
                 goto failed;
             }
+
+            ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                                  NGX_CONF_PROFILE_INIT_CONF);
         }
 
+        ngx_conf_profile_start(&profile);
+
         rv = ngx_http_merge_servers(cf, cmcf, module, mi);
         if (rv != NGX_CONF_OK) {
             goto failed;
         }
+
+        ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                              NGX_CONF_PROFILE_MERGE_CONF);
     }
 
 
@@ -311,9 +342,14 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         module = cf->cycle->modules[m]->ctx;
 
         if (module->postconfiguration) {
+            ngx_conf_profile_start(&profile);
+
             if (module->postconfiguration(cf) != NGX_OK) {
                 return NGX_CONF_ERROR;
             }
+
+            ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                                  NGX_CONF_PROFILE_POSTCONFIGURATION);
         }
     }
 
@@ -515,6 +551,7 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
              * QUESTION: 这里不用设置 ph->next 么？
              */
             ph->checker = ngx_http_core_find_config_phase;
+            ph->phase = i;
             n++;
             ph++;
 
@@ -549,6 +586,7 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
             if (use_rewrite) {
                 ph->checker = ngx_http_core_post_rewrite_phase;
                 ph->next = find_config_index;
+                ph->phase = i;
                 n++;
                 ph++;
             }
@@ -570,6 +608,7 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
             if (use_access) {
                 ph->checker = ngx_http_core_post_access_phase;
                 ph->next = n;
+                ph->phase = i;
                 ph++;
             }
 
@@ -592,6 +631,7 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
             ph->checker = checker;
             ph->handler = h[j];
             ph->next = n;
+            ph->phase = i;
             ph++;
         }
     }
@@ -760,6 +800,22 @@ ngx_http_merge_locations(ngx_conf_t *cf, ngx_queue_t *locations,
         lq = (ngx_http_location_queue_t *) q;
 
         clcf = lq->exact ? lq->exact : lq->inclusive;
+
+        if (clcf->loc_conf[ctx_index] == NULL) {
+
+            /* a shared loc_conf not set in the location */
+
+            clcf->loc_conf[ctx_index] = loc_conf[ctx_index];
+
+            rv = ngx_http_merge_locations(cf, clcf->locations, clcf->loc_conf,
+                                          module, ctx_index);
+            if (rv != NGX_CONF_OK) {
+                return rv;
+            }
+
+            continue;
+        }
+
         // NOTE: 注意这一句，在 ngx_http_merge_servers 中有解释
         ctx->loc_conf = clcf->loc_conf;
 
@@ -791,6 +847,33 @@ ngx_http_merge_locations(ngx_conf_t *cf, ngx_queue_t *locations,
 }
 
 
+/*
+ * A module whose merged loc_conf is just inherited when a location
+ * sets none of its directives may be registered from preconfiguration:
+ * such locations then use the parent's loc_conf instead of creating
+ * and merging their own.  Only the directives of the module may access
+ * its loc_conf during parsing, and the module must not depend on the
+ * merge being called for every location.
+ */
+
+void
+ngx_http_share_loc_conf(ngx_conf_t *cf, ngx_module_t *module)
+{
+    ngx_http_module_t          *m;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    m = module->ctx;
+
+    if (m->create_loc_conf == NULL || m->merge_loc_conf == NULL) {
+        return;
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    cmcf->shared_loc_conf[module->ctx_index] = 1;
+}
+
+
 static ngx_int_t
 ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_core_loc_conf_t *pclcf)
@@ -940,6 +1023,14 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         *clcfp = NULL;
 
         ngx_queue_split(locations, regex, &tail);
+
+#if (NGX_RE2)
+        if (pclcf->regex_location_set
+            && ngx_http_init_regex_location_set(cf, pclcf, r) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+#endif
     }
 
 #endif
@@ -948,10 +1039,77 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 }
 
 
+#if (NGX_RE2)
+
+/*
+ * the regex locations of one level are also added to an RE2 set,
+ * which is matched first to skip the locations that cannot match;
+ * the first matching location is still found by PCRE in the order
+ * of the configuration, and sets the captures
+ */
+
+static ngx_int_t
+ngx_http_init_regex_location_set(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *pclcf, ngx_uint_t n)
+{
+    u_char                      errstr[NGX_MAX_CONF_ERRSTR];
+    ngx_int_t                   rc;
+    ngx_str_t                   err;
+    ngx_regex_set_t            *set;
+    ngx_http_core_loc_conf_t  **clcfp;
+
+    set = ngx_regex_set_create(cf->pool, n);
+    if (set == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
+
+        err.len = NGX_MAX_CONF_ERRSTR;
+        err.data = errstr;
+
+        rc = ngx_regex_set_add(set, &(*clcfp)->name,
+                               (*clcfp)->regex_caseless ? NGX_REGEX_CASELESS
+                                                        : 0,
+                               &err);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            ngx_log_error(NGX_LOG_NOTICE, cf->log, 0,
+                          "regex location \"%V\" is not supported by RE2 "
+                          "and is always tested: %V", &(*clcfp)->name, &err);
+        }
+    }
+
+    rc = ngx_regex_set_compile(set);
+
+    if (rc == NGX_DECLINED) {
+        return NGX_OK;
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                      "failed to compile RE2 set of %ui regex locations, "
+                      "the locations are tested one by one", n);
+        return NGX_OK;
+    }
+
+    pclcf->regex_set = set;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf)
 {
+    ngx_array_t                 nodes;
     ngx_queue_t                *q, *locations;
     ngx_http_core_loc_conf_t   *clcf;
     ngx_http_location_queue_t  *lq;
@@ -994,6 +1152,32 @@ ngx_http_init_static_location_trees(ngx_conf_t *cf,
         return NGX_ERROR;
     }
 
+    if (ngx_array_init(&nodes, cf->temp_pool, 16,
+                       sizeof(ngx_http_location_tree_node_t *))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_collect_static_locations(pclcf->static_locations, &nodes)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    pclcf->static_trie = ngx_pcalloc(cf->pool,
+                                     sizeof(ngx_http_location_trie_t));
+    if (pclcf->static_trie == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_create_locations_trie(cf, pclcf->static_trie, nodes.elts,
+                                       nodes.nelts, 0)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
     return NGX_OK;
 }
 
@@ -1408,6 +1592,147 @@ inclusive:
 }
 
 
+#define ngx_http_location_node_name(node)                                     \
+    ((node)->exact ? &(node)->exact->name : &(node)->inclusive->name)
+
+#if (NGX_HAVE_CASELESS_FILESYSTEM)
+#define ngx_http_location_key(c)  ngx_tolower(c)
+#else
+#define ngx_http_location_key(c)  (c)
+#endif
+
+
+/*
+ * an in-order walk of the tree yields the locations sorted
+ * by ngx_filename_cmp(): the "tree" subtree holds names prefixed
+ * by the node name, which sort after it and before the right subtree
+ */
+
+static ngx_int_t
+ngx_http_collect_static_locations(ngx_http_location_tree_node_t *node,
+    ngx_array_t *nodes)
+{
+    ngx_http_location_tree_node_t  **n;
+
+    if (node == NULL) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_collect_static_locations(node->left, nodes) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    n = ngx_array_push(nodes);
+    if (n == NULL) {
+        return NGX_ERROR;
+    }
+
+    *n = node;
+
+    if (ngx_http_collect_static_locations(node->tree, nodes) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_collect_static_locations(node->right, nodes);
+}
+
+
+/*
+ * all "n" names share the first "depth" bytes; the first one is
+ * the trie node itself if it is exactly "depth" bytes long, the rest
+ * are split into children by the byte at "depth", and each child label
+ * runs up to the common prefix of the first and last names of the group
+ */
+
+static ngx_int_t
+ngx_http_create_locations_trie(ngx_conf_t *cf, ngx_http_location_trie_t *trie,
+    ngx_http_location_tree_node_t **nodes, ngx_uint_t n, size_t depth)
+{
+    size_t                     len;
+    u_char                     c;
+    ngx_str_t                 *name, *first, *last;
+    ngx_uint_t                 i, j, k;
+    ngx_http_location_trie_t  *child;
+
+    i = 0;
+
+    if (ngx_http_location_node_name(nodes[0])->len == depth) {
+        trie->exact = nodes[0]->exact;
+        trie->inclusive = nodes[0]->inclusive;
+        trie->auto_redirect = nodes[0]->auto_redirect;
+        i = 1;
+    }
+
+    if (i == n) {
+        return NGX_OK;
+    }
+
+    k = 0;
+
+    c = 0;
+
+    for (j = i; j < n; j++) {
+        name = ngx_http_location_node_name(nodes[j]);
+
+        if (j == i || ngx_http_location_key(name->data[depth]) != c) {
+            c = ngx_http_location_key(name->data[depth]);
+            k++;
+        }
+    }
+
+    trie->children = ngx_pcalloc(cf->pool,
+                                 k * sizeof(ngx_http_location_trie_t));
+    if (trie->children == NULL) {
+        return NGX_ERROR;
+    }
+
+    trie->keys = ngx_pnalloc(cf->pool, k);
+    if (trie->keys == NULL) {
+        return NGX_ERROR;
+    }
+
+    trie->nchildren = k;
+
+    for (k = 0; i < n; k++, i = j) {
+
+        first = ngx_http_location_node_name(nodes[i]);
+        c = ngx_http_location_key(first->data[depth]);
+
+        for (j = i + 1; j < n; j++) {
+            name = ngx_http_location_node_name(nodes[j]);
+
+            if (ngx_http_location_key(name->data[depth]) != c) {
+                break;
+            }
+        }
+
+        last = ngx_http_location_node_name(nodes[j - 1]);
+
+        for (len = depth + 1; len < first->len && len < last->len; len++) {
+            if (ngx_http_location_key(first->data[len])
+                != ngx_http_location_key(last->data[len]))
+            {
+                break;
+            }
+        }
+
+        child = &trie->children[k];
+
+        trie->keys[k] = c;
+        child->label = first->data + depth;
+        child->len = len - depth;
+
+        if (ngx_http_create_locations_trie(cf, child, &nodes[i], j - i, len)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_http_add_listen(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_listen_opt_t *lsopt)
@@ -1434,7 +1759,10 @@ ngx_http_add_listen(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     port = cmcf->ports->elts;
     for (i = 0; i < cmcf->ports->nelts; i++) {
 
-        if (p != port[i].port || sa->sa_family != port[i].family) {
+        if (p != port[i].port
+            || lsopt->type != port[i].type
+            || sa->sa_family != port[i].family)
+        {
             continue;
         }
 
@@ -1459,6 +1787,7 @@ ngx_http_add_listen(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
      *       如果是 Unix domain 的话，port = 0
      */
     port->family = sa->sa_family;
+    port->type = lsopt->type;
     port->port = p;
     port->addrs.elts = NULL;
 
@@ -1615,8 +1944,7 @@ ngx_http_add_address(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     }
 
     addr->opt = *lsopt;
-    addr->hash.buckets = NULL;
-    addr->hash.size = 0;
+    ngx_memzero(&addr->hash, sizeof(ngx_hash_t));
     addr->wc_head = NULL;
     addr->wc_tail = NULL;
 #if (NGX_PCRE)
@@ -1817,10 +2145,19 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
         hash.hash = NULL;
         hash.temp_pool = ha.temp_pool;
 
-        if (ngx_hash_wildcard_init(&hash, ha.dns_wc_head.elts,
-                                   ha.dns_wc_head.nelts)
-            != NGX_OK)
-        {
+        rc = NGX_DECLINED;
+
+        if (cmcf->server_names_hash_trie) {
+            rc = ngx_hash_wildcard_trie_init(&hash, ha.dns_wc_head.elts,
+                                             ha.dns_wc_head.nelts);
+        }
+
+        if (rc == NGX_DECLINED) {
+            rc = ngx_hash_wildcard_init(&hash, ha.dns_wc_head.elts,
+                                        ha.dns_wc_head.nelts);
+        }
+
+        if (rc != NGX_OK) {
             goto failed;
         }
 
@@ -1835,10 +2172,19 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
         hash.hash = NULL;
         hash.temp_pool = ha.temp_pool;
 
-        if (ngx_hash_wildcard_init(&hash, ha.dns_wc_tail.elts,
-                                   ha.dns_wc_tail.nelts)
-            != NGX_OK)
-        {
+        rc = NGX_DECLINED;
+
+        if (cmcf->server_names_hash_trie) {
+            rc = ngx_hash_wildcard_trie_init(&hash, ha.dns_wc_tail.elts,
+                                             ha.dns_wc_tail.nelts);
+        }
+
+        if (rc == NGX_DECLINED) {
+            rc = ngx_hash_wildcard_init(&hash, ha.dns_wc_tail.elts,
+                                        ha.dns_wc_tail.nelts);
+        }
+
+        if (rc != NGX_OK) {
             goto failed;
         }
 
@@ -2034,6 +2380,11 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
 
     ls->handler = ngx_http_init_connection;
 
+#if (NGX_QUIC)
+    ls->type = addr->opt.type;
+    ls->quic = addr->opt.quic;
+#endif
+
     cscf = addr->default_server;
     ls->pool_size = cscf->connection_pool_size;
     ls->post_accept_timeout = cscf->client_header_timeout;
@@ -2088,6 +2439,10 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ls->fastopen = addr->opt.fastopen;
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+    ls->busy_poll = addr->opt.busy_poll;
+#endif
+
 #if (NGX_HAVE_REUSEPORT)
     ls->reuseport = addr->opt.reuseport;
 #endif
@@ -2123,14 +2478,19 @@ ngx_http_add_addrs(ngx_conf_t *cf, ngx_http_port_t *hport,
 #endif
 #if (NGX_HTTP_V2)
         addrs[i].conf.http2 = addr[i].opt.http2;
+#endif
+#if (NGX_QUIC)
+        addrs[i].conf.quic = addr[i].opt.quic;
 #endif
         addrs[i].conf.proxy_protocol = addr[i].opt.proxy_protocol;
 
         if (addr[i].hash.buckets == NULL
             && (addr[i].wc_head == NULL
-                || addr[i].wc_head->hash.buckets == NULL)
+                || (addr[i].wc_head->hash.buckets == NULL
+                    && addr[i].wc_head->trie == NULL))
             && (addr[i].wc_tail == NULL
-                || addr[i].wc_tail->hash.buckets == NULL)
+                || (addr[i].wc_tail->hash.buckets == NULL
+                    && addr[i].wc_tail->trie == NULL))
 #if (NGX_PCRE)
             && addr[i].nregex == 0
 #endif
@@ -2188,14 +2548,19 @@ ngx_http_add_addrs6(ngx_conf_t *cf, ngx_http_port_t *hport,
 #endif
 #if (NGX_HTTP_V2)
         addrs6[i].conf.http2 = addr[i].opt.http2;
+#endif
+#if (NGX_QUIC)
+        addrs6[i].conf.quic = addr[i].opt.quic;
 #endif
         addrs6[i].conf.proxy_protocol = addr[i].opt.proxy_protocol;
 
         if (addr[i].hash.buckets == NULL
             && (addr[i].wc_head == NULL
-                || addr[i].wc_head->hash.buckets == NULL)
+                || (addr[i].wc_head->hash.buckets == NULL
+                    && addr[i].wc_head->trie == NULL))
             && (addr[i].wc_tail == NULL
-                || addr[i].wc_tail->hash.buckets == NULL)
+                || (addr[i].wc_tail->hash.buckets == NULL
+                    && addr[i].wc_tail->trie == NULL))
 #if (NGX_PCRE)
             && addr[i].nregex == 0
 #endif
@@ -34,6 +34,7 @@ typedef u_char *(*ngx_http_log_handler_pt)(ngx_http_request_t *r,
 #include <ngx_http_upstream.h>
 #include <ngx_http_upstream_round_robin.h>
 #include <ngx_http_core_module.h>
+#include <ngx_http_index_module.h>
 
 #if (NGX_HTTP_V2)
 #include <ngx_http_v2.h>
@@ -47,6 +48,9 @@ typedef u_char *(*ngx_http_log_handler_pt)(ngx_http_request_t *r,
 #if (NGX_HTTP_SSL)
 #include <ngx_http_ssl_module.h>
 #endif
+#if (NGX_HTTP_GRPC)
+#include <ngx_http_grpc_module.h>
+#endif
 
 
 struct ngx_http_log_ctx_s {
@@ -78,6 +82,7 @@ typedef struct {
 
 ngx_int_t ngx_http_add_location(ngx_conf_t *cf, ngx_queue_t **locations,
     ngx_http_core_loc_conf_t *clcf);
+void ngx_http_share_loc_conf(ngx_conf_t *cf, ngx_module_t *module);
 ngx_int_t ngx_http_add_listen(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_listen_opt_t *lsopt);
 
@@ -122,6 +127,7 @@ void ngx_http_process_request(ngx_http_request_t *r);
 void ngx_http_update_location_config(ngx_http_request_t *r);
 void ngx_http_handler(ngx_http_request_t *r);
 void ngx_http_run_posted_requests(ngx_connection_t *c);
+void ngx_http_cpu_switch(ngx_http_request_t *r);
 ngx_int_t ngx_http_post_request(ngx_http_request_t *r,
     ngx_http_posted_request_t *pr);
 void ngx_http_finalize_request(ngx_http_request_t *r, ngx_int_t rc);
@@ -142,6 +148,7 @@ ngx_int_t ngx_http_read_client_request_body(ngx_http_request_t *r,
 ngx_int_t ngx_http_read_unbuffered_request_body(ngx_http_request_t *r);
 
 ngx_int_t ngx_http_send_header(ngx_http_request_t *r);
+ngx_int_t ngx_http_send_early_hints(ngx_http_request_t *r);
 ngx_int_t ngx_http_special_response_handler(ngx_http_request_t *r,
     ngx_int_t error);
 ngx_int_t ngx_http_filter_finalize_request(ngx_http_request_t *r,
@@ -171,10 +178,13 @@ extern ngx_module_t  ngx_http_module;
 
 extern ngx_str_t  ngx_http_html_default_types[];
 
+extern ngx_http_request_t  *ngx_http_cpu_request;
+
 
-extern ngx_http_output_header_filter_pt  ngx_http_top_header_filter;
-extern ngx_http_output_body_filter_pt    ngx_http_top_body_filter;
-extern ngx_http_request_body_filter_pt   ngx_http_top_request_body_filter;
+extern ngx_http_output_header_filter_pt       ngx_http_top_header_filter;
+extern ngx_http_output_early_hints_filter_pt  ngx_http_top_early_hints_filter;
+extern ngx_http_output_body_filter_pt         ngx_http_top_body_filter;
+extern ngx_http_request_body_filter_pt        ngx_http_top_request_body_filter;
 
 
 #endif /* _NGX_HTTP_H_INCLUDED_ */
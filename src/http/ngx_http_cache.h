@@ -29,6 +29,22 @@
 
 #define NGX_HTTP_CACHE_VERSION       5
 
+#define NGX_HTTP_CACHE_MEM_ENTRY     65536
+
+#define NGX_HTTP_CACHE_PROMOTE_USES  4
+
+#define NGX_HTTP_CACHE_STREAM_POLL   50
+
+#define NGX_HTTP_CACHE_EVICT_LRU     0
+#define NGX_HTTP_CACHE_EVICT_TINYLFU 1
+
+#define NGX_HTTP_CACHE_SKETCH_ROWS   4
+#define NGX_HTTP_CACHE_SKETCH_MAX    15
+#define NGX_HTTP_CACHE_EVICT_SAMPLE  8
+
+#define NGX_HTTP_CACHE_KEY_MD5       0
+#define NGX_HTTP_CACHE_KEY_MURMUR3   1
+
 
 typedef struct {
     ngx_uint_t                       status;
@@ -36,6 +52,10 @@ typedef struct {
 } ngx_http_cache_valid_t;
 
 
+typedef struct ngx_http_file_cache_mem_s  ngx_http_file_cache_mem_t;
+typedef struct ngx_http_file_cache_link_s  ngx_http_file_cache_link_t;
+
+
 typedef struct {
     ngx_rbtree_node_t                node;
     ngx_queue_t                      queue;
@@ -51,7 +71,11 @@ typedef struct {
     unsigned                         updating:1;
     unsigned                         deleting:1;
     unsigned                         purged:1;
-                                     /* 10 unused bits */
+    unsigned                         filling:1;
+    unsigned                         fast:1;
+    unsigned                         promoting:1;
+    unsigned                         fast_stale:1;
+                                     /* 6 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
@@ -59,9 +83,44 @@ typedef struct {
     size_t                           body_start;
     off_t                            fs_size;
     ngx_msec_t                       lock_time;
+
+    uint32_t                         fill_temp;
+    off_t                            fill_size;
+
+    ngx_http_file_cache_mem_t       *mem;
+
+    ngx_queue_t                      fast_queue;
+    ngx_file_uniq_t                  fast_uniq;
+
+    ngx_http_file_cache_link_t      *tags;
 } ngx_http_file_cache_node_t;
 
 
+/* a tag of cache entries, with the list of their links */
+
+typedef struct {
+    ngx_str_node_t                   sn;
+    ngx_queue_t                      links;
+    u_char                           data[1];
+} ngx_http_file_cache_tag_t;
+
+
+struct ngx_http_file_cache_link_s {
+    ngx_queue_t                      queue;
+    ngx_http_file_cache_tag_t       *tag;
+    ngx_http_file_cache_node_t      *node;
+    ngx_http_file_cache_link_t      *next;
+};
+
+
+struct ngx_http_file_cache_mem_s {
+    ngx_queue_t                      queue;
+    ngx_http_file_cache_node_t      *node;
+    size_t                           len;
+    u_char                           data[1];
+};
+
+
 struct ngx_http_cache_s {
     ngx_file_t                       file;
     ngx_array_t                      keys;
@@ -70,6 +129,7 @@ struct ngx_http_cache_s {
     u_char                           main[NGX_HTTP_CACHE_KEY_LEN];
 
     ngx_file_uniq_t                  uniq;
+    ngx_file_uniq_t                  fast_uniq;
     time_t                           valid_sec;
     time_t                           updating_sec;
     time_t                           error_sec;
@@ -106,8 +166,16 @@ struct ngx_http_cache_s {
 
     ngx_event_t                      wait_event;
 
+    uint32_t                         fill_temp;
+    ngx_buf_t                       *stream_buf;
+
+    ngx_array_t                     *tags;        /* ngx_str_t */
+
     unsigned                         lock:1;
     unsigned                         waiting:1;
+    unsigned                         read_while_write:1;
+    unsigned                         filling:1;
+    unsigned                         streaming:1;
 
     unsigned                         updated:1;
     unsigned                         updating:1;
@@ -115,6 +183,9 @@ struct ngx_http_cache_s {
     unsigned                         temp_file:1;
     unsigned                         purged:1;
     unsigned                         reading:1;
+    unsigned                         opening:1;
+    unsigned                         memory:1;
+    unsigned                         fast:1;
     unsigned                         secondary:1;
     unsigned                         background:1;
 
@@ -148,9 +219,33 @@ typedef struct {
     ngx_queue_t                      queue;
     ngx_atomic_t                     cold;
     ngx_atomic_t                     loading;
+    ngx_atomic_t                     loaded;
+    ngx_atomic_t                     loaders;
     off_t                            size;
     ngx_uint_t                       count;
     ngx_uint_t                       watermark;
+    ngx_queue_t                      mem_queue;
+    size_t                           mem_size;
+    ngx_queue_t                      fast_queue;
+    off_t                            fast_size;
+
+    ngx_rbtree_t                     tag_rbtree;
+    ngx_rbtree_node_t                tag_sentinel;
+
+    u_char                          *sketch;
+    ngx_uint_t                       sketch_mask;
+    ngx_uint_t                       sketch_samples;
+
+    ngx_atomic_t                     hits;
+    ngx_atomic_t                     stale;
+    ngx_atomic_t                     misses;
+    ngx_atomic_t                     rejected;
+    ngx_atomic_t                     evicted;
+    ngx_atomic_t                     fast_hits;
+    ngx_atomic_t                     slow_hits;
+    ngx_atomic_t                     promoted;
+    ngx_atomic_t                     demoted;
+    ngx_atomic_t                     purged;
 } ngx_http_file_cache_sh_t;
 
 
@@ -163,6 +258,17 @@ struct ngx_http_file_cache_s {
     off_t                            max_size;
     size_t                           bsize;
 
+    size_t                           memory_tier;
+    size_t                           memory_tier_entry;
+
+    ngx_path_t                      *fast_path;
+    off_t                            fast_max_size;
+    ngx_uint_t                       promote_uses;
+    u_char                          *fast_name;
+#if (NGX_THREADS || NGX_COMPAT)
+    ngx_thread_pool_t               *promote_thread_pool;
+#endif
+
     time_t                           inactive;
 
     time_t                           fail_time;
@@ -177,23 +283,56 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       manager_sleep;
     ngx_msec_t                       manager_threshold;
 
+    ngx_uint_t                       loader_shard;
+
+    ngx_str_t                        snapshot;
+    time_t                           snapshot_interval;
+    time_t                           snapshot_next;
+
     ngx_shm_zone_t                  *shm_zone;
 
     ngx_uint_t                       use_temp_path;
                                      /* unsigned use_temp_path:1 */
+
+    ngx_uint_t                       eviction;
+    ngx_uint_t                       sketch_width;
+
+    ngx_uint_t                       key_hash;
 };
 
 
+typedef struct {
+    ngx_str_t                        name;
+    off_t                            size;         /* bytes on disk */
+    ngx_uint_t                       entries;
+    ngx_atomic_uint_t                hits;
+    ngx_atomic_uint_t                stale;
+    ngx_atomic_uint_t                misses;
+    ngx_atomic_uint_t                rejected;     /* not admitted */
+    ngx_atomic_uint_t                evicted;      /* forced out */
+    ngx_atomic_uint_t                purged;
+    ngx_uint_t                       fast;         /* has a fast tier */
+    off_t                            fast_size;
+    ngx_atomic_uint_t                fast_hits;
+    ngx_atomic_uint_t                slow_hits;
+    ngx_atomic_uint_t                promoted;
+    ngx_atomic_uint_t                demoted;
+} ngx_http_file_cache_stat_t;
+
+
 ngx_int_t ngx_http_file_cache_new(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_create(ngx_http_request_t *r);
 void ngx_http_file_cache_create_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
+ngx_int_t ngx_http_file_cache_purge(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
+void ngx_http_file_cache_progress(ngx_http_request_t *r, ngx_temp_file_t *tf);
 void ngx_http_file_cache_update_header(ngx_http_request_t *r);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
+ngx_array_t *ngx_http_file_cache_stats(ngx_cycle_t *cycle, ngx_pool_t *pool);
 
 char *ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -12,6 +12,7 @@
 
 typedef struct {
     ngx_bufs_t  bufs;
+    off_t       prefetch;
 } ngx_http_copy_filter_conf_t;
 
 
@@ -45,6 +46,13 @@ static ngx_command_t  ngx_http_copy_filter_commands[] = {
       offsetof(ngx_http_copy_filter_conf_t, bufs),
       NULL },
 
+    { ngx_string("read_prefetch"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_off_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_copy_filter_conf_t, prefetch),
+      NULL },
+
       ngx_null_command
 };
 
@@ -119,6 +127,7 @@ ngx_http_copy_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
         ctx->pool = r->pool;
         ctx->bufs = conf->bufs;
+        ctx->prefetch = conf->prefetch;
         ctx->tag = (ngx_buf_tag_t) &ngx_http_copy_filter_module;
 
         ctx->output_filter = (ngx_output_chain_filter_pt)
@@ -352,6 +361,7 @@ ngx_http_copy_filter_create_conf(ngx_conf_t *cf)
     }
 
     conf->bufs.num = 0;
+    conf->prefetch = NGX_CONF_UNSET;
 
     return conf;
 }
@@ -364,6 +374,7 @@ ngx_http_copy_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_copy_filter_conf_t *conf = child;
 
     ngx_conf_merge_bufs_value(conf->bufs, prev->bufs, 2, 32768);
+    ngx_conf_merge_off_value(conf->prefetch, prev->prefetch, 0);
 
     return NULL;
 }
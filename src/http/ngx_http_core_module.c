@@ -22,8 +22,12 @@ typedef struct {
 
 
 static ngx_int_t ngx_http_core_find_location(ngx_http_request_t *r);
+#if (NGX_HAVE_MSG_ZEROCOPY)
+static void ngx_http_core_set_zerocopy(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf);
+#endif
 static ngx_int_t ngx_http_core_find_static_location(ngx_http_request_t *r,
-    ngx_http_location_tree_node_t *node);
+    ngx_http_location_trie_t *node);
 
 static ngx_int_t ngx_http_core_preconfiguration(ngx_conf_t *cf);
 static ngx_int_t ngx_http_core_postconfiguration(ngx_conf_t *cf);
@@ -40,6 +44,8 @@ static char *ngx_http_core_server(ngx_conf_t *cf, ngx_command_t *cmd,
     void *dummy);
 static char *ngx_http_core_location(ngx_conf_t *cf, ngx_command_t *cmd,
     void *dummy);
+static ngx_int_t ngx_http_core_create_shared_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, ngx_module_t *module);
 static ngx_int_t ngx_http_core_regex_location(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *clcf, ngx_str_t *regex, ngx_uint_t caseless);
 
@@ -57,10 +63,17 @@ static char *ngx_http_core_limit_except(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_set_aio(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_open_file_thread_handler(ngx_thread_task_t *task,
+    ngx_open_file_info_t *of);
+static void ngx_http_open_file_thread_event_handler(ngx_event_t *ev);
+#endif
 static char *ngx_http_core_directio(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_error_page(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_core_early_hints(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_error_log(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -72,25 +85,39 @@ static char *ngx_http_core_internal(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_http_core_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #if (NGX_HTTP_GZIP)
-static ngx_int_t ngx_http_gzip_accept_encoding(ngx_str_t *ae);
+static ngx_int_t ngx_http_gzip_allowed(ngx_http_request_t *r);
+static ngx_uint_t ngx_http_encoding_quantity(ngx_str_t *ae, ngx_str_t *name);
 static ngx_uint_t ngx_http_gzip_quantity(u_char *p, u_char *last);
 static char *ngx_http_gzip_disable(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #endif
+static ngx_int_t ngx_http_get_forwarded_addr_headers(ngx_http_request_t *r,
+    ngx_addr_t *addr, ngx_array_t *headers, ngx_str_t *value,
+    ngx_array_t *proxies, ngx_poptrie_cidrs_t *trusted, int recursive);
 static ngx_int_t ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r,
     ngx_addr_t *addr, u_char *xff, size_t xfflen, ngx_array_t *proxies,
-    int recursive);
+    ngx_poptrie_cidrs_t *trusted, int recursive);
 #if (NGX_HAVE_OPENAT)
 static char *ngx_http_disable_symlinks(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #endif
 
 static char *ngx_http_core_lowat_check(ngx_conf_t *cf, void *post, void *data);
+static char *ngx_http_core_notsent_lowat_check(ngx_conf_t *cf, void *post,
+    void *data);
+static char *ngx_http_core_pacing_rate_check(ngx_conf_t *cf, void *post,
+    void *data);
 static char *ngx_http_core_pool_size(ngx_conf_t *cf, void *post, void *data);
 
 static ngx_conf_post_t  ngx_http_core_lowat_post =
     { ngx_http_core_lowat_check };
 
+static ngx_conf_post_t  ngx_http_core_notsent_lowat_post =
+    { ngx_http_core_notsent_lowat_check };
+
+static ngx_conf_post_t  ngx_http_core_pacing_rate_post =
+    { ngx_http_core_pacing_rate_check };
+
 static ngx_conf_post_handler_pt  ngx_http_core_pool_size_p =
     ngx_http_core_pool_size;
 
@@ -174,6 +201,13 @@ static ngx_str_t  ngx_http_gzip_no_cache = ngx_string("no-cache");
 static ngx_str_t  ngx_http_gzip_no_store = ngx_string("no-store");
 static ngx_str_t  ngx_http_gzip_private = ngx_string("private");
 
+
+static ngx_str_t  ngx_http_encodings[] = {
+    ngx_string("gzip"),
+    ngx_string("br"),
+    ngx_string("zstd")
+};
+
 #endif
 
 
@@ -207,6 +241,20 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_main_conf_t, server_names_hash_bucket_size),
       NULL },
 
+    { ngx_string("server_names_hash_trie"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_core_main_conf_t, server_names_hash_trie),
+      NULL },
+
+    { ngx_string("client_body_memory_budget"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_core_main_conf_t, client_body_memory_budget),
+      NULL },
+
     { ngx_string("server"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_NOARGS,
       ngx_http_core_server,
@@ -282,6 +330,17 @@ static ngx_command_t  ngx_http_core_commands[] = {
       0,
       NULL },
 
+#if (NGX_RE2)
+
+    { ngx_string("regex_location_set"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, regex_location_set),
+      NULL },
+
+#endif
+
     { ngx_string("listen"),
       NGX_HTTP_SRV_CONF|NGX_CONF_1MORE,
       ngx_http_core_listen,
@@ -397,6 +456,24 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, sendfile),
       NULL },
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+    { ngx_string("send_zerocopy"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, send_zerocopy),
+      NULL },
+
+    { ngx_string("send_zerocopy_threshold"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, send_zerocopy_threshold),
+      NULL },
+
+#endif
+
     { ngx_string("sendfile_max_chunk"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -425,6 +502,13 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, aio_write),
       NULL },
 
+    { ngx_string("aio_open"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, aio_open),
+      NULL },
+
     { ngx_string("read_ahead"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -474,6 +558,20 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, send_lowat),
       &ngx_http_core_lowat_post },
 
+    { ngx_string("tcp_notsent_lowat"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, tcp_notsent_lowat),
+      &ngx_http_core_notsent_lowat_post },
+
+    { ngx_string("tcp_pacing_rate"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, tcp_pacing_rate),
+      &ngx_http_core_pacing_rate_post },
+
     { ngx_string("postpone_output"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -481,6 +579,13 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, postpone_output),
       NULL },
 
+    { ngx_string("pipelined_output_buffer"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, pipelined_output_buffer),
+      NULL },
+
     { ngx_string("limit_rate"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
                         |NGX_CONF_TAKE1,
@@ -659,6 +764,13 @@ static ngx_command_t  ngx_http_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("early_hints"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_core_early_hints,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("post_action"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
                         |NGX_CONF_TAKE1,
@@ -864,8 +976,13 @@ ngx_http_core_run_phases(ngx_http_request_t *r)
 
     while (ph[r->phase_handler].checker) {
 
+        ngx_probe3(http_phase_entry, r, ph[r->phase_handler].phase,
+                   r->phase_handler);
+
         rc = ph[r->phase_handler].checker(r, &ph[r->phase_handler]);
 
+        ngx_probe2(http_phase_exit, r, rc);
+
         if (rc == NGX_OK) {
             return;
         }
@@ -1191,6 +1308,17 @@ ngx_http_core_content_phase(ngx_http_request_t *r,
     ngx_str_t  path;
 
     if (r->content_handler) {
+
+        /*
+         * location handlers, such as proxy_pass, may wait long
+         * for the response, so early hints are sent before them
+         */
+
+        if (ngx_http_send_early_hints(r) == NGX_ERROR) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return NGX_OK;
+        }
+
         r->write_event_handler = ngx_http_request_empty_handler;
         ngx_http_finalize_request(r, r->content_handler(r));
         return NGX_OK;
@@ -1258,6 +1386,10 @@ ngx_http_update_location_config(ngx_http_request_t *r)
         r->connection->sendfile = 0;
     }
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    ngx_http_core_set_zerocopy(r, clcf);
+#endif
+
     if (clcf->client_body_in_file_only) {
         r->request_body_in_file_only = 1;
         r->request_body_in_persistent_file = 1;
@@ -1307,12 +1439,66 @@ ngx_http_update_location_config(ngx_http_request_t *r)
         r->connection->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
     }
 
+    if (r == r->main) {
+
+        /*
+         * a low TCP_NOTSENT_LOWAT makes writes return EAGAIN as soon as
+         * that much data is queued unsent, and write events are reported
+         * only when the queue drains below it, so large responses do not
+         * fill the socket buffer; errors are logged and otherwise ignored
+         */
+
+        (void) ngx_tcp_notsent_lowat(r->connection, clcf->tcp_notsent_lowat);
+        (void) ngx_tcp_pacing_rate(r->connection, clcf->tcp_pacing_rate);
+    }
+
     if (clcf->handler) {
         r->content_handler = clcf->handler;
     }
 }
 
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+static void
+ngx_http_core_set_zerocopy(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf)
+{
+    ngx_connection_t  *c;
+
+    c = r->connection;
+
+    if (c->zerocopy == NULL) {
+
+        if (!clcf->send_zerocopy) {
+            return;
+        }
+
+#if (NGX_HTTP_V2)
+        if (r->stream) {
+            return;
+        }
+#endif
+
+#if (NGX_HTTP_SSL)
+        if (c->ssl) {
+            return;
+        }
+#endif
+
+        c->zerocopy = ngx_pcalloc(c->pool, sizeof(ngx_zerocopy_t));
+        if (c->zerocopy == NULL) {
+            return;
+        }
+    }
+
+    c->zerocopy->enabled = clcf->send_zerocopy;
+    c->zerocopy->threshold = clcf->send_zerocopy_threshold;
+}
+
+#endif
+
+
 /*
  * NGX_OK       - exact or regex match
  * NGX_DONE     - auto redirect
@@ -1330,13 +1516,16 @@ ngx_http_core_find_location(ngx_http_request_t *r)
     ngx_int_t                  n;
     ngx_uint_t                 noregex;
     ngx_http_core_loc_conf_t  *clcf, **clcfp;
+#if (NGX_RE2)
+    u_char                    *matched;
+#endif
 
     noregex = 0;
 #endif
 
     pclcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-    rc = ngx_http_core_find_static_location(r, pclcf->static_locations);
+    rc = ngx_http_core_find_static_location(r, pclcf->static_trie);
 
     if (rc == NGX_AGAIN) {
 
@@ -1361,8 +1550,25 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
+#if (NGX_RE2)
+        matched = NULL;
+
+        if (pclcf->regex_set) {
+            matched = ngx_regex_set_match(pclcf->regex_set, &r->uri, r->pool);
+            if (matched == NULL) {
+                return NGX_ERROR;
+            }
+        }
+#endif
+
         for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
 
+#if (NGX_RE2)
+            if (matched && !matched[clcfp - pclcf->regex_locations]) {
+                continue;
+            }
+#endif
+
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "test location: ~ \"%V\"", &(*clcfp)->name);
 
@@ -1400,11 +1606,16 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
 static ngx_int_t
 ngx_http_core_find_static_location(ngx_http_request_t *r,
-    ngx_http_location_tree_node_t *node)
+    ngx_http_location_trie_t *node)
 {
-    u_char     *uri;
-    size_t      len, n;
-    ngx_int_t   rc, rv;
+    u_char                    *uri, *key;
+    size_t                     len;
+    ngx_int_t                  rv;
+    ngx_http_location_trie_t  *child;
+
+    if (node == NULL) {
+        return NGX_DECLINED;
+    }
 
     len = r->uri.len;
     uri = r->uri.data;
@@ -1413,67 +1624,78 @@ ngx_http_core_find_static_location(ngx_http_request_t *r,
 
     for ( ;; ) {
 
-        if (node == NULL) {
-            return rv;
-        }
-
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "test location: \"%*s\"",
-                       (size_t) node->len, node->name);
-
-        n = (len <= (size_t) node->len) ? len : node->len;
-
-        rc = ngx_filename_cmp(uri, node->name, n);
-
-        if (rc != 0) {
-            node = (rc < 0) ? node->left : node->right;
-
-            continue;
-        }
+        if (len == 0) {
 
-        if (len > (size_t) node->len) {
+            if (node->exact) {
+                r->loc_conf = node->exact->loc_conf;
+                return NGX_OK;
+            }
 
             if (node->inclusive) {
-
                 r->loc_conf = node->inclusive->loc_conf;
-                rv = NGX_AGAIN;
+                return NGX_AGAIN;
+            }
 
-                node = node->tree;
-                uri += n;
-                len -= n;
+            /* the "uri/" location with auto redirect */
 
-                continue;
-            }
+            key = ngx_strlchr(node->keys, node->keys + node->nchildren, '/');
 
-            /* exact only */
+            if (key) {
+                child = &node->children[key - node->keys];
 
-            node = node->right;
+                if (child->len == 1 && child->auto_redirect) {
+                    r->loc_conf = (child->exact) ? child->exact->loc_conf:
+                                                   child->inclusive->loc_conf;
+                    return NGX_DONE;
+                }
+            }
 
-            continue;
+            return rv;
         }
 
-        if (len == (size_t) node->len) {
+        if (node->inclusive) {
+            r->loc_conf = node->inclusive->loc_conf;
+            rv = NGX_AGAIN;
+        }
 
-            if (node->exact) {
-                r->loc_conf = node->exact->loc_conf;
-                return NGX_OK;
+#if (NGX_HAVE_CASELESS_FILESYSTEM)
+        key = ngx_strlchr(node->keys, node->keys + node->nchildren,
+                          ngx_tolower(*uri));
+#else
+        key = ngx_strlchr(node->keys, node->keys + node->nchildren, *uri);
+#endif
 
-            } else {
-                r->loc_conf = node->inclusive->loc_conf;
-                return NGX_AGAIN;
-            }
+        if (key == NULL) {
+            return rv;
         }
 
-        /* len < node->len */
+        child = &node->children[key - node->keys];
 
-        if (len + 1 == (size_t) node->len && node->auto_redirect) {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "test location: \"%*s\"", child->len, child->label);
 
-            r->loc_conf = (node->exact) ? node->exact->loc_conf:
-                                          node->inclusive->loc_conf;
-            rv = NGX_DONE;
+        if (len < child->len) {
+
+            if (len + 1 == child->len
+                && child->auto_redirect
+                && child->label[len] == '/'
+                && ngx_filename_cmp(uri, child->label, len) == 0)
+            {
+                r->loc_conf = (child->exact) ? child->exact->loc_conf:
+                                               child->inclusive->loc_conf;
+                return NGX_DONE;
+            }
+
+            return rv;
+        }
+
+        if (ngx_filename_cmp(uri, child->label, child->len) != 0) {
+            return rv;
         }
 
-        node = node->left;
+        uri += child->len;
+        len -= child->len;
+        node = child;
     }
 }
 
@@ -1637,6 +1859,50 @@ ngx_http_set_etag(ngx_http_request_t *r)
 }
 
 
+ngx_int_t
+ngx_http_set_file_etag(ngx_http_request_t *r, ngx_open_file_info_t *of)
+{
+    ngx_table_elt_t           *etag;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    /* the entity tag formatted by the open file cache */
+
+    if (of->etag.len == 0
+        || r->headers_out.last_modified_time != of->mtime
+        || r->headers_out.content_length_n != of->size)
+    {
+        return ngx_http_set_etag(r);
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (!clcf->etag) {
+        return NGX_OK;
+    }
+
+    etag = ngx_list_push(&r->headers_out.headers);
+    if (etag == NULL) {
+        return NGX_ERROR;
+    }
+
+    etag->hash = 1;
+    ngx_str_set(&etag->key, "ETag");
+
+    etag->value.data = ngx_pnalloc(r->pool, of->etag.len);
+    if (etag->value.data == NULL) {
+        etag->hash = 0;
+        return NGX_ERROR;
+    }
+
+    etag->value.len = of->etag.len;
+    ngx_memcpy(etag->value.data, of->etag.data, of->etag.len);
+
+    r->headers_out.etag = etag;
+
+    return NGX_OK;
+}
+
+
 void
 ngx_http_weak_etag(ngx_http_request_t *r)
 {
@@ -1780,6 +2046,74 @@ ngx_http_send_header(ngx_http_request_t *r)
 }
 
 
+ngx_int_t
+ngx_http_send_early_hints(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_str_t                  value;
+    ngx_uint_t                 i;
+    ngx_list_t                 headers;
+    ngx_table_elt_t           *h;
+    ngx_http_complex_value_t  *cv;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (clcf->early_hints == NULL
+        || r != r->main
+        || r->header_sent
+        || r->early_hints_sent
+        || r->post_action
+        || r->http_version < NGX_HTTP_VERSION_11)
+    {
+        return NGX_OK;
+    }
+
+    r->early_hints_sent = 1;
+
+    if (ngx_list_init(&headers, r->pool, clcf->early_hints->nelts,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    cv = clcf->early_hints->elts;
+
+    for (i = 0; i < clcf->early_hints->nelts; i++) {
+
+        if (ngx_http_complex_value(r, &cv[i], &value) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (value.len == 0) {
+            continue;
+        }
+
+        h = ngx_list_push(&headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = 1;
+        ngx_str_set(&h->key, "Link");
+        h->value = value;
+        h->lowcase_key = NULL;
+    }
+
+    if (headers.part.nelts == 0) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http early hints: %ui", headers.part.nelts);
+
+    rc = ngx_http_top_early_hints_filter(r, &headers);
+
+    return (rc == NGX_ERROR) ? NGX_ERROR : NGX_OK;
+}
+
+
 ngx_int_t
 ngx_http_output_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
@@ -1952,11 +2286,7 @@ ngx_http_auth_basic_user(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_gzip_ok(ngx_http_request_t *r)
 {
-    time_t                     date, expires;
-    ngx_uint_t                 p;
-    ngx_array_t               *cc;
-    ngx_table_elt_t           *e, *d, *ae;
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_table_elt_t  *ae;
 
     r->gzip_tested = 1;
 
@@ -1983,11 +2313,154 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
      */
 
     if (ngx_memcmp(ae->value.data, "gzip,", 5) != 0
-        && ngx_http_gzip_accept_encoding(&ae->value) != NGX_OK)
+        && ngx_http_encoding_quantity(&ae->value,
+                               &ngx_http_encodings[NGX_HTTP_ENCODING_GZIP])
+           == 0)
     {
         return NGX_DECLINED;
     }
 
+    if (ngx_http_gzip_allowed(r) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    r->gzip_ok = 1;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the encoding is selected if the client accepts it and none of
+ * the other registered encodings able to handle the response has
+ * a higher quantity; on a tie the encoding asked first wins
+ */
+
+ngx_int_t
+ngx_http_encoding_ok(ngx_http_request_t *r, ngx_uint_t encoding,
+    ngx_uint_t precompressed)
+{
+    ngx_uint_t                  i, q;
+    ngx_table_elt_t            *ae;
+    ngx_http_encoding_t        *enc;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    if (encoding == NGX_HTTP_ENCODING_GZIP) {
+
+        if (!r->gzip_tested) {
+            if (ngx_http_gzip_ok(r) != NGX_OK) {
+                return NGX_DECLINED;
+            }
+
+        } else if (!r->gzip_ok) {
+            return NGX_DECLINED;
+        }
+
+        ae = r->headers_in.accept_encoding;
+
+    } else {
+
+        if (r != r->main) {
+            return NGX_DECLINED;
+        }
+
+        ae = r->headers_in.accept_encoding;
+        if (ae == NULL) {
+            return NGX_DECLINED;
+        }
+
+        if (ngx_http_encoding_quantity(&ae->value,
+                                       &ngx_http_encodings[encoding])
+            == 0)
+        {
+            return NGX_DECLINED;
+        }
+
+        if (ngx_http_gzip_allowed(r) != NGX_OK) {
+            return NGX_DECLINED;
+        }
+    }
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    if (cmcf->encodings == NULL
+        || ngx_strlchr(ae->value.data, ae->value.data + ae->value.len, ';')
+           == NULL)
+    {
+        return NGX_OK;
+    }
+
+    q = ngx_http_encoding_quantity(&ae->value, &ngx_http_encodings[encoding]);
+
+    enc = cmcf->encodings->elts;
+
+    for (i = 0; i < cmcf->encodings->nelts; i++) {
+
+        if (enc[i].encoding == encoding
+            || enc[i].precompressed != precompressed)
+        {
+            continue;
+        }
+
+        if (ngx_http_encoding_quantity(&ae->value,
+                                       &ngx_http_encodings[enc[i].encoding])
+            <= q)
+        {
+            continue;
+        }
+
+        if (enc[i].handler(r) == NGX_OK) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http encoding \"%V\" preferred over \"%V\"",
+                           &ngx_http_encodings[enc[i].encoding],
+                           &ngx_http_encodings[encoding]);
+            return NGX_DECLINED;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_encoding_add(ngx_conf_t *cf, ngx_uint_t encoding,
+    ngx_uint_t precompressed, ngx_http_encoding_pt handler)
+{
+    ngx_http_encoding_t        *enc;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    if (cmcf->encodings == NULL) {
+        cmcf->encodings = ngx_array_create(cf->pool, 4,
+                                           sizeof(ngx_http_encoding_t));
+        if (cmcf->encodings == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    enc = ngx_array_push(cmcf->encodings);
+    if (enc == NULL) {
+        return NGX_ERROR;
+    }
+
+    enc->encoding = encoding;
+    enc->precompressed = precompressed;
+    enc->handler = handler;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_allowed(ngx_http_request_t *r)
+{
+    time_t                     date, expires;
+    ngx_uint_t                 p;
+    ngx_array_t               *cc;
+    ngx_table_elt_t           *e, *d;
+    ngx_http_core_loc_conf_t  *clcf;
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_in.msie6 && clcf->gzip_disable_msie6) {
@@ -2104,21 +2577,20 @@ ok:
 
 #endif
 
-    r->gzip_ok = 1;
-
     return NGX_OK;
 }
 
 
 /*
- * gzip is enabled for the following quantities:
+ * returns the encoding quantity in thousandths, the encoding is enabled
+ * for the following quantities:
  *     "gzip; q=0.001" ... "gzip; q=1.000"
- * gzip is disabled for the following quantities:
+ * the encoding is disabled for the following quantities:
  *     "gzip; q=0" ... "gzip; q=0.000", and for any invalid cases
  */
 
-static ngx_int_t
-ngx_http_gzip_accept_encoding(ngx_str_t *ae)
+static ngx_uint_t
+ngx_http_encoding_quantity(ngx_str_t *ae, ngx_str_t *name)
 {
     u_char  *p, *start, *last;
 
@@ -2126,34 +2598,37 @@ ngx_http_gzip_accept_encoding(ngx_str_t *ae)
     last = start + ae->len;
 
     for ( ;; ) {
-        p = ngx_strcasestrn(start, "gzip", 4 - 1);
+        p = ngx_strcasestrn(start, (char *) name->data, name->len - 1);
         if (p == NULL) {
-            return NGX_DECLINED;
+            return 0;
         }
 
-        if (p == start || (*(p - 1) == ',' || *(p - 1) == ' ')) {
+        if ((p == start || *(p - 1) == ',' || *(p - 1) == ' ')
+            && (p + name->len == last || p[name->len] == ','
+                || p[name->len] == ';' || p[name->len] == ' '))
+        {
             break;
         }
 
-        start = p + 4;
+        start = p + name->len;
     }
 
-    p += 4;
+    p += name->len;
 
     while (p < last) {
         switch (*p++) {
         case ',':
-            return NGX_OK;
+            return 1000;
         case ';':
             goto quantity;
         case ' ':
             continue;
         default:
-            return NGX_DECLINED;
+            return 0;
         }
     }
 
-    return NGX_OK;
+    return 1000;
 
 quantity:
 
@@ -2165,23 +2640,19 @@ quantity:
         case ' ':
             continue;
         default:
-            return NGX_DECLINED;
+            return 0;
         }
     }
 
-    return NGX_OK;
+    return 1000;
 
 equal:
 
     if (p + 2 > last || *p++ != '=') {
-        return NGX_DECLINED;
-    }
-
-    if (ngx_http_gzip_quantity(p, last) == 0) {
-        return NGX_DECLINED;
+        return 0;
     }
 
-    return NGX_OK;
+    return ngx_http_gzip_quantity(p, last);
 }
 
 
@@ -2197,16 +2668,16 @@ ngx_http_gzip_quantity(u_char *p, u_char *last)
         return 0;
     }
 
-    q = (c - '0') * 100;
+    q = c - '0';
 
     if (p == last) {
-        return q;
+        return q * 1000;
     }
 
     c = *p++;
 
     if (c == ',' || c == ' ') {
-        return q;
+        return q * 1000;
     }
 
     if (c != '.') {
@@ -2223,7 +2694,7 @@ ngx_http_gzip_quantity(u_char *p, u_char *last)
         }
 
         if (c >= '0' && c <= '9') {
-            q += c - '0';
+            q = q * 10 + c - '0';
             n++;
             continue;
         }
@@ -2231,7 +2702,15 @@ ngx_http_gzip_quantity(u_char *p, u_char *last)
         return 0;
     }
 
-    if (q > 100 || n > 3) {
+    if (n > 3) {
+        return 0;
+    }
+
+    while (n++ < 3) {
+        q *= 10;
+    }
+
+    if (q > 1000) {
         return 0;
     }
 
@@ -2701,10 +3180,117 @@ ngx_http_set_disable_symlinks(ngx_http_request_t *r,
 }
 
 
+void
+ngx_http_set_open_file_thread(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_open_file_info_t *of)
+{
+#if (NGX_THREADS)
+    if (clcf->aio == NGX_HTTP_AIO_THREADS && clcf->aio_open) {
+        of->thread_task = r->open_file_task;
+        of->thread_handler = ngx_http_open_file_thread_handler;
+        of->thread_ctx = r;
+    }
+#endif
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_open_file_thread_handler(ngx_thread_task_t *task,
+    ngx_open_file_info_t *of)
+{
+    ngx_str_t                  name;
+    ngx_thread_pool_t         *tp;
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    r = of->thread_ctx;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    tp = clcf->thread_pool;
+
+    if (tp == NULL) {
+        if (ngx_http_complex_value(r, clcf->thread_pool_value, &name)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        tp = ngx_thread_pool_get((ngx_cycle_t *) ngx_cycle, &name);
+
+        if (tp == NULL) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "thread pool \"%V\" not found", &name);
+            return NGX_ERROR;
+        }
+    }
+
+    task->event.data = r;
+    task->event.handler = ngx_http_open_file_thread_event_handler;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->open_file_task = task;
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_open_file_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http open thread: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+#endif
+
+
 ngx_int_t
 ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
     ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
     int recursive)
+{
+    return ngx_http_get_forwarded_addr_headers(r, addr, headers, value,
+                                               proxies, NULL, recursive);
+}
+
+
+ngx_int_t
+ngx_http_get_forwarded_addr_trusted(ngx_http_request_t *r, ngx_addr_t *addr,
+    ngx_array_t *headers, ngx_str_t *value, ngx_poptrie_cidrs_t *trusted,
+    int recursive)
+{
+    return ngx_http_get_forwarded_addr_headers(r, addr, headers, value,
+                                               NULL, trusted, recursive);
+}
+
+
+static ngx_int_t
+ngx_http_get_forwarded_addr_headers(ngx_http_request_t *r, ngx_addr_t *addr,
+    ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
+    ngx_poptrie_cidrs_t *trusted, int recursive)
 {
     ngx_int_t          rc;
     ngx_uint_t         i, found;
@@ -2713,7 +3299,7 @@ ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
     if (headers == NULL) {
         return ngx_http_get_forwarded_addr_internal(r, addr, value->data,
                                                     value->len, proxies,
-                                                    recursive);
+                                                    trusted, recursive);
     }
 
     i = headers->nelts;
@@ -2726,7 +3312,7 @@ ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
     while (i-- > 0) {
         rc = ngx_http_get_forwarded_addr_internal(r, addr, h[i]->value.data,
                                                   h[i]->value.len, proxies,
-                                                  recursive);
+                                                  trusted, recursive);
 
         if (!recursive) {
             break;
@@ -2750,13 +3336,21 @@ ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
 
 static ngx_int_t
 ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r, ngx_addr_t *addr,
-    u_char *xff, size_t xfflen, ngx_array_t *proxies, int recursive)
+    u_char *xff, size_t xfflen, ngx_array_t *proxies,
+    ngx_poptrie_cidrs_t *trusted, int recursive)
 {
     u_char      *p;
     ngx_int_t    rc;
     ngx_addr_t   paddr;
 
-    if (ngx_cidr_match(addr->sockaddr, proxies) != NGX_OK) {
+    if (trusted) {
+        rc = ngx_poptrie_cidrs_match(trusted, addr->sockaddr);
+
+    } else {
+        rc = ngx_cidr_match(addr->sockaddr, proxies);
+    }
+
+    if (rc != NGX_OK) {
         return NGX_DECLINED;
     }
 
@@ -2781,7 +3375,7 @@ ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r, ngx_addr_t *addr,
 
     if (recursive && p > xff) {
         rc = ngx_http_get_forwarded_addr_internal(r, addr, xff, p - 1 - xff,
-                                                  proxies, 1);
+                                                  proxies, trusted, 1);
 
         if (rc == NGX_DECLINED) {
             return NGX_DONE;
@@ -2918,6 +3512,7 @@ ngx_http_core_server(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
 
         lsopt.socklen = sizeof(struct sockaddr_in);
 
+        lsopt.type = SOCK_STREAM;
         lsopt.backlog = NGX_LISTEN_BACKLOG;
         lsopt.rcvbuf = -1;
         lsopt.sndbuf = -1;
@@ -2926,6 +3521,9 @@ ngx_http_core_server(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
 #endif
 #if (NGX_HAVE_TCP_FASTOPEN)
         lsopt.fastopen = -1;
+#endif
+#if (NGX_HAVE_BUSY_POLL)
+        lsopt.busy_poll = -1;
 #endif
         lsopt.wildcard = 1;
 
@@ -2957,10 +3555,11 @@ ngx_http_core_location(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
     size_t                     len;
     ngx_str_t                 *value, *name;
     ngx_uint_t                 i;
-    ngx_conf_t                 save;
-    ngx_http_module_t         *module;
-    ngx_http_conf_ctx_t       *ctx, *pctx;
-    ngx_http_core_loc_conf_t  *clcf, *pclcf;
+    ngx_conf_t                  save;
+    ngx_http_module_t          *module;
+    ngx_http_conf_ctx_t        *ctx, *pctx;
+    ngx_http_core_loc_conf_t   *clcf, *pclcf;
+    ngx_http_core_main_conf_t  *cmcf;
 
     ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_conf_ctx_t));
     if (ctx == NULL) {
@@ -2983,11 +3582,17 @@ ngx_http_core_location(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
         return NGX_CONF_ERROR;
     }
 
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
     for (i = 0; cf->cycle->modules[i]; i++) {
         if (cf->cycle->modules[i]->type != NGX_HTTP_MODULE) {
             continue;
         }
 
+        if (cmcf->shared_loc_conf[cf->cycle->modules[i]->ctx_index]) {
+            continue;
+        }
+
         module = cf->cycle->modules[i]->ctx;
 
         if (module->create_loc_conf) {
@@ -3226,6 +3831,7 @@ ngx_http_core_location(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
     save = *cf;
     cf->ctx = ctx;
     cf->cmd_type = NGX_HTTP_LOC_CONF;
+    cf->create_conf = ngx_http_core_create_shared_conf;
 
     rv = ngx_conf_parse(cf, NULL);
 
@@ -3235,6 +3841,44 @@ ngx_http_core_location(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
 }
 
 
+/*
+ * the loc_conf of a module registered with ngx_http_share_loc_conf()
+ * is created on the first directive of the module in the location,
+ * otherwise the location uses the loc_conf of its parent
+ */
+
+static ngx_int_t
+ngx_http_core_create_shared_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    ngx_module_t *module)
+{
+    ngx_http_module_t          *m;
+    ngx_http_conf_ctx_t        *ctx;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    if (module->type != NGX_HTTP_MODULE
+        || cmd->conf != NGX_HTTP_LOC_CONF_OFFSET)
+    {
+        return NGX_OK;
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    if (!cmcf->shared_loc_conf[module->ctx_index]) {
+        return NGX_OK;
+    }
+
+    m = module->ctx;
+    ctx = cf->ctx;
+
+    ctx->loc_conf[module->ctx_index] = m->create_loc_conf(cf);
+    if (ctx->loc_conf[module->ctx_index] == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_core_regex_location(ngx_conf_t *cf, ngx_http_core_loc_conf_t *clcf,
     ngx_str_t *regex, ngx_uint_t caseless)
@@ -3261,6 +3905,7 @@ ngx_http_core_regex_location(ngx_conf_t *cf, ngx_http_core_loc_conf_t *clcf,
     }
 
     clcf->name = *regex;
+    clcf->regex_caseless = (rc.options & NGX_REGEX_CASELESS) ? 1 : 0;
 
     return NGX_OK;
 
@@ -3401,12 +4046,20 @@ ngx_http_core_create_main_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    cmcf->shared_loc_conf = ngx_pcalloc(cf->pool, ngx_http_max_module);
+    if (cmcf->shared_loc_conf == NULL) {
+        return NULL;
+    }
+
     cmcf->server_names_hash_max_size = NGX_CONF_UNSET_UINT;
     cmcf->server_names_hash_bucket_size = NGX_CONF_UNSET_UINT;
+    cmcf->server_names_hash_trie = NGX_CONF_UNSET;
 
     cmcf->variables_hash_max_size = NGX_CONF_UNSET_UINT;
     cmcf->variables_hash_bucket_size = NGX_CONF_UNSET_UINT;
 
+    cmcf->client_body_memory_budget = NGX_CONF_UNSET_SIZE;
+
     return cmcf;
 }
 
@@ -3423,6 +4076,9 @@ ngx_http_core_init_main_conf(ngx_conf_t *cf, void *conf)
     cmcf->server_names_hash_bucket_size =
             ngx_align(cmcf->server_names_hash_bucket_size, ngx_cacheline_size);
 
+    ngx_conf_init_value(cmcf->server_names_hash_trie, 0);
+
+    ngx_conf_init_size_value(cmcf->client_body_memory_budget, 0);
 
     ngx_conf_init_uint_value(cmcf->variables_hash_max_size, 1024);
     ngx_conf_init_uint_value(cmcf->variables_hash_bucket_size, 64);
@@ -3569,6 +4225,7 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
      *     clcf->default_type = { 0, NULL };
      *     clcf->error_log = NULL;
      *     clcf->error_pages = NULL;
+     *     clcf->early_hints = NULL;
      *     clcf->client_body_path = NULL;
      *     clcf->regex = NULL;
      *     clcf->exact_match = 0;
@@ -3591,9 +4248,14 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     clcf->internal = NGX_CONF_UNSET;
     clcf->sendfile = NGX_CONF_UNSET;
     clcf->sendfile_max_chunk = NGX_CONF_UNSET_SIZE;
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    clcf->send_zerocopy = NGX_CONF_UNSET;
+    clcf->send_zerocopy_threshold = NGX_CONF_UNSET_SIZE;
+#endif
     clcf->subrequest_output_buffer_size = NGX_CONF_UNSET_SIZE;
     clcf->aio = NGX_CONF_UNSET;
     clcf->aio_write = NGX_CONF_UNSET;
+    clcf->aio_open = NGX_CONF_UNSET;
 #if (NGX_THREADS)
     clcf->thread_pool = NGX_CONF_UNSET_PTR;
     clcf->thread_pool_value = NGX_CONF_UNSET_PTR;
@@ -3605,7 +4267,10 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     clcf->tcp_nodelay = NGX_CONF_UNSET;
     clcf->send_timeout = NGX_CONF_UNSET_MSEC;
     clcf->send_lowat = NGX_CONF_UNSET_SIZE;
+    clcf->tcp_notsent_lowat = NGX_CONF_UNSET_SIZE;
+    clcf->tcp_pacing_rate = NGX_CONF_UNSET_SIZE;
     clcf->postpone_output = NGX_CONF_UNSET_SIZE;
+    clcf->pipelined_output_buffer = NGX_CONF_UNSET_SIZE;
     clcf->keepalive_timeout = NGX_CONF_UNSET_MSEC;
     clcf->keepalive_header = NGX_CONF_UNSET;
     clcf->keepalive_requests = NGX_CONF_UNSET_UINT;
@@ -3619,6 +4284,9 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     clcf->port_in_redirect = NGX_CONF_UNSET;
     clcf->msie_padding = NGX_CONF_UNSET;
     clcf->msie_refresh = NGX_CONF_UNSET;
+#if (NGX_RE2)
+    clcf->regex_location_set = NGX_CONF_UNSET;
+#endif
     clcf->log_not_found = NGX_CONF_UNSET;
     clcf->log_subrequest = NGX_CONF_UNSET;
     clcf->recursive_error_pages = NGX_CONF_UNSET;
@@ -3782,6 +4450,10 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         conf->error_pages = prev->error_pages;
     }
 
+    if (conf->early_hints == NULL) {
+        conf->early_hints = prev->early_hints;
+    }
+
     ngx_conf_merge_str_value(conf->default_type,
                               prev->default_type, "text/plain");
 
@@ -3812,11 +4484,17 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->sendfile, prev->sendfile, 0);
     ngx_conf_merge_size_value(conf->sendfile_max_chunk,
                               prev->sendfile_max_chunk, 0);
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    ngx_conf_merge_value(conf->send_zerocopy, prev->send_zerocopy, 0);
+    ngx_conf_merge_size_value(conf->send_zerocopy_threshold,
+                              prev->send_zerocopy_threshold, 16384);
+#endif
     ngx_conf_merge_size_value(conf->subrequest_output_buffer_size,
                               prev->subrequest_output_buffer_size,
                               (size_t) ngx_pagesize);
     ngx_conf_merge_value(conf->aio, prev->aio, NGX_HTTP_AIO_OFF);
     ngx_conf_merge_value(conf->aio_write, prev->aio_write, 0);
+    ngx_conf_merge_value(conf->aio_open, prev->aio_open, 0);
 #if (NGX_THREADS)
     ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
     ngx_conf_merge_ptr_value(conf->thread_pool_value, prev->thread_pool_value,
@@ -3832,8 +4510,14 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_msec_value(conf->send_timeout, prev->send_timeout, 60000);
     ngx_conf_merge_size_value(conf->send_lowat, prev->send_lowat, 0);
+    ngx_conf_merge_size_value(conf->tcp_notsent_lowat,
+                              prev->tcp_notsent_lowat, 0);
+    ngx_conf_merge_size_value(conf->tcp_pacing_rate,
+                              prev->tcp_pacing_rate, 0);
     ngx_conf_merge_size_value(conf->postpone_output, prev->postpone_output,
                               1460);
+    ngx_conf_merge_size_value(conf->pipelined_output_buffer,
+                              prev->pipelined_output_buffer, 0);
 
     if (conf->limit_rate == NULL) {
         conf->limit_rate = prev->limit_rate;
@@ -3893,6 +4577,10 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->port_in_redirect, prev->port_in_redirect, 1);
     ngx_conf_merge_value(conf->msie_padding, prev->msie_padding, 1);
     ngx_conf_merge_value(conf->msie_refresh, prev->msie_refresh, 0);
+#if (NGX_RE2)
+    ngx_conf_merge_value(conf->regex_location_set,
+                              prev->regex_location_set, 0);
+#endif
     ngx_conf_merge_value(conf->log_not_found, prev->log_not_found, 1);
     ngx_conf_merge_value(conf->log_subrequest, prev->log_subrequest, 0);
     ngx_conf_merge_value(conf->recursive_error_pages,
@@ -3989,6 +4677,7 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ngx_memzero(&lsopt, sizeof(ngx_http_listen_opt_t));
 
+    lsopt.type = SOCK_STREAM;
     lsopt.backlog = NGX_LISTEN_BACKLOG;
     lsopt.rcvbuf = -1;
     lsopt.sndbuf = -1;
@@ -4001,6 +4690,9 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #if (NGX_HAVE_TCP_FASTOPEN)
     lsopt.fastopen = -1;
 #endif
+#if (NGX_HAVE_BUSY_POLL)
+    lsopt.busy_poll = -1;
+#endif
 #if (NGX_HAVE_INET6)
     lsopt.ipv6only = 1;
 #endif
@@ -4073,6 +4765,25 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
 #endif
 
+#if (NGX_HAVE_BUSY_POLL)
+        if (ngx_strncmp(value[n].data, "busy_poll=", 10) == 0) {
+
+            /* microseconds */
+
+            lsopt.busy_poll = ngx_atoi(value[n].data + 10, value[n].len - 10);
+            lsopt.set = 1;
+            lsopt.bind = 1;
+
+            if (lsopt.busy_poll == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid busy_poll \"%V\"", &value[n]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+#endif
+
         if (ngx_strncmp(value[n].data, "backlog=", 8) == 0) {
             lsopt.backlog = ngx_atoi(value[n].data + 8, value[n].len - 8);
             lsopt.set = 1;
@@ -4213,6 +4924,19 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #endif
         }
 
+        if (ngx_strcmp(value[n].data, "quic") == 0) {
+#if (NGX_QUIC)
+            lsopt.quic = 1;
+            lsopt.type = SOCK_DGRAM;
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the \"quic\" parameter requires "
+                               "--with-quic");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (ngx_strcmp(value[n].data, "http2") == 0) {
 #if (NGX_HTTP_V2)
             lsopt.http2 = 1;
@@ -4338,6 +5062,36 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_QUIC)
+
+    if (lsopt.quic) {
+
+        /* the TLS handshake is a part of QUIC, and there are no streams */
+
+        if (lsopt.ssl) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"ssl\" parameter is incompatible "
+                               "with \"quic\"");
+            return NGX_CONF_ERROR;
+        }
+
+        if (lsopt.http2) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"http2\" parameter is incompatible "
+                               "with \"quic\"");
+            return NGX_CONF_ERROR;
+        }
+
+        if (lsopt.proxy_protocol) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"proxy_protocol\" parameter is "
+                               "incompatible with \"quic\"");
+            return NGX_CONF_ERROR;
+        }
+    }
+
+#endif
+
     for (n = 0; n < u.naddrs; n++) {
         lsopt.sockaddr = u.addrs[n].sockaddr;
         lsopt.socklen = u.addrs[n].socklen;
@@ -4834,6 +5588,48 @@ ngx_http_core_directio(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_core_early_hints(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t *clcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_uint_t                         i;
+    ngx_http_complex_value_t          *cv;
+    ngx_http_compile_complex_value_t   ccv;
+
+    if (clcf->early_hints == NULL) {
+        clcf->early_hints = ngx_array_create(cf->pool, 4,
+                                             sizeof(ngx_http_complex_value_t));
+        if (clcf->early_hints == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        cv = ngx_array_push(clcf->early_hints);
+        if (cv == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+        ccv.cf = cf;
+        ccv.value = &value[i];
+        ccv.complex_value = cv;
+
+        if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_http_core_error_page(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -4958,6 +5754,7 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_core_loc_conf_t *clcf = conf;
 
     time_t       inactive;
+    ssize_t      content;
     ngx_str_t   *value, s;
     ngx_int_t    max;
     ngx_uint_t   i;
@@ -4970,6 +5767,7 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     max = 0;
     inactive = 60;
+    content = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
 
@@ -4996,6 +5794,19 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "content=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            content = ngx_parse_size(&s);
+            if (content == NGX_ERROR) {
+                goto failed;
+            }
+
+            continue;
+        }
+
         if (ngx_strcmp(value[i].data, "off") == 0) {
 
             clcf->open_file_cache = NULL;
@@ -5022,11 +5833,13 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     clcf->open_file_cache = ngx_open_file_cache_init(cf->pool, max, inactive);
-    if (clcf->open_file_cache) {
-        return NGX_CONF_OK;
+    if (clcf->open_file_cache == NULL) {
+        return NGX_CONF_ERROR;
     }
 
-    return NGX_CONF_ERROR;
+    clcf->open_file_cache->content = content;
+
+    return NGX_CONF_OK;
 }
 
 
@@ -5334,6 +6147,40 @@ ngx_http_core_lowat_check(ngx_conf_t *cf, void *post, void *data)
 }
 
 
+static char *
+ngx_http_core_notsent_lowat_check(ngx_conf_t *cf, void *post, void *data)
+{
+#if !(NGX_HAVE_TCP_NOTSENT_LOWAT)
+    size_t *sp = data;
+
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "\"tcp_notsent_lowat\" is not supported, ignored");
+
+    *sp = 0;
+
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_core_pacing_rate_check(ngx_conf_t *cf, void *post, void *data)
+{
+#if !(NGX_HAVE_SO_MAX_PACING_RATE)
+    size_t *sp = data;
+
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "\"tcp_pacing_rate\" is not supported, ignored");
+
+    *sp = 0;
+
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_http_core_pool_size(ngx_conf_t *cf, void *post, void *data)
 {
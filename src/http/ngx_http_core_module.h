@@ -31,6 +31,11 @@ typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 #define NGX_HTTP_GZIP_PROXIED_ANY       0x0200
 
 
+#define NGX_HTTP_ENCODING_GZIP          0
+#define NGX_HTTP_ENCODING_BR            1
+#define NGX_HTTP_ENCODING_ZSTD          2
+
+
 #define NGX_HTTP_AIO_OFF                0
 #define NGX_HTTP_AIO_ON                 1
 #define NGX_HTTP_AIO_THREADS            2
@@ -61,6 +66,7 @@ typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 
 
 typedef struct ngx_http_location_tree_node_s  ngx_http_location_tree_node_t;
+typedef struct ngx_http_location_trie_s  ngx_http_location_trie_t;
 typedef struct ngx_http_core_loc_conf_s  ngx_http_core_loc_conf_t;
 
 
@@ -75,6 +81,7 @@ typedef struct {
     unsigned                   wildcard:1;
     unsigned                   ssl:1;
     unsigned                   http2:1;
+    unsigned                   quic:1;
 #if (NGX_HAVE_INET6)
     unsigned                   ipv6only:1;
 #endif
@@ -83,6 +90,7 @@ typedef struct {
     unsigned                   so_keepalive:2;
     unsigned                   proxy_protocol:1;
 
+    int                        type;
     int                        backlog;
     int                        rcvbuf;
     int                        sndbuf;
@@ -92,6 +100,9 @@ typedef struct {
 #if (NGX_HAVE_TCP_FASTOPEN)
     int                        fastopen;
 #endif
+#if (NGX_HAVE_BUSY_POLL)
+    int                        busy_poll;
+#endif
 #if (NGX_HAVE_KEEPALIVE_TUNABLE)
     int                        tcp_keepidle;
     int                        tcp_keepintvl;
@@ -140,6 +151,7 @@ struct ngx_http_phase_handler_s {
     ngx_http_phase_handler_pt  checker;
     ngx_http_handler_pt        handler;
     ngx_uint_t                 next;
+    ngx_uint_t                 phase;
 };
 
 
@@ -155,6 +167,15 @@ typedef struct {
 } ngx_http_phase_t;
 
 
+typedef ngx_int_t (*ngx_http_encoding_pt)(ngx_http_request_t *r);
+
+typedef struct {
+    ngx_uint_t                 encoding;
+    ngx_uint_t                 precompressed;
+    ngx_http_encoding_pt       handler;
+} ngx_http_encoding_t;
+
+
 typedef struct {
     ngx_array_t                servers;         /* ngx_http_core_srv_conf_t */
 
@@ -173,15 +194,28 @@ typedef struct {
 
     ngx_uint_t                 server_names_hash_max_size;
     ngx_uint_t                 server_names_hash_bucket_size;
+    ngx_flag_t                 server_names_hash_trie;
 
     ngx_uint_t                 variables_hash_max_size;
     ngx_uint_t                 variables_hash_bucket_size;
 
+    size_t                     client_body_memory_budget;
+
+    /* $request_cpu_time or status zones are used */
+    ngx_uint_t                 cpu_accounting;
+
     // NOTE: 这个是用于构造 variable_hash 散列表的初始结构体
     ngx_hash_keys_arrays_t    *variables_keys;
 
     ngx_array_t               *ports;
 
+    /* modules whose loc_conf is created only if a location sets it */
+    u_char                    *shared_loc_conf;
+
+#if (NGX_HTTP_GZIP)
+    ngx_array_t               *encodings;       /* ngx_http_encoding_t */
+#endif
+
     ngx_http_phase_t           phases[NGX_HTTP_LOG_PHASE + 1];
 } ngx_http_core_main_conf_t;
 
@@ -247,6 +281,7 @@ struct ngx_http_addr_conf_s {
 
     unsigned                   ssl:1;
     unsigned                   http2:1;
+    unsigned                   quic:1;
     unsigned                   proxy_protocol:1;
 };
 
@@ -276,6 +311,7 @@ typedef struct {
 
 typedef struct {
     ngx_int_t                  family;
+    ngx_int_t                  type;
     in_port_t                  port;
     ngx_array_t                addrs;     /* array of ngx_http_conf_addr_t */
 } ngx_http_conf_port_t;
@@ -320,6 +356,9 @@ struct ngx_http_core_loc_conf_s {
 
     unsigned      exact_match:1;
     unsigned      noregex:1;
+#if (NGX_PCRE)
+    unsigned      regex_caseless:1;
+#endif
 
     unsigned      auto_redirect:1;
 #if (NGX_HTTP_GZIP)
@@ -328,9 +367,13 @@ struct ngx_http_core_loc_conf_s {
 #endif
 
     ngx_http_location_tree_node_t   *static_locations;
+    ngx_http_location_trie_t        *static_trie;
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
 #endif
+#if (NGX_RE2)
+    ngx_regex_set_t                 *regex_set;
+#endif
 
     /* pointer to the modules' loc_conf */
     void        **loc_conf;
@@ -358,8 +401,14 @@ struct ngx_http_core_loc_conf_s {
 
     size_t        client_body_buffer_size; /* client_body_buffer_size */
     size_t        send_lowat;              /* send_lowat */
+    size_t        tcp_notsent_lowat;       /* tcp_notsent_lowat */
+    size_t        tcp_pacing_rate;         /* tcp_pacing_rate */
     size_t        postpone_output;         /* postpone_output */
+    size_t        pipelined_output_buffer; /* pipelined_output_buffer */
     size_t        sendfile_max_chunk;      /* sendfile_max_chunk */
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    size_t        send_zerocopy_threshold; /* send_zerocopy_threshold */
+#endif
     size_t        read_ahead;              /* read_ahead */
     size_t        subrequest_output_buffer_size;
                                            /* subrequest_output_buffer_size */
@@ -392,8 +441,12 @@ struct ngx_http_core_loc_conf_s {
     ngx_flag_t    sendfile;                /* sendfile */
     ngx_flag_t    aio;                     /* aio */
     ngx_flag_t    aio_write;               /* aio_write */
+    ngx_flag_t    aio_open;                /* aio_open */
     ngx_flag_t    tcp_nopush;              /* tcp_nopush */
     ngx_flag_t    tcp_nodelay;             /* tcp_nodelay */
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    ngx_flag_t    send_zerocopy;           /* send_zerocopy */
+#endif
     ngx_flag_t    reset_timedout_connection; /* reset_timedout_connection */
     ngx_flag_t    absolute_redirect;       /* absolute_redirect */
     ngx_flag_t    server_name_in_redirect; /* server_name_in_redirect */
@@ -401,6 +454,9 @@ struct ngx_http_core_loc_conf_s {
     ngx_flag_t    msie_padding;            /* msie_padding */
     ngx_flag_t    msie_refresh;            /* msie_refresh */
     ngx_flag_t    log_not_found;           /* log_not_found */
+#if (NGX_RE2)
+    ngx_flag_t    regex_location_set;      /* regex_location_set */
+#endif
     ngx_flag_t    log_subrequest;          /* log_subrequest */
     ngx_flag_t    recursive_error_pages;   /* recursive_error_pages */
     ngx_uint_t    server_tokens;           /* server_tokens */
@@ -429,6 +485,7 @@ struct ngx_http_core_loc_conf_s {
 #endif
 
     ngx_array_t  *error_pages;             /* error_page */
+    ngx_array_t  *early_hints;             /* early_hints */
 
     ngx_path_t   *client_body_temp_path;   /* client_body_temp_path */
 
@@ -476,6 +533,27 @@ struct ngx_http_location_tree_node_s {
 };
 
 
+/*
+ * a compressed radix trie of the static locations of one level, built
+ * from the location tree at configuration time: each node consumes
+ * "len" bytes of "label", children start with distinct bytes listed
+ * in "keys", so a lookup makes one pass over the URI
+ */
+
+struct ngx_http_location_trie_s {
+    ngx_http_location_trie_t        *children;
+    u_char                          *keys;
+    u_char                          *label;
+
+    ngx_http_core_loc_conf_t        *exact;
+    ngx_http_core_loc_conf_t        *inclusive;
+
+    ngx_uint_t                       nchildren;
+    size_t                           len;
+    ngx_uint_t                       auto_redirect;
+};
+
+
 void ngx_http_core_run_phases(ngx_http_request_t *r);
 ngx_int_t ngx_http_core_generic_phase(ngx_http_request_t *r,
     ngx_http_phase_handler_t *ph);
@@ -497,6 +575,8 @@ void *ngx_http_test_content_type(ngx_http_request_t *r, ngx_hash_t *types_hash);
 ngx_int_t ngx_http_set_content_type(ngx_http_request_t *r);
 void ngx_http_set_exten(ngx_http_request_t *r);
 ngx_int_t ngx_http_set_etag(ngx_http_request_t *r);
+ngx_int_t ngx_http_set_file_etag(ngx_http_request_t *r,
+    ngx_open_file_info_t *of);
 void ngx_http_weak_etag(ngx_http_request_t *r);
 ngx_int_t ngx_http_send_response(ngx_http_request_t *r, ngx_uint_t status,
     ngx_str_t *ct, ngx_http_complex_value_t *cv);
@@ -505,6 +585,10 @@ u_char *ngx_http_map_uri_to_path(ngx_http_request_t *r, ngx_str_t *name,
 ngx_int_t ngx_http_auth_basic_user(ngx_http_request_t *r);
 #if (NGX_HTTP_GZIP)
 ngx_int_t ngx_http_gzip_ok(ngx_http_request_t *r);
+ngx_int_t ngx_http_encoding_ok(ngx_http_request_t *r, ngx_uint_t encoding,
+    ngx_uint_t precompressed);
+ngx_int_t ngx_http_encoding_add(ngx_conf_t *cf, ngx_uint_t encoding,
+    ngx_uint_t precompressed, ngx_http_encoding_pt handler);
 #endif
 
 
@@ -520,6 +604,8 @@ ngx_http_cleanup_t *ngx_http_cleanup_add(ngx_http_request_t *r, size_t size);
 
 
 typedef ngx_int_t (*ngx_http_output_header_filter_pt)(ngx_http_request_t *r);
+typedef ngx_int_t (*ngx_http_output_early_hints_filter_pt)
+    (ngx_http_request_t *r, ngx_list_t *headers);
 typedef ngx_int_t (*ngx_http_output_body_filter_pt)
     (ngx_http_request_t *r, ngx_chain_t *chain);
 typedef ngx_int_t (*ngx_http_request_body_filter_pt)
@@ -534,10 +620,15 @@ ngx_int_t ngx_http_request_body_save_filter(ngx_http_request_t *r,
 
 ngx_int_t ngx_http_set_disable_symlinks(ngx_http_request_t *r,
     ngx_http_core_loc_conf_t *clcf, ngx_str_t *path, ngx_open_file_info_t *of);
+void ngx_http_set_open_file_thread(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_open_file_info_t *of);
 
 ngx_int_t ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
     ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
     int recursive);
+ngx_int_t ngx_http_get_forwarded_addr_trusted(ngx_http_request_t *r,
+    ngx_addr_t *addr, ngx_array_t *headers, ngx_str_t *value,
+    ngx_poptrie_cidrs_t *trusted, int recursive);
 
 
 extern ngx_module_t  ngx_http_core_module;
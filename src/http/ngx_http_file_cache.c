@@ -11,11 +11,18 @@
 #include <ngx_md5.h>
 
 
+static ngx_int_t ngx_http_file_cache_open_entry(ngx_http_request_t *r);
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
 static void ngx_http_file_cache_lock_wait(ngx_http_request_t *r,
     ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_stream_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_stream_wait_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_stream_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_file_cache_stream_size(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -28,8 +35,40 @@ static ngx_int_t ngx_http_cache_thread_handler(ngx_thread_task_t *task,
     ngx_file_t *file);
 static void ngx_http_cache_thread_event_handler(ngx_event_t *ev);
 #endif
+static ngx_int_t ngx_http_file_cache_mem_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_mem_store(ngx_http_request_t *r,
+    ngx_http_cache_t *c, size_t n);
+static void ngx_http_file_cache_mem_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static ngx_int_t ngx_http_file_cache_fast_open_name(ngx_http_request_t *r,
+    ngx_http_cache_t *c, ngx_str_t *name);
+static u_char *ngx_http_file_cache_fast_name(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_uint_t ngx_http_file_cache_fast_drop(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static void ngx_http_file_cache_fast_delete(ngx_http_file_cache_t *cache,
+    u_char *name);
+#if (NGX_THREADS)
+static void ngx_http_file_cache_promote(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_promote_thread(void *data, ngx_log_t *log);
+static void ngx_http_file_cache_promote_handler(ngx_event_t *ev);
+#endif
+static void ngx_http_file_cache_demote(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_sketch_init(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_sketch_add(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_uint_t ngx_http_file_cache_sketch_get(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_uint_t ngx_http_file_cache_admit(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_queue_t *ngx_http_file_cache_victim(ngx_http_file_cache_t *cache,
+    ngx_queue_t *q);
+static void ngx_http_file_cache_node_key(ngx_http_file_cache_node_t *fcn,
+    u_char *key);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
     ngx_path_t *path);
 static ngx_http_file_cache_node_t *
@@ -45,11 +84,20 @@ static ngx_int_t ngx_http_file_cache_reopen(ngx_http_request_t *r,
 static ngx_int_t ngx_http_file_cache_update_variant(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_cleanup(void *data);
+static void ngx_http_file_cache_tag(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_array_t *tags);
+static void ngx_http_file_cache_untag(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static ngx_uint_t ngx_http_file_cache_purge_node(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
 static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static ngx_queue_t *ngx_http_file_cache_last(ngx_http_file_cache_t *cache);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
     ngx_queue_t *q, u_char *name);
 static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_snapshot_read(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_snapshot_write(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static ngx_int_t ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx,
@@ -62,6 +110,9 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
+static void ngx_http_file_cache_fast_load(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_fast_file(ngx_tree_ctx_t *ctx,
+    ngx_str_t *path);
 static void ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache);
 
 
@@ -79,6 +130,45 @@ ngx_str_t  ngx_http_cache_status[] = {
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
 
+#define NGX_HTTP_FILE_CACHE_SNAPSHOT_MAGIC  0x78646e69  /* "indx" */
+#define NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH  4096
+
+
+typedef struct {
+    uint32_t                         magic;
+    uint32_t                         version;
+    size_t                           bsize;
+} ngx_http_file_cache_snapshot_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    off_t                            fs_size;
+} ngx_http_file_cache_snapshot_entry_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_http_file_cache_t           *cache;
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_file_uniq_t                  uniq;
+    ngx_file_uniq_t                  fast_uniq;
+    ngx_int_t                        rc;
+    u_char                          *from;
+    u_char                          *temp;
+    u_char                          *to;
+} ngx_http_file_cache_promote_t;
+
+#endif
+
+
+typedef struct {
+    ngx_http_file_cache_t           *cache;
+    u_char                          *name;
+} ngx_http_file_cache_fast_load_t;
+
+
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
@@ -110,18 +200,38 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             }
         }
 
+        if (cache->key_hash != ocache->key_hash) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different key_hash",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
+        if ((cache->fast_path == NULL) != (ocache->fast_path == NULL)
+            || (cache->fast_path
+                && ngx_strcmp(cache->fast_path->name.data,
+                              ocache->fast_path->name.data)
+                   != 0))
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different fast_path",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
         cache->sh = ocache->sh;
 
         cache->shpool = ocache->shpool;
         cache->bsize = ocache->bsize;
 
         cache->max_size /= cache->bsize;
+        cache->fast_max_size /= cache->bsize;
 
         if (!cache->sh->cold || cache->sh->loading) {
             cache->path->loader = NULL;
         }
 
-        return NGX_OK;
+        return ngx_http_file_cache_sketch_init(cache);
     }
 
     cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
@@ -130,6 +240,18 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         cache->sh = cache->shpool->data;
         cache->bsize = ngx_fs_bsize(cache->path->name.data);
         cache->max_size /= cache->bsize;
+        cache->fast_max_size /= cache->bsize;
+
+        if (shm_zone->shm.restored) {
+            cache->sh->rbtree.insert = ngx_http_file_cache_rbtree_insert_value;
+            cache->sh->tag_rbtree.insert = ngx_str_rbtree_insert_value;
+
+            /* the cache loader might have been interrupted */
+
+            cache->sh->loading = 0;
+            cache->sh->loaded = 0;
+            cache->sh->loaders = 0;
+        }
 
         return NGX_OK;
     }
@@ -145,16 +267,41 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
                     ngx_http_file_cache_rbtree_insert_value);
 
     ngx_queue_init(&cache->sh->queue);
+    ngx_queue_init(&cache->sh->mem_queue);
+    ngx_queue_init(&cache->sh->fast_queue);
+
+    ngx_rbtree_init(&cache->sh->tag_rbtree, &cache->sh->tag_sentinel,
+                    ngx_str_rbtree_insert_value);
 
     cache->sh->cold = 1;
     cache->sh->loading = 0;
+    cache->sh->loaded = 0;
+    cache->sh->loaders = 0;
     cache->sh->size = 0;
     cache->sh->count = 0;
     cache->sh->watermark = (ngx_uint_t) -1;
+    cache->sh->mem_size = 0;
+    cache->sh->fast_size = 0;
+
+    cache->sh->sketch = NULL;
+    cache->sh->sketch_mask = 0;
+    cache->sh->sketch_samples = 0;
+
+    cache->sh->hits = 0;
+    cache->sh->stale = 0;
+    cache->sh->misses = 0;
+    cache->sh->rejected = 0;
+    cache->sh->evicted = 0;
+    cache->sh->fast_hits = 0;
+    cache->sh->slow_hits = 0;
+    cache->sh->promoted = 0;
+    cache->sh->demoted = 0;
+    cache->sh->purged = 0;
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
     cache->max_size /= cache->bsize;
+    cache->fast_max_size /= cache->bsize;
 
     len = sizeof(" in cache keys zone \"\"") + shm_zone->shm.name.len;
 
@@ -167,6 +314,56 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
                 &shm_zone->shm.name);
 
     cache->shpool->log_nomem = 0;
+    cache->shpool->magazine = 1;
+
+    return ngx_http_file_cache_sketch_init(cache);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_sketch_init(ngx_http_file_cache_t *cache)
+{
+    size_t                     size;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+
+    if (cache->eviction == NGX_HTTP_CACHE_EVICT_TINYLFU
+        && sh->sketch
+        && sh->sketch_mask == cache->sketch_width - 1)
+    {
+        return NGX_OK;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (sh->sketch) {
+        ngx_slab_free_locked(cache->shpool, sh->sketch);
+        sh->sketch = NULL;
+    }
+
+    if (cache->eviction != NGX_HTTP_CACHE_EVICT_TINYLFU) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_OK;
+    }
+
+    size = NGX_HTTP_CACHE_SKETCH_ROWS * cache->sketch_width;
+
+    sh->sketch = ngx_slab_calloc_locked(cache->shpool, size);
+
+    if (sh->sketch) {
+        sh->sketch_mask = cache->sketch_width - 1;
+        sh->sketch_samples = 0;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (sh->sketch == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, ngx_cycle->log, 0,
+                      "could not allocate frequency sketch%s",
+                      cache->shpool->log_ctx);
+        return NGX_ERROR;
+    }
 
     return NGX_OK;
 }
@@ -227,18 +424,28 @@ ngx_http_file_cache_create(ngx_http_request_t *r)
 void
 ngx_http_file_cache_create_key(ngx_http_request_t *r)
 {
-    size_t             len;
-    ngx_str_t         *key;
-    ngx_uint_t         i;
-    ngx_md5_t          md5;
-    ngx_http_cache_t  *c;
+    size_t               len;
+    ngx_str_t           *key;
+    ngx_uint_t           i, murmur3;
+    ngx_md5_t            md5;
+    ngx_http_cache_t    *c;
+    ngx_murmur_hash3_t   mh;
 
     c = r->cache;
 
+    murmur3 = (c->file_cache
+               && c->file_cache->key_hash == NGX_HTTP_CACHE_KEY_MURMUR3);
+
     len = 0;
 
     ngx_crc32_init(c->crc32);
-    ngx_md5_init(&md5);
+
+    if (murmur3) {
+        ngx_murmur_hash3_init(&mh);
+
+    } else {
+        ngx_md5_init(&md5);
+    }
 
     key = c->keys.elts;
     for (i = 0; i < c->keys.nelts; i++) {
@@ -248,14 +455,26 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
         len += key[i].len;
 
         ngx_crc32_update(&c->crc32, key[i].data, key[i].len);
-        ngx_md5_update(&md5, key[i].data, key[i].len);
+
+        if (murmur3) {
+            ngx_murmur_hash3_update(&mh, key[i].data, key[i].len);
+
+        } else {
+            ngx_md5_update(&md5, key[i].data, key[i].len);
+        }
     }
 
     c->header_start = sizeof(ngx_http_file_cache_header_t)
                       + sizeof(ngx_http_file_cache_key) + len + 1;
 
     ngx_crc32_final(c->crc32);
-    ngx_md5_final(c->key, &md5);
+
+    if (murmur3) {
+        ngx_murmur_hash3_final(c->key, &mh);
+
+    } else {
+        ngx_md5_final(c->key, &md5);
+    }
 
     ngx_memcpy(c->main, c->key, NGX_HTTP_CACHE_KEY_LEN);
 }
@@ -263,8 +482,50 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
 
 ngx_int_t
 ngx_http_file_cache_open(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_http_file_cache_sh_t  *sh;
+
+    ngx_probe1(http_cache_lookup_start, r);
+
+    rc = ngx_http_file_cache_open_entry(r);
+
+    ngx_probe2(http_cache_lookup_done, r, rc);
+
+    sh = r->cache->file_cache->sh;
+
+    switch (rc) {
+
+    case NGX_OK:
+        (void) ngx_atomic_fetch_add(&sh->hits, 1);
+
+        if (r->cache->file_cache->fast_path && !r->cache->memory) {
+            (void) ngx_atomic_fetch_add(r->cache->fast ? &sh->fast_hits
+                                                       : &sh->slow_hits, 1);
+        }
+
+        break;
+
+    case NGX_HTTP_CACHE_STALE:
+    case NGX_HTTP_CACHE_UPDATING:
+        (void) ngx_atomic_fetch_add(&sh->stale, 1);
+        break;
+
+    case NGX_DECLINED:
+    case NGX_HTTP_CACHE_SCARCE:
+        (void) ngx_atomic_fetch_add(&sh->misses, 1);
+        break;
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_open_entry(ngx_http_request_t *r)
 {
     ngx_int_t                  rc, rv;
+    ngx_str_t                  name;
     ngx_uint_t                 test;
     ngx_http_cache_t          *c;
     ngx_pool_cleanup_t        *cln;
@@ -284,6 +545,14 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
 
     cache = c->file_cache;
 
+    if (c->opening) {
+
+        /* the file was being opened in a thread */
+
+        rv = NGX_DECLINED;
+        goto open;
+    }
+
     if (c->node == NULL) {
         cln = ngx_pool_cleanup_add(r->pool, 0);
         if (cln == NULL) {
@@ -319,7 +588,7 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
 
     } else { /* rc == NGX_DECLINED */
 
-        test = cache->sh->cold ? 1 : 0;
+        test = (cache->sh->cold && !c->purged) ? 1 : 0;
 
         if (c->min_uses > 1) {
 
@@ -343,20 +612,72 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (c->exists && cache->memory_tier) {
+        rc = ngx_http_file_cache_mem_open(r, c);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
+open:
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
 
-    of.uniq = c->uniq;
+    if (c->fast) {
+        if (ngx_http_file_cache_fast_open_name(r, c, &name) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        of.uniq = c->fast_uniq;
+
+    } else {
+        name = c->file.name;
+        of.uniq = c->uniq;
+    }
+
     of.valid = clcf->open_file_cache_valid;
     of.min_uses = clcf->open_file_cache_min_uses;
     of.events = clcf->open_file_cache_events;
     of.directio = NGX_OPEN_FILE_DIRECTIO_OFF;
     of.read_ahead = clcf->read_ahead;
 
-    if (ngx_open_cached_file(clcf->open_file_cache, &c->file.name, &of, r->pool)
-        != NGX_OK)
-    {
+    if (rv == NGX_DECLINED) {
+        ngx_http_set_open_file_thread(r, clcf, &of);
+    }
+
+    rc = ngx_open_cached_file(clcf->open_file_cache, &name, &of, r->pool);
+
+    c->opening = (rc == NGX_AGAIN);
+
+    if (rc == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
+
+    if (rc != NGX_OK && c->fast && of.err) {
+
+        /* the copy in the fast tier is unusable, the cache file is used */
+
+        if (of.err != NGX_ENOENT && of.err != NGX_ENOTDIR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, of.err,
+                          ngx_open_file_n " \"%s\" failed", name.data);
+        }
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        if (c->node->fast && c->node->fast_uniq == c->fast_uniq) {
+            (void) ngx_http_file_cache_fast_drop(cache, c->node);
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        c->fast = 0;
+        goto open;
+    }
+
+    if (rc != NGX_OK) {
         switch (of.err) {
 
         case 0:
@@ -368,17 +689,21 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
 
         default:
             ngx_log_error(NGX_LOG_CRIT, r->connection->log, of.err,
-                          ngx_open_file_n " \"%s\" failed", c->file.name.data);
+                          ngx_open_file_n " \"%s\" failed", name.data);
             return NGX_ERROR;
         }
     }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache fd: %d", of.fd);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache fd: %d f:%d", of.fd, c->fast);
 
     c->file.fd = of.fd;
     c->file.log = r->connection->log;
-    c->uniq = of.uniq;
+
+    if (!c->fast) {
+        c->uniq = of.uniq;
+    }
+
     c->length = of.size;
     c->fs_size = (of.fs_size + cache->bsize - 1) / cache->bsize;
 
@@ -402,6 +727,7 @@ done:
 static ngx_int_t
 ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
+    ngx_int_t                  rc;
     ngx_msec_t                 now, timer;
     ngx_http_file_cache_t     *cache;
 
@@ -422,18 +748,33 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->node->lock_time = now + c->lock_age;
         c->updating = 1;
         c->lock_time = c->node->lock_time;
+
+    } else if (c->read_while_write && c->node->filling && r == r->main) {
+        c->fill_temp = c->node->fill_temp;
+        c->length = c->node->fill_size;
+        c->streaming = 1;
     }
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache lock u:%d wt:%M",
-                   c->updating, c->wait_time);
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache lock u:%d s:%d wt:%M",
+                   c->updating, c->streaming, c->wait_time);
 
     if (c->updating) {
         return NGX_DECLINED;
     }
 
+    if (c->streaming) {
+        rc = ngx_http_file_cache_stream_open(r, c);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+
+        c->streaming = 0;
+    }
+
     if (c->lock_timeout == 0) {
         return NGX_HTTP_CACHE_SCARCE;
     }
@@ -503,7 +844,9 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     timer = c->node->lock_time - now;
 
-    if (c->node->updating && (ngx_msec_int_t) timer > 0) {
+    if (c->node->updating && (ngx_msec_int_t) timer > 0
+        && !(c->read_while_write && c->node->filling))
+    {
         wait = 1;
     }
 
@@ -523,108 +866,339 @@ wakeup:
 
 
 static ngx_int_t
-ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+ngx_http_file_cache_stream_open(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    u_char                        *p;
-    time_t                         now;
-    ssize_t                        n;
-    ngx_str_t                     *key;
-    ngx_int_t                      rc;
-    ngx_uint_t                     i;
-    ngx_http_file_cache_t         *cache;
-    ngx_http_file_cache_header_t  *h;
+    ngx_fd_t                  fd;
+    ngx_err_t                 err;
+    ngx_str_t                 name;
+    ngx_pool_cleanup_t       *cln;
+    ngx_pool_cleanup_file_t  *clnf;
 
-    n = ngx_http_file_cache_aio_read(r, c);
+    /* the temporary file is created next to the cache file */
 
-    if (n < 0) {
-        return n;
-    }
+    name.len = c->file.name.len + 1 + 10;
 
-    if ((size_t) n < c->header_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" is too small", c->file.name.data);
-        return NGX_DECLINED;
+    name.data = ngx_pnalloc(r->pool, name.len + 1);
+    if (name.data == NULL) {
+        return NGX_ERROR;
     }
 
-    h = (ngx_http_file_cache_header_t *) c->buf->pos;
+    (void) ngx_sprintf(name.data, "%V.%010uD%Z", &c->file.name, c->fill_temp);
 
-    if (h->version != NGX_HTTP_CACHE_VERSION) {
-        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
-                      "cache file \"%s\" version mismatch", c->file.name.data);
-        return NGX_DECLINED;
-    }
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache stream: \"%s\" %O",
+                   name.data, c->length);
 
-    if (h->crc32 != c->crc32 || (size_t) h->header_start != c->header_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has md5 collision", c->file.name.data);
-        return NGX_DECLINED;
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
     }
 
-    p = c->buf->pos + sizeof(ngx_http_file_cache_header_t)
-        + sizeof(ngx_http_file_cache_key);
+    fd = ngx_open_file(name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err == NGX_ENOENT) {
+
+            /* the entry has been completed or discarded just now */
 
-    key = c->keys.elts;
-    for (i = 0; i < c->keys.nelts; i++) {
-        if (ngx_memcmp(p, key[i].data, key[i].len) != 0) {
-            ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                          "cache file \"%s\" has md5 collision",
-                          c->file.name.data);
             return NGX_DECLINED;
         }
 
-        p += key[i].len;
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
+                      ngx_open_file_n " \"%s\" failed", name.data);
+        return NGX_ERROR;
     }
 
-    if ((size_t) h->body_start > c->body_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has too long header",
-                      c->file.name.data);
-        return NGX_DECLINED;
-    }
+    cln->handler = ngx_pool_cleanup_file;
+    clnf = cln->data;
 
-    if (h->vary_len > NGX_HTTP_CACHE_VARY_LEN) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has incorrect vary length",
-                      c->file.name.data);
-        return NGX_DECLINED;
-    }
+    clnf->fd = fd;
+    clnf->name = name.data;
+    clnf->log = r->pool->log;
 
-    if (h->vary_len) {
-        ngx_http_file_cache_vary(r, h->vary, h->vary_len, c->variant);
+    c->file.fd = fd;
+    c->file.log = r->connection->log;
 
-        if (ngx_memcmp(c->variant, h->variant, NGX_HTTP_CACHE_KEY_LEN) != 0) {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "http file cache vary mismatch");
-            return ngx_http_file_cache_reopen(r, c);
-        }
+    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
     }
 
-    c->buf->last += n;
+    return ngx_http_file_cache_read(r, c);
+}
 
-    c->valid_sec = h->valid_sec;
-    c->updating_sec = h->updating_sec;
-    c->error_sec = h->error_sec;
-    c->last_modified = h->last_modified;
-    c->date = h->date;
-    c->valid_msec = h->valid_msec;
-    c->body_start = h->body_start;
-    c->etag.len = h->etag_len;
-    c->etag.data = h->etag;
 
-    r->cached = 1;
+static void
+ngx_http_file_cache_stream_wait_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
 
-    cache = c->file_cache;
+    r = ev->data;
+    c = r->connection;
 
-    if (cache->sh->cold) {
+    ngx_http_set_log_request(c->log, r);
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_http_file_cache_stream_handler(r);
 
-        if (!c->node->exists) {
-            c->node->uses = 1;
-            c->node->body_start = c->body_start;
-            c->node->exists = 1;
-            c->node->uniq = c->uniq;
-            c->node->fs_size = c->fs_size;
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_file_cache_stream_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_buf_t                 *b;
+    ngx_chain_t                out;
+    ngx_event_t               *wev;
+    ngx_http_cache_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = r->cache;
+    b = c->stream_buf;
+    wev = r->connection->write;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache stream handler: %O-%O",
+                   b->file_pos, b->file_last);
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        r->connection->timedout = 1;
+
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (wev->delayed || r->aio) {
+        goto wait;
+    }
+
+    if (b->file_pos < b->file_last) {
+        rc = ngx_http_output_filter(r, NULL);
+
+    } else {
+        rc = ngx_http_file_cache_stream_size(r, c);
+
+        if (rc == NGX_ERROR) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        if (rc == NGX_OK && c->length == b->file_last) {
+
+            /* nothing new has been written yet */
+
+            if (wev->timer_set) {
+                ngx_del_timer(wev);
+            }
+
+            ngx_add_timer(&c->wait_event, NGX_HTTP_CACHE_STREAM_POLL);
+            return;
+        }
+
+        b->file_pos = b->file_last;
+        b->file_last = c->length;
+
+        b->in_file = (b->file_last > b->file_pos) ? 1 : 0;
+        b->last_buf = (rc == NGX_DONE) ? 1 : 0;
+        b->flush = 1;
+
+        out.buf = b;
+        out.next = NULL;
+
+        rc = ngx_http_output_filter(r, &out);
+    }
+
+    if (rc == NGX_ERROR || b->last_buf) {
+        ngx_http_finalize_request(r, rc);
+        return;
+    }
+
+    if (b->file_pos == b->file_last
+        && !r->buffered && !r->connection->buffered)
+    {
+        if (wev->timer_set) {
+            ngx_del_timer(wev);
+        }
+
+        ngx_add_timer(&c->wait_event, NGX_HTTP_CACHE_STREAM_POLL);
+        return;
+    }
+
+wait:
+
+    if (!wev->delayed) {
+        ngx_add_timer(wev, clcf->send_timeout);
+    }
+
+    if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_stream_size(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    off_t                   size;
+    ngx_uint_t              filling;
+    ngx_http_file_cache_t  *cache;
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    filling = c->node->filling;
+    size = c->node->fill_size;
+
+    if (c->node->fill_temp != c->fill_temp) {
+        filling = 0;
+        size = -1;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (size < c->length) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cache file \"%s\" was not completed",
+                      c->file.name.data);
+        return NGX_ERROR;
+    }
+
+    c->length = size;
+
+    return filling ? NGX_OK : NGX_DONE;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    u_char                        *p;
+    time_t                         now;
+    ssize_t                        n;
+    ngx_str_t                     *key;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_header_t  *h;
+
+    if (c->memory) {
+        /* the whole entry was copied from the memory tier */
+        n = c->length;
+
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);
+
+        if (n < 0) {
+            return n;
+        }
+    }
+
+    if ((size_t) n < c->header_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" is too small", c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    h = (ngx_http_file_cache_header_t *) c->buf->pos;
+
+    if (h->version != NGX_HTTP_CACHE_VERSION) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "cache file \"%s\" version mismatch", c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    if (h->crc32 != c->crc32 || (size_t) h->header_start != c->header_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has md5 collision", c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    p = c->buf->pos + sizeof(ngx_http_file_cache_header_t)
+        + sizeof(ngx_http_file_cache_key);
+
+    key = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        if (ngx_memcmp(p, key[i].data, key[i].len) != 0) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                          "cache file \"%s\" has md5 collision",
+                          c->file.name.data);
+            return NGX_DECLINED;
+        }
+
+        p += key[i].len;
+    }
+
+    if ((size_t) h->body_start > c->body_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has too long header",
+                      c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    if (h->vary_len > NGX_HTTP_CACHE_VARY_LEN) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has incorrect vary length",
+                      c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    if (h->vary_len) {
+        ngx_http_file_cache_vary(r, h->vary, h->vary_len, c->variant);
+
+        if (ngx_memcmp(c->variant, h->variant, NGX_HTTP_CACHE_KEY_LEN) != 0) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache vary mismatch");
+
+            if (c->streaming) {
+                return NGX_DECLINED;
+            }
+
+            return ngx_http_file_cache_reopen(r, c);
+        }
+    }
+
+    c->buf->last += n;
+
+    c->valid_sec = h->valid_sec;
+    c->updating_sec = h->updating_sec;
+    c->error_sec = h->error_sec;
+    c->last_modified = h->last_modified;
+    c->date = h->date;
+    c->valid_msec = h->valid_msec;
+    c->body_start = h->body_start;
+    c->etag.len = h->etag_len;
+    c->etag.data = h->etag;
+
+    r->cached = 1;
+
+    cache = c->file_cache;
+
+    if (c->streaming) {
+
+        /* the entry is being written and thus is fresh */
+
+        return NGX_OK;
+    }
+
+    if (cache->sh->cold) {
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        if (!c->node->exists) {
+            c->node->uses = 1;
+            c->node->body_start = c->body_start;
+            c->node->exists = 1;
+            c->node->uniq = c->uniq;
+            c->node->fs_size = c->fs_size;
 
             cache->sh->size += c->fs_size;
         }
@@ -659,6 +1233,16 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    if (cache->memory_tier && !c->memory) {
+        ngx_http_file_cache_mem_store(r, c, n);
+    }
+
+#if (NGX_THREADS)
+    if (cache->fast_path && !c->fast && !c->memory) {
+        ngx_http_file_cache_promote(r, c);
+    }
+#endif
+
     return NGX_OK;
 }
 
@@ -817,63 +1401,629 @@ ngx_http_cache_thread_event_handler(ngx_event_t *ev)
 
 
 static ngx_int_t
-ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+ngx_http_file_cache_mem_open(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_int_t                    rc;
+    size_t                       len;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_mem_t   *m;
     ngx_http_file_cache_node_t  *fcn;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
-
+    cache = c->file_cache;
     fcn = c->node;
 
-    if (fcn == NULL) {
-        fcn = ngx_http_file_cache_lookup(cache, c->key);
+    ngx_shmtx_lock(&cache->shpool->mutex);
+    m = fcn->mem;
+    len = m ? m->len : 0;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (m == NULL) {
+        return NGX_DECLINED;
     }
 
-    if (fcn) {
-        ngx_queue_remove(&fcn->queue);
+    /* the buffer is reused on vary mismatch, thus at least body_start */
 
-        if (c->node == NULL) {
-            fcn->uses++;
-            fcn->count++;
-        }
+    c->buf = ngx_create_temp_buf(r->pool, ngx_max(len, c->body_start));
+    if (c->buf == NULL) {
+        return NGX_ERROR;
+    }
 
-        if (fcn->error) {
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-            if (fcn->valid_sec < ngx_time()) {
-                goto renew;
-            }
+    m = fcn->mem;
 
-            rc = NGX_OK;
+    if (m == NULL || m->len != len) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
 
-            goto done;
-        }
+    ngx_queue_remove(&m->queue);
+    ngx_queue_insert_head(&cache->sh->mem_queue, &m->queue);
 
-        if (fcn->exists || fcn->uses >= c->min_uses) {
+    ngx_memcpy(c->buf->pos, m->data, len);
 
-            c->exists = fcn->exists;
-            if (fcn->body_start) {
-                c->body_start = fcn->body_start;
-            }
+    c->uniq = fcn->uniq;
+    c->fs_size = fcn->fs_size;
 
-            rc = NGX_OK;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-            goto done;
-        }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache memory hit: %uz", len);
 
-        rc = NGX_AGAIN;
+    c->memory = 1;
+    c->length = len;
+    c->file.fd = NGX_INVALID_FILE;
+    c->file.log = r->connection->log;
 
-        goto done;
-    }
+    return ngx_http_file_cache_read(r, c);
+}
 
-    fcn = ngx_slab_calloc_locked(cache->shpool,
-                                 sizeof(ngx_http_file_cache_node_t));
-    if (fcn == NULL) {
-        ngx_http_file_cache_set_watermark(cache);
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+static void
+ngx_http_file_cache_mem_store(ngx_http_request_t *r, ngx_http_cache_t *c,
+    size_t n)
+{
+    u_char                      *p;
+    size_t                       len;
+    ssize_t                      rc;
+    ngx_uint_t                   hot, tries;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_mem_t   *m;
+    ngx_http_file_cache_node_t  *fcn;
 
-        (void) ngx_http_file_cache_forced_expire(cache);
+    cache = c->file_cache;
+    fcn = c->node;
+    len = (size_t) c->length;
+
+    if (c->length > (off_t) cache->memory_tier_entry) {
+        return;
+    }
+
+    /*
+     * an entry is promoted to memory once it is hit more times
+     * than needed to be cached at all
+     */
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+    hot = (fcn->mem == NULL && fcn->uses > c->min_uses);
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (!hot) {
+        return;
+    }
+
+    if (n < len) {
+
+        /* read the rest of a small file synchronously */
+
+        p = ngx_pnalloc(r->pool, len);
+        if (p == NULL) {
+            return;
+        }
+
+        ngx_memcpy(p, c->buf->pos, n);
+
+        rc = ngx_read_file(&c->file, p + n, len - n, n);
+
+        if (rc == NGX_ERROR || (size_t) rc != len - n) {
+            return;
+        }
+
+    } else {
+        p = c->buf->pos;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (fcn->mem || !fcn->exists || fcn->uniq != c->uniq) {
+        goto done;
+    }
+
+    /* demote least recently used entries to stay within the limit */
+
+    while (cache->sh->mem_size + len > cache->memory_tier
+           && !ngx_queue_empty(&cache->sh->mem_queue))
+    {
+        q = ngx_queue_last(&cache->sh->mem_queue);
+        m = ngx_queue_data(q, ngx_http_file_cache_mem_t, queue);
+
+        ngx_http_file_cache_mem_free(cache, m->node);
+    }
+
+    for (tries = 0; /* void */ ; tries++) {
+
+        m = ngx_slab_alloc_locked(cache->shpool,
+                                  offsetof(ngx_http_file_cache_mem_t, data)
+                                  + len);
+        if (m) {
+            break;
+        }
+
+        if (tries == 2 || ngx_queue_empty(&cache->sh->mem_queue)) {
+            goto done;
+        }
+
+        q = ngx_queue_last(&cache->sh->mem_queue);
+        m = ngx_queue_data(q, ngx_http_file_cache_mem_t, queue);
+
+        ngx_http_file_cache_mem_free(cache, m->node);
+    }
+
+    m->node = fcn;
+    m->len = len;
+    ngx_memcpy(m->data, p, len);
+
+    ngx_queue_insert_head(&cache->sh->mem_queue, &m->queue);
+    cache->sh->mem_size += len;
+
+    fcn->mem = m;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache memory store: %uz", len);
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static void
+ngx_http_file_cache_mem_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_http_file_cache_mem_t  *m;
+
+    m = fcn->mem;
+
+    if (m == NULL) {
+        return;
+    }
+
+    ngx_queue_remove(&m->queue);
+    cache->sh->mem_size -= m->len;
+
+    ngx_slab_free_locked(cache->shpool, m);
+
+    fcn->mem = NULL;
+}
+
+
+/*
+ * The fast tier keeps copies of popular entries on a faster filesystem,
+ * with the same levels as the cache path.  An entry always has its file
+ * in the cache path; once it has been read "promote_uses" times, the file
+ * is copied in a thread pool, and the node records that the copy exists.
+ * Any change of the cache file drops the copy, and the cache manager
+ * drops the least recently used copies over "fast_max_size".
+ */
+
+static ngx_int_t
+ngx_http_file_cache_fast_open_name(ngx_http_request_t *r, ngx_http_cache_t *c,
+    ngx_str_t *name)
+{
+    ngx_path_t             *path;
+    ngx_http_file_cache_t  *cache;
+
+    cache = c->file_cache;
+    path = cache->fast_path;
+
+    name->len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name->data = ngx_pnalloc(r->pool, name->len + 1);
+    if (name->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(name->data, ngx_http_file_cache_fast_name(cache, c->key),
+               name->len + 1);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "cache fast file: \"%s\"", name->data);
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_file_cache_fast_name(ngx_http_file_cache_t *cache, u_char *key)
+{
+    u_char      *p;
+    size_t       len;
+    ngx_path_t  *path;
+
+    path = cache->fast_path;
+
+    p = cache->fast_name + path->name.len + 1 + path->len;
+    p = ngx_hex_dump(p, key, NGX_HTTP_CACHE_KEY_LEN);
+    *p = '\0';
+
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    ngx_create_hashed_filename(path, cache->fast_name, len);
+
+    return cache->fast_name;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_fast_drop(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    u_char  key[NGX_HTTP_CACHE_KEY_LEN];
+
+    /*
+     * called with the zone locked; returns 1 if the copy in the fast tier
+     * is to be deleted, its name is then in cache->fast_name
+     */
+
+    if (fcn->promoting) {
+        fcn->fast_stale = 1;
+    }
+
+    if (!fcn->fast) {
+        return 0;
+    }
+
+    ngx_queue_remove(&fcn->fast_queue);
+    cache->sh->fast_size -= fcn->fs_size;
+
+    fcn->fast = 0;
+    fcn->fast_uniq = 0;
+
+    ngx_http_file_cache_node_key(fcn, key);
+    (void) ngx_http_file_cache_fast_name(cache, key);
+
+    return 1;
+}
+
+
+static void
+ngx_http_file_cache_fast_delete(ngx_http_file_cache_t *cache, u_char *name)
+{
+    ngx_err_t  err;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache fast delete: \"%s\"", name);
+
+    if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
+    }
+}
+
+
+#if (NGX_THREADS)
+
+static void
+ngx_http_file_cache_promote(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    u_char                         *p;
+    size_t                          len;
+    ngx_thread_task_t              *task;
+    ngx_http_file_cache_t          *cache;
+    ngx_http_file_cache_node_t     *fcn;
+    ngx_http_file_cache_promote_t  *ctx;
+
+    cache = c->file_cache;
+    fcn = c->node;
+
+    if (c->fs_size > cache->fast_max_size) {
+        return;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (fcn->fast
+        || fcn->promoting
+        || !fcn->exists
+        || fcn->purged
+        || fcn->uses < cache->promote_uses
+        || (fcn->uniq && fcn->uniq != c->uniq))
+    {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    fcn->promoting = 1;
+    fcn->fast_stale = 0;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    len = cache->fast_path->name.len + 1 + cache->fast_path->len
+          + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    task = ngx_calloc(sizeof(ngx_thread_task_t)
+                      + sizeof(ngx_http_file_cache_promote_t)
+                      + c->file.name.len + 1 + len + 1 + len + 1 + 10,
+                      r->connection->log);
+    if (task == NULL) {
+        goto failed;
+    }
+
+    ctx = (ngx_http_file_cache_promote_t *) (task + 1);
+
+    ctx->cache = cache;
+    ngx_memcpy(ctx->key, c->key, NGX_HTTP_CACHE_KEY_LEN);
+    ctx->uniq = fcn->uniq;
+
+    p = (u_char *) (ctx + 1);
+
+    ctx->from = p;
+    p = ngx_cpymem(p, c->file.name.data, c->file.name.len + 1);
+
+    ctx->to = p;
+    p = ngx_cpymem(p, ngx_http_file_cache_fast_name(cache, c->key), len + 1);
+
+    /* the same suffix as temporary files in the cache have */
+
+    ctx->temp = p;
+    (void) ngx_sprintf(p, "%s.%010uD%Z", ctx->to,
+                       (uint32_t) ngx_next_temp_number(0));
+
+    task->ctx = ctx;
+    task->handler = ngx_http_file_cache_promote_thread;
+    task->event.data = task;
+    task->event.handler = ngx_http_file_cache_promote_handler;
+    task->event.log = ngx_cycle->log;
+
+    if (ngx_thread_task_post(cache->promote_thread_pool, task) != NGX_OK) {
+        ngx_free(task);
+        goto failed;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache promote: \"%s\"", ctx->to);
+
+    return;
+
+failed:
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+    fcn->promoting = 0;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static void
+ngx_http_file_cache_promote_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_file_cache_promote_t  *ctx = data;
+
+    ngx_err_t        err;
+    ngx_copy_file_t  cf;
+    ngx_file_info_t  fi;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http file cache promote thread: \"%s\"", ctx->from);
+
+    ctx->rc = NGX_ERROR;
+
+    err = ngx_create_full_path(ctx->temp,
+                               ngx_dir_access(NGX_FILE_OWNER_ACCESS));
+    if (err) {
+        ngx_log_error(NGX_LOG_CRIT, log, err,
+                      ngx_create_dir_n " \"%s\" failed", ctx->temp);
+        return;
+    }
+
+    /* the copy keeps the modification time, see the loader */
+
+    cf.size = -1;
+    cf.buf_size = 0;
+    cf.access = NGX_FILE_OWNER_ACCESS;
+    cf.time = -1;
+    cf.log = log;
+
+    if (ngx_copy_file(ctx->from, ctx->temp, &cf) != NGX_OK) {
+        goto failed;
+    }
+
+    if (ngx_rename_file(ctx->temp, ctx->to) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      ctx->temp, ctx->to);
+        goto failed;
+    }
+
+    if (ngx_file_info(ctx->to, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_file_info_n " \"%s\" failed", ctx->to);
+        return;
+    }
+
+    ctx->fast_uniq = ngx_file_uniq(&fi);
+    ctx->rc = NGX_OK;
+
+    return;
+
+failed:
+
+    if (ngx_delete_file(ctx->temp) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_delete_file_n " \"%s\" failed", ctx->temp);
+        }
+    }
+}
+
+
+static void
+ngx_http_file_cache_promote_handler(ngx_event_t *ev)
+{
+    ngx_uint_t                      discard;
+    ngx_thread_task_t              *task;
+    ngx_http_file_cache_t          *cache;
+    ngx_http_file_cache_node_t     *fcn;
+    ngx_http_file_cache_promote_t  *ctx;
+
+    task = ev->data;
+    ctx = task->ctx;
+    cache = ctx->cache;
+
+    discard = (ctx->rc == NGX_OK);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /*
+     * the node is looked up again, as it may have been deleted meanwhile;
+     * a copy of a file which was changed during the promotion is useless
+     */
+
+    fcn = ngx_http_file_cache_lookup(cache, ctx->key);
+
+    if (fcn && fcn->promoting) {
+
+        if (ctx->rc == NGX_OK
+            && !fcn->fast_stale
+            && !fcn->fast
+            && fcn->exists
+            && fcn->uniq == ctx->uniq)
+        {
+            fcn->fast = 1;
+            fcn->fast_uniq = ctx->fast_uniq;
+
+            ngx_queue_insert_head(&cache->sh->fast_queue, &fcn->fast_queue);
+            cache->sh->fast_size += fcn->fs_size;
+
+            (void) ngx_atomic_fetch_add(&cache->sh->promoted, 1);
+
+            discard = 0;
+        }
+
+        fcn->promoting = 0;
+        fcn->fast_stale = 0;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http file cache promote done: \"%s\" d:%ui",
+                   ctx->to, discard);
+
+    if (discard) {
+        ngx_http_file_cache_fast_delete(cache, ctx->to);
+    }
+
+    ngx_free(task);
+}
+
+#endif
+
+
+static void
+ngx_http_file_cache_demote(ngx_http_file_cache_t *cache)
+{
+    ngx_uint_t                   fast;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+
+    for ( ;; ) {
+
+        if (ngx_quit || ngx_terminate) {
+            return;
+        }
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        if (cache->sh->fast_size <= cache->fast_max_size
+            || ngx_queue_empty(&cache->sh->fast_queue))
+        {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->fast_queue);
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, fast_queue);
+
+        fast = ngx_http_file_cache_fast_drop(cache, fcn);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (fast) {
+            (void) ngx_atomic_fetch_add(&cache->sh->demoted, 1);
+            ngx_http_file_cache_fast_delete(cache, cache->fast_name);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_int_t                    rc;
+    ngx_uint_t                   fast;
+    ngx_http_file_cache_node_t  *fcn;
+
+    fast = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = c->node;
+
+    if (fcn == NULL) {
+        fcn = ngx_http_file_cache_lookup(cache, c->key);
+    }
+
+    if (fcn) {
+        ngx_queue_remove(&fcn->queue);
+
+        if (c->node == NULL) {
+            fcn->uses++;
+            fcn->count++;
+        }
+
+        if (fcn->fast) {
+            ngx_queue_remove(&fcn->fast_queue);
+            ngx_queue_insert_head(&cache->sh->fast_queue, &fcn->fast_queue);
+        }
+
+        c->purged = fcn->purged;
+
+        if (fcn->purged && fcn->exists && c->node == NULL) {
+            goto renew;
+        }
+
+        if (fcn->error) {
+
+            if (fcn->valid_sec < ngx_time()) {
+                goto renew;
+            }
+
+            rc = NGX_OK;
+
+            goto done;
+        }
+
+        if (fcn->exists || fcn->uses >= c->min_uses) {
+
+            c->exists = fcn->exists;
+            if (fcn->body_start) {
+                c->body_start = fcn->body_start;
+            }
+
+            rc = NGX_OK;
+
+            goto done;
+        }
+
+        rc = NGX_AGAIN;
+
+        goto done;
+    }
+
+    fcn = ngx_slab_calloc_locked(cache->shpool,
+                                 sizeof(ngx_http_file_cache_node_t));
+    if (fcn == NULL) {
+        ngx_http_file_cache_set_watermark(cache);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        (void) ngx_http_file_cache_forced_expire(cache);
 
         ngx_shmtx_lock(&cache->shpool->mutex);
 
@@ -903,6 +2053,19 @@ renew:
 
     rc = NGX_DECLINED;
 
+    ngx_http_file_cache_mem_free(cache, fcn);
+
+    if (cache->fast_path) {
+        fast = ngx_http_file_cache_fast_drop(cache, fcn);
+    }
+
+    if (fcn->purged) {
+
+        /* the file of a purged entry stays until replaced or deleted */
+
+        cache->sh->size -= fcn->fs_size;
+    }
+
     fcn->valid_msec = 0;
     fcn->error = 0;
     fcn->exists = 0;
@@ -913,11 +2076,28 @@ renew:
 
 done:
 
+    if (cache->sh->sketch && c->node == NULL) {
+        ngx_http_file_cache_sketch_add(cache, c->key);
+
+        if ((rc == NGX_DECLINED
+             || (rc == NGX_OK && !fcn->exists && !fcn->error))
+            && !ngx_http_file_cache_admit(cache, c->key))
+        {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                           "http file cache not admitted");
+
+            (void) ngx_atomic_fetch_add(&cache->sh->rejected, 1);
+            rc = NGX_AGAIN;
+        }
+    }
+
     fcn->expire = ngx_time() + cache->inactive;
 
     ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
 
     c->uniq = fcn->uniq;
+    c->fast = fcn->fast;
+    c->fast_uniq = fcn->fast_uniq;
     c->error = fcn->error;
     c->node = fcn;
 
@@ -925,6 +2105,10 @@ failed:
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
+    if (fast) {
+        ngx_http_file_cache_fast_delete(cache, cache->fast_name);
+    }
+
     return rc;
 }
 
@@ -1229,6 +2413,7 @@ ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
     c->secondary = 1;
+    c->memory = 0;
     c->file.name.len = 0;
     c->body_start = c->buf->end - c->buf->start;
 
@@ -1357,6 +2542,7 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 {
     off_t                   fs_size;
     ngx_int_t               rc;
+    ngx_uint_t              fast;
     ngx_file_uniq_t         uniq;
     ngx_file_info_t         fi;
     ngx_http_cache_t        *c;
@@ -1409,20 +2595,92 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
-    c->node->count--;
-    c->node->error = 0;
-    c->node->uniq = uniq;
-    c->node->body_start = c->body_start;
-
-    cache->sh->size += fs_size - c->node->fs_size;
-    c->node->fs_size = fs_size;
-
-    if (rc == NGX_OK) {
-        c->node->exists = 1;
+    ngx_http_file_cache_mem_free(cache, c->node);
+
+    fast = cache->fast_path ? ngx_http_file_cache_fast_drop(cache, c->node)
+                            : 0;
+
+    c->node->count--;
+    c->node->error = 0;
+    c->node->uniq = uniq;
+    c->node->body_start = c->body_start;
+
+    cache->sh->size += fs_size - c->node->fs_size;
+    c->node->fs_size = fs_size;
+
+    if (rc == NGX_OK) {
+        c->node->exists = 1;
+        c->node->purged = 0;
+
+        ngx_http_file_cache_untag(cache, c->node);
+
+        if (c->tags) {
+            ngx_http_file_cache_tag(cache, c->node, c->tags);
+        }
+    }
+
+    if (c->filling && c->node->fill_temp == c->fill_temp) {
+        c->node->filling = 0;
+        c->node->fill_size = (rc == NGX_OK) ? tf->offset : -1;
+    }
+
+    c->node->updating = 0;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (fast) {
+        ngx_http_file_cache_fast_delete(cache, cache->fast_name);
+    }
+}
+
+
+void
+ngx_http_file_cache_progress(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    ngx_int_t               n;
+    ngx_http_cache_t       *c;
+    ngx_http_file_cache_t  *cache;
+
+    c = r->cache;
+    cache = c->file_cache;
+
+    /*
+     * the progress of a locked cache update is published in the node
+     * for requests waiting for the lock, if they are able to find
+     * the temporary file next to the cache file
+     */
+
+    if (!c->read_while_write
+        || !c->updating
+        || cache->use_temp_path
+        || tf->file.fd == NGX_INVALID_FILE
+        || tf->offset == 0)
+    {
+        return;
+    }
+
+    if (!c->filling) {
+        if (tf->file.name.len < 10) {
+            return;
+        }
+
+        n = ngx_atoi(tf->file.name.data + tf->file.name.len - 10, 10);
+        if (n == NGX_ERROR) {
+            return;
+        }
+
+        c->fill_temp = (uint32_t) n;
+        c->filling = 1;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (c->node->lock_time == c->lock_time) {
+        c->node->filling = 1;
+        c->node->fill_temp = c->fill_temp;
+        c->node->fill_size = tf->offset;
     }
 
-    c->node->updating = 0;
-
     ngx_shmtx_unlock(&cache->shpool->mutex);
 }
 
@@ -1432,9 +2690,11 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
 {
     ssize_t                        n;
     ngx_err_t                      err;
+    ngx_uint_t                     fast;
     ngx_file_t                     file;
     ngx_file_info_t                fi;
     ngx_http_cache_t              *c;
+    ngx_http_file_cache_t         *cache;
     ngx_http_file_cache_header_t   h;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -1550,6 +2810,25 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
     (void) ngx_write_file(&file, (u_char *) &h,
                           sizeof(ngx_http_file_cache_header_t), 0);
 
+    /* the memory tier and the fast tier copies have the old header */
+
+    if (c->node) {
+        cache = c->file_cache;
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        ngx_http_file_cache_mem_free(cache, c->node);
+
+        fast = cache->fast_path ? ngx_http_file_cache_fast_drop(cache, c->node)
+                                : 0;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (fast) {
+            ngx_http_file_cache_fast_delete(cache, cache->fast_name);
+        }
+    }
+
 done:
 
     if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
@@ -1594,6 +2873,46 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return rc;
     }
 
+    if (c->streaming) {
+
+        /* the rest of the entry is sent as it is written */
+
+        b->file_pos = c->body_start;
+        b->file_last = c->body_start;
+        b->last_in_chain = 1;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+
+        c->stream_buf = b;
+
+        c->wait_event.handler = ngx_http_file_cache_stream_wait_handler;
+        c->wait_event.data = r;
+        c->wait_event.log = r->connection->log;
+
+        r->read_event_handler = ngx_http_test_reading;
+        r->write_event_handler = ngx_http_file_cache_stream_handler;
+
+        ngx_http_file_cache_stream_handler(r);
+
+        return NGX_DONE;
+    }
+
+    if (c->memory) {
+        b->pos = c->buf->pos + c->body_start;
+        b->last = c->buf->pos + c->length;
+
+        b->memory = (c->length - c->body_start) ? 1: 0;
+        b->last_buf = (r == r->main) ? 1: 0;
+        b->last_in_chain = 1;
+
+        out.buf = b;
+        out.next = NULL;
+
+        return ngx_http_output_filter(r, &out);
+    }
+
     b->file_pos = c->body_start;
     b->file_last = c->length;
 
@@ -1636,6 +2955,11 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
         fcn->updating = 0;
     }
 
+    if (c->filling && fcn->fill_temp == c->fill_temp) {
+        fcn->filling = 0;
+        fcn->fill_size = -1;
+    }
+
     if (c->error) {
         fcn->error = c->error;
 
@@ -1644,7 +2968,17 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
             fcn->valid_msec = c->valid_msec;
         }
 
+    } else if (fcn->purged && fcn->count == 0) {
+
+        /* the cache manager deletes the file */
+
+        ngx_queue_remove(&fcn->queue);
+        fcn->expire = 0;
+        ngx_queue_insert_tail(&cache->sh->queue, &fcn->queue);
+
     } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
+        ngx_http_file_cache_mem_free(cache, fcn);
+        ngx_http_file_cache_untag(cache, fcn);
         ngx_queue_remove(&fcn->queue);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
         ngx_slab_free_locked(cache->shpool, fcn);
@@ -1698,6 +3032,233 @@ ngx_http_file_cache_cleanup(void *data)
 }
 
 
+/*
+ * Entries may be tagged when they are stored, and all entries with a tag
+ * may be purged at once.  The tags are kept in a tree in the keys zone,
+ * each with the queue of its entries, so a purge costs no more than the
+ * number of entries purged.  A purged entry is not used anymore, and its
+ * file is deleted by the cache manager, unless the entry is stored again.
+ */
+
+static void
+ngx_http_file_cache_tag(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_array_t *tags)
+{
+    uint32_t                     hash;
+    ngx_str_t                   *name;
+    ngx_uint_t                   i;
+    ngx_http_file_cache_tag_t   *tag;
+    ngx_http_file_cache_link_t  *link;
+
+    name = tags->elts;
+
+    for (i = 0; i < tags->nelts; i++) {
+
+        hash = ngx_crc32_short(name[i].data, name[i].len);
+
+        tag = (ngx_http_file_cache_tag_t *)
+                  ngx_str_rbtree_lookup(&cache->sh->tag_rbtree, &name[i], hash);
+
+        if (tag == NULL) {
+            tag = ngx_slab_alloc_locked(cache->shpool,
+                             offsetof(ngx_http_file_cache_tag_t, data)
+                             + name[i].len);
+            if (tag == NULL) {
+                goto failed;
+            }
+
+            ngx_memcpy(tag->data, name[i].data, name[i].len);
+
+            tag->sn.node.key = hash;
+            tag->sn.str.len = name[i].len;
+            tag->sn.str.data = tag->data;
+
+            ngx_queue_init(&tag->links);
+
+            ngx_rbtree_insert(&cache->sh->tag_rbtree, &tag->sn.node);
+        }
+
+        link = ngx_slab_alloc_locked(cache->shpool,
+                                     sizeof(ngx_http_file_cache_link_t));
+        if (link == NULL) {
+
+            if (ngx_queue_empty(&tag->links)) {
+                ngx_rbtree_delete(&cache->sh->tag_rbtree, &tag->sn.node);
+                ngx_slab_free_locked(cache->shpool, tag);
+            }
+
+            goto failed;
+        }
+
+        link->tag = tag;
+        link->node = fcn;
+        link->next = fcn->tags;
+        fcn->tags = link;
+
+        ngx_queue_insert_tail(&tag->links, &link->queue);
+    }
+
+    return;
+
+failed:
+
+    ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                  "could not allocate cache tag \"%V\"%s",
+                  &name[i], cache->shpool->log_ctx);
+}
+
+
+static void
+ngx_http_file_cache_untag(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_http_file_cache_tag_t   *tag;
+    ngx_http_file_cache_link_t  *link, *next;
+
+    for (link = fcn->tags; link; link = next) {
+        next = link->next;
+        tag = link->tag;
+
+        ngx_queue_remove(&link->queue);
+        ngx_slab_free_locked(cache->shpool, link);
+
+        if (ngx_queue_empty(&tag->links)) {
+            ngx_rbtree_delete(&cache->sh->tag_rbtree, &tag->sn.node);
+            ngx_slab_free_locked(cache->shpool, tag);
+        }
+    }
+
+    fcn->tags = NULL;
+}
+
+
+ngx_int_t
+ngx_http_file_cache_purge(ngx_http_request_t *r)
+{
+    u_char                      *p;
+    uint32_t                     hash;
+    ngx_str_t                    key, *keys;
+    ngx_uint_t                   i, n;
+    ngx_queue_t                 *q;
+    ngx_http_cache_t            *c;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_tag_t   *tag;
+    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_link_t  *link, **lp;
+
+    c = r->cache;
+    cache = c->file_cache;
+
+    keys = c->keys.elts;
+    key.len = 0;
+
+    for (i = 0; i < c->keys.nelts; i++) {
+        key.len += keys[i].len;
+    }
+
+    key.data = ngx_pnalloc(r->pool, key.len);
+    if (key.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = key.data;
+
+    for (i = 0; i < c->keys.nelts; i++) {
+        p = ngx_cpymem(p, keys[i].data, keys[i].len);
+    }
+
+    n = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (key.len && key.data[key.len - 1] == '*') {
+
+        /* "tag*" purges all entries tagged with "tag" */
+
+        key.len--;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge tag: \"%V\"", &key);
+
+        hash = ngx_crc32_short(key.data, key.len);
+
+        tag = (ngx_http_file_cache_tag_t *)
+                  ngx_str_rbtree_lookup(&cache->sh->tag_rbtree, &key, hash);
+
+        if (tag) {
+            ngx_rbtree_delete(&cache->sh->tag_rbtree, &tag->sn.node);
+
+            while (!ngx_queue_empty(&tag->links)) {
+                q = ngx_queue_head(&tag->links);
+                link = ngx_queue_data(q, ngx_http_file_cache_link_t, queue);
+
+                ngx_queue_remove(q);
+
+                fcn = link->node;
+
+                for (lp = &fcn->tags; *lp != link; lp = &(*lp)->next) {
+                    /* void */
+                }
+
+                *lp = link->next;
+
+                ngx_slab_free_locked(cache->shpool, link);
+
+                n += ngx_http_file_cache_purge_node(cache, fcn);
+            }
+
+            ngx_slab_free_locked(cache->shpool, tag);
+        }
+
+    } else {
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge: \"%V\"", &key);
+
+        fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+        if (fcn) {
+            n = ngx_http_file_cache_purge_node(cache, fcn);
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purged: %ui", n);
+
+    if (n == 0) {
+        return NGX_DECLINED;
+    }
+
+    (void) ngx_atomic_fetch_add(&cache->sh->purged, n);
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_purge_node(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    if (!fcn->exists || fcn->purged) {
+        return 0;
+    }
+
+    fcn->purged = 1;
+
+    ngx_http_file_cache_mem_free(cache, fcn);
+
+    if (fcn->count == 0) {
+        ngx_queue_remove(&fcn->queue);
+        fcn->expire = 0;
+        ngx_queue_insert_tail(&cache->sh->queue, &fcn->queue);
+    }
+
+    return 1;
+}
+
+
 static time_t
 ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 {
@@ -1730,12 +3291,12 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     ngx_shmtx_lock(&cache->shpool->mutex);
 
     for ( ;; ) {
-        if (ngx_queue_empty(&cache->sh->queue)) {
+        q = ngx_http_file_cache_last(cache);
+
+        if (q == NULL) {
             break;
         }
 
-        q = ngx_queue_last(&cache->sh->queue);
-
         if (q == sentinel) {
             break;
         }
@@ -1748,7 +3309,12 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
                   fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
         if (fcn->count == 0) {
+            if (cache->sh->sketch) {
+                q = ngx_http_file_cache_victim(cache, q);
+            }
+
             ngx_http_file_cache_delete(cache, q, name);
+            (void) ngx_atomic_fetch_add(&cache->sh->evicted, 1);
             wait = 0;
             break;
         }
@@ -1776,19 +3342,184 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
             sentinel = q;
         }
 
-        if (--tries) {
-            continue;
+        if (--tries) {
+            continue;
+        }
+
+        wait = 1;
+        break;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static void
+ngx_http_file_cache_sketch_add(ngx_http_file_cache_t *cache, u_char *key)
+{
+    u_char                    *row;
+    uint32_t                   hash;
+    ngx_uint_t                 i, n, width;
+    ngx_http_file_cache_sh_t  *sh;
+
+    /* a count-min sketch with saturating counters, updated under the mutex */
+
+    sh = cache->sh;
+    width = sh->sketch_mask + 1;
+
+    for (i = 0; i < NGX_HTTP_CACHE_SKETCH_ROWS; i++) {
+        ngx_memcpy(&hash, &key[i * sizeof(uint32_t)], sizeof(uint32_t));
+
+        row = sh->sketch + i * width;
+        n = hash & sh->sketch_mask;
+
+        if (row[n] < NGX_HTTP_CACHE_SKETCH_MAX) {
+            row[n]++;
+        }
+    }
+
+    if (++sh->sketch_samples < 10 * width) {
+        return;
+    }
+
+    /* periodically halve all counters so that old popularity fades */
+
+    for (i = 0; i < NGX_HTTP_CACHE_SKETCH_ROWS * width; i++) {
+        sh->sketch[i] >>= 1;
+    }
+
+    sh->sketch_samples /= 2;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_sketch_get(ngx_http_file_cache_t *cache, u_char *key)
+{
+    u_char                    *row;
+    uint32_t                   hash;
+    ngx_uint_t                 i, freq, width;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+    width = sh->sketch_mask + 1;
+    freq = NGX_HTTP_CACHE_SKETCH_MAX;
+
+    for (i = 0; i < NGX_HTTP_CACHE_SKETCH_ROWS; i++) {
+        ngx_memcpy(&hash, &key[i * sizeof(uint32_t)], sizeof(uint32_t));
+
+        row = sh->sketch + i * width;
+
+        if (row[hash & sh->sketch_mask] < freq) {
+            freq = row[hash & sh->sketch_mask];
+        }
+    }
+
+    return freq;
+}
+
+
+static void
+ngx_http_file_cache_node_key(ngx_http_file_cache_node_t *fcn, u_char *key)
+{
+    ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(key + sizeof(ngx_rbtree_key_t), fcn->key,
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_admit(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_uint_t                   freq, vfreq;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_sh_t    *sh;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       vkey[NGX_HTTP_CACHE_KEY_LEN];
+
+    /*
+     * while the cache has room every new entry is admitted; once it is
+     * nearly full, a new entry must be requested more often than the
+     * entry that would have to be evicted to make room for it
+     */
+
+    sh = cache->sh;
+
+    if (sh->size < cache->max_size - cache->max_size / 16
+        && sh->count < sh->watermark)
+    {
+        return 1;
+    }
+
+    if (ngx_queue_empty(&sh->queue)) {
+        return 1;
+    }
+
+    q = ngx_http_file_cache_victim(cache, ngx_queue_last(&sh->queue));
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+    if (fcn->count) {
+        return 1;
+    }
+
+    ngx_http_file_cache_node_key(fcn, vkey);
+
+    freq = ngx_http_file_cache_sketch_get(cache, key);
+    vfreq = ngx_http_file_cache_sketch_get(cache, vkey);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache admit: freq:%ui victim:%ui", freq, vfreq);
+
+    return freq > vfreq;
+}
+
+
+static ngx_queue_t *
+ngx_http_file_cache_victim(ngx_http_file_cache_t *cache, ngx_queue_t *q)
+{
+    ngx_uint_t                   i, freq, best;
+    ngx_queue_t                 *victim;
+    ngx_http_file_cache_node_t  *fcn, *vfcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
+
+    /*
+     * sample a few entries from the tail of the inactive queue and
+     * choose the least frequently used one, preferring larger entries
+     */
+
+    victim = q;
+    vfcn = NULL;
+    best = 0;
+
+    for (i = 0; i < NGX_HTTP_CACHE_EVICT_SAMPLE; i++) {
+
+        if (q == ngx_queue_sentinel(&cache->sh->queue)) {
+            break;
         }
 
-        wait = 1;
-        break;
-    }
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+        if (fcn->count == 0) {
+            ngx_http_file_cache_node_key(fcn, key);
+            freq = ngx_http_file_cache_sketch_get(cache, key);
+
+            if (vfcn == NULL
+                || freq < best
+                || (freq == best && fcn->fs_size > vfcn->fs_size))
+            {
+                victim = q;
+                vfcn = fcn;
+                best = freq;
+            }
+        }
 
-    ngx_free(name);
+        q = ngx_queue_prev(q);
+    }
 
-    return wait;
+    return victim;
 }
 
 
@@ -1828,13 +3559,13 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
             break;
         }
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
-            wait = 10;
+        q = ngx_http_file_cache_last(cache);
+
+        if (q == NULL) {
+            wait = ngx_queue_empty(&cache->sh->queue) ? 10 : 1;
             break;
         }
 
-        q = ngx_queue_last(&cache->sh->queue);
-
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
         wait = fcn->expire - now;
@@ -1854,11 +3585,6 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
             goto next;
         }
 
-        if (fcn->deleting) {
-            wait = 1;
-            break;
-        }
-
         p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
                          sizeof(ngx_rbtree_key_t));
         len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
@@ -1903,18 +3629,48 @@ next:
 }
 
 
+static ngx_queue_t *
+ngx_http_file_cache_last(ngx_http_file_cache_t *cache)
+{
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+
+    /*
+     * entries which are being deleted by other cache managers
+     * are skipped, so several managers may delete files in parallel
+     */
+
+    for (q = ngx_queue_last(&cache->sh->queue);
+         q != ngx_queue_sentinel(&cache->sh->queue);
+         q = ngx_queue_prev(q))
+    {
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        if (!fcn->deleting) {
+            return q;
+        }
+    }
+
+    return NULL;
+}
+
+
 static void
 ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     u_char *name)
 {
     u_char                      *p;
     size_t                       len;
+    ngx_err_t                    err;
+    ngx_uint_t                   fast;
     ngx_path_t                  *path;
     ngx_http_file_cache_node_t  *fcn;
 
     fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
-    if (fcn->exists) {
+    ngx_http_file_cache_mem_free(cache, fcn);
+
+    if (fcn->exists || fcn->purged) {
         cache->sh->size -= fcn->fs_size;
 
         path = cache->path;
@@ -1925,10 +3681,17 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
         p = ngx_hex_dump(p, fcn->key, len);
         *p = '\0';
 
+        fast = cache->fast_path ? ngx_http_file_cache_fast_drop(cache, fcn)
+                                : 0;
+
         fcn->count++;
         fcn->deleting = 1;
         ngx_shmtx_unlock(&cache->shpool->mutex);
 
+        if (fast) {
+            ngx_http_file_cache_fast_delete(cache, cache->fast_name);
+        }
+
         len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
         ngx_create_hashed_filename(path, name, len);
 
@@ -1936,8 +3699,19 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
                        "http file cache expire: \"%s\"", name);
 
         if (ngx_delete_file(name) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
-                          ngx_delete_file_n " \"%s\" failed", name);
+            err = ngx_errno;
+
+            /*
+             * files loaded from a snapshot may no longer exist,
+             * as well as files of purged entries
+             */
+
+            if (err != NGX_ENOENT
+                || (cache->snapshot.len == 0 && !fcn->purged))
+            {
+                ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                              ngx_delete_file_n " \"%s\" failed", name);
+            }
         }
 
         ngx_shmtx_lock(&cache->shpool->mutex);
@@ -1946,6 +3720,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     }
 
     if (fcn->count == 0) {
+        ngx_http_file_cache_untag(cache, fcn);
         ngx_queue_remove(q);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
         ngx_slab_free_locked(cache->shpool, fcn);
@@ -1981,161 +3756,528 @@ ngx_http_file_cache_manager(void *data)
         count = cache->sh->count;
         watermark = cache->sh->watermark;
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache size: %O c:%ui w:%i",
+                       size, count, (ngx_int_t) watermark);
+
+        if (size < cache->max_size && count < watermark) {
+            break;
+        }
+
+        wait = ngx_http_file_cache_forced_expire(cache);
+
+        if (wait > 0) {
+            next = (ngx_msec_t) wait * 1000;
+            break;
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            break;
+        }
+
+        if (++cache->files >= cache->manager_files) {
+            next = cache->manager_sleep;
+            break;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        if (elapsed >= cache->manager_threshold) {
+            next = cache->manager_sleep;
+            break;
+        }
+    }
+
+done:
+
+    if (cache->fast_path) {
+        ngx_http_file_cache_demote(cache);
+    }
+
+    if (cache->snapshot_interval
+        && ngx_worker == 0
+        && !cache->sh->cold
+        && ngx_time() >= cache->snapshot_next)
+    {
+        ngx_http_file_cache_snapshot_write(cache);
+
+        ngx_time_update();
+        cache->snapshot_next = ngx_time() + cache->snapshot_interval;
+    }
+
+    elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache manager: %ui e:%M n:%M",
+                   cache->files, elapsed, next);
+
+    return next;
+}
+
+
+static void
+ngx_http_file_cache_loader(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    ngx_uint_t      n, shard;
+    ngx_tree_ctx_t  tree;
+
+    if (!cache->sh->cold) {
+        return;
+    }
+
+    /*
+     * the level 1 directories are split into shards, which are claimed
+     * by the loader processes one by one; the first shard also includes
+     * files in the cache root, and loading of an index snapshot
+     */
+
+    n = ngx_max(cache->path->loaders, 1);
+
+    if (cache->path->level[0] == 0) {
+        n = 1;
+    }
+
+    (void) ngx_atomic_fetch_add(&cache->sh->loaders, 1);
+
+    for ( ;; ) {
+
+        shard = ngx_atomic_fetch_add(&cache->sh->loading, 1);
+
+        if (shard >= n) {
+            break;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader, shard: %ui", shard);
+
+        if (shard == 0 && cache->snapshot.len) {
+            ngx_http_file_cache_snapshot_read(cache);
+        }
+
+        tree.init_handler = NULL;
+        tree.file_handler = ngx_http_file_cache_manage_file;
+        tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
+        tree.post_tree_handler = ngx_http_file_cache_noop;
+        tree.spec_handler = ngx_http_file_cache_delete_file;
+        tree.data = cache;
+        tree.alloc = 0;
+        tree.log = ngx_cycle->log;
+
+        cache->loader_shard = shard;
+        cache->last = ngx_current_msec;
+        cache->files = 0;
+
+        if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
+            break;
+        }
+
+        if (ngx_atomic_fetch_add(&cache->sh->loaded, 1) + 1 != n) {
+            continue;
+        }
+
+        if (cache->fast_path) {
+            ngx_http_file_cache_fast_load(cache);
+        }
+
+        cache->sh->cold = 0;
+
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "http file cache: %V %.3fM, bsize: %uz",
+                      &cache->path->name,
+                      ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                      cache->bsize);
+
+        break;
+    }
+
+    /*
+     * the last loader to exit resets the shards, so that loading
+     * can be restarted if it was interrupted
+     */
+
+    if (ngx_atomic_fetch_add(&cache->sh->loaders, -1) == 1) {
+        cache->sh->loading = 0;
+
+        if (cache->sh->cold) {
+            cache->sh->loaded = 0;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t              elapsed;
+    ngx_http_file_cache_t  *cache;
+
+    cache = ctx->data;
+
+    if (cache->snapshot.len
+        && path->len == cache->snapshot.len
+        && ngx_strncmp(path->data, cache->snapshot.data, path->len) == 0)
+    {
+        return NGX_OK;
+    }
+
+    if (cache->loader_shard
+        && ngx_strlchr(path->data + cache->path->name.len + 1,
+                       path->data + path->len, '/')
+           == NULL)
+    {
+        /* files in the cache root are loaded with the first shard */
+        return NGX_OK;
+    }
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        (void) ngx_http_file_cache_delete_file(ctx, path);
+    }
+
+    if (++cache->files >= cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(cache);
+
+    } else {
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
+
+        if (elapsed >= cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(cache);
+        }
+    }
+
+    return (ngx_quit || ngx_terminate || ngx_exiting) ? NGX_ABORT : NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    size_t                  len;
+    ngx_int_t               n;
+    ngx_uint_t              loaders;
+    ngx_http_file_cache_t  *cache;
+
+    if (path->len >= 5
+        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    cache = ctx->data;
+
+    loaders = ngx_max(cache->path->loaders, 1);
+    len = cache->path->name.len + 1;
+
+    if (loaders > 1
+        && cache->path->level[0]
+        && path->len == len + cache->path->level[0])
+    {
+        /* a level 1 directory */
+
+        n = ngx_hextoi(path->data + len, cache->path->level[0]);
+
+        if (n != NGX_ERROR && (ngx_uint_t) n % loaders != cache->loader_shard)
+        {
+            return NGX_DECLINED;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+{
+    ngx_msleep(cache->loader_sleep);
+
+    ngx_time_update();
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+}
+
+
+static void
+ngx_http_file_cache_snapshot_read(ngx_http_file_cache_t *cache)
+{
+    off_t                                   size;
+    ssize_t                                 n;
+    ngx_uint_t                              i, count;
+    ngx_file_t                              file;
+    ngx_http_cache_t                        c;
+    ngx_http_file_cache_snapshot_entry_t   *entries;
+    ngx_http_file_cache_snapshot_header_t   h;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = cache->snapshot;
+    file.log = ngx_cycle->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY,
+                            NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed", file.name.data);
+        }
+
+        return;
+    }
+
+    entries = NULL;
+    count = 0;
+
+    n = ngx_read_file(&file, (u_char *) &h, sizeof(h), 0);
+
+    if (n != sizeof(h)
+        || h.magic != NGX_HTTP_FILE_CACHE_SNAPSHOT_MAGIC
+        || h.version != NGX_HTTP_CACHE_VERSION
+        || h.bsize != cache->bsize)
+    {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "cache snapshot \"%s\" is invalid, ignored",
+                      file.name.data);
+        goto done;
+    }
+
+    size = NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH
+           * sizeof(ngx_http_file_cache_snapshot_entry_t);
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache size: %O c:%ui w:%i",
-                       size, count, (ngx_int_t) watermark);
+    entries = ngx_alloc(size, ngx_cycle->log);
+    if (entries == NULL) {
+        goto done;
+    }
 
-        if (size < cache->max_size && count < watermark) {
-            break;
-        }
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
 
-        wait = ngx_http_file_cache_forced_expire(cache);
+    for ( ;; ) {
+        n = ngx_read_file(&file, (u_char *) entries, size, file.offset);
 
-        if (wait > 0) {
-            next = (ngx_msec_t) wait * 1000;
+        if (n == NGX_ERROR || n == 0) {
             break;
         }
 
-        if (ngx_quit || ngx_terminate) {
-            break;
-        }
+        n /= sizeof(ngx_http_file_cache_snapshot_entry_t);
 
-        if (++cache->files >= cache->manager_files) {
-            next = cache->manager_sleep;
-            break;
-        }
+        for (i = 0; i < (ngx_uint_t) n; i++) {
+            ngx_memcpy(c.key, entries[i].key, NGX_HTTP_CACHE_KEY_LEN);
+            c.fs_size = entries[i].fs_size;
 
-        ngx_time_update();
+            if (ngx_http_file_cache_add(cache, &c) != NGX_OK) {
+                goto done;
+            }
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+            count++;
+        }
 
-        if (elapsed >= cache->manager_threshold) {
-            next = cache->manager_sleep;
+        if (ngx_quit || ngx_terminate) {
             break;
         }
     }
 
 done:
 
-    elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V snapshot, %ui entries loaded",
+                  &cache->path->name, count);
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache manager: %ui e:%M n:%M",
-                   cache->files, elapsed, next);
+    if (entries) {
+        ngx_free(entries);
+    }
 
-    return next;
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
 }
 
 
 static void
-ngx_http_file_cache_loader(void *data)
+ngx_http_file_cache_snapshot_write(ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_t  *cache = data;
-
-    ngx_tree_ctx_t  tree;
-
-    if (!cache->sh->cold || cache->sh->loading) {
+    u_char                                 *name;
+    ssize_t                                 n;
+    ngx_int_t                               rc;
+    ngx_uint_t                              i, count, first, visited;
+    ngx_file_t                              file;
+    ngx_rbtree_key_t                        key;
+    ngx_rbtree_node_t                      *node, *sentinel;
+    ngx_http_file_cache_node_t             *fcn;
+    ngx_http_file_cache_snapshot_entry_t   *entries;
+    ngx_http_file_cache_snapshot_header_t   h;
+    u_char                                  lkey[NGX_HTTP_CACHE_KEY_LEN];
+
+    name = ngx_alloc(cache->snapshot.len + sizeof(".tmp"), ngx_cycle->log);
+    if (name == NULL) {
         return;
     }
 
-    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+    ngx_sprintf(name, "%V.tmp%Z", &cache->snapshot);
+
+    entries = ngx_alloc(NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH
+                        * sizeof(ngx_http_file_cache_snapshot_entry_t),
+                        ngx_cycle->log);
+    if (entries == NULL) {
+        ngx_free(name);
         return;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache loader");
+    ngx_memzero(&file, sizeof(ngx_file_t));
 
-    tree.init_handler = NULL;
-    tree.file_handler = ngx_http_file_cache_manage_file;
-    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
-    tree.post_tree_handler = ngx_http_file_cache_noop;
-    tree.spec_handler = ngx_http_file_cache_delete_file;
-    tree.data = cache;
-    tree.alloc = 0;
-    tree.log = ngx_cycle->log;
+    file.name.data = name;
+    file.name.len = cache->snapshot.len + sizeof(".tmp") - 1;
+    file.log = ngx_cycle->log;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    file.fd = ngx_open_file(name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                            NGX_FILE_DEFAULT_ACCESS);
 
-    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
-        cache->sh->loading = 0;
-        return;
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        goto failed;
     }
 
-    cache->sh->cold = 0;
-    cache->sh->loading = 0;
+    h.magic = NGX_HTTP_FILE_CACHE_SNAPSHOT_MAGIC;
+    h.version = NGX_HTTP_CACHE_VERSION;
+    h.bsize = cache->bsize;
 
-    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
-                  "http file cache: %V %.3fM, bsize: %uz",
-                  &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
-                  cache->bsize);
-}
+    if (ngx_write_file(&file, (u_char *) &h, sizeof(h), 0) == NGX_ERROR) {
+        goto close;
+    }
+
+    /*
+     * the tree is walked in batches to keep the zone unlocked while
+     * writing; each batch continues after the last key seen
+     */
 
+    rc = NGX_OK;
+    count = 0;
+    first = 1;
 
-static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    return NGX_OK;
-}
+    for ( ;; ) {
+        ngx_shmtx_lock(&cache->shpool->mutex);
 
+        node = cache->sh->rbtree.root;
+        sentinel = cache->sh->rbtree.sentinel;
 
-static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
+        if (node == sentinel) {
+            node = NULL;
 
-    cache = ctx->data;
+        } else if (first) {
+            node = ngx_rbtree_min(node, sentinel);
 
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        (void) ngx_http_file_cache_delete_file(ctx, path);
-    }
+        } else {
+            ngx_memcpy((u_char *) &key, lkey, sizeof(ngx_rbtree_key_t));
+
+            fcn = NULL;
+
+            while (node != sentinel) {
+
+                if (key < node->key
+                    || (key == node->key
+                        && ngx_memcmp(&lkey[sizeof(ngx_rbtree_key_t)],
+                                      ((ngx_http_file_cache_node_t *)
+                                           node)->key,
+                                      NGX_HTTP_CACHE_KEY_LEN
+                                      - sizeof(ngx_rbtree_key_t))
+                           < 0))
+                {
+                    fcn = (ngx_http_file_cache_node_t *) node;
+                    node = node->left;
+
+                } else {
+                    node = node->right;
+                }
+            }
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
+            node = fcn ? &fcn->node : NULL;
+        }
 
-    } else {
-        ngx_time_update();
+        first = 0;
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+        for (i = 0, visited = 0;
+             node && visited < NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH;
+             visited++)
+        {
+            fcn = (ngx_http_file_cache_node_t *) node;
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+            ngx_memcpy(lkey, &node->key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&lkey[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
+            if (fcn->exists && !fcn->deleting && !fcn->purged) {
+                ngx_memcpy(entries[i].key, lkey, NGX_HTTP_CACHE_KEY_LEN);
+                entries[i].fs_size = fcn->fs_size;
+                i++;
+            }
+
+            node = ngx_rbtree_next(&cache->sh->rbtree, node);
         }
-    }
 
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
-}
+        ngx_shmtx_unlock(&cache->shpool->mutex);
 
+        if (i) {
+            n = ngx_write_file(&file, (u_char *) entries,
+                               i * sizeof(ngx_http_file_cache_snapshot_entry_t),
+                               file.offset);
 
-static ngx_int_t
-ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    if (path->len >= 5
-        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
-    {
-        return NGX_DECLINED;
+            if (n == NGX_ERROR) {
+                rc = NGX_ERROR;
+                break;
+            }
+
+            count += i;
+        }
+
+        if (node == NULL || ngx_quit || ngx_terminate) {
+            break;
+        }
     }
 
-    return NGX_OK;
-}
+    if (rc == NGX_OK && !ngx_quit && !ngx_terminate) {
 
+        if (ngx_rename_file(name, cache->snapshot.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                          name, cache->snapshot.data);
 
-static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
-{
-    ngx_msleep(cache->loader_sleep);
+        } else {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                           "http file cache snapshot: \"%s\", %ui entries",
+                           cache->snapshot.data, count);
+        }
+    }
 
-    ngx_time_update();
+close:
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+failed:
+
+    ngx_free(entries);
+    ngx_free(name);
 }
 
 
@@ -2186,80 +4328,233 @@ ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
 
         p += 2;
 
-        c.key[i] = (u_char) n;
+        c.key[i] = (u_char) n;
+    }
+
+    return ngx_http_file_cache_add(cache, &c);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+    if (fcn == NULL) {
+
+        fcn = ngx_slab_calloc_locked(cache->shpool,
+                                     sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_http_file_cache_set_watermark(cache);
+
+            if (cache->fail_time != ngx_time()) {
+                cache->fail_time = ngx_time();
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                           "could not allocate node%s", cache->shpool->log_ctx);
+            }
+
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
+
+        cache->sh->count++;
+
+        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+        fcn->uses = 1;
+        fcn->exists = 1;
+        fcn->fs_size = c->fs_size;
+
+        cache->sh->size += c->fs_size;
+
+    } else {
+        ngx_queue_remove(&fcn->queue);
+    }
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "http file cache delete: \"%s\"", path->data);
+
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_fast_load(ngx_http_file_cache_t *cache)
+{
+    ngx_tree_ctx_t                    tree;
+    ngx_http_file_cache_fast_load_t   ld;
+
+    /* the names of cache files, to compare the copies with */
+
+    ld.cache = cache;
+    ld.name = ngx_alloc(cache->path->name.len + 1 + cache->path->len
+                        + 2 * NGX_HTTP_CACHE_KEY_LEN + 1, ngx_cycle->log);
+    if (ld.name == NULL) {
+        return;
+    }
+
+    ngx_memcpy(ld.name, cache->path->name.data, cache->path->name.len);
+
+    tree.init_handler = NULL;
+    tree.file_handler = ngx_http_file_cache_fast_file;
+    tree.pre_tree_handler = ngx_http_file_cache_noop;
+    tree.post_tree_handler = ngx_http_file_cache_noop;
+    tree.spec_handler = ngx_http_file_cache_delete_file;
+    tree.data = &ld;
+    tree.alloc = 0;
+    tree.log = ngx_cycle->log;
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+
+    (void) ngx_walk_tree(&tree, &cache->fast_path->name);
+
+    ngx_free(ld.name);
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %.3fM",
+                  &cache->fast_path->name,
+                  ((double) cache->sh->fast_size * cache->bsize)
+                  / (1024 * 1024));
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_fast_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    u_char                           *p;
+    size_t                            len;
+    ngx_int_t                         n;
+    ngx_uint_t                        i;
+    ngx_msec_t                        elapsed;
+    ngx_file_info_t                   fi;
+    ngx_http_file_cache_t            *cache;
+    ngx_http_file_cache_node_t       *fcn;
+    ngx_http_file_cache_fast_load_t  *ld;
+    u_char                            key[NGX_HTTP_CACHE_KEY_LEN];
+
+    ld = ctx->data;
+    cache = ld->cache;
+
+    /*
+     * a copy is kept only if the node of the entry exists and the cache
+     * file has the same size and modification time; copies of changed
+     * files are deleted, and so are copies made by workers meanwhile
+     * left intact, as well as temporary files of promotions
+     */
+
+    len = path->len - cache->fast_path->name.len;
+
+    if (len == 1 + cache->path->len + 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
+        && path->data[path->len - 10 - 1] == '.')
+    {
+        return NGX_OK;
+    }
+
+    if (len != 1 + cache->path->len + 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        goto delete;
+    }
+
+    p = &path->data[path->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
+
+        if (n == NGX_ERROR) {
+            goto delete;
+        }
+
+        p += 2;
+
+        key[i] = (u_char) n;
     }
 
-    return ngx_http_file_cache_add(cache, &c);
-}
+    p = ngx_cpymem(ld->name + cache->path->name.len,
+                   path->data + cache->fast_path->name.len, len);
+    *p = '\0';
 
+    if (ngx_file_info(ld->name, &fi) == NGX_FILE_ERROR
+        || ngx_file_mtime(&fi) != ctx->mtime
+        || ngx_file_size(&fi) != ctx->size)
+    {
+        goto delete;
+    }
 
-static ngx_int_t
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
-{
-    ngx_http_file_cache_node_t  *fcn;
+    if (ngx_file_info(path->data, &fi) == NGX_FILE_ERROR) {
+        goto delete;
+    }
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    fcn = ngx_http_file_cache_lookup(cache, key);
 
-    if (fcn == NULL) {
+    if (fcn && (fcn->fast || fcn->promoting)) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        goto next;
+    }
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
-                                     sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_http_file_cache_set_watermark(cache);
+    if (fcn == NULL || !fcn->exists || fcn->purged) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        goto delete;
+    }
 
-            if (cache->fail_time != ngx_time()) {
-                cache->fail_time = ngx_time();
-                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                           "could not allocate node%s", cache->shpool->log_ctx);
-            }
+    fcn->fast = 1;
+    fcn->fast_uniq = ngx_file_uniq(&fi);
 
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
-        }
+    ngx_queue_insert_head(&cache->sh->fast_queue, &fcn->fast_queue);
+    cache->sh->fast_size += fcn->fs_size;
 
-        cache->sh->count++;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    goto next;
 
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+delete:
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    (void) ngx_http_file_cache_delete_file(ctx, path);
 
-        fcn->uses = 1;
-        fcn->exists = 1;
-        fcn->fs_size = c->fs_size;
+next:
 
-        cache->sh->size += c->fs_size;
+    if (++cache->files >= cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(cache);
 
     } else {
-        ngx_queue_remove(&fcn->queue);
-    }
-
-    fcn->expire = ngx_time() + cache->inactive;
-
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
-
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-
-    return NGX_OK;
-}
-
+        ngx_time_update();
 
-static ngx_int_t
-ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
-                   "http file cache delete: \"%s\"", path->data);
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
-    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", path->data);
+        if (elapsed >= cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(cache);
+        }
     }
 
-    return NGX_OK;
+    return (ngx_quit || ngx_terminate || ngx_exiting) ? NGX_ABORT : NGX_OK;
 }
 
 
@@ -2299,22 +4594,96 @@ ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
 }
 
 
+ngx_array_t *
+ngx_http_file_cache_stats(ngx_cycle_t *cycle, ngx_pool_t *pool)
+{
+    ngx_uint_t                   i;
+    ngx_list_part_t             *part;
+    ngx_array_t                 *stats;
+    ngx_shm_zone_t              *shm_zone;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_sh_t    *sh;
+    ngx_http_file_cache_stat_t  *st;
+
+    stats = ngx_array_create(pool, 1, sizeof(ngx_http_file_cache_stat_t));
+    if (stats == NULL) {
+        return NULL;
+    }
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].init != ngx_http_file_cache_init) {
+            continue;
+        }
+
+        cache = shm_zone[i].data;
+        sh = cache->sh;
+
+        if (sh == NULL) {
+            continue;
+        }
+
+        st = ngx_array_push(stats);
+        if (st == NULL) {
+            return NULL;
+        }
+
+        st->name = shm_zone[i].shm.name;
+        st->size = sh->size * cache->bsize;
+        st->entries = sh->count;
+        st->hits = sh->hits;
+        st->stale = sh->stale;
+        st->misses = sh->misses;
+        st->rejected = sh->rejected;
+        st->evicted = sh->evicted;
+        st->purged = sh->purged;
+
+        st->fast = (cache->fast_path != NULL);
+        st->fast_size = sh->fast_size * cache->bsize;
+        st->fast_hits = sh->fast_hits;
+        st->slow_hits = sh->slow_hits;
+        st->promoted = sh->promoted;
+        st->demoted = sh->demoted;
+    }
+
+    return stats;
+}
+
+
 char *
 ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     char  *confp = conf;
 
-    off_t                   max_size;
+    off_t                   max_size, fast_max_size;
     u_char                 *last, *p;
     time_t                  inactive;
-    ssize_t                 size;
-    ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files, manager_files;
+    ssize_t                 size, memory_tier, memory_tier_entry;
+    ngx_str_t               s, name, fast, *value;
+    time_t                  snapshot;
+    ngx_int_t               loader_files, manager_files, loader_processes,
+                            promote_uses;
     ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
                             manager_threshold;
-    ngx_uint_t              i, n, use_temp_path;
+    ngx_uint_t              i, n, use_temp_path, eviction, width, key_hash;
     ngx_array_t            *caches;
     ngx_http_file_cache_t  *cache, **ce;
+#if (NGX_THREADS)
+    ngx_str_t               thread_pool;
+#endif
 
     cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_t));
     if (cache == NULL) {
@@ -2341,6 +4710,18 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     name.len = 0;
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
+    memory_tier = 0;
+    memory_tier_entry = NGX_HTTP_CACHE_MEM_ENTRY;
+    fast.len = 0;
+    fast_max_size = NGX_MAX_OFF_T_VALUE;
+    promote_uses = NGX_HTTP_CACHE_PROMOTE_USES;
+#if (NGX_THREADS)
+    thread_pool.len = 0;
+#endif
+    loader_processes = 1;
+    snapshot = 0;
+    eviction = NGX_HTTP_CACHE_EVICT_LRU;
+    key_hash = NGX_HTTP_CACHE_KEY_MD5;
 
     value = cf->args->elts;
 
@@ -2476,6 +4857,98 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "memory_tier=", 12) == 0) {
+
+            s.len = value[i].len - 12;
+            s.data = value[i].data + 12;
+
+            memory_tier = ngx_parse_size(&s);
+            if (memory_tier == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid memory_tier value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "memory_tier_entry=", 18) == 0) {
+
+            s.len = value[i].len - 18;
+            s.data = value[i].data + 18;
+
+            memory_tier_entry = ngx_parse_size(&s);
+            if (memory_tier_entry == NGX_ERROR || memory_tier_entry == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid memory_tier_entry value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fast_path=", 10) == 0) {
+
+            fast.len = value[i].len - 10;
+            fast.data = value[i].data + 10;
+
+            if (fast.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid fast_path value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fast_max_size=", 14) == 0) {
+
+            s.len = value[i].len - 14;
+            s.data = value[i].data + 14;
+
+            fast_max_size = ngx_parse_offset(&s);
+            if (fast_max_size <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid fast_max_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "promote_uses=", 13) == 0) {
+
+            promote_uses = ngx_atoi(value[i].data + 13, value[i].len - 13);
+
+            /* the "uses" counter of a node has 10 bits */
+
+            if (promote_uses <= 0 || promote_uses > 1023) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid promote_uses value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "promote_threads", 15) == 0
+            && (value[i].len == 15 || value[i].data[15] == '='))
+        {
+
+#if (NGX_THREADS)
+            thread_pool.len = value[i].len > 16 ? value[i].len - 16 : 0;
+            thread_pool.data = value[i].data + 16;
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"promote_threads\" requires "
+                               "threads support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (ngx_strncmp(value[i].data, "loader_files=", 13) == 0) {
 
             loader_files = ngx_atoi(value[i].data + 13, value[i].len - 13);
@@ -2488,6 +4961,69 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "loader_processes=", 17) == 0) {
+
+            loader_processes = ngx_atoi(value[i].data + 17,
+                                        value[i].len - 17);
+            if (loader_processes <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid loader_processes value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "eviction=", 9) == 0) {
+
+            if (ngx_strcmp(&value[i].data[9], "lru") == 0) {
+                eviction = NGX_HTTP_CACHE_EVICT_LRU;
+
+            } else if (ngx_strcmp(&value[i].data[9], "tinylfu") == 0) {
+                eviction = NGX_HTTP_CACHE_EVICT_TINYLFU;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid eviction value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "key_hash=", 9) == 0) {
+
+            if (ngx_strcmp(&value[i].data[9], "md5") == 0) {
+                key_hash = NGX_HTTP_CACHE_KEY_MD5;
+
+            } else if (ngx_strcmp(&value[i].data[9], "murmur3") == 0) {
+                key_hash = NGX_HTTP_CACHE_KEY_MURMUR3;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid key_hash value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "snapshot=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            snapshot = ngx_parse_time(&s, 1);
+            if (snapshot == (time_t) NGX_ERROR || snapshot == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid snapshot value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "loader_sleep=", 13) == 0) {
 
             s.len = value[i].len - 13;
@@ -2575,6 +5111,7 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
     cache->path->data = cache;
+    cache->path->loaders = loader_processes;
     cache->path->conf_file = cf->conf_file->file.name.data;
     cache->path->line = cf->conf_file->line;
     cache->loader_files = loader_files;
@@ -2584,11 +5121,114 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
 
+    if (snapshot) {
+        cache->snapshot.len = cache->path->name.len + sizeof("/snapshot") - 1;
+        cache->snapshot.data = ngx_pnalloc(cf->pool, cache->snapshot.len + 1);
+        if (cache->snapshot.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(cache->snapshot.data, "%V/snapshot%Z", &cache->path->name);
+
+        cache->snapshot_interval = snapshot;
+    }
+
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
 
-    cache->shm_zone = ngx_shared_memory_add(cf, &name, size, cmd->post);
+    if (fast.len) {
+#if (NGX_THREADS)
+        cache->fast_path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+        if (cache->fast_path == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (fast.data[fast.len - 1] == '/') {
+            fast.len--;
+        }
+
+        cache->fast_path->name = fast;
+
+        if (ngx_conf_full_name(cf->cycle, &cache->fast_path->name, 0)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        if (cache->fast_path->name.len == cache->path->name.len
+            && ngx_strncmp(cache->fast_path->name.data,
+                           cache->path->name.data, cache->path->name.len)
+               == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"fast_path\" is the cache path");
+            return NGX_CONF_ERROR;
+        }
+
+        /* the fast tier has the same levels, and is managed with the cache */
+
+        cache->fast_path->len = cache->path->len;
+        ngx_memcpy(cache->fast_path->level, cache->path->level,
+                   sizeof(cache->path->level));
+
+        cache->fast_path->conf_file = cf->conf_file->file.name.data;
+        cache->fast_path->line = cf->conf_file->line;
+
+        if (ngx_add_path(cf, &cache->fast_path) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->fast_name = ngx_pnalloc(cf->pool, cache->fast_path->name.len
+                                       + 1 + cache->fast_path->len
+                                       + 2 * NGX_HTTP_CACHE_KEY_LEN + 1);
+        if (cache->fast_name == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_memcpy(cache->fast_name, cache->fast_path->name.data,
+                   cache->fast_path->name.len);
+
+        cache->promote_thread_pool = ngx_thread_pool_add(cf,
+                                          thread_pool.len ? &thread_pool
+                                                          : NULL);
+        if (cache->promote_thread_pool == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->fast_max_size = fast_max_size;
+        cache->promote_uses = promote_uses;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"fast_path\" requires threads support");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    /* response bodies of the memory tier are kept in the keys zone */
+
+    cache->memory_tier = memory_tier;
+    cache->memory_tier_entry = ngx_min(memory_tier_entry, memory_tier);
+
+    /*
+     * the frequency sketch of the "tinylfu" eviction has roughly
+     * one counter per 128 bytes of the keys zone in each of its rows
+     */
+
+    cache->eviction = eviction;
+    cache->key_hash = key_hash;
+
+    if (eviction == NGX_HTTP_CACHE_EVICT_TINYLFU) {
+        for (width = 1024; width < (ngx_uint_t) size / 128; width <<= 1) {
+            /* void */
+        }
+
+        cache->sketch_width = width;
+        size += NGX_HTTP_CACHE_SKETCH_ROWS * width + ngx_pagesize;
+    }
+
+    cache->shm_zone = ngx_shared_memory_add(cf, &name, size + memory_tier,
+                                            cmd->post);
     if (cache->shm_zone == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -2599,6 +5239,8 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    cache->shm_zone->shm.layout = 1;
+
 
     cache->shm_zone->init = ngx_http_file_cache_init;
     cache->shm_zone->data = cache;
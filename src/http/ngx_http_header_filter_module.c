@@ -11,8 +11,47 @@
 #include <nginx.h>
 
 
+#define NGX_HTTP_HEADER_CACHE_ENTRIES  64
+#define NGX_HTTP_HEADER_CACHE_SIZE     512
+
+
+typedef struct {
+    ngx_http_core_loc_conf_t  *clcf;
+    ngx_uint_t                 status;
+    off_t                      content_length_n;
+    time_t                     last_modified_time;
+
+    size_t                     content_type_len;
+    size_t                     charset_len;
+
+    ngx_http_header_block_t   *block;
+
+    unsigned                   keepalive:1;
+    unsigned                   chunked:1;
+    unsigned                   gzip_vary:1;
+
+    /* offsets in the serialized header */
+    uint16_t                   date;
+    uint16_t                   content_type;
+    uint16_t                   headers;
+    uint16_t                   len;
+
+    u_char                     data[NGX_HTTP_HEADER_CACHE_SIZE];
+} ngx_http_header_cache_t;
+
+
+static ngx_http_header_cache_t **ngx_http_header_filter_entry(
+    ngx_http_request_t *r, ngx_http_core_loc_conf_t *clcf);
+static ngx_buf_t *ngx_http_header_filter_cached(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_http_header_cache_t *hc);
+static void ngx_http_header_filter_cache(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_http_header_cache_t **entry,
+    ngx_buf_t *b, u_char *date, u_char *content_type, u_char *headers,
+    u_char *block);
 static ngx_int_t ngx_http_header_filter_init(ngx_conf_t *cf);
 static ngx_int_t ngx_http_header_filter(ngx_http_request_t *r);
+static ngx_int_t ngx_http_early_hints_filter(ngx_http_request_t *r,
+    ngx_list_t *headers);
 
 
 static ngx_http_module_t  ngx_http_header_filter_module_ctx = {
@@ -153,10 +192,21 @@ ngx_http_header_out_t  ngx_http_headers_out[] = {
 };
 
 
+/*
+ * The serialized headers of the recent responses, per worker process.
+ * An entry is reused only if every input it was built from matches,
+ * so a changed file invalidates it lazily through its new size or
+ * modification time, and only the Date header is patched.
+ */
+
+static ngx_http_header_cache_t  *ngx_http_header_cache[
+                                            NGX_HTTP_HEADER_CACHE_ENTRIES];
+
+
 static ngx_int_t
 ngx_http_header_filter(ngx_http_request_t *r)
 {
-    u_char                    *p;
+    u_char                    *p, *date, *content_type, *headers, *block;
     size_t                     len;
     ngx_str_t                  host, *status_line;
     ngx_buf_t                 *b;
@@ -165,6 +215,7 @@ ngx_http_header_filter(ngx_http_request_t *r)
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
     ngx_connection_t          *c;
+    ngx_http_header_cache_t  **entry;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
@@ -279,6 +330,18 @@ ngx_http_header_filter(ngx_http_request_t *r)
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
+    c = r->connection;
+
+    entry = status_line ? ngx_http_header_filter_entry(r, clcf) : NULL;
+
+    if (entry && *entry) {
+        b = ngx_http_header_filter_cached(r, clcf, *entry);
+
+        if (b) {
+            goto done;
+        }
+    }
+
     if (r->headers_out.server == NULL) {
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
             len += sizeof(ngx_http_server_full_string) - 1;
@@ -318,8 +381,6 @@ ngx_http_header_filter(ngx_http_request_t *r)
         len += sizeof("Last-Modified: Mon, 28 Sep 1970 06:00:00 GMT" CRLF) - 1;
     }
 
-    c = r->connection;
-
     if (r->headers_out.location
         && r->headers_out.location->value.len
         && r->headers_out.location->value.data[0] == '/'
@@ -431,6 +492,10 @@ ngx_http_header_filter(ngx_http_request_t *r)
                + sizeof(CRLF) - 1;
     }
 
+    if (r->headers_out.header_block) {
+        len += r->headers_out.header_block->data.len;
+    }
+
     b = ngx_create_temp_buf(r->pool, len);
     if (b == NULL) {
         return NGX_ERROR;
@@ -465,8 +530,12 @@ ngx_http_header_filter(ngx_http_request_t *r)
         b->last = ngx_cpymem(b->last, p, len);
     }
 
+    date = b->last;
+    content_type = NULL;
+
     if (r->headers_out.date == NULL) {
         b->last = ngx_cpymem(b->last, "Date: ", sizeof("Date: ") - 1);
+        date = b->last;
         b->last = ngx_cpymem(b->last, ngx_cached_http_time.data,
                              ngx_cached_http_time.len);
 
@@ -477,6 +546,7 @@ ngx_http_header_filter(ngx_http_request_t *r)
         b->last = ngx_cpymem(b->last, "Content-Type: ",
                              sizeof("Content-Type: ") - 1);
         p = b->last;
+        content_type = p;
         b->last = ngx_copy(b->last, r->headers_out.content_type.data,
                            r->headers_out.content_type.len);
 
@@ -576,6 +646,8 @@ ngx_http_header_filter(ngx_http_request_t *r)
     }
 #endif
 
+    headers = b->last;
+
     part = &r->headers_out.headers.part;
     header = part->elts;
 
@@ -602,13 +674,29 @@ ngx_http_header_filter(ngx_http_request_t *r)
         *b->last++ = CR; *b->last++ = LF;
     }
 
+    block = b->last;
+
+    if (r->headers_out.header_block) {
+        b->last = ngx_cpymem(b->last, r->headers_out.header_block->data.data,
+                             r->headers_out.header_block->data.len);
+    }
+
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "%*s", (size_t) (b->last - b->pos), b->pos);
 
     /* the end of HTTP header */
     *b->last++ = CR; *b->last++ = LF;
 
-    r->header_size = b->last - b->pos;
+    if (entry) {
+        ngx_http_header_filter_cache(r, clcf, entry, b, date, content_type,
+                                     headers, block);
+    }
+
+done:
+
+    /* early hints may have been sent before */
+
+    r->header_size += b->last - b->pos;
 
     if (r->header_only) {
         b->last_buf = 1;
@@ -621,10 +709,354 @@ ngx_http_header_filter(ngx_http_request_t *r)
 }
 
 
+static ngx_http_header_cache_t **
+ngx_http_header_filter_entry(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf)
+{
+    ngx_uint_t  key;
+
+    /*
+     * only the responses whose headers are built here entirely,
+     * and which do not depend on the connection, are cached; a status
+     * line given as text, such as the one of a proxied response,
+     * is not a part of the key
+     */
+
+    if (r->headers_out.status_line.len
+        || r->headers_out.server
+        || r->headers_out.date
+        || r->headers_out.content_length
+        || r->headers_out.last_modified
+        || r->headers_out.location
+        || r->headers_out.status == NGX_HTTP_SWITCHING_PROTOCOLS)
+    {
+        return NULL;
+    }
+
+    key = (ngx_uint_t) (uintptr_t) clcf;
+    key = ngx_hash(key, r->headers_out.status);
+    key = ngx_hash(key, (ngx_uint_t) r->headers_out.content_length_n);
+    key = ngx_hash(key, (ngx_uint_t) r->headers_out.last_modified_time);
+    key = ngx_hash(key, r->headers_out.content_type.len);
+
+    return &ngx_http_header_cache[key % NGX_HTTP_HEADER_CACHE_ENTRIES];
+}
+
+
+static ngx_buf_t *
+ngx_http_header_filter_cached(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_http_header_cache_t *hc)
+{
+    u_char           *p, *last;
+    size_t            len, charset;
+    ngx_buf_t        *b;
+    ngx_uint_t        i, gzip_vary;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header;
+
+    charset = 0;
+
+    if (r->headers_out.content_type.len
+        && r->headers_out.content_type_len == r->headers_out.content_type.len)
+    {
+        charset = r->headers_out.charset.len;
+    }
+
+#if (NGX_HTTP_GZIP)
+    gzip_vary = (r->gzip_vary && clcf->gzip_vary);
+#else
+    gzip_vary = 0;
+#endif
+
+    if (hc->clcf != clcf
+        || hc->status != r->headers_out.status
+        || hc->content_length_n != r->headers_out.content_length_n
+        || hc->last_modified_time != r->headers_out.last_modified_time
+        || hc->keepalive != r->keepalive
+        || hc->chunked != r->chunked
+        || hc->gzip_vary != gzip_vary
+        || hc->content_type_len != r->headers_out.content_type.len
+        || hc->charset_len != charset
+        || hc->block != r->headers_out.header_block)
+    {
+        return NULL;
+    }
+
+    p = hc->data + hc->content_type;
+
+    if (ngx_memcmp(p, r->headers_out.content_type.data,
+                   r->headers_out.content_type.len)
+        != 0)
+    {
+        return NULL;
+    }
+
+    p += r->headers_out.content_type.len + sizeof("; charset=") - 1;
+
+    if (charset
+        && ngx_memcmp(p, r->headers_out.charset.data, charset) != 0)
+    {
+        return NULL;
+    }
+
+    p = hc->data + hc->headers;
+    last = hc->data + hc->len;
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        if ((size_t) (last - p) < header[i].key.len + header[i].value.len
+                                  + sizeof(": " CRLF) - 1)
+        {
+            return NULL;
+        }
+
+        if (ngx_memcmp(p, header[i].key.data, header[i].key.len) != 0) {
+            return NULL;
+        }
+
+        p += header[i].key.len;
+
+        if (p[0] != ':' || p[1] != ' ') {
+            return NULL;
+        }
+
+        p += sizeof(": ") - 1;
+
+        if (ngx_memcmp(p, header[i].value.data, header[i].value.len) != 0) {
+            return NULL;
+        }
+
+        p += header[i].value.len;
+
+        if (p[0] != CR || p[1] != LF) {
+            return NULL;
+        }
+
+        p += sizeof(CRLF) - 1;
+    }
+
+    if (p != last) {
+        return NULL;
+    }
+
+    len = hc->len + sizeof(CRLF) - 1;
+
+    if (hc->block) {
+        len += hc->block->data.len;
+    }
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->last = ngx_cpymem(b->last, hc->data, hc->len);
+
+    if (hc->block) {
+        b->last = ngx_cpymem(b->last, hc->block->data.data,
+                             hc->block->data.len);
+    }
+
+    /* the end of HTTP header */
+    *b->last++ = CR; *b->last++ = LF;
+
+    ngx_memcpy(b->pos + hc->date, ngx_cached_http_time.data,
+               ngx_cached_http_time.len);
+
+    if (charset) {
+
+        /* update r->headers_out.content_type for possible logging */
+
+        r->headers_out.content_type.len += sizeof("; charset=") - 1 + charset;
+        r->headers_out.content_type.data = b->pos + hc->content_type;
+    }
+
+#if (NGX_HTTP_GZIP)
+    if (r->gzip_vary && !clcf->gzip_vary) {
+        r->gzip_vary = 0;
+    }
+#endif
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http header cache hit: %uz", len);
+
+    return b;
+}
+
+
+static void
+ngx_http_header_filter_cache(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_http_header_cache_t **entry,
+    ngx_buf_t *b, u_char *date, u_char *content_type, u_char *headers,
+    u_char *block)
+{
+    size_t                    charset;
+    ngx_http_header_cache_t  *hc;
+
+    /* the header block and the end of the header are not kept */
+
+    if ((size_t) (block - b->pos) > NGX_HTTP_HEADER_CACHE_SIZE) {
+        return;
+    }
+
+    hc = *entry;
+
+    if (hc == NULL) {
+        hc = ngx_alloc(sizeof(ngx_http_header_cache_t), r->connection->log);
+        if (hc == NULL) {
+            return;
+        }
+
+        *entry = hc;
+    }
+
+    charset = 0;
+
+    if (content_type == NULL) {
+        content_type = b->pos;
+
+    } else if (r->headers_out.content_type.data == content_type) {
+
+        /* the charset was added, see ngx_http_header_filter() */
+
+        charset = r->headers_out.charset.len;
+    }
+
+    hc->clcf = clcf;
+    hc->status = r->headers_out.status;
+    hc->content_length_n = r->headers_out.content_length_n;
+    hc->last_modified_time = r->headers_out.last_modified_time;
+
+    hc->content_type_len = r->headers_out.content_type.len;
+    hc->charset_len = charset;
+    hc->block = r->headers_out.header_block;
+
+    if (charset) {
+        hc->content_type_len = r->headers_out.content_type_len;
+    }
+
+    hc->keepalive = r->keepalive;
+    hc->chunked = r->chunked;
+#if (NGX_HTTP_GZIP)
+    hc->gzip_vary = r->gzip_vary;
+#else
+    hc->gzip_vary = 0;
+#endif
+
+    hc->date = (uint16_t) (date - b->pos);
+    hc->content_type = (uint16_t) (content_type - b->pos);
+    hc->headers = (uint16_t) (headers - b->pos);
+    hc->len = (uint16_t) (block - b->pos);
+
+    ngx_memcpy(hc->data, b->pos, block - b->pos);
+}
+
+
+static ngx_int_t
+ngx_http_early_hints_filter(ngx_http_request_t *r, ngx_list_t *headers)
+{
+    size_t            len;
+    ngx_buf_t        *b;
+    ngx_uint_t        i;
+    ngx_chain_t       out;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header;
+
+    if (r->http_version < NGX_HTTP_VERSION_11) {
+        return NGX_OK;
+    }
+
+    len = sizeof("HTTP/1.1 103 Early Hints" CRLF) - 1
+          /* the end of the header */
+          + sizeof(CRLF) - 1;
+
+    part = &headers->part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        len += header[i].key.len + sizeof(": ") - 1 + header[i].value.len
+               + sizeof(CRLF) - 1;
+    }
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->last, "HTTP/1.1 103 Early Hints" CRLF,
+                         sizeof("HTTP/1.1 103 Early Hints" CRLF) - 1);
+
+    part = &headers->part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        b->last = ngx_copy(b->last, header[i].key.data, header[i].key.len);
+        *b->last++ = ':'; *b->last++ = ' ';
+
+        b->last = ngx_copy(b->last, header[i].value.data, header[i].value.len);
+        *b->last++ = CR; *b->last++ = LF;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "%*s", (size_t) (b->last - b->pos), b->pos);
+
+    *b->last++ = CR; *b->last++ = LF;
+
+    r->header_size = b->last - b->pos;
+
+    b->flush = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_write_filter(r, &out);
+}
+
+
 static ngx_int_t
 ngx_http_header_filter_init(ngx_conf_t *cf)
 {
     ngx_http_top_header_filter = ngx_http_header_filter;
+    ngx_http_top_early_hints_filter = ngx_http_early_hints_filter;
 
     return NGX_OK;
 }
@@ -10,6 +10,16 @@
 #include <ngx_http.h>
 
 
+#if (NGX_HAVE_SSE2 || NGX_HAVE_NEON)
+
+#define NGX_HTTP_PARSE_SIMD  1
+
+static ngx_inline u_char *ngx_http_parse_skip_value(u_char *p, u_char *last);
+static ngx_inline u_char *ngx_http_parse_skip_uri(u_char *p, u_char *last);
+
+#endif
+
+
 static uint32_t  usual[] = {
     0xffffdbfe, /* 1111 1111 1111 1111  1101 1011 1111 1110 */
 
@@ -546,6 +556,9 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_check_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+#if (NGX_HTTP_PARSE_SIMD)
+                p = ngx_http_parse_skip_uri(p + 1, b->last) - 1;
+#endif
                 break;
             }
 
@@ -1035,6 +1048,11 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 goto done;
             case '\0':
                 return NGX_HTTP_PARSE_INVALID_HEADER;
+#if (NGX_HTTP_PARSE_SIMD)
+            default:
+                p = ngx_http_parse_skip_value(p + 1, b->last) - 1;
+                break;
+#endif
             }
             break;
 
@@ -2166,7 +2184,8 @@ ngx_int_t
 ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
     ngx_http_chunked_t *ctx)
 {
-    u_char     *pos, ch, c;
+    off_t       size;
+    u_char     *pos, *p, ch, c;
     ngx_int_t   rc;
     enum {
         sw_chunk_start = 0,
@@ -2192,6 +2211,66 @@ ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
 
     rc = NGX_AGAIN;
 
+    /*
+     * a fast path for the usual chunk size line without extensions,
+     * if it is in the buffer completely; anything else, including
+     * the last chunk, is left to the state machine below
+     */
+
+    if (state == sw_chunk_start || state == sw_after_data) {
+
+        pos = b->pos;
+
+        if (state == sw_after_data) {
+            if (b->last - pos < 2 || pos[0] != CR || pos[1] != LF) {
+                goto slow;
+            }
+
+            pos += 2;
+        }
+
+        size = 0;
+
+        /* up to 15 hexadecimal digits cannot overflow off_t */
+
+        for (p = pos; p < b->last && p - pos < 15; p++) {
+            ch = *p;
+
+            if (ch >= '0' && ch <= '9') {
+                size = size * 16 + (ch - '0');
+                continue;
+            }
+
+            c = (u_char) (ch | 0x20);
+
+            if (c >= 'a' && c <= 'f') {
+                size = size * 16 + (c - 'a' + 10);
+                continue;
+            }
+
+            break;
+        }
+
+        if (size == 0 || b->last - p < 2 || p[0] != CR || p[1] != LF) {
+            goto slow;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http chunked size: %O", size);
+
+        ctx->size = size;
+        state = sw_chunk_data;
+        pos = p + 2;
+
+        if (pos < b->last) {
+            rc = NGX_OK;
+        }
+
+        goto data;
+    }
+
+slow:
+
     for (pos = b->pos; pos < b->last; pos++) {
 
         ch = *pos;
@@ -2428,3 +2507,134 @@ invalid:
 
     return NGX_ERROR;
 }
+
+
+#if (NGX_HTTP_PARSE_SIMD)
+
+/*
+ * the functions below skip 16 bytes at a time while there is nothing
+ * the parser state machine has to look at; they return a pointer to
+ * the first byte to be parsed byte by byte, which is either a byte of
+ * interest or one of the last less than 16 bytes of the buffer
+ */
+
+static ngx_inline u_char *
+ngx_http_parse_skip_value(u_char *p, u_char *last)
+{
+#if (NGX_HAVE_SSE2)
+
+    int      mask;
+    __m128i  v, sp;
+
+    /* space, CR, LF, and NUL are all not greater than space */
+
+    sp = _mm_set1_epi8(' ');
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, sp), v));
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+#else /* NGX_HAVE_NEON */
+
+    uint64_t    mask;
+    uint8x16_t  v, sp;
+
+    sp = vdupq_n_u8(' ');
+
+    while (last - p >= 16) {
+        v = vld1q_u8(p);
+
+        /* 4 bits of the mask per byte */
+
+        mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(
+                   vreinterpretq_u16_u8(vcleq_u8(v, sp)), 4)), 0);
+
+        if (mask) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+
+        p += 16;
+    }
+
+#endif
+
+    return p;
+}
+
+
+static ngx_inline u_char *
+ngx_http_parse_skip_uri(u_char *p, u_char *last)
+{
+#if (NGX_HAVE_SSE2)
+
+    int      mask;
+    __m128i  v, l, plain;
+
+    /* letters, digits, "-", and "_" do not change the parser state */
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+        l = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+        plain = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                              _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1)));
+
+        plain = _mm_or_si128(plain,
+                    _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1))));
+
+        plain = _mm_or_si128(plain,
+                             _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+                                          _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))));
+
+        mask = _mm_movemask_epi8(plain) ^ 0xffff;
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+#else /* NGX_HAVE_NEON */
+
+    uint64_t    mask;
+    uint8x16_t  v, l, plain;
+
+    while (last - p >= 16) {
+        v = vld1q_u8(p);
+        l = vorrq_u8(v, vdupq_n_u8(0x20));
+
+        plain = vandq_u8(vcgeq_u8(l, vdupq_n_u8('a')),
+                         vcleq_u8(l, vdupq_n_u8('z')));
+
+        plain = vorrq_u8(plain, vandq_u8(vcgeq_u8(v, vdupq_n_u8('0')),
+                                         vcleq_u8(v, vdupq_n_u8('9'))));
+
+        plain = vorrq_u8(plain, vorrq_u8(vceqq_u8(v, vdupq_n_u8('-')),
+                                         vceqq_u8(v, vdupq_n_u8('_'))));
+
+        mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(
+                   vreinterpretq_u16_u8(vmvnq_u8(plain)), 4)), 0);
+
+        if (mask) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+
+        p += 16;
+    }
+
+#endif
+
+    return p;
+}
+
+#endif
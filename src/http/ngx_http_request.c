@@ -10,7 +10,25 @@
 #include <ngx_http.h>
 
 
+/*
+ * an idle keepalive connection without c->pool, the state needed to
+ * recreate the pool is followed by the client address, the local address
+ * if it is not the listening one, and the client address text
+ */
+
+typedef struct {
+    ngx_http_connection_t   hc;
+    ngx_http_log_ctx_t      ctx;
+    ngx_log_t               log;
+    size_t                  size;
+    unsigned                local:1;
+} ngx_http_parked_connection_t;
+
+
 static void ngx_http_wait_request_handler(ngx_event_t *ev);
+#if (NGX_QUIC)
+static void ngx_http_quic_init(ngx_connection_t *c);
+#endif
 static ngx_http_request_t *ngx_http_alloc_request(ngx_connection_t *c);
 static void ngx_http_process_request_line(ngx_event_t *rev);
 static void ngx_http_process_request_headers(ngx_event_t *rev);
@@ -49,6 +67,12 @@ static void ngx_http_request_finalizer(ngx_http_request_t *r);
 
 static void ngx_http_set_keepalive(ngx_http_request_t *r);
 static void ngx_http_keepalive_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_park_connection(ngx_connection_t *c);
+static ngx_int_t ngx_http_unpark_connection(ngx_connection_t *c);
+static void ngx_http_idle_stat(ngx_connection_t *c, ngx_int_t n);
+static ngx_int_t ngx_http_send_pipelined(ngx_connection_t *c,
+    ngx_http_connection_t *hc);
+static void ngx_http_pipelined_handler(ngx_event_t *wev);
 static void ngx_http_set_lingering_close(ngx_http_request_t *r);
 static void ngx_http_lingering_close_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_post_action(ngx_http_request_t *r);
@@ -65,6 +89,12 @@ static void ngx_http_ssl_handshake_handler(ngx_connection_t *c);
 #endif
 
 
+/* the main request whose handler is running, for CPU time accounting */
+
+ngx_http_request_t  *ngx_http_cpu_request;
+static uint64_t      ngx_http_cpu_start;
+
+
 static char *ngx_http_client_errors[] = {
 
     /* NGX_HTTP_PARSE_INVALID_METHOD */
@@ -320,6 +350,13 @@ ngx_http_init_connection(ngx_connection_t *c)
 
     c->log_error = NGX_ERROR_INFO;
 
+#if (NGX_QUIC)
+    if (hc->addr_conf->quic) {
+        ngx_http_quic_init(c);
+        return;
+    }
+#endif
+
     rev = c->read;
     rev->handler = ngx_http_wait_request_handler;
     c->write->handler = ngx_http_empty_handler;
@@ -371,6 +408,44 @@ ngx_http_init_connection(ngx_connection_t *c)
 }
 
 
+#if (NGX_QUIC)
+
+static void
+ngx_http_quic_init(ngx_connection_t *c)
+{
+    ngx_quic_conf_t           *qcf;
+    ngx_http_connection_t     *hc;
+    ngx_http_ssl_srv_conf_t   *sscf;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    hc = c->data;
+
+    qcf = ngx_palloc(c->pool, sizeof(ngx_quic_conf_t));
+    if (qcf == NULL) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    sscf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_ssl_module);
+    clcf = ngx_http_get_module_loc_conf(hc->conf_ctx, ngx_http_core_module);
+
+    qcf->ssl = &sscf->ssl;
+    qcf->handshake_timeout = c->listening->post_accept_timeout;
+
+    /* there are no requests yet, so the connection is kept as idle one */
+
+    qcf->timeout = clcf->keepalive_timeout ? clcf->keepalive_timeout
+                                           : qcf->handshake_timeout;
+
+    hc->ssl = 1;
+    c->log->action = "QUIC handshaking";
+
+    ngx_quic_run(c, qcf);
+}
+
+#endif
+
+
 static void
 ngx_http_wait_request_handler(ngx_event_t *rev)
 {
@@ -605,7 +680,7 @@ ngx_http_alloc_request(ngx_connection_t *c)
     }
 
 #if (NGX_HTTP_SSL)
-    if (c->ssl) {
+    if (c->ssl && !c->ssl->sendfile) {
         r->main_filter_need_in_memory = 1;
     }
 #endif
@@ -1012,6 +1087,7 @@ ngx_http_ssl_certificate(ngx_ssl_conn_t *ssl_conn, void *arg)
                        "ssl key: \"%s\"", key.data);
 
         if (ngx_ssl_connection_certificate(c, r->pool, &cert, &key,
+                                           sscf->certificate_cache,
                                            sscf->passwords)
             != NGX_OK)
         {
@@ -1057,6 +1133,8 @@ ngx_http_process_request_line(ngx_event_t *rev)
         return;
     }
 
+    ngx_http_cpu_enter(r);
+
     rc = NGX_AGAIN;
 
     for ( ;; ) {
@@ -1195,6 +1273,8 @@ ngx_http_process_request_line(ngx_event_t *rev)
     }
 
     ngx_http_run_posted_requests(c);
+
+    ngx_http_cpu_leave();
 }
 
 
@@ -1342,6 +1422,8 @@ ngx_http_process_request_headers(ngx_event_t *rev)
         return;
     }
 
+    ngx_http_cpu_enter(r);
+
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
 
     rc = NGX_AGAIN;
@@ -1500,6 +1582,8 @@ ngx_http_process_request_headers(ngx_event_t *rev)
     }
 
     ngx_http_run_posted_requests(c);
+
+    ngx_http_cpu_leave();
 }
 
 
@@ -2057,6 +2141,8 @@ ngx_http_process_request(ngx_http_request_t *r)
     c->write->handler = ngx_http_request_handler;
     r->read_event_handler = ngx_http_block_reading;
 
+    ngx_probe1(http_request_start, r);
+
     ngx_http_handler(r);
 }
 
@@ -2335,10 +2421,13 @@ ngx_http_request_handler(ngx_event_t *ev)
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http run request: \"%V?%V\"", &r->uri, &r->args);
 
+    ngx_http_cpu_enter(r);
+
     if (c->close) {
         r->main->count++;
         ngx_http_terminate_request(r, 0);
         ngx_http_run_posted_requests(c);
+        ngx_http_cpu_leave();
         return;
     }
 
@@ -2355,6 +2444,8 @@ ngx_http_request_handler(ngx_event_t *ev)
     }
 
     ngx_http_run_posted_requests(c);
+
+    ngx_http_cpu_leave();
 }
 
 
@@ -2391,6 +2482,31 @@ ngx_http_run_posted_requests(ngx_connection_t *c)
 }
 
 
+void
+ngx_http_cpu_switch(ngx_http_request_t *r)
+{
+    uint64_t         now;
+    struct timespec  ts;
+
+    /* the CPU time of the thread, so the thread pools are not counted */
+
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    (void) clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+#else
+    (void) clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+#endif
+
+    now = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    if (ngx_http_cpu_request) {
+        ngx_http_cpu_request->cpu_time += now - ngx_http_cpu_start;
+    }
+
+    ngx_http_cpu_request = r ? r->main : NULL;
+    ngx_http_cpu_start = now;
+}
+
+
 ngx_int_t
 ngx_http_post_request(ngx_http_request_t *r, ngx_http_posted_request_t *pr)
 {
@@ -3218,6 +3334,32 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
         hc->nbusy = 0;
     }
 
+    if (hc->pipelined) {
+
+        /* the responses held for the last of the pipelined requests */
+
+        switch (ngx_http_send_pipelined(c, hc)) {
+
+        case NGX_ERROR:
+            ngx_http_close_connection(c);
+            return;
+
+        case NGX_AGAIN:
+            wev->handler = ngx_http_pipelined_handler;
+
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_close_connection(c);
+                return;
+            }
+
+            break;
+
+        default: /* NGX_OK */
+            ngx_pfree(c->pool, hc->pipelined->start);
+            hc->pipelined = NULL;
+        }
+    }
+
 #if (NGX_HTTP_SSL)
     if (c->ssl) {
         ngx_ssl_free_buffer(c);
@@ -3226,7 +3368,10 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
 
     rev->handler = ngx_http_keepalive_handler;
 
-    if (wev->active && (ngx_event_flags & NGX_USE_LEVEL_EVENT)) {
+    if (wev->active
+        && wev->handler == ngx_http_empty_handler
+        && (ngx_event_flags & NGX_USE_LEVEL_EVENT))
+    {
         if (ngx_del_event(wev, NGX_WRITE_EVENT, 0) != NGX_OK) {
             ngx_http_close_connection(c);
             return;
@@ -3259,11 +3404,15 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
     r->http_state = NGX_HTTP_KEEPALIVE_STATE;
 #endif
 
+    ngx_http_idle_stat(c, 1);
+
     c->idle = 1;
     ngx_reusable_connection(c, 1);
 
     ngx_add_timer(rev, clcf->keepalive_timeout);
 
+    (void) ngx_http_park_connection(c);
+
     if (rev->ready) {
         ngx_post_event(rev, &ngx_posted_events);
     }
@@ -3307,6 +3456,11 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
 
 #endif
 
+    if (c->pool == NULL && ngx_http_unpark_connection(c) != NGX_OK) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
     b = c->buffer;
     size = b->end - b->start;
 
@@ -3360,6 +3514,8 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
             b->pos = NULL;
         }
 
+        (void) ngx_http_park_connection(c);
+
         return;
     }
 
@@ -3382,6 +3538,8 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
     c->log->handler = ngx_http_log_error;
     c->log->action = "reading client request line";
 
+    ngx_http_idle_stat(c, -1);
+
     c->idle = 0;
     ngx_reusable_connection(c, 0);
 
@@ -3401,6 +3559,297 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
 }
 
 
+static ngx_int_t
+ngx_http_park_connection(ngx_connection_t *c)
+{
+    u_char                        *p;
+    size_t                         size;
+    ngx_uint_t                     local;
+    ngx_pool_t                    *pool;
+    ngx_pool_large_t              *l;
+    ngx_http_log_ctx_t            *ctx;
+    ngx_http_parked_connection_t  *pc;
+
+    /*
+     * An idle keepalive connection does not need c->pool: the little
+     * state it has is moved to a single allocation of the exact size,
+     * and the pool is destroyed until the next request arrives.
+     *
+     * The SSL state, the PROXY protocol header, cleanup handlers and
+     * large allocations still in use may be referenced from elsewhere,
+     * so such connections keep their pools.
+     */
+
+#if (NGX_HTTP_SSL)
+    if (c->ssl) {
+        return NGX_DECLINED;
+    }
+#endif
+
+    if (c->proxy_protocol || c->pool->cleanup) {
+        return NGX_DECLINED;
+    }
+
+    if (((ngx_http_connection_t *) c->data)->pipelined) {
+        return NGX_DECLINED;
+    }
+
+    for (l = c->pool->large; l; l = l->next) {
+        if (l->alloc) {
+            return NGX_DECLINED;
+        }
+    }
+
+    local = (c->local_sockaddr != c->listening->sockaddr);
+
+    size = sizeof(ngx_http_parked_connection_t)
+           + ngx_align(c->socklen, NGX_ALIGNMENT)
+           + (local ? c->local_socklen : 0) + c->addr_text.len;
+
+    pc = ngx_alloc(size, c->log);
+    if (pc == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_http_idle_stat(c, -1);
+
+    ctx = c->log->data;
+
+    pc->hc = *(ngx_http_connection_t *) c->data;
+    pc->ctx = *ctx;
+    pc->log = *c->log;
+    pc->log.data = &pc->ctx;
+    pc->size = size;
+    pc->local = local;
+
+    p = (u_char *) pc + sizeof(ngx_http_parked_connection_t);
+
+    ngx_memcpy(p, c->sockaddr, c->socklen);
+    c->sockaddr = (struct sockaddr *) p;
+    p += ngx_align(c->socklen, NGX_ALIGNMENT);
+
+    if (local) {
+        ngx_memcpy(p, c->local_sockaddr, c->local_socklen);
+        c->local_sockaddr = (struct sockaddr *) p;
+        p += c->local_socklen;
+    }
+
+    ngx_memcpy(p, c->addr_text.data, c->addr_text.len);
+    c->addr_text.data = p;
+
+    pool = c->pool;
+
+    c->pool = NULL;
+    c->buffer = NULL;
+    c->data = pc;
+
+    c->log = &pc->log;
+    c->read->log = c->log;
+    c->write->log = c->log;
+
+    pool->log = c->log;
+
+    ngx_destroy_pool(pool);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http keepalive parked: %uz", size);
+
+    ngx_http_idle_stat(c, 1);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_unpark_connection(ngx_connection_t *c)
+{
+    u_char                        *addr_text;
+    ngx_log_t                     *log;
+    ngx_buf_t                     *b;
+    ngx_pool_t                    *pool;
+    struct sockaddr               *sockaddr, *local_sockaddr;
+    ngx_http_log_ctx_t            *ctx;
+    ngx_http_connection_t         *hc;
+    ngx_http_core_srv_conf_t      *cscf;
+    ngx_http_parked_connection_t  *pc;
+
+    pc = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http keepalive unpark");
+
+    cscf = ngx_http_get_module_srv_conf(pc->hc.conf_ctx, ngx_http_core_module);
+
+    pool = ngx_create_pool(c->listening->pool_size, c->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    hc = ngx_palloc(pool, sizeof(ngx_http_connection_t));
+    ctx = ngx_palloc(pool, sizeof(ngx_http_log_ctx_t));
+    log = ngx_palloc(pool, sizeof(ngx_log_t));
+    sockaddr = ngx_palloc(pool, c->socklen);
+    addr_text = ngx_pnalloc(pool, c->addr_text.len);
+    b = ngx_create_temp_buf(pool, cscf->client_header_buffer_size);
+
+    if (hc == NULL || ctx == NULL || log == NULL || sockaddr == NULL
+        || addr_text == NULL || b == NULL)
+    {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    if (pc->local) {
+        local_sockaddr = ngx_palloc(pool, c->local_socklen);
+        if (local_sockaddr == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(local_sockaddr, c->local_sockaddr, c->local_socklen);
+        c->local_sockaddr = local_sockaddr;
+    }
+
+    ngx_http_idle_stat(c, -1);
+
+    *hc = pc->hc;
+    *ctx = pc->ctx;
+    *log = pc->log;
+    log->data = ctx;
+
+    ngx_memcpy(sockaddr, c->sockaddr, c->socklen);
+    c->sockaddr = sockaddr;
+
+    ngx_memcpy(addr_text, c->addr_text.data, c->addr_text.len);
+    c->addr_text.data = addr_text;
+
+    c->pool = pool;
+    c->buffer = b;
+    c->data = hc;
+
+    c->log = log;
+    c->read->log = log;
+    c->write->log = log;
+
+    pool->log = log;
+
+    ngx_free(pc);
+
+    ngx_http_idle_stat(c, 1);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_idle_stat(ngx_connection_t *c, ngx_int_t n)
+{
+    ngx_http_connection_t         *hc;
+    ngx_http_parked_connection_t  *pc;
+
+    if (!ngx_event_loop_timing) {
+        return;
+    }
+
+    if (c->pool == NULL) {
+        pc = c->data;
+        ngx_event_loop_idle(1, n, n * (ssize_t) pc->size);
+        return;
+    }
+
+    hc = c->data;
+
+    if (n > 0) {
+        hc->memory = ngx_pool_memory(c->pool);
+    }
+
+    ngx_event_loop_idle(0, n, n * (ssize_t) hc->memory);
+}
+
+
+static ngx_int_t
+ngx_http_send_pipelined(ngx_connection_t *c, ngx_http_connection_t *hc)
+{
+    off_t       sent;
+    ssize_t     n;
+    ngx_buf_t  *b;
+
+    b = hc->pipelined;
+
+    /* the held bytes have been already accounted to their requests */
+
+    sent = c->sent;
+
+    while (b->pos < b->last) {
+
+        n = c->send(c, b->pos, b->last - b->pos);
+
+        if (n == NGX_ERROR) {
+            c->sent = sent;
+            c->error = 1;
+            return NGX_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            c->sent = sent;
+            return NGX_AGAIN;
+        }
+
+        b->pos += n;
+    }
+
+    c->sent = sent;
+
+    b->pos = b->start;
+    b->last = b->start;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_pipelined_handler(ngx_event_t *wev)
+{
+    ngx_connection_t       *c;
+    ngx_http_connection_t  *hc;
+
+    c = wev->data;
+    hc = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http pipelined handler");
+
+    switch (ngx_http_send_pipelined(c, hc)) {
+
+    case NGX_ERROR:
+        ngx_http_close_connection(c);
+        return;
+
+    case NGX_AGAIN:
+        if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+            ngx_http_close_connection(c);
+        }
+
+        return;
+
+    default: /* NGX_OK */
+        break;
+    }
+
+    wev->handler = ngx_http_empty_handler;
+
+    if (wev->active && (ngx_event_flags & NGX_USE_LEVEL_EVENT)) {
+        if (ngx_del_event(wev, NGX_WRITE_EVENT, 0) != NGX_OK) {
+            ngx_http_close_connection(c);
+            return;
+        }
+    }
+
+    ngx_pfree(c->pool, hc->pipelined->start);
+    hc->pipelined = NULL;
+
+    (void) ngx_http_park_connection(c);
+}
+
+
 static void
 ngx_http_set_lingering_close(ngx_http_request_t *r)
 {
@@ -3433,6 +3882,10 @@ ngx_http_set_lingering_close(ngx_http_request_t *r)
         }
     }
 
+    if (r->http_connection->pipelined) {
+        (void) ngx_http_send_pipelined(c, r->http_connection);
+    }
+
     if (ngx_shutdown_socket(c->fd, NGX_WRITE_SHUTDOWN) == -1) {
         ngx_connection_error(c, ngx_socket_errno,
                              ngx_shutdown_socket_n " failed");
@@ -3623,6 +4076,10 @@ ngx_http_close_request(ngx_http_request_t *r, ngx_int_t rc)
     }
 #endif
 
+    if (r->http_connection->pipelined && !c->error) {
+        (void) ngx_http_send_pipelined(c, r->http_connection);
+    }
+
     ngx_http_free_request(r, rc);
     ngx_http_close_connection(c);
 }
@@ -3647,6 +4104,8 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
         return;
     }
 
+    ngx_probe2(http_request_done, r, r->headers_out.status);
+
     cln = r->cleanup;
     r->cleanup = NULL;
 
@@ -3674,6 +4133,10 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
         r->headers_out.status = rc;
     }
 
+    if (ngx_http_cpu_request == r) {
+        ngx_http_cpu_switch(NULL);
+    }
+
     if (!r->logged) {
         log->action = "logging request";
 
@@ -3739,11 +4202,28 @@ ngx_http_log_request(ngx_http_request_t *r)
 void
 ngx_http_close_connection(ngx_connection_t *c)
 {
+    void        *parked;
     ngx_pool_t  *pool;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "close http connection: %d", c->fd);
 
+    if (c->fd == (ngx_socket_t) -1) {
+
+        /*
+         * a detached mirror request, the connection memory belongs
+         * to the mirror module and the request pool is already freed
+         */
+
+        c->destroyed = 1;
+        return;
+    }
+
+    if (c->idle && c->read->handler == ngx_http_keepalive_handler) {
+        ngx_http_idle_stat(c, -1);
+        c->idle = 0;
+    }
+
 #if (NGX_HTTP_SSL)
 
     if (c->ssl) {
@@ -3763,9 +4243,18 @@ ngx_http_close_connection(ngx_connection_t *c)
 
     pool = c->pool;
 
+    /* a parked keepalive connection has no pool */
+
+    parked = pool ? NULL : c->data;
+
     ngx_close_connection(c);
 
-    ngx_destroy_pool(pool);
+    if (pool) {
+        ngx_destroy_pool(pool);
+
+    } else {
+        ngx_free(parked);
+    }
 }
 
 
@@ -148,6 +148,7 @@
 #define NGX_HTTP_SSI_BUFFERED              0x01
 #define NGX_HTTP_SUB_BUFFERED              0x02
 #define NGX_HTTP_COPY_BUFFERED             0x04
+#define NGX_HTTP_RANGE_BUFFERED            0x08
 
 
 typedef enum {
@@ -178,9 +179,22 @@ typedef struct {
 } ngx_http_header_out_t;
 
 
+typedef struct {
+    ngx_table_elt_t                 **elts;
+    ngx_uint_t                        mask;
+
+    /* the end of the headers list when the index was built */
+    ngx_list_part_t                  *last;
+    ngx_uint_t                        nelts;
+} ngx_http_headers_index_t;
+
+
 typedef struct {
     ngx_list_t                        headers;
 
+    /* built on the first $http_* lookup of an unknown header */
+    ngx_http_headers_index_t         *index;
+
     ngx_table_elt_t                  *host;
     ngx_table_elt_t                  *connection;
     ngx_table_elt_t                  *if_modified_since;
@@ -251,6 +265,16 @@ typedef struct {
 } ngx_http_headers_in_t;
 
 
+/* the headers known when the configuration is read, see add_header */
+
+typedef struct {
+    ngx_list_part_t                   part;     /* ngx_table_elt_t */
+    ngx_str_t                         data;     /* serialized for HTTP/1.x */
+    size_t                            size;     /* names and values */
+    size_t                            max;      /* the longest name or value */
+} ngx_http_header_block_t;
+
+
 typedef struct {
     ngx_list_t                        headers;
     ngx_list_t                        trailers;
@@ -271,6 +295,8 @@ typedef struct {
     ngx_table_elt_t                  *expires;
     ngx_table_elt_t                  *etag;
 
+    ngx_http_header_block_t          *header_block;
+
     ngx_str_t                        *override_charset;
 
     size_t                            content_type_len;
@@ -297,6 +323,7 @@ typedef struct {
     ngx_buf_t                        *buf;
     off_t                             rest;
     off_t                             received;
+    size_t                            memory;
     ngx_chain_t                      *free;
     ngx_chain_t                      *busy;
     ngx_http_chunked_t               *chunked;
@@ -322,6 +349,12 @@ typedef struct {
 
     ngx_chain_t                      *free;
 
+    /* responses held while the next pipelined request is processed */
+    ngx_buf_t                        *pipelined;
+
+    /* pool memory of an idle keepalive connection, for the statistics */
+    size_t                            memory;
+
     unsigned                          ssl:1;
     unsigned                          proxy_protocol:1;
 } ngx_http_connection_t;
@@ -401,6 +434,8 @@ struct ngx_http_request_s {
     time_t                            start_sec;
     ngx_msec_t                        start_msec;
 
+    uint64_t                          cpu_time;     /* in nanoseconds */
+
     ngx_uint_t                        method;
     ngx_uint_t                        http_version;
 
@@ -450,6 +485,10 @@ struct ngx_http_request_s {
 
     ngx_http_cleanup_t               *cleanup;
 
+#if (NGX_THREADS || NGX_COMPAT)
+    ngx_thread_task_t                *open_file_task;
+#endif
+
     unsigned                          count:16;
     unsigned                          subrequests:8;
     unsigned                          blocked:8;
@@ -483,6 +522,7 @@ struct ngx_http_request_s {
     unsigned                          request_body_in_persistent_file:1;
     unsigned                          request_body_in_clean_file:1;
     unsigned                          request_body_file_group_access:1;
+    unsigned                          request_body_file_preallocate:1;
     unsigned                          request_body_file_log_level:3;
     unsigned                          request_body_no_buffering:1;
 
@@ -537,6 +577,7 @@ struct ngx_http_request_s {
     unsigned                          request_complete:1;
     unsigned                          request_output:1;
     unsigned                          header_sent:1;
+    unsigned                          early_hints_sent:1;
     unsigned                          expect_tested:1;
     unsigned                          root_tested:1;
     unsigned                          done:1;
@@ -612,4 +653,24 @@ extern ngx_http_header_out_t   ngx_http_headers_out[];
     ((ngx_http_log_ctx_t *) log->data)->current_request = r
 
 
+/*
+ * the CPU time of an event handler is charged to the main request it
+ * runs for; the handler may free the request, so the time is charged
+ * on leaving only if the request is still there
+ */
+
+#define ngx_http_cpu_enter(r)                                                 \
+    if (((ngx_http_core_main_conf_t *)                                        \
+         ngx_http_get_module_main_conf(r, ngx_http_core_module))              \
+        ->cpu_accounting)                                                     \
+    {                                                                         \
+        ngx_http_cpu_switch(r);                                               \
+    }
+
+#define ngx_http_cpu_leave()                                                  \
+    if (ngx_http_cpu_request) {                                               \
+        ngx_http_cpu_switch(NULL);                                            \
+    }
+
+
 #endif /* _NGX_HTTP_REQUEST_H_INCLUDED_ */
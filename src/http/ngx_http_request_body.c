@@ -13,6 +13,8 @@
 static void ngx_http_read_client_request_body_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_do_read_client_request_body(ngx_http_request_t *r);
 static ngx_int_t ngx_http_write_request_body(ngx_http_request_t *r);
+static ngx_int_t ngx_http_request_body_next_buffer(ngx_http_request_t *r);
+static void ngx_http_request_body_memory_cleanup(void *data);
 static ngx_int_t ngx_http_read_discarded_request_body(ngx_http_request_t *r);
 static ngx_int_t ngx_http_discard_request_body_filter(ngx_http_request_t *r,
     ngx_buf_t *b);
@@ -26,6 +28,11 @@ static ngx_int_t ngx_http_request_body_chunked_filter(ngx_http_request_t *r,
     ngx_chain_t *in);
 
 
+
+/* memory used by request bodies over client_body_buffer_size, per worker */
+
+static size_t  ngx_http_request_body_memory;
+
 ngx_int_t
 ngx_http_read_client_request_body(ngx_http_request_t *r,
     ngx_http_client_body_handler_pt post_handler)
@@ -480,6 +487,12 @@ ngx_http_write_request_body(ngx_http_request_t *r)
             tf->access = 0660;
         }
 
+        if (r->request_body_file_preallocate
+            && r->headers_in.content_length_n > 0)
+        {
+            tf->preallocate = r->headers_in.content_length_n;
+        }
+
         rb->temp_file = tf;
 
         if (rb->bufs == NULL) {
@@ -1103,6 +1116,7 @@ ngx_http_request_body_chunked_filter(ngx_http_request_t *r, ngx_chain_t *in)
 ngx_int_t
 ngx_http_request_body_save_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
+    ngx_int_t                  rc;
     ngx_buf_t                 *b;
     ngx_chain_t               *cl;
     ngx_http_request_body_t   *rb;
@@ -1149,10 +1163,18 @@ ngx_http_request_body_save_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     if (rb->rest > 0) {
 
-        if (rb->buf && rb->buf->last == rb->buf->end
-            && ngx_http_write_request_body(r) != NGX_OK)
-        {
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        if (rb->buf && rb->buf->last == rb->buf->end) {
+
+            rc = ngx_http_request_body_next_buffer(r);
+
+            if (rc == NGX_ERROR) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            if (rc == NGX_DECLINED && ngx_http_write_request_body(r) != NGX_OK)
+            {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
         }
 
         return NGX_OK;
@@ -1187,3 +1209,112 @@ ngx_http_request_body_save_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     return NGX_OK;
 }
+
+
+/*
+ * with "client_body_memory_budget", a full read buffer is kept in memory
+ * and reading continues to a new buffer, as long as the worker budget
+ * allows; otherwise the body is written to a temporary file
+ */
+
+static ngx_int_t
+ngx_http_request_body_next_buffer(ngx_http_request_t *r)
+{
+    size_t                      size;
+    u_char                     *p;
+    ngx_buf_t                  *b;
+    ngx_chain_t                *cl;
+    ngx_pool_cleanup_t         *cln;
+    ngx_http_request_body_t    *rb;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    rb = r->request_body;
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    if (cmcf->client_body_memory_budget == 0
+        || rb->temp_file
+        || r->request_body_in_file_only
+        || r->request_body_in_single_buf)
+    {
+        return NGX_DECLINED;
+    }
+
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        return NGX_DECLINED;
+    }
+#endif
+
+    size = rb->buf->end - rb->buf->start;
+
+    if (ngx_http_request_body_memory + size > cmcf->client_body_memory_budget)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http client request body memory budget exceeded, "
+                       "used: %uz", ngx_http_request_body_memory);
+        return NGX_DECLINED;
+    }
+
+    p = ngx_pnalloc(r->pool, size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (rb->memory == 0) {
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_request_body_memory_cleanup;
+        cln->data = rb;
+    }
+
+    /*
+     * buffers saved point to the read buffer memory and are busy;
+     * they are replaced with copies, and the originals are marked
+     * as consumed to be reused by the body filters
+     */
+
+    for (cl = rb->bufs; cl; cl = cl->next) {
+
+        if (cl->buf->tag != (ngx_buf_tag_t) &ngx_http_read_client_request_body) {
+            continue;
+        }
+
+        b = ngx_alloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        *b = *cl->buf;
+        b->tag = (ngx_buf_tag_t) &ngx_http_request_body_save_filter;
+
+        cl->buf->pos = cl->buf->last;
+        cl->buf = b;
+    }
+
+    rb->memory += size;
+    ngx_http_request_body_memory += size;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http client request body in memory: %uz, used: %uz",
+                   rb->memory, ngx_http_request_body_memory);
+
+    rb->buf->start = p;
+    rb->buf->pos = p;
+    rb->buf->last = p;
+    rb->buf->end = p + size;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_request_body_memory_cleanup(void *data)
+{
+    ngx_http_request_body_t  *rb = data;
+
+    ngx_http_request_body_memory -= rb->memory;
+}
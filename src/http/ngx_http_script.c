@@ -11,6 +11,10 @@
 
 
 static ngx_int_t ngx_http_script_init_arrays(ngx_http_script_compile_t *sc);
+static ngx_int_t ngx_http_script_compile_parts(ngx_conf_t *cf,
+    ngx_http_complex_value_t *cv);
+static ngx_int_t ngx_http_complex_value_parts(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value);
 static ngx_int_t ngx_http_script_done(ngx_http_script_compile_t *sc);
 static ngx_int_t ngx_http_script_add_copy_code(ngx_http_script_compile_t *sc,
     ngx_str_t *value, ngx_uint_t last);
@@ -70,6 +74,10 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 
     ngx_http_script_flush_complex_value(r, val);
 
+    if (val->parts) {
+        return ngx_http_complex_value_parts(r, val, value);
+    }
+
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
 
     e.ip = val->lengths;
@@ -104,6 +112,67 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 }
 
 
+static ngx_int_t
+ngx_http_complex_value_parts(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value)
+{
+    u_char                     *p;
+    size_t                      len;
+    ngx_uint_t                  i;
+    ngx_http_script_part_t     *part;
+    ngx_http_variable_value_t  *vv;
+
+    part = val->parts;
+    len = 0;
+
+    /*
+     * variables were flushed, so the second lookup of a variable
+     * returns the value computed by the first one
+     */
+
+    for (i = 0; i < val->nparts; i++) {
+
+        if (part[i].text.data) {
+            len += part[i].text.len;
+            continue;
+        }
+
+        vv = ngx_http_get_indexed_variable(r, part[i].index);
+
+        if (vv && !vv->not_found) {
+            len += vv->len;
+        }
+    }
+
+    value->len = len;
+    value->data = ngx_pnalloc(r->pool, len);
+    if (value->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = value->data;
+
+    for (i = 0; i < val->nparts; i++) {
+
+        if (part[i].text.data) {
+            p = ngx_cpymem(p, part[i].text.data, part[i].text.len);
+            continue;
+        }
+
+        vv = ngx_http_get_indexed_variable(r, part[i].index);
+
+        if (vv && !vv->not_found) {
+            p = ngx_cpymem(p, vv->data, vv->len);
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http complex value: \"%V\"", value);
+
+    return NGX_OK;
+}
+
+
 size_t
 ngx_http_complex_value_size(ngx_http_request_t *r,
     ngx_http_complex_value_t *val, size_t default_value)
@@ -174,6 +243,8 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->flushes = NULL;
     ccv->complex_value->lengths = NULL;
     ccv->complex_value->values = NULL;
+    ccv->complex_value->parts = NULL;
+    ccv->complex_value->nparts = 0;
 
     if (nv == 0 && nc == 0) {
         return NGX_OK;
@@ -235,6 +306,76 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->lengths = lengths.elts;
     ccv->complex_value->values = values.elts;
 
+    return ngx_http_script_compile_parts(ccv->cf, ccv->complex_value);
+}
+
+
+static ngx_int_t
+ngx_http_script_compile_parts(ngx_conf_t *cf, ngx_http_complex_value_t *cv)
+{
+    u_char                       *ip;
+    ngx_uint_t                    n;
+    ngx_http_script_part_t       *part;
+    ngx_http_script_code_pt       code;
+    ngx_http_script_var_code_t   *vcode;
+    ngx_http_script_copy_code_t  *ccode;
+
+    /*
+     * the consecutive characters are already merged into one copy code,
+     * values with captures, prefixes or other codes keep the engine
+     */
+
+    n = 0;
+
+    for (ip = cv->values; *(uintptr_t *) ip; n++) {
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            ccode = (ngx_http_script_copy_code_t *) ip;
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + ((ccode->len + sizeof(uintptr_t) - 1)
+                     & ~(sizeof(uintptr_t) - 1));
+
+        } else if (code == ngx_http_script_copy_var_code) {
+            ip += sizeof(ngx_http_script_var_code_t);
+
+        } else {
+            return NGX_OK;
+        }
+    }
+
+    part = ngx_palloc(cf->pool, n * sizeof(ngx_http_script_part_t));
+    if (part == NULL) {
+        return NGX_ERROR;
+    }
+
+    cv->parts = part;
+    cv->nparts = n;
+
+    for (ip = cv->values; *(uintptr_t *) ip; part++) {
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            ccode = (ngx_http_script_copy_code_t *) ip;
+
+            part->text.len = ccode->len;
+            part->text.data = ip + sizeof(ngx_http_script_copy_code_t);
+            part->index = 0;
+
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + ((ccode->len + sizeof(uintptr_t) - 1)
+                     & ~(sizeof(uintptr_t) - 1));
+
+        } else {
+            vcode = (ngx_http_script_var_code_t *) ip;
+
+            ngx_str_null(&part->text);
+            part->index = vcode->index;
+
+            ip += sizeof(ngx_http_script_var_code_t);
+        }
+    }
+
     return NGX_OK;
 }
 
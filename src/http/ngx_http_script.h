@@ -63,12 +63,26 @@ typedef struct {
 } ngx_http_script_compile_t;
 
 
+/*
+ * a value built only of constant strings and variables, interpreted
+ * by ngx_http_complex_value() without the script engine
+ */
+
+typedef struct {
+    ngx_str_t                   text;     /* text.data is NULL for variables */
+    ngx_uint_t                  index;
+} ngx_http_script_part_t;
+
+
 typedef struct {
     ngx_str_t                   value;
     ngx_uint_t                 *flushes;
     void                       *lengths;
     void                       *values;
 
+    ngx_http_script_part_t     *parts;
+    ngx_uint_t                  nparts;
+
     // QUESTION: 为什么内嵌 union，而不是直接放在 struct 里面？
     union {
         size_t                  size;
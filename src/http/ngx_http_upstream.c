@@ -10,6 +10,64 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_str_node_t                      sn;
+    ngx_rbtree_t                       *tree;
+    ngx_pool_t                         *pool;
+
+    ngx_queue_t                         waiting;
+    ngx_uint_t                          count;
+
+    ngx_str_t                           header;
+    ngx_chain_t                        *body;
+    ngx_chain_t                       **last;
+    size_t                              size;
+    size_t                              max_size;
+
+    unsigned                            linked:1;
+    unsigned                            done:1;
+} ngx_http_upstream_coalesce_node_t;
+
+
+struct ngx_http_upstream_coalesce_s {
+    ngx_queue_t                         queue;
+    ngx_event_t                         event;
+    ngx_http_upstream_coalesce_node_t  *node;
+
+    unsigned                            leader:1;
+    unsigned                            waiting:1;
+};
+
+
+/* how often queued requests look for servers released by other workers */
+#define NGX_HTTP_UPSTREAM_QUEUE_POLL  100
+
+
+struct ngx_http_upstream_queue_s {
+    ngx_queue_t                         queue;
+    ngx_event_t                         event;
+    ngx_http_upstream_srv_conf_t       *upstream;
+    ngx_msec_t                          start;
+    ngx_msec_t                          deadline;
+
+    unsigned                            waiting:1;
+    unsigned                            woken:1;
+};
+
+
+#if (NGX_HAVE_SPLICE)
+
+#define NGX_HTTP_UPSTREAM_SPLICE_SIZE  65536
+
+
+struct ngx_http_upstream_splice_s {
+    ngx_fd_t                            fd[2];
+    size_t                              size;
+};
+
+#endif
+
+
 #if (NGX_HTTP_CACHE)
 static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
@@ -19,6 +77,8 @@ static ngx_int_t ngx_http_upstream_cache_send(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_background_update(
     ngx_http_request_t *r, ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_cache_tags(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_check_range(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_status(ngx_http_request_t *r,
@@ -29,6 +89,36 @@ static ngx_int_t ngx_http_upstream_cache_etag(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 #endif
 
+static ngx_int_t ngx_http_upstream_coalesce(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_coalesce_send(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_coalesce_header(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_coalesce_body(
+    ngx_http_upstream_coalesce_node_t *node, ngx_chain_t *in);
+static void ngx_http_upstream_coalesce_done(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_int_t rc);
+static void ngx_http_upstream_coalesce_finish(
+    ngx_http_upstream_coalesce_node_t *node, ngx_uint_t done);
+static void ngx_http_upstream_coalesce_wake_handler(ngx_event_t *ev);
+static void ngx_http_upstream_coalesce_cleanup(void *data);
+
+static ngx_int_t ngx_http_upstream_queue_add(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_queue_wake(ngx_http_upstream_srv_conf_t *uscf);
+static void ngx_http_upstream_queue_handler(ngx_event_t *ev);
+static void ngx_http_upstream_queue_cleanup(void *data);
+
+static ngx_int_t ngx_http_upstream_hedge(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_hedge_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_retry_budget(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_stats_latency(ngx_http_upstream_srv_conf_t *uscf,
+    ngx_msec_t ms);
+static void ngx_http_upstream_stats_update(ngx_http_upstream_srv_conf_t *uscf);
+
 static void ngx_http_upstream_init_request(ngx_http_request_t *r);
 static void ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx);
 static void ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r);
@@ -43,6 +133,19 @@ static void ngx_http_upstream_send_request(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_uint_t do_write);
 static ngx_int_t ngx_http_upstream_send_request_body(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_uint_t do_write);
+#if (NGX_HAVE_SPLICE)
+static ngx_http_upstream_splice_t *ngx_http_upstream_splice_create(
+    ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_splice_request_init(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_splice_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_splice_response_init(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_splice_response(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_splice_cleanup(void *data);
+#endif
 static void ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_read_request_handler(ngx_http_request_t *r);
@@ -164,6 +267,8 @@ static ngx_int_t ngx_http_upstream_response_time_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_upstream_response_length_variable(
     ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_bytes_buffered_variable(
+    ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_upstream_header_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_upstream_trailer_variable(ngx_http_request_t *r,
@@ -174,6 +279,12 @@ static ngx_int_t ngx_http_upstream_cookie_variable(ngx_http_request_t *r,
 static char *ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static char *ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_upstream_queue(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_upstream_retry_budget_directive(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_hedge_directive(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 
 static ngx_int_t ngx_http_upstream_set_local(ngx_http_request_t *r,
   ngx_http_upstream_t *u, ngx_http_upstream_local_t *local);
@@ -344,6 +455,27 @@ static ngx_command_t  ngx_http_upstream_commands[] = {
       0,
       NULL },
 
+    { ngx_string("queue"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_queue,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("retry_budget"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_retry_budget_directive,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("hedge"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_hedge_directive,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -397,6 +529,10 @@ static ngx_http_variable_t  ngx_http_upstream_vars[] = {
       ngx_http_upstream_response_time_variable, 1,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("upstream_queue_time"), NULL,
+      ngx_http_upstream_response_time_variable, 3,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_string("upstream_response_time"), NULL,
       ngx_http_upstream_response_time_variable, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
@@ -413,6 +549,18 @@ static ngx_http_variable_t  ngx_http_upstream_vars[] = {
       ngx_http_upstream_response_length_variable, 2,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("upstream_bytes_spliced"), NULL,
+      ngx_http_upstream_response_length_variable, 3,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_bytes_copied"), NULL,
+      ngx_http_upstream_response_length_variable, 4,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_bytes_buffered"), NULL,
+      ngx_http_upstream_bytes_buffered_variable, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
 #if (NGX_HTTP_CACHE)
 
     { ngx_string("upstream_cache_status"), NULL,
@@ -612,6 +760,35 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
 
 #endif
 
+    if (u->conf->coalesce) {
+        ngx_int_t  rc;
+
+        rc = ngx_http_upstream_coalesce(r, u);
+
+        if (rc == NGX_BUSY) {
+            r->write_event_handler = ngx_http_upstream_init_request;
+            return;
+        }
+
+        r->write_event_handler = ngx_http_request_empty_handler;
+
+        if (rc == NGX_ERROR) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        if (rc == NGX_OK) {
+            rc = ngx_http_upstream_coalesce_send(r, u);
+
+            if (rc == NGX_DONE) {
+                return;
+            }
+
+            ngx_http_finalize_request(r, rc);
+            return;
+        }
+    }
+
     /*
      * NOTE: store 标志位表示是否需要将上游的响应存放至临时文件中
      */
@@ -833,6 +1010,11 @@ found:
         u->peer.tries = u->conf->next_upstream_tries;
     }
 
+    if (uscf->stats) {
+        ngx_http_upstream_stats_update(uscf);
+        (void) ngx_atomic_fetch_add(&uscf->stats->requests, 1);
+    }
+
     ngx_http_upstream_connect(r, u);
 }
 
@@ -843,6 +1025,7 @@ static ngx_int_t
 ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
     ngx_int_t               rc;
+    ngx_uint_t              purge;
     ngx_http_cache_t       *c;
     ngx_http_file_cache_t  *cache;
 
@@ -850,7 +1033,24 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     if (c == NULL) {
 
-        if (!(r->method & u->conf->cache_methods)) {
+        purge = 0;
+
+        if (u->conf->cache_purge) {
+            switch (ngx_http_test_predicates(r, u->conf->cache_purge)) {
+
+            case NGX_ERROR:
+                return NGX_ERROR;
+
+            case NGX_DECLINED:
+                purge = 1;
+                break;
+
+            default: /* NGX_OK */
+                break;
+            }
+        }
+
+        if (!purge && !(r->method & u->conf->cache_methods)) {
             return NGX_DECLINED;
         }
 
@@ -874,8 +1074,28 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
         /* TODO: add keys */
 
+        r->cache->file_cache = cache;
+
         ngx_http_file_cache_create_key(r);
 
+        if (purge) {
+            rc = ngx_http_file_cache_purge(r);
+
+            r->cache = NULL;
+
+            switch (rc) {
+
+            case NGX_OK:
+                return NGX_HTTP_NO_CONTENT;
+
+            case NGX_DECLINED:
+                return NGX_HTTP_NOT_FOUND;
+
+            default:
+                return NGX_ERROR;
+            }
+        }
+
         if (r->cache->header_start + 256 > u->conf->buffer_size) {
             ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
                           "%V_buffer_size %uz is not enough for cache key, "
@@ -911,6 +1131,7 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
         c->lock = u->conf->cache_lock;
         c->lock_timeout = u->conf->cache_lock_timeout;
         c->lock_age = u->conf->cache_lock_age;
+        c->read_while_write = u->conf->cache_read_while_write;
 
         u->cache_status = NGX_HTTP_CACHE_MISS;
     }
@@ -1155,6 +1376,65 @@ ngx_http_upstream_cache_background_update(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_upstream_cache_tags(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    u_char                    *p, *last, *start;
+    ngx_str_t                  value, *tag;
+    ngx_uint_t                 i;
+    ngx_http_complex_value_t  *cv;
+
+    cv = u->conf->cache_tags->elts;
+
+    for (i = 0; i < u->conf->cache_tags->nelts; i++) {
+
+        if (ngx_http_complex_value(r, &cv[i], &value) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        /* a value may list several tags separated by spaces */
+
+        p = value.data;
+        last = value.data + value.len;
+
+        while (p < last) {
+
+            while (p < last && *p == ' ') {
+                p++;
+            }
+
+            start = p;
+
+            while (p < last && *p != ' ') {
+                p++;
+            }
+
+            if (p == start) {
+                break;
+            }
+
+            if (r->cache->tags == NULL) {
+                r->cache->tags = ngx_array_create(r->pool, 2,
+                                                  sizeof(ngx_str_t));
+                if (r->cache->tags == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            tag = ngx_array_push(r->cache->tags);
+            if (tag == NULL) {
+                return NGX_ERROR;
+            }
+
+            tag->len = p - start;
+            tag->data = start;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_cache_check_range(ngx_http_request_t *r,
     ngx_http_upstream_t *u)
@@ -1206,129 +1486,978 @@ ngx_http_upstream_cache_check_range(ngx_http_request_t *r,
 #endif
 
 
-static void
-ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx)
+static ngx_int_t
+ngx_http_upstream_coalesce(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    ngx_uint_t                     run_posted;
-    ngx_connection_t              *c;
-    ngx_http_request_t            *r;
-    ngx_http_upstream_t           *u;
-    ngx_http_upstream_resolved_t  *ur;
-
-    run_posted = ctx->async;
-
-    r = ctx->data;
-    c = r->connection;
+    uint32_t                            hash;
+    ngx_str_t                           key;
+    ngx_pool_t                         *pool;
+    ngx_pool_cleanup_t                 *cln;
+    ngx_http_upstream_coalesce_t       *co;
+    ngx_http_upstream_main_conf_t      *umcf;
+    ngx_http_upstream_coalesce_node_t  *node;
 
-    u = r->upstream;
-    ur = u->resolved;
+    co = u->coalesce;
 
-    ngx_http_set_log_request(c->log, r);
+    if (co) {
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                   "http upstream resolve: \"%V?%V\"", &r->uri, &r->args);
+        if (co->waiting) {
+            return NGX_BUSY;
+        }
 
-    if (ctx->state) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                      "%V could not be resolved (%i: %s)",
-                      &ctx->name, ctx->state,
-                      ngx_resolver_strerror(ctx->state));
+        if (co->leader || !co->node->done) {
+            return NGX_DECLINED;
+        }
 
-        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_BAD_GATEWAY);
-        goto failed;
+        return NGX_OK;
     }
 
-    ur->naddrs = ctx->naddrs;
-    ur->addrs = ctx->addrs;
-
-#if (NGX_DEBUG)
+    if (r != r->main
+        || r->method != NGX_HTTP_GET
+        || u->conf->store
+        || r->headers_in.content_length_n > 0
+        || r->headers_in.chunked
+        || r->headers_in.range
+        || r->headers_in.if_modified_since
+        || r->headers_in.if_unmodified_since
+        || r->headers_in.if_match
+        || r->headers_in.if_none_match)
     {
-    u_char      text[NGX_SOCKADDR_STRLEN];
-    ngx_str_t   addr;
-    ngx_uint_t  i;
-
-    addr.data = text;
-
-    for (i = 0; i < ctx->naddrs; i++) {
-        addr.len = ngx_sock_ntop(ur->addrs[i].sockaddr, ur->addrs[i].socklen,
-                                 text, NGX_SOCKADDR_STRLEN, 0);
-
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "name was resolved to %V", &addr);
+        return NGX_DECLINED;
     }
+
+#if (NGX_HTTP_CACHE)
+    if (r->cache) {
+        return NGX_DECLINED;
     }
 #endif
 
-    if (ngx_http_upstream_create_round_robin_peer(r, ur) != NGX_OK) {
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
-        goto failed;
+    if (ngx_http_complex_value(r, u->conf->coalesce, &key) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    ngx_resolve_name_done(ctx);
-    ur->ctx = NULL;
+    if (key.len == 0) {
+        return NGX_DECLINED;
+    }
 
-    u->peer.start_time = ngx_current_msec;
+    co = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_coalesce_t));
+    if (co == NULL) {
+        return NGX_ERROR;
+    }
 
-    if (u->conf->next_upstream_tries
-        && u->peer.tries > u->conf->next_upstream_tries)
-    {
-        u->peer.tries = u->conf->next_upstream_tries;
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
     }
 
-    ngx_http_upstream_connect(r, u);
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
 
-failed:
+    hash = ngx_crc32_long(key.data, key.len);
 
-    if (run_posted) {
-        ngx_http_run_posted_requests(c);
-    }
-}
+    node = (ngx_http_upstream_coalesce_node_t *)
+               ngx_str_rbtree_lookup(&umcf->coalesce, &key, hash);
 
+    if (node) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http upstream coalesce wait: \"%V\"", &key);
 
-static void
-ngx_http_upstream_handler(ngx_event_t *ev)
-{
-    ngx_connection_t     *c;
-    ngx_http_request_t   *r;
-    ngx_http_upstream_t  *u;
+        co->node = node;
+        co->waiting = 1;
+        co->event.handler = ngx_http_upstream_coalesce_wake_handler;
+        co->event.data = r;
+        co->event.log = r->connection->log;
 
-    c = ev->data;
-    r = c->data;
+        ngx_queue_insert_tail(&node->waiting, &co->queue);
+        node->count++;
 
-    u = r->upstream;
-    c = r->connection;
+        cln->handler = ngx_http_upstream_coalesce_cleanup;
+        cln->data = co;
 
-    ngx_http_set_log_request(c->log, r);
+        u->coalesce = co;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                   "http upstream request: \"%V?%V\"", &r->uri, &r->args);
+        return NGX_BUSY;
+    }
 
-    if (ev->delayed && ev->timedout) {
-        ev->delayed = 0;
-        ev->timedout = 0;
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream coalesce lead: \"%V\"", &key);
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
     }
 
-    if (ev->write) {
-        u->write_event_handler(r, u);
+    node = ngx_pcalloc(pool, sizeof(ngx_http_upstream_coalesce_node_t));
+    if (node == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
 
-    } else {
-        u->read_event_handler(r, u);
+    node->sn.str.data = ngx_pnalloc(pool, key.len);
+    if (node->sn.str.data == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
     }
 
-    ngx_http_run_posted_requests(c);
-}
+    ngx_memcpy(node->sn.str.data, key.data, key.len);
+    node->sn.str.len = key.len;
+    node->sn.node.key = hash;
 
+    node->tree = &umcf->coalesce;
+    node->pool = pool;
+    node->count = 1;
+    node->last = &node->body;
+    node->max_size = u->conf->coalesce_max_size;
 
-static void
-ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r)
-{
-    ngx_http_upstream_check_broken_connection(r, r->connection->read);
-}
+    ngx_queue_init(&node->waiting);
 
+    ngx_rbtree_insert(node->tree, &node->sn.node);
+    node->linked = 1;
 
-static void
-ngx_http_upstream_wr_check_broken_connection(ngx_http_request_t *r)
+    co->node = node;
+    co->leader = 1;
+
+    cln->handler = ngx_http_upstream_coalesce_cleanup;
+    cln->data = co;
+
+    u->coalesce = co;
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_coalesce_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_int_t                           rc;
+    ngx_buf_t                          *b;
+    ngx_chain_t                        *cl, *in, *out, **ll;
+    ngx_http_upstream_coalesce_node_t  *node;
+
+    node = u->coalesce->node;
+
+    ngx_memzero(&u->buffer, sizeof(ngx_buf_t));
+
+    u->buffer.start = node->header.data;
+    u->buffer.pos = node->header.data;
+    u->buffer.last = node->header.data + node->header.len;
+    u->buffer.end = u->buffer.last;
+    u->buffer.memory = 1;
+
+    ngx_memzero(&u->headers_in, sizeof(ngx_http_upstream_headers_in_t));
+    u->headers_in.content_length_n = -1;
+    u->headers_in.last_modified_time = -1;
+
+    if (ngx_list_init(&u->headers_in.headers, r->pool, 8,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_list_init(&u->headers_in.trailers, r->pool, 2,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rc = u->process_header(r);
+
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "coalesced response contains invalid header");
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_http_upstream_process_headers(r, u) != NGX_OK) {
+        return NGX_DONE;
+    }
+
+    if (r->headers_out.content_length_n == -1) {
+        r->headers_out.content_length_n = node->size - node->header.len;
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    if (node->body == NULL) {
+        return ngx_http_send_special(r, NGX_HTTP_LAST);
+    }
+
+    b = NULL;
+    ll = &out;
+
+    for (in = node->body; in; in = in->next) {
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->start = in->buf->pos;
+        b->pos = in->buf->pos;
+        b->last = in->buf->last;
+        b->end = in->buf->last;
+        b->memory = 1;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        *ll = cl;
+        ll = &cl->next;
+    }
+
+    *ll = NULL;
+
+    b->last_buf = 1;
+    b->last_in_chain = 1;
+
+    return ngx_http_output_filter(r, out);
+}
+
+
+static void
+ngx_http_upstream_coalesce_header(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    size_t                              len;
+    ngx_http_upstream_coalesce_node_t  *node;
+
+    node = u->coalesce->node;
+
+    if (!node->linked) {
+        return;
+    }
+
+    len = u->buffer.pos - u->buffer.start;
+
+    if (!u->buffering
+        || u->upgrade
+        || u->headers_in.status_n == 0
+        || len == 0
+        || len > node->max_size)
+    {
+        ngx_http_upstream_coalesce_finish(node, 0);
+        return;
+    }
+
+    node->header.data = ngx_pnalloc(node->pool, len);
+    if (node->header.data == NULL) {
+        ngx_http_upstream_coalesce_finish(node, 0);
+        return;
+    }
+
+    ngx_memcpy(node->header.data, u->buffer.start, len);
+    node->header.len = len;
+    node->size = len;
+}
+
+
+static void
+ngx_http_upstream_coalesce_body(ngx_http_upstream_coalesce_node_t *node,
+    ngx_chain_t *in)
+{
+    size_t        size;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    if (!node->linked) {
+        return;
+    }
+
+    for ( /* void */ ; in; in = in->next) {
+
+        if (ngx_buf_special(in->buf)) {
+            continue;
+        }
+
+        if (!ngx_buf_in_memory(in->buf)) {
+            goto failed;
+        }
+
+        size = in->buf->last - in->buf->pos;
+
+        if (size == 0) {
+            continue;
+        }
+
+        if (size > node->max_size - node->size) {
+            goto failed;
+        }
+
+        b = ngx_create_temp_buf(node->pool, size);
+        if (b == NULL) {
+            goto failed;
+        }
+
+        b->last = ngx_cpymem(b->last, in->buf->pos, size);
+
+        cl = ngx_alloc_chain_link(node->pool);
+        if (cl == NULL) {
+            goto failed;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+
+        *node->last = cl;
+        node->last = &cl->next;
+        node->size += size;
+    }
+
+    return;
+
+failed:
+
+    ngx_http_upstream_coalesce_finish(node, 0);
+}
+
+
+static void
+ngx_http_upstream_coalesce_done(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    ngx_int_t rc)
+{
+    ngx_uint_t                          done;
+    ngx_event_pipe_t                   *p;
+    ngx_http_upstream_coalesce_node_t  *node;
+
+    node = u->coalesce->node;
+    p = u->pipe;
+
+    done = 0;
+
+    if (rc == 0 && node->linked && node->header.len) {
+
+        if (r->header_only) {
+            done = 1;
+
+        } else if (p && !p->upstream_error && !p->downstream_error
+                   && (p->upstream_done
+                       || (p->upstream_eof && p->length == -1)))
+        {
+            done = 1;
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream coalesce done: %ui", done);
+
+    ngx_http_upstream_coalesce_finish(node, done);
+}
+
+
+static void
+ngx_http_upstream_coalesce_finish(ngx_http_upstream_coalesce_node_t *node,
+    ngx_uint_t done)
+{
+    ngx_queue_t                   *q;
+    ngx_http_upstream_coalesce_t  *co;
+
+    if (!node->linked) {
+        return;
+    }
+
+    ngx_rbtree_delete(node->tree, &node->sn.node);
+
+    node->linked = 0;
+    node->done = done;
+
+    while (!ngx_queue_empty(&node->waiting)) {
+        q = ngx_queue_head(&node->waiting);
+        ngx_queue_remove(q);
+
+        co = ngx_queue_data(q, ngx_http_upstream_coalesce_t, queue);
+        co->waiting = 0;
+
+        ngx_post_event(&co->event, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_upstream_coalesce_wake_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream coalesce wake: \"%V?%V\"",
+                   &r->uri, &r->args);
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_upstream_coalesce_cleanup(void *data)
+{
+    ngx_http_upstream_coalesce_t *co = data;
+
+    ngx_http_upstream_coalesce_node_t  *node;
+
+    node = co->node;
+
+    if (co->leader) {
+        ngx_http_upstream_coalesce_finish(node, 0);
+    }
+
+    if (co->waiting) {
+        ngx_queue_remove(&co->queue);
+        co->waiting = 0;
+    }
+
+    if (co->event.posted) {
+        ngx_delete_posted_event(&co->event);
+    }
+
+    if (--node->count == 0) {
+        ngx_destroy_pool(node->pool);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_queue_add(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_msec_int_t                 timer;
+    ngx_pool_cleanup_t            *cln;
+    ngx_http_upstream_queue_t     *q;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = u->upstream;
+
+    if (uscf == NULL || uscf->queue_max == 0) {
+        return NGX_DECLINED;
+    }
+
+    q = u->queue;
+
+    if (q == NULL) {
+        q = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_queue_t));
+        if (q == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        q->event.handler = ngx_http_upstream_queue_handler;
+        q->event.data = r;
+        q->event.log = r->connection->log;
+        q->upstream = uscf;
+        q->deadline = ngx_current_msec + uscf->queue_timeout;
+
+        cln->handler = ngx_http_upstream_queue_cleanup;
+        cln->data = q;
+
+        u->queue = q;
+    }
+
+    timer = (ngx_msec_int_t) (q->deadline - ngx_current_msec);
+
+    if (timer <= 0) {
+        return NGX_DECLINED;
+    }
+
+    if (q->start) {
+
+        /* a request woken up, but still without a server, keeps its place */
+
+        ngx_queue_insert_head(&uscf->queue, &q->queue);
+
+    } else {
+
+        if (uscf->queued >= uscf->queue_max) {
+            ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                          "upstream queue is full");
+            return NGX_DECLINED;
+        }
+
+        ngx_queue_insert_tail(&uscf->queue, &q->queue);
+    }
+
+    uscf->queued++;
+
+    q->waiting = 1;
+    q->start = ngx_current_msec;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * servers are released by other worker processes too,
+     * and nothing wakes up the request then, so it is retried periodically
+     */
+
+    if (uscf->shm_zone && timer > NGX_HTTP_UPSTREAM_QUEUE_POLL) {
+        timer = NGX_HTTP_UPSTREAM_QUEUE_POLL;
+    }
+
+#endif
+
+    ngx_add_timer(&q->event, (ngx_msec_t) timer);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream queued: %ui of %ui",
+                   uscf->queued, uscf->queue_max);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_queue_wake(ngx_http_upstream_srv_conf_t *uscf)
+{
+    ngx_queue_t                *q;
+    ngx_http_upstream_queue_t  *uq;
+
+    if (uscf == NULL || uscf->queued == 0) {
+        return;
+    }
+
+    q = ngx_queue_head(&uscf->queue);
+    ngx_queue_remove(q);
+    uscf->queued--;
+
+    uq = ngx_queue_data(q, ngx_http_upstream_queue_t, queue);
+    uq->waiting = 0;
+
+    ngx_post_event(&uq->event, &ngx_posted_events);
+}
+
+
+static void
+ngx_http_upstream_queue_handler(ngx_event_t *ev)
+{
+    ngx_connection_t           *c;
+    ngx_http_request_t         *r;
+    ngx_http_upstream_t        *u;
+    ngx_http_upstream_queue_t  *q;
+
+    r = ev->data;
+    c = r->connection;
+    u = r->upstream;
+    q = u->queue;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream queue handler: \"%V?%V\"",
+                   &r->uri, &r->args);
+
+    if (q->waiting) {
+        ngx_queue_remove(&q->queue);
+        q->upstream->queued--;
+        q->waiting = 0;
+    }
+
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+
+    if (ev->timedout) {
+        ev->timedout = 0;
+
+        if ((ngx_msec_int_t) (q->deadline - ngx_current_msec) <= 0) {
+            u->state->queue_time += ngx_current_msec - q->start;
+
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream queue timed out");
+
+            ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_NOLIVE);
+            ngx_http_run_posted_requests(c);
+            return;
+        }
+    }
+
+    q->woken = 1;
+
+    ngx_http_upstream_connect(r, u);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_upstream_queue_cleanup(void *data)
+{
+    ngx_http_upstream_queue_t *q = data;
+
+    if (q->waiting) {
+        ngx_queue_remove(&q->queue);
+        q->upstream->queued--;
+        q->waiting = 0;
+    }
+
+    if (q->event.timer_set) {
+        ngx_del_timer(&q->event);
+    }
+
+    if (q->event.posted) {
+        ngx_delete_posted_event(&q->event);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hedge(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_msec_t                     delay;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = u->upstream;
+
+    /* only requests which are safe to repeat and cheap to resend */
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))
+        || r->headers_in.content_length_n > 0
+        || r->headers_in.chunked
+        || u->peer.tries < 2)
+    {
+        return NGX_OK;
+    }
+
+    delay = uscf->stats->hedge_delay;
+
+    if (delay == 0) {
+        return NGX_OK;
+    }
+
+    delay = ngx_max(delay, uscf->hedge_min);
+
+    if (u->hedge == NULL) {
+        u->hedge = ngx_pcalloc(r->pool, sizeof(ngx_event_t));
+        if (u->hedge == NULL) {
+            return NGX_ERROR;
+        }
+
+        u->hedge->handler = ngx_http_upstream_hedge_handler;
+        u->hedge->data = r;
+        u->hedge->log = r->connection->log;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream hedge delay: %M", delay);
+
+    ngx_add_timer(u->hedge, delay);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_hedge_handler(ngx_event_t *ev)
+{
+    ngx_msec_t            timeout;
+    ngx_connection_t     *c;
+    ngx_http_request_t   *r;
+    ngx_http_upstream_t  *u;
+
+    r = ev->data;
+    c = r->connection;
+    u = r->upstream;
+
+    ev->timedout = 0;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream hedge: \"%V?%V\"", &r->uri, &r->args);
+
+    timeout = u->conf->next_upstream_timeout;
+
+    if (u->peer.connection == NULL
+        || u->state->header_time != (ngx_msec_t) -1
+        || u->peer.tries < 2
+        || (timeout && ngx_current_msec - u->peer.start_time >= timeout))
+    {
+        return;
+    }
+
+    if (ngx_http_upstream_retry_budget(r, u) != NGX_OK) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                  "upstream is slow, trying next one");
+
+    ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_HEDGE);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_retry_budget(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_http_upstream_stats_t     *stats;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = u->upstream;
+
+    if (uscf == NULL || uscf->retry_budget == 0) {
+        return NGX_OK;
+    }
+
+    stats = uscf->stats;
+
+    ngx_http_upstream_stats_update(uscf);
+
+    if (stats->retries
+        >= uscf->retry_min + stats->requests * uscf->retry_budget / 100)
+    {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "upstream retry budget is exhausted");
+        return NGX_DECLINED;
+    }
+
+    (void) ngx_atomic_fetch_add(&stats->retries, 1);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_stats_latency(ngx_http_upstream_srv_conf_t *uscf,
+    ngx_msec_t ms)
+{
+    ngx_uint_t  b, k;
+
+    /* 4 buckets per power of 2 */
+
+    if (ms < 4) {
+        b = ms;
+
+    } else {
+        for (k = 2; (ms >> (k + 1)) && k < 31; k++) { /* void */ }
+
+        b = 4 * (k - 1) + ((ms >> (k - 2)) & 3);
+
+        if (b >= NGX_HTTP_UPSTREAM_LATENCY_BUCKETS) {
+            b = NGX_HTTP_UPSTREAM_LATENCY_BUCKETS - 1;
+        }
+    }
+
+    (void) ngx_atomic_fetch_add(&uscf->stats->latency[b], 1);
+}
+
+
+static void
+ngx_http_upstream_stats_update(ngx_http_upstream_srv_conf_t *uscf)
+{
+    time_t                      now;
+    ngx_uint_t                  i, k, n, total;
+    ngx_atomic_uint_t           updated;
+    ngx_http_upstream_stats_t  *stats;
+
+    stats = uscf->stats;
+    now = ngx_time();
+
+    updated = stats->updated;
+
+    if ((time_t) updated == now
+        || !ngx_atomic_cmp_set(&stats->updated, updated, now))
+    {
+        return;
+    }
+
+    /*
+     * once a second, by one process only; as other processes update
+     * the counters meanwhile, a few updates may be lost, which is fine
+     */
+
+    if (now - (time_t) stats->decayed >= 10) {
+        stats->decayed = now;
+
+        stats->requests /= 2;
+        stats->retries /= 2;
+
+        for (i = 0; i < NGX_HTTP_UPSTREAM_LATENCY_BUCKETS; i++) {
+            stats->latency[i] /= 2;
+        }
+    }
+
+    if (uscf->hedge == 0) {
+        return;
+    }
+
+    total = 0;
+
+    for (i = 0; i < NGX_HTTP_UPSTREAM_LATENCY_BUCKETS; i++) {
+        total += stats->latency[i];
+    }
+
+    /* too few responses to estimate the latency */
+
+    if (total < 20) {
+        stats->hedge_delay = 0;
+        return;
+    }
+
+    total = total * uscf->hedge / 100;
+    n = 0;
+
+    for (i = 0; i < NGX_HTTP_UPSTREAM_LATENCY_BUCKETS - 1; i++) {
+        n += stats->latency[i];
+
+        if (n > total) {
+            break;
+        }
+    }
+
+    /* the upper bound of the bucket */
+
+    if (i < 4) {
+        stats->hedge_delay = i + 1;
+
+    } else {
+        k = i / 4 + 1;
+        stats->hedge_delay = (5 + i % 4) << (k - 2);
+    }
+}
+
+
+static void
+ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    ngx_uint_t                     run_posted;
+    ngx_connection_t              *c;
+    ngx_http_request_t            *r;
+    ngx_http_upstream_t           *u;
+    ngx_http_upstream_resolved_t  *ur;
+
+    run_posted = ctx->async;
+
+    r = ctx->data;
+    c = r->connection;
+
+    u = r->upstream;
+    ur = u->resolved;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream resolve: \"%V?%V\"", &r->uri, &r->args);
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "%V could not be resolved (%i: %s)",
+                      &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state));
+
+        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_BAD_GATEWAY);
+        goto failed;
+    }
+
+    ur->naddrs = ctx->naddrs;
+    ur->addrs = ctx->addrs;
+
+#if (NGX_DEBUG)
+    {
+    u_char      text[NGX_SOCKADDR_STRLEN];
+    ngx_str_t   addr;
+    ngx_uint_t  i;
+
+    addr.data = text;
+
+    for (i = 0; i < ctx->naddrs; i++) {
+        addr.len = ngx_sock_ntop(ur->addrs[i].sockaddr, ur->addrs[i].socklen,
+                                 text, NGX_SOCKADDR_STRLEN, 0);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "name was resolved to %V", &addr);
+    }
+    }
+#endif
+
+    if (ngx_http_upstream_create_round_robin_peer(r, ur) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        goto failed;
+    }
+
+    ngx_resolve_name_done(ctx);
+    ur->ctx = NULL;
+
+    u->peer.start_time = ngx_current_msec;
+
+    if (u->conf->next_upstream_tries
+        && u->peer.tries > u->conf->next_upstream_tries)
+    {
+        u->peer.tries = u->conf->next_upstream_tries;
+    }
+
+    ngx_http_upstream_connect(r, u);
+
+failed:
+
+    if (run_posted) {
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+
+static void
+ngx_http_upstream_handler(ngx_event_t *ev)
+{
+    ngx_connection_t     *c;
+    ngx_http_request_t   *r;
+    ngx_http_upstream_t  *u;
+
+    c = ev->data;
+    r = c->data;
+
+    u = r->upstream;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream request: \"%V?%V\"", &r->uri, &r->args);
+
+    ngx_http_cpu_enter(r);
+
+    if (ev->delayed && ev->timedout) {
+        ev->delayed = 0;
+        ev->timedout = 0;
+    }
+
+    if (ev->write) {
+        u->write_event_handler(r, u);
+
+    } else {
+        u->read_event_handler(r, u);
+    }
+
+    ngx_http_run_posted_requests(c);
+
+    ngx_http_cpu_leave();
+}
+
+
+static void
+ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r)
+{
+    ngx_http_upstream_check_broken_connection(r, r->connection->read);
+}
+
+
+static void
+ngx_http_upstream_wr_check_broken_connection(ngx_http_request_t *r)
 {
     ngx_http_upstream_check_broken_connection(r, r->connection->write);
 }
@@ -1536,6 +2665,19 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     r->connection->log->action = "connecting to upstream";
 
+    ngx_probe1(http_upstream_connect, r);
+
+    if (u->queue && u->queue->woken) {
+
+        /* the state of the attempt which was queued is continued */
+
+        u->queue->woken = 0;
+        u->state->queue_time += ngx_current_msec - u->queue->start;
+        u->start_time = ngx_current_msec;
+
+        goto connect;
+    }
+
     if (u->state && u->state->response_time == (ngx_msec_t) -1) {
         /*
          * QUESTION: response_time 不是表示 upstream 响应的时间么？
@@ -1559,6 +2701,8 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     u->state->connect_time = (ngx_msec_t) -1;
     u->state->header_time = (ngx_msec_t) -1;
 
+connect:
+
     rc = ngx_event_connect_peer(&u->peer);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -1573,6 +2717,19 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     u->state->peer = u->peer.name;
 
     if (rc == NGX_BUSY) {
+
+        rc = ngx_http_upstream_queue_add(r, u);
+
+        if (rc == NGX_OK) {
+            return;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
         ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "no live upstreams");
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_NOLIVE);
         return;
@@ -1671,6 +2828,14 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     u->request_body_sent = 0;
     u->request_body_blocked = 0;
 
+    if (u->upstream && u->upstream->hedge) {
+        if (ngx_http_upstream_hedge(r, u) != NGX_OK) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+    }
+
     if (rc == NGX_AGAIN) {
         ngx_add_timer(c->write, u->conf->connect_timeout);
         return;
@@ -2045,6 +3210,8 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u,
 
     if (u->state->connect_time == (ngx_msec_t) -1) {
         u->state->connect_time = ngx_current_msec - u->start_time;
+
+        ngx_probe1(http_upstream_connected, r);
     }
 
     // NOTE: test_connect 主要以 SO_ERROR 调用 getsockopt
@@ -2203,96 +3370,345 @@ ngx_http_upstream_send_request_body(ngx_http_request_t *r,
             u->request_body_blocked = 0;
         }
 
-        return rc;
+        return rc;
+    }
+
+    if (!u->request_sent) {
+
+        /*
+         * NOTE: 第一次调用 ngx_output_chain，所以需要设置 request_sent
+         */
+        u->request_sent = 1;
+        out = u->request_bufs;
+
+        if (r->request_body->bufs) {
+            for (cl = out; cl->next; cl = cl->next) { /* void */ }
+            cl->next = r->request_body->bufs;
+            r->request_body->bufs = NULL;
+        }
+
+        c = u->peer.connection;
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (clcf->tcp_nodelay && ngx_tcp_nodelay(c) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        r->read_event_handler = ngx_http_upstream_read_request_handler;
+
+    } else {
+        out = NULL;
+    }
+
+    for ( ;; ) {
+
+        if (do_write) {
+            rc = ngx_output_chain(&u->output, out);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            while (out) {
+                ln = out;
+                out = out->next;
+                ngx_free_chain(r->pool, ln);
+            }
+
+            if (rc == NGX_AGAIN) {
+                u->request_body_blocked = 1;
+
+            } else {
+                u->request_body_blocked = 0;
+            }
+
+            if (rc == NGX_OK && !r->reading_body) {
+                break;
+            }
+        }
+
+        if (r->reading_body) {
+
+#if (NGX_HAVE_SPLICE)
+
+            if (u->request_body_splice
+                && ngx_http_upstream_splice_request_init(r, u) == NGX_ERROR)
+            {
+                return NGX_ERROR;
+            }
+
+            if (u->request_splice) {
+                rc = ngx_http_upstream_splice_request_body(r, u);
+
+                if (rc == NGX_ERROR || rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+                    return rc;
+                }
+
+                break;
+            }
+
+#endif
+
+            /* read client request body */
+
+            rc = ngx_http_read_unbuffered_request_body(r);
+
+            if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+                return rc;
+            }
+
+            out = r->request_body->bufs;
+            r->request_body->bufs = NULL;
+        }
+
+        /* stop if there is nothing to send */
+
+        if (out == NULL) {
+            rc = NGX_AGAIN;
+            break;
+        }
+
+        do_write = 1;
+    }
+
+    if (!r->reading_body) {
+        if (!u->store && !r->post_action && !u->conf->ignore_client_abort) {
+            r->read_event_handler =
+                                  ngx_http_upstream_rd_check_broken_connection;
+        }
+    }
+
+    return rc;
+}
+
+
+#if (NGX_HAVE_SPLICE)
+
+static ngx_http_upstream_splice_t *
+ngx_http_upstream_splice_create(ngx_http_request_t *r)
+{
+    ngx_pool_cleanup_t          *cln;
+    ngx_http_upstream_splice_t  *sp;
+
+    sp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_splice_t));
+    if (sp == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    if (pipe2(sp->fd, O_NONBLOCK|O_CLOEXEC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      "pipe2() failed");
+        return NULL;
+    }
+
+    sp->size = 0;
+
+    cln->handler = ngx_http_upstream_splice_cleanup;
+    cln->data = sp;
+
+    return sp;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_splice_request_init(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_http_request_body_t     *rb;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_upstream_splice_t  *sp;
+
+    rb = r->request_body;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (u->request_body_blocked
+        || rb->bufs
+        || rb->buf == NULL
+        || rb->buf->pos != rb->buf->last
+        || r->header_in->pos != r->header_in->last)
+    {
+        /* previously read data are not sent yet */
+        return NGX_DECLINED;
+    }
+
+    u->request_body_splice = 0;
+
+    if (rb->rest <= (off_t) clcf->client_body_buffer_size
+        || ngx_http_top_request_body_filter
+           != ngx_http_request_body_save_filter
+#if (NGX_HTTP_V2)
+        || r->stream
+#endif
+#if (NGX_SSL)
+        || r->connection->ssl
+        || u->peer.connection->ssl
+#endif
+        )
+    {
+        return NGX_DECLINED;
+    }
+
+    sp = ngx_http_upstream_splice_create(r);
+    if (sp == NULL) {
+        return NGX_DECLINED;
     }
 
-    if (!u->request_sent) {
+    u->request_splice = sp;
 
-        /*
-         * NOTE: 第一次调用 ngx_output_chain，所以需要设置 request_sent
-         */
-        u->request_sent = 1;
-        out = u->request_bufs;
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream splice request body: %O, pipe %d:%d",
+                   rb->rest, sp->fd[0], sp->fd[1]);
 
-        if (r->request_body->bufs) {
-            for (cl = out; cl->next; cl = cl->next) { /* void */ }
-            cl->next = r->request_body->bufs;
-            r->request_body->bufs = NULL;
-        }
+    return NGX_OK;
+}
 
-        c = u->peer.connection;
-        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-        if (clcf->tcp_nodelay && ngx_tcp_nodelay(c) != NGX_OK) {
-            return NGX_ERROR;
-        }
+static ngx_int_t
+ngx_http_upstream_splice_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    size_t                       size;
+    ssize_t                      n;
+    ngx_err_t                    err;
+    ngx_connection_t            *c, *pc;
+    ngx_http_request_body_t     *rb;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_upstream_splice_t  *sp;
 
-        r->read_event_handler = ngx_http_upstream_read_request_handler;
+    c = r->connection;
+    pc = u->peer.connection;
+    rb = r->request_body;
+    sp = u->request_splice;
 
-    } else {
-        out = NULL;
+    if (c->read->timedout) {
+        c->timedout = 1;
+        return NGX_HTTP_REQUEST_TIME_OUT;
     }
 
     for ( ;; ) {
 
-        if (do_write) {
-            rc = ngx_output_chain(&u->output, out);
+        if (sp->size) {
 
-            if (rc == NGX_ERROR) {
+            /* move the data from the pipe to upstream */
+
+            n = splice(sp->fd[0], NULL, pc->fd, NULL, sp->size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "http upstream splice to upstream: %z of %uz",
+                           n, sp->size);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EAGAIN) {
+                    pc->write->ready = 0;
+                    u->request_body_blocked = 1;
+                    return NGX_AGAIN;
+                }
+
+                pc->write->error = 1;
+                ngx_connection_error(pc, err, "splice() to upstream failed");
                 return NGX_ERROR;
             }
 
-            while (out) {
-                ln = out;
-                out = out->next;
-                ngx_free_chain(r->pool, ln);
-            }
+            sp->size -= n;
+            pc->sent += n;
+            u->state->bytes_spliced += n;
 
-            if (rc == NGX_AGAIN) {
-                u->request_body_blocked = 1;
+            u->request_body_blocked = 0;
 
-            } else {
-                u->request_body_blocked = 0;
-            }
+            continue;
+        }
 
-            if (rc == NGX_OK && !r->reading_body) {
-                break;
+        if (rb->rest == 0) {
+            break;
+        }
+
+        if (!c->read->ready) {
+            clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+            ngx_add_timer(c->read, clcf->client_body_timeout);
+
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
             }
+
+            return NGX_AGAIN;
         }
 
-        if (r->reading_body) {
-            /* read client request body */
+        /* move the data from the client to the pipe */
 
-            rc = ngx_http_read_unbuffered_request_body(r);
+        size = NGX_HTTP_UPSTREAM_SPLICE_SIZE;
 
-            if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
-                return rc;
+        if ((off_t) size > rb->rest) {
+            size = (size_t) rb->rest;
+        }
+
+        n = splice(c->fd, NULL, sp->fd[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http upstream splice from client: %z of %O",
+                       n, rb->rest);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+                c->read->ready = 0;
+                continue;
             }
 
-            out = r->request_body->bufs;
-            r->request_body->bufs = NULL;
+            c->error = 1;
+            ngx_connection_error(c, err, "splice() from client failed");
+            return NGX_HTTP_BAD_REQUEST;
         }
 
-        /* stop if there is nothing to send */
-
-        if (out == NULL) {
-            rc = NGX_AGAIN;
-            break;
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "client prematurely closed connection");
+            c->error = 1;
+            return NGX_HTTP_BAD_REQUEST;
         }
 
-        do_write = 1;
+        rb->rest -= n;
+        r->request_length += n;
+        sp->size = n;
     }
 
-    if (!r->reading_body) {
-        if (!u->store && !r->post_action && !u->conf->ignore_client_abort) {
-            r->read_event_handler =
-                                  ngx_http_upstream_rd_check_broken_connection;
-        }
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
     }
 
-    return rc;
+    r->reading_body = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_splice_cleanup(void *data)
+{
+    ngx_http_upstream_splice_t  *sp = data;
+
+    if (close(sp->fd[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() pipe failed");
+    }
+
+    if (close(sp->fd[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() pipe failed");
+    }
 }
 
+#endif
+
 
 static void
 ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
@@ -2497,6 +3913,16 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     u->state->header_time = ngx_current_msec - u->start_time;
 
+    if (u->hedge && u->hedge->timer_set) {
+        ngx_del_timer(u->hedge);
+    }
+
+    if (u->upstream && u->upstream->stats) {
+        ngx_http_upstream_stats_latency(u->upstream, u->state->header_time);
+    }
+
+    ngx_probe2(http_upstream_header, r, u->headers_in.status_n);
+
     if (u->headers_in.status_n >= NGX_HTTP_SPECIAL_RESPONSE) {
 
         if (ngx_http_upstream_test_next(r, u) == NGX_OK) {
@@ -2984,6 +4410,10 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     ngx_connection_t          *c;
     ngx_http_core_loc_conf_t  *clcf;
 
+    if (u->coalesce && u->coalesce->leader) {
+        ngx_http_upstream_coalesce_header(r, u);
+    }
+
     rc = ngx_http_send_header(r);
 
     if (rc == NGX_ERROR || rc > NGX_OK || r->post_action) {
@@ -3173,6 +4603,13 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
                 return;
             }
 
+            if (u->conf->cache_tags
+                && ngx_http_upstream_cache_tags(r, u) != NGX_OK)
+            {
+                ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+                return;
+            }
+
         } else {
             u->cacheable = 0;
         }
@@ -3198,6 +4635,7 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     p->output_ctx = r;
     p->tag = u->output.tag;
     p->bufs = u->conf->bufs;
+    p->adaptive = u->conf->adaptive_buffers;
     p->busy_size = u->conf->busy_buffers_size;
     p->upstream = u->peer.connection;
     p->downstream = c;
@@ -3208,6 +4646,10 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     p->cacheable = u->cacheable || u->store;
 
+#if (NGX_HTTP_CACHE)
+    p->write_behind = u->cacheable && u->conf->cache_write_behind;
+#endif
+
     p->temp_file = ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t));
     if (p->temp_file == NULL) {
         ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
@@ -3238,6 +4680,13 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     p->max_temp_file_size = u->conf->max_temp_file_size;
     p->temp_file_write_size = u->conf->temp_file_write_size;
 
+    if (u->coalesce && u->coalesce->leader && u->coalesce->node->linked) {
+
+        /* the coalesced body is collected from memory buffers only */
+
+        p->max_temp_file_size = 0;
+    }
+
 #if (NGX_THREADS)
     if (clcf->aio == NGX_HTTP_AIO_THREADS && clcf->aio_write) {
         p->thread_handler = ngx_http_upstream_thread_handler;
@@ -3672,6 +5121,28 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
 
     for ( ;; ) {
 
+#if (NGX_HAVE_SPLICE)
+
+        if (u->response_body_splice
+            && ngx_http_upstream_splice_response_init(r, u) == NGX_ERROR)
+        {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+
+        if (u->response_splice) {
+            rc = ngx_http_upstream_splice_response(r, u);
+
+            if (rc == NGX_AGAIN) {
+                break;
+            }
+
+            ngx_http_upstream_finalize_request(r, u, rc);
+            return;
+        }
+
+#endif
+
         if (do_write) {
 
             if (u->out_bufs || u->busy_bufs || downstream->buffered) {
@@ -3782,6 +5253,195 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_http_upstream_splice_response_init(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_connection_t            *c;
+    ngx_http_upstream_splice_t  *sp;
+
+    c = r->connection;
+
+    if (u->out_bufs || u->busy_bufs) {
+        /* previously read data are not sent yet */
+        return NGX_DECLINED;
+    }
+
+    if ((u->length != -1 && u->length <= (off_t) u->conf->buffer_size)
+        || r != r->main
+        || c->data != r
+        || r->chunked
+        || r->limit_rate
+        || r->filter_need_in_memory
+        || r->filter_need_temporary
+        || r->headers_out.content_length_n != u->headers_in.content_length_n
+#if (NGX_HTTP_V2)
+        || r->stream
+#endif
+#if (NGX_SSL)
+        || c->ssl
+        || u->peer.connection->ssl
+#endif
+        )
+    {
+        u->response_body_splice = 0;
+        return NGX_DECLINED;
+    }
+
+    if (r->out) {
+
+        /* the response header may still be postponed */
+
+        if (ngx_http_send_special(r, NGX_HTTP_FLUSH) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (r->out || c->buffered) {
+        return NGX_DECLINED;
+    }
+
+    u->response_body_splice = 0;
+
+    sp = ngx_http_upstream_splice_create(r);
+    if (sp == NULL) {
+        return NGX_DECLINED;
+    }
+
+    u->response_splice = sp;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream splice response: %O, pipe %d:%d",
+                   u->length, sp->fd[0], sp->fd[1]);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_splice_response(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    size_t                       size;
+    ssize_t                      n;
+    ngx_err_t                    err;
+    ngx_connection_t            *downstream, *upstream;
+    ngx_http_upstream_splice_t  *sp;
+
+    downstream = r->connection;
+    upstream = u->peer.connection;
+    sp = u->response_splice;
+
+    for ( ;; ) {
+
+        if (sp->size) {
+
+            /* move the data from the pipe to the client */
+
+            n = splice(sp->fd[0], NULL, downstream->fd, NULL, sp->size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                           "http upstream splice to client: %z of %uz",
+                           n, sp->size);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EAGAIN) {
+                    downstream->write->ready = 0;
+                    return NGX_AGAIN;
+                }
+
+                downstream->write->error = 1;
+                downstream->error = 1;
+                ngx_connection_error(downstream, err,
+                                     "splice() to client failed");
+                return NGX_ERROR;
+            }
+
+            sp->size -= n;
+            downstream->sent += n;
+
+            continue;
+        }
+
+        if (u->length == 0) {
+            u->keepalive = !u->headers_in.connection_close;
+            return NGX_OK;
+        }
+
+        if (upstream->read->eof) {
+
+            if (u->length == -1) {
+                return NGX_OK;
+            }
+
+            ngx_log_error(NGX_LOG_ERR, upstream->log, 0,
+                          "upstream prematurely closed connection");
+            return NGX_HTTP_BAD_GATEWAY;
+        }
+
+        if (upstream->read->error) {
+            return NGX_HTTP_BAD_GATEWAY;
+        }
+
+        if (!upstream->read->ready) {
+            return NGX_AGAIN;
+        }
+
+        /* move the data from upstream to the pipe */
+
+        size = NGX_HTTP_UPSTREAM_SPLICE_SIZE;
+
+        if (u->length != -1 && (off_t) size > u->length) {
+            size = (size_t) u->length;
+        }
+
+        n = splice(upstream->fd, NULL, sp->fd[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                       "http upstream splice from upstream: %z of %O",
+                       n, u->length);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+                upstream->read->ready = 0;
+                continue;
+            }
+
+            upstream->read->error = 1;
+            ngx_connection_error(upstream, err,
+                                 "splice() from upstream failed");
+            continue;
+        }
+
+        if (n == 0) {
+            upstream->read->ready = 0;
+            upstream->read->eof = 1;
+            continue;
+        }
+
+        if (u->length != -1) {
+            u->length -= n;
+        }
+
+        u->state->bytes_received += n;
+        u->state->response_length += n;
+        u->state->bytes_spliced += n;
+
+        sp->size = n;
+    }
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_upstream_non_buffered_filter_init(void *data)
 {
@@ -3924,6 +5584,10 @@ ngx_http_upstream_output_filter(void *data, ngx_chain_t *chain)
     r = data;
     p = r->upstream->pipe;
 
+    if (r->upstream->coalesce && r->upstream->coalesce->leader) {
+        ngx_http_upstream_coalesce_body(r->upstream->coalesce->node, chain);
+    }
+
     rc = ngx_http_output_filter(r, chain);
 
     p->aio = r->aio;
@@ -4102,6 +5766,9 @@ ngx_http_upstream_process_request(ngx_http_request_t *r,
 
             } else if (p->upstream_error) {
                 ngx_http_file_cache_free(r->cache, p->temp_file);
+
+            } else {
+                ngx_http_file_cache_progress(r, p->temp_file);
             }
         }
 
@@ -4238,6 +5905,10 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http next upstream, %xi", ft_type);
 
+    if (u->hedge && u->hedge->timer_set) {
+        ngx_del_timer(u->hedge);
+    }
+
     if (u->peer.sockaddr) {
 
         if (u->peer.connection) {
@@ -4245,7 +5916,8 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
         }
 
         if (ft_type == NGX_HTTP_UPSTREAM_FT_HTTP_403
-            || ft_type == NGX_HTTP_UPSTREAM_FT_HTTP_404)
+            || ft_type == NGX_HTTP_UPSTREAM_FT_HTTP_404
+            || ft_type == NGX_HTTP_UPSTREAM_FT_HEDGE)
         {
             state = NGX_PEER_NEXT;
 
@@ -4255,6 +5927,8 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
 
         u->peer.free(&u->peer, u->peer.data, state);
         u->peer.sockaddr = NULL;
+
+        ngx_http_upstream_queue_wake(u->upstream);
     }
 
     if (ft_type == NGX_HTTP_UPSTREAM_FT_TIMEOUT) {
@@ -4271,6 +5945,7 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
 
     case NGX_HTTP_UPSTREAM_FT_TIMEOUT:
     case NGX_HTTP_UPSTREAM_FT_HTTP_504:
+    case NGX_HTTP_UPSTREAM_FT_HEDGE:
         status = NGX_HTTP_GATEWAY_TIME_OUT;
         break;
 
@@ -4319,10 +5994,14 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
         ft_type |= NGX_HTTP_UPSTREAM_FT_NON_IDEMPOTENT;
     }
 
-    if (u->peer.tries == 0
-        || ((u->conf->next_upstream & ft_type) != ft_type)
-        || (u->request_sent && r->request_body_no_buffering)
-        || (timeout && ngx_current_msec - u->peer.start_time >= timeout))
+    /* a hedged request was checked by ngx_http_upstream_hedge_handler() */
+
+    if (ft_type != NGX_HTTP_UPSTREAM_FT_HEDGE
+        && (u->peer.tries == 0
+            || ((u->conf->next_upstream & ft_type) != ft_type)
+            || (u->request_sent && r->request_body_no_buffering)
+            || (timeout && ngx_current_msec - u->peer.start_time >= timeout)
+            || ngx_http_upstream_retry_budget(r, u) != NGX_OK))
     {
 #if (NGX_HTTP_CACHE)
 
@@ -4414,6 +6093,10 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     *u->cleanup = NULL;
     u->cleanup = NULL;
 
+    if (u->coalesce && u->coalesce->leader) {
+        ngx_http_upstream_coalesce_done(r, u, rc);
+    }
+
     if (u->resolved && u->resolved->ctx) {
         ngx_resolve_name_done(u->resolved->ctx);
         u->resolved->ctx = NULL;
@@ -4422,6 +6105,8 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     if (u->state && u->state->response_time == (ngx_msec_t) -1) {
         u->state->response_time = ngx_current_msec - u->start_time;
 
+        ngx_probe2(http_upstream_done, r, rc);
+
         if (u->pipe && u->pipe->read_length) {
             u->state->bytes_received += u->pipe->read_length
                                         - u->pipe->preread_size;
@@ -4433,11 +6118,21 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
         }
     }
 
-    u->finalize_request(r, rc);
+    u->finalize_request(r, rc);
+
+    if (u->queue) {
+        ngx_http_upstream_queue_cleanup(u->queue);
+    }
+
+    if (u->hedge && u->hedge->timer_set) {
+        ngx_del_timer(u->hedge);
+    }
 
     if (u->peer.free && u->peer.sockaddr) {
         u->peer.free(&u->peer, u->peer.data, 0);
         u->peer.sockaddr = NULL;
+
+        ngx_http_upstream_queue_wake(u->upstream);
     }
 
     if (u->peer.connection) {
@@ -5541,6 +7236,9 @@ ngx_http_upstream_response_time_variable(ngx_http_request_t *r,
         } else if (data == 2) {
             ms = state[i].connect_time;
 
+        } else if (data == 3) {
+            ms = state[i].queue_time;
+
         } else {
             ms = state[i].response_time;
         }
@@ -5618,6 +7316,14 @@ ngx_http_upstream_response_length_variable(ngx_http_request_t *r,
         } else if (data == 2) {
             p = ngx_sprintf(p, "%O", state[i].bytes_sent);
 
+        } else if (data == 3) {
+            p = ngx_sprintf(p, "%O", state[i].bytes_spliced);
+
+        } else if (data == 4) {
+            p = ngx_sprintf(p, "%O", state[i].bytes_sent
+                                     + state[i].bytes_received
+                                     - state[i].bytes_spliced);
+
         } else {
             p = ngx_sprintf(p, "%O", state[i].response_length);
         }
@@ -5649,6 +7355,51 @@ ngx_http_upstream_response_length_variable(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_upstream_bytes_buffered_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char               *p;
+    off_t                 n;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    if (u == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    /*
+     * the memory allocated for the response buffers
+     * and the bytes written to a temporary file
+     */
+
+    n = u->buffer.end - u->buffer.start;
+
+    if (u->pipe) {
+        n += u->pipe->allocated_size;
+
+        if (u->pipe->temp_file) {
+            n += u->pipe->temp_file->offset;
+        }
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%O", n) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_header_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -5818,6 +7569,7 @@ ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
                                          |NGX_HTTP_UPSTREAM_MAX_CONNS
                                          |NGX_HTTP_UPSTREAM_MAX_FAILS
                                          |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                                         |NGX_HTTP_UPSTREAM_SLOW_START
                                          |NGX_HTTP_UPSTREAM_DOWN
                                          |NGX_HTTP_UPSTREAM_BACKUP);
     if (uscf == NULL) {
@@ -5917,8 +7669,9 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     time_t                       fail_timeout;
     ngx_str_t                   *value, s;
     ngx_url_t                    u;
+    ngx_msec_t                   slow_start;
     ngx_int_t                    weight, max_conns, max_fails;
-    ngx_uint_t                   i;
+    ngx_uint_t                   i, resolve;
     ngx_http_upstream_server_t  *us;
 
     us = ngx_array_push(uscf->servers);
@@ -5934,6 +7687,8 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max_conns = 0;
     max_fails = 1;
     fail_timeout = 10;
+    slow_start = 0;
+    resolve = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
 
@@ -6000,6 +7755,24 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "slow_start=", 11) == 0) {
+
+            if (!(uscf->flags & NGX_HTTP_UPSTREAM_SLOW_START)) {
+                goto not_supported;
+            }
+
+            s.len = value[i].len - 11;
+            s.data = &value[i].data[11];
+
+            slow_start = ngx_parse_time(&s, 0);
+
+            if (slow_start == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
         if (ngx_strcmp(value[i].data, "backup") == 0) {
 
             if (!(uscf->flags & NGX_HTTP_UPSTREAM_BACKUP)) {
@@ -6022,6 +7795,25 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (ngx_strcmp(value[i].data, "resolve") == 0) {
+            resolve = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "service=", 8) == 0) {
+
+            us->service.len = value[i].len - 8;
+            us->service.data = &value[i].data[8];
+
+            if (us->service.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+#endif
+
         goto invalid;
     }
 
@@ -6029,6 +7821,16 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     u.url = value[1];
     u.default_port = 80;
+    u.no_resolve = resolve;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (us->service.len && !resolve) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "service upstream \"%V\" requires "
+                           "\"resolve\" parameter", &u.url);
+        return NGX_CONF_ERROR;
+    }
+#endif
 
     if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
         if (u.err) {
@@ -6039,6 +7841,22 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (us->service.len && !u.no_port) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "service upstream \"%V\" may not have port",
+                           &u.url);
+        return NGX_CONF_ERROR;
+    }
+
+    if (resolve && u.naddrs == 0) {
+        us->host = u.host;
+        us->port = u.port;
+    }
+
+#endif
+
     us->name = u.url;
     us->addrs = u.addrs;
     us->naddrs = u.naddrs;
@@ -6046,6 +7864,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     us->max_conns = max_conns;
     us->max_fails = max_fails;
     us->fail_timeout = fail_timeout;
+    us->slow_start = slow_start;
 
     return NGX_CONF_OK;
 
@@ -6066,6 +7885,190 @@ not_supported:
 }
 
 
+static char *
+ngx_http_upstream_queue(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_msec_t   timeout;
+
+    if (uscf->queue_max) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid queue size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    timeout = 60000;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "timeout=", 8) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 8;
+        s.data = value[2].data + 8;
+
+        timeout = ngx_parse_time(&s, 0);
+
+        if (timeout == (ngx_msec_t) NGX_ERROR) {
+            goto invalid;
+        }
+    }
+
+    uscf->queue_max = n;
+    uscf->queue_timeout = timeout;
+
+    ngx_queue_init(&uscf->queue);
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_upstream_retry_budget_directive(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    size_t      len;
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (uscf->retry_budget) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    len = value[1].len;
+
+    if (len && value[1].data[len - 1] == '%') {
+        len--;
+    }
+
+    n = ngx_atoi(value[1].data, len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid retry budget \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    uscf->retry_budget = n;
+    uscf->retry_min = 10;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "min=", 4) != 0) {
+            goto invalid;
+        }
+
+        n = ngx_atoi(value[2].data + 4, value[2].len - 4);
+
+        if (n == NGX_ERROR) {
+            goto invalid;
+        }
+
+        uscf->retry_min = n;
+    }
+
+    if (uscf->stats == NULL) {
+        uscf->stats = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_stats_t));
+        if (uscf->stats == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_upstream_hedge_directive(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value, s;
+
+    if (uscf->hedge) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n < 50 || n > 99) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid percentile \"%V\", "
+                           "it must be between 50 and 99", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    uscf->hedge = n;
+    uscf->hedge_min = 0;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "min=", 4) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 4;
+        s.data = value[2].data + 4;
+
+        uscf->hedge_min = ngx_parse_time(&s, 0);
+
+        if (uscf->hedge_min == (ngx_msec_t) NGX_ERROR) {
+            goto invalid;
+        }
+    }
+
+    if (uscf->stats == NULL) {
+        uscf->stats = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_stats_t));
+        if (uscf->stats == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 ngx_http_upstream_srv_conf_t *
 ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
 {
@@ -6147,6 +8150,9 @@ ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
     uscf->line = cf->conf_file->line;
     uscf->port = u->port;
     uscf->no_port = u->no_port;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    uscf->resolver_timeout = NGX_CONF_UNSET_MSEC;
+#endif
 
     if (u->naddrs == 1 && (u->port || u->family == AF_UNIX)) {
         uscf->servers = ngx_array_create(cf->pool, 1,
@@ -6496,6 +8502,115 @@ ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     return NGX_OK;
 }
 
+ngx_int_t
+ngx_http_upstream_serializer_init(ngx_http_upstream_serializer_t *s,
+    ngx_pool_t *pool, size_t size)
+{
+    s->buf = ngx_create_temp_buf(pool, size);
+    if (s->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->out = ngx_alloc_chain_link(pool);
+    if (s->out == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->out->buf = s->buf;
+    s->out->next = NULL;
+
+    s->last = s->out;
+    s->ref = NULL;
+    s->pool = pool;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_upstream_serializer_add(ngx_http_upstream_serializer_t *s,
+    u_char *data, size_t len)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    if (len < NGX_HTTP_UPSTREAM_REF_SIZE) {
+        s->buf->last = ngx_cpymem(s->buf->last, data, len);
+        return NGX_OK;
+    }
+
+    b = ngx_calloc_buf(s->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->start = data;
+    b->pos = data;
+    b->last = data + len;
+    b->end = b->last;
+    b->memory = 1;
+
+    cl = s->last;
+
+    if (s->buf->pos == s->buf->last) {
+
+        /* nothing was copied since the previous reference */
+
+        cl->buf = b;
+
+    } else {
+        cl->next = ngx_alloc_chain_link(s->pool);
+        if (cl->next == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl = cl->next;
+        cl->buf = b;
+
+        /* copying continues in the rest of the buffer */
+
+        b = ngx_calloc_buf(s->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->start = s->buf->last;
+        b->pos = b->start;
+        b->last = b->start;
+        b->end = s->buf->end;
+        b->temporary = 1;
+
+        s->buf = b;
+    }
+
+    s->ref = cl;
+
+    cl->next = ngx_alloc_chain_link(s->pool);
+    if (cl->next == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl = cl->next;
+    cl->buf = s->buf;
+    cl->next = NULL;
+
+    s->last = cl;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_upstream_serializer_finish(ngx_http_upstream_serializer_t *s)
+{
+    /* an empty buffer after the last reference is not sent */
+
+    if (s->ref && s->buf->pos == s->buf->last) {
+        s->ref->next = NULL;
+        s->last = s->ref;
+    }
+}
+
 
 static void *
 ngx_http_upstream_create_main_conf(ngx_conf_t *cf)
@@ -6514,6 +8629,9 @@ ngx_http_upstream_create_main_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    ngx_rbtree_init(&umcf->coalesce, &umcf->coalesce_sentinel,
+                    ngx_str_rbtree_insert_value);
+
     return umcf;
 }
 
@@ -31,6 +31,7 @@
 #define NGX_HTTP_UPSTREAM_FT_BUSY_LOCK       0x00001000
 #define NGX_HTTP_UPSTREAM_FT_MAX_WAITING     0x00002000
 #define NGX_HTTP_UPSTREAM_FT_NON_IDEMPOTENT  0x00004000
+#define NGX_HTTP_UPSTREAM_FT_HEDGE           0x00008000
 #define NGX_HTTP_UPSTREAM_FT_NOLIVE          0x40000000
 #define NGX_HTTP_UPSTREAM_FT_OFF             0x80000000
 
@@ -65,6 +66,7 @@ typedef struct {
     off_t                            response_length;
     off_t                            bytes_received;
     off_t                            bytes_sent;
+    off_t                            bytes_spliced;
 
     ngx_str_t                       *peer;
 } ngx_http_upstream_state_t;
@@ -74,10 +76,33 @@ typedef struct {
     ngx_hash_t                       headers_in_hash;
     ngx_array_t                      upstreams;
                                              /* ngx_http_upstream_srv_conf_t */
+    ngx_rbtree_t                     coalesce;
+    ngx_rbtree_node_t                coalesce_sentinel;
 } ngx_http_upstream_main_conf_t;
 
+typedef struct ngx_http_upstream_coalesce_s  ngx_http_upstream_coalesce_t;
+typedef struct ngx_http_upstream_queue_s  ngx_http_upstream_queue_t;
+typedef struct ngx_http_upstream_splice_s  ngx_http_upstream_splice_t;
+
 typedef struct ngx_http_upstream_srv_conf_s  ngx_http_upstream_srv_conf_t;
 
+
+#define NGX_HTTP_UPSTREAM_LATENCY_BUCKETS  64
+
+/*
+ * the counters are decayed periodically, so they reflect recent requests;
+ * they are kept in the upstream zone, if any
+ */
+
+typedef struct {
+    ngx_atomic_t                     requests;
+    ngx_atomic_t                     retries;
+    ngx_atomic_t                     decayed;
+    ngx_atomic_t                     updated;
+    ngx_atomic_t                     hedge_delay;
+    ngx_atomic_t                     latency[NGX_HTTP_UPSTREAM_LATENCY_BUCKETS];
+} ngx_http_upstream_stats_t;
+
 typedef ngx_int_t (*ngx_http_upstream_init_pt)(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us);
 typedef ngx_int_t (*ngx_http_upstream_init_peer_pt)(ngx_http_request_t *r,
@@ -106,6 +131,13 @@ typedef struct {
     ngx_msec_t                       slow_start;
     ngx_uint_t                       down;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    /* a name resolved at run time */
+    ngx_str_t                        host;
+    ngx_str_t                        service;
+    in_port_t                        port;
+#endif
+
     unsigned                         backup:1;
 
     NGX_COMPAT_BEGIN(6)
@@ -120,6 +152,7 @@ typedef struct {
 #define NGX_HTTP_UPSTREAM_DOWN          0x0010
 #define NGX_HTTP_UPSTREAM_BACKUP        0x0020
 #define NGX_HTTP_UPSTREAM_MAX_CONNS     0x0100
+#define NGX_HTTP_UPSTREAM_SLOW_START    0x0200
 
 
 struct ngx_http_upstream_srv_conf_s {
@@ -142,8 +175,22 @@ struct ngx_http_upstream_srv_conf_s {
     in_port_t                        port;
     ngx_uint_t                       no_port;  /* unsigned no_port:1 */
 
+    /* requests waiting for a server in this worker process */
+    ngx_queue_t                      queue;
+    ngx_uint_t                       queued;
+    ngx_uint_t                       queue_max;
+    ngx_msec_t                       queue_timeout;
+
+    ngx_uint_t                       retry_budget;  /* percent of requests */
+    ngx_uint_t                       retry_min;
+    ngx_uint_t                       hedge;         /* latency percentile */
+    ngx_msec_t                       hedge_min;
+    ngx_http_upstream_stats_t       *stats;
+
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_shm_zone_t                  *shm_zone;
+    ngx_resolver_t                  *resolver;
+    ngx_msec_t                       resolver_timeout;
 #endif
 };
 
@@ -178,6 +225,7 @@ typedef struct {
     size_t                           temp_file_write_size_conf;
 
     ngx_bufs_t                       bufs;
+    ngx_flag_t                       adaptive_buffers;
 
     ngx_uint_t                       ignore_headers;
     ngx_uint_t                       next_upstream;
@@ -219,16 +267,22 @@ typedef struct {
     ngx_flag_t                       cache_revalidate;
     ngx_flag_t                       cache_convert_head;
     ngx_flag_t                       cache_background_update;
+    ngx_flag_t                       cache_write_behind;
+    ngx_flag_t                       cache_read_while_write;
 
     ngx_array_t                     *cache_valid;
     ngx_array_t                     *cache_bypass;
     ngx_array_t                     *cache_purge;
+    ngx_array_t                     *cache_tags;
     ngx_array_t                     *no_cache;
 #endif
 
     ngx_array_t                     *store_lengths;
     ngx_array_t                     *store_values;
 
+    ngx_http_complex_value_t        *coalesce;
+    size_t                           coalesce_max_size;
+
 #if (NGX_HTTP_CACHE)
     signed                           cache:2;
 #endif
@@ -397,6 +451,12 @@ struct ngx_http_upstream_s {
      */
     ngx_http_cleanup_pt             *cleanup;
 
+    ngx_http_upstream_coalesce_t    *coalesce;
+    ngx_http_upstream_queue_t       *queue;
+    ngx_event_t                     *hedge;
+    ngx_http_upstream_splice_t      *request_splice;
+    ngx_http_upstream_splice_t      *response_splice;
+
     unsigned                         store:1;
     unsigned                         cacheable:1;
     unsigned                         accel:1;
@@ -412,6 +472,8 @@ struct ngx_http_upstream_s {
     unsigned                         request_sent:1;
     unsigned                         request_body_sent:1;
     unsigned                         request_body_blocked:1;
+    unsigned                         request_body_splice:1;
+    unsigned                         response_body_splice:1;
     unsigned                         header_sent:1;
 };
 
@@ -429,6 +491,24 @@ typedef struct {
 } ngx_http_upstream_param_t;
 
 
+/*
+ * request headers are serialized into a chain which references values
+ * of NGX_HTTP_UPSTREAM_REF_SIZE bytes or longer instead of copying them,
+ * the rest is copied into a single buffer, sized by the caller without
+ * the referenced values
+ */
+
+#define NGX_HTTP_UPSTREAM_REF_SIZE  256
+
+typedef struct {
+    ngx_chain_t                     *out;
+    ngx_chain_t                     *last;
+    ngx_chain_t                     *ref;
+    ngx_buf_t                       *buf;
+    ngx_pool_t                      *pool;
+} ngx_http_upstream_serializer_t;
+
+
 ngx_int_t ngx_http_upstream_create(ngx_http_request_t *r);
 void ngx_http_upstream_init(ngx_http_request_t *r);
 ngx_http_upstream_srv_conf_t *ngx_http_upstream_add(ngx_conf_t *cf,
@@ -440,6 +520,11 @@ char *ngx_http_upstream_param_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
 ngx_int_t ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
     ngx_str_t *default_hide_headers, ngx_hash_init_t *hash);
+ngx_int_t ngx_http_upstream_serializer_init(ngx_http_upstream_serializer_t *s,
+    ngx_pool_t *pool, size_t size);
+ngx_int_t ngx_http_upstream_serializer_add(ngx_http_upstream_serializer_t *s,
+    u_char *data, size_t len);
+void ngx_http_upstream_serializer_finish(ngx_http_upstream_serializer_t *s);
 
 
 #define ngx_http_conf_upstream_srv_conf(uscf, module)                         \
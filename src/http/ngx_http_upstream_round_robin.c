@@ -16,6 +16,15 @@
 
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp);
+static ngx_uint_t ngx_http_upstream_slow_start(
+    ngx_http_upstream_rr_peer_t *peer);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t ngx_http_upstream_init_resolve_peer(ngx_conf_t *cf,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_server_t *server);
+
+#endif
 
 #if (NGX_HTTP_SSL)
 
@@ -40,7 +49,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
     ngx_url_t                      u;
-    ngx_uint_t                     i, j, n, w;
+    ngx_uint_t                     i, j, n, r, w;
     ngx_http_upstream_server_t    *server;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
@@ -51,6 +60,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         server = us->servers->elts;
 
         n = 0;
+        r = 0;
         w = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
@@ -58,17 +68,35 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 continue;
             }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                r++;
+                continue;
+            }
+#endif
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
         }
 
-        if (n == 0) {
+        if (n == 0 && r == 0) {
             ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
                           "no servers in upstream \"%V\" in %s:%ui",
                           &us->host, us->file_name, us->line);
             return NGX_ERROR;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (r && us->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "resolving names at run time requires "
+                          "upstream \"%V\" in %s:%ui "
+                          "to be in shared memory",
+                          &us->host, us->file_name, us->line);
+            return NGX_ERROR;
+        }
+#endif
+
         peers = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_rr_peers_t));
         if (peers == NULL) {
             return NGX_ERROR;
@@ -80,7 +108,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         }
 
         // balus: 为什么要对 single 特殊对待？
-        peers->single = (n == 1);
+        peers->single = (n == 1 && r == 0);
         peers->number = n;
         // balus: 如果 w == n，那么说明每个 server 的 weight 都是 1
         peers->weighted = (w != n);
@@ -99,6 +127,18 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 continue;
             }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                if (ngx_http_upstream_init_resolve_peer(cf, peers, &server[i])
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                continue;
+            }
+#endif
+
             /*
              * balus: 一个 server(ngx_http_upstream_server_t) 中可能包含有多个地址
              *        对每个地址，我们都使用一个 peer 来表示，所有的 peer 虽然是一个数
@@ -116,6 +156,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -148,6 +189,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
          */
 
         n = 0;
+        r = 0;
         w = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
@@ -155,14 +197,32 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 continue;
             }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                r++;
+                continue;
+            }
+#endif
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
         }
 
-        if (n == 0) {
+        if (n == 0 && r == 0) {
             return NGX_OK;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (r && us->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "resolving names at run time requires "
+                          "upstream \"%V\" in %s:%ui "
+                          "to be in shared memory",
+                          &us->host, us->file_name, us->line);
+            return NGX_ERROR;
+        }
+#endif
+
         backup = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_rr_peers_t));
         if (backup == NULL) {
             return NGX_ERROR;
@@ -193,6 +253,18 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 continue;
             }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                if (ngx_http_upstream_init_resolve_peer(cf, backup, &server[i])
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                continue;
+            }
+#endif
+
             for (j = 0; j < server[i].naddrs; j++) {
                 peer[n].sockaddr = server[i].addrs[j].sockaddr;
                 peer[n].socklen = server[i].addrs[j].socklen;
@@ -203,6 +275,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -317,6 +390,53 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t
+ngx_http_upstream_init_resolve_peer(ngx_conf_t *cf,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_server_t *server)
+{
+    ngx_http_upstream_host_t     *host;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    /*
+     * the peer keeps parameters of the server, peers with addresses
+     * of the name are created from it in the upstream zone
+     */
+
+    peer = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_rr_peer_t));
+    if (peer == NULL) {
+        return NGX_ERROR;
+    }
+
+    host = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_host_t));
+    if (host == NULL) {
+        return NGX_ERROR;
+    }
+
+    host->name = server->host;
+    host->service = server->service;
+    host->port = server->port;
+
+    peer->weight = server->weight;
+    peer->effective_weight = server->weight;
+    peer->max_conns = server->max_conns;
+    peer->max_fails = server->max_fails;
+    peer->fail_timeout = server->fail_timeout;
+    peer->slow_start = server->slow_start;
+    peer->down = server->down;
+    peer->server = server->name;
+    peer->host = host;
+
+    peer->next = peers->resolve;
+    peers->resolve = peer;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 /*
  * balus: 这个函数做了些啥呢？(Q)
  */
@@ -346,8 +466,15 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     // balus: 注意 us->peer 是 ngx_http_upstream_peer_t(而不是 ngx_http_upstream_rr_peer_t)
     rrp->peers = us->peer.data;
     rrp->current = NULL;
+
+    ngx_http_upstream_rr_peers_rlock(rrp->peers);
+
     // balus: config 字段用来干啥的？
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    rrp->config = rrp->peers->config ? *rrp->peers->config : 0;
+#else
     rrp->config = 0;
+#endif
 
     /*
      * balus: number 表示的是该 peers_t 对应的 upstream_srv_conf 中所有 server 的
@@ -367,6 +494,10 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
         n = rrp->peers->next->number;
     }
 
+    r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
+
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
     /*
      * balus: 用一个位图来记录上游服务器是否被选择过。
      *        如果 n <= 64，那么用一个uintptr 就可以充当位图了
@@ -400,7 +531,6 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
      */
     r->upstream->peer.get = ngx_http_upstream_get_round_robin_peer;
     r->upstream->peer.free = ngx_http_upstream_free_round_robin_peer;
-    r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
 #if (NGX_HTTP_SSL)
     r->upstream->peer.set_session =
                                ngx_http_upstream_set_round_robin_peer_session;
@@ -565,6 +695,15 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     peers = rrp->peers;
     ngx_http_upstream_rr_peers_wlock(peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (ngx_http_upstream_rr_peers_changed(rrp)) {
+
+        /* the "tried" bitmap does not match the peers anymore */
+
+        goto busy;
+    }
+#endif
+
     if (peers->single) {
         // balus: 如果是 single 的话，说明只有一台服务器(backup 的也没有)
         peer = peers->peer;
@@ -636,6 +775,10 @@ failed:
         ngx_http_upstream_rr_peers_wlock(peers);
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+busy:
+#endif
+
     ngx_http_upstream_rr_peers_unlock(peers);
 
     pc->name = peers->name;
@@ -650,16 +793,18 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
     time_t                        now;
     uintptr_t                     m;
     ngx_int_t                     total;
-    ngx_uint_t                    i, n, p;
-    ngx_http_upstream_rr_peer_t  *peer, *best;
+    ngx_uint_t                    i, n, p, sp;
+    ngx_http_upstream_rr_peer_t  *peer, *best, *slow;
 
     now = ngx_time();
 
     best = NULL;
+    slow = NULL;
     total = 0;
 
 #if (NGX_SUPPRESS_WARN)
     p = 0;
+    sp = 0;
 #endif
 
     /*
@@ -708,6 +853,16 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
+        if (peer->start_time && ngx_http_upstream_slow_start(peer)) {
+
+            if (slow == NULL) {
+                slow = peer;
+                sp = i;
+            }
+
+            continue;
+        }
+
         /*
          * balus: 经过了这么多个 if 到这里，这个 peer 满足了所有的条件，说明他很久没有被选中了
          *         所以增加他的 current_weight，把负载往这个 peer 这里偏一点
@@ -727,7 +882,15 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
     }
 
     if (best == NULL) {
-        return NULL;
+
+        /* only servers in slow start are available */
+
+        if (slow == NULL) {
+            return NULL;
+        }
+
+        best = slow;
+        p = sp;
     }
 
     rrp->current = best;
@@ -755,6 +918,28 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 }
 
 
+static ngx_uint_t
+ngx_http_upstream_slow_start(ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_msec_t  elapsed;
+
+    elapsed = ngx_current_msec - peer->start_time;
+
+    if (elapsed >= peer->slow_start) {
+        peer->start_time = 0;
+        return 0;
+    }
+
+    /*
+     * a server which came back is skipped with a probability decreasing
+     * from 1 to 0 over the slow_start time, so its share of requests
+     * grows linearly up to that of its weight
+     */
+
+    return (ngx_msec_t) ngx_random() % peer->slow_start >= elapsed;
+}
+
+
 /*
  * balus: 释放一台上游服务器
  */
@@ -820,6 +1005,14 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
         /* mark peer live if check passed */
 
         if (peer->accessed < peer->checked) {
+
+            if (peer->slow_start
+                && peer->max_fails
+                && peer->fails >= peer->max_fails)
+            {
+                peer->start_time = ngx_current_msec;
+            }
+
             peer->fails = 0;
         }
     }
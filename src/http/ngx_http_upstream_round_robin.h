@@ -15,6 +15,25 @@
 
 
 typedef struct ngx_http_upstream_rr_peer_s   ngx_http_upstream_rr_peer_t;
+typedef struct ngx_http_upstream_rr_peers_s  ngx_http_upstream_rr_peers_t;
+
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+typedef struct {
+    ngx_event_t                     event;      /* must be first */
+    ngx_str_t                       name;
+    ngx_str_t                       service;
+    in_port_t                       port;
+    ngx_msec_t                      timeout;
+    ngx_resolver_t                 *resolver;
+    ngx_http_upstream_rr_peers_t   *peers;      /* primary peers */
+    ngx_http_upstream_rr_peer_t    *peer;       /* parameters of the server */
+    unsigned                        backup:1;
+} ngx_http_upstream_host_t;
+
+#endif
+
 
 struct ngx_http_upstream_rr_peer_s {
     struct sockaddr                *sockaddr;
@@ -34,6 +53,9 @@ struct ngx_http_upstream_rr_peer_s {
     ngx_uint_t                      conns;
     ngx_uint_t                      max_conns;
 
+    ngx_uint_t                      ewma;       /* response time average */
+    ngx_msec_t                      ewma_time;
+
     ngx_uint_t                      fails;
     time_t                          accessed;
     time_t                          checked;
@@ -43,7 +65,7 @@ struct ngx_http_upstream_rr_peer_s {
     ngx_msec_t                      slow_start;
     ngx_msec_t                      start_time;
 
-    ngx_uint_t                      down;
+    ngx_uint_t                      down;       /* bitmask */
 
 #if (NGX_HTTP_SSL || NGX_COMPAT)
     void                           *ssl_session;
@@ -52,6 +74,8 @@ struct ngx_http_upstream_rr_peer_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_atomic_t                    lock;
+    ngx_uint_t                      id;
+    ngx_http_upstream_host_t       *host;
 #endif
 
     ngx_http_upstream_rr_peer_t    *next;
@@ -61,7 +85,13 @@ struct ngx_http_upstream_rr_peer_s {
 };
 
 
-typedef struct ngx_http_upstream_rr_peers_s  ngx_http_upstream_rr_peers_t;
+/* set by the "down" parameter */
+#define NGX_HTTP_UPSTREAM_RR_PEER_DOWN       0x01
+/* set by active health checks */
+#define NGX_HTTP_UPSTREAM_RR_PEER_UNHEALTHY  0x02
+/* set by the upstream_conf API, existing connections are not affected */
+#define NGX_HTTP_UPSTREAM_RR_PEER_DRAIN      0x04
+
 
 struct ngx_http_upstream_rr_peers_s {
     ngx_uint_t                      number;
@@ -69,7 +99,20 @@ struct ngx_http_upstream_rr_peers_s {
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_slab_pool_t                *shpool;
     ngx_atomic_t                    rwlock;
+    ngx_atomic_t                    idle;       /* keepalive connections */
     ngx_http_upstream_rr_peers_t   *zone_next;
+
+    /* changed each time peers are added, removed or reweighted */
+    ngx_uint_t                     *config;
+
+    /* servers resolved at run time */
+    ngx_http_upstream_rr_peer_t    *resolve;
+
+    /* removed servers with connections still open */
+    ngx_http_upstream_rr_peer_t    *zombies;
+
+    /* the id of the next server added, in primary peers */
+    ngx_uint_t                      next_id;
 #endif
 
     ngx_uint_t                      total_weight;
@@ -118,8 +161,14 @@ struct ngx_http_upstream_rr_peers_s {
         ngx_rwlock_unlock(&peer->lock);                                       \
     }
 
+
+#define ngx_http_upstream_rr_peers_changed(rrp)                               \
+    ((rrp)->peers->config && (rrp)->config != *(rrp)->peers->config)
+
 #else
 
+#define ngx_http_upstream_rr_peers_changed(rrp)  0
+
 #define ngx_http_upstream_rr_peers_rlock(peers)
 #define ngx_http_upstream_rr_peers_wlock(peers)
 #define ngx_http_upstream_rr_peers_unlock(peers)
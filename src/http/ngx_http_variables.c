@@ -34,6 +34,11 @@ static ngx_int_t ngx_http_variable_headers_internal(ngx_http_request_t *r,
 
 static ngx_int_t ngx_http_variable_unknown_header_in(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_http_headers_index_t *ngx_http_variable_headers_index(
+    ngx_http_request_t *r);
+static ngx_uint_t ngx_http_variable_header_key(u_char *name, size_t len);
+static ngx_int_t ngx_http_variable_header_match(ngx_table_elt_t *h,
+    u_char *name, size_t len);
 static ngx_int_t ngx_http_variable_unknown_header_out(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_unknown_trailer_out(ngx_http_request_t *r,
@@ -63,6 +68,8 @@ static ngx_int_t ngx_http_variable_proxy_protocol_addr(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_proxy_protocol_port(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_proxy_protocol_tlv(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_server_addr(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_server_port(ngx_http_request_t *r,
@@ -103,6 +110,10 @@ static ngx_int_t ngx_http_variable_request_length(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_request_time(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_request_cpu_time(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_request_pool_bytes(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_request_id(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_status(ngx_http_request_t *r,
@@ -143,6 +154,14 @@ static ngx_int_t ngx_http_variable_time_iso8601(ngx_http_request_t *r,
 static ngx_int_t ngx_http_variable_time_local(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 
+#if (NGX_PCRE)
+static ngx_uint_t ngx_http_map_cache_lookup(ngx_http_map_cache_t *cache,
+    ngx_str_t *match);
+static void ngx_http_map_cache_insert(ngx_http_map_cache_t *cache,
+    ngx_str_t *match, ngx_uint_t index);
+static void ngx_http_map_cache_cleanup(void *data);
+#endif
+
 /*
  * TODO:
  *     Apache CGI: AUTH_TYPE, PATH_INFO (null), PATH_TRANSLATED
@@ -159,6 +178,35 @@ static ngx_int_t ngx_http_variable_time_local(ngx_http_request_t *r,
  * they are handled using dedicated entries
  */
 
+#if (NGX_PCRE)
+
+#define NGX_HTTP_MAP_CACHE_MISS     (ngx_uint_t) -1
+#define NGX_HTTP_MAP_CACHE_MAX_LEN  1024
+
+
+/*
+ * per worker LRU of map values not found in the hash, the index
+ * of the first matching regex or nregex if none matched
+ */
+
+struct ngx_http_map_cache_s {
+    ngx_rbtree_t                  rbtree;
+    ngx_rbtree_node_t             sentinel;
+    ngx_queue_t                   queue;
+    ngx_uint_t                    size;
+    ngx_uint_t                    n;
+};
+
+
+typedef struct {
+    ngx_str_node_t                sn;
+    ngx_queue_t                   queue;
+    ngx_uint_t                    index;
+} ngx_http_map_cache_node_t;
+
+#endif
+
+
 static ngx_http_variable_t  ngx_http_core_variables[] = {
 
     { ngx_string("http_host"), NULL, ngx_http_variable_header,
@@ -214,6 +262,10 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
       ngx_http_variable_proxy_protocol_port,
       offsetof(ngx_proxy_protocol_t, dst_port), 0, 0 },
 
+    { ngx_string("proxy_protocol_tlv_"), NULL,
+      ngx_http_variable_proxy_protocol_tlv,
+      0, NGX_HTTP_VAR_PREFIX, 0 },
+
     { ngx_string("server_addr"), NULL, ngx_http_variable_server_addr, 0, 0, 0 },
 
     { ngx_string("server_port"), NULL, ngx_http_variable_server_port, 0, 0, 0 },
@@ -296,6 +348,14 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
     { ngx_string("request_time"), NULL, ngx_http_variable_request_time,
       0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("request_cpu_time"), NULL,
+      ngx_http_variable_request_cpu_time,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_pool_bytes"), NULL,
+      ngx_http_variable_request_pool_bytes,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_string("request_id"), NULL,
       ngx_http_variable_request_id,
       0, 0, 0 },
@@ -990,9 +1050,204 @@ static ngx_int_t
 ngx_http_variable_unknown_header_in(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    return ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
-                                            &r->headers_in.headers.part,
-                                            sizeof("http_") - 1);
+    ngx_str_t *var = (ngx_str_t *) data;
+
+    u_char                    *name;
+    size_t                     len;
+    ngx_uint_t                 i;
+    ngx_table_elt_t           *h;
+    ngx_list_t                *headers;
+    ngx_http_headers_index_t  *index;
+
+    headers = &r->headers_in.headers;
+
+    if (headers->last == NULL) {
+        /* the request line was not parsed */
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    index = r->headers_in.index;
+
+    /* rebuild the index if headers were added after it was built */
+
+    if (index == NULL
+        || index->last != headers->last
+        || index->nelts != headers->last->nelts)
+    {
+        index = ngx_http_variable_headers_index(r);
+
+        if (index == NULL) {
+            return ngx_http_variable_unknown_header(v, var, &headers->part,
+                                                    sizeof("http_") - 1);
+        }
+    }
+
+    name = var->data + sizeof("http_") - 1;
+    len = var->len - (sizeof("http_") - 1);
+
+    i = ngx_http_variable_header_key(name, len) & index->mask;
+
+    for ( /* void */ ; index->elts[i]; i = (i + 1) & index->mask) {
+
+        h = index->elts[i];
+
+        if (!ngx_http_variable_header_match(h, name, len)) {
+            continue;
+        }
+
+        if (h->hash == 0) {
+            /* the header was deleted, a later one may have the same name */
+            return ngx_http_variable_unknown_header(v, var, &headers->part,
+                                                    sizeof("http_") - 1);
+        }
+
+        v->len = h->value.len;
+        v->valid = 1;
+        v->no_cacheable = 0;
+        v->not_found = 0;
+        v->data = h->value.data;
+
+        return NGX_OK;
+    }
+
+    v->not_found = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_headers_index_t *
+ngx_http_variable_headers_index(ngx_http_request_t *r)
+{
+    ngx_uint_t                 i, j, n, size;
+    ngx_list_part_t           *part;
+    ngx_table_elt_t           *header, *h;
+    ngx_http_headers_index_t  *index;
+
+    index = r->headers_in.index;
+
+    if (index == NULL) {
+        index = ngx_palloc(r->pool, sizeof(ngx_http_headers_index_t));
+        if (index == NULL) {
+            return NULL;
+        }
+    }
+
+    n = 0;
+
+    for (part = &r->headers_in.headers.part; part; part = part->next) {
+        n += part->nelts;
+    }
+
+    /* keep the open addressing table at most half full */
+
+    for (size = 8; size < n * 2; size *= 2) { /* void */ }
+
+    index->elts = ngx_pcalloc(r->pool, size * sizeof(ngx_table_elt_t *));
+    if (index->elts == NULL) {
+        return NULL;
+    }
+
+    index->mask = size - 1;
+
+    part = &r->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        j = ngx_http_variable_header_key(header[i].key.data,
+                                         header[i].key.len)
+            & index->mask;
+
+        /* the first of the headers with the same name is found */
+
+        for ( /* void */ ; index->elts[j]; j = (j + 1) & index->mask) {
+            h = index->elts[j];
+
+            if (ngx_http_variable_header_match(h, header[i].key.data,
+                                               header[i].key.len))
+            {
+                break;
+            }
+        }
+
+        if (index->elts[j] == NULL) {
+            index->elts[j] = &header[i];
+        }
+    }
+
+    index->last = r->headers_in.headers.last;
+    index->nelts = r->headers_in.headers.last->nelts;
+
+    r->headers_in.index = index;
+
+    return index;
+}
+
+
+/*
+ * header names are compared as variable names, that is, in lowercase
+ * and with dashes replaced by underscores
+ */
+
+#define ngx_http_variable_header_char(c)                                     \
+    (((c) >= 'A' && (c) <= 'Z') ? ((c) | 0x20) : ((c) == '-') ? '_' : (c))
+
+
+static ngx_uint_t
+ngx_http_variable_header_key(u_char *name, size_t len)
+{
+    u_char      ch;
+    ngx_uint_t  i, key;
+
+    key = 0;
+
+    for (i = 0; i < len; i++) {
+        ch = name[i];
+        key = ngx_hash(key, ngx_http_variable_header_char(ch));
+    }
+
+    return key;
+}
+
+
+static ngx_int_t
+ngx_http_variable_header_match(ngx_table_elt_t *h, u_char *name, size_t len)
+{
+    u_char      c1, c2;
+    ngx_uint_t  i;
+
+    if (h->key.len != len) {
+        return 0;
+    }
+
+    for (i = 0; i < len; i++) {
+        c1 = h->key.data[i];
+        c2 = name[i];
+
+        if (ngx_http_variable_header_char(c1)
+            != ngx_http_variable_header_char(c2))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
 }
 
 
@@ -1000,9 +1255,19 @@ static ngx_int_t
 ngx_http_variable_unknown_header_out(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
+    ngx_int_t  rc;
+
+    rc = ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
+                                          &r->headers_out.headers.part,
+                                          sizeof("sent_http_") - 1);
+
+    if (rc != NGX_OK || !v->not_found || r->headers_out.header_block == NULL) {
+        return rc;
+    }
+
     return ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
-                                            &r->headers_out.headers.part,
-                                            sizeof("sent_http_") - 1);
+                                        &r->headers_out.header_block->part,
+                                        sizeof("sent_http_") - 1);
 }
 
 
@@ -1437,6 +1702,39 @@ ngx_http_variable_proxy_protocol_port(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_variable_proxy_protocol_tlv(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_str_t *name = (ngx_str_t *) data;
+
+    ngx_int_t  rc;
+    ngx_str_t  tlv, value;
+
+    tlv.len = name->len - (sizeof("proxy_protocol_tlv_") - 1);
+    tlv.data = name->data + sizeof("proxy_protocol_tlv_") - 1;
+
+    rc = ngx_proxy_protocol_get_tlv(r->connection, &tlv, &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = value.len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = value.data;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_variable_server_addr(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -2249,6 +2547,57 @@ ngx_http_variable_request_time(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_variable_request_cpu_time(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char    *p;
+    uint64_t   us;
+
+    p = ngx_pnalloc(r->pool, NGX_INT64_LEN + 8);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the time of the running handler so far */
+
+    if (ngx_http_cpu_request == r->main) {
+        ngx_http_cpu_switch(r);
+    }
+
+    us = r->main->cpu_time / 1000;
+
+    v->len = ngx_sprintf(p, "%uL.%06uL", us / 1000000, us % 1000000) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_variable_request_pool_bytes(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    p = ngx_pnalloc(r->pool, NGX_SIZE_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%uz", ngx_pool_memory(r->main->pool)) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_variable_request_id(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -2482,17 +2831,68 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
 #if (NGX_PCRE)
 
     if (len && map->nregex) {
+        u_char                *matched;
         ngx_int_t              n;
         ngx_uint_t             i;
         ngx_http_map_regex_t  *reg;
 
         reg = map->regex;
 
+        if (map->cache) {
+            i = ngx_http_map_cache_lookup(map->cache, match);
+
+            if (i == map->nregex) {
+                return NULL;
+            }
+
+            /*
+             * a regex without captures has no side effects, otherwise
+             * it is executed again to set the captures
+             */
+
+            if (i != NGX_HTTP_MAP_CACHE_MISS) {
+
+                if (reg[i].regex->ncaptures == 0) {
+                    return reg[i].value;
+                }
+
+                n = ngx_http_regex_exec(r, reg[i].regex, match);
+
+                if (n == NGX_OK) {
+                    return reg[i].value;
+                }
+
+                if (n == NGX_ERROR) {
+                    return NULL;
+                }
+            }
+        }
+
+        matched = NULL;
+
+#if (NGX_RE2)
+        if (map->set) {
+            matched = ngx_regex_set_match(map->set, match, r->pool);
+            if (matched == NULL) {
+                return NULL;
+            }
+        }
+#endif
+
         for (i = 0; i < map->nregex; i++) {
 
+            if (matched && !matched[i]) {
+                continue;
+            }
+
             n = ngx_http_regex_exec(r, reg[i].regex, match);
 
             if (n == NGX_OK) {
+
+                if (map->cache) {
+                    ngx_http_map_cache_insert(map->cache, match, i);
+                }
+
                 return reg[i].value;
             }
 
@@ -2504,6 +2904,10 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
 
             return NULL;
         }
+
+        if (map->cache) {
+            ngx_http_map_cache_insert(map->cache, match, map->nregex);
+        }
     }
 
 #endif
@@ -2514,6 +2918,122 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
 
 #if (NGX_PCRE)
 
+ngx_int_t
+ngx_http_map_cache_init(ngx_conf_t *cf, ngx_http_map_t *map, ngx_uint_t size)
+{
+    ngx_pool_cleanup_t    *cln;
+    ngx_http_map_cache_t  *cache;
+
+    cache = ngx_palloc(cf->pool, sizeof(ngx_http_map_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_str_rbtree_insert_value);
+    ngx_queue_init(&cache->queue);
+
+    cache->size = size;
+    cache->n = 0;
+
+    cln->handler = ngx_http_map_cache_cleanup;
+    cln->data = cache;
+
+    map->cache = cache;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_map_cache_lookup(ngx_http_map_cache_t *cache, ngx_str_t *match)
+{
+    uint32_t                    hash;
+    ngx_str_node_t             *sn;
+    ngx_http_map_cache_node_t  *cn;
+
+    hash = ngx_crc32_short(match->data, match->len);
+
+    sn = ngx_str_rbtree_lookup(&cache->rbtree, match, hash);
+
+    if (sn == NULL) {
+        return NGX_HTTP_MAP_CACHE_MISS;
+    }
+
+    cn = (ngx_http_map_cache_node_t *) sn;
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+    return cn->index;
+}
+
+
+static void
+ngx_http_map_cache_insert(ngx_http_map_cache_t *cache, ngx_str_t *match,
+    ngx_uint_t index)
+{
+    ngx_queue_t                *q;
+    ngx_http_map_cache_node_t  *cn;
+
+    if (match->len > NGX_HTTP_MAP_CACHE_MAX_LEN) {
+        return;
+    }
+
+    if (cache->n == cache->size) {
+        q = ngx_queue_last(&cache->queue);
+        cn = ngx_queue_data(q, ngx_http_map_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->rbtree, &cn->sn.node);
+        ngx_free(cn);
+
+        cache->n--;
+    }
+
+    cn = ngx_alloc(sizeof(ngx_http_map_cache_node_t) + match->len,
+                   ngx_cycle->log);
+    if (cn == NULL) {
+        return;
+    }
+
+    cn->sn.node.key = ngx_crc32_short(match->data, match->len);
+    cn->sn.str.len = match->len;
+    cn->sn.str.data = (u_char *) cn + sizeof(ngx_http_map_cache_node_t);
+    ngx_memcpy(cn->sn.str.data, match->data, match->len);
+
+    cn->index = index;
+
+    ngx_rbtree_insert(&cache->rbtree, &cn->sn.node);
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+    cache->n++;
+}
+
+
+static void
+ngx_http_map_cache_cleanup(void *data)
+{
+    ngx_http_map_cache_t  *cache = data;
+
+    ngx_queue_t                *q;
+    ngx_http_map_cache_node_t  *cn;
+
+    while (!ngx_queue_empty(&cache->queue)) {
+        q = ngx_queue_head(&cache->queue);
+        cn = ngx_queue_data(q, ngx_http_map_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_free(cn);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_variable_not_found(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     uintptr_t data)
@@ -2835,6 +3355,14 @@ ngx_http_variables_init_vars(ngx_conf_t *cf)
         if (av->flags & NGX_HTTP_VAR_NOHASH) {
             key[n].key.data = NULL;
         }
+
+        /* the CPU time is only measured if it is used */
+
+        if (av->get_handler == ngx_http_variable_request_cpu_time
+            && (av->flags & NGX_HTTP_VAR_INDEXED))
+        {
+            cmcf->cpu_accounting = 1;
+        }
     }
 
 
@@ -92,17 +92,28 @@ ngx_int_t ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re,
 #endif
 
 
+typedef struct ngx_http_map_cache_s  ngx_http_map_cache_t;
+
+
 typedef struct {
     ngx_hash_combined_t           hash;
 #if (NGX_PCRE)
     ngx_http_map_regex_t         *regex;
     ngx_uint_t                    nregex;
+#if (NGX_RE2)
+    ngx_regex_set_t              *set;
+#endif
+    ngx_http_map_cache_t         *cache;
 #endif
 } ngx_http_map_t;
 
 
 void *ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map,
     ngx_str_t *match);
+#if (NGX_PCRE)
+ngx_int_t ngx_http_map_cache_init(ngx_conf_t *cf, ngx_http_map_t *map,
+    ngx_uint_t size);
+#endif
 
 
 ngx_int_t ngx_http_variables_add_core_vars(ngx_conf_t *cf);
@@ -10,6 +10,8 @@
 #include <ngx_http.h>
 
 
+static ngx_int_t ngx_http_write_filter_hold(ngx_http_request_t *r,
+    off_t size, ngx_http_core_loc_conf_t *clcf);
 static ngx_int_t ngx_http_write_filter_init(ngx_conf_t *cf);
 
 
@@ -48,6 +50,7 @@ ngx_int_t
 ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
     off_t                      size, sent, nsent, limit;
+    ngx_buf_t                 *b, *hb;
     ngx_uint_t                 last, flush, sync;
     ngx_msec_t                 delay;
     ngx_chain_t               *cl, *ln, **ll, *chain;
@@ -213,6 +216,13 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
+    if (last
+        && clcf->pipelined_output_buffer
+        && ngx_http_write_filter_hold(r, size, clcf) == NGX_OK)
+    {
+        return NGX_OK;
+    }
+
     /*
      * avoid the output if there are no last buf, no flush point,
      * there are the incoming bufs and the size of all bufs
@@ -289,6 +299,37 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
         limit = clcf->sendfile_max_chunk;
     }
 
+    hb = r->http_connection ? r->http_connection->pipelined : NULL;
+
+    if (hb && hb->pos < hb->last) {
+
+        /* the responses held for the pipelined requests go first */
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = hb->pos;
+        b->last = hb->last;
+        b->memory = 1;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = r->out;
+        r->out = cl;
+
+        /* the bytes were accounted to the requests they belong to */
+
+        c->sent -= hb->last - hb->pos;
+
+        hb->pos = hb->last;
+    }
+
     sent = c->sent;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
@@ -361,6 +402,115 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
 }
 
 
+static ngx_int_t
+ngx_http_write_filter_hold(ngx_http_request_t *r, off_t size,
+    ngx_http_core_loc_conf_t *clcf)
+{
+    u_char                 *p;
+    ngx_buf_t              *b, *hb;
+    ngx_chain_t            *cl, *ln;
+    ngx_connection_t       *c;
+    ngx_http_connection_t  *hc;
+
+    /*
+     * A complete response to a request followed by another pipelined one
+     * is copied aside and sent together with the output of the next
+     * request, so a batch of pipelined responses needs a single writev()
+     * or sendfile().  Only in-memory responses that fit into the buffer
+     * are held, and only if the next request has been received entirely,
+     * since the client does not wait for the responses to send it.
+     */
+
+    c = r->connection;
+    b = r->header_in;
+
+    if (r != r->main
+        || r->http_version >= NGX_HTTP_VERSION_20
+        || !r->keepalive
+        || r->lingering_close
+        || r->discard_body
+        || c->buffered
+        || b == NULL
+        || b->pos == b->last)
+    {
+        return NGX_DECLINED;
+    }
+
+    for (p = b->pos; /* void */ ; p++) {
+
+        p = ngx_strlchr(p, b->last, LF);
+
+        if (p == NULL) {
+            return NGX_DECLINED;
+        }
+
+        if (p + 1 < b->last && p[1] == LF) {
+            break;
+        }
+
+        if (p + 2 < b->last && p[1] == CR && p[2] == LF) {
+            break;
+        }
+    }
+
+    for (cl = r->out; cl; cl = cl->next) {
+        if (cl->buf->in_file && !ngx_buf_in_memory(cl->buf)) {
+            return NGX_DECLINED;
+        }
+    }
+
+    hc = r->http_connection;
+    hb = hc->pipelined;
+
+    if (hb == NULL) {
+        hb = ngx_create_temp_buf(c->pool, clcf->pipelined_output_buffer);
+        if (hb == NULL) {
+            return NGX_DECLINED;
+        }
+
+        hc->pipelined = hb;
+    }
+
+    if (hb->pos == hb->last) {
+
+        /* nothing was sent partially, so nothing refers to the memory */
+
+        hb->pos = hb->start;
+        hb->last = hb->start;
+    }
+
+    if (size > hb->end - hb->last) {
+        return NGX_DECLINED;
+    }
+
+    for (cl = r->out; cl; /* void */) {
+        ln = cl;
+        cl = cl->next;
+
+        if (ngx_buf_in_memory(ln->buf)) {
+            hb->last = ngx_cpymem(hb->last, ln->buf->pos,
+                                  ln->buf->last - ln->buf->pos);
+            ln->buf->pos = ln->buf->last;
+        }
+
+        if (ln->buf->in_file) {
+            ln->buf->file_pos = ln->buf->file_last;
+        }
+
+        ngx_free_chain(r->pool, ln);
+    }
+
+    r->out = NULL;
+
+    c->sent += size;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http write filter held pipelined response: %O", size);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_write_filter_init(ngx_conf_t *cf)
 {
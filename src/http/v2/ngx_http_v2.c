@@ -56,9 +56,20 @@ typedef struct {
 
 #define NGX_HTTP_V2_ROOT                         (void *) -1
 
+/* preread buffers kept for reuse per worker */
+#define NGX_HTTP_V2_FREE_BUFFERS                 32
+
+
+typedef struct {
+    ngx_http_v2_main_conf_t       *h2mcf;
+    u_char                        *start;
+    size_t                         size;
+} ngx_http_v2_preread_t;
+
 
 static void ngx_http_v2_read_handler(ngx_event_t *rev);
 static void ngx_http_v2_write_handler(ngx_event_t *wev);
+static void ngx_http_v2_schedule_frames(ngx_http_v2_connection_t *h2c);
 static void ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c);
 
 static u_char *ngx_http_v2_state_proxy_protocol(ngx_http_v2_connection_t *h2c,
@@ -135,6 +146,8 @@ static ngx_http_v2_node_t *ngx_http_v2_get_closed_node(
 #define ngx_http_v2_index(h2scf, sid)  ((sid >> 1) & h2scf->streams_index_mask)
 
 static ngx_int_t ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c);
+static ngx_int_t ngx_http_v2_send_streams_limit(ngx_http_v2_connection_t *h2c);
+static ngx_int_t ngx_http_v2_send_ping(ngx_http_v2_connection_t *h2c);
 static ngx_int_t ngx_http_v2_settings_frame_handler(
     ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
 static ngx_int_t ngx_http_v2_send_window_update(ngx_http_v2_connection_t *h2c,
@@ -168,18 +181,30 @@ static ngx_int_t ngx_http_v2_construct_request_line(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v2_cookie(ngx_http_request_t *r,
     ngx_http_v2_header_t *header);
 static ngx_int_t ngx_http_v2_construct_cookie_header(ngx_http_request_t *r);
+static void ngx_http_v2_urgency(ngx_http_v2_stream_t *stream,
+    ngx_str_t *value);
 static void ngx_http_v2_run_request(ngx_http_request_t *r);
 static void ngx_http_v2_run_request_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_v2_process_request_body(ngx_http_request_t *r,
     u_char *pos, size_t size, ngx_uint_t last);
 static ngx_int_t ngx_http_v2_filter_request_body(ngx_http_request_t *r);
 static void ngx_http_v2_read_client_request_body_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_v2_grow_body_window(ngx_http_request_t *r);
+static ngx_int_t ngx_http_v2_swap_body_buffer(ngx_http_request_t *r);
+static ngx_msec_t ngx_http_v2_rtt(ngx_http_v2_connection_t *h2c);
+static void ngx_http_v2_recv_window_updated(ngx_http_v2_stream_t *stream);
+static ngx_buf_t *ngx_http_v2_preread_buffer(ngx_http_request_t *r);
+static void ngx_http_v2_free_preread_buffer(ngx_http_v2_stream_t *stream);
+static void ngx_http_v2_preread_cleanup(void *data);
 
 static ngx_int_t ngx_http_v2_terminate_stream(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_stream_t *stream, ngx_uint_t status);
+static void ngx_http_v2_adapt_streams(ngx_http_v2_connection_t *h2c,
+    ngx_http_request_t *r);
 static void ngx_http_v2_close_stream_handler(ngx_event_t *ev);
 static void ngx_http_v2_handle_connection_handler(ngx_event_t *rev);
 static void ngx_http_v2_idle_handler(ngx_event_t *rev);
+static void ngx_http_v2_idle_stat(ngx_http_v2_connection_t *h2c, ngx_int_t n);
 static void ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
     ngx_uint_t status);
 
@@ -229,12 +254,14 @@ static ngx_http_v2_parse_header_t  ngx_http_v2_parse_headers[] = {
 void
 ngx_http_v2_init(ngx_event_t *rev)
 {
+    ngx_uint_t                 i;
     ngx_connection_t          *c;
     ngx_pool_cleanup_t        *cln;
     ngx_http_connection_t     *hc;
     ngx_http_v2_srv_conf_t    *h2scf;
     ngx_http_v2_main_conf_t   *h2mcf;
     ngx_http_v2_connection_t  *h2c;
+    ngx_http_core_loc_conf_t  *clcf;
 
     c = rev->data;
     hc = c->data;
@@ -268,13 +295,37 @@ ngx_http_v2_init(ngx_event_t *rev)
 
     h2c->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
 
+    h2c->hpack_enc.size = NGX_HTTP_V2_TABLE_SIZE;
+
+    for (i = 0; i < NGX_HTTP_V2_URGENCY_LEVELS; i++) {
+        ngx_queue_init(&h2c->scheduled[i]);
+    }
+
     h2c->frame_size = NGX_HTTP_V2_DEFAULT_FRAME_SIZE;
 
     h2scf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_v2_module);
 
+    /*
+     * streams share the socket, so TCP_NOTSENT_LOWAT and the pacing rate
+     * are set per connection: with a shallow socket queue, frames wait
+     * in the output queue, where they are ordered by stream priorities
+     */
+
+    clcf = ngx_http_get_module_loc_conf(hc->conf_ctx, ngx_http_core_module);
+
+    if (ngx_tcp_notsent_lowat(c, clcf->tcp_notsent_lowat) != NGX_OK
+        || ngx_tcp_pacing_rate(c, clcf->tcp_pacing_rate) != NGX_OK)
+    {
+        ngx_http_close_connection(c);
+        return;
+    }
+
     h2c->concurrent_pushes = h2scf->concurrent_pushes;
     h2c->priority_limit = h2scf->concurrent_streams;
 
+    h2c->concurrent_streams = h2scf->concurrent_streams;
+    h2c->streams_limit = h2scf->concurrent_streams;
+
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
     if (h2c->pool == NULL) {
         ngx_http_close_connection(c);
@@ -310,6 +361,13 @@ ngx_http_v2_init(ngx_event_t *rev)
         return;
     }
 
+    /* the round trip time for request body window autotuning */
+
+    if (h2scf->body_window_max && ngx_http_v2_send_ping(h2c) == NGX_ERROR) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
     h2c->state.handler = hc->proxy_protocol ? ngx_http_v2_state_proxy_protocol
                                             : ngx_http_v2_state_preface;
 
@@ -439,7 +497,9 @@ ngx_http_v2_read_handler(ngx_event_t *rev)
         return;
     }
 
-    if (h2c->last_out && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR) {
+    if ((h2c->last_out || h2c->nscheduled)
+        && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR)
+    {
         ngx_http_v2_finalize_connection(h2c, 0);
         return;
     }
@@ -478,7 +538,7 @@ ngx_http_v2_write_handler(ngx_event_t *wev)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 write handler");
 
-    if (h2c->last_out == NULL && !c->buffered) {
+    if (h2c->last_out == NULL && h2c->nscheduled == 0 && !c->buffered) {
 
         if (wev->timer_set) {
             ngx_del_timer(wev);
@@ -528,6 +588,10 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
         return NGX_AGAIN;
     }
 
+again:
+
+    ngx_http_v2_schedule_frames(h2c);
+
     cl = NULL;
     out = NULL;
 
@@ -599,6 +663,10 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
 
     h2c->last_out = frame;
 
+    if (frame == NULL && h2c->nscheduled && wev->ready) {
+        goto again;
+    }
+
     if (!wev->ready) {
         ngx_add_timer(wev, clcf->send_timeout);
         return NGX_AGAIN;
@@ -622,6 +690,69 @@ error:
 }
 
 
+/*
+ * Streams are served in the order of urgency, streams of the same
+ * urgency round-robin.  Each stream moves up to a quantum, scaled with
+ * its RFC 7540 weight, of its frames to the output queue per round.
+ */
+
+static void
+ngx_http_v2_schedule_frames(ngx_http_v2_connection_t *h2c)
+{
+    size_t                    quantum, size;
+    ngx_uint_t                i;
+    ngx_queue_t              *q, *last;
+    ngx_http_v2_stream_t     *stream;
+    ngx_http_v2_out_frame_t  *frame;
+    ngx_http_v2_srv_conf_t   *h2scf;
+
+    if (h2c->nscheduled == 0) {
+        return;
+    }
+
+    for (i = 0; ngx_queue_empty(&h2c->scheduled[i]); i++) { /* void */ }
+
+    h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
+                                         ngx_http_v2_module);
+
+    last = ngx_queue_last(&h2c->scheduled[i]);
+
+    do {
+        q = ngx_queue_head(&h2c->scheduled[i]);
+        ngx_queue_remove(q);
+
+        stream = ngx_queue_data(q, ngx_http_v2_stream_t, scheduled);
+
+        quantum = h2scf->send_quantum * stream->node->weight
+                  / NGX_HTTP_V2_DEFAULT_WEIGHT;
+        size = 0;
+
+        do {
+            frame = stream->out;
+            stream->out = frame->next;
+
+            size += frame->length;
+
+            ngx_http_v2_queue_ordered_frame(h2c, frame);
+
+        } while (stream->out && size < quantum);
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2:%ui scheduled %uz of %uz, urgency:%ui",
+                       stream->node->id, size, quantum, i);
+
+        if (stream->out) {
+            ngx_queue_insert_tail(&h2c->scheduled[i], q);
+
+        } else {
+            h2c->nscheduled--;
+            stream->queue_time += ngx_current_msec - stream->queued_at;
+        }
+
+    } while (q != last);
+}
+
+
 static void
 ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
 {
@@ -629,7 +760,7 @@ ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
     ngx_connection_t        *c;
     ngx_http_v2_srv_conf_t  *h2scf;
 
-    if (h2c->last_out || h2c->processing || h2c->pushing) {
+    if (h2c->last_out || h2c->nscheduled || h2c->processing || h2c->pushing) {
         return;
     }
 
@@ -695,6 +826,8 @@ ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
     }
 
     ngx_add_timer(c->read, h2scf->idle_timeout);
+
+    ngx_http_v2_idle_stat(h2c, 1);
 }
 
 
@@ -897,6 +1030,12 @@ ngx_http_v2_state_data(ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end)
     }
 
     stream->recv_window -= size;
+    stream->recv_bytes += size;
+
+    if (stream->recv_window == 0 && !stream->recv_blocked_set) {
+        stream->recv_blocked_set = 1;
+        stream->recv_blocked = ngx_current_msec;
+    }
 
     if (stream->no_flow_control
         && stream->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4)
@@ -939,12 +1078,11 @@ static u_char *
 ngx_http_v2_state_read_data(ngx_http_v2_connection_t *h2c, u_char *pos,
     u_char *end)
 {
-    size_t                   size;
-    ngx_buf_t               *buf;
-    ngx_int_t                rc;
-    ngx_http_request_t      *r;
-    ngx_http_v2_stream_t    *stream;
-    ngx_http_v2_srv_conf_t  *h2scf;
+    size_t                 size;
+    ngx_buf_t             *buf;
+    ngx_int_t              rc;
+    ngx_http_request_t    *r;
+    ngx_http_v2_stream_t  *stream;
 
     stream = h2c->state.stream;
 
@@ -989,15 +1127,11 @@ ngx_http_v2_state_read_data(ngx_http_v2_connection_t *h2c, u_char *pos,
         buf = stream->preread;
 
         if (buf == NULL) {
-            h2scf = ngx_http_get_module_srv_conf(r, ngx_http_v2_module);
-
-            buf = ngx_create_temp_buf(r->pool, h2scf->preread_size);
+            buf = ngx_http_v2_preread_buffer(r);
             if (buf == NULL) {
                 return ngx_http_v2_connection_error(h2c,
                                                     NGX_HTTP_V2_INTERNAL_ERROR);
             }
-
-            stream->preread = buf;
         }
 
         if (size > (size_t) (buf->end - buf->last)) {
@@ -1141,7 +1275,7 @@ ngx_http_v2_state_headers(ngx_http_v2_connection_t *h2c, u_char *pos,
 
     h2c->state.header_limit = h2scf->max_header_size;
 
-    if (h2c->processing >= h2scf->concurrent_streams) {
+    if (h2c->processing >= h2c->concurrent_streams) {
         ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
                       "concurrent streams exceeded %ui", h2c->processing);
 
@@ -1558,6 +1692,7 @@ ngx_http_v2_state_process_header(ngx_http_v2_connection_t *h2c, u_char *pos,
     ngx_http_core_main_conf_t  *cmcf;
 
     static ngx_str_t cookie = ngx_string("cookie");
+    static ngx_str_t priority = ngx_string("priority");
 
     header = &h2c->state.header;
 
@@ -1658,6 +1793,12 @@ ngx_http_v2_state_process_header(ngx_http_v2_connection_t *h2c, u_char *pos,
         }
     }
 
+    if (header->name.len == priority.len
+        && ngx_memcmp(header->name.data, priority.data, priority.len) == 0)
+    {
+        ngx_http_v2_urgency(h2c->state.stream, &header->value);
+    }
+
     if (header->name.len == cookie.len
         && ngx_memcmp(header->name.data, cookie.data, cookie.len) == 0)
     {
@@ -1991,6 +2132,16 @@ ngx_http_v2_state_settings(ngx_http_v2_connection_t *h2c, u_char *pos,
             return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR);
         }
 
+        /*
+         * limits are announced one at a time after the initial settings,
+         * so this acknowledges the last one
+         */
+
+        if (h2c->settings_ack && h2c->streams_pending) {
+            h2c->concurrent_streams = h2c->streams_limit;
+            h2c->streams_pending = 0;
+        }
+
         h2c->settings_ack = 1;
 
         return ngx_http_v2_state_complete(h2c, pos, end);
@@ -2091,7 +2242,7 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
 
-            h2c->table_update = 1;
+            ngx_http_v2_table_update(h2c, value);
             break;
 
         default:
@@ -2137,6 +2288,7 @@ ngx_http_v2_state_push_promise(ngx_http_v2_connection_t *h2c, u_char *pos,
 static u_char *
 ngx_http_v2_state_ping(ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end)
 {
+    uint32_t                  rtt;
     ngx_buf_t                *buf;
     ngx_http_v2_out_frame_t  *frame;
 
@@ -2156,6 +2308,19 @@ ngx_http_v2_state_ping(ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end)
                    "http2 PING frame");
 
     if (h2c->state.flags & NGX_HTTP_V2_ACK_FLAG) {
+
+        if (ngx_memcmp(pos, "rtt", 4) == 0) {
+            rtt = (uint32_t) ngx_current_msec
+                  - ngx_http_v2_parse_uint32(pos + 4);
+
+            if (rtt < 60000) {
+                h2c->rtt = rtt + 1;
+            }
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                           "http2 PING rtt:%uD", rtt);
+        }
+
         return ngx_http_v2_state_skip(h2c, pos, end);
     }
 
@@ -2761,6 +2926,35 @@ ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c)
 }
 
 
+static ngx_int_t
+ngx_http_v2_send_streams_limit(ngx_http_v2_connection_t *h2c)
+{
+    ngx_buf_t                *buf;
+    ngx_http_v2_out_frame_t  *frame;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 send SETTINGS frame max streams:%ui",
+                   h2c->streams_limit);
+
+    frame = ngx_http_v2_get_frame(h2c, NGX_HTTP_V2_SETTINGS_PARAM_SIZE,
+                                  NGX_HTTP_V2_SETTINGS_FRAME,
+                                  NGX_HTTP_V2_NO_FLAG, 0);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    buf = frame->first->buf;
+
+    buf->last = ngx_http_v2_write_uint16(buf->last,
+                                         NGX_HTTP_V2_MAX_STREAMS_SETTING);
+    buf->last = ngx_http_v2_write_uint32(buf->last, h2c->streams_limit);
+
+    ngx_http_v2_queue_blocked_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_v2_settings_frame_handler(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
@@ -2807,6 +3001,36 @@ ngx_http_v2_send_window_update(ngx_http_v2_connection_t *h2c, ngx_uint_t sid,
 }
 
 
+static ngx_int_t
+ngx_http_v2_send_ping(ngx_http_v2_connection_t *h2c)
+{
+    ngx_buf_t                *buf;
+    ngx_http_v2_out_frame_t  *frame;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 send PING frame");
+
+    frame = ngx_http_v2_get_frame(h2c, NGX_HTTP_V2_PING_SIZE,
+                                  NGX_HTTP_V2_PING_FRAME,
+                                  NGX_HTTP_V2_NO_FLAG, 0);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    buf = frame->first->buf;
+
+    /* the payload is echoed by the client and carries the time it was sent */
+
+    buf->last = ngx_cpymem(buf->last, "rtt", 4);
+    buf->last = ngx_http_v2_write_uint32(buf->last,
+                                         (uint32_t) ngx_current_msec);
+
+    ngx_http_v2_queue_blocked_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_v2_send_rst_stream(ngx_http_v2_connection_t *h2c, ngx_uint_t sid,
     ngx_uint_t status)
@@ -3091,6 +3315,9 @@ ngx_http_v2_create_stream(ngx_http_v2_connection_t *h2c, ngx_uint_t push)
 
     stream->send_window = h2c->init_window;
     stream->recv_window = h2scf->preread_size;
+    stream->recv_mark = ngx_current_msec;
+
+    stream->urgency = NGX_HTTP_V2_DEFAULT_URGENCY;
 
     if (push) {
         h2c->pushing++;
@@ -3736,6 +3963,47 @@ ngx_http_v2_construct_cookie_header(ngx_http_request_t *r)
 }
 
 
+/*
+ * The "u" parameter of the "Priority" header field (RFC 9218) selects
+ * the urgency level the stream's DATA frames are scheduled at.
+ */
+
+static void
+ngx_http_v2_urgency(ngx_http_v2_stream_t *stream, ngx_str_t *value)
+{
+    u_char  *p, *end;
+
+    p = value->data;
+    end = p + value->len;
+
+    while (p < end) {
+
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        if (end - p >= 3
+            && p[0] == 'u' && p[1] == '=' && p[2] >= '0' && p[2] <= '7'
+            && (end - p == 3
+                || p[3] == ',' || p[3] == ';' || p[3] == ' ' || p[3] == '\t'))
+        {
+            stream->urgency = p[2] - '0';
+        }
+
+        p = ngx_strlchr(p, end, ',');
+
+        if (p == NULL) {
+            break;
+        }
+
+        p++;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, stream->request->connection->log, 0,
+                   "http2 stream urgency: %ui", stream->urgency);
+}
+
+
 static void
 ngx_http_v2_run_request(ngx_http_request_t *r)
 {
@@ -3744,6 +4012,8 @@ ngx_http_v2_run_request(ngx_http_request_t *r)
 
     fc = r->connection;
 
+    ngx_http_cpu_enter(r);
+
     if (ngx_http_v2_construct_request_line(r) != NGX_OK) {
         goto failed;
     }
@@ -3781,6 +4051,8 @@ ngx_http_v2_run_request(ngx_http_request_t *r)
 failed:
 
     ngx_http_run_posted_requests(fc);
+
+    ngx_http_cpu_leave();
 }
 
 
@@ -3876,7 +4148,7 @@ ngx_http_v2_read_request_body(ngx_http_request_t *r)
         if (buf) {
             rc = ngx_http_v2_process_request_body(r, buf->pos,
                                                   buf->last - buf->pos, 1);
-            ngx_pfree(r->pool, buf->start);
+            ngx_http_v2_free_preread_buffer(stream);
             return rc;
         }
 
@@ -3887,7 +4159,7 @@ ngx_http_v2_read_request_body(ngx_http_request_t *r)
         rc = ngx_http_v2_process_request_body(r, buf->pos,
                                               buf->last - buf->pos, 0);
 
-        ngx_pfree(r->pool, buf->start);
+        ngx_http_v2_free_preread_buffer(stream);
 
         if (rc != NGX_OK) {
             stream->skip_data = 1;
@@ -3922,6 +4194,8 @@ ngx_http_v2_read_request_body(ngx_http_request_t *r)
         }
 
         stream->recv_window += size;
+
+        ngx_http_v2_recv_window_updated(stream);
     }
 
     if (!buf) {
@@ -4187,7 +4461,22 @@ ngx_http_v2_read_unbuffered_request_body(ngx_http_request_t *r)
     }
 
     if (r->request_body->busy != NULL) {
-        return NGX_AGAIN;
+        rc = ngx_http_v2_swap_body_buffer(r);
+
+        if (rc == NGX_DECLINED) {
+            return NGX_AGAIN;
+        }
+
+        if (rc == NGX_ERROR) {
+            stream->skip_data = 1;
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+    } else {
+        if (ngx_http_v2_grow_body_window(r) != NGX_OK) {
+            stream->skip_data = 1;
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
     }
 
     buf = r->request_body->buf;
@@ -4233,10 +4522,309 @@ ngx_http_v2_read_unbuffered_request_body(ngx_http_request_t *r)
 
     stream->recv_window = window;
 
+    ngx_http_v2_recv_window_updated(stream);
+
     return NGX_AGAIN;
 }
 
 
+static ngx_int_t
+ngx_http_v2_grow_body_window(ngx_http_request_t *r)
+{
+    off_t                      rest;
+    size_t                     size, grow, bytes;
+    ngx_buf_t                 *buf, *b;
+    ngx_msec_t                 rtt, elapsed;
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_srv_conf_t    *h2scf;
+    ngx_http_v2_connection_t  *h2c;
+
+    stream = r->stream;
+    h2c = stream->connection;
+    buf = r->request_body->buf;
+
+    h2scf = ngx_http_get_module_srv_conf(r, ngx_http_v2_module);
+
+    size = buf->end - buf->start;
+
+    if (size >= ngx_min(h2scf->body_window_max, NGX_HTTP_V2_MAX_WINDOW)) {
+        return NGX_OK;
+    }
+
+    rtt = ngx_http_v2_rtt(h2c);
+    elapsed = ngx_current_msec - stream->recv_mark;
+
+    if (rtt == 0 || elapsed < rtt) {
+        return NGX_OK;
+    }
+
+    bytes = stream->recv_bytes;
+
+    stream->recv_bytes = 0;
+    stream->recv_mark = ngx_current_msec;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 body window %uz, received %uz in %M, rtt:%M",
+                   size, bytes, elapsed, rtt);
+
+    /*
+     * a client limited by the window sends about a window per round
+     * trip, the window is doubled while more than half of it is used
+     */
+
+    if ((uint64_t) bytes * rtt / elapsed <= size / 2) {
+        return NGX_OK;
+    }
+
+    grow = ngx_min(size, ngx_min(h2scf->body_window_max,
+                                 NGX_HTTP_V2_MAX_WINDOW) - size);
+
+    if (r->headers_in.content_length_n > 0) {
+        rest = r->headers_in.content_length_n - r->request_body->received;
+
+        if (rest <= (off_t) size) {
+            return NGX_OK;
+        }
+
+        if (rest - (off_t) size < (off_t) grow) {
+            grow = (size_t) (rest - (off_t) size);
+        }
+    }
+
+    if (h2c->body_window + grow > h2scf->body_window_budget) {
+
+        if (h2c->body_window >= h2scf->body_window_budget) {
+            return NGX_OK;
+        }
+
+        grow = h2scf->body_window_budget - h2c->body_window;
+    }
+
+    b = ngx_create_temp_buf(r->pool, size + grow);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 body window %uz grown by %uz, rtt:%M, conn:%uz",
+                   size, grow, rtt, h2c->body_window + grow);
+
+    ngx_pfree(r->pool, buf->start);
+
+    r->request_body->buf = b;
+
+    if (stream->body_spare) {
+        ngx_pfree(r->pool, stream->body_spare->start);
+        stream->body_spare = NULL;
+    }
+
+    stream->body_window += grow;
+    h2c->body_window += grow;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_swap_body_buffer(ngx_http_request_t *r)
+{
+    size_t                 size;
+    ngx_buf_t             *buf, *spare;
+    ngx_chain_t           *cl;
+    ngx_http_v2_stream_t  *stream;
+
+    /*
+     * while the upstream is sending the buffer, the client fills
+     * the second one, instead of waiting for the buffer to be sent
+     * and then for a window update; the upstream still limits the
+     * client as data of both buffers can be in flight
+     */
+
+    stream = r->stream;
+    buf = r->request_body->buf;
+
+    size = buf->end - buf->start;
+
+    if (stream->recv_window >= size / 2) {
+        return NGX_DECLINED;
+    }
+
+    spare = stream->body_spare;
+
+    if (spare == NULL) {
+        spare = ngx_create_temp_buf(r->pool, size);
+        if (spare == NULL) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        for (cl = r->request_body->busy; cl; cl = cl->next) {
+            if (cl->buf->pos >= spare->start && cl->buf->pos < spare->end) {
+                return NGX_DECLINED;
+            }
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 body buffer swap, window:%uz", stream->recv_window);
+
+    r->request_body->buf = spare;
+    stream->body_spare = buf;
+
+    return NGX_OK;
+}
+
+
+static ngx_msec_t
+ngx_http_v2_rtt(ngx_http_v2_connection_t *h2c)
+{
+#if (NGX_HAVE_TCP_INFO)
+    socklen_t        len;
+    struct tcp_info  ti;
+#endif
+
+    if (h2c->rtt) {
+        return h2c->rtt;
+    }
+
+#if (NGX_HAVE_TCP_INFO)
+
+    /* no PING acknowledgement yet */
+
+    len = sizeof(struct tcp_info);
+
+    if (getsockopt(h2c->connection->fd, IPPROTO_TCP, TCP_INFO, &ti, &len)
+        == 0)
+    {
+        return ti.tcpi_rtt / 1000 + 1;
+    }
+
+#endif
+
+    return 0;
+}
+
+
+static void
+ngx_http_v2_recv_window_updated(ngx_http_v2_stream_t *stream)
+{
+    if (stream->recv_blocked_set) {
+        stream->recv_blocked_time += ngx_current_msec - stream->recv_blocked;
+        stream->recv_blocked_set = 0;
+    }
+}
+
+
+static ngx_buf_t *
+ngx_http_v2_preread_buffer(ngx_http_request_t *r)
+{
+    u_char                     *p;
+    size_t                      size;
+    ngx_buf_t                  *b;
+    ngx_pool_cleanup_t         *cln;
+    ngx_http_v2_stream_t       *stream;
+    ngx_http_v2_preread_t      *pr;
+    ngx_http_v2_srv_conf_t     *h2scf;
+    ngx_http_v2_main_conf_t    *h2mcf;
+    ngx_http_v2_free_buffer_t  *fb;
+
+    /*
+     * preread buffers are taken from a per-worker list, as with many
+     * streams they would be allocated and freed at a high rate
+     */
+
+    stream = r->stream;
+
+    h2scf = ngx_http_get_module_srv_conf(r, ngx_http_v2_module);
+    h2mcf = ngx_http_get_module_main_conf(r, ngx_http_v2_module);
+
+    size = h2scf->preread_size;
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_http_v2_preread_t));
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    fb = h2mcf->free_buffers;
+
+    if (fb && fb->size == size) {
+        h2mcf->free_buffers = fb->next;
+        h2mcf->nfree_buffers--;
+        p = (u_char *) fb;
+
+    } else {
+        p = ngx_alloc(size, r->connection->log);
+        if (p == NULL) {
+            return NULL;
+        }
+    }
+
+    pr = cln->data;
+    pr->h2mcf = h2mcf;
+    pr->start = p;
+    pr->size = size;
+
+    cln->handler = ngx_http_v2_preread_cleanup;
+
+    b->start = p;
+    b->pos = p;
+    b->last = p;
+    b->end = p + size;
+    b->temporary = 1;
+
+    stream->preread = b;
+    stream->preread_cleanup = cln;
+
+    return b;
+}
+
+
+static void
+ngx_http_v2_free_preread_buffer(ngx_http_v2_stream_t *stream)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    cln = stream->preread_cleanup;
+
+    cln->handler(cln->data);
+    cln->handler = NULL;
+
+    stream->preread = NULL;
+    stream->preread_cleanup = NULL;
+}
+
+
+static void
+ngx_http_v2_preread_cleanup(void *data)
+{
+    ngx_http_v2_preread_t  *pr = data;
+
+    ngx_http_v2_main_conf_t    *h2mcf;
+    ngx_http_v2_free_buffer_t  *fb;
+
+    h2mcf = pr->h2mcf;
+
+    if (h2mcf->nfree_buffers >= NGX_HTTP_V2_FREE_BUFFERS
+        || pr->size < sizeof(ngx_http_v2_free_buffer_t))
+    {
+        ngx_free(pr->start);
+        return;
+    }
+
+    fb = (ngx_http_v2_free_buffer_t *) pr->start;
+    fb->size = pr->size;
+    fb->next = h2mcf->free_buffers;
+
+    h2mcf->free_buffers = fb;
+    h2mcf->nfree_buffers++;
+}
+
+
 static ngx_int_t
 ngx_http_v2_terminate_stream(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_stream_t *stream, ngx_uint_t status)
@@ -4275,6 +4863,7 @@ ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc)
     ngx_event_t               *ev;
     ngx_connection_t          *fc;
     ngx_http_v2_node_t        *node;
+    ngx_http_v2_srv_conf_t    *h2scf;
     ngx_http_v2_connection_t  *h2c;
 
     h2c = stream->connection;
@@ -4317,6 +4906,8 @@ ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc)
         h2c->state.stream = NULL;
     }
 
+    h2c->body_window -= stream->body_window;
+
     push = stream->node->id % 2 == 0;
 
     node->stream = NULL;
@@ -4335,6 +4926,13 @@ ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc)
 
     h2c->frames -= stream->frames;
 
+    h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
+                                         ngx_http_v2_module);
+
+    if (h2scf->min_concurrent_streams && !push) {
+        ngx_http_v2_adapt_streams(h2c, stream->request);
+    }
+
     ngx_http_free_request(stream->request, rc);
 
     if (pool != h2c->state.pool) {
@@ -4386,6 +4984,102 @@ ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc)
 }
 
 
+/*
+ * The limit of concurrent streams of a connection is lowered by a quarter
+ * when a stream waited for the upstream header longer than
+ * "http2_concurrent_streams_latency" or the worker runs out of
+ * connections, at most once per that time, and raised by a quarter once
+ * as many fast streams as the limit have completed while the client used
+ * at least half of it.  The limit stays between "http2_min_concurrent_streams"
+ * and "http2_max_concurrent_streams".
+ */
+
+static void
+ngx_http_v2_adapt_streams(ngx_http_v2_connection_t *h2c,
+    ngx_http_request_t *r)
+{
+    ngx_uint_t                  limit, slow;
+    ngx_http_upstream_state_t  *state;
+    ngx_http_v2_srv_conf_t     *h2scf;
+
+    if (!h2c->settings_ack || h2c->streams_pending || h2c->goaway) {
+        return;
+    }
+
+    h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
+                                         ngx_http_v2_module);
+
+    slow = (ngx_accept_disabled > 0);
+
+    if (r->upstream_states && r->upstream_states->nelts) {
+        state = r->upstream_states->elts;
+        state = &state[r->upstream_states->nelts - 1];
+
+        if (state->header_time == (ngx_msec_t) -1) {
+            slow |= (state->status >= NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+        } else {
+            slow |= (state->header_time > h2scf->streams_latency);
+        }
+    }
+
+    limit = h2c->streams_limit;
+
+    if (slow) {
+        h2c->streams_fast = 0;
+
+        if (limit == h2scf->min_concurrent_streams
+            || ngx_current_msec - h2c->streams_lowered
+               < h2scf->streams_latency)
+        {
+            return;
+        }
+
+        h2c->streams_lowered = ngx_current_msec;
+
+        limit = ngx_max(limit - limit / 4, h2scf->min_concurrent_streams);
+
+    } else {
+
+        if (limit == h2scf->concurrent_streams
+            || h2c->processing * 2 < limit
+            || ++h2c->streams_fast < limit)
+        {
+            return;
+        }
+
+        h2c->streams_fast = 0;
+
+        limit = ngx_min(limit + limit / 4 + 1, h2scf->concurrent_streams);
+    }
+
+    if (limit == h2c->streams_limit) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 concurrent streams %ui -> %ui",
+                   h2c->streams_limit, limit);
+
+    h2c->streams_limit = limit;
+
+    /* a raised limit applies at once, a lowered one once acknowledged */
+
+    if (limit > h2c->concurrent_streams) {
+        h2c->concurrent_streams = limit;
+    }
+
+    h2c->streams_pending = 1;
+
+    if (ngx_http_v2_send_streams_limit(h2c) != NGX_OK) {
+        h2c->connection->error = 1;
+        return;
+    }
+
+    ngx_post_event(h2c->connection->write, &ngx_posted_events);
+}
+
+
 static void
 ngx_http_v2_close_stream_handler(ngx_event_t *ev)
 {
@@ -4435,7 +5129,9 @@ ngx_http_v2_handle_connection_handler(ngx_event_t *rev)
         return;
     }
 
-    if (h2c->last_out && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR) {
+    if ((h2c->last_out || h2c->nscheduled)
+        && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR)
+    {
         ngx_http_v2_finalize_connection(h2c, 0);
         return;
     }
@@ -4456,6 +5152,8 @@ ngx_http_v2_idle_handler(ngx_event_t *rev)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 idle handler");
 
+    ngx_http_v2_idle_stat(h2c, -1);
+
     if (rev->timedout || c->close) {
         ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
         return;
@@ -4507,6 +5205,28 @@ ngx_http_v2_idle_handler(ngx_event_t *rev)
 }
 
 
+static void
+ngx_http_v2_idle_stat(ngx_http_v2_connection_t *h2c, ngx_int_t n)
+{
+    if (n > 0) {
+        if (!ngx_event_loop_timing) {
+            return;
+        }
+
+        h2c->memory = ngx_pool_memory(h2c->connection->pool);
+
+    } else if (h2c->memory == 0) {
+        return;
+    }
+
+    ngx_event_loop_idle(0, n, n * (ssize_t) h2c->memory);
+
+    if (n < 0) {
+        h2c->memory = 0;
+    }
+}
+
+
 static void
 ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
     ngx_uint_t status)
@@ -4541,6 +5261,12 @@ ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
 
     h2c->last_out = NULL;
 
+    for (i = 0; i < NGX_HTTP_V2_URGENCY_LEVELS; i++) {
+        ngx_queue_init(&h2c->scheduled[i]);
+    }
+
+    h2c->nscheduled = 0;
+
     h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
                                          ngx_http_v2_module);
 
@@ -4556,6 +5282,7 @@ ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
             }
 
             stream->waiting = 0;
+            stream->out = NULL;
 
             r = stream->request;
             fc = r->connection;
@@ -4766,6 +5493,8 @@ ngx_http_v2_pool_cleanup(void *data)
 {
     ngx_http_v2_connection_t  *h2c = data;
 
+    ngx_http_v2_idle_stat(h2c, -1);
+
     if (h2c->state.pool) {
         ngx_destroy_pool(h2c->state.pool);
     }
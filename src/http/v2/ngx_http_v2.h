@@ -25,6 +25,8 @@
 #define NGX_HTTP_V2_MAX_FIELD                                                 \
     (127 + (1 << (NGX_HTTP_V2_INT_OCTETS - 1) * 7) - 1)
 
+#define NGX_HTTP_V2_TABLE_SIZE           4096
+
 #define NGX_HTTP_V2_STREAM_ID_SIZE       4
 
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
@@ -54,6 +56,9 @@
 
 #define NGX_HTTP_V2_DEFAULT_WEIGHT       16
 
+#define NGX_HTTP_V2_URGENCY_LEVELS       8
+#define NGX_HTTP_V2_DEFAULT_URGENCY      3
+
 
 typedef struct ngx_http_v2_connection_s   ngx_http_v2_connection_t;
 typedef struct ngx_http_v2_node_s         ngx_http_v2_node_t;
@@ -115,6 +120,25 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+typedef struct {
+    size_t                           name_len;
+    size_t                           value_len;
+} ngx_http_v2_hpack_field_t;
+
+
+typedef struct {
+    ngx_http_v2_hpack_field_t       *fields;
+    ngx_uint_t                       nfields;
+
+    size_t                           size;
+    size_t                           used;
+    size_t                           len;
+    u_char                          *storage;
+
+    unsigned                         reset:1;
+} ngx_http_v2_hpack_enc_t;
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
@@ -127,6 +151,17 @@ struct ngx_http_v2_connection_s {
     ngx_uint_t                       idle;
     ngx_uint_t                       priority_limit;
 
+    /*
+     * the limit of concurrent streams in effect and the one announced
+     * last, they differ while a lowered limit is not acknowledged
+     */
+    ngx_uint_t                       concurrent_streams;
+    ngx_uint_t                       streams_limit;
+
+    /* fast streams since the limit changed, and when it was lowered */
+    ngx_uint_t                       streams_fast;
+    ngx_msec_t                       streams_lowered;
+
     ngx_uint_t                       pushing;
     ngx_uint_t                       concurrent_pushes;
 
@@ -134,6 +169,13 @@ struct ngx_http_v2_connection_s {
     size_t                           recv_window;
     size_t                           init_window;
 
+    /* memory of request body windows grown by autotuning */
+    size_t                           body_window;
+    ngx_msec_t                       rtt;
+
+    /* pool memory of an idle connection, for the statistics */
+    size_t                           memory;
+
     size_t                           frame_size;
 
     ngx_queue_t                      waiting;
@@ -141,6 +183,7 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_enc_t          hpack_enc;
 
     ngx_pool_t                      *pool;
 
@@ -151,6 +194,9 @@ struct ngx_http_v2_connection_s {
 
     ngx_http_v2_out_frame_t         *last_out;
 
+    ngx_queue_t                      scheduled[NGX_HTTP_V2_URGENCY_LEVELS];
+    ngx_uint_t                       nscheduled;
+
     ngx_queue_t                      dependencies;
     ngx_queue_t                      closed;
 
@@ -163,6 +209,7 @@ struct ngx_http_v2_connection_s {
     unsigned                         blocked:1;
     unsigned                         goaway:1;
     unsigned                         push_disabled:1;
+    unsigned                         streams_pending:1;
 };
 
 
@@ -193,9 +240,28 @@ struct ngx_http_v2_stream_s {
      */
     ssize_t                          send_window;
     size_t                           recv_window;
+    size_t                           body_window;
+
+    /* flow control waits of the stream and of the client, msec */
+    ngx_msec_t                       send_blocked;
+    ngx_msec_t                       send_blocked_time;
+    ngx_msec_t                       recv_blocked;
+    ngx_msec_t                       recv_blocked_time;
+
+    /* the time the stream's frames waited for their turn, msec */
+    ngx_msec_t                       queued_at;
+    ngx_msec_t                       queue_time;
+
+    /* body bytes received since recv_mark, for window autotuning */
+    size_t                           recv_bytes;
+    ngx_msec_t                       recv_mark;
 
     ngx_buf_t                       *preread;
 
+    /* the second request body buffer, filled while the upstream sends */
+    ngx_buf_t                       *body_spare;
+    ngx_pool_cleanup_t              *preread_cleanup;
+
     ngx_uint_t                       frames;
 
     ngx_http_v2_out_frame_t         *free_frames;
@@ -204,6 +270,11 @@ struct ngx_http_v2_stream_s {
 
     ngx_queue_t                      queue;
 
+    ngx_http_v2_out_frame_t         *out;
+    ngx_http_v2_out_frame_t         *last_frame;
+    ngx_queue_t                      scheduled;
+    ngx_uint_t                       urgency;
+
     ngx_array_t                     *cookies;
 
     ngx_pool_t                      *pool;
@@ -216,6 +287,8 @@ struct ngx_http_v2_stream_s {
     unsigned                         rst_sent:1;
     unsigned                         no_flow_control:1;
     unsigned                         skip_data:1;
+    unsigned                         send_blocked_set:1;
+    unsigned                         recv_blocked_set:1;
 };
 
 
@@ -234,29 +307,37 @@ struct ngx_http_v2_out_frame_s {
 };
 
 
+/*
+ * DATA frames and trailers are not put to the output queue directly:
+ * they are kept per stream, and ngx_http_v2_send_output_queue() moves
+ * them to the output queue a quantum per stream at a time, so a stream
+ * with a lot of data queued cannot delay other streams for long.
+ */
+
 static ngx_inline void
 ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
-    ngx_http_v2_out_frame_t  **out;
+    ngx_http_v2_stream_t  *stream;
 
-    for (out = &h2c->last_out; *out; out = &(*out)->next) {
+    stream = frame->stream;
 
-        if ((*out)->blocked || (*out)->stream == NULL) {
-            break;
-        }
+    frame->next = NULL;
 
-        if ((*out)->stream->node->rank < frame->stream->node->rank
-            || ((*out)->stream->node->rank == frame->stream->node->rank
-                && (*out)->stream->node->rel_weight
-                   >= frame->stream->node->rel_weight))
-        {
-            break;
-        }
+    if (stream->out) {
+        stream->last_frame->next = frame;
+
+    } else {
+        stream->out = frame;
+
+        ngx_queue_insert_tail(&h2c->scheduled[stream->urgency],
+                              &stream->scheduled);
+        h2c->nscheduled++;
+
+        stream->queued_at = ngx_current_msec;
     }
 
-    frame->next = *out;
-    *out = frame;
+    stream->last_frame = frame;
 }
 
 
@@ -309,6 +390,13 @@ ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
+ngx_int_t ngx_http_v2_table_lookup(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t *index);
+ngx_int_t ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value);
+void ngx_http_v2_table_update(ngx_http_v2_connection_t *h2c, size_t size);
+void ngx_http_v2_table_reset(ngx_http_v2_connection_t *h2c);
+
 
 ngx_int_t ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len,
     u_char **dst, ngx_uint_t last, ngx_log_t *log);
@@ -416,6 +504,8 @@ size_t ngx_http_v2_huff_encode(u_char *src, size_t len, u_char *dst,
 
 u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
+u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
+    ngx_uint_t value);
 
 
 #endif /* _NGX_HTTP_V2_H_INCLUDED_ */
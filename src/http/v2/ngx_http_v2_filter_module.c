@@ -27,6 +27,11 @@
 #define NGX_HTTP_V2_NO_TRAILERS           (ngx_http_v2_out_frame_t *) -1
 
 
+#define NGX_HTTP_V2_NOT_INDEXED           0
+#define NGX_HTTP_V2_INDEXED               1
+#define NGX_HTTP_V2_NEVER_INDEXED         2
+
+
 typedef struct {
     ngx_str_t      name;
     u_char         index;
@@ -52,6 +57,40 @@ static ngx_http_v2_push_header_t  ngx_http_v2_push_headers[] = {
     (sizeof(ngx_http_v2_push_headers) / sizeof(ngx_http_v2_push_header_t))
 
 
+/*
+ * Response headers which are unlikely to repeat on a connection are sent
+ * without indexing, so they do not push useful entries out of the dynamic
+ * table; set-cookie is additionally marked as never indexed.
+ */
+
+typedef struct {
+    ngx_str_t      name;
+    ngx_uint_t     indexing;
+} ngx_http_v2_indexing_t;
+
+
+static ngx_http_v2_indexing_t  ngx_http_v2_indexing[] = {
+    { ngx_string("age"), NGX_HTTP_V2_NOT_INDEXED },
+    { ngx_string("content-length"), NGX_HTTP_V2_NOT_INDEXED },
+    { ngx_string("content-range"), NGX_HTTP_V2_NOT_INDEXED },
+    { ngx_string("etag"), NGX_HTTP_V2_NOT_INDEXED },
+    { ngx_string("last-modified"), NGX_HTTP_V2_NOT_INDEXED },
+    { ngx_string("location"), NGX_HTTP_V2_NOT_INDEXED },
+    { ngx_string("set-cookie"), NGX_HTTP_V2_NEVER_INDEXED },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_int_t ngx_http_v2_early_hints_filter(ngx_http_request_t *r,
+    ngx_list_t *headers);
+
+static u_char *ngx_http_v2_write_table_update(ngx_http_v2_connection_t *h2c,
+    u_char *pos);
+static u_char *ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c,
+    u_char *pos, ngx_uint_t index, ngx_str_t *name, ngx_str_t *value,
+    ngx_uint_t indexing, u_char *tmp);
+static ngx_uint_t ngx_http_v2_header_indexing(ngx_str_t *name);
+
 static ngx_int_t ngx_http_v2_push_resources(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v2_push_resource(ngx_http_request_t *r,
     ngx_str_t *path, ngx_str_t *binary);
@@ -127,7 +166,8 @@ ngx_module_t  ngx_http_v2_filter_module = {
 };
 
 
-static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+static ngx_http_output_header_filter_pt       ngx_http_next_header_filter;
+static ngx_http_output_early_hints_filter_pt  ngx_http_next_early_hints_filter;
 
 
 static ngx_int_t
@@ -135,31 +175,20 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
     u_char                     status, *pos, *start, *p, *tmp;
     size_t                     len, tmp_len;
-    ngx_str_t                  host, location;
-    ngx_uint_t                 i, port, fin;
+    ngx_str_t                  host, location, server, name, value;
+    ngx_uint_t                 i, port, fin, indexing;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
     ngx_connection_t          *fc;
     ngx_http_cleanup_t        *cln;
     ngx_http_v2_stream_t      *stream;
+    ngx_http_header_block_t   *block;
     ngx_http_v2_out_frame_t   *frame;
     ngx_http_v2_connection_t  *h2c;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
-
-    static const u_char nginx[5] = "\x84\xaa\x63\x55\xe7";
-#if (NGX_HTTP_GZIP)
-    static const u_char accept_encoding[12] =
-        "\x8b\x84\x84\x2d\x69\x5b\x05\x44\x3c\x86\xaa\x6f";
-#endif
-
-    static size_t nginx_ver_len = ngx_http_v2_literal_size(NGINX_VER);
-    static u_char nginx_ver[ngx_http_v2_literal_size(NGINX_VER)];
-
-    static size_t nginx_ver_build_len =
-                                  ngx_http_v2_literal_size(NGINX_VER_BUILD);
-    static u_char nginx_ver_build[ngx_http_v2_literal_size(NGINX_VER_BUILD)];
+    u_char                     buf[sizeof("Wed, 31 Dec 1986 18:00:00 GMT")];
 
     stream = r->stream;
 
@@ -253,49 +282,76 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
-    len = h2c->table_update ? 1 : 0;
+    len = h2c->table_update ? 1 + NGX_HTTP_V2_INT_OCTETS : 0;
 
-    len += status ? 1 : 1 + ngx_http_v2_literal_size("418");
+    len += status ? 1 : NGX_HTTP_V2_INT_OCTETS
+                        + ngx_http_v2_literal_size("418");
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_out.server == NULL) {
 
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            len += 1 + nginx_ver_len;
+            ngx_str_set(&server, NGINX_VER);
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            len += 1 + nginx_ver_build_len;
+            ngx_str_set(&server, NGINX_VER_BUILD);
 
         } else {
-            len += 1 + sizeof(nginx);
+            ngx_str_set(&server, "nginx");
         }
+
+        len += NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS + server.len;
     }
 
     if (r->headers_out.date == NULL) {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += NGX_HTTP_V2_INT_OCTETS
+               + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     if (r->headers_out.content_type.len) {
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
         {
-            len += sizeof("; charset=") - 1 + r->headers_out.charset.len;
+            value.len = r->headers_out.content_type.len
+                        + sizeof("; charset=") - 1
+                        + r->headers_out.charset.len;
+
+            value.data = ngx_pnalloc(r->pool, value.len);
+            if (value.data == NULL) {
+                return NGX_ERROR;
+            }
+
+            p = ngx_cpymem(value.data, r->headers_out.content_type.data,
+                           r->headers_out.content_type.len);
+
+            p = ngx_cpymem(p, "; charset=", sizeof("; charset=") - 1);
+
+            ngx_memcpy(p, r->headers_out.charset.data,
+                       r->headers_out.charset.len);
+
+            /* updated r->headers_out.content_type is also needed for logging */
+
+            r->headers_out.content_type = value;
         }
+
+        len += NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS
+               + r->headers_out.content_type.len;
     }
 
     if (r->headers_out.content_length == NULL
         && r->headers_out.content_length_n >= 0)
     {
-        len += 1 + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
+        len += NGX_HTTP_V2_INT_OCTETS
+               + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += NGX_HTTP_V2_INT_OCTETS
+               + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -373,7 +429,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
         r->headers_out.location->hash = 0;
 
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
+        len += NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS
+               + r->headers_out.location->value.len;
     }
 
     tmp_len = len;
@@ -381,7 +438,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 #if (NGX_HTTP_GZIP)
     if (r->gzip_vary) {
         if (clcf->gzip_vary) {
-            len += 1 + sizeof(accept_encoding);
+            len += NGX_HTTP_V2_INT_OCTETS
+                   + ngx_http_v2_literal_size("Accept-Encoding");
 
         } else {
             r->gzip_vary = 0;
@@ -434,6 +492,24 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
+    block = r->headers_out.header_block;
+
+    if (block) {
+        if (block->max > NGX_HTTP_V2_MAX_FIELD) {
+            ngx_log_error(NGX_LOG_CRIT, fc->log, 0,
+                          "too long response header");
+            return NGX_ERROR;
+        }
+
+        len += block->part.nelts * (1 + NGX_HTTP_V2_INT_OCTETS
+                                    + NGX_HTTP_V2_INT_OCTETS)
+               + block->size;
+
+        if (block->max > tmp_len) {
+            tmp_len = block->max;
+        }
+    }
+
     tmp = ngx_palloc(r->pool, tmp_len);
     pos = ngx_pnalloc(r->pool, len);
 
@@ -443,12 +519,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     start = pos;
 
-    if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
-    }
+    pos = ngx_http_v2_write_table_update(h2c, pos);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 output header: \":status: %03ui\"",
@@ -458,52 +529,24 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         *pos++ = status;
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
-        *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
-        pos = ngx_sprintf(pos, "%03ui", r->headers_out.status);
+        ngx_str_set(&name, ":status");
+        value.data = buf;
+        value.len = ngx_sprintf(buf, "%03ui", r->headers_out.status) - buf;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                       &name, &value, NGX_HTTP_V2_INDEXED,
+                                       tmp);
     }
 
     if (r->headers_out.server == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"server: %V\"", &server);
 
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER);
-
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER_BUILD);
-
-        } else {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: nginx\"");
-        }
-
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
-
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            if (nginx_ver[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver, (u_char *) NGINX_VER,
-                                            sizeof(NGINX_VER) - 1, tmp);
-                nginx_ver_len = p - nginx_ver;
-            }
-
-            pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
-
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            if (nginx_ver_build[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver_build,
-                                            (u_char *) NGINX_VER_BUILD,
-                                            sizeof(NGINX_VER_BUILD) - 1, tmp);
-                nginx_ver_build_len = p - nginx_ver_build;
-            }
-
-            pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
+        ngx_str_set(&name, "server");
 
-        } else {
-            pos = ngx_cpymem(pos, nginx, sizeof(nginx));
-        }
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_SERVER_INDEX,
+                                       &name, &server, NGX_HTTP_V2_INDEXED,
+                                       tmp);
     }
 
     if (r->headers_out.date == NULL) {
@@ -511,45 +554,31 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
-                                      ngx_cached_http_time.len, tmp);
-    }
-
-    if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
-
-        if (r->headers_out.content_type_len == r->headers_out.content_type.len
-            && r->headers_out.charset.len)
-        {
-            len = r->headers_out.content_type.len + sizeof("; charset=") - 1
-                  + r->headers_out.charset.len;
-
-            p = ngx_pnalloc(r->pool, len);
-            if (p == NULL) {
-                return NGX_ERROR;
-            }
-
-            p = ngx_cpymem(p, r->headers_out.content_type.data,
-                           r->headers_out.content_type.len);
-
-            p = ngx_cpymem(p, "; charset=", sizeof("; charset=") - 1);
-
-            p = ngx_cpymem(p, r->headers_out.charset.data,
-                           r->headers_out.charset.len);
+        /*
+         * the date changes once a second, so it is still worth indexing
+         * on connections with several responses per second
+         */
 
-            /* updated r->headers_out.content_type is also needed for logging */
+        ngx_str_set(&name, "date");
+        value.len = ngx_cached_http_time.len;
+        value.data = ngx_cached_http_time.data;
 
-            r->headers_out.content_type.len = len;
-            r->headers_out.content_type.data = p - len;
-        }
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_DATE_INDEX,
+                                       &name, &value, NGX_HTTP_V2_INDEXED,
+                                       tmp);
+    }
 
+    if (r->headers_out.content_type.len) {
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+        ngx_str_set(&name, "content-type");
+
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_TYPE_INDEX,
+                                       &name, &r->headers_out.content_type,
+                                       NGX_HTTP_V2_INDEXED, tmp);
     }
 
     if (r->headers_out.content_length == NULL
@@ -559,30 +588,32 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        ngx_str_set(&name, "content-length");
+        value.data = buf;
+        value.len = ngx_sprintf(buf, "%O", r->headers_out.content_length_n)
+                    - buf;
 
-        p = pos;
-        pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
-        *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_LENGTH_INDEX,
+                                       &name, &value, NGX_HTTP_V2_NOT_INDEXED,
+                                       tmp);
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
-
-        ngx_http_time(pos, r->headers_out.last_modified_time);
-        len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
+        ngx_str_set(&name, "last-modified");
+        value.data = buf;
+        value.len = ngx_http_time(buf, r->headers_out.last_modified_time)
+                    - buf;
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"last-modified: %*s\"",
-                       len, pos);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"last-modified: %V\"", &value);
 
-        /*
-         * Date will always be encoded using huffman in the temporary buffer,
-         * so it's safe here to use src and dst pointing to the same address.
-         */
-        pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_LAST_MODIFIED_INDEX,
+                                       &name, &value, NGX_HTTP_V2_NOT_INDEXED,
+                                       tmp);
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -590,9 +621,11 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len, tmp);
+        ngx_str_set(&name, "location");
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_LOCATION_INDEX,
+                                       &name, &r->headers_out.location->value,
+                                       NGX_HTTP_V2_NOT_INDEXED, tmp);
     }
 
 #if (NGX_HTTP_GZIP)
@@ -600,8 +633,12 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        ngx_str_set(&name, "vary");
+        ngx_str_set(&value, "Accept-Encoding");
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_VARY_INDEX,
+                                       &name, &value, NGX_HTTP_V2_INDEXED,
+                                       tmp);
     }
 #endif
 
@@ -634,13 +671,21 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
 #endif
 
-        *pos++ = 0;
+        indexing = ngx_http_v2_header_indexing(&header[i].key);
 
-        pos = ngx_http_v2_write_name(pos, header[i].key.data,
-                                     header[i].key.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &header[i].key,
+                                       &header[i].value, indexing, tmp);
+    }
 
-        pos = ngx_http_v2_write_value(pos, header[i].value.data,
-                                      header[i].value.len, tmp);
+    if (block) {
+        header = block->part.elts;
+
+        for (i = 0; i < block->part.nelts; i++) {
+            indexing = ngx_http_v2_header_indexing(&header[i].key);
+
+            pos = ngx_http_v2_write_header(h2c, pos, 0, &header[i].key,
+                                           &header[i].value, indexing, tmp);
+        }
     }
 
     fin = r->header_only
@@ -648,6 +693,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     frame = ngx_http_v2_create_headers_frame(r, start, pos, fin);
     if (frame == NULL) {
+
+        /* the client will never see the fields just added to the table */
+
+        ngx_http_v2_table_reset(h2c);
         return NGX_ERROR;
     }
 
@@ -670,6 +719,218 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t
+ngx_http_v2_early_hints_filter(ngx_http_request_t *r, ngx_list_t *headers)
+{
+    u_char                    *pos, *start, *tmp;
+    size_t                     len, tmp_len;
+    ngx_str_t                  name, value;
+    ngx_uint_t                 i;
+    ngx_list_part_t           *part;
+    ngx_table_elt_t           *header;
+    ngx_connection_t          *fc;
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_out_frame_t   *frame;
+    ngx_http_v2_connection_t  *h2c;
+
+    stream = r->stream;
+
+    if (!stream) {
+        return ngx_http_next_early_hints_filter(r, headers);
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 early hints filter");
+
+    fc = r->connection;
+
+    if (fc->error) {
+        return NGX_ERROR;
+    }
+
+    h2c = stream->connection;
+
+    len = h2c->table_update ? 1 + NGX_HTTP_V2_INT_OCTETS : 0;
+
+    len += NGX_HTTP_V2_INT_OCTETS + ngx_http_v2_literal_size("103");
+
+    tmp_len = len;
+
+    part = &headers->part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].value.len > NGX_HTTP_V2_MAX_FIELD) {
+            ngx_log_error(NGX_LOG_CRIT, fc->log, 0,
+                          "too long early hints header value: \"%V: %V\"",
+                          &header[i].key, &header[i].value);
+            return NGX_ERROR;
+        }
+
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + header[i].key.len
+                 + NGX_HTTP_V2_INT_OCTETS + header[i].value.len;
+
+        if (header[i].key.len > tmp_len) {
+            tmp_len = header[i].key.len;
+        }
+
+        if (header[i].value.len > tmp_len) {
+            tmp_len = header[i].value.len;
+        }
+    }
+
+    tmp = ngx_palloc(r->pool, tmp_len);
+    pos = ngx_pnalloc(r->pool, len);
+
+    if (pos == NULL || tmp == NULL) {
+        return NGX_ERROR;
+    }
+
+    start = pos;
+
+    pos = ngx_http_v2_write_table_update(h2c, pos);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                   "http2 output header: \":status: 103\"");
+
+    ngx_str_set(&name, ":status");
+    ngx_str_set(&value, "103");
+
+    pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                   &name, &value, NGX_HTTP_V2_INDEXED, tmp);
+
+    part = &headers->part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"%V: %V\"",
+                       &header[i].key, &header[i].value);
+
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &header[i].key,
+                                       &header[i].value,
+                                       ngx_http_v2_header_indexing(
+                                                             &header[i].key),
+                                       tmp);
+    }
+
+    frame = ngx_http_v2_create_headers_frame(r, start, pos, 0);
+    if (frame == NULL) {
+        ngx_http_v2_table_reset(h2c);
+        return NGX_ERROR;
+    }
+
+    ngx_http_v2_queue_blocked_frame(h2c, frame);
+
+    stream->queued++;
+
+    return ngx_http_v2_filter_send(fc, stream);
+}
+
+
+static u_char *
+ngx_http_v2_write_table_update(ngx_http_v2_connection_t *h2c, u_char *pos)
+{
+    if (!h2c->table_update) {
+        return pos;
+    }
+
+    if (h2c->hpack_enc.reset) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table size update: 0");
+
+        *pos++ = (1 << 5) | 0;
+        h2c->hpack_enc.reset = 0;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table size update: %uz", h2c->hpack_enc.size);
+
+    *pos = 1 << 5;
+    pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                h2c->hpack_enc.size);
+
+    h2c->table_update = 0;
+
+    return pos;
+}
+
+
+static u_char *
+ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, ngx_uint_t indexing,
+    u_char *tmp)
+{
+    ngx_int_t  rc;
+
+    rc = ngx_http_v2_table_lookup(h2c, name, value, &index);
+
+    if (rc == NGX_OK && indexing != NGX_HTTP_V2_NEVER_INDEXED) {
+        *pos = 0x80;
+        return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), index);
+    }
+
+    if (indexing == NGX_HTTP_V2_INDEXED
+        && ngx_http_v2_table_insert(h2c, name, value) == NGX_OK)
+    {
+        /* the name index refers to the table before the insertion */
+
+        *pos = 0x40;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(6), index);
+
+    } else {
+        *pos = (indexing == NGX_HTTP_V2_NEVER_INDEXED) ? 0x10 : 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+    }
+
+    if (index == 0) {
+        pos = ngx_http_v2_write_name(pos, name->data, name->len, tmp);
+    }
+
+    return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+}
+
+
+static ngx_uint_t
+ngx_http_v2_header_indexing(ngx_str_t *name)
+{
+    ngx_http_v2_indexing_t  *hi;
+
+    for (hi = ngx_http_v2_indexing; hi->name.len; hi++) {
+
+        if (hi->name.len == name->len
+            && ngx_strncasecmp(hi->name.data, name->data, name->len) == 0)
+        {
+            return hi->indexing;
+        }
+    }
+
+    return NGX_HTTP_V2_INDEXED;
+}
+
+
 static ngx_int_t
 ngx_http_v2_push_resources(ngx_http_request_t *r)
 {
@@ -975,7 +1236,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
 
             value = &(*h)->value;
 
-            len = 1 + NGX_HTTP_V2_INT_OCTETS + value->len;
+            len = NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS + value->len;
 
             pos = ngx_pnalloc(r->pool, len);
             if (pos == NULL) {
@@ -984,14 +1245,21 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
 
             binary[i].data = pos;
 
-            *pos++ = ngx_http_v2_inc_indexed(ph[i].index);
+            /*
+             * request headers of pushed resources are never indexed, so
+             * the encoded fields can be reused for all pushes of a request
+             */
+
+            *pos = 0;
+            pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4),
+                                        ph[i].index);
             pos = ngx_http_v2_write_value(pos, value->data, value->len, tmp);
 
             binary[i].len = pos - binary[i].data;
         }
     }
 
-    len = (h2c->table_update ? 1 : 0)
+    len = (h2c->table_update ? 1 + NGX_HTTP_V2_INT_OCTETS : 0)
           + 1
           + 1 + NGX_HTTP_V2_INT_OCTETS + path->len
           + 1 + NGX_HTTP_V2_INT_OCTETS + r->schema.len;
@@ -1007,12 +1275,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
 
     start = pos;
 
-    if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
-    }
+    pos = ngx_http_v2_write_table_update(h2c, pos);
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 push header: \":method: GET\"");
@@ -1022,7 +1285,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 push header: \":path: %V\"", path);
 
-    *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_PATH_INDEX);
+    *pos++ = NGX_HTTP_V2_PATH_INDEX;
     pos = ngx_http_v2_write_value(pos, path->data, path->len, tmp);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
@@ -1037,7 +1300,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
         *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
+        *pos++ = NGX_HTTP_V2_SCHEME_HTTP_INDEX;
         pos = ngx_http_v2_write_value(pos, r->schema.data, r->schema.len, tmp);
     }
 
@@ -1057,6 +1320,10 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
 
     frame = ngx_http_v2_create_push_frame(r, start, pos);
     if (frame == NULL) {
+
+        /* a pending table size update could have been lost */
+
+        ngx_http_v2_table_reset(h2c);
         return NGX_ERROR;
     }
 
@@ -1417,10 +1684,11 @@ static ngx_chain_t *
 ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in, off_t limit)
 {
     off_t                      size, offset;
-    size_t                     rest, frame_size;
+    size_t                     rest, frame_size, chunk_size, file_chunk_size;
     ngx_chain_t               *cl, *out, **ln;
     ngx_http_request_t        *r;
     ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_srv_conf_t    *h2scf;
     ngx_http_v2_loc_conf_t    *h2lcf;
     ngx_http_v2_out_frame_t   *frame, *trailers;
     ngx_http_v2_connection_t  *h2c;
@@ -1499,8 +1767,19 @@ ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in, off_t limit)
 
     h2lcf = ngx_http_get_module_loc_conf(r, ngx_http_v2_module);
 
-    frame_size = (h2lcf->chunk_size < h2c->frame_size)
-                 ? h2lcf->chunk_size : h2c->frame_size;
+    chunk_size = ngx_min(h2lcf->chunk_size, h2c->frame_size);
+
+    /*
+     * Each DATA frame of a file buffer costs a separate writev() of its
+     * header and sendfile() of its payload, so file buffers are sliced
+     * as coarsely as the peer and the scheduler quantum allow.
+     */
+
+    h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
+                                         ngx_http_v2_module);
+
+    file_chunk_size = ngx_min(ngx_max(chunk_size, h2scf->send_quantum),
+                              h2c->frame_size);
 
     trailers = NGX_HTTP_V2_NO_TRAILERS;
 
@@ -1509,6 +1788,9 @@ ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in, off_t limit)
 #endif
 
     for ( ;; ) {
+        frame_size = (in->buf->in_file && !ngx_buf_in_memory(in->buf))
+                     ? file_chunk_size : chunk_size;
+
         if ((off_t) frame_size > limit) {
             frame_size = (size_t) limit;
         }
@@ -1763,15 +2045,29 @@ ngx_http_v2_flow_control(ngx_http_v2_connection_t *h2c,
 
     if (stream->send_window <= 0) {
         stream->exhausted = 1;
-        return NGX_DECLINED;
+        goto blocked;
     }
 
     if (h2c->send_window == 0) {
         ngx_http_v2_waiting_queue(h2c, stream);
-        return NGX_DECLINED;
+        goto blocked;
+    }
+
+    if (stream->send_blocked_set) {
+        stream->send_blocked_time += ngx_current_msec - stream->send_blocked;
+        stream->send_blocked_set = 0;
     }
 
     return NGX_OK;
+
+blocked:
+
+    if (!stream->send_blocked_set) {
+        stream->send_blocked_set = 1;
+        stream->send_blocked = ngx_current_msec;
+    }
+
+    return NGX_DECLINED;
 }
 
 
@@ -2110,12 +2406,28 @@ ngx_http_v2_filter_cleanup(void *data)
         ngx_queue_remove(&stream->queue);
     }
 
+    window = 0;
+    h2c = stream->connection;
+
+    if (stream->out) {
+
+        for (frame = stream->out; frame; frame = frame->next) {
+            window += frame->length;
+            stream->queued--;
+        }
+
+        stream->out = NULL;
+
+        ngx_queue_remove(&stream->scheduled);
+        h2c->nscheduled--;
+
+        stream->queue_time += ngx_current_msec - stream->queued_at;
+    }
+
     if (stream->queued == 0) {
-        return;
+        goto done;
     }
 
-    window = 0;
-    h2c = stream->connection;
     fn = &h2c->last_out;
 
     for ( ;; ) {
@@ -2140,6 +2452,8 @@ ngx_http_v2_filter_cleanup(void *data)
         fn = &frame->next;
     }
 
+done:
+
     if (h2c->send_window == 0 && window) {
 
         while (!ngx_queue_empty(&h2c->waiting)) {
@@ -2172,5 +2486,8 @@ ngx_http_v2_filter_init(ngx_conf_t *cf)
     ngx_http_next_header_filter = ngx_http_top_header_filter;
     ngx_http_top_header_filter = ngx_http_v2_header_filter;
 
+    ngx_http_next_early_hints_filter = ngx_http_top_early_hints_filter;
+    ngx_http_top_early_hints_filter = ngx_http_v2_early_hints_filter;
+
     return NGX_OK;
 }
@@ -18,8 +18,32 @@ typedef struct {
 } ngx_http_v2_huff_decode_code_t;
 
 
-static ngx_inline ngx_int_t ngx_http_v2_huff_decode_bits(u_char *state,
-    u_char *ending, ngx_uint_t bits, u_char **dst);
+/*
+ * The table below walks the code tree 4 bits at a time.  To halve the
+ * number of steps, it is used once to build a table that consumes a whole
+ * octet per step: with the shortest code being 5 bits long, an octet
+ * completes at most two symbols.
+ */
+
+typedef struct {
+    u_char  next;
+    u_char  flags;
+    u_char  sym[2];
+} ngx_http_v2_huff_decode_octet_t;
+
+
+#define NGX_HTTP_V2_HUFF_EMIT    0x03
+#define NGX_HTTP_V2_HUFF_ENDING  0x04
+#define NGX_HTTP_V2_HUFF_ERROR   0x08
+
+
+static void ngx_http_v2_huff_decode_init(void);
+
+
+static ngx_uint_t  ngx_http_v2_huff_decode_ready;
+
+static ngx_http_v2_huff_decode_octet_t
+    ngx_http_v2_huff_decode_octets[256][256];
 
 
 static ngx_http_v2_huff_decode_code_t  ngx_http_v2_huff_decode_codes[256][16] =
@@ -2643,37 +2667,51 @@ ngx_int_t
 ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len, u_char **dst,
     ngx_uint_t last, ngx_log_t *log)
 {
-    u_char  *end, ch, ending;
+    u_char                           *end, *p, ch, ending;
+    ngx_http_v2_huff_decode_octet_t  *octet;
+
+    if (!ngx_http_v2_huff_decode_ready) {
+        ngx_http_v2_huff_decode_init();
+    }
 
     ch = 0;
     ending = 1;
 
+    p = *dst;
     end = src + len;
 
     while (src != end) {
         ch = *src++;
 
-        if (ngx_http_v2_huff_decode_bits(state, &ending, ch >> 4, dst)
-            != NGX_OK)
-        {
+        octet = &ngx_http_v2_huff_decode_octets[*state][ch];
+
+        if (octet->flags & NGX_HTTP_V2_HUFF_ERROR) {
             ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
                            "http2 huffman decoding error at state %d: "
-                           "bad code 0x%Xd", *state, ch >> 4);
+                           "bad code 0x%Xd", *state, ch);
 
+            *dst = p;
             return NGX_ERROR;
         }
 
-        if (ngx_http_v2_huff_decode_bits(state, &ending, ch & 0xf, dst)
-            != NGX_OK)
-        {
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
-                           "http2 huffman decoding error at state %d: "
-                           "bad code 0x%Xd", *state, ch & 0xf);
+        switch (octet->flags & NGX_HTTP_V2_HUFF_EMIT) {
 
-            return NGX_ERROR;
+        case 2:
+            *p++ = octet->sym[0];
+            *p++ = octet->sym[1];
+            break;
+
+        case 1:
+            *p++ = octet->sym[0];
+            break;
         }
+
+        ending = octet->flags & NGX_HTTP_V2_HUFF_ENDING;
+        *state = octet->next;
     }
 
+    *dst = p;
+
     if (last) {
         if (!ending) {
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
@@ -2690,25 +2728,47 @@ ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len, u_char **dst,
 }
 
 
-
-static ngx_inline ngx_int_t
-ngx_http_v2_huff_decode_bits(u_char *state, u_char *ending, ngx_uint_t bits,
-    u_char **dst)
+static void
+ngx_http_v2_huff_decode_init(void)
 {
-    ngx_http_v2_huff_decode_code_t  code;
+    ngx_uint_t                        state, ch, next, n;
+    ngx_http_v2_huff_decode_code_t    code;
+    ngx_http_v2_huff_decode_octet_t  *octet;
 
-    code = ngx_http_v2_huff_decode_codes[*state][bits];
+    for (state = 0; state < 256; state++) {
+        for (ch = 0; ch < 256; ch++) {
 
-    if (code.next == *state) {
-        return NGX_ERROR;
-    }
+            octet = &ngx_http_v2_huff_decode_octets[state][ch];
+            n = 0;
 
-    if (code.emit) {
-        *(*dst)++ = code.sym;
-    }
+            code = ngx_http_v2_huff_decode_codes[state][ch >> 4];
 
-    *ending = code.ending;
-    *state = code.next;
+            if (code.next == state) {
+                octet->flags = NGX_HTTP_V2_HUFF_ERROR;
+                continue;
+            }
 
-    return NGX_OK;
+            if (code.emit) {
+                octet->sym[n++] = code.sym;
+            }
+
+            next = code.next;
+
+            code = ngx_http_v2_huff_decode_codes[next][ch & 0xf];
+
+            if (code.next == next) {
+                octet->flags = NGX_HTTP_V2_HUFF_ERROR;
+                continue;
+            }
+
+            if (code.emit) {
+                octet->sym[n++] = code.sym;
+            }
+
+            octet->next = code.next;
+            octet->flags = n | (code.ending ? NGX_HTTP_V2_HUFF_ENDING : 0);
+        }
+    }
+
+    ngx_http_v2_huff_decode_ready = 1;
 }
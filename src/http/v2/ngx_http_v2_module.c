@@ -15,6 +15,10 @@ static ngx_int_t ngx_http_v2_add_variables(ngx_conf_t *cf);
 
 static ngx_int_t ngx_http_v2_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_v2_blocked_time_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_v2_streams_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 
 static ngx_int_t ngx_http_v2_module_init(ngx_cycle_t *cycle);
 
@@ -75,6 +79,20 @@ static ngx_command_t  ngx_http_v2_commands[] = {
       offsetof(ngx_http_v2_srv_conf_t, concurrent_streams),
       NULL },
 
+    { ngx_string("http2_min_concurrent_streams"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, min_concurrent_streams),
+      NULL },
+
+    { ngx_string("http2_concurrent_streams_latency"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, streams_latency),
+      NULL },
+
     { ngx_string("http2_max_concurrent_pushes"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_num_slot,
@@ -110,6 +128,20 @@ static ngx_command_t  ngx_http_v2_commands[] = {
       offsetof(ngx_http_v2_srv_conf_t, preread_size),
       &ngx_http_v2_preread_size_post },
 
+    { ngx_string("http2_body_window_max"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, body_window_max),
+      NULL },
+
+    { ngx_string("http2_body_window_budget"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, body_window_budget),
+      NULL },
+
     { ngx_string("http2_streams_index_size"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_num_slot,
@@ -117,6 +149,13 @@ static ngx_command_t  ngx_http_v2_commands[] = {
       offsetof(ngx_http_v2_srv_conf_t, streams_index_mask),
       &ngx_http_v2_streams_index_mask_post },
 
+    { ngx_string("http2_send_quantum"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, send_quantum),
+      NULL },
+
     { ngx_string("http2_recv_timeout"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -248,6 +287,31 @@ static ngx_http_variable_t  ngx_http_v2_vars[] = {
     { ngx_string("http2"), NULL,
       ngx_http_v2_variable, 0, 0, 0 },
 
+    { ngx_string("http2_send_blocked_time"), NULL,
+      ngx_http_v2_blocked_time_variable,
+      offsetof(ngx_http_v2_stream_t, send_blocked_time),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("http2_recv_blocked_time"), NULL,
+      ngx_http_v2_blocked_time_variable,
+      offsetof(ngx_http_v2_stream_t, recv_blocked_time),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("http2_queue_time"), NULL,
+      ngx_http_v2_blocked_time_variable,
+      offsetof(ngx_http_v2_stream_t, queue_time),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("http2_streams"), NULL,
+      ngx_http_v2_streams_variable,
+      offsetof(ngx_http_v2_connection_t, processing),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("http2_streams_limit"), NULL,
+      ngx_http_v2_streams_variable,
+      offsetof(ngx_http_v2_connection_t, concurrent_streams),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
       ngx_http_null_variable
 };
 
@@ -305,6 +369,64 @@ ngx_http_v2_variable(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_v2_blocked_time_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char      *p;
+    ngx_msec_t   ms;
+
+    if (r->stream == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_TIME_T_LEN + 4);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ms = *(ngx_msec_t *) ((char *) r->stream + data);
+
+    v->len = ngx_sprintf(p, "%T.%03M", (time_t) ms / 1000, ms % 1000) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_streams_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char      *p;
+    ngx_uint_t   n;
+
+    if (r->stream == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = *(ngx_uint_t *) ((char *) r->stream->connection + data);
+
+    v->len = ngx_sprintf(p, "%ui", n) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_v2_module_init(ngx_cycle_t *cycle)
 {
@@ -352,6 +474,8 @@ ngx_http_v2_create_srv_conf(ngx_conf_t *cf)
     h2scf->pool_size = NGX_CONF_UNSET_SIZE;
 
     h2scf->concurrent_streams = NGX_CONF_UNSET_UINT;
+    h2scf->min_concurrent_streams = NGX_CONF_UNSET_UINT;
+    h2scf->streams_latency = NGX_CONF_UNSET_MSEC;
     h2scf->concurrent_pushes = NGX_CONF_UNSET_UINT;
     h2scf->max_requests = NGX_CONF_UNSET_UINT;
 
@@ -359,9 +483,13 @@ ngx_http_v2_create_srv_conf(ngx_conf_t *cf)
     h2scf->max_header_size = NGX_CONF_UNSET_SIZE;
 
     h2scf->preread_size = NGX_CONF_UNSET_SIZE;
+    h2scf->body_window_max = NGX_CONF_UNSET_SIZE;
+    h2scf->body_window_budget = NGX_CONF_UNSET_SIZE;
 
     h2scf->streams_index_mask = NGX_CONF_UNSET_UINT;
 
+    h2scf->send_quantum = NGX_CONF_UNSET_SIZE;
+
     h2scf->recv_timeout = NGX_CONF_UNSET_MSEC;
     h2scf->idle_timeout = NGX_CONF_UNSET_MSEC;
 
@@ -379,6 +507,17 @@ ngx_http_v2_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_uint_value(conf->concurrent_streams,
                               prev->concurrent_streams, 128);
+    ngx_conf_merge_uint_value(conf->min_concurrent_streams,
+                              prev->min_concurrent_streams, 0);
+    ngx_conf_merge_msec_value(conf->streams_latency,
+                              prev->streams_latency, 500);
+
+    if (conf->min_concurrent_streams > conf->concurrent_streams) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"http2_min_concurrent_streams\" must not be "
+                           "greater than \"http2_max_concurrent_streams\"");
+        return NGX_CONF_ERROR;
+    }
     ngx_conf_merge_uint_value(conf->concurrent_pushes,
                               prev->concurrent_pushes, 10);
     ngx_conf_merge_uint_value(conf->max_requests, prev->max_requests, 1000);
@@ -390,9 +529,17 @@ ngx_http_v2_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_size_value(conf->preread_size, prev->preread_size, 65536);
 
+    ngx_conf_merge_size_value(conf->body_window_max, prev->body_window_max, 0);
+    ngx_conf_merge_size_value(conf->body_window_budget,
+                              prev->body_window_budget,
+                              4 * conf->body_window_max);
+
     ngx_conf_merge_uint_value(conf->streams_index_mask,
                               prev->streams_index_mask, 32 - 1);
 
+    ngx_conf_merge_size_value(conf->send_quantum, prev->send_quantum,
+                              16 * 1024);
+
     ngx_conf_merge_msec_value(conf->recv_timeout,
                               prev->recv_timeout, 30000);
     ngx_conf_merge_msec_value(conf->idle_timeout,
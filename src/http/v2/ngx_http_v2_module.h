@@ -14,21 +14,38 @@
 #include <ngx_http.h>
 
 
+typedef struct ngx_http_v2_free_buffer_s  ngx_http_v2_free_buffer_t;
+
+struct ngx_http_v2_free_buffer_s {
+    ngx_http_v2_free_buffer_t      *next;
+    size_t                          size;
+};
+
+
 typedef struct {
     size_t                          recv_buffer_size;
     u_char                         *recv_buffer;
+
+    /* preread buffers kept by the worker for reuse by streams */
+    ngx_http_v2_free_buffer_t      *free_buffers;
+    ngx_uint_t                      nfree_buffers;
 } ngx_http_v2_main_conf_t;
 
 
 typedef struct {
     size_t                          pool_size;
     ngx_uint_t                      concurrent_streams;
+    ngx_uint_t                      min_concurrent_streams;
+    ngx_msec_t                      streams_latency;
     ngx_uint_t                      concurrent_pushes;
     ngx_uint_t                      max_requests;
     size_t                          max_field_size;
     size_t                          max_header_size;
     size_t                          preread_size;
+    size_t                          body_window_max;
+    size_t                          body_window_budget;
     ngx_uint_t                      streams_index_mask;
+    size_t                          send_quantum;
     ngx_msec_t                      recv_timeout;
     ngx_msec_t                      idle_timeout;
 } ngx_http_v2_srv_conf_t;
@@ -10,11 +10,10 @@
 #include <ngx_http.h>
 
 
-#define NGX_HTTP_V2_TABLE_SIZE  4096
-
-
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
+static void ngx_http_v2_table_evict(ngx_http_v2_connection_t *h2c,
+    size_t size);
 
 
 static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
@@ -361,3 +360,205 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+/*
+ * The encoder side of the dynamic table mirrors what the client's decoder
+ * holds after it has processed all header blocks sent so far.  Fields are
+ * stored back to back in the storage, the oldest one first, so eviction is
+ * a single memmove() and a lookup is a linear scan of at most
+ * NGX_HTTP_V2_TABLE_SIZE / 32 entries.
+ */
+
+ngx_int_t
+ngx_http_v2_table_lookup(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value, ngx_uint_t *index)
+{
+    u_char                     *p;
+    ngx_uint_t                  i, n, found;
+    ngx_http_v2_hpack_enc_t    *hpack;
+    ngx_http_v2_hpack_field_t  *field;
+
+    hpack = &h2c->hpack_enc;
+
+    p = hpack->storage;
+    field = hpack->fields;
+    n = hpack->nfields;
+
+    found = 0;
+
+    for (i = 0; i < n; i++) {
+
+        if (field[i].name_len == name->len
+            && ngx_strncasecmp(p, name->data, name->len) == 0)
+        {
+            found = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + n - i;
+
+            if (field[i].value_len == value->len
+                && ngx_memcmp(p + name->len, value->data, value->len) == 0)
+            {
+                *index = found;
+                return NGX_OK;
+            }
+        }
+
+        p += field[i].name_len + field[i].value_len;
+    }
+
+    if (*index) {
+        return NGX_DECLINED;
+    }
+
+    if (found) {
+        *index = found;
+        return NGX_DECLINED;
+    }
+
+    /* pseudo-headers are never looked up by name */
+
+    for (i = NGX_HTTP_V2_STATUS_500_INDEX;
+         i < NGX_HTTP_V2_STATIC_TABLE_ENTRIES;
+         i++)
+    {
+        if (ngx_http_v2_static_table[i].name.len == name->len
+            && ngx_strncasecmp(ngx_http_v2_static_table[i].name.data,
+                               name->data, name->len)
+               == 0)
+        {
+            *index = i + 1;
+            break;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+ngx_int_t
+ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    u_char                   *p;
+    size_t                    size;
+    ngx_http_v2_hpack_enc_t  *hpack;
+
+    hpack = &h2c->hpack_enc;
+
+    size = 32 + name->len + value->len;
+
+    /*
+     * large fields are not worth indexing: they would evict most of
+     * the table while being unlikely to repeat verbatim
+     */
+
+    if (size > hpack->size / 4) {
+        return NGX_DECLINED;
+    }
+
+    if (hpack->storage == NULL) {
+        hpack->fields = ngx_palloc(h2c->connection->pool,
+                                   sizeof(ngx_http_v2_hpack_field_t)
+                                   * (NGX_HTTP_V2_TABLE_SIZE / 32));
+        if (hpack->fields == NULL) {
+            return NGX_ERROR;
+        }
+
+        hpack->storage = ngx_palloc(h2c->connection->pool,
+                                    NGX_HTTP_V2_TABLE_SIZE);
+        if (hpack->storage == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table insert: \"%V: %V\"", name, value);
+
+    ngx_http_v2_table_evict(h2c, size);
+
+    p = hpack->storage + hpack->len;
+
+    ngx_strlow(p, name->data, name->len);
+    ngx_memcpy(p + name->len, value->data, value->len);
+
+    hpack->fields[hpack->nfields].name_len = name->len;
+    hpack->fields[hpack->nfields].value_len = value->len;
+    hpack->nfields++;
+
+    hpack->len += name->len + value->len;
+    hpack->used += size;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v2_table_update(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    if (size > NGX_HTTP_V2_TABLE_SIZE) {
+        size = NGX_HTTP_V2_TABLE_SIZE;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 new encoder table size: %uz was:%uz",
+                   size, h2c->hpack_enc.size);
+
+    if (size == h2c->hpack_enc.size) {
+        return;
+    }
+
+    h2c->hpack_enc.size = size;
+
+    ngx_http_v2_table_evict(h2c, 0);
+
+    h2c->table_update = 1;
+}
+
+
+void
+ngx_http_v2_table_reset(ngx_http_v2_connection_t *h2c)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 encoder table reset");
+
+    h2c->hpack_enc.nfields = 0;
+    h2c->hpack_enc.len = 0;
+    h2c->hpack_enc.used = 0;
+    h2c->hpack_enc.reset = 1;
+
+    h2c->table_update = 1;
+}
+
+
+static void
+ngx_http_v2_table_evict(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    size_t                      len;
+    ngx_uint_t                  n;
+    ngx_http_v2_hpack_enc_t    *hpack;
+    ngx_http_v2_hpack_field_t  *field;
+
+    hpack = &h2c->hpack_enc;
+
+    len = 0;
+
+    for (n = 0; hpack->used + size > hpack->size; n++) {
+        field = &hpack->fields[n];
+
+        len += field->name_len + field->value_len;
+        hpack->used -= 32 + field->name_len + field->value_len;
+    }
+
+    if (n == 0) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table evict: %ui", n);
+
+    hpack->nfields -= n;
+    hpack->len -= len;
+
+    ngx_memmove(hpack->fields, hpack->fields + n,
+                hpack->nfields * sizeof(ngx_http_v2_hpack_field_t));
+    ngx_memmove(hpack->storage, hpack->storage + len, hpack->len);
+}
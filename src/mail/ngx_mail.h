@@ -171,9 +171,23 @@ typedef enum {
 } ngx_smtp_state_e;
 
 
+#if (NGX_HAVE_SPLICE)
+
+typedef struct {
+    ngx_fd_t                fd[2];
+    size_t                  size;
+} ngx_mail_proxy_pipe_t;
+
+#endif
+
+
 typedef struct {
     ngx_peer_connection_t   upstream;
     ngx_buf_t              *buffer;
+#if (NGX_HAVE_SPLICE)
+    ngx_mail_proxy_pipe_t   pipe[2];
+#endif
+    unsigned                pipelining:1;
 } ngx_mail_proxy_ctx_t;
 
 
@@ -185,6 +199,9 @@ typedef struct {
     ngx_str_t               out;
     ngx_buf_t              *buffer;
 
+    /* responses to pipelined SMTP commands not sent yet */
+    ngx_buf_t              *pipelined;
+
     void                  **ctx;
     void                  **main_conf;
     void                  **srv_conf;
@@ -9,15 +9,63 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 #include <ngx_event_connect.h>
+#include <ngx_md5.h>
 #include <ngx_mail.h>
 
 
+#define NGX_MAIL_AUTH_HTTP_CACHE_FIELDS  4
+
+
+typedef struct {
+    u_char                          color;
+    u_char                          error;
+    u_short                         len[NGX_MAIL_AUTH_HTTP_CACHE_FIELDS];
+    ngx_queue_t                     queue;
+    ngx_msec_t                      expire;
+    time_t                          sleep;
+    u_char                          key[16];
+    u_char                          data[1];
+} ngx_mail_auth_http_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+    ngx_queue_t                     queue;
+} ngx_mail_auth_http_cache_sh_t;
+
+
+typedef struct {
+    ngx_mail_auth_http_cache_sh_t  *sh;
+    ngx_slab_pool_t                *shpool;
+} ngx_mail_auth_http_cache_t;
+
+
+typedef struct ngx_mail_auth_http_conf_s  ngx_mail_auth_http_conf_t;
+
 typedef struct {
+    ngx_queue_t                     queue;
+    ngx_connection_t               *connection;
+    ngx_mail_auth_http_conf_t      *conf;
+} ngx_mail_auth_http_keepalive_t;
+
+
+struct ngx_mail_auth_http_conf_s {
     ngx_addr_t                     *peer;
 
     ngx_msec_t                      timeout;
     ngx_flag_t                      pass_client_cert;
 
+    ngx_uint_t                      keepalive;
+    ngx_msec_t                      keepalive_timeout;
+
+    ngx_queue_t                     cache;
+    ngx_queue_t                     free;
+
+    ngx_shm_zone_t                 *cache_zone;
+    ngx_msec_t                      cache_valid;
+    ngx_msec_t                      cache_invalid;
+
     ngx_str_t                       host_header;
     ngx_str_t                       uri;
     ngx_str_t                       header;
@@ -26,7 +74,7 @@ typedef struct {
 
     u_char                         *file;
     ngx_uint_t                      line;
-} ngx_mail_auth_http_conf_t;
+};
 
 
 typedef struct ngx_mail_auth_http_ctx_s  ngx_mail_auth_http_ctx_t;
@@ -55,22 +103,54 @@ struct ngx_mail_auth_http_ctx_s {
     ngx_str_t                       errcode;
 
     time_t                          sleep;
+    off_t                           content_length;
+
+    uint32_t                        hash;
+    u_char                          key[16];
 
     ngx_pool_t                     *pool;
+
+    unsigned                        keepalive:1;
+    unsigned                        cache:1;
 };
 
 
+static void ngx_mail_auth_http_connect(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_uint_t cached);
+static void ngx_mail_auth_http_retry(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_http_write_handler(ngx_event_t *wev);
 static void ngx_mail_auth_http_read_handler(ngx_event_t *rev);
 static void ngx_mail_auth_http_ignore_status_line(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
+static ngx_int_t ngx_mail_auth_http_set_error(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
+static void ngx_mail_auth_http_done(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_sleep_handler(ngx_event_t *rev);
 static ngx_int_t ngx_mail_auth_http_parse_header_line(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_http_block_read(ngx_event_t *rev);
 static void ngx_mail_auth_http_dummy_handler(ngx_event_t *ev);
+static ngx_int_t ngx_mail_auth_http_get_peer(ngx_mail_auth_http_ctx_t *ctx,
+    ngx_mail_auth_http_conf_t *ahcf);
+static void ngx_mail_auth_http_free_peer(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
+static void ngx_mail_auth_http_keepalive_close_handler(ngx_event_t *ev);
+static ngx_int_t ngx_mail_auth_http_cache_lookup(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_mail_auth_http_conf_t *ahcf);
+static void ngx_mail_auth_http_cache_store(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_uint_t error);
+static ngx_rbtree_node_t *ngx_mail_auth_http_cache_find(
+    ngx_mail_auth_http_cache_t *cache, u_char *key, uint32_t hash);
+static void ngx_mail_auth_http_cache_delete(ngx_mail_auth_http_cache_t *cache,
+    ngx_mail_auth_http_cache_node_t *cn);
+static void ngx_mail_auth_http_cache_expire(ngx_mail_auth_http_cache_t *cache,
+    ngx_uint_t n);
+static ngx_int_t ngx_mail_auth_http_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
 static ngx_buf_t *ngx_mail_auth_http_create_request(ngx_mail_session_t *s,
     ngx_pool_t *pool, ngx_mail_auth_http_conf_t *ahcf);
 static ngx_int_t ngx_mail_auth_http_escape(ngx_pool_t *pool, ngx_str_t *text,
@@ -82,6 +162,8 @@ static char *ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent,
 static char *ngx_mail_auth_http(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_mail_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_mail_auth_http_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_command_t  ngx_mail_auth_http_commands[] = {
@@ -114,6 +196,27 @@ static ngx_command_t  ngx_mail_auth_http_commands[] = {
       offsetof(ngx_mail_auth_http_conf_t, pass_client_cert),
       NULL },
 
+    { ngx_string("auth_http_keepalive"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_auth_http_conf_t, keepalive),
+      NULL },
+
+    { ngx_string("auth_http_keepalive_timeout"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_auth_http_conf_t, keepalive_timeout),
+      NULL },
+
+    { ngx_string("auth_http_cache"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_1MORE,
+      ngx_mail_auth_http_cache,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -182,18 +285,10 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
     }
 
     ctx->pool = pool;
+    ctx->content_length = -1;
 
     ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
 
-    ctx->request = ngx_mail_auth_http_create_request(s, pool, ahcf);
-    if (ctx->request == NULL) {
-        ngx_destroy_pool(ctx->pool);
-        ngx_mail_session_internal_server_error(s);
-        return;
-    }
-
-    ngx_mail_set_ctx(s, ctx, ngx_mail_auth_http_module);
-
     ctx->peer.sockaddr = ahcf->peer->sockaddr;
     ctx->peer.socklen = ahcf->peer->socklen;
     ctx->peer.name = &ahcf->peer->name;
@@ -201,18 +296,62 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
     ctx->peer.log = s->connection->log;
     ctx->peer.log_error = NGX_ERROR_ERR;
 
-    rc = ngx_event_connect_peer(&ctx->peer);
+    if (ahcf->cache_zone) {
+        rc = ngx_mail_auth_http_cache_lookup(s, ctx, ahcf);
 
-    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
-        if (ctx->peer.connection) {
-            ngx_close_connection(ctx->peer.connection);
+        if (rc == NGX_OK) {
+            ngx_mail_auth_http_done(s, ctx);
+            return;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_destroy_pool(ctx->pool);
+            ngx_mail_session_internal_server_error(s);
+            return;
         }
+    }
 
+    ctx->request = ngx_mail_auth_http_create_request(s, pool, ahcf);
+    if (ctx->request == NULL) {
         ngx_destroy_pool(ctx->pool);
         ngx_mail_session_internal_server_error(s);
         return;
     }
 
+    ngx_mail_set_ctx(s, ctx, ngx_mail_auth_http_module);
+
+    ctx->handler = ngx_mail_auth_http_ignore_status_line;
+
+    ngx_mail_auth_http_connect(s, ctx, 1);
+}
+
+
+static void
+ngx_mail_auth_http_connect(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_uint_t cached)
+{
+    ngx_int_t                   rc;
+    ngx_mail_auth_http_conf_t  *ahcf;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    if (cached && ngx_mail_auth_http_get_peer(ctx, ahcf) == NGX_OK) {
+        rc = NGX_OK;
+
+    } else {
+        rc = ngx_event_connect_peer(&ctx->peer);
+
+        if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+            if (ctx->peer.connection) {
+                ngx_close_connection(ctx->peer.connection);
+            }
+
+            ngx_destroy_pool(ctx->pool);
+            ngx_mail_session_internal_server_error(s);
+            return;
+        }
+    }
+
     ctx->peer.connection->data = s;
     ctx->peer.connection->pool = s->connection->pool;
 
@@ -220,8 +359,6 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
     ctx->peer.connection->read->handler = ngx_mail_auth_http_read_handler;
     ctx->peer.connection->write->handler = ngx_mail_auth_http_write_handler;
 
-    ctx->handler = ngx_mail_auth_http_ignore_status_line;
-
     ngx_add_timer(ctx->peer.connection->read, ahcf->timeout);
     ngx_add_timer(ctx->peer.connection->write, ahcf->timeout);
 
@@ -232,6 +369,29 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
 }
 
 
+static void
+ngx_mail_auth_http_retry(ngx_mail_session_t *s, ngx_mail_auth_http_ctx_t *ctx)
+{
+    /*
+     * the auth http server has closed a kept alive connection
+     * before responding, so the request is repeated once
+     * over a new connection
+     */
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http retry");
+
+    ngx_close_connection(ctx->peer.connection);
+
+    ctx->peer.connection = NULL;
+    ctx->peer.cached = 0;
+
+    ctx->request->pos = ctx->request->start;
+
+    ngx_mail_auth_http_connect(s, ctx, 0);
+}
+
+
 static void
 ngx_mail_auth_http_write_handler(ngx_event_t *wev)
 {
@@ -263,6 +423,12 @@ ngx_mail_auth_http_write_handler(ngx_event_t *wev)
     n = ngx_send(c, ctx->request->pos, size);
 
     if (n == NGX_ERROR) {
+
+        if (ctx->peer.cached) {
+            ngx_mail_auth_http_retry(s, ctx);
+            return;
+        }
+
         ngx_close_connection(c);
         ngx_destroy_pool(ctx->pool);
         ngx_mail_session_internal_server_error(s);
@@ -346,6 +512,11 @@ ngx_mail_auth_http_read_handler(ngx_event_t *rev)
         return;
     }
 
+    if (ctx->peer.cached && ctx->response->last == ctx->response->start) {
+        ngx_mail_auth_http_retry(s, ctx);
+        return;
+    }
+
     ngx_close_connection(c);
     ngx_destroy_pool(ctx->pool);
     ngx_mail_session_internal_server_error(s);
@@ -463,11 +634,8 @@ static void
 ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx)
 {
-    u_char      *p;
-    time_t       timer;
-    size_t       len, size;
-    ngx_int_t    rc, port, n;
-    ngx_addr_t  *peer;
+    size_t     len;
+    ngx_int_t  rc, n;
 
     ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
                    "mail auth http process headers");
@@ -522,52 +690,13 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
                 ctx->errmsg.len = len;
                 ctx->errmsg.data = ctx->header_start;
 
-                switch (s->protocol) {
-
-                case NGX_MAIL_POP3_PROTOCOL:
-                    size = sizeof("-ERR ") - 1 + len + sizeof(CRLF) - 1;
-                    break;
-
-                case NGX_MAIL_IMAP_PROTOCOL:
-                    size = s->tag.len + sizeof("NO ") - 1 + len
-                           + sizeof(CRLF) - 1;
-                    break;
-
-                default: /* NGX_MAIL_SMTP_PROTOCOL */
-                    ctx->err = ctx->errmsg;
-                    continue;
-                }
-
-                p = ngx_pnalloc(s->connection->pool, size);
-                if (p == NULL) {
+                if (ngx_mail_auth_http_set_error(s, ctx) != NGX_OK) {
                     ngx_close_connection(ctx->peer.connection);
                     ngx_destroy_pool(ctx->pool);
                     ngx_mail_session_internal_server_error(s);
                     return;
                 }
 
-                ctx->err.data = p;
-
-                switch (s->protocol) {
-
-                case NGX_MAIL_POP3_PROTOCOL:
-                    *p++ = '-'; *p++ = 'E'; *p++ = 'R'; *p++ = 'R'; *p++ = ' ';
-                    break;
-
-                case NGX_MAIL_IMAP_PROTOCOL:
-                    p = ngx_cpymem(p, s->tag.data, s->tag.len);
-                    *p++ = 'N'; *p++ = 'O'; *p++ = ' ';
-                    break;
-
-                default: /* NGX_MAIL_SMTP_PROTOCOL */
-                    break;
-                }
-
-                p = ngx_cpymem(p, ctx->header_start, len);
-                *p++ = CR; *p++ = LF;
-
-                ctx->err.len = p - ctx->err.data;
-
                 continue;
             }
 
@@ -677,6 +806,35 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
                 continue;
             }
 
+            if (len == sizeof("Content-Length") - 1
+                && ngx_strncasecmp(ctx->header_name_start,
+                                   (u_char *) "Content-Length",
+                                   sizeof("Content-Length") - 1)
+                   == 0)
+            {
+                ctx->content_length = ngx_atoof(ctx->header_start,
+                                                ctx->header_end
+                                                - ctx->header_start);
+                continue;
+            }
+
+            if (len == sizeof("Connection") - 1
+                && ngx_strncasecmp(ctx->header_name_start,
+                                   (u_char *) "Connection",
+                                   sizeof("Connection") - 1)
+                   == 0)
+            {
+                len = ctx->header_end - ctx->header_start;
+
+                ctx->keepalive =
+                    (len == sizeof("keep-alive") - 1
+                     && ngx_strncasecmp(ctx->header_start,
+                                        (u_char *) "keep-alive",
+                                        sizeof("keep-alive") - 1)
+                        == 0);
+                continue;
+            }
+
             /* ignore other headers */
 
             continue;
@@ -686,192 +844,267 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
             ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
                            "mail auth http header done");
 
-            ngx_close_connection(ctx->peer.connection);
+            ngx_mail_auth_http_free_peer(s, ctx);
+            ngx_mail_auth_http_done(s, ctx);
 
-            if (ctx->err.len) {
+            return;
+        }
 
-                ngx_log_error(NGX_LOG_INFO, s->connection->log, 0,
-                              "client login failed: \"%V\"", &ctx->errmsg);
+        if (rc == NGX_AGAIN ) {
+            return;
+        }
 
-                if (s->protocol == NGX_MAIL_SMTP_PROTOCOL) {
+        /* rc == NGX_ERROR */
 
-                    if (ctx->errcode.len == 0) {
-                        ctx->errcode = ngx_mail_smtp_errcode;
-                    }
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid header in response",
+                      ctx->peer.name);
+        ngx_close_connection(ctx->peer.connection);
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
 
-                    ctx->err.len = ctx->errcode.len + ctx->errmsg.len
-                                   + sizeof(" " CRLF) - 1;
+        return;
+    }
+}
 
-                    p = ngx_pnalloc(s->connection->pool, ctx->err.len);
-                    if (p == NULL) {
-                        ngx_destroy_pool(ctx->pool);
-                        ngx_mail_session_internal_server_error(s);
-                        return;
-                    }
 
-                    ctx->err.data = p;
+static ngx_int_t
+ngx_mail_auth_http_set_error(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx)
+{
+    u_char  *p;
+    size_t   len, size;
 
-                    p = ngx_cpymem(p, ctx->errcode.data, ctx->errcode.len);
-                    *p++ = ' ';
-                    p = ngx_cpymem(p, ctx->errmsg.data, ctx->errmsg.len);
-                    *p++ = CR; *p = LF;
-                }
+    len = ctx->errmsg.len;
 
-                s->out = ctx->err;
-                timer = ctx->sleep;
+    switch (s->protocol) {
 
-                ngx_destroy_pool(ctx->pool);
+    case NGX_MAIL_POP3_PROTOCOL:
+        size = sizeof("-ERR ") - 1 + len + sizeof(CRLF) - 1;
+        break;
 
-                if (timer == 0) {
-                    s->quit = 1;
-                    ngx_mail_send(s->connection->write);
-                    return;
-                }
+    case NGX_MAIL_IMAP_PROTOCOL:
+        size = s->tag.len + sizeof("NO ") - 1 + len + sizeof(CRLF) - 1;
+        break;
 
-                ngx_add_timer(s->connection->read, (ngx_msec_t) (timer * 1000));
+    default: /* NGX_MAIL_SMTP_PROTOCOL */
+        ctx->err = ctx->errmsg;
+        return NGX_OK;
+    }
 
-                s->connection->read->handler = ngx_mail_auth_sleep_handler;
+    p = ngx_pnalloc(s->connection->pool, size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
 
-                return;
-            }
+    ctx->err.data = p;
 
-            if (s->auth_wait) {
-                timer = ctx->sleep;
+    switch (s->protocol) {
 
-                ngx_destroy_pool(ctx->pool);
+    case NGX_MAIL_POP3_PROTOCOL:
+        *p++ = '-'; *p++ = 'E'; *p++ = 'R'; *p++ = 'R'; *p++ = ' ';
+        break;
 
-                if (timer == 0) {
-                    ngx_mail_auth_http_init(s);
-                    return;
-                }
+    case NGX_MAIL_IMAP_PROTOCOL:
+        p = ngx_cpymem(p, s->tag.data, s->tag.len);
+        *p++ = 'N'; *p++ = 'O'; *p++ = ' ';
+        break;
 
-                ngx_add_timer(s->connection->read, (ngx_msec_t) (timer * 1000));
+    default: /* NGX_MAIL_SMTP_PROTOCOL */
+        break;
+    }
 
-                s->connection->read->handler = ngx_mail_auth_sleep_handler;
+    p = ngx_cpymem(p, ctx->errmsg.data, len);
+    *p++ = CR; *p++ = LF;
 
-                return;
-            }
+    ctx->err.len = p - ctx->err.data;
 
-            if (ctx->addr.len == 0 || ctx->port.len == 0) {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V did not send server or port",
-                              ctx->peer.name);
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
+    return NGX_OK;
+}
 
-            if (s->passwd.data == NULL
-                && s->protocol != NGX_MAIL_SMTP_PROTOCOL)
-            {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V did not send password",
-                              ctx->peer.name);
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
 
-            peer = ngx_pcalloc(s->connection->pool, sizeof(ngx_addr_t));
-            if (peer == NULL) {
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
+static void
+ngx_mail_auth_http_done(ngx_mail_session_t *s, ngx_mail_auth_http_ctx_t *ctx)
+{
+    u_char      *p;
+    time_t       timer;
+    size_t       len;
+    ngx_int_t    rc, port;
+    ngx_addr_t  *peer;
 
-            rc = ngx_parse_addr(s->connection->pool, peer,
-                                ctx->addr.data, ctx->addr.len);
+    if (ctx->err.len) {
 
-            switch (rc) {
-            case NGX_OK:
-                break;
+        ngx_log_error(NGX_LOG_INFO, s->connection->log, 0,
+                      "client login failed: \"%V\"", &ctx->errmsg);
 
-            case NGX_DECLINED:
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V sent invalid server "
-                              "address:\"%V\"",
-                              ctx->peer.name, &ctx->addr);
-                /* fall through */
+        if (ctx->cache) {
+            ngx_mail_auth_http_cache_store(s, ctx, 1);
+        }
 
-            default:
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
+        if (s->protocol == NGX_MAIL_SMTP_PROTOCOL) {
+
+            if (ctx->errcode.len == 0) {
+                ctx->errcode = ngx_mail_smtp_errcode;
             }
 
-            port = ngx_atoi(ctx->port.data, ctx->port.len);
-            if (port == NGX_ERROR || port < 1 || port > 65535) {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V sent invalid server "
-                              "port:\"%V\"",
-                              ctx->peer.name, &ctx->port);
+            ctx->err.len = ctx->errcode.len + ctx->errmsg.len
+                           + sizeof(" " CRLF) - 1;
+
+            p = ngx_pnalloc(s->connection->pool, ctx->err.len);
+            if (p == NULL) {
                 ngx_destroy_pool(ctx->pool);
                 ngx_mail_session_internal_server_error(s);
                 return;
             }
 
-            ngx_inet_set_port(peer->sockaddr, (in_port_t) port);
+            ctx->err.data = p;
 
-            len = ctx->addr.len + 1 + ctx->port.len;
+            p = ngx_cpymem(p, ctx->errcode.data, ctx->errcode.len);
+            *p++ = ' ';
+            p = ngx_cpymem(p, ctx->errmsg.data, ctx->errmsg.len);
+            *p++ = CR; *p = LF;
+        }
 
-            peer->name.len = len;
+        s->out = ctx->err;
+        timer = ctx->sleep;
 
-            peer->name.data = ngx_pnalloc(s->connection->pool, len);
-            if (peer->name.data == NULL) {
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
+        ngx_destroy_pool(ctx->pool);
 
-            len = ctx->addr.len;
+        if (timer == 0) {
+            s->quit = 1;
+            ngx_mail_send(s->connection->write);
+            return;
+        }
 
-            ngx_memcpy(peer->name.data, ctx->addr.data, len);
+        ngx_add_timer(s->connection->read, (ngx_msec_t) (timer * 1000));
 
-            peer->name.data[len++] = ':';
+        s->connection->read->handler = ngx_mail_auth_sleep_handler;
 
-            ngx_memcpy(peer->name.data + len, ctx->port.data, ctx->port.len);
+        return;
+    }
 
-            ngx_destroy_pool(ctx->pool);
-            ngx_mail_proxy_init(s, peer);
+    if (s->auth_wait) {
+        timer = ctx->sleep;
 
-            return;
-        }
+        ngx_destroy_pool(ctx->pool);
 
-        if (rc == NGX_AGAIN ) {
+        if (timer == 0) {
+            ngx_mail_auth_http_init(s);
             return;
         }
 
-        /* rc == NGX_ERROR */
+        ngx_add_timer(s->connection->read, (ngx_msec_t) (timer * 1000));
+
+        s->connection->read->handler = ngx_mail_auth_sleep_handler;
+
+        return;
+    }
 
+    if (ctx->addr.len == 0 || ctx->port.len == 0) {
         ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                      "auth http server %V sent invalid header in response",
+                      "auth http server %V did not send server or port",
                       ctx->peer.name);
-        ngx_close_connection(ctx->peer.connection);
         ngx_destroy_pool(ctx->pool);
         ngx_mail_session_internal_server_error(s);
-
         return;
     }
-}
 
+    if (s->passwd.data == NULL
+        && s->protocol != NGX_MAIL_SMTP_PROTOCOL)
+    {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V did not send password",
+                      ctx->peer.name);
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
 
-static void
-ngx_mail_auth_sleep_handler(ngx_event_t *rev)
-{
-    ngx_connection_t          *c;
-    ngx_mail_session_t        *s;
-    ngx_mail_core_srv_conf_t  *cscf;
+    peer = ngx_pcalloc(s->connection->pool, sizeof(ngx_addr_t));
+    if (peer == NULL) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, rev->log, 0, "mail auth sleep handler");
+    rc = ngx_parse_addr(s->connection->pool, peer,
+                        ctx->addr.data, ctx->addr.len);
 
-    c = rev->data;
-    s = c->data;
+    switch (rc) {
+    case NGX_OK:
+        break;
 
-    if (rev->timedout) {
+    case NGX_DECLINED:
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid server "
+                      "address:\"%V\"",
+                      ctx->peer.name, &ctx->addr);
+        /* fall through */
 
-        rev->timedout = 0;
+    default:
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
 
-        if (s->auth_wait) {
+    port = ngx_atoi(ctx->port.data, ctx->port.len);
+    if (port == NGX_ERROR || port < 1 || port > 65535) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid server "
+                      "port:\"%V\"",
+                      ctx->peer.name, &ctx->port);
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
+
+    ngx_inet_set_port(peer->sockaddr, (in_port_t) port);
+
+    len = ctx->addr.len + 1 + ctx->port.len;
+
+    peer->name.len = len;
+
+    peer->name.data = ngx_pnalloc(s->connection->pool, len);
+    if (peer->name.data == NULL) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
+
+    len = ctx->addr.len;
+
+    ngx_memcpy(peer->name.data, ctx->addr.data, len);
+
+    peer->name.data[len++] = ':';
+
+    ngx_memcpy(peer->name.data + len, ctx->port.data, ctx->port.len);
+
+    if (ctx->cache) {
+        ngx_mail_auth_http_cache_store(s, ctx, 0);
+    }
+
+    ngx_destroy_pool(ctx->pool);
+    ngx_mail_proxy_init(s, peer);
+}
+
+
+static void
+ngx_mail_auth_sleep_handler(ngx_event_t *rev)
+{
+    ngx_connection_t          *c;
+    ngx_mail_session_t        *s;
+    ngx_mail_core_srv_conf_t  *cscf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, rev->log, 0, "mail auth sleep handler");
+
+    c = rev->data;
+    s = c->data;
+
+    if (rev->timedout) {
+
+        rev->timedout = 0;
+
+        if (s->auth_wait) {
             s->auth_wait = 0;
             ngx_mail_auth_http_init(s);
             return;
@@ -1128,6 +1361,170 @@ ngx_mail_auth_http_dummy_handler(ngx_event_t *ev)
 }
 
 
+static ngx_int_t
+ngx_mail_auth_http_get_peer(ngx_mail_auth_http_ctx_t *ctx,
+    ngx_mail_auth_http_conf_t *ahcf)
+{
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_mail_auth_http_keepalive_t  *item;
+
+    if (ngx_queue_empty(&ahcf->cache)) {
+        return NGX_DECLINED;
+    }
+
+    q = ngx_queue_head(&ahcf->cache);
+    ngx_queue_remove(q);
+
+    item = ngx_queue_data(q, ngx_mail_auth_http_keepalive_t, queue);
+
+    ngx_queue_insert_head(&ahcf->free, q);
+
+    c = item->connection;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    c->idle = 0;
+    c->log = ctx->peer.log;
+    c->read->log = ctx->peer.log;
+    c->write->log = ctx->peer.log;
+
+    ctx->peer.connection = c;
+    ctx->peer.cached = 1;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, c->log, 0,
+                   "mail auth http get keepalive connection %p", c);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_mail_auth_http_free_peer(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx)
+{
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_mail_auth_http_conf_t       *ahcf;
+    ngx_mail_auth_http_keepalive_t  *item;
+
+    c = ctx->peer.connection;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    /*
+     * the connection is kept only if the server agreed to keep it alive
+     * and the response body, if any, has been read completely
+     */
+
+    if (ahcf->keepalive == 0
+        || !ctx->keepalive
+        || ctx->content_length
+           != (off_t) (ctx->response->last - ctx->response->pos)
+        || c->read->eof
+        || c->read->error
+        || c->error)
+    {
+        ngx_close_connection(c);
+        return;
+    }
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        return;
+    }
+
+    if (ngx_queue_empty(&ahcf->free)) {
+
+        q = ngx_queue_last(&ahcf->cache);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_mail_auth_http_keepalive_t, queue);
+
+        ngx_close_connection(item->connection);
+
+    } else {
+        q = ngx_queue_head(&ahcf->free);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_mail_auth_http_keepalive_t, queue);
+    }
+
+    ngx_queue_insert_head(&ahcf->cache, q);
+
+    item->connection = c;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http free keepalive connection %p", c);
+
+    ngx_add_timer(c->read, ahcf->keepalive_timeout);
+
+    c->write->handler = ngx_mail_auth_http_dummy_handler;
+    c->read->handler = ngx_mail_auth_http_keepalive_close_handler;
+
+    c->data = item;
+    c->idle = 1;
+    c->pool = NULL;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+
+    if (c->read->ready) {
+        ngx_mail_auth_http_keepalive_close_handler(c->read);
+    }
+}
+
+
+static void
+ngx_mail_auth_http_keepalive_close_handler(ngx_event_t *ev)
+{
+    int                              n;
+    char                             buf[1];
+    ngx_connection_t                *c;
+    ngx_mail_auth_http_keepalive_t  *item;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, ev->log, 0,
+                   "mail auth http keepalive close handler");
+
+    c = ev->data;
+
+    if (c->close || c->read->timedout) {
+        goto close;
+    }
+
+    n = recv(c->fd, buf, 1, MSG_PEEK);
+
+    if (n == -1 && ngx_socket_errno == NGX_EAGAIN) {
+        ev->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            goto close;
+        }
+
+        return;
+    }
+
+close:
+
+    item = c->data;
+
+    ngx_close_connection(c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&item->conf->free, &item->queue);
+}
+
+
 static ngx_buf_t *
 ngx_mail_auth_http_create_request(ngx_mail_session_t *s, ngx_pool_t *pool,
     ngx_mail_auth_http_conf_t *ahcf)
@@ -1211,6 +1608,7 @@ ngx_mail_auth_http_create_request(ngx_mail_session_t *s, ngx_pool_t *pool,
 
     len = sizeof("GET ") - 1 + ahcf->uri.len + sizeof(" HTTP/1.0" CRLF) - 1
           + sizeof("Host: ") - 1 + ahcf->host_header.len + sizeof(CRLF) - 1
+          + sizeof("Connection: keep-alive" CRLF) - 1
           + sizeof("Auth-Method: ") - 1
                 + ngx_mail_auth_http_method[s->auth_method].len
                 + sizeof(CRLF) - 1
@@ -1255,6 +1653,11 @@ ngx_mail_auth_http_create_request(ngx_mail_session_t *s, ngx_pool_t *pool,
                          ahcf->host_header.len);
     *b->last++ = CR; *b->last++ = LF;
 
+    if (ahcf->keepalive) {
+        b->last = ngx_cpymem(b->last, "Connection: keep-alive" CRLF,
+                             sizeof("Connection: keep-alive" CRLF) - 1);
+    }
+
     b->last = ngx_cpymem(b->last, "Auth-Method: ",
                          sizeof("Auth-Method: ") - 1);
     b->last = ngx_cpymem(b->last,
@@ -1415,6 +1818,433 @@ ngx_mail_auth_http_escape(ngx_pool_t *pool, ngx_str_t *text, ngx_str_t *escaped)
 }
 
 
+static ngx_int_t
+ngx_mail_auth_http_cache_lookup(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_mail_auth_http_conf_t *ahcf)
+{
+    u_char                           *p, buf[2];
+    ngx_md5_t                         md5;
+    ngx_str_t                        *f[NGX_MAIL_AUTH_HTTP_CACHE_FIELDS];
+    ngx_uint_t                        i, n;
+    ngx_connection_t                 *c;
+    ngx_rbtree_node_t                *node;
+    ngx_mail_auth_http_cache_t       *cache;
+    ngx_mail_auth_http_cache_node_t  *cn;
+
+    /*
+     * only plain text credentials are cached; a challenge based response
+     * is unique to the session, and an SMTP session without authentication
+     * is authorized by its envelope
+     */
+
+    switch (s->auth_method) {
+
+    case NGX_MAIL_AUTH_PLAIN:
+    case NGX_MAIL_AUTH_LOGIN:
+    case NGX_MAIL_AUTH_LOGIN_USERNAME:
+        break;
+
+    default:
+        return NGX_DECLINED;
+    }
+
+    c = s->connection;
+
+    buf[0] = (u_char) s->protocol;
+    buf[1] = (u_char) s->auth_method;
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, buf, 2);
+    ngx_md5_update(&md5, c->local_sockaddr, c->local_socklen);
+    ngx_md5_update(&md5, s->login.data, s->login.len);
+    ngx_md5_update(&md5, "", 1);
+    ngx_md5_update(&md5, s->passwd.data, s->passwd.len);
+    ngx_md5_final(ctx->key, &md5);
+
+    ctx->hash = ngx_crc32_short(ctx->key, 16);
+    ctx->cache = 1;
+
+    cache = ahcf->cache_zone->data;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = ngx_mail_auth_http_cache_find(cache, ctx->key, ctx->hash);
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_MAIL, c->log, 0,
+                       "mail auth http cache: %08XD miss", ctx->hash);
+        return NGX_DECLINED;
+    }
+
+    cn = (ngx_mail_auth_http_cache_node_t *) &node->color;
+
+    if ((ngx_msec_int_t) (cn->expire - ngx_current_msec) <= 0) {
+        ngx_mail_auth_http_cache_delete(cache, cn);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_MAIL, c->log, 0,
+                       "mail auth http cache: %08XD expired", ctx->hash);
+        return NGX_DECLINED;
+    }
+
+    n = 0;
+
+    for (i = 0; i < NGX_MAIL_AUTH_HTTP_CACHE_FIELDS; i++) {
+        n += cn->len[i];
+    }
+
+    p = ngx_pnalloc(c->pool, n);
+    if (p == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, cn->data, n);
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    if (cn->error) {
+        f[0] = &ctx->errmsg;
+        f[1] = &ctx->errcode;
+        f[2] = NULL;
+        f[3] = NULL;
+
+        ctx->sleep = cn->sleep;
+
+    } else {
+        f[0] = &ctx->addr;
+        f[1] = &ctx->port;
+        f[2] = &s->login;
+        f[3] = &s->passwd;
+    }
+
+    for (i = 0; i < NGX_MAIL_AUTH_HTTP_CACHE_FIELDS; i++) {
+        if (f[i]) {
+            f[i]->len = cn->len[i];
+            f[i]->data = p;
+        }
+
+        p += cn->len[i];
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_MAIL, c->log, 0,
+                   "mail auth http cache: %08XD hit, error:%d",
+                   ctx->hash, ctx->errmsg.len != 0);
+
+    ctx->cache = 0;
+
+    if (ctx->errmsg.len) {
+        return ngx_mail_auth_http_set_error(s, ctx);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_mail_auth_http_cache_store(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_uint_t error)
+{
+    u_char                           *p;
+    size_t                            n;
+    ngx_str_t                        *f[NGX_MAIL_AUTH_HTTP_CACHE_FIELDS];
+    ngx_uint_t                        i;
+    ngx_msec_t                        valid;
+    ngx_rbtree_node_t                *node;
+    ngx_mail_auth_http_conf_t        *ahcf;
+    ngx_mail_auth_http_cache_t       *cache;
+    ngx_mail_auth_http_cache_node_t  *cn;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    if (error) {
+        valid = ahcf->cache_invalid;
+
+        f[0] = &ctx->errmsg;
+        f[1] = &ctx->errcode;
+        f[2] = NULL;
+        f[3] = NULL;
+
+    } else {
+        valid = ahcf->cache_valid;
+
+        f[0] = &ctx->addr;
+        f[1] = &ctx->port;
+        f[2] = &s->login;
+        f[3] = &s->passwd;
+    }
+
+    if (valid == 0) {
+        return;
+    }
+
+    n = 0;
+
+    for (i = 0; i < NGX_MAIL_AUTH_HTTP_CACHE_FIELDS; i++) {
+        if (f[i]) {
+            if (f[i]->len > 0xffff) {
+                return;
+            }
+
+            n += f[i]->len;
+        }
+    }
+
+    n += offsetof(ngx_rbtree_node_t, color)
+         + offsetof(ngx_mail_auth_http_cache_node_t, data);
+
+    cache = ahcf->cache_zone->data;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = ngx_mail_auth_http_cache_find(cache, ctx->key, ctx->hash);
+
+    if (node) {
+        /* stored by a concurrent session */
+        cn = (ngx_mail_auth_http_cache_node_t *) &node->color;
+        ngx_mail_auth_http_cache_delete(cache, cn);
+    }
+
+    ngx_mail_auth_http_cache_expire(cache, 1);
+
+    node = ngx_slab_alloc_locked(cache->shpool, n);
+
+    if (node == NULL) {
+        ngx_mail_auth_http_cache_expire(cache, 0);
+
+        node = ngx_slab_alloc_locked(cache->shpool, n);
+        if (node == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                           "mail auth http cache: %08XD not stored",
+                           ctx->hash);
+            return;
+        }
+    }
+
+    cn = (ngx_mail_auth_http_cache_node_t *) &node->color;
+
+    node->key = ctx->hash;
+    cn->error = (u_char) error;
+    cn->expire = ngx_current_msec + valid;
+    cn->sleep = ctx->sleep;
+
+    ngx_memcpy(cn->key, ctx->key, 16);
+
+    p = cn->data;
+
+    for (i = 0; i < NGX_MAIL_AUTH_HTTP_CACHE_FIELDS; i++) {
+        if (f[i] == NULL) {
+            cn->len[i] = 0;
+            continue;
+        }
+
+        cn->len[i] = (u_short) f[i]->len;
+        p = ngx_cpymem(p, f[i]->data, f[i]->len);
+    }
+
+    ngx_rbtree_insert(&cache->sh->rbtree, node);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http cache: %08XD stored, error:%ui",
+                   ctx->hash, error);
+}
+
+
+static void
+ngx_mail_auth_http_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t                **p;
+    ngx_mail_auth_http_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_mail_auth_http_cache_node_t *) &node->color;
+            cnt = (ngx_mail_auth_http_cache_node_t *) &temp->color;
+
+            p = (ngx_memcmp(cn->key, cnt->key, 16) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_rbtree_node_t *
+ngx_mail_auth_http_cache_find(ngx_mail_auth_http_cache_t *cache, u_char *key,
+    uint32_t hash)
+{
+    ngx_int_t                         rc;
+    ngx_rbtree_node_t                *node, *sentinel;
+    ngx_mail_auth_http_cache_node_t  *cn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        cn = (ngx_mail_auth_http_cache_node_t *) &node->color;
+
+        rc = ngx_memcmp(key, cn->key, 16);
+
+        if (rc == 0) {
+            return node;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_mail_auth_http_cache_delete(ngx_mail_auth_http_cache_t *cache,
+    ngx_mail_auth_http_cache_node_t *cn)
+{
+    ngx_rbtree_node_t  *node;
+
+    node = (ngx_rbtree_node_t *)
+               ((u_char *) cn - offsetof(ngx_rbtree_node_t, color));
+
+    ngx_queue_remove(&cn->queue);
+    ngx_rbtree_delete(&cache->sh->rbtree, node);
+    ngx_slab_free_locked(cache->shpool, node);
+}
+
+
+static void
+ngx_mail_auth_http_cache_expire(ngx_mail_auth_http_cache_t *cache,
+    ngx_uint_t n)
+{
+    ngx_queue_t                      *q;
+    ngx_mail_auth_http_cache_node_t  *cn;
+
+    /*
+     * n == 1 deletes one or two expired entries at most,
+     * n == 0 deletes the least recently used entry and then one or two
+     * expired ones
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        cn = ngx_queue_data(q, ngx_mail_auth_http_cache_node_t, queue);
+
+        if (n++ != 0
+            && (ngx_msec_int_t) (cn->expire - ngx_current_msec) > 0)
+        {
+            return;
+        }
+
+        ngx_mail_auth_http_cache_delete(cache, cn);
+    }
+}
+
+
+static ngx_int_t
+ngx_mail_auth_http_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_mail_auth_http_cache_t  *ocache = data;
+
+    size_t                       len;
+    ngx_mail_auth_http_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_mail_auth_http_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_mail_auth_http_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in auth_http_cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in auth_http_cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* a full zone evicts entries */
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_mail_auth_http_create_conf(ngx_conf_t *cf)
 {
@@ -1427,6 +2257,9 @@ ngx_mail_auth_http_create_conf(ngx_conf_t *cf)
 
     ahcf->timeout = NGX_CONF_UNSET_MSEC;
     ahcf->pass_client_cert = NGX_CONF_UNSET;
+    ahcf->keepalive = NGX_CONF_UNSET_UINT;
+    ahcf->keepalive_timeout = NGX_CONF_UNSET_MSEC;
+    ahcf->cache_zone = NGX_CONF_UNSET_PTR;
 
     ahcf->file = cf->conf_file->file.name.data;
     ahcf->line = cf->conf_file->line;
@@ -1441,10 +2274,11 @@ ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_mail_auth_http_conf_t *prev = parent;
     ngx_mail_auth_http_conf_t *conf = child;
 
-    u_char           *p;
-    size_t            len;
-    ngx_uint_t        i;
-    ngx_table_elt_t  *header;
+    u_char                          *p;
+    size_t                           len;
+    ngx_uint_t                       i;
+    ngx_table_elt_t                 *header;
+    ngx_mail_auth_http_keepalive_t  *item;
 
     if (conf->peer == NULL) {
         conf->peer = prev->peer;
@@ -1464,6 +2298,36 @@ ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->pass_client_cert, prev->pass_client_cert, 0);
 
+    ngx_conf_merge_uint_value(conf->keepalive, prev->keepalive, 0);
+    ngx_conf_merge_msec_value(conf->keepalive_timeout,
+                              prev->keepalive_timeout, 60000);
+
+    ngx_queue_init(&conf->cache);
+    ngx_queue_init(&conf->free);
+
+    if (conf->keepalive) {
+        item = ngx_pcalloc(cf->pool, conf->keepalive
+                                     * sizeof(ngx_mail_auth_http_keepalive_t));
+        if (item == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < conf->keepalive; i++) {
+            ngx_queue_insert_head(&conf->free, &item[i].queue);
+            item[i].conf = conf;
+        }
+    }
+
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_zone = prev->cache_zone;
+        conf->cache_valid = prev->cache_valid;
+        conf->cache_invalid = prev->cache_invalid;
+    }
+
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_zone = NULL;
+    }
+
     if (conf->headers == NULL) {
         conf->headers = prev->headers;
         conf->header = prev->header;
@@ -1572,3 +2436,142 @@ ngx_mail_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_mail_auth_http_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_mail_auth_http_conf_t *ahcf = conf;
+
+    u_char                      *p;
+    ssize_t                      size;
+    ngx_str_t                   *value, name, s;
+    ngx_uint_t                   i;
+    ngx_msec_t                   valid, invalid;
+    ngx_shm_zone_t              *shm_zone;
+    ngx_mail_auth_http_cache_t  *cache;
+
+    if (ahcf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "takes no parameters with \"off\"";
+        }
+
+        ahcf->cache_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    size = 0;
+    name.len = 0;
+    valid = 10000;
+    invalid = 10000;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            valid = ngx_parse_time(&s, 0);
+
+            if (valid == (ngx_msec_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid valid value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "invalid=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            invalid = ngx_parse_time(&s, 0);
+
+            if (invalid == (ngx_msec_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid invalid value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_mail_auth_http_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data == NULL) {
+        cache = ngx_pcalloc(cf->pool, sizeof(ngx_mail_auth_http_cache_t));
+        if (cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        shm_zone->init = ngx_mail_auth_http_cache_init_zone;
+        shm_zone->data = cache;
+    }
+
+    ahcf->cache_zone = shm_zone;
+    ahcf->cache_valid = valid;
+    ahcf->cache_invalid = invalid;
+
+    return NGX_CONF_OK;
+}
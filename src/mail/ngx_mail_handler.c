@@ -710,6 +710,19 @@ ngx_mail_read_command(ngx_mail_session_t *s, ngx_connection_t *c)
     ngx_str_t                  l;
     ngx_mail_core_srv_conf_t  *cscf;
 
+    cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
+
+    if (s->buffer->pos < s->buffer->last) {
+
+        /* a pipelined command may be already buffered */
+
+        rc = cscf->protocol->parse_command(s);
+
+        if (rc != NGX_AGAIN) {
+            goto parsed;
+        }
+    }
+
     n = c->recv(c, s->buffer->last, s->buffer->end - s->buffer->last);
 
     if (n == NGX_ERROR || n == 0) {
@@ -732,8 +745,6 @@ ngx_mail_read_command(ngx_mail_session_t *s, ngx_connection_t *c)
         }
     }
 
-    cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
-
     rc = cscf->protocol->parse_command(s);
 
     if (rc == NGX_AGAIN) {
@@ -753,6 +764,8 @@ ngx_mail_read_command(ngx_mail_session_t *s, ngx_connection_t *c)
         return NGX_MAIL_PARSE_INVALID_COMMAND;
     }
 
+parsed:
+
     if (rc == NGX_IMAP_NEXT || rc == NGX_MAIL_PARSE_INVALID_COMMAND) {
         return rc;
     }
@@ -16,11 +16,17 @@ typedef struct {
     ngx_flag_t  enable;
     ngx_flag_t  pass_error_message;
     ngx_flag_t  xclient;
+    ngx_flag_t  splice;
     size_t      buffer_size;
     ngx_msec_t  timeout;
 } ngx_mail_proxy_conf_t;
 
 
+#if (NGX_HAVE_SPLICE)
+#define NGX_MAIL_PROXY_SPLICE_SIZE  65536
+#endif
+
+
 static void ngx_mail_proxy_block_read(ngx_event_t *rev);
 static void ngx_mail_proxy_pop3_handler(ngx_event_t *rev);
 static void ngx_mail_proxy_imap_handler(ngx_event_t *rev);
@@ -28,7 +34,14 @@ static void ngx_mail_proxy_smtp_handler(ngx_event_t *rev);
 static void ngx_mail_proxy_dummy_handler(ngx_event_t *ev);
 static ngx_int_t ngx_mail_proxy_read_response(ngx_mail_session_t *s,
     ngx_uint_t state);
+static u_char *ngx_mail_proxy_smtp_reply_end(u_char *p, u_char *last);
+static ngx_uint_t ngx_mail_proxy_smtp_pipelining(ngx_buf_t *b);
 static void ngx_mail_proxy_handler(ngx_event_t *ev);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_mail_proxy_splice(ngx_mail_session_t *s,
+    ngx_connection_t *src, ngx_connection_t *dst, ngx_buf_t *b);
+static void ngx_mail_proxy_splice_cleanup(void *data);
+#endif
 static void ngx_mail_proxy_upstream_error(ngx_mail_session_t *s);
 static void ngx_mail_proxy_internal_server_error(ngx_mail_session_t *s);
 static void ngx_mail_proxy_close_session(ngx_mail_session_t *s);
@@ -74,6 +87,13 @@ static ngx_command_t  ngx_mail_proxy_commands[] = {
       offsetof(ngx_mail_proxy_conf_t, xclient),
       NULL },
 
+    { ngx_string("proxy_splice"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_proxy_conf_t, splice),
+      NULL },
+
       ngx_null_command
 };
 
@@ -128,6 +148,13 @@ ngx_mail_proxy_init(ngx_mail_session_t *s, ngx_addr_t *peer)
 
     s->proxy = p;
 
+#if (NGX_HAVE_SPLICE)
+    p->pipe[0].fd[0] = NGX_INVALID_FILE;
+    p->pipe[0].fd[1] = NGX_INVALID_FILE;
+    p->pipe[1].fd[0] = NGX_INVALID_FILE;
+    p->pipe[1].fd[1] = NGX_INVALID_FILE;
+#endif
+
     p->upstream.sockaddr = peer->sockaddr;
     p->upstream.socklen = peer->socklen;
     p->upstream.name = &peer->name;
@@ -607,7 +634,19 @@ ngx_mail_proxy_smtp_handler(ngx_event_t *rev)
 
         s->connection->log->action = "sending MAIL FROM to upstream";
 
+        if (s->mail_state == ngx_smtp_helo_from
+            && ngx_mail_proxy_smtp_pipelining(s->proxy->buffer))
+        {
+            /* RFC 2920, MAIL FROM and RCPT TO are sent together */
+            s->proxy->pipelining = 1;
+        }
+
         line.len = s->smtp_from.len + sizeof(CRLF) - 1;
+
+        if (s->proxy->pipelining) {
+            line.len += s->smtp_to.len + sizeof(CRLF) - 1;
+        }
+
         line.data = ngx_pnalloc(c->pool, line.len);
         if (line.data == NULL) {
             ngx_mail_proxy_internal_server_error(s);
@@ -615,13 +654,42 @@ ngx_mail_proxy_smtp_handler(ngx_event_t *rev)
         }
 
         p = ngx_cpymem(line.data, s->smtp_from.data, s->smtp_from.len);
-        *p++ = CR; *p = LF;
+        *p++ = CR; *p++ = LF;
+
+        if (s->proxy->pipelining) {
+            p = ngx_cpymem(p, s->smtp_to.data, s->smtp_to.len);
+            *p++ = CR; *p++ = LF;
+        }
 
         s->mail_state = ngx_smtp_from;
 
         break;
 
     case ngx_smtp_from:
+
+        if (s->proxy->pipelining) {
+
+            /*
+             * RCPT TO has been sent already, its reply follows
+             * the reply to MAIL FROM in the buffer
+             */
+
+            b = s->proxy->buffer;
+
+            p = ngx_mail_proxy_smtp_reply_end(b->pos, b->last);
+
+            b->last = ngx_movemem(b->start, p, b->last - p);
+            b->pos = b->start;
+
+            s->mail_state = ngx_smtp_to;
+
+            if (ngx_mail_proxy_smtp_reply_end(b->pos, b->last) == NULL) {
+                return;
+            }
+
+            goto to;
+        }
+
         ngx_log_debug0(NGX_LOG_DEBUG_MAIL, rev->log, 0,
                        "mail proxy send rcpt to");
 
@@ -645,6 +713,8 @@ ngx_mail_proxy_smtp_handler(ngx_event_t *rev)
     case ngx_smtp_xclient:
     case ngx_smtp_to:
 
+    to:
+
         b = s->proxy->buffer;
 
         if (s->auth_method == NGX_MAIL_AUTH_NONE) {
@@ -854,25 +924,94 @@ ngx_mail_proxy_read_response(ngx_mail_session_t *s, ngx_uint_t state)
         return NGX_ERROR;
     }
 
-    s->out.len = b->last - p - 2;
+    m = b->last;
+
+    if (s->protocol == NGX_MAIL_SMTP_PROTOCOL && s->proxy->pipelining) {
+
+        /* the replies to the following pipelined commands are not passed */
+
+        m = ngx_mail_proxy_smtp_reply_end(p, b->last);
+
+        if (m == NULL) {
+            return NGX_AGAIN;
+        }
+    }
+
+    s->out.len = m - p - 2;
     s->out.data = p;
 
     ngx_log_error(NGX_LOG_INFO, s->connection->log, 0,
                   "upstream sent invalid response: \"%V\"", &s->out);
 
-    s->out.len = b->last - b->pos;
+    s->out.len = m - b->pos;
     s->out.data = b->pos;
 
     return NGX_ERROR;
 }
 
 
+static u_char *
+ngx_mail_proxy_smtp_reply_end(u_char *p, u_char *last)
+{
+    u_char  *line;
+
+    /* returns the end of the first complete, possibly multiline, reply */
+
+    for ( ;; ) {
+        line = p;
+
+        p = ngx_strlchr(p, last, LF);
+
+        if (p == NULL) {
+            return NULL;
+        }
+
+        p++;
+
+        if (p - line < 5 || line[3] != '-') {
+            return p;
+        }
+    }
+}
+
+
+static ngx_uint_t
+ngx_mail_proxy_smtp_pipelining(ngx_buf_t *b)
+{
+    u_char  *p, *last;
+
+    /* looks for the PIPELINING extension in the EHLO reply */
+
+    for (p = b->pos; p < b->last; p = last + 1) {
+
+        last = ngx_strlchr(p, b->last, LF);
+
+        if (last == NULL) {
+            return 0;
+        }
+
+        if (last - p >= (ssize_t) sizeof("250-PIPELINING") - 1
+            && ngx_strncasecmp(p + 4, (u_char *) "PIPELINING",
+                               sizeof("PIPELINING") - 1)
+               == 0
+            && (last - p == sizeof("250-PIPELINING") - 1
+                || p[4 + sizeof("PIPELINING") - 1] == CR))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
 static void
 ngx_mail_proxy_handler(ngx_event_t *ev)
 {
     char                   *action, *recv_action, *send_action;
     size_t                  size;
     ssize_t                 n;
+    ngx_int_t               rc;
     ngx_buf_t              *b;
     ngx_uint_t              do_write;
     ngx_connection_t       *c, *src, *dst;
@@ -941,7 +1080,26 @@ ngx_mail_proxy_handler(ngx_event_t *ev)
                    "mail proxy handler: %ui, #%d > #%d",
                    do_write, src->fd, dst->fd);
 
-    for ( ;; ) {
+    pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
+
+    rc = NGX_DECLINED;
+
+#if (NGX_HAVE_SPLICE)
+
+    if (pcf->splice) {
+        c->log->action = send_action;
+
+        rc = ngx_mail_proxy_splice(s, src, dst, b);
+
+        if (rc == NGX_ERROR) {
+            ngx_mail_proxy_close_session(s);
+            return;
+        }
+    }
+
+#endif
+
+    while (rc == NGX_DECLINED) {
 
         if (do_write) {
 
@@ -1032,12 +1190,171 @@ ngx_mail_proxy_handler(ngx_event_t *ev)
     }
 
     if (c == s->connection) {
-        pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
         ngx_add_timer(c->read, pcf->timeout);
     }
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_mail_proxy_splice(ngx_mail_session_t *s, ngx_connection_t *src,
+    ngx_connection_t *dst, ngx_buf_t *b)
+{
+    ssize_t                 n;
+    ngx_err_t               err;
+    ngx_pool_cleanup_t     *cln;
+    ngx_mail_proxy_pipe_t  *pp;
+
+#if (NGX_MAIL_SSL)
+
+    /*
+     * encrypted data can only be spliced to a connection
+     * with kernel TLS for sending
+     */
+
+    if (src->ssl || (dst->ssl && !dst->ssl->sendfile)) {
+        return NGX_DECLINED;
+    }
+
+#endif
+
+    pp = &s->proxy->pipe[src == s->proxy->upstream.connection];
+
+    if (pp->fd[0] == NGX_INVALID_FILE) {
+
+        /* switch to splice() once the buffered data are sent */
+
+        if (b->pos != b->last || dst->buffered) {
+            return NGX_DECLINED;
+        }
+
+        if (s->proxy->pipe[0].fd[0] == NGX_INVALID_FILE
+            && s->proxy->pipe[1].fd[0] == NGX_INVALID_FILE)
+        {
+            cln = ngx_pool_cleanup_add(s->connection->pool, 0);
+            if (cln == NULL) {
+                return NGX_ERROR;
+            }
+
+            cln->handler = ngx_mail_proxy_splice_cleanup;
+            cln->data = s->proxy;
+        }
+
+        if (pipe2(pp->fd, O_NONBLOCK|O_CLOEXEC) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, s->connection->log, ngx_errno,
+                          "pipe2() failed");
+            pp->fd[0] = NGX_INVALID_FILE;
+            pp->fd[1] = NGX_INVALID_FILE;
+            return NGX_ERROR;
+        }
+
+        ngx_log_debug4(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                       "mail proxy splice #%d > #%d, pipe %d:%d",
+                       src->fd, dst->fd, pp->fd[0], pp->fd[1]);
+    }
+
+    /* the pipe is only filled when it is empty, so eof means no data */
+
+    for ( ;; ) {
+
+        if (pp->size) {
+
+            if (!dst->write->ready) {
+                break;
+            }
+
+            n = splice(pp->fd[0], NULL, dst->fd, NULL, pp->size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                           "mail proxy splice write: %z of %uz",
+                           n, pp->size);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EAGAIN) {
+                    dst->write->ready = 0;
+                    break;
+                }
+
+                dst->write->error = 1;
+                ngx_connection_error(dst, err, "splice() failed");
+                return NGX_ERROR;
+            }
+
+            pp->size -= n;
+            dst->sent += n;
+
+            continue;
+        }
+
+        if (!src->read->ready || src->read->eof) {
+            break;
+        }
+
+        n = splice(src->fd, NULL, pp->fd[1], NULL,
+                   NGX_MAIL_PROXY_SPLICE_SIZE,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                       "mail proxy splice read: %z", n);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+                src->read->ready = 0;
+                break;
+            }
+
+            ngx_connection_error(src, err, "splice() failed");
+
+            src->read->ready = 0;
+            src->read->error = 1;
+            src->read->eof = 1;
+            break;
+        }
+
+        if (n == 0) {
+            src->read->ready = 0;
+            src->read->eof = 1;
+            break;
+        }
+
+        pp->size = n;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_mail_proxy_splice_cleanup(void *data)
+{
+    ngx_mail_proxy_ctx_t  *p = data;
+
+    ngx_uint_t  i, j;
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+
+            if (p->pipe[i].fd[j] == NGX_INVALID_FILE) {
+                continue;
+            }
+
+            if (close(p->pipe[i].fd[j]) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                              "close() pipe failed");
+            }
+        }
+    }
+}
+
+#endif
+
+
 static void
 ngx_mail_proxy_upstream_error(ngx_mail_session_t *s)
 {
@@ -1102,6 +1419,7 @@ ngx_mail_proxy_create_conf(ngx_conf_t *cf)
     pcf->enable = NGX_CONF_UNSET;
     pcf->pass_error_message = NGX_CONF_UNSET;
     pcf->xclient = NGX_CONF_UNSET;
+    pcf->splice = NGX_CONF_UNSET;
     pcf->buffer_size = NGX_CONF_UNSET_SIZE;
     pcf->timeout = NGX_CONF_UNSET_MSEC;
 
@@ -1118,6 +1436,7 @@ ngx_mail_proxy_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->enable, prev->enable, 0);
     ngx_conf_merge_value(conf->pass_error_message, prev->pass_error_message, 0);
     ngx_conf_merge_value(conf->xclient, prev->xclient, 1);
+    ngx_conf_merge_value(conf->splice, prev->splice, 0);
     ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size,
                               (size_t) ngx_pagesize);
     ngx_conf_merge_msec_value(conf->timeout, prev->timeout, 24 * 60 * 60000);
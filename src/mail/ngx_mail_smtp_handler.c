@@ -20,6 +20,9 @@ static void ngx_mail_smtp_greeting(ngx_mail_session_t *s, ngx_connection_t *c);
 static void ngx_mail_smtp_invalid_pipelining(ngx_event_t *rev);
 static ngx_int_t ngx_mail_smtp_create_buffer(ngx_mail_session_t *s,
     ngx_connection_t *c);
+static ngx_int_t ngx_mail_smtp_pipeline(ngx_mail_session_t *s,
+    ngx_connection_t *c);
+static void ngx_mail_smtp_flush(ngx_mail_session_t *s, ngx_connection_t *c);
 
 static ngx_int_t ngx_mail_smtp_helo(ngx_mail_session_t *s, ngx_connection_t *c);
 static ngx_int_t ngx_mail_smtp_auth(ngx_mail_session_t *s, ngx_connection_t *c);
@@ -452,11 +455,22 @@ ngx_mail_smtp_auth_state(ngx_event_t *rev)
         return;
     }
 
+next:
+
     s->blocked = 0;
 
     rc = ngx_mail_read_command(s, c);
 
-    if (rc == NGX_AGAIN || rc == NGX_ERROR) {
+    if (rc == NGX_AGAIN) {
+
+        if (s->pipelined && s->pipelined->pos != s->pipelined->last) {
+            ngx_mail_smtp_flush(s, c);
+        }
+
+        return;
+    }
+
+    if (rc == NGX_ERROR) {
         return;
     }
 
@@ -542,6 +556,31 @@ ngx_mail_smtp_auth_state(ngx_event_t *rev)
     switch (rc) {
 
     case NGX_DONE:
+
+        if (s->pipelined && s->pipelined->pos != s->pipelined->last) {
+
+            /*
+             * the responses to the commands pipelined before
+             * the authentication are sent first
+             */
+
+            s->out.len = 0;
+            s->blocked = 0;
+
+            ngx_mail_smtp_flush(s, c);
+
+            if (c->destroyed) {
+                return;
+            }
+
+            if (s->out.len) {
+                ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                              "client does not read pipelined responses");
+                ngx_mail_close_connection(c);
+                return;
+            }
+        }
+
         ngx_mail_auth(s, c);
         return;
 
@@ -568,11 +607,106 @@ ngx_mail_smtp_auth_state(ngx_event_t *rev)
             s->arg_start = s->buffer->pos;
         }
 
-        ngx_mail_send(c->write);
+        if (s->blocked && !s->quit) {
+
+            /*
+             * the response is delayed while the next pipelined command
+             * is already buffered, so the responses are sent together
+             */
+
+            rc = ngx_mail_smtp_pipeline(s, c);
+
+            if (rc == NGX_OK) {
+                goto next;
+            }
+
+            if (rc == NGX_ERROR) {
+                ngx_mail_session_internal_server_error(s);
+                return;
+            }
+        }
+
+        ngx_mail_smtp_flush(s, c);
     }
 }
 
 
+static ngx_int_t
+ngx_mail_smtp_pipeline(ngx_mail_session_t *s, ngx_connection_t *c)
+{
+    ngx_buf_t                 *b;
+    ngx_mail_smtp_srv_conf_t  *sscf;
+
+    b = s->pipelined;
+
+    if (b == NULL) {
+        sscf = ngx_mail_get_module_srv_conf(s, ngx_mail_smtp_module);
+
+        b = ngx_create_temp_buf(c->pool, sscf->client_buffer_size);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        s->pipelined = b;
+    }
+
+    if ((size_t) (b->end - b->last) < s->out.len) {
+        return NGX_DECLINED;
+    }
+
+    b->last = ngx_cpymem(b->last, s->out.data, s->out.len);
+
+    s->out.len = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_mail_smtp_flush(ngx_mail_session_t *s, ngx_connection_t *c)
+{
+    u_char     *p;
+    size_t      size;
+    ngx_buf_t  *b;
+
+    b = s->pipelined;
+
+    if (b && b->pos != b->last) {
+
+        size = b->last - b->pos;
+
+        if ((size_t) (b->end - b->last) >= s->out.len) {
+            b->last = ngx_cpymem(b->last, s->out.data, s->out.len);
+
+            s->out.data = b->pos;
+            s->out.len = b->last - b->pos;
+
+        } else {
+            p = ngx_pnalloc(c->pool, size + s->out.len);
+            if (p == NULL) {
+                ngx_mail_session_internal_server_error(s);
+                return;
+            }
+
+            ngx_memcpy(ngx_cpymem(p, b->pos, size), s->out.data, s->out.len);
+
+            s->out.data = p;
+            s->out.len += size;
+        }
+
+        /*
+         * the buffer is not reused until the output is sent,
+         * as no command is processed while s->out.len is not 0
+         */
+
+        b->pos = b->start;
+        b->last = b->start;
+    }
+
+    ngx_mail_send(c->write);
+}
+
+
 static ngx_int_t
 ngx_mail_smtp_helo(ngx_mail_session_t *s, ngx_connection_t *c)
 {
@@ -25,6 +25,10 @@ static char *ngx_mail_ssl_password_file(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_mail_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_mail_ssl_session_ticket_keys_zone(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_mail_ssl_async(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_conf_enum_t  ngx_mail_starttls_state[] = {
@@ -134,7 +138,7 @@ static ngx_command_t  ngx_mail_ssl_commands[] = {
       NULL },
 
     { ngx_string("ssl_session_cache"),
-      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE12,
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE123,
       ngx_mail_ssl_session_cache,
       NGX_MAIL_SRV_CONF_OFFSET,
       0,
@@ -154,6 +158,20 @@ static ngx_command_t  ngx_mail_ssl_commands[] = {
       offsetof(ngx_mail_ssl_conf_t, session_ticket_keys),
       NULL },
 
+    { ngx_string("ssl_session_ticket_keys_zone"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_1MORE,
+      ngx_mail_ssl_session_ticket_keys_zone,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("ssl_async"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_mail_ssl_async,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("ssl_session_timeout"),
       NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_sec_slot,
@@ -196,6 +214,13 @@ static ngx_command_t  ngx_mail_ssl_commands[] = {
       offsetof(ngx_mail_ssl_conf_t, crl),
       NULL },
 
+    { ngx_string("ssl_ktls"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_ssl_conf_t, ktls),
+      NULL },
+
       ngx_null_command
 };
 
@@ -251,6 +276,7 @@ ngx_mail_ssl_create_conf(ngx_conf_t *cf)
      *     scf->trusted_certificate = { 0, NULL };
      *     scf->crl = { 0, NULL };
      *     scf->ciphers = { 0, NULL };
+     *     scf->async_pool = { 0, NULL };
      *     scf->shm_zone = NULL;
      */
 
@@ -266,6 +292,9 @@ ngx_mail_ssl_create_conf(ngx_conf_t *cf)
     scf->session_timeout = NGX_CONF_UNSET;
     scf->session_tickets = NGX_CONF_UNSET;
     scf->session_ticket_keys = NGX_CONF_UNSET_PTR;
+    scf->session_ticket_keys_zone = NGX_CONF_UNSET_PTR;
+    scf->async = NGX_CONF_UNSET_UINT;
+    scf->ktls = NGX_CONF_UNSET;
 
     return scf;
 }
@@ -455,12 +484,42 @@ ngx_mail_ssl_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_ptr_value(conf->session_ticket_keys,
                          prev->session_ticket_keys, NULL);
 
-    if (ngx_ssl_session_ticket_keys(cf, &conf->ssl, conf->session_ticket_keys)
+    ngx_conf_merge_ptr_value(conf->session_ticket_keys_zone,
+                         prev->session_ticket_keys_zone, NULL);
+
+    if (conf->session_ticket_keys_zone) {
+        if (ngx_ssl_session_ticket_keys_shared(cf, &conf->ssl,
+                                               conf->session_ticket_keys_zone)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+    } else if (ngx_ssl_session_ticket_keys(cf, &conf->ssl,
+                                           conf->session_ticket_keys)
+               != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->async == NGX_CONF_UNSET_UINT) {
+        conf->async_pool = prev->async_pool;
+    }
+
+    ngx_conf_merge_uint_value(conf->async, prev->async, NGX_SSL_ASYNC_OFF);
+
+    if (ngx_ssl_async(cf, &conf->ssl, conf->async, &conf->async_pool)
         != NGX_OK)
     {
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_merge_value(conf->ktls, prev->ktls, 0);
+
+    if (ngx_ssl_ktls(cf, &conf->ssl, conf->ktls) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -551,11 +610,13 @@ ngx_mail_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     size_t       len;
     ngx_str_t   *value, name, size;
-    ngx_int_t    n;
+    ngx_int_t    n, shards;
     ngx_uint_t   i, j;
 
     value = cf->args->elts;
 
+    shards = 0;
+
     for (i = 1; i < cf->args->nelts; i++) {
 
         if (ngx_strcmp(value[i].data, "off") == 0) {
@@ -635,12 +696,43 @@ ngx_mail_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
             scf->shm_zone->init = ngx_ssl_session_cache_init;
 
+            /* the layout is the number of shards, see ngx_ssl_session_cache_shards() */
+
+            if (scf->shm_zone->shm.layout == 0) {
+                scf->shm_zone->shm.layout = 1;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+
+            if (shards <= 0 || shards > NGX_SSL_MAX_SESSION_CACHE_SHARDS) {
+                goto invalid;
+            }
+
             continue;
         }
 
         goto invalid;
     }
 
+    if (shards) {
+        if (scf->shm_zone == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"shards\" requires a shared session cache");
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_ssl_session_cache_shards(cf, scf->shm_zone, shards)
+            != NGX_CONF_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     if (scf->shm_zone && scf->builtin_session_cache == NGX_CONF_UNSET) {
         scf->builtin_session_cache = NGX_SSL_NO_BUILTIN_SCACHE;
     }
@@ -654,3 +746,31 @@ invalid:
 
     return NGX_CONF_ERROR;
 }
+
+
+static char *
+ngx_mail_ssl_session_ticket_keys_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_mail_ssl_conf_t  *scf = conf;
+
+    if (scf->session_ticket_keys_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    return ngx_ssl_session_ticket_keys_zone(cf, &scf->session_ticket_keys_zone,
+                                            &ngx_mail_ssl_module);
+}
+
+
+static char *
+ngx_mail_ssl_async(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_mail_ssl_conf_t  *scf = conf;
+
+    if (scf->async != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    return ngx_ssl_async_conf(cf, &scf->async, &scf->async_pool);
+}
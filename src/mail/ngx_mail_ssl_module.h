@@ -53,6 +53,12 @@ typedef struct {
 
     ngx_flag_t       session_tickets;
     ngx_array_t     *session_ticket_keys;
+    ngx_shm_zone_t  *session_ticket_keys_zone;
+
+    ngx_uint_t       async;
+    ngx_str_t        async_pool;
+
+    ngx_flag_t       ktls;
 
     u_char          *file;
     ngx_uint_t       line;
@@ -7,6 +7,7 @@
 
 #include <ngx_config.h>
 #include <ngx_core.h>
+#include <ngx_event.h>
 
 /*
  * declare Profiler interface here because
@@ -18,13 +19,36 @@ void ProfilerStop(void);
 void ProfilerRegisterThread(void);
 
 
+typedef struct {
+    ngx_str_t   profiles;
+    ngx_msec_t  duration;
+} ngx_google_perftools_conf_t;
+
+
 static void *ngx_google_perftools_create_conf(ngx_cycle_t *cycle);
+static char *ngx_google_perftools_init_conf(ngx_cycle_t *cycle, void *conf);
 static ngx_int_t ngx_google_perftools_worker(ngx_cycle_t *cycle);
+static ngx_int_t ngx_google_perftools_start(ngx_google_perftools_conf_t *gptcf,
+    ngx_log_t *log);
+static void ngx_google_perftools_signal_handler(int signo);
+static void ngx_google_perftools_handler(ngx_event_t *ev);
 
 
-typedef struct {
-    ngx_str_t  profiles;
-} ngx_google_perftools_conf_t;
+/*
+ * with google_perftools_duration set, a worker profiles only on demand:
+ * SIGURG sent to the worker starts profiling for the duration, after
+ * which the profile is written to "<profiles>.<pid>.<time>"; the signal
+ * is ignored by default, so sending it to other processes is harmless
+ */
+
+#define NGX_GOOGLE_PERFTOOLS_SIGNAL  SIGURG
+#define NGX_GOOGLE_PERFTOOLS_POLL    1000
+
+
+static u_char        *ngx_google_perftools_profile;
+static ngx_uint_t     ngx_google_perftools_running;
+static sig_atomic_t   ngx_google_perftools_requested;
+static ngx_event_t    ngx_google_perftools_event;
 
 
 static ngx_command_t  ngx_google_perftools_commands[] = {
@@ -36,6 +60,13 @@ static ngx_command_t  ngx_google_perftools_commands[] = {
       offsetof(ngx_google_perftools_conf_t, profiles),
       NULL },
 
+    { ngx_string("google_perftools_duration"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_google_perftools_conf_t, duration),
+      NULL },
+
       ngx_null_command
 };
 
@@ -43,7 +74,7 @@ static ngx_command_t  ngx_google_perftools_commands[] = {
 static ngx_core_module_t  ngx_google_perftools_module_ctx = {
     ngx_string("google_perftools"),
     ngx_google_perftools_create_conf,
-    NULL
+    ngx_google_perftools_init_conf
 };
 
 
@@ -79,14 +110,27 @@ ngx_google_perftools_create_conf(ngx_cycle_t *cycle)
      *     gptcf->profiles = { 0, NULL };
      */
 
+    gptcf->duration = NGX_CONF_UNSET_MSEC;
+
     return gptcf;
 }
 
 
+static char *
+ngx_google_perftools_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_google_perftools_conf_t *gptcf = conf;
+
+    ngx_conf_init_msec_value(gptcf->duration, 0);
+
+    return NGX_CONF_OK;
+}
+
+
 static ngx_int_t
 ngx_google_perftools_worker(ngx_cycle_t *cycle)
 {
-    u_char                       *profile;
+    struct sigaction              sa;
     ngx_google_perftools_conf_t  *gptcf;
 
     gptcf = (ngx_google_perftools_conf_t *)
@@ -96,8 +140,10 @@ ngx_google_perftools_worker(ngx_cycle_t *cycle)
         return NGX_OK;
     }
 
-    profile = ngx_alloc(gptcf->profiles.len + NGX_INT_T_LEN + 2, cycle->log);
-    if (profile == NULL) {
+    ngx_google_perftools_profile = ngx_alloc(gptcf->profiles.len
+                                             + 2 * NGX_INT_T_LEN + 3,
+                                             cycle->log);
+    if (ngx_google_perftools_profile == NULL) {
         return NGX_OK;
     }
 
@@ -106,20 +152,102 @@ ngx_google_perftools_worker(ngx_cycle_t *cycle)
         ProfilerStop();
     }
 
-    ngx_sprintf(profile, "%V.%d%Z", &gptcf->profiles, ngx_pid);
+    if (gptcf->duration == 0) {
+        (void) ngx_google_perftools_start(gptcf, cycle->log);
+        return NGX_OK;
+    }
+
+    ngx_memzero(&sa, sizeof(struct sigaction));
+    sa.sa_handler = ngx_google_perftools_signal_handler;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(NGX_GOOGLE_PERFTOOLS_SIGNAL, &sa, NULL) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "sigaction(SIGURG) failed");
+        return NGX_OK;
+    }
+
+    /* the signal handler only sets a flag, which is polled by the timer */
+
+    ngx_google_perftools_event.handler = ngx_google_perftools_handler;
+    ngx_google_perftools_event.data = gptcf;
+    ngx_google_perftools_event.log = cycle->log;
+    ngx_google_perftools_event.cancelable = 1;
+
+    ngx_add_timer(&ngx_google_perftools_event, NGX_GOOGLE_PERFTOOLS_POLL);
+
+    return NGX_OK;
+}
 
-    if (ProfilerStart(profile)) {
+
+static ngx_int_t
+ngx_google_perftools_start(ngx_google_perftools_conf_t *gptcf, ngx_log_t *log)
+{
+    if (gptcf->duration) {
+        ngx_sprintf(ngx_google_perftools_profile, "%V.%d.%T%Z",
+                    &gptcf->profiles, ngx_pid, ngx_time());
+
+    } else {
+        ngx_sprintf(ngx_google_perftools_profile, "%V.%d%Z",
+                    &gptcf->profiles, ngx_pid);
+    }
+
+    if (ProfilerStart(ngx_google_perftools_profile)) {
         /* start ITIMER_PROF timer */
         ProfilerRegisterThread();
 
-    } else {
-        ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
-                      "ProfilerStart(%s) failed", profile);
+        return NGX_OK;
     }
 
-    ngx_free(profile);
+    ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                  "ProfilerStart(%s) failed", ngx_google_perftools_profile);
 
-    return NGX_OK;
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_google_perftools_signal_handler(int signo)
+{
+    ngx_google_perftools_requested = 1;
+}
+
+
+static void
+ngx_google_perftools_handler(ngx_event_t *ev)
+{
+    ngx_google_perftools_conf_t  *gptcf;
+
+    gptcf = ev->data;
+
+    if (ngx_google_perftools_running) {
+        ProfilerStop();
+
+        ngx_log_error(NGX_LOG_NOTICE, ev->log, 0,
+                      "profile \"%s\" written", ngx_google_perftools_profile);
+
+        ngx_google_perftools_running = 0;
+
+        /* the requests received while profiling are dropped */
+
+        ngx_google_perftools_requested = 0;
+
+    } else if (ngx_google_perftools_requested) {
+        ngx_google_perftools_requested = 0;
+
+        if (ngx_google_perftools_start(gptcf, ev->log) == NGX_OK) {
+
+            ngx_log_error(NGX_LOG_NOTICE, ev->log, 0,
+                          "profiling for %M ms", gptcf->duration);
+
+            ngx_google_perftools_running = 1;
+
+            ngx_add_timer(ev, gptcf->duration);
+            return;
+        }
+    }
+
+    ngx_add_timer(ev, NGX_GOOGLE_PERFTOOLS_POLL);
 }
 
 
@@ -10,6 +10,15 @@
 #include <ngx_channel.h>
 
 
+static ngx_int_t ngx_notify_channel_ring(ngx_int_t slot, ngx_log_t *log);
+
+
+static ngx_channel_ring_t          *ngx_channel_rings;
+static ngx_channel_msg_handler_pt   ngx_channel_handlers[NGX_CHANNEL_COMMANDS];
+static ngx_uint_t                   ngx_channel_commands =
+                                                      NGX_CHANNEL_USER_COMMAND;
+
+
 /*
  * ATTENTION: 这个是在不同进程之间传递文件描述符的方法！
  */
@@ -254,3 +263,305 @@ ngx_close_channel(ngx_fd_t *fd, ngx_log_t *log)
         ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "close() channel failed");
     }
 }
+
+
+ngx_int_t
+ngx_init_channel_rings(ngx_log_t *log)
+{
+    ngx_shm_t  shm;
+
+    if (ngx_channel_rings) {
+        return NGX_OK;
+    }
+
+    ngx_memzero(&shm, sizeof(ngx_shm_t));
+
+    shm.size = sizeof(ngx_channel_ring_t) * NGX_MAX_PROCESSES;
+    ngx_str_set(&shm.name, "nginx_channel_rings");
+    shm.log = log;
+    shm.numa = NGX_SHM_NUMA_DEFAULT;
+
+    if (ngx_shm_alloc(&shm) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_channel_rings = (ngx_channel_ring_t *) shm.addr;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_open_channel_ring(ngx_int_t slot, ngx_log_t *log)
+{
+    ngx_fd_t             fd;
+    ngx_channel_ring_t  *ring;
+
+    ngx_processes[slot].notify = -1;
+
+    if (ngx_channel_rings == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ring = &ngx_channel_rings[slot];
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->notified = 0;
+
+#if (NGX_HAVE_EVENTFD)
+
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    fd = eventfd(0, 0);
+#else
+    fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (fd == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    if (ngx_nonblocking(fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_nonblocking_n " eventfd failed");
+        goto failed;
+    }
+
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "fcntl(FD_CLOEXEC) eventfd failed");
+        goto failed;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "channel ring s:%i eventfd:%d", slot, fd);
+
+    ngx_processes[slot].notify = fd;
+
+    return NGX_OK;
+
+failed:
+
+    if (close(fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "eventfd close() failed");
+    }
+
+    return NGX_ERROR;
+
+#else
+
+    (void) fd;
+
+    return NGX_OK;
+
+#endif
+}
+
+
+void
+ngx_close_channel_ring(ngx_int_t slot, ngx_log_t *log)
+{
+    if (ngx_processes[slot].notify == -1) {
+        return;
+    }
+
+    if (close(ngx_processes[slot].notify) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "eventfd close() failed");
+    }
+
+    ngx_processes[slot].notify = -1;
+}
+
+
+/*
+ * the handlers are added before the child processes are spawned,
+ * so the commands are the same in the master and the children
+ */
+
+ngx_int_t
+ngx_add_channel_handler(ngx_channel_msg_handler_pt handler)
+{
+    if (ngx_channel_commands == NGX_CHANNEL_COMMANDS) {
+        return NGX_ERROR;
+    }
+
+    ngx_channel_handlers[ngx_channel_commands] = handler;
+
+    return ngx_channel_commands++;
+}
+
+
+ngx_int_t
+ngx_post_channel(ngx_int_t slot, ngx_uint_t command, void *data, size_t len,
+    ngx_log_t *log)
+{
+    ngx_atomic_uint_t    head;
+    ngx_channel_msg_t   *msg;
+    ngx_channel_ring_t  *ring;
+
+    if (ngx_channel_rings == NULL || len > NGX_CHANNEL_MSG_SIZE) {
+        return NGX_DECLINED;
+    }
+
+    ring = &ngx_channel_rings[slot];
+
+    head = ring->head;
+
+    if (head - ring->tail == NGX_CHANNEL_RING_SIZE) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "channel ring of process %P is full",
+                      ngx_processes[slot].pid);
+        return NGX_AGAIN;
+    }
+
+    msg = &ring->msgs[head % NGX_CHANNEL_RING_SIZE];
+
+    msg->command = command;
+    msg->len = len;
+
+    if (len) {
+        ngx_memcpy(msg->data, data, len);
+    }
+
+    ngx_memory_barrier();
+
+    ring->head = head + 1;
+
+    ngx_memory_barrier();
+
+    if (!ngx_atomic_cmp_set(&ring->notified, 0, 1)) {
+
+        /* the child is already woken up and has not yet read the ring */
+
+        return NGX_OK;
+    }
+
+    if (ngx_notify_channel_ring(slot, log) != NGX_OK) {
+        ring->notified = 0;
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_notify_channel_ring(ngx_int_t slot, ngx_log_t *log)
+{
+    ngx_channel_t  ch;
+
+#if (NGX_HAVE_EVENTFD)
+
+    static uint64_t  inc = 1;
+
+    if (ngx_processes[slot].notify != -1) {
+
+        if ((size_t) write(ngx_processes[slot].notify, &inc,
+                           sizeof(uint64_t))
+            != sizeof(uint64_t))
+        {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "write() to eventfd %d failed",
+                          ngx_processes[slot].notify);
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+#endif
+
+    if (ngx_processes[slot].channel[0] == -1) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&ch, sizeof(ngx_channel_t));
+
+    ch.command = NGX_CMD_RING;
+    ch.fd = -1;
+
+    return ngx_write_channel(ngx_processes[slot].channel[0], &ch,
+                             sizeof(ngx_channel_t), log);
+}
+
+
+void
+ngx_broadcast_channel(ngx_uint_t command, void *data, size_t len,
+    ngx_log_t *log)
+{
+    ngx_int_t  i;
+
+    for (i = 0; i < ngx_last_process; i++) {
+
+        if (ngx_processes[i].pid == -1
+            || ngx_processes[i].detached
+            || ngx_processes[i].exited
+            || ngx_processes[i].exiting)
+        {
+            continue;
+        }
+
+        (void) ngx_post_channel(i, command, data, len, log);
+    }
+}
+
+
+/*
+ * a child rearms its ring before reading it, so a message posted while
+ * the ring is read either is read too or wakes the child up again
+ */
+
+void
+ngx_rearm_channel_ring(ngx_int_t slot)
+{
+    if (ngx_channel_rings) {
+        ngx_channel_rings[slot].notified = 0;
+        ngx_memory_barrier();
+    }
+}
+
+
+ngx_int_t
+ngx_read_channel_ring(ngx_int_t slot, ngx_channel_msg_t *msg)
+{
+    ngx_atomic_uint_t    tail;
+    ngx_channel_ring_t  *ring;
+
+    if (ngx_channel_rings == NULL) {
+        return NGX_DONE;
+    }
+
+    ring = &ngx_channel_rings[slot];
+
+    tail = ring->tail;
+
+    if (tail == ring->head) {
+        return NGX_DONE;
+    }
+
+    ngx_memory_barrier();
+
+    *msg = ring->msgs[tail % NGX_CHANNEL_RING_SIZE];
+
+    ngx_memory_barrier();
+
+    ring->tail = tail + 1;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_call_channel_handler(ngx_cycle_t *cycle, ngx_channel_msg_t *msg)
+{
+    if (msg->command >= NGX_CHANNEL_COMMANDS
+        || ngx_channel_handlers[msg->command] == NULL)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "unknown channel command %ui", msg->command);
+        return;
+    }
+
+    ngx_channel_handlers[msg->command](cycle, msg);
+}
@@ -22,6 +22,39 @@ typedef struct {
 } ngx_channel_t;
 
 
+/*
+ * The channel rings pass messages from the master process to its children
+ * through shared memory, a child is woken up by its eventfd, or by
+ * a channel message if there is no eventfd, once for all messages
+ * posted before it runs
+ */
+
+#define NGX_CHANNEL_RING_SIZE      64
+#define NGX_CHANNEL_MSG_SIZE       48
+
+#define NGX_CHANNEL_USER_COMMAND   16
+#define NGX_CHANNEL_COMMANDS       64
+
+
+typedef struct {
+    ngx_uint_t          command;
+    size_t              len;
+    u_char              data[NGX_CHANNEL_MSG_SIZE];
+} ngx_channel_msg_t;
+
+
+typedef struct {
+    ngx_atomic_t        head;
+    ngx_atomic_t        tail;
+    ngx_atomic_t        notified;
+    ngx_channel_msg_t   msgs[NGX_CHANNEL_RING_SIZE];
+} ngx_channel_ring_t;
+
+
+typedef void (*ngx_channel_msg_handler_pt)(ngx_cycle_t *cycle,
+    ngx_channel_msg_t *msg);
+
+
 ngx_int_t ngx_write_channel(ngx_socket_t s, ngx_channel_t *ch, size_t size,
     ngx_log_t *log);
 ngx_int_t ngx_read_channel(ngx_socket_t s, ngx_channel_t *ch, size_t size,
@@ -30,5 +63,17 @@ ngx_int_t ngx_add_channel_event(ngx_cycle_t *cycle, ngx_fd_t fd,
     ngx_int_t event, ngx_event_handler_pt handler);
 void ngx_close_channel(ngx_fd_t *fd, ngx_log_t *log);
 
+ngx_int_t ngx_init_channel_rings(ngx_log_t *log);
+ngx_int_t ngx_open_channel_ring(ngx_int_t slot, ngx_log_t *log);
+void ngx_close_channel_ring(ngx_int_t slot, ngx_log_t *log);
+ngx_int_t ngx_add_channel_handler(ngx_channel_msg_handler_pt handler);
+ngx_int_t ngx_post_channel(ngx_int_t slot, ngx_uint_t command, void *data,
+    size_t len, ngx_log_t *log);
+void ngx_broadcast_channel(ngx_uint_t command, void *data, size_t len,
+    ngx_log_t *log);
+void ngx_rearm_channel_ring(ngx_int_t slot);
+ngx_int_t ngx_read_channel_ring(ngx_int_t slot, ngx_channel_msg_t *msg);
+void ngx_call_channel_handler(ngx_cycle_t *cycle, ngx_channel_msg_t *msg);
+
 
 #endif /* _NGX_CHANNEL_H_INCLUDED_ */
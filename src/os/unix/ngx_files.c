@@ -653,6 +653,21 @@ failed:
 }
 
 
+ngx_int_t
+ngx_open_file_mapping(ngx_file_mapping_t *fm)
+{
+    fm->addr = mmap(NULL, fm->size, PROT_READ, MAP_SHARED, fm->fd, 0);
+    if (fm->addr != MAP_FAILED) {
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_CRIT, fm->log, ngx_errno,
+                  "mmap(%uz) \"%s\" failed", fm->size, fm->name);
+
+    return NGX_ERROR;
+}
+
+
 void
 ngx_close_file_mapping(ngx_file_mapping_t *fm)
 {
@@ -826,6 +841,42 @@ ngx_read_ahead(ngx_fd_t fd, size_t n)
 #endif
 
 
+#if (NGX_HAVE_POSIX_FADVISE)
+
+ngx_int_t
+ngx_prefetch_file(ngx_fd_t fd, off_t offset, off_t size)
+{
+    int  err;
+
+    err = posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+
+    if (err == 0) {
+        return 0;
+    }
+
+    ngx_set_errno(err);
+    return NGX_FILE_ERROR;
+}
+
+
+ngx_int_t
+ngx_drop_file_cache(ngx_fd_t fd, off_t offset, off_t size)
+{
+    int  err;
+
+    err = posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+
+    if (err == 0) {
+        return 0;
+    }
+
+    ngx_set_errno(err);
+    return NGX_FILE_ERROR;
+}
+
+#endif
+
+
 #if (NGX_HAVE_O_DIRECT)
 
 ngx_int_t
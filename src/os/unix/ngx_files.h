@@ -191,6 +191,7 @@ ngx_int_t ngx_set_file_time(u_char *name, ngx_fd_t fd, time_t s);
 
 
 ngx_int_t ngx_create_file_mapping(ngx_file_mapping_t *fm);
+ngx_int_t ngx_open_file_mapping(ngx_file_mapping_t *fm);
 void ngx_close_file_mapping(ngx_file_mapping_t *fm);
 
 
@@ -320,6 +321,47 @@ ngx_int_t ngx_read_ahead(ngx_fd_t fd, size_t n);
 #endif
 
 
+#if (NGX_HAVE_POSIX_FADVISE)
+
+#define NGX_HAVE_PREFETCH        1
+
+ngx_int_t ngx_prefetch_file(ngx_fd_t fd, off_t offset, off_t size);
+#define ngx_prefetch_file_n      "posix_fadvise(POSIX_FADV_WILLNEED)"
+
+#else
+
+#define ngx_prefetch_file(fd, offset, size)  0
+#define ngx_prefetch_file_n      "ngx_prefetch_file_n"
+
+#endif
+
+
+#if (NGX_HAVE_POSIX_FADVISE)
+
+ngx_int_t ngx_drop_file_cache(ngx_fd_t fd, off_t offset, off_t size);
+#define ngx_drop_file_cache_n    "posix_fadvise(POSIX_FADV_DONTNEED)"
+
+#else
+
+#define ngx_drop_file_cache(fd, offset, size)  0
+#define ngx_drop_file_cache_n    "ngx_drop_file_cache_n"
+
+#endif
+
+
+#if (NGX_HAVE_FALLOCATE)
+
+#define ngx_preallocate_file(fd, size)                                       \
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size)
+#define ngx_preallocate_file_n   "fallocate()"
+
+#endif
+
+
+#define ngx_fsync_file(fd)       fsync(fd)
+#define ngx_fsync_file_n         "fsync()"
+
+
 #if (NGX_HAVE_O_DIRECT)
 
 ngx_int_t ngx_directio_on(ngx_fd_t fd);
@@ -379,6 +421,15 @@ ssize_t ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size,
 
 extern ngx_uint_t  ngx_file_aio;
 
+#if (NGX_HAVE_IO_URING)
+ngx_int_t ngx_file_aio_uring_init(ngx_cycle_t *cycle, int fd,
+    ngx_uint_t entries);
+void ngx_file_aio_uring_done(ngx_cycle_t *cycle);
+void ngx_file_aio_uring_process(ngx_log_t *log);
+
+extern int         ngx_file_aio_uring;
+#endif
+
 #endif
 
 #if (NGX_THREADS)
@@ -9,6 +9,38 @@
 #define _NGX_LINUX_H_INCLUDED_
 
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+#define NGX_ZEROCOPY_SENDS  64
+
+
+typedef struct {
+    size_t                 size;
+    uint32_t               id;
+    unsigned               zerocopy:1;
+    unsigned               done:1;
+} ngx_zerocopy_send_t;
+
+
+/*
+ * data sent with MSG_ZEROCOPY are not reported as sent, and so their
+ * buffers are not reused, until the kernel signals the completion
+ */
+
+typedef struct {
+    size_t                 threshold;
+    size_t                 inflight;
+    uint32_t               next_id;
+    ngx_uint_t             head;
+    ngx_uint_t             n;
+    unsigned               enabled:1;
+    unsigned               sockopt:1;
+    ngx_zerocopy_send_t    sends[NGX_ZEROCOPY_SENDS];
+} ngx_zerocopy_t;
+
+#endif
+
+
 ngx_chain_t *ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in,
     off_t limit);
 
@@ -14,6 +14,57 @@ extern int            ngx_eventfd;
 extern aio_context_t  ngx_aio_ctx;
 
 
+#if (NGX_HAVE_IO_URING)
+
+/*
+ * The io_uring backend reads files with IORING_OP_READ, which, unlike
+ * io_submit(), does not block on buffered files, so it works without
+ * directio.  Reads posted during an event loop iteration are queued and
+ * submitted in one io_uring_enter() call from a posted event, and the
+ * completions are signalled via the same eventfd as with Linux AIO.
+ */
+
+typedef struct {
+    unsigned             *head;
+    unsigned             *tail;
+    unsigned             *mask;
+    unsigned             *entries;
+    unsigned             *array;
+    struct io_uring_sqe  *sqes;
+    unsigned              tail_local;
+
+    unsigned             *cq_head;
+    unsigned             *cq_tail;
+    unsigned             *cq_mask;
+    struct io_uring_cqe  *cqes;
+
+    void                 *sq_ring;
+    void                 *cq_ring;
+    size_t                sq_ring_size;
+    size_t                cq_ring_size;
+    size_t                sqes_size;
+
+    ngx_uint_t            nsubmit;
+    ngx_uint_t            inflight;
+    ngx_uint_t            max_inflight;
+
+    ngx_event_t           submit;
+} ngx_file_aio_ring_t;
+
+
+static ssize_t ngx_file_aio_uring_read(ngx_file_t *file, u_char *buf,
+    size_t size, off_t offset);
+static void ngx_file_aio_uring_submit(ngx_event_t *ev);
+static void ngx_file_aio_uring_cancel(ngx_err_t err, ngx_log_t *log);
+
+
+int                   ngx_file_aio_uring = -1;
+
+static ngx_file_aio_ring_t  ngx_file_aio_ring;
+
+#endif
+
+
 static void ngx_file_aio_event_handler(ngx_event_t *ev);
 
 
@@ -93,6 +144,14 @@ ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_IO_URING)
+
+    if (ngx_file_aio_uring != -1) {
+        return ngx_file_aio_uring_read(file, buf, size, offset);
+    }
+
+#endif
+
     ngx_memzero(&aio->aiocb, sizeof(struct iocb));
 
     aio->aiocb.aio_data = (uint64_t) (uintptr_t) ev;
@@ -146,3 +205,407 @@ ngx_file_aio_event_handler(ngx_event_t *ev)
 
     aio->handler(ev);
 }
+
+
+#if (NGX_HAVE_IO_URING)
+
+/*
+ * We call io_uring_setup(), io_uring_enter(), and io_uring_register()
+ * directly as syscalls to avoid dependency on liburing.
+ */
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   NULL, 0);
+}
+
+
+static int
+io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+ngx_int_t
+ngx_file_aio_uring_init(ngx_cycle_t *cycle, int fd, ngx_uint_t entries)
+{
+    u_char                  *p;
+    ngx_file_aio_ring_t     *r;
+    struct io_uring_params   params;
+
+    r = &ngx_file_aio_ring;
+
+    ngx_memzero(r, sizeof(ngx_file_aio_ring_t));
+    ngx_memzero(&params, sizeof(struct io_uring_params));
+
+    params.flags = IORING_SETUP_CLAMP;
+
+    ngx_file_aio_uring = io_uring_setup(entries, &params);
+
+    if (ngx_file_aio_uring == -1) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_errno,
+                      "io_uring_setup() failed, using Linux AIO");
+        return NGX_DECLINED;
+    }
+
+    /* IORING_OP_READ appeared in Linux 5.6, the same as IORING_FEAT_NODROP */
+
+    if (!(params.features & IORING_FEAT_NODROP)) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "io_uring features 0x%xD are not sufficient, "
+                      "using Linux AIO", params.features);
+        goto failed;
+    }
+
+    r->sq_ring_size = params.sq_off.array
+                      + params.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = params.cq_off.cqes
+                      + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->sq_ring_size = ngx_max(r->sq_ring_size, r->cq_ring_size);
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, ngx_file_aio_uring,
+                      IORING_OFF_SQ_RING);
+
+    if (r->sq_ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        r->sq_ring = NULL;
+        goto failed;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE, ngx_file_aio_uring,
+                          IORING_OFF_CQ_RING);
+
+        if (r->cq_ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            r->cq_ring = NULL;
+            goto failed;
+        }
+    }
+
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_POPULATE, ngx_file_aio_uring,
+                   IORING_OFF_SQES);
+
+    if (r->sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        r->sqes = NULL;
+        goto failed;
+    }
+
+    if (io_uring_register(ngx_file_aio_uring, IORING_REGISTER_EVENTFD, &fd, 1)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring_register(IORING_REGISTER_EVENTFD) failed");
+        goto failed;
+    }
+
+    p = r->sq_ring;
+
+    r->head = (unsigned *) (p + params.sq_off.head);
+    r->tail = (unsigned *) (p + params.sq_off.tail);
+    r->mask = (unsigned *) (p + params.sq_off.ring_mask);
+    r->entries = (unsigned *) (p + params.sq_off.ring_entries);
+    r->array = (unsigned *) (p + params.sq_off.array);
+    r->tail_local = *r->tail;
+
+    p = r->cq_ring;
+
+    r->cq_head = (unsigned *) (p + params.cq_off.head);
+    r->cq_tail = (unsigned *) (p + params.cq_off.tail);
+    r->cq_mask = (unsigned *) (p + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (p + params.cq_off.cqes);
+
+    /* completions of all reads in flight fit into the completion queue */
+
+    r->max_inflight = params.cq_entries;
+
+    r->submit.handler = ngx_file_aio_uring_submit;
+    r->submit.log = cycle->log;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "aio io_uring: fd:%d sq:%uD cq:%uD",
+                   ngx_file_aio_uring, params.sq_entries, params.cq_entries);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_file_aio_uring_done(cycle);
+
+    return NGX_DECLINED;
+}
+
+
+void
+ngx_file_aio_uring_done(ngx_cycle_t *cycle)
+{
+    ngx_file_aio_ring_t  *r;
+
+    r = &ngx_file_aio_ring;
+
+    if (r->submit.posted) {
+        ngx_delete_posted_event(&r->submit);
+    }
+
+    if (r->sqes && munmap(r->sqes, r->sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQES) failed");
+    }
+
+    if (r->cq_ring && r->cq_ring != r->sq_ring
+        && munmap(r->cq_ring, r->cq_ring_size) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_CQ_RING) failed");
+    }
+
+    if (r->sq_ring && munmap(r->sq_ring, r->sq_ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQ_RING) failed");
+    }
+
+    if (ngx_file_aio_uring != -1 && close(ngx_file_aio_uring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ngx_memzero(r, sizeof(ngx_file_aio_ring_t));
+
+    ngx_file_aio_uring = -1;
+}
+
+
+static ssize_t
+ngx_file_aio_uring_read(ngx_file_t *file, u_char *buf, size_t size,
+    off_t offset)
+{
+    unsigned              n;
+    ngx_event_t          *ev;
+    ngx_file_aio_ring_t  *r;
+    struct io_uring_sqe  *sqe;
+
+    r = &ngx_file_aio_ring;
+
+    if (r->tail_local - *r->head >= *r->entries && r->nsubmit) {
+
+        /* the submission queue is full */
+
+        ngx_file_aio_uring_submit(&r->submit);
+    }
+
+    if (r->inflight >= r->max_inflight
+        || r->tail_local - *r->head >= *r->entries)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, file->log, 0,
+                       "aio io_uring busy, %ui reads in flight", r->inflight);
+
+        return ngx_read_file(file, buf, size, offset);
+    }
+
+    ev = &file->aio->event;
+
+    n = r->tail_local & *r->mask;
+
+    sqe = &r->sqes[n];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file->fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t) (uintptr_t) ev;
+
+    r->array[n] = n;
+    r->tail_local++;
+
+    ngx_memory_barrier();
+    *r->tail = r->tail_local;
+
+    r->nsubmit++;
+    r->inflight++;
+
+    if (!r->submit.posted) {
+        ngx_post_event(&r->submit, &ngx_posted_events);
+    }
+
+    ev->handler = ngx_file_aio_event_handler;
+
+    ev->active = 1;
+    ev->ready = 0;
+    ev->complete = 0;
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_file_aio_uring_submit(ngx_event_t *ev)
+{
+    int                   n;
+    ngx_err_t             err;
+    ngx_file_aio_ring_t  *r;
+
+    r = &ngx_file_aio_ring;
+
+    if (r->nsubmit == 0) {
+        return;
+    }
+
+    n = io_uring_enter(ngx_file_aio_uring, r->nsubmit, 0, 0);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "aio io_uring submit: %ui, %d", r->nsubmit, n);
+
+    if (n >= 0) {
+        r->nsubmit -= ngx_min((ngx_uint_t) n, r->nsubmit);
+
+        if (r->nsubmit && !ev->posted) {
+            ngx_post_event(ev, &ngx_posted_next_events);
+        }
+
+        return;
+    }
+
+    err = ngx_errno;
+
+    switch (err) {
+
+    case NGX_EINTR:
+    case NGX_EBUSY:
+    case NGX_EAGAIN:
+
+        /* the reads are submitted again in the next iteration */
+
+        if (!ev->posted) {
+            ngx_post_event(ev, &ngx_posted_next_events);
+        }
+
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_ALERT, ev->log, err, "io_uring_enter() failed");
+
+    ngx_file_aio_uring_cancel(err, ev->log);
+}
+
+
+static void
+ngx_file_aio_uring_cancel(ngx_err_t err, ngx_log_t *log)
+{
+    unsigned              head;
+    ngx_event_t          *e;
+    ngx_event_aio_t      *aio;
+    ngx_file_aio_ring_t  *r;
+    struct io_uring_sqe  *sqe;
+
+    r = &ngx_file_aio_ring;
+
+    /*
+     * the reads not consumed by the kernel are completed with the error,
+     * and their entries are taken back from the submission queue
+     */
+
+    for (head = *r->head; head != r->tail_local; head++) {
+        sqe = &r->sqes[r->array[head & *r->mask]];
+
+        e = (ngx_event_t *) (uintptr_t) sqe->user_data;
+
+        e->complete = 1;
+        e->active = 0;
+        e->ready = 1;
+
+        aio = e->data;
+        aio->res = -err;
+
+        ngx_post_event(e, &ngx_posted_events);
+
+        r->inflight--;
+    }
+
+    r->tail_local = *r->head;
+
+    ngx_memory_barrier();
+    *r->tail = r->tail_local;
+
+    r->nsubmit = 0;
+}
+
+
+void
+ngx_file_aio_uring_process(ngx_log_t *log)
+{
+    unsigned              head, tail;
+    ngx_event_t          *e;
+    ngx_event_aio_t      *aio;
+    ngx_file_aio_ring_t  *r;
+    struct io_uring_cqe  *cqe;
+
+    r = &ngx_file_aio_ring;
+
+    head = *r->cq_head;
+
+    for ( ;; ) {
+        tail = *r->cq_tail;
+
+        ngx_memory_barrier();
+
+        if (head == tail) {
+            break;
+        }
+
+        while (head != tail) {
+            cqe = &r->cqes[head & *r->cq_mask];
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                           "aio io_uring event: %XL %d",
+                           cqe->user_data, cqe->res);
+
+            e = (ngx_event_t *) (uintptr_t) cqe->user_data;
+
+            e->complete = 1;
+            e->active = 0;
+            e->ready = 1;
+
+            aio = e->data;
+            aio->res = cqe->res;
+
+            ngx_post_event(e, &ngx_posted_events);
+
+            r->inflight--;
+            head++;
+        }
+
+        ngx_memory_barrier();
+        *r->cq_head = head;
+    }
+}
+
+#endif
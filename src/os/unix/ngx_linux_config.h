@@ -79,6 +79,11 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_FICLONE)
+#include <linux/fs.h>           /* FICLONE */
+#endif
+
+
 #if (NGX_HAVE_POLL)
 #include <poll.h>
 #endif
@@ -89,6 +94,12 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_IO_URING)
+#include <poll.h>
+#include <linux/io_uring.h>
+#endif
+
+
 #if (NGX_HAVE_SYS_EVENTFD_H)
 #include <sys/eventfd.h>
 #endif
@@ -104,6 +115,36 @@ typedef struct iocb  ngx_aiocb_t;
 #endif
 
 
+#if (NGX_HAVE_MBIND)
+#include <linux/mempolicy.h>
+#endif
+
+
+#if (NGX_HAVE_FUTEX)
+#include <linux/futex.h>
+#endif
+
+
+#if (NGX_HAVE_INOTIFY)
+#include <sys/inotify.h>
+#endif
+
+
+#if (NGX_HAVE_REUSEPORT_CBPF)
+#include <linux/filter.h>
+#endif
+
+
+#if (NGX_HAVE_UDP_SEGMENT || NGX_HAVE_UDP_GRO)
+#include <netinet/udp.h>
+#endif
+
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#endif
+
+
 #define NGX_LISTEN_BACKLOG        511
 
 
@@ -25,6 +25,15 @@ static ssize_t ngx_linux_sendfile_thread(ngx_connection_t *c, ngx_buf_t *file,
 static void ngx_linux_sendfile_thread_handler(void *data, ngx_log_t *log);
 #endif
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+static ngx_chain_t *ngx_linux_zerocopy_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit, ngx_uint_t *declined);
+static ssize_t ngx_linux_zerocopy_send(ngx_connection_t *c, ngx_iovec_t *vec);
+static void ngx_linux_zerocopy_complete(ngx_connection_t *c);
+static ngx_chain_t *ngx_linux_zerocopy_retire(ngx_connection_t *c,
+    ngx_chain_t *in);
+#endif
+
 
 /*
  * On Linux up to 2.4.21 sendfile() (syscall #187) works with 32-bit
@@ -63,6 +72,19 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         return in;
     }
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+    if (c->zerocopy) {
+        ngx_uint_t  declined;
+
+        in = ngx_linux_zerocopy_chain(c, in, limit, &declined);
+
+        if (!declined) {
+            return in;
+        }
+    }
+
+#endif
 
     /* the maximum limit size is 2G-1 - the page size */
 
@@ -440,3 +462,355 @@ again:
 }
 
 #endif /* NGX_THREADS */
+
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+/*
+ * memory buffers are sent with MSG_ZEROCOPY, and the data remain
+ * in the chain until the completion is read from the error queue;
+ * "zc->inflight" bytes at the start of the chain are skipped when
+ * sending, and file buffers are only sent when nothing is in flight
+ */
+
+static ngx_chain_t *
+ngx_linux_zerocopy_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit,
+    ngx_uint_t *declined)
+{
+    int                   on;
+    off_t                 send;
+    u_char               *pos;
+    size_t                skip, size;
+    ssize_t               n;
+    ngx_buf_t            *b;
+    ngx_uint_t            zerocopy;
+    ngx_chain_t          *cl;
+    ngx_iovec_t           vec;
+    ngx_zerocopy_t       *zc;
+    ngx_zerocopy_send_t  *zs;
+    struct iovec          iovs[NGX_IOVS_PREALLOCATE];
+
+    zc = c->zerocopy;
+
+    *declined = 0;
+
+    if (zc->n) {
+        ngx_linux_zerocopy_complete(c);
+        in = ngx_linux_zerocopy_retire(c, in);
+    }
+
+    if (limit == 0 || limit > (off_t) (NGX_SENDFILE_MAXSIZE - ngx_pagesize)) {
+        limit = NGX_SENDFILE_MAXSIZE - ngx_pagesize;
+    }
+
+    send = 0;
+
+    vec.iovs = iovs;
+    vec.nalloc = NGX_IOVS_PREALLOCATE;
+
+    for ( ;; ) {
+
+        /* skip the data in flight */
+
+        skip = zc->inflight;
+        b = NULL;
+        pos = NULL;
+
+        for (cl = in; cl && skip; cl = cl->next) {
+
+            if (ngx_buf_special(cl->buf)) {
+                continue;
+            }
+
+            size = ngx_buf_size(cl->buf);
+
+            if (size > skip) {
+                b = cl->buf;
+                pos = b->pos;
+                b->pos += skip;
+                break;
+            }
+
+            skip -= size;
+        }
+
+        cl = ngx_output_chain_to_iovec(&vec, cl, limit - send, c->log);
+
+        if (b) {
+            b->pos = pos;
+        }
+
+        if (cl == NGX_CHAIN_ERROR) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (zc->n == 0
+            && (!zc->enabled || vec.size == 0 || vec.size < zc->threshold))
+        {
+            /* nothing in flight, a file or small buffers are sent as usual */
+
+            *declined = 1;
+            return in;
+        }
+
+        if (vec.size == 0 || zc->n == NGX_ZEROCOPY_SENDS) {
+
+            /* wait for completions, they are reported with EPOLLERR */
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "zerocopy wait: %uz in flight, %ui sends",
+                           zc->inflight, zc->n);
+
+            c->write->ready = 0;
+            return in;
+        }
+
+        zerocopy = (zc->enabled && vec.size >= zc->threshold);
+
+        if (zerocopy && !zc->sockopt) {
+            on = 1;
+
+            if (setsockopt(c->fd, SOL_SOCKET, SO_ZEROCOPY,
+                           (const void *) &on, sizeof(int))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_INFO, c->log, ngx_socket_errno,
+                              "setsockopt(SO_ZEROCOPY) failed, ignored");
+
+                zc->enabled = 0;
+                zerocopy = 0;
+
+            } else {
+                zc->sockopt = 1;
+            }
+        }
+
+        if (zerocopy) {
+            n = ngx_linux_zerocopy_send(c, &vec);
+
+            if (n == NGX_DECLINED) {
+                zerocopy = 0;
+                n = ngx_writev(c, &vec);
+            }
+
+        } else {
+            n = ngx_writev(c, &vec);
+        }
+
+        if (n == NGX_ERROR) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            c->write->ready = 0;
+            return in;
+        }
+
+        zs = &zc->sends[(zc->head + zc->n) % NGX_ZEROCOPY_SENDS];
+
+        zs->size = n;
+        zs->zerocopy = zerocopy;
+        zs->done = !zerocopy;
+        zs->id = zerocopy ? zc->next_id++ : 0;
+
+        zc->n++;
+        zc->inflight += n;
+
+        send += n;
+
+        in = ngx_linux_zerocopy_retire(c, in);
+
+        if ((size_t) n < vec.size) {
+            c->write->ready = 0;
+            return in;
+        }
+
+        if (send >= limit || in == NULL) {
+            return in;
+        }
+    }
+}
+
+
+static ssize_t
+ngx_linux_zerocopy_send(ngx_connection_t *c, ngx_iovec_t *vec)
+{
+    ssize_t        n;
+    ngx_err_t      err;
+    struct msghdr  msg;
+
+    ngx_memzero(&msg, sizeof(struct msghdr));
+
+    msg.msg_iov = vec->iovs;
+    msg.msg_iovlen = vec->count;
+
+eintr:
+
+    n = sendmsg(c->fd, &msg, MSG_ZEROCOPY);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "sendmsg zerocopy: %z of %uz", n, vec->size);
+
+    if (n == -1) {
+        err = ngx_socket_errno;
+
+        switch (err) {
+        case NGX_EAGAIN:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() not ready");
+            return NGX_AGAIN;
+
+        case NGX_EINTR:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() was interrupted");
+            goto eintr;
+
+        case ENOBUFS:
+
+            /* the socket option memory limit is reached, data are copied */
+
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() with MSG_ZEROCOPY failed");
+            return NGX_DECLINED;
+
+        default:
+            c->write->error = 1;
+            ngx_connection_error(c, err, "sendmsg() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return n;
+}
+
+
+static void
+ngx_linux_zerocopy_complete(ngx_connection_t *c)
+{
+    uint32_t                   lo, hi;
+    ssize_t                    n;
+    ngx_err_t                  err;
+    ngx_uint_t                 i;
+    struct msghdr              msg;
+    struct cmsghdr            *cmsg;
+    ngx_zerocopy_t            *zc;
+    ngx_zerocopy_send_t       *zs;
+    struct sock_extended_err  *serr;
+
+    union {
+        struct cmsghdr         cm;
+        u_char                 buf[CMSG_SPACE(sizeof(struct sock_extended_err)
+                                              + sizeof(struct sockaddr_in6))];
+    } control;
+
+    zc = c->zerocopy;
+
+    for ( ;; ) {
+        ngx_memzero(&msg, sizeof(struct msghdr));
+
+        msg.msg_control = &control;
+        msg.msg_controllen = sizeof(control);
+
+        n = recvmsg(c->fd, &msg, MSG_ERRQUEUE);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, c->log, err,
+                              "recvmsg(MSG_ERRQUEUE) failed");
+            }
+
+            return;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == IPPROTO_IP
+                  && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == IPPROTO_IPV6
+                     && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+
+            serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+
+            if (serr->ee_errno != 0
+                || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            lo = serr->ee_info;
+            hi = serr->ee_data;
+
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "zerocopy completed: %uD-%uD%s", lo, hi,
+                           (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                           ? " copied" : "");
+
+            for (i = 0; i < zc->n; i++) {
+                zs = &zc->sends[(zc->head + i) % NGX_ZEROCOPY_SENDS];
+
+                if (zs->zerocopy && (uint32_t) (zs->id - lo) <= hi - lo) {
+                    zs->done = 1;
+                }
+            }
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+
+                /*
+                 * the kernel had to copy the data anyway, as with
+                 * loopback or a device without scatter-gather,
+                 * so there is no reason to delay buffers
+                 */
+
+                zc->enabled = 0;
+            }
+        }
+    }
+}
+
+
+static ngx_chain_t *
+ngx_linux_zerocopy_retire(ngx_connection_t *c, ngx_chain_t *in)
+{
+    size_t                sent;
+    ngx_zerocopy_t       *zc;
+    ngx_zerocopy_send_t  *zs;
+
+    zc = c->zerocopy;
+
+    sent = 0;
+
+    while (zc->n) {
+        zs = &zc->sends[zc->head];
+
+        if (!zs->done) {
+            break;
+        }
+
+        sent += zs->size;
+
+        zc->head = (zc->head + 1) % NGX_ZEROCOPY_SENDS;
+        zc->n--;
+    }
+
+    if (sent == 0) {
+        return in;
+    }
+
+    zc->inflight -= sent;
+    c->sent += sent;
+
+    return ngx_chain_update_sent(in, sent);
+}
+
+#endif
@@ -179,10 +179,13 @@ ngx_spawn_process(ngx_cycle_t *cycle, ngx_spawn_proc_pt proc, void *data,
 
         ngx_channel = ngx_processes[s].channel[1];
 
+        (void) ngx_open_channel_ring(s, cycle->log);
+
     } else {
         // QUESTION: NGX_PROCESSS_DETATCHED 就表示不和 master 通信？
         ngx_processes[s].channel[0] = -1;
         ngx_processes[s].channel[1] = -1;
+        ngx_processes[s].notify = -1;
     }
 
     ngx_process_slot = s;
@@ -196,6 +199,7 @@ ngx_spawn_process(ngx_cycle_t *cycle, ngx_spawn_proc_pt proc, void *data,
         ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
                       "fork() failed while spawning \"%s\"", name);
         ngx_close_channel(ngx_processes[s].channel, cycle->log);
+        ngx_close_channel_ring(s, cycle->log);
         return NGX_INVALID_PID;
 
     case 0:
@@ -23,6 +23,7 @@ typedef struct {
     ngx_pid_t           pid;
     int                 status;
     ngx_socket_t        channel[2];
+    ngx_fd_t            notify;
 
     ngx_spawn_proc_pt   proc;
     void               *data;
@@ -9,23 +9,42 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 #include <ngx_channel.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
 
 
 static void ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n,
     ngx_int_t type);
+static void ngx_start_worker_process(ngx_cycle_t *cycle, ngx_int_t i,
+    ngx_int_t type);
+static void ngx_roll_worker_processes(ngx_cycle_t *cycle,
+    ngx_core_conf_t *ccf);
 static void ngx_start_cache_manager_processes(ngx_cycle_t *cycle,
     ngx_uint_t respawn);
 static void ngx_pass_open_channel(ngx_cycle_t *cycle, ngx_channel_t *ch);
 static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo);
+static void ngx_signal_processes(ngx_cycle_t *cycle, int signo,
+    ngx_int_t worker);
 static ngx_uint_t ngx_reap_children(ngx_cycle_t *cycle);
 static void ngx_master_process_exit(ngx_cycle_t *cycle);
 static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker);
 static void ngx_worker_process_exit(ngx_cycle_t *cycle);
 static void ngx_channel_handler(ngx_event_t *ev);
+static void ngx_channel_ring_handler(ngx_event_t *ev);
+static void ngx_read_channel_rings(ngx_cycle_t *cycle);
 static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_cache_manager_process_handler(ngx_event_t *ev);
 static void ngx_cache_loader_process_handler(ngx_event_t *ev);
+static ngx_msec_t ngx_cache_manager_run(ngx_cycle_t *cycle);
+static void ngx_cache_loader_run(ngx_cycle_t *cycle);
+#if (NGX_THREADS)
+static void ngx_cache_manager_threads_init(ngx_cycle_t *cycle);
+static void ngx_cache_manager_thread_post(ngx_event_t *ev);
+static void ngx_cache_manager_thread_handler(void *data, ngx_log_t *log);
+static void ngx_cache_manager_thread_done(ngx_event_t *ev);
+#endif
 
 
 ngx_uint_t    ngx_process;
@@ -55,6 +74,9 @@ ngx_uint_t    ngx_restart;
 
 static u_char  master_process[] = "master process";
 
+/* the next worker to be replaced by a rolling reload, or -1 */
+static ngx_int_t  ngx_rolling = -1;
+
 
 static ngx_cache_manager_ctx_t  ngx_cache_manager_ctx = {
     ngx_cache_manager_process_handler, "cache manager process", 0
@@ -65,6 +87,21 @@ static ngx_cache_manager_ctx_t  ngx_cache_loader_ctx = {
 };
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_thread_pool_t  *pool;
+    ngx_msec_t          next;
+    ngx_msec_t          load;
+    ngx_uint_t          loader;  /* unsigned  loader:1; */
+} ngx_cache_manager_thread_ctx_t;
+
+
+static ngx_event_t  ngx_cache_manager_event;
+
+#endif
+
+
 static ngx_cycle_t      ngx_exit_cycle;
 static ngx_log_t        ngx_exit_log;
 static ngx_open_file_t  ngx_exit_log_file;
@@ -130,6 +167,11 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
 
     ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
 
+    if (ngx_init_channel_rings(cycle->log) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "channel rings are not available");
+    }
+
     // QUESTION: 为什么这里用 PROCESS_RESPAWN？
     ngx_start_worker_processes(cycle, ccf->worker_processes,
                                NGX_PROCESS_RESPAWN);
@@ -210,6 +252,7 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
             }
 
             sigio = ccf->worker_processes + 2 /* cache processes */;
+            ngx_rolling = -1;
 
             /*
              * NOTE:
@@ -225,6 +268,8 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
         }
 
         if (ngx_quit) {
+            ngx_rolling = -1;
+
             // NOTE: 收到 QUIT 信号，直接停止子进程
             ngx_signal_worker_processes(cycle,
                                         ngx_signal_value(NGX_SHUTDOWN_SIGNAL));
@@ -279,6 +324,24 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
             ngx_cycle = cycle;
             ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx,
                                                    ngx_core_module);
+
+            if (ccf->rolling_reload && ccf->worker_processes > 1) {
+
+                /* processes of an unfinished rolling reload are old now */
+
+                for (i = 0; i < ngx_last_process; i++) {
+                    ngx_processes[i].just_spawn = 0;
+                }
+
+                ngx_rolling = 0;
+                ngx_roll_worker_processes(cycle, ccf);
+
+                live = 1;
+                continue;
+            }
+
+            ngx_rolling = -1;
+
             /*
              * QUESTION: 这里用的是 JUST_RESPAWN，new_binary 时用的是 RESPAWN，
              *           二者有什么区别么？
@@ -296,6 +359,11 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
                                         ngx_signal_value(NGX_SHUTDOWN_SIGNAL));
         }
 
+        if (ngx_rolling != -1 && ngx_sigalrm) {
+            ngx_sigalrm = 0;
+            ngx_roll_worker_processes(cycle, ccf);
+        }
+
         if (ngx_restart) {
             ngx_restart = 0;
             ngx_start_worker_processes(cycle, ccf->worker_processes,
@@ -348,6 +416,8 @@ ngx_single_process_cycle(ngx_cycle_t *cycle)
         }
     }
 
+    ngx_log_init_buffers(cycle);
+
     for ( ;; ) {
         ngx_log_debug0(NGX_LOG_DEBUG_EVENT, cycle->log, 0, "worker cycle");
 
@@ -390,25 +460,80 @@ ngx_single_process_cycle(ngx_cycle_t *cycle)
 static void
 ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n, ngx_int_t type)
 {
-    ngx_int_t      i;
-    ngx_channel_t  ch;
+    ngx_int_t  i;
 
     ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "start worker processes");
 
+    for (i = 0; i < n; i++) {
+        ngx_start_worker_process(cycle, i, type);
+    }
+}
+
+
+static void
+ngx_start_worker_process(ngx_cycle_t *cycle, ngx_int_t i, ngx_int_t type)
+{
+    ngx_channel_t  ch;
+
+    ngx_spawn_process(cycle, ngx_worker_process_cycle,
+                      (void *) (intptr_t) i, "worker process", type);
+
     ngx_memzero(&ch, sizeof(ngx_channel_t));
 
     ch.command = NGX_CMD_OPEN_CHANNEL;
+    ch.pid = ngx_processes[ngx_process_slot].pid;
+    ch.slot = ngx_process_slot;
+    ch.fd = ngx_processes[ngx_process_slot].channel[0];
 
-    for (i = 0; i < n; i++) {
+    ngx_pass_open_channel(cycle, &ch);
+}
 
-        ngx_spawn_process(cycle, ngx_worker_process_cycle,
-                          (void *) (intptr_t) i, "worker process", type);
 
-        ch.pid = ngx_processes[ngx_process_slot].pid;
-        ch.slot = ngx_process_slot;
-        ch.fd = ngx_processes[ngx_process_slot].channel[0];
+/*
+ * A rolling reload replaces old workers by new ones one at a time,
+ * every "worker_rolling_reload" interval, so only one worker at a time
+ * starts with cold caches and drains its connections.  The old cache
+ * processes and old workers beyond the new number of workers are shut
+ * down with the last one.
+ */
 
-        ngx_pass_open_channel(cycle, &ch);
+static void
+ngx_roll_worker_processes(ngx_cycle_t *cycle, ngx_core_conf_t *ccf)
+{
+    struct itimerval  itv;
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                  "rolling reload of worker process %i", ngx_rolling);
+
+    if (ngx_rolling == 0) {
+        ngx_start_cache_manager_processes(cycle, 1);
+    }
+
+    ngx_start_worker_process(cycle, ngx_rolling, NGX_PROCESS_JUST_RESPAWN);
+
+    /* allow the new process to start */
+    ngx_msleep(100);
+
+    if (ngx_rolling == ccf->worker_processes - 1) {
+        ngx_rolling = -1;
+        ngx_signal_worker_processes(cycle,
+                                    ngx_signal_value(NGX_SHUTDOWN_SIGNAL));
+        return;
+    }
+
+    ngx_signal_processes(cycle, ngx_signal_value(NGX_SHUTDOWN_SIGNAL),
+                         ngx_rolling);
+
+    ngx_rolling++;
+
+    itv.it_interval.tv_sec = 0;
+    itv.it_interval.tv_usec = 0;
+    itv.it_value.tv_sec = ccf->rolling_reload / 1000;
+    itv.it_value.tv_usec = (ccf->rolling_reload % 1000) * 1000;
+
+    if (setitimer(ITIMER_REAL, &itv, NULL) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "setitimer() failed");
     }
 }
 
@@ -416,9 +541,17 @@ ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n, ngx_int_t type)
 static void
 ngx_start_cache_manager_processes(ngx_cycle_t *cycle, ngx_uint_t respawn)
 {
-    ngx_uint_t       i, manager, loader;
-    ngx_path_t     **path;
-    ngx_channel_t    ch;
+    ngx_uint_t        i, manager, loader;
+    ngx_path_t      **path;
+    ngx_channel_t     ch;
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (ccf->cache_manager == NGX_CACHE_MANAGER_THREADS) {
+        /* caches are managed by worker processes */
+        return;
+    }
 
     manager = 0;
     loader = 0;
@@ -431,7 +564,7 @@ ngx_start_cache_manager_processes(ngx_cycle_t *cycle, ngx_uint_t respawn)
         }
 
         if (path[i]->loader) {
-            loader = 1;
+            loader = ngx_max(loader, ngx_max(path[i]->loaders, 1));
         }
     }
 
@@ -452,20 +585,22 @@ ngx_start_cache_manager_processes(ngx_cycle_t *cycle, ngx_uint_t respawn)
 
     ngx_pass_open_channel(cycle, &ch);
 
-    if (loader == 0) {
-        return;
-    }
+    /* loader processes share work by claiming parts of cache paths */
 
-    ngx_spawn_process(cycle, ngx_cache_manager_process_cycle,
-                      &ngx_cache_loader_ctx, "cache loader process",
-                      respawn ? NGX_PROCESS_JUST_SPAWN : NGX_PROCESS_NORESPAWN);
+    for (i = 0; i < loader; i++) {
 
-    ch.command = NGX_CMD_OPEN_CHANNEL;
-    ch.pid = ngx_processes[ngx_process_slot].pid;
-    ch.slot = ngx_process_slot;
-    ch.fd = ngx_processes[ngx_process_slot].channel[0];
+        ngx_spawn_process(cycle, ngx_cache_manager_process_cycle,
+                          &ngx_cache_loader_ctx, "cache loader process",
+                          respawn ? NGX_PROCESS_JUST_SPAWN
+                                  : NGX_PROCESS_NORESPAWN);
 
-    ngx_pass_open_channel(cycle, &ch);
+        ch.command = NGX_CMD_OPEN_CHANNEL;
+        ch.pid = ngx_processes[ngx_process_slot].pid;
+        ch.slot = ngx_process_slot;
+        ch.fd = ngx_processes[ngx_process_slot].channel[0];
+
+        ngx_pass_open_channel(cycle, &ch);
+    }
 }
 
 
@@ -499,6 +634,18 @@ ngx_pass_open_channel(ngx_cycle_t *cycle, ngx_channel_t *ch)
 
 static void
 ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
+{
+    ngx_signal_processes(cycle, signo, -1);
+}
+
+
+/*
+ * signals all processes but just spawned ones, or the old worker
+ * processes with the given number only
+ */
+
+static void
+ngx_signal_processes(ngx_cycle_t *cycle, int signo, ngx_int_t worker)
 {
     ngx_int_t      i;
     ngx_err_t      err;
@@ -551,6 +698,14 @@ ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
             continue;
         }
 
+        if (worker != -1
+            && (ngx_processes[i].proc != ngx_worker_process_cycle
+                || ngx_processes[i].data != (void *) (intptr_t) worker
+                || ngx_processes[i].just_spawn))
+        {
+            continue;
+        }
+
         // QUESTION: just_spawn 是何时设置的？为什么要在这里置为 0？
         if (ngx_processes[i].just_spawn) {
             ngx_processes[i].just_spawn = 0;
@@ -564,9 +719,10 @@ ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
         }
 
         if (ch.command) {
-            if (ngx_write_channel(ngx_processes[i].channel[0],
-                                  &ch, sizeof(ngx_channel_t), cycle->log)
-                == NGX_OK)
+            if (ngx_post_channel(i, ch.command, NULL, 0, cycle->log) == NGX_OK
+                || ngx_write_channel(ngx_processes[i].channel[0],
+                                     &ch, sizeof(ngx_channel_t), cycle->log)
+                   == NGX_OK)
             {
                 if (signo != ngx_signal_value(NGX_REOPEN_SIGNAL)) {
                     ngx_processes[i].exiting = 1;
@@ -639,6 +795,7 @@ ngx_reap_children(ngx_cycle_t *cycle)
             // NOTE: detached 的进程就不会和 master 通信，就不用处理 channel
             if (!ngx_processes[i].detached) {
                 ngx_close_channel(ngx_processes[i].channel, cycle->log);
+                ngx_close_channel_ring(i, cycle->log);
 
                 ngx_processes[i].channel[0] = -1;
                 ngx_processes[i].channel[1] = -1;
@@ -738,7 +895,11 @@ ngx_reap_children(ngx_cycle_t *cycle)
 static void
 ngx_master_process_exit(ngx_cycle_t *cycle)
 {
-    ngx_uint_t  i;
+    ngx_uint_t        i;
+#if (NGX_SHM_PERSISTENT)
+    ngx_list_part_t  *part;
+    ngx_shm_zone_t   *shm_zone;
+#endif
 
     ngx_delete_pidfile(cycle);
 
@@ -750,6 +911,29 @@ ngx_master_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+#if (NGX_SHM_PERSISTENT)
+
+    /* all processes have exited, persistent zones are consistent */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        ngx_shm_close(&shm_zone[i].shm);
+    }
+
+#endif
+
     ngx_close_listening_sockets(cycle);
 
     /*
@@ -788,6 +972,10 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
 
     ngx_worker_process_init(cycle, worker);
 
+#if (NGX_THREADS)
+    ngx_cache_manager_threads_init(cycle);
+#endif
+
     ngx_setproctitle("worker process");
 
     for ( ;; ) {
@@ -947,11 +1135,17 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
     }
 
     if (worker >= 0) {
-        cpu_affinity = ngx_get_cpu_affinity(worker);
+        cpu_affinity = ngx_get_cpu_affinity(cycle, worker);
 
         if (cpu_affinity) {
             ngx_setaffinity(cpu_affinity, cycle->log);
         }
+
+#if (NGX_HAVE_SCHED_SETAFFINITY && NGX_HAVE_MBIND)
+        if (ccf->cpu_affinity_numa) {
+            ngx_set_numa_node(ccf->cpu_affinity_node[worker], cycle->log);
+        }
+#endif
     }
 
 #if (NGX_HAVE_PR_SET_DUMPABLE)
@@ -985,6 +1179,13 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
     tp = ngx_timeofday();
     srandom(((unsigned) ngx_pid << 16) ^ tp->sec ^ tp->msec);
 
+#if (NGX_THREADS)
+    ngx_main_thread = pthread_self();
+#endif
+
+    ngx_pool_cache_init(ccf->pool_cache);
+    ngx_io_buffer_cache_init(ccf->io_buffers, ccf->io_buffers_huge);
+
     /*
      * disable deleting previous events for the listening sockets because
      * in the worker processes there are no events at all at this point
@@ -1005,6 +1206,8 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
         }
     }
 
+    ngx_log_init_buffers(cycle);
+
     for (n = 0; n < ngx_last_process; n++) {
 
         if (ngx_processes[n].pid == -1) {
@@ -1016,6 +1219,8 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
             continue;
         }
 
+        ngx_close_channel_ring(n, cycle->log);
+
         // QUESTION: 为啥在 ngx_process[n].pid != -1 的情况下却有这种可能呢？
         if (ngx_processes[n].channel[1] == -1) {
             continue;
@@ -1045,6 +1250,19 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
         /* fatal */
         exit(2);
     }
+
+    if (ngx_processes[ngx_process_slot].notify != -1
+        && ngx_add_channel_event(cycle, ngx_processes[ngx_process_slot].notify,
+                                 NGX_READ_EVENT, ngx_channel_ring_handler)
+           == NGX_ERROR)
+    {
+        /* fatal */
+        exit(2);
+    }
+
+    /* messages might be posted before the event was added */
+
+    ngx_read_channel_rings(cycle);
 }
 
 
@@ -1060,18 +1278,23 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+    ngx_pool_cache_done(cycle->log);
+    ngx_io_buffer_cache_done(cycle->log);
+    ngx_slab_magazines_done(cycle->log);
+
     if (ngx_exiting) {
-        c = cycle->connections;
         for (i = 0; i < cycle->connection_n; i++) {
-            if (c[i].fd != -1
-                && c[i].read
-                && !c[i].read->accept
-                && !c[i].read->channel
-                && !c[i].read->resolver)
+            c = ngx_cycle_connection(cycle, i);
+
+            if (c->fd != -1
+                && c->read
+                && !c->read->accept
+                && !c->read->channel
+                && !c->read->resolver)
             {
                 ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
                               "*%uA open socket #%d left in connection %ui",
-                              c[i].number, c[i].fd, i);
+                              c->number, c->fd, i);
                 ngx_debug_quit = 1;
             }
         }
@@ -1193,6 +1416,66 @@ ngx_channel_handler(ngx_event_t *ev)
 
             ngx_processes[ch.slot].channel[0] = -1;
             break;
+
+        case NGX_CMD_RING:
+            ngx_read_channel_rings((ngx_cycle_t *) ngx_cycle);
+            break;
+        }
+    }
+}
+
+
+static void
+ngx_channel_ring_handler(ngx_event_t *ev)
+{
+    ssize_t            n;
+    uint64_t           count;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    n = read(c->fd, &count, sizeof(uint64_t));
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                   "channel ring handler: %z count:%uL", n, count);
+
+    if (n == -1 && ngx_errno != NGX_EAGAIN) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                      "read() eventfd %d failed", c->fd);
+    }
+
+    ngx_read_channel_rings((ngx_cycle_t *) ngx_cycle);
+}
+
+
+static void
+ngx_read_channel_rings(ngx_cycle_t *cycle)
+{
+    ngx_channel_msg_t  msg;
+
+    ngx_rearm_channel_ring(ngx_process_slot);
+
+    while (ngx_read_channel_ring(ngx_process_slot, &msg) == NGX_OK) {
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                       "channel ring command: %ui", msg.command);
+
+        switch (msg.command) {
+
+        case NGX_CMD_QUIT:
+            ngx_quit = 1;
+            break;
+
+        case NGX_CMD_TERMINATE:
+            ngx_terminate = 1;
+            break;
+
+        case NGX_CMD_REOPEN:
+            ngx_reopen = 1;
+            break;
+
+        default:
+            ngx_call_channel_handler(cycle, &msg);
         }
     }
 }
@@ -1251,6 +1534,22 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 
 static void
 ngx_cache_manager_process_handler(ngx_event_t *ev)
+{
+    ngx_add_timer(ev, ngx_cache_manager_run((ngx_cycle_t *) ngx_cycle));
+}
+
+
+static void
+ngx_cache_loader_process_handler(ngx_event_t *ev)
+{
+    ngx_cache_loader_run((ngx_cycle_t *) ngx_cycle);
+
+    exit(0);
+}
+
+
+static ngx_msec_t
+ngx_cache_manager_run(ngx_cycle_t *cycle)
 {
     ngx_uint_t    i;
     ngx_msec_t    next, n;
@@ -1258,8 +1557,8 @@ ngx_cache_manager_process_handler(ngx_event_t *ev)
 
     next = 60 * 60 * 1000;
 
-    path = ngx_cycle->paths.elts;
-    for (i = 0; i < ngx_cycle->paths.nelts; i++) {
+    path = cycle->paths.elts;
+    for (i = 0; i < cycle->paths.nelts; i++) {
 
         if (path[i]->manager) {
             n = path[i]->manager(path[i]->data);
@@ -1274,23 +1573,20 @@ ngx_cache_manager_process_handler(ngx_event_t *ev)
         next = 1;
     }
 
-    ngx_add_timer(ev, next);
+    return next;
 }
 
 
 static void
-ngx_cache_loader_process_handler(ngx_event_t *ev)
+ngx_cache_loader_run(ngx_cycle_t *cycle)
 {
-    ngx_uint_t     i;
-    ngx_path_t   **path;
-    ngx_cycle_t   *cycle;
-
-    cycle = (ngx_cycle_t *) ngx_cycle;
+    ngx_uint_t    i;
+    ngx_path_t  **path;
 
     path = cycle->paths.elts;
     for (i = 0; i < cycle->paths.nelts; i++) {
 
-        if (ngx_terminate || ngx_quit) {
+        if (ngx_terminate || ngx_quit || ngx_exiting) {
             break;
         }
 
@@ -1299,6 +1595,146 @@ ngx_cache_loader_process_handler(ngx_event_t *ev)
             ngx_time_update();
         }
     }
+}
 
-    exit(0);
+
+#if (NGX_THREADS)
+
+/*
+ * With "cache_manager threads" every worker process runs the cache manager
+ * and the cache loader as a chain of thread pool tasks instead of separate
+ * processes.  Only one task of a worker runs at a time, so the per-process
+ * state of caches is not shared between threads, while the managers of
+ * different workers evict files concurrently and the loaders split cache
+ * paths by claiming shards.
+ */
+
+static void
+ngx_cache_manager_threads_init(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                       i, manager, loader;
+    ngx_path_t                     **path;
+    ngx_core_conf_t                 *ccf;
+    ngx_thread_task_t               *task;
+    ngx_cache_manager_thread_ctx_t  *ctx;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (ccf->cache_manager != NGX_CACHE_MANAGER_THREADS) {
+        return;
+    }
+
+    manager = 0;
+    loader = 0;
+
+    path = cycle->paths.elts;
+    for (i = 0; i < cycle->paths.nelts; i++) {
+
+        if (path[i]->manager) {
+            manager = 1;
+        }
+
+        if (path[i]->loader) {
+            loader = 1;
+        }
+    }
+
+    if (manager == 0) {
+        return;
+    }
+
+    task = ngx_thread_task_alloc(cycle->pool,
+                                 sizeof(ngx_cache_manager_thread_ctx_t));
+    if (task == NULL) {
+        return;
+    }
+
+    ctx = task->ctx;
+
+    ctx->pool = ngx_thread_pool_get(cycle, &ccf->cache_manager_pool);
+    if (ctx->pool == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "thread pool \"%V\" not found",
+                      &ccf->cache_manager_pool);
+        return;
+    }
+
+    ctx->next = 0;
+    ctx->load = ngx_current_msec + ngx_cache_loader_ctx.delay;
+    ctx->loader = loader;
+
+    task->handler = ngx_cache_manager_thread_handler;
+    task->event.handler = ngx_cache_manager_thread_done;
+    task->event.data = task;
+    task->event.log = cycle->log;
+
+    ngx_cache_manager_event.handler = ngx_cache_manager_thread_post;
+    ngx_cache_manager_event.data = task;
+    ngx_cache_manager_event.log = cycle->log;
+    ngx_cache_manager_event.cancelable = 1;
+
+    ngx_add_timer(&ngx_cache_manager_event, ngx_cache_manager_ctx.delay);
 }
+
+
+static void
+ngx_cache_manager_thread_post(ngx_event_t *ev)
+{
+    ngx_thread_task_t  *task = ev->data;
+
+    ngx_cache_manager_thread_ctx_t  *ctx;
+
+    ctx = task->ctx;
+
+    if (ngx_thread_task_post(ctx->pool, task) != NGX_OK) {
+        ngx_add_timer(ev, 1000);
+    }
+}
+
+
+static void
+ngx_cache_manager_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_cache_manager_thread_ctx_t *ctx = data;
+
+    ngx_msec_int_t  delay;
+
+    delay = (ngx_msec_int_t) (ctx->load - ngx_current_msec);
+
+    if (ctx->loader && delay <= 0) {
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "cache loader thread");
+
+        ngx_cache_loader_run((ngx_cycle_t *) ngx_cycle);
+
+        ctx->loader = 0;
+        ctx->next = 1;
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "cache manager thread");
+
+    ctx->next = ngx_cache_manager_run((ngx_cycle_t *) ngx_cycle);
+
+    if (ctx->loader && ctx->next > (ngx_msec_t) delay) {
+        ctx->next = delay;
+    }
+}
+
+
+static void
+ngx_cache_manager_thread_done(ngx_event_t *ev)
+{
+    ngx_thread_task_t  *task = ev->data;
+
+    ngx_cache_manager_thread_ctx_t  *ctx;
+
+    ctx = task->ctx;
+
+    if (ngx_exiting || ngx_terminate || ngx_quit) {
+        return;
+    }
+
+    ngx_add_timer(&ngx_cache_manager_event, ctx->next);
+}
+
+#endif
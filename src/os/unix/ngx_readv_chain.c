@@ -67,6 +67,10 @@ ngx_readv_chain(ngx_connection_t *c, ngx_chain_t *chain, off_t limit)
 
 #endif
 
+    if (ngx_read_budget && ngx_event_read_exhausted(c)) {
+        return NGX_AGAIN;
+    }
+
     prev = NULL;
     iov = NULL;
     size = 0;
@@ -142,6 +146,8 @@ ngx_readv_chain(ngx_connection_t *c, ngx_chain_t *chain, off_t limit)
 
         if (n > 0) {
 
+            c->budget_used += n;
+
 #if (NGX_HAVE_KQUEUE)
 
             if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
@@ -65,6 +65,10 @@ ngx_unix_recv(ngx_connection_t *c, u_char *buf, size_t size)
 
 #endif
 
+    if (ngx_read_budget && ngx_event_read_exhausted(c)) {
+        return NGX_AGAIN;
+    }
+
     do {
         n = recv(c->fd, buf, size, 0);
 
@@ -93,6 +97,8 @@ ngx_unix_recv(ngx_connection_t *c, u_char *buf, size_t size)
 
         if (n > 0) {
 
+            c->budget_used += n;
+
 #if (NGX_HAVE_KQUEUE)
 
             if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
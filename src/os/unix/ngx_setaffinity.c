@@ -50,4 +50,114 @@ ngx_setaffinity(ngx_cpuset_t *cpu_affinity, ngx_log_t *log)
     }
 }
 
+
+/*
+ * fills the node of each CPU, or -1 if it is not known, from
+ * the "/sys/devices/system/node/nodeN/cpulist" files which contain
+ * lists of CPU ranges such as "0-7,16-23", and returns the number
+ * of nodes found
+ */
+
+ngx_uint_t
+ngx_get_cpu_nodes(ngx_int_t *nodes, ngx_log_t *log)
+{
+    u_char     *p, *last;
+    ssize_t     n;
+    ngx_fd_t    fd;
+    ngx_int_t   from, to;
+    ngx_uint_t  i, node, found;
+    u_char      name[sizeof("/sys/devices/system/node/node/cpulist")
+                     + NGX_INT_T_LEN];
+    u_char      buf[4096];
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        nodes[i] = -1;
+    }
+
+    found = 0;
+
+    for (node = 0; node < NGX_NUMA_MAX_NODES; node++) {
+
+        ngx_sprintf(name, "/sys/devices/system/node/node%ui/cpulist%Z", node);
+
+        fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+        if (fd == NGX_INVALID_FILE) {
+            continue;
+        }
+
+        n = ngx_read_fd(fd, buf, sizeof(buf));
+
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_read_fd_n " \"%s\" failed", name);
+        }
+
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", name);
+        }
+
+        if (n <= 0) {
+            continue;
+        }
+
+        p = buf;
+        last = buf + n;
+
+        while (p < last) {
+
+            for (from = 0; p < last && *p >= '0' && *p <= '9'; p++) {
+                from = from * 10 + *p - '0';
+            }
+
+            to = from;
+
+            if (p < last && *p == '-') {
+                for (p++, to = 0; p < last && *p >= '0' && *p <= '9'; p++) {
+                    to = to * 10 + *p - '0';
+                }
+            }
+
+            while (from <= to && from < CPU_SETSIZE) {
+                nodes[from++] = node;
+            }
+
+            if (p == last || *p != ',') {
+                break;
+            }
+
+            p++;
+        }
+
+        found++;
+    }
+
+    return found;
+}
+
+
+#if (NGX_HAVE_MBIND)
+
+void
+ngx_set_numa_node(ngx_int_t node, ngx_log_t *log)
+{
+    unsigned long  mask;
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "set_mempolicy(): preferring node #%i", node);
+
+    mask = 1UL << node;
+
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+                NGX_NUMA_MAX_NODES + 1)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "set_mempolicy() failed");
+    }
+}
+
+#endif
+
 #endif
@@ -25,6 +25,18 @@ typedef cpuset_t  ngx_cpuset_t;
 
 void ngx_setaffinity(ngx_cpuset_t *cpu_affinity, ngx_log_t *log);
 
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+
+/* the node masks of mbind() and set_mempolicy() are one word long */
+#define NGX_NUMA_MAX_NODES  (sizeof(unsigned long) * 8)
+
+ngx_uint_t ngx_get_cpu_nodes(ngx_int_t *nodes, ngx_log_t *log);
+#if (NGX_HAVE_MBIND)
+void ngx_set_numa_node(ngx_int_t node, ngx_log_t *log);
+#endif
+
+#endif
+
 #else
 
 #define ngx_setaffinity(cpu_affinity, log)
@@ -11,10 +11,102 @@
 
 #if (NGX_HAVE_MAP_ANON)
 
+#if (NGX_SHM_PERSISTENT)
+
+#include <sys/file.h>
+
+
+/*
+ * A persistent zone is mapped from a file: the first page holds a header,
+ * and the zone follows it.  Pointers within the zone stay valid only if
+ * it is mapped at the same address, so the address is recorded in the
+ * header.  The file is locked while it is used, and the header is marked
+ * clean when the master process exits.  The contents are restored only
+ * from a clean file of the same nginx build and with the same layout, as
+ * set by the module which owns the zone; the module then has to update
+ * pointers to code, such as rbtree insert functions.
+ */
+
+#define NGX_SHM_FILE_MAGIC    "ngx_shm"
+#define NGX_SHM_FILE_VERSION  1
+
+
+typedef struct {
+    u_char        magic[8];
+    uint32_t      version;
+    uint32_t      binary;        /* nginx_version */
+    uint32_t      signature;
+    uint32_t      clean;
+    u_char       *addr;
+    size_t        size;
+    ngx_uint_t    layout;
+} ngx_shm_file_header_t;
+
+
+static ngx_int_t ngx_shm_alloc_file(ngx_shm_t *shm);
+
+#endif
+
+#if (NGX_HAVE_MAP_HUGETLB)
+static size_t ngx_shm_huge_page_size(ngx_log_t *log);
+#endif
+#if (NGX_HAVE_MBIND)
+static void ngx_shm_set_policy(ngx_shm_t *shm, size_t len);
+#endif
+
+
 ngx_int_t
 ngx_shm_alloc(ngx_shm_t *shm)
 {
-    shm->addr = (u_char *) mmap(NULL, shm->size,
+    size_t  len;
+
+    shm->page_size = ngx_pagesize;
+    len = shm->size;
+
+#if (NGX_SHM_PERSISTENT)
+
+    shm->fd = NGX_INVALID_FILE;
+    shm->restored = 0;
+
+    if (shm->file.len) {
+
+        if (ngx_shm_alloc_file(shm) == NGX_OK) {
+            goto mapped;
+        }
+
+        /* an anonymous zone is used instead */
+
+        shm->file.len = 0;
+    }
+
+#endif
+
+#if (NGX_HAVE_MAP_HUGETLB)
+
+    if (shm->huge == NGX_SHM_HUGE_ON) {
+        shm->page_size = ngx_shm_huge_page_size(shm->log);
+        len = ngx_align(shm->size, shm->page_size);
+
+        shm->addr = (u_char *) mmap(NULL, len, PROT_READ|PROT_WRITE,
+                                    MAP_ANON|MAP_SHARED|MAP_HUGETLB, -1, 0);
+
+        if (shm->addr != MAP_FAILED) {
+            goto mapped;
+        }
+
+        /* huge pages are not reserved or are exhausted */
+
+        ngx_log_error(NGX_LOG_WARN, shm->log, ngx_errno,
+                      "mmap(MAP_HUGETLB, %uz) failed for zone \"%V\", "
+                      "using regular pages", len, &shm->name);
+
+        shm->page_size = ngx_pagesize;
+        len = shm->size;
+    }
+
+#endif
+
+    shm->addr = (u_char *) mmap(NULL, len,
                                 PROT_READ|PROT_WRITE,
                                 MAP_ANON|MAP_SHARED, -1, 0);
 
@@ -24,16 +116,402 @@ ngx_shm_alloc(ngx_shm_t *shm)
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_MADV_HUGEPAGE)
+
+    /* transparent huge pages of shared memory also depend on "shmem_enabled" */
+
+    if (shm->huge != NGX_SHM_HUGE_OFF
+        && madvise(shm->addr, len, MADV_HUGEPAGE) == -1)
+    {
+        ngx_log_error(NGX_LOG_WARN, shm->log, ngx_errno,
+                      "madvise(MADV_HUGEPAGE) failed for zone \"%V\"",
+                      &shm->name);
+    }
+
+#endif
+
+#if (NGX_HAVE_MAP_HUGETLB || NGX_SHM_PERSISTENT)
+mapped:
+#endif
+
+#if (NGX_HAVE_MBIND)
+
+    /* the policy is set before the pages are touched */
+
+    if (shm->numa != NGX_SHM_NUMA_DEFAULT) {
+        ngx_shm_set_policy(shm, len);
+    }
+
+#endif
+
+    if (shm->huge != NGX_SHM_HUGE_OFF || shm->numa != NGX_SHM_NUMA_DEFAULT) {
+        ngx_log_error(NGX_LOG_NOTICE, shm->log, 0,
+                      "shared memory zone \"%V\" of %uz bytes "
+                      "uses %uzK pages%s",
+                      &shm->name, len, shm->page_size / 1024,
+                      (shm->huge != NGX_SHM_HUGE_OFF
+                       && shm->page_size == (size_t) ngx_pagesize)
+                      ? ", transparent huge pages advised" : "");
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_SHM_PERSISTENT)
+
+static ngx_int_t
+ngx_shm_alloc_file(ngx_shm_t *shm)
+{
+    u_char                 *addr, *hint;
+    size_t                  len;
+    ssize_t                 n;
+    ngx_fd_t                fd;
+    ngx_err_t               err;
+    ngx_shm_file_header_t   h, *header;
+
+    if (ngx_test_config) {
+        return NGX_DECLINED;
+    }
+
+    len = ngx_pagesize + shm->size;
+
+    fd = ngx_open_file(shm->file.data, NGX_FILE_RDWR,
+                       NGX_FILE_CREATE_OR_OPEN, NGX_FILE_OWNER_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", shm->file.data);
+        return NGX_DECLINED;
+    }
+
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "fcntl(FD_CLOEXEC) \"%s\" failed", shm->file.data);
+        goto failed;
+    }
+
+    if (flock(fd, LOCK_EX|LOCK_NB) == -1) {
+        err = ngx_errno;
+
+        if (err != NGX_EAGAIN) {
+            ngx_log_error(NGX_LOG_ALERT, shm->log, err,
+                          "flock(\"%s\") failed", shm->file.data);
+            goto failed;
+        }
+
+        if (ngx_process == NGX_PROCESS_MASTER || ngx_inherited) {
+
+            /*
+             * the zone is still used by old worker processes after
+             * reconfiguration, or by the old executable on binary upgrade;
+             * the contents cannot be shared with another executable,
+             * so a new file is created
+             */
+
+            if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+                ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                              ngx_close_file_n " \"%s\" failed",
+                              shm->file.data);
+            }
+
+            if (ngx_delete_file(shm->file.data) == NGX_FILE_ERROR) {
+                ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                              ngx_delete_file_n " \"%s\" failed",
+                              shm->file.data);
+                return NGX_DECLINED;
+            }
+
+            return ngx_shm_alloc_file(shm);
+        }
+
+        ngx_log_error(NGX_LOG_WARN, shm->log, 0,
+                      "\"%s\" is used by another process, "
+                      "shared memory zone \"%V\" is not persistent",
+                      shm->file.data, &shm->name);
+        goto failed;
+    }
+
+    n = pread(fd, &h, sizeof(ngx_shm_file_header_t), 0);
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "pread() \"%s\" failed", shm->file.data);
+        goto failed;
+    }
+
+    if (n != sizeof(ngx_shm_file_header_t)
+        || ngx_memcmp(h.magic, NGX_SHM_FILE_MAGIC, sizeof(h.magic)) != 0
+        || h.version != NGX_SHM_FILE_VERSION
+        || h.binary != nginx_version
+        || h.signature != ngx_crc32_short((u_char *) NGX_MODULE_SIGNATURE,
+                                          sizeof(NGX_MODULE_SIGNATURE) - 1)
+        || h.size != shm->size
+        || h.layout != shm->layout
+        || !h.clean)
+    {
+        if (n) {
+            ngx_log_error(NGX_LOG_NOTICE, shm->log, 0,
+                          "\"%s\" does not match shared memory zone \"%V\"",
+                          shm->file.data, &shm->name);
+        }
+
+        goto create;
+    }
+
+    hint = h.addr - ngx_pagesize;
+
+    addr = (u_char *) mmap(hint, len, PROT_READ|PROT_WRITE, MAP_SHARED,
+                           fd, 0);
+
+    if (addr == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "mmap(\"%s\", %uz) failed", shm->file.data, len);
+        goto failed;
+    }
+
+    if (addr != hint) {
+        ngx_log_error(NGX_LOG_NOTICE, shm->log, 0,
+                      "shared memory zone \"%V\" cannot be mapped at %p",
+                      &shm->name, h.addr);
+
+        if (munmap(addr, len) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                          "munmap(%p, %uz) failed", addr, len);
+        }
+
+        goto create;
+    }
+
+    header = (ngx_shm_file_header_t *) addr;
+    header->clean = 0;
+
+    if (msync(header, ngx_pagesize, MS_SYNC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "msync(\"%s\") failed", shm->file.data);
+    }
+
+    shm->exists = 1;
+    shm->restored = 1;
+
+    ngx_log_error(NGX_LOG_NOTICE, shm->log, 0,
+                  "shared memory zone \"%V\" is restored from \"%s\"",
+                  &shm->name, shm->file.data);
+
+    goto done;
+
+create:
+
+    /* the file is emptied so that the zone is zero-filled */
+
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, len) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "ftruncate(\"%s\", %uz) failed", shm->file.data, len);
+        goto failed;
+    }
+
+    addr = (u_char *) mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED,
+                           fd, 0);
+
+    if (addr == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "mmap(\"%s\", %uz) failed", shm->file.data, len);
+        goto failed;
+    }
+
+    header = (ngx_shm_file_header_t *) addr;
+
+    ngx_memcpy(header->magic, NGX_SHM_FILE_MAGIC, sizeof(header->magic));
+    header->version = NGX_SHM_FILE_VERSION;
+    header->binary = nginx_version;
+    header->signature = ngx_crc32_short((u_char *) NGX_MODULE_SIGNATURE,
+                                        sizeof(NGX_MODULE_SIGNATURE) - 1);
+    header->clean = 0;
+    header->addr = addr + ngx_pagesize;
+    header->size = shm->size;
+    header->layout = shm->layout;
+
+done:
+
+    /* worker processes share the lock, see ngx_shm_close() */
+
+    if (flock(fd, LOCK_SH) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "flock(\"%s\") failed", shm->file.data);
+    }
+
+    shm->addr = addr + ngx_pagesize;
+    shm->fd = fd;
+
     return NGX_OK;
+
+failed:
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", shm->file.data);
+    }
+
+    return NGX_DECLINED;
+}
+
+
+void
+ngx_shm_close(ngx_shm_t *shm)
+{
+    ngx_shm_file_header_t  *header;
+
+    if (shm->fd == NGX_INVALID_FILE) {
+        return;
+    }
+
+    /* the file may be used by another process after binary upgrade */
+
+    if (flock(shm->fd, LOCK_EX|LOCK_NB) == -1) {
+        return;
+    }
+
+    if (msync(shm->addr, shm->size, MS_SYNC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "msync(\"%s\") failed", shm->file.data);
+        return;
+    }
+
+    header = (ngx_shm_file_header_t *) (shm->addr - ngx_pagesize);
+    header->clean = 1;
+
+    if (msync(header, ngx_pagesize, MS_SYNC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "msync(\"%s\") failed", shm->file.data);
+    }
+}
+
+#endif
+
+
+#if (NGX_HAVE_MAP_HUGETLB)
+
+static size_t
+ngx_shm_huge_page_size(ngx_log_t *log)
+{
+    u_char     *p, *last;
+    size_t      size;
+    ssize_t     n;
+    ngx_fd_t    fd;
+    u_char      buf[4096];
+
+    size = 2 * 1024 * 1024;
+
+    fd = ngx_open_file("/proc/meminfo", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        return size;
+    }
+
+    n = ngx_read_fd(fd, buf, sizeof(buf) - 1);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"/proc/meminfo\" failed");
+    }
+
+    if (n <= 0) {
+        return size;
+    }
+
+    buf[n] = '\0';
+    last = buf + n;
+
+    /* "Hugepagesize:       2048 kB" */
+
+    p = (u_char *) ngx_strstr(buf, "Hugepagesize:");
+
+    if (p == NULL) {
+        return size;
+    }
+
+    for (p += sizeof("Hugepagesize:") - 1; p < last && *p == ' '; p++) {
+        /* void */
+    }
+
+    for (n = 0; p < last && *p >= '0' && *p <= '9'; p++) {
+        n = n * 10 + (*p - '0');
+    }
+
+    if (n > 0) {
+        size = (size_t) n * 1024;
+    }
+
+    return size;
+}
+
+#endif
+
+
+#if (NGX_HAVE_MBIND)
+
+static void
+ngx_shm_set_policy(ngx_shm_t *shm, size_t len)
+{
+    int            mode;
+    unsigned long  mask;
+
+    if (shm->numa == NGX_SHM_NUMA_INTERLEAVE) {
+
+        /* the kernel leaves out nodes without memory or not allowed */
+
+        mode = MPOL_INTERLEAVE;
+        mask = (unsigned long) -1;
+
+    } else {
+        mode = MPOL_BIND;
+        mask = 1UL << shm->numa;
+    }
+
+    if (syscall(SYS_mbind, shm->addr, len, mode, &mask,
+                sizeof(unsigned long) * 8 + 1, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_WARN, shm->log, ngx_errno,
+                      "mbind() failed for zone \"%V\"", &shm->name);
+    }
 }
 
+#endif
+
 
 void
 ngx_shm_free(ngx_shm_t *shm)
 {
-    if (munmap((void *) shm->addr, shm->size) == -1) {
+    size_t  len;
+
+#if (NGX_SHM_PERSISTENT)
+
+    if (shm->fd != NGX_INVALID_FILE) {
+        len = ngx_pagesize + shm->size;
+
+        if (munmap((void *) (shm->addr - ngx_pagesize), len) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                          "munmap(%p, %uz) failed", shm->addr, len);
+        }
+
+        if (ngx_close_file(shm->fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", shm->file.data);
+        }
+
+        return;
+    }
+
+#endif
+
+    /* huge page mappings are unmapped in whole pages */
+
+    len = ngx_align(shm->size, shm->page_size);
+
+    if (munmap((void *) shm->addr, len) == -1) {
         ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
-                      "munmap(%p, %uz) failed", shm->addr, shm->size);
+                      "munmap(%p, %uz) failed", shm->addr, len);
     }
 }
 
@@ -44,6 +522,8 @@ ngx_shm_alloc(ngx_shm_t *shm)
 {
     ngx_fd_t  fd;
 
+    shm->page_size = ngx_pagesize;
+
     fd = open("/dev/zero", O_RDWR);
 
     if (fd == -1) {
@@ -89,6 +569,8 @@ ngx_shm_alloc(ngx_shm_t *shm)
 {
     int  id;
 
+    shm->page_size = ngx_pagesize;
+
     id = shmget(IPC_PRIVATE, shm->size, (SHM_R|SHM_W|IPC_CREAT));
 
     if (id == -1) {
@@ -13,17 +13,41 @@
 #include <ngx_core.h>
 
 
+#define NGX_SHM_HUGE_OFF          0
+#define NGX_SHM_HUGE_ON           1
+#define NGX_SHM_HUGE_TRANSPARENT  2
+
+#define NGX_SHM_NUMA_DEFAULT      -1
+#define NGX_SHM_NUMA_INTERLEAVE   -2
+
+#if (NGX_HAVE_MAP_ANON && NGX_HAVE_FLOCK)
+#define NGX_SHM_PERSISTENT        1
+#endif
+
+
 typedef struct {
     u_char      *addr;
     size_t       size;
     ngx_str_t    name;
     ngx_log_t   *log;
     ngx_uint_t   exists;   /* unsigned  exists:1;  */
+
+    ngx_uint_t   huge;
+    ngx_int_t    numa;     /* node to bind to, or NGX_SHM_NUMA_* */
+    size_t       page_size;
+
+    ngx_str_t    file;     /* backing file of a persistent zone */
+    ngx_fd_t     fd;
+    ngx_uint_t   layout;   /* of contents which can be restored, or 0 */
+    ngx_uint_t   restored; /* unsigned  restored:1; */
 } ngx_shm_t;
 
 
 ngx_int_t ngx_shm_alloc(ngx_shm_t *shm);
 void ngx_shm_free(ngx_shm_t *shm);
+#if (NGX_SHM_PERSISTENT)
+void ngx_shm_close(ngx_shm_t *shm);
+#endif
 
 
 #endif /* _NGX_SHMEM_H_INCLUDED_ */
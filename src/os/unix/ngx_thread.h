@@ -60,11 +60,20 @@ ngx_tid_t ngx_thread_tid(void);
 
 #define ngx_log_tid           ngx_thread_tid()
 
+
+/* process-local caches are not locked and are bypassed in thread pools */
+
+#define ngx_thread_is_main()  pthread_equal(pthread_self(), ngx_main_thread)
+
+extern pthread_t  ngx_main_thread;
+
 #else
 
 #define ngx_log_tid           0
 #define NGX_TID_T_FMT         "%d"
 
+#define ngx_thread_is_main()  1
+
 #endif
 
 
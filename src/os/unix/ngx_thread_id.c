@@ -10,6 +10,9 @@
 #include <ngx_thread_pool.h>
 
 
+pthread_t  ngx_main_thread;
+
+
 #if (NGX_LINUX)
 
 /*
@@ -13,6 +13,55 @@
 static ngx_chain_t *ngx_udp_output_chain_to_iovec(ngx_iovec_t *vec,
     ngx_chain_t *in, ngx_log_t *log);
 static ssize_t ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec);
+#if (NGX_HAVE_SENDMMSG)
+static ssize_t ngx_udp_queue_send(ngx_connection_t *c, ngx_iovec_t *vec);
+static void ngx_udp_queue_handler(ngx_event_t *ev);
+static void ngx_udp_queue_flush(void);
+static ngx_uint_t ngx_udp_queue_build(ngx_uint_t from, struct mmsghdr *msgs,
+    ngx_uint_t *first);
+static void ngx_udp_set_srcaddr(struct msghdr *msg, struct sockaddr *local);
+
+
+#define NGX_UDP_QUEUE_SIZE    65536
+
+/* the kernel UDP_MAX_SEGMENTS */
+#define NGX_UDP_MAX_SEGMENTS  64
+
+
+typedef struct {
+    u_char                 *data;
+    size_t                  size;
+    socklen_t               socklen;
+    socklen_t               local_socklen;
+    ngx_sockaddr_t          sockaddr;
+    ngx_sockaddr_t          local_sockaddr;
+} ngx_udp_datagram_t;
+
+
+/*
+ * datagrams sent on shared listening sockets with "udp_batch" are copied
+ * to a queue and sent together by sendmmsg() after the current events are
+ * handled; consecutive datagrams to a peer, which are equal in size except
+ * the last one, are adjacent in the buffer and sent as one UDP_SEGMENT
+ * (GSO) message
+ */
+
+typedef struct {
+    ngx_event_t             event;
+    ngx_socket_t            fd;
+    ngx_uint_t              n;
+    u_char                 *last;
+    ngx_udp_datagram_t      datagrams[NGX_UDP_BATCH];
+    u_char                  buffer[NGX_UDP_QUEUE_SIZE];
+} ngx_udp_queue_t;
+
+
+static ngx_udp_queue_t      ngx_udp_queue;
+#if (NGX_HAVE_UDP_SEGMENT)
+static ngx_uint_t           ngx_udp_gso = 1;
+#endif
+
+#endif
 
 
 ngx_chain_t *
@@ -88,7 +137,24 @@ ngx_udp_unix_sendmsg_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
         send += vec.size;
 
+#if (NGX_HAVE_SENDMMSG)
+
+        if (c->shared && vec.size <= NGX_UDP_QUEUE_SIZE) {
+            ngx_event_conf_t  *ecf;
+
+            ecf = ngx_event_get_conf(ngx_cycle->conf_ctx,
+                                     ngx_event_core_module);
+
+            n = ecf->udp_batch ? ngx_udp_queue_send(c, &vec)
+                               : ngx_sendmsg(c, &vec);
+
+        } else {
+            n = ngx_sendmsg(c, &vec);
+        }
+
+#else
         n = ngx_sendmsg(c, &vec);
+#endif
 
         if (n == NGX_ERROR) {
             return NGX_CHAIN_ERROR;
@@ -333,3 +399,321 @@ eintr:
 
     return n;
 }
+
+
+#if (NGX_HAVE_SENDMMSG)
+
+static ssize_t
+ngx_udp_queue_send(ngx_connection_t *c, ngx_iovec_t *vec)
+{
+    ngx_uint_t           i;
+    ngx_udp_queue_t     *q;
+    ngx_udp_datagram_t  *d;
+
+    q = &ngx_udp_queue;
+
+    if (q->last == NULL) {
+        q->last = q->buffer;
+        q->event.handler = ngx_udp_queue_handler;
+        q->event.log = ngx_cycle->log;
+    }
+
+    if (q->n
+        && (q->fd != c->fd
+            || q->n == NGX_UDP_BATCH
+            || (size_t) (q->buffer + NGX_UDP_QUEUE_SIZE - q->last)
+               < vec->size))
+    {
+        ngx_udp_queue_flush();
+    }
+
+    d = &q->datagrams[q->n++];
+
+    d->data = q->last;
+    d->size = vec->size;
+
+    for (i = 0; i < vec->count; i++) {
+        q->last = ngx_cpymem(q->last, vec->iovs[i].iov_base,
+                             vec->iovs[i].iov_len);
+    }
+
+    /* the connection may be closed before the queue is flushed */
+
+    d->socklen = c->socklen;
+    ngx_memcpy(&d->sockaddr, c->sockaddr, c->socklen);
+
+    if (c->listening && c->listening->wildcard && c->local_sockaddr) {
+        d->local_socklen = c->local_socklen;
+        ngx_memcpy(&d->local_sockaddr, c->local_sockaddr, c->local_socklen);
+
+    } else {
+        d->local_socklen = 0;
+    }
+
+    q->fd = c->fd;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "udp queue: fd:%d %uz, n:%ui", c->fd, vec->size, q->n);
+
+    if (!q->event.posted) {
+        ngx_post_event(&q->event, &ngx_posted_events);
+    }
+
+    return vec->size;
+}
+
+
+static void
+ngx_udp_queue_handler(ngx_event_t *ev)
+{
+    ngx_udp_queue_flush();
+}
+
+
+static void
+ngx_udp_queue_flush(void)
+{
+    int                     rc;
+    ngx_err_t               err;
+    ngx_uint_t              i, n, calls;
+    ngx_udp_queue_t        *q;
+    struct mmsghdr          msgs[NGX_UDP_BATCH];
+    ngx_uint_t              first[NGX_UDP_BATCH + 1];
+
+    q = &ngx_udp_queue;
+
+    if (q->n == 0) {
+        return;
+    }
+
+    if (q->event.posted) {
+        ngx_delete_posted_event(&q->event);
+    }
+
+    n = ngx_udp_queue_build(0, msgs, first);
+    calls = 0;
+
+    for (i = 0; i < n; /* void */) {
+
+        rc = sendmmsg(q->fd, &msgs[i], n - i, 0);
+
+        calls++;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                       "sendmmsg: fd:%d %d of %ui", q->fd, rc, n - i);
+
+        if (rc >= 0) {
+            i += rc;
+            continue;
+        }
+
+        err = ngx_socket_errno;
+
+        if (err == NGX_EINTR) {
+            continue;
+        }
+
+        if (err == NGX_EAGAIN) {
+            ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, err,
+                          "sendmmsg() not ready, %ui datagrams dropped",
+                          q->n - first[i]);
+            break;
+        }
+
+#if (NGX_HAVE_UDP_SEGMENT)
+
+        if (err == EIO && first[i + 1] - first[i] > 1) {
+
+            /* the device does not support checksum offloading */
+
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, err,
+                          "sendmmsg() with UDP_SEGMENT failed, "
+                          "segmentation offload disabled");
+
+            ngx_udp_gso = 0;
+
+            n = ngx_udp_queue_build(first[i], msgs, first);
+            i = 0;
+            continue;
+        }
+
+#endif
+
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, err,
+                      "sendmmsg() failed, %ui datagrams dropped",
+                      first[i + 1] - first[i]);
+
+        /* the message is skipped */
+
+        i++;
+    }
+
+    if (ngx_event_loop_timing) {
+        ngx_event_loop_udp(1, calls, q->n);
+    }
+
+    q->n = 0;
+    q->last = q->buffer;
+}
+
+
+static ngx_uint_t
+ngx_udp_queue_build(ngx_uint_t from, struct mmsghdr *msgs, ngx_uint_t *first)
+{
+    size_t                  total;
+    ngx_uint_t              i, n, segs;
+    struct msghdr          *msg;
+    ngx_udp_queue_t        *q;
+    ngx_udp_datagram_t     *d, *next;
+#if (NGX_HAVE_UDP_SEGMENT)
+    uint16_t                size;
+    struct cmsghdr         *cmsg;
+#endif
+
+    static struct iovec     iovs[NGX_UDP_BATCH];
+    static u_char           controls[NGX_UDP_BATCH][NGX_UDP_CONTROL_LEN];
+
+    q = &ngx_udp_queue;
+
+    n = 0;
+
+    for (i = from; i < q->n; i += segs) {
+
+        d = &q->datagrams[i];
+
+        total = d->size;
+        segs = 1;
+
+#if (NGX_HAVE_UDP_SEGMENT)
+
+        while (ngx_udp_gso
+               && i + segs < q->n
+               && segs < NGX_UDP_MAX_SEGMENTS
+               && d[segs - 1].size == d->size)
+        {
+            next = &d[segs];
+
+            if (next->size > d->size
+                || total + next->size > 65507
+                || ngx_cmp_sockaddr(&next->sockaddr.sockaddr, next->socklen,
+                                    &d->sockaddr.sockaddr, d->socklen, 1)
+                   != NGX_OK
+                || next->local_socklen != d->local_socklen
+                || (d->local_socklen
+                    && ngx_cmp_sockaddr(&next->local_sockaddr.sockaddr,
+                                        next->local_socklen,
+                                        &d->local_sockaddr.sockaddr,
+                                        d->local_socklen, 0)
+                       != NGX_OK))
+            {
+                break;
+            }
+
+            total += next->size;
+            segs++;
+        }
+
+#else
+        (void) next;
+#endif
+
+        first[n] = i;
+
+        iovs[n].iov_base = d->data;
+        iovs[n].iov_len = total;
+
+        msg = &msgs[n].msg_hdr;
+
+        ngx_memzero(msg, sizeof(struct msghdr));
+
+        msg->msg_name = &d->sockaddr;
+        msg->msg_namelen = d->socklen;
+        msg->msg_iov = &iovs[n];
+        msg->msg_iovlen = 1;
+        msg->msg_control = controls[n];
+
+        if (d->local_socklen) {
+            ngx_udp_set_srcaddr(msg, &d->local_sockaddr.sockaddr);
+        }
+
+#if (NGX_HAVE_UDP_SEGMENT)
+
+        if (segs > 1) {
+            cmsg = (struct cmsghdr *) (controls[n] + msg->msg_controllen);
+
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+            size = (uint16_t) d->size;
+            ngx_memcpy(CMSG_DATA(cmsg), &size, sizeof(uint16_t));
+
+            msg->msg_controllen += CMSG_SPACE(sizeof(uint16_t));
+        }
+
+#endif
+
+        if (msg->msg_controllen == 0) {
+            msg->msg_control = NULL;
+        }
+
+        n++;
+    }
+
+    first[n] = q->n;
+
+    return n;
+}
+
+
+static void
+ngx_udp_set_srcaddr(struct msghdr *msg, struct sockaddr *local)
+{
+    struct cmsghdr  *cmsg;
+
+    cmsg = msg->msg_control;
+
+#if (NGX_HAVE_IP_PKTINFO)
+
+    if (local->sa_family == AF_INET) {
+        struct in_pktinfo   *pkt;
+        struct sockaddr_in  *sin;
+
+        cmsg->cmsg_level = IPPROTO_IP;
+        cmsg->cmsg_type = IP_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+
+        sin = (struct sockaddr_in *) local;
+
+        pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+        ngx_memzero(pkt, sizeof(struct in_pktinfo));
+        pkt->ipi_spec_dst = sin->sin_addr;
+
+        msg->msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
+    }
+
+#endif
+
+#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
+
+    if (local->sa_family == AF_INET6) {
+        struct in6_pktinfo   *pkt6;
+        struct sockaddr_in6  *sin6;
+
+        cmsg->cmsg_level = IPPROTO_IPV6;
+        cmsg->cmsg_type = IPV6_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+
+        sin6 = (struct sockaddr_in6 *) local;
+
+        pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+        ngx_memzero(pkt6, sizeof(struct in6_pktinfo));
+        pkt6->ipi6_addr = sin6->sin6_addr;
+
+        msg->msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
+    }
+
+#endif
+}
+
+#endif
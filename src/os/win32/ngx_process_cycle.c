@@ -780,6 +780,8 @@ ngx_worker_thread(void *data)
         }
     }
 
+    ngx_log_init_buffers(cycle);
+
     while (!ngx_quit) {
 
         if (ngx_exiting) {
@@ -834,17 +836,18 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
     }
 
     if (ngx_exiting) {
-        c = cycle->connections;
         for (i = 0; i < cycle->connection_n; i++) {
-            if (c[i].fd != (ngx_socket_t) -1
-                && c[i].read
-                && !c[i].read->accept
-                && !c[i].read->channel
-                && !c[i].read->resolver)
+            c = ngx_cycle_connection(cycle, i);
+
+            if (c->fd != (ngx_socket_t) -1
+                && c->read
+                && !c->read->accept
+                && !c->read->channel
+                && !c->read->resolver)
             {
                 ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
                               "*%uA open socket #%d left in connection %ui",
-                              c[i].number, c[i].fd, i);
+                              c->number, c->fd, i);
             }
         }
     }
@@ -13,6 +13,14 @@
 #include <ngx_core.h>
 
 
+#define NGX_SHM_HUGE_OFF          0
+#define NGX_SHM_HUGE_ON           1
+#define NGX_SHM_HUGE_TRANSPARENT  2
+
+#define NGX_SHM_NUMA_DEFAULT      -1
+#define NGX_SHM_NUMA_INTERLEAVE   -2
+
+
 typedef struct {
     u_char      *addr;
     size_t       size;
@@ -20,6 +28,14 @@ typedef struct {
     HANDLE       handle;
     ngx_log_t   *log;
     ngx_uint_t   exists;   /* unsigned  exists:1;  */
+
+    /* not supported */
+    ngx_uint_t   huge;
+    ngx_int_t    numa;
+    size_t       page_size;
+    ngx_str_t    file;
+    ngx_uint_t   layout;
+    ngx_uint_t   restored;
 } ngx_shm_t;
 
 
@@ -79,6 +79,7 @@ ngx_stream_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_array_t                    ports;
     ngx_stream_listen_t           *listen;
     ngx_stream_module_t           *module;
+    ngx_conf_profile_t             profile;
     ngx_stream_conf_ctx_t         *ctx;
     ngx_stream_core_srv_conf_t   **cscfp;
     ngx_stream_core_main_conf_t   *cmcf;
@@ -134,6 +135,8 @@ ngx_stream_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         module = cf->cycle->modules[m]->ctx;
         mi = cf->cycle->modules[m]->ctx_index;
 
+        ngx_conf_profile_start(&profile);
+
         if (module->create_main_conf) {
             ctx->main_conf[mi] = module->create_main_conf(cf);
             if (ctx->main_conf[mi] == NULL) {
@@ -147,6 +150,9 @@ ngx_stream_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 return NGX_CONF_ERROR;
             }
         }
+
+        ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                              NGX_CONF_PROFILE_CREATE_CONF);
     }
 
 
@@ -161,9 +167,14 @@ ngx_stream_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         module = cf->cycle->modules[m]->ctx;
 
         if (module->preconfiguration) {
+            ngx_conf_profile_start(&profile);
+
             if (module->preconfiguration(cf) != NGX_OK) {
                 return NGX_CONF_ERROR;
             }
+
+            ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                                  NGX_CONF_PROFILE_PRECONFIGURATION);
         }
     }
 
@@ -198,13 +209,20 @@ ngx_stream_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         cf->ctx = ctx;
 
         if (module->init_main_conf) {
+            ngx_conf_profile_start(&profile);
+
             rv = module->init_main_conf(cf, ctx->main_conf[mi]);
             if (rv != NGX_CONF_OK) {
                 *cf = pcf;
                 return rv;
             }
+
+            ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                                  NGX_CONF_PROFILE_INIT_CONF);
         }
 
+        ngx_conf_profile_start(&profile);
+
         for (s = 0; s < cmcf->servers.nelts; s++) {
 
             /* merge the server{}s' srv_conf's */
@@ -221,6 +239,9 @@ ngx_stream_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 }
             }
         }
+
+        ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                              NGX_CONF_PROFILE_MERGE_CONF);
     }
 
     if (ngx_stream_init_phases(cf, cmcf) != NGX_OK) {
@@ -235,9 +256,14 @@ ngx_stream_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         module = cf->cycle->modules[m]->ctx;
 
         if (module->postconfiguration) {
+            ngx_conf_profile_start(&profile);
+
             if (module->postconfiguration(cf) != NGX_OK) {
                 return NGX_CONF_ERROR;
             }
+
+            ngx_conf_profile_stop(&profile, cf->cycle->modules[m],
+                                  NGX_CONF_PROFILE_POSTCONFIGURATION);
         }
     }
 
@@ -0,0 +1,852 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+#define NGX_STREAM_CACHE_MISS     1
+#define NGX_STREAM_CACHE_HIT      2
+#define NGX_STREAM_CACHE_EXPIRED  3
+#define NGX_STREAM_CACHE_BYPASS   4
+
+
+typedef struct {
+    u_char                          color;
+    u_char                          dummy;
+    u_short                         len;
+    ngx_queue_t                     queue;
+    ngx_msec_t                      expire;
+    size_t                          size;
+    u_char                          data[1];
+} ngx_stream_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+    ngx_queue_t                     queue;
+} ngx_stream_cache_shctx_t;
+
+
+typedef struct {
+    ngx_stream_cache_shctx_t       *sh;
+    ngx_slab_pool_t                *shpool;
+    ngx_stream_complex_value_t      key;
+} ngx_stream_cache_ctx_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_str_t                       key;
+    uint32_t                        hash;
+    ngx_uint_t                      status;
+    unsigned                        store:1;
+} ngx_stream_cache_session_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_msec_t                      valid;
+    size_t                          id_length;
+} ngx_stream_cache_srv_conf_t;
+
+
+static ngx_int_t ngx_stream_cache_filter(ngx_stream_session_t *s,
+    ngx_chain_t *in, ngx_uint_t from_upstream);
+static ngx_int_t ngx_stream_cache_send(ngx_stream_session_t *s,
+    ngx_buf_t *b);
+static void ngx_stream_cache_store(ngx_stream_session_t *s,
+    ngx_stream_cache_session_t *cs, u_char *data, size_t size);
+static ngx_rbtree_node_t *ngx_stream_cache_lookup(ngx_rbtree_t *rbtree,
+    ngx_str_t *key, uint32_t hash);
+static void ngx_stream_cache_delete(ngx_stream_cache_ctx_t *ctx,
+    ngx_stream_cache_node_t *cn);
+static void ngx_stream_cache_expire(ngx_stream_cache_ctx_t *ctx,
+    ngx_uint_t n);
+
+static ngx_int_t ngx_stream_cache_status_variable(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_stream_cache_payload_variable(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data);
+static void *ngx_stream_cache_create_conf(ngx_conf_t *cf);
+static char *ngx_stream_cache_merge_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_stream_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_stream_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_stream_cache_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_stream_cache_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_stream_cache_commands[] = {
+
+    { ngx_string("cache_zone"),
+      NGX_STREAM_MAIN_CONF|NGX_CONF_TAKE2,
+      ngx_stream_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("cache"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_stream_cache,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_valid"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_cache_srv_conf_t, valid),
+      NULL },
+
+    { ngx_string("cache_id_length"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_cache_srv_conf_t, id_length),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_cache_module_ctx = {
+    ngx_stream_cache_add_variables,        /* preconfiguration */
+    ngx_stream_cache_init,                 /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_stream_cache_create_conf,          /* create server configuration */
+    ngx_stream_cache_merge_conf            /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_cache_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_cache_module_ctx,          /* module context */
+    ngx_stream_cache_commands,             /* module directives */
+    NGX_STREAM_MODULE,                     /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_stream_variable_t  ngx_stream_cache_vars[] = {
+
+    { ngx_string("cache_status"), NULL,
+      ngx_stream_cache_status_variable, 0, NGX_STREAM_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("cache_payload"), NULL,
+      ngx_stream_cache_payload_variable, 0, 0, 0 },
+
+      ngx_stream_null_variable
+};
+
+
+static ngx_str_t  ngx_stream_cache_status[] = {
+    ngx_string("MISS"),
+    ngx_string("HIT"),
+    ngx_string("EXPIRED"),
+    ngx_string("BYPASS")
+};
+
+
+static ngx_stream_filter_pt  ngx_stream_next_filter;
+
+
+static ngx_int_t
+ngx_stream_cache_handler(ngx_stream_session_t *s)
+{
+    ngx_str_t                     key;
+    ngx_buf_t                    *b;
+    ngx_connection_t             *c;
+    ngx_rbtree_node_t            *node;
+    ngx_stream_cache_ctx_t       *ctx;
+    ngx_stream_cache_node_t      *cn;
+    ngx_stream_cache_session_t   *cs;
+    ngx_stream_cache_srv_conf_t  *cscf;
+
+    c = s->connection;
+
+    cscf = ngx_stream_get_module_srv_conf(s, ngx_stream_cache_module);
+
+    /*
+     * only datagrams have known request and response boundaries,
+     * the first datagram of a session is the request
+     */
+
+    if (cscf->shm_zone == NULL
+        || c->type != SOCK_DGRAM
+        || c->buffer == NULL
+        || ngx_stream_get_module_ctx(s, ngx_stream_cache_module))
+    {
+        return NGX_DECLINED;
+    }
+
+    cs = ngx_pcalloc(c->pool, sizeof(ngx_stream_cache_session_t));
+    if (cs == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_stream_set_ctx(s, cs, ngx_stream_cache_module);
+
+    ctx = cscf->shm_zone->data;
+
+    if (ngx_stream_complex_value(s, &ctx->key, &key) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (key.len == 0 || key.len > 65535) {
+        cs->status = NGX_STREAM_CACHE_BYPASS;
+        return NGX_DECLINED;
+    }
+
+    cs->shm_zone = cscf->shm_zone;
+    cs->key = key;
+    cs->hash = ngx_crc32_short(key.data, key.len);
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    node = ngx_stream_cache_lookup(&ctx->sh->rbtree, &key, cs->hash);
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "stream cache: %08XD miss", cs->hash);
+
+        cs->status = NGX_STREAM_CACHE_MISS;
+        cs->store = 1;
+
+        return NGX_DECLINED;
+    }
+
+    cn = (ngx_stream_cache_node_t *) &node->color;
+
+    if ((ngx_msec_int_t) (cn->expire - ngx_current_msec) <= 0) {
+        ngx_stream_cache_delete(ctx, cn);
+
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "stream cache: %08XD expired", cs->hash);
+
+        cs->status = NGX_STREAM_CACHE_EXPIRED;
+        cs->store = 1;
+
+        return NGX_DECLINED;
+    }
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&ctx->sh->queue, &cn->queue);
+
+    b = ngx_create_temp_buf(c->pool, cn->size);
+
+    if (b) {
+        b->last = ngx_cpymem(b->pos, cn->data + cn->len, cn->size);
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                   "stream cache: %08XD hit", cs->hash);
+
+    cs->status = NGX_STREAM_CACHE_HIT;
+
+    if (ngx_stream_cache_send(s, b) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_STREAM_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_cache_send(ngx_stream_session_t *s, ngx_buf_t *b)
+{
+    size_t                        n;
+    ngx_buf_t                    *buf;
+    ngx_chain_t                   out;
+    ngx_stream_cache_srv_conf_t  *cscf;
+
+    b->last_buf = 1;
+
+    /* the response carries the transaction id of the request */
+
+    cscf = ngx_stream_get_module_srv_conf(s, ngx_stream_cache_module);
+
+    buf = s->connection->buffer;
+    n = ngx_min(cscf->id_length, (size_t) (buf->last - buf->pos));
+    n = ngx_min(n, (size_t) (b->last - b->pos));
+
+    ngx_memcpy(b->pos, buf->pos, n);
+
+    out.buf = b;
+    out.next = NULL;
+
+    if (ngx_stream_top_filter(s, &out, 1) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_cache_filter(ngx_stream_session_t *s, ngx_chain_t *in,
+    ngx_uint_t from_upstream)
+{
+    ngx_buf_t                   *b;
+    ngx_stream_cache_session_t  *cs;
+
+    cs = ngx_stream_get_module_ctx(s, ngx_stream_cache_module);
+
+    if (cs == NULL || !cs->store || !from_upstream || in == NULL) {
+        return ngx_stream_next_filter(s, in, from_upstream);
+    }
+
+    /* each buffer is a datagram, the first one is the response */
+
+    b = in->buf;
+
+    if (ngx_buf_in_memory(b) && b->last != b->pos) {
+        cs->store = 0;
+        ngx_stream_cache_store(s, cs, b->pos, b->last - b->pos);
+    }
+
+    return ngx_stream_next_filter(s, in, from_upstream);
+}
+
+
+static void
+ngx_stream_cache_store(ngx_stream_session_t *s,
+    ngx_stream_cache_session_t *cs, u_char *data, size_t size)
+{
+    size_t                        n;
+    ngx_rbtree_node_t            *node;
+    ngx_stream_cache_ctx_t       *ctx;
+    ngx_stream_cache_node_t      *cn;
+    ngx_stream_cache_srv_conf_t  *cscf;
+
+    cscf = ngx_stream_get_module_srv_conf(s, ngx_stream_cache_module);
+
+    ctx = cs->shm_zone->data;
+
+    n = offsetof(ngx_rbtree_node_t, color)
+        + offsetof(ngx_stream_cache_node_t, data)
+        + cs->key.len
+        + size;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    node = ngx_stream_cache_lookup(&ctx->sh->rbtree, &cs->key, cs->hash);
+
+    if (node) {
+        /* stored by a concurrent session */
+        ngx_stream_cache_delete(ctx, (ngx_stream_cache_node_t *) &node->color);
+    }
+
+    ngx_stream_cache_expire(ctx, 1);
+
+    node = ngx_slab_alloc_locked(ctx->shpool, n);
+
+    if (node == NULL) {
+        ngx_stream_cache_expire(ctx, 0);
+
+        node = ngx_slab_alloc_locked(ctx->shpool, n);
+        if (node == NULL) {
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+            ngx_log_debug1(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
+                           "stream cache: %08XD not stored", cs->hash);
+            return;
+        }
+    }
+
+    cn = (ngx_stream_cache_node_t *) &node->color;
+
+    node->key = cs->hash;
+    cn->len = (u_short) cs->key.len;
+    cn->expire = ngx_current_msec + cscf->valid;
+    cn->size = size;
+
+    ngx_memcpy(ngx_cpymem(cn->data, cs->key.data, cs->key.len), data, size);
+
+    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_queue_insert_head(&ctx->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
+                   "stream cache: %08XD stored %uz", cs->hash, size);
+}
+
+
+static void
+ngx_stream_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t        **p;
+    ngx_stream_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_stream_cache_node_t *) &node->color;
+            cnt = (ngx_stream_cache_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(cn->data, cnt->data, cn->len, cnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_rbtree_node_t *
+ngx_stream_cache_lookup(ngx_rbtree_t *rbtree, ngx_str_t *key, uint32_t hash)
+{
+    ngx_int_t                 rc;
+    ngx_rbtree_node_t        *node, *sentinel;
+    ngx_stream_cache_node_t  *cn;
+
+    node = rbtree->root;
+    sentinel = rbtree->sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        cn = (ngx_stream_cache_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(key->data, cn->data, key->len, (size_t) cn->len);
+
+        if (rc == 0) {
+            return node;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_stream_cache_delete(ngx_stream_cache_ctx_t *ctx,
+    ngx_stream_cache_node_t *cn)
+{
+    ngx_rbtree_node_t  *node;
+
+    node = (ngx_rbtree_node_t *)
+               ((u_char *) cn - offsetof(ngx_rbtree_node_t, color));
+
+    ngx_queue_remove(&cn->queue);
+    ngx_rbtree_delete(&ctx->sh->rbtree, node);
+    ngx_slab_free_locked(ctx->shpool, node);
+}
+
+
+static void
+ngx_stream_cache_expire(ngx_stream_cache_ctx_t *ctx, ngx_uint_t n)
+{
+    ngx_queue_t              *q;
+    ngx_stream_cache_node_t  *cn;
+
+    /*
+     * n == 1 deletes one or two expired entries at most,
+     * n == 0 deletes the least recently used entry and then one or two
+     * expired ones
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&ctx->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&ctx->sh->queue);
+
+        cn = ngx_queue_data(q, ngx_stream_cache_node_t, queue);
+
+        if (n++ != 0
+            && (ngx_msec_int_t) (cn->expire - ngx_current_msec) > 0)
+        {
+            return;
+        }
+
+        ngx_stream_cache_delete(ctx, cn);
+    }
+}
+
+
+static ngx_int_t
+ngx_stream_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_stream_cache_ctx_t  *octx = data;
+
+    size_t                   len;
+    ngx_stream_cache_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        if (ctx->key.value.len != octx->key.value.len
+            || ngx_strncmp(ctx->key.value.data, octx->key.value.data,
+                           ctx->key.value.len)
+               != 0)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache_zone \"%V\" uses the \"%V\" key "
+                          "while previously it used the \"%V\" key",
+                          &shm_zone->shm.name, &ctx->key.value,
+                          &octx->key.value);
+            return NGX_ERROR;
+        }
+
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_stream_cache_shctx_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_stream_cache_rbtree_insert_value);
+
+    ngx_queue_init(&ctx->sh->queue);
+
+    len = sizeof(" in cache_zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in cache_zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* a full zone evicts entries */
+    ctx->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_cache_status_variable(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data)
+{
+    ngx_stream_cache_session_t  *cs;
+
+    cs = ngx_stream_get_module_ctx(s, ngx_stream_cache_module);
+
+    if (cs == NULL || cs->status == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = ngx_stream_cache_status[cs->status - 1].len;
+    v->data = ngx_stream_cache_status[cs->status - 1].data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_cache_payload_variable(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data)
+{
+    size_t                        n;
+    ngx_buf_t                    *b;
+    ngx_stream_cache_srv_conf_t  *cscf;
+
+    b = s->connection->buffer;
+
+    if (b == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    /* the transaction id does not take part in the key */
+
+    cscf = ngx_stream_get_module_srv_conf(s, ngx_stream_cache_module);
+
+    n = ngx_min(cscf->id_length, (size_t) (b->last - b->pos));
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = b->last - b->pos - n;
+    v->data = b->pos + n;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_stream_cache_create_conf(ngx_conf_t *cf)
+{
+    ngx_stream_cache_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_stream_cache_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->shm_zone = NGX_CONF_UNSET_PTR;
+    conf->valid = NGX_CONF_UNSET_MSEC;
+    conf->id_length = NGX_CONF_UNSET_SIZE;
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_cache_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_stream_cache_srv_conf_t *prev = parent;
+    ngx_stream_cache_srv_conf_t *conf = child;
+
+    ngx_conf_merge_ptr_value(conf->shm_zone, prev->shm_zone, NULL);
+    ngx_conf_merge_msec_value(conf->valid, prev->valid, 10000);
+    ngx_conf_merge_size_value(conf->id_length, prev->id_length, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_stream_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    u_char                              *p;
+    ssize_t                              size;
+    ngx_str_t                           *value, name, s;
+    ngx_uint_t                           i;
+    ngx_shm_zone_t                      *shm_zone;
+    ngx_stream_cache_ctx_t              *ctx;
+    ngx_stream_compile_complex_value_t   ccv;
+
+    value = cf->args->elts;
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_stream_cache_ctx_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_stream_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = &ctx->key;
+
+    if (ngx_stream_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    size = 0;
+    name.len = 0;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_stream_cache_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ctx = shm_zone->data;
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "%V \"%V\" is already bound to key \"%V\"",
+                           &cmd->name, &name, &ctx->key.value);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_stream_cache_init_zone;
+    shm_zone->data = ctx;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_stream_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_stream_cache_srv_conf_t *cscf = conf;
+
+    ngx_str_t  *value;
+
+    if (cscf->shm_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        cscf->shm_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    cscf->shm_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                           &ngx_stream_cache_module);
+    if (cscf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_cache_add_variables(ngx_conf_t *cf)
+{
+    ngx_stream_variable_t  *var, *v;
+
+    for (v = ngx_stream_cache_vars; v->name.len; v++) {
+        var = ngx_stream_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_cache_init(ngx_conf_t *cf)
+{
+    ngx_stream_handler_pt        *h;
+    ngx_stream_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_STREAM_PREREAD_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_stream_cache_handler;
+
+    ngx_stream_next_filter = ngx_stream_top_filter;
+    ngx_stream_top_filter = ngx_stream_cache_filter;
+
+    return NGX_OK;
+}
@@ -9,6 +9,10 @@
 #include <ngx_core.h>
 #include <ngx_stream.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 #if (NGX_ZLIB)
 #include <zlib.h>
 #endif
@@ -35,6 +39,7 @@ typedef struct {
     ngx_str_t                    name;
     ngx_array_t                 *flushes;
     ngx_array_t                 *ops;        /* array of ngx_stream_log_op_t */
+    ngx_uint_t                   binary;     /* unsigned  binary:1 */
 } ngx_stream_log_fmt_t;
 
 
@@ -51,9 +56,33 @@ typedef struct {
     ngx_event_t                 *event;
     ngx_msec_t                   flush;
     ngx_int_t                    gzip;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t           *thread_pool;
+    ngx_thread_task_t           *task;
+    ngx_thread_task_t          **free;       /* ring of idle buffers */
+    ngx_uint_t                   nfree;
+    ngx_uint_t                   nbuffers;
+    ngx_uint_t                   dropped;
+#endif
 } ngx_stream_log_buf_t;
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_open_file_t             *file;
+    u_char                      *start;
+    size_t                       len;
+    ngx_fd_t                     fd;
+    ngx_int_t                    gzip;
+    ssize_t                      n;
+    ngx_err_t                    err;
+} ngx_stream_log_thread_ctx_t;
+
+#endif
+
+
 typedef struct {
     ngx_array_t                 *lengths;
     ngx_array_t                 *values;
@@ -68,6 +97,7 @@ typedef struct {
     ngx_syslog_peer_t           *syslog_peer;
     ngx_stream_log_fmt_t        *format;
     ngx_stream_complex_value_t  *filter;
+    ngx_msec_t                   interval;
 } ngx_stream_log_t;
 
 
@@ -78,10 +108,33 @@ typedef struct {
     time_t                       open_file_cache_valid;
     ngx_uint_t                   open_file_cache_min_uses;
 
+    /* the shortest interval of interim records among the logs */
+    ngx_msec_t                   interval;
+
     ngx_uint_t                   off;        /* unsigned  off:1 */
 } ngx_stream_log_srv_conf_t;
 
 
+/* the counters of a session at the previous record to a log */
+
+typedef struct {
+    off_t                        sent;
+    off_t                        received;
+    time_t                       sec;
+    ngx_msec_t                   msec;
+    ngx_msec_t                   next;
+} ngx_stream_log_interim_t;
+
+
+typedef struct {
+    ngx_stream_session_t        *session;
+    ngx_event_t                  event;
+    ngx_stream_log_interim_t    *logs;
+    ngx_stream_log_interim_t    *current;
+    ngx_uint_t                   interim;    /* unsigned  interim:1 */
+} ngx_stream_log_ctx_t;
+
+
 typedef struct {
     ngx_str_t                    name;
     size_t                       len;
@@ -94,6 +147,25 @@ typedef struct {
 #define NGX_STREAM_LOG_ESCAPE_NONE     2
 
 
+/* the same record layout as of the binary http access log */
+
+#define NGX_STREAM_LOG_BINARY_MAGIC    0x4e
+#define NGX_STREAM_LOG_BINARY_VERSION  1
+#define NGX_STREAM_LOG_BINARY_HEADER   6
+
+#define NGX_STREAM_LOG_BINARY_NONE     0
+#define NGX_STREAM_LOG_BINARY_UINT     1    /* 64-bit integer */
+#define NGX_STREAM_LOG_BINARY_TIME     2    /* msec since the epoch */
+#define NGX_STREAM_LOG_BINARY_MSEC     3    /* duration in msec */
+#define NGX_STREAM_LOG_BINARY_ADDR     4    /* length byte, 4 or 16 bytes */
+#define NGX_STREAM_LOG_BINARY_STRING   5    /* 16-bit length, bytes */
+
+#define NGX_STREAM_LOG_BINARY_INT_LEN  9
+#define NGX_STREAM_LOG_BINARY_ADDR_LEN 18
+
+
+static ngx_int_t ngx_stream_log_record(ngx_stream_session_t *s,
+    ngx_stream_log_t *log);
 static void ngx_stream_log_write(ngx_stream_session_t *s, ngx_stream_log_t *log,
     u_char *buf, size_t len);
 static ssize_t ngx_stream_log_script_write(ngx_stream_session_t *s,
@@ -110,6 +182,55 @@ static void ngx_stream_log_gzip_free(void *opaque, void *address);
 static void ngx_stream_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_stream_log_flush_handler(ngx_event_t *ev);
 
+#if (NGX_THREADS)
+static ngx_int_t ngx_stream_log_thread_post(ngx_open_file_t *file,
+    ngx_log_t *log);
+static void ngx_stream_log_thread_handler(void *data, ngx_log_t *log);
+static void ngx_stream_log_thread_event_handler(ngx_event_t *ev);
+#endif
+
+static ngx_int_t ngx_stream_log_interim_init(ngx_stream_session_t *s);
+static void ngx_stream_log_interim_handler(ngx_event_t *ev);
+static void ngx_stream_log_interim_cleanup(void *data);
+static ngx_stream_log_interim_t *ngx_stream_log_interim_state(
+    ngx_stream_session_t *s);
+
+static u_char *ngx_stream_log_record_type(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_bytes_sent_delta(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_bytes_received_delta(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_session_time_delta(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+
+static u_char *ngx_stream_log_binary_record(ngx_stream_session_t *s,
+    ngx_stream_log_fmt_t *fmt, u_char *buf);
+static u_char *ngx_stream_log_binary_time(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_binary_session_time(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_binary_status(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_binary_bytes_sent(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_binary_bytes_received(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_binary_remote_addr(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_binary_record_type(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_binary_bytes_sent_delta(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_binary_bytes_received_delta(
+    ngx_stream_session_t *s, u_char *buf, ngx_stream_log_op_t *op);
+static u_char *ngx_stream_log_binary_session_time_delta(
+    ngx_stream_session_t *s, u_char *buf, ngx_stream_log_op_t *op);
+static size_t ngx_stream_log_binary_variable_getlen(ngx_stream_session_t *s,
+    uintptr_t data);
+static u_char *ngx_stream_log_binary_variable(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op);
+
 static ngx_int_t ngx_stream_log_variable_compile(ngx_conf_t *cf,
     ngx_stream_log_op_t *op, ngx_str_t *value, ngx_uint_t escape);
 static size_t ngx_stream_log_variable_getlen(ngx_stream_session_t *s,
@@ -136,7 +257,8 @@ static char *ngx_stream_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_stream_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_stream_log_compile_format(ngx_conf_t *cf,
-    ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
+    ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s,
+    ngx_uint_t binary);
 static char *ngx_stream_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_stream_log_init(ngx_conf_t *cf);
@@ -197,17 +319,56 @@ ngx_module_t  ngx_stream_log_module = {
 };
 
 
+static ngx_stream_log_var_t  ngx_stream_log_vars[] = {
+    { ngx_string("log_record"), sizeof("interim") - 1,
+                          ngx_stream_log_record_type },
+    { ngx_string("bytes_sent_delta"), NGX_OFF_T_LEN,
+                          ngx_stream_log_bytes_sent_delta },
+    { ngx_string("bytes_received_delta"), NGX_OFF_T_LEN,
+                          ngx_stream_log_bytes_received_delta },
+    { ngx_string("session_time_delta"), NGX_TIME_T_LEN + 4,
+                          ngx_stream_log_session_time_delta },
+
+    { ngx_null_string, 0, NULL }
+};
+
+
+static ngx_stream_log_var_t  ngx_stream_log_binary_vars[] = {
+    { ngx_string("time_local"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_time },
+    { ngx_string("time_iso8601"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_time },
+    { ngx_string("msec"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_time },
+    { ngx_string("session_time"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_session_time },
+    { ngx_string("status"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_status },
+    { ngx_string("bytes_sent"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_bytes_sent },
+    { ngx_string("bytes_received"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_bytes_received },
+    { ngx_string("remote_addr"), NGX_STREAM_LOG_BINARY_ADDR_LEN,
+                          ngx_stream_log_binary_remote_addr },
+    { ngx_string("log_record"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_record_type },
+    { ngx_string("bytes_sent_delta"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_bytes_sent_delta },
+    { ngx_string("bytes_received_delta"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_bytes_received_delta },
+    { ngx_string("session_time_delta"), NGX_STREAM_LOG_BINARY_INT_LEN,
+                          ngx_stream_log_binary_session_time_delta },
+
+    { ngx_null_string, 0, NULL }
+};
+
+
 static ngx_int_t
 ngx_stream_log_handler(ngx_stream_session_t *s)
 {
-    u_char                     *line, *p;
-    size_t                      len, size;
-    ssize_t                     n;
-    ngx_str_t                   val;
-    ngx_uint_t                  i, l;
+    ngx_uint_t                  l;
     ngx_stream_log_t           *log;
-    ngx_stream_log_op_t        *op;
-    ngx_stream_log_buf_t       *buffer;
+    ngx_stream_log_ctx_t       *ctx;
     ngx_stream_log_srv_conf_t  *lscf;
 
     ngx_log_debug0(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
@@ -219,131 +380,220 @@ ngx_stream_log_handler(ngx_stream_session_t *s)
         return NGX_OK;
     }
 
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_log_module);
+
+    if (ctx && ctx->event.timer_set) {
+        ngx_del_timer(&ctx->event);
+    }
+
     log = lscf->logs->elts;
     for (l = 0; l < lscf->logs->nelts; l++) {
 
-        if (log[l].filter) {
-            if (ngx_stream_complex_value(s, log[l].filter, &val) != NGX_OK) {
-                return NGX_ERROR;
-            }
+        if (ctx) {
+            ctx->current = &ctx->logs[l];
+        }
 
-            if (val.len == 0 || (val.len == 1 && val.data[0] == '0')) {
-                continue;
-            }
+        if (ngx_stream_log_record(s, &log[l]) != NGX_OK) {
+            return NGX_ERROR;
         }
+    }
+
+    return NGX_OK;
+}
 
-        if (ngx_time() == log[l].disk_full_time) {
 
-            /*
-             * on FreeBSD writing to a full filesystem with enabled softupdates
-             * may block process for much longer time than writing to non-full
-             * filesystem, so we skip writing to a log for one second
-             */
+static ngx_int_t
+ngx_stream_log_record(ngx_stream_session_t *s, ngx_stream_log_t *log)
+{
+    u_char                *line, *p;
+    size_t                 len, size;
+    ssize_t                n;
+    ngx_str_t              val;
+    ngx_uint_t             i, interim;
+#if (NGX_THREADS)
+    ngx_int_t              rc;
+#endif
+    ngx_stream_log_op_t   *op;
+    ngx_stream_log_buf_t  *buffer;
+    ngx_stream_log_ctx_t  *ctx;
+
+    if (log->filter) {
+        if (ngx_stream_complex_value(s, log->filter, &val) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
-            continue;
+        if (val.len == 0 || (val.len == 1 && val.data[0] == '0')) {
+            return NGX_OK;
         }
+    }
 
-        ngx_stream_script_flush_no_cacheable_variables(s,
-                                                       log[l].format->flushes);
+    if (ngx_time() == log->disk_full_time) {
 
-        len = 0;
-        op = log[l].format->ops->elts;
-        for (i = 0; i < log[l].format->ops->nelts; i++) {
-            if (op[i].len == 0) {
-                len += op[i].getlen(s, op[i].data);
+        /*
+         * on FreeBSD writing to a full filesystem with enabled softupdates
+         * may block process for much longer time than writing to non-full
+         * filesystem, so we skip writing to a log for one second
+         */
 
-            } else {
-                len += op[i].len;
-            }
-        }
+        return NGX_OK;
+    }
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_log_module);
 
-        if (log[l].syslog_peer) {
+    interim = ctx ? ctx->interim : 0;
 
-            /* length of syslog's PRI and HEADER message parts */
-            len += sizeof("<255>Jan 01 00:00:00 ") - 1
-                   + ngx_cycle->hostname.len + 1
-                   + log[l].syslog_peer->tag.len + 2;
+    ngx_stream_script_flush_no_cacheable_variables(s, log->format->flushes);
 
-            goto alloc_line;
+    len = 0;
+    op = log->format->ops->elts;
+    for (i = 0; i < log->format->ops->nelts; i++) {
+        if (op[i].len == 0) {
+            len += op[i].getlen(s, op[i].data);
+
+        } else {
+            len += op[i].len;
         }
+    }
 
-        len += NGX_LINEFEED_SIZE;
+    if (log->syslog_peer) {
 
-        buffer = log[l].file ? log[l].file->data : NULL;
+        /* length of syslog's PRI and HEADER message parts */
+        len += sizeof("<255>Jan 01 00:00:00 ") - 1
+               + ngx_cycle->hostname.len + 1
+               + log->syslog_peer->tag.len + 2;
 
-        if (buffer) {
+        goto alloc_line;
+    }
 
-            if (len > (size_t) (buffer->last - buffer->pos)) {
+    len += log->format->binary ? NGX_STREAM_LOG_BINARY_HEADER
+                               : NGX_LINEFEED_SIZE;
 
-                ngx_stream_log_write(s, &log[l], buffer->start,
-                                     buffer->pos - buffer->start);
+    buffer = log->file ? log->file->data : NULL;
 
-                buffer->pos = buffer->start;
-            }
+    if (buffer) {
 
-            if (len <= (size_t) (buffer->last - buffer->pos)) {
+        if (len > (size_t) (buffer->last - buffer->pos)) {
 
-                p = buffer->pos;
+#if (NGX_THREADS)
+            if (buffer->thread_pool) {
+                rc = ngx_stream_log_thread_post(log->file, s->connection->log);
 
-                if (buffer->event && p == buffer->start) {
-                    ngx_add_timer(buffer->event, buffer->flush);
+                if (rc == NGX_BUSY
+                    && len <= (size_t) (buffer->last - buffer->start))
+                {
+                    /* all buffers are being written, drop the line */
+                    buffer->dropped++;
+                    return NGX_OK;
                 }
 
-                for (i = 0; i < log[l].format->ops->nelts; i++) {
-                    p = op[i].run(s, p, &op[i]);
+                if (rc == NGX_OK || rc == NGX_BUSY) {
+                    goto buffered;
                 }
+            }
+#endif
 
-                ngx_linefeed(p);
+            ngx_stream_log_write(s, log, buffer->start,
+                                 buffer->pos - buffer->start);
 
-                buffer->pos = p;
+            buffer->pos = buffer->start;
+        }
 
-                continue;
+#if (NGX_THREADS)
+    buffered:
+#endif
+
+        if (len <= (size_t) (buffer->last - buffer->pos)) {
+
+            p = buffer->pos;
+
+            if (buffer->event && p == buffer->start) {
+                ngx_add_timer(buffer->event, buffer->flush);
             }
 
-            if (buffer->event && buffer->event->timer_set) {
-                ngx_del_timer(buffer->event);
+            if (log->format->binary) {
+                buffer->pos = ngx_stream_log_binary_record(s, log->format, p);
+                return NGX_OK;
             }
-        }
 
-    alloc_line:
+            for (i = 0; i < log->format->ops->nelts; i++) {
+                p = op[i].run(s, p, &op[i]);
+            }
 
-        line = ngx_pnalloc(s->connection->pool, len);
-        if (line == NULL) {
-            return NGX_ERROR;
-        }
+            ngx_linefeed(p);
 
-        p = line;
+            buffer->pos = p;
 
-        if (log[l].syslog_peer) {
-            p = ngx_syslog_add_header(log[l].syslog_peer, line);
+            return NGX_OK;
         }
 
-        for (i = 0; i < log[l].format->ops->nelts; i++) {
-            p = op[i].run(s, p, &op[i]);
+        if (buffer->event && buffer->event->timer_set
+            && buffer->pos == buffer->start)
+        {
+            ngx_del_timer(buffer->event);
         }
+    }
 
-        if (log[l].syslog_peer) {
+alloc_line:
 
-            size = p - line;
+    /*
+     * interim records are not allocated from the session pool,
+     * which would otherwise grow during a long session
+     */
 
-            n = ngx_syslog_send(log[l].syslog_peer, line, size);
+    if (interim) {
+        line = ngx_alloc(len, s->connection->log);
 
-            if (n < 0) {
-                ngx_log_error(NGX_LOG_WARN, s->connection->log, 0,
-                              "send() to syslog failed");
+    } else {
+        line = ngx_pnalloc(s->connection->pool, len);
+    }
 
-            } else if ((size_t) n != size) {
-                ngx_log_error(NGX_LOG_WARN, s->connection->log, 0,
-                              "send() to syslog has written only %z of %uz",
-                              n, size);
-            }
+    if (line == NULL) {
+        return NGX_ERROR;
+    }
 
-            continue;
+    p = line;
+
+    if (log->format->binary) {
+        p = ngx_stream_log_binary_record(s, log->format, p);
+        ngx_stream_log_write(s, log, line, p - line);
+        goto done;
+    }
+
+    if (log->syslog_peer) {
+        p = ngx_syslog_add_header(log->syslog_peer, line);
+    }
+
+    for (i = 0; i < log->format->ops->nelts; i++) {
+        p = op[i].run(s, p, &op[i]);
+    }
+
+    if (log->syslog_peer) {
+
+        size = p - line;
+
+        n = ngx_syslog_send(log->syslog_peer, line, size);
+
+        if (n < 0) {
+            ngx_log_error(NGX_LOG_WARN, s->connection->log, 0,
+                          "send() to syslog failed");
+
+        } else if ((size_t) n != size) {
+            ngx_log_error(NGX_LOG_WARN, s->connection->log, 0,
+                          "send() to syslog has written only %z of %uz",
+                          n, size);
         }
 
-        ngx_linefeed(p);
+        goto done;
+    }
+
+    ngx_linefeed(p);
+
+    ngx_stream_log_write(s, log, line, p - line);
 
-        ngx_stream_log_write(s, &log[l], line, p - line);
+done:
+
+    if (interim) {
+        ngx_free(line);
     }
 
     return NGX_OK;
@@ -515,150 +765,778 @@ ngx_stream_log_gzip(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level,
     zstream.zfree = ngx_stream_log_gzip_free;
     zstream.opaque = pool;
 
-    out = ngx_pnalloc(pool, size);
-    if (out == NULL) {
-        goto done;
-    }
+    out = ngx_pnalloc(pool, size);
+    if (out == NULL) {
+        goto done;
+    }
+
+    zstream.next_in = buf;
+    zstream.avail_in = len;
+    zstream.next_out = out;
+    zstream.avail_out = size;
+
+    rc = deflateInit2(&zstream, (int) level, Z_DEFLATED, wbits + 16, memlevel,
+                      Z_DEFAULT_STRATEGY);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0, "deflateInit2() failed: %d", rc);
+        goto done;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_STREAM, log, 0,
+                   "deflate in: ni:%p no:%p ai:%ud ao:%ud",
+                   zstream.next_in, zstream.next_out,
+                   zstream.avail_in, zstream.avail_out);
+
+    rc = deflate(&zstream, Z_FINISH);
+
+    if (rc != Z_STREAM_END) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "deflate(Z_FINISH) failed: %d", rc);
+        goto done;
+    }
+
+    ngx_log_debug5(NGX_LOG_DEBUG_STREAM, log, 0,
+                   "deflate out: ni:%p no:%p ai:%ud ao:%ud rc:%d",
+                   zstream.next_in, zstream.next_out,
+                   zstream.avail_in, zstream.avail_out,
+                   rc);
+
+    size -= zstream.avail_out;
+
+    rc = deflateEnd(&zstream);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0, "deflateEnd() failed: %d", rc);
+        goto done;
+    }
+
+    n = ngx_write_fd(fd, out, size);
+
+    if (n != (ssize_t) size) {
+        err = (n == -1) ? ngx_errno : 0;
+
+        ngx_destroy_pool(pool);
+
+        ngx_set_errno(err);
+        return -1;
+    }
+
+done:
+
+    ngx_destroy_pool(pool);
+
+    /* simulate successful logging */
+    return len;
+}
+
+
+static void *
+ngx_stream_log_gzip_alloc(void *opaque, u_int items, u_int size)
+{
+    ngx_pool_t *pool = opaque;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, pool->log, 0,
+                   "gzip alloc: n:%ud s:%ud", items, size);
+
+    return ngx_palloc(pool, items * size);
+}
+
+
+static void
+ngx_stream_log_gzip_free(void *opaque, void *address)
+{
+#if 0
+    ngx_pool_t *pool = opaque;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, pool->log, 0,
+                   "gzip free: %p", address);
+#endif
+}
+
+#endif
+
+
+static void
+ngx_stream_log_flush(ngx_open_file_t *file, ngx_log_t *log)
+{
+    size_t                 len;
+    ssize_t                n;
+    ngx_stream_log_buf_t  *buffer;
+
+    buffer = file->data;
+
+#if (NGX_THREADS)
+    if (buffer->dropped) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "%ui lines dropped from \"%s\", "
+                      "all %ui log buffers were busy",
+                      buffer->dropped, file->name.data, buffer->nbuffers);
+
+        buffer->dropped = 0;
+    }
+#endif
+
+    len = buffer->pos - buffer->start;
+
+    if (len == 0) {
+        return;
+    }
+
+#if (NGX_ZLIB)
+    if (buffer->gzip) {
+        n = ngx_stream_log_gzip(file->fd, buffer->start, len, buffer->gzip,
+                                log);
+    } else {
+        n = ngx_write_fd(file->fd, buffer->start, len);
+    }
+#else
+    n = ngx_write_fd(file->fd, buffer->start, len);
+#endif
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      file->name.data);
+
+    } else if ((size_t) n != len) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                      file->name.data, n, len);
+    }
+
+    buffer->pos = buffer->start;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+}
+
+
+static void
+ngx_stream_log_flush_handler(ngx_event_t *ev)
+{
+#if (NGX_THREADS)
+    ngx_int_t              rc;
+    ngx_open_file_t       *file;
+    ngx_stream_log_buf_t  *buffer;
+#endif
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "stream log buffer flush handler");
+
+#if (NGX_THREADS)
+    file = ev->data;
+    buffer = file->data;
+
+    if (buffer->thread_pool) {
+        rc = ngx_stream_log_thread_post(file, ev->log);
+
+        if (rc == NGX_OK) {
+            return;
+        }
+
+        if (rc == NGX_BUSY) {
+            ngx_add_timer(ev, buffer->flush);
+            return;
+        }
+    }
+#endif
+
+    ngx_stream_log_flush(ev->data, ev->log);
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_stream_log_thread_post(ngx_open_file_t *file, ngx_log_t *log)
+{
+    ngx_fd_t                      fd;
+    ngx_thread_task_t            *task;
+    ngx_stream_log_buf_t         *buffer;
+    ngx_stream_log_thread_ctx_t  *ctx;
+
+    buffer = file->data;
+
+    if (buffer->pos == buffer->start) {
+        return NGX_OK;
+    }
+
+    if (buffer->nfree == 0) {
+        return NGX_BUSY;
+    }
+
+    /*
+     * the descriptor is duplicated as the file may be reopened
+     * or closed while the write is still in progress
+     */
+
+    fd = dup(file->fd);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "dup() of \"%s\" failed", file->name.data);
+        return NGX_ERROR;
+    }
+
+    task = buffer->task;
+    ctx = task->ctx;
+
+    ctx->len = buffer->pos - ctx->start;
+    ctx->fd = fd;
+
+    task->event.data = task;
+    task->event.handler = ngx_stream_log_thread_event_handler;
+    task->event.log = ngx_cycle->log;
+
+    if (ngx_thread_task_post(buffer->thread_pool, task) != NGX_OK) {
+        (void) ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, log, 0,
+                   "stream log thread post: %uz bytes, %ui buffers free",
+                   ctx->len, buffer->nfree - 1);
+
+    task = buffer->free[--buffer->nfree];
+    ctx = task->ctx;
+
+    buffer->task = task;
+    buffer->last = ctx->start + (buffer->last - buffer->start);
+    buffer->start = ctx->start;
+    buffer->pos = ctx->start;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_log_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_stream_log_thread_ctx_t *ctx = data;
+
+    ssize_t  n;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                   "stream log thread write: %uz", ctx->len);
+
+#if (NGX_ZLIB)
+    if (ctx->gzip) {
+        n = ngx_stream_log_gzip(ctx->fd, ctx->start, ctx->len, ctx->gzip, log);
+    } else {
+        n = ngx_write_fd(ctx->fd, ctx->start, ctx->len);
+    }
+#else
+    n = ngx_write_fd(ctx->fd, ctx->start, ctx->len);
+#endif
+
+    ctx->err = (n == -1) ? ngx_errno : 0;
+    ctx->n = n;
+
+    (void) ngx_close_file(ctx->fd);
+}
+
+
+static void
+ngx_stream_log_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_thread_task_t            *task;
+    ngx_stream_log_buf_t         *buffer;
+    ngx_stream_log_thread_ctx_t  *ctx;
+
+    task = ev->data;
+    ctx = task->ctx;
+    buffer = ctx->file->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, ev->log, 0,
+                   "stream log thread done: %z", ctx->n);
+
+    if (ctx->n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ctx->err,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      ctx->file->name.data);
+
+    } else if ((size_t) ctx->n != ctx->len) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                      ctx->file->name.data, ctx->n, ctx->len);
+    }
+
+    buffer->free[buffer->nfree++] = task;
+
+    if (buffer->dropped) {
+        ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                      "%ui lines dropped from \"%s\", "
+                      "all %ui log buffers were busy",
+                      buffer->dropped, ctx->file->name.data,
+                      buffer->nbuffers);
+
+        buffer->dropped = 0;
+    }
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_stream_log_interim_init(ngx_stream_session_t *s)
+{
+    ngx_uint_t                  l;
+    ngx_stream_log_t           *log;
+    ngx_pool_cleanup_t         *cln;
+    ngx_stream_log_ctx_t       *ctx;
+    ngx_stream_log_srv_conf_t  *lscf;
+
+    lscf = ngx_stream_get_module_srv_conf(s, ngx_stream_log_module);
+
+    if (lscf->off || lscf->interval == 0) {
+        return NGX_DECLINED;
+    }
+
+    ctx = ngx_pcalloc(s->connection->pool, sizeof(ngx_stream_log_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->logs = ngx_pcalloc(s->connection->pool,
+                            lscf->logs->nelts
+                            * sizeof(ngx_stream_log_interim_t));
+    if (ctx->logs == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(s->connection->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_stream_log_interim_cleanup;
+    cln->data = ctx;
+
+    log = lscf->logs->elts;
+    for (l = 0; l < lscf->logs->nelts; l++) {
+        ctx->logs[l].sec = s->start_sec;
+        ctx->logs[l].msec = s->start_msec;
+        ctx->logs[l].next = ngx_current_msec + log[l].interval;
+    }
+
+    ctx->session = s;
+
+    ctx->event.handler = ngx_stream_log_interim_handler;
+    ctx->event.data = ctx;
+    ctx->event.log = s->connection->log;
+    ctx->event.cancelable = 1;
+
+    ngx_add_timer(&ctx->event, lscf->interval);
+
+    ngx_stream_set_ctx(s, ctx, ngx_stream_log_module);
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_stream_log_interim_handler(ngx_event_t *ev)
+{
+    ngx_msec_t                  timer;
+    ngx_uint_t                  l;
+    ngx_time_t                 *tp;
+    ngx_msec_int_t              left;
+    ngx_stream_log_t           *log;
+    ngx_stream_log_ctx_t       *ctx;
+    ngx_stream_session_t       *s;
+    ngx_stream_log_interim_t   *st;
+    ngx_stream_log_srv_conf_t  *lscf;
+
+    ctx = ev->data;
+    s = ctx->session;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_STREAM, ev->log, 0,
+                   "stream log interim handler");
+
+    lscf = ngx_stream_get_module_srv_conf(s, ngx_stream_log_module);
+
+    tp = ngx_timeofday();
+    timer = NGX_TIMER_INFINITE;
+
+    ctx->interim = 1;
+
+    log = lscf->logs->elts;
+    for (l = 0; l < lscf->logs->nelts; l++) {
+
+        if (log[l].interval == 0) {
+            continue;
+        }
+
+        st = &ctx->logs[l];
+
+        left = (ngx_msec_int_t) (st->next - ngx_current_msec);
+
+        if (left <= 0) {
+            ctx->current = st;
+
+            (void) ngx_stream_log_record(s, &log[l]);
+
+            st->sent = s->connection->sent;
+            st->received = s->received;
+            st->sec = tp->sec;
+            st->msec = tp->msec;
+            st->next = ngx_current_msec + log[l].interval;
+
+            left = log[l].interval;
+        }
+
+        timer = ngx_min(timer, (ngx_msec_t) left);
+    }
+
+    ctx->interim = 0;
+    ctx->current = NULL;
+
+    ngx_add_timer(ev, timer);
+}
+
+
+static void
+ngx_stream_log_interim_cleanup(void *data)
+{
+    ngx_stream_log_ctx_t  *ctx = data;
+
+    if (ctx->event.timer_set) {
+        ngx_del_timer(&ctx->event);
+    }
+}
+
+
+static ngx_stream_log_interim_t *
+ngx_stream_log_interim_state(ngx_stream_session_t *s)
+{
+    ngx_stream_log_ctx_t  *ctx;
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_log_module);
+
+    return ctx ? ctx->current : NULL;
+}
+
+
+static u_char *
+ngx_stream_log_record_type(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    ngx_stream_log_ctx_t  *ctx;
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_log_module);
+
+    if (ctx && ctx->interim) {
+        return ngx_cpymem(buf, "interim", sizeof("interim") - 1);
+    }
+
+    return ngx_cpymem(buf, "final", sizeof("final") - 1);
+}
+
+
+static off_t
+ngx_stream_log_sent_delta(ngx_stream_session_t *s)
+{
+    ngx_stream_log_interim_t  *st;
+
+    st = ngx_stream_log_interim_state(s);
+
+    return s->connection->sent - (st ? st->sent : 0);
+}
+
+
+static off_t
+ngx_stream_log_received_delta(ngx_stream_session_t *s)
+{
+    ngx_stream_log_interim_t  *st;
+
+    st = ngx_stream_log_interim_state(s);
+
+    return s->received - (st ? st->received : 0);
+}
+
+
+static ngx_msec_int_t
+ngx_stream_log_time_delta(ngx_stream_session_t *s)
+{
+    time_t                     sec;
+    ngx_msec_t                 msec;
+    ngx_time_t                *tp;
+    ngx_msec_int_t             ms;
+    ngx_stream_log_interim_t  *st;
+
+    st = ngx_stream_log_interim_state(s);
+
+    if (st) {
+        sec = st->sec;
+        msec = st->msec;
+
+    } else {
+        sec = s->start_sec;
+        msec = s->start_msec;
+    }
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t) ((tp->sec - sec) * 1000 + (tp->msec - msec));
+
+    return ngx_max(ms, 0);
+}
+
+
+static u_char *
+ngx_stream_log_bytes_sent_delta(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    return ngx_sprintf(buf, "%O", ngx_stream_log_sent_delta(s));
+}
+
+
+static u_char *
+ngx_stream_log_bytes_received_delta(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    return ngx_sprintf(buf, "%O", ngx_stream_log_received_delta(s));
+}
+
+
+static u_char *
+ngx_stream_log_session_time_delta(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    ngx_msec_int_t  ms;
+
+    ms = ngx_stream_log_time_delta(s);
+
+    return ngx_sprintf(buf, "%T.%03M", (time_t) ms / 1000, ms % 1000);
+}
+
+
+static u_char *
+ngx_stream_log_binary_record(ngx_stream_session_t *s,
+    ngx_stream_log_fmt_t *fmt, u_char *buf)
+{
+    u_char               *p;
+    size_t                len;
+    ngx_uint_t            i;
+    ngx_stream_log_op_t  *op;
+
+    p = buf + NGX_STREAM_LOG_BINARY_HEADER;
+
+    op = fmt->ops->elts;
+    for (i = 0; i < fmt->ops->nelts; i++) {
+        p = op[i].run(s, p, &op[i]);
+    }
+
+    len = p - buf - NGX_STREAM_LOG_BINARY_HEADER;
+
+    buf[0] = NGX_STREAM_LOG_BINARY_MAGIC;
+    buf[1] = NGX_STREAM_LOG_BINARY_VERSION;
+    buf[2] = (u_char) (len >> 24);
+    buf[3] = (u_char) (len >> 16);
+    buf[4] = (u_char) (len >> 8);
+    buf[5] = (u_char) len;
+
+    return p;
+}
+
+
+static ngx_inline u_char *
+ngx_stream_log_binary_uint(u_char *buf, ngx_uint_t type, uint64_t n)
+{
+    *buf++ = (u_char) type;
+    *buf++ = (u_char) (n >> 56);
+    *buf++ = (u_char) (n >> 48);
+    *buf++ = (u_char) (n >> 40);
+    *buf++ = (u_char) (n >> 32);
+    *buf++ = (u_char) (n >> 24);
+    *buf++ = (u_char) (n >> 16);
+    *buf++ = (u_char) (n >> 8);
+    *buf++ = (u_char) n;
+
+    return buf;
+}
+
+
+static u_char *
+ngx_stream_log_binary_time(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return ngx_stream_log_binary_uint(buf, NGX_STREAM_LOG_BINARY_TIME,
+                                      (uint64_t) tp->sec * 1000 + tp->msec);
+}
+
+
+static u_char *
+ngx_stream_log_binary_session_time(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    ngx_time_t      *tp;
+    ngx_msec_int_t   ms;
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - s->start_sec) * 1000 + (tp->msec - s->start_msec));
+    ms = ngx_max(ms, 0);
+
+    return ngx_stream_log_binary_uint(buf, NGX_STREAM_LOG_BINARY_MSEC, ms);
+}
 
-    zstream.next_in = buf;
-    zstream.avail_in = len;
-    zstream.next_out = out;
-    zstream.avail_out = size;
 
-    rc = deflateInit2(&zstream, (int) level, Z_DEFLATED, wbits + 16, memlevel,
-                      Z_DEFAULT_STRATEGY);
+static u_char *
+ngx_stream_log_binary_status(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    return ngx_stream_log_binary_uint(buf, NGX_STREAM_LOG_BINARY_UINT,
+                                      s->status);
+}
 
-    if (rc != Z_OK) {
-        ngx_log_error(NGX_LOG_ALERT, log, 0, "deflateInit2() failed: %d", rc);
-        goto done;
-    }
 
-    ngx_log_debug4(NGX_LOG_DEBUG_STREAM, log, 0,
-                   "deflate in: ni:%p no:%p ai:%ud ao:%ud",
-                   zstream.next_in, zstream.next_out,
-                   zstream.avail_in, zstream.avail_out);
+static u_char *
+ngx_stream_log_binary_bytes_sent(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    return ngx_stream_log_binary_uint(buf, NGX_STREAM_LOG_BINARY_UINT,
+                                      s->connection->sent);
+}
 
-    rc = deflate(&zstream, Z_FINISH);
 
-    if (rc != Z_STREAM_END) {
-        ngx_log_error(NGX_LOG_ALERT, log, 0,
-                      "deflate(Z_FINISH) failed: %d", rc);
-        goto done;
-    }
+static u_char *
+ngx_stream_log_binary_bytes_received(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    return ngx_stream_log_binary_uint(buf, NGX_STREAM_LOG_BINARY_UINT,
+                                      s->received);
+}
 
-    ngx_log_debug5(NGX_LOG_DEBUG_STREAM, log, 0,
-                   "deflate out: ni:%p no:%p ai:%ud ao:%ud rc:%d",
-                   zstream.next_in, zstream.next_out,
-                   zstream.avail_in, zstream.avail_out,
-                   rc);
 
-    size -= zstream.avail_out;
+static u_char *
+ngx_stream_log_binary_remote_addr(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    struct sockaddr      *sa;
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
 
-    rc = deflateEnd(&zstream);
+    sa = s->connection->sockaddr;
 
-    if (rc != Z_OK) {
-        ngx_log_error(NGX_LOG_ALERT, log, 0, "deflateEnd() failed: %d", rc);
-        goto done;
-    }
+    switch (sa->sa_family) {
 
-    n = ngx_write_fd(fd, out, size);
+    case AF_INET:
+        sin = (struct sockaddr_in *) sa;
 
-    if (n != (ssize_t) size) {
-        err = (n == -1) ? ngx_errno : 0;
+        *buf++ = NGX_STREAM_LOG_BINARY_ADDR;
+        *buf++ = 4;
 
-        ngx_destroy_pool(pool);
+        return ngx_cpymem(buf, &sin->sin_addr, 4);
 
-        ngx_set_errno(err);
-        return -1;
-    }
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) sa;
 
-done:
+        *buf++ = NGX_STREAM_LOG_BINARY_ADDR;
+        *buf++ = 16;
 
-    ngx_destroy_pool(pool);
+        return ngx_cpymem(buf, &sin6->sin6_addr, 16);
+#endif
 
-    /* simulate successful logging */
-    return len;
+    default: /* AF_UNIX */
+        *buf = NGX_STREAM_LOG_BINARY_NONE;
+        return buf + 1;
+    }
 }
 
 
-static void *
-ngx_stream_log_gzip_alloc(void *opaque, u_int items, u_int size)
+static u_char *
+ngx_stream_log_binary_record_type(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
 {
-    ngx_pool_t *pool = opaque;
+    ngx_stream_log_ctx_t  *ctx;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, pool->log, 0,
-                   "gzip alloc: n:%ud s:%ud", items, size);
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_log_module);
 
-    return ngx_palloc(pool, items * size);
+    return ngx_stream_log_binary_uint(buf, NGX_STREAM_LOG_BINARY_UINT,
+                                      (ctx && ctx->interim) ? 1 : 0);
 }
 
 
-static void
-ngx_stream_log_gzip_free(void *opaque, void *address)
+static u_char *
+ngx_stream_log_binary_bytes_sent_delta(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
 {
-#if 0
-    ngx_pool_t *pool = opaque;
-
-    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, pool->log, 0,
-                   "gzip free: %p", address);
-#endif
+    return ngx_stream_log_binary_uint(buf, NGX_STREAM_LOG_BINARY_UINT,
+                                      ngx_stream_log_sent_delta(s));
 }
 
-#endif
+
+static u_char *
+ngx_stream_log_binary_bytes_received_delta(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op)
+{
+    return ngx_stream_log_binary_uint(buf, NGX_STREAM_LOG_BINARY_UINT,
+                                      ngx_stream_log_received_delta(s));
+}
 
 
-static void
-ngx_stream_log_flush(ngx_open_file_t *file, ngx_log_t *log)
+static u_char *
+ngx_stream_log_binary_session_time_delta(ngx_stream_session_t *s,
+    u_char *buf, ngx_stream_log_op_t *op)
 {
-    size_t                 len;
-    ssize_t                n;
-    ngx_stream_log_buf_t  *buffer;
+    return ngx_stream_log_binary_uint(buf, NGX_STREAM_LOG_BINARY_MSEC,
+                                      ngx_stream_log_time_delta(s));
+}
 
-    buffer = file->data;
 
-    len = buffer->pos - buffer->start;
+static size_t
+ngx_stream_log_binary_variable_getlen(ngx_stream_session_t *s, uintptr_t data)
+{
+    ngx_stream_variable_value_t  *value;
 
-    if (len == 0) {
-        return;
-    }
+    value = ngx_stream_get_indexed_variable(s, data);
 
-#if (NGX_ZLIB)
-    if (buffer->gzip) {
-        n = ngx_stream_log_gzip(file->fd, buffer->start, len, buffer->gzip,
-                                log);
-    } else {
-        n = ngx_write_fd(file->fd, buffer->start, len);
+    if (value == NULL || value->not_found) {
+        return 1;
     }
-#else
-    n = ngx_write_fd(file->fd, buffer->start, len);
-#endif
 
-    if (n == -1) {
-        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
-                      ngx_write_fd_n " to \"%s\" failed",
-                      file->name.data);
+    return 3 + ngx_min(value->len, 0xffff);
+}
 
-    } else if ((size_t) n != len) {
-        ngx_log_error(NGX_LOG_ALERT, log, 0,
-                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
-                      file->name.data, n, len);
-    }
 
-    buffer->pos = buffer->start;
+static u_char *
+ngx_stream_log_binary_variable(ngx_stream_session_t *s, u_char *buf,
+    ngx_stream_log_op_t *op)
+{
+    size_t                        len;
+    ngx_stream_variable_value_t  *value;
 
-    if (buffer->event && buffer->event->timer_set) {
-        ngx_del_timer(buffer->event);
+    value = ngx_stream_get_indexed_variable(s, op->data);
+
+    if (value == NULL || value->not_found) {
+        *buf = NGX_STREAM_LOG_BINARY_NONE;
+        return buf + 1;
     }
-}
 
+    /* longer values are truncated */
 
-static void
-ngx_stream_log_flush_handler(ngx_event_t *ev)
-{
-    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
-                   "stream log buffer flush handler");
+    len = ngx_min(value->len, 0xffff);
 
-    ngx_stream_log_flush(ev->data, ev->log);
+    *buf++ = NGX_STREAM_LOG_BINARY_STRING;
+    *buf++ = (u_char) (len >> 8);
+    *buf++ = (u_char) len;
+
+    return ngx_cpymem(buf, value->data, len);
 }
 
 
@@ -961,6 +1839,7 @@ ngx_stream_log_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     conf->logs = prev->logs;
     conf->off = prev->off;
+    conf->interval = prev->interval;
 
     return NGX_CONF_OK;
 }
@@ -974,8 +1853,15 @@ ngx_stream_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ssize_t                              size;
     ngx_int_t                            gzip;
     ngx_uint_t                           i, n;
-    ngx_msec_t                           flush;
+    ngx_msec_t                           flush, interval;
     ngx_str_t                           *value, name, s;
+#if (NGX_THREADS)
+    ngx_int_t                            nbuffers;
+    ngx_str_t                            pool;
+    ngx_thread_pool_t                   *tp;
+    ngx_thread_task_t                   *task;
+    ngx_stream_log_thread_ctx_t         *ctx;
+#endif
     ngx_stream_log_t                    *log;
     ngx_syslog_peer_t                   *peer;
     ngx_stream_log_buf_t                *buffer;
@@ -1090,9 +1976,21 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+    if (log->syslog_peer && log->format->binary) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "binary log format \"%V\" cannot be used "
+                           "with syslog", &name);
+        return NGX_CONF_ERROR;
+    }
+
     size = 0;
     flush = 0;
     gzip = 0;
+    interval = 0;
+#if (NGX_THREADS)
+    tp = NULL;
+    nbuffers = 0;
+#endif
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1159,6 +2057,66 @@ process_formats:
 #endif
         }
 
+        if (ngx_strncmp(value[i].data, "threads", 7) == 0
+            && (value[i].len == 7 || value[i].data[7] == '='))
+        {
+#if (NGX_THREADS)
+            pool.len = value[i].len > 8 ? value[i].len - 8 : 0;
+            pool.data = value[i].data + 8;
+
+            tp = ngx_thread_pool_add(cf, pool.len ? &pool : NULL);
+            if (tp == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            if (size == 0) {
+                size = 64 * 1024;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"threads\" is unsupported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "buffers=", 8) == 0) {
+#if (NGX_THREADS)
+            nbuffers = ngx_atoi(value[i].data + 8, value[i].len - 8);
+
+            if (nbuffers < 2 || nbuffers > 64) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of buffers \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"buffers\" is unsupported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            interval = ngx_parse_time(&s, 0);
+
+            if (interval == (ngx_msec_t) NGX_ERROR || interval < 1000) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid interval \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
             s.len = value[i].len - 3;
             s.data = value[i].data + 3;
@@ -1187,6 +2145,27 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+    if (interval) {
+        log->interval = interval;
+
+        if (lscf->interval == 0 || interval < lscf->interval) {
+            lscf->interval = interval;
+        }
+    }
+
+#if (NGX_THREADS)
+    if (nbuffers && tp == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no thread pool is defined for access_log \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (tp && nbuffers == 0) {
+        nbuffers = 4;
+    }
+#endif
+
     if (flush && size == 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "no buffer is defined for access_log \"%V\"",
@@ -1222,6 +2201,18 @@ process_formats:
                 return NGX_CONF_ERROR;
             }
 
+#if (NGX_THREADS)
+            if (buffer->thread_pool != tp
+                || buffer->nbuffers != (ngx_uint_t) nbuffers)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "access_log \"%V\" already defined "
+                                   "with conflicting thread pool parameters",
+                                   &value[1]);
+                return NGX_CONF_ERROR;
+            }
+#endif
+
             return NGX_CONF_OK;
         }
 
@@ -1230,7 +2221,51 @@ process_formats:
             return NGX_CONF_ERROR;
         }
 
+#if (NGX_THREADS)
+        if (tp) {
+            buffer->free = ngx_palloc(cf->pool,
+                                      nbuffers * sizeof(ngx_thread_task_t *));
+            if (buffer->free == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            for (n = 0; n < (ngx_uint_t) nbuffers; n++) {
+                task = ngx_thread_task_alloc(cf->pool,
+                                          sizeof(ngx_stream_log_thread_ctx_t));
+                if (task == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                ctx = task->ctx;
+
+                ctx->start = ngx_pnalloc(cf->pool, size);
+                if (ctx->start == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                ctx->file = log->file;
+                ctx->gzip = gzip;
+
+                task->handler = ngx_stream_log_thread_handler;
+
+                buffer->free[n] = task;
+            }
+
+            buffer->task = buffer->free[--nbuffers];
+            buffer->nfree = nbuffers;
+            buffer->nbuffers = nbuffers + 1;
+            buffer->thread_pool = tp;
+
+            buffer->start = ((ngx_stream_log_thread_ctx_t *)
+                                                 buffer->task->ctx)->start;
+
+        } else {
+            buffer->start = ngx_pnalloc(cf->pool, size);
+        }
+#else
         buffer->start = ngx_pnalloc(cf->pool, size);
+#endif
+
         if (buffer->start == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1268,7 +2303,7 @@ ngx_stream_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_stream_log_main_conf_t *lmcf = conf;
 
     ngx_str_t             *value;
-    ngx_uint_t             i;
+    ngx_uint_t             i, s;
     ngx_stream_log_fmt_t  *fmt;
 
     value = cf->args->elts;
@@ -1291,6 +2326,14 @@ ngx_stream_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     fmt->name = value[1];
+    fmt->binary = 0;
+
+    s = 2;
+
+    if (cf->args->nelts > 3 && ngx_strcmp(value[2].data, "binary") == 0) {
+        fmt->binary = 1;
+        s = 3;
+    }
 
     fmt->flushes = ngx_array_create(cf->pool, 4, sizeof(ngx_int_t));
     if (fmt->flushes == NULL) {
@@ -1303,13 +2346,13 @@ ngx_stream_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     return ngx_stream_log_compile_format(cf, fmt->flushes, fmt->ops,
-                                         cf->args, 2);
+                                         cf->args, s, fmt->binary);
 }
 
 
 static char *
 ngx_stream_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
-    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s)
+    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s, ngx_uint_t binary)
 {
     u_char                *data, *p, ch;
     size_t                 i, len;
@@ -1317,6 +2360,7 @@ ngx_stream_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
     ngx_int_t             *flush;
     ngx_uint_t             bracket, escape;
     ngx_stream_log_op_t   *op;
+    ngx_stream_log_var_t  *v;
 
     escape = NGX_STREAM_LOG_ESCAPE_DEFAULT;
     value = args->elts;
@@ -1403,8 +2447,34 @@ ngx_stream_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
                     goto invalid;
                 }
 
-                if (ngx_stream_log_variable_compile(cf, op, &var, escape)
-                    != NGX_OK)
+                v = binary ? ngx_stream_log_binary_vars : ngx_stream_log_vars;
+
+                for ( /* void */ ; v->name.len; v++) {
+
+                    if (v->name.len == var.len
+                        && ngx_strncmp(v->name.data, var.data, var.len) == 0)
+                    {
+                        op->len = v->len;
+                        op->getlen = NULL;
+                        op->run = v->run;
+                        op->data = 0;
+
+                        goto found;
+                    }
+                }
+
+                if (binary) {
+                    op->data = ngx_stream_get_variable_index(cf, &var);
+                    if (op->data == (uintptr_t) NGX_ERROR) {
+                        return NGX_CONF_ERROR;
+                    }
+
+                    op->len = 0;
+                    op->getlen = ngx_stream_log_binary_variable_getlen;
+                    op->run = ngx_stream_log_binary_variable;
+
+                } else if (ngx_stream_log_variable_compile(cf, op, &var, escape)
+                           != NGX_OK)
                 {
                     return NGX_CONF_ERROR;
                 }
@@ -1419,6 +2489,8 @@ ngx_stream_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
                     *flush = op->data; /* variable index */
                 }
 
+            found:
+
                 continue;
             }
 
@@ -1430,6 +2502,14 @@ ngx_stream_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
 
             len = &value[s].data[i] - data;
 
+            if (binary) {
+
+                /* text between variables only separates binary fields */
+
+                ops->nelts--;
+                continue;
+            }
+
             if (len) {
 
                 op->len = len;
@@ -1592,5 +2672,12 @@ ngx_stream_log_init(ngx_conf_t *cf)
 
     *h = ngx_stream_log_handler;
 
+    h = ngx_array_push(&cmcf->phases[NGX_STREAM_POST_ACCEPT_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_stream_log_interim_init;
+
     return NGX_OK;
 }
@@ -13,6 +13,7 @@
 typedef struct {
     ngx_uint_t                    hash_max_size;
     ngx_uint_t                    hash_bucket_size;
+    ngx_uint_t                    addr_cache;
 } ngx_stream_map_conf_t;
 
 
@@ -31,14 +32,47 @@ typedef struct {
 } ngx_stream_map_conf_ctx_t;
 
 
+/*
+ * per worker LRU of the values selected for client addresses, used by maps
+ * of $remote_addr and $binary_remote_addr, which only depend on the address
+ */
+
+typedef struct {
+    ngx_rbtree_t                  rbtree;
+    ngx_rbtree_node_t             sentinel;
+    ngx_queue_t                   queue;
+    ngx_queue_t                   free;
+} ngx_stream_map_cache_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t             node;
+    ngx_queue_t                   queue;
+    ngx_uint_t                    len;
+    u_char                        addr[16];
+    ngx_stream_variable_value_t  *value;
+} ngx_stream_map_cache_node_t;
+
+
 typedef struct {
     ngx_stream_map_t              map;
     ngx_stream_complex_value_t    value;
     ngx_stream_variable_value_t  *default_value;
+    ngx_stream_map_cache_t       *cache;
     ngx_uint_t                    hostnames;      /* unsigned  hostnames:1 */
 } ngx_stream_map_ctx_t;
 
 
+static ngx_stream_variable_value_t *ngx_stream_map_cache_lookup(
+    ngx_stream_map_cache_t *cache, ngx_connection_t *c);
+static void ngx_stream_map_cache_insert(ngx_stream_map_cache_t *cache,
+    ngx_connection_t *c, ngx_stream_variable_value_t *value);
+static ngx_uint_t ngx_stream_map_cache_key(ngx_connection_t *c,
+    u_char **addr);
+static void ngx_stream_map_cache_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_stream_map_cache_t *ngx_stream_map_cache_create(ngx_conf_t *cf,
+    ngx_uint_t size);
 static int ngx_libc_cdecl ngx_stream_map_cmp_dns_wildcards(const void *one,
     const void *two);
 static void *ngx_stream_map_create_conf(ngx_conf_t *cf);
@@ -70,6 +104,13 @@ static ngx_command_t  ngx_stream_map_commands[] = {
       offsetof(ngx_stream_map_conf_t, hash_bucket_size),
       NULL },
 
+    { ngx_string("map_addr_cache"),
+      NGX_STREAM_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_STREAM_MAIN_CONF_OFFSET,
+      offsetof(ngx_stream_map_conf_t, addr_cache),
+      NULL },
+
       ngx_null_command
 };
 
@@ -115,6 +156,15 @@ ngx_stream_map_variable(ngx_stream_session_t *s, ngx_stream_variable_value_t *v,
     ngx_log_debug0(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
                    "stream map started");
 
+    if (map->cache) {
+        value = ngx_stream_map_cache_lookup(map->cache, s->connection);
+
+        if (value) {
+            val = s->connection->addr_text;
+            goto found;
+        }
+    }
+
     if (ngx_stream_complex_value(s, &map->value, &val) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -129,6 +179,12 @@ ngx_stream_map_variable(ngx_stream_session_t *s, ngx_stream_variable_value_t *v,
         value = map->default_value;
     }
 
+    if (map->cache) {
+        ngx_stream_map_cache_insert(map->cache, s->connection, value);
+    }
+
+found:
+
     if (!value->valid) {
         cv = (ngx_stream_complex_value_t *) value->data;
 
@@ -153,6 +209,197 @@ ngx_stream_map_variable(ngx_stream_session_t *s, ngx_stream_variable_value_t *v,
 }
 
 
+static ngx_stream_variable_value_t *
+ngx_stream_map_cache_lookup(ngx_stream_map_cache_t *cache, ngx_connection_t *c)
+{
+    u_char                       *addr;
+    ngx_int_t                     rc;
+    ngx_uint_t                    len;
+    ngx_rbtree_key_t              hash;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_stream_map_cache_node_t  *cn;
+
+    len = ngx_stream_map_cache_key(c, &addr);
+
+    if (len == 0) {
+        return NULL;
+    }
+
+    hash = ngx_crc32_short(addr, len);
+
+    node = cache->rbtree.root;
+    sentinel = cache->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash != node->key) {
+            node = (hash < node->key) ? node->left : node->right;
+            continue;
+        }
+
+        cn = (ngx_stream_map_cache_node_t *) node;
+
+        if (len != cn->len) {
+            rc = (ngx_int_t) len - (ngx_int_t) cn->len;
+
+        } else {
+            rc = ngx_memcmp(addr, cn->addr, len);
+        }
+
+        if (rc == 0) {
+            ngx_queue_remove(&cn->queue);
+            ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+            return cn->value;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_stream_map_cache_insert(ngx_stream_map_cache_t *cache, ngx_connection_t *c,
+    ngx_stream_variable_value_t *value)
+{
+    u_char                       *addr;
+    ngx_uint_t                    len;
+    ngx_queue_t                  *q;
+    ngx_stream_map_cache_node_t  *cn;
+
+    len = ngx_stream_map_cache_key(c, &addr);
+
+    if (len == 0) {
+        return;
+    }
+
+    /* the nodes are preallocated, the least recently used one is reused */
+
+    if (!ngx_queue_empty(&cache->free)) {
+        q = ngx_queue_head(&cache->free);
+        cn = ngx_queue_data(q, ngx_stream_map_cache_node_t, queue);
+
+    } else {
+        q = ngx_queue_last(&cache->queue);
+        cn = ngx_queue_data(q, ngx_stream_map_cache_node_t, queue);
+
+        ngx_rbtree_delete(&cache->rbtree, &cn->node);
+    }
+
+    ngx_queue_remove(q);
+
+    cn->node.key = ngx_crc32_short(addr, len);
+    cn->len = len;
+    ngx_memcpy(cn->addr, addr, len);
+    cn->value = value;
+
+    ngx_rbtree_insert(&cache->rbtree, &cn->node);
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+}
+
+
+static ngx_uint_t
+ngx_stream_map_cache_key(ngx_connection_t *c, u_char **addr)
+{
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (c->sockaddr->sa_family) {
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) c->sockaddr;
+        *addr = (u_char *) &sin->sin_addr;
+        return sizeof(in_addr_t);
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) c->sockaddr;
+        *addr = sin6->sin6_addr.s6_addr;
+        return 16;
+#endif
+
+    default:
+        return 0;
+    }
+}
+
+
+static void
+ngx_stream_map_cache_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_int_t                     rc;
+    ngx_rbtree_node_t           **p;
+    ngx_stream_map_cache_node_t  *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key != temp->key) {
+            p = (node->key < temp->key) ? &temp->left : &temp->right;
+
+        } else {
+            cn = (ngx_stream_map_cache_node_t *) node;
+            cnt = (ngx_stream_map_cache_node_t *) temp;
+
+            if (cn->len != cnt->len) {
+                rc = (ngx_int_t) cn->len - (ngx_int_t) cnt->len;
+
+            } else {
+                rc = ngx_memcmp(cn->addr, cnt->addr, cn->len);
+            }
+
+            p = (rc < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_stream_map_cache_t *
+ngx_stream_map_cache_create(ngx_conf_t *cf, ngx_uint_t size)
+{
+    ngx_uint_t                    i;
+    ngx_stream_map_cache_t       *cache;
+    ngx_stream_map_cache_node_t  *cn;
+
+    cache = ngx_palloc(cf->pool, sizeof(ngx_stream_map_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cn = ngx_palloc(cf->pool, size * sizeof(ngx_stream_map_cache_node_t));
+    if (cn == NULL) {
+        return NULL;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_stream_map_cache_insert_value);
+    ngx_queue_init(&cache->queue);
+    ngx_queue_init(&cache->free);
+
+    for (i = 0; i < size; i++) {
+        ngx_queue_insert_tail(&cache->free, &cn[i].queue);
+    }
+
+    return cache;
+}
+
+
 static void *
 ngx_stream_map_create_conf(ngx_conf_t *cf)
 {
@@ -165,6 +412,7 @@ ngx_stream_map_create_conf(ngx_conf_t *cf)
 
     mcf->hash_max_size = NGX_CONF_UNSET_UINT;
     mcf->hash_bucket_size = NGX_CONF_UNSET_UINT;
+    mcf->addr_cache = NGX_CONF_UNSET_UINT;
 
     return mcf;
 }
@@ -179,11 +427,16 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                           *value, name;
     ngx_conf_t                           save;
     ngx_pool_t                          *pool;
+    ngx_uint_t                           cacheable;
     ngx_hash_init_t                      hash;
     ngx_stream_map_ctx_t                *map;
     ngx_stream_variable_t               *var;
     ngx_stream_map_conf_ctx_t            ctx;
     ngx_stream_compile_complex_value_t   ccv;
+#if (NGX_PCRE)
+    ngx_uint_t                           i;
+    ngx_stream_map_regex_t              *reg;
+#endif
 
     if (mcf->hash_max_size == NGX_CONF_UNSET_UINT) {
         mcf->hash_max_size = 2048;
@@ -197,6 +450,10 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                                           ngx_cacheline_size);
     }
 
+    if (mcf->addr_cache == NGX_CONF_UNSET_UINT) {
+        mcf->addr_cache = 0;
+    }
+
     map = ngx_pcalloc(cf->pool, sizeof(ngx_stream_map_ctx_t));
     if (map == NULL) {
         return NGX_CONF_ERROR;
@@ -214,6 +471,17 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    /* the values selected for the client address can be cached */
+
+    cacheable = mcf->addr_cache
+                && ((value[1].len == sizeof("$remote_addr") - 1
+                     && ngx_strncmp(value[1].data, "$remote_addr",
+                                    sizeof("$remote_addr") - 1) == 0)
+                    || (value[1].len == sizeof("$binary_remote_addr") - 1
+                        && ngx_strncmp(value[1].data, "$binary_remote_addr",
+                                       sizeof("$binary_remote_addr") - 1)
+                           == 0));
+
     name = value[2];
 
     if (name.data[0] != '$') {
@@ -358,6 +626,33 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
 #endif
 
+    /*
+     * the selected value only depends on the client address unless
+     * the map is volatile or a matching regex sets captures
+     */
+
+    if (ctx.no_cacheable) {
+        cacheable = 0;
+    }
+
+#if (NGX_PCRE)
+    reg = map->map.regex;
+
+    for (i = 0; cacheable && i < map->map.nregex; i++) {
+        if (reg[i].regex->ncaptures) {
+            cacheable = 0;
+        }
+    }
+#endif
+
+    if (cacheable) {
+        map->cache = ngx_stream_map_cache_create(cf, mcf->addr_cache);
+        if (map->cache == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+    }
+
     ngx_destroy_pool(pool);
 
     return rv;
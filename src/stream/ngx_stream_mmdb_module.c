@@ -0,0 +1,343 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+typedef struct {
+    ngx_mmdb_t                  *mmdb;
+    ngx_stream_complex_value_t  *source;
+    ngx_uint_t                   index;
+} ngx_stream_mmdb_t;
+
+
+typedef struct {
+    ngx_stream_mmdb_t           *db;
+    ngx_uint_t                   field;
+} ngx_stream_mmdb_variable_t;
+
+
+typedef struct {
+    ngx_uint_t                   ndbs;
+} ngx_stream_mmdb_conf_t;
+
+
+/* the results of a session, per database */
+
+typedef struct {
+    ngx_str_t                   *values;
+    ngx_uint_t                   done;    /* unsigned  done:1; */
+} ngx_stream_mmdb_ctx_t;
+
+
+static ngx_int_t ngx_stream_mmdb_variable(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data);
+static ngx_str_t *ngx_stream_mmdb_lookup(ngx_stream_session_t *s,
+    ngx_stream_mmdb_t *db);
+static void *ngx_stream_mmdb_create_conf(ngx_conf_t *cf);
+static char *ngx_stream_mmdb_block(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_stream_mmdb(ngx_conf_t *cf, ngx_command_t *dummy,
+    void *conf);
+
+
+static ngx_command_t  ngx_stream_mmdb_commands[] = {
+
+    { ngx_string("mmdb"),
+      NGX_STREAM_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_1MORE,
+      ngx_stream_mmdb_block,
+      NGX_STREAM_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_mmdb_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_stream_mmdb_create_conf,           /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL                                   /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_mmdb_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_mmdb_module_ctx,           /* module context */
+    ngx_stream_mmdb_commands,              /* module directives */
+    NGX_STREAM_MODULE,                     /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_stream_mmdb_variable(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data)
+{
+    ngx_stream_mmdb_variable_t *var = (ngx_stream_mmdb_variable_t *) data;
+
+    ngx_str_t  *values;
+
+    values = ngx_stream_mmdb_lookup(s, var->db);
+
+    if (values == NULL || values[var->field].data == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = values[var->field].len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = values[var->field].data;
+
+    return NGX_OK;
+}
+
+
+static ngx_str_t *
+ngx_stream_mmdb_lookup(ngx_stream_session_t *s, ngx_stream_mmdb_t *db)
+{
+    ngx_int_t                rc;
+    ngx_str_t                source, *values;
+    ngx_addr_t               addr;
+    ngx_pool_t              *pool;
+    ngx_stream_mmdb_ctx_t   *ctx;
+    ngx_stream_mmdb_conf_t  *mcf;
+
+    pool = s->connection->pool;
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_mmdb_module);
+
+    if (ctx == NULL) {
+        mcf = ngx_stream_get_module_main_conf(s, ngx_stream_mmdb_module);
+
+        ctx = ngx_pcalloc(pool, mcf->ndbs * sizeof(ngx_stream_mmdb_ctx_t));
+        if (ctx == NULL) {
+            return NULL;
+        }
+
+        ngx_stream_set_ctx(s, ctx, ngx_stream_mmdb_module);
+    }
+
+    ctx = &ctx[db->index];
+
+    /* all fields of a database are looked up at once */
+
+    if (ctx->done) {
+        return ctx->values;
+    }
+
+    ctx->done = 1;
+
+    if (db->source) {
+        if (ngx_stream_complex_value(s, db->source, &source) != NGX_OK) {
+            return NULL;
+        }
+
+        if (ngx_parse_addr(pool, &addr, source.data, source.len) != NGX_OK) {
+            return NULL;
+        }
+
+    } else {
+        addr.sockaddr = s->connection->sockaddr;
+    }
+
+    values = ngx_palloc(pool, db->mmdb->fields.nelts * sizeof(ngx_str_t));
+    if (values == NULL) {
+        return NULL;
+    }
+
+    rc = ngx_mmdb_lookup(db->mmdb, addr.sockaddr, values, pool,
+                         s->connection->log);
+
+    if (rc == NGX_OK) {
+        ctx->values = values;
+    }
+
+    return ctx->values;
+}
+
+
+static void *
+ngx_stream_mmdb_create_conf(ngx_conf_t *cf)
+{
+    ngx_stream_mmdb_conf_t  *mcf;
+
+    mcf = ngx_pcalloc(cf->pool, sizeof(ngx_stream_mmdb_conf_t));
+    if (mcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     mcf->ndbs = 0;
+     */
+
+    return mcf;
+}
+
+
+static char *
+ngx_stream_mmdb_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_stream_mmdb_conf_t  *mcf = conf;
+
+    char                                *rv;
+    ngx_int_t                            n;
+    ngx_str_t                           *value, name, str;
+    ngx_uint_t                           i, cache;
+    ngx_conf_t                           save;
+    ngx_stream_mmdb_t                   *db;
+    ngx_stream_compile_complex_value_t   ccv;
+
+    db = ngx_pcalloc(cf->pool, sizeof(ngx_stream_mmdb_t));
+    if (db == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    cache = 256;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "cache=", 6) == 0) {
+
+            n = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (n == NGX_ERROR) {
+                goto invalid;
+            }
+
+            cache = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "source=", 7) == 0) {
+
+            str.len = value[i].len - 7;
+            str.data = value[i].data + 7;
+
+            db->source = ngx_palloc(cf->pool,
+                                    sizeof(ngx_stream_complex_value_t));
+            if (db->source == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_memzero(&ccv, sizeof(ngx_stream_compile_complex_value_t));
+
+            ccv.cf = cf;
+            ccv.value = &str;
+            ccv.complex_value = db->source;
+
+            if (ngx_stream_compile_complex_value(&ccv) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    name = value[1];
+
+    db->mmdb = ngx_mmdb_open(cf, &name, cache);
+    if (db->mmdb == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    db->index = mcf->ndbs++;
+
+    save = *cf;
+    cf->handler = ngx_stream_mmdb;
+    cf->handler_conf = (void *) db;
+
+    rv = ngx_conf_parse(cf, NULL);
+
+    *cf = save;
+
+    return rv;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_stream_mmdb(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
+{
+    ngx_int_t                    field;
+    ngx_str_t                   *value, name;
+    ngx_stream_mmdb_t           *db;
+    ngx_stream_variable_t       *v;
+    ngx_stream_mmdb_variable_t  *var;
+
+    db = conf;
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts < 2) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid number of the mmdb parameters");
+        return NGX_CONF_ERROR;
+    }
+
+    name = value[0];
+
+    if (name.len < 2 || name.data[0] != '$') {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid variable name \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len--;
+    name.data++;
+
+    /* the keys of maps and the indices of arrays down to the value */
+
+    field = ngx_mmdb_add_field(cf, db->mmdb, &value[1], cf->args->nelts - 1);
+    if (field == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    var = ngx_palloc(cf->pool, sizeof(ngx_stream_mmdb_variable_t));
+    if (var == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    var->db = db;
+    var->field = field;
+
+    v = ngx_stream_add_variable(cf, &name, NGX_STREAM_VAR_CHANGEABLE);
+    if (v == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    v->get_handler = ngx_stream_mmdb_variable;
+    v->data = (uintptr_t) var;
+
+    return NGX_CONF_OK;
+}
@@ -24,6 +24,7 @@ typedef struct {
     ngx_msec_t                       timeout;
     ngx_msec_t                       next_upstream_timeout;
     size_t                           buffer_size;
+    size_t                           max_buffer_size;
     ngx_stream_complex_value_t      *upload_rate;
     ngx_stream_complex_value_t      *download_rate;
     ngx_uint_t                       requests;
@@ -33,6 +34,11 @@ typedef struct {
     ngx_flag_t                       proxy_protocol;
     ngx_stream_upstream_local_t     *local;
     ngx_flag_t                       socket_keepalive;
+    ngx_flag_t                       splice;
+    ngx_uint_t                       prewarm;
+
+    /* per worker list of ngx_stream_proxy_warm_peer_t */
+    ngx_queue_t                      warm;
 
 #if (NGX_STREAM_SSL)
     ngx_flag_t                       ssl_enable;
@@ -58,6 +64,55 @@ typedef struct {
 } ngx_stream_proxy_srv_conf_t;
 
 
+/*
+ * with "proxy_prewarm" each worker keeps idle upstream connections,
+ * connected and with TLS handshaked in advance, for each upstream peer
+ * the sessions of a server were proxied to; a session takes one of them
+ * after the balancer has chosen the peer and a replacement is connected
+ */
+
+typedef struct {
+    ngx_queue_t                      queue;
+    ngx_queue_t                      idle;
+    ngx_uint_t                       nidle;
+    ngx_uint_t                       nconnecting;
+    ngx_str_t                        name;
+    socklen_t                        socklen;
+    ngx_sockaddr_t                   sockaddr;
+} ngx_stream_proxy_warm_peer_t;
+
+
+typedef struct {
+    ngx_queue_t                      queue;
+    ngx_peer_connection_t            peer;
+    ngx_stream_proxy_warm_peer_t    *warm_peer;
+    ngx_stream_proxy_srv_conf_t     *pscf;
+#if (NGX_STREAM_SSL)
+    ngx_str_t                        ssl_name;
+#endif
+    unsigned                         idle:1;
+} ngx_stream_proxy_warm_t;
+
+
+#if (NGX_HAVE_SPLICE)
+
+#define NGX_STREAM_PROXY_SPLICE_SIZE      65536
+#define NGX_STREAM_PROXY_SPLICE_BUFFERED  0x20
+
+
+typedef struct {
+    ngx_fd_t                         fd[2];
+    size_t                           size;
+} ngx_stream_proxy_pipe_t;
+
+
+typedef struct {
+    ngx_stream_proxy_pipe_t          pipe[2];
+} ngx_stream_proxy_ctx_t;
+
+#endif
+
+
 static void ngx_stream_proxy_handler(ngx_stream_session_t *s);
 static ngx_int_t ngx_stream_proxy_eval(ngx_stream_session_t *s,
     ngx_stream_proxy_srv_conf_t *pscf);
@@ -65,6 +120,14 @@ static ngx_int_t ngx_stream_proxy_set_local(ngx_stream_session_t *s,
     ngx_stream_upstream_t *u, ngx_stream_upstream_local_t *local);
 static void ngx_stream_proxy_connect(ngx_stream_session_t *s);
 static void ngx_stream_proxy_init_upstream(ngx_stream_session_t *s);
+static ngx_int_t ngx_stream_proxy_warm_connect(ngx_stream_session_t *s);
+static ngx_int_t ngx_stream_proxy_warm_add(ngx_stream_session_t *s,
+    ngx_stream_proxy_warm_peer_t *wp);
+static void ngx_stream_proxy_warm_handler(ngx_event_t *ev);
+static void ngx_stream_proxy_warm_ready(ngx_stream_proxy_warm_t *w);
+static void ngx_stream_proxy_warm_idle_handler(ngx_event_t *ev);
+static void ngx_stream_proxy_warm_close(ngx_stream_proxy_warm_t *w);
+static void ngx_stream_proxy_warm_cleanup(void *data);
 static void ngx_stream_proxy_resolve_handler(ngx_resolver_ctx_t *ctx);
 static void ngx_stream_proxy_upstream_handler(ngx_event_t *ev);
 static void ngx_stream_proxy_downstream_handler(ngx_event_t *ev);
@@ -72,8 +135,17 @@ static void ngx_stream_proxy_process_connection(ngx_event_t *ev,
     ngx_uint_t from_upstream);
 static void ngx_stream_proxy_connect_handler(ngx_event_t *ev);
 static ngx_int_t ngx_stream_proxy_test_connect(ngx_connection_t *c);
+static ngx_int_t ngx_stream_proxy_alloc_buffer(ngx_stream_session_t *s,
+    ngx_buf_t *b, size_t size);
+static void ngx_stream_proxy_free_buffer(ngx_buf_t *b);
+static void ngx_stream_proxy_buffers_cleanup(void *data);
 static void ngx_stream_proxy_process(ngx_stream_session_t *s,
     ngx_uint_t from_upstream, ngx_uint_t do_write);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_stream_proxy_splice(ngx_stream_session_t *s,
+    ngx_uint_t from_upstream);
+static void ngx_stream_proxy_splice_cleanup(void *data);
+#endif
 static ngx_int_t ngx_stream_proxy_test_finalize(ngx_stream_session_t *s,
     ngx_uint_t from_upstream);
 static void ngx_stream_proxy_next_upstream(ngx_stream_session_t *s);
@@ -97,7 +169,9 @@ static char *ngx_stream_proxy_ssl_password_file(ngx_conf_t *cf,
 static void ngx_stream_proxy_ssl_init_connection(ngx_stream_session_t *s);
 static void ngx_stream_proxy_ssl_handshake(ngx_connection_t *pc);
 static void ngx_stream_proxy_ssl_save_session(ngx_connection_t *c);
-static ngx_int_t ngx_stream_proxy_ssl_name(ngx_stream_session_t *s);
+static ngx_int_t ngx_stream_proxy_ssl_name(ngx_stream_session_t *s,
+    ngx_connection_t *pc);
+static void ngx_stream_proxy_warm_ssl_handshake(ngx_connection_t *c);
 static ngx_int_t ngx_stream_proxy_set_ssl(ngx_conf_t *cf,
     ngx_stream_proxy_srv_conf_t *pscf);
 
@@ -140,6 +214,13 @@ static ngx_command_t  ngx_stream_proxy_commands[] = {
       0,
       NULL },
 
+    { ngx_string("proxy_prewarm"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, prewarm),
+      NULL },
+
     { ngx_string("proxy_socket_keepalive"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -147,6 +228,13 @@ static ngx_command_t  ngx_stream_proxy_commands[] = {
       offsetof(ngx_stream_proxy_srv_conf_t, socket_keepalive),
       NULL },
 
+    { ngx_string("proxy_splice"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, splice),
+      NULL },
+
     { ngx_string("proxy_connect_timeout"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -168,6 +256,13 @@ static ngx_command_t  ngx_stream_proxy_commands[] = {
       offsetof(ngx_stream_proxy_srv_conf_t, buffer_size),
       NULL },
 
+    { ngx_string("proxy_max_buffer_size"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, max_buffer_size),
+      NULL },
+
     { ngx_string("proxy_downstream_buffer"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -368,11 +463,11 @@ ngx_module_t  ngx_stream_proxy_module = {
 static void
 ngx_stream_proxy_handler(ngx_stream_session_t *s)
 {
-    u_char                           *p;
     ngx_str_t                        *host;
     ngx_uint_t                        i;
     ngx_connection_t                 *c;
     ngx_resolver_ctx_t               *ctx, temp;
+    ngx_pool_cleanup_t               *cln;
     ngx_stream_upstream_t            *u;
     ngx_stream_core_srv_conf_t       *cscf;
     ngx_stream_proxy_srv_conf_t      *pscf;
@@ -423,16 +518,19 @@ ngx_stream_proxy_handler(ngx_stream_session_t *s)
         return;
     }
 
-    p = ngx_pnalloc(c->pool, pscf->buffer_size);
-    if (p == NULL) {
+    /* the buffers are allocated on reading and freed while idle */
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
         ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
         return;
     }
 
-    u->downstream_buf.start = p;
-    u->downstream_buf.end = p + pscf->buffer_size;
-    u->downstream_buf.pos = p;
-    u->downstream_buf.last = p;
+    cln->handler = ngx_stream_proxy_buffers_cleanup;
+    cln->data = u;
+
+    u->downstream_size = pscf->buffer_size;
+    u->upstream_size = pscf->buffer_size;
 
     if (c->read->ready) {
         ngx_post_event(c->read, &ngx_posted_events);
@@ -707,7 +805,12 @@ ngx_stream_proxy_connect(ngx_stream_session_t *s)
     u->state->first_byte_time = (ngx_msec_t) -1;
     u->state->response_time = (ngx_msec_t) -1;
 
-    rc = ngx_event_connect_peer(&u->peer);
+    if (pscf->prewarm && u->peer.type == SOCK_STREAM) {
+        rc = ngx_stream_proxy_warm_connect(s);
+
+    } else {
+        rc = ngx_event_connect_peer(&u->peer);
+    }
 
     ngx_log_debug1(NGX_LOG_DEBUG_STREAM, c->log, 0, "proxy connect: %i", rc);
 
@@ -826,19 +929,6 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
                        NGX_STREAM_UPSTREAM_NOTIFY_CONNECT);
     }
 
-    if (u->upstream_buf.start == NULL) {
-        p = ngx_pnalloc(c->pool, pscf->buffer_size);
-        if (p == NULL) {
-            ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
-            return;
-        }
-
-        u->upstream_buf.start = p;
-        u->upstream_buf.end = p + pscf->buffer_size;
-        u->upstream_buf.pos = p;
-        u->upstream_buf.last = p;
-    }
-
     if (c->buffer && c->buffer->pos < c->buffer->last) {
         ngx_log_debug1(NGX_LOG_DEBUG_STREAM, c->log, 0,
                        "stream proxy add preread buffer: %uz",
@@ -869,7 +959,7 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
             return;
         }
 
-        p = ngx_pnalloc(c->pool, NGX_PROXY_PROTOCOL_MAX_HEADER);
+        p = ngx_pnalloc(c->pool, NGX_PROXY_PROTOCOL_V1_MAX_HEADER);
         if (p == NULL) {
             ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
             return;
@@ -877,7 +967,8 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
 
         cl->buf->pos = p;
 
-        p = ngx_proxy_protocol_write(c, p, p + NGX_PROXY_PROTOCOL_MAX_HEADER);
+        p = ngx_proxy_protocol_write(c, p,
+                                     p + NGX_PROXY_PROTOCOL_V1_MAX_HEADER);
         if (p == NULL) {
             ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
             return;
@@ -911,6 +1002,474 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
 }
 
 
+static ngx_int_t
+ngx_stream_proxy_warm_connect(ngx_stream_session_t *s)
+{
+    ngx_int_t                      rc;
+    ngx_uint_t                     n;
+    ngx_queue_t                   *q;
+    ngx_connection_t              *pc;
+    ngx_pool_cleanup_t            *cln;
+    ngx_event_get_peer_pt          get;
+    ngx_stream_upstream_t         *u;
+    ngx_stream_proxy_warm_t       *w;
+    ngx_stream_proxy_srv_conf_t   *pscf;
+    ngx_stream_proxy_warm_peer_t  *wp;
+
+    u = s->upstream;
+
+    pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
+
+    rc = u->peer.get(&u->peer, u->peer.data);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    wp = NULL;
+
+    for (q = ngx_queue_head(&pscf->warm);
+         q != ngx_queue_sentinel(&pscf->warm);
+         q = ngx_queue_next(q))
+    {
+        wp = ngx_queue_data(q, ngx_stream_proxy_warm_peer_t, queue);
+
+        if (ngx_cmp_sockaddr(u->peer.sockaddr, u->peer.socklen,
+                             &wp->sockaddr.sockaddr, wp->socklen, 1)
+            == NGX_OK)
+        {
+            break;
+        }
+
+        wp = NULL;
+    }
+
+    if (wp == NULL) {
+        wp = ngx_pcalloc(ngx_cycle->pool,
+                         sizeof(ngx_stream_proxy_warm_peer_t));
+        if (wp == NULL) {
+            return NGX_ERROR;
+        }
+
+        wp->name.data = ngx_pstrdup(ngx_cycle->pool, u->peer.name);
+        if (wp->name.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        wp->name.len = u->peer.name->len;
+
+        wp->socklen = u->peer.socklen;
+        ngx_memcpy(&wp->sockaddr, u->peer.sockaddr, u->peer.socklen);
+
+        ngx_queue_init(&wp->idle);
+        ngx_queue_insert_tail(&pscf->warm, &wp->queue);
+    }
+
+    w = NULL;
+
+    if (!ngx_queue_empty(&wp->idle)) {
+        q = ngx_queue_head(&wp->idle);
+        ngx_queue_remove(q);
+
+        w = ngx_queue_data(q, ngx_stream_proxy_warm_t, queue);
+
+        w->idle = 0;
+        wp->nidle--;
+    }
+
+    if (!ngx_exiting) {
+        for (n = wp->nidle + wp->nconnecting; n < pscf->prewarm; n++) {
+            if (ngx_stream_proxy_warm_add(s, wp) != NGX_OK) {
+                break;
+            }
+        }
+    }
+
+    if (w == NULL) {
+        get = u->peer.get;
+        u->peer.get = ngx_event_get_peer;
+
+        rc = ngx_event_connect_peer(&u->peer);
+
+        u->peer.get = get;
+
+        return rc;
+    }
+
+    pc = w->peer.connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
+                   "proxy prewarmed connection: %d, idle: %ui",
+                   pc->fd, wp->nidle);
+
+    cln = ngx_pool_cleanup_add(s->connection->pool, 0);
+    if (cln == NULL) {
+        ngx_stream_proxy_warm_close(w);
+        return NGX_ERROR;
+    }
+
+    /* the pool is destroyed with the session, after the connection */
+
+    cln->handler = ngx_stream_proxy_warm_cleanup;
+    cln->data = pc->pool;
+
+    if (pc->read->timer_set) {
+        ngx_del_timer(pc->read);
+    }
+
+    pc->idle = 0;
+    ngx_reusable_connection(pc, 0);
+
+    u->peer.connection = pc;
+
+#if (NGX_STREAM_SSL)
+
+    if (pc->ssl && pscf->ssl_session_reuse) {
+        pc->ssl->save_session = ngx_stream_proxy_ssl_save_session;
+
+        /* the peer session is shared through the upstream zone, if any */
+
+        u->peer.save_session(&u->peer, u->peer.data);
+    }
+
+#endif
+
+    return NGX_DONE;
+}
+
+
+static ngx_int_t
+ngx_stream_proxy_warm_add(ngx_stream_session_t *s,
+    ngx_stream_proxy_warm_peer_t *wp)
+{
+    ngx_int_t                     rc;
+    ngx_pool_t                   *pool;
+    ngx_connection_t             *c;
+    ngx_stream_upstream_t        *u;
+    ngx_stream_proxy_warm_t      *w;
+    ngx_stream_proxy_srv_conf_t  *pscf;
+
+    u = s->upstream;
+
+    pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
+
+    pool = ngx_create_pool(1024, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    w = ngx_pcalloc(pool, sizeof(ngx_stream_proxy_warm_t));
+    if (w == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    w->warm_peer = wp;
+    w->pscf = pscf;
+
+    w->peer.sockaddr = &wp->sockaddr.sockaddr;
+    w->peer.socklen = wp->socklen;
+    w->peer.name = &wp->name;
+    w->peer.get = ngx_event_get_peer;
+    w->peer.log = ngx_cycle->log;
+    w->peer.log_error = NGX_ERROR_ERR;
+    w->peer.local = u->peer.local;
+    w->peer.type = SOCK_STREAM;
+    w->peer.so_keepalive = u->peer.so_keepalive;
+
+    rc = ngx_event_connect_peer(&w->peer);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    c = w->peer.connection;
+
+    c->data = w;
+    c->pool = pool;
+
+    /* closed on worker shutdown by ngx_close_idle_connections() */
+    c->idle = 1;
+
+    wp->nconnecting++;
+
+#if (NGX_STREAM_SSL)
+
+    if (pscf->ssl) {
+
+        if (ngx_ssl_create_connection(pscf->ssl, c,
+                                      NGX_SSL_BUFFER|NGX_SSL_CLIENT)
+            != NGX_OK)
+        {
+            ngx_stream_proxy_warm_close(w);
+            return NGX_ERROR;
+        }
+
+        if (pscf->ssl_server_name || pscf->ssl_verify) {
+            if (ngx_stream_proxy_ssl_name(s, c) != NGX_OK) {
+                ngx_stream_proxy_warm_close(w);
+                return NGX_ERROR;
+            }
+
+            w->ssl_name.data = ngx_pstrdup(pool, &u->ssl_name);
+            if (w->ssl_name.data == NULL) {
+                ngx_stream_proxy_warm_close(w);
+                return NGX_ERROR;
+            }
+
+            w->ssl_name.len = u->ssl_name.len;
+        }
+
+        /*
+         * the balancer state of the session still refers to the peer,
+         * so it sets a saved session for the prewarmed connection too
+         */
+
+        if (pscf->ssl_session_reuse
+            && u->peer.set_session(&w->peer, u->peer.data) != NGX_OK)
+        {
+            ngx_stream_proxy_warm_close(w);
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    c->read->handler = ngx_stream_proxy_warm_handler;
+    c->write->handler = ngx_stream_proxy_warm_handler;
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, pscf->connect_timeout);
+
+    } else {
+        ngx_post_event(c->write, &ngx_posted_events);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                   "proxy prewarm connect: %d to %V", c->fd, &wp->name);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_proxy_warm_handler(ngx_event_t *ev)
+{
+    ngx_connection_t         *c;
+    ngx_stream_proxy_warm_t  *w;
+
+    c = ev->data;
+    w = c->data;
+
+    if (c->close) {
+        ngx_stream_proxy_warm_close(w);
+        return;
+    }
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream %V timed out while prewarming",
+                      &w->warm_peer->name);
+        ngx_stream_proxy_warm_close(w);
+        return;
+    }
+
+    if (ngx_stream_proxy_test_connect(c) != NGX_OK) {
+        ngx_stream_proxy_warm_close(w);
+        return;
+    }
+
+#if (NGX_STREAM_SSL)
+
+    if (c->ssl) {
+        ngx_int_t  rc;
+
+        rc = ngx_ssl_handshake(c);
+
+        if (rc == NGX_AGAIN) {
+
+            if (!c->write->timer_set) {
+                ngx_add_timer(c->write, w->pscf->connect_timeout);
+            }
+
+            c->ssl->handler = ngx_stream_proxy_warm_ssl_handshake;
+            return;
+        }
+
+        ngx_stream_proxy_warm_ssl_handshake(c);
+        return;
+    }
+
+#endif
+
+    ngx_stream_proxy_warm_ready(w);
+}
+
+
+static void
+ngx_stream_proxy_warm_ready(ngx_stream_proxy_warm_t *w)
+{
+    ngx_connection_t              *c;
+    ngx_stream_proxy_warm_peer_t  *wp;
+
+    c = w->peer.connection;
+    wp = w->warm_peer;
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (ngx_exiting || c->close) {
+        ngx_stream_proxy_warm_close(w);
+        return;
+    }
+
+    c->read->handler = ngx_stream_proxy_warm_idle_handler;
+    c->write->handler = ngx_stream_proxy_warm_idle_handler;
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_stream_proxy_warm_close(w);
+        return;
+    }
+
+    wp->nconnecting--;
+    wp->nidle++;
+
+    w->idle = 1;
+    ngx_queue_insert_tail(&wp->idle, &w->queue);
+
+    ngx_reusable_connection(c, 1);
+
+    ngx_add_timer(c->read, w->pscf->timeout);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                   "proxy prewarmed: %d to %V, idle: %ui",
+                   c->fd, &wp->name, wp->nidle);
+
+    if (c->read->ready) {
+        ngx_post_event(c->read, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_stream_proxy_warm_idle_handler(ngx_event_t *ev)
+{
+    int                       n;
+    char                      buf[1];
+    ngx_err_t                 err;
+    ngx_connection_t         *c;
+    ngx_stream_proxy_warm_t  *w;
+
+    if (ev->write) {
+        return;
+    }
+
+    c = ev->data;
+    w = c->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                   "proxy prewarmed idle handler: %d", c->fd);
+
+    if (c->close || ev->timedout) {
+        goto close;
+    }
+
+    /*
+     * the upstream is not expected to send anything before the client,
+     * except for TLS messages after the handshake, such as session tickets
+     */
+
+#if (NGX_STREAM_SSL)
+
+    if (c->ssl) {
+        ERR_clear_error();
+
+        n = SSL_peek(c->ssl->connection, buf, 1);
+
+        if (n <= 0
+            && SSL_get_error(c->ssl->connection, n) == SSL_ERROR_WANT_READ)
+        {
+            ERR_clear_error();
+
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                goto close;
+            }
+
+            return;
+        }
+
+        goto close;
+    }
+
+#endif
+
+    n = recv(c->fd, buf, 1, MSG_PEEK);
+
+    err = ngx_socket_errno;
+
+    if (n == -1 && err == NGX_EAGAIN) {
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            goto close;
+        }
+
+        return;
+    }
+
+close:
+
+    ngx_stream_proxy_warm_close(w);
+}
+
+
+static void
+ngx_stream_proxy_warm_close(ngx_stream_proxy_warm_t *w)
+{
+    ngx_pool_t                    *pool;
+    ngx_connection_t              *c;
+    ngx_stream_proxy_warm_peer_t  *wp;
+
+    c = w->peer.connection;
+    wp = w->warm_peer;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                   "close proxy prewarmed connection: %d", c->fd);
+
+    if (w->idle) {
+        ngx_queue_remove(&w->queue);
+        wp->nidle--;
+
+    } else {
+        wp->nconnecting--;
+    }
+
+#if (NGX_STREAM_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        (void) ngx_ssl_shutdown(c);
+    }
+
+#endif
+
+    pool = c->pool;
+
+    ngx_close_connection(c);
+    ngx_destroy_pool(pool);
+}
+
+
+static void
+ngx_stream_proxy_warm_cleanup(void *data)
+{
+    ngx_pool_t  *pool = data;
+
+    ngx_destroy_pool(pool);
+}
+
+
 #if (NGX_STREAM_SSL)
 
 static ngx_int_t
@@ -921,14 +1480,15 @@ ngx_stream_proxy_send_proxy_protocol(ngx_stream_session_t *s)
     ngx_connection_t             *c, *pc;
     ngx_stream_upstream_t        *u;
     ngx_stream_proxy_srv_conf_t  *pscf;
-    u_char                        buf[NGX_PROXY_PROTOCOL_MAX_HEADER];
+    u_char                        buf[NGX_PROXY_PROTOCOL_V1_MAX_HEADER];
 
     c = s->connection;
 
     ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0,
                    "stream proxy send PROXY protocol header");
 
-    p = ngx_proxy_protocol_write(c, buf, buf + NGX_PROXY_PROTOCOL_MAX_HEADER);
+    p = ngx_proxy_protocol_write(c, buf,
+                                 buf + NGX_PROXY_PROTOCOL_V1_MAX_HEADER);
     if (p == NULL) {
         ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
         return NGX_ERROR;
@@ -1029,7 +1589,7 @@ ngx_stream_proxy_ssl_init_connection(ngx_stream_session_t *s)
     }
 
     if (pscf->ssl_server_name || pscf->ssl_verify) {
-        if (ngx_stream_proxy_ssl_name(s) != NGX_OK) {
+        if (ngx_stream_proxy_ssl_name(s, pc) != NGX_OK) {
             ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
             return;
         }
@@ -1124,8 +1684,47 @@ ngx_stream_proxy_ssl_save_session(ngx_connection_t *c)
 }
 
 
+static void
+ngx_stream_proxy_warm_ssl_handshake(ngx_connection_t *c)
+{
+    long                      rc;
+    ngx_stream_proxy_warm_t  *w;
+
+    w = c->data;
+
+    if (!c->ssl->handshaked || c->close) {
+        goto failed;
+    }
+
+    if (w->pscf->ssl_verify) {
+        rc = SSL_get_verify_result(c->ssl->connection);
+
+        if (rc != X509_V_OK) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream SSL certificate verify error: (%l:%s)",
+                          rc, X509_verify_cert_error_string(rc));
+            goto failed;
+        }
+
+        if (ngx_ssl_check_host(c, &w->ssl_name) != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream SSL certificate does not match \"%V\"",
+                          &w->ssl_name);
+            goto failed;
+        }
+    }
+
+    ngx_stream_proxy_warm_ready(w);
+    return;
+
+failed:
+
+    ngx_stream_proxy_warm_close(w);
+}
+
+
 static ngx_int_t
-ngx_stream_proxy_ssl_name(ngx_stream_session_t *s)
+ngx_stream_proxy_ssl_name(ngx_stream_session_t *s, ngx_connection_t *pc)
 {
     u_char                       *p, *last;
     ngx_str_t                     name;
@@ -1204,7 +1803,7 @@ ngx_stream_proxy_ssl_name(ngx_stream_session_t *s)
     ngx_log_debug1(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
                    "upstream SSL server name: \"%s\"", name.data);
 
-    if (SSL_set_tlsext_host_name(u->peer.connection->ssl->connection,
+    if (SSL_set_tlsext_host_name(pc->ssl->connection,
                                  (char *) name.data)
         == 0)
     {
@@ -1503,6 +2102,7 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
     ngx_int_t                     rc;
     ngx_uint_t                    flags, *packets;
     ngx_msec_t                    delay;
+    size_t                       *bsize;
     ngx_chain_t                  *cl, **ll, **out, **busy;
     ngx_connection_t             *c, *pc, *src, *dst;
     ngx_log_handler_pt            handler;
@@ -1535,6 +2135,7 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
         src = pc;
         dst = c;
         b = &u->upstream_buf;
+        bsize = &u->upstream_size;
         limit_rate = u->download_rate;
         received = &u->received;
         packets = &u->responses;
@@ -1547,6 +2148,7 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
         src = c;
         dst = pc;
         b = &u->downstream_buf;
+        bsize = &u->downstream_size;
         limit_rate = u->upload_rate;
         received = &s->received;
         packets = &u->requests;
@@ -1558,6 +2160,23 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
 
     for ( ;; ) {
 
+#if (NGX_HAVE_SPLICE)
+
+        if (pscf->splice && limit_rate == 0) {
+            rc = ngx_stream_proxy_splice(s, from_upstream);
+
+            if (rc == NGX_ERROR) {
+                ngx_stream_proxy_finalize(s, NGX_STREAM_OK);
+                return;
+            }
+
+            if (rc == NGX_OK) {
+                break;
+            }
+        }
+
+#endif
+
         if (do_write && dst) {
 
             if (*out || *busy || dst->buffered) {
@@ -1576,10 +2195,24 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
                 if (*busy == NULL) {
                     b->pos = b->start;
                     b->last = b->start;
+
+                    if ((size_t) (b->end - b->start) < *bsize) {
+                        /* reallocated with the increased size */
+                        ngx_stream_proxy_free_buffer(b);
+                    }
                 }
             }
         }
 
+        if (b->start == NULL && src->read->ready && !src->read->delayed
+            && !src->read->error)
+        {
+            if (ngx_stream_proxy_alloc_buffer(s, b, *bsize) != NGX_OK) {
+                ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
+                return;
+            }
+        }
+
         size = b->end - b->last;
 
         if (size && src->read->ready && !src->read->delayed
@@ -1655,6 +2288,26 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
                 b->last += n;
                 do_write = 1;
 
+                /*
+                 * a stream buffer filled up is doubled up to
+                 * proxy_max_buffer_size, and is halved down to
+                 * proxy_buffer_size after short reads
+                 */
+
+                if (c->type == SOCK_STREAM) {
+                    if (b->last == b->end) {
+                        if (*bsize < pscf->max_buffer_size) {
+                            *bsize = ngx_min(*bsize * 2,
+                                             pscf->max_buffer_size);
+                        }
+
+                    } else if ((size_t) n < *bsize / 4
+                               && *bsize > pscf->buffer_size)
+                    {
+                        *bsize = ngx_max(*bsize / 2, pscf->buffer_size);
+                    }
+                }
+
                 continue;
             }
         }
@@ -1664,6 +2317,12 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
 
     c->log->action = "proxying connection";
 
+    if (b->start && b->last == b->start && *out == NULL && *busy == NULL
+        && !src->read->ready)
+    {
+        ngx_stream_proxy_free_buffer(b);
+    }
+
     if (ngx_stream_proxy_test_finalize(s, from_upstream) == NGX_OK) {
         return;
     }
@@ -1691,6 +2350,267 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
 }
 
 
+static ngx_int_t
+ngx_stream_proxy_alloc_buffer(ngx_stream_session_t *s, ngx_buf_t *b,
+    size_t size)
+{
+    u_char  *p;
+
+    p = ngx_alloc(size, s->connection->log);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
+                   "stream proxy buffer alloc: %p:%uz", p, size);
+
+    b->start = p;
+    b->end = p + size;
+    b->pos = p;
+    b->last = p;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_proxy_free_buffer(ngx_buf_t *b)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, ngx_cycle->log, 0,
+                   "stream proxy buffer free: %p", b->start);
+
+    ngx_free(b->start);
+
+    b->start = NULL;
+    b->end = NULL;
+    b->pos = NULL;
+    b->last = NULL;
+}
+
+
+static void
+ngx_stream_proxy_buffers_cleanup(void *data)
+{
+    ngx_stream_upstream_t  *u = data;
+
+    if (u->downstream_buf.start) {
+        ngx_free(u->downstream_buf.start);
+    }
+
+    if (u->upstream_buf.start) {
+        ngx_free(u->upstream_buf.start);
+    }
+}
+
+
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_stream_proxy_splice(ngx_stream_session_t *s, ngx_uint_t from_upstream)
+{
+    off_t                    *received;
+    ssize_t                   n;
+    ngx_err_t                 err;
+    ngx_uint_t               *packets;
+    ngx_chain_t              *out, *busy;
+    ngx_connection_t         *c, *pc, *src, *dst;
+    ngx_pool_cleanup_t       *cln;
+    ngx_stream_upstream_t    *u;
+    ngx_stream_proxy_ctx_t   *ctx;
+    ngx_stream_proxy_pipe_t  *pp;
+
+    u = s->upstream;
+    c = s->connection;
+
+    if (c->type != SOCK_STREAM || !u->connected) {
+        return NGX_DECLINED;
+    }
+
+    pc = u->peer.connection;
+
+#if (NGX_STREAM_SSL)
+    if (c->ssl || pc->ssl) {
+        return NGX_DECLINED;
+    }
+#endif
+
+    if (from_upstream) {
+        src = pc;
+        dst = c;
+        received = &u->received;
+        packets = &u->responses;
+        out = u->downstream_out;
+        busy = u->downstream_busy;
+
+    } else {
+        src = c;
+        dst = pc;
+        received = &s->received;
+        packets = &u->requests;
+        out = u->upstream_out;
+        busy = u->upstream_busy;
+    }
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_proxy_module);
+
+    pp = ctx ? &ctx->pipe[from_upstream] : NULL;
+
+    if (pp == NULL || pp->fd[0] == NGX_INVALID_FILE) {
+
+        /* switch to splice() once the buffered data are sent */
+
+        if (out || busy || dst->buffered) {
+            return NGX_DECLINED;
+        }
+
+        if (ctx == NULL) {
+            ctx = ngx_palloc(c->pool, sizeof(ngx_stream_proxy_ctx_t));
+            if (ctx == NULL) {
+                return NGX_ERROR;
+            }
+
+            ctx->pipe[0].fd[0] = NGX_INVALID_FILE;
+            ctx->pipe[0].fd[1] = NGX_INVALID_FILE;
+            ctx->pipe[0].size = 0;
+            ctx->pipe[1].fd[0] = NGX_INVALID_FILE;
+            ctx->pipe[1].fd[1] = NGX_INVALID_FILE;
+            ctx->pipe[1].size = 0;
+
+            cln = ngx_pool_cleanup_add(c->pool, 0);
+            if (cln == NULL) {
+                return NGX_ERROR;
+            }
+
+            cln->handler = ngx_stream_proxy_splice_cleanup;
+            cln->data = ctx;
+
+            ngx_stream_set_ctx(s, ctx, ngx_stream_proxy_module);
+        }
+
+        pp = &ctx->pipe[from_upstream];
+
+        if (pipe2(pp->fd, O_NONBLOCK|O_CLOEXEC) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno, "pipe2() failed");
+            pp->fd[0] = NGX_INVALID_FILE;
+            pp->fd[1] = NGX_INVALID_FILE;
+            return NGX_ERROR;
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "stream proxy splice %s, pipe %d:%d",
+                       from_upstream ? "from upstream" : "to upstream",
+                       pp->fd[0], pp->fd[1]);
+    }
+
+    for ( ;; ) {
+
+        if (pp->size) {
+            n = splice(pp->fd[0], NULL, dst->fd, NULL, pp->size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                           "stream proxy splice write: %z of %uz",
+                           n, pp->size);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EAGAIN) {
+                    dst->write->ready = 0;
+                    break;
+                }
+
+                dst->write->error = 1;
+                ngx_connection_error(dst, err, "splice() failed");
+                return NGX_ERROR;
+            }
+
+            pp->size -= n;
+            dst->sent += n;
+            u->spliced += n;
+
+            if (pp->size == 0) {
+                dst->buffered &= ~NGX_STREAM_PROXY_SPLICE_BUFFERED;
+            }
+
+            continue;
+        }
+
+        if (!src->read->ready || src->read->eof || src->read->error) {
+            break;
+        }
+
+        n = splice(src->fd, NULL, pp->fd[1], NULL,
+                   NGX_STREAM_PROXY_SPLICE_SIZE,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "stream proxy splice read: %z", n);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+                src->read->ready = 0;
+                break;
+            }
+
+            ngx_connection_error(src, err, "splice() failed");
+
+            src->read->ready = 0;
+            src->read->error = 1;
+            src->read->eof = 1;
+            break;
+        }
+
+        if (n == 0) {
+            src->read->ready = 0;
+            src->read->eof = 1;
+            break;
+        }
+
+        if (from_upstream) {
+            if (u->state->first_byte_time == (ngx_msec_t) -1) {
+                u->state->first_byte_time = ngx_current_msec - u->start_time;
+            }
+        }
+
+        (*packets)++;
+        *received += n;
+
+        pp->size = n;
+        dst->buffered |= NGX_STREAM_PROXY_SPLICE_BUFFERED;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_proxy_splice_cleanup(void *data)
+{
+    ngx_stream_proxy_ctx_t  *ctx = data;
+
+    ngx_uint_t  i, j;
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+
+            if (ctx->pipe[i].fd[j] == NGX_INVALID_FILE) {
+                continue;
+            }
+
+            if (close(ctx->pipe[i].fd[j]) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                              "close() pipe failed");
+            }
+        }
+    }
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_stream_proxy_test_finalize(ngx_stream_session_t *s,
     ngx_uint_t from_upstream)
@@ -1829,6 +2749,7 @@ ngx_stream_proxy_next_upstream(ngx_stream_session_t *s)
 
         u->state->bytes_received = u->received;
         u->state->bytes_sent = pc->sent;
+        u->state->bytes_spliced = u->spliced;
 
         ngx_close_connection(pc);
         u->peer.connection = NULL;
@@ -1869,6 +2790,7 @@ ngx_stream_proxy_finalize(ngx_stream_session_t *s, ngx_uint_t rc)
         if (pc) {
             u->state->bytes_received = u->received;
             u->state->bytes_sent = pc->sent;
+            u->state->bytes_spliced = u->spliced;
         }
     }
 
@@ -1969,6 +2891,7 @@ ngx_stream_proxy_create_srv_conf(ngx_conf_t *cf)
     conf->timeout = NGX_CONF_UNSET_MSEC;
     conf->next_upstream_timeout = NGX_CONF_UNSET_MSEC;
     conf->buffer_size = NGX_CONF_UNSET_SIZE;
+    conf->max_buffer_size = NGX_CONF_UNSET_SIZE;
     conf->requests = NGX_CONF_UNSET_UINT;
     conf->responses = NGX_CONF_UNSET_UINT;
     conf->next_upstream_tries = NGX_CONF_UNSET_UINT;
@@ -1976,6 +2899,10 @@ ngx_stream_proxy_create_srv_conf(ngx_conf_t *cf)
     conf->proxy_protocol = NGX_CONF_UNSET;
     conf->local = NGX_CONF_UNSET_PTR;
     conf->socket_keepalive = NGX_CONF_UNSET;
+    conf->splice = NGX_CONF_UNSET;
+    conf->prewarm = NGX_CONF_UNSET_UINT;
+
+    ngx_queue_init(&conf->warm);
 
 #if (NGX_STREAM_SSL)
     conf->ssl_enable = NGX_CONF_UNSET;
@@ -2008,6 +2935,16 @@ ngx_stream_proxy_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->buffer_size,
                               prev->buffer_size, 16384);
 
+    ngx_conf_merge_size_value(conf->max_buffer_size,
+                              prev->max_buffer_size, conf->buffer_size);
+
+    if (conf->max_buffer_size < conf->buffer_size) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"proxy_max_buffer_size\" must be equal to "
+                           "or greater than \"proxy_buffer_size\"");
+        return NGX_CONF_ERROR;
+    }
+
     if (conf->upload_rate == NULL) {
         conf->upload_rate = prev->upload_rate;
     }
@@ -2034,6 +2971,23 @@ ngx_stream_proxy_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->socket_keepalive,
                               prev->socket_keepalive, 0);
 
+    ngx_conf_merge_value(conf->splice, prev->splice, 0);
+
+    ngx_conf_merge_uint_value(conf->prewarm, prev->prewarm, 0);
+
+    if (conf->prewarm && conf->local
+        && (conf->local->value
+#if (NGX_HAVE_TRANSPARENT_PROXY)
+            || conf->local->transparent
+#endif
+           ))
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"proxy_prewarm\" cannot be used with "
+                           "\"proxy_bind\" with variables or transparent");
+        return NGX_CONF_ERROR;
+    }
+
 #if (NGX_STREAM_SSL)
 
     ngx_conf_merge_value(conf->ssl_enable, prev->ssl_enable, 0);
@@ -2071,6 +3025,13 @@ ngx_stream_proxy_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_ptr_value(conf->ssl_passwords, prev->ssl_passwords, NULL);
 
+    if (conf->prewarm && conf->ssl_enable && conf->proxy_protocol) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"proxy_prewarm\" cannot be used with "
+                           "\"proxy_protocol\" and \"proxy_ssl\"");
+        return NGX_CONF_ERROR;
+    }
+
     if (conf->ssl_enable && ngx_stream_proxy_set_ssl(cf, conf) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
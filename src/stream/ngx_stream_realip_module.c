@@ -11,7 +11,8 @@
 
 
 typedef struct {
-    ngx_array_t       *from;     /* array of ngx_cidr_t */
+    ngx_array_t          *from;     /* array of ngx_cidr_t */
+    ngx_poptrie_cidrs_t  *trusted;
 } ngx_stream_realip_srv_conf_t;
 
 
@@ -112,7 +113,7 @@ ngx_stream_realip_handler(ngx_stream_session_t *s)
         return NGX_DECLINED;
     }
 
-    if (ngx_cidr_match(c->sockaddr, rscf->from) != NGX_OK) {
+    if (ngx_poptrie_cidrs_match(rscf->trusted, c->sockaddr) != NGX_OK) {
         return NGX_DECLINED;
     }
 
@@ -290,6 +291,7 @@ ngx_stream_realip_create_srv_conf(ngx_conf_t *cf)
      * set by ngx_pcalloc():
      *
      *     conf->from = NULL;
+     *     conf->trusted = NULL;
      */
 
     return conf;
@@ -303,7 +305,24 @@ ngx_stream_realip_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_stream_realip_srv_conf_t *conf = child;
 
     if (conf->from == NULL) {
+
+        if (prev->from && prev->trusted == NULL) {
+            prev->trusted = ngx_poptrie_cidrs_create(cf->pool, prev->from,
+                                                     cf->log);
+            if (prev->trusted == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
         conf->from = prev->from;
+        conf->trusted = prev->trusted;
+
+    } else if (conf->trusted == NULL) {
+        conf->trusted = ngx_poptrie_cidrs_create(cf->pool, conf->from,
+                                                 cf->log);
+        if (conf->trusted == NULL) {
+            return NGX_CONF_ERROR;
+        }
     }
 
     return NGX_CONF_OK;
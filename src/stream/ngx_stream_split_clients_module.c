@@ -10,6 +10,13 @@
 #include <ngx_stream.h>
 
 
+#define NGX_STREAM_SPLIT_CLIENTS_MURMUR2   0
+#define NGX_STREAM_SPLIT_CLIENTS_MURMUR64  1
+
+/* blocks with more parts look up the part in a table by the hash prefix */
+#define NGX_STREAM_SPLIT_CLIENTS_TABLE     8
+
+
 typedef struct {
     uint32_t                      percent;
     ngx_stream_variable_value_t   value;
@@ -19,6 +26,8 @@ typedef struct {
 typedef struct {
     ngx_stream_complex_value_t    value;
     ngx_array_t                   parts;
+    uint16_t                     *table;
+    ngx_uint_t                    hash;
 } ngx_stream_split_clients_ctx_t;
 
 
@@ -30,7 +39,7 @@ static char *ngx_stream_split_clients(ngx_conf_t *cf, ngx_command_t *dummy,
 static ngx_command_t  ngx_stream_split_clients_commands[] = {
 
     { ngx_string("split_clients"),
-      NGX_STREAM_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_TAKE2,
+      NGX_STREAM_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_TAKE23,
       ngx_conf_split_clients_block,
       NGX_STREAM_MAIN_CONF_OFFSET,
       0,
@@ -86,11 +95,18 @@ ngx_stream_split_clients_variable(ngx_stream_session_t *s,
         return NGX_OK;
     }
 
-    hash = ngx_murmur_hash2(val.data, val.len);
+    if (ctx->hash == NGX_STREAM_SPLIT_CLIENTS_MURMUR64) {
+        hash = (uint32_t) (ngx_murmur_hash64a(val.data, val.len) >> 32);
+
+    } else {
+        hash = ngx_murmur_hash2(val.data, val.len);
+    }
 
     part = ctx->parts.elts;
 
-    for (i = 0; i < ctx->parts.nelts; i++) {
+    i = ctx->table ? ctx->table[hash >> 16] : 0;
+
+    for ( /* void */ ; i < ctx->parts.nelts; i++) {
 
         ngx_log_debug2(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
                        "stream split: %uD %uD", hash, part[i].percent);
@@ -111,7 +127,7 @@ ngx_conf_split_clients_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     char                                *rv;
     uint32_t                             sum, last;
     ngx_str_t                           *value, name;
-    ngx_uint_t                           i;
+    ngx_uint_t                           i, n;
     ngx_conf_t                           save;
     ngx_stream_variable_t               *var;
     ngx_stream_split_clients_ctx_t      *ctx;
@@ -137,6 +153,20 @@ ngx_conf_split_clients_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     name = value[2];
 
+    if (cf->args->nelts == 4) {
+        if (ngx_strcmp(value[3].data, "hash=murmur2") == 0) {
+            ctx->hash = NGX_STREAM_SPLIT_CLIENTS_MURMUR2;
+
+        } else if (ngx_strcmp(value[3].data, "hash=murmur64") == 0) {
+            ctx->hash = NGX_STREAM_SPLIT_CLIENTS_MURMUR64;
+
+        } else {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[3]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
     if (name.data[0] != '$') {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid variable name \"%V\"", &name);
@@ -192,6 +222,31 @@ ngx_conf_split_clients_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
+    if (ctx->parts.nelts <= NGX_STREAM_SPLIT_CLIENTS_TABLE) {
+        return rv;
+    }
+
+    /*
+     * the table gives for each 16-bit hash prefix the first part which
+     * may match, the rest of the hash is compared with the parts as usual
+     */
+
+    ctx->table = ngx_palloc(cf->pool, 0x10000 * sizeof(uint16_t));
+    if (ctx->table == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 0, n = 0; n < 0x10000; n++) {
+        while (i < ctx->parts.nelts
+               && part[i].percent
+               && part[i].percent <= (uint32_t) n << 16)
+        {
+            i++;
+        }
+
+        ctx->table[n] = (uint16_t) i;
+    }
+
     return rv;
 }
 
@@ -41,10 +41,18 @@ static char *ngx_stream_ssl_merge_conf(ngx_conf_t *cf, void *parent,
 static ngx_int_t ngx_stream_ssl_compile_certificates(ngx_conf_t *cf,
     ngx_stream_ssl_conf_t *conf);
 
+static char *ngx_stream_ssl_certificate_cache(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 static char *ngx_stream_ssl_password_file(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_stream_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_stream_ssl_session_ticket_keys_zone(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_stream_ssl_async(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_stream_ssl_handshake_limit(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 static ngx_int_t ngx_stream_ssl_init(ngx_conf_t *cf);
 
 
@@ -91,6 +99,13 @@ static ngx_command_t  ngx_stream_ssl_commands[] = {
       offsetof(ngx_stream_ssl_conf_t, certificate_keys),
       NULL },
 
+    { ngx_string("ssl_certificate_cache"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE123,
+      ngx_stream_ssl_certificate_cache,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("ssl_password_file"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
       ngx_stream_ssl_password_file,
@@ -162,7 +177,7 @@ static ngx_command_t  ngx_stream_ssl_commands[] = {
       NULL },
 
     { ngx_string("ssl_session_cache"),
-      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE12,
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE123,
       ngx_stream_ssl_session_cache,
       NGX_STREAM_SRV_CONF_OFFSET,
       0,
@@ -182,6 +197,27 @@ static ngx_command_t  ngx_stream_ssl_commands[] = {
       offsetof(ngx_stream_ssl_conf_t, session_ticket_keys),
       NULL },
 
+    { ngx_string("ssl_session_ticket_keys_zone"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_1MORE,
+      ngx_stream_ssl_session_ticket_keys_zone,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("ssl_async"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_stream_ssl_async,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("ssl_handshake_limit"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE12,
+      ngx_stream_ssl_handshake_limit,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("ssl_session_timeout"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_sec_slot,
@@ -471,6 +507,7 @@ ngx_stream_ssl_certificate(ngx_ssl_conn_t *ssl_conn, void *arg)
                        "ssl key: \"%s\"", key.data);
 
         if (ngx_ssl_connection_certificate(c, c->pool, &cert, &key,
+                                           sslcf->certificate_cache,
                                            sslcf->passwords)
             != NGX_OK)
         {
@@ -588,12 +625,14 @@ ngx_stream_ssl_create_conf(ngx_conf_t *cf)
      *     scf->trusted_certificate = { 0, NULL };
      *     scf->crl = { 0, NULL };
      *     scf->ciphers = { 0, NULL };
+     *     scf->async_pool = { 0, NULL };
      *     scf->shm_zone = NULL;
      */
 
     scf->handshake_timeout = NGX_CONF_UNSET_MSEC;
     scf->certificates = NGX_CONF_UNSET_PTR;
     scf->certificate_keys = NGX_CONF_UNSET_PTR;
+    scf->certificate_cache = NGX_CONF_UNSET_PTR;
     scf->passwords = NGX_CONF_UNSET_PTR;
     scf->prefer_server_ciphers = NGX_CONF_UNSET;
     scf->verify = NGX_CONF_UNSET_UINT;
@@ -602,6 +641,9 @@ ngx_stream_ssl_create_conf(ngx_conf_t *cf)
     scf->session_timeout = NGX_CONF_UNSET;
     scf->session_tickets = NGX_CONF_UNSET;
     scf->session_ticket_keys = NGX_CONF_UNSET_PTR;
+    scf->session_ticket_keys_zone = NGX_CONF_UNSET_PTR;
+    scf->async = NGX_CONF_UNSET_UINT;
+    scf->handshake_limit = NGX_CONF_UNSET_PTR;
 
     return scf;
 }
@@ -635,6 +677,9 @@ ngx_stream_ssl_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_ptr_value(conf->certificate_keys, prev->certificate_keys,
                          NULL);
 
+    ngx_conf_merge_ptr_value(conf->certificate_cache, prev->certificate_cache,
+                         NULL);
+
     ngx_conf_merge_ptr_value(conf->passwords, prev->passwords, NULL);
 
     ngx_conf_merge_str_value(conf->dhparam, prev->dhparam, "");
@@ -805,7 +850,40 @@ ngx_stream_ssl_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_ptr_value(conf->session_ticket_keys,
                          prev->session_ticket_keys, NULL);
 
-    if (ngx_ssl_session_ticket_keys(cf, &conf->ssl, conf->session_ticket_keys)
+    ngx_conf_merge_ptr_value(conf->session_ticket_keys_zone,
+                         prev->session_ticket_keys_zone, NULL);
+
+    if (conf->session_ticket_keys_zone) {
+        if (ngx_ssl_session_ticket_keys_shared(cf, &conf->ssl,
+                                               conf->session_ticket_keys_zone)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+    } else if (ngx_ssl_session_ticket_keys(cf, &conf->ssl,
+                                           conf->session_ticket_keys)
+               != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->async == NGX_CONF_UNSET_UINT) {
+        conf->async_pool = prev->async_pool;
+    }
+
+    ngx_conf_merge_uint_value(conf->async, prev->async, NGX_SSL_ASYNC_OFF);
+
+    if (ngx_ssl_async(cf, &conf->ssl, conf->async, &conf->async_pool)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_merge_ptr_value(conf->handshake_limit, prev->handshake_limit,
+                             NULL);
+
+    if (ngx_ssl_handshake_limit(cf, &conf->ssl, conf->handshake_limit)
         != NGX_OK)
     {
         return NGX_CONF_ERROR;
@@ -899,6 +977,20 @@ found:
 }
 
 
+static char *
+ngx_stream_ssl_certificate_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_stream_ssl_conf_t  *scf = conf;
+
+    if (scf->certificate_cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    return ngx_ssl_certificate_cache(cf, &scf->certificate_cache);
+}
+
+
 static char *
 ngx_stream_ssl_password_file(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -929,11 +1021,13 @@ ngx_stream_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     size_t       len;
     ngx_str_t   *value, name, size;
-    ngx_int_t    n;
+    ngx_int_t    n, shards;
     ngx_uint_t   i, j;
 
     value = cf->args->elts;
 
+    shards = 0;
+
     for (i = 1; i < cf->args->nelts; i++) {
 
         if (ngx_strcmp(value[i].data, "off") == 0) {
@@ -1013,12 +1107,43 @@ ngx_stream_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
             scf->shm_zone->init = ngx_ssl_session_cache_init;
 
+            /* the layout is the number of shards, see ngx_ssl_session_cache_shards() */
+
+            if (scf->shm_zone->shm.layout == 0) {
+                scf->shm_zone->shm.layout = 1;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+
+            if (shards <= 0 || shards > NGX_SSL_MAX_SESSION_CACHE_SHARDS) {
+                goto invalid;
+            }
+
             continue;
         }
 
         goto invalid;
     }
 
+    if (shards) {
+        if (scf->shm_zone == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"shards\" requires a shared session cache");
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_ssl_session_cache_shards(cf, scf->shm_zone, shards)
+            != NGX_CONF_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     if (scf->shm_zone && scf->builtin_session_cache == NGX_CONF_UNSET) {
         scf->builtin_session_cache = NGX_SSL_NO_BUILTIN_SCACHE;
     }
@@ -1034,6 +1159,48 @@ invalid:
 }
 
 
+static char *
+ngx_stream_ssl_session_ticket_keys_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_stream_ssl_conf_t  *scf = conf;
+
+    if (scf->session_ticket_keys_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    return ngx_ssl_session_ticket_keys_zone(cf, &scf->session_ticket_keys_zone,
+                                            &ngx_stream_ssl_module);
+}
+
+
+static char *
+ngx_stream_ssl_async(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_stream_ssl_conf_t  *scf = conf;
+
+    if (scf->async != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    return ngx_ssl_async_conf(cf, &scf->async, &scf->async_pool);
+}
+
+
+static char *
+ngx_stream_ssl_handshake_limit(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_stream_ssl_conf_t  *scf = conf;
+
+    if (scf->handshake_limit != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    return ngx_ssl_handshake_limit_conf(cf, &scf->handshake_limit);
+}
+
+
 static ngx_int_t
 ngx_stream_ssl_init(ngx_conf_t *cf)
 {
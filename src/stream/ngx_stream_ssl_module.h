@@ -37,6 +37,8 @@ typedef struct {
     ngx_array_t     *certificate_values;
     ngx_array_t     *certificate_key_values;
 
+    ngx_ssl_cache_t *certificate_cache;
+
     ngx_str_t        dhparam;
     ngx_str_t        ecdh_curve;
     ngx_str_t        client_certificate;
@@ -51,6 +53,11 @@ typedef struct {
 
     ngx_flag_t       session_tickets;
     ngx_array_t     *session_ticket_keys;
+    ngx_shm_zone_t  *session_ticket_keys_zone;
+
+    ngx_uint_t       async;
+    ngx_str_t        async_pool;
+    ngx_ssl_handshake_limit_t *handshake_limit;
 
     u_char          *file;
     ngx_uint_t       line;
@@ -7,6 +7,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_stream.h>
+#include <ngx_md5.h>
 
 
 typedef struct {
@@ -14,31 +15,79 @@ typedef struct {
 } ngx_stream_ssl_preread_srv_conf_t;
 
 
+#define NGX_STREAM_SSL_PREREAD_CIPHERS     128
+#define NGX_STREAM_SSL_PREREAD_EXTENSIONS  64
+#define NGX_STREAM_SSL_PREREAD_GROUPS      32
+#define NGX_STREAM_SSL_PREREAD_FORMATS     16
+
+/* "65535," per JA3 field value */
+#define NGX_STREAM_SSL_PREREAD_JA3_LEN                                        \
+    (6 * (1 + NGX_STREAM_SSL_PREREAD_CIPHERS                                  \
+          + NGX_STREAM_SSL_PREREAD_EXTENSIONS                                 \
+          + NGX_STREAM_SSL_PREREAD_GROUPS                                     \
+          + NGX_STREAM_SSL_PREREAD_FORMATS))
+
+/* GREASE values, RFC 8701, are ignored in fingerprints */
+#define ngx_stream_ssl_preread_grease(v)                                      \
+    (((v) & 0x0f0f) == 0x0a0a && ((v) >> 8) == ((v) & 0xff))
+
+
 typedef struct {
     size_t          left;
     size_t          size;
     size_t          ext;
+    size_t          items;
     u_char         *pos;
     u_char         *dst;
     u_char          buf[4];
     u_char          version[2];
     ngx_str_t       host;
     ngx_str_t       alpn;
+
+    /* ALPN protocol_name_list, in the preread buffer */
+    ngx_str_t       alpn_list;
+
     ngx_log_t      *log;
     ngx_pool_t     *pool;
     ngx_uint_t      state;
+
+    /* ClientHello fields for the JA3 fingerprint */
+    ngx_uint_t      hello_version;
+    ngx_uint_t      nciphers;
+    ngx_uint_t      nextensions;
+    ngx_uint_t      ngroups;
+    ngx_uint_t      nformats;
+    uint16_t        ciphers[NGX_STREAM_SSL_PREREAD_CIPHERS];
+    uint16_t        extensions[NGX_STREAM_SSL_PREREAD_EXTENSIONS];
+    uint16_t        groups[NGX_STREAM_SSL_PREREAD_GROUPS];
+    uint16_t        formats[NGX_STREAM_SSL_PREREAD_FORMATS];
+
+    unsigned        fingerprint:1;
+    u_char          ja3_hash[32];
 } ngx_stream_ssl_preread_ctx_t;
 
 
 static ngx_int_t ngx_stream_ssl_preread_handler(ngx_stream_session_t *s);
 static ngx_int_t ngx_stream_ssl_preread_parse_record(
     ngx_stream_ssl_preread_ctx_t *ctx, u_char *pos, u_char *last);
+static void ngx_stream_ssl_preread_fingerprint(
+    ngx_stream_ssl_preread_ctx_t *ctx);
+static u_char *ngx_stream_ssl_preread_ja3(ngx_stream_ssl_preread_ctx_t *ctx,
+    u_char *buf);
+static u_char *ngx_stream_ssl_preread_list(u_char *p, u_char sep,
+    uint16_t *list, ngx_uint_t n);
 static ngx_int_t ngx_stream_ssl_preread_protocol_variable(
     ngx_stream_session_t *s, ngx_stream_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_stream_ssl_preread_server_name_variable(
     ngx_stream_session_t *s, ngx_stream_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_stream_ssl_preread_alpn_protocols_variable(
     ngx_stream_session_t *s, ngx_stream_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_stream_ssl_preread_ja3_variable(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_stream_ssl_preread_ja3_hash_variable(
+    ngx_stream_session_t *s, ngx_stream_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_stream_ssl_preread_list_variable(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_stream_ssl_preread_add_variables(ngx_conf_t *cf);
 static void *ngx_stream_ssl_preread_create_srv_conf(ngx_conf_t *cf);
 static char *ngx_stream_ssl_preread_merge_srv_conf(ngx_conf_t *cf, void *parent,
@@ -98,6 +147,20 @@ static ngx_stream_variable_t  ngx_stream_ssl_preread_vars[] = {
     { ngx_string("ssl_preread_alpn_protocols"), NULL,
       ngx_stream_ssl_preread_alpn_protocols_variable, 0, 0, 0 },
 
+    { ngx_string("ssl_preread_ciphers"), NULL,
+      ngx_stream_ssl_preread_list_variable,
+      offsetof(ngx_stream_ssl_preread_ctx_t, nciphers), 0, 0 },
+
+    { ngx_string("ssl_preread_extensions"), NULL,
+      ngx_stream_ssl_preread_list_variable,
+      offsetof(ngx_stream_ssl_preread_ctx_t, nextensions), 0, 0 },
+
+    { ngx_string("ssl_preread_ja3"), NULL,
+      ngx_stream_ssl_preread_ja3_variable, 0, 0, 0 },
+
+    { ngx_string("ssl_preread_ja3_hash"), NULL,
+      ngx_stream_ssl_preread_ja3_hash_variable, 0, 0, 0 },
+
       ngx_stream_null_variable
 };
 
@@ -187,6 +250,10 @@ ngx_stream_ssl_preread_handler(ngx_stream_session_t *s)
             return NGX_DECLINED;
         }
 
+        if (rc == NGX_OK) {
+            ngx_stream_ssl_preread_fingerprint(ctx);
+        }
+
         if (rc != NGX_AGAIN) {
             return rc;
         }
@@ -204,8 +271,9 @@ static ngx_int_t
 ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
     u_char *pos, u_char *last)
 {
-    size_t   left, n, size, ext;
-    u_char  *dst, *p;
+    size_t      left, n, size, ext, items;
+    u_char     *dst, *p;
+    ngx_uint_t  v;
 
     enum {
         sw_start = 0,
@@ -215,6 +283,7 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
         sw_sid_len,         /* session_id length */
         sw_sid,             /* session_id */
         sw_cs_len,          /* cipher_suites length */
+        sw_cs_item,         /* cipher_suite */
         sw_cs,              /* cipher_suites */
         sw_cm_len,          /* compression_methods length */
         sw_cm,              /* compression_methods */
@@ -226,7 +295,11 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
         sw_alpn_len,        /* ALPN length */
         sw_alpn_proto_len,  /* ALPN protocol_name length */
         sw_alpn_proto_data, /* ALPN protocol_name */
-        sw_supver_len       /* supported_versions length */
+        sw_supver_len,      /* supported_versions length */
+        sw_groups_len,      /* supported_groups length */
+        sw_group,           /* supported_groups NamedGroup */
+        sw_formats_len,     /* ec_point_formats length */
+        sw_format           /* ec_point_formats ECPointFormat */
     } state;
 
     ngx_log_debug2(NGX_LOG_DEBUG_STREAM, ctx->log, 0,
@@ -236,6 +309,7 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
     size = ctx->size;
     left = ctx->left;
     ext = ctx->ext;
+    items = ctx->items;
     dst = ctx->dst;
     p = ctx->buf;
 
@@ -277,6 +351,8 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
             break;
 
         case sw_version:
+            ctx->hello_version = (ctx->version[0] << 8) + ctx->version[1];
+
             state = sw_random;
             dst = NULL;
             size = 32;
@@ -301,9 +377,33 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
             break;
 
         case sw_cs_len:
-            state = sw_cs;
-            dst = NULL;
-            size = (p[0] << 8) + p[1];
+            items = (p[0] << 8) + p[1];
+
+            if (items & 1) {
+                ngx_log_debug0(NGX_LOG_DEBUG_STREAM, ctx->log, 0,
+                               "ssl preread: cipher suites format error");
+                return NGX_DECLINED;
+            }
+
+            state = items ? sw_cs_item : sw_cs;
+            dst = p;
+            size = items ? 2 : 0;
+            break;
+
+        case sw_cs_item:
+            v = (p[0] << 8) + p[1];
+
+            if (!ngx_stream_ssl_preread_grease(v)
+                && ctx->nciphers < NGX_STREAM_SSL_PREREAD_CIPHERS)
+            {
+                ctx->ciphers[ctx->nciphers++] = (uint16_t) v;
+            }
+
+            items -= 2;
+
+            state = items ? sw_cs_item : sw_cs;
+            dst = p;
+            size = items ? 2 : 0;
             break;
 
         case sw_cs:
@@ -340,6 +440,14 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
             break;
 
         case sw_ext_header:
+            v = (p[0] << 8) + p[1];
+
+            if (!ngx_stream_ssl_preread_grease(v)
+                && ctx->nextensions < NGX_STREAM_SSL_PREREAD_EXTENSIONS)
+            {
+                ctx->extensions[ctx->nextensions++] = (uint16_t) v;
+            }
+
             if (p[0] == 0 && p[1] == 0 && ctx->host.data == NULL) {
                 /* SNI extension */
                 state = sw_sni_len;
@@ -348,7 +456,9 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
                 break;
             }
 
-            if (p[0] == 0 && p[1] == 16 && ctx->alpn.data == NULL) {
+            if (p[0] == 0 && p[1] == 16
+                && ctx->alpn.data == NULL && ctx->alpn_list.data == NULL)
+            {
                 /* ALPN extension */
                 state = sw_alpn_len;
                 dst = p;
@@ -364,6 +474,24 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
                 break;
             }
 
+            ext = (p[2] << 8) + p[3];
+
+            if (p[0] == 0 && p[1] == 10 && ext >= 2) {
+                /* supported_groups extension */
+                state = sw_groups_len;
+                dst = p;
+                size = 2;
+                break;
+            }
+
+            if (p[0] == 0 && p[1] == 11 && ext >= 1) {
+                /* ec_point_formats extension */
+                state = sw_formats_len;
+                dst = p;
+                size = 1;
+                break;
+            }
+
             state = sw_ext;
             dst = NULL;
             size = (p[2] << 8) + p[3];
@@ -392,12 +520,21 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
             }
             ext -= 3 + size;
 
+            state = sw_sni_host;
+
+            /* the name is not copied unless it spans records */
+
+            if ((size_t) (last - pos) >= size) {
+                ctx->host.data = pos;
+                dst = NULL;
+                break;
+            }
+
             ctx->host.data = ngx_pnalloc(ctx->pool, size);
             if (ctx->host.data == NULL) {
                 return NGX_ERROR;
             }
 
-            state = sw_sni_host;
             dst = ctx->host.data;
             break;
 
@@ -415,9 +552,20 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
         case sw_alpn_len:
             ext = (p[0] << 8) + p[1];
 
-            ctx->alpn.data = ngx_pnalloc(ctx->pool, ext);
-            if (ctx->alpn.data == NULL) {
-                return NGX_ERROR;
+            /*
+             * the list is converted to the variable value on demand
+             * unless it spans records
+             */
+
+            if ((size_t) (last - pos) >= ext) {
+                ctx->alpn_list.data = pos;
+                ctx->alpn_list.len = ext;
+
+            } else {
+                ctx->alpn.data = ngx_pnalloc(ctx->pool, ext);
+                if (ctx->alpn.data == NULL) {
+                    return NGX_ERROR;
+                }
             }
 
             state = sw_alpn_proto_len;
@@ -442,10 +590,25 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
             ext -= 1 + size;
 
             state = sw_alpn_proto_data;
-            dst = ctx->alpn.data + ctx->alpn.len;
+            dst = ctx->alpn.data ? ctx->alpn.data + ctx->alpn.len : NULL;
             break;
 
         case sw_alpn_proto_data:
+            if (ctx->alpn.data == NULL) {
+
+                if (ext) {
+                    state = sw_alpn_proto_len;
+                    dst = p;
+                    size = 1;
+                    break;
+                }
+
+                state = sw_ext;
+                dst = NULL;
+                size = 0;
+                break;
+            }
+
             ctx->alpn.len += p[0];
 
             ngx_log_debug1(NGX_LOG_DEBUG_STREAM, ctx->log, 0,
@@ -477,6 +640,54 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
             dst = NULL;
             size = p[0];
             break;
+
+        case sw_groups_len:
+            ext -= 2;
+            items = ngx_min((size_t) ((p[0] << 8) + p[1]), ext) & ~1;
+            ext -= items;
+
+            state = items ? sw_group : sw_ext;
+            dst = items ? p : NULL;
+            size = items ? 2 : ext;
+            break;
+
+        case sw_group:
+            v = (p[0] << 8) + p[1];
+
+            if (!ngx_stream_ssl_preread_grease(v)
+                && ctx->ngroups < NGX_STREAM_SSL_PREREAD_GROUPS)
+            {
+                ctx->groups[ctx->ngroups++] = (uint16_t) v;
+            }
+
+            items -= 2;
+
+            state = items ? sw_group : sw_ext;
+            dst = items ? p : NULL;
+            size = items ? 2 : ext;
+            break;
+
+        case sw_formats_len:
+            ext -= 1;
+            items = ngx_min((size_t) p[0], ext);
+            ext -= items;
+
+            state = items ? sw_format : sw_ext;
+            dst = items ? p : NULL;
+            size = items ? 1 : ext;
+            break;
+
+        case sw_format:
+            if (ctx->nformats < NGX_STREAM_SSL_PREREAD_FORMATS) {
+                ctx->formats[ctx->nformats++] = p[0];
+            }
+
+            items -= 1;
+
+            state = items ? sw_format : sw_ext;
+            dst = items ? p : NULL;
+            size = items ? 1 : ext;
+            break;
         }
 
         if (left < size) {
@@ -490,12 +701,80 @@ ngx_stream_ssl_preread_parse_record(ngx_stream_ssl_preread_ctx_t *ctx,
     ctx->size = size;
     ctx->left = left;
     ctx->ext = ext;
+    ctx->items = items;
     ctx->dst = dst;
 
     return NGX_AGAIN;
 }
 
 
+static void
+ngx_stream_ssl_preread_fingerprint(ngx_stream_ssl_preread_ctx_t *ctx)
+{
+    u_char     *last;
+    ngx_md5_t   md5;
+    u_char      hash[16];
+    u_char      buf[NGX_STREAM_SSL_PREREAD_JA3_LEN];
+
+    last = ngx_stream_ssl_preread_ja3(ctx, buf);
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, buf, last - buf);
+    ngx_md5_final(hash, &md5);
+
+    ngx_hex_dump(ctx->ja3_hash, hash, 16);
+
+    ctx->fingerprint = 1;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, ctx->log, 0,
+                   "ssl preread: JA3 \"%*s\"", last - buf, buf);
+}
+
+
+/*
+ * "SSLVersion,Ciphers,Extensions,EllipticCurves,EllipticCurvePointFormats"
+ * with decimal values separated by "-", as defined by JA3
+ */
+
+static u_char *
+ngx_stream_ssl_preread_ja3(ngx_stream_ssl_preread_ctx_t *ctx, u_char *buf)
+{
+    u_char  *p;
+
+    p = ngx_sprintf(buf, "%ui,", ctx->hello_version);
+
+    p = ngx_stream_ssl_preread_list(p, '-', ctx->ciphers, ctx->nciphers);
+    *p++ = ',';
+
+    p = ngx_stream_ssl_preread_list(p, '-', ctx->extensions,
+                                    ctx->nextensions);
+    *p++ = ',';
+
+    p = ngx_stream_ssl_preread_list(p, '-', ctx->groups, ctx->ngroups);
+    *p++ = ',';
+
+    return ngx_stream_ssl_preread_list(p, '-', ctx->formats, ctx->nformats);
+}
+
+
+static u_char *
+ngx_stream_ssl_preread_list(u_char *p, u_char sep, uint16_t *list,
+    ngx_uint_t n)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < n; i++) {
+        if (i) {
+            *p++ = sep;
+        }
+
+        p = ngx_sprintf(p, "%ui", (ngx_uint_t) list[i]);
+    }
+
+    return p;
+}
+
+
 static ngx_int_t
 ngx_stream_ssl_preread_protocol_variable(ngx_stream_session_t *s,
     ngx_variable_value_t *v, uintptr_t data)
@@ -579,6 +858,7 @@ static ngx_int_t
 ngx_stream_ssl_preread_alpn_protocols_variable(ngx_stream_session_t *s,
     ngx_variable_value_t *v, uintptr_t data)
 {
+    u_char                        *p, *last, *dst;
     ngx_stream_ssl_preread_ctx_t  *ctx;
 
     ctx = ngx_stream_get_module_ctx(s, ngx_stream_ssl_preread_module);
@@ -588,6 +868,32 @@ ngx_stream_ssl_preread_alpn_protocols_variable(ngx_stream_session_t *s,
         return NGX_OK;
     }
 
+    if (ctx->alpn.data == NULL && ctx->alpn_list.len) {
+
+        /* protocol names with length prefixes replaced by commas */
+
+        dst = ngx_pnalloc(s->connection->pool, ctx->alpn_list.len);
+        if (dst == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx->alpn.data = dst;
+
+        p = ctx->alpn_list.data;
+        last = p + ctx->alpn_list.len;
+
+        while (p < last) {
+            if (dst != ctx->alpn.data) {
+                *dst++ = ',';
+            }
+
+            dst = ngx_cpymem(dst, p + 1, p[0]);
+            p += 1 + p[0];
+        }
+
+        ctx->alpn.len = dst - ctx->alpn.data;
+    }
+
     v->valid = 1;
     v->no_cacheable = 0;
     v->not_found = 0;
@@ -598,6 +904,100 @@ ngx_stream_ssl_preread_alpn_protocols_variable(ngx_stream_session_t *s,
 }
 
 
+static ngx_int_t
+ngx_stream_ssl_preread_list_variable(ngx_stream_session_t *s,
+    ngx_variable_value_t *v, uintptr_t data)
+{
+    u_char                        *p;
+    uint16_t                      *list;
+    ngx_uint_t                     n;
+    ngx_stream_ssl_preread_ctx_t  *ctx;
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_ssl_preread_module);
+
+    if (ctx == NULL || !ctx->fingerprint) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    n = *(ngx_uint_t *) ((char *) ctx + data);
+
+    if (data == offsetof(ngx_stream_ssl_preread_ctx_t, nciphers)) {
+        list = ctx->ciphers;
+
+    } else {
+        list = ctx->extensions;
+    }
+
+    p = ngx_pnalloc(s->connection->pool, n * 6);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+    v->len = ngx_stream_ssl_preread_list(p, '-', list, n) - p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_ssl_preread_ja3_variable(ngx_stream_session_t *s,
+    ngx_variable_value_t *v, uintptr_t data)
+{
+    u_char                        *p;
+    ngx_stream_ssl_preread_ctx_t  *ctx;
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_ssl_preread_module);
+
+    if (ctx == NULL || !ctx->fingerprint) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(s->connection->pool, NGX_STREAM_SSL_PREREAD_JA3_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+    v->len = ngx_stream_ssl_preread_ja3(ctx, p) - p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_ssl_preread_ja3_hash_variable(ngx_stream_session_t *s,
+    ngx_variable_value_t *v, uintptr_t data)
+{
+    ngx_stream_ssl_preread_ctx_t  *ctx;
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_ssl_preread_module);
+
+    if (ctx == NULL || !ctx->fingerprint) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    /* computed while parsing, so maps look it up without copying */
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = sizeof(ctx->ja3_hash);
+    v->data = ctx->ja3_hash;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_stream_ssl_preread_add_variables(ngx_conf_t *cf)
 {
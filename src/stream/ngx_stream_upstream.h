@@ -60,6 +60,13 @@ typedef struct {
     ngx_msec_t                         slow_start;
     ngx_uint_t                         down;
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    /* a name resolved at run time */
+    ngx_str_t                          host;
+    ngx_str_t                          service;
+    in_port_t                          port;
+#endif
+
     unsigned                           backup:1;
 
     NGX_COMPAT_BEGIN(4)
@@ -83,6 +90,8 @@ struct ngx_stream_upstream_srv_conf_s {
 
 #if (NGX_STREAM_UPSTREAM_ZONE)
     ngx_shm_zone_t                    *shm_zone;
+    ngx_resolver_t                    *resolver;
+    ngx_msec_t                         resolver_timeout;
 #endif
 };
 
@@ -93,6 +102,7 @@ typedef struct {
     ngx_msec_t                         first_byte_time;
     off_t                              bytes_sent;
     off_t                              bytes_received;
+    off_t                              bytes_spliced;
 
     ngx_str_t                         *peer;
 } ngx_stream_upstream_state_t;
@@ -120,6 +130,10 @@ typedef struct {
     ngx_buf_t                          downstream_buf;
     ngx_buf_t                          upstream_buf;
 
+    /* sizes of the buffers to allocate */
+    size_t                             downstream_size;
+    size_t                             upstream_size;
+
     ngx_chain_t                       *free;
     ngx_chain_t                       *upstream_out;
     ngx_chain_t                       *upstream_busy;
@@ -127,6 +141,7 @@ typedef struct {
     ngx_chain_t                       *downstream_busy;
 
     off_t                              received;
+    off_t                              spliced;
     time_t                             start_sec;
     ngx_uint_t                         requests;
     ngx_uint_t                         responses;
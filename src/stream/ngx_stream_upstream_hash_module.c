@@ -22,9 +22,18 @@ typedef struct {
 } ngx_stream_upstream_chash_points_t;
 
 
+typedef struct {
+    ngx_uint_t                            number;
+    uint32_t                             *lookup;
+    ngx_stream_upstream_rr_peer_t       **peer;
+} ngx_stream_upstream_maglev_t;
+
+
 typedef struct {
     ngx_stream_complex_value_t            key;
     ngx_stream_upstream_chash_points_t   *points;
+    ngx_stream_upstream_maglev_t         *maglev;
+    ngx_uint_t                            bound;
 } ngx_stream_upstream_hash_srv_conf_t;
 
 
@@ -58,6 +67,18 @@ static ngx_int_t ngx_stream_upstream_init_chash_peer(ngx_stream_session_t *s,
 static ngx_int_t ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc,
     void *data);
 
+static ngx_int_t ngx_stream_upstream_init_maglev(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_update_maglev(ngx_pool_t *pool,
+    ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_init_maglev_peer(ngx_stream_session_t *s,
+    ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_get_maglev_peer(ngx_peer_connection_t *pc,
+    void *data);
+
+static ngx_uint_t ngx_stream_upstream_hash_bound(
+    ngx_stream_upstream_hash_peer_data_t *hp);
+
 static void *ngx_stream_upstream_hash_create_conf(ngx_conf_t *cf);
 static char *ngx_stream_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -66,7 +87,7 @@ static char *ngx_stream_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_stream_upstream_hash_commands[] = {
 
     { ngx_string("hash"),
-      NGX_STREAM_UPS_CONF|NGX_CONF_TAKE12,
+      NGX_STREAM_UPS_CONF|NGX_CONF_TAKE123,
       ngx_stream_upstream_hash,
       NGX_STREAM_SRV_CONF_OFFSET,
       0,
@@ -178,7 +199,12 @@ ngx_stream_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_stream_upstream_rr_peers_rlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
+    if (hp->tries > 20
+        || hp->rrp.peers->single
+        || hp->rrp.peers->number == 0
+        || hp->key.len == 0
+        || ngx_stream_upstream_rr_peers_changed(&hp->rrp))
+    {
         ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -289,8 +315,8 @@ ngx_stream_upstream_init_chash(ngx_conf_t *cf,
     size_t                                host_len, port_len, size;
     uint32_t                              hash, base_hash;
     ngx_str_t                            *server;
-    ngx_uint_t                            npoints, i, j;
-    ngx_stream_upstream_rr_peer_t        *peer;
+    ngx_uint_t                            npoints, i, j, k;
+    ngx_stream_upstream_rr_peer_t        *peer, *list[2];
     ngx_stream_upstream_rr_peers_t       *peers;
     ngx_stream_upstream_chash_points_t   *points;
     ngx_stream_upstream_hash_srv_conf_t  *hcf;
@@ -308,6 +334,16 @@ ngx_stream_upstream_init_chash(ngx_conf_t *cf,
     peers = us->peer.data;
     npoints = peers->total_weight * 160;
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+    /* points of servers resolved at run time are known from their names */
+
+    for (peer = peers->resolve; peer; peer = peer->next) {
+        npoints += peer->weight * 160;
+    }
+
+#endif
+
     size = sizeof(ngx_stream_upstream_chash_points_t)
            + sizeof(ngx_stream_upstream_chash_point_t) * (npoints - 1);
 
@@ -318,73 +354,82 @@ ngx_stream_upstream_init_chash(ngx_conf_t *cf,
 
     points->number = 0;
 
-    for (peer = peers->peer; peer; peer = peer->next) {
-        server = &peer->server;
-
-        /*
-         * Hash expression is compatible with Cache::Memcached::Fast:
-         * crc32(HOST \0 PORT PREV_HASH).
-         */
+    list[0] = peers->peer;
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    list[1] = peers->resolve;
+#else
+    list[1] = NULL;
+#endif
 
-        if (server->len >= 5
-            && ngx_strncasecmp(server->data, (u_char *) "unix:", 5) == 0)
-        {
-            host = server->data + 5;
-            host_len = server->len - 5;
-            port = NULL;
-            port_len = 0;
-            goto done;
-        }
+    for (k = 0; k < 2; k++) {
+        for (peer = list[k]; peer; peer = peer->next) {
+            server = &peer->server;
 
-        for (j = 0; j < server->len; j++) {
-            c = server->data[server->len - j - 1];
+            /*
+             * Hash expression is compatible with Cache::Memcached::Fast:
+             * crc32(HOST \0 PORT PREV_HASH).
+             */
 
-            if (c == ':') {
-                host = server->data;
-                host_len = server->len - j - 1;
-                port = server->data + server->len - j;
-                port_len = j;
+            if (server->len >= 5
+                && ngx_strncasecmp(server->data, (u_char *) "unix:", 5) == 0)
+            {
+                host = server->data + 5;
+                host_len = server->len - 5;
+                port = NULL;
+                port_len = 0;
                 goto done;
             }
 
-            if (c < '0' || c > '9') {
-                break;
+            for (j = 0; j < server->len; j++) {
+                c = server->data[server->len - j - 1];
+
+                if (c == ':') {
+                    host = server->data;
+                    host_len = server->len - j - 1;
+                    port = server->data + server->len - j;
+                    port_len = j;
+                    goto done;
+                }
+
+                if (c < '0' || c > '9') {
+                    break;
+                }
             }
-        }
 
-        host = server->data;
-        host_len = server->len;
-        port = NULL;
-        port_len = 0;
+            host = server->data;
+            host_len = server->len;
+            port = NULL;
+            port_len = 0;
 
-    done:
+        done:
 
-        ngx_crc32_init(base_hash);
-        ngx_crc32_update(&base_hash, host, host_len);
-        ngx_crc32_update(&base_hash, (u_char *) "", 1);
-        ngx_crc32_update(&base_hash, port, port_len);
+            ngx_crc32_init(base_hash);
+            ngx_crc32_update(&base_hash, host, host_len);
+            ngx_crc32_update(&base_hash, (u_char *) "", 1);
+            ngx_crc32_update(&base_hash, port, port_len);
 
-        prev_hash.value = 0;
-        npoints = peer->weight * 160;
+            prev_hash.value = 0;
+            npoints = peer->weight * 160;
 
-        for (j = 0; j < npoints; j++) {
-            hash = base_hash;
+            for (j = 0; j < npoints; j++) {
+                hash = base_hash;
 
-            ngx_crc32_update(&hash, prev_hash.byte, 4);
-            ngx_crc32_final(hash);
+                ngx_crc32_update(&hash, prev_hash.byte, 4);
+                ngx_crc32_final(hash);
 
-            points->point[points->number].hash = hash;
-            points->point[points->number].server = server;
-            points->number++;
+                points->point[points->number].hash = hash;
+                points->point[points->number].server = server;
+                points->number++;
 
-#if (NGX_HAVE_LITTLE_ENDIAN)
-            prev_hash.value = hash;
-#else
-            prev_hash.byte[0] = (u_char) (hash & 0xff);
-            prev_hash.byte[1] = (u_char) ((hash >> 8) & 0xff);
-            prev_hash.byte[2] = (u_char) ((hash >> 16) & 0xff);
-            prev_hash.byte[3] = (u_char) ((hash >> 24) & 0xff);
-#endif
+    #if (NGX_HAVE_LITTLE_ENDIAN)
+                prev_hash.value = hash;
+    #else
+                prev_hash.byte[0] = (u_char) (hash & 0xff);
+                prev_hash.byte[1] = (u_char) ((hash >> 8) & 0xff);
+                prev_hash.byte[2] = (u_char) ((hash >> 16) & 0xff);
+                prev_hash.byte[3] = (u_char) ((hash >> 24) & 0xff);
+    #endif
+            }
         }
     }
 
@@ -500,7 +545,7 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     intptr_t                              m;
     ngx_str_t                            *server;
     ngx_int_t                             total;
-    ngx_uint_t                            i, n, best_i;
+    ngx_uint_t                            i, n, best_i, load;
     ngx_stream_upstream_rr_peer_t        *peer, *best;
     ngx_stream_upstream_chash_point_t    *point;
     ngx_stream_upstream_chash_points_t   *points;
@@ -511,7 +556,12 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_stream_upstream_rr_peers_wlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
+    if (hp->tries > 20
+        || hp->rrp.peers->single
+        || hp->rrp.peers->number == 0
+        || hp->key.len == 0
+        || ngx_stream_upstream_rr_peers_changed(&hp->rrp))
+    {
         ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -524,6 +574,8 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     points = hcf->points;
     point = &points->point[0];
 
+    load = ngx_stream_upstream_hash_bound(hp);
+
     for ( ;; ) {
         server = point[hp->hash % points->number].server;
 
@@ -561,6 +613,12 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
+            if (load && peer->conns * hp->rrp.peers->total_weight * 100
+                        >= load * peer->weight)
+            {
+                continue;
+            }
+
             if (peer->server.len != server->len
                 || ngx_strncmp(peer->server.data, server->data, server->len)
                    != 0)
@@ -618,6 +676,329 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 }
 
 
+static ngx_int_t
+ngx_stream_upstream_init_maglev(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us)
+{
+    uint32_t                             *lookup;
+    ngx_uint_t                            size, filled, i, n, w;
+    ngx_stream_upstream_rr_peer_t        *peer;
+    ngx_stream_upstream_rr_peers_t       *peers;
+    ngx_stream_upstream_maglev_t         *maglev;
+    ngx_stream_upstream_hash_srv_conf_t  *hcf;
+    struct {
+        ngx_uint_t                        pos;
+        ngx_uint_t                        skip;
+        ngx_uint_t                        weight;
+    }                                    *perm;
+
+    if (ngx_stream_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_stream_upstream_init_maglev_peer;
+
+    peers = us->peer.data;
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (peers->resolve) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "maglev hashing does not support resolving names "
+                      "at run time in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
+#endif
+
+    /*
+     * Maglev hashing: the lookup table maps hash values to peers and is
+     * filled by peers in turn, each taking the next free slot of its own
+     * permutation of the table, "weight" slots per turn.  A table size
+     * well above the number of peers keeps the shares even, and a prime
+     * size makes every permutation cover the whole table.  The size only
+     * depends on the number of peers for very large upstreams, as keys
+     * are remapped when it changes.
+     */
+
+    size = ngx_max(peers->total_weight * 100, 65537);
+
+    for ( ;; ) {
+        for (i = 2; i * i <= size; i++) {
+            if (size % i == 0) {
+                break;
+            }
+        }
+
+        if (i * i > size) {
+            break;
+        }
+
+        size++;
+    }
+
+    maglev = ngx_palloc(cf->pool, sizeof(ngx_stream_upstream_maglev_t));
+    if (maglev == NULL) {
+        return NGX_ERROR;
+    }
+
+    lookup = ngx_palloc(cf->pool, size * sizeof(uint32_t));
+    if (lookup == NULL) {
+        return NGX_ERROR;
+    }
+
+    perm = ngx_palloc(cf->temp_pool, peers->number * sizeof(*perm));
+    if (perm == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        perm[i].pos = ngx_crc32_long(peer->name.data, peer->name.len) % size;
+        perm[i].skip = ngx_murmur_hash2(peer->name.data, peer->name.len)
+                       % (size - 1) + 1;
+        perm[i].weight = peer->weight;
+    }
+
+    ngx_memset(lookup, 0xff, size * sizeof(uint32_t));
+
+    filled = 0;
+
+    for ( ;; ) {
+        for (i = 0; i < peers->number; i++) {
+            for (w = 0; w < perm[i].weight; w++) {
+
+                n = perm[i].pos;
+
+                while (lookup[n] != (uint32_t) -1) {
+                    n = (n + perm[i].skip) % size;
+                }
+
+                lookup[n] = (uint32_t) i;
+                perm[i].pos = (n + perm[i].skip) % size;
+
+                if (++filled == size) {
+                    goto done;
+                }
+            }
+        }
+    }
+
+done:
+
+    maglev->number = size;
+    maglev->lookup = lookup;
+    maglev->peer = NULL;
+
+    hcf = ngx_stream_conf_upstream_srv_conf(us,
+                                            ngx_stream_upstream_hash_module);
+    hcf->maglev = maglev;
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (us->shm_zone) {
+        return NGX_OK;
+    }
+#endif
+
+    return ngx_stream_upstream_update_maglev(cf->pool, us);
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_update_maglev(ngx_pool_t *pool,
+    ngx_stream_upstream_srv_conf_t *us)
+{
+    size_t                                size;
+    ngx_uint_t                            i;
+    ngx_stream_upstream_rr_peer_t        *peer, **peerp;
+    ngx_stream_upstream_rr_peers_t       *peers;
+    ngx_stream_upstream_hash_srv_conf_t  *hcf;
+
+    hcf = ngx_stream_conf_upstream_srv_conf(us,
+                                            ngx_stream_upstream_hash_module);
+
+    peers = us->peer.data;
+
+    size = peers->number * sizeof(ngx_stream_upstream_rr_peer_t *);
+
+    peerp = pool ? ngx_palloc(pool, size) : ngx_alloc(size, ngx_cycle->log);
+    if (peerp == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        peerp[i] = peer;
+    }
+
+    hcf->maglev->peer = peerp;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_init_maglev_peer(ngx_stream_session_t *s,
+    ngx_stream_upstream_srv_conf_t *us)
+{
+    ngx_stream_upstream_hash_srv_conf_t   *hcf;
+    ngx_stream_upstream_hash_peer_data_t  *hp;
+
+    if (ngx_stream_upstream_init_hash_peer(s, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    s->upstream->peer.get = ngx_stream_upstream_get_maglev_peer;
+
+    hp = s->upstream->peer.data;
+    hcf = ngx_stream_conf_upstream_srv_conf(us,
+                                            ngx_stream_upstream_hash_module);
+
+    hp->hash = ngx_crc32_long(hp->key.data, hp->key.len);
+
+    ngx_stream_upstream_rr_peers_rlock(hp->rrp.peers);
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (hp->rrp.peers->shpool && hcf->maglev->peer == NULL) {
+        if (ngx_stream_upstream_update_maglev(NULL, us) != NGX_OK) {
+            ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
+            return NGX_ERROR;
+        }
+    }
+#endif
+
+    ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_get_maglev_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_stream_upstream_hash_peer_data_t  *hp = data;
+
+    time_t                          now;
+    uintptr_t                       m;
+    ngx_uint_t                      i, n, load;
+    ngx_stream_upstream_rr_peer_t  *peer;
+    ngx_stream_upstream_maglev_t   *maglev;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                   "get maglev hash peer, try: %ui", pc->tries);
+
+    ngx_stream_upstream_rr_peers_wlock(hp->rrp.peers);
+
+    if (hp->tries > 20
+        || hp->rrp.peers->single
+        || hp->rrp.peers->number == 0
+        || hp->key.len == 0
+        || ngx_stream_upstream_rr_peers_changed(&hp->rrp))
+    {
+        ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+    maglev = hp->conf->maglev;
+
+    load = ngx_stream_upstream_hash_bound(hp);
+
+    /* unusable peers are skipped by walking the lookup table */
+
+    for ( ;; ) {
+        i = maglev->lookup[hp->hash % maglev->number];
+        peer = maglev->peer[i];
+
+        ngx_log_debug2(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                       "maglev hash peer:%uD, peer:%ui", hp->hash, i);
+
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (hp->rrp.tried[n] & m) {
+            goto next;
+        }
+
+        if (peer->down) {
+            goto next;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            goto next;
+        }
+
+        if (peer->max_conns && peer->conns >= peer->max_conns) {
+            goto next;
+        }
+
+        if (load && peer->conns * hp->rrp.peers->total_weight * 100
+                    >= load * peer->weight)
+        {
+            goto next;
+        }
+
+        break;
+
+    next:
+
+        hp->hash++;
+
+        if (++hp->tries > 20) {
+            ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
+            return hp->get_rr_peer(pc, &hp->rrp);
+        }
+    }
+
+    hp->rrp.current = peer;
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    peer->conns++;
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
+
+    hp->rrp.tried[n] |= m;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_stream_upstream_hash_bound(ngx_stream_upstream_hash_peer_data_t *hp)
+{
+    ngx_uint_t                      conns;
+    ngx_stream_upstream_rr_peer_t  *peer;
+
+    /*
+     * With "bound", a peer takes at most "bound" times its weighted share
+     * of the active connections, the one being established included;
+     * the value returned is compared against conns * total_weight * 100.
+     */
+
+    if (hp->conf->bound == 0) {
+        return 0;
+    }
+
+    conns = 1;
+
+    for (peer = hp->rrp.peers->peer; peer; peer = peer->next) {
+        conns += peer->conns;
+    }
+
+    return conns * hp->conf->bound;
+}
+
+
 static void *
 ngx_stream_upstream_hash_create_conf(ngx_conf_t *cf)
 {
@@ -629,6 +1010,8 @@ ngx_stream_upstream_hash_create_conf(ngx_conf_t *cf)
     }
 
     conf->points = NULL;
+    conf->maglev = NULL;
+    conf->bound = 0;
 
     return conf;
 }
@@ -639,6 +1022,7 @@ ngx_stream_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_stream_upstream_hash_srv_conf_t  *hcf = conf;
 
+    ngx_int_t                            n;
     ngx_str_t                           *value;
     ngx_stream_upstream_srv_conf_t      *uscf;
     ngx_stream_compile_complex_value_t   ccv;
@@ -675,11 +1059,33 @@ ngx_stream_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     } else if (ngx_strcmp(value[2].data, "consistent") == 0) {
         uscf->peer.init_upstream = ngx_stream_upstream_init_chash;
 
+    } else if (ngx_strcmp(value[2].data, "maglev") == 0) {
+        uscf->peer.init_upstream = ngx_stream_upstream_init_maglev;
+
     } else {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[2]);
         return NGX_CONF_ERROR;
     }
 
+    if (cf->args->nelts == 4) {
+
+        if (ngx_strncmp(value[3].data, "bound=", 6) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[3]);
+            return NGX_CONF_ERROR;
+        }
+
+        n = ngx_atofp(value[3].data + 6, value[3].len - 6, 2);
+
+        if (n == NGX_ERROR || n <= 100) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid bound \"%V\"", &value[3]);
+            return NGX_CONF_ERROR;
+        }
+
+        hcf->bound = n;
+    }
+
     return NGX_CONF_OK;
 }
@@ -18,6 +18,9 @@ typedef struct {
 typedef struct {
     ngx_uint_t                              two;
     ngx_stream_upstream_random_range_t     *ranges;
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    ngx_uint_t                            config;
+#endif
 } ngx_stream_upstream_random_srv_conf_t;
 
 
@@ -142,6 +145,14 @@ ngx_stream_upstream_update_random(ngx_pool_t *pool,
         total_weight += peer->weight;
     }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (pool == NULL && rcf->ranges) {
+        ngx_free(rcf->ranges);
+    }
+
+    rcf->config = peers->config ? *peers->config : 0;
+#endif
+
     rcf->ranges = ranges;
 
     return NGX_OK;
@@ -186,7 +197,11 @@ ngx_stream_upstream_init_random_peer(ngx_stream_session_t *s,
     ngx_stream_upstream_rr_peers_rlock(rp->rrp.peers);
 
 #if (NGX_STREAM_UPSTREAM_ZONE)
-    if (rp->rrp.peers->shpool && rcf->ranges == NULL) {
+    if (rp->rrp.peers->shpool
+        && (rcf->ranges == NULL
+            || (rp->rrp.peers->config
+                && rcf->config != *rp->rrp.peers->config)))
+    {
         if (ngx_stream_upstream_update_random(NULL, us) != NGX_OK) {
             ngx_stream_upstream_rr_peers_unlock(rp->rrp.peers);
             return NGX_ERROR;
@@ -220,7 +235,11 @@ ngx_stream_upstream_get_random_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_stream_upstream_rr_peers_rlock(peers);
 
-    if (rp->tries > 20 || peers->single) {
+    if (rp->tries > 20
+        || peers->single
+        || peers->number == 0
+        || ngx_stream_upstream_rr_peers_changed(rrp))
+    {
         ngx_stream_upstream_rr_peers_unlock(peers);
         return ngx_stream_upstream_get_round_robin_peer(pc, rrp);
     }
@@ -314,7 +333,11 @@ ngx_stream_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_stream_upstream_rr_peers_wlock(peers);
 
-    if (rp->tries > 20 || peers->single) {
+    if (rp->tries > 20
+        || peers->single
+        || peers->number == 0
+        || ngx_stream_upstream_rr_peers_changed(rrp))
+    {
         ngx_stream_upstream_rr_peers_unlock(peers);
         return ngx_stream_upstream_get_round_robin_peer(pc, rrp);
     }
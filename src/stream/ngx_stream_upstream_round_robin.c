@@ -19,6 +19,14 @@ static ngx_stream_upstream_rr_peer_t *ngx_stream_upstream_get_peer(
 static void ngx_stream_upstream_notify_round_robin_peer(
     ngx_peer_connection_t *pc, void *data, ngx_uint_t state);
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+static ngx_int_t ngx_stream_upstream_init_resolve_peer(ngx_conf_t *cf,
+    ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_server_t *server);
+
+#endif
+
 #if (NGX_STREAM_SSL)
 
 static ngx_int_t ngx_stream_upstream_set_round_robin_peer_session(
@@ -38,7 +46,7 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_stream_upstream_srv_conf_t *us)
 {
     ngx_url_t                        u;
-    ngx_uint_t                       i, j, n, w;
+    ngx_uint_t                       i, j, n, r, w;
     ngx_stream_upstream_server_t    *server;
     ngx_stream_upstream_rr_peer_t   *peer, **peerp;
     ngx_stream_upstream_rr_peers_t  *peers, *backup;
@@ -49,6 +57,7 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
         server = us->servers->elts;
 
         n = 0;
+        r = 0;
         w = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
@@ -56,17 +65,35 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
                 continue;
             }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                r++;
+                continue;
+            }
+#endif
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
         }
 
-        if (n == 0) {
+        if (n == 0 && r == 0) {
             ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
                           "no servers in upstream \"%V\" in %s:%ui",
                           &us->host, us->file_name, us->line);
             return NGX_ERROR;
         }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+        if (r && us->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "resolving names at run time requires "
+                          "upstream \"%V\" in %s:%ui "
+                          "to be in shared memory",
+                          &us->host, us->file_name, us->line);
+            return NGX_ERROR;
+        }
+#endif
+
         peers = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_rr_peers_t));
         if (peers == NULL) {
             return NGX_ERROR;
@@ -77,7 +104,7 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
             return NGX_ERROR;
         }
 
-        peers->single = (n == 1);
+        peers->single = (n == 1 && r == 0);
         peers->number = n;
         peers->weighted = (w != n);
         peers->total_weight = w;
@@ -91,6 +118,18 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
                 continue;
             }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                if (ngx_stream_upstream_init_resolve_peer(cf, peers, &server[i])
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                continue;
+            }
+#endif
+
             for (j = 0; j < server[i].naddrs; j++) {
                 peer[n].sockaddr = server[i].addrs[j].sockaddr;
                 peer[n].socklen = server[i].addrs[j].socklen;
@@ -115,6 +154,7 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
         /* backup servers */
 
         n = 0;
+        r = 0;
         w = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
@@ -122,14 +162,32 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
                 continue;
             }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                r++;
+                continue;
+            }
+#endif
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
         }
 
-        if (n == 0) {
+        if (n == 0 && r == 0) {
             return NGX_OK;
         }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+        if (r && us->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "resolving names at run time requires "
+                          "upstream \"%V\" in %s:%ui "
+                          "to be in shared memory",
+                          &us->host, us->file_name, us->line);
+            return NGX_ERROR;
+        }
+#endif
+
         backup = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_rr_peers_t));
         if (backup == NULL) {
             return NGX_ERROR;
@@ -155,6 +213,19 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
                 continue;
             }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                if (ngx_stream_upstream_init_resolve_peer(cf, backup,
+                                                          &server[i])
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                continue;
+            }
+#endif
+
             for (j = 0; j < server[i].naddrs; j++) {
                 peer[n].sockaddr = server[i].addrs[j].sockaddr;
                 peer[n].socklen = server[i].addrs[j].socklen;
@@ -246,6 +317,52 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
 }
 
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+static ngx_int_t
+ngx_stream_upstream_init_resolve_peer(ngx_conf_t *cf,
+    ngx_stream_upstream_rr_peers_t *peers, ngx_stream_upstream_server_t *server)
+{
+    ngx_stream_upstream_host_t     *host;
+    ngx_stream_upstream_rr_peer_t  *peer;
+
+    /*
+     * the peer keeps parameters of the server, peers with addresses
+     * of the name are created from it in the upstream zone
+     */
+
+    peer = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_rr_peer_t));
+    if (peer == NULL) {
+        return NGX_ERROR;
+    }
+
+    host = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_host_t));
+    if (host == NULL) {
+        return NGX_ERROR;
+    }
+
+    host->name = server->host;
+    host->service = server->service;
+    host->port = server->port;
+
+    peer->weight = server->weight;
+    peer->effective_weight = server->weight;
+    peer->max_conns = server->max_conns;
+    peer->max_fails = server->max_fails;
+    peer->fail_timeout = server->fail_timeout;
+    peer->down = server->down;
+    peer->server = server->name;
+    peer->host = host;
+
+    peer->next = peers->resolve;
+    peers->resolve = peer;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
     ngx_stream_upstream_srv_conf_t *us)
@@ -267,7 +384,14 @@ ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
 
     rrp->peers = us->peer.data;
     rrp->current = NULL;
+
+    ngx_stream_upstream_rr_peers_rlock(rrp->peers);
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    rrp->config = rrp->peers->config ? *rrp->peers->config : 0;
+#else
     rrp->config = 0;
+#endif
 
     n = rrp->peers->number;
 
@@ -275,6 +399,10 @@ ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
         n = rrp->peers->next->number;
     }
 
+    s->upstream->peer.tries = ngx_stream_upstream_tries(rrp->peers);
+
+    ngx_stream_upstream_rr_peers_unlock(rrp->peers);
+
     if (n <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
         rrp->data = 0;
@@ -291,7 +419,6 @@ ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
     s->upstream->peer.get = ngx_stream_upstream_get_round_robin_peer;
     s->upstream->peer.free = ngx_stream_upstream_free_round_robin_peer;
     s->upstream->peer.notify = ngx_stream_upstream_notify_round_robin_peer;
-    s->upstream->peer.tries = ngx_stream_upstream_tries(rrp->peers);
 #if (NGX_STREAM_SSL)
     s->upstream->peer.set_session =
                              ngx_stream_upstream_set_round_robin_peer_session;
@@ -441,6 +568,15 @@ ngx_stream_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     peers = rrp->peers;
     ngx_stream_upstream_rr_peers_wlock(peers);
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (ngx_stream_upstream_rr_peers_changed(rrp)) {
+
+        /* the "tried" bitmap does not match the peers anymore */
+
+        goto busy;
+    }
+#endif
+
     if (peers->single) {
         peer = peers->peer;
 
@@ -505,6 +641,10 @@ failed:
         ngx_stream_upstream_rr_peers_wlock(peers);
     }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+busy:
+#endif
+
     ngx_stream_upstream_rr_peers_unlock(peers);
 
     pc->name = peers->name;
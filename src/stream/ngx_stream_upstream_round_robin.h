@@ -15,6 +15,26 @@
 
 
 typedef struct ngx_stream_upstream_rr_peer_s   ngx_stream_upstream_rr_peer_t;
+typedef struct ngx_stream_upstream_rr_peers_s  ngx_stream_upstream_rr_peers_t;
+
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+typedef struct {
+    ngx_event_t                      event;      /* must be first */
+    ngx_str_t                        name;
+    ngx_str_t                        service;
+    in_port_t                        port;
+    ngx_msec_t                       timeout;
+    ngx_resolver_t                  *resolver;
+    ngx_stream_upstream_rr_peers_t  *peers;      /* primary peers */
+    ngx_stream_upstream_rr_peer_t   *peer;       /* parameters of the server */
+    ngx_stream_upstream_rr_peer_t   *zombies;
+    unsigned                         backup:1;
+} ngx_stream_upstream_host_t;
+
+#endif
+
 
 struct ngx_stream_upstream_rr_peer_s {
     struct sockaddr                 *sockaddr;
@@ -45,6 +65,7 @@ struct ngx_stream_upstream_rr_peer_s {
 
 #if (NGX_STREAM_UPSTREAM_ZONE)
     ngx_atomic_t                     lock;
+    ngx_stream_upstream_host_t      *host;
 #endif
 
     ngx_stream_upstream_rr_peer_t   *next;
@@ -54,8 +75,6 @@ struct ngx_stream_upstream_rr_peer_s {
 };
 
 
-typedef struct ngx_stream_upstream_rr_peers_s  ngx_stream_upstream_rr_peers_t;
-
 struct ngx_stream_upstream_rr_peers_s {
     ngx_uint_t                       number;
 
@@ -63,6 +82,12 @@ struct ngx_stream_upstream_rr_peers_s {
     ngx_slab_pool_t                 *shpool;
     ngx_atomic_t                     rwlock;
     ngx_stream_upstream_rr_peers_t  *zone_next;
+
+    /* changed each time peers are added or removed */
+    ngx_uint_t                      *config;
+
+    /* servers resolved at run time */
+    ngx_stream_upstream_rr_peer_t   *resolve;
 #endif
 
     ngx_uint_t                       total_weight;
@@ -111,8 +136,14 @@ struct ngx_stream_upstream_rr_peers_s {
         ngx_rwlock_unlock(&peer->lock);                                       \
     }
 
+
+#define ngx_stream_upstream_rr_peers_changed(rrp)                             \
+    ((rrp)->peers->config && (rrp)->config != *(rrp)->peers->config)
+
 #else
 
+#define ngx_stream_upstream_rr_peers_changed(rrp)  0
+
 #define ngx_stream_upstream_rr_peers_rlock(peers)
 #define ngx_stream_upstream_rr_peers_wlock(peers)
 #define ngx_stream_upstream_rr_peers_unlock(peers)
@@ -18,6 +18,20 @@ static ngx_stream_upstream_rr_peers_t *ngx_stream_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_stream_upstream_srv_conf_t *uscf);
 static ngx_stream_upstream_rr_peer_t *ngx_stream_upstream_zone_copy_peer(
     ngx_stream_upstream_rr_peers_t *peers, ngx_stream_upstream_rr_peer_t *src);
+static ngx_int_t ngx_stream_upstream_zone_copy_hosts(
+    ngx_stream_upstream_srv_conf_t *uscf,
+    ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peers_t *primary);
+static void ngx_stream_upstream_zone_free_peer(ngx_slab_pool_t *pool,
+    ngx_stream_upstream_rr_peer_t *peer);
+static char *ngx_stream_upstream_zone_resolver(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_stream_upstream_zone_resolver_timeout(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_stream_upstream_zone_init(ngx_conf_t *cf);
+static ngx_int_t ngx_stream_upstream_zone_init_worker(ngx_cycle_t *cycle);
+static void ngx_stream_upstream_zone_resolve_timer(ngx_event_t *event);
+static void ngx_stream_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
 
 
 static ngx_command_t  ngx_stream_upstream_zone_commands[] = {
@@ -29,13 +43,27 @@ static ngx_command_t  ngx_stream_upstream_zone_commands[] = {
       0,
       NULL },
 
+    { ngx_string("resolver"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_1MORE,
+      ngx_stream_upstream_zone_resolver,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("resolver_timeout"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_stream_upstream_zone_resolver_timeout,
+      0,
+      offsetof(ngx_stream_upstream_srv_conf_t, resolver_timeout),
+      NULL },
+
       ngx_null_command
 };
 
 
 static ngx_stream_module_t  ngx_stream_upstream_zone_module_ctx = {
     NULL,                                  /* preconfiguration */
-    NULL,                                  /* postconfiguration */
+    ngx_stream_upstream_zone_init,         /* postconfiguration */
 
     NULL,                                  /* create main configuration */
     NULL,                                  /* init main configuration */
@@ -52,7 +80,7 @@ ngx_module_t  ngx_stream_upstream_zone_module = {
     NGX_STREAM_MODULE,                     /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_stream_upstream_zone_init_worker,  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -222,6 +250,20 @@ ngx_stream_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
         *peerp = peer;
     }
 
+    if (peers->resolve || (peers->next && peers->next->resolve)) {
+
+        /* shared by primary and backup peers */
+
+        peers->config = ngx_slab_calloc(shpool, sizeof(ngx_uint_t));
+        if (peers->config == NULL) {
+            return NULL;
+        }
+
+        if (ngx_stream_upstream_zone_copy_hosts(uscf, peers, peers) != NGX_OK) {
+            return NULL;
+        }
+    }
+
     if (peers->next == NULL) {
         goto done;
     }
@@ -247,6 +289,12 @@ ngx_stream_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
         *peerp = peer;
     }
 
+    backup->config = peers->config;
+
+    if (ngx_stream_upstream_zone_copy_hosts(uscf, backup, peers) != NGX_OK) {
+        return NULL;
+    }
+
     peers->next = backup;
 
 done:
@@ -289,8 +337,10 @@ ngx_stream_upstream_zone_copy_peer(ngx_stream_upstream_rr_peers_t *peers,
     }
 
     if (src) {
-        ngx_memcpy(dst->sockaddr, src->sockaddr, src->socklen);
-        ngx_memcpy(dst->name.data, src->name.data, src->name.len);
+        if (src->sockaddr) {
+            ngx_memcpy(dst->sockaddr, src->sockaddr, src->socklen);
+            ngx_memcpy(dst->name.data, src->name.data, src->name.len);
+        }
 
         dst->server.data = ngx_slab_alloc_locked(pool, src->server.len);
         if (dst->server.data == NULL) {
@@ -320,3 +370,468 @@ failed:
 
     return NULL;
 }
+
+
+static ngx_int_t
+ngx_stream_upstream_zone_copy_hosts(ngx_stream_upstream_srv_conf_t *uscf,
+    ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peers_t *primary)
+{
+    ngx_stream_upstream_host_t     *host;
+    ngx_stream_upstream_rr_peer_t  *peer, **peerp;
+
+    for (peerp = &peers->resolve; *peerp; peerp = &peer->next) {
+
+        host = ngx_slab_calloc(peers->shpool,
+                               sizeof(ngx_stream_upstream_host_t));
+        if (host == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* pool is unlocked */
+        peer = ngx_stream_upstream_zone_copy_peer(peers, *peerp);
+        if (peer == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* the names are only used by workers of this cycle */
+
+        host->name = (*peerp)->host->name;
+        host->service = (*peerp)->host->service;
+        host->port = (*peerp)->host->port;
+        host->timeout = uscf->resolver_timeout;
+        host->resolver = uscf->resolver;
+        host->peers = primary;
+        host->peer = peer;
+        host->backup = (peers != primary);
+
+        peer->host = host;
+
+        *peerp = peer;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_upstream_zone_free_peer(ngx_slab_pool_t *pool,
+    ngx_stream_upstream_rr_peer_t *peer)
+{
+    if (peer->server.data) {
+        ngx_slab_free_locked(pool, peer->server.data);
+    }
+
+    if (peer->name.data) {
+        ngx_slab_free_locked(pool, peer->name.data);
+    }
+
+    if (peer->sockaddr) {
+        ngx_slab_free_locked(pool, peer->sockaddr);
+    }
+
+    if (peer->ssl_session) {
+        ngx_slab_free_locked(pool, peer->ssl_session);
+    }
+
+    ngx_slab_free_locked(pool, peer);
+}
+
+
+static char *
+ngx_stream_upstream_zone_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_str_t                       *value;
+    ngx_stream_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_stream_conf_get_module_srv_conf(cf, ngx_stream_upstream_module);
+
+    if (uscf->resolver) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    uscf->resolver = ngx_resolver_create(cf, &value[1], cf->args->nelts - 1);
+    if (uscf->resolver == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_stream_upstream_zone_resolver_timeout(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_stream_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_stream_conf_get_module_srv_conf(cf, ngx_stream_upstream_module);
+
+    return ngx_conf_set_msec_slot(cf, cmd, uscf);
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_zone_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                        i;
+    ngx_stream_core_srv_conf_t       *cscf;
+    ngx_stream_upstream_rr_peers_t   *peers;
+    ngx_stream_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_stream_upstream_main_conf_t  *umcf;
+
+    /* upstreams without a resolver use the one of the stream block */
+
+    umcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_upstream_module);
+    cscf = ngx_stream_conf_get_module_srv_conf(cf, ngx_stream_core_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        peers = uscf->peer.data;
+
+        if (uscf->shm_zone == NULL
+            || peers == NULL
+            || (peers->resolve == NULL
+                && (peers->next == NULL || peers->next->resolve == NULL)))
+        {
+            continue;
+        }
+
+        if (uscf->resolver == NULL) {
+            uscf->resolver = cscf->resolver;
+        }
+
+        ngx_conf_merge_msec_value(uscf->resolver_timeout,
+                                  cscf->resolver_timeout, 30000);
+
+        if (uscf->resolver == NULL || uscf->resolver->connections.nelts == 0) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "no resolver defined to resolve names "
+                          "of upstream \"%V\" in %s:%ui",
+                          &uscf->host, uscf->file_name, uscf->line);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_zone_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                        i, n;
+    ngx_core_conf_t                  *ccf;
+    ngx_stream_upstream_host_t       *host;
+    ngx_stream_upstream_rr_peer_t    *peer;
+    ngx_stream_upstream_rr_peers_t   *peers;
+    ngx_stream_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_stream_upstream_main_conf_t  *umcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_stream_cycle_get_module_main_conf(cycle,
+                                                 ngx_stream_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    uscfp = umcf->upstreams.elts;
+    n = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone == NULL) {
+            continue;
+        }
+
+        for (peers = uscf->peer.data; peers; peers = peers->next) {
+
+            for (peer = peers->resolve; peer; peer = peer->next) {
+
+                /* each name is resolved by one of the workers */
+
+                if (ngx_process == NGX_PROCESS_WORKER
+                    && n++ % ccf->worker_processes != ngx_worker)
+                {
+                    continue;
+                }
+
+                host = peer->host;
+
+                /* the event may be left by a previous worker in this slot */
+
+                ngx_memzero(&host->event, sizeof(ngx_event_t));
+
+                host->event.handler = ngx_stream_upstream_zone_resolve_timer;
+                host->event.data = host;
+                host->event.log = cycle->log;
+                host->event.cancelable = 1;
+
+                ngx_add_timer(&host->event, 1);
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_upstream_zone_resolve_timer(ngx_event_t *event)
+{
+    ngx_resolver_ctx_t          *ctx;
+    ngx_stream_upstream_host_t  *host;
+
+    host = event->data;
+
+    ctx = ngx_resolve_start(host->resolver, NULL);
+    if (ctx == NULL) {
+        goto retry;
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "no resolver defined to resolve %V", &host->name);
+        return;
+    }
+
+    ctx->name = host->name;
+    ctx->service = host->service;
+    ctx->handler = ngx_stream_upstream_zone_resolve_handler;
+    ctx->data = host;
+    ctx->timeout = host->timeout;
+    ctx->cancelable = 1;
+
+    if (ngx_resolve_name(ctx) == NGX_OK) {
+        return;
+    }
+
+retry:
+
+    ngx_add_timer(event, ngx_max(host->timeout, 1000));
+}
+
+
+static void
+ngx_stream_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    time_t                           now;
+    ngx_uint_t                       i, n, w, added, removed, priority;
+    ngx_msec_t                       timer;
+    ngx_event_t                     *event;
+    ngx_slab_pool_t                 *shpool;
+    ngx_resolver_addr_t             *addr;
+    ngx_stream_upstream_host_t      *host;
+    ngx_stream_upstream_rr_peer_t   *peer, *template, **peerp, **last;
+    ngx_stream_upstream_rr_peers_t  *peers;
+
+    host = ctx->data;
+    event = &host->event;
+    template = host->peer;
+
+    peers = host->backup ? host->peers->next : host->peers;
+    shpool = peers->shpool;
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "upstream \"%V\": %V could not be resolved (%i: %s)",
+                      peers->name, &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state));
+
+        if (ctx->state != NGX_RESOLVE_NXDOMAIN) {
+
+            /* servers are kept until the name is known to be gone */
+
+            ngx_resolve_name_done(ctx);
+            ngx_add_timer(event, ngx_max(host->timeout, 1000));
+            return;
+        }
+
+        ctx->naddrs = 0;
+    }
+
+    /* only the most preferred targets of a service are used */
+
+    priority = (ngx_uint_t) -1;
+
+    for (i = 0; i < ctx->naddrs; i++) {
+        addr = &ctx->addrs[i];
+
+        if (host->service.len == 0) {
+            ngx_inet_set_port(addr->sockaddr, host->port);
+
+        } else if (addr->priority < priority) {
+            priority = addr->priority;
+        }
+    }
+
+    added = 0;
+    removed = 0;
+
+    /* backup peers are changed under the lock of primary peers as well */
+
+    ngx_stream_upstream_rr_peers_wlock(host->peers);
+
+    if (host->backup) {
+        ngx_stream_upstream_rr_peers_wlock(peers);
+    }
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    /* removed peers wait for their connections to be closed */
+
+    for (peerp = &peers->peer; *peerp; /* void */) {
+        peer = *peerp;
+
+        if (peer->host != host) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        for (i = 0; i < ctx->naddrs; i++) {
+            addr = &ctx->addrs[i];
+
+            if (host->service.len && addr->priority != priority) {
+                continue;
+            }
+
+            if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                 addr->sockaddr, addr->socklen, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i < ctx->naddrs) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_STREAM, event->log, 0,
+                       "upstream \"%V\": removed %V", peers->name, &peer->name);
+
+        *peerp = peer->next;
+
+        peer->next = host->zombies;
+        host->zombies = peer;
+
+        removed++;
+    }
+
+    last = peerp;
+
+    for (i = 0; i < ctx->naddrs; i++) {
+        addr = &ctx->addrs[i];
+
+        if (host->service.len && addr->priority != priority) {
+            continue;
+        }
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+            if (peer->host == host
+                && ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                    addr->sockaddr, addr->socklen, 1)
+                   == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (peer) {
+            continue;
+        }
+
+        peer = ngx_stream_upstream_zone_copy_peer(peers, template);
+        if (peer == NULL) {
+            break;
+        }
+
+        ngx_memcpy(peer->sockaddr, addr->sockaddr, addr->socklen);
+        peer->socklen = addr->socklen;
+
+        peer->name.len = ngx_sock_ntop(peer->sockaddr, peer->socklen,
+                                       peer->name.data, NGX_SOCKADDR_STRLEN, 1);
+
+        if (host->service.len) {
+            peer->weight = ngx_max(addr->weight, 1);
+            peer->effective_weight = peer->weight;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_STREAM, event->log, 0,
+                       "upstream \"%V\": added %V", peers->name, &peer->name);
+
+        peer->next = NULL;
+
+        *last = peer;
+        last = &peer->next;
+
+        added++;
+    }
+
+    for (peerp = &host->zombies; *peerp; /* void */) {
+        peer = *peerp;
+
+        if (peer->conns) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        *peerp = peer->next;
+
+        ngx_stream_upstream_zone_free_peer(shpool, peer);
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    if (added || removed) {
+        n = 0;
+        w = 0;
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+            n++;
+            w += peer->weight;
+        }
+
+        peers->number = n;
+        peers->total_weight = w;
+        peers->weighted = (w != n);
+
+        (*peers->config)++;
+    }
+
+    if (host->backup) {
+        ngx_stream_upstream_rr_peers_unlock(peers);
+    }
+
+    ngx_stream_upstream_rr_peers_unlock(host->peers);
+
+    if (added || removed) {
+        ngx_log_error(NGX_LOG_NOTICE, event->log, 0,
+                      "upstream \"%V\": %V resolved, "
+                      "%ui servers added, %ui removed",
+                      peers->name, &ctx->name, added, removed);
+    }
+
+    now = ngx_time();
+
+    timer = (ngx_msec_t) 1000 * (ctx->valid > now ? ctx->valid - now + 1 : 1);
+
+    ngx_resolve_name_done(ctx);
+
+    ngx_add_timer(event, timer);
+}